@@ -0,0 +1,694 @@
+
+/*******************************************************************************************
+ *
+ * times the hot paths of the overlapper, the pass over .las files and the consensus
+ * on a database and one of its .las files. results are written as json to stdout.
+ *
+ * the k-mer sorting and matching is run on a block of the database against itself,
+ * the alignment and consensus kernels on a sample of the overlaps in the .las file.
+ *
+ *******************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "lib/oflags.h"
+#include "lib/pass.h"
+#include "lib/utils.h"
+
+#include "db/DB.h"
+#include "dalign/align.h"
+#include "dalign/filter.h"
+#include "corrector/consensus.h"
+
+// defaults
+
+#define DEF_ARG_B       1
+#define DEF_ARG_E       0.70
+#define DEF_ARG_J       4
+#define DEF_ARG_K       14
+#define DEF_ARG_N       1000
+#define DEF_ARG_P       100
+#define DEF_ARG_R       3
+
+#define DEF_BIN_SHIFT   6
+#define DEF_HIT_MIN     35
+
+// consensus windows in trace points and the number of B segments used for each
+
+#define CONS_WINDOW_SEGMENTS    5
+#define CONS_MAX_COVERAGE       20
+
+// filter.c globals, daligner's defaults
+
+int VERBOSE = 0;
+int BIASED = 0;
+int MINIMIZER = 0;
+int MINOVER = 2000;
+int HGAP_MIN = 0;
+int SYMMETRIC = 1;
+int IDENTITY = 0;
+int NTHREADS = DEF_ARG_J;
+int NSHIFT = 2;
+
+uint64 MEM_LIMIT = 0;
+uint64 MEM_PHYSICAL = 0;
+
+typedef struct
+{
+    const char* name;
+    const char* unit;           // of items
+
+    uint64 items;               // processed in each repetition
+    double* seconds;            // of each repetition
+    int nrep;
+} BenchResult;
+
+typedef struct
+{
+    HITS_DB db;
+    char* pathLas;
+
+    int twidth;
+    int repeats;
+
+    // overlaps sampled from the .las file, grouped in piles
+
+    Overlap* ovls;
+    int novl;
+    int maxovl;
+
+    int* piles;                 // index of the first overlap of each pile, piles[npiles] = novl
+    int npiles;
+    int maxpiles;
+
+    ovl_trace* trace;
+    uint64 tcur;
+    uint64 tmax;
+
+    char** aseq;                // A-read of each pile
+    char** bseq;                // B-read of each overlap, complemented if needed
+
+    // pass()
+
+    uint64 pass_novl;
+} BenchContext;
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void result_init( BenchResult* res, const char* name, const char* unit, int repeats )
+{
+    res->name = name;
+    res->unit = unit;
+    res->items = 0;
+    res->seconds = malloc( sizeof( double ) * repeats );
+    res->nrep = 0;
+}
+
+static void result_add( BenchResult* res, double seconds, uint64 items )
+{
+    res->seconds[ res->nrep++ ] = seconds;
+    res->items = items;
+}
+
+static void result_print( BenchResult* res, FILE* fileOut, int last )
+{
+    double best = 0;
+    double mean = 0;
+    int i;
+
+    for ( i = 0; i < res->nrep; i++ )
+    {
+        if ( i == 0 || res->seconds[ i ] < best )
+        {
+            best = res->seconds[ i ];
+        }
+
+        mean += res->seconds[ i ];
+    }
+
+    if ( res->nrep > 0 )
+    {
+        mean /= res->nrep;
+    }
+
+    fprintf( fileOut, "    \"%s\": {\"unit\": \"%s\", \"items\": %llu, \"best\": %.6f, \"mean\": %.6f, \"per_second\": %.1f, \"seconds\": [",
+             res->name, res->unit, res->items, best, mean, best > 0 ? res->items / best : 0.0 );
+
+    for ( i = 0; i < res->nrep; i++ )
+    {
+        fprintf( fileOut, "%s%.6f", i > 0 ? ", " : "", res->seconds[ i ] );
+    }
+
+    fprintf( fileOut, "]}%s\n", last ? "" : "," );
+
+    free( res->seconds );
+}
+
+// Sort_Kmers and Match_Filter of a block against itself in forward orientation
+
+static void bench_kmers( BenchContext* bctx, char* pathBlock, BenchResult* resSort, BenchResult* resMatch )
+{
+    HITS_DB block;
+    int r, i;
+
+    if ( Open_DB( pathBlock, &block ) < 0 )
+    {
+        fprintf( stderr, "could not open block %s\n", pathBlock );
+        exit( 1 );
+    }
+
+    Read_All_Sequences( &block, 0 );
+
+    Align_Spec* spec = New_Align_Spec( DEF_ARG_E, bctx->twidth, block.freq, NTHREADS, SYMMETRIC, 0, 0 );
+    Overlap_IO_Buffer* buffer = OVL_IO_Buffer( spec );
+
+    for ( r = 0; r < bctx->repeats; r++ )
+    {
+        int len;
+        double start = now();
+
+        void* table = Sort_Kmers( &block, &len );
+
+        double sorted = now();
+
+        Match_Filter( "A", &block, "A", &block, table, len, table, len, 0, spec );
+
+        double matched = now();
+
+        uint64 novl = 0;
+
+        for ( i = 0; i < NTHREADS; i++ )
+        {
+            novl += buffer[ i ].otop;
+        }
+
+        Reset_Overlap_Buffer( spec );
+        free( table );
+
+        result_add( resSort, sorted - start, len );
+        result_add( resMatch, matched - sorted, novl );
+    }
+
+    Free_Align_Spec( spec );
+    Close_DB( &block );
+}
+
+// pass() over the whole .las file with unpacked traces
+
+static int pass_handler_count( void* _ctx, Overlap* ovls, int novl )
+{
+    BenchContext* bctx = (BenchContext*)_ctx;
+
+    UNUSED( ovls );
+
+    bctx->pass_novl += novl;
+
+    return 1;
+}
+
+static void bench_pass( BenchContext* bctx, BenchResult* res )
+{
+    int r;
+
+    for ( r = 0; r < bctx->repeats; r++ )
+    {
+        FILE* fileOvlIn = fopen( bctx->pathLas, "r" );
+
+        if ( fileOvlIn == NULL )
+        {
+            fprintf( stderr, "could not open %s\n", bctx->pathLas );
+            exit( 1 );
+        }
+
+        double start = now();
+
+        PassContext* pctx = pass_init( fileOvlIn, NULL );
+
+        pctx->split_b      = 0;
+        pctx->load_trace   = 1;
+        pctx->unpack_trace = 1;
+        pctx->data         = bctx;
+
+        bctx->pass_novl = 0;
+
+        pass( pctx, pass_handler_count );
+
+        pass_free( pctx );
+
+        result_add( res, now() - start, bctx->pass_novl );
+
+        fclose( fileOvlIn );
+    }
+}
+
+// sample the first piles of the .las file for the alignment and consensus kernels
+
+static int pass_handler_sample( void* _ctx, Overlap* ovls, int novl )
+{
+    BenchContext* bctx = (BenchContext*)_ctx;
+    int i;
+
+    if ( bctx->novl + novl > bctx->maxovl || bctx->npiles + 1 >= bctx->maxpiles )
+    {
+        return 0;
+    }
+
+    bctx->piles[ bctx->npiles++ ] = bctx->novl;
+
+    for ( i = 0; i < novl; i++ )
+    {
+        Overlap* ovl = bctx->ovls + bctx->novl;
+
+        *ovl = ovls[ i ];
+
+        if ( bctx->tcur + ovl->path.tlen > bctx->tmax )
+        {
+            bctx->tmax = bctx->tmax * 1.2 + ovl->path.tlen + 1000;
+            bctx->trace = realloc( bctx->trace, sizeof( ovl_trace ) * bctx->tmax );
+        }
+
+        memcpy( bctx->trace + bctx->tcur, ovls[ i ].path.trace, sizeof( ovl_trace ) * ovl->path.tlen );
+
+        // trace pointers are fixed up once sampling is done
+
+        ovl->path.trace = (void*)( bctx->tcur );
+        bctx->tcur += ovl->path.tlen;
+
+        bctx->novl += 1;
+    }
+
+    return 1;
+}
+
+static void sample_overlaps( BenchContext* bctx, int maxovl, int maxpiles )
+{
+    FILE* fileOvlIn = fopen( bctx->pathLas, "r" );
+    int i;
+
+    if ( fileOvlIn == NULL )
+    {
+        fprintf( stderr, "could not open %s\n", bctx->pathLas );
+        exit( 1 );
+    }
+
+    bctx->maxovl   = maxovl;
+    bctx->ovls     = malloc( sizeof( Overlap ) * maxovl );
+    bctx->maxpiles = maxpiles + 1;
+    bctx->piles    = malloc( sizeof( int ) * bctx->maxpiles );
+
+    PassContext* pctx = pass_init( fileOvlIn, NULL );
+
+    pctx->split_b      = 0;
+    pctx->load_trace   = 1;
+    pctx->unpack_trace = 1;
+    pctx->data         = bctx;
+
+    bctx->twidth = pctx->twidth;
+
+    pass( pctx, pass_handler_sample );
+
+    pass_free( pctx );
+    fclose( fileOvlIn );
+
+    bctx->piles[ bctx->npiles ] = bctx->novl;
+
+    for ( i = 0; i < bctx->novl; i++ )
+    {
+        bctx->ovls[ i ].path.trace = bctx->trace + (uint64)( bctx->ovls[ i ].path.trace );
+    }
+
+    // the reads are unpacked up front, the kernels don't time the disk
+
+    bctx->aseq = malloc( sizeof( char* ) * bctx->npiles );
+    bctx->bseq = malloc( sizeof( char* ) * bctx->novl );
+
+    int p;
+
+    for ( p = 0; p < bctx->npiles; p++ )
+    {
+        Overlap* ovl = bctx->ovls + bctx->piles[ p ];
+
+        bctx->aseq[ p ] = New_Read_Buffer( &( bctx->db ) );
+        Load_Read( &( bctx->db ), ovl->aread, bctx->aseq[ p ], 0 );
+
+        for ( i = bctx->piles[ p ]; i < bctx->piles[ p + 1 ]; i++ )
+        {
+            ovl = bctx->ovls + i;
+
+            bctx->bseq[ i ] = New_Read_Buffer( &( bctx->db ) );
+            Load_Read( &( bctx->db ), ovl->bread, bctx->bseq[ i ], 0 );
+
+            if ( ovl->flags & OVL_COMP )
+            {
+                Complement_Seq( bctx->bseq[ i ], DB_READ_LEN( &( bctx->db ), ovl->bread ) );
+            }
+        }
+    }
+}
+
+static void sample_free( BenchContext* bctx )
+{
+    int i;
+
+    for ( i = 0; i < bctx->npiles; i++ )
+    {
+        free( bctx->aseq[ i ] - 1 );
+    }
+
+    for ( i = 0; i < bctx->novl; i++ )
+    {
+        free( bctx->bseq[ i ] - 1 );
+    }
+
+    free( bctx->aseq );
+    free( bctx->bseq );
+    free( bctx->ovls );
+    free( bctx->piles );
+    free( bctx->trace );
+}
+
+// Local_Alignment seeded at the start of the sampled overlaps and Compute_Trace_PTS
+// of their trace points
+
+static void bench_align( BenchContext* bctx, BenchResult* resLocal, BenchResult* resTrace )
+{
+    HITS_DB* db = &( bctx->db );
+    Align_Spec* spec = New_Align_Spec( DEF_ARG_E, bctx->twidth, db->freq, 1, 0, 0, 0 );
+    Work_Data* work = New_Work_Data();
+    Alignment align;
+    Path path;
+    int r, p, i;
+
+    for ( r = 0; r < bctx->repeats; r++ )
+    {
+        uint64 nfound = 0;
+        double start = now();
+
+        for ( p = 0; p < bctx->npiles; p++ )
+        {
+            for ( i = bctx->piles[ p ]; i < bctx->piles[ p + 1 ]; i++ )
+            {
+                Overlap* ovl = bctx->ovls + i;
+
+                align.path  = &path;
+                align.flags = ( ovl->flags & OVL_COMP ) ? COMP_FLAG : 0;
+                align.aseq  = bctx->aseq[ p ];
+                align.bseq  = bctx->bseq[ i ];
+                align.alen  = DB_READ_LEN( db, ovl->aread );
+                align.blen  = DB_READ_LEN( db, ovl->bread );
+
+                int diag = ovl->path.abpos - ovl->path.bbpos;
+                int anti = ovl->path.abpos + ovl->path.bbpos;
+
+                if ( Local_Alignment( &align, work, spec, diag, diag, anti, -1, -1 ) != NULL &&
+                     path.aepos - path.abpos >= MINOVER / 2 )
+                {
+                    nfound += 1;
+                }
+            }
+        }
+
+        result_add( resLocal, now() - start, nfound );
+    }
+
+    for ( r = 0; r < bctx->repeats; r++ )
+    {
+        double start = now();
+
+        for ( p = 0; p < bctx->npiles; p++ )
+        {
+            for ( i = bctx->piles[ p ]; i < bctx->piles[ p + 1 ]; i++ )
+            {
+                Overlap* ovl = bctx->ovls + i;
+
+                // Compute_Trace_PTS points the path to its work data, keep the sample
+
+                path = ovl->path;
+
+                align.path  = &path;
+                align.flags = ( ovl->flags & OVL_COMP ) ? COMP_FLAG : 0;
+                align.aseq  = bctx->aseq[ p ];
+                align.bseq  = bctx->bseq[ i ];
+                align.alen  = DB_READ_LEN( db, ovl->aread );
+                align.blen  = DB_READ_LEN( db, ovl->bread );
+
+                Compute_Trace_PTS( &align, work, bctx->twidth, GREEDIEST );
+            }
+        }
+
+        result_add( resTrace, now() - start, bctx->novl );
+    }
+
+    Free_Work_Data( work );
+    Free_Align_Spec( spec );
+}
+
+// position in B at the trace point boundary apos of ovl, -1 if it isn't one
+
+static int trace_bpos( Overlap* ovl, int twidth, int apos )
+{
+    ovl_trace* trace = ovl->path.trace;
+    int a = ovl->path.abpos;
+    int b = ovl->path.bbpos;
+    int j;
+
+    for ( j = 0; j < ovl->path.tlen && a < apos; j += 2 )
+    {
+        b += trace[ j + 1 ];
+        a = ( a / twidth + 1 ) * twidth;
+
+        if ( a > ovl->path.aepos )
+        {
+            a = ovl->path.aepos;
+        }
+    }
+
+    return ( a == apos ) ? b : -1;
+}
+
+// consensus of windows of CONS_WINDOW_SEGMENTS trace points along the sampled A-reads,
+// from the B segments spanning them
+
+static void bench_consensus( BenchContext* bctx, BenchResult* res )
+{
+    HITS_DB* db = &( bctx->db );
+    consensus* cns = consensus_init();
+    int window = CONS_WINDOW_SEGMENTS * bctx->twidth;
+    int r, p, i;
+
+    for ( r = 0; r < bctx->repeats; r++ )
+    {
+        uint64 nwindows = 0;
+        double start = now();
+
+        for ( p = 0; p < bctx->npiles; p++ )
+        {
+            int aread = bctx->ovls[ bctx->piles[ p ] ].aread;
+            int alen = DB_READ_LEN( db, aread );
+            int wb;
+
+            for ( wb = 0; wb + window <= alen; wb += window )
+            {
+                int we = wb + window;
+
+                consensus_reset( cns );
+                consensus_add( cns, bctx->aseq[ p ], wb, we );
+
+                for ( i = bctx->piles[ p ]; i < bctx->piles[ p + 1 ] && cns->added < CONS_MAX_COVERAGE; i++ )
+                {
+                    Overlap* ovl = bctx->ovls + i;
+
+                    if ( ovl->path.abpos > wb || ovl->path.aepos < we )
+                    {
+                        continue;
+                    }
+
+                    int bb = trace_bpos( ovl, bctx->twidth, wb );
+                    int be = trace_bpos( ovl, bctx->twidth, we );
+
+                    if ( bb == -1 || be == -1 || be <= bb )
+                    {
+                        continue;
+                    }
+
+                    consensus_add( cns, bctx->bseq[ i ], bb, be );
+                }
+
+                consensus_sequence( cns, 0 );
+
+                nwindows += 1;
+            }
+        }
+
+        result_add( res, now() - start, nwindows );
+    }
+
+    consensus_free( cns );
+}
+
+static void usage()
+{
+    fprintf( stderr, "usage: [-b n] [-j n] [-n n] [-p n] [-r n] database input.las\n\n" );
+
+    fprintf( stderr, "Times Sort_Kmers, Match_Filter, Local_Alignment, Compute_Trace_PTS, pass() and consensus_add\n" );
+    fprintf( stderr, "and writes the results as json to stdout.\n\n" );
+
+    fprintf( stderr, "options: -b n  database block used for Sort_Kmers and Match_Filter (default %d)\n", DEF_ARG_B );
+    fprintf( stderr, "         -j n  threads of Sort_Kmers and Match_Filter, a power of 2 (default %d)\n", DEF_ARG_J );
+    fprintf( stderr, "         -n n  number of overlaps sampled for the alignment and consensus kernels (default %d)\n", DEF_ARG_N );
+    fprintf( stderr, "         -p n  maximum number of piles sampled (default %d)\n", DEF_ARG_P );
+    fprintf( stderr, "         -r n  repetitions of each kernel (default %d)\n", DEF_ARG_R );
+}
+
+int main( int argc, char* argv[] )
+{
+    BenchContext bctx;
+    int block = DEF_ARG_B;
+    int maxovl = DEF_ARG_N;
+    int maxpiles = DEF_ARG_P;
+    int c;
+
+    bzero( &bctx, sizeof( BenchContext ) );
+    bctx.repeats = DEF_ARG_R;
+
+    opterr = 0;
+
+    while ( ( c = getopt( argc, argv, "b:j:n:p:r:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'b':
+                block = atoi( optarg );
+                break;
+
+            case 'j':
+                NTHREADS = atoi( optarg );
+                break;
+
+            case 'n':
+                maxovl = atoi( optarg );
+                break;
+
+            case 'p':
+                maxpiles = atoi( optarg );
+                break;
+
+            case 'r':
+                bctx.repeats = atoi( optarg );
+                break;
+
+            default:
+                usage();
+                exit( 1 );
+        }
+    }
+
+    if ( argc - optind != 2 )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    if ( NTHREADS < 1 || ( NTHREADS & ( NTHREADS - 1 ) ) != 0 )
+    {
+        fprintf( stderr, "invalid number of threads %d, must be a power of 2\n", NTHREADS );
+        exit( 1 );
+    }
+
+    if ( bctx.repeats < 1 || maxovl < 1 || maxpiles < 1 || block < 0 )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    for ( NSHIFT = 0; ( 1 << NSHIFT ) < NTHREADS; NSHIFT++ )
+    {
+    }
+
+    char* pathDb = argv[ optind ];
+    bctx.pathLas = argv[ optind + 1 ];
+
+    if ( Open_DB( pathDb, &( bctx.db ) ) < 0 )
+    {
+        fprintf( stderr, "could not open database %s\n", pathDb );
+        exit( 1 );
+    }
+
+    if ( Set_Filter_Params( DEF_ARG_K, DEF_BIN_SHIFT, 0, DEF_HIT_MIN ) )
+    {
+        fprintf( stderr, "illegal combination of filter parameters\n" );
+        exit( 1 );
+    }
+
+    BenchResult results[ 6 ];
+    int i;
+
+    result_init( results + 0, "sort_kmers", "kmers", bctx.repeats );
+    result_init( results + 1, "match_filter", "overlaps", bctx.repeats );
+    result_init( results + 2, "local_alignment", "alignments", bctx.repeats );
+    result_init( results + 3, "compute_trace_pts", "overlaps", bctx.repeats );
+    result_init( results + 4, "pass", "overlaps", bctx.repeats );
+    result_init( results + 5, "consensus_add", "windows", bctx.repeats );
+
+    // overlaps first, the trace spacing of the block's alignment spec is taken from the .las
+
+    sample_overlaps( &bctx, maxovl, maxpiles );
+
+    char* pathBlock = pathDb;
+
+    if ( block > 0 )
+    {
+        char* root = Root( pathDb, ".db" );
+        char* dir = PathTo( pathDb );
+
+        pathBlock = malloc( strlen( dir ) + strlen( root ) + 20 );
+        sprintf( pathBlock, "%s/%s.%d", dir, root, block );
+
+        free( dir );
+        free( root );
+    }
+
+    bench_kmers( &bctx, pathBlock, results + 0, results + 1 );
+    bench_align( &bctx, results + 2, results + 3 );
+    bench_pass( &bctx, results + 4 );
+    bench_consensus( &bctx, results + 5 );
+
+    printf( "{\n" );
+    printf( "  \"database\": \"%s\",\n", pathDb );
+    printf( "  \"block\": \"%s\",\n", pathBlock );
+    printf( "  \"las\": \"%s\",\n", bctx.pathLas );
+    printf( "  \"threads\": %d,\n", NTHREADS );
+    printf( "  \"repeats\": %d,\n", bctx.repeats );
+    printf( "  \"sampled_piles\": %d,\n", bctx.npiles );
+    printf( "  \"sampled_overlaps\": %d,\n", bctx.novl );
+    printf( "  \"kernels\": {\n" );
+
+    for ( i = 0; i < 6; i++ )
+    {
+        result_print( results + i, stdout, i == 5 );
+    }
+
+    printf( "  }\n" );
+    printf( "}\n" );
+
+    if ( pathBlock != pathDb )
+    {
+        free( pathBlock );
+    }
+
+    sample_free( &bctx );
+    Close_DB( &( bctx.db ) );
+
+    return 0;
+}
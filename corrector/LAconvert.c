@@ -22,11 +22,13 @@
 #include "lib/oflags.h"
 #include "lib/pass.h"
 #include "lib/tracks.h"
+#include "lib/utils.h"
 
 // command line defaults
 
 #define DEF_ARG_T TRACK_TRIM
 #define DEF_ARG_TT TRACK_TRIM
+#define DEF_ARG_J 1
 
 // switches
 
@@ -50,6 +52,10 @@ typedef struct
 
     int* amap;
     int* bmap;
+    int bmap_rid;       // corrected read bmap holds the position mapping of
+
+    int sort_piles;     // read ids are not mapped in order, sort each pile
+    int nthreads;
 
     char* nameTrim_c;
 
@@ -57,8 +63,6 @@ typedef struct
     ovl_header_twidth twidth;
 
     int* riduc_to_ridc;
-
-    FILE* fileLas_c;
 } ConvertContext;
 
 static void trace_to_posmap( int32_t* trace, int tlen, int alen, int* posmap )
@@ -111,10 +115,30 @@ static void trace_to_posmap( int32_t* trace, int tlen, int alen, int* posmap )
     }
 }
 
-static void convert_pre( PassContext* pctx, ConvertContext* cctx )
+// order of LAsort, ( bread, COMP, abpos ) within a pile
+
+static int cmp_ovls( const void* x, const void* y )
 {
-    ovl_header_write( cctx->fileLas_c, pctx->novl, pctx->twidth );
+    Overlap* o1 = (Overlap*)x;
+    Overlap* o2 = (Overlap*)y;
+
+    int cmp = o1->bread - o2->bread;
+
+    if ( cmp == 0 )
+    {
+        cmp = COMP( o1->flags ) - COMP( o2->flags );
 
+        if ( cmp == 0 )
+        {
+            cmp = o1->path.abpos - o2->path.abpos;
+        }
+    }
+
+    return cmp;
+}
+
+static void convert_pre( PassContext* pctx, ConvertContext* cctx )
+{
     cctx->tbytes = pctx->tbytes;
     cctx->amap   = malloc( sizeof( int ) * cctx->db_u->maxlen );
     cctx->bmap   = malloc( sizeof( int ) * cctx->db_u->maxlen );
@@ -143,6 +167,31 @@ static void convert_pre( PassContext* pctx, ConvertContext* cctx )
         cctx->riduc_to_ridc[ data_src[ b ] ] = i;
     }
 
+    // the output stays sorted if the corrected reads are in the order of their sources
+
+    int prev = -1;
+
+    for ( i = 0; i < cctx->db_u->nreads; i++ )
+    {
+        if ( cctx->riduc_to_ridc[ i ] == -1 )
+        {
+            continue;
+        }
+
+        if ( cctx->riduc_to_ridc[ i ] < prev )
+        {
+            cctx->sort_piles = 1;
+            break;
+        }
+
+        prev = cctx->riduc_to_ridc[ i ];
+    }
+
+    if ( cctx->sort_piles )
+    {
+        fprintf( stderr, "warning: corrected reads are not in source order, the output has to be sorted with LAsort\n" );
+    }
+
     // convert trim track
 
     track_data* data_trim_u = cctx->trim->data;
@@ -252,11 +301,11 @@ static void convert_post( ConvertContext* cctx )
     free( cctx->trim_d_c );
 }
 
+// the overlaps are converted in place and written by the pass, discarded ones are purged
+
 static int convert_process( void* _ctx, Overlap* ovl, int novl )
 {
     ConvertContext* ctx = (ConvertContext*)_ctx;
-    FILE* fileLas_c     = ctx->fileLas_c;
-    int tbytes          = ctx->tbytes;
     int a_u             = ovl->aread;
     int a_c             = ctx->riduc_to_ridc[ a_u ];
 
@@ -309,9 +358,16 @@ static int convert_process( void* _ctx, Overlap* ovl, int novl )
             exit( 1 );
         }
 
-        track_anno tbb = anno[ b_c ] / sizeof( track_data );
-        track_anno tbe = anno[ b_c + 1 ] / sizeof( track_data );
-        trace_to_posmap( (int32_t*)( data + tbb ), tbe - tbb, DB_READ_LEN( ctx->db_u, b_u ), bmap );
+        // overlaps with the same B-read are consecutive in a sorted pile
+
+        if ( b_c != ctx->bmap_rid )
+        {
+            track_anno tbb = anno[ b_c ] / sizeof( track_data );
+            track_anno tbe = anno[ b_c + 1 ] / sizeof( track_data );
+            trace_to_posmap( (int32_t*)( data + tbb ), tbe - tbb, DB_READ_LEN( ctx->db_u, b_u ), bmap );
+
+            ctx->bmap_rid = b_c;
+        }
 
         int ab_u = o->path.abpos;
         int ae_u = o->path.aepos - 1;
@@ -396,17 +452,52 @@ static int convert_process( void* _ctx, Overlap* ovl, int novl )
         o->bread = b_c;
 
         assert( 0 <= o->path.bbpos && o->path.bbpos < o->path.bepos && o->path.bepos <= DB_READ_LEN( ctx->db_c, b_c ) );
+    }
 
-        Write_Overlap( fileLas_c, o, tbytes );
+    if ( ctx->sort_piles )
+    {
+        qsort( ovl, novl, sizeof( Overlap ), cmp_ovls );
     }
 
     return 1;
 }
 
+// per thread position maps for pass_parallel(), the tracks and read id mapping are shared
+
+static void* convert_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    ConvertContext* ctx  = (ConvertContext*)_ctx;
+    ConvertContext* tctx = malloc( sizeof( ConvertContext ) );
+
+    memcpy( tctx, ctx, sizeof( ConvertContext ) );
+
+    tctx->amap     = malloc( sizeof( int ) * ctx->db_u->maxlen );
+    tctx->bmap     = malloc( sizeof( int ) * ctx->db_u->maxlen );
+    tctx->bmap_rid = -1;
+
+    return tctx;
+}
+
+static void convert_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( _ctx );
+    UNUSED( thread );
+
+    ConvertContext* tctx = (ConvertContext*)_tctx;
+
+    free( tctx->amap );
+    free( tctx->bmap );
+
+    free( tctx );
+}
+
 static void usage()
 {
-    fprintf( stderr, "usage  : [-tT <track>] <uncorrected.db> <uncorrected.las> <corrected.db> <corrected.las>\n" );
-    fprintf( stderr, "options: -t ... uncorrected db trim track (%s)\n", DEF_ARG_T );
+    fprintf( stderr, "usage  : [-j n] [-tT <track>] <uncorrected.db> <uncorrected.las> <corrected.db> <corrected.las>\n" );
+    fprintf( stderr, "options: -j ... number of threads (%d)\n", DEF_ARG_J );
+    fprintf( stderr, "         -t ... uncorrected db trim track (%s)\n", DEF_ARG_T );
     fprintf( stderr, "         -T ... corrected db trim track (%s)\n", DEF_ARG_TT );
 }
 
@@ -416,6 +507,7 @@ int main( int argc, char* argv[] )
     ConvertContext cctx;
     HITS_DB db_u, db_c;
     FILE* fileLas_u;
+    FILE* fileLas_c;
 
     bzero( &cctx, sizeof( ConvertContext ) );
     cctx.db_u = &db_u;
@@ -425,14 +517,19 @@ int main( int argc, char* argv[] )
 
     char* trim_u    = DEF_ARG_T;
     cctx.nameTrim_c = DEF_ARG_TT;
+    cctx.nthreads   = DEF_ARG_J;
 
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "t:T:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "j:t:T:" ) ) != -1 )
     {
         switch ( c )
         {
+            case 'j':
+                cctx.nthreads = atoi( optarg );
+                break;
+
             case 't':
                 trim_u = optarg;
                 break;
@@ -453,6 +550,12 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    if ( cctx.nthreads < 1 )
+    {
+        fprintf( stderr, "invalid number of threads %d\n", cctx.nthreads );
+        exit( 1 );
+    }
+
     char* pathdb_u  = argv[ optind++ ];
     char* pathlas_u = argv[ optind++ ];
     char* pathdb_c  = argv[ optind++ ];
@@ -464,7 +567,7 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
-    if ( ( cctx.fileLas_c = fopen( pathlas_c, "w" ) ) == NULL )
+    if ( ( fileLas_c = fopen( pathlas_c, "w" ) ) == NULL )
     {
         fprintf( stderr, "could not open '%s'\n", pathlas_c );
         exit( 1 );
@@ -497,24 +600,35 @@ int main( int argc, char* argv[] )
         fprintf( stderr, "failed load track %s", "source" );
     }
 
-    pctx             = pass_init( fileLas_u, NULL );
-    pctx->split_b    = 0;
-    pctx->load_trace = 0;
-    pctx->data       = &cctx;
+    pctx                  = pass_init( fileLas_u, fileLas_c );
+    pctx->split_b         = 0;
+    pctx->load_trace      = 0;
+    pctx->purge_discarded = 1;
+    pctx->data            = &cctx;
+    pctx->thread_init     = convert_thread_init;
+    pctx->thread_reduce   = convert_thread_reduce;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if ( cctx.nthreads > 1 && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load( &db_u, pathlas_u, 0 );
+    }
 
     convert_pre( pctx, &cctx );
 
-    pass( pctx, convert_process );
+    pass_parallel( pctx, convert_process, cctx.nthreads );
 
     convert_post( &cctx );
 
+    lasidx_close( pctx->index );
     pass_free( pctx );
 
     Close_DB( &db_u );
     Close_DB( &db_c );
 
     fclose( fileLas_u );
-    fclose( cctx.fileLas_c );
+    fclose( fileLas_c );
 
     return 0;
 }
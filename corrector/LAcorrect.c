@@ -20,20 +20,22 @@
 
 #include "consensus.h"
 #include "lib/colors.h"
+#include "lib/instrument.h"
 #include "lib/oflags.h"
 #include "lib/pass.h"
+#include "lib/placement.h"
 #include "lib/tracks.h"
 #include "lib/utils.h"
 
 #include "dalign/align.h"
 #include "db/DB.h"
+#include "lib/read_cache.h"
 
 // settings
 
 #define MIN_TWIDTH 20
 
-#define MAX_COVERAGE 20
-#define MAX_TILES 40
+#define TILE_POOL 2     // B tiles kept for each A tile, relative to the depth of its consensus
 
 #undef ADJUST_OFFSETS      // use mid-points to adjust pass through points
 #undef FIX_BOUNDARY_ERRORS // perform multi-tile alignment around segment boundary
@@ -55,6 +57,22 @@
 #define DEF_ARG_Q TRACK_Q
 #define DEF_ARG_B -1
 #define DEF_ARG_J 1
+#define DEF_ARG_M 1024
+#define DEF_ARG_T 20
+#define DEF_ARG_S 0
+
+#define READ_CACHE_SHARDS 64         // separately locked parts of the shared read cache
+
+#define CHUNKS_PER_THREAD 16         // chunks of A-reads handed out to the threads
+
+#define TRACK_POSTRACE "postrace"
+#define DB_OUT_PROLOG  "DAZZ_READ"
+
+#ifdef HIDE_FILES
+#define PATHSEP "/."
+#else
+#define PATHSEP "/"
+#endif
 
 // development only
 
@@ -67,17 +85,104 @@
 #include "msa/msa.h"
 #endif
 
+// a read written to the database (-d). in the chunk files the record is followed by
+// the npostrace values of its postrace track and its 2-bit packed bases.
+
+typedef struct
+{
+    int rlen;
+    int source[ 3 ];    // the A-read and the part of it that was corrected, -1 -1 for copies
+    int npostrace;
+    int count[ 4 ];     // of each base
+} db_out_record;
+
+// a track of the output database, anno as byte offsets into data
+
+typedef struct
+{
+    track_anno* anno;
+    uint64 maxanno;
+
+    track_data* data;
+    uint64 ndata;
+    uint64 maxdata;
+} db_out_track;
+
+// the output database, created or appended to. a database that has been split is
+// not appended to, since its blocks would no longer cover all the reads.
+
+typedef struct
+{
+    char* path;         // as given
+    char* root;
+    char* pwd;
+    char* fname;        // file name recorded in the stub for the reads added
+
+    int nfiles;         // of the stub before adding
+    int* flast;
+    char** fnames;
+    char** fprologs;
+
+    FILE* bases;
+    FILE* indx;
+
+    HITS_DB header;     // as found in the .idx
+    int ureads;         // before adding
+    int nreads;
+    int64 offset;       // end of the .bps
+    int64 totlen;
+    int maxlen;
+    int64 count[ 4 ];
+
+    db_out_track source;
+    db_out_track postrace;
+
+    char* buf;
+    int maxbuf;
+} db_out;
+
+// chunks of A-reads the threads pull from. the output of each chunk goes to
+// a temporary file and is appended to the output once all chunks before it are.
+
+typedef struct
+{
+    int nchunks;
+    off_t* offsets;     // chunk c covers offsets[c] .. offsets[c + 1] - 1 of the overlap file
+    int* rb;            // and the A-reads rb[c] .. rb[c + 1] - 1
+
+    int block_rb;       // copies of uncorrected reads are only written for the block
+    int block_re;
+
+    FILE** out;         // output of the finished chunks
+    char* done;
+
+    int next;           // next chunk handed out
+    int nwritten;       // chunks appended to fileOut
+    int writing;        // a thread is appending
+
+    int ncorrected;     // corrected reads appended to fileOut
+
+    FILE* fileOut;
+    db_out* dbOut;      // instead of fileOut
+
+    PassCheckpoint* ckpt; // optional, taken in between the chunks written
+
+    pthread_mutex_t lock;
+} corrector_queue;
+
 // parameters for each correction thread
 
 typedef struct
 {
     int verbose;
     int thread;     // thread number
+    int pin;        // pin the thread to a core
     int twidth;     // spacing between the alignment trace points
-    off_t start;    // start offset in the overlap file
-    off_t end;      // end offset in the overlap
+    int maxdepth;   // tiles in the consensus of an A tile
+    int stable;     // stop after that many tiles did not change it
     FILE* fileOvls; // overlaps
-    FILE* fileOut;  // output file
+    corrector_queue* queue;
+    Read_Cache* rcache; // B-reads shared by the threads
 
     HITS_DB db;         // database
     HITS_TRACK* qtrack; // quality track
@@ -115,6 +220,9 @@ typedef struct
 
     int twidth; // spacing of trace points
 
+    int maxdepth; // tiles used for the consensus of an A tile
+    int maxtiles; // the best of which are chosen from that many, ranked by QV
+
     int ntoff;
     int* toff;
 
@@ -123,7 +231,9 @@ typedef struct
 
     int maxreads;
     int nreads;
-    char** reads;
+    char** reads;                // sequences of the reads pinned in the cache
+    Read_Cache_Entry** rentries; // for the current pile
+    Read_Cache* rcache;
 
     FILE* fileOut;
     HITS_DB* db;
@@ -164,6 +274,10 @@ typedef struct
 
     char* fastaHeader; // keeps pointer to base_out
 
+    int dbOut;         // write db_out_records instead of fasta
+    char* dbseq;       // packing a corrected read
+    int dbmax;
+
 } corrector_context;
 
 // needed for getopt
@@ -202,55 +316,6 @@ static int has_valid_pt_points( Overlap* ovl )
     return 1;
 }
 
-static off_t* partition_overlaps( FILE* fileOvls, int parts )
-{
-    Overlap ovl;
-    ovl_header_novl novl;
-    ovl_header_twidth twidth;
-
-    off_t* offsets = calloc( parts + 1, sizeof( off_t ) );
-
-    ovl_header_read( fileOvls, &novl, &twidth );
-
-    if ( parts == 1 )
-    {
-        offsets[ 0 ] = ftello( fileOvls );
-    }
-    else
-    {
-        int64 ovls_chunk = novl / parts;
-
-        off_t offprev = ftello( fileOvls );
-        int aprev, chunk;
-        aprev = chunk = 0;
-        int64 novl    = 0;
-
-        while ( !Read_Overlap( fileOvls, &ovl ) )
-        {
-            if ( ovl.aread != aprev )
-            {
-                offprev = ftello( fileOvls ) - OVERLAP_IO_SIZE;
-                aprev   = ovl.aread;
-            }
-
-            fseek( fileOvls, TBYTES( twidth ) * ovl.path.tlen, SEEK_CUR );
-
-            if ( ( novl % ovls_chunk ) == 0 )
-            {
-                offsets[ chunk++ ] = offprev;
-            }
-
-            novl++;
-        }
-    }
-
-    struct stat info;
-    fstat( fileno( fileOvls ), &info );
-    offsets[ parts ] = info.st_size;
-
-    return offsets;
-}
-
 static int cmp_tovl_qv( const void* a, const void* b )
 {
     tile_overlap* tovl1 = (tile_overlap*)a;
@@ -319,7 +384,7 @@ static char* single_tile_consensus( corrector_context* cctx, int t, int* tiles_u
                      bb, be, NULL, 0 );
 #endif
 
-            if ( cctx->cons->added >= MAX_COVERAGE )
+            if ( cctx->cons->added >= cctx->maxdepth || consensus_stable( cctx->cons ) )
             {
                 break;
             }
@@ -451,7 +516,7 @@ static char* multi_tile_consensus( corrector_context* cctx, Overlap* ovls, int n
         msa_add( cctx->malign, cctx->reads[ ovl + 1 ], -1, -1, bb, be, NULL, 0 );
 #endif
 
-        if ( cctx->cons->added == MAX_COVERAGE )
+        if ( cctx->cons->added == cctx->maxdepth || consensus_stable( cctx->cons ) )
         {
             break;
         }
@@ -478,27 +543,33 @@ static int load_read( corrector_context* cctx, int rid, int comp )
 {
     if ( cctx->nreads == cctx->maxreads )
     {
-        int maxreads = cctx->maxreads * 1.2 + 100;
-        cctx->reads  = realloc( cctx->reads, sizeof( char* ) * maxreads );
-
-        for ( ; cctx->maxreads < maxreads; cctx->maxreads++ )
-        {
-            cctx->reads[ cctx->maxreads ] = New_Read_Buffer( cctx->db );
-        }
+        cctx->maxreads = cctx->maxreads * 1.2 + 100;
+        cctx->reads    = realloc( cctx->reads, sizeof( char* ) * cctx->maxreads );
+        cctx->rentries = realloc( cctx->rentries, sizeof( Read_Cache_Entry* ) * cctx->maxreads );
     }
 
-    Load_Read( cctx->db, rid, cctx->reads[ cctx->nreads ], 0 );
+    Read_Cache_Entry* entry = rc_get( cctx->rcache, rid, comp );
 
-    if ( comp )
-    {
-        Complement_Seq( cctx->reads[ cctx->nreads ], DB_READ_LEN( cctx->db, rid ) );
-    }
+    cctx->rentries[ cctx->nreads ] = entry;
+    cctx->reads[ cctx->nreads ]    = entry->seq;
 
     cctx->nreads++;
 
     return cctx->nreads - 1;
 }
 
+static void release_reads( corrector_context* cctx )
+{
+    int i;
+
+    for ( i = 0; i < cctx->nreads; i++ )
+    {
+        rc_release( cctx->rcache, cctx->rentries[ i ] );
+    }
+
+    cctx->nreads = 0;
+}
+
 #ifdef ADJUST_OFFSETS
 
 static int round_down( int n, int f )
@@ -731,6 +802,30 @@ static void write_seq( FILE* file, char* seq )
     }
 }
 
+// write the read seq in [0-3] (with room for 4 more bytes) as a record, packing it in place
+
+static void write_record( FILE* file, char* seq, int rlen, int* source, int* postrace, int npostrace )
+{
+    db_out_record rec;
+    int i;
+
+    rec.rlen = rlen;
+    memcpy( rec.source, source, sizeof( rec.source ) );
+    rec.npostrace = npostrace;
+    bzero( rec.count, sizeof( rec.count ) );
+
+    for ( i = 0; i < rlen; i++ )
+    {
+        rec.count[ (int)seq[ i ] ] += 1;
+    }
+
+    Compress_Read( rlen, seq );
+
+    fwrite( &rec, sizeof( db_out_record ), 1, file );
+    fwrite( postrace, sizeof( int ), npostrace, file );
+    fwrite( seq, 1, COMPRESSED_LEN( rlen ), file );
+}
+
 static char* append_consensus( corrector_context* cctx, char* seqcons, int tiles_used )
 {
     int ncons = strlen( seqcons );
@@ -1042,16 +1137,9 @@ static int break_read( corrector_context* cctx, int aread )
     int alen = cctx->db->reads[ aread ].rlen;
     int ae   = MIN( alen, ( cctx->ce_first_tile + cctx->ce_tcur - 1 ) * cctx->twidth );
 
-    fprintf( cctx->fileOut, ">%d.%d source=%d,%d,%d correctionq=", aread, cctx->ncorrected, aread, ab, ae );
-
     int i;
-    for ( i = 0; i < cctx->curtiles; i += 2 )
-    {
-        if ( i > 0 )
-            fprintf( cctx->fileOut, "," );
-
-        fprintf( cctx->fileOut, "%d,%d", cctx->tiles[ i ], cctx->tiles[ i + 1 ] );
-    }
+    int* postrace = NULL;
+    int npostrace = 0;
 
 #ifdef TRACK_POSITIONS
     Alignment aln;
@@ -1079,25 +1167,57 @@ static int break_read( corrector_context* cctx, int aread )
 
     Compute_Trace_ALL( &aln, cctx->align_work_data );
 
-    if ( path.tlen > 0 )
+    postrace  = (int*)( path.trace );
+    npostrace = path.tlen;
+
+    Lower_Read( aln.bseq );
+#endif
+
+    if ( cctx->dbOut )
     {
-        fprintf( cctx->fileOut, " postrace=" );
-        for ( i = 0; i < path.tlen; i++ )
+        int rlen      = strlen( seq );
+        int source[ 3 ] = {aread, ab, ae};
+
+        if ( rlen + 4 > cctx->dbmax )
+        {
+            cctx->dbmax = rlen * 1.2 + 100;
+            cctx->dbseq = realloc( cctx->dbseq, cctx->dbmax );
+        }
+
+        memcpy( cctx->dbseq, seq, rlen + 1 );
+        Number_Read( cctx->dbseq );
+
+        write_record( cctx->fileOut, cctx->dbseq, rlen, source, postrace, npostrace );
+    }
+    else
+    {
+        fprintf( cctx->fileOut, ">%d.%d source=%d,%d,%d correctionq=", aread, cctx->ncorrected, aread, ab, ae );
+
+        for ( i = 0; i < cctx->curtiles; i += 2 )
         {
             if ( i > 0 )
-            {
                 fprintf( cctx->fileOut, "," );
-            }
-            fprintf( cctx->fileOut, "%d", ( (int*)( path.trace ) )[ i ] );
+
+            fprintf( cctx->fileOut, "%d,%d", cctx->tiles[ i ], cctx->tiles[ i + 1 ] );
         }
-    }
 
-    Lower_Read( aln.bseq );
-#endif
+        if ( npostrace > 0 )
+        {
+            fprintf( cctx->fileOut, " postrace=" );
+            for ( i = 0; i < npostrace; i++ )
+            {
+                if ( i > 0 )
+                {
+                    fprintf( cctx->fileOut, "," );
+                }
+                fprintf( cctx->fileOut, "%d", postrace[ i ] );
+            }
+        }
 
-    fprintf( cctx->fileOut, "\n" );
+        fprintf( cctx->fileOut, "\n" );
 
-    write_seq( cctx->fileOut, seq );
+        write_seq( cctx->fileOut, seq );
+    }
 
     cctx->ncorrected++;
 
@@ -1122,6 +1242,37 @@ static int cmp_povl_length( const void* a, const void* b )
     return len_y - len_x;
 }
 
+// slot of A tile tile for a B tile with the given QV. a free one, or once they are taken the
+// one of the worst B tile if it is worse, -1 otherwise. equal QVs keep the longer overlap.
+
+static int tile_slot( corrector_context* cctx, int* curtiles, int tile, int qv )
+{
+    int tb = cctx->toff[ tile ];
+    int te = cctx->toff[ tile + 1 ];
+
+    if ( tb + curtiles[ tile ] < te )
+    {
+        return tb + curtiles[ tile ]++;
+    }
+
+#ifdef USE_A_TILES
+    tb += 1;
+#endif
+
+    int j;
+    int worst = -1;
+
+    for ( j = tb; j < te; j++ )
+    {
+        if ( cctx->tovl[ j ].qv > qv && ( worst == -1 || cctx->tovl[ j ].qv >= cctx->tovl[ worst ].qv ) )
+        {
+            worst = j;
+        }
+    }
+
+    return worst;
+}
+
 static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls )
 {
     int a = ovls[ 0 ]->aread;
@@ -1174,7 +1325,7 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
 
         for ( t = tb; t <= te; t++ )
         {
-            if ( cctx->toff[ t + 1 ] < MAX_TILES )
+            if ( cctx->toff[ t + 1 ] < cctx->maxtiles )
             {
                 cctx->toff[ t + 1 ]++;
             }
@@ -1184,7 +1335,7 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
 #ifdef USE_A_TILES
     for ( i = 0; i < ntiles; i++ )
     {
-        if ( cctx->toff[ i + 1 ] < MAX_TILES )
+        if ( cctx->toff[ i + 1 ] < cctx->maxtiles )
         {
             cctx->toff[ i + 1 ]++;
         }
@@ -1248,11 +1399,8 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
         be      = ovls[ i ]->path.bbpos + trace[ 1 ];
         readidx = -1;
 
-        if ( curtiles[ tile ] < MAX_TILES )
+        if ( ( p = tile_slot( cctx, curtiles, tile, trace[ 0 ] ) ) != -1 )
         {
-            p = cctx->toff[ tile ] + curtiles[ tile ];
-            curtiles[ tile ] += 1;
-
             readidx = load_read( cctx, bread, ovls[ i ]->flags & OVL_COMP );
 
             cctx->tovl[ p ].read  = readidx;
@@ -1287,11 +1435,8 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
                 be += trace[ t + 1 ];
             }
 
-            if ( curtiles[ tile ] < MAX_TILES )
+            if ( ( p = tile_slot( cctx, curtiles, tile, trace[ t ] ) ) != -1 )
             {
-                p = cctx->toff[ tile ] + curtiles[ tile ];
-                curtiles[ tile ] += 1;
-
                 if ( readidx == -1 )
                 {
                     readidx = load_read( cctx, bread, ovls[ i ]->flags & OVL_COMP );
@@ -1306,10 +1451,6 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
 
                 cctx->tovl[ p ].qv = trace[ t ];
             }
-            else
-            {
-                p = -1;
-            }
         }
 
         if ( p != -1 && ovls[ i ]->path.aepos < alen && ( ovls[ i ]->path.aepos % cctx->twidth ) )
@@ -1357,8 +1498,11 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
 #endif
 
         int tiles_used;
+        uint64_t start = INS_START();
         char* seqcons = single_tile_consensus( cctx, i, &tiles_used );
 
+        INS_STOP( "correct.tile", start );
+        INS_OBSERVE( "correct.tile_depth", tiles_used );
 
         if ( cctx->ce_tcur == 0 )
         {
@@ -1378,70 +1522,65 @@ static void correct_overlaps( corrector_context* cctx, Overlap** ovls, int nOvls
 
     cctx->db->reads[ a ].flags |= READ_CORRECTED;
 
-    cctx->nreads = 0;
+    release_reads( cctx );
 }
 
-static void* corrector_thread( void* arg )
-{
-    corrector_arg* carg = (corrector_arg*)arg;
-    FILE* fileOvls      = carg->fileOvls;
-    corrector_context cctx;
-
-    cctx.cons = consensus_init();
+// write the copies of the reads in [rb, re) that were supposed to be corrected but had no overlaps
 
-#ifdef DEBUG_MULTI
-    cctx.malign        = msa_init();
-    cctx.malign_indent = 0;
-#endif
+static void write_copies( corrector_context* cctx, corrector_queue* queue, char* buf, int rb, int re )
+{
+    HITS_DB* db = cctx->db;
 
-    cctx.ntoff = cctx.ntovl = 0;
-    cctx.nreads = cctx.maxreads = 0;
-    cctx.verbose                = carg->verbose;
-    cctx.toff                   = NULL;
-    cctx.tovl                   = NULL;
-    cctx.reads                  = NULL;
-    cctx.fileOut                = carg->fileOut;
-    cctx.fastaHeader            = carg->fastaHeader;
-    cctx.db                     = &( carg->db );
-    cctx.seqcons                = NULL;
-    cctx.maxcons                = 0;
-    cctx.tiles                  = malloc( sizeof( int ) * 2 * ( carg->db.maxlen / carg->twidth + 1 ) );
-    cctx.curtiles               = 0;
-    cctx.twidth                 = carg->twidth;
-    cctx.qtrack_offset          = carg->qtrack->anno;
-    cctx.qtrack_data            = carg->qtrack->data;
-    cctx.track = malloc( sizeof( int ) * carg->db.maxlen );
+    rb = MAX( rb, queue->block_rb );
+    re = MIN( re, queue->block_re );
 
-    cctx.stats_tiles_single = 0;
-    cctx.stats_tiles_multi  = 0;
+    int i;
+    for ( i = rb; i < re; i++ )
+    {
+        int flags = db->reads[ i ].flags;
 
-    cctx.thread = carg->thread;
+        if ( ( flags & READ_CORRECT ) && !( flags & READ_CORRECTED ) )
+        {
+            if ( cctx->dbOut )
+            {
+                int source[ 3 ] = {i, -1, -1};
 
-    cctx.mtc_dmax  = 0;
-    cctx.mtc_data  = NULL;
-    cctx.mtc_dsort = NULL;
+                Load_Read( db, i, buf, 0 );
+                write_record( cctx->fileOut, buf, DB_READ_LEN( db, i ), source, NULL, 0 );
+            }
+            else
+            {
+                Load_Read( db, i, buf, 1 );
 
-    cctx.ce_smax        = 0;
-    cctx.ce_seq_singles = NULL;
+                fprintf( cctx->fileOut, ">copy.%d source=%d,%d,%d\n", i, i, -1, -1 );
+                write_seq( cctx->fileOut, buf );
+            }
+        }
+    }
+}
 
-    cctx.ce_tcur  = 0;
-    cctx.ce_tiles = malloc( sizeof( int ) * ( cctx.db->maxlen / cctx.twidth + 1 ) );
+// correct the A-reads of chunk c, writing them and the copies in read order to cctx->fileOut
 
-    cctx.align_work_data = New_Work_Data();
+static void correct_chunk( corrector_context* cctx, corrector_arg* carg, char* buf, int c )
+{
+    corrector_queue* queue = carg->queue;
+    FILE* fileOvls         = carg->fileOvls;
+    off_t end              = queue->offsets[ c + 1 ];
+    int next               = queue->rb[ c ];
 
     ovl_trace* trace = NULL;
     int tmax, tcur;
     tcur = tmax = 0;
 
-    size_t tbytes = TBYTES( cctx.twidth );
+    size_t tbytes = TBYTES( cctx->twidth );
 
     int omax              = 500;
     Overlap* pOvls        = malloc( sizeof( Overlap ) * omax );
     Overlap** ovls_sorted = malloc( sizeof( Overlap* ) * omax );
 
-    fseek( fileOvls, carg->start, SEEK_SET );
+    fseeko( fileOvls, queue->offsets[ c ], SEEK_SET );
 
-    while ( !Read_Overlap( fileOvls, pOvls ) && ( pOvls->flags & OVL_DISCARD || pOvls->path.tlen == 0 ) )
+    while ( ftello( fileOvls ) < end && !Read_Overlap( fileOvls, pOvls ) && ( pOvls->flags & OVL_DISCARD || pOvls->path.tlen == 0 ) )
     {
         fseek( fileOvls, tbytes * pOvls->path.tlen, SEEK_CUR );
     }
@@ -1449,9 +1588,7 @@ static void* corrector_thread( void* arg )
     int a, n;
     n = 0;
 
-    cctx.ncorrected = 0;
-
-    while ( ftell( fileOvls ) < carg->end )
+    while ( ftello( fileOvls ) < end )
     {
         pOvls[ 0 ]       = pOvls[ n ];
         ovls_sorted[ 0 ] = pOvls;
@@ -1519,93 +1656,619 @@ static void* corrector_thread( void* arg )
         qsort( ovls_sorted, n, sizeof( Overlap* ), cmp_povl_length );
 
 #ifdef ADJUST_OFFSETS
-        adjust_offsets( &cctx, ovls_sorted, n );
+        adjust_offsets( cctx, ovls_sorted, n );
 #endif
 
-        correct_overlaps( &cctx, ovls_sorted, n );
-    }
+        write_copies( cctx, queue, buf, next, a );
 
-    if ( cctx.toff != NULL )
-    {
-        free( cctx.toff );
-    }
+        uint64_t start = INS_START();
 
-    if ( cctx.tovl != NULL )
-    {
-        free( cctx.tovl );
-    }
+        correct_overlaps( cctx, ovls_sorted, n );
 
-    int i;
-    for ( i = 0; i < cctx.maxreads; i++ )
-    {
-        free( cctx.reads[ i ] - 1 );
+        INS_STOP( "correct.read", start );
+        INS_COUNT( "correct.overlaps", n );
+
+        next = MAX( next, a + 1 );
     }
 
-    free( cctx.reads );
-    free( cctx.mtc_data );
-    free( cctx.mtc_dsort );
-    free( cctx.ce_tiles );
-    free( cctx.ce_seq_singles );
-    free( cctx.track );
-    free( cctx.tiles );
-    free( cctx.seqcons );
+    write_copies( cctx, queue, buf, next, queue->rb[ c + 1 ] );
+
     free( pOvls );
     free( ovls_sorted );
     free( trace );
-
-    Free_Work_Data( cctx.align_work_data );
-
-    consensus_free( cctx.cons );
-
-#ifdef DEBUG_MULTI
-    msa_free( cctx.malign );
-#endif
-
-    return NULL;
 }
 
-static void usage()
-{
-    printf( "usage: [-v] [-r <file>] [-j n] [-q track] database input.las output.fasta\n\n" );
-    printf( "Corrects the reads from the database based on the alignments in\n" );
-    printf( "input.las and stores the correct reads in output.fasta\n\n" );
-    printf( "Output files are named output.<thread.number>.fasta\n\n" );
-    printf( "options: -v        enable verbose output\n" );
-    printf( "         -j n      number of threads (default %d)\n", DEF_ARG_J );
-    printf( "         -q track  name of the quality track (default %s)\n", DEF_ARG_Q );
-    printf( "         -r file   text file with ids of the reads to be corrected\n");
-}
+// writing the corrected reads to a database
 
-int main( int argc, char* argv[] )
+static void db_out_track_init( db_out_track* t, HITS_DB* db, char* name )
 {
-    FILE* fileOvls;
-    HITS_DB db;
-    int64 novl;
-    int twidth;
-
-    int verbose  = 0;
-    int nThreads = DEF_ARG_J;
-    int block    = DEF_ARG_B;
-
-    char* qTrackName = DEF_ARG_Q;
-    char* pathReadIds = NULL;
+    uint64 nreads = DB_NREADS( db );
+    HITS_TRACK* track;
 
-    // process arguments
+    bzero( t, sizeof( db_out_track ) );
 
-    int c;
+    t->maxanno = nreads + 1000;
+    t->anno    = calloc( t->maxanno + 1, sizeof( track_anno ) );
 
-    opterr = 0;
+    // keep the track of the reads added before, which may not have it
 
-    while ( ( c = getopt( argc, argv, "vr:b:j:q:" ) ) != -1 )
+    if ( nreads > 0 && ( track = track_load( db, name ) ) != NULL )
     {
-        switch ( c )
+        if ( track->size != sizeof( track_anno ) || track->data == NULL )
         {
-            case 'r':
-                pathReadIds = optarg;
-                break;
+            fprintf( stderr, "track %s of %s has an unexpected format\n", name, db->path );
+            exit( 1 );
+        }
 
-            case 'v':
-                verbose++;
+        memcpy( t->anno, track->anno, sizeof( track_anno ) * ( nreads + 1 ) );
+
+        t->ndata   = t->anno[ nreads ] / sizeof( track_data );
+        t->maxdata = t->ndata + 1000;
+        t->data    = malloc( sizeof( track_data ) * t->maxdata );
+
+        memcpy( t->data, track->data, sizeof( track_data ) * t->ndata );
+
+        Close_Track( db, name );
+    }
+    else
+    {
+        t->maxdata = 1000;
+        t->data    = malloc( sizeof( track_data ) * t->maxdata );
+    }
+}
+
+static void db_out_track_add( db_out_track* t, int read, int* values, int nvalues )
+{
+    if ( (uint64)read + 1 >= t->maxanno )
+    {
+        t->maxanno = t->maxanno * 1.2 + 1000;
+        t->anno    = realloc( t->anno, sizeof( track_anno ) * ( t->maxanno + 1 ) );
+    }
+
+    if ( t->ndata + nvalues > t->maxdata )
+    {
+        t->maxdata = ( t->ndata + nvalues ) * 1.2 + 1000;
+        t->data    = realloc( t->data, sizeof( track_data ) * t->maxdata );
+    }
+
+    memcpy( t->data + t->ndata, values, sizeof( track_data ) * nvalues );
+    t->ndata += nvalues;
+
+    t->anno[ read + 1 ] = t->anno[ read ] + sizeof( track_data ) * nvalues;
+}
+
+static void db_out_track_free( db_out_track* t )
+{
+    free( t->anno );
+    free( t->data );
+}
+
+static db_out* db_out_open( char* path, char* fname )
+{
+    db_out* out = calloc( 1, sizeof( db_out ) );
+    HITS_DB db;
+    FILE* stub;
+    int i;
+
+    out->path  = path;
+    out->root  = Root( path, ".db" );
+    out->pwd   = PathTo( path );
+    out->fname = fname;
+
+    if ( ( stub = fopen( Catenate( out->pwd, "/", out->root, ".db" ), "r" ) ) == NULL )
+    {
+        out->bases = Fopen( Catenate( out->pwd, PATHSEP, out->root, ".bps" ), "w" );
+        out->indx  = Fopen( Catenate( out->pwd, PATHSEP, out->root, ".idx" ), "w" );
+
+        if ( out->bases == NULL || out->indx == NULL )
+        {
+            exit( 1 );
+        }
+
+        bzero( &db, sizeof( HITS_DB ) );
+    }
+    else
+    {
+        char prolog[ MAX_NAME ], name[ MAX_NAME ];
+        int nblocks;
+
+        if ( fscanf( stub, DB_NFILE, &( out->nfiles ) ) != 1 )
+        {
+            fprintf( stderr, "malformed stub of %s\n", path );
+            exit( 1 );
+        }
+
+        out->flast    = malloc( sizeof( int ) * out->nfiles );
+        out->fnames   = malloc( sizeof( char* ) * out->nfiles );
+        out->fprologs = malloc( sizeof( char* ) * out->nfiles );
+
+        for ( i = 0; i < out->nfiles; i++ )
+        {
+            if ( fscanf( stub, DB_FDATA, out->flast + i, name, prolog ) != 3 )
+            {
+                fprintf( stderr, "malformed stub of %s\n", path );
+                exit( 1 );
+            }
+
+            if ( strcmp( name, fname ) == 0 )
+            {
+                fprintf( stderr, "%s has already been added to %s\n", fname, path );
+                exit( 1 );
+            }
+
+            out->fnames[ i ]   = strdup( name );
+            out->fprologs[ i ] = strdup( prolog );
+        }
+
+        if ( fscanf( stub, DB_NBLOCK, &nblocks ) == 1 )
+        {
+            fprintf( stderr, "%s has been split, split it after adding the last reads\n", path );
+            exit( 1 );
+        }
+
+        fclose( stub );
+
+        if ( Open_DB( path, &db ) )
+        {
+            fprintf( stderr, "could not open '%s'\n", path );
+            exit( 1 );
+        }
+
+        out->bases = Fopen( Catenate( out->pwd, PATHSEP, out->root, ".bps" ), "r+" );
+        out->indx  = Fopen( Catenate( out->pwd, PATHSEP, out->root, ".idx" ), "r+" );
+
+        if ( out->bases == NULL || out->indx == NULL ||
+             fread( &( out->header ), sizeof( HITS_DB ), 1, out->indx ) != 1 )
+        {
+            fprintf( stderr, "could not read the index of %s\n", path );
+            exit( 1 );
+        }
+
+        fseeko( out->bases, 0, SEEK_END );
+        fseeko( out->indx, 0, SEEK_END );
+
+        out->ureads = out->header.ureads;
+        out->offset = ftello( out->bases );
+    }
+
+    db_out_track_init( &( out->source ), &db, TRACK_SOURCE );
+    db_out_track_init( &( out->postrace ), &db, TRACK_POSTRACE );
+
+    if ( out->ureads > 0 )
+    {
+        Close_DB( &db );
+    }
+    else
+    {
+        fwrite( &( out->header ), sizeof( HITS_DB ), 1, out->indx );
+    }
+
+    out->nreads = out->ureads;
+
+    return out;
+}
+
+// append the records of a chunk file
+
+static void db_out_chunk( db_out* out, FILE* fileChunk )
+{
+    db_out_record rec;
+    int* values = NULL;
+    int maxvalues = 0;
+    int i;
+
+    while ( fread( &rec, sizeof( db_out_record ), 1, fileChunk ) == 1 )
+    {
+        size_t clen = COMPRESSED_LEN( rec.rlen );
+
+        if ( rec.npostrace > maxvalues )
+        {
+            maxvalues = rec.npostrace * 1.2 + 100;
+            values    = realloc( values, sizeof( int ) * maxvalues );
+        }
+
+        if ( (int64)clen > out->maxbuf )
+        {
+            out->maxbuf = clen * 1.2 + 1000;
+            out->buf    = realloc( out->buf, out->maxbuf );
+        }
+
+        if ( fread( values, sizeof( int ), rec.npostrace, fileChunk ) != (size_t)rec.npostrace ||
+             fread( out->buf, 1, clen, fileChunk ) != clen )
+        {
+            fprintf( stderr, "failed to read the corrected reads from a temporary file\n" );
+            exit( 1 );
+        }
+
+        HITS_READ hr;
+        hr.boff  = out->offset;
+        hr.rlen  = rec.rlen;
+        hr.coff  = -1;
+        hr.flags = DB_BEST;
+
+        if ( fwrite( out->buf, 1, clen, out->bases ) != clen ||
+             fwrite( &hr, sizeof( HITS_READ ), 1, out->indx ) != 1 )
+        {
+            fprintf( stderr, "failed to write read %d to %s\n", out->nreads, out->path );
+            exit( 1 );
+        }
+
+        db_out_track_add( &( out->source ), out->nreads, rec.source, 3 );
+        db_out_track_add( &( out->postrace ), out->nreads, values, rec.npostrace );
+
+        for ( i = 0; i < 4; i++ )
+        {
+            out->count[ i ] += rec.count[ i ];
+        }
+
+        out->offset += clen;
+        out->totlen += rec.rlen;
+        out->maxlen = MAX( out->maxlen, rec.rlen );
+        out->nreads += 1;
+    }
+
+    free( values );
+}
+
+// finalize the .idx, the stub and the tracks
+
+static void db_out_close( db_out* out )
+{
+    HITS_DB* hdr = &( out->header );
+    FILE* stub;
+    int i;
+
+    for ( i = 0; i < 4; i++ )
+    {
+        hdr->freq[ i ] = (float)( ( (double)hdr->freq[ i ] * hdr->totlen + out->count[ i ] ) / MAX( 1, hdr->totlen + out->totlen ) );
+    }
+
+    hdr->ureads = out->nreads;
+    hdr->totlen += out->totlen;
+    hdr->maxlen = MAX( hdr->maxlen, out->maxlen );
+
+    rewind( out->indx );
+    fwrite( hdr, sizeof( HITS_DB ), 1, out->indx );
+
+    fclose( out->indx );
+    fclose( out->bases );
+
+    if ( ( stub = Fopen( Catenate( out->pwd, "/", out->root, ".db" ), "w" ) ) == NULL )
+    {
+        exit( 1 );
+    }
+
+    fprintf( stub, DB_NFILE, out->nfiles + 1 );
+
+    for ( i = 0; i < out->nfiles; i++ )
+    {
+        fprintf( stub, DB_FDATA, out->flast[ i ], out->fnames[ i ], out->fprologs[ i ] );
+
+        free( out->fnames[ i ] );
+        free( out->fprologs[ i ] );
+    }
+
+    fprintf( stub, DB_FDATA, out->nreads, out->fname, DB_OUT_PROLOG );
+
+    fclose( stub );
+
+    HITS_DB db;
+
+    if ( Open_DB( out->path, &db ) )
+    {
+        fprintf( stderr, "could not open '%s'\n", out->path );
+        exit( 1 );
+    }
+
+    track_write( &db, TRACK_SOURCE, 0, out->source.anno, out->source.data, out->source.ndata );
+    track_write( &db, TRACK_POSTRACE, 0, out->postrace.anno, out->postrace.data, out->postrace.ndata );
+
+    Close_DB( &db );
+
+    db_out_track_free( &( out->source ) );
+    db_out_track_free( &( out->postrace ) );
+
+    free( out->flast );
+    free( out->fnames );
+    free( out->fprologs );
+    free( out->buf );
+    free( out->root );
+    free( out->pwd );
+    free( out );
+}
+
+// copies a chunk to the fasta output. the threads number their corrected reads
+// aread.N in the order they happen to get the chunks, which is replaced with
+// their position in the output, so it doesn't depend on the threading.
+
+static void append_fasta( corrector_queue* queue, FILE* fileChunk, char** line, size_t* maxline )
+{
+    ssize_t len;
+
+    while ( ( len = getline( line, maxline, fileChunk ) ) > 0 )
+    {
+        char* c = *line;
+        char* end;
+        int aread;
+
+        if ( c[ 0 ] == '>' && ( aread = strtol( c + 1, &end, 10 ), end > c + 1 ) && *end == '.' )
+        {
+            strtol( end + 1, &end, 10 );
+
+            fprintf( queue->fileOut, ">%d.%d", aread, queue->ncorrected );
+            fputs( end, queue->fileOut );
+
+            queue->ncorrected += 1;
+        }
+        else
+        {
+            fwrite( c, 1, len, queue->fileOut );
+        }
+    }
+}
+
+// append the finished chunks to the output in order, at most one thread at a time
+
+static void write_chunks( corrector_queue* queue )
+{
+    char* line = NULL;
+    size_t maxline = 0;
+
+    pthread_mutex_lock( &( queue->lock ) );
+
+    while ( !queue->writing && queue->nwritten < queue->nchunks && queue->done[ queue->nwritten ] )
+    {
+        int c = queue->nwritten;
+        FILE* fileChunk = queue->out[ c ];
+
+        queue->writing = 1;
+
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        rewind( fileChunk );
+
+        if ( queue->dbOut )
+        {
+            db_out_chunk( queue->dbOut, fileChunk );
+        }
+        else
+        {
+            append_fasta( queue, fileChunk, &line, &maxline );
+        }
+
+        fclose( fileChunk );
+
+        if ( queue->ckpt && pass_checkpoint_due( queue->ckpt ) )
+        {
+            queue->ckpt->off   = queue->offsets[ c + 1 ];
+            queue->ckpt->aread = queue->rb[ c + 1 ] - 1;
+
+            pass_checkpoint_write( queue->ckpt );
+        }
+
+        pthread_mutex_lock( &( queue->lock ) );
+
+        queue->out[ c ] = NULL;
+        queue->nwritten += 1;
+        queue->writing = 0;
+    }
+
+    pthread_mutex_unlock( &( queue->lock ) );
+
+    free( line );
+}
+
+static void* corrector_thread( void* arg )
+{
+    corrector_arg* carg     = (corrector_arg*)arg;
+    corrector_queue* queue  = carg->queue;
+    corrector_context cctx;
+
+    // pinned before allocating, so that its buffers are placed on the thread's node
+
+    if ( carg->pin )
+    {
+        placement_pin( carg->thread );
+    }
+
+    cctx.cons = consensus_init();
+    consensus_stop( cctx.cons, carg->stable );
+
+#ifdef DEBUG_MULTI
+    cctx.malign        = msa_init();
+    cctx.malign_indent = 0;
+#endif
+
+    cctx.ntoff = cctx.ntovl = 0;
+    cctx.nreads = cctx.maxreads = 0;
+    cctx.verbose                = carg->verbose;
+    cctx.toff                   = NULL;
+    cctx.tovl                   = NULL;
+    cctx.reads                  = NULL;
+    cctx.rentries               = NULL;
+    cctx.rcache                 = carg->rcache;
+    cctx.fileOut                = NULL;
+    cctx.fastaHeader            = carg->fastaHeader;
+    cctx.dbOut                  = ( queue->dbOut != NULL );
+    cctx.dbseq                  = NULL;
+    cctx.dbmax                  = 0;
+    cctx.db                     = &( carg->db );
+    cctx.seqcons                = NULL;
+    cctx.maxcons                = 0;
+    cctx.tiles                  = malloc( sizeof( int ) * 2 * ( carg->db.maxlen / carg->twidth + 1 ) );
+    cctx.curtiles               = 0;
+    cctx.twidth                 = carg->twidth;
+    cctx.maxdepth               = carg->maxdepth;
+    cctx.maxtiles               = TILE_POOL * carg->maxdepth;
+    cctx.qtrack_offset          = carg->qtrack->anno;
+    cctx.qtrack_data            = carg->qtrack->data;
+    cctx.track = malloc( sizeof( int ) * carg->db.maxlen );
+
+    cctx.stats_tiles_single = 0;
+    cctx.stats_tiles_multi  = 0;
+
+    cctx.thread = carg->thread;
+
+    cctx.mtc_dmax  = 0;
+    cctx.mtc_data  = NULL;
+    cctx.mtc_dsort = NULL;
+
+    cctx.ce_smax        = 0;
+    cctx.ce_seq_singles = NULL;
+
+    cctx.ce_tcur  = 0;
+    cctx.ce_tiles = malloc( sizeof( int ) * ( cctx.db->maxlen / cctx.twidth + 1 ) );
+
+    cctx.align_work_data = New_Work_Data();
+
+    cctx.ncorrected = 0;
+
+    char* buf = New_Read_Buffer( cctx.db );
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &( queue->lock ) );
+
+        int c = queue->next;
+
+        if ( c < queue->nchunks )
+        {
+            queue->next += 1;
+        }
+
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        if ( c >= queue->nchunks )
+        {
+            break;
+        }
+
+        if ( ( cctx.fileOut = tmpfile() ) == NULL )
+        {
+            fprintf( stderr, "failed to create temporary output for chunk %d\n", c );
+            exit( 1 );
+        }
+
+        correct_chunk( &cctx, carg, buf, c );
+
+        pthread_mutex_lock( &( queue->lock ) );
+
+        queue->out[ c ]  = cctx.fileOut;
+        queue->done[ c ] = 1;
+
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        cctx.fileOut = NULL;
+
+        write_chunks( queue );
+    }
+
+    free( buf - 1 );
+
+    if ( cctx.toff != NULL )
+    {
+        free( cctx.toff );
+    }
+
+    if ( cctx.tovl != NULL )
+    {
+        free( cctx.tovl );
+    }
+
+    free( cctx.reads );
+    free( cctx.rentries );
+    free( cctx.mtc_data );
+    free( cctx.mtc_dsort );
+    free( cctx.ce_tiles );
+    free( cctx.ce_seq_singles );
+    free( cctx.track );
+    free( cctx.tiles );
+    free( cctx.seqcons );
+    free( cctx.dbseq );
+
+    Free_Work_Data( cctx.align_work_data );
+
+    consensus_free( cctx.cons );
+
+#ifdef DEBUG_MULTI
+    msa_free( cctx.malign );
+#endif
+
+    return NULL;
+}
+
+static void usage()
+{
+    printf( "usage: [-vNdR] [-r <file>] [-j n] [-M n] [-q track] database input.las output.fasta|output.db\n\n" );
+    printf( "Corrects the reads from the database based on the alignments in\n" );
+    printf( "input.las and stores the correct reads in output.fasta in read order\n\n" );
+    printf( "options: -v        enable verbose output\n" );
+    printf( "         -d        add the corrected reads to the database output.db instead, along with\n" );
+    printf( "                   their %s and %s tracks. the reads of further runs can be added\n", TRACK_SOURCE, TRACK_POSTRACE );
+    printf( "                   to it, as long as it has not been split\n" );
+    printf( "         -j n      number of threads (default %d)\n", DEF_ARG_J );
+    printf( "         -N        pin the threads to cores spread over the NUMA nodes\n" );
+    printf( "         -M n      size of the read cache shared by the threads in MB (default %d)\n", DEF_ARG_M );
+    printf( "         -q track  name of the quality track (default %s)\n", DEF_ARG_Q );
+    printf( "         -t n      maximum number of B tiles in the consensus of an A tile (default %d).\n", DEF_ARG_T );
+    printf( "                   the %dn B tiles with the best QVs of the whole pile are kept,\n", TILE_POOL );
+    printf( "                   of which the best n are used\n" );
+    printf( "         -s n      stop adding B tiles to a consensus once n in a row did not change it\n" );
+    printf( "                   (default %d, off)\n", DEF_ARG_S );
+    printf( "         -r file   text file with ids of the reads to be corrected\n");
+    printf( "         -R        checkpoint to output.fasta%s every %ds and resume from it, if present.\n",
+                                PASS_CHECKPOINT_SUFFIX, PASS_CHECKPOINT_INTERVAL );
+    printf( "                   the resumed run needs the same arguments\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+    FILE* fileOvls;
+    HITS_DB db;
+    int64 novl;
+    int twidth;
+
+    int verbose  = 0;
+    int pin      = 0;
+    int nThreads = DEF_ARG_J;
+    int block    = DEF_ARG_B;
+    int cacheMb  = DEF_ARG_M;
+    int dbOut    = 0;
+    int maxdepth = DEF_ARG_T;
+    int stable   = DEF_ARG_S;
+    int resume   = 0;
+
+    char* qTrackName = DEF_ARG_Q;
+    char* pathReadIds = NULL;
+
+    // process arguments
+
+    int c;
+
+    opterr = 0;
+
+    while ( ( c = getopt( argc, argv, "vNdRr:b:j:M:q:t:s:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'R':
+                resume = 1;
+                break;
+
+            case 'r':
+                pathReadIds = optarg;
+                break;
+
+            case 'v':
+                verbose++;
+                break;
+
+            case 'N':
+                pin = 1;
+                break;
+
+            case 'd':
+                dbOut = 1;
                 break;
 
             case 'j':
@@ -1616,10 +2279,22 @@ int main( int argc, char* argv[] )
                 block = atoi( optarg );
                 break;
 
+            case 'M':
+                cacheMb = atoi( optarg );
+                break;
+
             case 'q':
                 qTrackName = optarg;
                 break;
 
+            case 't':
+                maxdepth = atoi( optarg );
+                break;
+
+            case 's':
+                stable = atoi( optarg );
+                break;
+
             default:
                 usage();
                 exit( 1 );
@@ -1632,6 +2307,20 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    // profile columns count up to 255 tiles
+
+    if ( maxdepth < 1 || maxdepth > 255 )
+    {
+        fprintf( stderr, "invalid tile depth %d\n", maxdepth );
+        exit( 1 );
+    }
+
+    if ( resume && dbOut )
+    {
+        fprintf( stderr, "checkpoints need fasta output\n" );
+        exit( 1 );
+    }
+
     char* pcPathReadsIn  = argv[ optind++ ];
     char* pcPathOverlaps = argv[ optind++ ];
     char* pcBaseOut      = argv[ optind++ ];
@@ -1654,6 +2343,8 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    rewind( fileOvls );
+
     // init
 
     if ( Open_DB( pcPathReadsIn, &db ) )
@@ -1662,6 +2353,10 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    // the threads share the mapped bases
+
+    Map_Bases( &db );
+
     HITS_TRACK* qtrack = track_load( &db, qTrackName );
 
     if ( qtrack == NULL )
@@ -1670,11 +2365,80 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
-    off_t* offsets = partition_overlaps( fileOvls, nThreads );
+    // chunks of A-reads, split using the index if there is an up to date one
 
-    fclose( fileOvls );
+    PassContext* pctx = pass_init( fileOvls, NULL );
+
+    pctx->index = lasidx_load( &db, pcPathOverlaps, 0 );
+
+    corrector_queue queue;
+    bzero( &queue, sizeof( corrector_queue ) );
+
+    queue.nchunks = nThreads * CHUNKS_PER_THREAD;
+    queue.offsets = pass_partition( pctx, queue.nchunks );
+    queue.rb      = malloc( sizeof( int ) * ( queue.nchunks + 1 ) );
+    queue.out     = calloc( queue.nchunks, sizeof( FILE* ) );
+    queue.done    = calloc( queue.nchunks, 1 );
+
+    // first A-read of each chunk
+
+    queue.rb[ queue.nchunks ] = DB_NREADS( &db );
 
     int i;
+    for ( i = queue.nchunks - 1; i > 0; i-- )
+    {
+        Overlap ovl;
+
+        fseeko( fileOvls, queue.offsets[ i ], SEEK_SET );
+
+        if ( queue.offsets[ i ] < queue.offsets[ i + 1 ] && !Read_Overlap( fileOvls, &ovl ) )
+        {
+            queue.rb[ i ] = ovl.aread;
+        }
+        else
+        {
+            queue.rb[ i ] = queue.rb[ i + 1 ];
+        }
+    }
+
+    queue.rb[ 0 ] = 0;
+
+    // continue with the chunk following the checkpoint, which is only found
+    // if the input is cut into the same chunks again
+
+    if ( resume )
+    {
+        queue.ckpt = pass_checkpoint_load( pcBaseOut, fileOvls );
+
+        if ( queue.ckpt->resumed )
+        {
+            for ( i = 0; i <= queue.nchunks; i++ )
+            {
+                if ( queue.offsets[ i ] == queue.ckpt->off && queue.rb[ i ] == queue.ckpt->aread + 1 )
+                {
+                    break;
+                }
+            }
+
+            if ( i > queue.nchunks )
+            {
+                fprintf( stderr, "checkpoint %s is not at a chunk boundary, resume with the same number of threads\n", queue.ckpt->path );
+                exit( 1 );
+            }
+
+            queue.next = queue.nwritten = i;
+
+            if ( verbose )
+            {
+                printf( "resuming after A-read %d\n", queue.ckpt->aread );
+            }
+        }
+    }
+
+    lasidx_close( pctx->index );
+    pass_free( pctx );
+
+    fclose( fileOvls );
 
     for ( i = 0; i < DB_NREADS( &db ); i++ )
     {
@@ -1711,35 +2475,83 @@ int main( int argc, char* argv[] )
         }
     }
 
+    if ( block > 0 )
+    {
+        DB_block_range( pcPathReadsIn, block, &queue.block_rb, &queue.block_re );
+    }
+    else
+    {
+        queue.block_rb = 0;
+        queue.block_re = DB_NREADS( &db );
+    }
+
+    char* fnameOut = NULL;
+
+    if ( dbOut )
+    {
+        fnameOut    = Root( pcPathOverlaps, ".las" );
+        queue.dbOut = db_out_open( pcBaseOut, fnameOut );
+    }
+    else if ( ( queue.fileOut = fopen( pcBaseOut, ( queue.ckpt && queue.ckpt->resumed ) ? "r+" : "w" ) ) == NULL )
+    {
+        fprintf( stderr, "could not create '%s'\n", pcBaseOut );
+        exit( 1 );
+    }
+
+    if ( queue.ckpt )
+    {
+        pass_checkpoint_output( queue.ckpt, queue.fileOut );
+
+        // continue the numbering of the corrected reads already written
+
+        if ( queue.ckpt->resumed )
+        {
+            off_t size = ftello( queue.fileOut );
+            char* line = NULL;
+            size_t maxline = 0;
+
+            rewind( queue.fileOut );
+
+            while ( ftello( queue.fileOut ) < size && getline( &line, &maxline, queue.fileOut ) > 0 )
+            {
+                if ( line[ 0 ] == '>' && line[ 1 ] >= '0' && line[ 1 ] <= '9' )
+                {
+                    queue.ncorrected += 1;
+                }
+            }
+
+            free( line );
+            fseeko( queue.fileOut, size, SEEK_SET );
+        }
+    }
+
+    pthread_mutex_init( &( queue.lock ), NULL );
+
+    Read_Cache* rcache = rc_init( &db, (size_t)cacheMb * 1024 * 1024, READ_CACHE_SHARDS );
+
     pthread_t* threads   = malloc( sizeof( pthread_t ) * nThreads );
     corrector_arg* cargs = malloc( sizeof( corrector_arg ) * nThreads );
 
-    char* pcOut = malloc( strlen( pcBaseOut ) + 20 );
-
     for ( i = 0; i < nThreads; i++ )
     {
         cargs[ i ].qtrack  = qtrack;
         cargs[ i ].verbose = verbose;
 
         cargs[ i ].thread = i;
-        cargs[ i ].start  = offsets[ i ];
-        cargs[ i ].end    = offsets[ i + 1 ];
+        cargs[ i ].pin    = pin;
         cargs[ i ].twidth = twidth;
+        cargs[ i ].maxdepth = maxdepth;
+        cargs[ i ].stable   = stable;
+        cargs[ i ].queue  = &queue;
+        cargs[ i ].rcache = rcache;
 
         cargs[ i ].fileOvls = fopen( pcPathOverlaps, "r" );
 
-        sprintf( pcOut, "%s.%02d.fasta", pcBaseOut, i );
-        cargs[ i ].fileOut = fopen( pcOut, "w" );
-
         memcpy( &( cargs[ i ].db ), &db, sizeof( HITS_DB ) );
 
-        cargs[ i ].db.bases    = NULL;
         cargs[ i ].fastaHeader = pcBaseOut;
     }
 
-    free( offsets );
-    free( pcOut );
-
     for ( i = 0; i < nThreads; i++ )
     {
         pthread_create( threads + i, NULL, corrector_thread, cargs + i );
@@ -1750,40 +2562,50 @@ int main( int argc, char* argv[] )
         pthread_join( threads[ i ], NULL );
     }
 
-    char* buf = New_Read_Buffer( &db );
-    int rb, re;
-    if ( block > 0 )
+    for ( i = 0; i < nThreads; i++ )
     {
-        DB_block_range( pcPathReadsIn, block, &rb, &re );
+        fclose( cargs[ i ].fileOvls );
+    }
+
+    if ( dbOut )
+    {
+        if ( verbose )
+        {
+            printf( "%d reads added to %s\n", queue.dbOut->nreads - queue.dbOut->ureads, pcBaseOut );
+        }
+
+        db_out_close( queue.dbOut );
+        free( fnameOut );
     }
     else
     {
-        rb = 0;
-        re = DB_NREADS( &db );
+        fclose( queue.fileOut );
     }
 
-    for ( i = rb; i < re; i++ )
+    // the output is complete
+
+    if ( queue.ckpt )
     {
-        int flags = db.reads[i].flags;
+        pass_checkpoint_free( queue.ckpt, 1 );
+    }
 
-        if ( (flags & READ_CORRECT) && !(flags & READ_CORRECTED) )
-        {
-            FILE* fileOut = cargs[ i % nThreads ].fileOut;
+    if ( verbose )
+    {
+        uint64 hits, misses;
 
-            Load_Read( &db, i, buf, 1 );
+        rc_stats( rcache, &hits, &misses );
 
-            fprintf( fileOut, ">copy.%d source=%d,%d,%d\n", i, i, -1, -1 );
-            write_seq( fileOut, buf );
-        }
+        printf( "read cache: %llu hits %llu misses\n", (unsigned long long)hits, (unsigned long long)misses );
     }
-    free( buf - 1 );
 
-    for ( i = 0; i < nThreads; i++ )
-    {
-        fclose( cargs[ i ].fileOvls );
-        fclose( cargs[ i ].fileOut );
-        fclose( cargs[ i ].db.bases );
-    }
+    rc_free( rcache );
+
+    pthread_mutex_destroy( &( queue.lock ) );
+
+    free( queue.offsets );
+    free( queue.rb );
+    free( queue.out );
+    free( queue.done );
 
     free( cargs );
     free( threads );
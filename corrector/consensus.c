@@ -4,11 +4,17 @@
 #include <string.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "consensus.h"
 #include "lib/colors.h"
 
 #define CONS_MIN_COV_FRACTION   0.5 // base calling threshold
 
+#define NO_BASE                 0xff // profile column without a majority base
+
 #undef DEBUG_SHOW_ADD
 
 typedef struct
@@ -29,10 +35,10 @@ typedef struct
 } v3_consensus_alignment;
 
 
-static int match(char* a, int ia, profile_entry* p, int ip)
-{
-    profile_entry* pEntry = (p + ip);
+// majority base of a profile column, or NO_BASE if the dash wins
 
+static unsigned char profile_base(profile_entry* pEntry)
+{
     char nMax = pEntry->counts[0];
     char cMax = 0;
     char nCount;
@@ -49,9 +55,57 @@ static int match(char* a, int ia, profile_entry* p, int ip)
     if (nCount > nMax ) { nMax = nCount; cMax = 3; }
 
     nCount = pEntry->counts[4];
-    if (nCount >= nMax ) { return 0; }
+    if (nCount >= nMax ) { return NO_BASE; }
+
+    return cMax;
+}
 
-    return (cMax == a[ia]);
+static void profile_bases(consensus* c)
+{
+    v3_consensus_alignment_ctx* pCtx = c->aln_ctx;
+
+    if (c->curprof > pCtx->maxbase)
+    {
+        pCtx->maxbase = 1.2 * c->curprof + 100;
+        pCtx->Abase = (unsigned char*)realloc(pCtx->Abase, pCtx->maxbase);
+    }
+
+    int i;
+    for (i = 0; i < c->curprof; i++)
+    {
+        pCtx->Abase[i] = profile_base(c->profile + i);
+    }
+}
+
+// extends the match of b against the profile bases a from j up to n
+
+static inline int snake(char* b, unsigned char* a, int j, int n)
+{
+#ifdef __SSE2__
+    if (j >= 0)
+    {
+        while (j + 16 <= n)
+        {
+            __m128i vb = _mm_loadu_si128((__m128i*)(b + j));
+            __m128i va = _mm_loadu_si128((__m128i*)(a + j));
+            int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+
+            if (mask)
+            {
+                return j + __builtin_ctz(mask);
+            }
+
+            j += 16;
+        }
+    }
+#endif
+
+    while (j < n && a[j] == (unsigned char)b[j])
+    {
+        j += 1;
+    }
+
+    return j;
 }
 
 static int v3_align_onp(v3_consensus_alignment* pAlign,
@@ -59,6 +113,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
 {
     int**  PVF = pAlign->pCtx->PVF; // wave->PVF;
     int**  PHF = pAlign->pCtx->PHF; // wave->PHF;
+    unsigned char* Abase = pAlign->pCtx->Abase + (A - pAlign->pCtx->Aabs);
     int    D;
     int    del = M - N;
 
@@ -95,7 +150,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
         {
             int   k, i, j;
             int   am, ac, ap;
-            profile_entry* a;
+            unsigned char* a;
 
             F2 = F1;
             F1 = F0;
@@ -132,15 +187,13 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
       }                             \
                                     \
   if (N < i)                        \
-    while (j < N && match(B,j,a,j)) \
-      j += 1;                       \
+    j = snake(B, a, j, N);          \
   else                              \
-    while (j < i && match(B,j,a,j)) \
-      j += 1;                       \
+    j = snake(B, a, j, i);          \
   F0[k] = j;
 
             j = -2;
-            a = A + hgh;
+            a = Abase + hgh;
             i = M - hgh;
 
             for (k = hgh; k > del; k--)
@@ -153,7 +206,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
             }
 
             j = -2;
-            a = A + low;
+            a = Abase + low;
             i = M - low;
 
             for (k = low; k < del; k++)
@@ -178,7 +231,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
 
     {
         int   k, h, m, e, c;
-        profile_entry* a;
+        unsigned char* a;
         int   ap = (pAlign->pCtx->Aabs - A) - 1; // (wave->Aabs - A) - 1;
         int   bp = (B - pAlign->pCtx->Babs) + 1; // (B - wave->Babs) + 1;
 
@@ -208,7 +261,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
 
             if (h < k)       // => e = -1 or 2
             {
-                a = A + k;
+                a = Abase + k;
 
                 if (k < 0)
                 {
@@ -224,7 +277,7 @@ static int v3_align_onp(v3_consensus_alignment* pAlign,
                     c = PVF[D][h] - 1;
                 }
 
-                while (c >= m && match(B,c,a,c)) // a[c] == B[c])
+                while (c >= m && a[c] == (unsigned char)B[c])
                 {
                     c -= 1;
                 }
@@ -537,11 +590,19 @@ consensus* consensus_init()
     c->seq = NULL;
     c->nseq = 0;
 
+    c->stop = 0;
+    c->stable = 0;
+    c->prev = NULL;
+    c->nprev = 0;
+    c->maxprev = 0;
+
     c->aln_ctx = (v3_consensus_alignment_ctx*)malloc(sizeof(v3_consensus_alignment_ctx));
     c->aln_ctx->ntrace = 0;
     c->aln_ctx->trace = NULL;
     c->aln_ctx->vecmax = 0;
     c->aln_ctx->vector = NULL;
+    c->aln_ctx->maxbase = 0;
+    c->aln_ctx->Abase = NULL;
 
     return c;
 }
@@ -552,10 +613,12 @@ void consensus_free(consensus* c)
 
     free(c->aln_ctx->trace);
     free(c->aln_ctx->vector);
+    free(c->aln_ctx->Abase);
 
     free(c->aln_ctx);
 
     free(c->seq);
+    free(c->prev);
     free(c);
 }
 
@@ -614,6 +677,37 @@ void consensus_reset(consensus* c)
 {
     c->curprof = 0;
     c->added = 0;
+    c->stable = 0;
+    c->nprev = 0;
+}
+
+// count the adds in a row after which the consensus sequence stayed the same
+
+static void consensus_track(consensus* c)
+{
+    if (c->stop <= 0)
+    {
+        return;
+    }
+
+    char* seq = consensus_sequence(c, 0);
+    int len = strlen(seq);
+
+    if (c->added > 1 && len == c->nprev && memcmp(seq, c->prev, len) == 0)
+    {
+        c->stable++;
+        return;
+    }
+
+    if (len >= c->maxprev)
+    {
+        c->maxprev = 1.2 * len + 100;
+        c->prev = (char*)realloc(c->prev, c->maxprev);
+    }
+
+    memcpy(c->prev, seq, len);
+    c->nprev = len;
+    c->stable = 0;
 }
 
 static void consensus_add_first(consensus* c, char* seq, int len)
@@ -628,7 +722,9 @@ static void consensus_add_first(consensus* c, char* seq, int len)
     }
 
     c->curprof = len;
-    bzero(c->profile, sizeof(profile_entry)*c->maxprof);
+
+    // consensus_add writes the entries past curprof before using them
+    bzero(c->profile, sizeof(profile_entry)*len);
 
     int i;
     for (i = 0; i < len; i++)
@@ -654,6 +750,7 @@ void consensus_add(consensus* cns, char* seq, int sb, int se) // , int pb, int p
     {
         consensus_add_first(cns, seq+sb, se-sb);
         cns->added++;
+        consensus_track(cns);
 
         // consensus_print_profile(cns, stdout);
 
@@ -675,6 +772,8 @@ void consensus_add(consensus* cns, char* seq, int sb, int se) // , int pb, int p
     aln.abpos = 0;
     aln.aepos = cns->curprof;
 
+    profile_bases(cns);
+
     assert( aln.bbpos >= 0 );
     assert( aln.bbpos < aln.bepos );
 
@@ -788,6 +887,7 @@ void consensus_add(consensus* cns, char* seq, int sb, int se) // , int pb, int p
     cns->curprof += aln.diffs_a;
 
     cns->added++;
+    consensus_track(cns);
 
     // consensus_print_profile(cns, stdout, 1);
 
@@ -798,6 +898,18 @@ int consensus_added(consensus* c)
     return c->added;
 }
 
+// consider the consensus stable once adds in a row did not change it
+
+void consensus_stop(consensus* c, int adds)
+{
+    c->stop = adds;
+}
+
+int consensus_stable(consensus* c)
+{
+    return (c->stop > 0 && c->stable >= c->stop);
+}
+
 char* consensus_sequence(consensus* c, int dashes)
 {
     profile_entry* pEntry;
@@ -22,6 +22,9 @@ typedef struct
     int** PHF;
 
     profile_entry* Aabs;
+
+    unsigned char* Abase;   // majority base of each profile column
+    int maxbase;
 } v3_consensus_alignment_ctx;
 
 typedef struct
@@ -37,6 +40,12 @@ typedef struct
 
     int added;
 
+    int stop;        // adds in a row that leave the consensus unchanged to make it stable, 0 for never
+    int stable;      // adds in a row that did
+    char* prev;      // consensus before them
+    int nprev;
+    int maxprev;
+
     v3_consensus_alignment_ctx* aln_ctx;
 } consensus;
 
@@ -52,3 +61,7 @@ char* consensus_sequence(consensus* c, int dashes);
 void consensus_print_profile(consensus* c, FILE* fileOut, int colorize);
 
 int consensus_added(consensus* c);
+
+void consensus_stop(consensus* c, int adds);
+
+int consensus_stable(consensus* c);
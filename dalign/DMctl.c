@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <glob.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,14 +19,143 @@ static void usage( FILE* fout, const char* app )
 
     fprintf( fout, "Interact with the dynamic masking server.\n\n" );
 
-    fprintf( fout, "options: -h  masking server host (%s)\n", DEF_ARG_H );
+    fprintf( fout, "options: -h  masking server host (%s), host[:port],... for all shards of a sharded server\n", DEF_ARG_H );
     fprintf( fout, "         -p  masking server port (%d)\n\n", DEF_ARG_P );
 
     fprintf( fout, "commands: shutdown        initiate shutdown of the dynamic masking server\n" );
     fprintf( fout, "          lock            disable coverage statistics updates\n" );
     fprintf( fout, "          unlock          enable coverage statistics updates\n" );
     fprintf( fout, "          track           write track(s)\n" );
-    fprintf( fout, "          done [dir|input.las ...]  send done signal for all overlap files in dir or a list of las file\n" );
+    fprintf( fout, "          done [dir|input.las|pattern|@list|- ...]  send done signal for all overlap files in dir or a list of las file\n" );
+    fprintf( fout, "                          quoted glob patterns are expanded, @list and - read one path per line from a file or stdin\n" );
+}
+
+typedef struct
+{
+    char** files;
+    int maxf;
+    int curf;
+} FileList;
+
+// adds path if it has the .las extension
+
+static void add_file( FileList* fl, const char* path )
+{
+    int len = strlen( path );
+
+    if ( ( len < 4 ) || ( strcasecmp( path + ( len - 4 ), ".las" ) != 0 ) )
+    {
+        return;
+    }
+
+    if ( fl->curf + 1 >= fl->maxf )
+    {
+        fl->maxf  = fl->maxf * 1.2 + 10;
+        fl->files = (char**)realloc( fl->files, sizeof( char* ) * fl->maxf );
+    }
+
+    fl->files[ fl->curf++ ] = strdup( path );
+}
+
+static void add_list( FileList* fl, FILE* fin )
+{
+    char* line  = NULL;
+    size_t maxl = 0;
+    ssize_t len;
+
+    while ( ( len = getline( &line, &maxl, fin ) ) != -1 )
+    {
+        while ( len > 0 && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' ) )
+        {
+            line[ --len ] = '\0';
+        }
+
+        if ( len > 0 )
+        {
+            add_file( fl, line );
+        }
+    }
+
+    free( line );
+}
+
+static void add_dir( FileList* fl, const char* dir )
+{
+    DIR* dp = opendir( dir );
+    struct dirent* ep;
+
+    if ( dp == NULL )
+    {
+        perror( "Couldn't open the directory" );
+        return;
+    }
+
+    while ( ( ep = readdir( dp ) ) )
+    {
+        char* path = malloc( strlen( dir ) + strlen( ep->d_name ) + 2 );
+
+        sprintf( path, "%s/%s", dir, ep->d_name );
+        add_file( fl, path );
+
+        free( path );
+    }
+
+    closedir( dp );
+}
+
+static void add_argument( FileList* fl, const char* arg )
+{
+    struct stat sb;
+
+    if ( strcmp( arg, "-" ) == 0 )
+    {
+        add_list( fl, stdin );
+    }
+    else if ( arg[ 0 ] == '@' )
+    {
+        FILE* fin = fopen( arg + 1, "r" );
+
+        if ( fin == NULL )
+        {
+            fprintf( stderr, "warning: failed to open list %s\n", arg + 1 );
+            return;
+        }
+
+        add_list( fl, fin );
+        fclose( fin );
+    }
+    else if ( stat( arg, &sb ) == -1 )
+    {
+        // not a file, might be a pattern the shell didn't expand
+
+        glob_t g;
+
+        if ( glob( arg, 0, NULL, &g ) != 0 )
+        {
+            fprintf( stderr, "warning: file %s is not accepted!\n", arg );
+            return;
+        }
+
+        size_t i;
+        for ( i = 0; i < g.gl_pathc; i++ )
+        {
+            add_file( fl, g.gl_pathv[ i ] );
+        }
+
+        globfree( &g );
+    }
+    else if ( S_ISDIR( sb.st_mode ) )
+    {
+        add_dir( fl, arg );
+    }
+    else if ( S_ISREG( sb.st_mode ) )
+    {
+        add_file( fl, arg );
+    }
+    else
+    {
+        fprintf( stderr, "warning: file %s is not accepted!\n", arg );
+    }
 }
 
 int main( int argc, char* argv[] )
@@ -70,7 +200,7 @@ int main( int argc, char* argv[] )
     }
 
     char* command   = argv[ optind++ ];
-    DynamicMask* dm = dm_init( host, port );
+    DynamicMask* dm = dm_init_shards( host, port );
 
     if ( dm == NULL )
     {
@@ -100,87 +230,29 @@ int main( int argc, char* argv[] )
     }
     else if ( strcasecmp( command, "done" ) == 0 )
     {
-        char** files;
-        int maxf = 100;
-        int curf = 0;
-        int i, len, dirLen;
+        FileList fl;
+        int i;
 
-        files = (char**)malloc( sizeof( char* ) * maxf );
+        fl.maxf  = 100;
+        fl.curf  = 0;
+        fl.files = (char**)malloc( sizeof( char* ) * fl.maxf );
 
         while ( argc - optind > 0 )
         {
-            struct stat sb;
-            stat( argv[ optind ], &sb );
-
-            if ( S_ISDIR( sb.st_mode ) )
-            {
-                DIR* dp;
-                struct dirent* ep;
-                dp = opendir( argv[ optind ] );
-
-                if ( dp != NULL )
-                {
-                    dirLen = strlen( argv[ optind ] );
-                    while ( ( ep = readdir( dp ) ) )
-                    {
-                        if ( curf == maxf )
-                        {
-                            maxf  = maxf * 1.2 + 10;
-                            files = (char**)realloc( files, sizeof( char* ) * maxf );
-                        }
-                        len = strlen( ep->d_name );
-                        // check for las file name extension
-                        if ( ( len < 4 ) || ( ( strcasecmp( ep->d_name + ( len - 4 ), ".las" ) != 0 ) ) )
-                            continue;
-
-                        files[ curf ] = (char*)malloc( dirLen + len + 20 );
-                        sprintf( files[ curf ], "%s/%s", argv[ optind ], ep->d_name );
-                        curf++;
-                    }
-                    (void)closedir( dp );
-                }
-                else
-                    perror( "Couldn't open the directory" );
-            }
-            else if ( S_ISREG( sb.st_mode ) )
-            {
-                if ( curf == maxf )
-                {
-                    maxf  = maxf * 1.2 + 10;
-                    files = (char**)realloc( files, sizeof( char* ) * maxf );
-                }
-                len = strlen( argv[ optind ] );
-                if ( ( len > 4 ) && ( ( strcasecmp( argv[ optind ] + ( len - 4 ), ".las" ) == 0 ) ) )
-                {
-                    files[ curf ] = (char*)malloc( len + 10 );
-                    memcpy( files[ curf ], argv[ optind ], len );
-                    files[ curf ][ len ] = '\0';
-                    curf++;
-                }
-            }
-            else
-            {
-                fprintf( stderr, "warning: file %s is not accepted!\n", argv[ optind ] );
-            }
+            add_argument( &fl, argv[ optind ] );
             optind++;
         }
 
-        files[ curf ] = NULL;
+        fl.files[ fl.curf ] = NULL;
 
-        //        i = 0;
-        //        while (files[i] != NULL)
-        //          {
-        //            printf("file[%d]: %s\n", i, files[i]);
-        //            i++;
-        //          }
-        //        exit(1);
+        // all of them are sent at once, the server orders the batch by block
 
-        if ( !dm_done( dm, files ) )
+        if ( !dm_done( dm, fl.files ) )
             fprintf( stderr, "server did not get results\n" );
 
-        for ( i = 0; i < curf; i++ )
-            free( files[ i ] );
-        free( files );
+        for ( i = 0; i < fl.curf; i++ )
+            free( fl.files[ i ] );
+        free( fl.files );
     }
     else
     {
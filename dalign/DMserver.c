@@ -11,7 +11,9 @@
         - start dmask_server with db, expected coverage and optional checkpoint file
         - server listenes on <port> (argument -p) for messages
         - daligner jobs connect to server and retrieve mask track for the block to be processed
-        - finished daligner jobs report path of .las file to the dmask server
+        - finished daligner jobs report path of .las file to the dmask server. any number of paths
+          can be reported at once (DMctl done), each batch is queued diagonal first
+        - with -w <dir> the server queues the .las files written to dir itself
         - server processes .las files, updates coverage statistics and derives new mask track from it
         - regions of reads receiving an excess of coverage are masked
         - on server shutdown a mask track is written to disk
@@ -21,9 +23,21 @@
         - to resume from a checkpoint drop the suffix, the server will resume from the file automatically
           on startup
         - amount of worker threads for processing .las files can be set using -t <threads>
+        - with -D the server hands out the block pairs to daligner workers started with -d
+          instead of a static plan, see dispatch_pick
+        - with -S <shard>/<shards> the blocks are split into contiguous ranges among several
+          servers, each keeping the coverage of its reads only. daligner -D is given all of them
+          as host:port,host:port,... and the checkpoints and the per-block mask tracks written by
+          the shards are merged with TKmerge
+        - with -M <store> the coverage statistics live in a memory mapped file, which is synced
+          every -c <minutes>. a restarted server maps it again instead of reading a checkpoint.
+          it is tied to the db, shard and -q it was created with
 
     memory usage:
         50x human genome needs roughly 20GB of memory
+        with -q <width> the coverage of a read is kept as 4 bit levels for segments of <width> bases
+        until any of its segments exceeds the masking threshold, only those reads keep the exact
+        run-length encoded coverage. bases of the compact reads cost 1/(2*width) bytes.
 
     CPU/IO requirements:
         .las files are large initially when no repeat regions have been masked
@@ -34,25 +48,34 @@
 */
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #if defined( __APPLE__ )
+#include <sys/event.h>
 #include <sys/syslimits.h>
 #else
 #include <linux/limits.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #endif
 
+#include "lib/compression.h"
 #include "lib/dmask.h"
 #include "lib/dmask_proto.h"
 #include "lib/oflags.h"
@@ -62,20 +85,46 @@
 
 #define DEF_ARG_P DMASK_DEFAULT_PORT
 #define DEF_ARG_T 4  // worker threads
+#define DEF_ARG_S 2  // threads answering track requests
 #define DEF_ARG_C 10 // checkpoint intervals (min)
 #define DEF_ARG_U 10 // track update (min)
 #define DEF_ARG_R 10 // report every (min)
 #define DEF_ARG_CC 0 // mask contained reads completely
 #define DEF_ARG_E 0  // no repeat masking n bases from the read ends
+#define DEF_ARG_Q 0  // exact coverage for all reads
 
-#define COV_LOCK_GRANULARITY 4 // must be a power of 2
+#define COV_LOCK_STRIPES 4096 // must be a power of 2, reads are assigned round-robin
 
 #define MAX_COV 255
 
-#define BACKLOG 20 // Passed to listen()
+#define Q_LEVELS 16 // coverage levels of compact reads (4 bits)
+
+#define CHECKPOINT_COMPACT -2 // in place of nreads, marks checkpoints containing compact reads
+#define CHECKPOINT_SHARD -3   // precedes the read range of the checkpoints of a shard
+
+#define DIRTY_TRACK 0x1      // coverage changed since the last track update
+#define DIRTY_CHECKPOINT 0x2 // coverage changed since the last checkpoint
+
+#define BACKLOG 128 // Passed to listen()
+
+#define MAX_EVENTS 64                    // socket events handled per poller wakeup
+#define MAX_MESSAGE ( 64 * 1024 * 1024 ) // connections announcing larger messages are dropped
+#define SEND_TIMEOUT ( 60 * 1000 )       // ms a response waits for a client to drain its socket
+
+#if defined( MSG_NOSIGNAL )
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
 
 #define COV_FACTOR_THRESHOLD 2 // mask if more than 2 times expected coverage
 
+#define PAIR_OPEN 0
+#define PAIR_BUSY 1
+#define PAIR_DONE 2
+
+#define DISPATCH_BAND 2 // a worker keeps its A block for pairs at most this much further from the diagonal than the front
+
 #define REPORT_INTERVALS "dmask.report.txt"
 
 #define SEMAPHORE_FILL_COUNT_PREFIX "sem.queue.fill.count" // semaphore name prefix
@@ -89,6 +138,9 @@ typedef struct _WorkerContext WorkerContext;
 typedef struct _WorkQueueItem WorkQueueItem;
 typedef struct _ReadCoverageRle ReadCoverageRle;
 typedef struct _ReadCoverage ReadCoverage;
+typedef struct _Connection Connection;
+typedef struct _ResponseJob ResponseJob;
+typedef struct _CovStore CovStore;
 
 struct _WorkQueueItem
 {
@@ -96,6 +148,35 @@ struct _WorkQueueItem
     WorkQueueItem* next;
 };
 
+/*
+    client connection, messages are collected from the non-blocking socket
+    until complete
+*/
+struct _Connection
+{
+    int sock;
+    int refs;                  // listener and queued responses, guarded by conn_lock
+    pthread_mutex_t send_lock; // one response at a time
+
+    DmHeader header; // of the message being received
+    char* data;      // message being received, header followed by its data
+    uint64 dmax;
+    uint64 dcur;
+
+    int pair_a; // block pair handed out to the client, 0 if none
+    int pair_b;
+};
+
+/*
+    track request waiting for a responder thread
+*/
+struct _ResponseJob
+{
+    Connection* conn;
+    DmHeader header;
+    ResponseJob* next;
+};
+
 struct _ReadCoverageRle
 {
     unsigned char value;
@@ -128,6 +209,8 @@ struct _WorkerContext
 
     ReadCoverage cov_temp; // temporary location outside ServerContext for reduced (un)locking
 
+    uint64 q_rng; // random state for rounding compact coverage
+
     uint32 trace_max; // allocated elements for trace
     uint32 trace_cur; // next free element in trace
     ovl_trace* trace; // overlap trace points
@@ -141,15 +224,12 @@ struct _ServerContext
     HITS_DB* db;  // database
     uint64 bases; // number of bases in the db
 
-    // socket buffer
-    char* data; // socket input buffer
-    int dmax;   // buffer size
-
     // threads
     pthread_t thread_socket_listener;
     pthread_t thread_reporter;
     pthread_t thread_track;
     pthread_t thread_checkpoint;
+    pthread_t thread_watch;
 
     // work queue
     WorkQueueItem* queue_start; // global work queue containing .las files
@@ -159,15 +239,35 @@ struct _ServerContext
     char* path_sem_fill_count;
     int queue_len;
 
+    // directories watched for .las files (-w)
+    char** watch;  // their real paths
+    int* watch_wd; // inotify watch descriptors
+    int nwatch;
+    int watch_fd;
+
+    // track requests, answered by the responder threads
+    ResponseJob* resp_start;
+    ResponseJob* resp_end;
+    pthread_mutex_t resp_lock;
+    pthread_cond_t resp_cond;
+
+    pthread_mutex_t conn_lock; // connection reference counts
+
     // coverage statistics
     ReadCoverage* cov; // coverage statistics for each read
     int cov_changed;   // have the coverage stats changed since the last update_track call
+    unsigned char* cov_dirty; // DIRTY_xxx flags of each read, guarded by the read's cov lock
     // pthread_mutex_t cov_lock;               // lock for cov and cov_changed
 
-    pthread_mutex_t cov_locks[ COV_LOCK_GRANULARITY ];
+    pthread_mutex_t cov_locks[ COV_LOCK_STRIPES ];
 
-    uint32 lock_mask;
-    uint32 lock_shift;
+    // compact coverage (-q), used for reads without run-length encoded coverage
+    int q_width;           // bases per segment, 0 if disabled
+    int q_step;            // coverage per level
+    uint64* q_off;         // offset of each read's segments in q_data
+    unsigned char* q_data; // levels, two segments per byte
+
+    CovStore* store; // memory mapped coverage (-M), NULL if kept on the heap
 
     // track data
     uint64 t_dmax;
@@ -175,13 +275,42 @@ struct _ServerContext
     track_data* t_data;
     pthread_mutex_t t_lock;
 
+    // track versions for delta requests
+    uint64 t_epoch;         // identifies the server instance
+    uint64 t_version;       // bumped by each track update that changes intervals
+    uint64* t_rversion;     // version of the last change of each read
+    uint64 t_pdmax;
+    track_anno* t_panno;    // track before the update
+    track_data* t_pdata;
+
+    // block pairs handed out to daligner workers (-D), only used by the socket listener
+    int d_blocks;           // 0 if disabled
+    unsigned char* d_state; // PAIR_xxx of A block a and B block b <= a at a * ( d_blocks + 1 ) + b
+    int* d_held;            // workers holding a pair of each A block
+    uint64 d_open;          // pairs not handed out
+    uint64 d_busy;          // handed out and not finished
+
+    // reads owned by the server, all unless it is one of several shards (-S)
+    int shard;   // 1..shards, 0 if not sharded
+    int shards;
+    int r_block; // first and last block of the shard
+    int r_lblock;
+    int* r_bfirst; // first read of the blocks r_block..r_lblock+1
+    int r_first;   // reads r_first..r_last-1
+    int r_last;
+
     // command line arguments
     int cov_expected;
     int port;
     int worker_threads;
+    int responder_threads;
     char* checkpoint;
+    char* store_path;
 
     int checkpoint_suffix;
+    char* checkpoint_prev;   // last checkpoint written, records of clean reads are copied from it
+    uint64* checkpoint_off;  // file offsets of the reads' records in checkpoint_prev
+    uint64* checkpoint_noff; // offsets of the checkpoint being written
     int shutdown;
     int report_intervals; // write detailed intervals to disk with next report
     int lock;             // don't update coverage statistics
@@ -192,6 +321,8 @@ struct _ServerContext
 
     int mask_contained;
     int keep_ends; // keep n bases at the read ends not masked
+
+    int cov_threshold; // mask if coverage is above
 };
 
 /*
@@ -201,15 +332,15 @@ struct _ServerContext
 
 ServerContext* g_sctx;
 
-#define rid2lock( rid ) ( ( rid ) >> g_sctx->lock_shift )
-
 /*
-static int rid2lock(uint32 rid)
-{
-    return ( rid >> g_sctx->lock_shift );
-}
+    the coverage of a read is guarded by one of COV_LOCK_STRIPES locks. consecutive reads,
+    which are the A-reads of the same .las file, use different stripes.
 */
 
+#define rid2lock( rid ) ( ( rid ) & ( COV_LOCK_STRIPES - 1 ) )
+
+#define owns_read( ctx, rid ) ( ( rid ) >= ( ctx )->r_first && ( rid ) < ( ctx )->r_last )
+
 static void queue_add( ServerContext* ctx, char* path )
 {
     WorkQueueItem* item = (WorkQueueItem*)malloc( sizeof( WorkQueueItem ) );
@@ -250,6 +381,171 @@ static char* queue_remove( ServerContext* ctx )
     return path;
 }
 
+/*
+    daligner names its .las files <db>.<a>.<db>.<b>.las, merged ones are <db>.<a>.las.
+    a batch of files is queued diagonal first, then by increasing distance of the blocks,
+    so the highly repetitive regions get masked early. files without block numbers are
+    queued last in the order received.
+*/
+
+typedef struct
+{
+    char* path;
+    int dist; // |a - b|, INT_MAX if the blocks are unknown
+    int a;
+    int b;
+    int idx; // position in the batch
+} QueuedPath;
+
+static int las_blocks( const char* path, int* a, int* b )
+{
+    const char* name = strrchr( path, '/' );
+    const char* end  = path + strlen( path );
+    int nblocks      = 0;
+
+    name = name ? name + 1 : path;
+
+    if ( end - name > 4 && strcmp( end - 4, ".las" ) == 0 )
+    {
+        end -= 4;
+    }
+
+    // the last two numeric components of the name
+
+    while ( name < end )
+    {
+        const char* dot = memchr( name, '.', end - name );
+        const char* c;
+
+        if ( dot == NULL )
+        {
+            dot = end;
+        }
+
+        for ( c = name; c < dot && *c >= '0' && *c <= '9'; c++ )
+        {
+        }
+
+        if ( c == dot && c > name )
+        {
+            *a = *b;
+            *b = atoi( name );
+            nblocks++;
+        }
+
+        name = dot + 1;
+    }
+
+    if ( nblocks == 1 )
+    {
+        *a = *b;
+    }
+
+    return MIN( nblocks, 2 );
+}
+
+static int cmp_queued_paths( const void* x, const void* y )
+{
+    const QueuedPath* p = (const QueuedPath*)x;
+    const QueuedPath* q = (const QueuedPath*)y;
+
+    if ( p->dist != q->dist )
+    {
+        return ( p->dist < q->dist ) ? -1 : 1;
+    }
+
+    if ( p->a != q->a )
+    {
+        return p->a - q->a;
+    }
+
+    if ( p->b != q->b )
+    {
+        return p->b - q->b;
+    }
+
+    return p->idx - q->idx;
+}
+
+// queues the NULL separated paths in data
+
+static void queue_add_paths( ServerContext* ctx, char* data, uint64 dlen )
+{
+    if ( ctx->lock )
+    {
+        printf( "updates locked, ignoring available .las files\n" );
+        return;
+    }
+
+    uint64 i, beg;
+    int npaths = 0;
+
+    for ( i = 0; i < dlen; i++ )
+    {
+        if ( data[ i ] == '\0' )
+        {
+            npaths++;
+        }
+    }
+
+    QueuedPath* paths = malloc( sizeof( QueuedPath ) * ( npaths + 1 ) );
+    int n             = 0;
+
+    for ( i = beg = 0; i < dlen; i++ )
+    {
+        if ( data[ i ] != '\0' )
+        {
+            continue;
+        }
+
+        QueuedPath* qp = paths + n;
+        int a = 0, b = 0;
+
+        if ( i - beg > PATH_MAX )
+        {
+            fprintf( stderr, "ignoring .las file with a path exceeding %d characters\n", PATH_MAX );
+        }
+        else
+        {
+            qp->path = data + beg;
+            qp->idx  = n;
+
+            if ( las_blocks( qp->path, &a, &b ) )
+            {
+                qp->dist = abs( a - b );
+                qp->a    = MIN( a, b );
+                qp->b    = MAX( a, b );
+            }
+            else
+            {
+                qp->dist = INT_MAX;
+                qp->a = qp->b = 0;
+            }
+
+            n++;
+        }
+
+        beg = i + 1;
+    }
+
+    qsort( paths, n, sizeof( QueuedPath ), cmp_queued_paths );
+
+    pthread_mutex_lock( &( ctx->queue_lock ) );
+
+    int k;
+    for ( k = 0; k < n; k++ )
+    {
+        queue_add( ctx, paths[ k ].path );
+        sem_post( ctx->queue_fill_count );
+
+        printf( "QUEUE LEN %3d ADD %s\n", ctx->queue_len, paths[ k ].path );
+    }
+
+    pthread_mutex_unlock( &( ctx->queue_lock ) );
+
+    free( paths );
+}
+
 static int cmp_ovls( const void* a, const void* b )
 {
     Overlap* x = *(Overlap**)a;
@@ -325,185 +621,809 @@ static int rle_unpack( unsigned char* unpacked, ReadCoverageRle* packed )
     return j;
 }
 
-static void mask_contained_read( WorkerContext* wctx, int aread, int alen )
+/*
+    coverage store (-M)
+
+    the run-length encoded coverage of the owned reads and the compact coverage are kept in a
+    memory mapped file, a restarted server just maps it again and checkpoints reduce to msync.
+
+    file layout, all offsets are from the start of the file
+
+        CovStoreHeader      padded to a page
+        CovStoreSlot        for each read of the db
+        compact coverage    q_off[ nreads ] bytes, padded to a page
+        arena               slots of 2^k ReadCoverageRle, k >= STORE_MIN_CLASS
+
+    a read's coverage is rewritten in place if it fits its slot, otherwise it moves to a
+    larger one. freed slots are kept in a list for each size class, linked through their
+    first 8 bytes. the file grows in STORE_GROW steps within a mapping reserved on open.
+*/
+
+#define STORE_MAGIC 0x564f434d // MCOV
+#define STORE_VERSION 1
+
+#define STORE_OPEN 1   // in use by a server, found on open after a crash
+#define STORE_CLOSED 2
+
+#define STORE_CLASSES 32
+#define STORE_MIN_CLASS 2 // 4 elements
+#define STORE_GROW ( 256ULL * 1024 * 1024 )
+
+typedef struct
 {
-    ServerContext* sctx = wctx->sctx;
-    int unpack          = 0;
-    int lock = rid2lock( aread ); // aread & ( COV_LOCK_GRANULARITY - 1 );
+    uint32 magic;
+    uint32 version;
+    int32 nreads;
+    int32 r_first;
+    int32 r_last;
+    int32 q_width;
+    int32 q_step;
+    int32 state;
+
+    uint64 table; // offsets of the slot table
+    uint64 q;     // the compact coverage
+    uint64 arena; // and the arena
+    uint64 used;  // end of the allocated part of the arena
+    uint64 free[ STORE_CLASSES ]; // first free slot of each size class, 0 if none
+} CovStoreHeader;
+
+typedef struct
+{
+    uint64 off; // of the read's coverage, 0 if it has none
+    uint64 cap; // elements of the slot
+} CovStoreSlot;
 
-    if ( sctx->db->reads[ aread ].flags )
-    {
-        return;
-    }
+struct _CovStore
+{
+    int fd;
+    char* base;
+    uint64 size;    // of the file
+    uint64 maxsize; // of the mapping
 
-    pthread_mutex_lock( sctx->cov_locks + lock );
+    CovStoreHeader* header;
+    CovStoreSlot* slots;
 
-    sctx->db->reads[ aread ].flags = 1;
+    pthread_mutex_t lock; // slot allocation
+};
+
+#define STORE_ALIGN( n, a ) ( ( ( n ) + ( a ) - 1 ) / ( a ) * ( a ) )
+
+static int store_class( uint64 n )
+{
+    int k = STORE_MIN_CLASS;
 
-    // TODO --- redundant ... fix
-    // pthread_mutex_lock( &(sctx->cov_lock) );
+    while ( ( 1ULL << k ) < n )
     {
-        if ( sctx->cov[ aread ].data != NULL )
-        {
-            memcpy( wctx->cov_temp.data, sctx->cov[ aread ].data, sctx->cov[ aread ].dmax * sizeof( ReadCoverageRle ) );
-            unpack = 1;
-        }
+        k++;
     }
-    // pthread_mutex_unlock( &(sctx->cov_lock) );
 
-    if ( unpack )
+    return k;
+}
+
+static void store_grow( CovStore* store, uint64 size )
+{
+    if ( size > store->maxsize )
     {
-        bzero( wctx->read_cov_temp, sizeof( unsigned char ) * alen );
-        rle_unpack( wctx->read_cov_temp, wctx->cov_temp.data );
+        fprintf( stderr, "coverage store exceeds its reserved %llu bytes\n", store->maxsize );
+        exit( 1 );
+    }
 
-        int i;
-        for ( i = 0; i < alen; i++ )
-        {
-            wctx->read_cov[ i ] = MAX_COV;
-        }
+    size = MIN( MAX( size, store->size + STORE_GROW ), store->maxsize );
+
+    if ( ftruncate( store->fd, size ) != 0 )
+    {
+        fprintf( stderr, "failed to grow coverage store to %llu bytes: %s\n", size, strerror( errno ) );
+        exit( 1 );
     }
 
-    size_t dcur = rle_pack( wctx->read_cov, alen, &( wctx->cov_temp.data ), &( wctx->cov_temp.dmax ) );
+    store->size = size;
+}
+
+// slot for at least n elements, called with the store locked
+
+static uint64 store_alloc( CovStore* store, uint64 n, uint64* cap )
+{
+    CovStoreHeader* header = store->header;
+    int k                  = store_class( n );
+    uint64 off             = header->free[ k ];
 
-    // pthread_mutex_lock( &(sctx->cov_lock) );
+    if ( off )
+    {
+        header->free[ k ] = *(uint64*)( store->base + off );
+    }
+    else
     {
-        if ( dcur >= sctx->cov[ aread ].dmax )
+        off = header->used;
+
+        if ( off + ( sizeof( ReadCoverageRle ) << k ) > store->size )
         {
-            sctx->cov[ aread ].dmax = dcur * 1.2 + 10;
-            sctx->cov[ aread ].data = realloc( sctx->cov[ aread ].data, sctx->cov[ aread ].dmax * sizeof( ReadCoverageRle ) );
+            store_grow( store, off + ( sizeof( ReadCoverageRle ) << k ) );
         }
 
-        memcpy( sctx->cov[ aread ].data, wctx->cov_temp.data, dcur * sizeof( ReadCoverageRle ) );
-
-        sctx->cov_changed = 1;
+        header->used = off + ( sizeof( ReadCoverageRle ) << k );
     }
-    // pthread_mutex_unlock( &(sctx->cov_lock) );
 
-    pthread_mutex_unlock( sctx->cov_locks + lock );
+    *cap = 1ULL << k;
+
+    return off;
 }
 
-static void update_coverage( WorkerContext* wctx, int aread, int alen )
+static void store_release( CovStore* store, uint64 off, uint64 cap )
 {
-    ServerContext* sctx = wctx->sctx;
-    int unpack          = 0;
+    int k = store_class( cap );
 
-    int lock = rid2lock( aread ); // aread & ( COV_LOCK_GRANULARITY - 1 );
+    *(uint64*)( store->base + off ) = store->header->free[ k ];
+    store->header->free[ k ]        = off;
+}
 
-    pthread_mutex_lock( sctx->cov_locks + lock );
+// write n elements of coverage for read, called with the read's cov lock held
 
-    // TODO --- redundant ... fix
-    // pthread_mutex_lock( &(sctx->cov_lock) );
-    {
-        if ( sctx->cov[ aread ].data != NULL )
-        {
-            memcpy( wctx->cov_temp.data, sctx->cov[ aread ].data, sctx->cov[ aread ].dmax * sizeof( ReadCoverageRle ) );
-            unpack = 1;
-        }
-    }
-    // pthread_mutex_unlock( &(sctx->cov_lock) );
+static void store_put( CovStore* store, ReadCoverage* cov, int read, ReadCoverageRle* data, int n )
+{
+    CovStoreSlot* slot = store->slots + read;
 
-    if ( unpack )
+    if ( (uint64)n > slot->cap )
     {
-        bzero( wctx->read_cov_temp, sizeof( unsigned char ) * alen );
-        rle_unpack( wctx->read_cov_temp, wctx->cov_temp.data );
+        uint64 cap;
 
-        int i;
-        for ( i = 0; i < alen; i++ )
+        pthread_mutex_lock( &( store->lock ) );
+
+        uint64 off = store_alloc( store, n, &cap );
+
+        pthread_mutex_unlock( &( store->lock ) );
+
+        memcpy( store->base + off, data, sizeof( ReadCoverageRle ) * n );
+
+        uint64 prev     = slot->off;
+        uint64 prev_cap = slot->cap;
+
+        slot->off = off;
+        slot->cap = cap;
+
+        cov->data = (ReadCoverageRle*)( store->base + off );
+        cov->dmax = cap;
+
+        if ( prev )
         {
-            uint32 cov = wctx->read_cov[ i ] + wctx->read_cov_temp[ i ];
+            pthread_mutex_lock( &( store->lock ) );
 
-            if ( cov > MAX_COV )
-            {
-                cov = MAX_COV;
-            }
+            store_release( store, prev, prev_cap );
 
-            wctx->read_cov[ i ] = cov;
+            pthread_mutex_unlock( &( store->lock ) );
         }
     }
+    else
+    {
+        memcpy( cov->data, data, sizeof( ReadCoverageRle ) * n );
+    }
+}
+
+// coverage of a read is usable if it is terminated within its slot and covers the read
 
-    size_t dcur = rle_pack( wctx->read_cov, alen, &( wctx->cov_temp.data ), &( wctx->cov_temp.dmax ) );
+static int store_check_read( ReadCoverageRle* rle, uint64 cap, int alen )
+{
+    uint64 i;
+    uint64 len = 0;
 
-    // pthread_mutex_lock( &(sctx->cov_lock) );
+    for ( i = 0; i < cap; i++ )
     {
-        if ( dcur >= sctx->cov[ aread ].dmax )
+        if ( rle[ i ].count == 0 )
         {
-            sctx->cov[ aread ].dmax = dcur * 1.2 + 10;
-            sctx->cov[ aread ].data = realloc( sctx->cov[ aread ].data, sctx->cov[ aread ].dmax * sizeof( ReadCoverageRle ) );
+            return ( len == (uint64)alen );
         }
 
-        memcpy( sctx->cov[ aread ].data, wctx->cov_temp.data, dcur * sizeof( ReadCoverageRle ) );
-
-        sctx->cov_changed = 1;
+        len += rle[ i ].count;
     }
-    // pthread_mutex_unlock( &(sctx->cov_lock) );
 
-    pthread_mutex_unlock( sctx->cov_locks + lock );
+    return 0;
 }
 
-static void write_mask_tracks( ServerContext* sctx )
+// after a crash the free lists and the end of the arena are rebuilt from the slot table
+
+static void store_recover( CovStore* store, HITS_DB* db )
 {
-    HITS_DB* db = sctx->db;
-    int nreads  = db->nreads;
+    CovStoreHeader* header = store->header;
+    uint64 used            = header->arena;
+    int reset              = 0;
+    int i;
 
-    track_anno* anno_r = malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
-    track_data* data_r = malloc( sctx->t_anno[ nreads ] );
-    int dcur_r         = 0;
+    fprintf( stderr, "coverage store was not closed, recovering\n" );
 
-    track_anno* anno_c = malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
-    track_data* data_c = malloc( 2 * sizeof( track_data ) * db->nreads );
-    int dcur_c         = 0;
+    bzero( header->free, sizeof( header->free ) );
 
-    int i;
-    for ( i = 0; i < nreads; i++ )
+    for ( i = header->r_first; i < header->r_last; i++ )
     {
-        track_anno beg = sctx->t_anno[ i ] / sizeof( track_data );
-        track_anno end = sctx->t_anno[ i + 1 ] / sizeof( track_data );
-
-        anno_r[ i ] = 0;
-        anno_c[ i ] = 0;
+        CovStoreSlot* slot = store->slots + i;
 
-        if ( db->reads[ i ].flags == 1 )
+        if ( slot->off == 0 )
         {
-            data_c[ dcur_c++ ] = 0;
-            data_c[ dcur_c++ ] = DB_READ_LEN( db, i );
-
-            anno_c[ i ] += 2 * sizeof( track_data );
+            continue;
         }
-        else
-        {
-            while ( beg < end )
-            {
-                track_data b = sctx->t_data[ beg ];
-                track_data e = sctx->t_data[ beg + 1 ];
 
-                data_r[ dcur_r++ ] = b;
-                data_r[ dcur_r++ ] = e;
+        if ( slot->off < header->arena || slot->cap < ( 1ULL << STORE_MIN_CLASS ) || ( slot->cap & ( slot->cap - 1 ) ) ||
+             slot->off + sizeof( ReadCoverageRle ) * slot->cap > store->size )
+        {
+            slot->off = slot->cap = 0;
+            reset++;
 
-                beg += 2;
-                anno_r[ i ] += 2 * sizeof( track_data );
-            }
+            continue;
         }
+
+        used = MAX( used, slot->off + sizeof( ReadCoverageRle ) * slot->cap );
     }
 
-    track_anno off_r = 0;
-    track_anno off_c = 0;
+    header->used = used;
 
-    for ( i = 0; i <= nreads; i++ )
+    // reads with damaged coverage restart with zero coverage
+
+    for ( i = header->r_first; i < header->r_last; i++ )
     {
-        track_anno tmp = anno_c[ i ];
-        anno_c[ i ]    = off_c;
-        off_c += tmp;
+        CovStoreSlot* slot = store->slots + i;
+        int alen           = DB_READ_LEN( db, i );
 
-        tmp         = anno_r[ i ];
-        anno_r[ i ] = off_r;
-        off_r += tmp;
-    }
+        if ( slot->off && !store_check_read( (ReadCoverageRle*)( store->base + slot->off ), slot->cap, alen ) )
+        {
+            ReadCoverageRle* rle = (ReadCoverageRle*)( store->base + slot->off );
 
-    track_write( db, TRACK_MASK_R, 0, anno_r, data_r, anno_r[ nreads ] / sizeof( track_data ) );
-    track_write( db, TRACK_MASK_C, 0, anno_c, data_c, anno_c[ nreads ] / sizeof( track_data ) );
+            rle[ 0 ].value = 0;
+            rle[ 0 ].count = alen;
+            rle[ 1 ].count = 0;
 
-    // write_track_trimmed(db, TRACK_MASK_R, 0, anno_r, data_r, anno_r[ nreads ] / sizeof(track_data));
-    // write_track_trimmed(db, TRACK_MASK_C, 0, anno_c, data_c, anno_c[ nreads ] / sizeof(track_data));
+            reset++;
+        }
+    }
+
+    if ( reset )
+    {
+        fprintf( stderr, "reset the coverage of %d reads\n", reset );
+    }
+}
+
+/*
+    maps the store at path, the mapping is large enough for each owned read to move to a
+    slot for its maximum number of elements twice. returns 1 if it existed and ctx->cov and
+    ctx->q_data refer to it.
+*/
+
+static int store_open( ServerContext* ctx, const char* path )
+{
+    HITS_DB* db      = ctx->db;
+    int nreads       = db->nreads;
+    uint64 page      = sysconf( _SC_PAGESIZE );
+    CovStore* store  = malloc( sizeof( CovStore ) );
+    uint64 table     = STORE_ALIGN( sizeof( CovStoreHeader ), page );
+    uint64 q         = table + sizeof( CovStoreSlot ) * nreads;
+    uint64 q_bytes   = ctx->q_width ? ctx->q_off[ nreads ] : 0;
+    uint64 arena     = STORE_ALIGN( q + q_bytes, page );
+    uint64 reserve   = arena + STORE_GROW;
+    struct stat st;
+    int exists;
+    int i;
+
+    for ( i = ctx->r_first; i < ctx->r_last; i++ )
+    {
+        reserve += ( sizeof( ReadCoverageRle ) << store_class( DB_READ_LEN( db, i ) + 1 ) ) * 2;
+    }
+
+    store->fd = open( path, O_RDWR | O_CREAT, 0644 );
+
+    if ( store->fd == -1 || fstat( store->fd, &st ) != 0 )
+    {
+        fprintf( stderr, "failed to open coverage store %s: %s\n", path, strerror( errno ) );
+        exit( 1 );
+    }
+
+    exists         = ( st.st_size > 0 );
+    store->size    = st.st_size;
+    store->maxsize = MAX( reserve, store->size );
+
+    store->base = mmap( NULL, store->maxsize, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0 );
+
+    if ( store->base == MAP_FAILED )
+    {
+        fprintf( stderr, "failed to map %llu bytes of coverage store %s: %s\n", store->maxsize, path, strerror( errno ) );
+        exit( 1 );
+    }
+
+    store->header = (CovStoreHeader*)store->base;
+    store->slots  = (CovStoreSlot*)( store->base + table );
+
+    pthread_mutex_init( &( store->lock ), NULL );
+
+    CovStoreHeader* header = store->header;
+
+    if ( exists )
+    {
+        if ( store->size < sizeof( CovStoreHeader ) || header->magic != STORE_MAGIC || header->version != STORE_VERSION )
+        {
+            fprintf( stderr, "%s is not a coverage store\n", path );
+            exit( 1 );
+        }
+
+        if ( header->nreads != nreads || header->r_first != ctx->r_first || header->r_last != ctx->r_last ||
+             header->q_width != ctx->q_width || ( ctx->q_width && header->q_step != ctx->q_step ) ||
+             header->table != table || header->q != q || header->arena != arena || store->size < arena )
+        {
+            fprintf( stderr, "coverage store %s was created for a different db, shard or -q\n", path );
+            exit( 1 );
+        }
+
+        if ( header->state != STORE_CLOSED )
+        {
+            store_recover( store, db );
+        }
+    }
+    else
+    {
+        store_grow( store, arena );
+
+        bzero( header, sizeof( CovStoreHeader ) );
+
+        header->magic   = STORE_MAGIC;
+        header->version = STORE_VERSION;
+        header->nreads  = nreads;
+        header->r_first = ctx->r_first;
+        header->r_last  = ctx->r_last;
+        header->q_width = ctx->q_width;
+        header->q_step  = ctx->q_width ? ctx->q_step : 0;
+        header->table   = table;
+        header->q       = q;
+        header->arena   = arena;
+        header->used    = arena;
+    }
+
+    header->state = STORE_OPEN;
+
+    ctx->store = store;
+
+    if ( !exists )
+    {
+        return 0;
+    }
+
+    for ( i = 0; i < nreads; i++ )
+    {
+        CovStoreSlot* slot = store->slots + i;
+
+        if ( slot->off )
+        {
+            ctx->cov[ i ].data = (ReadCoverageRle*)( store->base + slot->off );
+            ctx->cov[ i ].dmax = slot->cap;
+        }
+    }
+
+    if ( ctx->q_width )
+    {
+        free( ctx->q_data );
+        ctx->q_data = (unsigned char*)( store->base + q );
+    }
+
+    return 1;
+}
+
+// moves the coverage initialised on the heap into a new store
+
+static void store_fill( ServerContext* ctx )
+{
+    CovStore* store = ctx->store;
+    int i;
+
+    for ( i = ctx->r_first; i < ctx->r_last; i++ )
+    {
+        ReadCoverage* cov     = ctx->cov + i;
+        ReadCoverageRle* data = cov->data;
+
+        if ( data == NULL )
+        {
+            continue;
+        }
+
+        int n = 1;
+        while ( data[ n - 1 ].count )
+        {
+            n++;
+        }
+
+        cov->data = NULL;
+        cov->dmax = 0;
+
+        store_put( store, cov, i, data, n );
+
+        free( data );
+    }
+
+    if ( ctx->q_width )
+    {
+        unsigned char* q_data = (unsigned char*)( store->base + store->header->q );
+
+        memcpy( q_data, ctx->q_data, ctx->q_off[ ctx->db->nreads ] );
+
+        free( ctx->q_data );
+        ctx->q_data = q_data;
+    }
+}
+
+static void store_sync( CovStore* store )
+{
+    if ( msync( store->base, store->size, MS_SYNC ) != 0 )
+    {
+        fprintf( stderr, "failed to sync coverage store: %s\n", strerror( errno ) );
+    }
+}
+
+static void store_close( CovStore* store )
+{
+    store_sync( store );
+
+    store->header->state = STORE_CLOSED;
+
+    store_sync( store );
+
+    munmap( store->base, store->maxsize );
+    close( store->fd );
+
+    pthread_mutex_destroy( &( store->lock ) );
+
+    free( store );
+}
+
+/*
+    compact coverage
+
+    the levels of a read's segments are stored in q_data[ q_off[ read ] ... q_off[ read + 1 ] ).
+    a segment is credited with the maximum coverage of its bases. levels are rounded randomly
+    so the accumulated coverage remains unbiased. compact reads always stay below the
+    masking threshold, they are converted to run-length encoded coverage beforehand.
+*/
+
+#define QCOV_BYTES( len, width ) ( ( ( ( len ) + ( width ) - 1 ) / ( width ) + 1 ) / 2 )
+
+static inline int qcov_get( unsigned char* seg, int s )
+{
+    return ( seg[ s >> 1 ] >> ( ( s & 1 ) << 2 ) ) & 0xf;
+}
+
+static inline void qcov_set( unsigned char* seg, int s, int level )
+{
+    int shift = ( s & 1 ) << 2;
+
+    seg[ s >> 1 ] = ( seg[ s >> 1 ] & ~( 0xf << shift ) ) | ( level << shift );
+}
+
+static inline uint64 qcov_random( uint64* state )
+{
+    uint64 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return ( *state = x );
+}
+
+static inline int qcov_level( int cov, int step, uint64* rng )
+{
+    int level = cov / step;
+    int rem   = cov % step;
+
+    if ( rem && (int)( qcov_random( rng ) % step ) < rem )
+    {
+        level++;
+    }
+
+    return MIN( level, Q_LEVELS - 1 );
+}
+
+static inline int qcov_segment_max( unsigned char* values, int beg, int end )
+{
+    int i;
+    int vmax = 0;
+
+    for ( i = beg; i < end; i++ )
+    {
+        vmax = MAX( vmax, values[ i ] );
+    }
+
+    return vmax;
+}
+
+// per base coverage of a compact read
+
+static void qcov_expand( int width, int step, unsigned char* seg, int alen, unsigned char* values )
+{
+    int s, beg;
+
+    for ( s = beg = 0; beg < alen; s++, beg += width )
+    {
+        int cov = MIN( qcov_get( seg, s ) * step, MAX_COV );
+
+        memset( values + beg, cov, MIN( width, alen - beg ) );
+    }
+}
+
+// store per base coverage as compact read unless it exceeds the threshold, returns success
+
+static int qcov_store( ServerContext* sctx, int read, unsigned char* values, int alen, uint64* rng )
+{
+    unsigned char* seg = sctx->q_data + sctx->q_off[ read ];
+    int width          = sctx->q_width;
+    int s, beg;
+
+    for ( beg = 0; beg < alen; beg += width )
+    {
+        if ( qcov_segment_max( values, beg, MIN( beg + width, alen ) ) > sctx->cov_threshold )
+        {
+            return 0;
+        }
+    }
+
+    for ( s = beg = 0; beg < alen; s++, beg += width )
+    {
+        int cov = qcov_segment_max( values, beg, MIN( beg + width, alen ) );
+
+        qcov_set( seg, s, qcov_level( cov, sctx->q_step, rng ) );
+    }
+
+    return 1;
+}
+
+// add the coverage in read_cov to a compact read, fails if the read would exceed the threshold
+
+static int qcov_add( WorkerContext* wctx, int aread, int alen )
+{
+    ServerContext* sctx = wctx->sctx;
+    unsigned char* seg  = sctx->q_data + sctx->q_off[ aread ];
+    int width           = sctx->q_width;
+    int step            = sctx->q_step;
+    int s, beg;
+
+    for ( s = beg = 0; beg < alen; s++, beg += width )
+    {
+        int cov = qcov_get( seg, s ) * step + qcov_segment_max( wctx->read_cov, beg, MIN( beg + width, alen ) );
+
+        if ( cov > sctx->cov_threshold )
+        {
+            return 0;
+        }
+    }
+
+    for ( s = beg = 0; beg < alen; s++, beg += width )
+    {
+        int cov = qcov_get( seg, s ) * step + qcov_segment_max( wctx->read_cov, beg, MIN( beg + width, alen ) );
+
+        qcov_set( seg, s, qcov_level( cov, step, &( wctx->q_rng ) ) );
+    }
+
+    return 1;
+}
+
+// publish the n elements of coverage in cov_temp, called with the read's cov lock held
+
+static void publish_coverage( WorkerContext* wctx, int aread, int n )
+{
+    ServerContext* sctx = wctx->sctx;
+
+    if ( sctx->store )
+    {
+        store_put( sctx->store, sctx->cov + aread, aread, wctx->cov_temp.data, n );
+    }
+    else
+    {
+        // swap buffers, the old one is reused by the worker
+
+        ReadCoverage old   = sctx->cov[ aread ];
+        sctx->cov[ aread ] = wctx->cov_temp;
+        wctx->cov_temp     = old;
+    }
+}
+
+static void mask_contained_read( WorkerContext* wctx, int aread, int alen )
+{
+    ServerContext* sctx = wctx->sctx;
+    int lock            = rid2lock( aread );
+
+    if ( sctx->db->reads[ aread ].flags )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( sctx->cov_locks + lock );
+
+    sctx->db->reads[ aread ].flags = 1;
+
+    if ( sctx->cov[ aread ].data != NULL )
+    {
+        bzero( wctx->read_cov_temp, sizeof( unsigned char ) * alen );
+        rle_unpack( wctx->read_cov_temp, sctx->cov[ aread ].data );
+
+        int i;
+        for ( i = 0; i < alen; i++ )
+        {
+            wctx->read_cov[ i ] = MAX_COV;
+        }
+    }
+
+    int n = rle_pack( wctx->read_cov, alen, &( wctx->cov_temp.data ), &( wctx->cov_temp.dmax ) );
+
+    publish_coverage( wctx, aread, n );
+
+    sctx->cov_dirty[ aread ] |= DIRTY_TRACK | DIRTY_CHECKPOINT;
+    sctx->cov_changed = 1;
+
+    pthread_mutex_unlock( sctx->cov_locks + lock );
+}
+
+static void update_coverage( WorkerContext* wctx, int aread, int alen )
+{
+    ServerContext* sctx = wctx->sctx;
+    int lock            = rid2lock( aread );
+
+    pthread_mutex_lock( sctx->cov_locks + lock );
+
+    int history = 0;
+
+    if ( sctx->cov[ aread ].data != NULL )
+    {
+        bzero( wctx->read_cov_temp, sizeof( unsigned char ) * alen );
+        rle_unpack( wctx->read_cov_temp, sctx->cov[ aread ].data );
+
+        history = 1;
+    }
+    else if ( sctx->q_width )
+    {
+        // compact reads don't contribute to the track, no need to flag the update
+
+        if ( qcov_add( wctx, aread, alen ) )
+        {
+            sctx->cov_dirty[ aread ] |= DIRTY_CHECKPOINT;
+
+            pthread_mutex_unlock( sctx->cov_locks + lock );
+            return;
+        }
+
+        // exceeds the threshold, continues with exact coverage
+
+        qcov_expand( sctx->q_width, sctx->q_step, sctx->q_data + sctx->q_off[ aread ], alen, wctx->read_cov_temp );
+
+        history = 1;
+    }
+
+    if ( history )
+    {
+        int i;
+        for ( i = 0; i < alen; i++ )
+        {
+            uint32 cov = wctx->read_cov[ i ] + wctx->read_cov_temp[ i ];
+
+            if ( cov > MAX_COV )
+            {
+                cov = MAX_COV;
+            }
+
+            wctx->read_cov[ i ] = cov;
+        }
+    }
+
+    int n = rle_pack( wctx->read_cov, alen, &( wctx->cov_temp.data ), &( wctx->cov_temp.dmax ) );
+
+    publish_coverage( wctx, aread, n );
+
+    sctx->cov_dirty[ aread ] |= DIRTY_TRACK | DIRTY_CHECKPOINT;
+    sctx->cov_changed = 1;
+
+    pthread_mutex_unlock( sctx->cov_locks + lock );
+}
+
+// block tracks span all reads, only those of the block have intervals
+
+static void write_block_track( HITS_DB* db, const char* track, int block, int beg, int end, track_anno* anno, track_data* data )
+{
+    int nreads        = db->nreads;
+    track_anno* banno = malloc( sizeof( track_anno ) * ( nreads + 1 ) );
+
+    int i;
+    for ( i = 0; i <= nreads; i++ )
+    {
+        if ( i <= beg )
+        {
+            banno[ i ] = 0;
+        }
+        else if ( i <= end )
+        {
+            banno[ i ] = anno[ i ] - anno[ beg ];
+        }
+        else
+        {
+            banno[ i ] = banno[ end ];
+        }
+    }
+
+    track_write( db, track, block, banno, data + anno[ beg ] / sizeof( track_data ), banno[ nreads ] / sizeof( track_data ) );
+
+    free( banno );
+}
+
+static void write_mask_tracks( ServerContext* sctx )
+{
+    HITS_DB* db = sctx->db;
+    int nreads  = db->nreads;
+
+    track_anno* anno_r = malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
+    track_data* data_r = malloc( sctx->t_anno[ nreads ] );
+    int dcur_r         = 0;
+
+    track_anno* anno_c = malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
+    track_data* data_c = malloc( 2 * sizeof( track_data ) * db->nreads );
+    int dcur_c         = 0;
+
+    int i;
+    for ( i = 0; i < nreads; i++ )
+    {
+        track_anno beg = sctx->t_anno[ i ] / sizeof( track_data );
+        track_anno end = sctx->t_anno[ i + 1 ] / sizeof( track_data );
+
+        anno_r[ i ] = 0;
+        anno_c[ i ] = 0;
+
+        if ( db->reads[ i ].flags == 1 )
+        {
+            data_c[ dcur_c++ ] = 0;
+            data_c[ dcur_c++ ] = DB_READ_LEN( db, i );
+
+            anno_c[ i ] += 2 * sizeof( track_data );
+        }
+        else
+        {
+            while ( beg < end )
+            {
+                track_data b = sctx->t_data[ beg ];
+                track_data e = sctx->t_data[ beg + 1 ];
+
+                data_r[ dcur_r++ ] = b;
+                data_r[ dcur_r++ ] = e;
+
+                beg += 2;
+                anno_r[ i ] += 2 * sizeof( track_data );
+            }
+        }
+    }
+
+    track_anno off_r = 0;
+    track_anno off_c = 0;
+
+    for ( i = 0; i <= nreads; i++ )
+    {
+        track_anno tmp = anno_c[ i ];
+        anno_c[ i ]    = off_c;
+        off_c += tmp;
+
+        tmp         = anno_r[ i ];
+        anno_r[ i ] = off_r;
+        off_r += tmp;
+    }
+
+    if ( sctx->shard )
+    {
+        // only the blocks of the shard, merged with TKmerge
+
+        int b;
+        for ( b = sctx->r_block; b <= sctx->r_lblock; b++ )
+        {
+            int beg = sctx->r_bfirst[ b - sctx->r_block ];
+            int end = sctx->r_bfirst[ b - sctx->r_block + 1 ];
+
+            write_block_track( db, TRACK_MASK_R, b, beg, end, anno_r, data_r );
+            write_block_track( db, TRACK_MASK_C, b, beg, end, anno_c, data_c );
+        }
+    }
+    else
+    {
+        track_write( db, TRACK_MASK_R, 0, anno_r, data_r, anno_r[ nreads ] / sizeof( track_data ) );
+        track_write( db, TRACK_MASK_C, 0, anno_c, data_c, anno_c[ nreads ] / sizeof( track_data ) );
+    }
+
+    // write_track_trimmed(db, TRACK_MASK_R, 0, anno_r, data_r, anno_r[ nreads ] / sizeof(track_data));
+    // write_track_trimmed(db, TRACK_MASK_C, 0, anno_c, data_c, anno_c[ nreads ] / sizeof(track_data));
 }
 
 static void process_las( WorkerContext* ctx, const char* path )
@@ -537,16 +1457,24 @@ static void process_las( WorkerContext* ctx, const char* path )
         ctx->ovls_sorted = (Overlap**)realloc( ctx->ovls_sorted, ctx->maxovl * sizeof( Overlap* ) );
     }
 
-    ovl_header_novl i;
-    for ( i = 0; i < novl; i++ )
+    ovl_header_novl i, n;
+    for ( i = n = 0; i < novl; i++ )
     {
-        Overlap* ovl = ctx->ovls + i;
+        Overlap* ovl = ctx->ovls + n;
 
         if ( Read_Overlap( fileIn, ovl ) )
         {
             break;
         }
 
+        // the coverage of A reads of other shards is kept there
+
+        if ( !owns_read( ctx->sctx, ovl->aread ) )
+        {
+            fseeko( fileIn, ovl->path.tlen * tbytes, SEEK_CUR );
+            continue;
+        }
+
 #ifdef TRANSFER_ANNOTATION
 
         if ( ovl->path.tlen + ctx->trace_cur > ctx->trace_max )
@@ -557,7 +1485,7 @@ static void process_las( WorkerContext* ctx, const char* path )
 
             ovl_header_novl j;
 
-            for ( j = 0; j < i; j++ )
+            for ( j = 0; j < n; j++ )
             {
                 ctx->ovls[ j ].path.trace = trace + ( (ovl_trace*)( ctx->ovls[ j ].path.trace ) - ctx->trace );
             }
@@ -579,15 +1507,20 @@ static void process_las( WorkerContext* ctx, const char* path )
         fseeko( fileIn, ovl->path.tlen * tbytes, SEEK_CUR );
 #endif
 
-        ctx->ovls_sorted[ i ] = ovl;
+        ctx->ovls_sorted[ n ] = ovl;
+        n++;
     }
-    novl = i;
+    novl = n;
 
     fclose( fileIn );
 
     if ( novl == 0 )
     {
-        fprintf( stderr, "reading las file yielded %lld overlaps\n", novl );
+        if ( i == 0 )
+        {
+            fprintf( stderr, "reading las file yielded %lld overlaps\n", novl );
+        }
+
         return;
     }
 
@@ -608,7 +1541,7 @@ static void process_las( WorkerContext* ctx, const char* path )
                 mask_contained_read( ctx, ovl_o->aread, ovlALen );
             }
 
-            if ( ovl_o->path.bbpos == 0 )
+            if ( ovl_o->path.bbpos == 0 && owns_read( ctx->sctx, ovl_o->bread ) )
             {
                 int blen = DB_READ_LEN( ctx->db, ovl_o->bread );
 
@@ -810,172 +1743,639 @@ static int map_repeat_to_b(Overlap* ovl, int* _beg, int* _end)
             break;
         }
 
-        boff += trace[j + 1];
-    }
+        boff += trace[j + 1];
+    }
+
+    if (ibb == -1 || ibe == -1)
+    {
+        return 0;
+    }
+
+    if (ovl->flags & OVL_COMP)
+    {
+        int t = ibb;
+        int blen = DB_READ_LEN(ctx->db, ovl->bread);
+
+        ibb = blen - ibe;
+        ibe = blen - t;
+    }
+
+    assert(ibb <= ibe);
+
+    *_beg = ibb;
+    *_end = ibe;
+
+    return 1;
+}
+*/
+
+/*
+    rebuild the track. the intervals of clean reads are taken from the previous track,
+    only the dirty reads are locked and derived from their coverage.
+*/
+
+static void update_track( ServerContext* sctx )
+{
+    time_t time_beg = time( NULL );
+    int nreads      = sctx->db->nreads;
+    int i;
+    uint64 dcur = 0;
+
+    // updates arriving while the reads are scanned flag the next update
+
+    sctx->cov_changed = 0;
+
+    // keep the previous track for the clean reads and to find the reads that changed
+
+    uint64 plen = sctx->t_anno[ nreads ];
+
+    if ( plen > sizeof( track_data ) * sctx->t_pdmax )
+    {
+        sctx->t_pdmax = plen / sizeof( track_data ) * 1.2 + 1000;
+        sctx->t_pdata = (track_data*)realloc( sctx->t_pdata, sizeof( track_data ) * sctx->t_pdmax );
+    }
+
+    memcpy( sctx->t_panno, sctx->t_anno, sizeof( track_anno ) * ( nreads + 1 ) );
+    memcpy( sctx->t_pdata, sctx->t_data, plen );
+
+    track_data* t_data = sctx->t_data;
+    track_anno* t_anno = sctx->t_anno;
+    track_anno* p_anno = sctx->t_panno;
+    track_data* p_data = sctx->t_pdata;
+    uint64 t_dmax      = sctx->t_dmax;
+    int cov_threshold  = sctx->cov_threshold;
+
+    uint64 version = sctx->t_version + 1;
+    int dirty      = 0;
+    int changed    = 0;
+
+    for ( i = 0; i < nreads; i++ )
+    {
+        uint64 dcur_prev = dcur;
+        uint64 pbeg      = p_anno[ i ] / sizeof( track_data );
+        uint64 pend      = p_anno[ i + 1 ] / sizeof( track_data );
+
+        t_anno[ i ] = dcur * sizeof( track_data );
+
+        if ( dcur + ( pend - pbeg ) + 2 >= t_dmax )
+        {
+            sctx->t_dmax = t_dmax = ( dcur + ( pend - pbeg ) ) * 1.2 + 1000;
+            sctx->t_data = t_data = (track_data*)realloc( t_data, sizeof( track_data ) * t_dmax );
+        }
+
+        // a read flagged while it is copied is caught by the next update
+
+        if ( !( sctx->cov_dirty[ i ] & DIRTY_TRACK ) )
+        {
+            memcpy( t_data + dcur, p_data + pbeg, sizeof( track_data ) * ( pend - pbeg ) );
+            dcur += pend - pbeg;
+
+            continue;
+        }
+
+        int lock = rid2lock( i );
+
+        pthread_mutex_lock( sctx->cov_locks + lock );
+
+        sctx->cov_dirty[ i ] &= ~DIRTY_TRACK;
+
+        ReadCoverage* cov    = sctx->cov + i;
+        ReadCoverageRle* rle = cov->data;
+
+        // compact reads are below the threshold
+
+        if ( rle )
+        {
+            int j   = 0;
+            int pos = 0;
+
+            while ( rle[ j ].count )
+            {
+                if ( rle[ j ].value > cov_threshold )
+                {
+                    if ( dcur + 2 >= t_dmax )
+                    {
+                        sctx->t_dmax = t_dmax = dcur * 1.2 + 1000;
+                        sctx->t_data = t_data = (track_data*)realloc( t_data, sizeof( track_data ) * t_dmax );
+                    }
+
+                    if ( dcur != dcur_prev && pos == t_data[ dcur - 1 ] )
+                    {
+                        t_data[ dcur - 1 ] = pos + rle[ j ].count;
+                    }
+                    else
+                    {
+                        t_data[ dcur++ ] = pos;
+                        t_data[ dcur++ ] = pos + rle[ j ].count;
+                    }
+                }
+
+                pos += rle[ j ].count;
+
+                j++;
+            }
+        }
+
+        pthread_mutex_unlock( sctx->cov_locks + lock );
+
+        dirty++;
+
+        if ( dcur - dcur_prev != pend - pbeg ||
+             memcmp( t_data + dcur_prev, p_data + pbeg, sizeof( track_data ) * ( dcur - dcur_prev ) ) != 0 )
+        {
+            sctx->t_rversion[ i ] = version;
+            changed++;
+        }
+    }
+
+    t_anno[ nreads ] = dcur * sizeof( track_data );
+
+    if ( changed )
+    {
+        sctx->t_version = version;
+    }
+
+    printf( "UPDATE TRACK (%ld secs) %d dirty reads, %d changed, version %llu\n",
+            time( NULL ) - time_beg, dirty, changed, sctx->t_version );
+}
+
+static int socket_send( int sock, void* buffer, uint64 len )
+{
+    uint64 bcur = 0;
+
+    while ( bcur < len )
+    {
+        ssize_t sent = send( sock, (char*)buffer + bcur, len - bcur, SEND_FLAGS );
+
+        if ( sent < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) )
+        {
+            // client sockets are non-blocking, wait for a slow client to drain
+
+            struct pollfd pfd;
+
+            pfd.fd     = sock;
+            pfd.events = POLLOUT;
+
+            if ( poll( &pfd, 1, SEND_TIMEOUT ) == 0 )
+            {
+                fprintf( stderr, "send timed out\n" );
+                return 0;
+            }
+
+            continue;
+        }
+
+        if ( sent < 1 )
+        {
+            fprintf( stderr, "failed to send\n" );
+            return 0;
+        }
+
+        bcur += sent;
+    }
+
+    return 1;
+}
+
+/*
+    changes of the track for reads bfirst..bfirst+nreads since version of epoch,
+    or all reads with intervals if the client's copy is from a different epoch or missing
+*/
+
+static void send_track_delta( ServerContext* ctx, int sock, uint64 bfirst, uint64 nreads, uint64 epoch, uint64 version )
+{
+    uint64 i, n, dlen;
+    DmHeader headerResp;
+
+    bzero( &headerResp, sizeof( DmHeader ) );
+
+    headerResp.version = DM_VERSION;
+    headerResp.type    = DM_TYPE_RESPONSE_DELTA;
+
+    pthread_mutex_lock( &( ctx->t_lock ) );
+
+    track_anno* t_anno = ctx->t_anno;
+    uint64 full        = ( epoch != ctx->t_epoch || version == 0 || version > ctx->t_version );
+
+    n = dlen = 0;
+    for ( i = bfirst; i < bfirst + nreads; i++ )
+    {
+        track_anno len = t_anno[ i + 1 ] - t_anno[ i ];
+
+        if ( full ? ( len > 0 ) : ( ctx->t_rversion[ i ] > version ) )
+        {
+            n++;
+            dlen += len;
+        }
+    }
+
+    uint64 ulen   = sizeof( uint64 ) * ( 2 + 2 * n ) + dlen;
+    uint64* delta = malloc( ulen );
+    uint64* reads = delta + 2;
+    uint64* lens  = reads + n;
+    char* data    = (char*)( lens + n );
+
+    delta[ 0 ] = full;
+    delta[ 1 ] = n;
+
+    n = 0;
+    for ( i = bfirst; i < bfirst + nreads; i++ )
+    {
+        track_anno len = t_anno[ i + 1 ] - t_anno[ i ];
+
+        if ( full ? ( len > 0 ) : ( ctx->t_rversion[ i ] > version ) )
+        {
+            reads[ n ] = i - bfirst;
+            lens[ n ]  = len;
+            n++;
+
+            memcpy( data, (char*)ctx->t_data + t_anno[ i ], len );
+            data += len;
+        }
+    }
+
+    headerResp.reserved1 = ctx->t_epoch;
+    headerResp.reserved2 = ctx->t_version;
+    headerResp.reserved3 = ulen;
+
+    pthread_mutex_unlock( &( ctx->t_lock ) );
+
+    void* cbuf;
+    uint64_t clen;
+
+    compress_chunks( delta, ulen, &cbuf, &clen );
+    free( delta );
+
+    headerResp.length = sizeof( DmHeader ) + clen;
+
+    printf( "  SENDING %llu bytes (%s %llu reads, %llu bytes uncompressed)\n",
+            headerResp.length, full ? "FULL" : "DELTA", n, ulen );
+
+    if ( socket_send( sock, &headerResp, sizeof( DmHeader ) ) )
+    {
+        socket_send( sock, cbuf, clen );
+    }
+
+    free( cbuf );
+}
+
+static void shutdown_server( ServerContext* ctx )
+{
+    ctx->shutdown = 1;
+
+    // TODO ... cheap hack to wake up all worker threads so they terminate
+
+    int i;
+    for ( i = 0; i < ctx->worker_threads; i++ )
+    {
+        sem_post( ctx->queue_fill_count );
+    }
+}
+
+static void send_track( ServerContext* ctx, int sock, uint64 bfirst, uint64 nreads )
+{
+    track_anno* anno = (track_anno*)malloc( sizeof( track_anno ) * ( nreads + 1 ) );
+
+    pthread_mutex_lock( &( ctx->t_lock ) );
+    {
+        memcpy( anno, ctx->t_anno + bfirst, sizeof( track_anno ) * ( nreads + 1 ) );
+        uint64 i;
+        track_anno off = anno[ 0 ];
+        for ( i = 0; i <= nreads; i++ )
+        {
+            anno[ i ] -= off;
+        }
+        uint64 dlen = anno[ nreads ];
+
+        // DATA: ctx->t_data[ off : off + dlen ]
+
+        DmHeader headerResp;
+        bzero( &headerResp, sizeof( DmHeader ) );
+
+        headerResp.version = DM_VERSION;
+        headerResp.type    = DM_TYPE_RESPONSE_TRACK;
+        headerResp.length  = sizeof( DmHeader ) +
+                            sizeof( track_anno ) * ( nreads + 1 ) +
+                            dlen;
+
+        printf( "  SENDING %llu bytes (ANNO %llu DATA %llu)\n",
+                headerResp.length,
+                sizeof( track_anno ) * ( nreads + 1 ),
+                dlen );
+
+        // send track
+
+        if ( socket_send( sock, &headerResp, sizeof( DmHeader ) ) &&
+             socket_send( sock, anno, sizeof( track_anno ) * ( nreads + 1 ) ) )
+        {
+            socket_send( sock, ctx->t_data + off / sizeof( track_data ), dlen );
+        }
+    }
+    pthread_mutex_unlock( &( ctx->t_lock ) );
+
+    free( anno );
+}
+
+static Connection* connection_new( int sock )
+{
+    Connection* conn = (Connection*)malloc( sizeof( Connection ) );
+
+    conn->sock = sock;
+    conn->refs = 1;
+
+    pthread_mutex_init( &( conn->send_lock ), NULL );
+
+    conn->dmax = 1024;
+    conn->dcur = 0;
+    conn->data = malloc( conn->dmax );
+
+    conn->pair_a = 0;
+    conn->pair_b = 0;
+
+    return conn;
+}
+
+static void connection_release( ServerContext* ctx, Connection* conn )
+{
+    pthread_mutex_lock( &( ctx->conn_lock ) );
+
+    int refs = --( conn->refs );
+
+    pthread_mutex_unlock( &( ctx->conn_lock ) );
+
+    if ( refs == 0 )
+    {
+        close( conn->sock );
+
+        pthread_mutex_destroy( &( conn->send_lock ) );
+
+        free( conn->data );
+        free( conn );
+    }
+}
+
+/*
+    track requests are answered by the responder threads, a slow
+    client must not hold up the messages of all others
+*/
+
+static void response_add( ServerContext* ctx, Connection* conn )
+{
+    ResponseJob* job = (ResponseJob*)malloc( sizeof( ResponseJob ) );
+
+    job->conn   = conn;
+    job->header = conn->header;
+    job->next   = NULL;
+
+    pthread_mutex_lock( &( ctx->conn_lock ) );
+    conn->refs++;
+    pthread_mutex_unlock( &( ctx->conn_lock ) );
+
+    pthread_mutex_lock( &( ctx->resp_lock ) );
+
+    if ( ctx->resp_end != NULL )
+    {
+        ctx->resp_end->next = job;
+    }
+    else
+    {
+        ctx->resp_start = job;
+    }
+
+    ctx->resp_end = job;
+
+    pthread_cond_signal( &( ctx->resp_cond ) );
+    pthread_mutex_unlock( &( ctx->resp_lock ) );
+}
+
+static void* responder_thread( void* arg )
+{
+    ServerContext* ctx = (ServerContext*)arg;
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &( ctx->resp_lock ) );
+
+        // shutdown_server is called from the signal handler and can't signal resp_cond, check once a second
+
+        while ( ctx->resp_start == NULL && !ctx->shutdown )
+        {
+            struct timespec ts;
+
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_sec += 1;
+
+            pthread_cond_timedwait( &( ctx->resp_cond ), &( ctx->resp_lock ), &ts );
+        }
+
+        ResponseJob* job = ctx->resp_start;
+
+        if ( job == NULL )
+        {
+            pthread_mutex_unlock( &( ctx->resp_lock ) );
+            break;
+        }
+
+        ctx->resp_start = job->next;
 
-    if (ibb == -1 || ibe == -1)
-    {
-        return 0;
-    }
+        if ( ctx->resp_start == NULL )
+        {
+            ctx->resp_end = NULL;
+        }
 
-    if (ovl->flags & OVL_COMP)
-    {
-        int t = ibb;
-        int blen = DB_READ_LEN(ctx->db, ovl->bread);
+        pthread_mutex_unlock( &( ctx->resp_lock ) );
 
-        ibb = blen - ibe;
-        ibe = blen - t;
-    }
+        Connection* conn = job->conn;
+        DmHeader* header = &( job->header );
 
-    assert(ibb <= ibe);
+        pthread_mutex_lock( &( conn->send_lock ) );
 
-    *_beg = ibb;
-    *_end = ibe;
+        if ( header->type == DM_TYPE_REQUEST_TRACK )
+        {
+            send_track( ctx, conn->sock, header->reserved1, header->reserved2 );
+        }
+        else
+        {
+            send_track_delta( ctx, conn->sock, header->reserved1, header->reserved2, header->reserved3, header->reserved4 );
+        }
 
-    return 1;
+        pthread_mutex_unlock( &( conn->send_lock ) );
+
+        connection_release( ctx, conn );
+        free( job );
+    }
+
+    return NULL;
 }
+
+#define PAIR( ctx, a, b ) ( ( ctx )->d_state[ (uint64)( a ) * ( ( ctx )->d_blocks + 1 ) + ( b ) ] )
+
+/*
+    the next pair for a worker that compared A block prev last. the diagonal comes first,
+    then the pairs by their distance to it. the worker stays with prev while one of its
+    pairs is within DISPATCH_BAND of the front, otherwise it gets the A block at the front
+    that the fewest workers are holding.
 */
 
-static void update_track( ServerContext* sctx )
+static int dispatch_pick( ServerContext* ctx, int prev, int* _a, int* _b )
 {
-    time_t time_beg = time( NULL );
-    int nreads      = sctx->db->nreads;
-    int i;
-    uint64 dcur = 0;
+    int n = ctx->d_blocks;
+    int a, d;
+    int dmin = -1;
 
-    /*
-    for (i = 0; i < COV_LOCK_GRANULARITY; i++)
+    for ( d = 0; d < n && dmin == -1; d++ )
     {
-        pthread_mutex_lock( sctx->cov_locks + i );
+        for ( a = d + 1; a <= n; a++ )
+        {
+            if ( PAIR( ctx, a, a - d ) == PAIR_OPEN )
+            {
+                dmin = d;
+                break;
+            }
+        }
     }
-    */
-
-    bzero( sctx->t_anno, sizeof( track_anno ) * ( nreads + 1 ) );
-
-    track_data* t_data = sctx->t_data;
-    track_anno* t_anno = sctx->t_anno;
-    uint64 t_dmax      = sctx->t_dmax;
-    int cov_threshold  = sctx->cov_expected * COV_FACTOR_THRESHOLD;
 
-    for ( i = 0; i < nreads; i++ )
+    if ( dmin == -1 )
     {
-        ReadCoverage* cov    = sctx->cov + i;
-        ReadCoverageRle* rle = cov->data;
+        return 0;
+    }
 
-        if ( rle )
+    if ( prev > 0 && dmin > 0 )
+    {
+        for ( d = dmin; d <= dmin + DISPATCH_BAND && d < prev; d++ )
         {
-            int j            = 0;
-            int pos          = 0;
-            uint64 dcur_prev = dcur;
-
-            while ( rle[ j ].count )
+            if ( PAIR( ctx, prev, prev - d ) == PAIR_OPEN )
             {
-                if ( rle[ j ].value > cov_threshold )
-                {
-                    if ( dcur + 2 >= t_dmax )
-                    {
-                        sctx->t_dmax = t_dmax = dcur * 1.2 + 1000;
-                        sctx->t_data = t_data = (track_data*)realloc( t_data, sizeof( track_data ) * t_dmax );
-                    }
-
-                    if ( dcur != dcur_prev && pos == t_data[ dcur - 1 ] )
-                    {
-                        t_data[ dcur - 1 ] = pos + rle[ j ].count;
-                    }
-                    else
-                    {
-                        t_data[ dcur++ ] = pos;
-                        t_data[ dcur++ ] = pos + rle[ j ].count;
+                *_a = prev;
+                *_b = prev - d;
 
-                        t_anno[ i ] += sizeof( track_data ) * 2;
-                    }
-                }
-
-                pos += rle[ j ].count;
-
-                j++;
+                return 1;
             }
         }
     }
 
-    /*
-    for (i = 0; i < COV_LOCK_GRANULARITY; i++)
-    {
-        pthread_mutex_unlock( sctx->cov_locks + i );
-    }
-    */
+    int best = -1;
 
-    track_anno off = 0;
-    for ( i = 0; i <= nreads; i++ )
+    for ( a = dmin + 1; a <= n; a++ )
     {
-        track_anno tmp = t_anno[ i ];
-        t_anno[ i ]    = off;
-        off += tmp;
+        if ( PAIR( ctx, a, a - dmin ) == PAIR_OPEN && ( best == -1 || ctx->d_held[ a ] < ctx->d_held[ best ] ) )
+        {
+            best = a;
+        }
     }
 
-    sctx->cov_changed = 0;
+    *_a = best;
+    *_b = best - dmin;
 
-    printf( "UPDATE TRACK (%ld secs)\n", time( NULL ) - time_beg );
+    return 1;
 }
 
-static void shutdown_server( ServerContext* ctx )
+static void dispatch_release( ServerContext* ctx, Connection* conn, int done )
 {
-    ctx->shutdown = 1;
+    int a = conn->pair_a;
+    int b = conn->pair_b;
 
-    // TODO ... cheap hack to wake up all worker threads so they terminate
+    if ( a == 0 )
+    {
+        return;
+    }
 
-    int i;
-    for ( i = 0; i < ctx->worker_threads; i++ )
+    if ( done )
     {
-        sem_post( ctx->queue_fill_count );
+        PAIR( ctx, a, b ) = PAIR_DONE;
     }
-}
+    else
+    {
+        printf( "PAIR %d x %d returned\n", a, b );
 
-static void socket_data_handler( ServerContext* ctx, int newsock, fd_set* set )
-{
-    DmHeader header;
+        PAIR( ctx, a, b ) = PAIR_OPEN;
+        ctx->d_open++;
+    }
 
-    if ( recv( newsock, &header, sizeof( header ), 0 ) != sizeof( header ) )
-    {
-        fprintf( stderr, "CLOSE CONNECTION\n" );
+    ctx->d_busy--;
+    ctx->d_held[ a ]--;
 
-        FD_CLR( newsock, set );
-        close( newsock );
+    conn->pair_a = conn->pair_b = 0;
+}
 
-        return;
-    }
+static void dispatch_pair( ServerContext* ctx, Connection* conn, DmHeader* header )
+{
+    DmHeader resp;
+    bzero( &resp, sizeof( DmHeader ) );
 
-    char* data;
-    int dcur    = 0;
-    int pending = header.length - sizeof( header );
+    resp.version = DM_VERSION;
+    resp.type    = DM_TYPE_RESPONSE_PAIR;
+    resp.length  = sizeof( DmHeader );
 
-    if ( ctx->dmax < pending )
+    if ( ctx->d_blocks == 0 )
     {
-        ctx->dmax = pending * 2;
-        ctx->data = realloc( ctx->data, ctx->dmax );
+        fprintf( stderr, "pair requested, but dispatch is not enabled (-D)\n" );
     }
-
-    data = ctx->data;
-
-    while ( pending )
+    else
     {
-        int received = recv( newsock, data + dcur, pending, 0 );
+        int prev = conn->pair_a;
+        int a, b;
 
-        if ( received < 1 )
+        if ( prev != 0 && ( header->reserved1 != (uint64)conn->pair_a || header->reserved2 != (uint64)conn->pair_b ) )
         {
-            break;
+            fprintf( stderr, "pair %llu x %llu reported finished, %d x %d was handed out\n",
+                     header->reserved1, header->reserved2, conn->pair_a, conn->pair_b );
         }
 
-        dcur += received;
-        pending -= received;
-    }
+        dispatch_release( ctx, conn, 1 );
 
-    if ( pending != 0 )
-    {
-        fprintf( stderr, "error %d bytes pending\n", pending );
-        return;
+        if ( dispatch_pick( ctx, prev, &a, &b ) )
+        {
+            PAIR( ctx, a, b ) = PAIR_BUSY;
+
+            ctx->d_open--;
+            ctx->d_busy++;
+            ctx->d_held[ a ]++;
+
+            conn->pair_a = a;
+            conn->pair_b = b;
+
+            resp.reserved1 = a;
+            resp.reserved2 = b;
+
+            printf( "PAIR %d x %d (%llu open, %llu busy)\n", a, b, ctx->d_open, ctx->d_busy );
+        }
     }
 
+    resp.reserved3 = ctx->d_busy;
+
+    pthread_mutex_lock( &( conn->send_lock ) );
+
+    socket_send( conn->sock, &resp, sizeof( DmHeader ) );
+
+    pthread_mutex_unlock( &( conn->send_lock ) );
+}
+
+static void send_range( ServerContext* ctx, Connection* conn )
+{
+    DmHeader resp;
+    bzero( &resp, sizeof( DmHeader ) );
+
+    resp.version   = DM_VERSION;
+    resp.type      = DM_TYPE_RESPONSE_RANGE;
+    resp.length    = sizeof( DmHeader );
+    resp.reserved1 = ctx->r_first;
+    resp.reserved2 = ctx->r_last;
+    resp.reserved3 = ctx->db->nreads;
+
+    pthread_mutex_lock( &( conn->send_lock ) );
+
+    socket_send( conn->sock, &resp, sizeof( DmHeader ) );
+
+    pthread_mutex_unlock( &( conn->send_lock ) );
+}
+
+static void message_handler( ServerContext* ctx, Connection* conn )
+{
+    DmHeader header = conn->header;
+    char* data      = conn->data + sizeof( DmHeader );
+    uint64 dcur     = header.length - sizeof( DmHeader );
+
     switch ( header.type )
     {
         case DM_TYPE_SHUTDOWN:
@@ -1022,98 +2422,213 @@ static void socket_data_handler( ServerContext* ctx, int newsock, fd_set* set )
             break;
 
         case DM_TYPE_LAS_AVAILABLE:
-            if ( ctx->lock )
+            queue_add_paths( ctx, data, dcur );
+
+            break;
+
+        case DM_TYPE_REQUEST_TRACK:
+            printf( "REQUEST TRACK ... bfirst = %llu nreads = %llu\n", header.reserved1, header.reserved2 );
+
+            response_add( ctx, conn );
+
+            break;
+
+        case DM_TYPE_REQUEST_DELTA:
+            printf( "REQUEST DELTA ... bfirst = %llu nreads = %llu version = %llu\n",
+                    header.reserved1, header.reserved2, header.reserved4 );
+
+            if ( header.reserved1 < (uint64)ctx->r_first || header.reserved1 + header.reserved2 > (uint64)ctx->r_last )
             {
-                printf( "updates locked, ignoring available .las files\n" );
+                fprintf( stderr, "delta requested for reads outside of %d..%d\n", ctx->r_first, ctx->r_last - 1 );
             }
-            else
-            {
-                pthread_mutex_lock( &( ctx->queue_lock ) );
-                {
-                    int i;
-                    int beg = 0;
-                    for ( i = 0; i < dcur; i++ )
-                    {
-                        if ( data[ i ] == '\0' )
-                        {
-                            queue_add( ctx, data + beg );
-                            sem_post( ctx->queue_fill_count );
 
-                            printf( "QUEUE LEN %3d ADD %s\n", ctx->queue_len, data + beg );
+            response_add( ctx, conn );
 
-                            beg = i + 1;
-                        }
-                    }
-                }
+            break;
 
-                pthread_mutex_unlock( &( ctx->queue_lock ) );
-            }
+        case DM_TYPE_REQUEST_PAIR:
+            dispatch_pair( ctx, conn, &header );
 
             break;
 
-        case DM_TYPE_REQUEST_TRACK:
-        {
-            uint64 bfirst = header.reserved1;
-            uint64 nreads = header.reserved2;
+        case DM_TYPE_REQUEST_RANGE:
+            send_range( ctx, conn );
+
+            break;
+
+        default:
+            fprintf( stderr, "unknown message type %d\n", header.type );
+            break;
+    }
+}
 
-            printf( "REQUEST TRACK ... bfirst = %llu nreads = %llu\n", bfirst, nreads );
+/*
+    read what's available on the connection and handle the completed messages.
+    returns 0 if the connection is to be closed.
+*/
 
-            track_anno* anno = (track_anno*)malloc( sizeof( track_anno ) * ( nreads + 1 ) );
+static int connection_read( ServerContext* ctx, Connection* conn )
+{
+    while ( 1 )
+    {
+        uint64 want;
 
-            pthread_mutex_lock( &( ctx->t_lock ) );
-            {
-                memcpy( anno, ctx->t_anno + bfirst, sizeof( track_anno ) * ( nreads + 1 ) );
-                uint64 i;
-                track_anno off = anno[ 0 ];
-                for ( i = 0; i <= nreads; i++ )
-                {
-                    anno[ i ] -= off;
-                }
-                uint64 dlen = anno[ nreads ];
+        if ( conn->dcur < sizeof( DmHeader ) )
+        {
+            want = sizeof( DmHeader ) - conn->dcur;
+        }
+        else
+        {
+            want = conn->header.length - conn->dcur;
+        }
 
-                // DATA: ctx->t_data[ off : off + dlen ]
+        ssize_t received = recv( conn->sock, conn->data + conn->dcur, want, 0 );
 
-                DmHeader headerResp;
-                bzero( &headerResp, sizeof( DmHeader ) );
+        if ( received == 0 )
+        {
+            return 0;
+        }
 
-                headerResp.version = DM_VERSION;
-                headerResp.type    = DM_TYPE_RESPONSE_TRACK;
-                headerResp.length  = sizeof( DmHeader ) +
-                                    sizeof( track_anno ) * ( nreads + 1 ) +
-                                    dlen;
+        if ( received < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
 
-                printf( "  SENDING %llu bytes (ANNO %llu DATA %llu)\n",
-                        headerResp.length,
-                        sizeof( track_anno ) * ( nreads + 1 ),
-                        dlen );
+            return ( errno == EAGAIN || errno == EWOULDBLOCK );
+        }
 
-                send( newsock, &headerResp, sizeof( DmHeader ), 0 );
+        conn->dcur += received;
 
-                // send track
+        if ( conn->dcur == sizeof( DmHeader ) )
+        {
+            memcpy( &( conn->header ), conn->data, sizeof( DmHeader ) );
 
-                send( newsock, anno, sizeof( track_anno ) * ( nreads + 1 ), 0 );
-                send( newsock, ctx->t_data + off / sizeof( track_data ), dlen, 0 );
+            if ( conn->header.length < sizeof( DmHeader ) || conn->header.length > MAX_MESSAGE )
+            {
+                fprintf( stderr, "malformed message header\n" );
+                return 0;
             }
-            pthread_mutex_unlock( &( ctx->t_lock ) );
 
-            free( anno );
+            if ( conn->dmax < conn->header.length )
+            {
+                conn->dmax = conn->header.length * 2;
+                conn->data = realloc( conn->data, conn->dmax );
+            }
         }
-        break;
 
-        default:
-            fprintf( stderr, "unknown message type %d\n", header.type );
-            break;
+        if ( conn->dcur >= sizeof( DmHeader ) && conn->dcur == conn->header.length )
+        {
+            message_handler( ctx, conn );
+
+            conn->dcur = 0;
+        }
+    }
+}
+
+static int set_nonblocking( int sock )
+{
+    int flags = fcntl( sock, F_GETFL, 0 );
+
+    return ( flags != -1 && fcntl( sock, F_SETFL, flags | O_NONBLOCK ) != -1 );
+}
+
+/*
+    readiness notification for the listener, epoll or kqueue on macOS.
+    the listening socket is registered with a NULL pointer.
+*/
+
+#if defined( __APPLE__ )
+
+static int poller_create()
+{
+    return kqueue();
+}
+
+static int poller_add( int poller, int fd, void* ptr )
+{
+    struct kevent ev;
+
+    EV_SET( &ev, fd, EVFILT_READ, EV_ADD, 0, 0, ptr );
+
+    return kevent( poller, &ev, 1, NULL, 0, NULL );
+}
+
+static void poller_del( int poller, int fd )
+{
+    struct kevent ev;
+
+    EV_SET( &ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL );
+
+    kevent( poller, &ev, 1, NULL, 0, NULL );
+}
+
+static int poller_wait( int poller, void** ready, int timeout )
+{
+    struct kevent evs[ MAX_EVENTS ];
+    struct timespec ts;
+
+    ts.tv_sec  = timeout / 1000;
+    ts.tv_nsec = ( timeout % 1000 ) * 1000000;
+
+    int i;
+    int n = kevent( poller, NULL, 0, evs, MAX_EVENTS, &ts );
+
+    for ( i = 0; i < n; i++ )
+    {
+        ready[ i ] = evs[ i ].udata;
+    }
+
+    return n;
+}
+
+#else
+
+static int poller_create()
+{
+    return epoll_create1( 0 );
+}
+
+static int poller_add( int poller, int fd, void* ptr )
+{
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = ptr;
+
+    return epoll_ctl( poller, EPOLL_CTL_ADD, fd, &ev );
+}
+
+static void poller_del( int poller, int fd )
+{
+    struct epoll_event ev;
+
+    epoll_ctl( poller, EPOLL_CTL_DEL, fd, &ev );
+}
+
+static int poller_wait( int poller, void** ready, int timeout )
+{
+    struct epoll_event evs[ MAX_EVENTS ];
+
+    int i;
+    int n = epoll_wait( poller, evs, MAX_EVENTS, timeout );
+
+    for ( i = 0; i < n; i++ )
+    {
+        ready[ i ] = evs[ i ].data.ptr;
     }
+
+    return n;
 }
 
+#endif
+
 static void* socket_listener_thread( void* arg )
 {
     ServerContext* ctx = (ServerContext*)arg;
 
     int sock;
-    fd_set socks;
-    fd_set readsocks;
-    int maxsock;
     int reuseaddr = 1; /* True */
 
     /* Create the socket */
@@ -1148,14 +2663,23 @@ static void* socket_listener_thread( void* arg )
     /* Listen */
     if ( listen( sock, BACKLOG ) < 0 )
     {
-        perror( "listen" );
+        perror( "listen" );
+        return NULL;
+    }
+
+    /* Set up the poller */
+    int poller = poller_create();
+
+    if ( poller == -1 || !set_nonblocking( sock ) || poller_add( poller, sock, NULL ) == -1 )
+    {
+        perror( "poller" );
         return NULL;
     }
 
-    /* Set up the fd_set */
-    FD_ZERO( &socks );
-    FD_SET( sock, &socks );
-    maxsock = sock;
+    // open connections by socket
+
+    Connection** conns = NULL;
+    int maxconns       = 0;
 
     printf( "socket listener thread reporting for duty (port %d)\n", ctx->port );
 
@@ -1168,52 +2692,98 @@ static void* socket_listener_thread( void* arg )
             break;
         }
 
-        int s;
-        readsocks = socks;
-        if ( select( maxsock + 1, &readsocks, NULL, NULL, NULL ) == -1 )
+        void* ready[ MAX_EVENTS ];
+        int i, n;
+
+        if ( ( n = poller_wait( poller, ready, 1000 ) ) == -1 )
         {
-            perror( "select" );
-            return NULL;
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            perror( "poller" );
+            break;
         }
 
-        for ( s = 0; s <= maxsock; s++ )
+        for ( i = 0; i < n; i++ )
         {
-            if ( FD_ISSET( s, &readsocks ) )
+            Connection* conn = (Connection*)ready[ i ];
+
+            if ( conn == NULL )
             {
-                // printf("SOCKET %d READY\n", s);
+                /* New connections */
+                int newsock;
+                struct sockaddr_in their_addr;
+                socklen_t size = sizeof( struct sockaddr_in );
 
-                if ( s == sock )
+                while ( ( newsock = accept( sock, (struct sockaddr*)&their_addr, &size ) ) != -1 )
                 {
-                    /* New connection */
-                    int newsock;
-                    struct sockaddr_in their_addr;
-                    socklen_t size = sizeof( struct sockaddr_in );
+                    printf( "CONNECT FROM %s:%d\n", inet_ntoa( their_addr.sin_addr ), htons( their_addr.sin_port ) );
 
-                    newsock = accept( sock, (struct sockaddr*)&their_addr, &size );
+#if defined( SO_NOSIGPIPE )
+                    int nosigpipe = 1;
+                    setsockopt( newsock, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof( int ) );
+#endif
 
-                    if ( newsock == -1 )
+                    if ( newsock >= maxconns )
                     {
-                        perror( "accept" );
+                        int maxconns_new = newsock * 1.2 + 64;
+
+                        conns = (Connection**)realloc( conns, sizeof( Connection* ) * maxconns_new );
+                        bzero( conns + maxconns, sizeof( Connection* ) * ( maxconns_new - maxconns ) );
+
+                        maxconns = maxconns_new;
                     }
-                    else
-                    {
-                        printf( "CONNECT FROM %s:%d\n", inet_ntoa( their_addr.sin_addr ), htons( their_addr.sin_port ) );
 
-                        FD_SET( newsock, &socks );
-                        if ( newsock > maxsock )
-                        {
-                            maxsock = newsock;
-                        }
+                    conn = connection_new( newsock );
+
+                    if ( !set_nonblocking( newsock ) || poller_add( poller, newsock, conn ) == -1 )
+                    {
+                        perror( "poller" );
+                        connection_release( ctx, conn );
+                        continue;
                     }
+
+                    conns[ newsock ] = conn;
                 }
-                else
+
+                if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                {
+                    perror( "accept" );
+                }
+            }
+            else if ( !connection_read( ctx, conn ) )
+            {
+                printf( "CLOSE CONNECTION\n" );
+
+                if ( ctx->d_blocks )
                 {
-                    socket_data_handler( ctx, s, &socks );
+                    dispatch_release( ctx, conn, 0 );
                 }
+
+                poller_del( poller, conn->sock );
+                conns[ conn->sock ] = NULL;
+
+                connection_release( ctx, conn );
             }
         }
     }
 
+    // connections still held by queued responses are closed by the responders
+
+    int i;
+    for ( i = 0; i < maxconns; i++ )
+    {
+        if ( conns[ i ] )
+        {
+            connection_release( ctx, conns[ i ] );
+        }
+    }
+
+    free( conns );
+
+    close( poller );
     close( sock );
 
     return NULL;
@@ -1226,6 +2796,8 @@ static void* worker_thread( void* arg )
 
     printf( "worker thread %d reporting for duty\n", wctx->id );
 
+    wctx->q_rng ^= wctx->id + 1;
+
     while ( 1 )
     {
         if ( sem_wait( sctx->queue_fill_count ) )
@@ -1269,6 +2841,8 @@ static void worker_ctx_init( ServerContext* sctx, WorkerContext* wctx )
     wctx->cov_temp.data = malloc( wctx->cov_temp.dmax );
     wctx->db            = sctx->db;
 
+    wctx->q_rng = 88172645463325252ULL;
+
     wctx->trace_max = 1 * 1024 * 1024;
     wctx->trace_cur = 0;
     wctx->trace     = malloc( sizeof( ovl_trace ) * wctx->trace_max );
@@ -1305,139 +2879,520 @@ static void* update_track_thread( void* arg )
             break;
         }
 
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
+        if ( sctx->cov_changed )
+        {
+            pthread_mutex_lock( &( sctx->t_lock ) );
+
+            update_track( sctx );
+
+            pthread_mutex_unlock( &( sctx->t_lock ) );
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    checkpoints are written incrementally. the records of reads that didn't change since
+    the previous checkpoint are copied from its file, only the dirty reads are locked
+    and serialized. no lock is held while writing.
+*/
+
+static int checkpoint_write( ServerContext* sctx, const char* path )
+{
+    time_t time_beg = time( NULL );
+    HITS_DB* db     = sctx->db;
+
+    FILE* fileOut = fopen( path, "w" );
+
+    if ( fileOut == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", path );
+        return 0;
+    }
+
+    setvbuf( fileOut, NULL, _IOFBF, IO_BUFFER_SIZE );
+
+    FILE* filePrev = NULL;
+
+    if ( sctx->checkpoint_prev && ( filePrev = fopen( sctx->checkpoint_prev, "r" ) ) == NULL )
+    {
+        fprintf( stderr, "failed to open previous checkpoint %s, writing all reads\n", sctx->checkpoint_prev );
+    }
+
+    // compact checkpoints: marker, nreads, segment width and level step.
+    // compact reads have no run-length encoded elements, their segments follow instead.
+    // the checkpoints of a shard start with a marker and its read range and contain only those reads.
+
+    if ( sctx->shard )
+    {
+        int shard = CHECKPOINT_SHARD;
+
+        fwrite( &shard, sizeof( shard ), 1, fileOut );
+        fwrite( &( sctx->r_first ), sizeof( sctx->r_first ), 1, fileOut );
+        fwrite( &( sctx->r_last ), sizeof( sctx->r_last ), 1, fileOut );
+    }
+
+    if ( sctx->q_width )
+    {
+        int compact = CHECKPOINT_COMPACT;
+
+        fwrite( &compact, sizeof( compact ), 1, fileOut );
+        fwrite( &( db->nreads ), sizeof( db->nreads ), 1, fileOut );
+        fwrite( &( sctx->q_width ), sizeof( sctx->q_width ), 1, fileOut );
+        fwrite( &( sctx->q_step ), sizeof( sctx->q_step ), 1, fileOut );
+    }
+    else
+    {
+        fwrite( &( db->nreads ), sizeof( db->nreads ), 1, fileOut );
+    }
+
+    uint64* off  = sctx->checkpoint_off;
+    uint64* noff = sctx->checkpoint_noff;
+    uint64 cur   = ftello( fileOut );
+    uint64 rmax  = 1024;
+    char* rec    = malloc( rmax );
+    char* copy   = malloc( IO_BUFFER_SIZE );
+    int dirty    = 0;
+    int i        = sctx->r_first;
+    int last     = sctx->r_last;
+
+    while ( i < last )
+    {
+        if ( filePrev && !( sctx->cov_dirty[ i ] & DIRTY_CHECKPOINT ) )
+        {
+            // copy the records of a run of clean reads
+
+            int j = i;
+
+            while ( j < last && !( sctx->cov_dirty[ j ] & DIRTY_CHECKPOINT ) )
+            {
+                noff[ j ] = cur + ( off[ j ] - off[ i ] );
+                j++;
+            }
+
+            uint64 pos = off[ i ];
+            uint64 end = off[ j ];
+
+            while ( pos < end )
+            {
+                size_t len = MIN( end - pos, IO_BUFFER_SIZE );
+
+                if ( pread( fileno( filePrev ), copy, len, pos ) != (ssize_t)len )
+                {
+                    break;
+                }
+
+                fwrite( copy, 1, len, fileOut );
+                pos += len;
+            }
+
+            if ( pos != end )
+            {
+                fprintf( stderr, "failed to read previous checkpoint %s\n", sctx->checkpoint_prev );
+                break;
+            }
+
+            cur += end - off[ i ];
+            i = j;
+
+            continue;
+        }
+
+        // serialize under the lock, write after releasing it
+
+        int lock = rid2lock( i );
+
+        pthread_mutex_lock( sctx->cov_locks + lock );
+
+        sctx->cov_dirty[ i ] &= ~DIRTY_CHECKPOINT;
+
+        ReadCoverage* cov = sctx->cov + i;
+
+        // count data elements
+
+        size_t items = 0;
+        if ( cov->data )
+        {
+            while ( cov->data[ items ].count )
+            {
+                items++;
+            }
+        }
+
+        uint64 nbytes = items * sizeof( ReadCoverageRle );
+
+        if ( items == 0 && sctx->q_width )
+        {
+            nbytes = sctx->q_off[ i + 1 ] - sctx->q_off[ i ];
+        }
+
+        if ( sizeof( size_t ) + nbytes > rmax )
+        {
+            rmax = ( sizeof( size_t ) + nbytes ) * 1.2 + 1024;
+            rec  = realloc( rec, rmax );
+        }
+
+        // count & elements
+
+        memcpy( rec, &items, sizeof( size_t ) );
+
+        if ( items > 0 )
+        {
+            memcpy( rec + sizeof( size_t ), cov->data, nbytes );
+        }
+        else if ( nbytes > 0 )
+        {
+            memcpy( rec + sizeof( size_t ), sctx->q_data + sctx->q_off[ i ], nbytes );
+        }
+
+        pthread_mutex_unlock( sctx->cov_locks + lock );
+
+        fwrite( rec, 1, sizeof( size_t ) + nbytes, fileOut );
+
+        noff[ i ] = cur;
+        cur += sizeof( size_t ) + nbytes;
+
+        dirty++;
+        i++;
+    }
+
+    noff[ last ] = cur;
+
+    free( rec );
+    free( copy );
+
+    if ( filePrev )
+    {
+        fclose( filePrev );
+    }
+
+    int ok = ( i == last && !ferror( fileOut ) );
+
+    if ( fclose( fileOut ) != 0 || !ok )
+    {
+        // the reads serialized this time are only in the failed file, start over with the next one
+
+        fprintf( stderr, "failed to write checkpoint %s\n", path );
+
+        free( sctx->checkpoint_prev );
+        sctx->checkpoint_prev = NULL;
+
+        return 0;
+    }
+
+    free( sctx->checkpoint_prev );
+    sctx->checkpoint_prev = strdup( path );
+
+    sctx->checkpoint_off  = noff;
+    sctx->checkpoint_noff = off;
+
+    printf( "CHECKPOINT (%ld secs) %d dirty reads\n", time( NULL ) - time_beg, dirty );
+
+    return 1;
+}
+
+static int checkpoint_read( ServerContext* sctx, FILE* fileIn )
+{
+    HITS_DB* db  = sctx->db;
+    int nreads   = 0;
+    int q_width  = 0;
+    int q_step   = 0;
+    uint64 q_rng = 88172645463325252ULL;
+
+    int first = 0;
+    int last  = 0;
+
+    if ( fread( &nreads, sizeof( nreads ), 1, fileIn ) != 1 )
+    {
+        fprintf( stderr, "failed to read nreads from checkpoint file\n" );
+        return 0;
+    }
+
+    if ( nreads == CHECKPOINT_SHARD )
+    {
+        if ( fread( &first, sizeof( first ), 1, fileIn ) != 1 ||
+             fread( &last, sizeof( last ), 1, fileIn ) != 1 ||
+             fread( &nreads, sizeof( nreads ), 1, fileIn ) != 1 )
+        {
+            fprintf( stderr, "failed to read header of shard checkpoint file\n" );
+            return 0;
+        }
+    }
+
+    if ( nreads == CHECKPOINT_COMPACT )
+    {
+        if ( fread( &nreads, sizeof( nreads ), 1, fileIn ) != 1 ||
+             fread( &q_width, sizeof( q_width ), 1, fileIn ) != 1 ||
+             fread( &q_step, sizeof( q_step ), 1, fileIn ) != 1 ||
+             q_width < 1 || q_step < 1 )
+        {
+            fprintf( stderr, "failed to read header of compact checkpoint file\n" );
+            return 0;
+        }
+    }
+
+    if ( nreads != db->nreads )
+    {
+        fprintf( stderr, "failed to restore checkpoint. nreads in db not the same as in checkpoint\n" );
+        return 0;
+    }
+
+    if ( last == 0 )
+    {
+        last = nreads;
+    }
+
+    if ( first != sctx->r_first || last != sctx->r_last )
+    {
+        fprintf( stderr, "failed to restore checkpoint. it contains reads %d..%d, the server owns %d..%d\n",
+                 first, last - 1, sctx->r_first, sctx->r_last - 1 );
+        return 0;
+    }
+
+    unsigned char* values = malloc( DB_READ_MAXLEN( db ) );
+    unsigned char* seg    = q_width ? malloc( QCOV_BYTES( DB_READ_MAXLEN( db ), q_width ) ) : NULL;
+
+    size_t items;
+    int read;
+
+    for ( read = first; read < last && !feof( fileIn ); read++ )
+    {
+        if ( fread( &items, sizeof( size_t ), 1, fileIn ) != 1 )
+        {
+            break;
+        }
+
+        ReadCoverage* cov = sctx->cov + read;
+        int alen          = DB_READ_LEN( db, read );
+
+        if ( items == 0 && q_width )
+        {
+            // compact read of the checkpoint
+
+            uint64 nbytes = QCOV_BYTES( alen, q_width );
+
+            if ( fread( seg, 1, nbytes, fileIn ) != nbytes )
+            {
+                break;
+            }
+
+            if ( sctx->q_width == q_width && sctx->q_step == q_step )
+            {
+                memcpy( sctx->q_data + sctx->q_off[ read ], seg, nbytes );
+                continue;
+            }
+
+            qcov_expand( q_width, q_step, seg, alen, values );
+
+            if ( !sctx->q_width || !qcov_store( sctx, read, values, alen, &q_rng ) )
+            {
+                rle_pack( values, alen, &( cov->data ), &( cov->dmax ) );
+            }
+
+            continue;
+        }
+
+        if ( items >= cov->dmax )
+        {
+            cov->dmax = items * 1.2 + 10;
+            cov->data = (ReadCoverageRle*)realloc( cov->data, sizeof( ReadCoverageRle ) * cov->dmax );
+        }
+
+        if ( fread( cov->data, sizeof( ReadCoverageRle ), items, fileIn ) != items )
+        {
+            break;
+        }
+
+        cov->data[ items ].count = 0;
+        cov->data[ items ].value = 0;
+
+        // exact reads of the checkpoint that are below the threshold become compact
+
+        if ( sctx->q_width )
+        {
+            bzero( values, alen );
+            rle_unpack( values, cov->data );
+
+            if ( qcov_store( sctx, read, values, alen, &q_rng ) )
+            {
+                free( cov->data );
+
+                cov->data = NULL;
+                cov->dmax = 0;
+            }
+        }
+    }
+
+    free( values );
+    free( seg );
+
+    if ( read != last )
+    {
+        fprintf( stderr, "warning: checkpoint didn't contain data for all reads.\n" );
+
+        for ( read = 0; read < nreads; read++ )
+        {
+            ReadCoverage* cov = sctx->cov + read;
+
+            if ( cov->data )
+            {
+                cov->data[ 0 ].count = 0;
+                cov->data[ 0 ].value = 0;
+            }
+        }
+
+        if ( sctx->q_width )
         {
-            pthread_mutex_lock( sctx->cov_locks + i );
+            bzero( sctx->q_data, sctx->q_off[ nreads ] );
         }
+    }
 
-        // pthread_mutex_lock( &(sctx->cov_lock) );
+    return 1;
+}
 
-        if ( sctx->cov_changed )
-        {
-            pthread_mutex_lock( &( sctx->t_lock ) );
+/*
+    queues the .las files showing up in the watched directories (-w) once they are closed
+    after writing or moved there. files also reported by their daligner jobs are counted twice,
+    the watch is meant for jobs that don't report to the server.
+*/
 
-            update_track( sctx );
+#if defined( __APPLE__ )
 
-            pthread_mutex_unlock( &( sctx->t_lock ) );
-        }
+static void watch_open( ServerContext* ctx )
+{
+    UNUSED( ctx );
 
-        // pthread_mutex_unlock( &(sctx->cov_lock) );
+    fprintf( stderr, "watching directories (-w) requires inotify\n" );
+    exit( 1 );
+}
 
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
-        {
-            pthread_mutex_unlock( sctx->cov_locks + i );
-        }
-    }
+static void* watch_thread( void* arg )
+{
+    UNUSED( arg );
 
     return NULL;
 }
 
-static int checkpoint_write( ServerContext* sctx, FILE* fileOut )
-{
-    time_t time_beg = time( NULL );
-
-    fwrite( &( sctx->db->nreads ), sizeof( sctx->db->nreads ), 1, fileOut );
+#else
 
+static void watch_open( ServerContext* ctx )
+{
     int i;
-    for ( i = 0; i < sctx->db->nreads; i++ )
-    {
-        ReadCoverage* cov = sctx->cov + i;
 
-        // count data elements
+    ctx->watch_fd = inotify_init1( IN_NONBLOCK );
 
-        size_t items = 0;
-        if ( cov->data )
-        {
-            while ( cov->data[ items ].count )
-            {
-                items++;
-            }
-        }
+    if ( ctx->watch_fd == -1 )
+    {
+        fprintf( stderr, "failed to initialise inotify: %s\n", strerror( errno ) );
+        exit( 1 );
+    }
 
-        // write count & elements
+    ctx->watch_wd = malloc( sizeof( int ) * ctx->nwatch );
 
-        fwrite( &items, sizeof( size_t ), 1, fileOut );
+    for ( i = 0; i < ctx->nwatch; i++ )
+    {
+        char* dir = realpath( ctx->watch[ i ], NULL );
 
-        if ( items > 0 )
+        if ( dir == NULL ||
+             ( ctx->watch_wd[ i ] = inotify_add_watch( ctx->watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR ) ) == -1 )
         {
-            fwrite( cov->data, sizeof( ReadCoverageRle ), items, fileOut );
+            fprintf( stderr, "failed to watch %s: %s\n", ctx->watch[ i ], strerror( errno ) );
+            exit( 1 );
         }
-    }
 
-    printf( "CHECKPOINT (%ld secs)\n", time( NULL ) - time_beg );
+        ctx->watch[ i ] = dir;
 
-    return 1;
+        printf( "watching %s for .las files\n", dir );
+    }
 }
 
-static int checkpoint_read( ServerContext* sctx, FILE* fileIn )
+static void* watch_thread( void* arg )
 {
-    int nreads = 0;
+    ServerContext* sctx = (ServerContext*)arg;
+    char events[ 64 * 1024 ] __attribute__( ( aligned( __alignof__( struct inotify_event ) ) ) );
 
-    if ( fread( &nreads, sizeof( nreads ), 1, fileIn ) != 1 )
-    {
-        fprintf( stderr, "failed to read nreads from checkpoint file\n" );
-        return 0;
-    }
+    uint64 dmax = 64 * 1024;
+    uint64 dcur = 0;
+    char* data  = malloc( dmax );
 
-    if ( nreads != sctx->db->nreads )
-    {
-        fprintf( stderr, "failed to restore checkpoint. nreads in db not the same as in checkpoint\n" );
-        return 0;
-    }
+    struct pollfd pfd;
+    pfd.fd     = sctx->watch_fd;
+    pfd.events = POLLIN;
 
-    size_t items;
-    int read;
+    printf( "watch thread reporting for duty\n" );
 
-    for ( read = 0; read < nreads && !feof( fileIn ); read++ )
+    while ( !sctx->shutdown )
     {
-        if ( fread( &items, sizeof( size_t ), 1, fileIn ) != 1 )
+        if ( poll( &pfd, 1, 1000 ) < 1 )
         {
-            break;
+            continue;
         }
 
-        ReadCoverage* cov = sctx->cov + read;
+        // the events pending are queued as one batch
 
-        if ( items >= cov->dmax )
-        {
-            cov->dmax = items * 1.2 + 10;
-            cov->data = (ReadCoverageRle*)realloc( cov->data, sizeof( ReadCoverageRle ) * cov->dmax );
-        }
+        ssize_t len;
 
-        if ( fread( cov->data, sizeof( ReadCoverageRle ), items, fileIn ) != items )
+        while ( ( len = read( sctx->watch_fd, events, sizeof( events ) ) ) > 0 )
         {
-            break;
-        }
+            char* ptr = events;
 
-        cov->data[ items ].count = 0;
-        cov->data[ items ].value = 0;
-    }
+            while ( ptr < events + len )
+            {
+                struct inotify_event* ev = (struct inotify_event*)ptr;
+                ptr += sizeof( struct inotify_event ) + ev->len;
 
-    if ( read != nreads )
-    {
-        fprintf( stderr, "warning: checkpoint didn't contain data for all reads.\n" );
+                int nlen = ev->len ? strlen( ev->name ) : 0;
 
-        for ( read = 0; read < nreads; read++ )
-        {
-            ReadCoverage* cov = sctx->cov + read;
+                if ( nlen < 5 || ( ev->mask & IN_ISDIR ) || strcmp( ev->name + nlen - 4, ".las" ) != 0 )
+                {
+                    continue;
+                }
 
-            if ( cov->data )
-            {
-                cov->data[ 0 ].count = 0;
-                cov->data[ 0 ].value = 0;
+                int i;
+                for ( i = 0; i < sctx->nwatch && sctx->watch_wd[ i ] != ev->wd; i++ )
+                {
+                }
+
+                if ( i == sctx->nwatch )
+                {
+                    continue;
+                }
+
+                uint64 plen = strlen( sctx->watch[ i ] ) + nlen + 2;
+
+                if ( dcur + plen > dmax )
+                {
+                    dmax = ( dcur + plen ) * 1.2 + 1000;
+                    data = realloc( data, dmax );
+                }
+
+                sprintf( data + dcur, "%s/%s", sctx->watch[ i ], ev->name );
+                dcur += plen;
             }
         }
+
+        if ( dcur )
+        {
+            queue_add_paths( sctx, data, dcur );
+            dcur = 0;
+        }
     }
 
-    return 1;
+    free( data );
+
+    return NULL;
 }
 
+#endif
+
 static void* checkpoint_thread( void* arg )
 {
     ServerContext* sctx = (ServerContext*)arg;
 
     // pthread_mutex_t* cov_lock = &(sctx->cov_lock);
 
-    char* path = malloc( strlen( sctx->checkpoint ) + 20 );
+    char* path = sctx->checkpoint ? malloc( strlen( sctx->checkpoint ) + 20 ) : NULL;
 
     printf( "checkpoint thread reporting for duty\n" );
 
@@ -1451,28 +3406,20 @@ static void* checkpoint_thread( void* arg )
             i--;
         }
 
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
+        // the store only needs its dirty pages written, checkpoint files are still
+        // written if requested since TKmerge combines those of the shards
+
+        if ( sctx->store )
         {
-            pthread_mutex_lock( sctx->cov_locks + i );
+            store_sync( sctx->store );
         }
 
-        // pthread_mutex_lock(cov_lock);
-
-        sprintf( path, "%s.%d", sctx->checkpoint, sctx->checkpoint_suffix );
-        sctx->checkpoint_suffix = ( sctx->checkpoint_suffix + 1 ) % 2;
-
-        FILE* fileOut = fopen( path, "w" );
-        setvbuf( fileOut, NULL, _IOFBF, IO_BUFFER_SIZE );
-
-        checkpoint_write( sctx, fileOut );
-
-        fclose( fileOut );
-
-        // pthread_mutex_unlock(cov_lock);
-
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
+        if ( sctx->checkpoint )
         {
-            pthread_mutex_unlock( sctx->cov_locks + i );
+            sprintf( path, "%s.%d", sctx->checkpoint, sctx->checkpoint_suffix );
+            sctx->checkpoint_suffix = ( sctx->checkpoint_suffix + 1 ) % 2;
+
+            checkpoint_write( sctx, path );
         }
 
         if ( sctx->shutdown )
@@ -1530,12 +3477,7 @@ static void* reporter_thread( void* arg )
         uint64 reads_with_intervals, bases_masked;
         reads_with_intervals = bases_masked = 0;
 
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
-        {
-            pthread_mutex_lock( sctx->cov_locks + i );
-        }
-
-        // pthread_mutex_lock(cov_lock);
+        pthread_mutex_lock( &( sctx->t_lock ) );
         {
             track_anno* t_anno = sctx->t_anno;
             track_data* t_data = sctx->t_data;
@@ -1581,12 +3523,7 @@ static void* reporter_thread( void* arg )
                 }
             }
         }
-        // pthread_mutex_unlock(cov_lock);
-
-        for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
-        {
-            pthread_mutex_unlock( sctx->cov_locks + i );
-        }
+        pthread_mutex_unlock( &( sctx->t_lock ) );
 
         if ( sctx->report_intervals )
         {
@@ -1600,7 +3537,7 @@ static void* reporter_thread( void* arg )
         }
 
         printf( "      reads %'12d   bases %'18llu\n",
-                sctx->db->nreads, sctx->bases );
+                sctx->r_last - sctx->r_first, sctx->bases );
         printf( "  annotated %'12llu  masked %'18llu (%2d%%)\n",
                 reads_with_intervals, bases_masked, (int)( 100.0 * bases_masked / sctx->bases ) );
     }
@@ -1623,8 +3560,19 @@ static void ctx_init( ServerContext* ctx, HITS_DB* db, HITS_TRACK* mask )
     ctx->t_data = (track_data*)malloc( sizeof( track_data ) * ctx->t_dmax );
     bzero( ctx->t_anno, sizeof( track_anno ) * ( db->nreads + 1 ) );
 
-    ctx->dmax = 10 * 1024;
-    ctx->data = malloc( ctx->dmax );
+    ctx->t_epoch    = ( (uint64)time( NULL ) << 22 ) ^ getpid();
+    ctx->t_version  = 0;
+    ctx->t_rversion = calloc( db->nreads, sizeof( uint64 ) );
+    ctx->t_panno    = (track_anno*)malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
+    ctx->t_pdmax    = ctx->t_dmax;
+    ctx->t_pdata    = (track_data*)malloc( sizeof( track_data ) * ctx->t_pdmax );
+
+    ctx->resp_start = NULL;
+    ctx->resp_end   = NULL;
+
+    pthread_mutex_init( &( ctx->resp_lock ), NULL );
+    pthread_cond_init( &( ctx->resp_cond ), NULL );
+    pthread_mutex_init( &( ctx->conn_lock ), NULL );
 
     ctx->db = db;
 
@@ -1651,17 +3599,74 @@ static void ctx_init( ServerContext* ctx, HITS_DB* db, HITS_TRACK* mask )
     ctx->cov = malloc( sizeof( ReadCoverage ) * db->nreads );
     bzero( ctx->cov, sizeof( ReadCoverage ) * db->nreads );
 
+    ctx->cov_threshold = ctx->cov_expected * COV_FACTOR_THRESHOLD;
+
+    // everything owned is dirty initially
+
+    ctx->cov_dirty = calloc( db->nreads, 1 );
+    memset( ctx->cov_dirty + ctx->r_first, DIRTY_TRACK | DIRTY_CHECKPOINT, ctx->r_last - ctx->r_first );
+
+    ctx->checkpoint_prev = NULL;
+    ctx->checkpoint_off  = malloc( sizeof( uint64 ) * ( db->nreads + 1 ) );
+    ctx->checkpoint_noff = malloc( sizeof( uint64 ) * ( db->nreads + 1 ) );
+
+    if ( ctx->q_width )
+    {
+        // the threshold has to be representable with a level to spare
+
+        ctx->q_step = ctx->cov_threshold / ( Q_LEVELS - 2 ) + 1;
+        ctx->q_off  = malloc( sizeof( uint64 ) * ( db->nreads + 1 ) );
+
+        int i;
+        uint64 off = 0;
+
+        for ( i = 0; i < db->nreads; i++ )
+        {
+            ctx->q_off[ i ] = off;
+
+            if ( owns_read( ctx, i ) )
+            {
+                off += QCOV_BYTES( DB_READ_LEN( db, i ), ctx->q_width );
+            }
+        }
+
+        ctx->q_off[ db->nreads ] = off;
+        ctx->q_data              = calloc( off, 1 );
+
+        printf( "compact coverage, %d bases per segment, %d per level, %'llu bytes\n",
+                ctx->q_width, ctx->q_step, off );
+    }
+    else
+    {
+        ctx->q_off  = NULL;
+        ctx->q_data = NULL;
+    }
+
     // pthread_mutex_init(&(ctx->cov_lock), NULL);
 
     int i;
-    for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
+    for ( i = 0; i < COV_LOCK_STRIPES; i++ )
     {
         pthread_mutex_init( ctx->cov_locks + i, NULL );
     }
 
     FILE* fileIn;
+    int restored = 0;
+
+    ctx->store = NULL;
+
+    if ( ctx->store_path )
+    {
+        restored = store_open( ctx, ctx->store_path );
+    }
+
+    if ( restored )
+    {
+        printf( "resuming from coverage store %s\n", ctx->store_path );
 
-    if ( ctx->checkpoint && ( fileIn = fopen( ctx->checkpoint, "r" ) ) )
+        ctx->cov_changed = 1;
+    }
+    else if ( ctx->checkpoint && ( fileIn = fopen( ctx->checkpoint, "r" ) ) )
     {
         printf( "initialising from checkpoint\n" );
 
@@ -1679,7 +3684,7 @@ static void ctx_init( ServerContext* ctx, HITS_DB* db, HITS_TRACK* mask )
 
         unsigned char* read_cov = malloc( DB_READ_MAXLEN( db ) );
 
-        for ( i = 0; i < db->nreads; i++ )
+        for ( i = ctx->r_first; i < ctx->r_last; i++ )
         {
             b = anno[ i ] / sizeof( track_data );
             e = anno[ i + 1 ] / sizeof( track_data );
@@ -1726,8 +3731,10 @@ static void ctx_init( ServerContext* ctx, HITS_DB* db, HITS_TRACK* mask )
         unsigned char* read_cov = malloc( DB_READ_MAXLEN( db ) );
         bzero( read_cov, DB_READ_MAXLEN( db ) );
 
+        // compact reads start with zero coverage
+
         int i;
-        for ( i = 0; i < db->nreads; i++ )
+        for ( i = ctx->r_first; i < ctx->r_last && !ctx->q_width; i++ )
         {
             int alen = DB_READ_LEN( db, i );
             rle_pack( read_cov, alen, &( ctx->cov[ i ].data ), &( ctx->cov[ i ].dmax ) );
@@ -1738,12 +3745,17 @@ static void ctx_init( ServerContext* ctx, HITS_DB* db, HITS_TRACK* mask )
         free( read_cov );
     }
 
+    if ( ctx->store && !restored )
+    {
+        store_fill( ctx );
+    }
+
     update_track( ctx );
 
     HITS_READ* reads = ctx->db->reads;
 
     int64 bases = 0;
-    for ( i = 0; i < ctx->db->nreads; i++ )
+    for ( i = ctx->r_first; i < ctx->r_last; i++ )
     {
         bases += reads[ i ].rlen;
     }
@@ -1755,6 +3767,9 @@ static void ctx_free( ServerContext* ctx )
 {
     free( ctx->t_anno );
     free( ctx->t_data );
+    free( ctx->t_rversion );
+    free( ctx->t_panno );
+    free( ctx->t_pdata );
 
     sem_close( ctx->queue_fill_count );
     sem_unlink( ctx->path_sem_fill_count );
@@ -1762,25 +3777,42 @@ static void ctx_free( ServerContext* ctx )
 
     pthread_mutex_destroy( &( ctx->t_lock ) );
     pthread_mutex_destroy( &( ctx->queue_lock ) );
+    pthread_mutex_destroy( &( ctx->resp_lock ) );
+    pthread_cond_destroy( &( ctx->resp_cond ) );
+    pthread_mutex_destroy( &( ctx->conn_lock ) );
     // pthread_mutex_destroy( &(ctx->cov_lock) );
 
     int i;
-    for ( i = 0; i < COV_LOCK_GRANULARITY; i++ )
+    for ( i = 0; i < COV_LOCK_STRIPES; i++ )
     {
         pthread_mutex_destroy( ctx->cov_locks + i );
     }
 
-    for ( i = 0; i < ctx->db->nreads; i++ )
+    if ( ctx->store )
+    {
+        store_close( ctx->store );
+    }
+    else
     {
-        if ( ctx->cov[ i ].data )
+        for ( i = 0; i < ctx->db->nreads; i++ )
         {
-            free( ctx->cov[ i ].data );
+            if ( ctx->cov[ i ].data )
+            {
+                free( ctx->cov[ i ].data );
+            }
         }
+
+        free( ctx->q_data );
     }
 
     free( ctx->cov );
 
-    free( ctx->data );
+    free( ctx->q_off );
+
+    free( ctx->cov_dirty );
+    free( ctx->checkpoint_prev );
+    free( ctx->checkpoint_off );
+    free( ctx->checkpoint_noff );
 }
 
 static void sigint_handler( int sig, siginfo_t* si, void* unused )
@@ -1799,35 +3831,29 @@ static void sigint_handler( int sig, siginfo_t* si, void* unused )
 
 static void usage( FILE* fout, const char* app )
 {
-    fprintf( fout, "usage:  %s [-C] [-i track] [-t n] [-p n] [-c minutes] [-r minutes] [-u minutes] database expected.coverage [checkpoint.file]\n\n", app );
+    fprintf( fout, "usage:  %s [-CD] [-i track] [-q n] [-t n] [-s n] [-p n] [-c minutes] [-r minutes] [-u minutes] [-S shard/shards] [-M store] [-w dir ...] database expected.coverage [checkpoint.file]\n\n", app );
 
     fprintf( fout, "Dynamic masking server process. Maintains coverage statistics for all reads and makes masking tracks available to daligner processes.\n\n" );
 
     fprintf( fout, "options:\n" );
     fprintf( fout, "  -t n  worker threads (%d)\n", DEF_ARG_T );
+    fprintf( fout, "  -s n  threads answering track requests (%d)\n", DEF_ARG_S );
     fprintf( fout, "  -p n  listen port (%d)\n", DEF_ARG_P );
     fprintf( fout, "  -c n  minutes between checkpoints (%d)\n", DEF_ARG_C );
     fprintf( fout, "  -r n  minutes between reports (%d)\n", DEF_ARG_R );
     fprintf( fout, "  -u n  minutes between in-memory track updates (%d)\n", DEF_ARG_U );
-    fprintf( fout, "  -i track  initialize masks from track\n\n" );
+    fprintf( fout, "  -i track  initialize masks from track\n" );
+    fprintf( fout, "  -q n  compact coverage statistics in segments of n bases for reads below the threshold (%d, off)\n", DEF_ARG_Q );
+    fprintf( fout, "  -D    hand out the block pairs to daligner -d workers, only for the first of several shards\n" );
+    fprintf( fout, "  -S shard/shards  keep the coverage statistics of the shard-th of shards contiguous ranges of blocks\n" );
+    fprintf( fout, "  -M store  keep the coverage statistics in a memory mapped file, resumed from if it exists\n" );
+    fprintf( fout, "  -w dir  queue the .las files written to dir, can be given multiple times\n\n" );
 
     fprintf( fout, "experimental:\n" );
     fprintf( fout, "  -e n  no repeat masking <int> bases from the read ends. -1 to disable repeat masking altogether (%d)\n", DEF_ARG_E );
     fprintf( fout, "  -C  mask contained reads completely (%d)\n", DEF_ARG_CC );
 }
 
-uint32 ilog2( uint32 x )
-{
-    uint32 shift = 0;
-    while ( x )
-    {
-        x >>= 1;
-        shift += 1;
-    }
-
-    return shift;
-}
-
 int main( int argc, char* argv[] )
 {
     char* app = argv[ 0 ];
@@ -1840,7 +3866,9 @@ int main( int argc, char* argv[] )
     pthread_t* reporter        = &( ctx.thread_reporter );
     pthread_t* track           = &( ctx.thread_track );
     pthread_t* checkpoint      = &( ctx.thread_checkpoint );
+    pthread_t* watch           = &( ctx.thread_watch );
     pthread_t* worker;
+    pthread_t* responder;
     WorkerContext* wctx;
 
     // use the environments locale
@@ -1856,24 +3884,50 @@ int main( int argc, char* argv[] )
     char* init_track_name      = NULL;
     ctx.port              = DEF_ARG_P;
     ctx.worker_threads    = DEF_ARG_T;
+    ctx.responder_threads = DEF_ARG_S;
     ctx.checkpoint        = NULL;
+    ctx.store_path        = NULL;
+    ctx.watch             = NULL;
+    ctx.nwatch            = 0;
     ctx.checkpoint_wait   = DEF_ARG_C;
     ctx.report_wait       = DEF_ARG_R;
     ctx.track_update_wait = DEF_ARG_U;
     ctx.mask_contained    = DEF_ARG_CC;
     ctx.keep_ends         = DEF_ARG_E;
+    ctx.q_width           = DEF_ARG_Q;
 
+    ctx.shard             = 0;
+    ctx.shards            = 0;
+
+    int dispatch = 0;
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "Ci:e:u:r:t:p:c:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "CDi:e:q:u:r:t:s:p:c:S:M:w:" ) ) != -1 )
     {
         switch ( c )
         {
+            case 'S':
+                if ( sscanf( optarg, "%d/%d", &( ctx.shard ), &( ctx.shards ) ) != 2 )
+                {
+                    fprintf( stderr, "malformed shard %s, expected <shard>/<shards>\n", optarg );
+                    exit( 1 );
+                }
+                break;
+
             case 'i':
                 init_track_name = optarg;
                 break;
 
+            case 'M':
+                ctx.store_path = optarg;
+                break;
+
+            case 'w':
+                ctx.watch                = realloc( ctx.watch, sizeof( char* ) * ( ctx.nwatch + 1 ) );
+                ctx.watch[ ctx.nwatch++ ] = optarg;
+                break;
+
             case 'e':
                 ctx.keep_ends = atoi( optarg );
                 break;
@@ -1882,6 +3936,14 @@ int main( int argc, char* argv[] )
                 ctx.mask_contained = 1;
                 break;
 
+            case 'D':
+                dispatch = 1;
+                break;
+
+            case 'q':
+                ctx.q_width = atoi( optarg );
+                break;
+
             case 'c':
                 ctx.checkpoint_wait = atoi( optarg );
                 break;
@@ -1902,6 +3964,10 @@ int main( int argc, char* argv[] )
                 ctx.worker_threads = atoi( optarg );
                 break;
 
+            case 's':
+                ctx.responder_threads = atoi( optarg );
+                break;
+
             default:
                 usage(stdout, app);
                 exit( 1 );
@@ -1941,18 +4007,42 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    if ( ctx.q_width < 0 )
+    {
+        fprintf( stderr, "invalid segment width %d\n", ctx.q_width );
+        exit( 1 );
+    }
+
     if ( ctx.worker_threads < 1 )
     {
         fprintf( stderr, "number of workers threads must be greater than zero\n" );
         exit( 1 );
     }
 
+    if ( ctx.responder_threads < 1 )
+    {
+        fprintf( stderr, "number of responder threads must be greater than zero\n" );
+        exit( 1 );
+    }
+
     if ( ctx.port == 0 )
     {
         fprintf( stderr, "invalid listen port %d\n", ctx.port );
         exit( 1 );
     }
 
+    if ( ctx.shards && ( ctx.shard < 1 || ctx.shard > ctx.shards ) )
+    {
+        fprintf( stderr, "invalid shard %d/%d\n", ctx.shard, ctx.shards );
+        exit( 1 );
+    }
+
+    if ( dispatch && ctx.shard > 1 )
+    {
+        fprintf( stderr, "block pairs are handed out by the first shard (-D)\n" );
+        exit( 1 );
+    }
+
     if ( ctx.cov_expected < 1 || ctx.cov_expected > MAX_COV )
     {
         fprintf( stderr, "expected coverage outside valid internval [1..%d]\n", MAX_COV );
@@ -1979,13 +4069,6 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
-    // lock mask & shift
-    uint32 n_shift = ilog2( db.nreads );
-    uint32 g_shift = ilog2( COV_LOCK_GRANULARITY - 1 );
-
-    ctx.lock_shift = n_shift - g_shift;
-    ctx.lock_mask  = ( COV_LOCK_GRANULARITY - 1 ) << ctx.lock_shift;
-
     // reset db flags
     for ( i = 0; i < db.nreads; i++ )
     {
@@ -1995,8 +4078,50 @@ int main( int argc, char* argv[] )
     worker = (pthread_t*)malloc( sizeof( pthread_t ) * ctx.worker_threads );
     wctx   = (WorkerContext*)malloc( sizeof( WorkerContext ) * ctx.worker_threads );
 
+    responder = (pthread_t*)malloc( sizeof( pthread_t ) * ctx.responder_threads );
+
     printf( "db opened\n" );
 
+    ctx.r_first  = 0;
+    ctx.r_last   = db.nreads;
+    ctx.r_bfirst = NULL;
+
+    if ( ctx.shard )
+    {
+        // contiguous ranges of blocks, as even as possible
+
+        int nblocks = DB_Blocks( pathDb );
+
+        if ( nblocks < ctx.shards )
+        {
+            fprintf( stderr, "%d shards need at least as many blocks in %s\n", ctx.shards, pathDb );
+            exit( 1 );
+        }
+
+        ctx.r_block  = (int64)nblocks * ( ctx.shard - 1 ) / ctx.shards + 1;
+        ctx.r_lblock = (int64)nblocks * ctx.shard / ctx.shards;
+        ctx.r_bfirst = malloc( sizeof( int ) * ( ctx.r_lblock - ctx.r_block + 2 ) );
+
+        int b, beg, end;
+        for ( b = ctx.r_block; b <= ctx.r_lblock; b++ )
+        {
+            if ( DB_block_range( pathDb, b, &beg, &end ) != 1 )
+            {
+                fprintf( stderr, "failed to get the reads of block %d of %s\n", b, pathDb );
+                exit( 1 );
+            }
+
+            ctx.r_bfirst[ b - ctx.r_block ]     = beg;
+            ctx.r_bfirst[ b - ctx.r_block + 1 ] = end;
+        }
+
+        ctx.r_first = ctx.r_bfirst[ 0 ];
+        ctx.r_last  = ctx.r_bfirst[ ctx.r_lblock - ctx.r_block + 1 ];
+
+        printf( "shard %d/%d, blocks %d..%d, reads %d..%d\n",
+                ctx.shard, ctx.shards, ctx.r_block, ctx.r_lblock, ctx.r_first, ctx.r_last - 1 );
+    }
+
     if ( init_track_name )
     {
         init_track = track_load( &db, init_track_name );
@@ -2009,6 +4134,32 @@ int main( int argc, char* argv[] )
 
     ctx_init( &ctx, &db, init_track );
 
+    if ( ctx.nwatch )
+    {
+        watch_open( &ctx );
+    }
+
+    ctx.d_blocks = 0;
+
+    if ( dispatch )
+    {
+        int nblocks = DB_Blocks( pathDb );
+
+        if ( nblocks < 1 )
+        {
+            fprintf( stderr, "no blocks to hand out in %s\n", pathDb );
+            exit( 1 );
+        }
+
+        ctx.d_blocks = nblocks;
+        ctx.d_state  = calloc( (uint64)( nblocks + 1 ) * ( nblocks + 1 ), 1 );
+        ctx.d_held   = calloc( nblocks + 1, sizeof( int ) );
+        ctx.d_open   = (uint64)nblocks * ( nblocks + 1 ) / 2;
+        ctx.d_busy   = 0;
+
+        printf( "handing out %llu pairs of %d blocks\n", ctx.d_open, nblocks );
+    }
+
     if ( track )
     {
         Close_Track( &db, init_track_name );
@@ -2024,11 +4175,21 @@ int main( int argc, char* argv[] )
     pthread_create( reporter, NULL, reporter_thread, &ctx );
     pthread_create( track, NULL, update_track_thread, &ctx );
 
-    if ( ctx.checkpoint )
+    if ( ctx.checkpoint || ctx.store_path )
     {
         pthread_create( checkpoint, NULL, checkpoint_thread, &ctx );
     }
 
+    if ( ctx.nwatch )
+    {
+        pthread_create( watch, NULL, watch_thread, &ctx );
+    }
+
+    for ( i = 0; i < ctx.responder_threads; i++ )
+    {
+        pthread_create( responder + i, NULL, responder_thread, &ctx );
+    }
+
     for ( i = 0; i < ctx.worker_threads; i++ )
     {
         worker_ctx_init( &ctx, wctx + i );
@@ -2043,6 +4204,31 @@ int main( int argc, char* argv[] )
     pthread_join( *reporter, NULL );
     pthread_join( *track, NULL );
 
+    if ( ctx.checkpoint || ctx.store_path )
+    {
+        pthread_join( *checkpoint, NULL );
+    }
+
+    if ( ctx.nwatch )
+    {
+        pthread_join( *watch, NULL );
+
+        for ( i = 0; i < ctx.nwatch; i++ )
+        {
+            free( ctx.watch[ i ] );
+        }
+
+        free( ctx.watch_wd );
+        close( ctx.watch_fd );
+    }
+
+    free( ctx.watch );
+
+    for ( i = 0; i < ctx.responder_threads; i++ )
+    {
+        pthread_join( responder[ i ], NULL );
+    }
+
     for ( i = 0; i < ctx.worker_threads; i++ )
     {
         pthread_join( worker[ i ], NULL );
@@ -2060,9 +4246,18 @@ int main( int argc, char* argv[] )
 
     ctx_free( &ctx );
 
+    if ( ctx.d_blocks )
+    {
+        free( ctx.d_state );
+        free( ctx.d_held );
+    }
+
+    free( ctx.r_bfirst );
+
     Close_DB( &db );
 
     free( worker );
+    free( responder );
     free( wctx );
 
     return 0;
@@ -49,6 +49,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,10 +63,11 @@
 #define MAX( x, y ) ( ( ( x ) > ( y ) ) ? ( x ) : ( y ) )
 
 static char* Usage =
-    {" [-vbAIKSXT] [-k<int(14)>] [-w<int(6)>] [-h<int(35)>] [-t<int>] [-H<int>]\n"
+    {" [-vbdAIKSXTE] [-k<int(14)>] [-w<int(6)>] [-h<int(35)>] [-t<int>] [-H<int>]\n"
      " [-M<int>] [-e<double(.70)] [-l<int(1000)>] [-r<int>] [-s<int(100)>]\n"
      " [--dal<int(4)>] [--dalDiag<int(1)>] [--mrg<int(8)>] [-D host[:port]]\n"
-     " [-o fileSuffix] [-j<int(4)>] [-mtrack]+  <path:db> [<block:int>[-<range:int>]"};
+     " [-o fileSuffix] [-G file] [-P<int>] [-U<int>] [-F file] [-j<int(4)>] [-mtrack]+\n"
+     " [--hitDensity<double>] [--kmerTime<double>] [--hitTime<double>] <path:db> [<block:int>[-<range:int>]"};
 
 static void printUsage( char* prog, FILE* out )
 {
@@ -73,7 +75,22 @@ static void printUsage( char* prog, FILE* out )
     fprintf( out, "  -h            prints this usage info\n" );
     fprintf( out, "  -o ARG        specify a file prefix, if set the daligner plan is written to ARG.dalign.plan and the merge plan is written\n"
                   "                to ARG.merge.plan (default: not set, i.e. everything goes to stdout)\n" );
+    fprintf( out, "  -G ARG        write the daligner and LAmerge jobs as a JSON job graph to ARG, with their input blocks, estimated\n"
+                  "                memory, cost (see DBsplit -c), run time (see --hitDensity) and dependencies. jobs are grouped by A block, diagonal jobs come first (default: not set)\n" );
+    fprintf( out, "  -P ARG        memory of a compute node in Gb, gives the number of slots of a job group in the job graph (default: not set)\n" );
+    fprintf( out, "  -F ARG        daligner suppresses the k-mers that are frequent in the whole database, as listed in ARG by KMsketch (default: not set)\n" );
     fprintf( out, "  -v            enable verbose mode for daligner and LAmerge\n" );
+    fprintf( out, "  -d            report DBdust jobs for each block and the TKcat job that combines their dust tracks. they are written to\n"
+                  "                ARG.dust.plan if -o is set (default: not set)\n" );
+    fprintf( out, "  -E            annotate every daligner job with its estimated peak memory, and its run time if --hitDensity is set\n" );
+    fprintf( out, "  --hitDensity ARG\n"
+                  "                seed hits per pair of k-mers, as reported by a dry run daligner -n. used for the memory of the hit lists\n"
+                  "                and the run time of the jobs in the plan annotations (-E) and the job graph (default: not set)\n" );
+    fprintf( out, "  --kmerTime ARG\n"
+                  "                seconds per million k-mers sorted, as reported by daligner -n (default: not set)\n" );
+    fprintf( out, "  --hitTime ARG seconds per million seed hits, as reported by daligner -n (default: not set)\n" );
+    fprintf( out, "  -U ARG        update an existing assembly with the blocks ARG and up appended by FA2db -a or DBsplit -a. only the pairs\n"
+                  "                with at least one of them are compared and their overlaps merged into the existing <block>.las (default: not set)\n" );
     fprintf( out, "  path          database\n" );
     fprintf( out, "  bID[-bID]     specify a block or a range of blocks\n" );
 
@@ -117,8 +134,18 @@ typedef struct
     int SORT;
     int CONSECUTIVE;
     int NO_TRACE_POINTS;
+    int DUST;
+    int ESTIMATE;
+
+    // measured by daligner -n, for the estimates of -E and -G
+
+    double HIT_DENSITY;
+    double KMER_TIME;
+    double HIT_TIME;
 
     int fblock, lblock;
+    int ublock; // first new block of an update, 0 if none
+    char* freqFile; // globally frequent k-mers (daligner -F)
     char* db; // full name dir + name + .db
     char* dbDir;
     char* dbName;
@@ -129,6 +156,10 @@ typedef struct
     int port;
     FILE* dalignOut;
     FILE* mergeOut;
+    FILE* graphOut;
+    FILE* dustOut;
+    char* dustPlan; // opened after parsing, only if -d is set
+    int NODE_MEM;
 
     // track info
     int MMAX, MTOP;
@@ -169,6 +200,11 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
     hopt->SORT            = 0;
     hopt->CONSECUTIVE     = 0;
     hopt->NO_TRACE_POINTS = 0;
+    hopt->DUST            = 0;
+    hopt->ESTIMATE        = 0;
+    hopt->HIT_DENSITY     = 0.;
+    hopt->KMER_TIME       = 0.;
+    hopt->HIT_TIME        = 0.;
 
     hopt->MTOP = 0;
     hopt->MMAX = 10;
@@ -182,6 +218,12 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
     hopt->dbBlocks  = 0;
     hopt->dalignOut = stdout;
     hopt->mergeOut  = stdout;
+    hopt->graphOut  = NULL;
+    hopt->dustOut   = stdout;
+    hopt->dustPlan  = NULL;
+    hopt->NODE_MEM  = 0;
+    hopt->ublock    = 0;
+    hopt->freqFile  = NULL;
 
     int c;
     while ( 1 )
@@ -211,16 +253,25 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
                 {"mrg", required_argument, 0, 'c'},
                 {"dServer", required_argument, 0, 'D'},
                 {"out", required_argument, 0, 'o'},
+                {"graph", required_argument, 0, 'G'},
+                {"nodeMem", required_argument, 0, 'P'},
+                {"update", required_argument, 0, 'U'},
+                {"frequent", required_argument, 0, 'F'},
                 {"nthreads", required_argument, 0, 'j'},
                 {"track", required_argument, 0, 'm'},
                 {"sort", required_argument, 0, 'S'},
                 {"jobOrder", no_argument, 0, 'X'},
-                {"noTrace", no_argument, 0, 'T'}};
+                {"noTrace", no_argument, 0, 'T'},
+                {"dust", no_argument, 0, 'd'},
+                {"estimate", no_argument, 0, 'E'},
+                {"hitDensity", required_argument, 0, 'x'},
+                {"kmerTime", required_argument, 0, 'y'},
+                {"hitTime", required_argument, 0, 'z'}};
 
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long( argc, argv, "?vbKXTSAIk:w:h:t:H:M:e:l:r:s:n:N:c:D:o:m:j:", long_options, &option_index );
+        c = getopt_long( argc, argv, "?vbdKXTSAIEk:w:h:t:H:M:e:l:r:s:n:N:c:D:o:G:P:U:F:m:j:", long_options, &option_index );
 
         /* Detect the end of the options. */
         if ( c == -1 )
@@ -261,6 +312,36 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
             case 'T':
                 hopt->NO_TRACE_POINTS = 1;
                 break;
+            case 'd':
+                hopt->DUST = 1;
+                break;
+            case 'E':
+                hopt->ESTIMATE = 1;
+                break;
+            case 'x':
+                hopt->HIT_DENSITY = strtod( optarg, NULL );
+                if ( errno || hopt->HIT_DENSITY < 0 )
+                {
+                    fprintf( stderr, "Cannot parse argument from option --hitDensity! \n" );
+                    exit( 1 );
+                }
+                break;
+            case 'y':
+                hopt->KMER_TIME = strtod( optarg, NULL );
+                if ( errno || hopt->KMER_TIME < 0 )
+                {
+                    fprintf( stderr, "Cannot parse argument from option --kmerTime! \n" );
+                    exit( 1 );
+                }
+                break;
+            case 'z':
+                hopt->HIT_TIME = strtod( optarg, NULL );
+                if ( errno || hopt->HIT_TIME < 0 )
+                {
+                    fprintf( stderr, "Cannot parse argument from option --hitTime! \n" );
+                    exit( 1 );
+                }
+                break;
             case 'j':
             {
                 int tmp = atoi( optarg );
@@ -456,9 +537,41 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
                     fprintf( stderr, "ERROR - Cannot open file %s for writing\n", out );
                     exit( 1 );
                 }
-                free( out );
+                sprintf( out, "%s.dust.plan", optarg );
+                hopt->dustPlan = out;
             }
             break;
+            case 'G':
+                if ( ( hopt->graphOut = fopen( optarg, "w" ) ) == NULL )
+                {
+                    fprintf( stderr, "ERROR - Cannot open file %s for writing\n", optarg );
+                    exit( 1 );
+                }
+                break;
+            case 'P':
+                hopt->NODE_MEM = (int)strtol( optarg, NULL, 10 );
+                if ( errno )
+                {
+                    fprintf( stderr, "Cannot parse argument from option -P/--nodeMem! \n" );
+                    exit( 1 );
+                }
+                if ( hopt->NODE_MEM < 1 )
+                {
+                    fprintf( stderr, "Node memory not accepted! Must be > 0! \n" );
+                    exit( 1 );
+                }
+                break;
+            case 'U':
+                hopt->ublock = (int)strtol( optarg, NULL, 10 );
+                if ( errno )
+                {
+                    fprintf( stderr, "Cannot parse argument from option -U/--update! \n" );
+                    exit( 1 );
+                }
+                break;
+            case 'F':
+                hopt->freqFile = optarg;
+                break;
             case 'm':
                 if ( hopt->MTOP >= hopt->MMAX )
                 {
@@ -565,247 +678,682 @@ HPC_OPT* parseOptions( int argc, char* argv[] )
         hopt->lblock = lblock;
     }
 
+    if ( hopt->ublock != 0 && ( hopt->ublock < 2 || hopt->ublock > hopt->dbBlocks ) )
+    {
+        fprintf( stderr, "Invalid first new block %d! Must be in [2, %d]\n", hopt->ublock, hopt->dbBlocks );
+        exit( 1 );
+    }
+
     return hopt;
 }
 
-int main( int argc, char* argv[] )
+typedef struct
 {
+    int ablock;
+    int* bblocks;
+    int nbblocks;
+    int diagonal;   // compares the A block against itself
+    int64 mem;      // estimated peak memory in bytes
+    double cost;    // estimated alignment cost
+    double time;    // estimated run time in seconds, 0 without --hitDensity
+} DAL_JOB;
+
+typedef struct
+{
+    int nreads;
+    int64 bases;
+    int64 cost;     // from the cost section of the DB (DBsplit -c), otherwise the sum of the squared read lengths
+} BLOCK_STAT;
+
+typedef struct
+{
+    char* buf;
+    int len;
+    int max;
+} CMD_BUF;
+
+static void cmd_append( CMD_BUF* cmd, const char* fmt, ... )
+{
+    va_list args;
+    int n;
+
+    while ( 1 )
     {
-        int njobs;
-        int i, j, k;
+        va_start( args, fmt );
+        n = vsnprintf( cmd->buf + cmd->len, cmd->max - cmd->len, fmt, args );
+        va_end( args );
 
-        HPC_OPT* hopt = parseOptions( argc, argv );
+        if ( n < cmd->max - cmd->len )
+            break;
 
-        if ( hopt->DAL_DIAG_JOBS == 0 )
+        cmd->max = 2 * cmd->max + n + 100;
+        cmd->buf = (char*)Realloc( cmd->buf, cmd->max, "Reallocating command buffer" );
+
+        if ( cmd->buf == NULL )
+            exit( 1 );
+    }
+
+    cmd->len += n;
+}
+
+static void cmd_block( CMD_BUF* cmd, HPC_OPT* hopt, int block )
+{
+    if ( strlen( hopt->dbDir ) > 1 )
+        cmd_append( cmd, " %s%s.%d", hopt->dbDir, hopt->dbName, block );
+    else
+        cmd_append( cmd, " %s.%d", hopt->dbName, block );
+}
+
+static char* daligner_cmd( HPC_OPT* hopt, DAL_JOB* job, CMD_BUF* cmd )
+{
+    int k;
+
+    cmd->len = 0;
+    cmd_append( cmd, "daligner" );
+    if ( hopt->VERBOSE )
+        cmd_append( cmd, " -v" );
+    if ( hopt->BIAS )
+        cmd_append( cmd, " -b" );
+    if ( hopt->ASYMMETRY )
+        cmd_append( cmd, " -A" );
+    if ( hopt->IDENTITY )
+        cmd_append( cmd, " -I" );
+    if ( hopt->IGNORE )
+        cmd_append( cmd, " -i" );
+    if ( hopt->KINT != 14 )
+        cmd_append( cmd, " -k%d", hopt->KINT );
+    if ( hopt->WINT != 6 )
+        cmd_append( cmd, " -w%d", hopt->WINT );
+    if ( hopt->HINT != 35 )
+        cmd_append( cmd, " -h%d", hopt->HINT );
+    if ( hopt->TINT > 0 )
+        cmd_append( cmd, " -t%d", hopt->TINT );
+    if ( hopt->HGAP > 0 )
+        cmd_append( cmd, " -H%d", hopt->HGAP );
+    if ( hopt->EREL > .1 )
+        cmd_append( cmd, " -e%g", hopt->EREL );
+    if ( hopt->MREL > .1 )
+        cmd_append( cmd, " -m%g", hopt->MREL );
+    if ( hopt->LINT != 1000 )
+        cmd_append( cmd, " -l%d", hopt->LINT );
+    if ( hopt->SINT != 100 )
+        cmd_append( cmd, " -s%d", hopt->SINT );
+    if ( hopt->NO_TRACE_POINTS > 0 )
+        cmd_append( cmd, " -T" );
+    if ( hopt->MEM > 0 )
+        cmd_append( cmd, " -M%d", hopt->MEM );
+    if ( hopt->host )
+        cmd_append( cmd, " -D%s", hopt->host );
+    if ( hopt->port > 0 )
+        cmd_append( cmd, ":%d", hopt->port );
+    if ( hopt->freqFile )
+        cmd_append( cmd, " -F%s", hopt->freqFile );
+    cmd_append( cmd, " -r%d", hopt->RUN_ID );
+    cmd_append( cmd, " -j%d", hopt->NTHREADS );
+    for ( k = 0; k < hopt->MTOP; k++ )
+        cmd_append( cmd, " -m%s", hopt->MASK[ k ] );
+
+    cmd_block( cmd, hopt, job->ablock );
+    for ( k = 0; k < job->nbblocks; k++ )
+        cmd_block( cmd, hopt, job->bblocks[ k ] );
+
+    return cmd->buf;
+}
+
+static char* merge_cmd( HPC_OPT* hopt, int block, CMD_BUF* cmd )
+{
+    char* dir = getDir( hopt->RUN_ID, block );
+
+    cmd->len = 0;
+    cmd_append( cmd, "LAmerge" );
+    if ( hopt->VERBOSE )
+    {
+        int v;
+
+        cmd_append( cmd, " -" );
+        for ( v = 0; v < hopt->VERBOSE; v++ )
+            cmd_append( cmd, "v" );
+    }
+    if ( hopt->KEEP )
+        cmd_append( cmd, " -k" );
+    if ( hopt->SORT )
+        cmd_append( cmd, " -s" );
+    cmd_append( cmd, " -n %d", hopt->MERGE_JOBS );
+
+    // the new overlaps of an old block are folded into its existing .las
+
+    if ( hopt->ublock > 0 && block < hopt->ublock )
+        cmd_append( cmd, " %s %s.%d.las %s.%d.las %s", hopt->db, hopt->dbName, block, hopt->dbName, block, dir );
+    else
+        cmd_append( cmd, " %s %s.%d.las %s", hopt->db, hopt->dbName, block, dir );
+
+    free( dir );
+
+    return cmd->buf;
+}
+
+static char* dust_cmd( HPC_OPT* hopt, int block, CMD_BUF* cmd )
+{
+    cmd->len = 0;
+    cmd_append( cmd, "DBdust" );
+    if ( hopt->BIAS )
+        cmd_append( cmd, " -b" );
+    cmd_append( cmd, " -T%d", hopt->NTHREADS );
+    cmd_block( cmd, hopt, block );
+
+    return cmd->buf;
+}
+
+static void add_job( DAL_JOB** jobs, int* njobs, int* maxjobs, int ablock, int nbblocks )
+{
+    if ( *njobs >= *maxjobs )
+    {
+        *maxjobs = 1.2 * ( *maxjobs ) + 100;
+        *jobs    = (DAL_JOB*)Realloc( *jobs, *maxjobs * sizeof( DAL_JOB ), "Reallocating job array" );
+
+        if ( *jobs == NULL )
+            exit( 1 );
+    }
+
+    DAL_JOB* job = *jobs + *njobs;
+
+    job->ablock   = ablock;
+    job->bblocks  = (int*)Malloc( nbblocks * sizeof( int ), "Allocating job blocks" );
+    job->nbblocks = 0;
+    job->diagonal = 0;
+    job->mem      = 0;
+
+    if ( job->bblocks == NULL )
+        exit( 1 );
+
+    *njobs += 1;
+}
+
+static void add_block( DAL_JOB* job, int block )
+{
+    job->bblocks[ job->nbblocks++ ] = block;
+
+    if ( block == job->ablock )
+        job->diagonal = 1;
+}
+
+// the daligner calls in plan order
+
+static DAL_JOB* plan_jobs( HPC_OPT* hopt, int* njobs )
+{
+    DAL_JOB* jobs = NULL;
+    int maxjobs   = 0;
+    int i, j;
+
+    *njobs = 0;
+
+    // if ddust server is not used, then report daligner jobs linewise i.e. block.1 vs block 1...n, block.2 vs block 1...n, ... block.n vs block 1...n
+    if ( hopt->CONSECUTIVE )
+    {
+        for ( i = hopt->fblock; i <= hopt->lblock; i++ )
         {
-            if ( hopt->host == NULL )
-                hopt->DAL_DIAG_JOBS = hopt->DAL_JOBS;
+            int low, hgh;
+
+            if ( hopt->ASYMMETRY )
+                low = hopt->fblock;
             else
-                hopt->DAL_DIAG_JOBS = 1;
-        }
+                low = i;
+            hgh     = hopt->lblock;
+            int count;
+            while ( low <= hgh )
+            {
+                count = 0;
 
-        njobs = 0;
+                add_job( &jobs, njobs, &maxjobs, i, hopt->DAL_JOBS );
 
-        if ( hopt->CONSECUTIVE )
+                while ( low <= hgh && count < hopt->DAL_JOBS )
+                {
+                    add_block( jobs + *njobs - 1, low );
+                    count++;
+                    low++;
+                }
+            }
+        }
+    }
+    else
+    {
+        int cur       = 0;
+        int blockCmps = ( hopt->lblock - hopt->fblock + 1 ) * ( hopt->lblock - hopt->fblock + 2 ) / 2;
+        int test      = 0;
+        int first     = 1;
+        int low, hgh;
+
+        while ( cur < blockCmps )
         {
             for ( i = hopt->fblock; i <= hopt->lblock; i++ )
             {
-                int low, hgh;
-
-                if ( hopt->ASYMMETRY )
-                    low = hopt->fblock;
+                if ( first )
+                {
+                    hgh = i - test * hopt->DAL_DIAG_JOBS;
+                    low = MAX( hopt->fblock, hgh - hopt->DAL_DIAG_JOBS + 1 );
+                }
                 else
-                    low = i;
-                hgh     = hopt->lblock;
-                int count;
-                while ( low < hgh )
                 {
-                    count = 0;
-                    while ( low <= hgh && count < hopt->DAL_JOBS )
+                    hgh = i - ( hopt->DAL_DIAG_JOBS + ( test - 1 ) * hopt->DAL_JOBS );
+                    low = MAX( hopt->fblock, hgh - hopt->DAL_JOBS + 1 );
+                }
+                if ( hgh >= low )
+                {
+                    add_job( &jobs, njobs, &maxjobs, i, hgh - low + 1 );
+
+                    for ( j = hgh; j >= low; j-- )
                     {
-                        count++;
-                        low++;
+                        cur++;
+                        add_block( jobs + *njobs - 1, j );
                     }
-                    njobs++;
                 }
             }
+            first = 0;
+            test++;
         }
-        else
+    }
+
+    return jobs;
+}
+
+// an update (-U) only compares the pairs with at least one new block, the others are done
+
+static void drop_old_pairs( HPC_OPT* hopt, DAL_JOB* jobs, int* njobs )
+{
+    int i, k, n;
+
+    n = 0;
+    for ( i = 0; i < *njobs; i++ )
+    {
+        DAL_JOB* job = jobs + i;
+        int nb       = 0;
+
+        job->diagonal = 0;
+        for ( k = 0; k < job->nbblocks; k++ )
         {
-            for ( i = hopt->fblock; i <= hopt->lblock; i++ )
+            int b = job->bblocks[ k ];
+
+            if ( job->ablock >= hopt->ublock || b >= hopt->ublock )
             {
-                njobs += 1 + (int)ceil( 1. * MAX( i - hopt->fblock + 1 - hopt->DAL_DIAG_JOBS, 0 ) / hopt->DAL_JOBS );
-                //						printf("%d --> %d (%d)\n", i, 1 + (int)ceil(1.*MAX(i-hopt->fblock+1-hopt->DAL_DIAG_JOBS, 0) / hopt->DAL_JOBS), njobs);
+                job->bblocks[ nb++ ] = b;
+
+                if ( b == job->ablock )
+                    job->diagonal = 1;
             }
         }
+        job->nbblocks = nb;
 
-        int cur = 0;
+        if ( nb > 0 )
+            jobs[ n++ ] = *job;
+        else
+            free( job->bblocks );
+    }
 
-        int blockCmps = ( hopt->lblock - hopt->fblock + 1 ) * ( hopt->lblock - hopt->fblock + 2 ) / 2;
-        int test      = 0;
-        if ( hopt->dalignOut == stdout )
-            fprintf( hopt->dalignOut, "# Daligner jobs (%d)\n", njobs );
-        int first = 1;
-        // if ddust server is not used, then report daligner jobs linewise i.e. block.1 vs block 1...n, block.2 vs block 1...n, ... block.n vs block 1...n
-        if ( hopt->CONSECUTIVE )
+    *njobs = n;
+}
+
+/*
+ * estimate of the peak memory of a daligner call with the memory model of filter.h.
+ * the A block stays loaded while the B blocks are compared one after the other. the
+ * masks are not known here, so every read contributes its length less k k-mers. the
+ * seed hits are only accounted for with the density measured by daligner -n, which
+ * also gives the run time from the k-mers sorted and the seed hits of the job.
+ */
+
+static int64 block_kmers( HPC_OPT* hopt, BLOCK_STAT* stat )
+{
+    return MAX( 0, stat->bases - (int64)hopt->KINT * stat->nreads );
+}
+
+static void estimate_mem( HPC_OPT* hopt, BLOCK_STAT* stats, DAL_JOB* job )
+{
+    BLOCK_STAT* a = stats + job->ablock;
+    int64 amem    = Block_Memory( a->nreads, a->bases );
+    int64 akmers  = block_kmers( hopt, a );
+    int64 limit   = (int64)hopt->MEM * 0x40000000ll;
+    int k;
+
+    job->mem  = 0;
+    job->time = akmers / 1e6 * hopt->KMER_TIME;
+
+    for ( k = 0; k < job->nbblocks; k++ )
+    {
+        BLOCK_STAT* b = stats + job->bblocks[ k ];
+        int64 bkmers  = block_kmers( hopt, b );
+        int64 nhits   = hopt->HIT_DENSITY * akmers * bkmers;
+        int self      = ( job->bblocks[ k ] == job->ablock );
+        int64 mem     = Daligner_Memory( amem, akmers, Block_Memory( b->nreads, b->bases ), bkmers, nhits, self, limit );
+
+        if ( mem > job->mem )
+            job->mem = mem;
+
+        job->time += ( self ? 1 : 2 ) * bkmers / 1e6 * hopt->KMER_TIME + 2 * nhits / 1e6 * hopt->HIT_TIME;
+    }
+
+    if ( hopt->HIT_DENSITY <= 0 )
+        job->time = 0;
+
+    // a comparison of two blocks of equal cost costs as much as one of the blocks
+
+    job->cost = 0;
+    for ( k = 0; k < job->nbblocks; k++ )
+        job->cost += sqrt( (double)stats[ job->ablock ].cost * stats[ job->bblocks[ k ] ].cost );
+
+}
+
+static BLOCK_STAT* block_stats( HPC_OPT* hopt )
+{
+    BLOCK_STAT* stats = (BLOCK_STAT*)Malloc( ( hopt->dbBlocks + 1 ) * sizeof( BLOCK_STAT ), "Allocating block stats" );
+    int64* costs;
+    int ncosts;
+    int b, i;
+
+    if ( stats == NULL )
+        exit( 1 );
+
+    costs = DB_Block_Costs( hopt->db, &ncosts );
+
+    if ( costs != NULL && ncosts != hopt->dbBlocks )
+    {
+        free( costs );
+        costs = NULL;
+    }
+
+    bzero( stats, ( hopt->dbBlocks + 1 ) * sizeof( BLOCK_STAT ) );
+
+    // the block totals cached by DBstats save opening every block
+
+    DB_STATS dbstats;
+
+    if ( DB_Stats_Load( hopt->db, &dbstats ) == 0 )
+    {
+        if ( dbstats.nblocks == hopt->dbBlocks )
         {
-            for ( i = hopt->fblock; i <= hopt->lblock; i++ )
+            for ( b = hopt->fblock; b <= hopt->lblock; b++ )
             {
-                int low, hgh;
+                stats[ b ].nreads = dbstats.breads[ b ];
+                stats[ b ].bases  = dbstats.bbases[ b ];
+                stats[ b ].cost   = costs ? costs[ b ] : dbstats.bcost[ b ];
+            }
 
-                if ( hopt->ASYMMETRY )
-                    low = hopt->fblock;
-                else
-                    low = i;
-                hgh     = hopt->lblock;
-                int count;
-                while ( low <= hgh )
-                {
-                    count = 0;
-                    fprintf( hopt->dalignOut, "daligner" );
-                    if ( hopt->VERBOSE )
-                        fprintf( hopt->dalignOut, " -v" );
-                    if ( hopt->BIAS )
-                        fprintf( hopt->dalignOut, " -b" );
-                    if ( hopt->ASYMMETRY )
-                        fprintf( hopt->dalignOut, " -A" );
-                    if ( hopt->IDENTITY )
-                        fprintf( hopt->dalignOut, " -I" );
-                    if ( hopt->IGNORE )
-                        fprintf( hopt->dalignOut, " -i" );
-                    if ( hopt->KINT != 14 )
-                        fprintf( hopt->dalignOut, " -k%d", hopt->KINT );
-                    if ( hopt->WINT != 6 )
-                        fprintf( hopt->dalignOut, " -w%d", hopt->WINT );
-                    if ( hopt->HINT != 35 )
-                        fprintf( hopt->dalignOut, " -h%d", hopt->HINT );
-                    if ( hopt->TINT > 0 )
-                        fprintf( hopt->dalignOut, " -t%d", hopt->TINT );
-                    if ( hopt->HGAP > 0 )
-                        fprintf( hopt->dalignOut, " -H%d", hopt->HGAP );
-                    if ( hopt->EREL > .1 )
-                        fprintf( hopt->dalignOut, " -e%g", hopt->EREL );
-                    if ( hopt->MREL > .1 )
-                        fprintf( hopt->dalignOut, " -m%g", hopt->MREL );
-                    if ( hopt->LINT != 1000 )
-                        fprintf( hopt->dalignOut, " -l%d", hopt->LINT );
-                    if ( hopt->SINT != 100 )
-                        fprintf( hopt->dalignOut, " -s%d", hopt->SINT );
-                    if ( hopt->MEM > 0 )
-                        fprintf( hopt->dalignOut, " -s%d", hopt->MEM );
-                    if ( hopt->NO_TRACE_POINTS > 0 )
-                        fprintf( hopt->dalignOut, " -T" );
-                    if ( hopt->host )
-                        fprintf( hopt->dalignOut, " -D%s", hopt->host );
-                    if ( hopt->port > 0 )
-                        fprintf( hopt->dalignOut, ":%d", hopt->port );
-                    fprintf( hopt->dalignOut, " -r%d", hopt->RUN_ID );
-                    fprintf( hopt->dalignOut, " -j%d", hopt->NTHREADS );
-                    for ( k = 0; k < hopt->MTOP; k++ )
-                        fprintf( hopt->dalignOut, " -m%s", hopt->MASK[ k ] );
-                    if ( strlen( hopt->dbDir ) > 1 )
-                        fprintf( hopt->dalignOut, " %s%s.%d", hopt->dbDir, hopt->dbName, i );
-                    else
-                        fprintf( hopt->dalignOut, " %s.%d", hopt->dbName, i );
-
-                    while ( low <= hgh && count < hopt->DAL_JOBS )
-                    {
-                        if ( strlen( hopt->dbDir ) > 1 )
-                            fprintf( hopt->dalignOut, " %s%s.%d", hopt->dbDir, hopt->dbName, low );
-                        else
-                            fprintf( hopt->dalignOut, " %s.%d", hopt->dbName, low );
-                        count++;
-                        low++;
-                    }
+            DB_Stats_Free( &dbstats );
+            free( costs );
 
-                    fprintf( hopt->dalignOut, "\n" );
-                }
-            }
+            return stats;
+        }
+
+        DB_Stats_Free( &dbstats );
+    }
+
+    for ( b = hopt->fblock; b <= hopt->lblock; b++ )
+    {
+        HITS_DB block;
+
+        if ( Open_DB_Block( hopt->db, &block, b ) == -1 )
+        {
+            fprintf( stderr, "failed to open block %d of %s\n", b, hopt->db );
+            exit( 1 );
         }
+
+        stats[ b ].nreads = block.nreads;
+        stats[ b ].bases  = block.totlen;
+
+        if ( costs )
+            stats[ b ].cost = costs[ b ];
         else
         {
-            int low, hgh;
-            while ( cur < blockCmps )
+            stats[ b ].cost = 0;
+            for ( i = 0; i < block.nreads; i++ )
+                stats[ b ].cost += (int64)block.reads[ i ].rlen * block.reads[ i ].rlen;
+        }
+
+        Close_DB( &block );
+    }
+
+    free( costs );
+
+    return stats;
+}
+
+static void json_string( FILE* out, const char* str )
+{
+    fputc( '"', out );
+
+    for ( ; *str; str++ )
+    {
+        if ( *str == '"' || *str == '\\' )
+            fprintf( out, "\\%c", *str );
+        else if ( (unsigned char)*str < 0x20 )
+            fprintf( out, "\\u%04x", *str );
+        else
+            fputc( *str, out );
+    }
+
+    fputc( '"', out );
+}
+
+static DAL_JOB* SORT_JOBS;
+
+// diagonal jobs first, since DMserver needs them for its coverage statistics, then grouped by A block
+
+static int cmp_jobs( const void* a, const void* b )
+{
+    DAL_JOB* x = SORT_JOBS + *(int*)a;
+    DAL_JOB* y = SORT_JOBS + *(int*)b;
+
+    if ( x->diagonal != y->diagonal )
+        return y->diagonal - x->diagonal;
+
+    if ( x->ablock != y->ablock )
+        return x->ablock - y->ablock;
+
+    return *(int*)a - *(int*)b;
+}
+
+/*
+ * job graph
+ *
+ * { "db": ..., "nodeMem": ..., "blocks": [ { "id", "reads", "bases", "cost" } ... ],
+ *   "jobs": [ { "id", "type", "group", "ablock", "bblocks", "diagonal", "mem", "cost", "time", "slots", "deps", "cmd" } ... ] }
+ *
+ * jobs of a group share the A block and should run back-to-back on the same node, where its
+ * sequences and k-mer table remain in the page cache. slots is the number of jobs of the group
+ * that fit into the node memory at the same time. merge jobs depend on all daligner
+ * jobs that write into their block's directory.
+ */
+
+static void write_graph( HPC_OPT* hopt, DAL_JOB* jobs, int njobs, CMD_BUF* cmd )
+{
+    FILE* out         = hopt->graphOut;
+    BLOCK_STAT* stats = block_stats( hopt );
+    int* order        = (int*)Malloc( njobs * sizeof( int ), "Allocating job order" );
+    int64* groupMem   = (int64*)Malloc( ( hopt->dbBlocks + 1 ) * sizeof( int64 ), "Allocating group memory" );
+    int i, j, k;
+
+    if ( order == NULL || groupMem == NULL )
+        exit( 1 );
+
+    bzero( groupMem, ( hopt->dbBlocks + 1 ) * sizeof( int64 ) );
+
+    for ( i = 0; i < njobs; i++ )
+    {
+        estimate_mem( hopt, stats, jobs + i );
+
+        if ( jobs[ i ].mem > groupMem[ jobs[ i ].ablock ] )
+            groupMem[ jobs[ i ].ablock ] = jobs[ i ].mem;
+
+        order[ i ] = i;
+    }
+
+    SORT_JOBS = jobs;
+    qsort( order, njobs, sizeof( int ), cmp_jobs );
+
+    fprintf( out, "{\n  \"db\": " );
+    json_string( out, hopt->db );
+    fprintf( out, ",\n  \"nodeMem\": %lld,\n  \"blocks\": [", hopt->NODE_MEM * 0x40000000ll );
+
+    for ( i = hopt->fblock; i <= hopt->lblock; i++ )
+    {
+        fprintf( out, "%s\n    { \"id\": %d, \"reads\": %d, \"bases\": %lld, \"cost\": %lld }",
+                 i == hopt->fblock ? "" : ",", i, stats[ i ].nreads, stats[ i ].bases, stats[ i ].cost );
+    }
+
+    fprintf( out, "\n  ],\n  \"jobs\": [" );
+
+    for ( i = 0; i < njobs; i++ )
+    {
+        DAL_JOB* job = jobs + order[ i ];
+        int slots    = 1;
+
+        if ( hopt->NODE_MEM > 0 && groupMem[ job->ablock ] > 0 )
+            slots = MAX( 1, hopt->NODE_MEM * 0x40000000ll / groupMem[ job->ablock ] );
+
+        fprintf( out, "%s\n    { \"id\": %d, \"type\": \"daligner\", \"group\": %d, \"ablock\": %d, \"bblocks\": [",
+                 i == 0 ? "" : ",", i, job->ablock, job->ablock );
+
+        for ( k = 0; k < job->nbblocks; k++ )
+            fprintf( out, "%s%d", k == 0 ? "" : ", ", job->bblocks[ k ] );
+
+        fprintf( out, "], \"diagonal\": %s, \"mem\": %lld, \"cost\": %.0f, \"time\": %.0f, \"slots\": %d, \"deps\": [], \"cmd\": ",
+                 job->diagonal ? "true" : "false", job->mem, job->cost, job->time, slots );
+        json_string( out, daligner_cmd( hopt, job, cmd ) );
+        fprintf( out, " }" );
+    }
+
+    for ( j = hopt->fblock; j <= hopt->lblock; j++ )
+    {
+        int ndeps = 0;
+
+        fprintf( out, "%s\n    { \"id\": %d, \"type\": \"LAmerge\", \"group\": %d, \"ablock\": %d, \"bblocks\": [], \"diagonal\": false, \"mem\": 0, \"cost\": 0, \"time\": 0, \"slots\": 1, \"deps\": [",
+                 njobs == 0 && j == hopt->fblock ? "" : ",", njobs + j - hopt->fblock, j, j );
+
+        for ( i = 0; i < njobs; i++ )
+        {
+            DAL_JOB* job = jobs + order[ i ];
+            int dep      = ( job->ablock == j );
+
+            for ( k = 0; !dep && !hopt->ASYMMETRY && k < job->nbblocks; k++ )
+                dep = ( job->bblocks[ k ] == j );
+
+            if ( dep )
+                fprintf( out, "%s%d", ndeps++ == 0 ? "" : ", ", i );
+        }
+
+        fprintf( out, "], \"cmd\": " );
+        json_string( out, merge_cmd( hopt, j, cmd ) );
+        fprintf( out, " }" );
+    }
+
+    fprintf( out, "\n  ]\n}\n" );
+
+    free( groupMem );
+    free( order );
+    free( stats );
+}
+
+int main( int argc, char* argv[] )
+{
+    {
+        int njobs;
+        int i;
+        CMD_BUF cmd = {NULL, 0, 0};
+
+        HPC_OPT* hopt = parseOptions( argc, argv );
+
+        if ( hopt->DAL_DIAG_JOBS == 0 )
+        {
+            if ( hopt->host == NULL )
+                hopt->DAL_DIAG_JOBS = hopt->DAL_JOBS;
+            else
+                hopt->DAL_DIAG_JOBS = 1;
+        }
+
+        DAL_JOB* jobs = plan_jobs( hopt, &njobs );
+
+        if ( hopt->ublock > 0 )
+            drop_old_pairs( hopt, jobs, &njobs );
+
+        // the blocks are dusted independently, TKcat combines their tracks once all blocks are done
+
+        if ( hopt->DUST )
+        {
+            if ( hopt->dustPlan && ( hopt->dustOut = fopen( hopt->dustPlan, "w" ) ) == NULL )
             {
-                for ( i = hopt->fblock; i <= hopt->lblock; i++ )
-                {
-                    if ( first )
-                    {
-                        hgh = i - test * hopt->DAL_DIAG_JOBS;
-                        low = MAX( hopt->fblock, hgh - hopt->DAL_DIAG_JOBS + 1 );
-                    }
-                    else
-                    {
-                        hgh = i - ( hopt->DAL_DIAG_JOBS + ( test - 1 ) * hopt->DAL_JOBS );
-                        low = MAX( hopt->fblock, hgh - hopt->DAL_JOBS + 1 );
-                    }
-                    if ( hgh >= low )
-                    {
-                        fprintf( hopt->dalignOut, "daligner" );
-                        if ( hopt->VERBOSE )
-                            fprintf( hopt->dalignOut, " -v" );
-                        if ( hopt->BIAS )
-                            fprintf( hopt->dalignOut, " -b" );
-                        if ( hopt->ASYMMETRY )
-                            fprintf( hopt->dalignOut, " -A" );
-                        if ( hopt->IDENTITY )
-                            fprintf( hopt->dalignOut, " -I" );
-                        if ( hopt->IGNORE )
-                            fprintf( hopt->dalignOut, " -i" );
-                        if ( hopt->KINT != 14 )
-                            fprintf( hopt->dalignOut, " -k%d", hopt->KINT );
-                        if ( hopt->WINT != 6 )
-                            fprintf( hopt->dalignOut, " -w%d", hopt->WINT );
-                        if ( hopt->HINT != 35 )
-                            fprintf( hopt->dalignOut, " -h%d", hopt->HINT );
-                        if ( hopt->TINT > 0 )
-                            fprintf( hopt->dalignOut, " -t%d", hopt->TINT );
-                        if ( hopt->HGAP > 0 )
-                            fprintf( hopt->dalignOut, " -H%d", hopt->HGAP );
-                        if ( hopt->EREL > .1 )
-                            fprintf( hopt->dalignOut, " -e%g", hopt->EREL );
-                        if ( hopt->MREL > .1 )
-                            fprintf( hopt->dalignOut, " -m%g", hopt->MREL );
-                        if ( hopt->LINT != 1000 )
-                            fprintf( hopt->dalignOut, " -l%d", hopt->LINT );
-                        if ( hopt->SINT != 100 )
-                            fprintf( hopt->dalignOut, " -s%d", hopt->SINT );
-                        if ( hopt->NO_TRACE_POINTS > 0 )
-                            fprintf( hopt->dalignOut, " -T" );
-                        if ( hopt->MEM > 0 )
-                            fprintf( hopt->dalignOut, " -s%d", hopt->MEM );
-                        if ( hopt->host )
-                            fprintf( hopt->dalignOut, " -D%s", hopt->host );
-                        if ( hopt->port > 0 )
-                            fprintf( hopt->dalignOut, ":%d", hopt->port );
-                        fprintf( hopt->dalignOut, " -r%d", hopt->RUN_ID );
-                        fprintf( hopt->dalignOut, " -j%d", hopt->NTHREADS );
-                        for ( j = 0; j < hopt->MTOP; j++ )
-                            fprintf( hopt->dalignOut, " -m%s", hopt->MASK[ j ] );
-                        if ( strlen( hopt->dbDir ) > 1 )
-                            fprintf( hopt->dalignOut, " %s%s.%d", hopt->dbDir, hopt->dbName, i );
-                        else
-                            fprintf( hopt->dalignOut, " %s.%d", hopt->dbName, i );
-
-                        for ( j = hgh; j >= low; j-- )
-                        {
-                            cur++;
-                            if ( strlen( hopt->dbDir ) > 1 )
-                                fprintf( hopt->dalignOut, " %s%s.%d", hopt->dbDir, hopt->dbName, j );
-                            else
-                                fprintf( hopt->dalignOut, " %s.%d", hopt->dbName, j );
-                        }
-
-                        fprintf( hopt->dalignOut, "\n" );
-                    }
-                }
-                if ( first && hopt->dalignOut == stdout && hopt->host != NULL )
-                    fprintf( hopt->dalignOut, "# end of diagonal\n" );
-                first = 0;
-                test++;
+                fprintf( stderr, "ERROR - Cannot open file %s for writing\n", hopt->dustPlan );
+                exit( 1 );
             }
+
+            // the old blocks of an update keep their dust tracks
+
+            int dblock = MAX( hopt->fblock, hopt->ublock );
+
+            if ( hopt->dustOut == stdout )
+                fprintf( hopt->dustOut, "# dust jobs (%d)\n", MAX( 0, hopt->lblock - dblock + 1 ) );
+
+            for ( i = dblock; i <= hopt->lblock; i++ )
+                fprintf( hopt->dustOut, "%s\n", dust_cmd( hopt, i, &cmd ) );
+
+            if ( hopt->fblock == 1 && hopt->lblock == hopt->dbBlocks )
+                fprintf( hopt->dustOut, "TKcat %s dust\n", hopt->db );
+
+            if ( hopt->dustOut != stdout )
+                fclose( hopt->dustOut );
+        }
+
+        free( hopt->dustPlan );
+
+        if ( hopt->ESTIMATE )
+        {
+            BLOCK_STAT* stats = block_stats( hopt );
+
+            for ( i = 0; i < njobs; i++ )
+                estimate_mem( hopt, stats, jobs + i );
+
+            free( stats );
         }
+
         if ( hopt->dalignOut == stdout )
-            fprintf( hopt->mergeOut, "# merge jobs(%d)\n", hopt->lblock - hopt->fblock + 1 );
-        char* dir;
-        for ( i = hopt->fblock; i <= hopt->lblock; i++ )
+            fprintf( hopt->dalignOut, "# Daligner jobs (%d)\n", njobs );
+
+        for ( i = 0; i < njobs; i++ )
         {
-            dir = getDir( hopt->RUN_ID, i );
-            fprintf( hopt->mergeOut, "LAmerge" );
-            if ( hopt->VERBOSE )
+            if ( i > 0 && !hopt->CONSECUTIVE && jobs[ i - 1 ].diagonal && !jobs[ i ].diagonal &&
+                 hopt->dalignOut == stdout && hopt->host != NULL )
+                fprintf( hopt->dalignOut, "# end of diagonal\n" );
+
+            fprintf( hopt->dalignOut, "%s", daligner_cmd( hopt, jobs + i, &cmd ) );
+
+            if ( hopt->ESTIMATE )
             {
-                fprintf( hopt->mergeOut, " -" );
-                int v;
-                for ( v = 0; v < hopt->VERBOSE; v++ )
-                    fprintf( hopt->mergeOut, "v" );
+                fprintf( hopt->dalignOut, " # mem %.2fGb", (double)jobs[ i ].mem / 0x40000000ll );
+
+                if ( jobs[ i ].time > 0 )
+                    fprintf( hopt->dalignOut, ", time %.0fs", jobs[ i ].time );
             }
-            if ( hopt->KEEP )
-                fprintf( hopt->mergeOut, " -k" );
-            if ( hopt->SORT )
-                fprintf( hopt->mergeOut, " -s" );
-            fprintf( hopt->mergeOut, " -n %d", hopt->MERGE_JOBS );
-            fprintf( hopt->mergeOut, " %s %s.%d.las %s \n", hopt->db, hopt->dbName, i, dir );
+
+            fprintf( hopt->dalignOut, "\n" );
         }
+
+        if ( njobs > 0 && !hopt->CONSECUTIVE && hopt->dalignOut == stdout && hopt->host != NULL && jobs[ njobs - 1 ].diagonal )
+            fprintf( hopt->dalignOut, "# end of diagonal\n" );
+
+        if ( hopt->dalignOut == stdout )
+            fprintf( hopt->mergeOut, "# merge jobs(%d)\n", hopt->lblock - hopt->fblock + 1 );
+
+        for ( i = hopt->fblock; i <= hopt->lblock; i++ )
+            fprintf( hopt->mergeOut, "%s \n", merge_cmd( hopt, i, &cmd ) );
+
+        if ( hopt->graphOut )
+        {
+            write_graph( hopt, jobs, njobs, &cmd );
+            fclose( hopt->graphOut );
+        }
+
+        for ( i = 0; i < njobs; i++ )
+            free( jobs[ i ].bblocks );
+
+        free( jobs );
+        free( cmd.buf );
     }
 
     exit( 0 );
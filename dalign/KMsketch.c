@@ -0,0 +1,526 @@
+
+/*
+    finds the k-mers that are frequent in the whole database, for daligner -F
+
+    daligner -t suppresses the k-mers that are frequent within a block, but a repeat that
+    is spread over many blocks stays below -t in each of them and floods Match_Filter with
+    hits. the k-mers of all blocks are counted in a count-min sketch of -d rows of 2^-w
+    counters (exact counts when all k-mers fit into the sketch), a k-mer and its reverse
+    complement share a counter. the blocks are processed one after the other, the reads
+    of a block are spread over -j threads.
+
+    a k-mer is frequent if its estimate reaches -c, by default -f times the median count
+    of the k-mer occurrences, i.e. the count of a typical k-mer of the genome. a second
+    pass collects the frequent k-mers, both orientations of them are written sorted to
+    the output file (see KFreq_Header in filter.h).
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "db/DB.h"
+#include "filter.h"
+
+#define DEF_ARG_K 14
+#define DEF_ARG_W 26
+#define DEF_ARG_D 4
+#define DEF_ARG_F 8.0
+#define DEF_ARG_J 4
+
+#define MAX_HIST ( 1 << 20 ) // counts beyond are pooled for the median
+
+#define MIN( x, y ) ( ( ( x ) < ( y ) ) ? ( x ) : ( y ) )
+#define MAX( x, y ) ( ( ( x ) > ( y ) ) ? ( x ) : ( y ) )
+
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+// the sketch
+
+static int Kmer;
+static uint64 Kmask;
+static int Depth;
+static uint64 Width;
+static int Exact; // a row indexed by the canonical k-mer
+static uint32* Counts;
+static uint32 Cutoff;
+
+static uint64 Seeds[] = {0x9e3779b97f4a7c15llu, 0xc2b2ae3d27d4eb4fllu, 0x165667b19e3779f9llu,
+                         0xd6e8feb86659fd93llu, 0xa0761d6478bd642fllu, 0xe7037ed1a0b428dbllu,
+                         0x8ebc6af09c88c6e3llu, 0x589965cc75374cc3llu};
+
+#define MAX_DEPTH ( (int)( sizeof( Seeds ) / sizeof( uint64 ) ) )
+
+typedef struct
+{
+    HITS_DB* block;
+    int beg, end; // reads
+
+    // collect pass, distinct frequent k-mers
+
+    uint64* set;
+    uint64 smax;
+    uint64 slen;
+} Sketch_Arg;
+
+static void usage()
+{
+    fprintf( stderr, "usage: [-v] [-k<int(%d)>] [-w<int(%d)>] [-d<int(%d)>] [-f<double(%.1f)>] [-c<int>] [-j<int(%d)>]\n",
+             DEF_ARG_K, DEF_ARG_W, DEF_ARG_D, DEF_ARG_F, DEF_ARG_J );
+    fprintf( stderr, "       <db> <out:kfreq>\n" );
+    fprintf( stderr, "options: -v ... verbose\n" );
+    fprintf( stderr, "         -k ... k-mer length, the one given to daligner (default: %d)\n", DEF_ARG_K );
+    fprintf( stderr, "         -w ... 2^-w counters per row of the sketch (default: %d)\n", DEF_ARG_W );
+    fprintf( stderr, "         -d ... rows of the sketch (default: %d, at most %d)\n", DEF_ARG_D, MAX_DEPTH );
+    fprintf( stderr, "         -f ... frequent k-mers occur -f times more often than the median k-mer (default: %.1f)\n", DEF_ARG_F );
+    fprintf( stderr, "         -c ... frequent k-mers occur at least -c times in the database, overrides -f\n" );
+    fprintf( stderr, "         -j ... number of threads (default: %d)\n", DEF_ARG_J );
+}
+
+static inline uint64 mix( uint64 c )
+{
+    c ^= ( c >> 31 );
+    c *= 0x7fb5d329728ea185llu;
+    c ^= ( c >> 27 );
+    c *= 0x81dadef4bc2dd44dllu;
+    c ^= ( c >> 33 );
+    return c;
+}
+
+static inline uint32* counter( int row, uint64 canon )
+{
+    if ( Exact )
+        return Counts + canon;
+
+    return Counts + row * Width + ( mix( canon ^ Seeds[ row ] ) & ( Width - 1 ) );
+}
+
+static inline uint32 estimate( uint64 canon )
+{
+    uint32 est = *counter( 0, canon );
+    int row;
+
+    for ( row = 1; row < Depth; row++ )
+    {
+        uint32 c = *counter( row, canon );
+        if ( c < est )
+            est = c;
+    }
+
+    return est;
+}
+
+// calls visit for the canonical code of each k-mer of the arg's reads
+
+#define FOR_KMERS( arg, canon, visit )                                         \
+    {                                                                          \
+        HITS_READ* reads = arg->block->reads;                                  \
+        char* bases      = (char*)arg->block->bases;                           \
+        int rshift       = 2 * ( Kmer - 1 );                                   \
+        int i, p;                                                              \
+                                                                               \
+        for ( i = arg->beg; i < arg->end; i++ )                                \
+        {                                                                      \
+            char* s    = bases + reads[ i ].boff;                              \
+            int rlen   = reads[ i ].rlen;                                      \
+            uint64 fwd = 0;                                                    \
+            uint64 rev = 0;                                                    \
+                                                                               \
+            for ( p = 0; p < rlen; p++ )                                       \
+            {                                                                  \
+                int x = s[ p ];                                                \
+                                                                               \
+                fwd = ( ( fwd << 2 ) | x ) & Kmask;                            \
+                rev = ( rev >> 2 ) | ( ( (uint64)( 3 - x ) ) << rshift );      \
+                                                                               \
+                if ( p + 1 >= Kmer )                                           \
+                {                                                              \
+                    uint64 canon = ( fwd < rev ) ? fwd : rev;                  \
+                    visit;                                                     \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    }
+
+static void* count_thread( void* _arg )
+{
+    Sketch_Arg* arg = (Sketch_Arg*)_arg;
+
+    FOR_KMERS( arg, canon, {
+        int row;
+        for ( row = 0; row < Depth; row++ )
+            __atomic_fetch_add( counter( row, canon ), 1, __ATOMIC_RELAXED );
+    } );
+
+    return NULL;
+}
+
+static int set_add( Sketch_Arg* arg, uint64 canon )
+{
+    uint64 mask = arg->smax - 1;
+    uint64 h    = mix( canon ) & mask;
+
+    while ( arg->set[ h ] != canon )
+    {
+        if ( arg->set[ h ] == UINT64_MAX )
+        {
+            arg->set[ h ] = canon;
+            arg->slen += 1;
+            return 1;
+        }
+
+        h = ( h + 1 ) & mask;
+    }
+
+    return 0;
+}
+
+static int set_contains( Sketch_Arg* arg, uint64 canon )
+{
+    uint64 mask = arg->smax - 1;
+    uint64 h    = mix( canon ) & mask;
+
+    while ( arg->set[ h ] != UINT64_MAX )
+    {
+        if ( arg->set[ h ] == canon )
+            return 1;
+
+        h = ( h + 1 ) & mask;
+    }
+
+    return 0;
+}
+
+static void set_grow( Sketch_Arg* arg )
+{
+    uint64* old = arg->set;
+    uint64 omax = arg->smax;
+    uint64 i;
+
+    arg->smax = 2 * omax;
+    arg->slen = 0;
+    arg->set  = malloc( sizeof( uint64 ) * arg->smax );
+    memset( arg->set, 0xff, sizeof( uint64 ) * arg->smax );
+
+    for ( i = 0; i < omax; i++ )
+        if ( old[ i ] != UINT64_MAX )
+            set_add( arg, old[ i ] );
+
+    free( old );
+}
+
+static void* collect_thread( void* _arg )
+{
+    Sketch_Arg* arg = (Sketch_Arg*)_arg;
+
+    FOR_KMERS( arg, canon, {
+        if ( !set_contains( arg, canon ) && estimate( canon ) >= Cutoff )
+        {
+            set_add( arg, canon );
+            if ( 2 * arg->slen > arg->smax )
+                set_grow( arg );
+        }
+    } );
+
+    return NULL;
+}
+
+static void run_blocks( char* db, int nblocks, int nthreads, Sketch_Arg* args, void* ( *worker )( void* ), int verbose )
+{
+    pthread_t threads[ nthreads ];
+    int b, t;
+
+    for ( b = ( nblocks > 0 ? 1 : 0 ); b <= nblocks; b++ )
+    {
+        HITS_DB block;
+
+        if ( Open_DB_Block( db, &block, b ) == -1 )
+        {
+            fprintf( stderr, "failed to open block %d of %s\n", b, db );
+            exit( 1 );
+        }
+
+        Read_All_Sequences( &block, 0 );
+
+        if ( verbose )
+        {
+            printf( "  block %d, %d reads\n", b, block.nreads );
+            fflush( stdout );
+        }
+
+        for ( t = 0; t < nthreads; t++ )
+        {
+            args[ t ].block = &block;
+            args[ t ].beg   = (int)( ( (int64)block.nreads * t ) / nthreads );
+            args[ t ].end   = (int)( ( (int64)block.nreads * ( t + 1 ) ) / nthreads );
+
+            pthread_create( threads + t, NULL, worker, args + t );
+        }
+
+        for ( t = 0; t < nthreads; t++ )
+            pthread_join( threads[ t ], NULL );
+
+        Close_DB( &block );
+    }
+}
+
+// median count of the k-mer occurrences, each counter of the first row weighs with its count
+
+static uint32 median_count()
+{
+    uint64* hist = calloc( MAX_HIST + 1, sizeof( uint64 ) );
+    uint64 total = 0;
+    uint64 i, sum;
+    uint32 c;
+
+    for ( i = 0; i < Width; i++ )
+    {
+        c = Counts[ i ];
+        hist[ MIN( c, MAX_HIST ) ] += c;
+        total += c;
+    }
+
+    sum = 0;
+    for ( c = 1; c <= MAX_HIST; c++ )
+    {
+        sum += hist[ c ];
+        if ( 2 * sum >= total )
+            break;
+    }
+
+    free( hist );
+
+    return MIN( c, MAX_HIST );
+}
+
+static int cmp_code( const void* x, const void* y )
+{
+    uint64 a = *(uint64*)x;
+    uint64 b = *(uint64*)y;
+
+    return ( a > b ) - ( a < b );
+}
+
+int main( int argc, char* argv[] )
+{
+    int kmer       = DEF_ARG_K;
+    int wbits      = DEF_ARG_W;
+    int depth      = DEF_ARG_D;
+    double factor  = DEF_ARG_F;
+    int64 cutoff   = 0;
+    int nthreads   = DEF_ARG_J;
+    int verbose    = 0;
+
+    // process arguments
+
+    int c;
+    opterr = 0;
+
+    while ( ( c = getopt( argc, argv, "vk:w:d:f:c:j:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'v':
+                verbose = 1;
+                break;
+
+            case 'k':
+                kmer = atoi( optarg );
+                break;
+
+            case 'w':
+                wbits = atoi( optarg );
+                break;
+
+            case 'd':
+                depth = atoi( optarg );
+                break;
+
+            case 'f':
+                factor = atof( optarg );
+                break;
+
+            case 'c':
+                cutoff = atoll( optarg );
+                break;
+
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
+            default:
+                usage();
+                exit( 1 );
+        }
+    }
+
+    if ( argc - optind != 2 )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    if ( kmer < 2 || kmer > 31 )
+    {
+        fprintf( stderr, "invalid k-mer length %d, must be in [2,31]\n", kmer );
+        exit( 1 );
+    }
+
+    if ( wbits < 10 || wbits > 32 )
+    {
+        fprintf( stderr, "invalid sketch width %d, must be in [10,32]\n", wbits );
+        exit( 1 );
+    }
+
+    if ( depth < 1 || depth > MAX_DEPTH )
+    {
+        fprintf( stderr, "invalid sketch depth %d, must be in [1,%d]\n", depth, MAX_DEPTH );
+        exit( 1 );
+    }
+
+    if ( factor <= 1 || cutoff < 0 || cutoff > UINT32_MAX || nthreads < 1 )
+    {
+        fprintf( stderr, "invalid -f, -c or -j argument\n" );
+        exit( 1 );
+    }
+
+    char* db      = argv[ optind ];
+    char* pathOut = argv[ optind + 1 ];
+    int nblocks   = DB_Blocks( db );
+
+    Kmer  = kmer;
+    Kmask = ( 0x1llu << ( 2 * kmer ) ) - 1;
+
+    // exact counts if they take no more space than the sketch
+
+    if ( Kmask + 1 <= ( (uint64)depth << wbits ) )
+    {
+        Exact = 1;
+        Depth = 1;
+        Width = Kmask + 1;
+    }
+    else
+    {
+        Depth = depth;
+        Width = 0x1llu << wbits;
+    }
+
+    Counts = calloc( Depth * Width, sizeof( uint32 ) );
+
+    if ( Counts == NULL )
+    {
+        fprintf( stderr, "failed to allocate the sketch of %d x %llu counters\n", Depth, Width );
+        exit( 1 );
+    }
+
+    Sketch_Arg* args = calloc( nthreads, sizeof( Sketch_Arg ) );
+    int t;
+
+    if ( verbose )
+    {
+        printf( "counting %d-mers in %d x %llu%s counters\n", Kmer, Depth, Width, Exact ? " exact" : "" );
+        fflush( stdout );
+    }
+
+    run_blocks( db, nblocks, nthreads, args, count_thread, verbose );
+
+    uint32 median = median_count();
+
+    if ( cutoff > 0 )
+        Cutoff = cutoff;
+    else
+        Cutoff = MAX( 2, (uint32)( factor * median + .5 ) );
+
+    if ( verbose )
+    {
+        printf( "median count %u, frequent k-mers occur at least %u times\n", median, Cutoff );
+        fflush( stdout );
+    }
+
+    for ( t = 0; t < nthreads; t++ )
+    {
+        args[ t ].smax = 1024;
+        args[ t ].set  = malloc( sizeof( uint64 ) * args[ t ].smax );
+        memset( args[ t ].set, 0xff, sizeof( uint64 ) * args[ t ].smax );
+    }
+
+    run_blocks( db, nblocks, nthreads, args, collect_thread, verbose );
+
+    free( Counts );
+
+    // both orientations of the frequent k-mers, sorted and unique
+
+    uint64 ncodes = 0;
+    uint64 i;
+
+    for ( t = 0; t < nthreads; t++ )
+        ncodes += 2 * args[ t ].slen;
+
+    uint64* codes = malloc( sizeof( uint64 ) * ( ncodes + 1 ) );
+    int rshift    = 2 * ( Kmer - 1 );
+
+    ncodes = 0;
+    for ( t = 0; t < nthreads; t++ )
+    {
+        for ( i = 0; i < args[ t ].smax; i++ )
+        {
+            uint64 fwd = args[ t ].set[ i ];
+            uint64 rev = 0;
+            int k;
+
+            if ( fwd == UINT64_MAX )
+                continue;
+
+            for ( k = 0; k < Kmer; k++ )
+                rev |= ( 3 - ( ( fwd >> ( 2 * k ) ) & 0x3 ) ) << ( rshift - 2 * k );
+
+            codes[ ncodes++ ] = fwd;
+            codes[ ncodes++ ] = rev;
+        }
+
+        free( args[ t ].set );
+    }
+
+    qsort( codes, ncodes, sizeof( uint64 ), cmp_code );
+
+    uint64 n = 0;
+    for ( i = 0; i < ncodes; i++ )
+        if ( n == 0 || codes[ n - 1 ] != codes[ i ] )
+            codes[ n++ ] = codes[ i ];
+
+    KFreq_Header head;
+    bzero( &head, sizeof( head ) );
+
+    head.magic   = KFREQ_MAGIC;
+    head.version = KFREQ_VERSION;
+    head.kmer    = Kmer;
+    head.cutoff  = Cutoff;
+    head.len     = n;
+
+    FILE* fileOut = fopen( pathOut, "w" );
+
+    if ( fileOut == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", pathOut );
+        exit( 1 );
+    }
+
+    if ( fwrite( &head, sizeof( head ), 1, fileOut ) != 1 || fwrite( codes, sizeof( uint64 ), n, fileOut ) != n ||
+         fclose( fileOut ) != 0 )
+    {
+        fprintf( stderr, "failed to write %s\n", pathOut );
+        exit( 1 );
+    }
+
+    if ( verbose )
+        printf( "%llu frequent k-mers written to %s\n", n, pathOut );
+
+    free( codes );
+    free( args );
+
+    return 0;
+}
@@ -40,49 +40,186 @@
  *  Merge together in index order, overlap files <XXX>.1.las, <XXX>.2.las, ... into a
  *    single overlap file and output to the standard output
  *
+ *  With -o the target is written directly, the bodies of the sources are copied in the
+ *    kernel (copy_file_range, sendfile) and the overlap count is filled in last
+ *
  *  Author:  Gene Myers
  *  Date  :  July 2013
  *
  *******************************************************************************************/
 
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 #include "db/DB.h"
 #include "align.h"
 
-static char *Usage = "<source:las> > <target>.las";
+static char *Usage = "[-o<target:las>] <source:las> [ > <target>.las ]";
 
 #define MEMORY   1000   //  How many megabytes for output buffer
 
+#define HEADER   (sizeof(int64) + sizeof(int))   //  Bytes of the .las header
+#define CHUNK    (1 << 30)                        //  Largest single in-kernel copy
+
+//  Copy len bytes following the header of in to out at ooff.  copy_file_range keeps the
+//    data in the kernel (and shares extents on file systems that can), sendfile serves
+//    the cases it rejects, e.g. different file systems on older kernels, and plain
+//    reads and writes are the last resort.  Returns 0 on success.
+
+static int copy_body(int in, int out, off_t ooff, int64 len)
+{ off_t  ioff;
+  char  *buf;
+
+  ioff = HEADER;
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 27)
+  while (len > 0)
+    { ssize_t n = copy_file_range(in,&ioff,out,&ooff,len < CHUNK ? len : CHUNK,0);
+      if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+        break;
+      if (n <= 0)
+        return (1);
+      len -= n;
+    }
+#endif
+
+#if defined(__linux__)
+  if (len > 0 && lseek(out,ooff,SEEK_SET) == ooff)
+    while (len > 0)
+      { ssize_t n = sendfile(out,in,&ioff,len < CHUNK ? len : CHUNK);
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+          break;
+        if (n <= 0)
+          return (1);
+        ooff += n;
+        len  -= n;
+      }
+#endif
+
+  if (len == 0)
+    return (0);
+
+  buf = (char *) Malloc(MEMORY * 1000000ll,"Allocating copy buffer");
+  if (buf == NULL)
+    exit (1);
+
+  while (len > 0)
+    { int64   want = len < MEMORY * 1000000ll ? len : MEMORY * 1000000ll;
+      ssize_t n    = pread(in,buf,want,ioff);
+      if (n <= 0 || pwrite(out,buf,n,ooff) != n)
+        { free(buf);
+          return (1);
+        }
+      ioff += n;
+      ooff += n;
+      len  -= n;
+    }
+
+  free(buf);
+  return (0);
+}
+
+//  Concatenate the sources <root>.1.las, <root>.2.las, ... into target.  The header
+//    carries no overlaps until all bodies are in place, so an interrupted run leaves
+//    an empty rather than a truncated file.
+
+static void cat_files(char *pwd, char *root, char *target, int64 novl, int tspace)
+{ int    out, in;
+  int64  zero, size;
+  off_t  ooff;
+  int    i;
+
+  out = open(target,O_WRONLY|O_CREAT|O_TRUNC,0666);
+  if (out < 0)
+    { fprintf(stderr,"%s: Cannot open %s for writing\n",Prog_Name,target);
+      exit (1);
+    }
+
+  zero = 0;
+  if (pwrite(out,&zero,sizeof(int64),0) != sizeof(int64) ||
+      pwrite(out,&tspace,sizeof(int),sizeof(int64)) != sizeof(int))
+    SYSTEM_ERROR
+
+  ooff = HEADER;
+  for (i = 0; 1; i++)
+    { struct stat info;
+      char *name = Catenate(pwd,"/",root,Numbered_Suffix(".",i+1,".las"));
+
+      if ((in = open(name,O_RDONLY)) < 0)
+        break;
+
+      if (fstat(in,&info) < 0 || info.st_size < (off_t) HEADER)
+        { fprintf(stderr,"%s: %s is truncated\n",Prog_Name,name);
+          exit (1);
+        }
+      size = info.st_size - HEADER;
+
+      if (copy_body(in,out,ooff,size))
+        { fprintf(stderr,"%s: Failed to copy %s to %s\n",Prog_Name,name,target);
+          exit (1);
+        }
+
+      ooff += size;
+      close(in);
+    }
+
+  if (ftruncate(out,ooff) < 0)
+    SYSTEM_ERROR
+  if (pwrite(out,&novl,sizeof(int64),0) != sizeof(int64))
+    SYSTEM_ERROR
+  if (close(out) < 0)
+    SYSTEM_ERROR
+}
+
 int main(int argc, char *argv[])
 { char     *iblock, *oblock;
   FILE     *input;
   int64     novl, bsize, ovlsize, ptrsize;
   int       tspace, tbytes;
   char     *pwd, *root;
+  char     *TARGET;
 
-  Prog_Name = Strdup("LAcat","");
+  //  Process options
 
-  if (argc <= 1)
-    { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
-      exit (1);
-    }
+  { int i, j;
+
+    Prog_Name = Strdup("LAcat","");
+
+    TARGET = NULL;
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-' && argv[i][1] == 'o')
+        TARGET = argv[i]+2;
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    if (argc != 2 || (TARGET != NULL && *TARGET == '\0'))
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"      -o: write the target directly, copying the sources in the kernel\n");
+        exit (1);
+      }
+  }
 
   ptrsize = sizeof(void *);
   ovlsize = sizeof(Overlap) - ptrsize;
-  bsize   = MEMORY * 1000000ll;
-  oblock  = (char *) Malloc(bsize,"Allocating output block");
-  iblock  = (char *) Malloc(bsize + ptrsize,"Allocating input block");
-  if (oblock == NULL || iblock == NULL)
-    exit (1);
-  iblock += ptrsize;
-
   pwd    = PathTo(argv[1]);
   root   = Root(argv[1],".las");
 
@@ -116,10 +253,26 @@ int main(int argc, char *argv[])
 
         fclose(input);
       }
+
+    if (TARGET != NULL)
+      { cat_files(pwd,root,TARGET,novl,tspace);
+
+        free(pwd);
+        free(root);
+        exit (0);
+      }
+
     fwrite(&novl,sizeof(int64),1,stdout);
     fwrite(&tspace,sizeof(int32),1,stdout);
   }
 
+  bsize   = MEMORY * 1000000ll;
+  oblock  = (char *) Malloc(bsize,"Allocating output block");
+  iblock  = (char *) Malloc(bsize + ptrsize,"Allocating input block");
+  if (oblock == NULL || iblock == NULL)
+    exit (1);
+  iblock += ptrsize;
+
   { int      i, j;
     Overlap *w;
     int64    tsize, povl;
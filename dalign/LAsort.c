@@ -40,6 +40,10 @@
  *  Load a file U.las of overlaps into memory, sort them all by A,B index,
  *    and then output the result to U.S.las
  *
+ *  The records are sorted on (aread, bread, COMP, abpos) by -j threads, each sorting a
+ *    slice of the keys that are then merged pairwise.  With a memory limit -M, files that
+ *    do not fit are sorted in runs that are spilled to disk and k-way merged.
+ *
  *  Author:  Gene Myers
  *  Date  :  July 2013
  *
@@ -50,66 +54,380 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "db/DB.h"
 #include "align.h"
 
-static char *Usage = "[-v] <align:las> ...";
+static char *Usage = "[-v] [-j<int(4)>] [-M<int>] <align:las> ...";
 
 #define MEMORY   1000   //  How many megabytes for output buffer
 
-static char *IBLOCK;
+#define MEM_UNIT 0x40000000ll    //  -M is given in GB
+
+#define MIN_RUN_BLOCK 1000000    //  Smallest input buffer of a run during the final merge
+
+#define MAX_THREADS   64
+
+typedef struct
+  { uint64 key1;     //  aread, bread
+    uint64 key2;     //  COMP, abpos
+    int64  off;      //  position of the record in the block, also makes the order stable
+  } SortKey;
+
+static int64 ptrsize, ovlsize;
+static int   tbytes;
+
+static inline void MAKE_KEY(SortKey *k, Overlap *o, int64 off)
+{ k->key1 = (((uint64) o->aread) << 32) | ((uint32) o->bread);
+  k->key2 = (((uint64) COMP(o->flags)) << 32) | ((uint32) o->path.abpos);
+  k->off  = off;
+}
+
+static inline int KEY_LESS(SortKey *l, SortKey *r)
+{ if (l->key1 != r->key1)
+    return (l->key1 < r->key1);
+  if (l->key2 != r->key2)
+    return (l->key2 < r->key2);
+  return (l->off < r->off);
+}
+
+static int SORT_KEY(const void *x, const void *y)
+{ SortKey *l = (SortKey *) x;
+  SortKey *r = (SortKey *) y;
+
+  if (KEY_LESS(l,r))
+    return (-1);
+  if (KEY_LESS(r,l))
+    return (1);
+  return (0);
+}
+
+//  Parallel sort: every thread qsorts a slice, then slices are merged pairwise
+
+typedef struct
+  { SortKey *src, *dst;
+    int64    beg, mid, end;
+  } Sort_Arg;
+
+static void *sort_thread(void *arg)
+{ Sort_Arg *a = (Sort_Arg *) arg;
+
+  qsort(a->src+a->beg,a->end-a->beg,sizeof(SortKey),SORT_KEY);
+  return (NULL);
+}
+
+static void *merge_thread(void *arg)
+{ Sort_Arg *a = (Sort_Arg *) arg;
+  SortKey  *s = a->src;
+  SortKey  *d = a->dst + a->beg;
+  int64     i, j;
+
+  i = a->beg;
+  j = a->mid;
+  while (i < a->mid && j < a->end)
+    if (KEY_LESS(s+j,s+i))
+      *d++ = s[j++];
+    else
+      *d++ = s[i++];
+  while (i < a->mid)
+    *d++ = s[i++];
+  while (j < a->end)
+    *d++ = s[j++];
+  return (NULL);
+}
+
+static SortKey *sort_keys(SortKey *keys, SortKey *tmp, int64 n, int nthreads)
+{ pthread_t threads[MAX_THREADS];
+  Sort_Arg  parms[MAX_THREADS];
+  int64     bound[MAX_THREADS+1];
+  int       nslice, t, u;
+
+  if (nthreads > MAX_THREADS)
+    nthreads = MAX_THREADS;
+  if (nthreads > n)
+    nthreads = n;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  nslice = nthreads;
+  for (t = 0; t <= nslice; t++)
+    bound[t] = (n*t)/nslice;
+
+  for (t = 0; t < nslice; t++)
+    { parms[t].src = keys;
+      parms[t].beg = bound[t];
+      parms[t].end = bound[t+1];
+    }
+  for (t = 1; t < nslice; t++)
+    pthread_create(threads+t,NULL,sort_thread,parms+t);
+  sort_thread(parms);
+  for (t = 1; t < nslice; t++)
+    pthread_join(threads[t],NULL);
+
+  while (nslice > 1)
+    { int npair = nslice/2;
+
+      for (t = 0; t < npair; t++)
+        { parms[t].src = keys;
+          parms[t].dst = tmp;
+          parms[t].beg = bound[2*t];
+          parms[t].mid = bound[2*t+1];
+          parms[t].end = bound[2*t+2];
+        }
+      if (nslice & 1)
+        memcpy(tmp+bound[nslice-1],keys+bound[nslice-1],
+               sizeof(SortKey)*(bound[nslice]-bound[nslice-1]));
+
+      for (t = 1; t < npair; t++)
+        pthread_create(threads+t,NULL,merge_thread,parms+t);
+      merge_thread(parms);
+      for (t = 1; t < npair; t++)
+        pthread_join(threads[t],NULL);
+
+      for (t = 0, u = 0; u <= nslice; t++, u += 2)
+        bound[t] = bound[u];
+      if (nslice & 1)
+        bound[t++] = bound[nslice];
+      nslice = t-1;
+
+      { SortKey *x = keys; keys = tmp; tmp = x; }
+    }
+
+  return (keys);
+}
+
+//  Build the keys of the complete records in block[0..len-1], at most maxn of them.
+//    Returns the number of records, *used is set to the bytes they occupy.
+
+static int64 build_keys(char *block, int64 len, int64 maxn, SortKey *keys, int64 *used)
+{ int64 off, n;
+
+  n   = 0;
+  off = 0;
+  while (n < maxn && off + ovlsize <= len)
+    { Overlap *o = (Overlap *) (block+off-ptrsize);
+      int64    span = ovlsize + o->path.tlen*tbytes;
+
+      if (off + span > len)
+        break;
+      MAKE_KEY(keys+n,o,off-ptrsize);
+      n   += 1;
+      off += span;
+    }
+  *used = off;
+  return (n);
+}
+
+//  Output the records of block in key order through the buffer fblock
+
+static void write_sorted(FILE *output, char *block, SortKey *keys, int64 n,
+                         char *fblock, int64 osize)
+{ int64    j;
+  Overlap *w;
+  int64    tsize, span;
+  char    *fptr, *ftop;
+
+  fptr = fblock;
+  ftop = fblock + osize;
+  for (j = 0; j < n; j++)
+    { w = (Overlap *) (block+keys[j].off);
+      tsize = w->path.tlen*tbytes;
+      span  = ovlsize + tsize;
+      if (fptr + span > ftop)
+        { fwrite(fblock,1,fptr-fblock,output);
+          fptr = fblock;
+        }
+      memcpy(fptr,((char *) w)+ptrsize,ovlsize);
+      fptr += ovlsize;
+      memcpy(fptr,(char *) (w+1),tsize);
+      fptr += tsize;
+    }
+  if (fptr > fblock)
+    fwrite(fblock,1,fptr-fblock,output);
+}
+
+//  A sorted run spilled to disk and its buffer during the final merge
+
+typedef struct
+  { FILE    *stream;
+    int64    novl;
+    char    *block;
+    int64    bsize;
+    char    *ptr, *top;
+    Overlap  ovl;
+    SortKey  key;
+  } Run;
+
+static void run_fill(Run *r)
+{ int64 left = r->top - r->ptr;
 
-static int SORT_OVL(const void *x, const void *y)
-{ int64 l = *((int64 *) x);
-  int64 r = *((int64 *) y);
+  memmove(r->block,r->ptr,left);
+  r->ptr = r->block;
+  r->top = r->block + left + fread(r->block+left,1,r->bsize-left,r->stream);
+}
 
-  Overlap *ol, *or;
-  int      al, ar;
-  int      bl, br;
-  int      pl, pr;
+//  Load the header of the next record of r into r->ovl and r->key
 
-  ol = (Overlap *) (IBLOCK+l);
-  al = ol->aread;
-  bl = ol->bread;
+static void run_next(Run *r, int idx)
+{ if (r->ptr + ovlsize > r->top)
+    run_fill(r);
+  memcpy(((char *) &(r->ovl))+ptrsize,r->ptr,ovlsize);
+  MAKE_KEY(&(r->key),&(r->ovl),idx);
+}
 
-  or = (Overlap *) (IBLOCK+r);
-  ar = or->aread;
-  br = or->bread;
+static void run_reheap(int s, Run **heap, int hsize)
+{ int  c, l, r;
+  Run *hs, *hr, *hl;
+
+  c  = s;
+  hs = heap[s];
+  while ((l = 2*c) <= hsize)
+    { r  = l+1;
+      hl = heap[l];
+      if (r > hsize)
+        hr = NULL;
+      else
+        hr = heap[r];
+      if (hr != NULL && KEY_LESS(&(hr->key),&(hl->key)))
+        { if (KEY_LESS(&(hr->key),&(hs->key)))
+            { heap[c] = hr;
+              c = r;
+            }
+          else
+            break;
+        }
+      else
+        { if (KEY_LESS(&(hl->key),&(hs->key)))
+            { heap[c] = hl;
+              c = l;
+            }
+          else
+            break;
+        }
+    }
+  if (c != s)
+    heap[c] = hs;
+}
 
-  if (al != ar)
-    return (al-ar);
-  if (bl != br)
-    return (bl-br);
+static void merge_runs(FILE *output, Run *runs, int nruns, int64 bytes,
+                       char *fblock, int64 osize)
+{ Run  **heap;
+  int    hsize, k;
+  char  *fptr, *ftop;
+
+  heap = (Run **) Malloc(sizeof(Run *)*(nruns+1),"Allocating LAsort merge heap");
+  if (heap == NULL)
+    exit (1);
+
+  hsize = 0;
+  for (k = 0; k < nruns; k++)
+    { Run *r = runs+k;
+
+      r->bsize = bytes/nruns;
+      if (r->bsize < MIN_RUN_BLOCK)
+        r->bsize = MIN_RUN_BLOCK;
+      r->block = (char *) Malloc(r->bsize,"Allocating LAsort run buffer");
+      if (r->block == NULL)
+        exit (1);
+      rewind(r->stream);
+      r->ptr = r->top = r->block;
+      if (r->novl > 0)
+        { run_next(r,k);
+          heap[++hsize] = r;
+        }
+    }
 
-  pl = ol->path.abpos;
-  pr = or->path.abpos;
+  for (k = hsize/2; k >= 1; k--)
+    run_reheap(k,heap,hsize);
+
+  fptr = fblock;
+  ftop = fblock + osize;
+  while (hsize > 0)
+    { Run  *r = heap[1];
+      int64 span = ovlsize + r->ovl.path.tlen*tbytes;
+
+      if (r->ptr + span > r->top)
+        { if (span > r->bsize)
+            { int64 off = r->ptr - r->block;
+              int64 top = r->top - r->block;
+
+              r->bsize = span;
+              r->block = (char *) Realloc(r->block,r->bsize,"Reallocating LAsort run buffer");
+              if (r->block == NULL)
+                exit (1);
+              r->ptr = r->block + off;
+              r->top = r->block + top;
+            }
+          run_fill(r);
+        }
+
+      if (fptr + span > ftop)
+        { fwrite(fblock,1,fptr-fblock,output);
+          fptr = fblock;
+        }
+      memcpy(fptr,r->ptr,span);
+      fptr   += span;
+      r->ptr += span;
+
+      r->novl -= 1;
+      if (r->novl > 0)
+        run_next(r,r-runs);
+      else
+        heap[1] = heap[hsize--];
+      if (hsize > 0)
+        run_reheap(1,heap,hsize);
+    }
+  if (fptr > fblock)
+    fwrite(fblock,1,fptr-fblock,output);
 
-  return (pl-pr);
+  for (k = 0; k < nruns; k++)
+    { free(runs[k].block);
+      fclose(runs[k].stream);
+    }
+  free(heap);
 }
 
 int main(int argc, char *argv[])
 { char     *iblock, *fblock;
   int64     isize,   osize;
-  int64     ovlsize, ptrsize;
-  int       tspace, tbytes;
+  int64     memlimit;
+  SortKey  *keys, *ktmp;
+  int64     kmax;
+  int       tspace;
   int       i;
 
   int       VERBOSE;
- 
+  int       NTHREADS;
+  int       MEMLIMIT;
+
   //  Process options
 
   { int j, k;
     int flags[128];
+    char *eptr;
 
     ARG_INIT("LAsort")
 
+    NTHREADS = 4;
+    MEMLIMIT = 0;
+
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
-        { ARG_FLAGS("v") }
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("v")
+            break;
+          case 'j':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+          case 'M':
+            ARG_NON_NEGATIVE(MEMLIMIT,"Memory limit")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
@@ -118,30 +436,44 @@ int main(int argc, char *argv[])
 
     if (argc <= 1)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"      -v: verbose\n");
+        fprintf(stderr,"      -j: number of sorting threads\n");
+        fprintf(stderr,"      -M: memory limit in GB, larger files are sorted in runs on disk\n");
         exit (1);
       }
 
   }
 
-  //  For each file do
+  //  With a memory limit 1/8th goes to the output buffer, 1/2 to the records of
+  //    a run and the rest to its two key arrays
+
+  ptrsize  = sizeof(void *);
+  ovlsize  = sizeof(Overlap) - ptrsize;
+  memlimit = MEMLIMIT * MEM_UNIT;
+  isize    = 0;
+  iblock   = NULL;
+  kmax     = 0;
+  keys     = NULL;
+  ktmp     = NULL;
+  osize    = MEMORY * 1000000ll;
+  if (memlimit > 0 && osize > memlimit/8)
+    osize = memlimit/8;
+  fblock   = Malloc(osize,"Allocating LAsort output block");
+  if (fblock == NULL)
+    exit (1);
 
-  ptrsize = sizeof(void *);
-  ovlsize = sizeof(Overlap) - ptrsize;
-  isize   = 0;
-  iblock  = NULL;
-  osize   = MEMORY * 1000000ll;
-  fblock  = Malloc(osize,"Allocating LAsort output block");
+  //  For each file do
 
   for (i = 1; i < argc; i++)
-    { int64    *perm;
-      FILE     *input, *foutput;
-      int64     novl;
+    { FILE     *input, *foutput;
+      int64     novl, size;
+      char     *pwd, *root;
 
-      //  Read in the entire file and output header
+      //  Open the file and output header
 
-      { int64  size;
-        struct stat info;
-        char  *pwd, *root, *name;
+      { struct stat info;
+        char  *name;
 
         pwd   = PathTo(argv[i]);
         root  = Root(argv[i],".las");
@@ -179,80 +511,173 @@ int main(int argc, char *argv[])
         fwrite(&novl,sizeof(int64),1,foutput);
         fwrite(&tspace,sizeof(int),1,foutput);
 
-        free(pwd);
-        free(root);
-
-        if (size > isize)
-          { if (iblock == NULL)
-              iblock = Malloc(size+ptrsize,"Allocating LAsort input block");
-            else
-              iblock = Realloc(iblock-ptrsize,size+ptrsize,"Allocating LAsort input block");
-            if (iblock == NULL)
-              exit (1);
-            iblock += ptrsize;
-            isize   = size;
-          }
         size -= (sizeof(int64) + sizeof(int));
-        if (size > 0)
-          { if (fread(iblock,size,1,input) != 1)
-              SYSTEM_ERROR
-          }
-        fclose(input);
       }
 
-      //  Set up unsorted permutation array
-
-      perm = (int64 *) Malloc(sizeof(int64)*novl,"Allocating LAsort permutation vector");
-      if (perm == NULL)
-        exit (1);
-
-      { int64 off;
-        int   j;
+      //  Entire file in memory if there is no limit or it fits
+
+      if (memlimit == 0 || size + 2*novl*((int64) sizeof(SortKey)) + osize <= memlimit)
+        { int64 n, used;
+          SortKey *sorted;
+
+          if (size > isize)
+            { if (iblock == NULL)
+                iblock = Malloc(size+ptrsize,"Allocating LAsort input block");
+              else
+                iblock = Realloc(iblock-ptrsize,size+ptrsize,"Allocating LAsort input block");
+              if (iblock == NULL)
+                exit (1);
+              iblock += ptrsize;
+              isize   = size;
+            }
+          if (size > 0)
+            { if (fread(iblock,size,1,input) != 1)
+                SYSTEM_ERROR
+            }
+
+          if (novl > kmax)
+            { kmax = novl;
+              free(keys);
+              free(ktmp);
+              keys = (SortKey *) Malloc(sizeof(SortKey)*kmax,"Allocating LAsort keys");
+              ktmp = (SortKey *) Malloc(sizeof(SortKey)*kmax,"Allocating LAsort keys");
+              if (keys == NULL || ktmp == NULL)
+                exit (1);
+            }
+
+          n = build_keys(iblock,size,novl,keys,&used);
+          if (n != novl || used != size)
+            { fprintf(stderr,"%s: %s.las is truncated or malformed\n",Prog_Name,root);
+              exit (1);
+            }
 
-        off = -ptrsize;
-        for (j = 0; j < novl; j++)
-          { perm[j] = off;
-            off += ovlsize + ((Overlap *) (iblock+off))->path.tlen*tbytes;
-          }
-      }
+          sorted = sort_keys(keys,ktmp,n,NTHREADS);
+          write_sorted(foutput,iblock,sorted,n,fblock,osize);
+        }
 
-      //  Sort permutation array of ptrs to records
-
-      IBLOCK = iblock;
-      qsort(perm,novl,sizeof(int64),SORT_OVL);
-
-      //  Output the records in sorted order
-
-      { int      j;
-        Overlap *w;
-        int64    tsize, span;
-        char    *fptr, *ftop;
-
-        fptr = fblock;
-        ftop = fblock + osize;
-        for (j = 0; j < novl; j++)
-          { w = (Overlap *) (iblock+perm[j]);
-            tsize = w->path.tlen*tbytes;
-            span  = ovlsize + tsize;
-            if (fptr + span > ftop)
-              { fwrite(fblock,1,fptr-fblock,foutput);
-                fptr = fblock;
-              }
-            memcpy(fptr,((char *) w)+ptrsize,ovlsize);
-            fptr += ovlsize;
-            memcpy(fptr,(char *) (w+1),tsize);
-            fptr += tsize;
-          }
-        if (fptr > fblock)
-          fwrite(fblock,1,fptr-fblock,foutput);
-      }
+      //  Otherwise sort runs that fit the limit, spill them and merge
 
-      free(perm);
+      else
+        { int64 bsize, maxn, have, total;
+          Run  *runs;
+          int   nruns, rmax;
+          int   eof;
+
+          bsize = memlimit/2;
+          maxn  = (memlimit - bsize - osize) / (2*((int64) sizeof(SortKey)));
+          if (maxn < 1)
+            maxn = 1;
+
+          if (bsize > isize)
+            { if (iblock == NULL)
+                iblock = Malloc(bsize+ptrsize,"Allocating LAsort input block");
+              else
+                iblock = Realloc(iblock-ptrsize,bsize+ptrsize,"Allocating LAsort input block");
+              if (iblock == NULL)
+                exit (1);
+              iblock += ptrsize;
+              isize   = bsize;
+            }
+          if (maxn > kmax)
+            { kmax = maxn;
+              free(keys);
+              free(ktmp);
+              keys = (SortKey *) Malloc(sizeof(SortKey)*kmax,"Allocating LAsort keys");
+              ktmp = (SortKey *) Malloc(sizeof(SortKey)*kmax,"Allocating LAsort keys");
+              if (keys == NULL || ktmp == NULL)
+                exit (1);
+            }
+
+          nruns = 0;
+          rmax  = 0;
+          runs  = NULL;
+          have  = 0;
+          total = 0;
+          eof   = 0;
+          while (total < novl)
+            { int64    n, used;
+              SortKey *sorted;
+              char    *rname;
+              Run     *r;
+
+              if (!eof && have < isize)
+                { int64 got = fread(iblock+have,1,isize-have,input);
+                  if (got < isize-have)
+                    eof = 1;
+                  have += got;
+                }
+
+              n = build_keys(iblock,have,maxn,keys,&used);
+              if (n == 0)
+                { if (eof)
+                    { fprintf(stderr,"%s: %s.las is truncated or malformed\n",Prog_Name,root);
+                      exit (1);
+                    }
+                  iblock = Realloc(iblock-ptrsize,2*isize+ptrsize,"Allocating LAsort input block");
+                  if (iblock == NULL)
+                    exit (1);
+                  iblock += ptrsize;
+                  isize  *= 2;
+                  continue;
+                }
+
+              if (nruns >= rmax)
+                { rmax = 1.2*rmax + 10;
+                  runs = (Run *) Realloc(runs,sizeof(Run)*rmax,"Allocating LAsort runs");
+                  if (runs == NULL)
+                    exit (1);
+                }
+
+              rname = Malloc(strlen(pwd)+strlen(root)+50,"Allocating LAsort run name");
+              if (rname == NULL)
+                exit (1);
+              sprintf(rname,"%s/.%s.S.%d.%d.las",pwd,root,getpid(),nruns);
+              r = runs+nruns;
+              r->stream = Fopen(rname,"w+");
+              if (r->stream == NULL)
+                exit (1);
+              unlink(rname);
+              free(rname);
+              r->novl = n;
+
+              sorted = sort_keys(keys,ktmp,n,NTHREADS);
+              write_sorted(r->stream,iblock,sorted,n,fblock,osize);
+
+              nruns += 1;
+              total += n;
+
+              memmove(iblock,iblock+used,have-used);
+              have -= used;
+            }
+
+          //  The run buffers get the whole limit, release the sort buffers first
+
+          free(iblock - ptrsize);
+          free(keys);
+          free(ktmp);
+          iblock = NULL;
+          keys   = ktmp = NULL;
+          isize  = kmax = 0;
+
+          if (VERBOSE)
+            { printf("    merging %d runs\n",nruns);
+              fflush(stdout);
+            }
+
+          merge_runs(foutput,runs,nruns,memlimit-osize,fblock,osize);
+          free(runs);
+        }
+
+      free(pwd);
+      free(root);
+      fclose(input);
       fclose(foutput);
     }
 
   if (iblock != NULL)
     free(iblock - ptrsize);
+  free(keys);
+  free(ktmp);
   free(fblock);
 
   exit (0);
@@ -40,6 +40,11 @@
  *  Split an OVL file arriving from the standard input into 'parts' equal sized .las-files
  *    <align>.1.las, <align>.2.las ... or according to a current partitioning of <path>
  *
+ *  Given the source as a file the cuts are found with its index instead, with -c into parts
+ *    of similar estimated cost rather than overlap count, and the parts are written
+ *    concurrently.  With -m only the manifest <align>.split of the cuts is written, which
+ *    the tools passing over the source take in place of a part file.
+ *
  *  Author:  Gene Myers
  *  Date  :  June 2014
  *
@@ -49,36 +54,302 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "db/DB.h"
 #include "align.h"
+#include "lib/lasidx.h"
+#include "lib/pass.h"
 
-static char *Usage = "<align:las> (<parts:int> | <path:db>) < <source>.las";
+static char *Usage[] =
+    { "[-cm] [-j<int(4)>] <align:las> (<parts:int> | <path:db>) <source:las>",
+      "                   <align:las> (<parts:int> | <path:db>) < <source>.las"
+    };
 
 #define MEMORY   1000   //  How many megabytes for output buffer
+#define PBUFFER    64   //  How many megabytes of buffer per thread writing parts
+
+//  Cut the reads of idx into parts.  With a DB the parts are its blocks bound[0..parts],
+//    otherwise a part ends with the first pile past its share of the overlaps (or of
+//    their cost), like the cuts made when streaming.
+
+static PassSplit *cut_parts(lasidx *idx, int parts, int *bound, int cost)
+{ PassSplit *split;
+  int64      total, acc, hgh;
+  off_t      pos;
+  int        nreads, prev;
+  int        i, r;
+
+  split  = (PassSplit *) Malloc(sizeof(PassSplit)*parts,"Allocating parts");
+  nreads = idx->nreads;
+
+  total = 0;
+  for (r = 0; r < nreads; r++)
+    total += (cost ? lasidx_cost(idx,r) : lasidx_novl(idx,r));
+
+  pos = sizeof(int64) + sizeof(int);
+  acc = 0;
+  r   = 0;
+  for (i = 0; i < parts; i++)
+    { PassSplit *p = split+i;
+      int        last;
+
+      if (bound != NULL)
+        { if (r < bound[i])
+            r = bound[i];
+          last = bound[i+1];
+          if (last > nreads)
+            last = nreads;
+          hgh  = 0;
+        }
+      else
+        { last = nreads;
+          hgh  = (total*(i+1))/parts;
+        }
+
+      p->beg    = p->end = pos;
+      p->novl   = p->cost = 0;
+      p->afirst = r;
+      p->alast  = r-1;
+
+      prev = 0;
+      for ( ; r < last; r++)
+        { uint64 n = lasidx_novl(idx,r);
+
+          if (n == 0)
+            continue;
+          if (bound == NULL && acc >= hgh && r > prev)
+            break;
+          prev = r;
+
+          if (p->novl == 0)
+            { p->afirst = r;
+              p->beg    = lasidx_offset(idx,r);
+            }
+          p->alast = r;
+          p->end   = lasidx_offset(idx,r) + lasidx_bytes(idx,r);
+          p->novl += n;
+          p->cost += lasidx_cost(idx,r);
+
+          acc += (cost ? lasidx_cost(idx,r) : n);
+        }
+
+      if (p->novl > 0)
+        pos = p->end;
+    }
+
+  return (split);
+}
+
+//  Write the parts claimed from the queue, a header followed by their range of the source
+
+typedef struct
+  { int         source;
+    int         tspace;
+    PassSplit  *split;
+    char      **names;
+    int         parts;
+    int         next;
+    int         status;
+    pthread_mutex_t lock;
+  } Part_Queue;
+
+static int write_part(Part_Queue *q, int i, char *buf, int64 bsize)
+{ PassSplit *p = q->split+i;
+  int64      novl;
+  off_t      off;
+  int        out;
+
+  out = open(q->names[i],O_WRONLY|O_CREAT|O_TRUNC,0666);
+  if (out < 0)
+    { fprintf(stderr,"%s: Cannot open %s for writing\n",Prog_Name,q->names[i]);
+      return (1);
+    }
+
+  novl = p->novl;
+  memcpy(buf,&novl,sizeof(int64));
+  memcpy(buf+sizeof(int64),&(q->tspace),sizeof(int));
+  if (write(out,buf,sizeof(int64)+sizeof(int)) != sizeof(int64)+sizeof(int))
+    { close(out);
+      return (1);
+    }
+
+  for (off = p->beg; off < p->end; )
+    { int64   want = p->end-off < bsize ? p->end-off : bsize;
+      ssize_t n    = pread(q->source,buf,want,off);
+      if (n <= 0 || write(out,buf,n) != n)
+        { close(out);
+          return (1);
+        }
+      off += n;
+    }
+
+  return (close(out) != 0);
+}
+
+static void *write_parts(void *arg)
+{ Part_Queue *q = (Part_Queue *) arg;
+  int64       bsize;
+  char       *buf;
+  int         i;
+
+  bsize = PBUFFER * 1000000ll;
+  buf   = (char *) Malloc(bsize,"Allocating part buffer");
+  if (buf == NULL)
+    exit (1);
+
+  while (1)
+    { pthread_mutex_lock(&(q->lock));
+      i = q->next++;
+      pthread_mutex_unlock(&(q->lock));
+
+      if (i >= q->parts)
+        break;
+
+      if (write_part(q,i,buf,bsize))
+        { fprintf(stderr,"%s: Failed to write %s\n",Prog_Name,q->names[i]);
+          pthread_mutex_lock(&(q->lock));
+          q->status = 1;
+          pthread_mutex_unlock(&(q->lock));
+        }
+    }
+
+  free(buf);
+  return (NULL);
+}
+
+static int split_file(char *source, char *pwd, char *root, int parts, int *bound,
+                      int cost, int manifest, int nthreads)
+{ lasidx    *idx;
+  PassSplit *split;
+  FILE      *input;
+  int64      novl;
+  int        tspace;
+  int        status;
+  int        i;
+
+  input = Fopen(source,"r");
+  if (input == NULL)
+    exit (1);
+  if (fread(&novl,sizeof(int64),1,input) != 1)
+    SYSTEM_ERROR
+  if (fread(&tspace,sizeof(int),1,input) != 1)
+    SYSTEM_ERROR
+
+  idx = lasidx_load(NULL,source,1);
+  if (idx == NULL)
+    { fprintf(stderr,"%s: Cannot index %s\n",Prog_Name,source);
+      exit (1);
+    }
+
+  split = cut_parts(idx,parts,bound,cost);
+
+  if (manifest)
+    status = pass_split_write(Catenate(pwd,"/",root,PASS_SPLIT_SUFFIX),source,split,parts);
+  else
+    { Part_Queue q;
+      pthread_t *threads;
+
+      q.source = fileno(input);
+      q.tspace = tspace;
+      q.split  = split;
+      q.parts  = parts;
+      q.next   = 0;
+      q.status = 0;
+      q.names  = (char **) Malloc(sizeof(char *)*parts,"Allocating part names");
+      threads  = (pthread_t *) Malloc(sizeof(pthread_t)*nthreads,"Allocating threads");
+      if (q.names == NULL || threads == NULL)
+        exit (1);
+      for (i = 0; i < parts; i++)
+        q.names[i] = Strdup(Catenate(pwd,"/",root,Numbered_Suffix(".",i+1,".las")),
+                            "Allocating part name");
+      pthread_mutex_init(&(q.lock),NULL);
+
+      for (i = 0; i < nthreads; i++)
+        pthread_create(threads+i,NULL,write_parts,&q);
+      for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i],NULL);
+
+      pthread_mutex_destroy(&(q.lock));
+      for (i = 0; i < parts; i++)
+        free(q.names[i]);
+      free(q.names);
+      free(threads);
+      status = q.status;
+    }
+
+  free(split);
+  lasidx_close(idx);
+  fclose(input);
+
+  return (status);
+}
 
 int main(int argc, char *argv[])
 { char     *iblock, *oblock;
   FILE     *output, *dbvis;
   int64     novl, bsize, ovlsize, ptrsize;
   int       parts, tspace, tbytes;
-  int       olast;
+  int      *bound;
   char     *root, *pwd;
 
-  Prog_Name = Strdup("LAsplit","");
+  int       COST;
+  int       MANIFEST;
+  int       NTHREADS;
 
-  if (argc != 3)
-    { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
-      exit (1);
-    }
+  //  Process options
+
+  { int i, j, k;
+    int flags[128];
+    char *eptr;
+
+    ARG_INIT("LAsplit")
+
+    NTHREADS = 4;
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("cm")
+            break;
+          case 'j':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    COST     = flags['c'];
+    MANIFEST = flags['m'];
+
+    if (argc != 3 && argc != 4)
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage[0]);
+        fprintf(stderr,"       %*s %s\n",(int) strlen(Prog_Name),"",Usage[1]);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"      -c: balance the parts by estimated cost instead of overlap count\n");
+        fprintf(stderr,"      -m: only write the manifest <align>%s of the cuts\n",PASS_SPLIT_SUFFIX);
+        fprintf(stderr,"      -j: number of threads writing the parts\n");
+        exit (1);
+      }
+
+    if (argc == 3 && (COST || MANIFEST))
+      { fprintf(stderr,"%s: -c and -m need the source as a file\n",Prog_Name);
+        exit (1);
+      }
+  }
 
   { char *eptr;
     int   nfiles;
     int64 size;
     char  buffer[2*MAX_NAME+100];
+    int   i;
 
     parts = strtol(argv[2],&eptr,10);
     if (*eptr != '\0')
@@ -105,11 +376,19 @@ int main(int argc, char *argv[])
           }
         if (fscanf(dbvis,DB_PARAMS,&size) != 1)
           SYSTEM_ERROR
-        if (fscanf(dbvis,DB_BDATA,&olast) != 1)
-          SYSTEM_ERROR
+
+        //  First read of each block and the end of the last one
+
+        bound = (int *) Malloc(sizeof(int)*(parts+1),"Allocating block bounds");
+        if (bound == NULL)
+          exit (1);
+        for (i = 0; i <= parts; i++)
+          if (fscanf(dbvis,DB_BDATA,bound+i) != 1)
+            SYSTEM_ERROR
+        fclose(dbvis);
       }
     else
-      { dbvis = NULL;
+      { bound = NULL;
         if (parts <= 0)
           { fprintf(stderr,"%s: Number of parts is not positive\n",Prog_Name);
             exit (1);
@@ -117,6 +396,19 @@ int main(int argc, char *argv[])
       }
   }
 
+  pwd   = PathTo(argv[1]);
+  root  = Root(argv[1],".las");
+
+  if (argc == 4)
+    { int status = split_file(argv[3],pwd,root,parts,bound,COST,MANIFEST,NTHREADS);
+
+      free(pwd);
+      free(root);
+      free(bound);
+
+      exit (status);
+    }
+
   ptrsize = sizeof(void *);
   ovlsize = sizeof(Overlap) - ptrsize;
   bsize   = MEMORY * 1000000ll;
@@ -126,9 +418,6 @@ int main(int argc, char *argv[])
     exit (1);
   iblock += ptrsize;
 
-  pwd   = PathTo(argv[1]);
-  root  = Root(argv[1],".las");
-
   if (fread(&novl,sizeof(int64),1,stdin) != 1)
     SYSTEM_ERROR
   if (fread(&tspace,sizeof(int),1,stdin) != 1)
@@ -155,17 +444,14 @@ int main(int argc, char *argv[])
           exit (1);
 
         low = hgh;
-        if (dbvis != NULL)
-          { if (fscanf(dbvis,DB_BDATA,&olast/*,&blast*/) != 1/*2*/)
-              SYSTEM_ERROR
-            last = olast-1;
+        if (bound != NULL)
+          { last = bound[i+1]-1;
             hgh  = 0;
           }
         else
           { last = 0;
             hgh  = (novl*(i+1))/parts;
           }
-
         povl = 0;
         fwrite(&povl,sizeof(int64),1,output);
         fwrite(&tspace,sizeof(int),1,output);
@@ -184,7 +470,7 @@ int main(int argc, char *argv[])
               }
 
             w = (Overlap *) (iptr-ptrsize);
-            if (dbvis == NULL)
+            if (bound == NULL)
               { if (j >= hgh && w->aread > last)
                   break;
                 last = w->aread;
@@ -231,6 +517,7 @@ int main(int argc, char *argv[])
 
   free(pwd);
   free(root);
+  free(bound);
   free(iblock-ptrsize);
   free(oblock);
 
@@ -194,6 +194,84 @@ void Free_Work_Data(Work_Data *ework)
 #define TRIM_MLAG 200                    //  How far can last trim point be behind best point
 #define WAVE_LAG   30                    //  How far can worst point be behind the best point
 
+/*  Word-at-a-time snakes.  snake_forward returns the number of symbols a[y],b[y],
+    a[y+1],b[y+1],... (snake_reverse: a[y],b[y],a[y-1],b[y-1],...) that match and are
+    not a terminator, examining 8 symbols at a time while they lie within the sequences
+    (k is the diagonal, i.e. a[y] = aseq[y+k]).  The symbol ending the snake is left to
+    the scalar loop that follows, so clipping is handled exactly as before.  path_shift
+    applies the bit vector update of s matching symbols at once.                          */
+
+#define SNAKE_TERM 0x0404040404040404ll   //  the terminator 4 is the only symbol with bit 2 set
+
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+static inline int snake_forward(char *a, char *b, int y, int k, int alen, int blen)
+  {
+    uint64 u, v, x;
+    int lim, s;
+
+    lim = (blen < alen - k ? blen : alen - k) - 7;
+    if (y < 0 || y + k < 0)
+      return (0);
+    for (s = y; s <= lim; s += 8)
+      {
+        memcpy(&u, a + s, 8);
+        memcpy(&v, b + s, 8);
+        x = (u ^ v) | (v & SNAKE_TERM);
+        if (x != 0)
+          return ((s - y) + (__builtin_ctzll(x) >> 3));
+      }
+    return (s - y);
+  }
+
+static inline int snake_reverse(char *a, char *b, int y, int k, int alen, int blen)
+  {
+    uint64 u, v, x;
+    int lim, s;
+
+    lim = (k < 0 ? 7 - k : 7);
+    if (y > blen || y + k > alen)
+      return (0);
+    for (s = y; s >= lim; s -= 8)
+      {
+        memcpy(&u, a + (s - 7), 8);
+        memcpy(&v, b + (s - 7), 8);
+        x = (u ^ v) | (v & SNAKE_TERM);
+        if (x != 0)
+          return ((y - s) + (__builtin_clzll(x) >> 3));
+      }
+    return (y - s);
+  }
+
+#else
+
+static inline int snake_forward(char *a, char *b, int y, int k, int alen, int blen)
+  {
+    (void) a; (void) b; (void) y; (void) k; (void) alen; (void) blen;
+    return (0);
+  }
+
+static inline int snake_reverse(char *a, char *b, int y, int k, int alen, int blen)
+  {
+    (void) a; (void) b; (void) y; (void) k; (void) alen; (void) blen;
+    return (0);
+  }
+
+#endif
+
+static inline void path_shift(BVEC *b, int *m, int s)
+  {
+    BVEC t = *b;
+    int n;
+
+    n = (s <= PATH_LEN ? s : PATH_LEN + 1);
+    *m += n - __builtin_popcountll((t >> (PATH_LEN + 1 - n)) & (((BVEC) 1 << n) - 1));
+    if (s >= 64)
+      *b = (BVEC) -1;
+    else
+      *b = (t << s) | (((BVEC) 1 << s) - 1);
+  }
+
 static double Bias_Factor[10] =
 { .690, .690, .690, .690, .780, .850, .900, .933, .966, 1.000 };
 
@@ -212,6 +290,7 @@ typedef struct
   int symmetric;                // HEIDELBERG_MODIFICATION
   int only_identity;            // HEIDELBERG_MODIFICATION
   int no_trace_points;          // HEIDELBERG_MODIFICATION
+  Overlap_Stream *stream;       // HEIDELBERG_MODIFICATION
 } _Align_Spec;
 
 /* Fill in bit table: TABLE[x] = 1 iff the alignment modeled by x (1 = match, 0 = mismatch)
@@ -297,6 +376,7 @@ Align_Spec *New_Align_Spec(double ave_corr, int trace_space, float *freq, int nt
         spec->nthreads = nthreads;
         spec->symmetric = symmetric;
         spec->only_identity = only_identity;
+        spec->stream = NULL;
 
         int i;
         spec->ioBuffer = (Overlap_IO_Buffer*) malloc(sizeof(Overlap_IO_Buffer) * nthreads);
@@ -307,6 +387,8 @@ Align_Spec *New_Align_Spec(double ave_corr, int trace_space, float *freq, int nt
             if (ob == NULL)
               exit(1);
 
+            ob->id = i;
+            ob->only_identity = only_identity;
             spec->ioBuffer[i] = *ob;
 
           }
@@ -404,6 +486,8 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
     char *aseq = align->aseq;
     char *bseq = align->bseq;
     Path *apath = align->path;
+    int alen = align->alen;
+    int blen = align->blen;
 
     int hgh, low, dif;
     int vlen, vmin, vmax;
@@ -532,6 +616,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             hb = avail++;
             nb += TRACE_SPACE;
 
+            y += snake_forward(a,bseq,y,k,alen,blen);
             while (1)
               {
                 c = bseq[y];
@@ -776,7 +861,7 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         ua = ub = -1;
         for (k = hgh; k >= low; k--)
           {
-            int y, m;
+            int y, m, s;
             int ha, hb;
             int c, d;
             BVEC b;
@@ -825,6 +910,11 @@ static int forward_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             b <<= 1;
 
             y = (c - k) >> 1;
+            s = snake_forward(a,bseq,y,k,alen,blen);
+            if (s > 0)
+              { y += s;
+                path_shift(&b,&m,s);
+              }
             while (1)
               {
                 c = bseq[y];
@@ -1135,6 +1225,8 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
     char *aseq = align->aseq - 1;
     char *bseq = align->bseq - 1;
     Path *apath = align->path;
+    int alen = align->alen;
+    int blen = align->blen;
 
     int hgh, low, dif;
     int vlen, vmin, vmax;
@@ -1259,6 +1351,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             pb->mark = y;
             hb = avail++;
 
+            y -= snake_reverse(a,bseq,y,k,alen,blen);
             while (1)
               {
                 c = bseq[y];
@@ -1500,7 +1593,7 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
         ua = ub = -1;
         for (k = low; k <= hgh; k++)
           {
-            int y, m;
+            int y, m, s;
             int ha, hb;
             int c, d;
             BVEC b;
@@ -1549,6 +1642,11 @@ static int reverse_wave(_Work_Data *work, _Align_Spec *spec, Alignment *align, P
             b <<= 1;
 
             y = (c - k) >> 1;
+            s = snake_reverse(a,bseq,y,k,alen,blen);
+            if (s > 0)
+              { y -= s;
+                path_shift(&b,&m,s);
+              }
             while (1)
               {
                 c = bseq[y];
@@ -2071,6 +2169,8 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
     char *aseq = align->aseq;
     char *bseq = align->bseq;
     Path *apath = align->path;
+    int alen = align->alen;
+    int blen = align->blen;
 
     int hgh, low, dif;
     int vlen, vmin, vmax;
@@ -2174,6 +2274,7 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             ha = avail++;
             na += TRACE_SPACE;
 
+            y += snake_forward(a,bseq,y,k,alen,blen);
             while (1)
               {
                 c = bseq[y];
@@ -2370,7 +2471,7 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         ua = -1;
         for (k = hgh; k >= low; k--)
           {
-            int y, m;
+            int y, m, s;
             int ha;
             int c, d;
             BVEC b;
@@ -2415,6 +2516,11 @@ static int forward_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             b <<= 1;
 
             y = (c - k) >> 1;
+            s = snake_forward(a,bseq,y,k,alen,blen);
+            if (s > 0)
+              { y += s;
+                path_shift(&b,&m,s);
+              }
             while (1)
               {
                 c = bseq[y];
@@ -2631,6 +2737,8 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
     char *aseq = align->aseq - 1;
     char *bseq = align->bseq - 1;
     Path *apath = align->path;
+    int alen = align->alen;
+    int blen = align->blen;
 
     int hgh, low, dif;
     int vlen, vmin, vmax;
@@ -2731,6 +2839,7 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             pb->mark = y + k;
             ha = avail++;
 
+            y -= snake_reverse(a,bseq,y,k,alen,blen);
             while (1)
               {
                 c = bseq[y];
@@ -2924,7 +3033,7 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
         ua = -1;
         for (k = low; k <= hgh; k++)
           {
-            int y, m;
+            int y, m, s;
             int ha;
             int c, d;
             BVEC b;
@@ -2969,6 +3078,11 @@ static int reverse_extend(_Work_Data *work, _Align_Spec *spec, Alignment *align,
             b <<= 1;
 
             y = (c - k) >> 1;
+            s = snake_reverse(a,bseq,y,k,alen,blen);
+            if (s > 0)
+              { y -= s;
+                path_shift(&b,&m,s);
+              }
             while (1)
               {
                 c = bseq[y];
@@ -3511,19 +3625,7 @@ void Flip_Alignment(Alignment *align, int full)
 
 void Complement_Seq(char *aseq, int len)
   {
-    char *s, *t;
-    int c;
-
-    s = aseq;
-    t = aseq + (len - 1);
-    while (s < t)
-      {
-        c = 3 - *s;
-        *s++ = (char) (3 - *t);
-        *t-- = (char) c;
-      }
-    if (s == t)
-      *s = (char) (3 - *s);
+    Complement_Read(len, aseq);
   }
 
 /* Print an alignment to file between a and b given in trace (unpacked).
@@ -4526,6 +4628,198 @@ static int ToA[4] =
 
 #endif
 
+/* Bit-parallel (Myers/Hyyro) path for the GREEDIEST mode of iter_np on segments of at most
+ BP_MAXLEN bases, i.e. the trace point spaced segments of Compute_Trace_PTS/MID.  The columns
+ of the edit distance matrix over A are computed 2 words at a time and kept as vertical and
+ horizontal deltas.  The point of wave D on diagonal k is the last cell of the diagonal whose
+ distance, plus the |del-k|-|del| iter_np charges for leaving diagonal del, is at most D.  So
+ the move iter_np takes into such a cell is found by stepping back along the diagonal to the
+ first cell that has a neighbor 1 closer to the origin, preferring the vertical, then the
+ diagonal and then the horizontal neighbor as FS_MOVE does.  The trace is exactly that of
+ iter_np.  Returns -1 where iter_np has to be run.
+ */
+
+#define BP_MAXLEN  128
+#define BP_MAXPATH (2*BP_MAXLEN+2)
+#define BP_MINDIFF  10
+
+typedef struct
+  { uint64  Pv[BP_MAXLEN+1][2], Mv[BP_MAXLEN+1][2];    //  column i, bit j-1 is D[i][j]-D[i][j-1]
+    uint64  Ph[BP_MAXLEN+1][2], Mh[BP_MAXLEN+1][2];    //  column i, bit j-1 is D[i][j]-D[i-1][j]
+    uint64  St[BP_MAXLEN+1][2];                        //  column i, bit j-1 is set if a neighbor
+  } BP_Matrix;                                         //    of (i,j) is 1 closer to the origin
+
+#define BP_BIT(w,r) ((int) (((w)[(r) >> 6] >> ((r) & 0x3f)) & 0x1))
+
+static inline int bp_vert(BP_Matrix *m, int i, int j)     //  D[i][j] - D[i][j-1], j > 0
+  { return (BP_BIT(m->Pv[i],j-1) - BP_BIT(m->Mv[i],j-1)); }
+
+static inline int bp_horz(BP_Matrix *m, int i, int j)     //  D[i][j] - D[i-1][j], i > 0
+  { if (j == 0)
+      return (1);
+    return (BP_BIT(m->Ph[i],j-1) - BP_BIT(m->Mh[i],j-1));
+  }
+
+static int bp_matrix(BP_Matrix *m, char *A, int M, char *B, int N)
+  { uint64 peq[4][2];
+    uint64 pv0, pv1, mv0, mv1;
+    int    i, j, c;
+    int    score;                   //  D[i][N]
+
+    memset(peq,0,sizeof(peq));
+    for (j = 0; j < N; j++)
+      { c = B[j];
+        if (c < 0 || c > 3)
+          return (-1);
+        peq[c][j >> 6] |= ((uint64) 1) << (j & 0x3f);
+      }
+
+    pv0 = pv1 = ~((uint64) 0);
+    mv0 = mv1 = 0;
+    score = N;
+    m->Pv[0][0] = m->St[0][0] = pv0;
+    m->Pv[0][1] = m->St[0][1] = pv1;
+    m->Mv[0][0] = mv0;
+    m->Mv[0][1] = mv1;
+
+    for (i = 1; i <= M; i++)
+      { uint64 eq0, eq1, xv0, xv1, xh0, xh1, ph0, ph1, mh0, mh1, s0, s1;
+
+        c = A[i-1];
+        if (c >= 0 && c <= 3)
+          { eq0 = peq[c][0];
+            eq1 = peq[c][1];
+          }
+        else
+          eq0 = eq1 = 0;
+
+        xv0 = eq0 | mv0;
+        xv1 = eq1 | mv1;
+        s0  = (eq0 & pv0) + pv0;
+        s1  = (eq1 & pv1) + pv1 + (s0 < pv0);
+        xh0 = (s0 ^ pv0) | eq0;
+        xh1 = (s1 ^ pv1) | eq1;
+        ph0 = mv0 | ~(xh0 | pv0);
+        ph1 = mv1 | ~(xh1 | pv1);
+        mh0 = pv0 & xh0;
+        mh1 = pv1 & xh1;
+
+        m->Ph[i][0] = ph0;
+        m->Ph[i][1] = ph1;
+        m->Mh[i][0] = mh0;
+        m->Mh[i][1] = mh1;
+        score += BP_BIT(m->Ph[i],N-1) - BP_BIT(m->Mh[i],N-1);
+
+        ph1 = (ph1 << 1) | (ph0 >> 63);     //  the top row goes up by 1 in each column
+        ph0 = (ph0 << 1) | 1;
+        mh1 = (mh1 << 1) | (mh0 >> 63);
+        mh0 = (mh0 << 1);
+
+        pv0 = mh0 | ~(xv0 | ph0);
+        pv1 = mh1 | ~(xv1 | ph1);
+        mv0 = ph0 & xv0;
+        mv1 = ph1 & xv1;
+
+        m->Pv[i][0] = pv0;
+        m->Pv[i][1] = pv1;
+        m->Mv[i][0] = mv0;
+        m->Mv[i][1] = mv1;
+        m->St[i][0] = pv0 | m->Ph[i][0] | (ph0 & ~mv0);
+        m->St[i][1] = pv1 | m->Ph[i][1] | (ph1 & ~mv1);
+      }
+
+    return (score);
+  }
+
+static int bp_np(char *A, int M, char *B, int N, Trace_Waves *wave)
+  { BP_Matrix m;
+    int       pk[BP_MAXPATH], pc[BP_MAXPATH], pe[BP_MAXPATH];
+    int       D, k, c, t, n, del;
+    int       dist;
+
+    dist = bp_matrix(&m,A,M,B,N);
+    if (dist < 0)
+      return (-1);
+
+    //  Walk back from the end of wave dist-|del| on diagonal del, taking the move iter_np
+    //    chose into each point, until reaching the start at wave 0 on diagonal 0.  t is
+    //    the distance at the current point c of diagonal k.
+
+    del = M - N;
+    D = dist - abs(del);
+    k = del;
+    c = N;
+    t = dist;
+    n = 0;
+    while (D != 0 || k != 0)
+      { int i, x, e;
+        int vt, dg;
+
+        i = c + k;
+        x = c;
+        while (x > 0 && ! BP_BIT(m.St[i],x-1))
+          { x -= 1;
+            i -= 1;
+          }
+        if (i == 0 && x == 0)
+          return (-1);
+        vt = (x > 0 && bp_vert(&m,i,x) > 0);
+        dg = (x > 0 && i > 0 && bp_vert(&m,i,x) + bp_horz(&m,i,x-1) > 0);
+
+        if (vt)                      //  from k+1
+          { if (k < del)
+              { e = 1;
+                D -= 2;
+              }
+            else
+              e = 4;
+            k += 1;
+            c = x-1;
+          }
+        else if (dg)                 //  from k
+          { e = 0;
+            D -= 1;
+            c = x-1;
+          }
+        else                         //  from k-1, as D[i][0] - D[i-1][0] = 1 if x = 0
+          { if (k > del)
+              { e = -1;
+                D -= 2;
+              }
+            else
+              e = 2;
+            k -= 1;
+            c = x;
+          }
+        t -= 1;
+
+        if (D < 0 || n >= BP_MAXPATH || t != D + abs(del) - abs(del-k))
+          return (-1);
+        pk[n] = k;
+        pc[n] = c;
+        pe[n] = e;
+        n += 1;
+      }
+
+      { int ap = (wave->Aabs - A) - 1;
+        int bp = (B - wave->Babs) + 1;
+        int h;
+
+        while (n-- > 0)
+          { k = pk[n];
+            h = k - pe[n];
+            if (pe[n] > 1)
+              h += 3;
+            if (h > k)
+              *wave->Stop++ = bp + pc[n];
+            else if (h < k)
+              *wave->Stop++ = ap - (pc[n] + k);
+          }
+      }
+
+    return (dist);
+  }
+
 static int iter_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode)
   {
     int **PVF = wave->PVF;
@@ -4885,6 +5179,23 @@ static int iter_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode)
     return (D + abs(del));
   }
 
+/* iter_np, or bp_np for the segments where it is faster.  diffs is the number of differences
+ recorded for the segment by its trace points, an upper bound, or -1 if not known.  Below
+ BP_MINDIFF the waves of iter_np stay narrow and it beats the fixed cost of the bit-vectors.
+ */
+
+static int trace_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode, int diffs)
+  { int d;
+
+    if (mode == GREEDIEST && diffs >= BP_MINDIFF && M > 0 && N > 0
+                          && M <= BP_MAXLEN && N <= BP_MAXLEN && wave->Aabs != wave->Babs)
+      { d = bp_np(A,M,B,N,wave);
+        if (d >= 0)
+          return (d);
+      }
+    return (iter_np(A,M,B,N,wave,mode));
+  }
+
 static int middle_np(char *A, int M, char *B, int N, Trace_Waves *wave, int mode)
   {
     int **PVF = wave->PVF;
@@ -5335,7 +5646,7 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
           {
             ae = ae + trace_spacing;
             be = bb + points[i];
-            d = iter_np(aseq + ab, ae - ab, bseq + bb, be - bb, &wave, mode);
+            d = trace_np(aseq + ab, ae - ab, bseq + bb, be - bb, &wave, mode, points[i-1]);
             if (d < 0)
               EXIT(1);
             diffs += d;
@@ -5344,7 +5655,7 @@ int Compute_Trace_PTS(Alignment *align, Work_Data *ework, int trace_spacing, int
           }
         ae = path->aepos;
         be = path->bepos;
-        d = iter_np(aseq + ab, ae - ab, bseq + bb, be - bb, &wave, mode);
+        d = trace_np(aseq + ab, ae - ab, bseq + bb, be - bb, &wave, mode, tlen >= 0 ? points[tlen] : -1);
         if (d < 0)
           EXIT(1);
         diffs += d;
@@ -5431,11 +5742,13 @@ int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int
         int i, d;
         int as, bs;
         int af, bf;
+        int pd;
 
         diffs = 0;
         ab = as = af = path->abpos;
         ae = (ab / trace_spacing) * trace_spacing;
         bb = bs = bf = path->bbpos;
+        pd = 0;
         tlen -= 2;
         for (i = 1; i < tlen; i += 2)
           {
@@ -5445,10 +5758,11 @@ int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int
               EXIT(1);
             af = wave.mida;
             bf = wave.midb;
-            d = iter_np(aseq + as, af - as, bseq + bs, bf - bs, &wave, mode);
+            d = trace_np(aseq + as, af - as, bseq + bs, bf - bs, &wave, mode, (pd + points[i-1]) / 2);
             if (d < 0)
               EXIT(1);
             diffs += d;
+            pd = points[i-1];
             ab = ae;
             bb = be;
             as = af;
@@ -5462,14 +5776,14 @@ int Compute_Trace_MID(Alignment *align, Work_Data *ework, int trace_spacing, int
           EXIT(1);
         af = wave.mida;
         bf = wave.midb;
-        d = iter_np(aseq + as, af - as, bseq + bs, bf - bs, &wave, mode);
+        d = trace_np(aseq + as, af - as, bseq + bs, bf - bs, &wave, mode, tlen >= 0 ? (pd + points[tlen]) / 2 : -1);
         if (d < 0)
           EXIT(1);
         diffs += d;
         as = af;
         bs = bf;
 
-        d += iter_np(aseq + af, ae - as, bseq + bf, be - bs, &wave, mode);
+        d += trace_np(aseq + af, ae - as, bseq + bf, be - bs, &wave, mode, tlen >= 0 ? points[tlen] / 2 : -1);
         if (d < 0)
           EXIT(1);
         diffs += d;
@@ -5624,12 +5938,19 @@ Overlap_IO_Buffer *CreateOverlapBuffer(int nthreads, int tbytes, int no_trace)
     iobuf->otop = 0;
     iobuf->ovls = (Overlap*) malloc(sizeof(Overlap) * iobuf->omax);
     iobuf->no_trace = no_trace;
+    iobuf->id = 0;
+    iobuf->only_identity = 0;
+    iobuf->limit = 0;
+    iobuf->nruns = 0;
+    iobuf->rmax = 0;
+    iobuf->runs = NULL;
 
     if (iobuf->ovls == NULL)
       {
         fprintf(stderr, "[ERROR] - Cannot allocate Overlap buffer of size: %d!\n", iobuf->omax);
         return NULL;
       }
+    Huge_Pages(iobuf->ovls, sizeof(Overlap) * iobuf->omax);
 
     if(no_trace)
       {
@@ -5658,10 +5979,13 @@ Overlap_IO_Buffer *CreateOverlapBuffer(int nthreads, int tbytes, int no_trace)
         fprintf(stderr, "[ERROR] - Cannot allocate trace buffer of size: %llu!\n", iobuf->tmax);
         return NULL;
       }
+    Huge_Pages(iobuf->trace, iobuf->tbytes * iobuf->tmax);
 
     return iobuf;
   }
 
+static void Spill_Overlap_Buffer(Overlap_IO_Buffer *iobuf);
+
 int AddOverlapToBuffer(Overlap_IO_Buffer *iobuf, Overlap *ovl, int tbytes)
   {
     if (iobuf == NULL)
@@ -5680,6 +6004,7 @@ int AddOverlapToBuffer(Overlap_IO_Buffer *iobuf, Overlap *ovl, int tbytes)
             fprintf(stderr, "[ERROR] - Cannot add increase overlap buffer size to %d!\n", iobuf->omax);
             return 1;
           }
+        Huge_Pages(iobuf->ovls, sizeof(Overlap) * iobuf->omax);
       }
 
     if (ovl->path.trace != NULL && (iobuf->no_trace == 0))
@@ -5698,6 +6023,7 @@ int AddOverlapToBuffer(Overlap_IO_Buffer *iobuf, Overlap *ovl, int tbytes)
                 fprintf(stderr, "[ERROR] - Cannot add increase trace point buffer size to %llu!\n", iobuf->tmax);
                 return 1;
               }
+            Huge_Pages(t, iobuf->tbytes * iobuf->tmax);
 
             if (t != iobuf->trace)
               {
@@ -5706,7 +6032,7 @@ int AddOverlapToBuffer(Overlap_IO_Buffer *iobuf, Overlap *ovl, int tbytes)
                 for (i = 0; i < iobuf->otop; i++)
                   {
                     iobuf->ovls[i].path.trace = t + cumOff;
-                    cumOff += iobuf->ovls[i].path.tlen;
+                    cumOff += iobuf->ovls[i].path.tlen * iobuf->tbytes;
                   }
 
                 iobuf->trace = t;
@@ -5741,6 +6067,10 @@ int AddOverlapToBuffer(Overlap_IO_Buffer *iobuf, Overlap *ovl, int tbytes)
     // adjust offsets
     iobuf->otop++;
     iobuf->ttop += tbytes * ovl->path.tlen;
+
+    if (iobuf->limit > 0 && iobuf->otop * sizeof(Overlap) + iobuf->ttop >= (uint64) iobuf->limit)
+      Spill_Overlap_Buffer(iobuf);
+
     return 0;
   }
 
@@ -5770,7 +6100,220 @@ static int SORT_OVL(const void *x, const void *y)
     if (COMP(l->flags) < COMP(r->flags))
       return -1;
 
-    return (l->path.abpos - r->path.abpos);
+    if (l->path.abpos != r->path.abpos)
+      return (l->path.abpos - r->path.abpos);
+
+    //  the report threads fill the buffers in a varying order, break the remaining
+    //  ties so the output does not depend on it
+
+    if (l->path.aepos != r->path.aepos)
+      return (l->path.aepos - r->path.aepos);
+
+    if (l->path.bbpos != r->path.bbpos)
+      return (l->path.bbpos - r->path.bbpos);
+
+    if (l->path.bepos != r->path.bepos)
+      return (l->path.bepos - r->path.bepos);
+
+    return (l->path.diffs - r->path.diffs);
+  }
+
+// sort the buffer and write it to a new run, the run file is unlinked right away
+
+static void Spill_Overlap_Buffer(Overlap_IO_Buffer *iobuf)
+  {
+    Overlap_Run *r;
+    char name[100];
+    int j;
+
+    qsort(iobuf->ovls, iobuf->otop, sizeof(Overlap), SORT_OVL);
+
+    if (iobuf->nruns >= iobuf->rmax)
+      {
+        iobuf->rmax = iobuf->rmax * 1.2 + 10;
+        iobuf->runs = (Overlap_Run*) realloc(iobuf->runs, sizeof(Overlap_Run) * iobuf->rmax);
+        if (iobuf->runs == NULL)
+          {
+            fprintf(stderr, "[ERROR] - Cannot allocate %d overlap runs!\n", iobuf->rmax);
+            exit(1);
+          }
+      }
+
+    r = iobuf->runs + iobuf->nruns;
+    sprintf(name, ".daligner.%d.%d.%d.las", (int) getpid(), iobuf->id, iobuf->nruns);
+    r->stream = Fopen(name, "w+");
+    if (r->stream == NULL)
+      exit(1);
+    unlink(name);
+
+    r->novl = 0;
+    r->trace = NULL;
+    r->tmax = 0;
+    for (j = 0; j < iobuf->otop; j++)
+      if (!iobuf->only_identity || iobuf->ovls[j].aread == iobuf->ovls[j].bread)
+        {
+          Write_Overlap(r->stream, iobuf->ovls + j, iobuf->tbytes);
+          r->novl += 1;
+        }
+
+    iobuf->nruns += 1;
+    iobuf->otop = 0;
+    iobuf->ttop = 0;
+  }
+
+void Set_Overlap_Buffer_Limit(Align_Spec* spec, int64 bytes)
+  {
+    Overlap_IO_Buffer *buf = OVL_IO_Buffer(spec);
+    int nthreads = Num_Threads(spec);
+    int i;
+
+    for (i = 0; i < nthreads; i++)
+      buf[i].limit = bytes / nthreads;
+  }
+
+void Set_Overlap_Stream(Align_Spec* spec, Overlap_Stream *stream)
+  {
+    ((_Align_Spec *) spec)->stream = stream;
+  }
+
+// open the output for the overlaps of block a vs b, either a .las file at path or a stream
+
+static FILE *open_output(Overlap_Stream *stream, char *path, int a, int b, int tspace, int tbytes)
+  {
+    FILE *out;
+
+    if (stream != NULL)
+      {
+        out = stream->open(stream->arg, a, b, tspace, tbytes);
+        if (out == NULL)
+          {
+            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot open stream for blocks %d and %d\n", a, b);
+            exit(1);
+          }
+        return out;
+      }
+
+    out = fopen(path, "w");
+    if (out == NULL)
+      {
+        fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot open file %s for writing\n", path);
+        exit(1);
+      }
+
+    int64 nhits = 0;
+    fwrite(&nhits, sizeof(int64), 1, out);
+    fwrite(&tspace, sizeof(int), 1, out);
+
+    return out;
+  }
+
+static void close_output(Overlap_Stream *stream, FILE *out, int64 nhits)
+  {
+    if (stream != NULL)
+      {
+        if (stream->close(stream->arg, out, nhits))
+          {
+            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Overlaps were not taken over by the stream\n");
+            exit(1);
+          }
+        return;
+      }
+
+    rewind(out);
+    fwrite(&nhits, sizeof(int64), 1, out);
+    fclose(out);
+  }
+
+// the overlaps of a block pair in sorted order, either the sorted in memory overlaps
+// or a merge of all spilled runs
+
+typedef struct
+{
+    Overlap *ovls;
+    int64 n, cur;
+
+    Overlap_Run **heap;
+    int hsize;
+    int popped;
+    int tbytes;
+} Overlap_Source;
+
+static int run_load(Overlap_Run *r, int tbytes)
+  {
+    if (r->novl == 0)
+      return 0;
+
+    if (Read_Overlap(r->stream, &(r->ovl)))
+      {
+        fprintf(stderr, "[ERROR] - Cannot read spilled overlap run!\n");
+        exit(1);
+      }
+
+    if (r->ovl.path.tlen * tbytes > r->tmax)
+      {
+        r->tmax = r->ovl.path.tlen * tbytes * 1.2 + 1000;
+        r->trace = realloc(r->trace, r->tmax);
+        if (r->trace == NULL)
+          {
+            fprintf(stderr, "[ERROR] - Cannot allocate trace buffer of size: %lld!\n", r->tmax);
+            exit(1);
+          }
+      }
+
+    r->ovl.path.trace = (tbytes > 0) ? r->trace : NULL;
+    if (Read_Trace(r->stream, &(r->ovl), tbytes))
+      {
+        fprintf(stderr, "[ERROR] - Cannot read spilled overlap run!\n");
+        exit(1);
+      }
+
+    r->novl -= 1;
+    return 1;
+  }
+
+static void run_reheap(int s, Overlap_Run **heap, int hsize)
+  {
+    int c, l, r;
+    Overlap_Run *hs;
+
+    c = s;
+    hs = heap[s];
+    while ((l = 2 * c) <= hsize)
+      {
+        r = l + 1;
+        if (r <= hsize && SORT_OVL(&(heap[r]->ovl), &(heap[l]->ovl)) < 0)
+          l = r;
+        if (SORT_OVL(&(heap[l]->ovl), &(hs->ovl)) >= 0)
+          break;
+        heap[c] = heap[l];
+        c = l;
+      }
+    heap[c] = hs;
+  }
+
+static Overlap *next_overlap(Overlap_Source *src)
+  {
+    if (src->heap == NULL)
+      {
+        if (src->cur >= src->n)
+          return NULL;
+        return src->ovls + src->cur++;
+      }
+
+    if (src->popped)
+      {
+        if (!run_load(src->heap[1], src->tbytes))
+          src->heap[1] = src->heap[src->hsize--];
+        if (src->hsize > 0)
+          run_reheap(1, src->heap, src->hsize);
+        src->popped = 0;
+      }
+
+    if (src->hsize == 0)
+      return NULL;
+
+    src->popped = 1;
+    return &(src->heap[1]->ovl);
   }
 
 void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblock, int lastRead)
@@ -5781,37 +6324,85 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblo
     int symmetric = Symmetric(spec);
     int only_identity = Only_Identity(spec);
 
+    Overlap_Source src;
+    Overlap *ovl;
+    Overlap *allOvls = NULL;
     int nallOvls = 0;
+    int nruns = 0;
     int i, j;
+
     for (i = 0; i < nthreads; i++)
-      nallOvls += buf[i].otop;
+      nruns += buf[i].nruns;
+
+    src.heap = NULL;
+    src.tbytes = buf->tbytes;
 
-    // TODO use smaller chunks for real sorting and merging
-    Overlap *allOvls = (Overlap*) malloc(sizeof(Overlap) * nallOvls);
-    if (allOvls == NULL)
+    if (nruns > 0)
       {
-        fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot create file overlap buffer for all threads\n");
-        exit(1);
+        // spill what is left and merge all runs
+
+        for (i = 0; i < nthreads; i++)
+          if (buf[i].otop > 0)
+            {
+              Spill_Overlap_Buffer(buf + i);
+              nruns += 1;
+            }
+
+        src.heap = (Overlap_Run**) malloc(sizeof(Overlap_Run*) * (nruns + 1));
+        if (src.heap == NULL)
+          {
+            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot create merge heap\n");
+            exit(1);
+          }
+
+        src.hsize = 0;
+        src.popped = 0;
+        for (i = 0; i < nthreads; i++)
+          for (j = 0; j < buf[i].nruns; j++)
+            {
+              rewind(buf[i].runs[j].stream);
+              if (run_load(buf[i].runs + j, src.tbytes))
+                src.heap[++src.hsize] = buf[i].runs + j;
+            }
+
+        for (i = src.hsize / 2; i >= 1; i--)
+          run_reheap(i, src.heap, src.hsize);
       }
+    else
+      {
+        for (i = 0; i < nthreads; i++)
+          nallOvls += buf[i].otop;
 
-    int count = 0;
-    for (i = 0; i < nthreads; i++)
-      for (j = 0; j < buf[i].otop; j++)
-        if (only_identity)
+        allOvls = (Overlap*) malloc(sizeof(Overlap) * nallOvls);
+        if (allOvls == NULL)
           {
-            if (buf[i].ovls[j].aread == buf[i].ovls[j].bread)
-              allOvls[count++] = buf[i].ovls[j];
+            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot create file overlap buffer for all threads\n");
+            exit(1);
           }
-        else
-          allOvls[count++] = buf[i].ovls[j];
 
-    if (only_identity)
-      nallOvls = count;
+        int count = 0;
+        for (i = 0; i < nthreads; i++)
+          for (j = 0; j < buf[i].otop; j++)
+            if (only_identity)
+              {
+                if (buf[i].ovls[j].aread == buf[i].ovls[j].bread)
+                  allOvls[count++] = buf[i].ovls[j];
+              }
+            else
+              allOvls[count++] = buf[i].ovls[j];
+
+        if (only_identity)
+          nallOvls = count;
+
+        assert(count == nallOvls);
 
-    assert(count == nallOvls);
+        // sort overlaps
+        qsort(allOvls, nallOvls, sizeof(Overlap), SORT_OVL);
 
-    // sort overlaps
-    qsort(allOvls, nallOvls, sizeof(Overlap), SORT_OVL);
+        src.ovls = allOvls;
+        src.n = nallOvls;
+        src.cur = 0;
+      }
 
     // get blocks ids and root
     int ablockID, bblockID;
@@ -5837,6 +6428,11 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblo
           }
       }
 
+    // stream the overlaps only if both blocks are known
+    Overlap_Stream *stream = ((_Align_Spec *) spec)->stream;
+    if (ablockID <= 0 || bblockID <= 0)
+      stream = NULL;
+
     // if parts are equal, then dump out all overlaps into a single file
     if (strcmp(ablock, bblock) == 0 || symmetric == 0)
       {
@@ -5860,26 +6456,18 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblo
         else
           sprintf(path, "%s.%s.las", aroot, broot);
 
-        FILE *out = fopen(path, "w");
-        if (out == NULL)
-          {
-            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot open file %s for writing\n", path);
-            exit(1);
-          }
-
         int64 nhits = 0;
         int tspace = Trace_Spacing(spec);
         int tbytes = buf->tbytes;
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fwrite(&tspace, sizeof(int), 1, out);
+        FILE *out = open_output(stream, path, ablockID, bblockID, tspace, tbytes);
 
-        for (j = 0; j < nallOvls; j++, nhits++)
-          Write_Overlap(out, allOvls + j, tbytes);
+        while ((ovl = next_overlap(&src)) != NULL)
+          {
+            Write_Overlap(out, ovl, tbytes);
+            nhits++;
+          }
 
-        assert(nhits == nallOvls);
-        rewind(out);
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fclose(out);
+        close_output(stream, out, nhits);
 
         // cleanup
         if (dirName)
@@ -5950,48 +6538,35 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblo
 
 //        printf("path1: %s, path2: %s\n", path1, path2);
 
+        // the reads up to lastRead belong to the lower block
+        int lowID = (bblockID < ablockID) ? bblockID : ablockID;
+        int highID = (bblockID < ablockID) ? ablockID : bblockID;
+
         // dump out reads to first overlap file
-        FILE *out = fopen(path1, "w");
-        if (out == NULL)
-          {
-            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot open file %s for writing\n", path1);
-            exit(1);
-          }
         int64 nhits = 0;
         int tspace = Trace_Spacing(spec);
         int tbytes = buf->tbytes;
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fwrite(&tspace, sizeof(int), 1, out);
+        FILE *out = open_output(stream, path1, lowID, highID, tspace, tbytes);
 
-        for (j = 0; j < nallOvls; j++, nhits++)
+        while ((ovl = next_overlap(&src)) != NULL && ovl->aread <= lastRead)
           {
-            if (allOvls[j].aread > lastRead)
-              break;
-            Write_Overlap(out, allOvls + j, tbytes);
+            Write_Overlap(out, ovl, tbytes);
+            nhits++;
           }
 
-        rewind(out);
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fclose(out);
+        close_output(stream, out, nhits);
 
         // dump out reads to second overlap file
-        out = fopen(path2, "w");
-        if (out == NULL)
-          {
-            fprintf(stderr, "[ERROR] - Write_Overlap_Buffer: Cannot open file %s for writing\n", path2);
-            exit(1);
-          }
-
         nhits = 0;
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fwrite(&tspace, sizeof(int), 1, out);
+        out = open_output(stream, path2, highID, lowID, tspace, tbytes);
 
-        for (; j < nallOvls; j++, nhits++)
-          Write_Overlap(out, allOvls + j, tbytes);
+        for (; ovl != NULL; ovl = next_overlap(&src))
+          {
+            Write_Overlap(out, ovl, tbytes);
+            nhits++;
+          }
 
-        rewind(out);
-        fwrite(&nhits, sizeof(int64), 1, out);
-        fclose(out);
+        close_output(stream, out, nhits);
 
         // cleanup
         free(dirName1);
@@ -6002,6 +6577,7 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char* bblo
 
     // cleanup
     free(allOvls);
+    free(src.heap);
   }
 
 void Reset_Overlap_Buffer(Align_Spec* spec)
@@ -6009,10 +6585,17 @@ void Reset_Overlap_Buffer(Align_Spec* spec)
     Overlap_IO_Buffer *buf = OVL_IO_Buffer(spec);
     int nthreads = Num_Threads(spec);
 
-    int i;
+    int i, j;
     for (i = 0; i < nthreads; i++)
       {
         buf[i].otop = 0;
         buf[i].ttop = 0;
+
+        for (j = 0; j < buf[i].nruns; j++)
+          {
+            fclose(buf[i].runs[j].stream);
+            free(buf[i].runs[j].trace);
+          }
+        buf[i].nruns = 0;
       }
   }
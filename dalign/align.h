@@ -370,6 +370,18 @@ int Check_Trace_Points(Overlap *ovl, int tspace, int verbose, char *fname);
  * BEGIN HEIDELBERG_ADDITION
  */
 
+// sorted run of overlaps spilled to a temporary file
+
+typedef struct
+{
+    FILE *stream;
+    int64 novl;
+    // current overlap while merging
+    Overlap ovl;
+    void *trace;
+    int64 tmax;
+} Overlap_Run;
+
 typedef struct
 {
     // trace buffer
@@ -382,6 +394,13 @@ typedef struct
     int omax;
     int otop;
     Overlap *ovls;
+    // spilled runs, a sorted run is written once the buffer holds limit bytes
+    int id;
+    int only_identity;
+    int64 limit;
+    int nruns;
+    int rmax;
+    Overlap_Run *runs;
 } Overlap_IO_Buffer;
 
 Overlap_IO_Buffer *CreateOverlapBuffer(int nthreads, int tbytes, int no_trace);
@@ -392,6 +411,25 @@ void Write_Overlap_Buffer(Align_Spec *spec, int RUN_ID, char *ablock, char *bblo
 
 void Reset_Overlap_Buffer(Align_Spec* spec);
 
+// bound the overlap buffers of all threads to bytes in total (0 = unbounded), beyond that
+// each thread spills sorted runs that Write_Overlap_Buffer merges
+
+void Set_Overlap_Buffer_Limit(Align_Spec* spec, int64 bytes);
+
+// instead of writing .las files, hand the sorted overlaps of each block pair to a stream.
+// open returns the FILE the overlaps of A block ablock vs B block bblock are written to
+// (without the .las header), close is passed the number of overlaps written and returns
+// 0 if they were taken over. only used when both block ids are known.
+
+typedef struct
+{
+    FILE *(*open)(void *arg, int ablock, int bblock, int tspace, int tbytes);
+    int (*close)(void *arg, FILE *out, int64 novl);
+    void *arg;
+} Overlap_Stream;
+
+void Set_Overlap_Stream(Align_Spec* spec, Overlap_Stream *stream);
+
 Overlap_IO_Buffer *OVL_IO_Buffer(Align_Spec *espec);
 
 int Num_Threads(Align_Spec *espec);
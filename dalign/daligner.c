@@ -78,6 +78,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/param.h>
 #if defined(BSD)
@@ -90,8 +91,11 @@ extern int optind, opterr, optopt;
 #include "db/DB.h"
 #include "filter.h"
 #include "lib/dmask.h"
+#include "lib/lastream.h"
 #include "lib/tracks.h"
 #include "lib/compression.h"
+#include "lib/instrument.h"
+#include "lib/placement.h"
 #include "align.h"
 
 static void usage()
@@ -99,10 +103,15 @@ static void usage()
     fprintf(stderr, "usage:  \n");
     fprintf(stderr, "daligner [-vbAIOT] [-k<int(14)>] [-w<int(6)>] [-h<int(35)>] [-t<int>] [-M<int>]\n");
     fprintf(stderr, "         [-e<double(.70)] [-l<int(1000)>] [-s<int(100)>] [-H<int>] [-j<int>]\n");
+    fprintf(stderr, "         [-W<int>] [-K] [-P] [-N] [-S<int>] [-F<kfreq>] [-n<int>]\n");
 #ifdef DMASK
-    fprintf(stderr, "         [-D<host:port>]\n");
+    fprintf(stderr, "         [-D<host:port>] [-d]\n");
 #endif
+    fprintf(stderr, "         [-L<host:port>]\n");
     fprintf(stderr, "         [-m<track>]+ <subject:db|dam> <target:db|dam> ...\n");
+#ifdef DMASK
+    fprintf(stderr, "         [-m<track>]+ -D<host:port> -d <db>\n");
+#endif
     fprintf(stderr, "         [-r<int()1>]\n");
     fprintf(stderr, "options: -v ... verbose\n");
     fprintf(stderr, "         -b ... data has a strong compositional bias (e.g. >65%% AT rich)\n");
@@ -113,6 +122,7 @@ static void usage()
     fprintf(stderr, "         -w ... diagonal band width (default: 6)\n");
     fprintf(stderr, "         -h ... hit theshold (in bp.s, default: 35\n");
     fprintf(stderr, "         -t ... tuple supression frequency, i.e. suppresses the use of any k-mer that occurs more than t times in either the subject or target block\n");
+    fprintf(stderr, "         -F ... also suppress the k-mers that are frequent in the whole database, as found by KMsketch\n");
     fprintf(stderr, "         -M ... specify the memory usage limit (in GB). Automatically adjust the -t parameter\n");
     fprintf(stderr, "         -e ... average correlation rate for local alignments (default: 0.5). Must be in [.5,1.)\n");
     fprintf(stderr, "         -l ... minimum alignment length (defaul: 1000)\n");
@@ -120,15 +130,29 @@ static void usage()
     fprintf(stderr, "         -H ... report only overlaps where the a-read is over -H base pairs long\n");
 #ifdef DMASK
     fprintf(stderr, "         -D ... set up host and port where the dynamic mask server is running (default port: %d)\n", DMASK_DEFAULT_PORT);
+    fprintf(stderr, "                comma separated host:port list of all shards of a sharded server (DMserver -S)\n");
+    fprintf(stderr, "         -d ... compare the block pairs of db handed out by the dynamic mask server (DMserver -D) until none are left\n");
 #endif
+    fprintf(stderr, "         -L ... stream the overlaps of the block pairs to LAserver instead of writing .las files (default port: %d)\n", LASTREAM_DEFAULT_PORT);
     fprintf(stderr, "         -m ... specify an interval track that is to be softmasked\n");
     fprintf(stderr, "         -r ... run identifier (default: 1). i.e. all overlap files of Block X a written to a subdirectory: dRUN-IDENTIFIER_X\n");
     fprintf(stderr, "         -j ... number of threads (default: 4). Must be a power of 2!\n");
     fprintf(stderr, "         -T ... disable trace points (default: enabled)\n");
+    fprintf(stderr, "         -K ... save the sorted k-mer tables of the blocks as <block>.[N|C].kmers, they are reused when present\n");
+    fprintf(stderr, "         -P ... load the next B block while comparing the current one (not with -D)\n");
+    fprintf(stderr, "         -N ... NUMA placement, pin the threads to cores spread over the nodes and interleave the blocks across them\n");
+    fprintf(stderr, "         -S ... hold at most -S MB of overlaps in memory, sorted runs beyond are spilled to disk (default: 1/4 of -M)\n");
+    fprintf(stderr, "         -W ... seed only with the minimizers of windows of -W k-mers (default: all k-mers), -h may need to be lowered\n");
+    fprintf(stderr, "         -n ... dry run, print the estimated memory of every comparison and exit. Compares the first -n reads of\n");
+    fprintf(stderr, "                every block to also estimate the seed hits and run time (0: memory of the k-mer tables only)\n");
   }
 
 int VERBOSE;   //   Globally visible to filter.c
 int BIASED;
+int MINIMIZER;
+int SAVE_KMERS;
+int PREFETCH;
+int PLACEMENT;
 int MINOVER;
 int HGAP_MIN;
 int SYMMETRIC;
@@ -439,17 +463,66 @@ HITS_TRACK *Merge_Tracks(HITS_DB *block, int mtop, int64 nsize)
     return (ntrack);
   }
 
+  //  Masked intervals of the combined track that are less than kmer apart are joined, and
+  //    stretched to the ends of the read if they come closer than that. The unmasked gaps
+  //    dropped could not hold a k-mer, so the tuples listed by Sort_Kmers do not change,
+  //    but it visits fewer intervals.
+
+static void Coalesce_Mask(HITS_DB *block, HITS_TRACK *track, int kmer)
+  {
+    int64 *anno = (int64 *) (track->anno);
+    int *data = (int *) (track->data);
+    int64 j, b, e, w;
+    int r, rlen, beg, end;
+
+    w = 0;
+    for (r = 0; r < block->nreads; r++)
+      {
+        rlen = block->reads[r].rlen;
+        b = anno[r];
+        e = anno[r + 1];
+        anno[r] = w;
+        for (j = b; j + 1 < e; j += 2)
+          {
+            beg = data[j];
+            end = data[j + 1];
+            if (beg < kmer)
+              beg = 0;
+            if (rlen - end < kmer)
+              end = rlen;
+            if (w > anno[r] && beg - data[w - 1] < kmer)
+              {
+                if (end > data[w - 1])
+                  data[w - 1] = end;
+              }
+            else
+              {
+                data[w++] = beg;
+                data[w++] = end;
+              }
+          }
+      }
+    anno[block->nreads] = w;
+  }
+
+  //  The bases of a block are loaded by a thread while its mask tracks are read
+
+static void *read_sequences(void *arg)
+  {
+    Read_All_Sequences_Parallel((HITS_DB *) arg, 0, NTHREADS);
+    return (NULL);
+  }
+
+  //  The mask tracks of block are combined into one private track, even a single one, as it is
+  //    coalesced in place
+
 #ifdef DMASK
-static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop, int kmer, DynamicMask* dm)
+static void load_masks(HITS_DB *block, char **mask, int *mstat, int mtop, int kmer, DynamicMask* dm)
 #else
-static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop, int kmer, void* dm)
+static void load_masks(HITS_DB *block, char **mask, int *mstat, int mtop, int kmer, void* dm)
 #endif
   {
-    int i, isdam, status, stop;
-
-    isdam = Open_DB(name, block);
-    if (isdam < 0)
-      exit(1);
+    int i, status, stop;
 
     stop = 0;
     for (i = 0; i < mtop; i++)
@@ -482,19 +555,37 @@ static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop
           anno[j] /= sizeof(track_data);
       }
 
-    if (stop > 1)
+    if (stop > 0)
       {
         int64 nsize;
         HITS_TRACK *track;
 
         nsize = Merge_Size(block, stop);
         track = Merge_Tracks(block, stop, nsize);
+        Coalesce_Mask(block, track, kmer);
 
         while (block->tracks != NULL)
           Close_Track(block, block->tracks->name);
 
         block->tracks = track;
       }
+  }
+
+#ifdef DMASK
+static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop, int kmer, DynamicMask* dm)
+#else
+static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop, int kmer, void* dm)
+#endif
+  {
+    int i, isdam;
+    pthread_t loader;
+    uint64_t start;
+
+    start = INS_START();
+
+    isdam = Open_DB(name, block);
+    if (isdam < 0)
+      exit(1);
 
     for (i = 0; i < block->nreads; i++)
       if (block->reads[i].rlen < kmer)
@@ -503,27 +594,140 @@ static int read_DB(HITS_DB *block, char* name, char **mask, int *mstat, int mtop
           exit(1);
         }
 
-    Read_All_Sequences(block, 0);
+    if (pthread_create(&loader, NULL, read_sequences, block) != 0)
+      {
+        fprintf(stderr, "[ERROR] - daligner: Cannot create thread to read block %s\n", name);
+        exit(1);
+      }
+
+    load_masks(block, mask, mstat, mtop, kmer, dm);
+
+    pthread_join(loader, NULL);
+
+    if (PLACEMENT)
+      placement_interleave(((char *) block->bases) - 1, block->totlen + block->nreads + 4);
+
+    INS_STOP("daligner.read_db", start);
 
     return (isdam);
   }
 
-static void complement(char *s, int len)
+  //  File name of block b of the DB at root (path without .db)
+
+static char *block_file(char *root, int b)
   {
-    char *t;
-    int c;
+    char *file;
+
+    file = (char *) Malloc(strlen(root) + 20, "Allocating block name");
+    if (file == NULL)
+      exit(1);
+    sprintf(file, "%s.%d", root, b);
+    return (file);
+  }
+
+static char *kmer_path(char *file, char *root, int comp)
+  {
+    char *dir, *path;
+
+    dir = PathTo(file);
+    path = Strdup(Catenate(dir, "/", root, comp ? ".C.kmers" : ".N.kmers"), "Allocating k-mer table name");
+    if (path == NULL)
+      exit(1);
+    free(dir);
+    return (path);
+  }
 
-    t = s + (len - 1);
-    while (s < t)
+  //  The sorted k-mer table of block (complemented if comp), taken from <root>.[N|C].kmers
+  //  next to file when that is current (and load is set), and saved there after sorting
+  //  if -K is set
+
+static void *block_index(HITS_DB *block, char *file, char *root, int comp, int *len, int map, int load)
+  {
+    char *path;
+    void *index;
+    uint64_t start;
+
+    start = INS_START();
+
+    path = kmer_path(file, root, comp);
+
+    index = NULL;
+    if (load)
+      index = Load_Kmers(path, block, len, map);
+    if (index == NULL)
+      {
+        index = Sort_Kmers(block, len);
+        if (SAVE_KMERS)
+          Save_Kmers(path, block, index, *len);
+      }
+
+    free(path);
+
+    INS_STOP("daligner.index", start);
+
+    return (index);
+  }
+
+  //  With -P the next B block, and its saved table if there is one, is loaded by a
+  //    producer thread while the current block is compared
+
+typedef struct
+  {
+    char      *file;
+    char     **mask;
+    int       *mstat;     //  private, main only reports the status of the first B block
+    int        mtop;
+    int        kmer;
+
+    HITS_DB    block;
+    char      *root;
+    void      *index;     //  its saved N table or NULL
+    int        len;
+
+    pthread_t  thread;
+  } Block_Load;
+
+static void *load_thread(void *arg)
+  {
+    Block_Load *load = (Block_Load *) arg;
+    char *path;
+    int isdam;
+
+    isdam = read_DB(&load->block, load->file, load->mask, load->mstat, load->mtop, load->kmer, NULL);
+    if (isdam)
+      load->root = Root(load->file, ".dam");
+    else
+      load->root = Root(load->file, ".db");
+
+    path = kmer_path(load->file, load->root, 0);
+    load->index = Load_Kmers(path, &load->block, &load->len, 0);
+    free(path);
+
+    return (NULL);
+  }
+
+static void start_load(Block_Load *load, char *file, char **mask, int *mstat, int mtop, int kmer)
+  {
+    load->file = file;
+    load->mask = mask;
+    load->mtop = mtop;
+    load->kmer = kmer;
+    load->mstat = (int *) Malloc((mtop + 1) * sizeof(int), "Allocating mask status array");
+    if (load->mstat == NULL)
+      exit(1);
+    memcpy(load->mstat, mstat, mtop * sizeof(int));
+
+    if (pthread_create(&load->thread, NULL, load_thread, load) != 0)
       {
-        c = *s;
-        *s = (char) (3 - *t);
-        *t = (char) (3 - c);
-        s += 1;
-        t -= 1;
+        fprintf(stderr, "%s: Cannot create block loading thread\n", Prog_Name);
+        exit(1);
       }
-    if (s == t)
-      *s = (char) (3 - *s);
+  }
+
+static void finish_load(Block_Load *load)
+  {
+    pthread_join(load->thread, NULL);
+    free(load->mstat);
   }
 
 static HITS_DB *complement_DB(HITS_DB *block, int inplace)
@@ -566,7 +770,7 @@ static HITS_DB *complement_DB(HITS_DB *block, int inplace)
         cblock->freq[2] = x;
 
         for (i = 0; i < nreads; i++)
-          complement(seq + reads[i].boff, reads[i].rlen);
+          Complement_Read(reads[i].rlen, seq + reads[i].boff);
       }
 
       {
@@ -667,6 +871,243 @@ static void createSubdir(HITS_DB* block, int RUN_ID)
       }
   }
 
+  //  Dry run (-n): the memory of every comparison is predicted from the block sizes, the merged
+  //    masks and the k-mer parameters.  With a sample size the first reads of each block are
+  //    compared as well, their seed hits and timings are scaled up by the sampled share of the
+  //    blocks, linearly for the k-mer sorts and quadratically for the comparisons.
+
+typedef struct
+  { HITS_DB block;
+    char   *file;
+    int     nreads;
+    int64   bases;
+    int64   kmers;     //  estimated for the whole block
+    int64   mem;       //  block with its merged mask
+    double  frac;      //  sampled share of the bases
+    void   *index;     //  sorted k-mers of the sample
+    int     len;
+    double  sort;      //  seconds spent sorting them
+  } Dry_Block;
+
+static double dry_seconds(uint64_t start)
+  { return ((ins_now() - start) / 1e9); }
+
+static void dry_open(Dry_Block *dry, char *file, char **mask, int *mstat, int mtop, int kmer, int sample)
+  {
+    HITS_DB *block = &dry->block;
+    HITS_TRACK *track;
+    int64 *anno;
+    int *data;
+    int64 j;
+    int r, p;
+    uint64_t start;
+
+    if (Open_DB(file, block) < 0)
+      exit(1);
+    load_masks(block, mask, mstat, mtop, kmer, NULL);
+
+    dry->file   = file;
+    dry->nreads = block->nreads;
+    dry->bases  = block->totlen;
+    dry->mem    = Block_Memory(block->nreads, block->totlen);
+
+    //  Sort_Kmers lists len-k k-mers for every unmasked stretch of a read
+
+    track = block->tracks;
+    anno  = NULL;
+    data  = NULL;
+    if (track != NULL)
+      { anno = (int64 *) track->anno;
+        data = (int *) track->data;
+        dry->mem += (block->nreads + 1) * sizeof(int64) + anno[block->nreads] * sizeof(int);
+      }
+
+    dry->kmers = 0;
+    for (r = 0; r < block->nreads; r++)
+      { p = 0;
+        if (track != NULL)
+          for (j = anno[r]; j + 1 < anno[r + 1]; j += 2)
+            { if (data[j] - p > kmer)
+                dry->kmers += data[j] - p - kmer;
+              p = data[j + 1];
+            }
+        if (block->reads[r].rlen - p > kmer)
+          dry->kmers += block->reads[r].rlen - p - kmer;
+      }
+    if (MINIMIZER > 0)
+      dry->kmers = (2 * dry->kmers) / (MINIMIZER + 1);
+
+    dry->index = NULL;
+    dry->len   = 0;
+    dry->frac  = 1.;
+    dry->sort  = 0.;
+    if (sample <= 0)
+      return;
+
+    if (sample < block->nreads)
+      { block->nreads = sample;
+        block->totlen = 0;
+        for (r = 0; r < sample; r++)
+          block->totlen += block->reads[r].rlen;
+      }
+    Read_All_Sequences_Parallel(block, 0, NTHREADS);
+    if (dry->bases > 0)
+      dry->frac = (1. * block->totlen) / dry->bases;
+
+    start = ins_now();
+    dry->index = Sort_Kmers(block, &dry->len);
+    dry->sort  = dry_seconds(start) / dry->frac;
+  }
+
+  //  Compares the samples of a and b (a itself on the diagonal) in both orientations like the
+  //    main loop does.  The seed hits of each orientation are returned in hits, the time spent
+  //    sorting the k-mers of b in *sort, both scaled to the full blocks.  Returns the time of
+  //    the comparisons proper.
+
+static double dry_compare(Dry_Block *a, Dry_Block *b, Align_Spec *aspec, int64 *hits, double *sort)
+  {
+    HITS_DB *cblock;
+    void *cindex;
+    int clen;
+    int64 nhits, chits;
+    double scale, time;
+    uint64_t start;
+
+    scale = 1. / (a->frac * b->frac);
+    if (a == b)
+      { nhits = Count_Hits(a->index, a->len, a->index, a->len, 1, 0);
+        start = ins_now();
+        Match_Filter(a->file, &a->block, a->file, &a->block, a->index, a->len, a->index, a->len, 0, aspec);
+        time  = dry_seconds(start) * scale;
+        *sort = 0.;
+
+        start  = ins_now();
+        cblock = complement_DB(&a->block, 0);
+        cindex = Sort_Kmers(cblock, &clen);
+        *sort += dry_seconds(start) / b->frac;
+      }
+    else
+      { nhits = Count_Hits(a->index, a->len, b->index, b->len, 0, 0);
+        start = ins_now();
+        Match_Filter(a->file, &a->block, b->file, &b->block, a->index, a->len, b->index, b->len, 0, aspec);
+        time  = dry_seconds(start) * scale;
+        *sort = b->sort;
+        if (nhits == 0)                //  Match_Filter only takes over b's table if there are hits
+          free(b->index);
+        b->index = NULL;
+
+        start  = ins_now();
+        cblock = complement_DB(&b->block, 1);
+        cindex = Sort_Kmers(cblock, &clen);
+        *sort += dry_seconds(start) / b->frac;
+      }
+
+    chits = Count_Hits(a->index, a->len, cindex, clen, a == b, 1);
+    start = ins_now();
+    Match_Filter(a->file, &a->block, b->file, cblock, a->index, a->len, cindex, clen, 1, aspec);
+    time += dry_seconds(start) * scale;
+    if (chits == 0)
+      free(cindex);
+    Reset_Overlap_Buffer(aspec);
+
+    if (a == b)
+      { cblock->reads = NULL;
+        cblock->path  = NULL;
+        Close_DB(cblock);
+      }
+
+    hits[0] = nhits * scale;
+    hits[1] = chits * scale;
+    return (time);
+  }
+
+static void dry_run(char **files, int nfiles, char **mask, int *mstat, int mtop, int kmer, int sample,
+                    double ave_error, int spacing, int no_trace)
+  {
+    Dry_Block _a, _b, *a = &_a, *b;
+    Align_Spec *aspec;
+    int64 hits[2], mem, peak;
+    int64 nhits, cells, sorted;
+    double match, sort, ksecs, hsecs;
+    int i, over;
+
+    dry_open(a, files[0], mask, mstat, mtop, kmer, sample);
+
+    aspec = New_Align_Spec(ave_error, spacing, a->block.freq, NTHREADS, SYMMETRIC, ONLY_IDENTITY, no_trace);
+    Set_Overlap_Buffer_Limit(aspec, MEM_LIMIT / 4);
+
+    if (sample > 0)
+      printf("\nDry run, sampling the first %d reads of every block\n\n", sample);
+    else
+      printf("\nDry run, seed hits not sampled (-n0), memory excludes the hit lists\n\n");
+
+    peak   = 0;
+    over   = 0;
+    nhits  = cells = 0;
+    sorted = a->kmers;
+    ksecs  = a->sort;
+    hsecs  = 0.;
+    for (i = 1; i < nfiles; i++)
+      { if (strcmp(files[0], files[i]) == 0)
+          b = a;
+        else
+          { b = &_b;
+            dry_open(b, files[i], mask, mstat, mtop, kmer, sample);
+          }
+
+        hits[0] = hits[1] = 0;
+        match = sort = 0.;
+        if (sample > 0)
+          match = dry_compare(a, b, aspec, hits, &sort);
+
+        mem = Daligner_Memory(a->mem, a->kmers, b->mem, b->kmers, MAX(hits[0], hits[1]), a == b, MEM_LIMIT);
+        if (mem > peak)
+          peak = mem;
+
+        if (i == 1)
+          printf("  %s: %d reads, %lld bases, %lld k-mers\n", a->file, a->nreads, a->bases, a->kmers);
+        if (b != a)
+          printf("  %s: %d reads, %lld bases, %lld k-mers\n", b->file, b->nreads, b->bases, b->kmers);
+        printf("    %s vs %s: %.2fGb", a->file, b->file, (1. * mem) / 0x40000000ll);
+        if (sample > 0)
+          printf(", %lld + %lld seed hits, %.0fs", hits[0], hits[1], match + sort);
+        if (MEM_LIMIT > 0 && mem > (int64) MEM_LIMIT)
+          { printf("  exceeds -M %.1fGb", (1. * MEM_LIMIT) / 0x40000000ll);
+            over = 1;
+          }
+        printf("\n");
+
+        nhits  += hits[0] + hits[1];
+        cells  += 2 * a->kmers * b->kmers;
+        sorted += (b == a ? 1 : 2) * b->kmers;
+        ksecs  += sort;
+        hsecs  += match;
+
+        if (b != a)
+          Close_DB(&b->block);
+      }
+
+    printf("\n  Peak memory %.2fGb", (1. * peak) / 0x40000000ll);
+    if (sample > 0)
+      printf(", run time %.0fs", ksecs + hsecs);
+    printf("\n");
+    if (sample > 0)
+      { printf("  Hit density %.3e", cells > 0 ? (1. * nhits) / cells : 0.);
+        printf(", %.4f seconds per million k-mers sorted", sorted > 0 ? ksecs / (sorted / 1e6) : 0.);
+        printf(", %.4f seconds per million hits\n", nhits > 0 ? hsecs / (nhits / 1e6) : 0.);
+        printf("  (HPCdaligner -E --hitDensity %.3e --kmerTime %.4f --hitTime %.4f)\n",
+               cells > 0 ? (1. * nhits) / cells : 0., sorted > 0 ? ksecs / (sorted / 1e6) : 0.,
+               nhits > 0 ? hsecs / (nhits / 1e6) : 0.);
+      }
+    fflush(stdout);
+
+    free(a->index);
+    Close_DB(&a->block);
+    Free_Align_Spec(aspec);
+
+    exit(over);
+  }
+
 int main(int argc, char *argv[])
   {
     HITS_DB _ablock, _bblock;
@@ -684,6 +1125,12 @@ int main(int argc, char *argv[])
 #else
     void* dm = NULL;
 #endif
+    int DISPATCH = 0;
+    char *droot = NULL;
+    char *ls_arg = NULL;
+    LaStream *ls = NULL;
+    char *freq_arg = NULL;
+    int dpair[2] = { 0, 0 };
 
     int isdam;
     int MMAX, MTOP, *MSTAT;
@@ -698,6 +1145,8 @@ int main(int argc, char *argv[])
     int SPACING = 100;
     int RUN_ID = 0;
     int NO_TRACE_POINTS=0;
+    int SPILL_LIMIT = -1;
+    int DRY_RUN = -1;
 
     MINOVER = 1000;    //   Globally visible to filter.c
     RUN_ID = 1;
@@ -726,7 +1175,7 @@ int main(int argc, char *argv[])
     int c;
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "vbOTAIk:w:h:t:M:e:l:s:H:D:m:r:j:")) != -1)
+    while ((c = getopt(argc, argv, "vbdOTAIKPNk:w:h:t:M:e:l:s:H:D:m:r:j:W:S:L:F:n:")) != -1)
       {
         switch (c)
         {
@@ -739,6 +1188,23 @@ int main(int argc, char *argv[])
           case 'T':
             NO_TRACE_POINTS = 1;
             break;
+          case 'K':
+            SAVE_KMERS = 1;
+            break;
+          case 'P':
+            PREFETCH = 1;
+            break;
+          case 'N':
+            PLACEMENT = 1;
+            break;
+          case 'S':
+            SPILL_LIMIT = atoi(optarg);
+            if (SPILL_LIMIT < 0)
+              {
+                fprintf(stderr, "invalid overlap buffer limit of %d\n", SPILL_LIMIT);
+                exit(1);
+              }
+            break;
           case 'I':
             IDENTITY = 1;
             break;
@@ -800,10 +1266,19 @@ int main(int argc, char *argv[])
                 }
               break;
             }
+          case 'L':
+            ls_arg = optarg;
+            break;
+          case 'F':
+            freq_arg = optarg;
+            break;
 #ifdef DMASK
           case 'D':
             dm_arg = optarg;
             break;
+          case 'd':
+            DISPATCH = 1;
+            break;
 #endif
           case 'M':
             {
@@ -826,6 +1301,22 @@ int main(int argc, char *argv[])
             MASK[MTOP] = optarg;
             MTOP++;
             break;
+          case 'W':
+            MINIMIZER = atoi(optarg);
+            if (MINIMIZER < 0 || MINIMIZER > 256)
+              {
+                fprintf(stderr, "invalid minimizer window of %d, must be in [0,256]\n", MINIMIZER);
+                exit(1);
+              }
+            break;
+          case 'n':
+            DRY_RUN = atoi(optarg);
+            if (DRY_RUN < 0)
+              {
+                fprintf(stderr, "invalid dry run sample of %d reads\n", DRY_RUN);
+                exit(1);
+              }
+            break;
           case 'r':
             RUN_ID = atoi(optarg);
             if (RUN_ID < 0)
@@ -881,6 +1372,32 @@ int main(int argc, char *argv[])
         fprintf(stderr, "invalid trace spacing of (%d)\n", SPACING);
         exit(1);
       }
+    if (MINIMIZER > 0 && BIASED)
+      {
+        fprintf(stderr, "minimizer seeding (-W) cannot be combined with -b\n");
+        exit(1);
+      }
+#ifdef DMASK
+    if (DISPATCH)
+      {
+        if (dm_arg == NULL || !SYMMETRIC || optind + 1 != argc)
+          {
+            fprintf(stderr, "[ERROR] - -d requires -D, a single database and excludes -A\n\n");
+            usage();
+            exit(1);
+          }
+
+        char *dir = PathTo(argv[optind]);
+        char *root = Root(argv[optind], ".db");
+
+        droot = Strdup(Catenate(dir, "/", root, ""), "Allocating database name");
+        if (droot == NULL)
+          exit(1);
+        free(dir);
+        free(root);
+      }
+    else
+#endif
     if (optind + 2 > argc)
       {
         fprintf(stderr, "[ERROR] - at least one target and one subject block are required\n\n");
@@ -894,25 +1411,27 @@ int main(int argc, char *argv[])
         fprintf(stderr, "Illegal combination of filter parameters\n");
         exit(1);
       }
-
-#ifdef DMASK
-    if (dm_arg != NULL)
+    if (freq_arg != NULL && Set_Filter_Frequent(freq_arg))
       {
-        char* dm_host = dm_arg;
-        char* port;
-        int dm_port;
+        fprintf(stderr, "%s holds no frequent %d-mers (KMsketch -k%d)\n", freq_arg, KMER_LEN, KMER_LEN);
+        exit(1);
+      }
+    Set_Filter_Placement(PLACEMENT);
 
-        if ((port = strchr(dm_host, ':')) == NULL)
-          {
-            dm_port = DMASK_DEFAULT_PORT;
-          }
-        else
+    if (DRY_RUN >= 0)
+      {
+        if (DISPATCH)
           {
-            *port = '\0';
-            dm_port = atoi(port + 1);
+            fprintf(stderr, "[ERROR] - the dry run (-n) needs the blocks on the command line, it excludes -d\n");
+            exit(1);
           }
+        dry_run(argv + optind, argc - optind, MASK, MSTAT, MTOP, KMER_LEN, DRY_RUN, AVE_ERROR, SPACING, NO_TRACE_POINTS);
+      }
 
-        dm = dm_init(dm_host, dm_port);
+#ifdef DMASK
+    if (dm_arg != NULL)
+      {
+        dm = dm_init_shards(dm_arg, DMASK_DEFAULT_PORT);
 
         if (dm == NULL)
           {
@@ -926,19 +1445,40 @@ int main(int argc, char *argv[])
       }
 #endif
 
-    /* Read in the reads in A */
+    if (ls_arg != NULL)
+      {
+        if (dm != NULL)
+          {
+            fprintf(stderr, "the dynamic mask server reads the .las files, -L excludes -D\n");
+            exit(1);
+          }
 
-    afile = argv[optind];
-    isdam = read_DB(ablock, afile, MASK, MSTAT, MTOP, KMER_LEN, dm);
+        ls = ls_init(ls_arg, LASTREAM_DEFAULT_PORT);
+        if (ls == NULL)
+          {
+            fprintf(stderr, "failed to initialise the overlap stream\n");
+            exit(1);
+          }
+      }
 
-    if (isdam)
-      aroot = Root(afile, ".dam");
-    else
-      aroot = Root(afile, ".db");
+    /* Read in the reads in A, with -d the blocks are read as the pairs come in */
+
+    afile = NULL;
+    aroot = NULL;
+    if (!DISPATCH)
+      {
+        afile = argv[optind];
+        isdam = read_DB(ablock, afile, MASK, MSTAT, MTOP, KMER_LEN, dm);
+
+        if (isdam)
+          aroot = Root(afile, ".dam");
+        else
+          aroot = Root(afile, ".db");
+      }
 
     // check if b-blocks belong to a different DB, if so unset SYMMETRIC flag!!!!
     optind++;
-    if (SYMMETRIC)
+    if (SYMMETRIC && !DISPATCH)
       {
         int i;
         broot = NULL;
@@ -975,20 +1515,78 @@ int main(int argc, char *argv[])
           }
       }
 
-    /* Create subdirectory */
-    createSubdir(ablock, RUN_ID);
+    /* Create subdirectory, not needed if the overlaps are streamed */
+    if (!DISPATCH && ls == NULL)
+      createSubdir(ablock, RUN_ID);
 
-    asettings = New_Align_Spec(AVE_ERROR, SPACING, ablock->freq, NTHREADS, SYMMETRIC, ONLY_IDENTITY, NO_TRACE_POINTS);
+    asettings = NULL;
 
     /* Compare against reads in B in both orientations */
       {
-        int i, j;
+        Block_Load load, *next;
+        int i, j, loaded;
+        uint64_t start;
+
         aindex = NULL;
         broot = NULL;
-        for (i = optind; i < argc; i++)
+        next = NULL;
+        for (i = optind; ; i++)
           {
-            bfile = argv[i];
-            if (strcmp(afile, bfile) != 0)
+#ifdef DMASK
+            if (DISPATCH)
+              {
+                int a, b, more;
+
+                more = dm_next_pair(dm, dpair[0], dpair[1], &a, &b);
+                if (more < 0)
+                  exit(1);
+                if (more == 0)
+                  break;
+
+                if (a != dpair[0])
+                  { if (afile != NULL)
+                      { free(aindex);
+                        Close_DB(ablock);
+                        free(aroot);
+                        free(afile);
+                      }
+
+                    afile = block_file(droot, a);
+                    read_DB(ablock, afile, MASK, MSTAT, MTOP, KMER_LEN, dm);
+                    aroot = Root(afile, ".db");
+                    aindex = NULL;
+
+                    if (ls == NULL)
+                      createSubdir(ablock, RUN_ID);
+                  }
+
+                if (VERBOSE)
+                  printf("\nComparing blocks %d and %d\n", a, b);
+
+                dpair[0] = a;
+                dpair[1] = b;
+                bfile = (a == b) ? afile : block_file(droot, b);
+              }
+            else
+#endif
+            if (i < argc)
+              bfile = argv[i];
+            else
+              break;
+
+            bindex = NULL;
+            loaded = 0;
+            if (next != NULL)
+              {
+                finish_load(next);
+                *bblock = next->block;
+                broot = next->root;
+                bindex = next->index;
+                blen = next->len;
+                loaded = 1;
+                next = NULL;
+              }
+            else if (strcmp(afile, bfile) != 0)
               {
                 isdam = read_DB(bblock, bfile, MASK, MSTAT, MTOP, KMER_LEN, dm);
                 if (isdam)
@@ -1006,15 +1604,37 @@ int main(int argc, char *argv[])
                     else if (MSTAT[j] == -1)
                       printf("[WARNING]: daligner %s track not sync'd with relevant db.\n", MASK[i]);
                   }
+              }
+
+            if (PREFETCH && dm == NULL && i + 1 < argc && strcmp(afile, argv[i + 1]) != 0)
+              {
+                next = &load;
+                start_load(next, argv[i + 1], MASK, MSTAT, MTOP, KMER_LEN);
+              }
 
+            if (asettings == NULL)
+              {
+                asettings = New_Align_Spec(AVE_ERROR, SPACING, ablock->freq, NTHREADS, SYMMETRIC, ONLY_IDENTITY, NO_TRACE_POINTS);
+                if (SPILL_LIMIT >= 0)
+                  Set_Overlap_Buffer_Limit(asettings, SPILL_LIMIT * 0x100000ll);
+                else
+                  Set_Overlap_Buffer_Limit(asettings, MEM_LIMIT / 4);
+                if (ls != NULL)
+                  Set_Overlap_Stream(asettings, &(ls->stream));
+              }
+
+            //  blocks switched with -d are freed again, their saved table is not mapped
+
+            if (aindex == NULL)
+              {
                 if (VERBOSE)
                   printf("\nBuilding index for %s\n", aroot);
-                aindex = Sort_Kmers(ablock, &alen);
+                aindex = block_index(ablock, afile, aroot, 0, &alen, !DISPATCH, 1);
               }
 
             if (strcmp(afile, bfile) != 0)
               {
-                if (SYMMETRIC)
+                if (SYMMETRIC && ls == NULL)
                   createSubdir(bblock, RUN_ID);
                 if (dm)
                   dm_send_next(dm, RUN_ID, ablock, aroot, bblock, broot);
@@ -1022,7 +1642,8 @@ int main(int argc, char *argv[])
                 if (VERBOSE)
                   printf("\nBuilding index for %s\n", broot);
 
-                bindex = Sort_Kmers(bblock, &blen);
+                if (bindex == NULL)
+                  bindex = block_index(bblock, bfile, broot, 0, &blen, 0, !loaded);
                 Match_Filter(aroot, ablock, broot, bblock, aindex, alen, bindex, blen, 0, asettings);
 
                 bblock = complement_DB(bblock, 1);
@@ -1030,7 +1651,7 @@ int main(int argc, char *argv[])
                 if (VERBOSE)
                   printf("\nBuilding index for c(%s)\n", broot);
 
-                bindex = Sort_Kmers(bblock, &blen);
+                bindex = block_index(bblock, bfile, broot, 1, &blen, 0, 1);
                 Match_Filter(aroot, ablock, broot, bblock, aindex, alen, bindex, blen, 1, asettings);
 
                 int lastRead;
@@ -1038,7 +1659,9 @@ int main(int argc, char *argv[])
                   lastRead = bblock->ufirst + bblock->nreads - 1;
                 else
                   lastRead = ablock->ufirst + ablock->nreads - 1;
+                start = INS_START();
                 Write_Overlap_Buffer(asettings, RUN_ID, aroot, broot, lastRead);
+                INS_STOP("daligner.write_overlaps", start);
                 Reset_Overlap_Buffer(asettings);
 
                 if (dm)
@@ -1062,10 +1685,12 @@ int main(int argc, char *argv[])
                 if (VERBOSE)
                   printf("\nBuilding index for c(%s)\n", aroot);
 
-                bindex = Sort_Kmers(bblock, &blen);
+                bindex = block_index(bblock, afile, aroot, 1, &blen, 0, 1);
                 Match_Filter(aroot, ablock, aroot, bblock, aindex, alen, bindex, blen, 1, asettings);
 
+                start = INS_START();
                 Write_Overlap_Buffer(asettings, RUN_ID, aroot, aroot, ablock->ufirst + ablock->nreads - 1);
+                INS_STOP("daligner.write_overlaps", start);
                 Reset_Overlap_Buffer(asettings);
 
                 if (dm)
@@ -1078,8 +1703,11 @@ int main(int argc, char *argv[])
 
                 bblock->reads = NULL;  //  ablock & bblock share "reads" vector, don't let Close_DB
                                        //     free it !
+                bblock->path = NULL;   //  nor the path, ablock lives on with -d
               }
             Close_DB(bblock);
+            if (DISPATCH && bfile != afile)
+              free(bfile);
           }
       }
 
@@ -58,10 +58,15 @@
 #include <unistd.h>
 #include <math.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "db/DB.h"
 #include "filter.h"
 #include "dalign/align.h"
+#include "lib/instrument.h"
+#include "lib/placement.h"
 
 #define THREAD    pthread_t
 #undef THREAD_OUTPUT
@@ -72,6 +77,8 @@
 
 #define PANEL_SIZE     50000   //  Size to break up very long A-reads
 #define PANEL_OVERLAP  10000   //  Overlap of A-panels
+#define PANEL_SPLIT        4   //  Pairs with hits in more panels are aligned in parts of this
+                               //    many panels by different threads
 
 #define MATCH_CHUNK    100     //  Max expected number of hits between two reads
 #define TRACE_CHUNK  20000     //  Max expected trace points in hits between two reads
@@ -109,6 +116,118 @@
 #define NOTHREAD
 #endif
 
+/*******************************************************************************************
+ *
+ *  THREAD POOL
+ *
+ *  The worker threads are started on first use and kept for all phases of all block
+ *    comparisons.  run_threads(func,args,size) calls func(args + i*size) in worker i for
+ *    i in [0,NTHREADS) and returns when all calls are done.
+ *
+ ********************************************************************************************/
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  void *(*func)(void *);
+  char *args;
+  size_t size;
+  int count;       //  workers taking part in the current round
+  int busy;        //  of which are still running
+  int round;
+  int nthreads;    //  workers started
+} Pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0 };
+
+static int Pin_Threads = 0;
+
+void Set_Filter_Placement(int pin)
+  {
+    Pin_Threads = pin;
+  }
+
+  //  Pinned workers first touch the buffers they write (k-mer lists, hit vectors, alignment
+  //    work data), which places those pages on the worker's node
+
+static void *pool_worker(void *arg)
+  {
+    int i = (int) (intptr_t) arg;
+    int round = 0;
+
+    if (Pin_Threads)
+      placement_pin(i);
+
+    while (1)
+      {
+        void *(*func)(void *);
+        void *args;
+
+        pthread_mutex_lock(&Pool.lock);
+        while (Pool.round == round)
+          pthread_cond_wait(&Pool.work, &Pool.lock);
+        round = Pool.round;
+        if (i >= Pool.count)
+          {
+            pthread_mutex_unlock(&Pool.lock);
+            continue;
+          }
+        func = Pool.func;
+        args = Pool.args + i * Pool.size;
+        pthread_mutex_unlock(&Pool.lock);
+
+        func(args);
+
+        pthread_mutex_lock(&Pool.lock);
+        if (--Pool.busy == 0)
+          pthread_cond_signal(&Pool.done);
+        pthread_mutex_unlock(&Pool.lock);
+      }
+
+    return (NULL);
+  }
+
+static void run_threads(void *(*func)(void *), void *args, size_t size)
+  {
+#ifdef NOTHREAD
+
+    int i;
+
+    for (i = 0; i < NTHREADS; i++)
+      func(((char *) args) + i * size);
+
+#else
+
+    pthread_mutex_lock(&Pool.lock);
+
+    while (Pool.nthreads < NTHREADS)
+      {
+        THREAD thread;
+
+        if (pthread_create(&thread, NULL, pool_worker, (void *) (intptr_t) Pool.nthreads) != 0)
+          {
+            fprintf(stderr, "%s: Cannot create worker thread\n", Prog_Name);
+            exit(1);
+          }
+        pthread_detach(thread);
+        Pool.nthreads += 1;
+      }
+
+    Pool.func = func;
+    Pool.args = (char *) args;
+    Pool.size = size;
+    Pool.count = Pool.busy = NTHREADS;
+    Pool.round += 1;
+    pthread_cond_broadcast(&Pool.work);
+
+    while (Pool.busy > 0)
+      pthread_cond_wait(&Pool.done, &Pool.lock);
+
+    pthread_mutex_unlock(&Pool.lock);
+
+#endif
+  }
+
 typedef struct
 {
   uint64 p1;   //  The lower half
@@ -187,6 +306,68 @@ int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin)
     return (0);
   }
 
+static uint64 *FreqList = NULL;   //  Globally frequent k-mers (Set_Filter_Frequent), sorted
+static int64   FreqLen  = 0;
+static uint64  FreqSum  = 0;      //  Checksum of the list for the k-mer table headers
+
+static uint64 mix_words(uint64 h, void *data, int64 size);
+
+int Set_Filter_Frequent(char *path)
+  { KFreq_Header head;
+    struct stat  info;
+    void        *mem;
+    int          fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return (1);
+
+    if (fstat(fd, &info) < 0 || pread(fd, &head, sizeof(KFreq_Header), 0) != sizeof(KFreq_Header)
+        || head.magic != KFREQ_MAGIC || head.version != KFREQ_VERSION || head.kmer != Kmer
+        || info.st_size != (off_t) (sizeof(KFreq_Header) + sizeof(uint64) * head.len))
+      { close(fd);
+        return (1);
+      }
+
+    if (head.len > 0)
+      { mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem == MAP_FAILED)
+          { close(fd);
+            return (1);
+          }
+        FreqList = (uint64 *) (((char *) mem) + sizeof(KFreq_Header));
+        FreqLen  = head.len;
+        FreqSum  = mix_words(head.cutoff, FreqList, sizeof(uint64) * FreqLen);
+      }
+    close(fd);
+
+    if (VERBOSE)
+      { printf("\n   Suppressing ");
+        Print_Number(FreqLen, 0, stdout);
+        printf(" k-mers occurring %lld+ times in the DB\n", head.cutoff);
+        fflush(stdout);
+      }
+
+    return (0);
+  }
+
+  //  Index of the first globally frequent k-mer >= code
+
+static int64 freq_find(uint64 code)
+  { int64 l, r, m;
+
+    l = 0;
+    r = FreqLen;
+    while (l < r)
+      { m = (l + r) / 2;
+        if (FreqList[m] < code)
+          l = m + 1;
+        else
+          r = m;
+      }
+    return (l);
+  }
+
 /*******************************************************************************************
  *
  *  LEXICOGRAPHIC SORT
@@ -314,8 +495,6 @@ static void *lex_thread(void *arg)
 
 static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
   {
-    THREAD threads[NTHREADS];
-
     int64 len, x, y;
     Double *xch;
     int i, j, k, z;
@@ -379,11 +558,7 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
               x += y;
             }
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_create(threads + i, NULL, lex_thread, parmx + i);
-
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
+        run_threads(lex_thread, parmx, sizeof(Lex_Arg));
 
         xch = LEX_src;
         LEX_src = LEX_trg;
@@ -421,12 +596,177 @@ static Double *lex_sort(int bytes[16], Double *src, Double *trg, Lex_Arg *parmx)
     return (LEX_src);
   }
 
+/*******************************************************************************************
+ *
+ *  IN-PLACE K-MER SORT
+ *
+ *  lex_sort needs a second vector of the size of the table.  When the two do not fit, the
+ *    k-mer table is sorted in place by an MSD radix sort (American flag sort) instead: the
+ *    entries are counted and moved into the buckets of their highest code byte, and the
+ *    buckets are then sorted recursively by the threads.  Equal codes are ordered by read
+ *    and position, which is the order lex_sort keeps as the tables are built in it.
+ *
+ ********************************************************************************************/
+
+#define FLAG_SMALL 32   //  Buckets up to this size are insertion sorted
+
+static inline int kmer_less(KmerPos *x, KmerPos *y)
+  { if (x->code != y->code)
+      return (x->code < y->code);
+    if (x->read != y->read)
+      return (x->read < y->read);
+    return (x->rpos < y->rpos);
+  }
+
+static int kmer_cmp(const void *x, const void *y)
+  { if (kmer_less((KmerPos *) x, (KmerPos *) y))
+      return (-1);
+    return (kmer_less((KmerPos *) y, (KmerPos *) x));
+  }
+
+static void flag_sort(KmerPos *a, int64 n, int shift)
+  { int64 cnt[BPOWR], beg[BPOWR], end[BPOWR];
+    int64 i, j, x;
+    int b, d;
+
+    while (1)
+      { if (n <= FLAG_SMALL)
+          { for (i = 1; i < n; i++)
+              { KmerPos v = a[i];
+                for (j = i; j > 0 && kmer_less(&v, a + (j - 1)); j--)
+                  a[j] = a[j - 1];
+                a[j] = v;
+              }
+            return;
+          }
+        if (shift < 0)                     //  All codes agree in their Kshift bits
+          { qsort(a, n, sizeof(KmerPos), kmer_cmp);
+            return;
+          }
+
+        for (b = 0; b < BPOWR; b++)
+          cnt[b] = 0;
+        for (i = 0; i < n; i++)
+          cnt[(a[i].code >> shift) & BMASK] += 1;
+
+        for (b = 0; b < BPOWR; b++)
+          if (cnt[b] == n)
+            break;
+        if (b < BPOWR)
+          { shift -= BSHIFT;
+            continue;
+          }
+        break;
+      }
+
+    x = 0;
+    for (b = 0; b < BPOWR; b++)
+      { beg[b] = x;
+        end[b] = x += cnt[b];
+      }
+
+    for (b = 0; b < BPOWR; b++)
+      while (beg[b] < end[b])
+        { KmerPos v = a[beg[b]];
+
+          while ((d = (v.code >> shift) & BMASK) != b)
+            { KmerPos w = a[beg[d]];
+              a[beg[d]++] = v;
+              v = w;
+            }
+          a[beg[b]++] = v;
+        }
+
+    x = 0;
+    for (b = 0; b < BPOWR; b++)
+      { flag_sort(a + x, cnt[b], shift - BSHIFT);
+        x += cnt[b];
+      }
+  }
+
+static KmerPos *FS_list;
+static int64    FS_bound[BPOWR + 1];
+static int      FS_shift;
+static int      FS_next;
+
+typedef struct
+  { int64 beg;
+    int64 end;
+    int64 cnt[BPOWR];
+  } Flag_Arg;
+
+static void *flag_count_thread(void *arg)
+  { Flag_Arg *data = (Flag_Arg *) arg;
+    KmerPos  *list = FS_list;
+    int       shift = FS_shift;
+    int64     i;
+    int       b;
+
+    for (b = 0; b < BPOWR; b++)
+      data->cnt[b] = 0;
+    for (i = data->beg; i < data->end; i++)
+      data->cnt[(list[i].code >> shift) & BMASK] += 1;
+    return (NULL);
+  }
+
+static void *flag_bucket_thread(void *arg)
+  { int b;
+
+    (void) arg;
+    while ((b = __atomic_fetch_add(&FS_next, 1, __ATOMIC_RELAXED)) < BPOWR)
+      flag_sort(FS_list + FS_bound[b], FS_bound[b + 1] - FS_bound[b], FS_shift - BSHIFT);
+    return (NULL);
+  }
+
+static void flag_sort_kmers(KmerPos *list, int64 len)
+  { Flag_Arg parmf[NTHREADS];
+    int64    beg[BPOWR], end[BPOWR];
+    int64    x;
+    int      i, b, d;
+
+    FS_list  = list;
+    FS_shift = ((Kshift - 1) / BSHIFT) * BSHIFT;
+
+    x = 0;
+    for (i = 0; i < NTHREADS; i++)
+      { parmf[i].beg = x;
+        parmf[i].end = x = (len * (i + 1)) >> NSHIFT;
+      }
+    run_threads(flag_count_thread, parmf, sizeof(Flag_Arg));
+
+    x = 0;
+    for (b = 0; b < BPOWR; b++)
+      { FS_bound[b] = beg[b] = x;
+        for (i = 0; i < NTHREADS; i++)
+          x += parmf[i].cnt[b];
+        end[b] = x;
+      }
+    FS_bound[BPOWR] = len;
+
+    for (b = 0; b < BPOWR; b++)
+      while (beg[b] < end[b])
+        { KmerPos v = list[beg[b]];
+
+          while ((d = (v.code >> FS_shift) & BMASK) != b)
+            { KmerPos w = list[beg[d]];
+              list[beg[d]++] = v;
+              v = w;
+            }
+          list[beg[b]++] = v;
+        }
+
+    FS_next = 0;
+    run_threads(flag_bucket_thread, parmf, sizeof(Flag_Arg));
+  }
+
 /*******************************************************************************************
  *
  *  INDEX BUILD
  *
  ********************************************************************************************/
 
+#define MAX_WINDOW 256          //  Largest minimizer window, a power of 2
+
 static int *NormShift = NULL;
 static int LogNorm, LogThresh;
 static int LogBase[4];
@@ -440,6 +780,8 @@ typedef struct
   int tnum;
   int64 *kptr;
   int fill;
+  int64 beg;     //  sample_thread: first list entry and number of seeds
+  int64 count;
 } Tuple_Arg;
 
 static void *tuple_thread(void *arg)
@@ -676,6 +1018,133 @@ static void *biased_tuple_thread(void *arg)
     return (NULL);
   }
 
+  /*  Sampled seeds: only the window minimizers of each read (or unmasked interval) are listed,
+      a k-mer being selected if its hash is the smallest of any MINIMIZER consecutive k-mers
+      (leftmost on ties).  Selection depends on the sequence alone, so a region shared by two
+      reads, or by a read and a complemented one, yields the same seeds in both.           */
+
+static uint64 seed_hash(uint64 c)
+  { c ^= (c >> 31);
+    c *= 0x7fb5d329728ea185llu;
+    c ^= (c >> 27);
+    c *= 0x81dadef4bc2dd44dllu;
+    c ^= (c >> 33);
+    return (c);
+  }
+
+static int64 sample_interval(char *s, int p, int q, int read, KmerPos *list, int64 n, int64 *kptr)
+  { uint64 hash[MAX_WINDOW];
+    uint64 code[MAX_WINDOW];
+    int    rpos[MAX_WINDOW];
+    int    head, tail, last;
+    int    b, w, x;
+    uint64 c, h;
+
+    if (p + Kmer > q)
+      return (n);
+
+    w = MINIMIZER;
+    head = tail = 0;
+    last = -1;
+    c = 0;
+    for (x = 1; x < Kmer; x++)
+      c = (c << 2) | s[p++];
+    b = p + (w-1);
+    for ( ; p < q; p++)
+      { c = ((c << 2) | s[p]) & Kmask;
+        h = seed_hash(c) & Kmask;
+        while (tail > head && hash[(tail-1) & (MAX_WINDOW-1)] > h)
+          tail -= 1;
+        x = tail++ & (MAX_WINDOW-1);
+        hash[x] = h;
+        code[x] = c;
+        rpos[x] = p;
+        if (rpos[head & (MAX_WINDOW-1)] <= p-w)
+          head += 1;
+        if (p < b)
+          continue;
+        x = head & (MAX_WINDOW-1);
+        if (rpos[x] != last)
+          { last = rpos[x];
+            if (list != NULL)
+              { list[n].read = read;
+                list[n].rpos = last;
+                list[n].code = code[x];
+                kptr[code[x] & BMASK] += 1;
+              }
+            n += 1;
+          }
+      }
+
+    if (last < 0)                     //  Interval shorter than a window: take its minimum
+      { x = head & (MAX_WINDOW-1);
+        if (list != NULL)
+          { list[n].read = read;
+            list[n].rpos = rpos[x];
+            list[n].code = code[x];
+            kptr[code[x] & BMASK] += 1;
+          }
+        n += 1;
+      }
+
+    return (n);
+  }
+
+  //  Called once with TA_list = NULL to count the seeds of each thread's reads, and once more
+  //  to list them starting at data->beg.
+
+static void *sample_thread(void *arg)
+  {
+    Tuple_Arg *data = (Tuple_Arg *) arg;
+    int tnum = data->tnum;
+    int64 *kptr = data->kptr;
+    KmerPos *list = TA_list;
+    HITS_READ *reads = TA_block->reads;
+    char *bases = (char *) (TA_block->bases);
+    int64 n;
+    int i, m;
+    uint64 c;
+
+    c = TA_block->nreads;
+    i = (c * tnum) >> NSHIFT;
+    m = (c * (tnum + 1)) >> NSHIFT;
+    n = data->beg;
+
+    if (TA_track != NULL)
+      {
+        int64 *anno1 = ((int64 *) (TA_track->anno)) + 1;
+        int *point = (int *) (TA_track->data);
+        int64 a, b, f;
+        int p, q;
+
+        f = anno1[i - 1];
+        for ( ; i < m; i++)
+          {
+            b = f;
+            f = anno1[i];
+            for (a = b; a <= f; a += 2)
+              {
+                if (a == b)
+                  p = 0;
+                else
+                  p = point[a - 1];
+                if (a == f)
+                  q = reads[i].rlen;
+                else
+                  q = point[a];
+                n = sample_interval(bases + reads[i].boff, p, q, i, list, n, kptr);
+              }
+          }
+      }
+
+    else
+      for ( ; i < m; i++)
+        n = sample_interval(bases + reads[i].boff, 0, reads[i].rlen, i, list, n, kptr);
+
+    data->count = n - data->beg;
+    return (NULL);
+  }
+
 static KmerPos *FR_src;
 static KmerPos *FR_trg;
 
@@ -693,16 +1162,20 @@ static void *compsize_thread(void *arg)
     KmerPos *src = FR_src;
     int n, i, c, p;
     uint64 h, g;
+    int64 f;
 
     i = data->beg;
     h = src[i].code;
+    f = freq_find(h);
     n = 0;
     while (i < end)
       {
         p = i++;
         while ((g = src[i].code) == h)
           i += 1;
-        if ((c = (i - p)) < TooFrequent)
+        while (f < FreqLen && FreqList[f] < h)
+          f += 1;
+        if ((c = (i - p)) < TooFrequent && (f >= FreqLen || FreqList[f] != h))
           n += c;
         h = g;
       }
@@ -719,16 +1192,20 @@ static void *compress_thread(void *arg)
     KmerPos *trg = FR_trg;
     int n, i, p;
     uint64 h, g;
+    int64 f;
 
     i = data->beg;
     h = src[i].code;
+    f = freq_find(h);
     n = data->kept;
     while (i < end)
       {
         p = i++;
         while ((g = src[i].code) == h)
           i += 1;
-        if (i - p < TooFrequent)
+        while (f < FreqLen && FreqList[f] < h)
+          f += 1;
+        if (i - p < TooFrequent && (f >= FreqLen || FreqList[f] != h))
           {
             while (p < i)
               trg[n++] = src[p++];
@@ -741,16 +1218,21 @@ static void *compress_thread(void *arg)
 
 void *Sort_Kmers(HITS_DB *block, int *len)
   {
-    THREAD threads[NTHREADS];
     Tuple_Arg parmt[NTHREADS];
     Comp_Arg parmf[NTHREADS];
     Lex_Arg parmx[NTHREADS];
+    int kept[NTHREADS];
     int mersort[16];
 
     KmerPos *src, *trg, *rez;
     int kmers, nreads;
     int i, j, x, z;
     uint64 h;
+    uint64_t start, phase;
+    int suppress, inplace;
+
+    start = INS_START();
+    suppress = (TooFrequent < INT32_MAX || FreqLen > 0);
 
     for (i = 0; i < NTHREADS; i++)
       parmx[i].sptr = (int64*) malloc(sizeof(int64) * NTHREADS * BPOWR);
@@ -782,7 +1264,46 @@ void *Sort_Kmers(HITS_DB *block, int *len)
     if (kmers <= 0)
       goto no_mers;
 
-    if (((Kshift - 1) / BSHIFT + (TooFrequent < INT32_MAX)) & 0x1)
+    TA_block = block;
+    TA_track = block->tracks;
+
+    for (i = 0; i < NTHREADS; i++)
+      {
+        parmt[i].tnum = i;
+        parmt[i].kptr = parmx[i].tptr;
+        for (j = 0; j < BPOWR; j++)
+          parmt[i].kptr[j] = 0;
+        parmt[i].beg = 0;
+      }
+
+    if (MINIMIZER > 0)
+      {
+        TA_list = NULL;
+        run_threads(sample_thread, parmt, sizeof(Tuple_Arg));
+
+        kmers = 0;
+        for (i = 0; i < NTHREADS; i++)
+          {
+            parmt[i].beg = kmers;
+            kmers += parmt[i].count;
+          }
+
+        if (kmers <= 0)
+          goto no_mers;
+      }
+
+    //  Sort in place if the two vectors of lex_sort take more than a quarter of the memory
+
+    inplace = (MEM_LIMIT > 0 && 2 * sizeof(KmerPos) * (kmers + 1) > MEM_LIMIT / 4);
+
+    if (inplace)
+      {
+        src = (KmerPos *) Malloc(sizeof(KmerPos) * (kmers + 1), "Allocating Sort_Kmers vector");
+        trg = NULL;
+        if (src == NULL)
+          exit(1);
+      }
+    else if (((Kshift - 1) / BSHIFT + suppress) & 0x1)
       {
         trg = (KmerPos *) Malloc(sizeof(KmerPos) * (kmers + 1), "Allocating Sort_Kmers vectors");
         src = (KmerPos *) Malloc(sizeof(KmerPos) * (kmers + 1), "Allocating Sort_Kmers vectors");
@@ -791,55 +1312,62 @@ void *Sort_Kmers(HITS_DB *block, int *len)
       {
         src = (KmerPos *) Malloc(sizeof(KmerPos) * (kmers + 1), "Allocating Sort_Kmers vectors");
         trg = (KmerPos *) Malloc(sizeof(KmerPos) * (kmers + 1), "Allocating Sort_Kmers vectors");
+        if (src == NULL || trg == NULL)
+          exit(1);
       }
-    if (src == NULL || trg == NULL)
-      exit(1);
 
     if (VERBOSE)
       {
         printf("\n   Kmer count = ");
         Print_Number((int64) kmers, 0, stdout);
-        printf("\n   Using %.2fGb of space\n", (1. * kmers) / 33554432);
+        printf("\n   Using %.2fGb of space%s\n", (1. * kmers) / (inplace ? 67108864 : 33554432),
+               inplace ? ", sorting in place" : "");
         fflush(stdout);
       }
 
-    TA_block = block;
     TA_list = src;
-    TA_track = block->tracks;
 
-    for (i = 0; i < NTHREADS; i++)
-      {
-        parmt[i].tnum = i;
-        parmt[i].kptr = parmx[i].tptr;
-        for (j = 0; j < BPOWR; j++)
-          parmt[i].kptr[j] = 0;
-      }
+    phase = INS_START();
+    if (MINIMIZER > 0)
+      run_threads(sample_thread, parmt, sizeof(Tuple_Arg));
+    else if (BIASED)
+      run_threads(biased_tuple_thread, parmt, sizeof(Tuple_Arg));
+    else
+      run_threads(tuple_thread, parmt, sizeof(Tuple_Arg));
+    INS_STOP("daligner.sort_kmers.tuples", phase);
 
-    if (BIASED)
+    if (MINIMIZER > 0)
       for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads + i, NULL, biased_tuple_thread, parmt + i);
+        {
+          parmx[i].beg = parmt[i].beg;
+          parmx[i].end = parmt[i].beg + parmt[i].count;
+        }
     else
-      for (i = 0; i < NTHREADS; i++)
-        pthread_create(threads + i, NULL, tuple_thread, parmt + i);
-
-    for (i = 0; i < NTHREADS; i++)
-      pthread_join(threads[i], NULL);
-
-    x = 0;
-    for (i = 0; i < NTHREADS; i++)
       {
-        parmx[i].beg = x;
-        j = (int) ((((int64) nreads) * (i + 1)) >> NSHIFT);
-        parmx[i].end = x = block->reads[j].boff - j * Kmer;
+        x = 0;
+        for (i = 0; i < NTHREADS; i++)
+          {
+            parmx[i].beg = x;
+            j = (int) ((((int64) nreads) * (i + 1)) >> NSHIFT);
+            parmx[i].end = x = block->reads[j].boff - j * Kmer;
+          }
       }
 
-    rez = (KmerPos *) lex_sort(mersort, (Double *) src, (Double *) trg, parmx);
-    if (BIASED || TA_track != NULL)
+    phase = INS_START();
+    if (inplace)
+      {
+        flag_sort_kmers(src, kmers);
+        rez = src;
+      }
+    else
+      rez = (KmerPos *) lex_sort(mersort, (Double *) src, (Double *) trg, parmx);
+    INS_STOP("daligner.sort_kmers.sort", phase);
+    if (MINIMIZER == 0 && (BIASED || TA_track != NULL))
       for (i = 0; i < NTHREADS; i++)
         kmers -= parmt[i].fill;
     rez[kmers].code = Kpowr;
 
-    if (TooFrequent < INT32_MAX && kmers > 0)
+    if (suppress && kmers > 0)
       {
         parmf[0].beg = 0;
         for (i = 1; i < NTHREADS; i++)
@@ -852,7 +1380,9 @@ void *Sort_Kmers(HITS_DB *block, int *len)
           }
         parmf[NTHREADS - 1].end = kmers;
 
-        if (src == rez)
+        if (inplace)
+          FR_src = FR_trg = rez;
+        else if (src == rez)
           {
             FR_src = src;
             FR_trg = rez = trg;
@@ -863,26 +1393,33 @@ void *Sort_Kmers(HITS_DB *block, int *len)
             FR_trg = rez = src;
           }
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_create(threads + i, NULL, compsize_thread, parmf + i);
+        phase = INS_START();
+        run_threads(compsize_thread, parmf, sizeof(Comp_Arg));
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
+        //  In place each thread compacts its own range, the ranges are moved together after
 
         x = 0;
         for (i = 0; i < NTHREADS; i++)
           {
             z = parmf[i].kept;
-            parmf[i].kept = x;
+            parmf[i].kept = (inplace ? parmf[i].beg : x);
+            kept[i] = z;
             x += z;
           }
         kmers = x;
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_create(threads + i, NULL, compress_thread, parmf + i);
+        run_threads(compress_thread, parmf, sizeof(Comp_Arg));
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
+        if (inplace)
+          {
+            x = 0;
+            for (i = 0; i < NTHREADS; i++)
+              {
+                memmove(rez + x, rez + parmf[i].beg, sizeof(KmerPos) * kept[i]);
+                x += kept[i];
+              }
+          }
+        INS_STOP("daligner.sort_kmers.suppress", phase);
 
         rez[kmers].code = Kpowr;
       }
@@ -906,7 +1443,7 @@ void *Sort_Kmers(HITS_DB *block, int *len)
 
     if (VERBOSE)
       {
-        if (TooFrequent < INT32_MAX)
+        if (suppress)
           {
             printf("   Revised kmer count = ");
             Print_Number((int64) kmers, 0, stdout);
@@ -935,14 +1472,192 @@ void *Sort_Kmers(HITS_DB *block, int *len)
     for (i = 0; i < NTHREADS; i++)
       free(parmx[i].sptr);
     *len = kmers;
+    INS_STOP("daligner.sort_kmers", start);
+    INS_COUNT("daligner.kmers", kmers);
     return (rez);
 
     no_mers: *len = 0;
     for (i = 0; i < NTHREADS; i++)
       free(parmx[i].sptr);
+    INS_STOP("daligner.sort_kmers", start);
     return (NULL);
   }
 
+/*******************************************************************************************
+ *
+ *  INDEX FILES
+ *
+ *  A sorted k-mer table is saved as a header followed by its len+1 KmerPos entries (the
+ *    last being the Kpowr sentinel), so it can be used in place when mapped.  The header
+ *    records the filter parameters that shape the table and a checksum of the block's
+ *    sequence and mask intervals.  A table that does not match is ignored.
+ *
+ ********************************************************************************************/
+
+#define KMER_MAGIC   0x52454d4b
+#define KMER_VERSION 1
+
+typedef struct
+  { uint32 magic;
+    uint16 version;
+    uint16 kmer;
+    int    suppress;
+    int    biased;
+    int    minimizer;
+    int    nreads;
+    int64  len;         //  table entries, excluding the sentinel
+    uint64 checksum;
+    int64  reserved1;
+    int64  reserved2;
+  } Kmer_Header;
+
+static uint64 mix_words(uint64 h, void *data, int64 size)
+  { char  *s = (char *) data;
+    uint64 w;
+
+    while (size >= 8)
+      { memcpy(&w, s, 8);
+        h = (h ^ w) * 0x100000001b3llu;
+        h ^= (h >> 29);
+        s += 8;
+        size -= 8;
+      }
+    w = 0;
+    memcpy(&w, s, size);
+    h = (h ^ w) * 0x100000001b3llu;
+    return (h ^ (h >> 29));
+  }
+
+static uint64 block_checksum(HITS_DB *block)
+  { HITS_TRACK *track = block->tracks;
+    int         nreads = block->nreads;
+    uint64      h;
+
+    h = mix_words(0xcbf29ce484222325llu, block->bases, block->reads[nreads].boff);
+    if (track != NULL)
+      { int64 *anno = (int64 *) (track->anno);
+
+        h = mix_words(h, anno, sizeof(int64) * (nreads + 1));
+        h = mix_words(h, track->data, sizeof(int) * anno[nreads]);
+      }
+    return (h);
+  }
+
+static void set_header(Kmer_Header *head, HITS_DB *block, int len)
+  { memset(head, 0, sizeof(Kmer_Header));
+    head->magic     = KMER_MAGIC;
+    head->version   = KMER_VERSION;
+    head->kmer      = Kmer;
+    head->suppress  = TooFrequent;
+    head->biased    = BIASED;
+    head->minimizer = MINIMIZER;
+    head->nreads    = block->nreads;
+    head->len       = len;
+    head->checksum  = block_checksum(block);
+    head->reserved1 = FreqSum;
+  }
+
+void *Load_Kmers(char *path, HITS_DB *block, int *len, int map)
+  { Kmer_Header head, want;
+    struct stat  info;
+    KmerPos     *table;
+    int64        size;
+    int          fd;
+    void        *mem;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return (NULL);
+
+    if (fstat(fd, &info) < 0 || pread(fd, &head, sizeof(Kmer_Header), 0) != sizeof(Kmer_Header))
+      goto stale;
+
+    set_header(&want, block, head.len);
+    if (memcmp(&head, &want, sizeof(Kmer_Header)) != 0)
+      goto stale;
+
+    size = sizeof(KmerPos) * (head.len + 1);
+    if (info.st_size != (off_t) (sizeof(Kmer_Header) + size))
+      goto stale;
+
+    if (map)
+      { mem = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem == MAP_FAILED)
+          goto stale;
+        table = (KmerPos *) (((char *) mem) + sizeof(Kmer_Header));
+      }
+    else
+      { int64 off, r;
+
+        table = (KmerPos *) Malloc(size, "Allocating k-mer table");
+        if (table == NULL)
+          exit(1);
+        if (Pin_Threads)
+          placement_interleave(table, size);
+        for (off = 0; off < size; off += r)
+          { r = pread(fd, ((char *) table) + off, size - off, sizeof(Kmer_Header) + off);
+            if (r <= 0)
+              { free(table);
+                goto stale;
+              }
+          }
+      }
+    close(fd);
+
+    if (VERBOSE)
+      { printf("\n   Loaded ");
+        Print_Number(head.len, 0, stdout);
+        printf(" k-mers from %s\n", path);
+        fflush(stdout);
+      }
+
+    *len = head.len;
+    return (table);
+
+  stale:
+    close(fd);
+    return (NULL);
+  }
+
+int Save_Kmers(char *path, HITS_DB *block, void *table, int len)
+  { Kmer_Header head;
+    FILE       *f;
+    char       *temp;
+    int         ok;
+
+    if (table == NULL)
+      return (0);
+
+    temp = Malloc(strlen(path) + 32, "Allocating k-mer table name");
+    if (temp == NULL)
+      exit(1);
+    sprintf(temp, "%s.%d.tmp", path, (int) getpid());
+
+    f = fopen(temp, "w");
+    if (f == NULL)
+      { fprintf(stderr, "%s: Cannot create k-mer table %s\n", Prog_Name, temp);
+        free(temp);
+        return (0);
+      }
+
+    set_header(&head, block, len);
+    ok = (fwrite(&head, sizeof(Kmer_Header), 1, f) == 1);
+    ok = ok && (fwrite(table, sizeof(KmerPos), len + 1, f) == (size_t) (len + 1));
+    ok = (fclose(f) == 0) && ok;
+
+    //  Concurrent jobs may save the same table, the rename makes that harmless
+
+    if (ok)
+      ok = (rename(temp, path) == 0);
+    if (!ok)
+      { fprintf(stderr, "%s: Cannot write k-mer table %s\n", Prog_Name, path);
+        unlink(temp);
+      }
+
+    free(temp);
+    return (ok);
+  }
+
 /*******************************************************************************************
  *
  *  FILTER MATCH
@@ -1280,11 +1995,25 @@ static int MR_two;
 static Align_Spec *MR_spec;
 static int MR_tspace;
 
+/*  Bounding box of a path kept by Handle_Redundancies: its A interval and the range of
+    diagonals at its interior trace points (dlow > dhgh if there are none).  Two paths
+    can only be entwined if both their A intervals and their diagonal bands intersect.  */
+
+typedef struct
+{
+  int abpos, aepos;
+  int dlow, dhgh;
+} Path_Box;
+
 typedef struct
 {
   uint64 max;
   uint64 top;
   uint16 *trace;
+  int bmax;        //  Scratch of Handle_Redundancies, grown as needed
+  Path_Box *box;   //    box[k] for each kept path k
+  int *order;      //    kept paths in order of abpos
+  int *cand;       //    candidates for the path being placed
 } Trace_Buffer;
 
 static int Entwine(Path *jpath, Path *kpath, Trace_Buffer *tbuf, int *where)
@@ -1441,12 +2170,85 @@ static void Fusion(Path *path1, int ap, Path *path2, Trace_Buffer *tbuf)
     path1->tlen = len;
   }
 
+static void Box_Path(Path *path, Trace_Buffer *tbuf, Path_Box *box)
+  {
+    uint16 *trace;
+    int i, tlen, dd;
+
+    trace = tbuf->trace + (uint64) (path->trace);
+    tlen = path->tlen - 2;
+
+    box->abpos = path->abpos;
+    box->aepos = path->aepos;
+    box->dlow = INT32_MAX;
+    box->dhgh = INT32_MIN;
+
+    dd = (path->abpos / MR_tspace) * MR_tspace - path->bbpos;
+    for (i = 1; i < tlen; i += 2)
+      {
+        dd += MR_tspace - trace[i];
+        if (dd < box->dlow)
+          box->dlow = dd;
+        if (dd > box->dhgh)
+          box->dhgh = dd;
+      }
+  }
+
+//  Place kept path k in tbuf->order (of length no) by its abpos, k not yet being in it
+
+static void Order_Box(Trace_Buffer *tbuf, int no, int k)
+  {
+    int *order = tbuf->order;
+    int l, r, m, abpos;
+
+    abpos = tbuf->box[k].abpos;
+    l = 0;
+    r = no;
+    while (l < r)
+      {
+        m = (l + r) / 2;
+        if (tbuf->box[order[m]].abpos < abpos)
+          l = m + 1;
+        else
+          r = m;
+      }
+    memmove(order + l + 1, order + l, sizeof(int) * (no - l));
+    order[l] = k;
+  }
+
+//  Path k of the kept paths has changed, recompute its box and move it within the order
+
+static void Rebox_Path(Path *amatch, int no, int k, Trace_Buffer *tbuf)
+  {
+    int *order = tbuf->order;
+    int i;
+
+    for (i = 0; order[i] != k; i++)
+      ;
+    memmove(order + i, order + i + 1, sizeof(int) * (no - i));
+    Box_Path(amatch + k, tbuf, tbuf->box + k);
+    Order_Box(tbuf, no, k);
+  }
+
+static int cand_cmp(const void *l, const void *r)
+  {
+    return (*((int *) r) - *((int *) l));
+  }
+
+/*  Each new path j is checked against the kept paths k = no, no-1, ..., 0 and merged into
+    the first one it is entwined with.  Only the kept paths whose A interval and diagonal
+    band meet those of j can pass the checks, so these candidates are found from the kept
+    paths in order of abpos (all of them start within span, the longest A interval kept,
+    before j) and examined in the same descending order of k.                               */
+
 static int Handle_Redundancies(Path *amatch, int novls, Path *bmatch, Trace_Buffer *tbuf)
   {
     Path *jpath, *kpath;
-    int j, k, no;
+    int j, k, c, no;
     int dist, awhen, bwhen;
     int hasB;
+    Path_Box jbox, *kbox;
+    int l, r, m, span, ncand;
 
 #ifdef TEST_CONTAIN
     for (j = 0; j < novls; j++)
@@ -1456,12 +2258,55 @@ static int Handle_Redundancies(Path *amatch, int novls, Path *bmatch, Trace_Buff
 
     hasB = (bmatch != NULL);
 
+    if (novls > tbuf->bmax)
+      {
+        tbuf->bmax = 1.2 * novls + 100;
+        tbuf->box = (Path_Box *) Realloc(tbuf->box, sizeof(Path_Box) * tbuf->bmax, "Allocating path boxes");
+        tbuf->order = (int *) Realloc(tbuf->order, sizeof(int) * tbuf->bmax, "Allocating path boxes");
+        tbuf->cand = (int *) Realloc(tbuf->cand, sizeof(int) * tbuf->bmax, "Allocating path boxes");
+        if (tbuf->box == NULL || tbuf->order == NULL || tbuf->cand == NULL)
+          exit(1);
+      }
+
     no = 0;
+    Box_Path(amatch, tbuf, tbuf->box);
+    tbuf->order[0] = 0;
+    span = tbuf->box[0].aepos - tbuf->box[0].abpos;
+
     for (j = 1; j < novls; j++)
       {
         jpath = amatch + j;
-        for (k = no; k >= 0; k--)
+        Box_Path(jpath, tbuf, &jbox);
+
+        ncand = 0;
+        if (jbox.dlow <= jbox.dhgh)
+          {
+            l = 0;
+            r = no + 1;
+            while (l < r)
+              {
+                m = (l + r) / 2;
+                if (tbuf->box[tbuf->order[m]].abpos < jbox.abpos - span)
+                  l = m + 1;
+                else
+                  r = m;
+              }
+            for (; l <= no; l++)
+              {
+                k = tbuf->order[l];
+                kbox = tbuf->box + k;
+                if (kbox->abpos > jbox.aepos)
+                  break;
+                if (kbox->aepos >= jbox.abpos && kbox->dlow <= jbox.dhgh && jbox.dlow <= kbox->dhgh)
+                  tbuf->cand[ncand++] = k;
+              }
+            if (ncand > 1)
+              qsort(tbuf->cand, ncand, sizeof(int), cand_cmp);
+          }
+
+        for (c = 0; c < ncand; c++)
           {
+            k = tbuf->cand[c];
             kpath = amatch + k;
 
             if (jpath->abpos < kpath->abpos)
@@ -1586,13 +2431,23 @@ static int Handle_Redundancies(Path *amatch, int novls, Path *bmatch, Trace_Buff
                   }
               }
           }
-        if (k < 0)
+        if (c < ncand)
+          {
+            Rebox_Path(amatch, no, k, tbuf);
+            kbox = tbuf->box + k;
+          }
+        else
           {
             no += 1;
             amatch[no] = *jpath;
             if (hasB)
               bmatch[no] = bmatch[j];
+            tbuf->box[no] = jbox;
+            Order_Box(tbuf, no, no);
+            kbox = &jbox;
           }
+        if (kbox->aepos - kbox->abpos > span)
+          span = kbox->aepos - kbox->abpos;
       }
 
     novls = no + 1;
@@ -1639,9 +2494,52 @@ void Diagonal_Span(Path *path, int *mind, int *maxd)
     *maxd = (hgh >> Binshift) + 1;
   }
 
+/*  A read pair with hits in more than PANEL_SPLIT panels (e.g. two ultra-long reads) would
+    keep one thread busy for long.  Its panels are cut into parts of PANEL_SPLIT panels that
+    are handed out before the chunks and skipped within them.  Each part leaves its matches
+    with the pair, the thread finishing the last part removes the redundant ones over all
+    parts (Handle_Redundancies) and outputs them.                                          */
+
+typedef struct
+{
+  Path *amatch;
+  Path *bmatch;
+  int novla;
+  int novlb;
+  uint16 *trace;
+  uint64 ttop;
+} Panel_Part;
+
+typedef struct
+{
+  int64 beg;             //  hits of the pair
+  int64 end;
+  pthread_mutex_t lock;
+  int left;              //  parts not done yet
+  int nparts;
+  Panel_Part *parts;
+} Panel_Pair;
+
+typedef struct
+{
+  Panel_Pair *pair;
+  int part;
+  int64 beg;             //  first hit of the part's panels
+  int abeg;              //  panels starting in [abeg,aend)
+  int aend;
+} Panel_Item;
+
+#define PANEL_STRIDE (PANEL_SIZE - PANEL_OVERLAP)
+
+static Panel_Pair *MR_split;   //  split pairs in hit order
+static int MR_nsplit;
+static Panel_Item *MR_items;
+static int MR_nitems;
+static int MR_nextitem;
+
 typedef struct
 {
-  int64 beg, end;
+  int tid;
   int *score;
   int *lastp;
   int *lasta;
@@ -1653,8 +2551,180 @@ typedef struct
   int64 nfilt;
   int64 ncheck;
   Overlap_IO_Buffer *iobuf;
+  Panel_Pair *split;     //  split pairs found by panel_scan_thread
+  int nsplit;
+  int msplit;
 } Report_Arg;
 
+/*  The hits are cut into REPORT_CHUNKS chunks per thread at B-read boundaries.  Thread t
+    owns chunks [t*REPORT_CHUNKS,(t+1)*REPORT_CHUNKS) and takes them from the front; once
+    they are done it steals chunks from the back of the other threads' ranges, so that a
+    dense region of hits no longer holds up the whole comparison.                        */
+
+#define REPORT_CHUNKS  64
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  int next;              //  chunks [next,last) are still to be done
+  int last;
+} Report_Queue;
+
+static Report_Queue *MR_queue;
+static int64 *MR_chunk;     //  chunk c covers hits [MR_chunk[c],MR_chunk[c+1])
+
+static int report_chunk(int tid, int64 *beg, int64 *end)
+  {
+    int i, t, c;
+
+    for (i = 0; i < NTHREADS; i++)
+      {
+        t = (tid + i) % NTHREADS;
+
+        pthread_mutex_lock(&MR_queue[t].lock);
+        if (MR_queue[t].next >= MR_queue[t].last)
+          c = -1;
+        else if (i == 0)
+          c = MR_queue[t].next++;
+        else
+          c = --MR_queue[t].last;
+        pthread_mutex_unlock(&MR_queue[t].lock);
+
+        if (c >= 0)
+          {
+            *beg = MR_chunk[c];
+            *end = MR_chunk[c + 1];
+            return (1);
+          }
+      }
+
+    return (0);
+  }
+
+  //  Panel_Pair of hits[beg,..) found by the scan of the chunks, collected in Report_Arg
+
+static void *panel_scan_thread(void *arg)
+  {
+    Report_Arg *data = (Report_Arg *) arg;
+    SeedPair *hits = MR_hits;
+    Double *hitd = (Double *) MR_hits;
+    int64 nidx, eidx;
+    uint64 cpair;
+    int64 p;
+
+    nidx = MR_chunk[data->tid * REPORT_CHUNKS];
+    eidx = MR_chunk[(data->tid + 1) * REPORT_CHUNKS];
+    data->nsplit = 0;
+    while (nidx < eidx)
+      {
+        cpair = hitd[nidx].p2;
+        for (p = nidx + 1; hitd[p].p2 == cpair; p++)
+          ;
+        if ((hits[p - 1].apos - 1) / PANEL_STRIDE >= PANEL_SPLIT)
+          {
+            if (data->nsplit >= data->msplit)
+              {
+                data->msplit = 1.2 * data->nsplit + 16;
+                data->split = (Panel_Pair *) Realloc(data->split, sizeof(Panel_Pair) * data->msplit, "Reallocating split pairs");
+                if (data->split == NULL)
+                  exit(1);
+              }
+            data->split[data->nsplit].beg = nidx;
+            data->split[data->nsplit].end = p;
+            data->nsplit += 1;
+          }
+        nidx = p;
+      }
+    return (NULL);
+  }
+
+static int panel_item(Panel_Item **item, int64 *beg, int64 *end)
+  {
+    int i;
+
+    i = __atomic_fetch_add(&MR_nextitem, 1, __ATOMIC_RELAXED);
+    if (i >= MR_nitems)
+      return (0);
+    *item = MR_items + i;
+    *beg = MR_items[i].beg;
+    *end = MR_items[i].pair->end;
+    return (1);
+  }
+
+  //  Leaves the matches of a part with its pair.  The last part of a pair gets the matches of
+  //    all parts in their order and returns 1.
+
+static int panel_collect(Panel_Item *item, Path **amatch, int *AOmax, int *novla,
+                         Path **bmatch, int *BOmax, int *novlb, Trace_Buffer *tbuf)
+  {
+    Panel_Pair *pair = item->pair;
+    Panel_Part *part = pair->parts + item->part;
+    int i, j, left;
+    uint64 base;
+
+    part->novla = *novla;
+    part->novlb = *novlb;
+    part->ttop = tbuf->top;
+    part->amatch = (Path *) Malloc(sizeof(Path) * (*novla + 1), "Allocating panel matches");
+    part->bmatch = (Path *) Malloc(sizeof(Path) * (*novlb + 1), "Allocating panel matches");
+    part->trace = (uint16 *) Malloc(sizeof(uint16) * (tbuf->top + 1), "Allocating panel traces");
+    if (part->amatch == NULL || part->bmatch == NULL || part->trace == NULL)
+      exit(1);
+    memcpy(part->amatch, *amatch, sizeof(Path) * (*novla));
+    memcpy(part->bmatch, *bmatch, sizeof(Path) * (*novlb));
+    memcpy(part->trace, tbuf->trace, sizeof(uint16) * tbuf->top);
+
+    pthread_mutex_lock(&pair->lock);
+    left = --pair->left;
+    pthread_mutex_unlock(&pair->lock);
+    if (left > 0)
+      return (0);
+
+    *novla = *novlb = 0;
+    tbuf->top = 0;
+    for (i = 0; i < pair->nparts; i++)
+      {
+        part = pair->parts + i;
+        if (*novla + part->novla > *AOmax)
+          {
+            *AOmax = 1.2 * (*novla + part->novla) + MATCH_CHUNK;
+            *amatch = Realloc(*amatch, sizeof(Path) * (*AOmax), "Reallocating match vector");
+          }
+        if (*novlb + part->novlb > *BOmax)
+          {
+            *BOmax = 1.2 * (*novlb + part->novlb) + MATCH_CHUNK;
+            *bmatch = Realloc(*bmatch, sizeof(Path) * (*BOmax), "Reallocating match vector");
+          }
+        if (tbuf->top + part->ttop > tbuf->max)
+          {
+            tbuf->max = 1.2 * (tbuf->top + part->ttop) + TRACE_CHUNK;
+            tbuf->trace = Realloc(tbuf->trace, sizeof(short) * tbuf->max, "Reallocating trace vector");
+          }
+        if (*amatch == NULL || *bmatch == NULL || tbuf->trace == NULL)
+          exit(1);
+
+        base = tbuf->top;
+        for (j = 0; j < part->novla; j++)
+          { (*amatch)[*novla] = part->amatch[j];
+            (*amatch)[*novla].trace = (void *) (((uint64) part->amatch[j].trace) + base);
+            *novla += 1;
+          }
+        for (j = 0; j < part->novlb; j++)
+          { (*bmatch)[*novlb] = part->bmatch[j];
+            (*bmatch)[*novlb].trace = (void *) (((uint64) part->bmatch[j].trace) + base);
+            *novlb += 1;
+          }
+        memcpy(tbuf->trace + base, part->trace, sizeof(uint16) * part->ttop);
+        tbuf->top += part->ttop;
+
+        free(part->amatch);
+        free(part->bmatch);
+        free(part->trace);
+      }
+
+    return (1);
+  }
+
 static void *report_thread(void *arg)
   {
     Report_Arg *data = (Report_Arg *) arg;
@@ -1699,7 +2769,9 @@ static void *report_thread(void *arg)
     Double *hitc;
     int minhit;
     uint64 cpair, npair;
-    int64 nidx, eidx;
+    int64 nidx, eidx, fidx;
+    Panel_Item *item;
+    int abeg, aend, split;
 
     //  In ovl and align roles of A and B are reversed, as the B sequence must be the
     //    complemented sequence !!
@@ -1724,6 +2796,10 @@ static void *report_thread(void *arg)
 
     tbuf->max = 2 * TRACE_CHUNK;
     tbuf->trace = Malloc(sizeof(short) * tbuf->max, "Allocating trace vector");
+    tbuf->bmax = 0;
+    tbuf->box = NULL;
+    tbuf->order = NULL;
+    tbuf->cand = NULL;
 
     if (amatch == NULL || bmatch == NULL || tbuf->trace == NULL)
       exit(1);
@@ -1739,273 +2815,322 @@ static void *report_thread(void *arg)
 #endif
     minhit = (Hitmin - 1) / Kmer + 1;
     hitc = hitd + (minhit - 1);
-    eidx = data->end - minhit;
-    nidx = data->beg;
-    for (cpair = hitd[nidx].p2; nidx < eidx; cpair = npair)
-      if (hitc[nidx].p2 != cpair)
-        {
-          nidx += 1;
-          while ((npair = hitd[nidx].p2) == cpair)
-            nidx += 1;
-        }
-      else
-        {
-          int ar, br;
-          int alen, blen;
-          int doA, doB;
-          int setaln, amark, amark2;
-          int apos, bpos, diag;
-          int64 lidx, sidx;
-          int64 f, h2;
-
-          ar = hits[nidx].aread;
-          br = hits[nidx].bread;
-          alen = aread[ar].rlen;
-          blen = bread[br].rlen;
-          if (alen < HGAP_MIN && blen < HGAP_MIN)
+    while (panel_item(&item, &nidx, &eidx) || (item = NULL, report_chunk(data->tid, &nidx, &eidx)))
+      {
+        if (item != NULL)
+          {
+            abeg = item->abeg;
+            aend = item->aend;
+            split = MR_nsplit;
+          }
+        else
+          {
+            int l, r, m;
+
+            abeg = 0;
+            aend = INT32_MAX;
+            eidx -= minhit;
+
+            l = 0;
+            r = MR_nsplit;
+            while (l < r)
+              { m = (l + r) / 2;
+                if (MR_split[m].beg < nidx)
+                  l = m + 1;
+                else
+                  r = m;
+              }
+            split = l;
+          }
+
+        for (cpair = hitd[nidx].p2; nidx < eidx; cpair = npair)
+          if (split < MR_nsplit && MR_split[split].beg == nidx)
+            {
+              nidx = MR_split[split++].end;
+              npair = hitd[nidx].p2;
+            }
+          else if (item == NULL && hitc[nidx].p2 != cpair)
             {
               nidx += 1;
               while ((npair = hitd[nidx].p2) == cpair)
                 nidx += 1;
-              continue;
             }
+          else
+            {
+              int ar, br;
+              int alen, blen;
+              int doA, doB;
+              int setaln, amark, amark2;
+              int apos, bpos, diag;
+              int64 lidx, sidx;
+              int64 f, h2;
+
+              ar = hits[nidx].aread;
+              br = hits[nidx].bread;
+              alen = aread[ar].rlen;
+              blen = bread[br].rlen;
+              if (alen < HGAP_MIN && blen < HGAP_MIN)
+                {
+                  nidx += 1;
+                  while ((npair = hitd[nidx].p2) == cpair)
+                    nidx += 1;
+                  continue;
+                }
 
 #ifdef TEST_GATHER
-          printf("%5d vs %5d : %5d x %5d\n",br+bfirst,ar+afirst,blen,alen);
+              printf("%5d vs %5d : %5d x %5d\n",br+bfirst,ar+afirst,blen,alen);
 #endif
-          setaln = 1;
-          doA = doB = 0;
-          amark2 = 0;
-          novla = novlb = 0;
-          tbuf->top = 0;
-          for (sidx = nidx; hitd[nidx].p2 == cpair; nidx = h2)
-            {
-              amark = amark2 + PANEL_SIZE;
-              amark2 = amark - PANEL_OVERLAP;
-
-              h2 = lidx = nidx;
-              do
+              setaln = 1;
+              doA = doB = 0;
+              amark2 = abeg;
+              novla = novlb = 0;
+              tbuf->top = 0;
+              fidx = nidx;
+              for (sidx = nidx; hitd[nidx].p2 == cpair && amark2 < aend; nidx = h2)
                 {
-                  apos = hits[nidx].apos;
-                  npair = hitd[++nidx].p2;
-                  if (apos <= amark2)
-                    h2 = nidx;
-                } while (npair == cpair && apos <= amark);
+                  amark = amark2 + PANEL_SIZE;
+                  amark2 = amark - PANEL_OVERLAP;
 
-              if (nidx - lidx < minhit)
-                continue;
-
-              for (f = lidx; f < nidx; f++)
-                {
-                  apos = hits[f].apos;
-                  diag = hits[f].diag >> Binshift;
-                  if (apos - lastp[diag] >= Kmer)
-                    score[diag] += Kmer;
-                  else
-                    score[diag] += apos - lastp[diag];
-                  lastp[diag] = apos;
-                }
+                  h2 = lidx = nidx;
+                  do
+                    {
+                      apos = hits[nidx].apos;
+                      npair = hitd[++nidx].p2;
+                      if (apos <= amark2)
+                        h2 = nidx;
+                    } while (npair == cpair && apos <= amark);
+                  if (nidx > fidx)
+                    fidx = nidx;
+
+                  if (nidx - lidx < minhit)
+                    continue;
+
+                  for (f = lidx; f < nidx; f++)
+                    {
+                      apos = hits[f].apos;
+                      diag = hits[f].diag >> Binshift;
+                      if (apos - lastp[diag] >= Kmer)
+                        score[diag] += Kmer;
+                      else
+                        score[diag] += apos - lastp[diag];
+                      lastp[diag] = apos;
+                    }
 
 #ifdef TEST_GATHER
-              printf("  %6lld upto %6d",nidx-lidx,amark);
+                  printf("  %6lld upto %6d",nidx-lidx,amark);
 #endif
 
-              for (f = lidx; f < nidx; f++)
-                {
-                  apos = hits[f].apos;
-                  diag = hits[f].diag;
-                  bpos = apos - diag;
-                  diag = diag >> Binshift;
-                  if (apos > lasta[diag] && (score[diag] + scorp[diag] >= Hitmin || score[diag] + scorm[diag] >= Hitmin))
+                  for (f = lidx; f < nidx; f++)
                     {
-                      if (setaln)
+                      apos = hits[f].apos;
+                      diag = hits[f].diag;
+                      bpos = apos - diag;
+                      diag = diag >> Binshift;
+                      if (apos > lasta[diag] && (score[diag] + scorp[diag] >= Hitmin || score[diag] + scorm[diag] >= Hitmin))
                         {
-                          setaln = 0;
-                          align->aseq = aseq + aread[ar].boff;
-                          align->bseq = bseq + bread[br].boff;
-                          align->alen = alen;
-                          align->blen = blen;
-                          ovlb->bread = ovla->aread = ar + afirst;
-                          ovlb->aread = ovla->bread = br + bfirst;
-                          doA = (alen >= HGAP_MIN);
-                          doB = (SYMMETRIC && blen >= HGAP_MIN && (ar != br || !MG_self || !MG_comp));
-                        }
+                          if (setaln)
+                            {
+                              setaln = 0;
+                              align->aseq = aseq + aread[ar].boff;
+                              align->bseq = bseq + bread[br].boff;
+                              align->alen = alen;
+                              align->blen = blen;
+                              ovlb->bread = ovla->aread = ar + afirst;
+                              ovlb->aread = ovla->bread = br + bfirst;
+                              doA = (alen >= HGAP_MIN);
+                              doB = (SYMMETRIC && blen >= HGAP_MIN && (ar != br || !MG_self || !MG_comp));
+                            }
 #ifdef TEST_GATHER
-                      else
-                      printf("\n                    ");
+                          else
+                          printf("\n                    ");
 
-                      if (scorm[diag] > scorp[diag])
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                          bpos,apos,apos-bpos,score[diag]+scorm[diag]);
-                      else
-                      printf("  %5d.. x %5d.. %5d (%3d)",
-                          bpos,apos,apos-bpos,score[diag]+scorp[diag]);
+                          if (scorm[diag] > scorp[diag])
+                          printf("  %5d.. x %5d.. %5d (%3d)",
+                              bpos,apos,apos-bpos,score[diag]+scorm[diag]);
+                          else
+                          printf("  %5d.. x %5d.. %5d (%3d)",
+                              bpos,apos,apos-bpos,score[diag]+scorp[diag]);
 #endif
-                      nfilt += 1;
+                          nfilt += 1;
 
-                      bpath = Local_Alignment(align, work, MR_spec, apos - bpos, apos - bpos, apos + bpos, -1, -1);
+                          bpath = Local_Alignment(align, work, MR_spec, apos - bpos, apos - bpos, apos + bpos, -1, -1);
 
-                        {
-                          int low, hgh, ae;
-
-                          Diagonal_Span(apath, &low, &hgh);
-                          if (diag < low)
-                            low = diag;
-                          else if (diag > hgh)
-                            hgh = diag;
-                          ae = apath->aepos;
-                          for (diag = low; diag <= hgh; diag++)
-                            if (ae > lasta[diag])
-                              lasta[diag] = ae;
+                            {
+                              int low, hgh, ae;
+
+                              Diagonal_Span(apath, &low, &hgh);
+                              if (diag < low)
+                                low = diag;
+                              else if (diag > hgh)
+                                hgh = diag;
+                              ae = apath->aepos;
+                              for (diag = low; diag <= hgh; diag++)
+                                if (ae > lasta[diag])
+                                  lasta[diag] = ae;
 #ifdef TEST_GATHER
-                          printf(" %d - %d @ %d",low,hgh,apath->aepos);
+                              printf(" %d - %d @ %d",low,hgh,apath->aepos);
 #endif
-                        }
-
-                      if ((apath->aepos - apath->abpos) + (apath->bepos - apath->bbpos) >= MINOVER)
-                        {
-                          if (doA)
-                            {
-                              if (novla >= AOmax)
-                                {
-                                  AOmax = 1.2 * novla + MATCH_CHUNK;
-                                  amatch = Realloc(amatch, sizeof(Path) * AOmax, "Reallocating match vector");
-                                  if (amatch == NULL)
-                                    exit(1);
-                                }
-                              if (tbuf->top + apath->tlen > tbuf->max)
-                                {
-                                  tbuf->max = 1.2 * (tbuf->top + apath->tlen) + TRACE_CHUNK;
-                                  tbuf->trace = Realloc(tbuf->trace, sizeof(short) * tbuf->max, "Reallocating trace vector");
-                                  if (tbuf->trace == NULL)
-                                    exit(1);
-                                }
-                              amatch[novla] = *apath;
-                              amatch[novla].trace = (void *) (tbuf->top);
-                              memcpy(tbuf->trace + tbuf->top, apath->trace, sizeof(short) * apath->tlen);
-                              novla += 1;
-                              tbuf->top += apath->tlen;
                             }
-                          if (doB)
+
+                          if ((apath->aepos - apath->abpos) + (apath->bepos - apath->bbpos) >= MINOVER)
                             {
-                              if (novlb >= BOmax)
+                              if (doA)
                                 {
-                                  BOmax = 1.2 * novlb + MATCH_CHUNK;
-                                  bmatch = Realloc(bmatch, sizeof(Path) * BOmax, "Reallocating match vector");
-                                  if (bmatch == NULL)
-                                    exit(1);
+                                  if (novla >= AOmax)
+                                    {
+                                      AOmax = 1.2 * novla + MATCH_CHUNK;
+                                      amatch = Realloc(amatch, sizeof(Path) * AOmax, "Reallocating match vector");
+                                      if (amatch == NULL)
+                                        exit(1);
+                                    }
+                                  if (tbuf->top + apath->tlen > tbuf->max)
+                                    {
+                                      tbuf->max = 1.2 * (tbuf->top + apath->tlen) + TRACE_CHUNK;
+                                      tbuf->trace = Realloc(tbuf->trace, sizeof(short) * tbuf->max, "Reallocating trace vector");
+                                      if (tbuf->trace == NULL)
+                                        exit(1);
+                                    }
+                                  amatch[novla] = *apath;
+                                  amatch[novla].trace = (void *) (tbuf->top);
+                                  memcpy(tbuf->trace + tbuf->top, apath->trace, sizeof(short) * apath->tlen);
+                                  novla += 1;
+                                  tbuf->top += apath->tlen;
                                 }
-                              if (tbuf->top + bpath->tlen > tbuf->max)
+                              if (doB)
                                 {
-                                  tbuf->max = 1.2 * (tbuf->top + bpath->tlen) + TRACE_CHUNK;
-                                  tbuf->trace = Realloc(tbuf->trace, sizeof(short) * tbuf->max, "Reallocating trace vector");
-                                  if (tbuf->trace == NULL)
-                                    exit(1);
+                                  if (novlb >= BOmax)
+                                    {
+                                      BOmax = 1.2 * novlb + MATCH_CHUNK;
+                                      bmatch = Realloc(bmatch, sizeof(Path) * BOmax, "Reallocating match vector");
+                                      if (bmatch == NULL)
+                                        exit(1);
+                                    }
+                                  if (tbuf->top + bpath->tlen > tbuf->max)
+                                    {
+                                      tbuf->max = 1.2 * (tbuf->top + bpath->tlen) + TRACE_CHUNK;
+                                      tbuf->trace = Realloc(tbuf->trace, sizeof(short) * tbuf->max, "Reallocating trace vector");
+                                      if (tbuf->trace == NULL)
+                                        exit(1);
+                                    }
+                                  bmatch[novlb] = *bpath;
+                                  bmatch[novlb].trace = (void *) (tbuf->top);
+                                  memcpy(tbuf->trace + tbuf->top, bpath->trace, sizeof(short) * bpath->tlen);
+                                  novlb += 1;
+                                  tbuf->top += bpath->tlen;
                                 }
-                              bmatch[novlb] = *bpath;
-                              bmatch[novlb].trace = (void *) (tbuf->top);
-                              memcpy(tbuf->trace + tbuf->top, bpath->trace, sizeof(short) * bpath->tlen);
-                              novlb += 1;
-                              tbuf->top += bpath->tlen;
-                            }
 
 #ifdef TEST_GATHER
-                          printf("  [%5d,%5d] x [%5d,%5d] = %4d",
-                              apath->abpos,apath->aepos,apath->bbpos,apath->bepos,apath->diffs);
+                              printf("  [%5d,%5d] x [%5d,%5d] = %4d",
+                                  apath->abpos,apath->aepos,apath->bbpos,apath->bepos,apath->diffs);
 #endif
 #ifdef SHOW_OVERLAP
-                          printf("\n\n                    %d(%d) vs %d(%d)\n\n",
-                              ovla->aread,ovla->alen,ovla->bread,ovla->blen);
-                          Print_ACartoon(stdout,align,ALIGN_INDENT);
+                              printf("\n\n                    %d(%d) vs %d(%d)\n\n",
+                                  ovla->aread,ovla->alen,ovla->bread,ovla->blen);
+                              Print_ACartoon(stdout,align,ALIGN_INDENT);
 #ifdef SHOW_ALIGNMENT
-                          Compute_Trace_ALL(align,work);
-                          printf("\n                      Diff = %d\n",align->path->diffs);
-                          Print_Alignment(stdout,align,work,
-                              ALIGN_INDENT,ALIGN_WIDTH,ALIGN_BORDER,0,5);
+                              Compute_Trace_ALL(align,work);
+                              printf("\n                      Diff = %d\n",align->path->diffs);
+                              Print_Alignment(stdout,align,work,
+                                  ALIGN_INDENT,ALIGN_WIDTH,ALIGN_BORDER,0,5);
 #endif
 #endif // SHOW_OVERLAP
 
-                        }
+                            }
 #ifdef TEST_GATHER
-                      else
-                      printf("  No alignment %d",
-                          ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos))/2);
+                          else
+                          printf("  No alignment %d",
+                              ((apath->aepos-apath->abpos) + (apath->bepos-apath->bbpos))/2);
 #endif
+                        }
                     }
-                }
 
-              for (f = lidx; f < nidx; f++)
-                {
-                  diag = hits[f].diag >> Binshift;
-                  score[diag] = lastp[diag] = 0;
-                }
+                  for (f = lidx; f < nidx; f++)
+                    {
+                      diag = hits[f].diag >> Binshift;
+                      score[diag] = lastp[diag] = 0;
+                    }
 #ifdef TEST_GATHER
-              printf("\n");
+                  printf("\n");
 #endif
-            }
+                }
 
-          for (f = sidx; f < nidx; f++)
-            {
-              int d;
+              for (f = sidx; f < fidx; f++)
+                {
+                  int d;
 
-              diag = hits[f].diag >> Binshift;
-              for (d = diag; d <= maxdiag; d++)
-                if (lasta[d] == 0)
-                  break;
-                else
-                  lasta[d] = 0;
-              for (d = diag - 1; d >= mindiag; d--)
-                if (lasta[d] == 0)
-                  break;
-                else
-                  lasta[d] = 0;
-            }
+                  diag = hits[f].diag >> Binshift;
+                  for (d = diag; d <= maxdiag; d++)
+                    if (lasta[d] == 0)
+                      break;
+                    else
+                      lasta[d] = 0;
+                  for (d = diag - 1; d >= mindiag; d--)
+                    if (lasta[d] == 0)
+                      break;
+                    else
+                      lasta[d] = 0;
+                }
 
-            {
-              int i;
+                {
+                  int i;
 
 #ifdef TEST_CONTAIN
-              if (novla > 1 || novlb > 1)
-              printf("\n%5d vs %5d:\n",ar,br);
+                  if (novla > 1 || novlb > 1)
+                  printf("\n%5d vs %5d:\n",ar,br);
 #endif
 
-              if (novla > 1)
-                {
-                  if (novlb > 1)
-                    novla = novlb = Handle_Redundancies(amatch, novla, bmatch, tbuf);
-                  else
-                    novla = Handle_Redundancies(amatch, novla, NULL, tbuf);
-                }
-              else if (novlb > 1)
-                novlb = Handle_Redundancies(bmatch, novlb, NULL, tbuf);
+                  if (item != NULL)
+                    {
+                      if (!panel_collect(item, &amatch, &AOmax, &novla, &bmatch, &BOmax, &novlb, tbuf))
+                        break;
+                      ovlb->bread = ovla->aread = ar + afirst;
+                      ovlb->aread = ovla->bread = br + bfirst;
+                    }
 
-              for (i = 0; i < novla; i++)
-                {
-                  ovla->path = amatch[i];
-                  ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
-                  if (small)
-                    Compress_TraceTo8(ovla);
+                  if (novla > 1)
+                    {
+                      if (novlb > 1)
+                        novla = novlb = Handle_Redundancies(amatch, novla, bmatch, tbuf);
+                      else
+                        novla = Handle_Redundancies(amatch, novla, NULL, tbuf);
+                    }
+                  else if (novlb > 1)
+                    novlb = Handle_Redundancies(bmatch, novlb, NULL, tbuf);
+
+                  for (i = 0; i < novla; i++)
+                    {
+                      ovla->path = amatch[i];
+                      ovla->path.trace = tbuf->trace + (uint64) (ovla->path.trace);
+                      if (small)
+                        Compress_TraceTo8(ovla);
 #ifdef THREAD_OUTPUT
-                  Write_Overlap(ofile1, ovla, tbytes);
+                      Write_Overlap(ofile1, ovla, tbytes);
 #endif
-                  AddOverlapToBuffer(obuf, ovla, tbytes);
-                }
-              for (i = 0; i < novlb; i++)
-                {
-                  ovlb->path = bmatch[i];
-                  ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
-                  if (small)
-                    Compress_TraceTo8(ovlb);
+                      AddOverlapToBuffer(obuf, ovla, tbytes);
+                    }
+                  for (i = 0; i < novlb; i++)
+                    {
+                      ovlb->path = bmatch[i];
+                      ovlb->path.trace = tbuf->trace + (uint64) (ovlb->path.trace);
+                      if (small)
+                        Compress_TraceTo8(ovlb);
 #ifdef THREAD_OUTPUT
-                  Write_Overlap(ofile2, ovlb, tbytes);
+                      Write_Overlap(ofile2, ovlb, tbytes);
 #endif
-                  AddOverlapToBuffer(obuf, ovlb, tbytes);
+                      AddOverlapToBuffer(obuf, ovlb, tbytes);
+                    }
+                  ahits += novla;
+                  bhits += novlb;
                 }
-              ahits += novla;
-              bhits += novlb;
+
+              if (item != NULL)
+                break;
             }
-        }
+      }
 
+    free(tbuf->cand);
+    free(tbuf->order);
+    free(tbuf->box);
     free(tbuf->trace);
     free(bmatch);
     free(amatch);
@@ -2036,9 +3161,68 @@ static void *report_thread(void *arg)
  *
  ********************************************************************************************/
 
+  //  Split the tables among the threads at k-mer boundaries and count the mutual k-mer
+  //    matches of each part, giving parmm[i].nhits and the histogram parmm[i].hitgram
+
+static void count_matches(Merge_Arg *parmm, KmerPos *asort, int alen, KmerPos *bsort, int blen,
+                          int self, int comp)
+  {
+    int i, j, p;
+    uint64 c;
+
+    MG_alist = asort;
+    MG_blist = bsort;
+    MG_self = self;
+    MG_comp = comp;
+
+    parmm[0].abeg = parmm[0].bbeg = 0;
+    for (i = 1; i < NTHREADS; i++)
+      {
+        p = (int) ((((int64) alen) * i) >> NSHIFT);
+        if (p > 0)
+          {
+            c = asort[p - 1].code;
+            while (asort[p].code == c)
+              p += 1;
+          }
+        parmm[i].abeg = parmm[i - 1].aend = p;
+        parmm[i].bbeg = parmm[i - 1].bend = find_tuple(asort[p].code, bsort, blen);
+      }
+    parmm[NTHREADS - 1].aend = alen;
+    parmm[NTHREADS - 1].bend = blen;
+
+    for (i = 0; i < NTHREADS; i++)
+      for (j = 0; j < MAXGRAM; j++)
+        parmm[i].hitgram[j] = 0;
+
+    run_threads(count_thread, parmm, sizeof(Merge_Arg));
+  }
+
+int64 Count_Hits(void *atable, int alen, void *btable, int blen, int self, int comp)
+  {
+    Merge_Arg *parmm;
+    int64 nhits;
+    int i;
+
+    if (alen == 0 || blen == 0)
+      return (0);
+
+    parmm = (Merge_Arg *) Malloc(sizeof(Merge_Arg) * NTHREADS, "Allocating hit counters");
+    if (parmm == NULL)
+      exit(1);
+
+    count_matches(parmm, (KmerPos *) atable, alen, (KmerPos *) btable, blen, self, comp);
+
+    nhits = 0;
+    for (i = 0; i < NTHREADS; i++)
+      nhits += parmm[i].nhits;
+
+    free(parmm);
+    return (nhits);
+  }
+
 void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, void *vasort, int alen, void *vbsort, int blen, int comp, Align_Spec *aspec)
   {
-    THREAD threads[NTHREADS];
     Merge_Arg parmm[NTHREADS];
     Lex_Arg parmx[NTHREADS];
     Report_Arg parmr[NTHREADS];
@@ -2051,6 +3235,9 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
 
     KmerPos *asort, *bsort;
     int64 atot, btot;
+    uint64_t start, phase;
+
+    start = INS_START();
 
     asort = (KmerPos *) vasort;
     bsort = (KmerPos *) vbsort;
@@ -2110,39 +3297,11 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
 
       {
         int i, j, p;
-        uint64 c;
         int limit;
 
-        MG_alist = asort;
-        MG_blist = bsort;
-        MG_self = (aname == bname);
-        MG_comp = comp;
-
-        parmm[0].abeg = parmm[0].bbeg = 0;
-        for (i = 1; i < NTHREADS; i++)
-          {
-            p = (int) ((((int64) alen) * i) >> NSHIFT);
-            if (p > 0)
-              {
-                c = asort[p - 1].code;
-                while (asort[p].code == c)
-                  p += 1;
-              }
-            parmm[i].abeg = parmm[i - 1].aend = p;
-            parmm[i].bbeg = parmm[i - 1].bend = find_tuple(asort[p].code, bsort, blen);
-          }
-        parmm[NTHREADS - 1].aend = alen;
-        parmm[NTHREADS - 1].bend = blen;
-
-        for (i = 0; i < NTHREADS; i++)
-          for (j = 0; j < MAXGRAM; j++)
-            parmm[i].hitgram[j] = 0;
-
-        for (i = 0; i < NTHREADS; i++)
-          pthread_create(threads + i, NULL, count_thread, parmm + i);
-
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
+        phase = INS_START();
+        count_matches(parmm, asort, alen, bsort, blen, aname == bname, comp);
+        INS_STOP("daligner.match_filter.count", phase);
 
         if (VERBOSE)
           printf("\n");
@@ -2262,11 +3421,9 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
               parmm[i].kptr[p] = 0;
           }
 
-        for (i = 0; i < NTHREADS; i++)
-          pthread_create(threads + i, NULL, merge_thread, parmm + i);
-
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
+        phase = INS_START();
+        run_threads(merge_thread, parmm, sizeof(Merge_Arg));
+        INS_STOP("daligner.match_filter.merge", phase);
 
 #ifdef TEST_PAIRS
         printf("\nSETUP SORT:\n");
@@ -2290,7 +3447,9 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
         parmx[NTHREADS - 1].beg = x;
         parmx[NTHREADS - 1].end = nhits;
 
+        phase = INS_START();
         khit = (SeedPair *) lex_sort(pairsort, (Double *) khit, (Double *) hhit, parmx);
+        INS_STOP("daligner.match_filter.sort", phase);
 
         khit[nhits].aread = 0x7fffffff;
         khit[nhits].bread = 0x7fffffff;
@@ -2307,7 +3466,7 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
       }
 
       {
-        int i, w;
+        int i, w, nchunk;
         int64 p;
         int d;
         int *counters;
@@ -2319,19 +3478,101 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
         MR_spec = aspec;
         MR_tspace = Trace_Spacing(aspec);
 
-        parmr[0].beg = 0;
-        for (i = 1; i < NTHREADS; i++)
+        nchunk = NTHREADS * REPORT_CHUNKS;
+        MR_chunk = (int64 *) Malloc((nchunk + 1) * sizeof(int64), "Allocating report chunks");
+        MR_queue = (Report_Queue *) Malloc(NTHREADS * sizeof(Report_Queue), "Allocating report chunks");
+        if (MR_chunk == NULL || MR_queue == NULL)
+          exit(1);
+
+        MR_chunk[0] = 0;
+        for (i = 1; i < nchunk; i++)
           {
-            p = (nhits * i) >> NSHIFT;
+            p = (nhits * i) / nchunk;
+            if (p < MR_chunk[i - 1])
+              p = MR_chunk[i - 1];
             if (p > 0)
               {
                 d = khit[p - 1].bread;
                 while ((khit[p].bread) == d)
                   p += 1;
               }
-            parmr[i].beg = parmr[i - 1].end = p;
+            MR_chunk[i] = p;
+          }
+        MR_chunk[nchunk] = nhits;
+
+        for (i = 0; i < NTHREADS; i++)
+          {
+            pthread_mutex_init(&MR_queue[i].lock, NULL);
+            MR_queue[i].next = i * REPORT_CHUNKS;
+            MR_queue[i].last = (i + 1) * REPORT_CHUNKS;
+            parmr[i].tid = i;
+            parmr[i].split = NULL;
+            parmr[i].msplit = 0;
+          }
+
+        //  Pairs with hits in too many panels are cut into parts
+
+        run_threads(panel_scan_thread, parmr, sizeof(Report_Arg));
+
+          {
+            int j, k, n;
+            int64 l, r, m;
+
+            MR_nsplit = 0;
+            for (i = 0; i < NTHREADS; i++)
+              MR_nsplit += parmr[i].nsplit;
+            MR_split = (Panel_Pair *) Malloc(sizeof(Panel_Pair) * (MR_nsplit + 1), "Allocating split pairs");
+            if (MR_split == NULL)
+              exit(1);
+
+            n = 0;
+            MR_nitems = 0;
+            for (i = 0; i < NTHREADS; i++)
+              for (j = 0; j < parmr[i].nsplit; j++)
+                { Panel_Pair *pair = MR_split + n++;
+
+                  *pair = parmr[i].split[j];
+                  pair->nparts = ((khit[pair->end - 1].apos - 1) / PANEL_STRIDE) / PANEL_SPLIT + 1;
+                  pair->left = pair->nparts;
+                  pair->parts = (Panel_Part *) Malloc(sizeof(Panel_Part) * pair->nparts, "Allocating split pairs");
+                  if (pair->parts == NULL)
+                    exit(1);
+                  pthread_mutex_init(&pair->lock, NULL);
+                  MR_nitems += pair->nparts;
+                }
+
+            MR_items = (Panel_Item *) Malloc(sizeof(Panel_Item) * (MR_nitems + 1), "Allocating split pairs");
+            if (MR_items == NULL)
+              exit(1);
+
+            n = 0;
+            for (j = 0; j < MR_nsplit; j++)
+              for (k = 0; k < MR_split[j].nparts; k++)
+                { Panel_Item *item = MR_items + n++;
+
+                  item->pair = MR_split + j;
+                  item->part = k;
+                  item->abeg = k * PANEL_SPLIT * PANEL_STRIDE;
+                  item->aend = item->abeg + PANEL_SPLIT * PANEL_STRIDE;
+
+                  l = MR_split[j].beg;
+                  r = MR_split[j].end;
+                  while (l < r)
+                    { m = (l + r) / 2;
+                      if (khit[m].apos <= item->abeg)
+                        l = m + 1;
+                      else
+                        r = m;
+                    }
+                  item->beg = l;
+                }
+            MR_nextitem = 0;
+
+            if (VERBOSE && MR_nsplit > 0)
+              { printf("   %d read pairs split into %d parts\n", MR_nsplit, MR_nitems);
+                fflush(stdout);
+              }
           }
-        parmr[NTHREADS - 1].end = nhits;
 
         w = ((ablock->maxlen >> Binshift) - ((-bblock->maxlen) >> Binshift)) + 1;
         counters = (int *) Malloc(NTHREADS * 3 * w * sizeof(int), "Allocating diagonal buckets");
@@ -2365,31 +3606,32 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
 #endif
           }
 
-#ifdef NOTHREAD
-
-        for (i = 0; i < NTHREADS; i++)
-        report_thread(parmr+i);
-
-#else
+        phase = INS_START();
+        run_threads(report_thread, parmr, sizeof(Report_Arg));
+        INS_STOP("daligner.match_filter.align", phase);
 
         for (i = 0; i < NTHREADS; i++)
-            pthread_create(threads + i, NULL, report_thread, parmr + i);
-
-        for (i = 0; i < NTHREADS; i++)
-          pthread_join(threads[i], NULL);
-
-#endif
-
-        if (VERBOSE)
-          for (i = 0; i < NTHREADS; i++)
-            {
-              nfilt += parmr[i].nfilt;
-              ncheck += parmr[i].ncheck;
-            }
+          {
+            nfilt += parmr[i].nfilt;
+            ncheck += parmr[i].ncheck;
+          }
 
         for (i = 0; i < NTHREADS; i++)
-          Free_Work_Data(parmr[i].work);
+          {
+            Free_Work_Data(parmr[i].work);
+            pthread_mutex_destroy(&MR_queue[i].lock);
+            free(parmr[i].split);
+          }
+        for (i = 0; i < MR_nsplit; i++)
+          {
+            pthread_mutex_destroy(&MR_split[i].lock);
+            free(MR_split[i].parts);
+          }
+        free(MR_split);
+        free(MR_items);
         free(counters);
+        free(MR_queue);
+        free(MR_chunk);
 
         for (i = 0; i < NTHREADS; i++)
           free(parmx[i].sptr);
@@ -2425,6 +3667,11 @@ void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock, vo
 
     epilogue:
 
+    INS_STOP("daligner.match_filter", start);
+    INS_COUNT("daligner.kmer_hits", nhits);
+    INS_COUNT("daligner.seed_hits", nfilt);
+    INS_COUNT("daligner.confirmed_hits", ncheck);
+
     if (VERBOSE)
       {
         int width;
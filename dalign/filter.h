@@ -52,6 +52,7 @@
 #include "align.h"
 
 extern int    BIASED;
+extern int    MINIMIZER;   //  > 0: only seed with the minimizers of windows of this many k-mers
 extern int    VERBOSE;
 extern int    MINOVER;
 extern int    HGAP_MIN;
@@ -66,10 +67,101 @@ extern int    NSHIFT;
 
 int Set_Filter_Params(int kmer, int binshift, int suppress, int hitmin);
 
+  //  The globally frequent k-mers of a DB as found by KMsketch: a header followed by the len
+  //  sorted codes of the k-mers in both orientations.  Set_Filter_Frequent maps such a file
+  //  after Set_Filter_Params, Sort_Kmers then suppresses these k-mers in addition to those
+  //  that are too frequent within the block.  Returns 1 if path holds no list for the k-mer
+  //  length.
+
+#define KFREQ_MAGIC   0x5145524b
+#define KFREQ_VERSION 1
+
+typedef struct
+  { uint32 magic;
+    uint16 version;
+    uint16 kmer;
+    int64  cutoff;      //  count from which on a k-mer is frequent
+    int64  len;         //  codes following the header
+  } KFreq_Header;
+
+int Set_Filter_Frequent(char *path);
+
+  //  With pin set the worker threads are pinned to cores spread over the NUMA nodes and the
+  //  k-mer tables read by Load_Kmers are interleaved across the nodes.  Call before the first
+  //  Sort_Kmers or Match_Filter.
+
+void Set_Filter_Placement(int pin);
+
 void *Sort_Kmers(HITS_DB *block, int *len);
 
+  //  Save_Kmers writes a table of Sort_Kmers to path, Load_Kmers returns it again or NULL if path
+  //  holds no table for block under the current parameters.  A mapped table (map = 1) is read
+  //  only and must not be passed as the B table of Match_Filter, which frees that table.
+
+int   Save_Kmers(char *path, HITS_DB *block, void *table, int len);
+void *Load_Kmers(char *path, HITS_DB *block, int *len, int map);
+
 void Match_Filter(char *aname, HITS_DB *ablock, char *bname, HITS_DB *bblock,
                   void *atable, int alen, void *btable, int blen,
                   int comp, Align_Spec *asettings);
 
+  //  Count_Hits returns the number of seed hits Match_Filter would merge for the tables before
+  //  any capping by MEM_LIMIT.  self is set if A is compared against itself (or its complement).
+
+int64 Count_Hits(void *atable, int alen, void *btable, int blen, int self, int comp);
+
+  //  Memory model for daligner -n and HPCdaligner.  A k-mer table entry and a seed hit take
+  //  FILTER_ENTRY bytes each.  A loaded block holds its bases and read records.  Sort_Kmers
+  //  needs two tables while sorting, one if those would exceed a quarter of limit.  Match_Filter
+  //  holds the A and B tables and two vectors of seed hits, the first one in place of the B
+  //  table if that is large enough.  With a limit the hits are capped to fit it.
+
+#define FILTER_ENTRY 16
+
+static inline int64 Block_Memory(int64 nreads, int64 bases)
+  { return (bases + nreads + 4 + (nreads + 1) * (int64) sizeof(HITS_READ)); }
+
+static inline int64 Sort_Kmers_Memory(int64 kmers, int64 limit)
+  { int64 table = (kmers + 1) * FILTER_ENTRY;
+
+    if (limit > 0 && 2 * table > limit / 4)
+      return (table);
+    return (2 * table);
+  }
+
+static inline int64 Match_Filter_Memory(int64 alen, int64 blen, int64 nhits, int self, int64 limit)
+  { int64 tables, mem;
+
+    if (self)
+      blen = 0;
+    tables = (alen + blen + 2) * FILTER_ENTRY;
+    if (self || nhits >= blen)
+      mem = (alen + 1 + 2 * (nhits + 1)) * FILTER_ENTRY;
+    else
+      mem = tables + (nhits + 1) * FILTER_ENTRY;
+    if (limit > 0 && mem > limit)
+      mem = (tables > limit) ? tables : limit;
+    return (mem);
+  }
+
+  //  Peak of a daligner comparison of block A against B, with the blocks' memory, their k-mers
+  //  and the seed hits of the larger of the two orientations.  The complement of B is built in
+  //  place, but A's complement for the comparison against itself is a copy.
+
+static inline int64 Daligner_Memory(int64 amem, int64 akmers, int64 bmem, int64 bkmers,
+                                    int64 nhits, int self, int64 limit)
+  { int64 atable, sort, filter;
+
+    atable = (akmers + 1) * FILTER_ENTRY;
+    if (self)
+      { sort   = 2 * amem + atable + Sort_Kmers_Memory(akmers, limit);
+        filter = 2 * amem + Match_Filter_Memory(akmers, akmers, nhits, 0, limit);
+      }
+    else
+      { sort   = amem + bmem + atable + Sort_Kmers_Memory(bkmers, limit);
+        filter = amem + bmem + Match_Filter_Memory(akmers, bkmers, nhits, 0, limit);
+      }
+    return (sort > filter ? sort : filter);
+  }
+
 #endif
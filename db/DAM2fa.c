@@ -47,9 +47,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
 #include "lib/tracks.h"
 #include "DB.h"
+#include "fastaOut.h"
 
 #ifdef HIDE_FILES
 #define PATHSEP "/."
@@ -57,13 +60,131 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-vU] [-w<int(80)>] <path:dam>";
+static char *Usage = "[-vUz] [-w<int(80)>] [-j<int(1)>] [-b<int> | -r<int>-<int>] <path:dam>";
+
+//  Formatting of the contigs for fasta_out_write(). a batch starts with a scaffold,
+//    the line position and the gaps are only carried over within a scaffold
+
+typedef struct
+  { HITS_DB    *db;
+    int         hdrs;           //  .hdr file, read with pread by the threads
+    track_anno *anno;
+    track_data *data;
+    char       *nstring;
+    int         upper;
+    int         width;
+  } Dam_Format;
+
+static int scaffold_start(void *arg, int i)
+{ Dam_Format *df = (Dam_Format *) arg;
+  int         b, e;
+
+  b = df->anno[i] / sizeof(track_data);
+  e = df->anno[i+1] / sizeof(track_data);
+  return (b < e && df->data[b] == 0);
+}
+
+static void format_contigs(void *arg, int beg, int end, fasta_buffer *buf)
+{ Dam_Format *df    = (Dam_Format *) arg;
+  HITS_DB    *db    = df->db;
+  HITS_READ  *reads = db->reads;
+  char       *nstring = df->nstring;
+  int         WIDTH = df->width;
+  char       *read;
+  char        header[MAX_NAME];
+  int         i, wpos, pfpulse;
+  int         b, e;
+
+  read    = New_Read_Buffer(db);
+  wpos    = 0;
+  pfpulse = 0;
+
+  for (i = beg; i < end; i++)
+    { int        j, len, nlen, w;
+      HITS_READ *r;
+
+      r   = reads + i;
+      len = r->rlen;
+
+      b = df->anno[i] / sizeof(track_data);
+      e = df->anno[i+1] / sizeof(track_data);
+
+      if (b < e)
+        { int origin = df->data[b];
+          int fpulse = df->data[b+1];
+
+          if (origin == 0)
+            { ssize_t n;
+              char   *eol;
+
+              if (i != beg && wpos != 0)
+                { fasta_append(buf,"\n",1);
+                  wpos = 0;
+                }
+              n = pread(df->hdrs,header,MAX_NAME-1,r->coff);
+              if (n <= 0)
+                { fprintf(stderr, "failed to read header\n");
+                  exit(1);
+                }
+              if ((eol = memchr(header,'\n',n)) != NULL)
+                n = (eol - header) + 1;
+              fasta_append(buf,header,n);
+            }
+
+          if (fpulse != 0)
+            { if (origin != 0)
+                nlen = fpulse - (pfpulse + reads[i-1].rlen);
+              else
+                nlen = fpulse;
+
+              for (j = 0; j+(w = WIDTH-wpos) <= nlen; j += w)
+                { fasta_append(buf,nstring,w);
+                  fasta_append(buf,"\n",1);
+                  wpos = 0;
+                }
+              if (j < nlen)
+                { fasta_append(buf,nstring,nlen-j);
+                  if (j == 0)
+                    wpos += nlen;
+                  else
+                    wpos = nlen-j;
+                }
+            }
+
+          pfpulse = fpulse;
+        }
+
+      Load_Read(db,i,read,df->upper);
+
+      for (j = 0; j+(w = WIDTH-wpos) <= len; j += w)
+        { fasta_append(buf,read+j,w);
+          fasta_append(buf,"\n",1);
+          wpos = 0;
+        }
+      if (j < len)
+        { fasta_append(buf,read+j,len-j);
+          if (j == 0)
+            wpos += len;
+          else
+            wpos = len-j;
+        }
+    }
+
+  //  the next batch starts a new scaffold, whose line ends this one
+
+  if (wpos > 0)
+    fasta_append(buf,"\n",1);
+
+  free(read-1);
+}
 
 int main(int argc, char *argv[])
 { HITS_DB    _db, *db = &_db;
   FILE       *dbfile, *hdrs;
   int         nfiles;
-  int         VERBOSE, UPPER, WIDTH;
+  int         VERBOSE, UPPER, WIDTH, GZIP;
+  int         NTHREADS, BLOCK, RBEG, REND;
+  char       *stub;
 
   HITS_TRACK* scaffolds_track;
 
@@ -75,18 +196,33 @@ int main(int argc, char *argv[])
 
     ARG_INIT("DAM2fasta")
 
-    WIDTH = 80;
+    WIDTH    = 80;
+    NTHREADS = 1;
+    BLOCK    = 0;
+    RBEG     = REND = -1;
 
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("vU")
+            ARG_FLAGS("vUz")
             break;
           case 'w':
             ARG_NON_NEGATIVE(WIDTH,"Line width")
             break;
+          case 'j':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+          case 'b':
+            ARG_POSITIVE(BLOCK,"Block")
+            break;
+          case 'r':
+            if (sscanf(argv[i]+2,"%d-%d",&RBEG,&REND) != 2 || RBEG < 0 || REND < RBEG)
+              { fprintf(stderr,"%s: Invalid read range %s\n",Prog_Name,argv[i]+2);
+                exit (1);
+              }
+            break;
         }
       else
         argv[j++] = argv[i];
@@ -94,6 +230,7 @@ int main(int argc, char *argv[])
 
     UPPER   = 1 + flags['U'];
     VERBOSE = flags['v'];
+    GZIP    = flags['z'];
 
     if (argc != 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -116,6 +253,10 @@ int main(int argc, char *argv[])
       { fprintf(stderr,"%s: Cannot be called on a block: %s\n",Prog_Name,argv[1]);
         exit (1);
       }
+
+    //  the threads share the mapped bases
+
+    Map_Bases(db);
   }
 
   // Load Track
@@ -133,7 +274,8 @@ int main(int argc, char *argv[])
 
     pwd    = PathTo(argv[1]);
     root   = Root(argv[1],".dam");
-    dbfile = Fopen(Catenate(pwd,"/",root,".dam"),"r");
+    stub   = Strdup(Catenate(pwd,"/",root,".dam"),"Allocating stub name");
+    dbfile = Fopen(stub,"r");
     hdrs   = Fopen(Catenate(pwd,PATHSEP,root,".hdr"),"r");
     free(pwd);
     free(root);
@@ -141,6 +283,37 @@ int main(int argc, char *argv[])
       exit (1);
   }
 
+  //  The range of contigs exported, extended to the scaffolds starting in it
+
+  { Dam_Format df;
+
+    df.anno = scaffolds_track->anno;
+    df.data = scaffolds_track->data;
+
+    if (BLOCK > 0)
+      { if (DB_block_range(stub,BLOCK,&RBEG,&REND) != 1)
+          { fprintf(stderr,"%s: Block %d of %s does not exist\n",Prog_Name,BLOCK,argv[1]);
+            exit (1);
+          }
+      }
+    else if (RBEG < 0)
+      { RBEG = 0;
+        REND = db->nreads;
+      }
+
+    if (REND > db->nreads)
+      REND = db->nreads;
+    if (RBEG > db->nreads)
+      RBEG = db->nreads;
+
+    while (RBEG < db->nreads && !scaffold_start(&df,RBEG))
+      RBEG += 1;
+    while (REND < db->nreads && !scaffold_start(&df,REND))
+      REND += 1;
+    if (REND < RBEG)
+      REND = RBEG;
+  }
+
   //  nfiles = # of files in data base
 
   if (fscanf(dbfile,DB_NFILE,&nfiles) != 1)
@@ -148,20 +321,10 @@ int main(int argc, char *argv[])
 
   //  For each file do:
 
-  { HITS_READ  *reads;
-    char       *read;
+  { Dam_Format  df;
+    fasta_out   fo;
     int         f, first;
     char        nstring[WIDTH+1];
-    int         b,e;
-    track_anno *scaf_anno;
-    track_data *scaf_data;
-
-    if(scaffolds_track)
-    {
-      scaf_anno = scaffolds_track->anno;
-      scaf_data = scaffolds_track->data;
-    }
-
 
     if (UPPER == 2)
       for (f = 0; f < WIDTH; f++)
@@ -171,112 +334,63 @@ int main(int argc, char *argv[])
         nstring[f] = 'n';
     nstring[WIDTH] = '\0';
 
-    reads = db->reads;
-    read  = New_Read_Buffer(db);
+    df.db      = db;
+    df.hdrs    = fileno(hdrs);
+    df.anno    = scaffolds_track->anno;
+    df.data    = scaffolds_track->data;
+    df.nstring = nstring;
+    df.upper   = UPPER;
+    df.width   = WIDTH;
+
+    bzero(&fo,sizeof(fasta_out));
+    fo.db       = db;
+    fo.format   = format_contigs;
+    fo.boundary = scaffold_start;
+    fo.arg      = &df;
+    fo.nthreads = NTHREADS;
+    fo.gzip     = GZIP;
+
     first = 0;
     for (f = 0; f < nfiles; f++)
-      { int   i, last, wpos;
+      { int   last, beg, end;
         FILE *ofile;
-        char  prolog[MAX_NAME], fname[MAX_NAME], header[MAX_NAME];
+        char  prolog[MAX_NAME], fname[MAX_NAME];
 
         //  Scan db image file line, create .fasta file for writing
 
         if (fscanf(dbfile,DB_FDATA,&last,fname,prolog) != 3)
           SYSTEM_ERROR
 
-        if ((ofile = Fopen(Catenate(".","/",fname,".fasta"),"w")) == NULL)
+        //  only the files with contigs in the range
+
+        beg = (first > RBEG ? first : RBEG);
+        end = (last < REND ? last : REND);
+        first = last;
+
+        if (beg >= end)
+          continue;
+
+        if ((ofile = Fopen(Catenate(".","/",fname,GZIP ? ".fasta.gz" : ".fasta"),"w")) == NULL)
           exit (1);
 
         if (VERBOSE)
-          { fprintf(stderr,"Creating %s.fasta ...\n",fname);
+          { fprintf(stderr,"Creating %s.fasta%s ...\n",fname,GZIP ? ".gz" : "");
             fflush(stdout);
           }
 
         //   For the relevant range of reads, write each to the file
         //     recreating the original headers with the index meta-data about each read
 
-        wpos        = 0;
-        int pfpulse = 0;
-
-        for (i = first; i < last; i++)
-          { int        j, len, nlen, w;
-
-            HITS_READ *r;
-
-            r     = reads + i;
-            len   = r->rlen;
-
-
-            if(scaffolds_track)
-            {
-              b = scaf_anno[i] / sizeof(track_data);
-              e = scaf_anno[i+1] / sizeof(track_data);
-
-              if(b<e)
-              {
-                int origin = scaf_data[b];
-                int fpulse = scaf_data[b+1];
-
-                if (origin == 0)
-                { if (i != first && wpos != 0)
-                  { fprintf(ofile,"\n");
-                    wpos = 0;
-                  }
-                  fseeko(hdrs,r->coff,SEEK_SET);
-                  if (fgets(header,MAX_NAME,hdrs) == NULL)
-                  {
-                    fprintf(stderr, "failed to read header\n");
-                    exit(1);
-                  }
-
-                  fputs(header,ofile);
-                }
-
-                if (fpulse != 0)
-                { if (origin != 0)
-                    nlen = fpulse - (pfpulse + reads[i-1].rlen);
-                  else
-                    nlen = fpulse;
-
-                  for (j = 0; j+(w = WIDTH-wpos) <= nlen; j += w)
-                  { fprintf(ofile,"%.*s\n",w,nstring);
-                    wpos = 0;
-                  }
-                  if (j < nlen)
-                  { fprintf(ofile,"%.*s",nlen-j,nstring);
-                    if (j == 0)
-                      wpos += nlen;
-                    else
-                      wpos = nlen-j;
-                  }
-                }
-
-                pfpulse = fpulse;
-                }
-                b+=2;
-              }
-
-            Load_Read(db,i,read,UPPER);
-
-            for (j = 0; j+(w = WIDTH-wpos) <= len; j += w)
-              { fprintf(ofile,"%.*s\n",w,read+j);
-                wpos = 0;
-              }
-            if (j < len)
-              { fprintf(ofile,"%s",read+j);
-                if (j == 0)
-                  wpos += len;
-                else
-                  wpos = len-j;
-              }
+        if (fasta_out_write(&fo,ofile,beg,end) != 0)
+          { fprintf(stderr,"%s: Failed to write %s.fasta\n",Prog_Name,fname);
+            exit (1);
           }
-        if (wpos > 0)
-          fprintf(ofile,"\n");
 
-        first = last;
+        fclose(ofile);
       }
   }
 
+  free(stub);
   fclose(hdrs);
   fclose(dbfile);
   Close_DB(db);
@@ -51,13 +51,23 @@
 
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <sys/param.h>
 
+#if defined( __SSSE3__ )
+#include <tmmintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
 #include "DB.h"
 
 #ifdef HIDE_FILES
@@ -80,11 +90,64 @@ char Ebuffer[ 1000 ];
 
 #endif
 
+//  Allocations of at least HUGE_THRESHOLD bytes are aligned to and advised for transparent
+//    huge pages, the large k-mer, hit and trace arrays are accessed at random and otherwise
+//    pay a TLB miss for nearly every access.  Setting MARVEL_HUGEPAGES=0 turns this off.
+
+#define HUGE_PAGE ( 2ll << 20 )
+#define HUGE_THRESHOLD ( 32ll << 20 )
+
+static int Huge_Enabled = -1;
+
+static int huge_enabled()
+{
+    if ( Huge_Enabled < 0 )
+    {
+        char* env = getenv( "MARVEL_HUGEPAGES" );
+
+        Huge_Enabled = ( env == NULL || ( strcmp( env, "0" ) != 0 && strcmp( env, "never" ) != 0 ) );
+    }
+    return ( Huge_Enabled );
+}
+
+void Huge_Pages( void* p, int64 size )
+{
+#ifdef MADV_HUGEPAGE
+    uintptr_t beg, end;
+
+    if ( p == NULL || size < HUGE_THRESHOLD || !huge_enabled() )
+        return;
+
+    beg = ( (uintptr_t)p + HUGE_PAGE - 1 ) & ~( HUGE_PAGE - 1 );
+    end = ( (uintptr_t)p + size ) & ~( HUGE_PAGE - 1 );
+
+    //  advice only, failure (e.g. THP disabled) leaves normal pages
+
+    if ( end > beg )
+        madvise( (void*)beg, end - beg, MADV_HUGEPAGE );
+#else
+    (void)p;
+    (void)size;
+#endif
+}
+
 void* Malloc( int64 size, char* mesg )
 {
     void* p;
 
-    if ( ( p = malloc( size ) ) == NULL )
+#ifdef MADV_HUGEPAGE
+    if ( size >= HUGE_THRESHOLD && huge_enabled() )
+    {
+        if ( posix_memalign( &p, HUGE_PAGE, size ) != 0 )
+            p = NULL;
+        else
+            Huge_Pages( p, size );
+    }
+    else
+#endif
+        p = malloc( size );
+
+    if ( p == NULL )
     {
         if ( mesg == NULL )
             EPRINTF( EPLACE, "%s: Out of memory\n", Prog_Name );
@@ -103,6 +166,8 @@ void* Realloc( void* p, int64 size, char* mesg )
         else
             EPRINTF( EPLACE, "%s: Out of memory (%s)\n", Prog_Name, mesg );
     }
+    else
+        Huge_Pages( p, size );
     return ( p );
 }
 
@@ -189,8 +254,8 @@ char* Root( char* name, char* suffix )
 
 char* Catenate( char* path, char* sep, char* root, char* suffix )
 {
-    static char* cat = NULL;
-    static int max   = -1;
+    static __thread char* cat = NULL;
+    static __thread int max   = -1;
     int len;
 
     if ( path == NULL || root == NULL || sep == NULL || suffix == NULL )
@@ -214,8 +279,8 @@ char* Catenate( char* path, char* sep, char* root, char* suffix )
 
 char* Numbered_Suffix( char* left, int num, char* right )
 {
-    static char* suffix = NULL;
-    static int max      = -1;
+    static __thread char* suffix = NULL;
+    static __thread int max      = -1;
     int len;
 
     if ( left == NULL || right == NULL )
@@ -306,24 +371,64 @@ int Number_Digits( int64 num )
  *
  ********************************************************************************************/
 
+//  The packing kernels handle 4 bases (one packed byte) at a time with a lookup table and
+//    word loads, the reverse complement 8 (16 with SSSE3 or NEON) bases from each end at a
+//    time.  The complement is 3 - x per byte as before, also for values outside of 0-3.
+
+#if __ORDER_LITTLE_ENDIAN__ == __BYTE_ORDER__
+
+#define UNPACK_BYTE( x ) ( ( ( (x) >> 6 ) & 3 ) | ( ( ( (x) >> 4 ) & 3 ) << 8 ) | \
+                           ( ( ( (x) >> 2 ) & 3 ) << 16 ) | ( (uint32)( (x) & 3 ) << 24 ) )
+
+#define PACK_WORD( w ) ( ( ( (w) & 3 ) << 6 ) | ( ( (w) >> 4 ) & 0x30 ) | \
+                         ( ( (w) >> 14 ) & 0x0c ) | ( ( (w) >> 24 ) & 3 ) )
+
+#else
+
+#define UNPACK_BYTE( x ) ( ( (uint32)( ( (x) >> 6 ) & 3 ) << 24 ) | ( ( ( (x) >> 4 ) & 3 ) << 16 ) | \
+                           ( ( ( (x) >> 2 ) & 3 ) << 8 ) | ( (x) & 3 ) )
+
+#define PACK_WORD( w ) ( ( ( (w) >> 18 ) & 0xc0 ) | ( ( (w) >> 12 ) & 0x30 ) | \
+                         ( ( (w) >> 6 ) & 0x0c ) | ( (w) & 3 ) )
+
+#endif
+
+#define UNPACK_4( x )  UNPACK_BYTE( x ), UNPACK_BYTE( x + 1 ), UNPACK_BYTE( x + 2 ), UNPACK_BYTE( x + 3 )
+#define UNPACK_16( x ) UNPACK_4( x ), UNPACK_4( x + 4 ), UNPACK_4( x + 8 ), UNPACK_4( x + 12 )
+#define UNPACK_64( x ) UNPACK_16( x ), UNPACK_16( x + 16 ), UNPACK_16( x + 32 ), UNPACK_16( x + 48 )
+
+static const uint32 Unpack_Table[ 256 ] =
+    {UNPACK_64( 0 ), UNPACK_64( 64 ), UNPACK_64( 128 ), UNPACK_64( 192 )};
+
+//  3 - x in each byte of w
+
+#define HIGH_BITS  0x8080808080808080llu
+#define THREES     0x0303030303030303llu
+
+#define COMPLEMENT_WORD( w ) ( ( ( THREES | HIGH_BITS ) - ( (w) & ~HIGH_BITS ) ) ^ ( ( THREES ^ ~(w) ) & HIGH_BITS ) )
+
 //  Compress read into 2-bits per base (from [0-3] per byte representation
+
 void Compress_Read( int len, char* s )
 {
     int i;
+    uint32 w;
     char c, d;
-    char *s0, *s1, *s2, *s3;
+    char *s0, *s1, *s2;
 
     s0 = s;
     s1 = s0 + 1;
     s2 = s1 + 1;
-    s3 = s2 + 1;
 
     c         = s1[ len ];
     d         = s2[ len ];
     s0[ len ] = s1[ len ] = s2[ len ] = 0;
 
     for ( i = 0; i < len; i += 4 )
-        *s++ = (char)( ( s0[ i ] << 6 ) | ( s1[ i ] << 4 ) | ( s2[ i ] << 2 ) | s3[ i ] );
+    {
+        memcpy( &w, s0 + i, sizeof( uint32 ) );
+        *s++ = (char)PACK_WORD( w );
+    }
 
     s1[ len ] = c;
     s2[ len ] = d;
@@ -333,29 +438,92 @@ void Compress_Read( int len, char* s )
 
 void Uncompress_Read( int len, char* s )
 {
-    int i, tlen, byte;
-    char *s0, *s1, *s2, *s3;
-    char* t;
-
-    s0 = s;
-    s1 = s0 + 1;
-    s2 = s1 + 1;
-    s3 = s2 + 1;
+    int i, tlen;
+    uint32 w;
 
     tlen = ( len - 1 ) / 4;
 
-    t = s + tlen;
-    for ( i = tlen * 4; i >= 0; i -= 4 )
+    for ( i = tlen; i >= 0; i-- )
     {
-        byte    = *t--;
-        s0[ i ] = (char)( ( byte >> 6 ) & 0x3 );
-        s1[ i ] = (char)( ( byte >> 4 ) & 0x3 );
-        s2[ i ] = (char)( ( byte >> 2 ) & 0x3 );
-        s3[ i ] = (char)( byte & 0x3 );
+        w = Unpack_Table[ (unsigned char)s[ i ] ];
+        memcpy( s + 4 * i, &w, sizeof( uint32 ) );
     }
     s[ len ] = 4;
 }
 
+//  Reverse complement read in [0-3] per byte representation in-place
+
+void Complement_Read( int len, char* s )
+{
+    char* t = s + len;
+    uint64 a, b;
+    int c;
+
+#if defined( __SSSE3__ )
+    const __m128i rev   = _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 );
+    const __m128i three = _mm_set1_epi8( 3 );
+
+    while ( t - s >= 32 )
+    {
+        __m128i x = _mm_loadu_si128( (__m128i*)s );
+        __m128i y = _mm_loadu_si128( (__m128i*)( t - 16 ) );
+
+        x = _mm_sub_epi8( three, _mm_shuffle_epi8( x, rev ) );
+        y = _mm_sub_epi8( three, _mm_shuffle_epi8( y, rev ) );
+
+        _mm_storeu_si128( (__m128i*)s, y );
+        _mm_storeu_si128( (__m128i*)( t - 16 ), x );
+
+        s += 16;
+        t -= 16;
+    }
+#elif defined( __ARM_NEON )
+    const uint8x16_t three = vdupq_n_u8( 3 );
+
+    while ( t - s >= 32 )
+    {
+        uint8x16_t x = vrev64q_u8( vld1q_u8( (uint8_t*)s ) );
+        uint8x16_t y = vrev64q_u8( vld1q_u8( (uint8_t*)( t - 16 ) ) );
+
+        x = vsubq_u8( three, vextq_u8( x, x, 8 ) );
+        y = vsubq_u8( three, vextq_u8( y, y, 8 ) );
+
+        vst1q_u8( (uint8_t*)s, y );
+        vst1q_u8( (uint8_t*)( t - 16 ), x );
+
+        s += 16;
+        t -= 16;
+    }
+#endif
+
+    while ( t - s >= 16 )
+    {
+        memcpy( &a, s, sizeof( uint64 ) );
+        memcpy( &b, t - 8, sizeof( uint64 ) );
+
+        a = __builtin_bswap64( a );
+        b = __builtin_bswap64( b );
+        a = COMPLEMENT_WORD( a );
+        b = COMPLEMENT_WORD( b );
+
+        memcpy( s, &b, sizeof( uint64 ) );
+        memcpy( t - 8, &a, sizeof( uint64 ) );
+
+        s += 8;
+        t -= 8;
+    }
+
+    t -= 1;
+    while ( s < t )
+    {
+        c    = *s;
+        *s++ = (char)( 3 - *t );
+        *t-- = (char)( 3 - c );
+    }
+    if ( s == t )
+        *s = (char)( 3 - *s );
+}
+
 //  Convert read in [0-3] representation to ascii representation (end with '\n')
 
 void Lower_Read( char* s )
@@ -392,15 +560,274 @@ void Number_Read( char* s )
     *s     = 4;
 }
 
+/*******************************************************************************************
+ *
+ *  SHARED COPIES
+ *
+ *  A published copy is a file <MARVEL_SHARED_DIR>/marvel.<kind>.<key> holding a SHARED_HEADER
+ *    and the data.  It is written under a temporary name and renamed, so a copy that can be
+ *    opened is complete.  Copies are mapped private, thus writes of a process (like the
+ *    kludge in reads[-1]) only duplicate the pages they touch.  The mappings of the process
+ *    are kept in a list, so Shared_Release can tell them from allocated memory.
+ *
+ ********************************************************************************************/
+
+#define SHARED_MAGIC  0x4d48534dllu
+#define SHARED_OFFSET 64
+
+typedef struct
+{
+    uint64 magic;
+    uint64 key;
+    uint64 size;
+} SHARED_HEADER;
+
+typedef struct _shared_map
+{
+    struct _shared_map* next;
+    char* addr;
+    size_t len;
+    int refs;
+} SHARED_MAP;
+
+static SHARED_MAP* Shared_Maps = NULL;
+
+static uint64 Shared_Mix( uint64 key, void* data, size_t len )
+{
+    unsigned char* s = (unsigned char*)data;
+    size_t i;
+
+    if ( key == 0 )
+        key = 0xcbf29ce484222325llu;
+
+    for ( i = 0; i < len; i++ )
+        key = ( key ^ s[ i ] ) * 0x100000001b3llu;
+
+    return ( key );
+}
+
+uint64 Shared_Key( uint64 key, char* path )
+{
+    struct stat st;
+    int64 id[ 4 ];
+
+    if ( stat( path, &st ) != 0 )
+        return ( 0 );
+
+    id[ 0 ] = st.st_dev;
+    id[ 1 ] = st.st_ino;
+    id[ 2 ] = st.st_size;
+    id[ 3 ] = st.st_mtime;
+
+    return ( Shared_Mix( Shared_Mix( key, path, strlen( path ) ), id, sizeof( id ) ) );
+}
+
+static char* Shared_Path( char* kind, uint64 key )
+{
+    char* dir = getenv( SHARED_DIR_ENV );
+    static char path[ PATH_MAX ];
+
+    if ( dir == NULL || *dir == '\0' || key == 0 )
+        return ( NULL );
+
+    snprintf( path, PATH_MAX, "%s/marvel.%s.%016llx", dir, kind, key );
+
+    return ( path );
+}
+
+void* Shared_Map( char* kind, uint64 key, size_t* size, int nrefs )
+{
+    char* path = Shared_Path( kind, key );
+    SHARED_HEADER* header;
+    SHARED_MAP* map;
+    struct stat st;
+    char* addr;
+    int fd;
+
+    if ( path == NULL || ( fd = open( path, O_RDONLY ) ) == -1 )
+        return ( NULL );
+
+    if ( fstat( fd, &st ) != 0 || st.st_size < SHARED_OFFSET )
+    {
+        close( fd );
+        return ( NULL );
+    }
+
+    addr = (char*)mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( addr == MAP_FAILED )
+        return ( NULL );
+
+    header = (SHARED_HEADER*)addr;
+
+    if ( header->magic != SHARED_MAGIC || header->key != key ||
+         header->size + SHARED_OFFSET > (uint64)st.st_size )
+    {
+        munmap( addr, st.st_size );
+        return ( NULL );
+    }
+
+    map = (SHARED_MAP*)Malloc( sizeof( SHARED_MAP ), "Allocating shared map" );
+    if ( map == NULL )
+    {
+        munmap( addr, st.st_size );
+        return ( NULL );
+    }
+
+    map->addr   = addr;
+    map->len    = st.st_size;
+    map->refs   = nrefs;
+    map->next   = Shared_Maps;
+    Shared_Maps = map;
+
+    *size = header->size;
+
+    return ( addr + SHARED_OFFSET );
+}
+
+void* Shared_Publish( char* kind, uint64 key, void* data, size_t size, int nrefs )
+{
+    char* path = Shared_Path( kind, key );
+    SHARED_HEADER header;
+    char* tmp;
+    char* addr;
+    int fd;
+
+    if ( path == NULL )
+        return ( NULL );
+
+    tmp = Numbered_Suffix( path, getpid(), ".tmp" );
+    if ( tmp == NULL )
+        return ( NULL );
+    tmp = Strdup( tmp, "Allocating shared path" );
+    if ( tmp == NULL )
+        return ( NULL );
+
+    if ( ( fd = open( tmp, O_RDWR | O_CREAT | O_TRUNC, 0644 ) ) == -1 )
+    {
+        free( tmp );
+        return ( NULL );
+    }
+
+    //  written through a mapping, hugetlbfs does not support write
+
+    addr = MAP_FAILED;
+    if ( ftruncate( fd, size + SHARED_OFFSET ) == 0 )
+        addr = (char*)mmap( NULL, size + SHARED_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+
+    if ( addr == MAP_FAILED )
+    {
+        unlink( tmp );
+        free( tmp );
+        return ( NULL );
+    }
+
+    header.magic = SHARED_MAGIC;
+    header.key   = key;
+    header.size  = size;
+
+    memcpy( addr, &header, sizeof( SHARED_HEADER ) );
+    memcpy( addr + SHARED_OFFSET, data, size );
+    munmap( addr, size + SHARED_OFFSET );
+
+    if ( rename( tmp, Shared_Path( kind, key ) ) != 0 )
+    {
+        unlink( tmp );
+        free( tmp );
+        return ( NULL );
+    }
+
+    free( tmp );
+
+    return ( Shared_Map( kind, key, &size, nrefs ) );
+}
+
+int Shared_Release( void* ptr )
+{
+    SHARED_MAP *map, *prev;
+
+    prev = NULL;
+    for ( map = Shared_Maps; map != NULL; map = map->next )
+    {
+        if ( (char*)ptr >= map->addr && (char*)ptr < map->addr + map->len )
+        {
+            if ( --map->refs == 0 )
+            {
+                if ( prev == NULL )
+                    Shared_Maps = map->next;
+                else
+                    prev->next = map->next;
+
+                munmap( map->addr, map->len );
+                free( map );
+            }
+
+            return ( 1 );
+        }
+        prev = map;
+    }
+
+    return ( 0 );
+}
+
 /*******************************************************************************************
  *
  *  DB OPEN, TRIM & CLOSE ROUTINES
  *
  ********************************************************************************************/
 
+//  Map the records ufirst-1 .. ufirst+nreads of the open .idx private and return a pointer to
+//    the first one.  reads[-1] falls into the header or the preceding record and reads[nreads]
+//    into the following record or the zero fill of the last page, so the layout is that of the
+//    allocated index.  Pages are only read when touched and changes (like the kludge in
+//    reads[-1]) stay with the process, as for published copies whose list the mapping joins.
+//    NULL if the records cannot be mapped, they are read in then.
+
+static HITS_READ* Map_Index( int fd, int ufirst, int nreads )
+{
+    struct stat st;
+    SHARED_MAP* map;
+    off_t beg, end, mbeg, fend;
+    long page;
+    char* addr;
+
+    page = sysconf( _SC_PAGESIZE );
+    beg  = sizeof( HITS_DB ) + sizeof( HITS_READ ) * ( (off_t)ufirst - 1 );
+    end  = beg + sizeof( HITS_READ ) * ( (off_t)nreads + 2 );
+
+    if ( page <= 0 || beg < 0 || beg % sizeof( int64 ) != 0 || fstat( fd, &st ) != 0 )
+        return ( NULL );
+
+    mbeg = ( beg / page ) * page;
+    fend = ( ( st.st_size + page - 1 ) / page ) * page;
+    if ( end > fend )
+        return ( NULL );
+
+    addr = (char*)mmap( NULL, end - mbeg, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, mbeg );
+    if ( addr == MAP_FAILED )
+        return ( NULL );
+
+    map = (SHARED_MAP*)Malloc( sizeof( SHARED_MAP ), "Allocating index map" );
+    if ( map == NULL )
+    {
+        munmap( addr, end - mbeg );
+        return ( NULL );
+    }
+
+    map->addr   = addr;
+    map->len    = end - mbeg;
+    map->refs   = 1;
+    map->next   = Shared_Maps;
+    Shared_Maps = map;
+
+    return ( (HITS_READ*)( addr + ( beg - mbeg ) ) );
+}
+
 // Open the given database or dam, "path" into the supplied HITS_DB record "db". If the name has
-//   a part # in it then just the part is opened.  The index array is allocated (for all or
-//   just the part) and read in.
+//   a part # in it then just the part is opened.  The index array (for all or just the part)
+//   is mapped from the .idx, or allocated and read in where that is not possible.
 // Return status of routine:
 //    -1: The DB could not be opened for a reason reported by the routine to EPLACE
 //     0: Open of DB proceeded without mishap
@@ -562,34 +989,66 @@ int Open_DB_Block( char* path, HITS_DB* db, int part )
     db->ufirst = ufirst;
 
     nreads = ulast - ufirst;
-    if ( part <= 0 )
+
     {
-        db->reads = (HITS_READ*)Malloc( sizeof( HITS_READ ) * ( nreads + 2 ), "Allocating Open_DB index" );
-        db->reads += 1;
-        if ( fread( db->reads, sizeof( HITS_READ ), nreads, index ) != (size_t)nreads )
+        HITS_READ* reads = NULL;
+        size_t size      = sizeof( HITS_READ ) * ( nreads + 2 );
+        uint64 key       = 0;
+
+        //  attach to the published index of the DB (part) or read and publish it
+
+        if ( getenv( SHARED_DIR_ENV ) != NULL )
         {
-            EPRINTF( EPLACE, "%s: Index file (.idx) of %s is junk\n", Prog_Name, root );
-            free( db->reads );
-            goto error2;
+            key = Shared_Mix( Shared_Mix( 0, &ufirst, sizeof( int ) ), &nreads, sizeof( int ) );
+            key = Shared_Key( key, Catenate( pwd, PATHSEP, root, ".idx" ) );
+
+            reads = (HITS_READ*)Shared_Map( "idx", key, &size, 1 );
+
+            if ( reads != NULL && size != sizeof( HITS_READ ) * ( nreads + 2 ) )
+            {
+                Shared_Release( reads );
+                reads = NULL;
+                size  = sizeof( HITS_READ ) * ( nreads + 2 );
+            }
         }
-    }
-    else
-    {
-        HITS_READ* reads;
-        int i, r, maxlen;
-        int64 totlen;
 
-        reads = (HITS_READ*)Malloc( sizeof( HITS_READ ) * ( nreads + 2 ), "Allocating Open_DB index" );
-        reads += 1;
+        //  map the records unless they are published, which needs a copy to write out
 
-        fseeko( index, sizeof( HITS_READ ) * ufirst, SEEK_CUR );
-        if ( fread( reads, sizeof( HITS_READ ), nreads, index ) != (size_t)nreads )
+        if ( reads == NULL && key == 0 && getenv( DB_INDEX_COPY_ENV ) == NULL )
+            reads = Map_Index( fileno( index ), ufirst, nreads );
+
+        if ( reads == NULL )
         {
-            EPRINTF( EPLACE, "%s: Index file (.idx) of %s is junk\n", Prog_Name, root );
-            free( reads );
-            goto error2;
+            HITS_READ* shared;
+
+            reads = (HITS_READ*)Malloc( size, "Allocating Open_DB index" );
+            if ( reads == NULL )
+                goto error2;
+
+            fseeko( index, sizeof( HITS_READ ) * ufirst, SEEK_CUR );
+            if ( fread( reads + 1, sizeof( HITS_READ ), nreads, index ) != (size_t)nreads )
+            {
+                EPRINTF( EPLACE, "%s: Index file (.idx) of %s is junk\n", Prog_Name, root );
+                free( reads );
+                goto error2;
+            }
+
+            if ( key != 0 && ( shared = (HITS_READ*)Shared_Publish( "idx", key, reads, size, 1 ) ) != NULL )
+            {
+                free( reads );
+                reads = shared;
+            }
         }
 
+        db->reads = reads + 1;
+    }
+
+    if ( part > 0 )
+    {
+        HITS_READ* reads = db->reads;
+        int i, r, maxlen;
+        int64 totlen;
+
         totlen = 0;
         maxlen = 0;
         for ( i = 0; i < nreads; i++ )
@@ -602,7 +1061,6 @@ int Open_DB_Block( char* path, HITS_DB* db, int part )
 
         db->maxlen = maxlen;
         db->totlen = totlen;
-        db->reads  = reads;
     }
 
     ( (int*)( db->reads ) )[ -1 ] = ulast - ufirst; //  Kludge, need these for DB part
@@ -641,7 +1099,11 @@ void Close_DB( HITS_DB* db )
 {
     HITS_TRACK *t, *p;
 
-    if ( db->loaded )
+    if ( db->loaded == DB_BASES_MAPPED )
+    {
+        Unmap_Bases( db );
+    }
+    else if ( db->loaded )
     {
         free( ( (char*)( db->bases ) ) - 1 );
         db->bases = NULL;
@@ -654,7 +1116,8 @@ void Close_DB( HITS_DB* db )
 
     if ( db->reads != NULL )
     {
-        free( db->reads - 1 );
+        if ( !Shared_Release( db->reads - 1 ) )
+            free( db->reads - 1 );
         db->reads = NULL;
     }
 
@@ -666,8 +1129,10 @@ void Close_DB( HITS_DB* db )
     for ( t = db->tracks; t != NULL; t = p )
     {
         p = t->next;
-        free( t->anno );
-        free( t->data );
+        if ( !Shared_Release( t->anno ) )
+            free( t->anno );
+        if ( !Shared_Release( t->data ) )
+            free( t->data );
         free( t->name );
         free( t );
     }
@@ -910,6 +1375,8 @@ int Load_QVs( HITS_DB* db )
         qvtrk->table  = table;
         qvtrk->coding = coding;
         qvtrk->quiva  = quiva;
+        qvtrk->map     = NULL;
+        qvtrk->mapsize = 0;
     }
 
     fclose( istub );
@@ -953,6 +1420,8 @@ void Close_QVs( HITS_DB* db )
             Free_QVcoding( qvtrk->coding + i );
         free( qvtrk->coding );
         free( qvtrk->table );
+        if ( qvtrk->map != NULL )
+            munmap( qvtrk->map, qvtrk->mapsize );
         fclose( qvtrk->quiva );
         db->tracks = track->next;
         free( track );
@@ -1206,8 +1675,10 @@ void Close_Track( HITS_DB* db, char* track )
     {
         if ( strcmp( record->name, track ) == 0 )
         {
-            free( record->anno );
-            free( record->data );
+            if ( !Shared_Release( record->anno ) )
+                free( record->anno );
+            if ( !Shared_Release( record->data ) )
+                free( record->data );
             free( record->name );
             if ( prev == NULL )
                 db->tracks = record->next;
@@ -1239,25 +1710,184 @@ char* New_Read_Buffer( HITS_DB* db )
     return ( read + 1 );
 }
 
-// Load into 'read' the i'th read in 'db'.  As an upper case ASCII string if ascii is 2, as a
-//   lower-case ASCII string is ascii is 1, and as a numeric string over 0(A), 1(C), 2(G), and
-//   3(T) otherwise.
-//
-// **NB**, the byte before read will be set to a delimiter character!
+/*******************************************************************************************
+ *
+ *  MAPPED BASES
+ *
+ *  With Map_Bases the .bps file is mapped read-only and db->bases points at a DB_MAP
+ *    instead of the FILE. Load_Read and Load_Subread unpack from the mapping and keep no
+ *    state in the db, so threads can share it.
+ *
+ ********************************************************************************************/
 
-int Load_Read( HITS_DB* db, int i, char* read, int ascii )
+typedef struct
 {
-    FILE* bases = (FILE*)db->bases;
-    int64 off;
-    int len, clen;
-    HITS_READ* r = db->reads;
+    char* addr;
+    size_t size;
+} DB_MAP;
 
-    if ( i >= db->nreads )
+int Map_Bases( HITS_DB* db )
+{
+    struct stat st;
+    DB_MAP* map;
+    char* path;
+    int fd;
+
+    if ( db->loaded == DB_BASES_MAPPED )
+        return ( 0 );
+
+    if ( db->loaded )
     {
-        EPRINTF( EPLACE, "%s: Index out of bounds (Load_Read)\n", Prog_Name );
+        EPRINTF( EPLACE, "%s: Sequences already loaded (Map_Bases)\n", Prog_Name );
         EXIT( 1 );
     }
-    if ( bases == NULL )
+
+    path = Catenate( db->path, "", "", ".bps" );
+    if ( path == NULL )
+        EXIT( 1 );
+
+    if ( ( fd = open( path, O_RDONLY ) ) == -1 || fstat( fd, &st ) == -1 )
+    {
+        EPRINTF( EPLACE, "%s: Cannot open %s for 'r'\n", Prog_Name, path );
+        if ( fd != -1 )
+            close( fd );
+        EXIT( 1 );
+    }
+
+    map = (DB_MAP*)Malloc( sizeof( DB_MAP ), "Allocating base map" );
+    if ( map == NULL )
+    {
+        close( fd );
+        EXIT( 1 );
+    }
+
+    map->size = st.st_size;
+    map->addr = NULL;
+
+    if ( map->size > 0 )
+    {
+        map->addr = (char*)mmap( NULL, map->size, PROT_READ, MAP_SHARED, fd, 0 );
+
+        if ( map->addr == MAP_FAILED )
+        {
+            EPRINTF( EPLACE, "%s: Cannot map %s (Map_Bases)\n", Prog_Name, path );
+            free( map );
+            close( fd );
+            EXIT( 1 );
+        }
+
+        madvise( map->addr, map->size, MADV_RANDOM );
+    }
+
+    close( fd );
+
+    if ( db->bases != NULL )
+        fclose( (FILE*)db->bases );
+
+    db->bases  = (void*)map;
+    db->loaded = DB_BASES_MAPPED;
+
+    return ( 0 );
+}
+
+void Unmap_Bases( HITS_DB* db )
+{
+    DB_MAP* map = (DB_MAP*)db->bases;
+
+    if ( db->loaded != DB_BASES_MAPPED )
+        return;
+
+    if ( map->size > 0 )
+        munmap( map->addr, map->size );
+
+    free( map );
+
+    db->bases  = NULL;
+    db->loaded = 0;
+}
+
+void Prefetch_Bases( HITS_DB* db, int beg, int end )
+{
+    DB_MAP* map   = (DB_MAP*)db->bases;
+    HITS_READ* r  = db->reads;
+    int64 page    = sysconf( _SC_PAGESIZE );
+    int64 from, to;
+
+    if ( db->loaded != DB_BASES_MAPPED || beg >= end || map->size == 0 )
+        return;
+
+    from = r[ beg ].boff;
+    to   = r[ end - 1 ].boff + COMPRESSED_LEN( r[ end - 1 ].rlen );
+    from -= from % page;
+
+    if ( to > (int64)map->size )
+        to = map->size;
+
+    madvise( map->addr + from, to - from, MADV_WILLNEED );
+}
+
+//  Unpack len bases starting at base beg of the 2-bit packed sequence t into s
+
+static void Unpack_Read( char* t, int beg, int len, char* s )
+{
+    int i, b;
+
+    t += beg / 4;
+    b = beg % 4;
+
+    for ( i = 0; i < len; i++ )
+    {
+        s[ i ] = (char)( ( t[ 0 ] >> ( 6 - 2 * b ) ) & 0x3 );
+        if ( ++b == 4 )
+        {
+            b = 0;
+            t++;
+        }
+    }
+    s[ len ] = 4;
+}
+
+static void Convert_Read( char* read, int ascii )
+{
+    if ( ascii == 1 )
+    {
+        Lower_Read( read );
+        read[ -1 ] = '\0';
+    }
+    else if ( ascii == 2 )
+    {
+        Upper_Read( read );
+        read[ -1 ] = '\0';
+    }
+    else
+        read[ -1 ] = 4;
+}
+
+// Load into 'read' the i'th read in 'db'.  As an upper case ASCII string if ascii is 2, as a
+//   lower-case ASCII string is ascii is 1, and as a numeric string over 0(A), 1(C), 2(G), and
+//   3(T) otherwise.
+//
+// **NB**, the byte before read will be set to a delimiter character!
+
+int Load_Read( HITS_DB* db, int i, char* read, int ascii )
+{
+    FILE* bases = (FILE*)db->bases;
+    int64 off;
+    int len, clen;
+    HITS_READ* r = db->reads;
+
+    if ( i >= db->nreads )
+    {
+        EPRINTF( EPLACE, "%s: Index out of bounds (Load_Read)\n", Prog_Name );
+        EXIT( 1 );
+    }
+    if ( db->loaded == DB_BASES_MAPPED )
+    {
+        Unpack_Read( ( (DB_MAP*)db->bases )->addr + r[ i ].boff, 0, r[ i ].rlen, read );
+        Convert_Read( read, ascii );
+        return ( 0 );
+    }
+    if ( bases == NULL )
     {
         bases = Fopen( Catenate( db->path, "", "", ".bps" ), "r" );
         if ( bases == NULL )
@@ -1308,6 +1938,12 @@ char* Load_Subread( HITS_DB* db, int i, int beg, int end, char* read, int ascii
         EPRINTF( EPLACE, "%s: Index out of bounds (Load_Read)\n", Prog_Name );
         EXIT( NULL );
     }
+    if ( db->loaded == DB_BASES_MAPPED )
+    {
+        Unpack_Read( ( (DB_MAP*)db->bases )->addr + r[ i ].boff, beg, end - beg, read );
+        Convert_Read( read, ascii );
+        return ( read );
+    }
     if ( bases == NULL )
     {
         bases = Fopen( Catenate( db->path, "", "", ".bps" ), "r" );
@@ -1383,12 +2019,96 @@ void Free_QV_Buffer( char** buf )
 // Load into entry the QV streams for the i'th read from db.  The parameter ascii applies to
 //  the DELTAG stream as described for Load_Read.
 
+int Map_QVs( HITS_DB* db )
+{
+    HITS_QV* qvtrk;
+    struct stat st;
+
+    if ( db->tracks == NULL || strcmp( db->tracks->name, ".@qvs" ) != 0 )
+    {
+        EPRINTF( EPLACE, "%s: QV's are not loaded (Map_QVs)\n", Prog_Name );
+        EXIT( 1 );
+    }
+
+    qvtrk = (HITS_QV*)db->tracks;
+    if ( qvtrk->map != NULL )
+        return ( 0 );
+
+    if ( fstat( fileno( qvtrk->quiva ), &st ) == -1 || st.st_size == 0 )
+    {
+        EPRINTF( EPLACE, "%s: Cannot stat the .qvs file (Map_QVs)\n", Prog_Name );
+        EXIT( 1 );
+    }
+
+    qvtrk->map = (char*)mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fileno( qvtrk->quiva ), 0 );
+    if ( qvtrk->map == MAP_FAILED )
+    {
+        qvtrk->map = NULL;
+        EPRINTF( EPLACE, "%s: Cannot map the .qvs file (Map_QVs)\n", Prog_Name );
+        EXIT( 1 );
+    }
+
+    qvtrk->mapsize = st.st_size;
+
+    madvise( qvtrk->map, qvtrk->mapsize, MADV_RANDOM );
+
+    return ( 0 );
+}
+
+//  Decode the deletion tag of a loaded entry as requested by ascii
+
+static void QVentry_Tags( char* deltag, int rlen, int ascii )
+{
+    if ( ascii != 1 )
+    {
+        if ( ascii != 2 )
+        {
+            char x         = deltag[ rlen ];
+            deltag[ rlen ] = '\0';
+            Number_Read( deltag );
+            deltag[ rlen ] = x;
+        }
+        else
+        {
+            int j;
+            int u = 'A' - 'a';
+
+            for ( j         = 0; j < rlen; j++ )
+                deltag[ j ] = (char)( deltag[ j ] + u );
+        }
+    }
+}
+
 int Load_QVentry( HITS_DB* db, int i, char** entry, int ascii )
 {
     HITS_READ* reads;
     FILE* quiva;
     int rlen;
 
+    //  A mapped .qvs is decoded without touching the file or the active db, see Map_QVs
+
+    if ( db->tracks != NULL && strcmp( db->tracks->name, ".@qvs" ) == 0 && ( (HITS_QV*)db->tracks )->map != NULL )
+    {
+        HITS_QV* qvtrk = (HITS_QV*)db->tracks;
+        int64 coff;
+
+        if ( i < 0 || i >= db->nreads )
+        {
+            EPRINTF( EPLACE, "%s: Index out of bounds (Load_QVentry)\n", Prog_Name );
+            EXIT( 1 );
+        }
+
+        rlen = db->reads[ i ].rlen;
+        coff = db->reads[ i ].coff;
+
+        if ( Uncompress_QVentry( qvtrk->map + coff, qvtrk->mapsize - coff, entry, qvtrk->coding + qvtrk->table[ i ], rlen ) )
+            EXIT( 1 );
+
+        QVentry_Tags( entry[ 1 ], rlen, ascii );
+
+        return ( 0 );
+    }
+
     if ( db != Active_DB )
     {
         if ( db->tracks == NULL || strcmp( db->tracks->name, ".@qvs" ) != 0 )
@@ -1413,26 +2133,7 @@ int Load_QVentry( HITS_DB* db, int i, char** entry, int ascii )
     if ( Uncompress_Next_QVentry( quiva, entry, Active_QV->coding + Active_QV->table[ i ], rlen ) )
         EXIT( 1 );
 
-    if ( ascii != 1 )
-    {
-        char* deltag = entry[ 1 ];
-
-        if ( ascii != 2 )
-        {
-            char x         = deltag[ rlen ];
-            deltag[ rlen ] = '\0';
-            Number_Read( deltag );
-            deltag[ rlen ] = x;
-        }
-        else
-        {
-            int j;
-            int u = 'A' - 'a';
-
-            for ( j         = 0; j < rlen; j++ )
-                deltag[ j ] = (char)( deltag[ j ] + u );
-        }
-    }
+    QVentry_Tags( entry[ 1 ], rlen, ascii );
 
     return ( 0 );
 }
@@ -1448,62 +2149,194 @@ int Load_QVentry( HITS_DB* db, int i, char** entry, int ascii )
 //   bases pointer to point at the block after closing the bases file.  If ascii is
 //   non-zero then the reads are converted to ACGT ascii, otherwise the reads are left
 //   as numeric strings over 0(A), 1(C), 2(G), and 3(T).
+//  The packed bases of all reads are fetched with one pread and unpacked by threads
+//    taking consecutive ranges of the reads, each writing its reads from offset o on
+
+typedef struct
+{
+    HITS_READ* reads;
+    char* packed;               // bases of the .bps file from offset base on
+    int64 base;
+    char* seq;
+    int64 o;
+    int beg, end;
+    int ascii;
+} Unpack_Job;
+
+static void* Unpack_Reads( void* arg )
+{
+    Unpack_Job* job  = (Unpack_Job*)arg;
+    HITS_READ* reads = job->reads;
+    int64 o          = job->o;
+    int i, k, len;
+    char *t, *s;
+
+    for ( i = job->beg; i < job->end; i++ )
+    {
+        len = reads[ i ].rlen;
+        t   = job->packed + ( reads[ i ].boff - job->base );
+        s   = job->seq + o;
+
+        // whole bytes first, so nothing is written past the read's terminator
+
+        for ( k = 0; k < len / 4; k++ )
+        {
+            uint32 w = Unpack_Table[ (unsigned char)t[ k ] ];
+            memcpy( s + 4 * k, &w, sizeof( uint32 ) );
+        }
+        for ( k = 4 * k; k < len; k++ )
+            s[ k ] = (char)( ( t[ k / 4 ] >> ( 6 - 2 * ( k % 4 ) ) ) & 0x3 );
+        s[ len ] = 4;
+
+        if ( job->ascii == 1 )
+            Lower_Read( s );
+        else if ( job->ascii )
+            Upper_Read( s );
+
+        reads[ i ].boff = o;
+        o += ( len + 1 );
+    }
+
+    return ( NULL );
+}
+
 int Read_All_Sequences( HITS_DB* db, int ascii )
 {
-    FILE* bases;
+    return ( Read_All_Sequences_Parallel( db, ascii, 1 ) );
+}
+
+int Read_All_Sequences_Parallel( HITS_DB* db, int ascii, int nthreads )
+{
     int nreads       = db->nreads;
     HITS_READ* reads = db->reads;
-    void ( *translate )( char* s );
 
-    char* seq;
-    int64 o, off;
-    int i, len, clen;
+    Unpack_Job* jobs;
+    pthread_t* threads;
+    char *seq, *packed;
+    int64 lo, hi, size, got, o, bases;
+    int i, t, fd;
 
-    bases = Fopen( Catenate( db->path, "", "", ".bps" ), "r" );
-    if ( bases == NULL )
+    Unmap_Bases( db );
+
+    if ( nthreads < 1 )
+        nthreads = 1;
+    if ( nthreads > nreads )
+        nthreads = ( nreads > 0 ) ? nreads : 1;
+
+    // the byte range of the .bps file holding the reads, trimmed away reads included
+
+    lo = hi = 0;
+    for ( i = 0; i < nreads; i++ )
+    {
+        int64 off = reads[ i ].boff;
+
+        if ( i == 0 || off < lo )
+            lo = off;
+        if ( i == 0 || off + COMPRESSED_LEN( reads[ i ].rlen ) > hi )
+            hi = off + COMPRESSED_LEN( reads[ i ].rlen );
+    }
+    size = hi - lo;
+
+    // not using Catenate, whose buffer is shared, as callers may load tracks meanwhile
+
+    {
+        char* path = (char*)Malloc( strlen( db->path ) + 5, "Allocating All Sequence Reads" );
+        if ( path == NULL )
+            EXIT( 1 );
+
+        sprintf( path, "%s.bps", db->path );
+        fd = open( path, O_RDONLY );
+        free( path );
+    }
+
+    if ( fd == -1 )
+    {
+        EPRINTF( EPLACE, "%s: Cannot open %s.bps for 'r'\n", Prog_Name, db->path );
         EXIT( 1 );
+    }
 
-    seq = (char*)Malloc( db->totlen + nreads + 4, "Allocating All Sequence Reads" );
-    if ( seq == NULL )
+    seq     = (char*)Malloc( db->totlen + nreads + 4, "Allocating All Sequence Reads" );
+    packed  = (char*)Malloc( size + 1, "Allocating All Sequence Reads" );
+    jobs    = (Unpack_Job*)Malloc( sizeof( Unpack_Job ) * nthreads, "Allocating All Sequence Reads" );
+    threads = (pthread_t*)Malloc( sizeof( pthread_t ) * nthreads, "Allocating All Sequence Reads" );
+    if ( seq == NULL || packed == NULL || jobs == NULL || threads == NULL )
     {
-        fclose( bases );
+        free( seq );
+        free( packed );
+        free( jobs );
+        free( threads );
+        close( fd );
         EXIT( 1 );
     }
 
+    for ( got = 0; got < size; )
+    {
+        ssize_t n = pread( fd, packed + got, size - got, lo + got );
+
+        if ( n <= 0 )
+        {
+            EPRINTF( EPLACE, "%s: Read of .bps file failed (Read_All_Sequences)\n", Prog_Name );
+            free( seq );
+            free( packed );
+            free( jobs );
+            free( threads );
+            close( fd );
+            EXIT( 1 );
+        }
+
+        got += n;
+    }
+
+    close( fd );
+
     *seq++ = 4;
 
-    if ( ascii == 1 )
-        translate = Lower_Read;
-    else
-        translate = Upper_Read;
+    // cut the reads into ranges of about the same number of bases
 
-    o = 0;
-    for ( i = 0; i < nreads; i++ )
+    o     = 0;
+    bases = 0;
+    i     = 0;
+    for ( t = 0; t < nthreads; t++ )
     {
-        len = reads[ i ].rlen;
-        off = reads[ i ].boff;
-        if ( ftello( bases ) != off )
-            fseeko( bases, off, SEEK_SET );
-        clen = COMPRESSED_LEN( len );
-        if ( clen > 0 )
-        {
-            if ( fread( seq + o, clen, 1, bases ) != 1 )
+        jobs[ t ].reads  = reads;
+        jobs[ t ].packed = packed;
+        jobs[ t ].base   = lo;
+        jobs[ t ].seq    = seq;
+        jobs[ t ].ascii  = ascii;
+        jobs[ t ].o      = o;
+        jobs[ t ].beg    = i;
+
+        if ( t == nthreads - 1 )
+            i = nreads;
+        else
+            while ( i < nreads && bases < ( db->totlen / nthreads ) * ( t + 1 ) )
             {
-                EPRINTF( EPLACE, "%s: Read of .bps file failed (Read_All_Sequences)\n", Prog_Name );
-                free( seq );
-                fclose( bases );
-                EXIT( 1 );
+                bases += reads[ i ].rlen;
+                o += reads[ i ].rlen + 1;
+                i += 1;
             }
-        }
-        Uncompress_Read( len, seq + o );
-        if ( ascii )
-            translate( seq + o );
-        reads[ i ].boff = o;
-        o += ( len + 1 );
+
+        jobs[ t ].end = i;
     }
-    reads[ nreads ].boff = o;
 
-    fclose( bases );
+    for ( t = 1; t < nthreads; t++ )
+        pthread_create( threads + t, NULL, Unpack_Reads, jobs + t );
+
+    Unpack_Reads( jobs );
+
+    for ( t = 1; t < nthreads; t++ )
+        pthread_join( threads[ t ], NULL );
+
+    reads[ nreads ].boff = 0;
+    if ( nreads > 0 )
+        reads[ nreads ].boff = reads[ nreads - 1 ].boff + reads[ nreads - 1 ].rlen + 1;
+
+    free( packed );
+    free( jobs );
+    free( threads );
+
+    if ( db->bases != NULL && db->loaded == 0 )
+        fclose( (FILE*)db->bases );
 
     db->bases  = (void*)seq;
     db->loaded = 1;
@@ -1645,7 +2478,9 @@ int DB_block_range( char* db, int block, int* _beg, int* _end )
     size_t ndb = strlen( db );
     char* path = (char*)malloc( ndb + 20 );
 
-    if ( strcmp(db + ndb - 3, ".db") != 0 )
+    // .dam stubs have to be named as such
+
+    if ( strcmp(db + ndb - 3, ".db") != 0 && ( ndb < 4 || strcmp(db + ndb - 4, ".dam") != 0 ) )
     {
         sprintf( path, "%s.db", db );
     }
@@ -1671,6 +2506,11 @@ int DB_block_range( char* db, int block, int* _beg, int* _end )
             break;
         }
 
+        if (in_ranges && strncmp(buf, "costs = ", 8) == 0)
+        {
+            break;
+        }
+
         if (in_ranges)
         {
             char* num = buf;
@@ -1760,6 +2600,332 @@ int DB_Blocks( char* db ) // HEIDELBERG_MODIFICATION
     return nblocks;
 }
 
+int64* DB_Block_Costs( char* db, int* _nblocks )
+{
+    FILE* fileDb;
+    size_t ndb = strlen( db );
+    char* path = (char*)malloc( ndb + 20 );
+    char* buffer;
+    int64* costs = NULL;
+    int nfiles, nblocks, ncosts, i;
+    int64 size;
+
+    *_nblocks = 0;
+
+    if ( strcmp( db + ndb - 3, ".db" ) != 0 )
+        sprintf( path, "%s.db", db );
+    else
+        strcpy( path, db );
+
+    fileDb = fopen( path, "r" );
+    free( path );
+
+    if ( fileDb == NULL )
+        return NULL;
+
+    buffer = (char*)malloc( 2 * MAX_NAME + 100 );
+
+    if ( fscanf( fileDb, DB_NFILE, &nfiles ) != 1 )
+        goto done;
+
+    for ( i = 0; i < nfiles; i++ )
+        if ( fgets( buffer, 2 * MAX_NAME + 100, fileDb ) == NULL )
+            goto done;
+
+    if ( fscanf( fileDb, DB_NBLOCK, &nblocks ) != 1 || fscanf( fileDb, DB_PARAMS, &size ) != 1 )
+        goto done;
+
+    for ( i = 0; i <= nblocks; i++ )
+        if ( fgets( buffer, 2 * MAX_NAME + 100, fileDb ) == NULL )
+            goto done;
+
+    if ( fscanf( fileDb, DB_NCOST, &ncosts ) != 1 || ncosts != nblocks )
+        goto done;
+
+    costs = (int64*)malloc( sizeof( int64 ) * ( nblocks + 1 ) );
+
+    for ( i = 1; i <= nblocks; i++ )
+        if ( fscanf( fileDb, DB_CDATA, costs + i ) != 1 )
+        {
+            free( costs );
+            costs = NULL;
+            goto done;
+        }
+
+    costs[ 0 ]  = 0;
+    *_nblocks = nblocks;
+
+done:
+    free( buffer );
+    fclose( fileDb );
+
+    return costs;
+}
+
+int* DB_Block_Bounds( char* db, int* _nblocks )
+{
+    FILE* fileDb;
+    size_t ndb = strlen( db );
+    char* path = (char*)malloc( ndb + 20 );
+    char* buffer;
+    int* bounds = NULL;
+    int nfiles, nblocks, i;
+    int64 size;
+
+    *_nblocks = 0;
+
+    if ( strcmp( db + ndb - 3, ".db" ) != 0 )
+        sprintf( path, "%s.db", db );
+    else
+        strcpy( path, db );
+
+    fileDb = fopen( path, "r" );
+    free( path );
+
+    if ( fileDb == NULL )
+        return NULL;
+
+    buffer = (char*)malloc( 2 * MAX_NAME + 100 );
+
+    if ( fscanf( fileDb, DB_NFILE, &nfiles ) != 1 )
+        goto done;
+
+    for ( i = 0; i < nfiles; i++ )
+        if ( fgets( buffer, 2 * MAX_NAME + 100, fileDb ) == NULL )
+            goto done;
+
+    if ( fscanf( fileDb, DB_NBLOCK, &nblocks ) != 1 || fscanf( fileDb, DB_PARAMS, &size ) != 1 )
+        goto done;
+
+    bounds = (int*)malloc( sizeof( int ) * ( nblocks + 1 ) );
+
+    for ( i = 0; i <= nblocks; i++ )
+        if ( fscanf( fileDb, DB_BDATA, bounds + i ) != 1 )
+        {
+            free( bounds );
+            bounds = NULL;
+            goto done;
+        }
+
+    *_nblocks = nblocks;
+
+done:
+    free( buffer );
+    fclose( fileDb );
+
+    return bounds;
+}
+
+/*******************************************************************************************
+ *
+ *  CACHED STATISTICS
+ *
+ *  STATS FILE FORMAT = VERSION KEY DAM READS BASES MAXLEN AVERAGE DEVIATION FREQ
+ *                      NBLOCK BLOCK^nblock NBIN BIN^nbin
+ *
+ ********************************************************************************************/
+
+#define DB_STATS_VERSION   "stats = %d\n"
+#define DB_STATS_KEY       "key = %lld %lld %lld %lld\n"   // size and mtime of the stub and the .idx
+#define DB_STATS_DAM       "dam = %d\n"
+#define DB_STATS_READS     "reads = %d\n"
+#define DB_STATS_BASES     "bases = %lld\n"
+#define DB_STATS_MAXLEN    "maxlen = %d\n"
+#define DB_STATS_AVERAGE   "average = %lld\n"
+#define DB_STATS_DEVIATION "deviation = %lld\n"
+#define DB_STATS_FREQ      "freq = %.9g %.9g %.9g %.9g\n"
+#define DB_STATS_FREQ_IN   "freq = %f %f %f %f\n"
+#define DB_STATS_NBLOCK    "blocks = %d\n"
+#define DB_STATS_BLOCK     " %d %lld %lld\n"               // reads, bases and cost of a block
+#define DB_STATS_NBIN      "bins = %d %d %d\n"             // bin size, number of bins, bins listed
+#define DB_STATS_BIN       " %d %d %lld\n"                 // reads and bases of a bin, if any
+
+#define DB_STATS_CURRENT 1
+
+//  path of the stats file and its key, NULL if the DB's files are not there
+
+static char* db_stats_key( char* path, int64* key, int* dam )
+{
+    struct stat st;
+    char *root, *pwd, *stats;
+    int plen;
+
+    plen = strlen( path );
+    if ( plen > 4 && strcmp( path + plen - 4, ".dam" ) == 0 )
+        root = Root( path, ".dam" );
+    else
+        root = Root( path, ".db" );
+    pwd = PathTo( path );
+
+    stats = NULL;
+
+    *dam = 0;
+    if ( stat( Catenate( pwd, "/", root, ".db" ), &st ) == -1 )
+    {
+        *dam = 1;
+        if ( stat( Catenate( pwd, "/", root, ".dam" ), &st ) == -1 )
+            goto done;
+    }
+
+    key[ 0 ] = st.st_size;
+    key[ 1 ] = st.st_mtime;
+
+    if ( stat( Catenate( pwd, PATHSEP, root, ".idx" ), &st ) == -1 )
+        goto done;
+
+    key[ 2 ] = st.st_size;
+    key[ 3 ] = st.st_mtime;
+
+    stats = Strdup( Catenate( pwd, PATHSEP, root, DB_STATS_SUFFIX ), "Allocating stats path" );
+
+done:
+    free( root );
+    free( pwd );
+
+    return ( stats );
+}
+
+int DB_Stats_Load( char* path, DB_STATS* stats )
+{
+    FILE* in;
+    char* spath;
+    int64 key[ 4 ], fkey[ 4 ];
+    int version, dam, nlisted, bin, i;
+
+    memset( stats, 0, sizeof( DB_STATS ) );
+
+    if ( ( spath = db_stats_key( path, key, &dam ) ) == NULL )
+        return ( 1 );
+
+    in = fopen( spath, "r" );
+    free( spath );
+
+    if ( in == NULL )
+        return ( 1 );
+
+    if ( fscanf( in, DB_STATS_VERSION, &version ) != 1 || version != DB_STATS_CURRENT ||
+         fscanf( in, DB_STATS_KEY, fkey, fkey + 1, fkey + 2, fkey + 3 ) != 4 ||
+         memcmp( key, fkey, sizeof( key ) ) != 0 )
+        goto error;
+
+    if ( fscanf( in, DB_STATS_DAM, &( stats->dam ) ) != 1 ||
+         fscanf( in, DB_STATS_READS, &( stats->nreads ) ) != 1 ||
+         fscanf( in, DB_STATS_BASES, &( stats->totlen ) ) != 1 ||
+         fscanf( in, DB_STATS_MAXLEN, &( stats->maxlen ) ) != 1 ||
+         fscanf( in, DB_STATS_AVERAGE, &( stats->ave ) ) != 1 ||
+         fscanf( in, DB_STATS_DEVIATION, &( stats->dev ) ) != 1 ||
+         fscanf( in, DB_STATS_FREQ_IN, stats->freq, stats->freq + 1, stats->freq + 2, stats->freq + 3 ) != 4 ||
+         fscanf( in, DB_STATS_NBLOCK, &( stats->nblocks ) ) != 1 || stats->nblocks < 0 )
+        goto error;
+
+    stats->breads = (int*)malloc( sizeof( int ) * ( stats->nblocks + 1 ) );
+    stats->bbases = (int64*)malloc( sizeof( int64 ) * ( stats->nblocks + 1 ) );
+    stats->bcost  = (int64*)malloc( sizeof( int64 ) * ( stats->nblocks + 1 ) );
+
+    stats->breads[ 0 ] = 0;
+    stats->bbases[ 0 ] = stats->bcost[ 0 ] = 0;
+
+    for ( i = 1; i <= stats->nblocks; i++ )
+        if ( fscanf( in, DB_STATS_BLOCK, stats->breads + i, stats->bbases + i, stats->bcost + i ) != 3 )
+            goto error;
+
+    if ( fscanf( in, DB_STATS_NBIN, &( stats->bin ), &( stats->nbin ), &nlisted ) != 3 ||
+         stats->bin <= 0 || stats->nbin < 0 )
+        goto error;
+
+    stats->hist = (int*)calloc( stats->nbin + 1, sizeof( int ) );
+    stats->bsum = (int64*)calloc( stats->nbin + 1, sizeof( int64 ) );
+
+    for ( i = 0; i < nlisted; i++ )
+    {
+        int count;
+        int64 bases;
+
+        if ( fscanf( in, DB_STATS_BIN, &bin, &count, &bases ) != 3 || bin < 0 || bin >= stats->nbin )
+            goto error;
+
+        stats->hist[ bin ] = count;
+        stats->bsum[ bin ] = bases;
+    }
+
+    fclose( in );
+
+    return ( 0 );
+
+error:
+    fclose( in );
+    DB_Stats_Free( stats );
+
+    return ( 1 );
+}
+
+int DB_Stats_Write( char* path, DB_STATS* stats )
+{
+    FILE* out;
+    char *spath, *tmp;
+    int64 key[ 4 ];
+    int dam, nlisted, i;
+
+    if ( ( spath = db_stats_key( path, key, &dam ) ) == NULL )
+        return ( 1 );
+
+    tmp = Strdup( Catenate( spath, ".tmp", "", "" ), "Allocating stats path" );
+
+    if ( ( out = fopen( tmp, "w" ) ) == NULL )
+    {
+        free( tmp );
+        free( spath );
+        return ( 1 );
+    }
+
+    fprintf( out, DB_STATS_VERSION, DB_STATS_CURRENT );
+    fprintf( out, DB_STATS_KEY, key[ 0 ], key[ 1 ], key[ 2 ], key[ 3 ] );
+    fprintf( out, DB_STATS_DAM, dam );
+    fprintf( out, DB_STATS_READS, stats->nreads );
+    fprintf( out, DB_STATS_BASES, stats->totlen );
+    fprintf( out, DB_STATS_MAXLEN, stats->maxlen );
+    fprintf( out, DB_STATS_AVERAGE, stats->ave );
+    fprintf( out, DB_STATS_DEVIATION, stats->dev );
+    fprintf( out, DB_STATS_FREQ, stats->freq[ 0 ], stats->freq[ 1 ], stats->freq[ 2 ], stats->freq[ 3 ] );
+
+    fprintf( out, DB_STATS_NBLOCK, stats->nblocks );
+    for ( i = 1; i <= stats->nblocks; i++ )
+        fprintf( out, DB_STATS_BLOCK, stats->breads[ i ], stats->bbases[ i ], stats->bcost[ i ] );
+
+    for ( nlisted = i = 0; i < stats->nbin; i++ )
+        if ( stats->hist[ i ] > 0 )
+            nlisted += 1;
+
+    fprintf( out, DB_STATS_NBIN, stats->bin, stats->nbin, nlisted );
+    for ( i = 0; i < stats->nbin; i++ )
+        if ( stats->hist[ i ] > 0 )
+            fprintf( out, DB_STATS_BIN, i, stats->hist[ i ], stats->bsum[ i ] );
+
+    if ( fclose( out ) != 0 || rename( tmp, spath ) != 0 )
+    {
+        unlink( tmp );
+        free( tmp );
+        free( spath );
+        return ( 1 );
+    }
+
+    free( tmp );
+    free( spath );
+
+    return ( 0 );
+}
+
+void DB_Stats_Free( DB_STATS* stats )
+{
+    free( stats->hist );
+    free( stats->bsum );
+    free( stats->breads );
+    free( stats->bbases );
+    free( stats->bcost );
+
+    memset( stats, 0, sizeof( DB_STATS ) );
+}
+
 char* getDir( int RUN_ID, int subjectID ) // HEIDELBERG_MODIFICATION
 {
     char* out = malloc( 32 );
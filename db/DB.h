@@ -174,12 +174,15 @@ void *Malloc(int64 size, char *mesg);                    //  Guarded versions of
 void *Realloc(void *object, int64 size, char *mesg);     //  and strdup, that output "mesg" to
 char *Strdup(char *string, char *mesg);                  //  stderr if out of memory
 
+void Huge_Pages(void *object, int64 size);  //  Advise huge pages for a large malloc'd object
+
 FILE *Fopen(char *path, char *mode);     // Open file path for "mode"
 char *PathTo(char *path);                // Return path portion of file name "path"
 char *Root(char *path, char *suffix);    // Return the root name, excluding suffix, of "path"
 
 // Catenate returns concatenation of path.sep.root.suffix in a *temporary* buffer
 // Numbered_Suffix returns concatenation of left.<num>.right in a *temporary* buffer
+// (one per thread)
 
 char *Catenate(char *path, char *sep, char *root, char *suffix);
 char *Numbered_Suffix(char *left, int num, char *right);
@@ -194,6 +197,7 @@ int  Number_Digits(int64 num);                        //  Return # of digits in
 
 void   Compress_Read(int len, char *s);   //  Compress read in-place into 2-bit form
 void Uncompress_Read(int len, char *s);   //  Uncompress read in-place into numeric form
+void Complement_Read(int len, char *s);  //  Reverse complement numeric read in-place
 void      Print_Read(char *s, int width);
 
 void Lower_Read(char *s);     //  Convert read from numbers to lowercase letters (0-3 to acgt)
@@ -247,6 +251,8 @@ typedef struct
     uint16        *table;   //  for i in [0,db->nreads-1]: read i should be decompressed with
                             //    scheme coding[table[i]]
     FILE          *quiva;   //  the open file pointer to the .qvs file
+    char          *map;     //  the .qvs file if mapped by Map_QVs, otherwise NULL
+    int64          mapsize;
   } HITS_QV;
 
 //  The DB record holds all information about the current state of an active DB including an
@@ -276,7 +282,7 @@ typedef struct
        //    integer spaces of the record.
 
     char       *path;       //  Root name of DB for .bps, .qvs, and tracks
-    int         loaded;     //  Are reads loaded in memory?
+    int         loaded;     //  Are reads loaded in memory? (DB_BASES_MAPPED if the .bps is mapped)
     void       *bases;      //  file pointer for bases file (to fetch reads from),
                             //    or memory pointer to uncompressed block of all sequences.
     HITS_READ  *reads;      //  Array [-1..nreads] of HITS_READ
@@ -286,7 +292,10 @@ typedef struct
 
 /*******************************************************************************************
  *
- *  DB STUB FILE FORMAT = NFILE FDATA^nfile NBLOCK PARAMS BDATA^nblock
+ *  DB STUB FILE FORMAT = NFILE FDATA^nfile NBLOCK PARAMS BDATA^nblock [NCOST CDATA^nblock]
+ *
+ *  The optional cost section is written by DBsplit -c and holds the estimated alignment
+ *  cost of each block.  It is dropped when reads are added to the DB.
  *
  ********************************************************************************************/
 
@@ -297,6 +306,8 @@ typedef struct
 #define DB_NBLOCK "blocks = %9d\n"  //  number of blocks
 #define DB_PARAMS "size = %9lld\n"  //  block size
 #define DB_BDATA  " %9d\n"          //  First read index (untrimmed)
+#define DB_NCOST  "costs = %9d\n"  //  number of block costs
+#define DB_CDATA  " %18lld\n"       //  estimated alignment cost of a block
 
 #define DB_FDATA_FIELDS 3
 #define DB_NFILE_FIELDS 1
@@ -330,6 +341,33 @@ typedef struct
 int Open_DB(char *path, HITS_DB *db);
 int Open_DB_Block(char* path, HITS_DB* db, int block);
 
+  // The read records of the .idx are mapped private by Open_DB, so opening even a very large
+  //   DB reads nothing but the pages of the records used.  Changes made to db->reads stay in
+  //   memory, as they did with the records read in.  If the environment variable
+  //   MARVEL_DB_INDEX_COPY is set they are read in instead, e.g. where the .idx might be
+  //   rewritten in place while the DB is open.
+
+#define DB_INDEX_COPY_ENV "MARVEL_DB_INDEX_COPY"
+
+  // Shared copies for processes on one node.  If the environment variable MARVEL_SHARED_DIR
+  //   names a directory, preferably on a tmpfs or hugetlbfs, Open_DB publishes the read index
+  //   of the DB (block) there and track_load the decompressed tracks.  Later processes opening
+  //   the same files map the published copy instead of loading their own.  Copies are keyed by
+  //   the device, inode, size and mtime of their source files, so stale ones are never used.
+  //   They are not removed, clean the directory when the jobs are done.
+  //
+  //   Shared_Key mixes the identity of the file at path into key (0 if it does not exist).
+  //   Shared_Map maps the copy of kind and key if present, Shared_Publish writes one from data
+  //   and maps it.  Both return NULL on failure.  A mapping is released when Shared_Release was
+  //   called for nrefs pointers into it.  Shared_Release returns 0 for other pointers.
+
+#define SHARED_DIR_ENV "MARVEL_SHARED_DIR"
+
+uint64 Shared_Key(uint64 key, char *path);
+void  *Shared_Map(char *kind, uint64 key, size_t *size, int nrefs);
+void  *Shared_Publish(char *kind, uint64 key, void *data, size_t size, int nrefs);
+int    Shared_Release(void *ptr);
+
   // Shut down an open 'db' by freeing all associated space, including tracks and QV structures,
   //   and any open file pointers.  The record pointed at by db however remains (the user
   //   supplied it and so should free it).
@@ -347,6 +385,13 @@ int Load_QVs(HITS_DB *db);
 
 void Close_QVs(HITS_DB *db);
 
+  // Map the .qvs file of 'db' read-only, the QV pseudo track must have been loaded.  Load_QVentry
+  //   then decodes straight from the mapping at the offset of the read, and may be called
+  //   concurrently on the same 'db'.  The mapping is released by Close_QVs.  A non-zero value
+  //   is returned if an error occured and INTERACTIVE is defined.
+
+int Map_QVs(HITS_DB *db);
+
   // Look up the file and header in the file of the indicated track.  Return:
   //     0: Track is for untrimmed DB
   //    -1: Track is not the right size of DB either trimmed or untrimmed
@@ -397,6 +442,22 @@ int  Load_Read(HITS_DB *db, int i, char *read, int ascii);
 
 char *Load_Subread(HITS_DB *db, int i, int beg, int end, char *read, int ascii);
 
+  // Map the .bps file of 'db' read-only. Load_Read and Load_Subread then unpack straight from
+  //   the mapping instead of seeking in the bases file, and may be called concurrently on the
+  //   same 'db'. The mapping is released by Close_DB, or by Unmap_Bases which returns to file
+  //   access. A non-zero value is returned if an error occured and INTERACTIVE is defined.
+
+#define DB_BASES_MAPPED 2
+
+int  Map_Bases(HITS_DB *db);
+void Unmap_Bases(HITS_DB *db);
+
+  // Advise the kernel that reads beg..end-1 of a mapped 'db' are about to be loaded, so that
+  //   their bases are paged in with large reads instead of a fault per page. Does nothing if
+  //   the bases are not mapped.
+
+void Prefetch_Bases(HITS_DB *db, int beg, int end);
+
   // Allocate a set of 5 vectors large enough to hold the longest QV stream that will occur
   //   in the database.  If cannot allocate memory then return NULL if INTERACTIVE is defined,
   //   or print error to stderr and exit otherwise.
@@ -428,6 +489,11 @@ int   Load_QVentry(HITS_DB *db, int i, char **entry, int ascii);
 
 int Read_All_Sequences(HITS_DB *db, int ascii);
 
+  // As Read_All_Sequences, but the reads are fetched with a single read of their part of
+  //   the .bps file and unpacked by nthreads threads, each taking a range of the reads.
+
+int Read_All_Sequences_Parallel(HITS_DB *db, int ascii, int nthreads);
+
   // For the DB or DAM "path" = "prefix/root[.db|.dam]", find all the files for that DB, i.e. all
   //   those of the form "prefix/[.]root.part" and call actor with the complete path to each file
   //   pointed at by path, and the suffix of the path by extension.  The . proceeds the root
@@ -446,4 +512,46 @@ char *getDir(int runID, int subjectID); // HEIDELBERG_MODIFICATION
 
 int DB_block_range( char* db, int block, int* _beg, int* _end ); // HEIDELBERG_MODIFICATION
 
+  // Costs of the blocks 1..nblocks of db as written by DBsplit -c, indexed by block number.
+  //   NULL if the DB has no cost section.
+
+int64 *DB_Block_Costs( char* db, int* nblocks );
+
+  // First untrimmed read of the blocks 1..nblocks+1 of db, block b covers the reads
+  //   bounds[b-1] .. bounds[b]-1. NULL if the DB has not been split.
+
+int *DB_Block_Bounds( char* db, int* nblocks );
+
+  // Statistics of an entire DB or DAM as cached by DBstats in the file .<root>.stats next to
+  //   the stub. The cache is keyed by the size and modification time of the stub and the .idx
+  //   and is ignored once either changed.  The length histogram counts hist[i] reads with
+  //   bsum[i] bases of length i*bin .. (i+1)*bin-1, block b in 1..nblocks (0 if the DB was not
+  //   split) has breads[b] reads of bbases[b] bases whose squared lengths add up to bcost[b].
+
+#define DB_STATS_SUFFIX ".stats"
+
+typedef struct
+  { int    dam;
+    int    nreads, maxlen;
+    int64  totlen, ave, dev;
+    float  freq[4];
+    int    bin, nbin;
+    int   *hist;
+    int64 *bsum;
+    int    nblocks;
+    int   *breads;
+    int64 *bbases;
+    int64 *bcost;
+  } DB_STATS;
+
+  // 0 if the cached statistics of path are current and were loaded into stats
+
+int  DB_Stats_Load( char* path, DB_STATS* stats );
+
+  // 0 if stats were cached for path, the key is taken at the time of the call
+
+int  DB_Stats_Write( char* path, DB_STATS* stats );
+
+void DB_Stats_Free( DB_STATS* stats );
+
 #endif // _HITS_DB
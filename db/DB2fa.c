@@ -49,19 +49,25 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/param.h>
 
 #include "DB.h"
+#include "fastaOut.h"
 #include "lib/tracks.h"
 
 static void usage()
 {
-    fprintf(stderr, "usage: [-vhUS] [-m <track>] [-w<int(80)>] <path:db>\n");
+    fprintf(stderr, "usage: [-vhUSz] [-m <track>] [-w<int(80)>] [-j <int>] [-b <int> | -r <int>-<int>] <path:db>\n");
     fprintf(stderr, "options: -v ... verbose\n");
     fprintf(stderr, "         -h ... print this help message\n");
     fprintf(stderr, "         -U ... upper case bases\n");
     fprintf(stderr, "         -w ... line width (default: 80)\n");
     fprintf(stderr, "         -m ... add track to fasta header (multiple -m possible)\n");
     fprintf(stderr, "         -S ... sort DB according read length (longest first) \n");
+    fprintf(stderr, "         -j ... number of threads decoding and compressing the reads (default: 1)\n");
+    fprintf(stderr, "         -z ... write gzip compressed .fasta.gz files\n");
+    fprintf(stderr, "         -b ... only export the reads of a block\n");
+    fprintf(stderr, "         -r ... only export the reads from-to (0-based, to excluded)\n");
 }
 
 extern char *optarg;
@@ -148,7 +154,7 @@ static void addProlog(DB_Header* dbh, int from, int to, char *fname, char *rname
 
 static int getPrologIndexOfRead(DB_Header* dbh, int readID)
 {
-    if (readID < 0 || readID > dbh->headers[dbh->numHeader - 1].to)
+    if (readID < 0 || readID >= dbh->headers[dbh->numHeader - 1].to)
         return -1;
 
     else if (dbh->numHeader == 1)
@@ -164,7 +170,7 @@ static int getPrologIndexOfRead(DB_Header* dbh, int readID)
         int i = (min + max) / 2;
         if (readID < headers[i].from)
             max = i - 1;
-        else if (readID > headers[i].to)
+        else if (readID >= headers[i].to)
             min = i + 1;
         else
             return i;
@@ -172,13 +178,86 @@ static int getPrologIndexOfRead(DB_Header* dbh, int readID)
     return -1;
 }
 
+// formatting of the reads for fasta_out_write(), positions are read ids unless sorted
+
+typedef struct
+{
+    HITS_DB *db;
+    DB_Header *dbh;
+    int *readIDs;
+    int file;                   // prolog of the reads, unless sorted
+
+    HITS_TRACK **tracks;
+    int ntracks;
+
+    int upper;
+    int width;
+} Fasta_Format;
+
+static void format_reads(void* arg, int beg, int end, fasta_buffer* buf)
+{
+    Fasta_Format *ff = (Fasta_Format*) arg;
+    HITS_DB *db = ff->db;
+    DB_Header *dbh = ff->dbh;
+    char *read = New_Read_Buffer(db);
+    int i, j, b, e;
+
+    for (i = beg; i < end; i++)
+    {
+        int h = i;
+        if (ff->readIDs)
+            h = ff->readIDs[i];
+
+        if (ff->readIDs)
+        {
+            int pidx = getPrologIndexOfRead(dbh, h);
+            if (pidx < 0)
+            {
+                fprintf(stderr, "Cannot find read: %d\n", h);
+                exit(1);
+            }
+
+            fasta_printf(buf, ">%s fileID=%d", dbh->headers[pidx].readName, pidx + 1);
+        }
+        else
+            fasta_printf(buf, ">%s", dbh->headers[ff->file].readName);
+
+        for (j = 0; j < ff->ntracks; j++)
+        {
+            track_anno *anno = ff->tracks[j]->anno;
+            track_data *data = ff->tracks[j]->data;
+
+            fasta_printf(buf, " %s=", ff->tracks[j]->name);
+            b = anno[h] / sizeof(track_data);
+            e = anno[h + 1] / sizeof(track_data);
+
+            while (b < e)
+            {
+                fasta_printf(buf, "%d", data[b]);
+                b++;
+                if (b < e)
+                    fasta_append(buf, ",", 1);
+            }
+        }
+
+        fasta_append(buf, "\n", 1);
+
+        Load_Read(db, h, read, ff->upper);
+
+        fasta_wrap(buf, read, db->reads[h].rlen, ff->width);
+    }
+
+    free(read - 1);
+}
+
 int main(int argc, char *argv[])
 {
     HITS_DB *db = &_db;
     FILE *dbfile;
     char *dbName;
     int nfiles;
-    int VERBOSE, UPPER, WIDTH, SORT;
+    int VERBOSE, UPPER, WIDTH, SORT, NTHREADS, GZIP;
+    int BLOCK, RBEG, REND;
 
     HITS_TRACK **out_tracks = NULL;
     int curTracks = 0;
@@ -192,14 +271,44 @@ int main(int argc, char *argv[])
         UPPER = 1;
         WIDTH = 80;
         SORT = 0;
+        NTHREADS = 1;
+        GZIP = 0;
+        BLOCK = 0;
+        RBEG = REND = -1;
 
         int c;
         opterr = 0;
 
-        while ((c = getopt(argc, argv, "hvUSw:m:")) != -1)
+        while ((c = getopt(argc, argv, "hvUSzw:m:j:b:r:")) != -1)
         {
             switch (c)
             {
+                case 'z':
+                    GZIP = 1;
+                    break;
+                case 'j':
+                    NTHREADS = atoi(optarg);
+                    if (NTHREADS < 1)
+                    {
+                        fprintf(stderr, "Invalid number of threads %d\n", NTHREADS);
+                        exit(1);
+                    }
+                    break;
+                case 'b':
+                    BLOCK = atoi(optarg);
+                    if (BLOCK < 1)
+                    {
+                        fprintf(stderr, "Invalid block %d\n", BLOCK);
+                        exit(1);
+                    }
+                    break;
+                case 'r':
+                    if (sscanf(optarg, "%d-%d", &RBEG, &REND) != 2 || RBEG < 0 || REND < RBEG)
+                    {
+                        fprintf(stderr, "Invalid read range %s\n", optarg);
+                        exit(1);
+                    }
+                    break;
                 case 'v':
                     VERBOSE += 1;
                     break;
@@ -268,8 +377,31 @@ int main(int argc, char *argv[])
             fprintf(stderr, "%s: Cannot be called on a block: %s\n", argv[0], dbName);
             exit(1);
         }
+
+        // the threads share the mapped bases
+
+        Map_Bases(db);
     }
 
+    // the range of reads exported
+
+    if (BLOCK > 0)
+    {
+        if (DB_block_range(dbName, BLOCK, &RBEG, &REND) != 1)
+        {
+            fprintf(stderr, "%s: Block %d of %s does not exist\n", argv[0], BLOCK, dbName);
+            exit(1);
+        }
+    }
+    else if (RBEG < 0)
+    {
+        RBEG = 0;
+        REND = db->nreads;
+    }
+
+    if (REND > db->nreads)
+        REND = db->nreads;
+
     // Load Tracks
     {
         int i;
@@ -299,9 +431,9 @@ int main(int argc, char *argv[])
 
     if (SORT)
     {
-        int num = db->nreads;
+        int num = REND - RBEG;
 
-        readIDs = (int*) malloc(sizeof(int) * num);
+        readIDs = (int*) malloc(sizeof(int) * (num + 1));
         if (readIDs == NULL)
         {
             fprintf(stderr, "[ERROR] - DB2fasta: Cannot allocate read id buffer for sorting!\n");
@@ -309,7 +441,7 @@ int main(int argc, char *argv[])
         }
         int i;
         for (i = 0; i < num; i++)
-            readIDs[i] = i;
+            readIDs[i] = RBEG + i;
 
         if (VERBOSE)
             printf("sorting ...");
@@ -348,108 +480,78 @@ int main(int argc, char *argv[])
                 exit(1);
             }
             addProlog(dbh, first, last, fname, file);
+            first = last;
         }
     }
 
     //  For each file do:
 
     {
-        HITS_READ *reads;
-        char *read;
-        int f, first;
-        int b, e;
-
-        reads = db->reads;
-        read = New_Read_Buffer(db);
-        first = 0;
+        Fasta_Format ff;
+        fasta_out fo;
+        int f;
+
+        ff.db = db;
+        ff.dbh = dbh;
+        ff.readIDs = readIDs;
+        ff.tracks = out_tracks;
+        ff.ntracks = curTracks;
+        ff.upper = UPPER;
+        ff.width = WIDTH;
+
+        bzero(&fo, sizeof(fasta_out));
+        fo.db = db;
+        fo.order = readIDs;
+        fo.format = format_reads;
+        fo.arg = &ff;
+        fo.nthreads = NTHREADS;
+        fo.gzip = GZIP;
+
         for (f = 0; f < nfiles; f++)
         {
-            int i, last;
             FILE *ofile;
+            int first, last;
 
             if (SORT)
             {
                 ofile = stdout;
-                last = db->nreads;
-                nfiles = 1;
+                first = 0;
+                last = REND - RBEG;
             }
             else
             {
-                if ((ofile = Fopen(Catenate(".", "/", dbh->headers[f].fileName, ".fasta"), "w")) == NULL)
+                //  only the files with reads in the range
+
+                first = MAX(dbh->headers[f].from, RBEG);
+                last = MIN(dbh->headers[f].to, REND);
+
+                if (first >= last)
+                    continue;
+
+                if ((ofile = Fopen(Catenate(".", "/", dbh->headers[f].fileName, GZIP ? ".fasta.gz" : ".fasta"), "w")) == NULL)
                     exit(1);
-                last = dbh->headers[f].to;
                 if (VERBOSE)
                 {
-                    fprintf(stderr, "Creating %s.fasta ...\n", dbh->headers[f].fileName);
+                    fprintf(stderr, "Creating %s.fasta%s ...\n", dbh->headers[f].fileName, GZIP ? ".gz" : "");
                     fflush(stdout);
                 }
 
+                ff.file = f;
             }
 
             //   For the relevant range of reads, write each to the file
             //     recreating the original headers with the index meta-data about each read
 
-            for (i = first; i < last; i++)
+            if (fasta_out_write(&fo, ofile, first, last) != 0)
             {
-                int j, len;
-                HITS_READ *r;
-
-                int h = i;
-                if (SORT)
-                    h = readIDs[i];
-
-                r = reads + h;
-
-                len = r->rlen;
-
-                if (SORT)
-                {
-                    int pidx = getPrologIndexOfRead(dbh, h);
-                    if (pidx < 0)
-                    {
-                        printf("Cannot find read: %d\n", h);
-                        fflush(stdout);
-                        exit(1);
-                    }
-
-                    fprintf(ofile, ">%s", dbh->headers[pidx].readName);
-                    fprintf(ofile, " fileID=%d", pidx + 1);
-                }
-                else
-                    fprintf(ofile, ">%s", dbh->headers[f].readName);
-
-                for (j = 0; j < curTracks; j++)
-                {
-                    track_anno *anno = out_tracks[j]->anno;
-                    track_data *data = out_tracks[j]->data;
-
-                    fprintf(ofile, " %s=", out_tracks[j]->name);
-                    b = anno[h] / sizeof(track_data);
-                    e = anno[h + 1] / sizeof(track_data);
-
-                    while (b < e)
-                    {
-                        fprintf(ofile, "%d", data[b]);
-                        b++;
-                        if (b < e)
-                            fprintf(ofile, ",");
-                    }
-                }
-
-                fprintf(ofile, "\n");
-
-                Load_Read(db, h, read, UPPER);
-
-                for (j = 0; j + WIDTH < len; j += WIDTH)
-                    fprintf(ofile, "%.*s\n", WIDTH, read + j);
-                if (j < len)
-                    fprintf(ofile, "%s\n", read + j);
+                fprintf(stderr, "[ERROR] - DB2fasta: Failed to write the reads\n");
+                exit(1);
             }
 
-            first = last;
-
             if (SORT)
                 break;
+
+            fclose(ofile);
         }
     }
 
@@ -38,6 +38,8 @@
 /********************************************************************************************
  *
  *  Recreate all the .quiva files that have been loaded into a specified database.
+ *    The entries of a file are decoded by -T threads from the memory mapped .qvs file,
+ *    each thread formats a run of reads that is written out in order.
  *
  *  Author:  Gene Myers
  *  Date  :  May 2014
@@ -47,6 +49,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lib/tracks.h"
 #include "DB.h"
@@ -58,12 +64,101 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-vU] <path:db>";
+static char *Usage = "[-vU] [-T<int(4)>] <path:db>";
+
+#define CHUNK_BASES 1000000   //  bases of the reads a thread decodes at a time
+
+typedef struct
+  { HITS_DB    *db;
+    QVcoding   *coding;       //  scheme of the current file
+    char       *qvs;          //  the mapped .qvs file
+    int64       qsize;
+    char       *prolog;
+    HITS_TRACK *rq_track;
+    HITS_TRACK *pacbio_track;
+    int         upper;
+    int         beg, end;     //  reads of the thread
+    char      **entry;
+    char       *out;          //  the .quiva text of reads beg..end-1
+    int64       olen, omax;
+  } Decode_Arg;
+
+static void Grow_Output(Decode_Arg *parm, int64 need)
+{ if (parm->olen + need > parm->omax)
+    { parm->omax = 1.2*(parm->olen + need) + 10000;
+      parm->out  = (char *) Realloc(parm->out,parm->omax,"Growing output buffer");
+      if (parm->out == NULL)
+        exit (1);
+    }
+}
+
+static void *Decode_Thread(void *arg)
+{ Decode_Arg *parm  = (Decode_Arg *) arg;
+  HITS_READ  *reads = parm->db->reads;
+  char      **entry = parm->entry;
+  int         plen  = strlen(parm->prolog);
+  int         i, e;
+
+  parm->olen = 0;
+  for (i = parm->beg; i < parm->end; i++)
+    { int        b, rlen;
+      HITS_READ *r;
+      int        sequCnt = 0;
+
+      r    = reads + i;
+      rlen = r->rlen;
+
+      Grow_Output(parm,plen + 100 + 5*(rlen+1));
+
+      parm->olen += sprintf(parm->out+parm->olen,"@%s_%d_%d",parm->prolog,sequCnt++,rlen);
+      if (parm->rq_track)
+        { track_anno* rq_anno = parm->rq_track->anno;
+          track_data* rq_data = parm->rq_track->data;
+
+          b = rq_anno[i] / sizeof(track_data);
+          e = rq_anno[i+1] / sizeof(track_data);
+          if (b<e)
+            parm->olen += sprintf(parm->out+parm->olen," RQ=0.%3d",rq_data[b]);
+        }
+
+      if (parm->pacbio_track)
+        { track_anno* pacbio_anno = parm->pacbio_track->anno;
+          track_data* pacbio_data = parm->pacbio_track->data;
+
+          b = pacbio_anno[i] / sizeof(track_data);
+          e = pacbio_anno[i+1] / sizeof(track_data);
+          if (b<e)
+            parm->olen += sprintf(parm->out+parm->olen," pacbio=%d,%d,%d",
+                                  pacbio_data[b], pacbio_data[b+1], pacbio_data[b+2]);
+        }
+      parm->out[parm->olen++] = '\n';
+
+      Uncompress_QVentry(parm->qvs+r->coff,parm->qsize-r->coff,entry,parm->coding,rlen);
+
+      if (parm->upper)
+        { char *deltag = entry[1];
+          int   j;
+
+          for (j = 0; j < rlen; j++)
+            deltag[j] -= 32;
+        }
+
+      for (e = 0; e < 5; e++)
+        { memcpy(parm->out+parm->olen,entry[e],rlen);
+          parm->olen += rlen;
+          parm->out[parm->olen++] = '\n';
+        }
+    }
+
+  return (NULL);
+}
 
 int main(int argc, char *argv[])
 { HITS_DB    _db, *db = &_db;
   FILE       *dbfile, *quiva;
-  int         VERBOSE, UPPER;
+  int         VERBOSE, UPPER, NTHREADS;
+  char       *qvs;
+  int64       qsize;
 
   HITS_TRACK* pacbio_track;
   HITS_TRACK* rq_track;
@@ -72,13 +167,23 @@ int main(int argc, char *argv[])
 
   { int   i, j, k;
     int   flags[128];
+    char *eptr;
 
     ARG_INIT("DB2quiva")
 
+    NTHREADS = 4;
+
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
-        { ARG_FLAGS("vU") }
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("vU")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
@@ -96,6 +201,7 @@ int main(int argc, char *argv[])
 
   { char *pwd, *root;
     int   status;
+    struct stat st;
 
     status = Open_DB(argv[1],db);
     if (status < 0)
@@ -117,6 +223,19 @@ int main(int argc, char *argv[])
     free(root);
     if (dbfile == NULL || quiva == NULL)
       exit (1);
+
+    //  Map the .qvs file, the threads decode from it at the offsets of the reads
+
+    qvs   = NULL;
+    qsize = 0;
+    if (fstat(fileno(quiva),&st) == 0 && st.st_size > 0)
+      { qsize = st.st_size;
+        qvs   = (char *) mmap(NULL,qsize,PROT_READ,MAP_SHARED,fileno(quiva),0);
+        if (qvs == MAP_FAILED)
+          { fprintf(stderr,"%s: Cannot map the .qvs file of %s\n",Prog_Name,argv[1]);
+            exit (1);
+          }
+      }
   }
 
   // Load Tracks
@@ -128,18 +247,37 @@ int main(int argc, char *argv[])
   //  For each file do:
 
   { HITS_READ  *reads;
-    int         f, first, nfiles;
+    int         f, t, first, nfiles;
     QVcoding   *coding;
-    char      **entry;
+    Decode_Arg *parm;
+    pthread_t  *threads;
 
     if (fscanf(dbfile,DB_NFILE,&nfiles) != 1)
       SYSTEM_ERROR
 
-    entry = New_QV_Buffer(db);
+    parm    = (Decode_Arg *) Malloc(sizeof(Decode_Arg)*NTHREADS,"Allocating thread arguments");
+    threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+    if (parm == NULL || threads == NULL)
+      exit (1);
+
+    for (t = 0; t < NTHREADS; t++)
+      { parm[t].db           = db;
+        parm[t].qvs          = qvs;
+        parm[t].qsize        = qsize;
+        parm[t].rq_track     = rq_track;
+        parm[t].pacbio_track = pacbio_track;
+        parm[t].upper        = UPPER;
+        parm[t].entry        = New_QV_Buffer(db);
+        parm[t].out          = NULL;
+        parm[t].olen         = 0;
+        parm[t].omax         = 0;
+      }
+
     reads = db->reads;
     first = 0;
     for (f = 0; f < nfiles; f++)
-      { int   i, last;
+      { int   i, last, nused;
+        int64 bases;
         FILE *ofile;
         char  prolog[MAX_NAME], fname[MAX_NAME];
 
@@ -158,61 +296,56 @@ int main(int argc, char *argv[])
             fflush(stderr);
           }
 
-        coding = Read_QVcoding(quiva);
-
-        track_anno* rq_anno = rq_track->anno;
-        track_data* rq_data = rq_track->data;
-
-        track_anno* pacbio_anno = pacbio_track->anno;
-        track_data* pacbio_data = pacbio_track->data;
-
-        //   For the relevant range of reads, write the header for each to the file
-        //     and then uncompress and write the quiva entry for each
-
-        for (i = first; i < last; i++)
-          { int        b, e, rlen;
-            HITS_READ *r;
-            int        sequCnt = 0;
-            r     = reads + i;
-            rlen  = r->rlen;
-
-           fprintf(ofile,"@%s_%d_%d",prolog,sequCnt++,rlen);
-           if (rq_track)
-              {
-                b = rq_anno[i] / sizeof(track_data);
-                e = rq_anno[i+1] / sizeof(track_data);
-
-                if(b<e)
-                  fprintf(ofile," RQ=0.%3d",rq_data[b]);
-              }
+        //  The scheme of the file precedes the entry of its first read
 
-            if(pacbio_track)
-              {
-                b = pacbio_anno[i] / sizeof(track_data);
-                e = pacbio_anno[i+1] / sizeof(track_data);
-                if(b<e)
-                  fprintf(ofile," pacbio=%d,%d,%d", pacbio_data[b], pacbio_data[b+1], pacbio_data[b+2]);
+        fseeko(quiva,reads[first].coff,SEEK_SET);
+        coding = Read_QVcoding(quiva);
+        if (coding == NULL)
+          exit (1);
+        reads[first].coff = ftello(quiva);
+
+        //   For the relevant range of reads, let each thread decode the headers and
+        //     quiva entries of up to CHUNK_BASES bases, and write them out in order
+
+        for (i = first; i < last; )
+          { for (nused = 0; nused < NTHREADS && i < last; nused++)
+              { parm[nused].coding = coding;
+                parm[nused].prolog = prolog;
+                parm[nused].beg    = i;
+                for (bases = 0; i < last && bases < CHUNK_BASES; i++)
+                  bases += reads[i].rlen;
+                parm[nused].end    = i;
               }
-            fprintf(ofile,"\n");
-
-            Uncompress_Next_QVentry(quiva,entry,coding,rlen);
 
-            if (UPPER)
-              { char *deltag = entry[1];
-                int   j;
-
-                for (j = 0; j < rlen; j++)
-                  deltag[j] -= 32;
+            if (nused == 1)
+              Decode_Thread(parm);
+            else
+              { for (t = 0; t < nused; t++)
+                  pthread_create(threads+t,NULL,Decode_Thread,parm+t);
+                for (t = 0; t < nused; t++)
+                  pthread_join(threads[t],NULL);
               }
 
-            for (e = 0; e < 5; e++)
-              fprintf(ofile,"%.*s\n",rlen,entry[e]);
+            for (t = 0; t < nused; t++)
+              fwrite(parm[t].out,1,parm[t].olen,ofile);
           }
 
+        Free_QVcoding(coding);
+        fclose(ofile);
+
         first = last;
       }
+
+    for (t = 0; t < NTHREADS; t++)
+      { Free_QV_Buffer(parm[t].entry);
+        free(parm[t].out);
+      }
+    free(threads);
+    free(parm);
   }
 
+  if (qvs != NULL)
+    munmap(qvs,qsize);
   fclose(quiva);
   fclose(dbfile);
   Close_DB(db);
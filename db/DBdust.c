@@ -52,6 +52,7 @@
 #include <strings.h>
 #include <math.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "DB.h"
 
@@ -71,11 +72,13 @@ static int Lowr[4] = { 'a', 'c', 'g', 't' };
 #endif
 static void usage()
   {
-    fprintf(stderr, "usage: [-b] [-w <int(64)>] [-t<double(2.)>] [-m<int(10)>] <path:db|dam>\n");
+    fprintf(stderr, "usage: [-b] [-w <int(64)>] [-t<double(2.)>] [-m<int(10)>] [-T<int(4)>] <path:db|dam>\n");
     fprintf(stderr, "options: -b ... biased, i.e. take into account the frequency of a given base\n");
     fprintf(stderr, "         -w ... scan window size\n");
     fprintf(stderr, "         -t ... thershold for being a low complexity interval\n");
     fprintf(stderr, "         -m ... intervals greater than -m bases are reported\n");
+    fprintf(stderr, "         -T ... number of threads\n");
+    fprintf(stderr, "a block of a split db (<path>.<block>) is dusted on its own, TKcat concatenates the block tracks\n");
   }
 
 extern char *optarg;
@@ -89,25 +92,351 @@ typedef struct _cand
     double        score;
   } Candidate;
 
+static int     WINDOW=64;
+static double  THRESH=2.;
+static int     MINLEN=9;
+static int     BIASED=0;
+static int     NTHREADS=4;
+
+static double  skew[64], thresh2r;
+static int     thresh2i;
+static double *tlen;             //  tlen[k] = THRESH * k, minimum score of an interval of k triples
+
+typedef struct
+  { HITS_DB *db;
+    int      beg, end;           //  reads [beg,end) of the thread
+    int     *ntop;               //  number of interval ends of each read
+    int     *data;               //  intervals of all reads in read order
+    int64    dlen, dmax;
+  } Dust_Arg;
+
+//  Dust reads [beg,end) into the buffers of parm.  The reads have to be accessible from
+//    several threads, i.e. the bases of db are memory mapped.
+
+static void *dust_thread(void *arg)
+{ Dust_Arg  *parm = (Dust_Arg *) arg;
+  HITS_DB   *db   = parm->db;
+  int       *mask, *mask1;
+  char      *read, *lag2;
+  int        wcount[64], lcount[64];
+  Candidate *cptr, *aptr;
+  int        i;
+
+  mask = (int *) Malloc((db->maxlen+1)*sizeof(int),"Allocating mask vector");
+  cptr = (Candidate *) Malloc((WINDOW+1)*sizeof(Candidate),"Allocating candidate vector");
+  read = New_Read_Buffer(db);
+  if (mask == NULL || cptr == NULL || read == NULL)
+    exit (1);
+
+  lag2 = read-2;
+
+  mask1 = mask+1;
+  *mask = -2;
+
+  aptr  = cptr+1;
+  for (i = 1; i < WINDOW; i++)
+    cptr[i].next = aptr+i;
+  cptr[WINDOW].next = NULL;
+
+  cptr->next = cptr->prev = cptr;
+  cptr->beg  = -2;
+
+  for (i = parm->beg; i < parm->end; i++)
+    { Candidate *lptr, *jptr;
+      int       *mtop;
+      double     mscore;
+      int        len;
+      int        wb, lb;
+      int        j, c, d;
+
+      len = db->reads[i].rlen;	  //  Fetch read
+      Load_Read(db,i,read,0);
+
+      c = (read[0] << 2) | read[1];     //   Convert to triple codes
+      for (j = 2; j < len; j++)
+        { c = ((c << 2) & 0x3f) | read[j];
+          lag2[j] = (char) c;
+        }
+      len -= 2;
+
+      bzero(wcount,sizeof(wcount));     //   Setup counter arrays
+      bzero(lcount,sizeof(lcount));
+
+      mtop = mask;                      //   The dust algorithm
+      lb   = wb   = -1;
+
+      if (BIASED)
+
+        { double lsqr, wsqr, trun;      //   Modification for high-compositional bias
+
+          wsqr = lsqr = 0.;
+          for (j = 0; j < len; j++)
+            { c = read[j];
+
+#define ADDR(e,cnt,sqr)	 sqr += (cnt[e]++) * skew[e];
+
+#define DELR(e,cnt,sqr)	 sqr -= (--cnt[e]) * skew[e];
+
+#define WADDR(e) ADDR(e,wcount,wsqr)
+#define WDELR(e) DELR(e,wcount,wsqr)
+#define LADDR(e) ADDR(e,lcount,lsqr)
+#define LDELR(e) DELR(e,lcount,lsqr)
+
+              if (j > WINDOW-3)
+                { d = read[++wb];
+                  WDELR(d)
+                }
+              WADDR(c)
+
+              if (lb < wb)
+                { d = read[++lb];
+                  LDELR(d)
+                }
+              trun  = (lcount[c]++) * skew[c];
+              lsqr += trun;
+              if (trun >= thresh2r)
+                { while (lb < j)
+                    { d = read[++lb];
+                      LDELR(d)
+                      if (d == c) break;
+                    }
+                }
+
+              jptr = cptr->prev;
+              if (jptr != cptr && jptr->beg <= wb)
+                { c = jptr->end + 2;
+                  if (*mtop+1 >= jptr->beg)
+                    { if (*mtop < c)
+                        *mtop = c;
+                    }
+                  else
+                    { *++mtop = jptr->beg;
+                      *++mtop = c;
+                    }
+                  lptr = jptr->prev;
+                  cptr->prev = lptr;
+                  lptr->next = cptr;
+                  jptr->next = aptr;
+                  aptr = jptr;
+                }
+
+              if (wsqr <= lsqr*THRESH) continue;
+
+              jptr   = cptr->next;
+              lptr   = cptr;
+              mscore = 0.;
+              for (c = lb; c > wb; c--)
+                { d = read[c];
+                  LADDR(d)
+                  if (lsqr >= tlen[j-c])
+                    { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
+                        if (jptr->score > mscore)
+                          mscore = jptr->score;
+                      if (lsqr >= mscore * (j-c))
+                        { mscore = lsqr / (j-c);
+                          if (lptr->beg == c)
+                            { lptr->end   = j;
+                              lptr->score = mscore;
+                            }
+                          else
+                            { aptr->beg   = c;
+                              aptr->end   = j;
+                              aptr->score = mscore;
+                              aptr->prev  = lptr;
+                              lptr = lptr->next = aptr;
+                              aptr = aptr->next;
+                              jptr->prev = lptr;
+                              lptr->next = jptr;
+                            }
+                        }
+                    }
+                }
+
+              for (c++; c <= lb; c++)
+                { d = read[c];
+                  LDELR(d)
+                }
+            }
+        }
+
+      else
+
+        { int lsqr, wsqr, trun;                 //  Algorithm for GC-balanced sequences
+
+          wsqr = lsqr = 0;
+          for (j = 0; j < len; j++)
+            { c = read[j];
+
+#define ADDI(e,cnt,sqr)	 sqr += (cnt[e]++);
+
+#define DELI(e,cnt,sqr)	 sqr -= (--cnt[e]);
+
+#define WADDI(e) ADDI(e,wcount,wsqr)
+#define WDELI(e) DELI(e,wcount,wsqr)
+#define LADDI(e) ADDI(e,lcount,lsqr)
+#define LDELI(e) DELI(e,lcount,lsqr)
+
+              if (j > WINDOW-3)
+                { d = read[++wb];
+                  WDELI(d)
+                }
+              WADDI(c)
+
+              if (lb < wb)
+                { d = read[++lb];
+                  LDELI(d)
+                }
+              trun  = lcount[c]++;
+              lsqr += trun;
+              if (trun >= thresh2i)
+                { while (lb < j)
+                    { d = read[++lb];
+                      LDELI(d)
+                      if (d == c) break;
+                    }
+                }
+
+              jptr = cptr->prev;
+              if (jptr != cptr && jptr->beg <= wb)
+                { c = jptr->end + 2;
+                  if (*mtop+1 >= jptr->beg)
+                    { if (*mtop < c)
+                        *mtop = c;
+                    }
+                  else
+                    { *++mtop = jptr->beg;
+                      *++mtop = c;
+                    }
+                  lptr = jptr->prev;
+                  cptr->prev = lptr;
+                  lptr->next = cptr;
+                  jptr->next = aptr;
+                  aptr = jptr;
+                }
+
+              if (wsqr <= lsqr*THRESH) continue;
+
+              jptr   = cptr->next;
+              lptr   = cptr;
+              mscore = 0.;
+              for (c = lb; c > wb; c--)
+                { d = read[c];
+                  LADDI(d)
+                  if (lsqr >= tlen[j-c])
+                    { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
+                        if (jptr->score > mscore)
+                          mscore = jptr->score;
+                      if (lsqr >= mscore * (j-c))
+                        { mscore = (1. * lsqr) / (j-c);
+                          if (lptr->beg == c)
+                            { lptr->end   = j;
+                              lptr->score = mscore;
+                            }
+                          else
+                            { aptr->beg   = c;
+                              aptr->end   = j;
+                              aptr->score = mscore;
+                              aptr->prev  = lptr;
+                              lptr = lptr->next = aptr;
+                              aptr = aptr->next;
+                              jptr->prev = lptr;
+                              lptr->next = jptr;
+                            }
+                        }
+                    }
+                }
+
+              for (c++; c <= lb; c++)
+                { d = read[c];
+                  LDELI(d)
+                }
+            }
+        }
+
+      while ((jptr = cptr->prev) != cptr)
+        { c = jptr->end + 2;
+          if (*mtop+1 >= jptr->beg)
+            { if (*mtop < c)
+                *mtop = c;
+            }
+          else
+            { *++mtop = jptr->beg;
+              *++mtop = c;
+            }
+          cptr->prev = jptr->prev;
+          jptr->prev->next = cptr;
+          jptr->next = aptr;
+          aptr = jptr;
+        }
+
+      { int *jtop, ntop;
+
+        ntop = 0;
+        for (jtop = mask1; jtop < mtop; jtop += 2)
+          if (jtop[1] - jtop[0] >= MINLEN)
+            { mask[++ntop] = jtop[0];
+              mask[++ntop] = jtop[1]+1;
+            }
+        mtop = mask + ntop;
+
+        if (parm->dlen + ntop > parm->dmax)
+          { parm->dmax = 1.2*(parm->dlen + ntop) + 1000;
+            parm->data = (int *) Realloc(parm->data,parm->dmax*sizeof(int),"Growing interval buffer");
+            if (parm->data == NULL)
+              exit (1);
+          }
+        memcpy(parm->data + parm->dlen,mask1,ntop*sizeof(int));
+        parm->dlen += ntop;
+        parm->ntop[i - parm->beg] = ntop;
+      }
+
+#ifdef DEBUG
+
+      { int *jtop;
+
+        printf("\nREAD %d\n",i);
+        for (jtop = mask1; jtop < mtop; jtop += 2)
+          printf(" [%5d,%5d]\n",jtop[0],jtop[1]);
+
+        Load_Read(db,i,read,0);
+
+        jtop = mask1;
+        for (c = 0; c < len; c++)
+          { while (jtop < mtop && c > jtop[1])
+              jtop += 2;
+            if (jtop < mtop && c >= *jtop)
+              printf("%c",Caps[(int) read[c]]);
+            else
+              printf("%c",Lowr[(int) read[c]]);
+            if ((c%80) == 79)
+              printf("\n");
+          }
+        printf("\n");
+      }
+
+#endif
+    }
+
+  free(read-1);
+  free(cptr);
+  free(mask);
+
+  return (NULL);
+}
+
 int main(int argc, char *argv[])
 { HITS_DB   _db, *db = &_db;
   FILE      *afile, *dfile;
   int64      indx;
   int        nreads;
-  int       *mask;
-  Candidate *cptr;
 
-  int        WINDOW=64;
-  double     THRESH=2.;
-  int        MINLEN=9;
-  int        BIASED=0;
 
   // parse arguments
   {
     int c;
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "bw:t:m:")) != -1)
+    while ((c = getopt(argc, argv, "bw:t:m:T:")) != -1)
       {
         switch (c)
         {
@@ -144,6 +473,16 @@ int main(int argc, char *argv[])
                 }
             }
             break;
+          case 'T':
+            {
+                NTHREADS = atoi(optarg);
+                if (NTHREADS <= 0)
+                {
+                  fprintf(stderr,"[ERROR] Number of threads must be positive (%d)\n",NTHREADS);
+                  exit(1);
+                }
+            }
+            break;
 
           default:
             fprintf(stderr,"Unsupported option: %s\n", argv[optind]);
@@ -167,11 +506,6 @@ int main(int argc, char *argv[])
       exit (1);
   }
 
-  mask = (int *) Malloc((db->maxlen+1)*sizeof(int),"Allocating mask vector");
-  cptr = (Candidate *) Malloc((WINDOW+1)*sizeof(Candidate),"Allocating candidate vector");
-  if (mask == NULL || cptr == NULL)
-    exit (1);
-
   { char *pwd, *root, *fname;
     int   size;
 
@@ -216,31 +550,20 @@ int main(int argc, char *argv[])
     free(root);
   }
 
-  { int       *mask1;
-    char      *read, *lag2;
-    int        wcount[64], lcount[64];
-    Candidate *aptr;
-    double     skew[64], thresh2r;
-    int        thresh2i;
-    int        i;
-
-    read = New_Read_Buffer(db);
-    lag2 = read-2;
-
-    mask1 = mask+1;
-    *mask = -2;
-
-    aptr  = cptr+1;
-    for (i = 1; i < WINDOW; i++)
-      cptr[i].next = aptr+i;
-    cptr[WINDOW].next = NULL;
-
-    cptr->next = cptr->prev = cptr;
-    cptr->beg  = -2;
+  { Dust_Arg  *parm;
+    pthread_t *threads;
+    int        nthreads, nnew;
+    int        i, t;
 
     thresh2r = 2.*THRESH;
     thresh2i = (int) ceil(thresh2r);
 
+    tlen = (double *) Malloc((WINDOW+1)*sizeof(double),"Allocating threshold vector");
+    if (tlen == NULL)
+      exit (1);
+    for (i = 0; i <= WINDOW; i++)
+      tlen[i] = THRESH * i;
+
     if (BIASED)
       { int a, b, c, p;
 
@@ -251,274 +574,56 @@ int main(int argc, char *argv[])
             skew[p++] = .015625 / (db->freq[a]*db->freq[b]*db->freq[c]);
       }
 
-    for (i = nreads; i < db->nreads; i++)
-      { Candidate *lptr, *jptr;
-        int       *mtop;
-        double     mscore;
-        int        len;
-        int        wb, lb;
-        int        j, c, d;
-
-        len = db->reads[i].rlen;	  //  Fetch read
-        Load_Read(db,i,read,0);
-
-        c = (read[0] << 2) | read[1];     //   Convert to triple codes
-        for (j = 2; j < len; j++)
-          { c = ((c << 2) & 0x3f) | read[j];
-            lag2[j] = (char) c;
-          }
-        len -= 2;
-
-        for (j = 0; j < 64; j++)		//   Setup counter arrays
-          wcount[j] = lcount[j] = 0;
-
-        mtop = mask;                      //   The dust algorithm
-        lb   = wb   = -1;
-
-        if (BIASED)
-
-          { double lsqr, wsqr, trun;      //   Modification for high-compositional bias
-
-            wsqr = lsqr = 0.;
-            for (j = 0; j < len; j++)
-              { c = read[j];
+    //  Split the new reads into one range per thread, the threads share the mapped bases
 
-#define ADDR(e,cnt,sqr)	 sqr += (cnt[e]++) * skew[e];
-
-#define DELR(e,cnt,sqr)	 sqr -= (--cnt[e]) * skew[e];
-
-#define WADDR(e) ADDR(e,wcount,wsqr)
-#define WDELR(e) DELR(e,wcount,wsqr)
-#define LADDR(e) ADDR(e,lcount,lsqr)
-#define LDELR(e) DELR(e,lcount,lsqr)
-
-                if (j > WINDOW-3)
-                  { d = read[++wb];
-                    WDELR(d)
-                  }
-                WADDR(c)
-
-                if (lb < wb)
-                  { d = read[++lb];
-                    LDELR(d)
-                  }
-                trun  = (lcount[c]++) * skew[c];
-                lsqr += trun;
-                if (trun >= thresh2r)
-                  { while (lb < j)
-                      { d = read[++lb];
-                        LDELR(d)
-                        if (d == c) break;
-                      }
-                  }
-
-                jptr = cptr->prev;
-                if (jptr != cptr && jptr->beg <= wb)
-                  { c = jptr->end + 2;
-                    if (*mtop+1 >= jptr->beg)
-                      { if (*mtop < c)
-                          *mtop = c;
-                      }
-                    else
-                      { *++mtop = jptr->beg;
-                        *++mtop = c;
-                      }
-                    lptr = jptr->prev;
-                    cptr->prev = lptr;
-                    lptr->next = cptr;
-                    jptr->next = aptr;
-                    aptr = jptr;
-                  }
-
-                if (wsqr <= lsqr*THRESH) continue;
-
-                jptr   = cptr->next;
-                lptr   = cptr;
-                mscore = 0.;
-                for (c = lb; c > wb; c--)
-                  { d = read[c];
-                    LADDR(d)
-                    if (lsqr >= THRESH * (j-c))
-                      { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
-                          if (jptr->score > mscore)
-                            mscore = jptr->score;
-                        if (lsqr >= mscore * (j-c))
-                          { mscore = lsqr / (j-c);
-                            if (lptr->beg == c)
-                              { lptr->end   = j;
-                                lptr->score = mscore;
-                              }
-                            else
-                              { aptr->beg   = c;
-                                aptr->end   = j;
-                                aptr->score = mscore;
-                                aptr->prev  = lptr;
-                                lptr = lptr->next = aptr;
-                                aptr = aptr->next;
-                                jptr->prev = lptr;
-                                lptr->next = jptr;
-                              }
-                          }
-                      }
-                  }
-
-                for (c++; c <= lb; c++)
-                  { d = read[c];
-                    LDELR(d)
-                  }
-              }
-          }
+    nnew     = db->nreads - nreads;
+    nthreads = NTHREADS;
+    if (nthreads > nnew)
+      nthreads = nnew;
+    if (nthreads > 1 && Map_Bases(db))
+      nthreads = 1;
 
-        else
-
-          { int lsqr, wsqr, trun;                 //  Algorithm for GC-balanced sequences
-
-            wsqr = lsqr = 0;
-            for (j = 0; j < len; j++)
-              { c = read[j];
-
-#define ADDI(e,cnt,sqr)	 sqr += (cnt[e]++);
+    parm    = (Dust_Arg *) Malloc((nthreads+1)*sizeof(Dust_Arg),"Allocating thread arguments");
+    threads = (pthread_t *) Malloc((nthreads+1)*sizeof(pthread_t),"Allocating threads");
+    if (parm == NULL || threads == NULL)
+      exit (1);
 
-#define DELI(e,cnt,sqr)	 sqr -= (--cnt[e]);
+    for (t = 0; t < nthreads; t++)
+      { parm[t].db   = db;
+        parm[t].beg  = nreads + (int) ((1.*nnew*t)/nthreads);
+        parm[t].end  = nreads + (int) ((1.*nnew*(t+1))/nthreads);
+        parm[t].ntop = (int *) Malloc((parm[t].end-parm[t].beg+1)*sizeof(int),"Allocating interval counts");
+        parm[t].data = NULL;
+        parm[t].dlen = parm[t].dmax = 0;
+        if (parm[t].ntop == NULL)
+          exit (1);
+      }
 
-#define WADDI(e) ADDI(e,wcount,wsqr)
-#define WDELI(e) DELI(e,wcount,wsqr)
-#define LADDI(e) ADDI(e,lcount,lsqr)
-#define LDELI(e) DELI(e,lcount,lsqr)
+    if (nthreads == 1)
+      dust_thread(parm);
+    else
+      { for (t = 0; t < nthreads; t++)
+          pthread_create(threads+t,NULL,dust_thread,parm+t);
+        for (t = 0; t < nthreads; t++)
+          pthread_join(threads[t],NULL);
+      }
 
-                if (j > WINDOW-3)
-                  { d = read[++wb];
-                    WDELI(d)
-                  }
-                WADDI(c)
-
-                if (lb < wb)
-                  { d = read[++lb];
-                    LDELI(d)
-                  }
-                trun  = lcount[c]++;
-                lsqr += trun;
-                if (trun >= thresh2i)
-                  { while (lb < j)
-                      { d = read[++lb];
-                        LDELI(d)
-                        if (d == c) break;
-                      }
-                  }
-
-                jptr = cptr->prev;
-                if (jptr != cptr && jptr->beg <= wb)
-                  { c = jptr->end + 2;
-                    if (*mtop+1 >= jptr->beg)
-                      { if (*mtop < c)
-                          *mtop = c;
-                      }
-                    else
-                      { *++mtop = jptr->beg;
-                        *++mtop = c;
-                      }
-                    lptr = jptr->prev;
-                    cptr->prev = lptr;
-                    lptr->next = cptr;
-                    jptr->next = aptr;
-                    aptr = jptr;
-                  }
-
-                if (wsqr <= lsqr*THRESH) continue;
-
-                jptr   = cptr->next;
-                lptr   = cptr;
-                mscore = 0.;
-                for (c = lb; c > wb; c--)
-                  { d = read[c];
-                    LADDI(d)
-                    if (lsqr >= THRESH * (j-c))
-                      { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
-                          if (jptr->score > mscore)
-                            mscore = jptr->score;
-                        if (lsqr >= mscore * (j-c))
-                          { mscore = (1. * lsqr) / (j-c);
-                            if (lptr->beg == c)
-                              { lptr->end   = j;
-                                lptr->score = mscore;
-                              }
-                            else
-                              { aptr->beg   = c;
-                                aptr->end   = j;
-                                aptr->score = mscore;
-                                aptr->prev  = lptr;
-                                lptr = lptr->next = aptr;
-                                aptr = aptr->next;
-                                jptr->prev = lptr;
-                                lptr->next = jptr;
-                              }
-                          }
-                      }
-                  }
-
-                for (c++; c <= lb; c++)
-                  { d = read[c];
-                    LDELI(d)
-                  }
-              }
-          }
+    //  Append the intervals of the threads in read order
 
-        while ((jptr = cptr->prev) != cptr)
-          { c = jptr->end + 2;
-            if (*mtop+1 >= jptr->beg)
-              { if (*mtop < c)
-                  *mtop = c;
-              }
-            else
-              { *++mtop = jptr->beg;
-                *++mtop = c;
-              }
-            cptr->prev = jptr->prev;
-            jptr->prev->next = cptr;
-            jptr->next = aptr;
-            aptr = jptr;
+    for (t = 0; t < nthreads; t++)
+      { for (i = parm[t].beg; i < parm[t].end; i++)
+          { indx += parm[t].ntop[i-parm[t].beg]*sizeof(int);
+            fwrite(&indx,sizeof(int64),1,afile);
           }
+        fwrite(parm[t].data,sizeof(int),parm[t].dlen,dfile);
 
-        { int *jtop, ntop;
-
-          ntop = 0;
-          for (jtop = mask1; jtop < mtop; jtop += 2)
-            if (jtop[1] - jtop[0] >= MINLEN)
-              { mask[++ntop] = jtop[0];
-                mask[++ntop] = jtop[1]+1;
-              }
-          mtop  = mask + ntop;
-          indx += ntop*sizeof(int);
-          fwrite(&indx,sizeof(int64),1,afile);
-          fwrite(mask1,sizeof(int),ntop,dfile);
-        }
-
-#ifdef DEBUG
-
-        { int *jtop;
-
-          printf("\nREAD %d\n",i);
-          for (jtop = mask1; jtop < mtop; jtop += 2)
-            printf(" [%5d,%5d]\n",jtop[0],jtop[1]);
-
-          Load_Read(db,i,read,0);
-
-          jtop = mask1;
-          for (c = 0; c < len; c++)
-            { while (jtop < mtop && c > jtop[1])
-                jtop += 2;
-              if (jtop < mtop && c >= *jtop)
-                printf("%c",Caps[(int) read[c]]);
-              else
-                printf("%c",Lowr[(int) read[c]]);
-              if ((c%80) == 79)
-                printf("\n");
-            }
-          printf("\n");
-        }
-
-#endif
+        free(parm[t].ntop);
+        free(parm[t].data);
       }
+
+    free(threads);
+    free(parm);
+    free(tlen);
   }
 
   fclose(afile);
@@ -54,6 +54,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/param.h>
 
 #include "DB.h"
 #include "fileUtils.h"
@@ -84,6 +85,122 @@ extern int optind, opterr, optopt;
 
 #define LAST_READ_SYMBOL   '$'
 
+#define FETCH_BATCH  (64 * 1024 * 1024)   // bases of a read list fetched ahead of the output
+#define FETCH_GAP    (256 * 1024)         // .bps bytes between two reads prefetched as one range
+
+typedef struct
+  { int   read;
+    int   beg, end;     // beg < 0 for the whole read
+    int64 seq;          // offset of its bases in the batch buffer
+  } Show_Entry;
+
+//  Read the whole read list, so that it can be fetched in the order of the .bps file
+
+static Show_Entry *load_read_list(HITS_DB *db, FILE *input, int *nentries)
+  { Read_Iterator *iter;
+    Show_Entry *list;
+    int n, nmax;
+
+    iter = init_read_iterator(input);
+    nmax = 1024;
+    list = (Show_Entry *) Malloc(sizeof(Show_Entry) * nmax, "Allocating read list");
+    if (list == NULL)
+      exit(1);
+
+    n = 0;
+    while (!next_read(iter))
+      { if (iter->read <= 0 || iter->read > db->nreads)
+          { fprintf(stderr, "[ERROR] line %d of read list, %d is not a valid index\n",
+                    iter->lineno - 1, iter->read);
+            exit(1);
+          }
+        if (n >= nmax)
+          { nmax = 1.2 * n + 1024;
+            list = (Show_Entry *) Realloc(list, sizeof(Show_Entry) * nmax, "Reallocating read list");
+            if (list == NULL)
+              exit(1);
+          }
+        list[n].read = iter->read - 1;      // the list is 1-based
+        list[n].beg  = iter->beg;
+        list[n].end  = iter->end;
+        n += 1;
+      }
+
+    free(iter);
+
+    *nentries = n;
+    return (list);
+  }
+
+static int cmp_entries(const void *a, const void *b)
+  { Show_Entry *x = *((Show_Entry **) a);
+    Show_Entry *y = *((Show_Entry **) b);
+
+    if (x->read != y->read)
+      return (x->read - y->read);
+    return ((x > y) - (x < y));
+  }
+
+//  Load the bases of the entries from beg on into buf, up to about FETCH_BATCH bases. The
+//    reads are prefetched and loaded sorted by id, with reads close to each other in the .bps
+//    file coalesced into one range. Returns the end of the batch.
+
+static int fetch_batch(HITS_DB *db, Show_Entry *list, int beg, int nentries, int ascii,
+                       char **buf, int64 *bmax, Show_Entry ***sorted, int *smax)
+  { HITS_READ *reads = db->reads;
+    Show_Entry **sort;
+    int64 size, off, last;
+    int end, n, k, first;
+
+    size = 0;
+    for (end = beg; end < nentries; end++)
+      { if (end > beg && size + reads[list[end].read].rlen + 2 > FETCH_BATCH)
+          break;
+        size += reads[list[end].read].rlen + 2;
+      }
+    n = end - beg;
+
+    if (size > *bmax)
+      { *bmax = size;
+        *buf  = (char *) Realloc(*buf, size, "Reallocating read batch");
+        if (*buf == NULL)
+          exit(1);
+      }
+    if (n > *smax)
+      { *smax   = n;
+        *sorted = (Show_Entry **) Realloc(*sorted, sizeof(Show_Entry *) * n, "Reallocating read batch");
+        if (*sorted == NULL)
+          exit(1);
+      }
+
+    sort = *sorted;
+    for (k = 0; k < n; k++)
+      sort[k] = list + beg + k;
+    qsort(sort, n, sizeof(Show_Entry *), cmp_entries);
+
+    first = 0;
+    last  = reads[sort[0]->read].boff;
+    for (k = 0; k < n; k++)
+      { HITS_READ *r = reads + sort[k]->read;
+
+        if (r->boff - last > FETCH_GAP)
+          { Prefetch_Bases(db, sort[first]->read, sort[k - 1]->read + 1);
+            first = k;
+          }
+        last = MAX(last, r->boff + COMPRESSED_LEN(r->rlen));
+      }
+    Prefetch_Bases(db, sort[first]->read, sort[n - 1]->read + 1);
+
+    off = 0;
+    for (k = 0; k < n; k++)
+      { sort[k]->seq = off;
+        Load_Read(db, sort[k]->read, *buf + off + 1, ascii);
+        off += reads[sort[k]->read].rlen + 2;
+      }
+
+    return (end);
+  }
+
 int main(int argc, char *argv[])
   {
     HITS_DB _db, *db = &_db;
@@ -99,7 +216,8 @@ int main(int argc, char *argv[])
 
     int reps, *pts;
     int input_pts;
-    Read_Iterator *iter = NULL;
+    Show_Entry *list = NULL;
+    int nentries;
     FILE *input;
     char *trim = NULL;
 
@@ -390,7 +508,10 @@ int main(int argc, char *argv[])
         if (input == NULL)
           exit(1);
 
-        iter = init_read_iterator(input);
+        list = load_read_list(db, input, &nentries);
+
+        if (DOSEQ && Map_Bases(db))
+          exit(1);
       }
     else
       {
@@ -468,6 +589,11 @@ int main(int argc, char *argv[])
         int c, b, e, i;
         int hilight, substr;
         int map;
+        Show_Entry *entry_pts;
+        char *batch;
+        Show_Entry **sorted;
+        int64 bmax;
+        int smax, bend;
         int (*iscase)(int);
         track_anno *pacbio_anno, *seqID_anno, *source_anno;
         track_data *pacbio_data, *seqID_data, *source_data;
@@ -522,16 +648,25 @@ int main(int argc, char *argv[])
         reads = db->reads;
         substr = 0;
 
+        entry_pts = NULL;
+        batch = NULL;
+        sorted = NULL;
+        bmax = smax = bend = 0;
+
         c = 0;
         while (1)
           {
             if (input_pts)
               {
-                if (next_read(iter))
+                if (c >= nentries)
                   break;
-                e = iter->read;
-                b = e - 1;
-                substr = (iter->beg >= 0);
+                if (DOSEQ && c >= bend)
+                  bend = fetch_batch(db, list, c, nentries, UPPER, &batch, &bmax, &sorted, &smax);
+                entry_pts = list + c;
+                b = entry_pts->read;
+                e = b + 1;
+                substr = (entry_pts->beg >= 0);
+                c += 1;
               }
             else
               {
@@ -640,7 +775,11 @@ int main(int argc, char *argv[])
                 if (DOQVS)
                   Load_QVentry(db, i, entry, UPPER);
                 if (DOSEQ)
-                  Load_Read(db, i, read, UPPER);
+                  { if (input_pts)
+                      memcpy(read - 1, batch + entry_pts->seq, r->rlen + 2);
+                    else
+                      Load_Read(db, i, read, UPPER);
+                  }
 
                 for (track = first; track != NULL; track = track->next)
                   {
@@ -696,8 +835,8 @@ int main(int argc, char *argv[])
 
                 if (substr)
                   {
-                    fst = iter->beg;
-                    lst = iter->end;
+                    fst = entry_pts->beg;
+                    lst = entry_pts->end;
                   }
                 else
                   {
@@ -747,12 +886,15 @@ int main(int argc, char *argv[])
                   }
               }
           }
+
+        free(batch);
+        free(sorted);
       }
 
     if (input_pts)
       {
         fclose(input);
-        free(iter);
+        free(list);
       }
     else
       free(pts);
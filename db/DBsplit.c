@@ -54,6 +54,17 @@
  *  Mod   :  New splitting definition to support incrementality, and new stub file format
  *  Date  :  April 2014
  *
+ *  With -c the number of blocks stays the one given by -s, but the cuts are placed such that
+ *  the blocks have about the same estimated alignment cost.  The daligner work of a read grows
+ *  with the square of its length, so a read costs rlen * rlen.  If a track is given with -t
+ *  (e.g. repeats), each of its bases counts -w times instead of once.  The block costs are
+ *  appended to the .db stub, where HPCdaligner picks them up.
+ *
+ *  With -a n the first n blocks are kept and only the reads after them (e.g. added by FA2db -a)
+ *  are split into new blocks, so the overlaps of the kept blocks remain valid (see HPCdaligner
+ *  -U).  The new blocks use the block size of the existing partition unless -s is given, with
+ *  -c they are balanced to the average cost of the kept blocks.
+ *
  ********************************************************************************************/
 
 #include <stdio.h>
@@ -62,6 +73,7 @@
 #include <unistd.h>
 
 #include "DB.h"
+#include "lib/tracks.h"
 
 #ifdef HIDE_FILES
 #define PATHSEP "/."
@@ -71,15 +83,67 @@
 
 #define DEF_ARG_S 200
 #define DEF_ARG_F 0
+#define DEF_ARG_W 4.0
+
+#define MAX_BLOCK_SIZE 2 // a cost balanced block holds at most this many times -s bases
 
 extern char* optarg;
 extern int optind, opterr, optopt;
 
 static void usage()
 {
-    fprintf( stderr, "usage: [-s<int(%d)>] <path:db|dam>\n", DEF_ARG_S );
+    fprintf( stderr, "usage: [-fc] [-s<int(%d)>] [-t<track>] [-w<double(%.1f)>] [-a<int>] <path:db|dam>\n", DEF_ARG_S, DEF_ARG_W );
     fprintf( stderr, "         -s ... set block size of -s * 1Mbp (default: %dMBs)\n", DEF_ARG_S );
     fprintf( stderr, "         -f ... force Yes on all interactive queries\n" );
+    fprintf( stderr, "         -c ... balance the blocks by estimated alignment cost, the number of blocks is given by -s\n" );
+    fprintf( stderr, "         -t ... interval track whose bases are weighted by -w in the cost (e.g. repeats)\n" );
+    fprintf( stderr, "         -w ... weight of the bases covered by -t (default: %.1f)\n", DEF_ARG_W );
+    fprintf( stderr, "         -a ... keep the first -a blocks, split only the reads after them into new blocks\n" );
+}
+
+// estimated alignment cost of each read
+
+static int64* read_costs( HITS_DB* db, char* trackName, double weight )
+{
+    int64* costs = (int64*)Malloc( sizeof( int64 ) * db->nreads, "Allocating read costs" );
+    HITS_TRACK* track = NULL;
+    int i;
+
+    if ( costs == NULL )
+        exit( 1 );
+
+    if ( trackName )
+    {
+        if ( ( track = track_load( db, trackName ) ) == NULL )
+        {
+            fprintf( stderr, "[ERROR] Cannot load track %s\n", trackName );
+            exit( 1 );
+        }
+    }
+
+    for ( i = 0; i < db->nreads; i++ )
+    {
+        int64 rlen = db->reads[ i ].rlen;
+        double elen = rlen;
+
+        if ( track )
+        {
+            track_anno* anno = (track_anno*)track->anno;
+            track_data* data = (track_data*)track->data;
+            track_anno b     = anno[ i ] / sizeof( track_data );
+            track_anno e     = anno[ i + 1 ] / sizeof( track_data );
+            int64 masked     = 0;
+
+            for ( ; b + 1 < e; b += 2 )
+                masked += data[ b + 1 ] - data[ b ];
+
+            elen += ( weight - 1 ) * masked;
+        }
+
+        costs[ i ] = (int64)( elen * rlen );
+    }
+
+    return costs;
 }
 
 int main( int argc, char* argv[] )
@@ -89,15 +153,26 @@ int main( int argc, char* argv[] )
     FILE *dbfile, *ixfile;
     int status;
 
-    int force = DEF_ARG_F;
-    int SIZE  = DEF_ARG_S;
+    int force      = DEF_ARG_F;
+    int SIZE       = DEF_ARG_S;
+    int COST       = 0;
+    char* TRACK    = NULL;
+    double WEIGHT  = DEF_ARG_W;
+    int APPEND     = 0; // blocks kept
+    int SIZE_SET   = 0;
+
+    // existing partition kept with -a
+
+    int nold       = 0;
+    int* obound    = NULL;
+    int64* ocost   = NULL;
 
     // parse arguments
     {
         int c;
         opterr = 0;
 
-        while ( ( c = getopt( argc, argv, "s:f" ) ) != -1 )
+        while ( ( c = getopt( argc, argv, "s:fa:ct:w:" ) ) != -1 )
         {
             switch ( c )
             {
@@ -105,9 +180,36 @@ int main( int argc, char* argv[] )
                     force = 1;
                     break;
 
+                case 'c':
+                    COST = 1;
+                    break;
+
+                case 'a':
+                    APPEND = atoi( optarg );
+                    if ( APPEND <= 0 )
+                    {
+                        fprintf( stderr, "invalid number of kept blocks %d\n", APPEND );
+                        exit( 1 );
+                    }
+                    break;
+
+                case 't':
+                    TRACK = optarg;
+                    break;
+
+                case 'w':
+                    WEIGHT = atof( optarg );
+                    if ( WEIGHT < 0 )
+                    {
+                        fprintf( stderr, "invalid track weight of %f\n", WEIGHT );
+                        exit( 1 );
+                    }
+                    break;
+
                 case 's':
                 {
-                    SIZE = atoi( optarg );
+                    SIZE     = atoi( optarg );
+                    SIZE_SET = 1;
                     if ( SIZE <= 0 )
                     {
                         fprintf( stderr, "invalid split size value of %d\n", SIZE );
@@ -177,7 +279,57 @@ int main( int argc, char* argv[] )
             SYSTEM_ERROR
 
         dbpos = ftello( dbfile );
-        if ( fscanf( dbfile, DB_NBLOCK, &nblocks ) == 1 && !force )
+        if ( APPEND )
+        {
+            int64 osize;
+            int ncost;
+
+            if ( fscanf( dbfile, DB_NBLOCK, &nblocks ) != 1 || nblocks < APPEND )
+            {
+                fprintf( stderr, "[ERROR] %s has less than %d blocks\n", argv[ optind ], APPEND );
+                exit( 1 );
+            }
+
+            if ( fscanf( dbfile, DB_PARAMS, &osize ) != 1 )
+                SYSTEM_ERROR
+
+            if ( !SIZE_SET )
+                SIZE = osize;
+
+            nold   = APPEND;
+            obound = (int*)Malloc( sizeof( int ) * ( nblocks + 1 ), "Allocating block boundaries" );
+            if ( obound == NULL )
+                exit( 1 );
+
+            for ( i = 0; i <= nblocks; i++ )
+                if ( fscanf( dbfile, DB_BDATA, obound + i ) != 1 )
+                    SYSTEM_ERROR
+
+            if ( fscanf( dbfile, DB_NCOST, &ncost ) == 1 && ncost == nblocks )
+            {
+                ocost = (int64*)Malloc( sizeof( int64 ) * nblocks, "Allocating block costs" );
+                if ( ocost == NULL )
+                    exit( 1 );
+
+                for ( i = 0; i < nblocks; i++ )
+                    if ( fscanf( dbfile, DB_CDATA, ocost + i ) != 1 )
+                        SYSTEM_ERROR
+            }
+
+            if ( obound[ nold ] >= db.ureads )
+            {
+                printf( "No reads after block %d\n", nold );
+                fclose( dbfile );
+                exit( 0 );
+            }
+
+            if ( COST && ocost == NULL )
+            {
+                fprintf( stderr, "[ERROR] -c needs the block costs of the kept blocks (DBsplit -c)\n" );
+                exit( 1 );
+            }
+        }
+        else if ( fscanf( dbfile, DB_NBLOCK, &nblocks ) == 1 && !force )
         {
             printf( "You are about to overwrite the current partition settings. This\n" );
             printf( "will invalidate any tracks, overlaps, and other derivative files.\n" );
@@ -204,26 +356,98 @@ int main( int argc, char* argv[] )
     {
         HITS_READ* reads = db.reads;
         int nreads       = db.ureads;
-        int64 size, totlen;
+        int64* costs     = NULL;
+        int64* bcost     = NULL;
+        int64 size, totlen, totcost, runcost, cost, target;
         int nblock, ireads, rlen, fno;
         int i;
 
         size = SIZE * 1000000ll;
 
-        nblock = 0;
-        totlen = 0;
-        ireads = 0;
-        fprintf( dbfile, DB_BDATA, 0 );
-        for ( i = 0; i < nreads; i++ )
+        nblock  = nold;
+        totlen  = 0;
+        totcost = 0;
+        runcost = 0;
+        cost    = 0;
+        ireads  = 0;
+        target  = 0;
+
+        // the new blocks of a partition with costs get theirs as well
+
+        if ( COST || ocost != NULL )
+        {
+            int64 bases = 0;
+            int nblocks = 0;
+
+            costs = read_costs( &db, TRACK, WEIGHT );
+
+            // as many blocks as -s alone would cut
+
+            for ( i = 0; i < nreads; i++ )
+            {
+                bases += reads[ i ].rlen;
+                totcost += costs[ i ];
+
+                if ( bases >= size )
+                {
+                    nblocks += 1;
+                    bases = 0;
+                }
+            }
+
+            if ( bases > 0 || nblocks == 0 )
+                nblocks += 1;
+
+            target = ( totcost + nblocks - 1 ) / nblocks;
+
+            // new blocks continue with the average cost of the old ones
+
+            if ( COST && nold > 0 )
+            {
+                totcost = 0;
+                for ( i = 0; i < nold; i++ )
+                    totcost += ocost[ i ];
+
+                target  = ( totcost + nold - 1 ) / nold;
+                runcost = nold * target;
+            }
+
+            bcost = (int64*)Malloc( sizeof( int64 ) * ( nreads + 1 ), "Allocating block costs" );
+            if ( bcost == NULL )
+                exit( 1 );
+        }
+
+        // cost mode cuts where the running cost passes the next multiple of the target,
+        // so the rounding does not accumulate over the blocks
+
+        if ( nold > 0 )
+        {
+            for ( i = 0; i <= nold; i++ )
+                fprintf( dbfile, DB_BDATA, obound[ i ] );
+        }
+        else
+            fprintf( dbfile, DB_BDATA, 0 );
+
+        for ( i = ( nold > 0 ) ? obound[ nold ] : 0; i < nreads; i++ )
         {
             rlen = reads[ i ].rlen;
             ireads += 1;
             totlen += rlen;
-            if ( totlen >= size )
+
+            if ( costs )
+            {
+                cost += costs[ i ];
+                runcost += costs[ i ];
+            }
+
+            if ( COST ? ( runcost >= ( nblock + 1 ) * target || totlen >= MAX_BLOCK_SIZE * size ) : totlen >= size )
             {
                 fprintf( dbfile, DB_BDATA, i + 1 );
+                if ( bcost )
+                    bcost[ nblock ] = cost;
                 totlen = 0;
                 ireads = 0;
+                cost   = 0;
                 nblock += 1;
             }
         }
@@ -231,9 +455,24 @@ int main( int argc, char* argv[] )
         if ( ireads > 0 )
         {
             fprintf( dbfile, DB_BDATA, nreads );
+            if ( bcost )
+                bcost[ nblock ] = cost;
             nblock += 1;
         }
 
+        if ( bcost )
+        {
+            for ( i = 0; i < nold; i++ )
+                bcost[ i ] = ocost[ i ];
+
+            fprintf( dbfile, DB_NCOST, nblock );
+            for ( i = 0; i < nblock; i++ )
+                fprintf( dbfile, DB_CDATA, bcost[ i ] );
+
+            free( costs );
+            free( bcost );
+        }
+
         fno = fileno( dbfile );
         if ( ftruncate( fno, ftello( dbfile ) ) < 0 )
             SYSTEM_ERROR
@@ -250,5 +489,8 @@ int main( int argc, char* argv[] )
     fclose( dbfile );
     Close_DB( &db );
 
+    free( obound );
+    free( ocost );
+
     return 0;
 }
@@ -1,47 +1,215 @@
 
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/param.h>
 #include <unistd.h>
 
 #include "DB.h"
 #include "lib/utils.h"
 
 #define DEF_ARG_B 1000
+#define DEF_ARG_J 4
 
 extern char* optarg;
 extern int optind, opterr, optopt;
 
 static void usage()
 {
-    fprintf( stderr, "usage: [-nr] [-bg <int>] <name:db|dam>\n" );
+    fprintf( stderr, "usage: [-fr] [-bgj <int>] <name:db|dam>\n" );
     fprintf( stderr, "options: -b ... bucket size of histogram length (%d)\n", DEF_ARG_B );
     fprintf( stderr, "         -g ... genome size\n" );
     fprintf( stderr, "         -r ... raw output\n" );
+    fprintf( stderr, "         -j ... threads (%d)\n", DEF_ARG_J );
+    fprintf( stderr, "         -f ... recompute the statistics instead of using the cached ones\n" );
+}
+
+typedef struct
+{
+    HITS_READ* reads;
+    int beg, end;
+    int64 ave;
+
+    int bin, nbin;
+    int* hist;
+    int64* bsum;
+    int64 dev;                  // sum of the squared deviations from ave
+
+    int* bounds;                // of the blocks, NULL if not split
+    int nblocks;
+    int* breads;
+    int64* bbases;
+    int64* bcost;
+} StatsArg;
+
+static void* stats_thread( void* arg )
+{
+    StatsArg* sa     = arg;
+    HITS_READ* reads = sa->reads;
+    int b            = 1;
+    int i;
+
+    sa->hist   = calloc( sa->nbin, sizeof( int ) );
+    sa->bsum   = calloc( sa->nbin, sizeof( int64 ) );
+    sa->breads = calloc( sa->nblocks + 1, sizeof( int ) );
+    sa->bbases = calloc( sa->nblocks + 1, sizeof( int64 ) );
+    sa->bcost  = calloc( sa->nblocks + 1, sizeof( int64 ) );
+    sa->dev    = 0;
+
+    for ( i = sa->beg; i < sa->end; i++ )
+    {
+        int64 rlen = reads[ i ].rlen;
+
+        sa->hist[ rlen / sa->bin ] += 1;
+        sa->bsum[ rlen / sa->bin ] += rlen;
+        sa->dev += ( rlen - sa->ave ) * ( rlen - sa->ave );
+
+        if ( sa->bounds )
+        {
+            while ( b < sa->nblocks && i >= sa->bounds[ b ] )
+            {
+                b += 1;
+            }
+
+            sa->breads[ b ] += 1;
+            sa->bbases[ b ] += rlen;
+            sa->bcost[ b ] += rlen * rlen;
+        }
+    }
+
+    return NULL;
+}
+
+// histogram and block totals of the reads, each thread covers a range of the reads
+
+static void compute_stats( HITS_DB* db, char* path, int bin, int nthreads, DB_STATS* stats )
+{
+    HITS_READ* reads = db->reads;
+    int nreads       = db->nreads;
+    int* bounds      = NULL;
+    int i, j;
+
+    bzero( stats, sizeof( DB_STATS ) );
+
+    stats->nreads = nreads;
+    stats->totlen = db->totlen;
+    stats->maxlen = db->maxlen;
+    stats->ave    = nreads > 0 ? db->totlen / nreads : 0;
+    stats->bin    = bin;
+    stats->nbin   = db->maxlen / bin + 1;
+
+    for ( i = 0; i < 4; i++ )
+    {
+        stats->freq[ i ] = db->freq[ i ];
+    }
+
+    if ( db->part == 0 )
+    {
+        bounds = DB_Block_Bounds( path, &( stats->nblocks ) );
+
+        if ( bounds != NULL && bounds[ stats->nblocks ] > nreads )
+        {
+            free( bounds );
+            bounds         = NULL;
+            stats->nblocks = 0;
+        }
+    }
+
+    nthreads = MAX( 1, MIN( nthreads, nreads ) );
+
+    StatsArg* args     = malloc( sizeof( StatsArg ) * nthreads );
+    pthread_t* threads = malloc( sizeof( pthread_t ) * nthreads );
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        StatsArg* sa = args + i;
+
+        sa->reads   = reads;
+        sa->beg     = (int64)nreads * i / nthreads;
+        sa->end     = (int64)nreads * ( i + 1 ) / nthreads;
+        sa->ave     = stats->ave;
+        sa->bin     = bin;
+        sa->nbin    = stats->nbin;
+        sa->bounds  = bounds;
+        sa->nblocks = stats->nblocks;
+
+        pthread_create( threads + i, NULL, stats_thread, sa );
+    }
+
+    stats->hist   = calloc( stats->nbin, sizeof( int ) );
+    stats->bsum   = calloc( stats->nbin, sizeof( int64 ) );
+    stats->breads = calloc( stats->nblocks + 1, sizeof( int ) );
+    stats->bbases = calloc( stats->nblocks + 1, sizeof( int64 ) );
+    stats->bcost  = calloc( stats->nblocks + 1, sizeof( int64 ) );
+
+    int64 dev = 0;
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        StatsArg* sa = args + i;
+
+        pthread_join( threads[ i ], NULL );
+
+        for ( j = 0; j < stats->nbin; j++ )
+        {
+            stats->hist[ j ] += sa->hist[ j ];
+            stats->bsum[ j ] += sa->bsum[ j ];
+        }
+
+        for ( j = 1; j <= stats->nblocks; j++ )
+        {
+            stats->breads[ j ] += sa->breads[ j ];
+            stats->bbases[ j ] += sa->bbases[ j ];
+            stats->bcost[ j ] += sa->bcost[ j ];
+        }
+
+        dev += sa->dev;
+
+        free( sa->hist );
+        free( sa->bsum );
+        free( sa->breads );
+        free( sa->bbases );
+        free( sa->bcost );
+    }
+
+    stats->dev = nreads > 0 ? (int64)sqrt( ( 1. * dev ) / nreads ) : 0;
+
+    free( bounds );
+    free( args );
+    free( threads );
 }
 
 int main( int argc, char* argv[] )
 {
     HITS_DB _db, *db = &_db;
+    DB_STATS _stats, *stats = &_stats;
     int dam;
 
     int nbin, *hist;
     int64* bsum;
 
-    int BIN     = DEF_ARG_B;
-    int64 GSIZE = -1;
-    int raw = 0;
+    int BIN      = DEF_ARG_B;
+    int64 GSIZE  = -1;
+    int raw      = 0;
+    int nthreads = DEF_ARG_J;
+    int force    = 0;
 
     // parse arguments
 
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "rb:g:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "frb:g:j:" ) ) != -1 )
     {
         switch ( c )
         {
+            case 'f':
+                force = 1;
+                break;
+
             case 'r':
                 raw = 1;
                 break;
@@ -64,6 +232,15 @@ int main( int argc, char* argv[] )
                 }
                 break;
 
+            case 'j':
+                nthreads = atoi( optarg );
+                if ( nthreads <= 0 )
+                {
+                    fprintf( stderr, "Invalid number of threads %d\n", nthreads );
+                    exit( 1 );
+                }
+                break;
+
             default:
                 fprintf( stderr, "Unsupported argument: %s\n", argv[ optind ] );
                 usage();
@@ -80,15 +257,41 @@ int main( int argc, char* argv[] )
 
     int i, status;
 
-    //  Open .db or .dam
+    //  Use the cached statistics if they are current and binned alike,
+    //  otherwise open the .db or .dam and compute them
 
-    status = Open_DB( argv[ optind ], db );
-    if ( status < 0 )
+    bzero( stats, sizeof( DB_STATS ) );
+
+    if ( !force && DB_Stats_Load( argv[ optind ], stats ) == 0 && stats->bin != BIN )
     {
-        exit( 1 );
+        DB_Stats_Free( stats );
     }
 
-    dam = status;
+    if ( stats->bin == BIN )
+    {
+        dam = stats->dam;
+    }
+    else
+    {
+        status = Open_DB( argv[ optind ], db );
+        if ( status < 0 )
+        {
+            exit( 1 );
+        }
+
+        dam = status;
+
+        compute_stats( db, argv[ optind ], BIN, nthreads, stats );
+
+        // best effort, the DB's directory might not be writable
+
+        if ( db->part == 0 )
+        {
+            DB_Stats_Write( argv[ optind ], stats );
+        }
+
+        Close_DB( db );
+    }
 
     if ( raw && dam )
     {
@@ -99,46 +302,29 @@ int main( int argc, char* argv[] )
     int64 totlen;
     int nreads, maxlen;
     int64 ave, dev;
-    HITS_READ* reads;
     int64* cum;
     int64* btot;
 
-    nreads = db->nreads;
-    totlen = db->totlen;
-    maxlen = db->maxlen;
-    reads  = db->reads;
+    nreads = stats->nreads;
+    totlen = stats->totlen;
+    maxlen = stats->maxlen;
+    ave    = stats->ave;
+    dev    = stats->dev;
+    hist   = stats->hist;
+    bsum   = stats->bsum;
 
-    nbin = maxlen / BIN + 1;
-    hist = (int*)Malloc( sizeof( int ) * nbin, "Allocating histograms" );
-    bsum = (int64*)Malloc( sizeof( int64 ) * nbin, "Allocating histograms" );
+    nbin = stats->nbin;
     btot = malloc( sizeof( int64 ) * nbin );
     cum  = malloc( sizeof( int64 ) * nbin );
-    if ( !hist || !bsum || !btot || !cum )
+    if ( !btot || !cum )
     {
         exit( 1 );
     }
 
-    bzero( hist, sizeof( int ) * nbin );
-    bzero( bsum, sizeof( uint64 ) * nbin );
     bzero( cum, sizeof( uint64 ) * nbin );
     bzero( btot, sizeof( uint64 ) * nbin );
 
-    for ( i = 0; i < nreads; i++ )
-    {
-        int rlen = reads[ i ].rlen;
-        hist[ rlen / BIN ] += 1;
-        bsum[ rlen / BIN ] += rlen;
-    }
-
     nbin = ( maxlen - 1 ) / BIN + 1;
-    ave  = totlen / nreads;
-    dev  = 0;
-    for ( i = 0; i < nreads; i++ )
-    {
-        int rlen = reads[ i ].rlen;
-        dev += ( rlen - ave ) * ( rlen - ave );
-    }
-    dev = (int64)sqrt( ( 1. * dev ) / nreads );
 
     int64 _cum  = 0;
     int64 _btot = 0;
@@ -168,11 +354,11 @@ int main( int argc, char* argv[] )
 
     if (raw)
     {
-        printf( "A %.3f C %.3f G %.3f T %.3f\n", db->freq[ 0 ], db->freq[ 1 ], db->freq[ 2 ], db->freq[ 3 ] );
+        printf( "A %.3f C %.3f G %.3f T %.3f\n", stats->freq[ 0 ], stats->freq[ 1 ], stats->freq[ 2 ], stats->freq[ 3 ] );
     }
     else
     {
-        printf( "Base composition: %.3f(A) %.3f(C) %.3f(G) %.3f(T)\n", db->freq[ 0 ], db->freq[ 1 ], db->freq[ 2 ], db->freq[ 3 ] );
+        printf( "Base composition: %.3f(A) %.3f(C) %.3f(G) %.3f(T)\n", stats->freq[ 0 ], stats->freq[ 1 ], stats->freq[ 2 ], stats->freq[ 3 ] );
         printf( "\nDistribution of Read Lengths (Bin size = %d)\n\n", BIN );
 
         printf( "%11s %11s %7s %7s %9s", "Bin", "Count", "% Reads", "% Bases", "Average" );
@@ -228,12 +414,9 @@ int main( int argc, char* argv[] )
         }
     }
 
-    free( hist );
-    free( bsum );
+    DB_Stats_Free( stats );
     free(btot);
     free(cum);
 
-    Close_DB( db );
-
     exit( 0 );
 }
@@ -65,6 +65,9 @@
 #include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
+#include <zlib.h>
 
 #include "DB.h"
 #include "fileUtils.h"
@@ -79,6 +82,7 @@
 #endif
 
 #define DEF_OPT_X 1000
+#define DEF_OPT_J 4
 
 extern char* optarg;
 extern int optind, opterr, optopt;
@@ -149,6 +153,25 @@ void initPacbioRead(pacbio_read* read, int createTracks)
     }
 }
 
+void freePacbioRead(pacbio_read* read)
+{
+    int i;
+    for (i = 0; i < read->maxtracks; i++)
+    {
+        free(read->trackName[i]);
+        free(read->trackfields[i]);
+    }
+
+    if (read->maxtracks > 0)
+    {
+        free(read->trackName);
+        free(read->trackfields);
+    }
+
+    free(read->prolog);
+    free(read->seq);
+}
+
 void resetPacbioRead(pacbio_read* pr)
 {
     pr->ntracks = 0;
@@ -582,322 +605,899 @@ void initDB( int argc, char** argv, CreateContext* ctx )
         }
     }
 
-    ctx->pr1 = (pacbio_read*)malloc( sizeof( pacbio_read ) );
-    ctx->pr2 = (pacbio_read*)malloc( sizeof( pacbio_read ) );
+}
 
-    initPacbioRead( ctx->pr1, ctx->t_create_n );
-    initPacbioRead( ctx->pr2, ctx->t_create_n );
+/*******************************************************************************************
+ *
+ *  Import pipeline:
+ *     reader threads parse the input files (fasta or fastq, optionally gzip compressed) and
+ *     collect the reads that pass the filters into batches. worker threads convert and
+ *     compress the batches, and the main thread appends them to the .bps and .idx files in
+ *     input order. the resulting DB does not depend on the number of threads.
+ *
+ ********************************************************************************************/
 
-    ctx->rmax = MAX_NAME + 60000;
-    ctx->read = (char*)malloc( ctx->rmax + 1 );
-    if ( ctx->read == NULL )
-    {
-        fprintf( stderr, "[Error] Cannot allocate read buffer\n" );
-        exit( 1 );
-    }
+#define IMPORT_BUFFER       ( 4 * 1024 * 1024 )     // input buffer of a reader
+#define IMPORT_BATCH_BASES  ( 8 * 1024 * 1024 )     // bases in a batch
+#define IMPORT_BATCHES      4                       // batches in flight per thread
+
+#define IMPORT_OK           0
+#define IMPORT_EMPTY        1                       // file without reads, skipped
+#define IMPORT_ERROR        2                       // message printed, abort when reached
+
+typedef struct
+{
+    int len;
+    int seqIDinFasta;
+    int hasPacbioHeader;
+    int well, beg, end;
+
+    int ntracks;
+    uint64 toff;                // [name offset] [nvalues] [values] for each track in tdata
+    uint64 soff;                // sequence in seq, compressed in place by the workers
+} import_read;
+
+typedef struct import_batch
+{
+    int file;                   // index of the input file
+    int num;                    // number of the batch in the file
+    int last;                   // last batch of the file
+    int status;
+    int done;                   // compressed
+
+    char* core;                 // first batch only, file name and prolog
+    char* prolog;
+
+    import_read* reads;
+    int nreads;
+    int maxreads;
+
+    char* seq;
+    uint64 nseq;
+    uint64 maxseq;
+
+    int* tdata;
+    uint64 ntdata;
+    uint64 maxtdata;
+
+    char* tnames;
+    uint64 ntnames;
+    uint64 maxtnames;
+
+    int64 count[ 4 ];
+
+    struct import_batch* next;
+} import_batch;
+
+typedef struct
+{
+    CreateContext* ctx;
+
+    char** files;
+    int nfiles;
+    int nextfile;               // next file to be claimed by a reader
+
+    int maxbatches;
+    int nbatches;               // in flight
+
+    import_batch* todo;         // waiting for a worker
+    import_batch* todo_last;
+    import_batch* ready;        // handed to the workers or compressed
+
+    int wfile;                  // position of the writer
+    int wseq;
+
+    int nreaders;               // readers still running
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} import_queue;
+
+typedef struct
+{
+    gzFile file;
+
+    char* buf;
+    int len;
+    int pos;
+    int max;
+    int eof;
+} import_input;
+
+static import_batch* batch_new( int file, int num )
+{
+    import_batch* batch = calloc( 1, sizeof( import_batch ) );
+
+    batch->file = file;
+    batch->num  = num;
+
+    return batch;
+}
+
+static void batch_free( import_batch* batch )
+{
+    free( batch->core );
+    free( batch->prolog );
+    free( batch->reads );
+    free( batch->seq );
+    free( batch->tdata );
+    free( batch->tnames );
+    free( batch );
 }
 
-static void addReadToDB( CreateContext* ctx, pacbio_read* prBest )
+static void* batch_grow( void* ptr, uint64* max, uint64 need, size_t size )
 {
-    int i, x;
-    for ( i = 0; i < prBest->len; i++ )
+    if ( need > *max )
     {
-        x = number[ (int)prBest->seq[ i ] ];
-        ctx->count[ x ] += 1;
-        prBest->seq[ i ] = (char)x;
+        *max = need * 1.2 + 1000;
+        ptr  = realloc( ptr, *max * size );
+
+        if ( ptr == NULL )
+        {
+            fprintf( stderr, "[ERROR] - Unable to allocate import buffer\n" );
+            exit( 1 );
+        }
     }
 
-    HITS_READ hr;
-    hr.boff  = ctx->offset;
-    hr.rlen  = prBest->len;
-    hr.coff  = -1;
-    hr.flags = DB_BEST;
+    return ptr;
+}
 
-    Compress_Read( prBest->len, prBest->seq );
-    size_t clen = COMPRESSED_LEN( prBest->len );
+// append a read that passed the filters
 
-    if ( fwrite( prBest->seq, 1, clen, ctx->bases ) != clen )
+static void batch_add( import_batch* batch, pacbio_read* pr )
+{
+    if ( batch->nreads == batch->maxreads )
     {
-        fprintf( stderr, "[ERROR] - Unable to write compressed sequence (%s, %d) to database\n", prBest->prolog, prBest->seqIDinFasta );
-        exit( 1 );
+        batch->maxreads = batch->maxreads * 1.2 + 1000;
+        batch->reads    = realloc( batch->reads, sizeof( import_read ) * batch->maxreads );
     }
-    if ( fwrite( &hr, sizeof( HITS_READ ), 1, ctx->indx ) != 1 )
+
+    import_read* r = batch->reads + batch->nreads;
+
+    r->len             = pr->len;
+    r->seqIDinFasta    = pr->seqIDinFasta;
+    r->hasPacbioHeader = pr->hasPacbioHeader;
+    r->well            = pr->well;
+    r->beg             = pr->beg;
+    r->end             = pr->end;
+    r->ntracks         = pr->ntracks;
+    r->toff            = batch->ntdata;
+    r->soff            = batch->nseq;
+
+    // room for Compress_Read's look ahead
+
+    batch->seq = batch_grow( batch->seq, &( batch->maxseq ), batch->nseq + pr->len + 4, 1 );
+    memcpy( batch->seq + batch->nseq, pr->seq, pr->len );
+    bzero( batch->seq + batch->nseq + pr->len, 4 );
+    batch->nseq += pr->len + 4;
+
+    int i;
+    for ( i = 0; i < pr->ntracks; i++ )
     {
-        fprintf( stderr, "[ERROR] - Unable to write HITS_READ (%s, %d) to database\n", prBest->prolog, prBest->seqIDinFasta );
-        exit( 1 );
+        int nvalues = pr->trackfields[ i ][ 1 ] - 2;
+        size_t nlen = strlen( pr->trackName[ i ] ) + 1;
+
+        batch->tnames = batch_grow( batch->tnames, &( batch->maxtnames ), batch->ntnames + nlen, 1 );
+        batch->tdata  = batch_grow( batch->tdata, &( batch->maxtdata ), batch->ntdata + nvalues + 2, sizeof( int ) );
+
+        batch->tdata[ batch->ntdata++ ] = batch->ntnames;
+        batch->tdata[ batch->ntdata++ ] = nvalues;
+
+        memcpy( batch->tnames + batch->ntnames, pr->trackName[ i ], nlen );
+        batch->ntnames += nlen;
+
+        memcpy( batch->tdata + batch->ntdata, pr->trackfields[ i ] + 2, sizeof( int ) * nvalues );
+        batch->ntdata += nvalues;
     }
 
-    add_to_track( ctx, find_track( ctx, TRACK_SEQID ), ctx->ureads, prBest->seqIDinFasta );
-    if ( prBest->hasPacbioHeader )
+    batch->nreads += 1;
+}
+
+// hand a batch to the workers, readers of files ahead of the writer wait while too many batches are in flight
+
+static void queue_push( import_queue* queue, import_batch* batch )
+{
+    pthread_mutex_lock( &queue->lock );
+
+    while ( queue->nbatches >= queue->maxbatches && batch->file != queue->wfile )
     {
-        add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, prBest->well );
-        add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, prBest->beg );
-        add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, prBest->end );
+        pthread_cond_wait( &queue->changed, &queue->lock );
     }
 
-    for ( i = 0; i < prBest->ntracks; i++ )
+    queue->nbatches += 1;
+
+    if ( queue->todo == NULL )
+        queue->todo = batch;
+    else
+        queue->todo_last->next = batch;
+
+    queue->todo_last = batch;
+    batch->next      = NULL;
+
+    pthread_cond_broadcast( &queue->changed );
+    pthread_mutex_unlock( &queue->lock );
+}
+
+// next line of the input without its line break, or NULL at the end of the file
+
+static char* input_line( import_input* in, int* _len )
+{
+    while ( 1 )
     {
-        int j;
-        for ( j = 2; j < prBest->trackfields[ i ][ 1 ]; j++ )
-            add_to_track( ctx, find_track( ctx, prBest->trackName[ i ] ), ctx->ureads, prBest->trackfields[ i ][ j ] );
-    }
+        char* eol = memchr( in->buf + in->pos, '\n', in->len - in->pos );
+
+        if ( eol != NULL || ( in->eof && in->pos < in->len ) )
+        {
+            char* line = in->buf + in->pos;
+            int len;
+
+            if ( eol == NULL )
+            {
+                eol = in->buf + in->len;
+            }
+
+            len     = eol - line;
+            in->pos = len + 1 + in->pos;
+
+            if ( len > 0 && line[ len - 1 ] == '\r' )
+            {
+                len -= 1;
+            }
+
+            line[ len ] = '\0';
+            *_len       = len;
+
+            return line;
+        }
+
+        if ( in->eof )
+        {
+            return NULL;
+        }
+
+        // keep the partial line and refill the buffer
+
+        memmove( in->buf, in->buf + in->pos, in->len - in->pos );
+        in->len -= in->pos;
+        in->pos = 0;
 
-    ctx->offset += clen;
-    ctx->ureads += 1;
-    ctx->totlen += prBest->len;
-    if ( prBest->len > ctx->maxlen )
-        ctx->maxlen = prBest->len;
+        if ( in->len == in->max )
+        {
+            in->max *= 2;
+            in->buf = realloc( in->buf, in->max + 1 );
+        }
+
+        int n = gzread( in->file, in->buf + in->len, in->max - in->len );
+
+        if ( n < 0 )
+        {
+            return NULL;
+        }
+
+        if ( n == 0 )
+        {
+            in->eof = 1;
+        }
+
+        in->len += n;
+    }
 }
 
-static void readFastaFile( CreateContext* ctx, char* name )
+// open <path>/<core><suffix> for the known fasta and fastq suffixes
+
+static gzFile input_open( char* name, char** _core )
 {
-    FILE* input;
-    char *path, *core, *prolog;
-    int nline, eof, rlen;
+    static char* suffix[] = { ".fasta", ".fa", ".fastq", ".fq",
+                              ".fasta.gz", ".fa.gz", ".fastq.gz", ".fq.gz", NULL };
+    char* path = PathTo( name );
+    char* full = malloc( strlen( path ) + strlen( name ) + 32 );
+    gzFile file = NULL;
+    int i;
 
-    //  Open it: <path>/<core>.fasta, check that core is not too long,
-    //           and checking that it is not already in flist.
+    // Catenate's buffer is shared, readers build their own paths
 
-    path = PathTo( name );
-    core = Root( name, ".fasta" );
-    if ( ( input = fopen( Catenate( path, "/", core, ".fasta" ), "r" ) ) == NULL )
+    for ( i = 0; suffix[ i ] != NULL && file == NULL; i++ )
     {
-        core = Root( name, ".fa" );
-        if ( ( input = fopen( Catenate( path, "/", core, ".fa" ), "r" ) ) == NULL )
-            errorExit( ctx );
+        char* core = Root( name, suffix[ i ] );
+
+        sprintf( full, "%s/%s%s", path, core, suffix[ i ] );
+
+        if ( ( file = gzopen( full, "r" ) ) != NULL )
+        {
+            *_core = core;
+        }
+        else
+        {
+            free( core );
+        }
     }
+
+    free( full );
     free( path );
 
-    if ( strlen( core ) >= MAX_NAME )
+    return file;
+}
+
+// set the sequence of pr from the line buffer
+
+static void set_sequence( pacbio_read* pr, char* seq, int len )
+{
+    if ( len >= pr->maxSequenceLen )
+    {
+        pr->maxSequenceLen = ( (int)( 1.2 * len ) ) + 1000 + MAX_NAME;
+        pr->seq            = (char*)realloc( pr->seq, pr->maxSequenceLen + 1 );
+
+        if ( pr->seq == NULL )
+        {
+            fprintf( stderr, "[ERROR] - Out of memory (Allocating sequence buffer)\n" );
+            exit( 1 );
+        }
+    }
+
+    memcpy( pr->seq, seq, len );
+    pr->len = len;
+}
+
+static int keep_read( CreateContext* ctx, pacbio_read* pr, int rlen )
+{
+    if ( rlen < ctx->opt_min_length )
     {
-        fprintf( stderr, "File name over %d chars: '%.200s'\n",
-                 MAX_NAME, core );
-        errorExit( ctx );
+        if ( ctx->VERBOSE > 1 )
+        {
+            fprintf( stderr, "Warning: skipping read of length %d\n", rlen );
+        }
+        return 0;
     }
 
+    if ( ctx->t_create_n && ctx->useFullHqReadsOnly )
     {
-        int j;
+        int i;
 
-        for ( j = 0; j < ctx->ofiles; j++ )
-            if ( strcmp( core, ctx->flist[ j ] ) == 0 )
+        for ( i = 0; i < pr->ntracks; i++ )
+        {
+            if ( strcmp( pr->trackName[ i ], "readType" ) == 0 )
             {
-                fprintf( stderr, "File %s.fasta is already in database %s.db\n", core, Root( ctx->dbname, ".db" ) );
-                errorExit( ctx );
+                break;
             }
+        }
+
+        // ignore reads that do not have the readType attribute
+        if ( i == pr->ntracks )
+            return 0;
+
+        // ignore reads that have not the proper format of readType argument
+        if ( pr->trackfields[ i ][ 1 ] != 3 )
+            return 0;
+
+        // TODO use enum from dextractUtils
+        // typedef enum { type_Empty = 0, type_FullHqRead0 = 1, type_FullHqRead1 = 2, type_PartialHqRead0 = 3, type_PartialHqRead1 = 4, type_PartialHqRead2 = 5, type_Multiload = 6, type_Indeterminate = 7, type_NotDefined = 255} readType ;
+        if ( pr->trackfields[ i ][ 2 ] != 1 && pr->trackfields[ i ][ 2 ] != 2 )
+            return 0;
     }
 
-    //  Get the header of the first line.  If the file is empty skip.
+    return 1;
+}
 
-    rlen  = 0;
-    nline = 1;
-    eof   = ( fgets( ctx->read, MAX_NAME, input ) == NULL );
-    if ( eof || strlen( ctx->read ) < 1 )
+static void readInputFile( import_queue* queue, int fidx, pacbio_read* pr1, pacbio_read* pr2, import_input* in )
+{
+    CreateContext* ctx  = queue->ctx;
+    import_batch* batch = batch_new( fidx, 0 );
+    char* core          = NULL;
+    char* line;
+    int len, nline;
+
+    if ( ( in->file = input_open( queue->files[ fidx ], &core ) ) == NULL )
     {
-        fprintf( stderr, "Skipping '%s', file is empty!\n", core );
-        fclose( input );
-        free( core );
+        fprintf( stderr, "Cannot open %s as a fasta or fastq file\n", queue->files[ fidx ] );
+        batch->status = IMPORT_ERROR;
+        batch->last   = 1;
+        queue_push( queue, batch );
         return;
     }
 
-    //   Add the file name to flist
+    gzbuffer( in->file, IMPORT_BUFFER );
+
+    in->len = in->pos = in->eof = 0;
+    batch->core = core;
 
-    if ( ctx->VERBOSE )
+    if ( strlen( core ) >= MAX_NAME )
     {
-        fprintf( stderr, "Adding '%s' ...\n", core );
-        fflush( stderr );
+        fprintf( stderr, "File name over %d chars: '%.200s'\n", MAX_NAME, core );
+        batch->status = IMPORT_ERROR;
     }
-    ctx->flist[ ctx->ofiles++ ] = core;
 
-    // Check that the first line has PACBIO format, and record prolog in 'prolog'.
+    //  Get the header of the first line.  If the file is empty skip.
 
-    if ( ctx->read[ strlen( ctx->read ) - 1 ] != '\n' )
+    nline = 1;
+    line  = input_line( in, &len );
+
+    if ( batch->status == IMPORT_OK && ( line == NULL || len < 1 ) )
+    {
+        batch->status = IMPORT_EMPTY;
+    }
+
+    if ( batch->status == IMPORT_OK && len > MAX_NAME - 2 )
     {
-        fprintf( stderr, "File %s.fasta, Line 1: Fasta line is too long (> %d chars)\n", core, MAX_NAME - 2 );
-        errorExit( ctx );
+        fprintf( stderr, "File %s, Line 1: Fasta line is too long (> %d chars)\n", core, MAX_NAME - 2 );
+        batch->status = IMPORT_ERROR;
     }
 
-    if ( !eof && ctx->read[ 0 ] != '>' )
+    if ( batch->status == IMPORT_OK && line[ 0 ] != '>' && line[ 0 ] != '@' )
     {
-        fprintf( stderr, "File %s.fasta, Line 1: First header in fasta file is missing\n", core );
-        errorExit( ctx );
+        fprintf( stderr, "File %s, Line 1: First header in fasta file is missing\n", core );
+        batch->status = IMPORT_ERROR;
     }
 
-    if ( isPacBioHeader( ctx->read + 1 ) )
+    if ( batch->status != IMPORT_OK )
+    {
+        gzclose( in->file );
+        batch->last = 1;
+        queue_push( queue, batch );
+        return;
+    }
+
+    int fastq = ( line[ 0 ] == '@' );
+
+    // Check that the first line has PACBIO format, and record prolog in 'prolog'.
+
+    if ( isPacBioHeader( line + 1 ) )
     {
         char* find;
-        find   = index( ctx->read + 1, '/' );
-        *find  = '\0';
-        prolog = Strdup( ctx->read + 1, "Extracting prolog" );
-        *find  = '/';
+        find          = index( line + 1, '/' );
+        *find         = '\0';
+        batch->prolog = Strdup( line + 1, "Extracting prolog" );
+        *find         = '/';
     }
     else
     {
-        prolog = Strdup( "DAZZ_READ", "Extracting prolog" );
+        batch->prolog = Strdup( "DAZZ_READ", "Extracting prolog" );
     }
 
     //  Read in all the sequences until end-of-file
 
     pacbio_read *prBest, *prNext;
-    prNext = ctx->pr1;
-    prBest = ( ctx->BEST ) ? NULL : ctx->pr1;
+    prNext = pr1;
+    prBest = ( ctx->BEST ) ? NULL : pr1;
 
+    pr1->seqIDinFasta = -1;
+    pr2->seqIDinFasta = -1;
+
+    int hmax    = MAX_NAME + 2;
+    char* hbuf  = malloc( hmax );
+    int smax    = MAX_NAME + 60000;
+    char* sbuf  = malloc( smax + 1 );
+    int nbatch  = 0;
+
+    while ( line != NULL )
     {
-        ctx->pr1->seqIDinFasta = -1;
-        ctx->pr2->seqIDinFasta = -1;
-        while ( !eof )
+        // parse header, as the fasta parser did including the line break
+
+        if ( len + 2 > hmax )
         {
-            // parse header
-            parse_header( ctx, ctx->read + ( rlen + 1 ), prNext );
-            prNext->seqIDinFasta += 1;
+            hmax = len + 1000;
+            hbuf = realloc( hbuf, hmax );
+        }
+
+        memcpy( hbuf, line + 1, len - 1 );
+        hbuf[ len - 1 ] = '\n';
+        hbuf[ len ]     = '\0';
+
+        parse_header( ctx, hbuf, prNext );
+        prNext->seqIDinFasta += 1;
 
-            rlen = 0;
-            while ( 1 )
+        int rlen = 0;
+        int qlen = 0;
+
+        while ( ( line = input_line( in, &len ) ) != NULL )
+        {
+            nline += 1;
+
+            if ( fastq ? line[ 0 ] == '+' : line[ 0 ] == '>' )
             {
-                char* line = NULL;
-                size_t linelen;
-                line = fgetln(input, &linelen);
+                break;
+            }
 
-                if (!line)
-                {
-                    eof = 1;
-                    break;
-                }
+            if ( rlen + len > smax )
+            {
+                smax = 1.2 * ( rlen + len ) + 1000;
+                sbuf = realloc( sbuf, smax + 1 );
+            }
 
-                if ( rlen + linelen > (size_t)ctx->rmax )
-                {
-                    ctx->rmax = 1.2 * (rlen + linelen) + 1000;
-                    ctx->read = realloc( ctx->read, ctx->rmax + 1 );
-                    if ( ctx->read == NULL )
-                    {
-                        fprintf( stderr, "File %s.fasta, Line %d:", core, nline );
-                        fprintf( stderr, "Out of memory (Allocating line buffer of %d bytes)\n", ctx->rmax );
-                        errorExit( ctx );
-                    }
-                }
+            memcpy( sbuf + rlen, line, len );
+            rlen += len;
+        }
 
-                if ( line[0] == '>' )
-                {
-                    memcpy(ctx->read + rlen, line, linelen + 1);
-                }
-                else if ( line[linelen - 1] == '\n' )
-                {
-                    line[linelen - 1] = '\0';
-                    linelen -= 1;
+        if ( fastq )
+        {
+            // quality values, which may start with '@', up to the length of the sequence
 
-                    memcpy(ctx->read + rlen, line, linelen);
-                }
+            if ( line == NULL )
+            {
+                fprintf( stderr, "File %s, Line %d: Fastq record without quality values\n", core, nline );
+                batch->status = IMPORT_ERROR;
+                break;
+            }
 
+            while ( qlen < rlen && ( line = input_line( in, &len ) ) != NULL )
+            {
                 nline += 1;
+                qlen += len;
+            }
 
-                if (line[0] == '>')
-                {
-                    break;
-                }
+            while ( ( line = input_line( in, &len ) ) != NULL && len == 0 )
+            {
+                nline += 1;
+            }
 
-                rlen += linelen;
+            if ( line != NULL && line[ 0 ] != '@' )
+            {
+                fprintf( stderr, "File %s, Line %d: Fastq header is missing\n", core, nline );
+                batch->status = IMPORT_ERROR;
+                break;
             }
+        }
 
-            if ( rlen < ctx->opt_min_length )
+        if ( !keep_read( ctx, prNext, rlen ) )
+        {
+            continue;
+        }
+
+        set_sequence( prNext, sbuf, rlen );
+
+        if ( ctx->BEST )
+        {
+            if ( prBest == NULL )
+            {
+                prBest = prNext;
+                prNext = ( prBest == pr1 ) ? pr2 : pr1;
+                continue;
+            }
+            else if ( prBest->well == prNext->well )
             {
-                if ( ctx->VERBOSE > 1 )
+                if ( prBest->len < prNext->len )
                 {
-                    fprintf( stderr, "Warning: skipping read of length %d\n", rlen );
+                    prBest = prNext;
+                    prNext = ( prBest == pr1 ) ? pr2 : pr1;
                 }
                 continue;
             }
+        }
 
-            if ( ctx->t_create_n && ctx->useFullHqReadsOnly )
-            {
-                int i;
+        batch_add( batch, prBest );
 
-                for ( i = 0; i < prNext->ntracks; i++ )
-                {
-                    if ( strcmp( prNext->trackName[ i ], "readType" ) == 0 )
-                    {
-                        break;
-                    }
-                }
+        if ( ctx->BEST )
+        {
+            prBest = prNext;
+            prNext = ( prBest == pr1 ) ? pr2 : pr1;
+        }
 
-                // ignore reads that do not have the readType attribute
-                if ( i == prNext->ntracks )
-                    continue;
+        if ( batch->nseq >= IMPORT_BATCH_BASES )
+        {
+            queue_push( queue, batch );
+            batch = batch_new( fidx, ++nbatch );
+        }
+    }
 
-                // ignore reads that have not the proper format of readType argument
-                if ( prNext->trackfields[ i ][ 1 ] != 3 )
-                    continue;
+    if ( gzclose( in->file ) != Z_OK && batch->status == IMPORT_OK )
+    {
+        fprintf( stderr, "File %s: read error\n", core );
+        batch->status = IMPORT_ERROR;
+    }
 
-                // TODO use enum from dextractUtils
-                // typedef enum { type_Empty = 0, type_FullHqRead0 = 1, type_FullHqRead1 = 2, type_PartialHqRead0 = 3, type_PartialHqRead1 = 4, type_PartialHqRead2 = 5, type_Multiload = 6, type_Indeterminate = 7, type_NotDefined = 255} readType ;
-                if ( prNext->trackfields[ i ][ 2 ] != 1 && prNext->trackfields[ i ][ 2 ] != 2 )
-                    continue;
-            }
+    //  flush last well group
+
+    if ( ctx->BEST && prBest != NULL && batch->status == IMPORT_OK )
+    {
+        batch_add( batch, prBest );
+    }
+
+    batch->last = 1;
+    queue_push( queue, batch );
+
+    free( hbuf );
+    free( sbuf );
+}
+
+static void* reader_thread( void* arg )
+{
+    import_queue* queue = arg;
+    pacbio_read pr1, pr2;
+    import_input in;
+
+    initPacbioRead( &pr1, queue->ctx->t_create_n );
+    initPacbioRead( &pr2, queue->ctx->t_create_n );
+
+    in.max = IMPORT_BUFFER;
+    in.buf = malloc( in.max + 1 );
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &queue->lock );
+        int fidx = queue->nextfile++;
+        pthread_mutex_unlock( &queue->lock );
 
-            prNext->len       = rlen;
-            ctx->read[ rlen ] = '\0';
+        if ( fidx >= queue->nfiles )
+        {
+            break;
+        }
+
+        readInputFile( queue, fidx, &pr1, &pr2, &in );
+    }
+
+    pthread_mutex_lock( &queue->lock );
+    queue->nreaders -= 1;
+    pthread_cond_broadcast( &queue->changed );
+    pthread_mutex_unlock( &queue->lock );
+
+    freePacbioRead( &pr1 );
+    freePacbioRead( &pr2 );
+    free( in.buf );
+
+    return NULL;
+}
+
+// convert to [0-3], count bases and compress each read in place
+
+static void compress_batch( import_batch* batch )
+{
+    int i, j, x;
+
+    for ( i = 0; i < batch->nreads; i++ )
+    {
+        import_read* r = batch->reads + i;
+        char* seq      = batch->seq + r->soff;
+
+        for ( j = 0; j < r->len; j++ )
+        {
+            x = number[ (int)seq[ j ] ];
+            batch->count[ x ] += 1;
+            seq[ j ] = (char)x;
+        }
+
+        Compress_Read( r->len, seq );
+    }
+}
+
+static void* worker_thread( void* arg )
+{
+    import_queue* queue = arg;
+
+    pthread_mutex_lock( &queue->lock );
+
+    while ( 1 )
+    {
+        import_batch* batch = queue->todo;
 
-            if ( rlen >= prNext->maxSequenceLen )
+        if ( batch == NULL )
+        {
+            if ( queue->nreaders == 0 )
             {
-                prNext->maxSequenceLen = ( (int)( 1.2 * rlen ) ) + 1000 + MAX_NAME;
-                prNext->seq            = (char*)realloc( prNext->seq, prNext->maxSequenceLen + 1 );
-                if ( prNext->seq == NULL )
-                {
-                    fprintf( stderr, "File %s.fasta, Line %d:", core, nline );
-                    fprintf( stderr, " Out of memory (Allocating line buffer)\n" );
-                    errorExit( ctx );
-                }
+                break;
             }
 
-            memcpy( prNext->seq, ctx->read, rlen );
+            pthread_cond_wait( &queue->changed, &queue->lock );
+            continue;
+        }
+
+        queue->todo = batch->next;
+        batch->next = queue->ready;
+        queue->ready = batch;
+
+        pthread_mutex_unlock( &queue->lock );
+
+        if ( batch->status == IMPORT_OK )
+        {
+            compress_batch( batch );
+        }
+
+        pthread_mutex_lock( &queue->lock );
+
+        batch->done = 1;
+        pthread_cond_broadcast( &queue->changed );
+    }
+
+    pthread_mutex_unlock( &queue->lock );
+
+    return NULL;
+}
+
+// wait for the compressed batch at the writer's position
+
+static import_batch* queue_next( import_queue* queue )
+{
+    pthread_mutex_lock( &queue->lock );
+
+    while ( 1 )
+    {
+        import_batch** link = &( queue->ready );
+
+        while ( *link != NULL && ( ( *link )->file != queue->wfile || ( *link )->num != queue->wseq ) )
+        {
+            link = &( ( *link )->next );
+        }
+
+        if ( *link != NULL && ( *link )->done )
+        {
+            import_batch* batch = *link;
+            *link               = batch->next;
+
+            pthread_mutex_unlock( &queue->lock );
+
+            return batch;
+        }
+
+        pthread_cond_wait( &queue->changed, &queue->lock );
+    }
+}
+
+// release a written batch and advance the writer
+
+static void queue_release( import_queue* queue, import_batch* batch )
+{
+    pthread_mutex_lock( &queue->lock );
+
+    queue->nbatches -= 1;
+
+    if ( batch->last )
+    {
+        queue->wfile += 1;
+        queue->wseq = 0;
+    }
+    else
+    {
+        queue->wseq += 1;
+    }
+
+    pthread_cond_broadcast( &queue->changed );
+    pthread_mutex_unlock( &queue->lock );
+
+    batch_free( batch );
+}
+
+static void writeBatch( CreateContext* ctx, import_batch* batch )
+{
+    int i, j, c;
+
+    for ( c = 0; c < 4; c++ )
+    {
+        ctx->count[ c ] += batch->count[ c ];
+    }
+
+    for ( i = 0; i < batch->nreads; i++ )
+    {
+        import_read* r = batch->reads + i;
+
+        HITS_READ hr;
+        hr.boff  = ctx->offset;
+        hr.rlen  = r->len;
+        hr.coff  = -1;
+        hr.flags = DB_BEST;
+
+        size_t clen = COMPRESSED_LEN( r->len );
+
+        if ( fwrite( batch->seq + r->soff, 1, clen, ctx->bases ) != clen )
+        {
+            fprintf( stderr, "[ERROR] - Unable to write compressed sequence (%s, %d) to database\n", batch->core, r->seqIDinFasta );
+            exit( 1 );
+        }
+        if ( fwrite( &hr, sizeof( HITS_READ ), 1, ctx->indx ) != 1 )
+        {
+            fprintf( stderr, "[ERROR] - Unable to write HITS_READ (%s, %d) to database\n", batch->core, r->seqIDinFasta );
+            exit( 1 );
+        }
+
+        add_to_track( ctx, find_track( ctx, TRACK_SEQID ), ctx->ureads, r->seqIDinFasta );
+        if ( r->hasPacbioHeader )
+        {
+            add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, r->well );
+            add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, r->beg );
+            add_to_track( ctx, find_track( ctx, TRACK_PACBIO_HEADER ), ctx->ureads, r->end );
+        }
+
+        int* tdata = batch->tdata + r->toff;
+
+        for ( j = 0; j < r->ntracks; j++ )
+        {
+            int track   = find_track( ctx, batch->tnames + tdata[ 0 ] );
+            int nvalues = tdata[ 1 ];
+            int k;
+
+            for ( k = 0; k < nvalues; k++ )
+                add_to_track( ctx, track, ctx->ureads, tdata[ 2 + k ] );
+
+            tdata += 2 + nvalues;
+        }
+
+        ctx->offset += clen;
+        ctx->ureads += 1;
+        ctx->totlen += r->len;
+        if ( r->len > ctx->maxlen )
+            ctx->maxlen = r->len;
+    }
+}
+
+static void importFiles( CreateContext* ctx, char** files, int nfiles )
+{
+    import_queue queue;
+    bzero( &queue, sizeof( import_queue ) );
 
-            if ( ctx->BEST )
+    queue.ctx        = ctx;
+    queue.files      = files;
+    queue.nfiles     = nfiles;
+    queue.maxbatches = IMPORT_BATCHES * ctx->nthreads;
+    queue.nreaders   = MIN( nfiles, ctx->nthreads );
+
+    pthread_mutex_init( &queue.lock, NULL );
+    pthread_cond_init( &queue.changed, NULL );
+
+    char* prolog = NULL;
+    int nreaders = queue.nreaders;
+    pthread_t* threads = malloc( sizeof( pthread_t ) * ( nreaders + ctx->nthreads ) );
+    int i;
+
+    for ( i = 0; i < nreaders; i++ )
+        pthread_create( threads + i, NULL, reader_thread, &queue );
+
+    for ( i = 0; i < ctx->nthreads; i++ )
+        pthread_create( threads + nreaders + i, NULL, worker_thread, &queue );
+
+    while ( queue.wfile < nfiles )
+    {
+        import_batch* batch = queue_next( &queue );
+
+        if ( batch->num == 0 )
+        {
+            if ( batch->status == IMPORT_ERROR )
+                errorExit( ctx );
+
+            if ( batch->status == IMPORT_EMPTY )
             {
-                if ( prBest == NULL )
-                {
-                    if ( prNext == ctx->pr1 )
-                    {
-                        prBest = ctx->pr1;
-                        prNext = ctx->pr2;
-                    }
-                    else
-                    {
-                        prBest = ctx->pr2;
-                        prNext = ctx->pr1;
-                    }
-                    continue;
-                }
-                else if ( prBest->well == prNext->well )
-                {
-                    if ( prBest->len < prNext->len )
-                    {
-                        prBest = prNext;
-                        prNext = ( prBest == ctx->pr1 ) ? ctx->pr2 : ctx->pr1;
-                    }
-                    continue;
-                }
+                fprintf( stderr, "Skipping '%s', file is empty!\n", batch->core );
+                queue_release( &queue, batch );
+                continue;
             }
 
-            addReadToDB( ctx, prBest );
+            for ( i = 0; i < ctx->ofiles; i++ )
+                if ( strcmp( batch->core, ctx->flist[ i ] ) == 0 )
+                {
+                    fprintf( stderr, "File %s is already in database %s.db\n", batch->core, Root( ctx->dbname, ".db" ) );
+                    errorExit( ctx );
+                }
 
-            if ( ctx->BEST )
+            if ( ctx->VERBOSE )
             {
-                prBest = prNext;
-                prNext = ( prBest == ctx->pr1 ) ? ctx->pr2 : ctx->pr1;
+                fprintf( stderr, "Adding '%s' ...\n", batch->core );
+                fflush( stderr );
             }
-        }
 
-        //  Complete processing of .fasta file: flush last well group, write file line
-        //      in db image, free prolog, and close file
+            ctx->flist[ ctx->ofiles++ ] = Strdup( batch->core, "Adding to file list" );
 
-        if ( ctx->BEST )
-        {
-            addReadToDB( ctx, prBest );
+            free( prolog );
+            prolog        = batch->prolog;
+            batch->prolog = NULL;
         }
 
-        fprintf( ctx->ostub, DB_FDATA, ctx->ureads, core, prolog );
+        if ( batch->status == IMPORT_ERROR )
+            errorExit( ctx );
+
+        writeBatch( ctx, batch );
+
+        //  Complete processing of the file: write file line in db image
+
+        if ( batch->last )
+            fprintf( ctx->ostub, DB_FDATA, ctx->ureads, ctx->flist[ ctx->ofiles - 1 ], prolog );
+
+        queue_release( &queue, batch );
     }
 
+    for ( i = 0; i < nreaders + ctx->nthreads; i++ )
+        pthread_join( threads[ i ], NULL );
+
+    pthread_cond_destroy( &queue.changed );
+    pthread_mutex_destroy( &queue.lock );
+
+    free( threads );
     free( prolog );
-    fclose( input );
 }
 
 static void updateBlockDBOffsets( CreateContext* ctx )
@@ -978,13 +1578,15 @@ static void updateBlockDBOffsets( CreateContext* ctx )
 
 static void usage(const char* progname)
 {
-    fprintf( stderr, "usage: %s [-vabQ] [-c <track>] [-x <int>] <path:db> (-f file  | <path:string> <input:fasta> ...)\n", progname );
+    fprintf( stderr, "usage: %s [-vabQ] [-c <track>] [-x <int>] [-j <int>] <path:db> (-f file  | <path:string> <input:fasta|fastq> ...)\n", progname );
     fprintf( stderr, "options: -v ... verbose\n" );
     fprintf( stderr, "         -Q ... only use pacbio reads with readtype FullHqRead\n" );
     fprintf( stderr, "         -a ... append new reads to new block\n" );
     fprintf( stderr, "         -b ... only the longest/best read from a pacbio well is incorporated into DB\n" );
     fprintf( stderr, "         -x ... min read length (%d)\n", DEF_OPT_X );
     fprintf( stderr, "         -c ... convert fasta header arguments (NAME=x,y) into database tracks\n" );
+    fprintf( stderr, "         -j ... number of threads (%d)\n", DEF_OPT_J );
+    fprintf( stderr, "input files can be fasta or fastq, optionally gzip compressed\n" );
 }
 
 static void parseOptions( int argc, char* argv[], CreateContext* ctx )
@@ -997,13 +1599,14 @@ static void parseOptions( int argc, char* argv[], CreateContext* ctx )
     ctx->BEST                  = 0;
     ctx->appendReadsToNewBlock = 0;
     ctx->opt_min_length        = DEF_OPT_X;
+    ctx->nthreads              = DEF_OPT_J;
 
     // parse arguments
 
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "vc:abQx:f:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "vc:abQx:f:j:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -1037,6 +1640,10 @@ static void parseOptions( int argc, char* argv[], CreateContext* ctx )
                 ctx->BEST = 1;
                 break;
 
+            case 'j':
+                ctx->nthreads = atoi( optarg );
+                break;
+
             case 'a':
                 ctx->appendReadsToNewBlock = 1;
                 break;
@@ -1063,6 +1670,12 @@ static void parseOptions( int argc, char* argv[], CreateContext* ctx )
         exit( 1 );
     }
 
+    if ( ctx->nthreads < 1 )
+    {
+        fprintf( stderr, "invalid number of threads %d\n", ctx->nthreads );
+        exit( 1 );
+    }
+
     if ( ( ctx->IFILE == NULL ) && argc - optind < 2 )
     {
         usage( argv[ 0 ] );
@@ -1092,17 +1705,26 @@ int main( int argc, char* argv[] )
     for ( c            = 0; c < 4; c++ ) //  count of acgt in new .fasta files
         ctx.count[ c ] = 0;
 
-    //  For each new .fasta file do:
+    //  Import the new files
+
+    char** files = malloc( sizeof( char* ) * ( ctx.ifiles + 1 ) );
+    int nfiles   = 0;
 
     ng = init_file_iterator( argc, argv, ctx.IFILE, ctx.lastParameterIdx + 1 );
-    while ( next_file( ng ) )
+    while ( nfiles < ctx.ifiles && next_file( ng ) )
     {
         if ( ng->name == NULL )
             errorExit( &ctx );
 
-        readFastaFile( &ctx, ng->name );
+        files[ nfiles++ ] = Strdup( ng->name, "Adding to input list" );
     }
 
+    importFiles( &ctx, files, nfiles );
+
+    for ( c = 0; c < nfiles; c++ )
+        free( files[ c ] );
+    free( files );
+
     //  Finished loading all sequences: update relevant fields in db record
 
     db.ureads = ctx.ureads;
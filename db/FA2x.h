@@ -52,6 +52,7 @@ typedef struct
     int appendReadsToNewBlock;
     int lastParameterIdx;
     int useFullHqReadsOnly;
+    int nthreads;            // FA2db import threads
     // int createTracks;
 
     FILE* IFILE;
@@ -62,6 +62,8 @@
 
 #define HUFF_CUTOFF  16   //  This cannot be larger than 16 !
 
+#define MULTI_BITS   12   //  Width of the multi-symbol lookup (at most 3 codes, see Build_Multi)
+
 
 /*******************************************************************************************
  *
@@ -69,17 +71,11 @@
  *
  ********************************************************************************************/
 
-static int LittleEndian;  //  Little-endian machine ?
-                          //     Referred by: Decode & Decode_Run
 static int Flip;          //  Flip endian of all coded shorts and ints
                           //     Referred by: Decode & Decode_Run & Read_Scheme
 
 static void Set_Endian(int flip)
-{ uint32 x = 3;
-  uint8 *b = (uint8 *) (&x);
-
-  Flip         = flip;
-  LittleEndian = (b[0] == 3);
+{ Flip = flip;
 }
 
 static void Flip_Long(void *w)
@@ -115,6 +111,8 @@ typedef struct
     uint32 codebits[256];    //  If type = 2, then code 255 is the special code for
     int    codelens[256];    //    non-Huffman exceptions
     int    lookup[0x10000];  //  Lookup table (just for decoding)
+    uint32 multi[1 << MULTI_BITS];  //  Multi-symbol lookup: # of codes (bits 0-3), their total
+                                    //    length (bits 4-7), and the codes (bits 8-15, 16-23, 24-31)
   } HScheme;
 
 typedef struct _HTree
@@ -354,6 +352,37 @@ static void Write_Scheme(HScheme *scheme, FILE *out)
     }
 }
 
+  //  For each MULTI_BITS prefix of the code stream, record the (up to 3) codes that lie completely
+  //    within it.  Codes of the exception symbol (type 2) end the sequence as they are followed by
+  //    an explicit value.  An entry with no codes means the single code lookup has to be used.
+
+static void Build_Multi(HScheme *scheme)
+{ int   *look, *lens;
+  int    signal;
+  uint32 v, m;
+  int    pos, k, c;
+
+  look = scheme->lookup;
+  lens = scheme->codelens;
+  if (scheme->type == 2)
+    signal = 255;
+  else
+    signal = 256;
+
+  for (v = 0; v < (1 << MULTI_BITS); v++)
+    { m   = 0;
+      pos = 0;
+      for (k = 0; k < 3; k++)
+        { c = look[((v << pos) << (16-MULTI_BITS)) & 0xffff];
+          if (c == signal || lens[c] == 0 || lens[c] > MULTI_BITS-pos)
+            break;
+          m   |= ((uint32) c) << (8*(k+1));
+          pos += lens[c];
+        }
+      scheme->multi[v] = m | (pos << 4) | k;
+    }
+}
+
   //  Allocate and read a code table from in, and return a pointer to it.
 
 static HScheme *Read_Scheme(FILE *in)
@@ -370,6 +399,7 @@ static HScheme *Read_Scheme(FILE *in)
   lens = scheme->codelens;
   bits = scheme->codebits;
   look = scheme->lookup;
+  bzero(look,sizeof(scheme->lookup));
 
   if (fread(&x,1,1,in) != 1)
     { EPRINTF(EPLACE,"Could not read scheme type byte (Read_Scheme)\n");
@@ -408,6 +438,8 @@ static HScheme *Read_Scheme(FILE *in)
         }
     }
 
+  Build_Multi(scheme);
+
   return (scheme);
 }
 
@@ -542,27 +574,22 @@ static void Encode_Run(HScheme *neme, HScheme *reme, FILE *out, uint8 *read, int
     fwrite(&ocode,sizeof(uint32),1,out);
 }
 
+  //  The decoders shift 32-bit words into the low half of icode and look up the 16 bits above
+  //    them (XPART), or the 8 bits above those (CPART).  Arithmetic on whole words keeps this
+  //    independent of the machine's endianness.
+
+#define XPART  ((uint16) (icode >> 32))
+#define CPART  ((uint8)  (icode >> 40))
+
   //  Read and decode from in, the next rlen symbols into read according to scheme
 
 static int Decode(HScheme *scheme, FILE *in, char *read, int rlen)
 { int    *look, *lens;
+  uint32 *multi, m;
   int     signal, ilen;
   uint64  icode;
-  uint32 *ipart;
-  uint16 *xpart;
-  uint8  *cpart;
-  int     j, n, c;
-
-  if (LittleEndian)
-    { ipart = ((uint32 *) (&icode));
-      xpart = ((uint16 *) (&icode)) + 2;
-      cpart = ((uint8  *) (&icode)) + 5;
-    }
-  else
-    { ipart = ((uint32 *) (&icode)) + 1;
-      xpart = ((uint16 *) (&icode)) + 1;
-      cpart = ((uint8  *) (&icode)) + 2;
-    }
+  uint32  word;
+  int     j, n, c, k;
 
   if (scheme->type == 2)
     signal  = 255;
@@ -574,10 +601,11 @@ static int Decode(HScheme *scheme, FILE *in, char *read, int rlen)
 #define GET								\
   if (n > ilen)								\
     { icode <<= ilen;							\
-      if (fread(ipart,sizeof(uint32),1,in) != 1)			\
+      if (fread(&word,sizeof(uint32),1,in) != 1)			\
         { EPRINTF(EPLACE,"Could not read more bits (Decode)\n");	\
           return (1);							\
         }								\
+      icode  |= word;							\
       ilen    = n-ilen;							\
       icode <<= ilen;							\
       ilen    = 32-ilen;						\
@@ -590,11 +618,12 @@ static int Decode(HScheme *scheme, FILE *in, char *read, int rlen)
 #define GETFLIP								\
   if (n > ilen)								\
     { icode <<= ilen;							\
-      if (fread(ipart,sizeof(uint32),1,in) != 1)			\
+      if (fread(&word,sizeof(uint32),1,in) != 1)			\
         { EPRINTF(EPLACE,"Could not read more bits (Decode)\n");	\
           return (1);							\
         }								\
-      Flip_Long(ipart);							\
+      Flip_Long(&word);							\
+      icode  |= word;							\
       ilen    = n-ilen;							\
       icode <<= ilen;							\
       ilen    = 32-ilen;						\
@@ -604,33 +633,46 @@ static int Decode(HScheme *scheme, FILE *in, char *read, int rlen)
       ilen   -= n;							\
     }
 
+  //  Up to 3 codes are taken at once if they fit into the next MULTI_BITS bits, the words
+  //    are read at the same points of the stream as when decoding one code at a time.  The
+  //    last code of the stream is always decoded on its own, as the single code decoder
+  //    consumes all codes before it (which may read one more word).
+
+#define MULTI(get)							\
+  for (j = 0; j < rlen; )						\
+    { get								\
+      m = multi[XPART >> (16-MULTI_BITS)];				\
+      k = (m & 0xf);							\
+      if (k > 0 && j+k < rlen)						\
+        { read[j++] = (char) (m >> 8);					\
+          if (k > 1)							\
+            { read[j++] = (char) (m >> 16);				\
+              if (k > 2)						\
+                read[j++] = (char) (m >> 24);				\
+            }								\
+          n = ((m >> 4) & 0xf);						\
+        }								\
+      else								\
+        { c = look[XPART];						\
+          n = lens[c];							\
+          if (c == signal)						\
+            { get							\
+              c = CPART;						\
+              n = 8;							\
+            }								\
+          read[j++] = (char) c;						\
+        }								\
+    }
+
+  multi = scheme->multi;
+
   n     = 16;
   ilen  = 0;
   icode = 0;
   if (Flip)
-    for (j = 0; j < rlen; j++)
-      { GETFLIP
-        c = look[*xpart];
-        n = lens[c];
-        if (c == signal)
-          { GETFLIP
-            c = *cpart;
-            n = 8;
-          }
-        read[j] = (char) c;
-      }
+    MULTI(GETFLIP)
   else
-    for (j = 0; j < rlen; j++)
-      { GET
-        c = look[*xpart];
-        n = lens[c];
-        if (c == signal)
-          { GET
-            c = *cpart;
-            n = 8;
-          }
-        read[j] = (char) c;
-      }
+    MULTI(GET)
 
   return (0);
 }
@@ -644,22 +686,9 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
   int    *rlook, *rlens;
   int     nsignal, ilen;
   uint64  icode;
-  uint32 *ipart;
-  uint16 *xpart;
-  uint8  *cpart;
+  uint32  word;
   int     j, n, c, k;
 
-  if (LittleEndian)
-    { ipart = ((uint32 *) (&icode));
-      xpart = ((uint16 *) (&icode)) + 2;
-      cpart = ((uint8  *) (&icode)) + 5;
-    }
-  else
-    { ipart = ((uint32 *) (&icode)) + 1;
-      xpart = ((uint16 *) (&icode)) + 1;
-      cpart = ((uint8  *) (&icode)) + 2;
-    }
-
   if (neme->type == 2)
     nsignal = 255;
   else
@@ -676,11 +705,11 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
   if (Flip)
     for (j = 0; j < rlen; j++)
       { GETFLIP
-        c = rlook[*xpart];
+        c = rlook[XPART];
         n = rlens[c];
         if (c == 255)
           { GETFLIP
-            c = *xpart;
+            c = XPART;
             n = 16;
           }
         for (k = 0; k < c; k++)
@@ -688,11 +717,11 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
 
         if (j < rlen)
           { GETFLIP
-            c = nlook[*xpart];
+            c = nlook[XPART];
             n = nlens[c];
             if (c == nsignal)
               { GETFLIP
-                c = *cpart;
+                c = CPART;
                 n = 8;
               }
             read[j] = (char) c;
@@ -701,11 +730,11 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
   else
     for (j = 0; j < rlen; j++)
       { GET
-        c = rlook[*xpart];
+        c = rlook[XPART];
         n = rlens[c];
         if (c == 255)
           { GET
-            c = *xpart;
+            c = XPART;
             n = 16;
           }
         for (k = 0; k < c; k++)
@@ -713,11 +742,11 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
 
         if (j < rlen)
           { GET
-            c = nlook[*xpart];
+            c = nlook[XPART];
             n = nlens[c];
             if (c == nsignal)
               { GET
-                c = *cpart;
+                c = CPART;
                 n = 8;
               }
             read[j] = (char) c;
@@ -728,6 +757,115 @@ static int Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
 }
 
 
+  //  Decode and Decode_Run on the bytes [*in,end) of a memory buffer.  *in is advanced past the
+  //    words read.  They depend on no state other than their arguments and so can be called
+  //    from several threads.
+
+#define GETMEM								\
+  if (n > ilen)								\
+    { icode <<= ilen;							\
+      if (in+sizeof(uint32) > end)					\
+        { EPRINTF(EPLACE,"Compressed entry is truncated (Decode)\n");	\
+          return (1);							\
+        }								\
+      memcpy(&word,in,sizeof(uint32));					\
+      in += sizeof(uint32);						\
+      if (flip)								\
+        Flip_Long(&word);						\
+      icode  |= word;							\
+      ilen    = n-ilen;							\
+      icode <<= ilen;							\
+      ilen    = 32-ilen;						\
+    }									\
+  else									\
+    { icode <<= n;							\
+      ilen   -= n;							\
+    }
+
+static int Decode_Mem(HScheme *scheme, int flip, uint8 **_in, uint8 *end, char *read, int rlen)
+{ int    *look, *lens;
+  uint32 *multi, m;
+  int     signal, ilen;
+  uint64  icode;
+  uint32  word;
+  uint8  *in;
+  int     j, n, c, k;
+
+  if (scheme->type == 2)
+    signal  = 255;
+  else
+    signal  = 256;
+  lens  = scheme->codelens;
+  look  = scheme->lookup;
+  multi = scheme->multi;
+
+  in    = *_in;
+  n     = 16;
+  ilen  = 0;
+  icode = 0;
+  MULTI(GETMEM)
+
+  *_in = in;
+  return (0);
+}
+
+static int Decode_Run_Mem(HScheme *neme, HScheme *reme, int flip, uint8 **_in, uint8 *end,
+                          char *read, int rlen, int rchar)
+{ int    *nlook, *nlens;
+  int    *rlook, *rlens;
+  int     nsignal, ilen;
+  uint64  icode;
+  uint32  word;
+  uint8  *in;
+  int     j, n, c, k;
+
+  if (neme->type == 2)
+    nsignal = 255;
+  else
+    nsignal = 256;
+  nlens = neme->codelens;
+  nlook = neme->lookup;
+
+  rlens = reme->codelens;
+  rlook = reme->lookup;
+
+  in    = *_in;
+  n     = 16;
+  ilen  = 0;
+  icode = 0;
+  for (j = 0; j < rlen; j++)
+    { GETMEM
+      c = rlook[XPART];
+      n = rlens[c];
+      if (c == 255)
+        { GETMEM
+          c = XPART;
+          n = 16;
+        }
+      if (c > rlen-j)
+        { EPRINTF(EPLACE,"Run exceeds the entry (Decode_Run)\n");
+          return (1);
+        }
+      for (k = 0; k < c; k++)
+        read[j++] = (char) rchar;
+
+      if (j < rlen)
+        { GETMEM
+          c = nlook[XPART];
+          n = nlens[c];
+          if (c == nsignal)
+            { GETMEM
+              c = CPART;
+              n = 8;
+            }
+          read[j] = (char) c;
+        }
+    }
+
+  *_in = in;
+  return (0);
+}
+
 /*******************************************************************************************
  *
  *  Histogrammers
@@ -1404,3 +1542,53 @@ int Uncompress_Next_QVentry(FILE *input, char **entry, QVcoding *coding, int rle
 
   return (0);
 }
+
+int Uncompress_QVentry(void *data, int64 len, char **entry, QVcoding *coding, int rlen)
+{ uint8 *in, *end;
+  int    clen, tlen;
+
+  in  = (uint8 *) data;
+  end = in + len;
+
+  if (coding->delChar < 0)
+    { if (Decode_Mem(coding->delScheme, coding->flip, &in, end, entry[0], rlen))
+        EXIT(1);
+      clen = rlen;
+    }
+  else
+    { if (Decode_Run_Mem(coding->delScheme, coding->dRunScheme, coding->flip, &in, end,
+                         entry[0], rlen, coding->delChar))
+        EXIT(1);
+      clen = Packed_Length(entry[0],rlen,coding->delChar);
+    }
+
+  tlen = COMPRESSED_LEN(clen);
+  if (in+tlen > end)
+    { EPRINTF(EPLACE,"Could not read deletions entry (Uncompress_QVentry)\n");
+      EXIT(1);
+    }
+  memcpy(entry[1],in,tlen);
+  in += tlen;
+  Uncompress_Read(clen,entry[1]);
+  Lower_Read(entry[1]);
+  if (coding->delChar >= 0)
+    Unpack_Tag(entry[1],clen,entry[0],rlen,coding->delChar);
+
+  if (Decode_Mem(coding->insScheme, coding->flip, &in, end, entry[2], rlen))
+    EXIT(1);
+
+  if (Decode_Mem(coding->mrgScheme, coding->flip, &in, end, entry[3], rlen))
+    EXIT(1);
+
+  if (coding->subChar < 0)
+    { if (Decode_Mem(coding->subScheme, coding->flip, &in, end, entry[4], rlen))
+        EXIT(1);
+    }
+  else
+    { if (Decode_Run_Mem(coding->subScheme, coding->sRunScheme, coding->flip, &in, end,
+                         entry[4], rlen, coding->subChar))
+        EXIT(1);
+    }
+
+  return (0);
+}
@@ -122,4 +122,10 @@ int      Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int
 
 int      Uncompress_Next_QVentry(FILE *input, char **entry, QVcoding *coding, int rlen);
 
+  //  As Uncompress_Next_QVentry, but the compressed entry is taken from the len bytes at data,
+  //    e.g. at the offset of the read in a memory mapped .qvs file.  It uses no global state,
+  //    so several threads can decode entries at the same time.
+
+int      Uncompress_QVentry(void *data, long long len, char **entry, QVcoding *coding, int rlen);
+
 #endif // _QV_COMPRESSOR
@@ -0,0 +1,302 @@
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "fastaOut.h"
+
+typedef struct
+{
+    fasta_out* fo;
+
+    int* cuts;                  // batch b covers the positions cuts[b] .. cuts[b + 1] - 1
+    int nbatches;
+
+    fasta_buffer* bufs;         // of the formatted batches
+    char* done;
+    int status;
+
+    int next;                   // next batch claimed by a worker
+    int written;                // batches written by the caller
+    int ahead;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} fasta_queue;
+
+static void fasta_reserve( fasta_buffer* buf, size_t len )
+{
+    if ( buf->len + len > buf->max )
+    {
+        buf->max  = ( buf->len + len ) * 1.2 + 4096;
+        buf->data = realloc( buf->data, buf->max );
+
+        if ( buf->data == NULL )
+        {
+            fprintf( stderr, "failed to allocate %zu bytes for the output\n", buf->max );
+            exit( 1 );
+        }
+    }
+}
+
+void fasta_append( fasta_buffer* buf, const char* data, size_t len )
+{
+    fasta_reserve( buf, len );
+
+    memcpy( buf->data + buf->len, data, len );
+    buf->len += len;
+}
+
+void fasta_printf( fasta_buffer* buf, const char* fmt, ... )
+{
+    va_list args;
+
+    va_start( args, fmt );
+    int len = vsnprintf( NULL, 0, fmt, args );
+    va_end( args );
+
+    fasta_reserve( buf, len + 1 );
+
+    va_start( args, fmt );
+    vsnprintf( buf->data + buf->len, len + 1, fmt, args );
+    va_end( args );
+
+    buf->len += len;
+}
+
+void fasta_wrap( fasta_buffer* buf, const char* seq, int len, int width )
+{
+    fasta_reserve( buf, len + len / width + 1 );
+
+    char* out = buf->data + buf->len;
+    int j;
+
+    for ( j = 0; j < len; j += width )
+    {
+        int n = ( len - j < width ) ? len - j : width;
+
+        memcpy( out, seq + j, n );
+        out += n;
+        *out++ = '\n';
+    }
+
+    buf->len = out - buf->data;
+}
+
+// replaces the buffer's content by a gzip member of it
+
+static int fasta_deflate( fasta_buffer* buf )
+{
+    z_stream zs;
+    bzero( &zs, sizeof( z_stream ) );
+
+    if ( deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        return 1;
+    }
+
+    size_t max = deflateBound( &zs, buf->len );
+    char* data = malloc( max );
+
+    zs.next_in   = (Bytef*)buf->data;
+    zs.avail_in  = buf->len;
+    zs.next_out  = (Bytef*)data;
+    zs.avail_out = max;
+
+    int status = deflate( &zs, Z_FINISH );
+
+    deflateEnd( &zs );
+
+    if ( status != Z_STREAM_END )
+    {
+        free( data );
+        return 1;
+    }
+
+    free( buf->data );
+
+    buf->data = data;
+    buf->len  = zs.total_out;
+    buf->max  = max;
+
+    return 0;
+}
+
+static void* fasta_worker( void* arg )
+{
+    fasta_queue* queue = arg;
+    fasta_out* fo      = queue->fo;
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &( queue->lock ) );
+
+        while ( queue->next < queue->nbatches && queue->next - queue->written >= queue->ahead )
+        {
+            pthread_cond_wait( &( queue->changed ), &( queue->lock ) );
+        }
+
+        int b = queue->next;
+
+        if ( b < queue->nbatches )
+        {
+            queue->next += 1;
+        }
+
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        if ( b >= queue->nbatches )
+        {
+            break;
+        }
+
+        fasta_buffer buf;
+        bzero( &buf, sizeof( fasta_buffer ) );
+
+        fo->format( fo->arg, queue->cuts[ b ], queue->cuts[ b + 1 ], &buf );
+
+        int status = ( fo->gzip && fasta_deflate( &buf ) );
+
+        pthread_mutex_lock( &( queue->lock ) );
+
+        queue->bufs[ b ] = buf;
+        queue->done[ b ] = 1;
+
+        if ( status )
+        {
+            queue->status = 1;
+        }
+
+        pthread_cond_broadcast( &( queue->changed ) );
+        pthread_mutex_unlock( &( queue->lock ) );
+    }
+
+    return NULL;
+}
+
+// cuts the positions into batches at the allowed boundaries
+
+static int* fasta_cut( fasta_out* fo, int beg, int end, int* _nbatches )
+{
+    HITS_READ* reads = fo->db->reads;
+    int maxcuts      = 16;
+    int* cuts        = malloc( sizeof( int ) * maxcuts );
+    int ncuts        = 0;
+    int64 bases      = 0;
+    int i;
+
+    cuts[ ncuts++ ] = beg;
+
+    for ( i = beg; i < end; i++ )
+    {
+        if ( bases >= FASTA_OUT_BATCH && ( fo->boundary == NULL || fo->boundary( fo->arg, i ) ) )
+        {
+            if ( ncuts + 1 >= maxcuts )
+            {
+                maxcuts = maxcuts * 2;
+                cuts    = realloc( cuts, sizeof( int ) * maxcuts );
+            }
+
+            cuts[ ncuts++ ] = i;
+            bases           = 0;
+        }
+
+        if ( fo->weight )
+        {
+            bases += fo->weight( fo->arg, i );
+        }
+        else
+        {
+            bases += reads[ fo->order ? fo->order[ i ] : i ].rlen;
+        }
+    }
+
+    cuts[ ncuts ] = end;
+
+    *_nbatches = ncuts;
+
+    return cuts;
+}
+
+int fasta_out_write( fasta_out* fo, FILE* out, int beg, int end )
+{
+    fasta_queue queue;
+    int nthreads = fo->nthreads;
+
+    // an empty range is still written as a batch, which makes an empty gzip member
+
+    queue.fo      = fo;
+    queue.cuts    = fasta_cut( fo, beg, end, &( queue.nbatches ) );
+    queue.bufs    = calloc( queue.nbatches, sizeof( fasta_buffer ) );
+    queue.done    = calloc( queue.nbatches, 1 );
+    queue.status  = 0;
+    queue.next    = queue.written = 0;
+    queue.ahead   = nthreads * FASTA_OUT_AHEAD;
+
+    pthread_mutex_init( &( queue.lock ), NULL );
+    pthread_cond_init( &( queue.changed ), NULL );
+
+    pthread_t* threads = malloc( sizeof( pthread_t ) * nthreads );
+    int i;
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        pthread_create( threads + i, NULL, fasta_worker, &queue );
+    }
+
+    int status = 0;
+    int b;
+
+    for ( b = 0; b < queue.nbatches; b++ )
+    {
+        pthread_mutex_lock( &( queue.lock ) );
+
+        while ( !queue.done[ b ] )
+        {
+            pthread_cond_wait( &( queue.changed ), &( queue.lock ) );
+        }
+
+        pthread_mutex_unlock( &( queue.lock ) );
+
+        fasta_buffer* buf = queue.bufs + b;
+
+        if ( buf->len > 0 && fwrite( buf->data, buf->len, 1, out ) != 1 )
+        {
+            status = 1;
+        }
+
+        free( buf->data );
+
+        pthread_mutex_lock( &( queue.lock ) );
+
+        queue.written += 1;
+
+        pthread_cond_broadcast( &( queue.changed ) );
+        pthread_mutex_unlock( &( queue.lock ) );
+    }
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    if ( queue.status )
+    {
+        fprintf( stderr, "failed to compress the output\n" );
+        status = 1;
+    }
+
+    pthread_cond_destroy( &( queue.changed ) );
+    pthread_mutex_destroy( &( queue.lock ) );
+
+    free( threads );
+    free( queue.cuts );
+    free( queue.bufs );
+    free( queue.done );
+
+    return status;
+}
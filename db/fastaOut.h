@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include <stdio.h>
+
+#include "DB.h"
+
+/*******************************************************************************************
+ *
+ *  Ordered parallel export of reads:
+ *     the reads at positions beg .. end-1 are cut into batches of about FASTA_OUT_BATCH bases.
+ *     worker threads format the batches into buffers, gzip each into a member of its own if
+ *     asked to, and the calling thread writes them to the output in order. the output does
+ *     not depend on the number of threads, concatenated gzip members are a valid gzip file.
+ *
+ ********************************************************************************************/
+
+#define FASTA_OUT_BATCH     ( 8 * 1024 * 1024 )     // bases in a batch
+#define FASTA_OUT_AHEAD     4                       // batches in flight per thread
+
+typedef struct
+{
+    char* data;
+    size_t len;
+    size_t max;
+} fasta_buffer;
+
+// formats the reads at positions beg .. end-1, called concurrently
+
+typedef void ( *fasta_format )( void* arg, int beg, int end, fasta_buffer* buf );
+
+// whether a batch may start at position i, the first of the range always can
+
+typedef int ( *fasta_boundary )( void* arg, int i );
+
+// bases written for position i, used to size the batches
+
+typedef int64 ( *fasta_weight )( void* arg, int i );
+
+typedef struct
+{
+    HITS_DB* db;                // with Map_Bases(), so that the threads can share it
+    int* order;                 // optional, read at each position, the identity otherwise
+
+    fasta_format format;
+    fasta_boundary boundary;    // optional, any position otherwise
+    fasta_weight weight;        // optional, the length of the read otherwise
+    void* arg;
+
+    int nthreads;
+    int gzip;
+} fasta_out;
+
+void fasta_append( fasta_buffer* buf, const char* data, size_t len );
+void fasta_printf( fasta_buffer* buf, const char* fmt, ... );
+
+// seq as lines of width bases
+
+void fasta_wrap( fasta_buffer* buf, const char* seq, int len, int width );
+
+// returns 0 on success
+
+int fasta_out_write( fasta_out* fo, FILE* out, int beg, int end );
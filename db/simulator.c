@@ -128,22 +128,6 @@ static char *random_genome()
   return (seq);
 }
 
-//  Complement (in the DNA sense) string *s*.
-
-static void complement(int elen, char *s)
-{ char *t;
-  int   c;
-
-  t = s + (elen-1);
-  while (s <= t)
-    { c = *s;
-      *s = (char) (3-*t);
-      *t = (char) (3-c);
-      s += 1;
-      t -= 1;
-    }
-}
-
 #define UNORM_LEN 60000
 #define UNORM_MAX   6.0
 
@@ -329,7 +313,7 @@ static void shotgun(char *source)
 
       if (drand48() >= FLIP_RATE)    //  Complement the string with probability FLIP_RATE.
         { printf(">Sim/%d/%d_%d RQ=0.%d\n",nreads+1,0,elen,qv);
-          complement(elen,rbuffer);
+          Complement_Read(elen,rbuffer);
           j = rend;
           rend = rbeg;
           rbeg = j;
@@ -96,8 +96,8 @@ q.single("{path}/OGbuild -t trim1 {db} {db}.filtered.las {db}.graphml")
 ##### tour the overlap graph and create contigs paths
 q.single("{path_scripts}/OGtour.py -c {db} {db}.graphml")
 
-q.single("{path}/LAcorrect -j 4 -r {db}.tour.rids {db} {db}.filtered.las {db}.corrected")
-q.single("{path}/FA2db -c source -c postrace {db}_CORRECTED [expand:{db}.corrected.*.fasta]")
+q.single("{path}/LAcorrect -j 4 -r {db}.tour.rids {db} {db}.filtered.las {db}.corrected.fasta")
+q.single("{path}/FA2db -c source -c postrace {db}_CORRECTED {db}.corrected.fasta")
 
 ##### create contig fasta files
 q.single("{path_scripts}/tour2fasta.py -c {db}_CORRECTED -t trim1 {db} {db}.tour.graphml {db}.tour.paths")
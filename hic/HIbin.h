@@ -0,0 +1,46 @@
+#pragma once
+
+#include <inttypes.h>
+
+/*
+ * binary contact matrix, written by HImatrix. all values little endian.
+ *
+ *   [HiBinHeader] [uint32 nbins[ncontigs]] [HiBinPair pair[npairs]]
+ *   [uint32 row[nrows]] [uint64 rowptr[nrows + 1]] [uint32 col[ncells]] [uint32 count[ncells]]
+ *
+ * one sparse matrix for each pair of contigs (a <= b) with at least one contact,
+ * the bins of contig a are the rows, the bins of b the columns. only the non-empty
+ * rows are stored, pair p has the rows row[pair[p].row] .. row[pair[p].row + pair[p].nrows - 1],
+ * the cells of row r are col/count[rowptr[r]] .. col/count[rowptr[r + 1] - 1].
+ * the matrices of a contig with itself (a == b) only hold the upper triangle.
+ *
+ * contigs are the sequences of the fasta file the DAM was built from, numbered
+ * in the order of the DAM.
+ */
+
+#define HI_BIN_MAGIC            0x31434948      // "HIC1"
+#define HI_BIN_VERSION          1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+
+    uint32_t binsize;
+    uint32_t pad;
+
+    uint64_t ncontigs;
+    uint64_t npairs;
+    uint64_t nrows;
+    uint64_t ncells;
+} HiBinHeader;
+
+typedef struct
+{
+    uint32_t a, b;              // contigs
+
+    uint64_t row;               // first row
+    uint64_t nrows;             // number of non-empty rows
+
+    uint64_t contacts;          // sum of the counts
+} HiBinPair;
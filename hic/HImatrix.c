@@ -0,0 +1,1103 @@
+/*******************************************************************************************
+ *
+ *  Bins Hi-C read pair alignments against the contigs of a DAM into sparse
+ *  contact matrices, one for each pair of contigs, and scores the links
+ *  between contigs for ordering and orienting them.
+ *
+ *  Date    : October 2026
+ *
+ *  Author  : MARVEL Team
+ *
+ *******************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
+
+#include "lib/tracks.h"
+#include "lib/utils.h"
+
+#include "db/DB.h"
+
+#include "HIbin.h"
+
+#ifdef HIDE_FILES
+#define PATHSEP "/."
+#else
+#define PATHSEP "/"
+#endif
+
+// defaults
+
+#define DEF_ARG_B        10000
+#define DEF_ARG_Q        10
+#define DEF_ARG_E        500000
+#define DEF_ARG_J        1
+
+// SAM flags
+
+#define SAM_PAIRED       0x1
+#define SAM_UNMAPPED     0x4
+#define SAM_MUNMAPPED    0x8
+#define SAM_FIRST        0x40
+#define SAM_SECONDARY    0x100
+#define SAM_DUPLICATE    0x400
+#define SAM_SUPPLEMENT   0x800
+
+#define SAM_SKIP         ( SAM_UNMAPPED | SAM_MUNMAPPED | SAM_SECONDARY | SAM_DUPLICATE | SAM_SUPPLEMENT )
+
+// input is handed to the workers in chunks of whole lines
+
+#define CHUNK_SIZE       ( 4 * 1024 * 1024 )
+#define CHUNK_QUEUE      4              // chunks queued per thread
+
+#define CELLS_INIT       ( 1 << 20 )    // cells a thread collects before coalescing them
+
+// contact between bin ba of contig a and bin bb of contig b, ( a, ba ) <= ( b, bb )
+
+typedef struct
+{
+    uint32_t a, b;
+    uint32_t ba, bb;
+    uint32_t count;
+} HiCell;
+
+typedef struct
+{
+    char* name;
+    uint64_t len;
+    uint32_t nbins;
+} HiContig;
+
+typedef struct
+{
+    char* buf;
+    size_t len;
+} HiChunk;
+
+// per thread state
+
+struct _HiContext;
+
+typedef struct
+{
+    struct _HiContext* hctx;
+    pthread_t thread;
+
+    HiCell* cells;
+    uint64_t ncells;
+    uint64_t maxcells;
+
+    uint64_t nlines;
+    uint64_t npairs;
+    uint64_t nfiltered;
+    uint64_t nunknown;
+    uint64_t nrange;
+} HiThread;
+
+// maintains the state of the app
+
+typedef struct _HiContext
+{
+    // arguments
+
+    int binsize;
+    int mapq;
+    int endlen;
+    int nthreads;
+    int verbose;
+
+    // contigs and the name lookup
+
+    HiContig* contigs;
+    int ncontigs;
+
+    int* hash;
+    uint32_t hashmask;
+
+    // chunk queue between the reader and the workers
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond_put;
+    pthread_cond_t cond_get;
+
+    HiChunk* queue;
+    int qmax;
+    int qbeg;
+    int qlen;
+    int qdone;
+
+    HiThread* threads;
+
+    // merged cells
+
+    HiCell* cells;
+    uint64_t ncells;
+} HiContext;
+
+static uint32_t name_hash(const char* name, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        h = ( h ^ (unsigned char)name[i] ) * 16777619u;
+    }
+
+    return h;
+}
+
+static int contig_lookup(HiContext* hctx, const char* name, size_t len)
+{
+    uint32_t h = name_hash(name, len) & hctx->hashmask;
+
+    while (hctx->hash[h] != -1)
+    {
+        char* cname = hctx->contigs[ hctx->hash[h] ].name;
+
+        if (strncmp(cname, name, len) == 0 && cname[len] == '\0')
+        {
+            return hctx->hash[h];
+        }
+
+        h = (h + 1) & hctx->hashmask;
+    }
+
+    return -1;
+}
+
+static void contig_insert(HiContext* hctx, int cid)
+{
+    char* name = hctx->contigs[cid].name;
+    uint32_t h = name_hash(name, strlen(name)) & hctx->hashmask;
+
+    while (hctx->hash[h] != -1)
+    {
+        h = (h + 1) & hctx->hashmask;
+    }
+
+    hctx->hash[h] = cid;
+}
+
+/*
+ * the contigs are the sequences of the fasta file, which FA2dam splits into
+ * pieces at the N's. the scaffold track holds ( piece number, offset ) for
+ * each piece, the header of the sequence is shared by its pieces.
+ */
+
+static int load_contigs(HiContext* hctx, char* path)
+{
+    HITS_DB db;
+    int status = Open_DB(path, &db);
+
+    if (status < 0)
+    {
+        return 0;
+    }
+
+    if (status == 0)
+    {
+        fprintf(stderr, "error: %s is not a DAM\n", path);
+        Close_DB(&db);
+        return 0;
+    }
+
+    HITS_TRACK* track = track_load(&db, TRACK_SCAFFOLD);
+
+    if (track == NULL)
+    {
+        fprintf(stderr, "error: failed to load track %s\n", TRACK_SCAFFOLD);
+        Close_DB(&db);
+        return 0;
+    }
+
+    char* root = Root(path, ".dam");
+    char* pwd = PathTo(path);
+    FILE* hdrs = Fopen(Catenate(pwd, PATHSEP, root, ".hdr"), "r");
+
+    free(pwd);
+    free(root);
+
+    if (hdrs == NULL)
+    {
+        Close_DB(&db);
+        return 0;
+    }
+
+    track_anno* anno = track->anno;
+    track_data* data = track->data;
+
+    HiContig* contigs = malloc(sizeof(HiContig) * db.nreads);
+    int ncontigs = 0;
+    char header[MAX_NAME];
+    int i;
+
+    for (i = 0; i < db.nreads; i++)
+    {
+        HITS_READ* r = db.reads + i;
+        track_anno b = anno[i] / sizeof(track_data);
+        track_anno e = anno[i + 1] / sizeof(track_data);
+
+        if (b >= e)
+        {
+            fprintf(stderr, "error: no %s entry for read %d\n", TRACK_SCAFFOLD, i);
+            break;
+        }
+
+        if (data[b] == 0)
+        {
+            fseeko(hdrs, r->coff, SEEK_SET);
+
+            if (fgets(header, MAX_NAME, hdrs) == NULL)
+            {
+                fprintf(stderr, "error: failed to read header of read %d\n", i);
+                break;
+            }
+
+            char* name = header + (header[0] == '>');
+            name[strcspn(name, " \t\r\n")] = '\0';
+
+            contigs[ncontigs].name = strdup(name);
+            contigs[ncontigs].len = 0;
+            ncontigs++;
+        }
+        else if (ncontigs == 0)
+        {
+            fprintf(stderr, "error: read %d doesn't start a sequence\n", i);
+            break;
+        }
+
+        contigs[ncontigs - 1].len = MAX(contigs[ncontigs - 1].len, (uint64_t)data[b + 1] + r->rlen);
+    }
+
+    fclose(hdrs);
+
+    int nreads = db.nreads;
+    Close_DB(&db);
+
+    if (i < nreads)
+    {
+        return 0;
+    }
+
+    uint32_t hsize = 1024;
+
+    while (hsize < 2 * (uint32_t)ncontigs)
+    {
+        hsize *= 2;
+    }
+
+    hctx->contigs = contigs;
+    hctx->ncontigs = ncontigs;
+    hctx->hash = malloc(sizeof(int) * hsize);
+    hctx->hashmask = hsize - 1;
+
+    memset(hctx->hash, -1, sizeof(int) * hsize);
+
+    for (i = 0; i < ncontigs; i++)
+    {
+        contigs[i].nbins = (contigs[i].len + hctx->binsize - 1) / hctx->binsize;
+
+        if (contig_lookup(hctx, contigs[i].name, strlen(contigs[i].name)) != -1)
+        {
+            fprintf(stderr, "warning: duplicate sequence name %s\n", contigs[i].name);
+        }
+
+        contig_insert(hctx, i);
+    }
+
+    return 1;
+}
+
+static int cmp_cells(const void* x, const void* y)
+{
+    const HiCell* c1 = x;
+    const HiCell* c2 = y;
+
+    if (c1->a != c2->a)
+    {
+        return c1->a < c2->a ? -1 : 1;
+    }
+
+    if (c1->b != c2->b)
+    {
+        return c1->b < c2->b ? -1 : 1;
+    }
+
+    if (c1->ba != c2->ba)
+    {
+        return c1->ba < c2->ba ? -1 : 1;
+    }
+
+    if (c1->bb != c2->bb)
+    {
+        return c1->bb < c2->bb ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// sorts the cells and sums up the counts of equal ones
+
+static uint64_t coalesce_cells(HiCell* cells, uint64_t n)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    qsort(cells, n, sizeof(HiCell), cmp_cells);
+
+    uint64_t i, j;
+
+    for (i = 1, j = 0; i < n; i++)
+    {
+        if (cmp_cells(cells + i, cells + j) == 0)
+        {
+            cells[j].count += cells[i].count;
+        }
+        else
+        {
+            cells[++j] = cells[i];
+        }
+    }
+
+    return j + 1;
+}
+
+static void add_contact(HiThread* tctx, uint32_t a, uint32_t ba, uint32_t b, uint32_t bb)
+{
+    if (tctx->ncells == tctx->maxcells)
+    {
+        tctx->ncells = coalesce_cells(tctx->cells, tctx->ncells);
+
+        // mostly distinct contacts, coalescing again soon won't help
+
+        if (tctx->ncells > tctx->maxcells / 2)
+        {
+            tctx->maxcells *= 2;
+            tctx->cells = realloc(tctx->cells, sizeof(HiCell) * tctx->maxcells);
+        }
+    }
+
+    HiCell* cell = tctx->cells + tctx->ncells;
+
+    if (a > b || (a == b && ba > bb))
+    {
+        cell->a = b;
+        cell->ba = bb;
+        cell->b = a;
+        cell->bb = ba;
+    }
+    else
+    {
+        cell->a = a;
+        cell->ba = ba;
+        cell->b = b;
+        cell->bb = bb;
+    }
+
+    cell->count = 1;
+    tctx->ncells++;
+}
+
+/*
+ * one SAM record. only the first mate of a pair is used, so each pair is counted once.
+ * the MAPQ of the mate is taken from the MQ tag if present.
+ */
+
+#define SAM_FIELDS 11
+
+static void process_line(HiContext* hctx, HiThread* tctx, char* line, char* end)
+{
+    char* field[SAM_FIELDS + 1];
+    int nfields = 0;
+    char* c = line;
+
+    tctx->nlines++;
+
+    if (*line == '@')
+    {
+        return;
+    }
+
+    field[nfields++] = c;
+
+    while (c < end && nfields <= SAM_FIELDS)
+    {
+        if (*c == '\t')
+        {
+            field[nfields++] = c + 1;
+        }
+
+        c++;
+    }
+
+    if (nfields < SAM_FIELDS)
+    {
+        return;
+    }
+
+    int flags = strtol(field[1], NULL, 10);
+
+    if ( !(flags & SAM_PAIRED) || !(flags & SAM_FIRST) )
+    {
+        return;
+    }
+
+    tctx->npairs++;
+
+    if ( (flags & SAM_SKIP) || strtol(field[4], NULL, 10) < hctx->mapq )
+    {
+        tctx->nfiltered++;
+        return;
+    }
+
+    if (nfields > SAM_FIELDS)
+    {
+        char* mq = field[SAM_FIELDS];
+
+        while ( (mq = strstr(mq, "MQ:i:")) != NULL && mq < end )
+        {
+            if (mq[-1] == '\t')
+            {
+                if (strtol(mq + 5, NULL, 10) < hctx->mapq)
+                {
+                    tctx->nfiltered++;
+                    return;
+                }
+
+                break;
+            }
+
+            mq += 5;
+        }
+    }
+
+    int a = contig_lookup(hctx, field[2], field[3] - field[2] - 1);
+    int b;
+
+    if (field[6][0] == '=' && field[6][1] == '\t')
+    {
+        b = a;
+    }
+    else
+    {
+        b = contig_lookup(hctx, field[6], field[7] - field[6] - 1);
+    }
+
+    if (a == -1 || b == -1)
+    {
+        tctx->nunknown++;
+        return;
+    }
+
+    int64_t pa = strtoll(field[3], NULL, 10) - 1;
+    int64_t pb = strtoll(field[7], NULL, 10) - 1;
+
+    if ( pa < 0 || pa >= (int64_t)hctx->contigs[a].len ||
+         pb < 0 || pb >= (int64_t)hctx->contigs[b].len )
+    {
+        tctx->nrange++;
+        return;
+    }
+
+    add_contact(tctx, a, pa / hctx->binsize, b, pb / hctx->binsize);
+}
+
+static void* worker(void* arg)
+{
+    HiThread* tctx = arg;
+    HiContext* hctx = tctx->hctx;
+
+    while (1)
+    {
+        pthread_mutex_lock(&hctx->lock);
+
+        while (hctx->qlen == 0 && !hctx->qdone)
+        {
+            pthread_cond_wait(&hctx->cond_get, &hctx->lock);
+        }
+
+        if (hctx->qlen == 0)
+        {
+            pthread_mutex_unlock(&hctx->lock);
+            break;
+        }
+
+        HiChunk chunk = hctx->queue[hctx->qbeg];
+        hctx->qbeg = (hctx->qbeg + 1) % hctx->qmax;
+        hctx->qlen--;
+
+        pthread_cond_signal(&hctx->cond_put);
+        pthread_mutex_unlock(&hctx->lock);
+
+        char* line = chunk.buf;
+        char* end = chunk.buf + chunk.len;
+
+        while (line < end)
+        {
+            char* eol = memchr(line, '\n', end - line);
+
+            if (eol == NULL)
+            {
+                eol = end;
+            }
+
+            *eol = '\0';
+
+            if (eol > line)
+            {
+                process_line(hctx, tctx, line, eol);
+            }
+
+            line = eol + 1;
+        }
+
+        free(chunk.buf);
+    }
+
+    tctx->ncells = coalesce_cells(tctx->cells, tctx->ncells);
+
+    return NULL;
+}
+
+static void queue_chunk(HiContext* hctx, char* buf, size_t len)
+{
+    pthread_mutex_lock(&hctx->lock);
+
+    while (hctx->qlen == hctx->qmax)
+    {
+        pthread_cond_wait(&hctx->cond_put, &hctx->lock);
+    }
+
+    HiChunk* chunk = hctx->queue + (hctx->qbeg + hctx->qlen) % hctx->qmax;
+    chunk->buf = buf;
+    chunk->len = len;
+    hctx->qlen++;
+
+    pthread_cond_signal(&hctx->cond_get);
+    pthread_mutex_unlock(&hctx->lock);
+}
+
+// reads the input and hands it to the workers in chunks ending at a line break
+
+static int process_input(HiContext* hctx, FILE* fileIn)
+{
+    int nthreads = hctx->nthreads;
+    int i;
+
+    hctx->qmax = nthreads * CHUNK_QUEUE;
+    hctx->queue = malloc(sizeof(HiChunk) * hctx->qmax);
+    hctx->qbeg = hctx->qlen = hctx->qdone = 0;
+
+    pthread_mutex_init(&hctx->lock, NULL);
+    pthread_cond_init(&hctx->cond_put, NULL);
+    pthread_cond_init(&hctx->cond_get, NULL);
+
+    hctx->threads = calloc(nthreads, sizeof(HiThread));
+
+    for (i = 0; i < nthreads; i++)
+    {
+        HiThread* tctx = hctx->threads + i;
+
+        tctx->hctx = hctx;
+        tctx->maxcells = CELLS_INIT;
+        tctx->cells = malloc(sizeof(HiCell) * tctx->maxcells);
+
+        pthread_create(&tctx->thread, NULL, worker, tctx);
+    }
+
+    char* carry = NULL;
+    size_t ncarry = 0;
+    int ok = 1;
+
+    while (1)
+    {
+        size_t size = MAX(CHUNK_SIZE, 2 * ncarry);
+        char* buf = malloc(size);
+
+        if (carry != NULL)
+        {
+            memcpy(buf, carry, ncarry);
+            free(carry);
+            carry = NULL;
+        }
+
+        size_t len = ncarry + fread(buf + ncarry, 1, size - ncarry, fileIn);
+        ncarry = 0;
+
+        if (len == 0)
+        {
+            free(buf);
+            break;
+        }
+
+        if (len == size)
+        {
+            char* eol = buf + len;
+
+            while (eol > buf && eol[-1] != '\n')
+            {
+                eol--;
+            }
+
+            // line longer than the chunk, continue it in the next one
+
+            if (eol == buf)
+            {
+                carry = buf;
+                ncarry = len;
+                continue;
+            }
+
+            ncarry = buf + len - eol;
+            len = eol - buf;
+
+            if (ncarry > 0)
+            {
+                carry = malloc(ncarry);
+                memcpy(carry, eol, ncarry);
+            }
+        }
+
+        queue_chunk(hctx, buf, len);
+    }
+
+    if (ferror(fileIn))
+    {
+        fprintf(stderr, "error: failed to read input\n");
+        ok = 0;
+    }
+
+    pthread_mutex_lock(&hctx->lock);
+    hctx->qdone = 1;
+    pthread_cond_broadcast(&hctx->cond_get);
+    pthread_mutex_unlock(&hctx->lock);
+
+    uint64_t ncells = 0;
+
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(hctx->threads[i].thread, NULL);
+        ncells += hctx->threads[i].ncells;
+    }
+
+    // merge the thread local cells
+
+    hctx->cells = malloc(sizeof(HiCell) * MAX(ncells, 1));
+    hctx->ncells = 0;
+
+    for (i = 0; i < nthreads; i++)
+    {
+        HiThread* tctx = hctx->threads + i;
+
+        memcpy(hctx->cells + hctx->ncells, tctx->cells, sizeof(HiCell) * tctx->ncells);
+        hctx->ncells += tctx->ncells;
+
+        free(tctx->cells);
+        tctx->cells = NULL;
+    }
+
+    hctx->ncells = coalesce_cells(hctx->cells, hctx->ncells);
+
+    pthread_mutex_destroy(&hctx->lock);
+    pthread_cond_destroy(&hctx->cond_put);
+    pthread_cond_destroy(&hctx->cond_get);
+    free(hctx->queue);
+
+    return ok;
+}
+
+static int write_matrix(HiContext* hctx, FILE* fileOut)
+{
+    HiCell* cells = hctx->cells;
+    uint64_t ncells = hctx->ncells;
+    uint64_t i, j;
+    int c;
+
+    HiBinHeader header;
+    bzero(&header, sizeof(HiBinHeader));
+
+    header.magic = HI_BIN_MAGIC;
+    header.version = HI_BIN_VERSION;
+    header.binsize = hctx->binsize;
+    header.ncontigs = hctx->ncontigs;
+    header.ncells = ncells;
+
+    for (i = 0; i < ncells; i++)
+    {
+        if (i == 0 || cells[i].a != cells[i - 1].a || cells[i].b != cells[i - 1].b)
+        {
+            header.npairs++;
+            header.nrows++;
+        }
+        else if (cells[i].ba != cells[i - 1].ba)
+        {
+            header.nrows++;
+        }
+    }
+
+    fwrite(&header, sizeof(HiBinHeader), 1, fileOut);
+
+    for (c = 0; c < hctx->ncontigs; c++)
+    {
+        uint32_t nbins = hctx->contigs[c].nbins;
+        fwrite(&nbins, sizeof(uint32_t), 1, fileOut);
+    }
+
+    // pair directory
+
+    uint64_t row = 0;
+
+    for (i = 0; i < ncells; i = j)
+    {
+        HiBinPair pair;
+
+        pair.a = cells[i].a;
+        pair.b = cells[i].b;
+        pair.row = row;
+        pair.nrows = 0;
+        pair.contacts = 0;
+
+        for (j = i; j < ncells && cells[j].a == pair.a && cells[j].b == pair.b; j++)
+        {
+            if (j == i || cells[j].ba != cells[j - 1].ba)
+            {
+                pair.nrows++;
+            }
+
+            pair.contacts += cells[j].count;
+        }
+
+        row += pair.nrows;
+
+        fwrite(&pair, sizeof(HiBinPair), 1, fileOut);
+    }
+
+    // rows
+
+    for (i = 0; i < ncells; i++)
+    {
+        if (i == 0 || cells[i].a != cells[i - 1].a || cells[i].b != cells[i - 1].b || cells[i].ba != cells[i - 1].ba)
+        {
+            fwrite(&(cells[i].ba), sizeof(uint32_t), 1, fileOut);
+        }
+    }
+
+    for (i = 0; i < ncells; i++)
+    {
+        if (i == 0 || cells[i].a != cells[i - 1].a || cells[i].b != cells[i - 1].b || cells[i].ba != cells[i - 1].ba)
+        {
+            fwrite(&i, sizeof(uint64_t), 1, fileOut);
+        }
+    }
+
+    fwrite(&ncells, sizeof(uint64_t), 1, fileOut);
+
+    // cells
+
+    for (i = 0; i < ncells; i++)
+    {
+        fwrite(&(cells[i].bb), sizeof(uint32_t), 1, fileOut);
+    }
+
+    for (i = 0; i < ncells; i++)
+    {
+        fwrite(&(cells[i].count), sizeof(uint32_t), 1, fileOut);
+    }
+
+    return !ferror(fileOut);
+}
+
+/*
+ * contacts near the ends of two contigs support joining them at those ends.
+ * the end regions are endlen bases long, at most half of the contig, and
+ * rounded to bins. the counts are normalized by the lengths of the end regions,
+ * so that short contigs aren't penalized.
+ */
+
+static int write_links(HiContext* hctx, FILE* fileOut)
+{
+    static const char* ends[4] = { "hh", "ht", "th", "tt" };
+
+    HiCell* cells = hctx->cells;
+    uint64_t ncells = hctx->ncells;
+    uint64_t binsize = hctx->binsize;
+    uint64_t i, j;
+
+    fprintf(fileOut, "# contigA contigB contacts density hh ht th tt ends score\n");
+
+    for (i = 0; i < ncells; i = j)
+    {
+        uint32_t a = cells[i].a;
+        uint32_t b = cells[i].b;
+
+        if (a == b)
+        {
+            for (j = i; j < ncells && cells[j].a == a && cells[j].b == b; j++) ;
+            continue;
+        }
+
+        HiContig* ca = hctx->contigs + a;
+        HiContig* cb = hctx->contigs + b;
+
+        uint64_t enda = MIN((uint64_t)hctx->endlen, ca->len / 2);
+        uint64_t endb = MIN((uint64_t)hctx->endlen, cb->len / 2);
+
+        uint64_t contacts = 0;
+        uint64_t nend[4] = { 0, 0, 0, 0 };
+
+        for (j = i; j < ncells && cells[j].a == a && cells[j].b == b; j++)
+        {
+            uint64_t beg_a = cells[j].ba * binsize;
+            uint64_t beg_b = cells[j].bb * binsize;
+
+            int head_a = ( beg_a < enda );
+            int tail_a = ( beg_a + binsize > ca->len - enda );
+            int head_b = ( beg_b < endb );
+            int tail_b = ( beg_b + binsize > cb->len - endb );
+
+            contacts += cells[j].count;
+
+            if (head_a && head_b) nend[0] += cells[j].count;
+            if (head_a && tail_b) nend[1] += cells[j].count;
+            if (tail_a && head_b) nend[2] += cells[j].count;
+            if (tail_a && tail_b) nend[3] += cells[j].count;
+        }
+
+        int best = 0;
+        int k;
+
+        for (k = 1; k < 4; k++)
+        {
+            if (nend[k] > nend[best])
+            {
+                best = k;
+            }
+        }
+
+        double density = contacts / ( (ca->len / 1.0e6) * (cb->len / 1.0e6) );
+        double score = 0;
+
+        if (enda > 0 && endb > 0)
+        {
+            score = nend[best] / ( (enda / 1.0e3) * (endb / 1.0e3) );
+        }
+
+        fprintf(fileOut, "%s %s %" PRIu64 " %.3f %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %s %.6f\n",
+                ca->name, cb->name, contacts, density,
+                nend[0], nend[1], nend[2], nend[3],
+                nend[best] ? ends[best] : "--", score);
+    }
+
+    return !ferror(fileOut);
+}
+
+static void usage()
+{
+    printf( "usage: [-v] [-j <int>] [-b <int>] [-q <int>] [-e <int>] [-l <links.txt>] contigs.dam output.cmx [pairs.sam|-]\n\n" );
+
+    printf( "Bins Hi-C read pairs aligned to the contigs of the DAM into sparse contact matrices.\n" );
+    printf( "The alignments are read as SAM text from pairs.sam or stdin, ie. samtools view -h pairs.bam.\n" );
+    printf( "The reference names have to match the sequence names of the fasta file the DAM was built from.\n\n" );
+
+    printf( "options: -v        verbose\n" );
+    printf( "         -j n      number of threads (default %d)\n", DEF_ARG_J );
+    printf( "         -b n      bin size (default %d)\n", DEF_ARG_B );
+    printf( "         -q n      minimum mapping quality of both mates (default %d)\n", DEF_ARG_Q );
+    printf( "         -e n      length of the contig ends scored for links (default %d)\n", DEF_ARG_E );
+    printf( "         -l file   write the links between the contigs to file\n" );
+    printf( "                   contacts and their density per Mb^2, the contacts between the head (h)\n" );
+    printf( "                   and tail (t) ends of the contigs, the best supported ends and their\n" );
+    printf( "                   contacts normalized by the length of the ends in kb\n" );
+}
+
+int main(int argc, char* argv[])
+{
+    HiContext hctx;
+
+    bzero(&hctx, sizeof(HiContext));
+
+    // process arguments
+
+    char* pathLinks = NULL;
+
+    hctx.binsize = DEF_ARG_B;
+    hctx.mapq = DEF_ARG_Q;
+    hctx.endlen = DEF_ARG_E;
+    hctx.nthreads = DEF_ARG_J;
+
+    opterr = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "vj:b:q:e:l:")) != -1)
+    {
+        switch (c)
+        {
+            case 'v':
+                      hctx.verbose = 1;
+                      break;
+
+            case 'j':
+                      hctx.nthreads = atoi(optarg);
+                      break;
+
+            case 'b':
+                      hctx.binsize = atoi(optarg);
+                      break;
+
+            case 'q':
+                      hctx.mapq = atoi(optarg);
+                      break;
+
+            case 'e':
+                      hctx.endlen = atoi(optarg);
+                      break;
+
+            case 'l':
+                      pathLinks = optarg;
+                      break;
+
+            default:
+                      usage();
+                      exit(1);
+        }
+    }
+
+    if (argc - optind < 2 || argc - optind > 3)
+    {
+        usage();
+        exit(1);
+    }
+
+    char* pathDam = argv[optind++];
+    char* pathMatrix = argv[optind++];
+    char* pathSam = optind < argc ? argv[optind++] : "-";
+
+    if (hctx.binsize < 1)
+    {
+        fprintf(stderr, "error: invalid bin size %d\n", hctx.binsize);
+        exit(1);
+    }
+
+    if (hctx.nthreads < 1)
+    {
+        fprintf(stderr, "error: invalid number of threads %d\n", hctx.nthreads);
+        exit(1);
+    }
+
+    if (hctx.endlen < 1)
+    {
+        fprintf(stderr, "error: invalid end length %d\n", hctx.endlen);
+        exit(1);
+    }
+
+    if (!load_contigs(&hctx, pathDam))
+    {
+        exit(1);
+    }
+
+    if (hctx.verbose)
+    {
+        printf("%d contigs\n", hctx.ncontigs);
+    }
+
+    FILE* fileSam = stdin;
+
+    if (strcmp(pathSam, "-") != 0 && (fileSam = fopen(pathSam, "r")) == NULL)
+    {
+        fprintf(stderr, "error: could not open %s\n", pathSam);
+        exit(1);
+    }
+
+    FILE* fileMatrix = fopen(pathMatrix, "w");
+
+    if (fileMatrix == NULL)
+    {
+        fprintf(stderr, "error: could not open %s\n", pathMatrix);
+        exit(1);
+    }
+
+    FILE* fileLinks = NULL;
+
+    if (pathLinks && (fileLinks = fopen(pathLinks, "w")) == NULL)
+    {
+        fprintf(stderr, "error: could not open %s\n", pathLinks);
+        exit(1);
+    }
+
+    // bin the contacts
+
+    if (!process_input(&hctx, fileSam))
+    {
+        exit(1);
+    }
+
+    if (fileSam != stdin)
+    {
+        fclose(fileSam);
+    }
+
+    if (hctx.verbose)
+    {
+        uint64_t nlines = 0, npairs = 0, nfiltered = 0, nunknown = 0, nrange = 0;
+        int i;
+
+        for (i = 0; i < hctx.nthreads; i++)
+        {
+            HiThread* tctx = hctx.threads + i;
+
+            nlines += tctx->nlines;
+            npairs += tctx->npairs;
+            nfiltered += tctx->nfiltered;
+            nunknown += tctx->nunknown;
+            nrange += tctx->nrange;
+        }
+
+        printf("%" PRIu64 " lines, %" PRIu64 " pairs\n", nlines, npairs);
+        printf("%" PRIu64 " filtered, %" PRIu64 " unknown reference, %" PRIu64 " out of range\n",
+               nfiltered, nunknown, nrange);
+        printf("%" PRIu64 " contacts in %" PRIu64 " cells\n",
+               npairs - nfiltered - nunknown - nrange, hctx.ncells);
+    }
+
+    // output
+
+    if (!write_matrix(&hctx, fileMatrix))
+    {
+        fprintf(stderr, "error: failed to write %s\n", pathMatrix);
+        exit(1);
+    }
+
+    fclose(fileMatrix);
+
+    if (fileLinks)
+    {
+        if (!write_links(&hctx, fileLinks))
+        {
+            fprintf(stderr, "error: failed to write %s\n", pathLinks);
+            exit(1);
+        }
+
+        fclose(fileLinks);
+    }
+
+    // cleanup
+
+    for (c = 0; c < hctx.ncontigs; c++)
+    {
+        free(hctx.contigs[c].name);
+    }
+
+    free(hctx.contigs);
+    free(hctx.hash);
+    free(hctx.threads);
+    free(hctx.cells);
+
+    return 0;
+}
@@ -71,7 +71,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <limits.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "types.h"
 #include "bitarr.h" /* exported prototypes */
 #ifdef NEED_FPUTS_PROTO
@@ -82,6 +89,11 @@ typedef struct {elem_t size; bit *vector;} BitVector;
 
 static void first_is_biggest(BitVector bv[2], unsigned *, unsigned *);
 
+static elem_t count_bytes(const bit arr[], size_t n);
+static void and_bytes(bit dst[], const bit a[], const bit b[], size_t n);
+static void or_bytes(bit dst[], const bit a[], const bit b[], size_t n);
+static void xor_bytes(bit dst[], const bit a[], const bit b[], size_t n);
+
 
 /*                                                                  *\
    ----------------------------------------------------------------
@@ -155,6 +167,50 @@ static void first_is_biggest(BitVector bv[2], unsigned *, unsigned *);
 #endif
 
 
+/*
+   Word access
+
+   The arrays are processed 8 bytes at a time.  Bit i of a word is bit
+   i % BITS_SZ of byte i / BITS_SZ of the word, as for the bytes.  The
+   arrays need not be aligned (see the read masks of TKhomogenize).
+*/
+
+static inline uint64_t load64(const bit * p)
+{
+    uint64_t w;
+
+    memcpy(&w, p, sizeof(w));
+
+#if __ORDER_BIG_ENDIAN__ == __BYTE_ORDER__
+    w = __builtin_bswap64(w);
+#endif
+
+    return w;
+}
+
+static inline void store64(bit * p, uint64_t w)
+{
+#if __ORDER_BIG_ENDIAN__ == __BYTE_ORDER__
+    w = __builtin_bswap64(w);
+#endif
+
+    memcpy(p, &w, sizeof(w));
+}
+
+static inline elem_t popcount64(uint64_t x)
+{
+#if defined(__POPCNT__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ( (x >> 1) & 0x5555555555555555ull );
+    x = ( x & 0x3333333333333333ull ) + ( (x >> 2) & 0x3333333333333333ull );
+    x = ( x + (x >> 4) ) & 0x0f0f0f0f0f0f0f0full;
+
+    return (x * 0x0101010101010101ull) >> 56;
+#endif
+}
+
+
 /*                                                                  *\
    ----------------------------------------------------------------
                   Initialization and Creation Code
@@ -222,12 +278,7 @@ void ba_copy(      bit    dst[],
          `src' is unchanged.
    Used by: ba_union()
 */
-            elem_t nelem  = NELEM(size,(BITS_SZ));
-   register elem_t i;
-
-   for (i=0; i < nelem; i++) {
-      dst[i] = src[i];
-   }
+   memcpy(dst, src, NELEM(size,(BITS_SZ)) * sizeof(bit));
 } /* ba_copy() */
 
 
@@ -260,49 +311,50 @@ void ba_assign(      bit    arr[],
 } /* ba_assign() */
 
 
+// sets or clears the bits elem_beg..elem_end (inclusive), whole bytes are filled with memset
+
 void ba_assign_range(bit arr[], elem_t elem_beg, elem_t elem_end, const bool value)
 {
-    if (value)
+    if (elem_beg > elem_end)
     {
-        do
-        {
-            arr[elem_beg / BITS_SZ] |= (1 << (elem_beg % BITS_SZ));
-            elem_beg++;
-        } while ( elem_beg % BITS_SZ && elem_beg <= elem_end);
+        ba_assign(arr, elem_beg, value);
+        return ;
+    }
 
-        while ( (elem_end + 1) % BITS_SZ && elem_end >= elem_beg)
-        {
-            arr[elem_end / BITS_SZ] |= (1 << (elem_end % BITS_SZ));
-            elem_end--;
-        }
+    elem_t first = elem_beg / BITS_SZ;
+    elem_t last = elem_end / BITS_SZ;
+    bit mfirst = (bit)( (bit)~0 << (elem_beg % BITS_SZ) );
+    bit mlast = (bit)( (bit)~0 >> (BITS_SZ - 1 - elem_end % BITS_SZ) );
 
-        while (elem_beg < elem_end)
-        {
-            arr[elem_beg / BITS_SZ] = ~0;
-            elem_beg += BITS_SZ;
-        }
+    if (first == last)
+    {
+        mfirst &= mlast;
+    }
+
+    if (value)
+    {
+        arr[first] |= mfirst;
     }
     else
     {
-        do
-        {
-            arr[elem_beg / BITS_SZ] &= ~(1 << (elem_beg % BITS_SZ));
-            elem_beg++;
-        } while ( elem_beg % BITS_SZ && elem_beg <= elem_end);
+        arr[first] &= (bit)~mfirst;
+    }
 
-        while ( (elem_end + 1) % BITS_SZ && elem_end >= elem_beg)
-        {
-            arr[elem_end / BITS_SZ] &= ~(1 << (elem_end % BITS_SZ));
-            elem_end--;
-        }
-                
-        while (elem_beg < elem_end)
-        {
-            arr[elem_beg / BITS_SZ] = 0;
-            elem_beg += BITS_SZ;
-        }
+    if (first == last)
+    {
+        return ;
     }
 
+    memset(arr + first + 1, value ? 0xff : 0, (last - first - 1) * sizeof(bit));
+
+    if (value)
+    {
+        arr[last] |= mlast;
+    }
+    else
+    {
+        arr[last] &= (bit)~mlast;
+    }
 }
 
 bool ba_value(const bit    arr[],
@@ -356,12 +408,8 @@ void ba_all_assign(      bit    arr[],
    Used by: ba_ul2b()
 */
             elem_t nelem  = NELEM(size,(BITS_SZ));
-            bit    setval = (value) ?~0 :0;
-   register elem_t i;
 
-   for (i=0; i < nelem; i++) {
-      arr[i] = setval;
-   }
+   memset(arr, (value) ?0xff :0, nelem * sizeof(bit));
    /* force canonical form */
    CANONIZE(arr,nelem,size);
 } /* ba_all_assign() */
@@ -481,38 +529,7 @@ unsigned long ba_count(const bit    arr[],
          are 1, then an unexpected value may be returned.
 */
 
-  register     unsigned long count;
-  register     elem_t        i;
-               elem_t        nelem = NELEM(size,(BITS_SZ));
-
-  static const unsigned bitcount[256] = {0, 1, 1, 2, 1, 2, 2, 3, 1, \
-        2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, \
-        4, 4, 5, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, \
-        3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, \
-        3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, \
-        4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, \
-        5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 1, \
-        2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, \
-        4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, \
-        4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, \
-        6, 6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, \
-        4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 3, 4, 4, 5, 4, \
-        5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, \
-        6, 6, 7, 6, 7, 7, 8};
-
-   if (bitcount[(sizeof bitcount / sizeof bitcount[0]) - 1] == BITS_SZ) {
-     /* lookup table will speed this up a lot */
-     for (count = 0L, i = 0; i < nelem; i++) {
-        count += bitcount[arr[i]];
-     }
-   } else {
-     for (count = 0L, i = 0; i < size; i++) {
-        if (ba_value(arr, i)) {
-           count++;
-        }
-     }
-   }
-   return (count);
+   return (count_bytes(arr, NELEM(size,(BITS_SZ))));
 } /* ba_count() */
 
 
@@ -544,7 +561,6 @@ bool ba_intersection(      bit    first[],
        `second'.
  */
 
-   register elem_t i;
             elem_t numints;
             unsigned  largest=0, smallest=1;
             BitVector bv[2];
@@ -561,10 +577,7 @@ bool ba_intersection(      bit    first[],
       return(FALSE); /* can't get memory, so can't continue */
    } else {
       numints = NELEM(size_second,(BITS_SZ));
-      for (i=0; i < numints; i++) {
-         (*result)[i] = (bv[smallest].vector[i] & \
-                         bv[largest].vector[i]);
-      }
+      and_bytes(*result, bv[smallest].vector, bv[largest].vector, numints);
       /* bits beyond size_second should be zero -- canonical form */
       CANONIZE(*result, numints, size_second);
       return(TRUE);
@@ -601,7 +614,6 @@ bool ba_union(      bit    first[],
          `second'.
  */
 
-    register elem_t    i;
              elem_t    numints;
              unsigned  largest=0, smallest=1;
              BitVector bv[2];
@@ -617,9 +629,7 @@ bool ba_union(      bit    first[],
    } else {
       ba_copy(*result, bv[largest].vector, bv[largest].size);
       numints = NELEM(bv[smallest].size,(BITS_SZ));
-      for (i=0; i < numints; i++) {
-         (*result)[i] |= bv[smallest].vector[i];
-      }
+      or_bytes(*result, *result, bv[smallest].vector, numints);
       CANONIZE(*result, numints, bv[largest].size);
       return(TRUE);
    }
@@ -654,7 +664,6 @@ bool ba_diff(      bit    first[],
    NOTE: This runs faster if the `first' array is not smaller than
          `second'.
  */
-    register elem_t    i;
              elem_t    numints;
              unsigned  largest=0, smallest=1;
              BitVector bv[2];
@@ -670,9 +679,7 @@ bool ba_diff(      bit    first[],
    } else {
       ba_copy(*diff, bv[largest].vector, bv[largest].size);
       numints = NELEM(bv[smallest].size,(BITS_SZ));
-      for (i=0; i < numints; i++) {
-         (*diff)[i] ^= bv[smallest].vector[i];
-      }
+      xor_bytes(*diff, *diff, bv[smallest].vector, numints);
       CANONIZE(*diff, numints, bv[largest].size);
       return(TRUE);
    }
@@ -692,9 +699,12 @@ void ba_complement(      bit    arr[],
    SEE ALSO: ba_toggle()
 */
             elem_t nelem = NELEM(size,(BITS_SZ));
-   register elem_t i;
+   register elem_t i = 0;
 
-   for (i=0; i < nelem; i++) {
+   for ( ; i + sizeof(uint64_t) <= nelem; i += sizeof(uint64_t)) {
+      store64(arr + i, ~load64(arr + i));
+   }
+   for ( ; i < nelem; i++) {
       arr[i] = ~arr[i];
    }
    /* force canonical form */
@@ -716,20 +726,295 @@ unsigned long ba_dotprod(const bit    first[],
    POST: The scalar product of the two vectors represented by the
          first `size_first' elements of `first' and the first
          `size_second' elements of `second' have been returned.
+   NOTE: Every pair of set bits contributes 1, i.e. the product of
+         the number of set bits of the two vectors.
 */
-   register elem_t        i, j;
-   register unsigned long sum = 0L;
-
-   for (i=0; i < size_first; i++) {
-      for (j=0; j < size_second; j++) {
-         sum += (first[i/BITS_SZ]  & (1<<(i % BITS_SZ))) \
-               &&                                        \
-                (second[j/BITS_SZ] & (1<<(j % BITS_SZ)));
-      }
-   }
-   return (sum);
+
+   return (ba_count_range(first, 0, size_first) * ba_count_range(second, 0, size_second));
 } /* ba_dotprod() */
 
+// number of set bits in [elem_beg, elem_end)
+
+elem_t ba_count_range(const bit arr[], elem_t elem_beg, elem_t elem_end)
+{
+    if (elem_beg >= elem_end)
+    {
+        return 0;
+    }
+
+    elem_t first = elem_beg / BITS_SZ;
+    elem_t last = (elem_end - 1) / BITS_SZ;
+    bit mfirst = (bit)( (bit)~0 << (elem_beg % BITS_SZ) );
+    bit mlast = (bit)( (bit)~0 >> (BITS_SZ - 1 - (elem_end - 1) % BITS_SZ) );
+
+    if (first == last)
+    {
+        return popcount64(arr[first] & mfirst & mlast);
+    }
+
+    return popcount64(arr[first] & mfirst) +
+           count_bytes(arr + first + 1, last - first - 1) +
+           popcount64(arr[last] & mlast);
+}
+
+// position of the first bit >= elem with the given value, size if there is none
+
+elem_t ba_find(const bit arr[], const elem_t size, elem_t elem, const bool value)
+{
+    if (elem >= size)
+    {
+        return size;
+    }
+
+    uint64_t flip = value ? 0 : ~(uint64_t)0;
+    elem_t nelem = NELEM(size, (BITS_SZ));
+    elem_t i = elem / BITS_SZ;
+    uint64_t w = ( (arr[i] ^ flip) & 0xff ) & ( 0xffu << (elem % BITS_SZ) );
+
+    // finish the byte of elem, then go on in words while there are 8 bytes left
+
+    while (w == 0)
+    {
+        i += 1;
+
+        if (i + sizeof(uint64_t) <= nelem)
+        {
+            w = load64(arr + i) ^ flip;
+
+            if (w == 0)
+            {
+                i += sizeof(uint64_t) - 1;
+            }
+            else
+            {
+                elem = i * BITS_SZ + __builtin_ctzll(w);
+
+                return (elem < size) ? elem : size;
+            }
+        }
+        else if (i < nelem)
+        {
+            w = (arr[i] ^ flip) & 0xff;
+        }
+        else
+        {
+            return size;
+        }
+    }
+
+    elem = i * BITS_SZ + __builtin_ctzll(w);
+
+    return (elem < size) ? elem : size;
+}
+
+/*
+   Rank and select
+
+   The number of set bits before every BA_RANK_BLOCK bits is sampled, a
+   rank is the sample plus the count of at most 64 bytes, select does a
+   binary search over the samples.  The index refers to the array and
+   has to be rebuilt after it is modified.
+*/
+
+ba_rank_index * ba_rank_new(const bit arr[], const elem_t size)
+{
+    ba_rank_index* idx = malloc( sizeof(ba_rank_index) );
+
+    if (idx == NULL)
+    {
+        return NULL;
+    }
+
+    idx->arr = arr;
+    idx->size = size;
+    idx->nblocks = NELEM(size, BA_RANK_BLOCK);
+    idx->ranks = malloc( sizeof(elem_t) * (idx->nblocks + 1) );
+
+    if (idx->ranks == NULL)
+    {
+        free(idx);
+        return NULL;
+    }
+
+    elem_t b;
+    elem_t rank = 0;
+
+    for (b = 0; b < idx->nblocks; b++)
+    {
+        elem_t beg = b * BA_RANK_BLOCK;
+        elem_t end = beg + BA_RANK_BLOCK;
+
+        idx->ranks[b] = rank;
+        rank += ba_count_range(arr, beg, end < size ? end : size);
+    }
+
+    idx->ranks[idx->nblocks] = rank;
+
+    return idx;
+}
+
+void ba_rank_free(ba_rank_index * idx)
+{
+    if (idx != NULL)
+    {
+        free(idx->ranks);
+        free(idx);
+    }
+}
+
+// number of set bits before elem
+
+elem_t ba_rank(const ba_rank_index * idx, const elem_t elem)
+{
+    if (elem >= idx->size)
+    {
+        return idx->ranks[idx->nblocks];
+    }
+
+    elem_t b = elem / BA_RANK_BLOCK;
+
+    return idx->ranks[b] + ba_count_range(idx->arr, b * BA_RANK_BLOCK, elem);
+}
+
+// position of the set bit with rank k (counting from 0), size if there are fewer
+
+elem_t ba_select(const ba_rank_index * idx, elem_t k)
+{
+    if (k >= idx->ranks[idx->nblocks])
+    {
+        return idx->size;
+    }
+
+    // last block starting with a rank <= k
+
+    elem_t lo = 0;
+    elem_t hi = idx->nblocks - 1;
+
+    while (lo < hi)
+    {
+        elem_t mid = (lo + hi + 1) / 2;
+
+        if (idx->ranks[mid] <= k)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    k -= idx->ranks[lo];
+
+    const bit* arr = idx->arr;
+    elem_t nelem = NELEM(idx->size, (BITS_SZ));
+    elem_t i = lo * (BA_RANK_BLOCK / BITS_SZ);
+    elem_t n;
+
+    while (i + sizeof(uint64_t) <= nelem && k >= (n = popcount64( load64(arr + i) )))
+    {
+        k -= n;
+        i += sizeof(uint64_t);
+    }
+
+    while (k >= (n = popcount64(arr[i])))
+    {
+        k -= n;
+        i += 1;
+    }
+
+    bit byte = arr[i];
+
+    while (k > 0)
+    {
+        byte &= byte - 1;
+        k -= 1;
+    }
+
+    return i * BITS_SZ + __builtin_ctz(byte);
+}
+
+/*
+   Byte array kernels
+*/
+
+static elem_t count_bytes(const bit arr[], size_t n)
+{
+    elem_t count = 0;
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    // nibble lookup, the byte counts are summed by sad
+
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+
+    for ( ; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256( (const __m256i*)(arr + i) );
+        __m256i c = _mm256_add_epi8( _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+                                     _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low)) );
+
+        acc = _mm256_add_epi64( acc, _mm256_sad_epu8(c, _mm256_setzero_si256()) );
+    }
+
+    count += _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+             _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+#endif
+
+    for ( ; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t))
+    {
+        count += popcount64( load64(arr + i) );
+    }
+
+    for ( ; i < n; i++)
+    {
+        count += popcount64(arr[i]);
+    }
+
+    return count;
+}
+
+#if defined(__AVX2__)
+#define BYTES_OP_AVX2(vop)                                                  \
+    for ( ; i + 32 <= n; i += 32)                                           \
+    {                                                                       \
+        __m256i va = _mm256_loadu_si256( (const __m256i*)(a + i) );         \
+        __m256i vb = _mm256_loadu_si256( (const __m256i*)(b + i) );         \
+                                                                            \
+        _mm256_storeu_si256( (__m256i*)(dst + i), vop(va, vb) );            \
+    }
+#else
+#define BYTES_OP_AVX2(vop)
+#endif
+
+// dst = a op b over n bytes, dst may be one of the operands
+
+#define BYTES_OP(name, op, vop)                                             \
+static void name(bit dst[], const bit a[], const bit b[], size_t n)        \
+{                                                                           \
+    size_t i = 0;                                                           \
+                                                                            \
+    BYTES_OP_AVX2(vop)                                                      \
+                                                                            \
+    for ( ; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t))              \
+    {                                                                       \
+        store64( dst + i, load64(a + i) op load64(b + i) );                 \
+    }                                                                       \
+                                                                            \
+    for ( ; i < n; i++)                                                     \
+    {                                                                       \
+        dst[i] = a[i] op b[i];                                              \
+    }                                                                       \
+}
+
+BYTES_OP(and_bytes, &, _mm256_and_si256)
+BYTES_OP(or_bytes, |, _mm256_or_si256)
+BYTES_OP(xor_bytes, ^, _mm256_xor_si256)
+
+
 /*                                                                  *\
    ----------------------------------------------------------------
                              Internal Function
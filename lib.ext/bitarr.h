@@ -36,3 +36,23 @@ char * ba_b2str(const bit arr[], const elem_t size, char * dest);
 bool ba_print(const bit arr[], const elem_t size, FILE * dest);
 
 size_t ba_bufsize(const elem_t nelems);
+
+elem_t ba_count_range(const bit arr[], elem_t elem_beg, elem_t elem_end);
+elem_t ba_find(const bit arr[], const elem_t size, elem_t elem, const bool value);
+
+// rank/select index over a bit array, see bitarr.c
+
+#define BA_RANK_BLOCK 512
+
+typedef struct
+{
+    const bit* arr;
+    elem_t size;
+    elem_t* ranks;          // set bits before each block of BA_RANK_BLOCK bits, nblocks + 1
+    elem_t nblocks;
+} ba_rank_index;
+
+ba_rank_index * ba_rank_new(const bit arr[], const elem_t size);
+void ba_rank_free(ba_rank_index * idx);
+elem_t ba_rank(const ba_rank_index * idx, const elem_t elem);
+elem_t ba_select(const ba_rank_index * idx, elem_t k);
@@ -10,9 +10,15 @@ import array
 class Track(object):
     STRUCT_TRACK_HEADER    = "@ii"
 
-    STRUCT_TRACK_HEADER_V2 = "@HHLQQQQQQ"
+    STRUCT_TRACK_HEADER_V2 = "@HHIQQQQQQQ"
     STRUCT_CHUNK_HEADER    = "@Q"
 
+    CHUNK_SIZED = 0x80
+
+    CODEC_ZLIB = 0
+    CODEC_ZSTD = 1
+    CODEC_NONE = 2
+
     def __init__(self):
         self.tName = None
         self.db = None
@@ -21,22 +27,42 @@ class Track(object):
         self.data = None
 
     @classmethod
-    def uncompress_chunks(cls, fin):
-        hsize = struct.calcsize(Track.STRUCT_CHUNK_HEADER)
-        data = bytes()
-
-        while True:
-            chunk = fin.read(hsize)
-
-            if len(chunk) == 0:
-                break
-
-            (clen, ) = struct.unpack(Track.STRUCT_CHUNK_HEADER, chunk)
+    def uncompress(cls, buf):
+        """inflates the chunks of a compressed track, see lib/compression.h"""
 
-            chunk = fin.read(clen)
-            data += zlib.decompress( chunk )
+        hsize = struct.calcsize(Track.STRUCT_CHUNK_HEADER)
+        data = []
+        pos = 0
+
+        while pos < len(buf):
+            (header, ) = struct.unpack_from(Track.STRUCT_CHUNK_HEADER, buf, pos)
+            pos += hsize
+
+            if (header >> 56) & Track.CHUNK_SIZED:
+                codec = (header >> 56) & ~Track.CHUNK_SIZED
+                clen = header & ((1 << 28) - 1)
+            else:
+                codec = Track.CODEC_ZLIB
+                clen = header & ((1 << 56) - 1)
+
+            chunk = buf[ pos : pos + clen ]
+            pos += clen
+
+            if codec == Track.CODEC_ZLIB:
+                data.append( zlib.decompress(chunk) )
+            elif codec == Track.CODEC_NONE:
+                data.append( bytes(chunk) )
+            elif codec == Track.CODEC_ZSTD:
+                import zstandard
+                data.append( zstandard.ZstdDecompressor().decompress(chunk, max_output_size = (header >> 28) & ((1 << 28) - 1)) )
+            else:
+                raise ValueError("unknown compression codec {}".format(codec))
+
+        return b"".join(data)
 
-        return data
+    @classmethod
+    def uncompress_chunks(cls, fin, clen):
+        return Track.uncompress( fin.read(clen) )
 
     @classmethod
     def from_data(cls, anno, data):
@@ -96,18 +122,18 @@ class Track(object):
             # t.data = numpy.fromfile(fileData, numpy.int32).tolist()
         else:
             ht = fileAnno.read( struct.calcsize(Track.STRUCT_TRACK_HEADER_V2) )
-            (t.version, t.size, dummy, t.tlen, t.clen, t.cdlen, dummy, dummy, dummy) = struct.unpack(Track.STRUCT_TRACK_HEADER_V2, ht)
+            (t.version, t.size, dummy, t.tlen, t.clen, t.cdlen, dummy, dummy, dummy, dummy) = struct.unpack(Track.STRUCT_TRACK_HEADER_V2, ht)
 
             t.anno = array.array("Q")
-            t.anno.frombytes( Track.uncompress_chunks(fileAnno) )
+            t.anno.frombytes( Track.uncompress_chunks(fileAnno, t.clen) )
 
-            # t.anno = numpy.frombuffer(Track.uncompress_chunks(fileAnno), numpy.uint64).tolist()
+            # t.anno = numpy.frombuffer(Track.uncompress_chunks(fileAnno, t.clen), numpy.uint64).tolist()
             t.anno = [ int(x / 4) for x in t.anno ]
 
             t.data = array.array(typecode4b)
-            t.data.frombytes( Track.uncompress_chunks(fileData) )
+            t.data.frombytes( Track.uncompress_chunks(fileData, t.cdlen) )
 
-            # t.data = numpy.frombuffer(Track.uncompress_chunks(fileData), numpy.int32).tolist()
+            # t.data = numpy.frombuffer(Track.uncompress_chunks(fileData, t.cdlen), numpy.int32).tolist()
 
         fileAnno.close()
         fileData.close()
@@ -136,6 +162,86 @@ class Track(object):
         return []
 
 
+class Stats(object):
+    """statistics of a DB as cached by DBstats in .<db>.stats, see DB_Stats_Load in db/DB.c"""
+
+    VERSION = 1
+
+    def __init__(self):
+        self.dam = False
+        self.nreads = 0
+        self.totlen = 0
+        self.maxlen = 0
+        self.ave = 0
+        self.dev = 0
+        self.freq = (0.0, 0.0, 0.0, 0.0)
+        self.blocks = []    # (reads, bases, cost) of the blocks 1..n
+        self.bin = 0
+        self.hist = {}      # bin -> (reads, bases)
+
+    @classmethod
+    def key(cls, path):
+        """stats file of the DB at path and the key it has to carry, None if the DB is missing"""
+
+        (dbPath, dbName) = os.path.split(path)
+
+        for suffix in (".db", ".dam"):
+            if dbName.endswith(suffix):
+                dbName = dbName[ : -len(suffix) ]
+
+        for suffix in (".db", ".dam"):
+            stub = os.path.join(dbPath, dbName + suffix)
+            idx = os.path.join(dbPath, "." + dbName + ".idx")
+
+            if os.path.exists(stub) and os.path.exists(idx):
+                (sstub, sidx) = (os.stat(stub), os.stat(idx))
+                key = (sstub.st_size, int(sstub.st_mtime), sidx.st_size, int(sidx.st_mtime))
+
+                return (os.path.join(dbPath, "." + dbName + ".stats"), key)
+
+        return (None, None)
+
+    @classmethod
+    def from_db(cls, path):
+        """the cached statistics if they are current, None otherwise"""
+
+        (spath, key) = Stats.key(path)
+
+        if spath == None or not os.path.exists(spath):
+            return None
+
+        values = {}
+        rows = []
+
+        for line in open(spath):
+            if line.startswith(" "):
+                rows.append( [ int(x) for x in line.split() ] )
+            else:
+                (name, value) = line.split("=", 1)
+                values[ name.strip() ] = value.split()
+
+                if name.strip() == "bins":
+                    bins = len(rows)
+
+        if int(values["stats"][0]) != Stats.VERSION or tuple( int(x) for x in values["key"] ) != key:
+            return None
+
+        s = cls()
+
+        s.dam = values["dam"][0] == "1"
+        s.nreads = int(values["reads"][0])
+        s.totlen = int(values["bases"][0])
+        s.maxlen = int(values["maxlen"][0])
+        s.ave = int(values["average"][0])
+        s.dev = int(values["deviation"][0])
+        s.freq = tuple( float(x) for x in values["freq"] )
+        s.blocks = [ tuple(row) for row in rows[ : bins ] ]
+        s.bin = int(values["bins"][0])
+        s.hist = dict( (row[0], (row[1], row[2])) for row in rows[ bins : ] )
+
+        return s
+
+
 class DB(object):
     STRUCT_HITS_DB    = "@iffffiqiiiPiPPP"
     STRUCT_HITS_READ  = "@iqqi4x" # pad to 32 byte
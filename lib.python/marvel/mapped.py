@@ -0,0 +1,394 @@
+
+# memory mapped access to .las files, DBs and tracks through numpy
+#
+# LASMap exposes the overlap records as numpy structured arrays (OVL_DTYPE), using
+# the .idx written next to the .las (see lib/lasidx.h) to locate the piles. traces
+# are returned as views into the map. DBMap maps the read index and the bases,
+# TrackMap the anno and data of a track.
+#
+# the record walks and the unpacking of the bases are done by native.so if it was
+# built (make -C lib.python), otherwise numpy does them.
+
+import ctypes
+import mmap
+import os
+import struct
+
+import numpy
+
+from marvel.DB import Track
+
+OVL_DTYPE = numpy.dtype([ ("tlen", "i4"), ("diffs", "i4"),
+                          ("ab", "i4"), ("bb", "i4"), ("ae", "i4"), ("be", "i4"),
+                          ("flags", "u4"), ("aread", "i4"), ("bread", "i4"), ("pad", "V4") ])
+
+LASIDX_HEADER_DTYPE = numpy.dtype([ ("magic", "u4"), ("version", "u2"), ("twidth", "u2"),
+                                    ("mtime", "i8"), ("size", "u8"),
+                                    ("nreads", "u8"), ("novl", "u8"),
+                                    ("reserved1", "u8"), ("reserved2", "u8") ])
+
+LASIDX_ENTRY_DTYPE = numpy.dtype([ ("offset", "u8"), ("novl", "u8"), ("tbytes", "u8") ])
+
+READ_DTYPE = numpy.dtype([ ("rlen", "i4"), ("pad", "V4"), ("boff", "i8"), ("coff", "i8"), ("flags", "i4"), ("pad2", "V4") ])
+
+LASIDX_MAGIC   = 0x5844494c
+LASIDX_VERSION = 2
+
+LETTERS = b"acgt"
+
+# the 4 letters of each packed byte, msb first
+
+def _unpack_table(letters):
+    codes = ( numpy.arange(256)[ : , None ] >> numpy.array([6, 4, 2, 0]) ) & 0x3
+
+    return numpy.frombuffer(letters, dtype = numpy.uint8)[ codes ]
+
+_UNPACK = _unpack_table(LETTERS)
+
+def _load_native():
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "native.so")
+
+    if not os.path.exists(path):
+        return None
+
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+
+    lib.unpack_bases.restype = None
+    lib.unpack_bases.argtypes = [ ctypes.c_void_p, ctypes.c_int64, ctypes.c_void_p, ctypes.c_char_p ]
+
+    lib.unpack_reads.restype = None
+    lib.unpack_reads.argtypes = [ ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_int64,
+                                  ctypes.c_void_p, ctypes.c_char_p ]
+
+    lib.las_scan.restype = ctypes.c_int64
+    lib.las_scan.argtypes = [ ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_int64, ctypes.c_int,
+                              ctypes.c_void_p, ctypes.c_void_p ]
+
+    return lib
+
+native = _load_native()
+
+def _map(path):
+    size = os.path.getsize(path)
+
+    if size == 0:
+        return (None, numpy.zeros(0, dtype = numpy.uint8))
+
+    with open(path, "rb") as f:
+        mm = mmap.mmap(f.fileno(), 0, access = mmap.ACCESS_READ)
+
+    return (mm, numpy.frombuffer(mm, dtype = numpy.uint8))
+
+def _address(arr):
+    return arr.ctypes.data if len(arr) > 0 else None
+
+class LASIndex(object):
+    def __init__(self, pathLas):
+        (base, ext) = os.path.splitext(pathLas)
+
+        self.path = base + ".idx"
+        self.entries = None
+
+        if len(ext) != 4 or not os.path.exists(self.path):
+            return
+
+        (self.map, raw) = _map(self.path)
+
+        if len(raw) < LASIDX_HEADER_DTYPE.itemsize:
+            return
+
+        header = raw[ : LASIDX_HEADER_DTYPE.itemsize ].view(LASIDX_HEADER_DTYPE)[0]
+        st = os.stat(pathLas)
+
+        if header["magic"] != LASIDX_MAGIC or header["version"] != LASIDX_VERSION or \
+           header["size"] != st.st_size or header["mtime"] != int(st.st_mtime):
+            return
+
+        nreads = int(header["nreads"])
+
+        self.entries = numpy.frombuffer(self.map, dtype = LASIDX_ENTRY_DTYPE,
+                                        count = nreads, offset = LASIDX_HEADER_DTYPE.itemsize)
+
+    def valid(self):
+        return self.entries is not None
+
+    def pile(self, aread):
+        if aread < 0 or aread >= len(self.entries):
+            return (0, 0)
+
+        e = self.entries[aread]
+
+        return (int(e["offset"]), int(e["novl"]))
+
+class LASMap(object):
+    STRUCT_LAS_HEADER = "@qi"
+    TRACE_XOVR        = 125
+
+    def __init__(self, path, index = True):
+        self.lasPath = path
+
+        (self.map, self.raw) = _map(path)
+
+        hlen = struct.calcsize(self.STRUCT_LAS_HEADER)
+
+        (self.nlas, self.twidth) = struct.unpack(self.STRUCT_LAS_HEADER, self.raw[ : hlen ].tobytes())
+
+        if self.twidth <= self.TRACE_XOVR:
+            self.ttype = numpy.dtype(numpy.uint8)
+        else:
+            self.ttype = numpy.dtype(numpy.uint16)
+
+        self.tbytes = self.ttype.itemsize
+        self.first = hlen
+
+        self.index = LASIndex(path) if index else None
+
+        if self.index is not None and not self.index.valid():
+            self.index = None
+
+        self.all = None
+
+    def path(self):
+        return os.path.abspath(self.lasPath)
+
+    def scan(self, offset = None, n = None):
+        """offsets and headers of up to n overlaps starting at the record at offset"""
+
+        if offset is None:
+            offset = self.first
+
+        if n is None:
+            n = self.nlas
+
+        if native is not None:
+            offsets = numpy.empty(n, dtype = numpy.uint64)
+            headers = numpy.empty(n, dtype = OVL_DTYPE)
+
+            found = native.las_scan(_address(self.raw), len(self.raw), offset, n, self.tbytes,
+                                    _address(offsets), _address(headers))
+
+            if found < 0:
+                raise ValueError("{} is truncated".format(self.lasPath))
+
+            return (offsets[ : found ], headers[ : found ])
+
+        offsets = []
+        size = len(self.raw)
+
+        while len(offsets) < n and offset < size:
+            (tlen, ) = struct.unpack_from("@i", self.map, offset)
+
+            offsets.append(offset)
+            offset += OVL_DTYPE.itemsize + tlen * self.tbytes
+
+            if offset > size:
+                raise ValueError("{} is truncated".format(self.lasPath))
+
+        offsets = numpy.array(offsets, dtype = numpy.uint64)
+
+        return (offsets, self.headers(offsets))
+
+    def headers(self, offsets):
+        """the records at offsets"""
+
+        rec = offsets.astype(numpy.int64)[ : , None ] + numpy.arange(OVL_DTYPE.itemsize)
+
+        return self.raw[ rec ].view(OVL_DTYPE).reshape(-1)
+
+    def overlaps(self):
+        """offsets and headers of all overlaps, read once and kept"""
+
+        if self.all is None:
+            self.all = self.scan()
+
+        return self.all
+
+    def pile(self, aread):
+        """offsets and headers of the overlaps of aread"""
+
+        if self.index is not None:
+            (offset, novl) = self.index.pile(aread)
+
+            if novl == 0:
+                return (numpy.zeros(0, dtype = numpy.uint64), numpy.zeros(0, dtype = OVL_DTYPE))
+
+            return self.scan(offset, novl)
+
+        (offsets, headers) = self.overlaps()
+
+        b = numpy.searchsorted(headers["aread"], aread, side = "left")
+        e = numpy.searchsorted(headers["aread"], aread, side = "right")
+
+        return (offsets[b : e], headers[b : e])
+
+    def trace(self, offset):
+        """trace of the record at offset as a view into the map"""
+
+        (tlen, ) = struct.unpack_from("@i", self.map, offset)
+
+        return numpy.frombuffer(self.map, dtype = self.ttype, count = tlen, offset = offset + OVL_DTYPE.itemsize)
+
+    def close(self):
+        self.raw = None
+        self.all = None
+
+        if self.map is not None:
+            self.map.close()
+
+class TrackMap(object):
+    STRUCT_TRACK_HEADER    = "@ii"
+    STRUCT_TRACK_HEADER_V2 = "@HHIQQQQQQQ"
+
+    def __init__(self, db, tName):
+        self.tName = tName
+
+        self.anno = None            # offsets in bytes, as stored
+        self.data = None
+
+        pathAnno = os.path.join(db.dir(), ".{0}.{1}.anno".format(db.name(), tName))
+
+        if os.path.exists(pathAnno):
+            pathData = os.path.join(db.dir(), ".{0}.{1}.data".format(db.name(), tName))
+
+            (self.mapAnno, raw) = _map(pathAnno)
+            self.mapData = None
+
+            hlen = struct.calcsize(self.STRUCT_TRACK_HEADER)
+
+            self.anno = raw[ hlen : ].view(numpy.uint64)
+
+            if os.path.exists(pathData):
+                (self.mapData, data) = _map(pathData)
+                self.data = data.view(numpy.int32)
+        else:
+            pathAnno = os.path.join(db.dir(), ".{0}.{1}.a2".format(db.name(), tName))
+            pathData = os.path.join(db.dir(), ".{0}.{1}.d2".format(db.name(), tName))
+
+            hlen = struct.calcsize(self.STRUCT_TRACK_HEADER_V2)
+
+            with open(pathAnno, "rb") as f:
+                header = struct.unpack(self.STRUCT_TRACK_HEADER_V2, f.read(hlen))
+                clen = header[4]
+                canno = f.read(clen)
+
+            self.mapAnno = self.mapData = None
+
+            self.anno = numpy.frombuffer(Track.uncompress(canno), dtype = numpy.uint64)
+
+            if os.path.exists(pathData):
+                with open(pathData, "rb") as f:
+                    cdata = f.read(header[5])
+
+                self.data = numpy.frombuffer(Track.uncompress(cdata), dtype = numpy.int32)
+
+        assert( len(self.anno) == db.reads() + 1 )
+
+    def name(self):
+        return self.tName
+
+    def has(self, rid):
+        return self.anno[rid] < self.anno[rid + 1]
+
+    def get(self, rid):
+        return self.data[ self.anno[rid] // 4 : self.anno[rid + 1] // 4 ]
+
+class DBMap(object):
+    STRUCT_HITS_DB = "@iffffiqiiiPiPPP"
+
+    def __init__(self, path):
+        if not os.path.exists(path):
+            raise FileNotFoundError("could not find {}".format(path))
+
+        (self.dbPath, self.dbName) = os.path.split(path)
+
+        if self.dbName.endswith(".db"):
+            self.dbName = self.dbName[:-3]
+
+        (self.mapIdx, idx) = _map( os.path.join(self.dbPath, "." + self.dbName + ".idx") )
+        (self.mapBps, self.bps) = _map( os.path.join(self.dbPath, "." + self.dbName + ".bps") )
+
+        hlen = struct.calcsize(self.STRUCT_HITS_DB)
+        header = struct.unpack(self.STRUCT_HITS_DB, idx[ : hlen ].tobytes())
+
+        self.ureads = header[0]
+        self.totlen = header[6]
+
+        self.arrReads = numpy.frombuffer(self.mapIdx, dtype = READ_DTYPE, count = self.ureads, offset = hlen)
+
+        self.tracks = {}
+
+    def dir(self):
+        return os.path.abspath(self.dbPath)
+
+    def name(self):
+        return self.dbName
+
+    def reads(self):
+        return self.ureads
+
+    def lengths(self):
+        return self.arrReads["rlen"]
+
+    def length(self, rid):
+        return int(self.arrReads[rid]["rlen"])
+
+    def track(self, tName):
+        if tName not in self.tracks:
+            self.tracks[tName] = TrackMap(self, tName)
+
+        return self.tracks[tName]
+
+    def codes(self, rid, letters = LETTERS):
+        """bases of the read as uint8 array of letters"""
+
+        rlen = int(self.arrReads[rid]["rlen"])
+        boff = int(self.arrReads[rid]["boff"])
+
+        if native is not None:
+            out = numpy.empty(rlen, dtype = numpy.uint8)
+
+            if rlen > 0:
+                native.unpack_bases(_address(self.bps) + boff, rlen, _address(out), letters)
+
+            return out
+
+        packed = self.bps[ boff : boff + (rlen + 3) // 4 ]
+
+        lut = _UNPACK if letters == LETTERS else _unpack_table(letters)
+
+        return lut[packed].reshape(-1)[ : rlen ]
+
+    def sequence(self, rid):
+        return self.codes(rid).tobytes().decode()
+
+    def sequences(self, rids, letters = LETTERS):
+        """bases of the reads back to back and the offsets of each read"""
+
+        rids = numpy.asarray(rids, dtype = numpy.int64)
+        rlen = numpy.ascontiguousarray( self.arrReads["rlen"][rids] )
+
+        offsets = numpy.zeros(len(rids) + 1, dtype = numpy.int64)
+        numpy.cumsum(rlen, out = offsets[1:])
+
+        if native is None:
+            return (numpy.concatenate( [ self.codes(rid, letters) for rid in rids ] + [ numpy.zeros(0, dtype = numpy.uint8) ] ), offsets)
+
+        boff = numpy.ascontiguousarray( self.arrReads["boff"][rids] )
+        out = numpy.empty(offsets[-1], dtype = numpy.uint8)
+
+        if len(out) > 0:
+            native.unpack_reads(_address(self.bps), _address(boff), _address(rlen), len(rids), _address(out), letters)
+
+        return (out, offsets)
+
+    def close(self):
+        self.arrReads = None
+        self.bps = None
+        self.tracks = {}
+
+        for mm in (self.mapIdx, self.mapBps):
+            if mm is not None:
+                mm.close()
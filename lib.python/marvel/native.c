@@ -0,0 +1,112 @@
+
+/*
+ * helpers for marvel.mapped, loaded through ctypes. they work on the memory
+ * maps of the .las and .bps files and write into buffers allocated by numpy.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define LAS_RECORD 40           // overlap record without the trace pointer
+
+// table of the 4 letters of the bases packed into a byte, msb first
+
+static void unpack_table(const char* letters, uint32_t* lut)
+{
+    int c, i;
+
+    for (c = 0; c < 256; c++)
+    {
+        char quad[4];
+
+        for (i = 0; i < 4; i++)
+        {
+            quad[i] = letters[ (c >> (6 - 2 * i)) & 0x3 ];
+        }
+
+        memcpy(lut + c, quad, 4);
+    }
+}
+
+static void unpack_with(const uint32_t* lut, const uint8_t* packed, int64_t rlen, char* out)
+{
+    int64_t i;
+
+    for (i = 0; i + 4 <= rlen; i += 4)
+    {
+        memcpy(out + i, lut + packed[i / 4], 4);
+    }
+
+    if (i < rlen)
+    {
+        char quad[4];
+
+        memcpy(quad, lut + packed[i / 4], 4);
+        memcpy(out + i, quad, rlen - i);
+    }
+}
+
+// unpacks rlen bases to out using letters (eg. "acgt" or "\0\1\2\3")
+
+void unpack_bases(const uint8_t* packed, int64_t rlen, char* out, const char* letters)
+{
+    uint32_t lut[256];
+
+    unpack_table(letters, lut);
+    unpack_with(lut, packed, rlen, out);
+}
+
+// unpacks n reads back to back into out
+
+void unpack_reads(const uint8_t* bps, const int64_t* boff, const int32_t* rlen, int64_t n,
+                  char* out, const char* letters)
+{
+    uint32_t lut[256];
+    int64_t i;
+
+    unpack_table(letters, lut);
+
+    for (i = 0; i < n; i++)
+    {
+        unpack_with(lut, bps + boff[i], rlen[i], out);
+        out += rlen[i];
+    }
+}
+
+// walks at most n overlap records starting at offset off of the mapped .las,
+// storing their offsets and, if headers is not NULL, copying the records.
+// returns the number of records, -1 if one is truncated.
+
+int64_t las_scan(const uint8_t* data, uint64_t size, uint64_t off, int64_t n, int tbytes,
+                 uint64_t* offsets, uint8_t* headers)
+{
+    int64_t i;
+
+    for (i = 0; i < n && off < size; i++)
+    {
+        int32_t tlen;
+
+        if ( off + LAS_RECORD > size )
+        {
+            return -1;
+        }
+
+        memcpy(&tlen, data + off, sizeof(int32_t));
+
+        offsets[i] = off;
+
+        if (headers != NULL)
+        {
+            memcpy(headers + i * LAS_RECORD, data + off, LAS_RECORD);
+        }
+
+        off += LAS_RECORD + (uint64_t)tlen * tbytes;
+
+        if ( off > size )
+        {
+            return -1;
+        }
+    }
+
+    return i;
+}
@@ -12,6 +12,7 @@ import types
 
 import marvel.rawqueue
 import marvel.config
+import marvel.DB
 
 class queue(marvel.rawqueue.rawqueue):
 
@@ -20,9 +21,11 @@ class queue(marvel.rawqueue.rawqueue):
     def __init__(self, db, cov, cores,
                        path_bin = marvel.config.PATH_BIN,
                        path_scripts = marvel.config.PATH_SCRIPTS,
-                       checkpoint = None, finish_block_on_error = False):
+                       checkpoint = None, finish_block_on_error = False,
+                       dag = False, memory = None):
 
-        super(queue, self).__init__(cores, checkpoint = checkpoint, finish_block_on_error = finish_block_on_error)
+        super(queue, self).__init__(cores, checkpoint = checkpoint, finish_block_on_error = finish_block_on_error,
+                                    dag = dag, memory = memory)
 
         self.db_path = db
         self.db = os.path.basename(db)
@@ -44,6 +47,19 @@ class queue(marvel.rawqueue.rawqueue):
                 self.set_blocks( int( strLine[ strLine.find("=")+1 : ].strip() ) )
                 break
 
+    def stats(self):
+        """statistics of the DB, DBstats only runs if its cached ones are missing or outdated"""
+
+        s = marvel.DB.Stats.from_db(self.db_path)
+
+        if s == None:
+            with open(os.devnull, "w") as null:
+                subprocess.call([ os.path.join(self.path_bin, "DBstats"), self.db_path ], stdout = null)
+
+            s = marvel.DB.Stats.from_db(self.db_path)
+
+        return s
+
     def replace_variables(self, strCmd, **args):
         return strCmd.format(db_path = self.db_path,
                              coverage = self.coverage,
@@ -7,6 +7,8 @@ import subprocess
 import time
 import shlex
 import glob
+import fnmatch
+import heapq
 import types
 import logging
 
@@ -17,15 +19,27 @@ try:
 except ImportError:
     DEVNULL = open(os.devnull, 'wb')
 
+# commands are queued in steps, the commands of a step run in parallel once all commands
+# of the steps before it have finished.
+#
+# with dag = True commands that declare the files they read (inputs) and write (outputs)
+# instead start as soon as the commands writing their inputs have finished, regardless of
+# the steps. inputs can be glob patterns. commands without declarations still wait for
+# everything queued before them and hold back everything queued after them. a command
+# runs if its threads and memory (MB) fit into cores and memory next to the running ones.
+
 class rawqueue(object):
 
     QUEUE_POLL = 0.5
 
-    def __init__(self, cores, poll = QUEUE_POLL, blocks = None, checkpoint = None, finish_block_on_error = False):
+    def __init__(self, cores, poll = QUEUE_POLL, blocks = None, checkpoint = None, finish_block_on_error = False,
+                       dag = False, memory = None):
         self.queue = []
         self.disable_add = False
 
         self.parallel = cores
+        self.memory = memory
+        self.dag = dag
         self.checkpoint = checkpoint
         self.blocks = blocks
         self.poll = poll
@@ -63,7 +77,16 @@ class rawqueue(object):
 
         return bargs
 
-    def block(self, strCmd, first = 1, last = -1, threads = 1, **args):
+    def format_files(self, files, **args):
+        if files is None:
+            return None
+
+        if isinstance(files, str):
+            files = [ files ]
+
+        return [ os.path.normpath( self.replace_variables(f, **args) ) for f in files ]
+
+    def block(self, strCmd, first = 1, last = -1, threads = 1, inputs = None, outputs = None, memory = 0, **args):
         if self.disable_add:
             return None
 
@@ -80,16 +103,19 @@ class rawqueue(object):
         for nBlock in range(first, last):
             bargs = self.assign_block_arguments(nBlock, args)
 
-            arrTask.append( ( self.replace_variables(strCmd, block = nBlock, **bargs), threads ) )
+            arrTask.append( ( self.replace_variables(strCmd, block = nBlock, **bargs), threads, memory,
+                              self.format_files(inputs, block = nBlock, **bargs),
+                              self.format_files(outputs, block = nBlock, **bargs) ) )
         self.queue.append( arrTask )
 
         return len(self.queue) - 1
 
-    def single(self, strCmd, threads = 1, **args):
+    def single(self, strCmd, threads = 1, inputs = None, outputs = None, memory = 0, **args):
         if self.disable_add:
             return None
 
-        self.queue.append( [ ( self.replace_variables(strCmd, **args), threads ) ] )
+        self.queue.append( [ ( self.replace_variables(strCmd, **args), threads, memory,
+                               self.format_files(inputs, **args), self.format_files(outputs, **args) ) ] )
 
         return len(self.queue) - 1
 
@@ -167,7 +193,7 @@ class rawqueue(object):
             if path != None and strCmd[0] != os.path.sep:
                 strCmd = os.path.join(path, strCmd)
 
-            arrBlock.append( (strCmd, threads) )
+            arrBlock.append( (strCmd, threads, 0, None, None) )
 
         if len(arrBlock) > 0:
             if first > len(arrBlock) or last != -1 and last > len(arrBlock):
@@ -194,6 +220,15 @@ class rawqueue(object):
         fileOut.write("{} {}".format(level, task))
         fileOut.close()
 
+    def write_checkpoint_dag(self, done):
+        pathTmp = self.checkpoint + ".tmp"
+
+        fileOut = open(pathTmp, "w")
+        fileOut.write("dag " + " ".join( str(i) for i in range(len(done)) if done[i] ))
+        fileOut.close()
+
+        os.rename(pathTmp, self.checkpoint)
+
     def delete_checkpoint(self):
         os.remove(self.checkpoint)
 
@@ -216,7 +251,81 @@ class rawqueue(object):
 
         return (level, task)
 
+    def read_checkpoint_dag(self):
+        """ids of the finished commands, from either kind of checkpoint"""
+
+        fileIn = open(self.checkpoint, "r")
+        items = fileIn.readline().split()
+        fileIn.close()
+
+        if len(items) > 0 and items[0] == "dag":
+            return set( int(i) for i in items[1:] )
+
+        (level, task) = self.read_checkpoint()
+
+        return set( range( sum( len(l) for l in self.queue[:level] ) + task ) )
+
+    def graph(self):
+        """the commands in queue order and the ids of the commands each of them waits for"""
+
+        tasks = []
+        deps = []
+
+        writer = {}         # file -> last command writing it
+        readers = {}        # file (or pattern) -> commands reading it since
+
+        barrier = []        # undeclared commands of the last step containing any
+        since = []          # commands queued after them
+
+        def match(key, path):
+            return key == path or fnmatch.fnmatchcase(path, key)
+
+        for level in self.queue:
+            undeclared = []
+            declared = []
+
+            for (strCmd, threads, memory, inputs, outputs) in level:
+                tid = len(tasks)
+                dep = set(barrier)
+
+                if inputs is None and outputs is None:
+                    dep.update(since)
+                    undeclared.append(tid)
+                else:
+                    for path in inputs or []:
+                        dep.update( w for (f, w) in writer.items() if match(path, f) )
+                        readers.setdefault(path, []).append(tid)
+
+                    for path in outputs or []:
+                        if path in writer:
+                            dep.add( writer[path] )
+
+                        for (f, r) in readers.items():
+                            if match(f, path):
+                                dep.update(r)
+
+                        writer[path] = tid
+
+                    declared.append(tid)
+
+                dep.discard(tid)
+
+                tasks.append( (strCmd, threads, memory) )
+                deps.append( sorted(dep) )
+
+            if len(undeclared) > 0:
+                barrier = undeclared
+                since = declared
+            else:
+                since.extend(declared)
+
+        return (tasks, deps)
+
     def dump(self, fileOut):
+        if self.dag:
+            self.dump_dag(fileOut)
+            return
+
         for i in range( len(self.queue) ):
 
             for command in self.queue[i]:
@@ -227,10 +336,148 @@ class rawqueue(object):
             if i < len(self.queue) - 1:
                 fileOut.write("# jobs prior must be complete in order to continue\n")
 
+    def dump_dag(self, fileOut):
+        (tasks, deps) = self.graph()
+
+        depth = []
+        for dep in deps:
+            depth.append( max( [ depth[d] + 1 for d in dep ] + [0] ) )
+
+        for d in range( max(depth + [-1]) + 1 ):
+            if d > 0:
+                fileOut.write("# jobs prior must be complete in order to continue\n")
+
+            for i in range(len(tasks)):
+                if depth[i] == d:
+                    fileOut.write(self.expand_dump(tasks[i][0]) + "\n")
+
+    def start(self, strCmd):
+        arrCmd = shlex.split(strCmd)
+        arrCmd = self.expand(arrCmd)
+
+        if strCmd[0] == '!':
+            arrCmd[0] = arrCmd[0][1:]
+
+            return subprocess.Popen( " ".join(arrCmd),
+                                     bufsize = -1,
+                                     stdout = DEVNULL, stderr = subprocess.STDOUT,
+                                     shell = True)
+
+        if not os.path.exists(arrCmd[0]):
+            logging.warning("command {} not found. potentially using non-absolute paths".format(arrCmd[0]))
+
+        return subprocess.Popen( arrCmd,
+                                 bufsize = -1,
+                                 stdout = DEVNULL, stderr = subprocess.STDOUT)
+
+    def process_dag(self, resume_from_checkpoint = False):
+        (tasks, deps) = self.graph()
+
+        done = [False] * len(tasks)
+
+        if resume_from_checkpoint:
+            if not os.path.exists(self.checkpoint):
+                logging.error("WARNING: resume from checkpoint requested, but no checkpoint found")
+            else:
+                finished = self.read_checkpoint_dag()
+
+                logging.info("RESUME {} of {}".format(len(finished), len(tasks)))
+
+                for i in finished:
+                    if i < len(tasks):
+                        done[i] = True
+
+        children = [ [] for i in range(len(tasks)) ]
+        waiting = [0] * len(tasks)
+
+        for i in range(len(tasks)):
+            for d in deps[i]:
+                if not done[d]:
+                    children[d].append(i)
+                    waiting[i] += 1
+
+        ready = [ i for i in range(len(tasks)) if not done[i] and waiting[i] == 0 ]
+        heapq.heapify(ready)
+
+        arrProcesses = []
+
+        nThreads = 0
+        nMemory = 0
+        nExit = False
+
+        while len(arrProcesses) > 0 or ( len(ready) > 0 and not nExit ):
+            for i in range(len(arrProcesses) - 1, -1, -1):
+                (proc, strCmd, threads, memory, taskid) = arrProcesses[i]
+
+                if proc.poll() == None:
+                    continue
+
+                if proc.returncode != 0:
+                    logging.info("exit {0} {1}".format(proc.returncode, strCmd))
+
+                    if not self.finish_block_on_error:
+                        sys.exit(1)
+                    else:
+                        nExit = True
+                else:
+                    (process_output, dummy) = proc.communicate()
+
+                    logging.info(process_output)
+
+                    done[taskid] = True
+
+                    for c in children[taskid]:
+                        waiting[c] -= 1
+
+                        if waiting[c] == 0:
+                            heapq.heappush(ready, c)
+
+                    if self.checkpoint != None:
+                        self.write_checkpoint_dag(done)
+
+                del arrProcesses[i]
+                nThreads -= threads
+                nMemory -= memory
+
+            # commands start in queue order, a command that does not fit holds back the ones after it
+
+            while len(ready) > 0 and not nExit:
+                (strCmd, threads, memory) = tasks[ ready[0] ]
+
+                if len(arrProcesses) > 0:
+                    if nThreads + threads > self.parallel:
+                        break
+
+                    if self.memory != None and nMemory + memory > self.memory:
+                        break
+
+                taskid = heapq.heappop(ready)
+
+                print("[{} {}] {}".format(taskid + 1, len(tasks), strCmd))
+                logging.info("[{} {}] {}\n".format(taskid + 1, len(tasks), strCmd))
+
+                arrProcesses.append( (self.start(strCmd), strCmd, threads, memory, taskid) )
+
+                nThreads += threads
+                nMemory += memory
+
+            if len(arrProcesses) > 0:
+                time.sleep( self.poll )
+
+        self.queue = []
+        self.disable_add = False
+
+        if self.checkpoint != None and not nExit:
+            self.delete_checkpoint()
+
     def process(self, resume_from_checkpoint = False):
         if len(self.queue) == 0:
             return
 
+        if self.dag:
+            self.process_dag(resume_from_checkpoint)
+            return
+
         arrProcesses = []
 
         nLevel = 0
@@ -296,7 +543,7 @@ class rawqueue(object):
                     # print("processing {0} of {1}".format(nLevel + 1, len(self.queue)))
 
             while nTask != len(self.queue[nLevel]) and nThreads < self.parallel:
-                (strCmd, threads) = self.queue[nLevel][nTask]
+                (strCmd, threads) = self.queue[nLevel][nTask][:2]
 
                 if len(self.queue[nLevel]) > 1:
                     print("[{} {} | {} {}] {}".format(nLevel + 1, len(self.queue), nTask + 1, len(self.queue[nLevel]), strCmd))
@@ -305,25 +552,7 @@ class rawqueue(object):
 
                 logging.info("[{} {} | {} {}] {}\n".format(nLevel + 1, len(self.queue), nTask + 1, len(self.queue[nLevel]), strCmd))
 
-                arrCmd = shlex.split(strCmd)
-                arrCmd = self.expand(arrCmd)
-
-                if strCmd[0] == '!':
-                    arrCmd[0] = arrCmd[0][1:]
-
-                    arrProcesses.append( (subprocess.Popen( " ".join(arrCmd),
-                                                            bufsize = -1,
-                                                            stdout = DEVNULL, stderr = subprocess.STDOUT,
-                                                            shell = True),
-                                          strCmd, threads, nTask) )
-                else:
-                    if not os.path.exists(arrCmd[0]):
-                        logging.warning("command {} not found. potentially using non-absolute paths".format(arrCmd[0]))
-
-                    arrProcesses.append( (subprocess.Popen( arrCmd,
-                                                            bufsize = -1,
-                                                            stdout = DEVNULL, stderr = subprocess.STDOUT),
-                                          strCmd, threads, nTask) )
+                arrProcesses.append( (self.start(strCmd), strCmd, threads, nTask) )
 
                 nTask += 1
                 nThreads += threads
@@ -0,0 +1,723 @@
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BIO_HAVE_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "bulkio.h"
+
+#define BIO_ENV_BACKEND     "MARVEL_IO"
+#define BIO_ENV_DIRECT      "MARVEL_IO_DIRECT"
+
+#define BIO_DEPTH           32                      // requests in flight in bio_read()
+#define BIO_CHUNK           ( 1024 * 1024 )         // largest single request of bio_read()
+
+#define BIO_STREAM_DEPTH    4                       // chunks of a stream in flight
+#define BIO_STREAM_CHUNK    ( 4 * 1024 * 1024 )
+
+#define BIO_ALIGN           4096                    // O_DIRECT offset, length and buffer alignment
+
+// queue of reads whose completions are reported by tag. for the pread backend
+// the reads are done as they are submitted.
+
+typedef struct
+{
+    int ring;                       // io_uring descriptor, -1 for pread
+
+#ifdef BIO_HAVE_URING
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    unsigned pending;               // queued, not yet passed to the kernel
+#endif
+
+    int ndone;
+    uint64_t done_tag[ BIO_DEPTH ];
+    ssize_t done_res[ BIO_DEPTH ];
+} bio_queue;
+
+struct bio_stream
+{
+    int fd;
+    int own_fd;                     // fd was opened for O_DIRECT
+    off_t align;
+    off_t size;
+
+    bio_queue queue;
+    int depth;
+
+    // ring of consecutive chunks, starting with the one at first
+
+    char* buf[ BIO_STREAM_DEPTH ];
+    off_t boff[ BIO_STREAM_DEPTH ];
+    size_t blen[ BIO_STREAM_DEPTH ];    // bytes read
+    size_t bwant[ BIO_STREAM_DEPTH ];
+    int bdone[ BIO_STREAM_DEPTH ];
+
+    int first;
+    int nchunks;
+    int returned;                   // chunk first was handed out, recycle it on the next call
+
+    off_t next;                     // offset of the next chunk to submit
+    off_t pos;                      // offset of the next byte handed out
+};
+
+static struct
+{
+    pthread_once_t once;
+    pthread_key_t key;
+
+    int uring;
+    int direct;
+} Bio = { PTHREAD_ONCE_INIT, 0, 0, 0 };
+
+#ifdef BIO_HAVE_URING
+
+static void ring_free(bio_queue* q)
+{
+    munmap(q->sqes, q->sqes_len);
+
+    if (q->cq_ptr != q->sq_ptr)
+    {
+        munmap(q->cq_ptr, q->cq_len);
+    }
+
+    munmap(q->sq_ptr, q->sq_len);
+    close(q->ring);
+
+    q->ring = -1;
+}
+
+static int ring_init(bio_queue* q, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    q->ring = fd;
+    q->pending = 0;
+
+    q->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    q->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    q->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (q->cq_len > q->sq_len)
+        {
+            q->sq_len = q->cq_len;
+        }
+
+        q->cq_len = q->sq_len;
+    }
+
+    q->sq_ptr = mmap(NULL, q->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (q->sq_ptr == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        q->cq_ptr = q->sq_ptr;
+    }
+    else
+    {
+        q->cq_ptr = mmap(NULL, q->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+        if (q->cq_ptr == MAP_FAILED)
+        {
+            munmap(q->sq_ptr, q->sq_len);
+            close(fd);
+            return -1;
+        }
+    }
+
+    q->sqes = mmap(NULL, q->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (q->sqes == MAP_FAILED)
+    {
+        if (q->cq_ptr != q->sq_ptr)
+        {
+            munmap(q->cq_ptr, q->cq_len);
+        }
+
+        munmap(q->sq_ptr, q->sq_len);
+        close(fd);
+        return -1;
+    }
+
+    char* sq = q->sq_ptr;
+    char* cq = q->cq_ptr;
+
+    q->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    q->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    q->sq_array = (unsigned*)(sq + p.sq_off.array);
+
+    q->cq_head = (unsigned*)(cq + p.cq_off.head);
+    q->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    q->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+// IORING_OP_READ needs 5.6, the probe fails on older kernels
+
+static int ring_supported()
+{
+    bio_queue q;
+
+    if ( ring_init(&q, 4) != 0 )
+    {
+        return 0;
+    }
+
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+
+    int supported = syscall(__NR_io_uring_register, q.ring, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                    probe->last_op >= IORING_OP_READ &&
+                    (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    ring_free(&q);
+
+    return supported;
+}
+
+#endif
+
+static void queue_init(bio_queue* q, unsigned entries)
+{
+    q->ring = -1;
+    q->ndone = 0;
+
+#ifdef BIO_HAVE_URING
+    if (Bio.uring)
+    {
+        ring_init(q, entries);
+    }
+#else
+    (void)entries;
+#endif
+}
+
+static void queue_free(bio_queue* q)
+{
+#ifdef BIO_HAVE_URING
+    if (q->ring != -1)
+    {
+        ring_free(q);
+    }
+#else
+    (void)q;
+#endif
+}
+
+static void queue_destroy(void* arg)
+{
+    queue_free(arg);
+    free(arg);
+}
+
+// at most BIO_DEPTH requests may be outstanding
+
+static void queue_submit(bio_queue* q, int fd, void* buf, size_t len, off_t off, uint64_t tag)
+{
+#ifdef BIO_HAVE_URING
+    if (q->ring != -1)
+    {
+        unsigned tail = *(q->sq_tail);
+        unsigned idx = tail & *(q->sq_mask);
+        struct io_uring_sqe* sqe = q->sqes + idx;
+
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->off = off;
+        sqe->addr = (uintptr_t)buf;
+        sqe->len = len;
+        sqe->user_data = tag;
+
+        q->sq_array[idx] = idx;
+
+        __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        q->pending += 1;
+
+        return ;
+    }
+#endif
+
+    ssize_t res = pread(fd, buf, len, off);
+
+    q->done_tag[q->ndone] = tag;
+    q->done_res[q->ndone] = (res < 0) ? -errno : res;
+    q->ndone += 1;
+}
+
+// passes the queued requests to the kernel, optionally waiting for a completion
+
+static int queue_enter(bio_queue* q, int wait)
+{
+#ifdef BIO_HAVE_URING
+    if (q->ring == -1 || (q->pending == 0 && !wait))
+    {
+        return 0;
+    }
+
+    int ret = syscall(__NR_io_uring_enter, q->ring, q->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    if (ret < 0)
+    {
+        return (errno == EINTR || errno == EAGAIN || errno == EBUSY) ? 0 : -1;
+    }
+
+    q->pending -= ret;
+#else
+    (void)q;
+    (void)wait;
+#endif
+
+    return 0;
+}
+
+// returns the result of the next completed request, -errno on failure
+
+static ssize_t queue_wait(bio_queue* q, uint64_t* tag)
+{
+    if (q->ring == -1)
+    {
+        q->ndone -= 1;
+        *tag = q->done_tag[q->ndone];
+
+        return q->done_res[q->ndone];
+    }
+
+#ifdef BIO_HAVE_URING
+    while (1)
+    {
+        unsigned head = *(q->cq_head);
+
+        if ( head != __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE) )
+        {
+            struct io_uring_cqe* cqe = q->cqes + (head & *(q->cq_mask));
+
+            *tag = cqe->user_data;
+            ssize_t res = cqe->res;
+
+            __atomic_store_n(q->cq_head, head + 1, __ATOMIC_RELEASE);
+
+            return res;
+        }
+
+        if ( queue_enter(q, 1) != 0 )
+        {
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+#endif
+
+    return -EINVAL;
+}
+
+static void bio_init()
+{
+    char* backend = getenv(BIO_ENV_BACKEND);
+    char* direct = getenv(BIO_ENV_DIRECT);
+
+#ifdef BIO_HAVE_URING
+    Bio.uring = ( backend != NULL && strcmp(backend, "uring") == 0 && ring_supported() );
+#else
+    (void)backend;
+#endif
+
+    Bio.direct = ( direct != NULL && strcmp(direct, "0") != 0 );
+
+    pthread_key_create(&Bio.key, queue_destroy);
+}
+
+int bio_enabled()
+{
+    pthread_once(&Bio.once, bio_init);
+
+    return Bio.uring || Bio.direct;
+}
+
+// every thread keeps its own queue for bio_read()
+
+static bio_queue* thread_queue()
+{
+    pthread_once(&Bio.once, bio_init);
+
+    bio_queue* q = pthread_getspecific(Bio.key);
+
+    if (q == NULL)
+    {
+        q = malloc(sizeof(bio_queue));
+        queue_init(q, BIO_DEPTH);
+
+        pthread_setspecific(Bio.key, q);
+    }
+
+    return q;
+}
+
+int bio_read(int fd, bio_req* reqs, int n)
+{
+    bio_queue* q = thread_queue();
+
+    bio_req slots[ BIO_DEPTH ];
+    int free_slots[ BIO_DEPTH ];
+    int nfree = BIO_DEPTH;
+    int inflight = 0;
+    int failed = 0;
+    int i = 0;
+    size_t pos = 0;
+
+    for (int s = 0; s < BIO_DEPTH; s++)
+    {
+        free_slots[s] = s;
+    }
+
+    while (1)
+    {
+        // split the requests into chunks and keep the queue full
+
+        while ( !failed && nfree > 0 && i < n )
+        {
+            if (pos == reqs[i].len)
+            {
+                i += 1;
+                pos = 0;
+                continue;
+            }
+
+            int s = free_slots[--nfree];
+            bio_req* slot = slots + s;
+
+            slot->buf = (char*)reqs[i].buf + pos;
+            slot->off = reqs[i].off + pos;
+            slot->len = reqs[i].len - pos;
+
+            if (slot->len > BIO_CHUNK)
+            {
+                slot->len = BIO_CHUNK;
+            }
+
+            pos += slot->len;
+
+            queue_submit(q, fd, slot->buf, slot->len, slot->off, s);
+            inflight += 1;
+        }
+
+        if (inflight == 0)
+        {
+            break;
+        }
+
+        if ( queue_enter(q, 0) != 0 )
+        {
+            failed = 1;
+        }
+
+        uint64_t tag;
+        ssize_t res = queue_wait(q, &tag);
+        bio_req* slot = slots + tag;
+
+        inflight -= 1;
+
+        if (res == -EINTR || res == -EAGAIN)
+        {
+            res = 0;
+        }
+        else if (res <= 0)
+        {
+            // errors and reads past the end of the file
+
+            failed = 1;
+            free_slots[nfree++] = tag;
+            continue;
+        }
+
+        slot->buf = (char*)slot->buf + res;
+        slot->off += res;
+        slot->len -= res;
+
+        if (slot->len > 0 && !failed)
+        {
+            queue_submit(q, fd, slot->buf, slot->len, slot->off, tag);
+            inflight += 1;
+        }
+        else
+        {
+            free_slots[nfree++] = tag;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+bio_stream* bio_stream_open(int fd, off_t start)
+{
+    pthread_once(&Bio.once, bio_init);
+
+    struct stat st;
+
+    if ( fstat(fd, &st) != 0 )
+    {
+        return NULL;
+    }
+
+    bio_stream* s = calloc(1, sizeof(bio_stream));
+
+    s->fd = fd;
+    s->align = 1;
+    s->size = st.st_size;
+
+#if defined(O_DIRECT)
+    if (Bio.direct)
+    {
+        char path[64];
+
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+        // file systems without O_DIRECT support fail the open
+
+        int dfd = open(path, O_RDONLY | O_DIRECT);
+
+        if (dfd != -1)
+        {
+            s->fd = dfd;
+            s->own_fd = 1;
+            s->align = BIO_ALIGN;
+        }
+    }
+#endif
+
+    queue_init(&(s->queue), BIO_STREAM_DEPTH);
+
+    // without io_uring reading ahead would block the caller
+
+    s->depth = (s->queue.ring == -1) ? 1 : BIO_STREAM_DEPTH;
+
+    for (int i = 0; i < s->depth; i++)
+    {
+        if ( posix_memalign((void**)(s->buf + i), BIO_ALIGN, BIO_STREAM_CHUNK) != 0 )
+        {
+            fprintf(stderr, "failed to allocate stream buffer\n");
+            exit(1);
+        }
+    }
+
+    s->pos = start;
+
+    return s;
+}
+
+static void stream_submit(bio_stream* s, int b)
+{
+    size_t done = s->blen[b];
+
+    queue_submit(&(s->queue), s->fd, s->buf[b] + done, s->bwant[b] - done, s->boff[b] + done, b);
+}
+
+// handles the next completion, returns -1 on errors
+
+static int stream_complete(bio_stream* s)
+{
+    uint64_t b;
+    ssize_t res = queue_wait(&(s->queue), &b);
+
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        stream_submit(s, b);
+        return 0;
+    }
+
+    if (res < 0)
+    {
+        s->bdone[b] = 1;
+        return -1;
+    }
+
+    s->blen[b] += res;
+
+    // short reads are continued unless they hit the end of the file
+
+    if ( res > 0 && s->blen[b] < s->bwant[b] && s->boff[b] + (off_t)s->blen[b] < s->size )
+    {
+        stream_submit(s, b);
+        return 0;
+    }
+
+    s->bdone[b] = 1;
+
+    return 0;
+}
+
+ssize_t bio_stream_next(bio_stream* s, char** data)
+{
+    if (s->returned)
+    {
+        s->first = (s->first + 1) % s->depth;
+        s->nchunks -= 1;
+        s->returned = 0;
+    }
+
+    if (s->pos >= s->size)
+    {
+        return 0;
+    }
+
+    if (s->nchunks == 0)
+    {
+        s->next = s->pos - s->pos % s->align;
+    }
+
+    while ( s->nchunks < s->depth && s->next < s->size )
+    {
+        int b = (s->first + s->nchunks) % s->depth;
+        off_t len = s->size - s->next;
+
+        if (len > BIO_STREAM_CHUNK)
+        {
+            len = BIO_STREAM_CHUNK;
+        }
+
+        s->boff[b] = s->next;
+        s->bwant[b] = (len + s->align - 1) / s->align * s->align;
+        s->blen[b] = 0;
+        s->bdone[b] = 0;
+
+        stream_submit(s, b);
+
+        s->next += BIO_STREAM_CHUNK;
+        s->nchunks += 1;
+    }
+
+    if ( queue_enter(&(s->queue), 0) != 0 )
+    {
+        return -1;
+    }
+
+    int b = s->first;
+
+    while ( !s->bdone[b] )
+    {
+        if ( stream_complete(s) != 0 )
+        {
+            return -1;
+        }
+    }
+
+    off_t end = s->boff[b] + s->blen[b];
+
+    if (s->pos >= end)
+    {
+        return 0;
+    }
+
+    *data = s->buf[b] + (s->pos - s->boff[b]);
+
+    ssize_t len = end - s->pos;
+
+    s->pos = end;
+    s->returned = 1;
+
+    return len;
+}
+
+// waits for the chunks in flight, their buffers can't be reused before
+
+static void stream_drain(bio_stream* s)
+{
+    int i;
+
+    for (i = 0; i < s->nchunks; i++)
+    {
+        int b = (s->first + i) % s->depth;
+
+        while ( !s->bdone[b] )
+        {
+            stream_complete(s);
+        }
+    }
+
+    s->first = 0;
+    s->nchunks = 0;
+    s->returned = 0;
+}
+
+void bio_stream_seek(bio_stream* s, off_t off)
+{
+    if (off != s->pos)
+    {
+        stream_drain(s);
+
+        s->pos = off;
+    }
+}
+
+void bio_stream_close(bio_stream* s)
+{
+    int i;
+
+    stream_drain(s);
+    queue_free(&(s->queue));
+
+    for (i = 0; i < s->depth; i++)
+    {
+        free(s->buf[i]);
+    }
+
+    if (s->own_fd)
+    {
+        close(s->fd);
+    }
+
+    free(s);
+}
@@ -0,0 +1,46 @@
+
+#pragma once
+
+#include <sys/types.h>
+
+// bulk reads with many requests in flight. reads are split into chunks that are
+// queued to the kernel together, which keeps parallel file systems busy where a
+// single outstanding pread per thread leaves most of the bandwidth unused.
+//
+// MARVEL_IO=uring selects the io_uring backend, on kernels without it (or if it
+// is not permitted) and by default the requests are served by pread(). with
+// MARVEL_IO_DIRECT=1 streams bypass the page cache (O_DIRECT) where the file
+// system supports it.
+
+typedef struct
+{
+    void* buf;
+    size_t len;
+    off_t off;
+} bio_req;
+
+// 1 if io_uring or O_DIRECT streams are enabled
+
+int bio_enabled();
+
+// reads all n requests completely, returns 0 on success and -1 on errors or
+// if a request extends beyond the end of the file
+
+int bio_read(int fd, bio_req* reqs, int n);
+
+// sequential reader that keeps the chunks following the current one in flight
+
+typedef struct bio_stream bio_stream;
+
+bio_stream* bio_stream_open(int fd, off_t start);
+
+// returns the data from the current offset to the end of the next chunk, valid
+// until the following call. 0 at the end of the file, -1 on errors.
+
+ssize_t bio_stream_next(bio_stream* s, char** data);
+
+// continue reading at offset off
+
+void bio_stream_seek(bio_stream* s, off_t off);
+
+void bio_stream_close(bio_stream* s);
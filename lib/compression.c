@@ -3,85 +3,756 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compression.h"
 #include "utils.h"
 
 #undef DEBUG_COMPRESSION
 
 #define COMPRESS_MAX_CHUNK ( 8 * 1024 * 1024 )
 
-void compress_chunks(void* ibuf, uint64_t ilen, void** _obuf, uint64_t* _olen)
+#define COMPRESS_MAX_THREADS 16
+
+#ifdef HAVE_LIBDEFLATE
+#define COMPRESS_LEVEL_DEFLATE 6
+#endif
+
+#ifdef HAVE_ZSTD
+#define COMPRESS_LEVEL_ZSTD    3
+#endif
+
+// chunk header: [8 bits flags|codec] [28 bits uncompressed size] [28 bits compressed size]
+// chunks written before codec ids existed only hold the compressed size and have no flags
+
+#define CHUNK_SIZED                 0x80
+
+#define CHUNK_HEADER( codec, ulen, clen ) ( ( (uint64_t)( ( codec ) | CHUNK_SIZED ) << 56 ) | ( (uint64_t)( ulen ) << 28 ) | ( clen ) )
+#define CHUNK_IS_SIZED( header )    ( ( ( header ) >> 56 ) & CHUNK_SIZED )
+#define CHUNK_CODEC( header )       ( (int)( ( ( header ) >> 56 ) & ~CHUNK_SIZED ) )
+#define CHUNK_LENGTH( header )      ( CHUNK_IS_SIZED( header ) ? ( ( header ) & ( ( 1llu << 28 ) - 1 ) ) : ( ( header ) & ( ( 1llu << 56 ) - 1 ) ) )
+#define CHUNK_SIZE( header )        ( ( ( header ) >> 28 ) & ( ( 1llu << 28 ) - 1 ) )
+
+static int compress_codec   = COMPRESS_CODEC_DEFAULT;
+static int compress_threads = 0;         // 0 ... one per core
+
+typedef struct
 {
-    uLongf chunk = COMPRESS_MAX_CHUNK;
+    void* in;
+    uint64_t ilen;
 
-    uint64_t omax = ilen * 1.01 + 12 + sizeof(uint64_t) * ( ilen / chunk + 1 );
-    void* obuf = malloc(omax);
-    void* ocur = obuf;
-    void* icur = ibuf;
+    void* out;
+    uint64_t omax;
+    uint64_t olen;
 
-#ifdef DEBUG_COMPRESSION
-    printf("compress_chunks ilen %" PRIu64 " omax %" PRIu64 "\n", ilen, omax);
+    int codec;
+} compress_job;
+
+typedef struct
+{
+    compress_job* jobs;
+    int njobs;
+    int next;
+
+    int decompress;
+    int failed;
+
+    pthread_mutex_t lock;
+} compress_queue;
+
+// per thread codec contexts, allocated on first use
+
+typedef struct
+{
+#ifdef HAVE_LIBDEFLATE
+    struct libdeflate_compressor* deflate_c;
+    struct libdeflate_decompressor* deflate_d;
+#endif
+
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstd_c;
+    ZSTD_DCtx* zstd_d;
+#endif
+
+    int unused;
+} compress_state;
+
+int compress_codec_available(int codec)
+{
+    switch ( codec )
+    {
+        case COMPRESS_CODEC_ZLIB:
+        case COMPRESS_CODEC_NONE:
+            return 1;
+
+#ifdef HAVE_ZSTD
+        case COMPRESS_CODEC_ZSTD:
+            return 1;
 #endif
+    }
+
+    return 0;
+}
 
-    while ( ilen != 0 )
+int compress_codec_parse(const char* name)
+{
+    if ( strcasecmp(name, "zlib") == 0 || strcasecmp(name, "deflate") == 0 || strcasecmp(name, "libdeflate") == 0 )
     {
-        if ( chunk > ilen )
+        return COMPRESS_CODEC_ZLIB;
+    }
+
+    if ( strcasecmp(name, "zstd") == 0 )
+    {
+        return COMPRESS_CODEC_ZSTD;
+    }
+
+    if ( strcasecmp(name, "none") == 0 )
+    {
+        return COMPRESS_CODEC_NONE;
+    }
+
+    return -1;
+}
+
+const char* compress_codec_name(int codec)
+{
+    switch ( codec )
+    {
+        case COMPRESS_CODEC_ZLIB:
+#ifdef HAVE_LIBDEFLATE
+            return "zlib (libdeflate)";
+#else
+            return "zlib";
+#endif
+
+        case COMPRESS_CODEC_ZSTD:
+            return "zstd";
+
+        case COMPRESS_CODEC_NONE:
+            return "none";
+    }
+
+    return "unknown";
+}
+
+void compress_set_codec(int codec)
+{
+    if ( !compress_codec_available(codec) )
+    {
+        fprintf(stderr, "compression codec %s not supported by this build\n", compress_codec_name(codec));
+        exit(1);
+    }
+
+    compress_codec = codec;
+}
+
+int compress_get_codec()
+{
+    return compress_codec;
+}
+
+void compress_set_threads(int nthreads)
+{
+    compress_threads = nthreads;
+}
+
+static int compress_nthreads(int njobs)
+{
+    int nthreads = compress_threads;
+
+    if ( nthreads <= 0 )
+    {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if ( nthreads > COMPRESS_MAX_THREADS )
         {
-            chunk = ilen;
+            nthreads = COMPRESS_MAX_THREADS;
         }
-        uLongf cchunk = omax - (ocur - obuf);
+    }
 
-        compress(ocur + sizeof(uint64_t), &cchunk, icur, chunk);
+    if ( nthreads > njobs )
+    {
+        nthreads = njobs;
+    }
 
-#ifdef DEBUG_COMPRESSION
-        printf("compressed chunk of %lu to %lu\n", chunk, cchunk);
+    if ( nthreads < 1 )
+    {
+        nthreads = 1;
+    }
+
+    return nthreads;
+}
+
+static void state_init(compress_state* state)
+{
+    bzero(state, sizeof(compress_state));
+}
+
+static void state_free(compress_state* state)
+{
+#ifdef HAVE_LIBDEFLATE
+    if ( state->deflate_c )
+    {
+        libdeflate_free_compressor(state->deflate_c);
+    }
+
+    if ( state->deflate_d )
+    {
+        libdeflate_free_decompressor(state->deflate_d);
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(state->zstd_c);
+    ZSTD_freeDCtx(state->zstd_d);
+#endif
+
+    UNUSED(state);
+}
+
+static uint64_t chunk_bound(compress_state* state, int codec, uint64_t len)
+{
+    UNUSED(state);
+
+    switch ( codec )
+    {
+        case COMPRESS_CODEC_NONE:
+            return len;
+
+#ifdef HAVE_ZSTD
+        case COMPRESS_CODEC_ZSTD:
+            return ZSTD_compressBound(len);
 #endif
 
-        *((uint64_t*)ocur) = cchunk;
-        ocur += cchunk + sizeof(uint64_t);
+        default:
+#ifdef HAVE_LIBDEFLATE
+            if ( state->deflate_c == NULL )
+            {
+                state->deflate_c = libdeflate_alloc_compressor(COMPRESS_LEVEL_DEFLATE);
+            }
 
-        icur += chunk;
-        ilen -= chunk;
+            return libdeflate_zlib_compress_bound(state->deflate_c, len);
+#else
+            return compressBound(len);
+#endif
     }
+}
 
-    *_obuf = obuf;
-    *_olen = ocur - obuf;
+static int chunk_compress(compress_state* state, compress_job* job)
+{
+    switch ( job->codec )
+    {
+        case COMPRESS_CODEC_NONE:
+        {
+            memcpy(job->out, job->in, job->ilen);
+            job->olen = job->ilen;
+
+            return 1;
+        }
+
+        case COMPRESS_CODEC_ZLIB:
+        {
+#ifdef HAVE_LIBDEFLATE
+            if ( state->deflate_c == NULL )
+            {
+                state->deflate_c = libdeflate_alloc_compressor(COMPRESS_LEVEL_DEFLATE);
+            }
+
+            job->olen = libdeflate_zlib_compress(state->deflate_c, job->in, job->ilen, job->out, job->omax);
+
+            return ( job->olen != 0 );
+#else
+            uLongf clen = job->omax;
+
+            if ( compress2(job->out, &clen, job->in, job->ilen, Z_DEFAULT_COMPRESSION) != Z_OK )
+            {
+                return 0;
+            }
+
+            job->olen = clen;
+
+            return 1;
+#endif
+        }
+
+#ifdef HAVE_ZSTD
+        case COMPRESS_CODEC_ZSTD:
+        {
+            if ( state->zstd_c == NULL )
+            {
+                state->zstd_c = ZSTD_createCCtx();
+            }
 
-    // return ( ocur - obuf );
+            size_t clen = ZSTD_compressCCtx(state->zstd_c, job->out, job->omax, job->in, job->ilen, COMPRESS_LEVEL_ZSTD);
+
+            if ( ZSTD_isError(clen) )
+            {
+                return 0;
+            }
+
+            job->olen = clen;
+
+            return 1;
+        }
+#endif
+    }
+
+    UNUSED(state);
+
+    return 0;
 }
 
-void uncompress_chunks(void* ibuf, uint64_t ilen, void* obuf, uint64_t olen)
+static int chunk_uncompress(compress_state* state, compress_job* job)
 {
-    UNUSED(olen);
+    switch ( job->codec )
+    {
+        case COMPRESS_CODEC_NONE:
+        {
+            if ( job->ilen > job->omax )
+            {
+                return 0;
+            }
 
-    void* icur = ibuf;
-    void* ocur = obuf;
+            memcpy(job->out, job->in, job->ilen);
+            job->olen = job->ilen;
+
+            return 1;
+        }
+
+        case COMPRESS_CODEC_ZLIB:
+        {
+#ifdef HAVE_LIBDEFLATE
+            if ( state->deflate_d == NULL )
+            {
+                state->deflate_d = libdeflate_alloc_decompressor();
+            }
+
+            size_t dlen;
+
+            if ( libdeflate_zlib_decompress(state->deflate_d, job->in, job->ilen, job->out, job->omax, &dlen) != LIBDEFLATE_SUCCESS )
+            {
+                return 0;
+            }
+
+            job->olen = dlen;
+
+            return 1;
+#else
+            uLongf dlen = job->omax;
+
+            if ( uncompress(job->out, &dlen, job->in, job->ilen) != Z_OK )
+            {
+                return 0;
+            }
+
+            job->olen = dlen;
+
+            return 1;
+#endif
+        }
+
+#ifdef HAVE_ZSTD
+        case COMPRESS_CODEC_ZSTD:
+        {
+            if ( state->zstd_d == NULL )
+            {
+                state->zstd_d = ZSTD_createDCtx();
+            }
+
+            size_t dlen = ZSTD_decompressDCtx(state->zstd_d, job->out, job->omax, job->in, job->ilen);
+
+            if ( ZSTD_isError(dlen) )
+            {
+                return 0;
+            }
+
+            job->olen = dlen;
+
+            return 1;
+        }
+#endif
+    }
+
+    fprintf(stderr, "compression codec %s not supported by this build\n", compress_codec_name(job->codec));
+
+    UNUSED(state);
+
+    return 0;
+}
+
+static void queue_work(compress_queue* queue, compress_state* state)
+{
+    while ( 1 )
+    {
+        pthread_mutex_lock(&queue->lock);
+        int i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+
+        if ( i >= queue->njobs )
+        {
+            break;
+        }
+
+        compress_job* job = queue->jobs + i;
+        int ok;
+
+        if ( queue->decompress )
+        {
+            ok = chunk_uncompress(state, job);
+        }
+        else
+        {
+            ok = chunk_compress(state, job);
+        }
+
+        if ( !ok )
+        {
+            pthread_mutex_lock(&queue->lock);
+            queue->failed = 1;
+            pthread_mutex_unlock(&queue->lock);
+        }
+    }
+}
+
+static void* queue_thread(void* arg)
+{
+    compress_queue* queue = arg;
+    compress_state state;
+
+    state_init(&state);
+    queue_work(queue, &state);
+    state_free(&state);
+
+    return NULL;
+}
+
+// process all jobs of the queue, the calling thread works along with the helpers
+
+static void queue_run(compress_queue* queue, compress_state* state)
+{
+    int nthreads = compress_nthreads(queue->njobs);
+    pthread_t threads[COMPRESS_MAX_THREADS];
+    int nstarted = 0;
+
+    pthread_mutex_init(&queue->lock, NULL);
+
+    int i;
+    for ( i = 1 ; i < nthreads ; i++ )
+    {
+        if ( pthread_create(threads + nstarted, NULL, queue_thread, queue) == 0 )
+        {
+            nstarted += 1;
+        }
+    }
+
+    queue_work(queue, state);
+
+    for ( i = 0 ; i < nstarted ; i++ )
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&queue->lock);
+}
+
+void compress_chunks(void* ibuf, uint64_t ilen, void** _obuf, uint64_t* _olen)
+{
+    int njobs = ( ilen + COMPRESS_MAX_CHUNK - 1 ) / COMPRESS_MAX_CHUNK;
+    compress_job* jobs = malloc( sizeof(compress_job) * ( njobs + 1 ) );
+
+    compress_state state;
+    state_init(&state);
 
 #ifdef DEBUG_COMPRESSION
-    printf("uncompress_chunks ilen = %" PRIu64 "\n", ilen);
+    printf("compress_chunks ilen %" PRIu64 " chunks %d codec %s\n", ilen, njobs, compress_codec_name(compress_codec));
 #endif
 
-    while ( (uint64_t)(icur - ibuf) != ilen )
+    // every chunk gets a slot of its worst case size, compacted afterwards
+
+    uint64_t omax = 0;
+
+    int i;
+    for ( i = 0 ; i < njobs ; i++ )
+    {
+        compress_job* job = jobs + i;
+
+        job->in = ibuf + (uint64_t)i * COMPRESS_MAX_CHUNK;
+        job->ilen = ilen - (uint64_t)i * COMPRESS_MAX_CHUNK;
+
+        if ( job->ilen > COMPRESS_MAX_CHUNK )
+        {
+            job->ilen = COMPRESS_MAX_CHUNK;
+        }
+
+        job->codec = compress_codec;
+        job->omax = chunk_bound(&state, job->codec, job->ilen);
+        job->olen = 0;
+
+        omax += sizeof(uint64_t) + job->omax;
+    }
+
+    void* obuf = malloc( omax + sizeof(uint64_t) );
+    void* ocur = obuf;
+
+    for ( i = 0 ; i < njobs ; i++ )
     {
-        uLongf clen = *((uint64_t*)icur);
+        jobs[i].out = ocur + sizeof(uint64_t);
+        ocur += sizeof(uint64_t) + jobs[i].omax;
+    }
 
-        // uLongf destlen = olen - (ocur - obuf);
-        uLongf destlen = COMPRESS_MAX_CHUNK;
+    compress_queue queue;
+    bzero(&queue, sizeof(compress_queue));
+
+    queue.jobs = jobs;
+    queue.njobs = njobs;
+    queue.decompress = 0;
+
+    queue_run(&queue, &state);
+
+    if ( queue.failed )
+    {
+        fprintf(stderr, "failed to compress %" PRIu64 " bytes using %s\n", ilen, compress_codec_name(compress_codec));
+        exit(1);
+    }
+
+    ocur = obuf;
+
+    for ( i = 0 ; i < njobs ; i++ )
+    {
+        uint64_t header = CHUNK_HEADER(jobs[i].codec, jobs[i].ilen, jobs[i].olen);
 
 #ifdef DEBUG_COMPRESSION
-        printf("uncompress %lu into %" PRIu64 " %ld", clen, olen, destlen);
+        printf("compressed chunk of %" PRIu64 " to %" PRIu64 "\n", jobs[i].ilen, jobs[i].olen);
 #endif
 
-        uncompress(ocur, &destlen, icur + sizeof(uint64_t), clen);
+        memcpy(ocur, &header, sizeof(uint64_t));
+        memmove(ocur + sizeof(uint64_t), jobs[i].out, jobs[i].olen);
+
+        ocur += sizeof(uint64_t) + jobs[i].olen;
+    }
+
+    uint64_t olen = ocur - obuf;
+
+    if ( olen > 0 )
+    {
+        obuf = realloc(obuf, olen);
+    }
+
+    state_free(&state);
+    free(jobs);
+
+    *_obuf = obuf;
+    *_olen = olen;
+}
+
+uint64_t uncompress_chunks(void* ibuf, uint64_t ilen, void* obuf, uint64_t olen)
+{
+    void* icur = ibuf;
+    int njobs = 0;
+    int sized = 1;
 
 #ifdef DEBUG_COMPRESSION
-        printf(" to %lu\n", destlen);
+    printf("uncompress_chunks ilen = %" PRIu64 "\n", ilen);
 #endif
 
-        icur += sizeof(uint64_t) + clen;
-        ocur += destlen;
+    while ( (uint64_t)(icur - ibuf) < ilen )
+    {
+        uint64_t header;
+        memcpy(&header, icur, sizeof(uint64_t));
+
+        if ( !CHUNK_IS_SIZED(header) )
+        {
+            sized = 0;
+        }
+
+        icur += sizeof(uint64_t) + CHUNK_LENGTH(header);
+        njobs += 1;
+    }
+
+    if ( (uint64_t)(icur - ibuf) != ilen )
+    {
+        fprintf(stderr, "corrupt compressed data of %" PRIu64 " bytes\n", ilen);
+        exit(1);
+    }
+
+    compress_job* jobs = malloc( sizeof(compress_job) * ( njobs + 1 ) );
+    uint64_t ooff = 0;
+
+    icur = ibuf;
+
+    int i;
+    for ( i = 0 ; i < njobs ; i++ )
+    {
+        compress_job* job = jobs + i;
+        uint64_t header;
+
+        memcpy(&header, icur, sizeof(uint64_t));
+
+        job->codec = CHUNK_CODEC(header);
+        job->in = icur + sizeof(uint64_t);
+        job->ilen = CHUNK_LENGTH(header);
+        job->olen = 0;
+
+        if ( sized )
+        {
+            job->out = obuf + ooff;
+            job->omax = CHUNK_SIZE(header);
+
+            ooff += job->omax;
+
+            if ( ooff > olen )
+            {
+                fprintf(stderr, "compressed data exceeds %" PRIu64 " bytes\n", olen);
+                exit(1);
+            }
+        }
+
+        icur += sizeof(uint64_t) + job->ilen;
+    }
+
+    compress_state state;
+    state_init(&state);
+
+    compress_queue queue;
+    bzero(&queue, sizeof(compress_queue));
+
+    queue.jobs = jobs;
+    queue.njobs = njobs;
+    queue.decompress = 1;
+
+    uint64_t total = 0;
+
+    if ( sized )
+    {
+        // output offsets are known up front, uncompress all chunks in parallel
+
+        queue_run(&queue, &state);
+
+        for ( i = 0 ; i < njobs ; i++ )
+        {
+            if ( jobs[i].olen != jobs[i].omax )
+            {
+                queue.failed = 1;
+            }
+
+            total += jobs[i].olen;
+        }
+    }
+    else
+    {
+        // old format, each chunk starts where the previous one ended
+
+        for ( i = 0 ; i < njobs && !queue.failed ; i++ )
+        {
+            compress_job* job = jobs + i;
+
+            job->out = obuf + total;
+            job->omax = olen - total;
+
+            if ( job->omax > COMPRESS_MAX_CHUNK )
+            {
+                job->omax = COMPRESS_MAX_CHUNK;
+            }
+
+            if ( !chunk_uncompress(&state, job) )
+            {
+                queue.failed = 1;
+            }
+
+            total += job->olen;
+        }
+    }
+
+    state_free(&state);
+
+    if ( queue.failed )
+    {
+        fprintf(stderr, "failed to uncompress %" PRIu64 " bytes\n", ilen);
+        exit(1);
+    }
+
+    free(jobs);
+
+    return total;
+}
+
+compress_chunk* compress_index(void* ibuf, uint64_t ilen, uint64_t* _nchunks)
+{
+    uint64_t nchunks = 0;
+    uint64_t coff = 0;
+
+    while ( coff < ilen )
+    {
+        uint64_t header;
+        memcpy(&header, ibuf + coff, sizeof(uint64_t));
+
+        if ( !CHUNK_IS_SIZED(header) )
+        {
+            *_nchunks = 0;
+            return NULL;
+        }
+
+        coff += sizeof(uint64_t) + CHUNK_LENGTH(header);
+        nchunks += 1;
     }
+
+    compress_chunk* index = malloc( sizeof(compress_chunk) * ( nchunks + 1 ) );
+    uint64_t uoff = 0;
+    uint64_t i;
+
+    coff = 0;
+
+    for ( i = 0 ; i < nchunks ; i++ )
+    {
+        uint64_t header;
+        memcpy(&header, ibuf + coff, sizeof(uint64_t));
+
+        index[i].coff = coff;
+        index[i].uoff = uoff;
+
+        coff += sizeof(uint64_t) + CHUNK_LENGTH(header);
+        uoff += CHUNK_SIZE(header);
+    }
+
+    index[nchunks].coff = coff;
+    index[nchunks].uoff = uoff;
+
+    *_nchunks = nchunks;
+
+    return index;
+}
+
+int compress_chunks_codec(void* ibuf, uint64_t ilen)
+{
+    int codec = -1;
+    uint64_t coff = 0;
+
+    while ( coff < ilen )
+    {
+        uint64_t header;
+        memcpy(&header, ibuf + coff, sizeof(uint64_t));
+
+        if ( !CHUNK_IS_SIZED(header) || ( codec != -1 && CHUNK_CODEC(header) != codec ) )
+        {
+            return -1;
+        }
+
+        codec = CHUNK_CODEC(header);
+        coff += sizeof(uint64_t) + CHUNK_LENGTH(header);
+    }
+
+    return codec;
 }
 
 #ifdef DEBUG_COMPRESSION
@@ -1,6 +1,52 @@
+#pragma once
 
 #include <inttypes.h>
 
-void uncompress_chunks(void* ibuf, uint64_t ilen, void* obuf, uint64_t olen);
+/*
+ * chunked compression of track and LAZ data
+ *
+ * the input is split into chunks of COMPRESS_MAX_CHUNK bytes, each stored as
+ *
+ *   [uint64 header] [compressed chunk]
+ *
+ * the header holds the codec, the uncompressed and the compressed size of the
+ * chunk. since the output offsets are known up front, independent chunks are
+ * (de)compressed in parallel. data written before codec ids were introduced
+ * (zlib, compressed size only) is still read, one chunk after the other.
+ *
+ * an index of the chunk offsets allows inflating part of the data. a range
+ * is uncompressed by passing the chunks covering it to uncompress_chunks.
+ */
+
+#define COMPRESS_CODEC_ZLIB         0       // zlib stream, via libdeflate when available
+#define COMPRESS_CODEC_ZSTD         1
+#define COMPRESS_CODEC_NONE         2       // stored as is, for data that is already compact
+
+#define COMPRESS_CODEC_DEFAULT      COMPRESS_CODEC_ZLIB
+
+typedef struct
+{
+    uint64_t coff;          // offset of the chunk header in the compressed data
+    uint64_t uoff;          // offset of the chunk in the uncompressed data
+} compress_chunk;
+
+int  compress_codec_available(int codec);
+int  compress_codec_parse(const char* name);
+const char* compress_codec_name(int codec);
+
+void compress_set_codec(int codec);
+int  compress_get_codec();
+void compress_set_threads(int nthreads);
+
+uint64_t uncompress_chunks(void* ibuf, uint64_t ilen, void* obuf, uint64_t olen);
 void compress_chunks(void* ibuf, uint64_t ilen, void** _obuf, uint64_t* _olen);
 
+// offsets of the chunks in ibuf followed by an entry for the end of the data.
+// returns NULL for data holding chunks without an uncompressed size.
+
+compress_chunk* compress_index(void* ibuf, uint64_t ilen, uint64_t* _nchunks);
+
+// codec shared by all chunks in ibuf, -1 if they differ or lack the uncompressed size
+
+int compress_chunks_codec(void* ibuf, uint64_t ilen);
+
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "compression.h"
 #include "dmask.h"
 #include "dmask_proto.h"
 
@@ -29,7 +30,61 @@ static int hostname_to_ip( const char* hostname, char* ip )
     return 0;
 }
 
-DynamicMask* dm_init( const char* host, uint16 port )
+static int socket_receive( int sock, uint64 data, void* buffer )
+{
+    uint64 pending = data;
+    uint64 bcur    = 0;
+
+    while ( pending )
+    {
+        int received = recv( sock, buffer + bcur, pending, 0 );
+
+        if ( received < 1 )
+        {
+            fprintf( stderr, "failed to receive\n" );
+            break;
+        }
+
+        bcur += received;
+        pending -= received;
+    }
+
+    if ( pending != 0 )
+    {
+        fprintf( stderr, "%lld pending bytes\n", pending );
+    }
+
+    return ( pending == 0 );
+}
+
+static int socket_send( int sock, void* buffer, uint64 data )
+{
+    uint64 pending = data;
+    uint64 bcur    = 0;
+
+    while ( pending )
+    {
+        int sent = send( sock, buffer + bcur, pending, 0 );
+
+        if ( sent < 1 )
+        {
+            if ( sent == -1 && errno == EINTR )
+            {
+                continue;
+            }
+
+            fprintf( stderr, "failed to send\n" );
+            break;
+        }
+
+        bcur += sent;
+        pending -= sent;
+    }
+
+    return ( pending == 0 );
+}
+
+static int dm_connect( const char* host, uint16 port, DmShard* shard )
 {
     int sockfd;
     struct sockaddr_in dest;
@@ -38,13 +93,13 @@ DynamicMask* dm_init( const char* host, uint16 port )
     if ( !hostname_to_ip( host, ip ) )
     {
         fprintf( stderr, "failed to resolve hostname\n" );
-        return NULL;
+        return 0;
     }
 
     if ( ( sockfd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
     {
         fprintf( stderr, "error creating socket\n" );
-        return NULL;
+        return 0;
     }
 
     bzero( &dest, sizeof( dest ) );
@@ -54,7 +109,8 @@ DynamicMask* dm_init( const char* host, uint16 port )
     if ( inet_aton( ip, &( dest.sin_addr ) ) == 0 )
     {
         fprintf( stderr, "failed to parse %s:%d\n", host, port );
-        return NULL;
+        close( sockfd );
+        return 0;
     }
 
     int retry     = 3;
@@ -75,19 +131,153 @@ DynamicMask* dm_init( const char* host, uint16 port )
     }
 
     if ( connected == 0 )
+    {
+        close( sockfd );
+        return 0;
+    }
+
+    shard->sockfd = sockfd;
+    shard->dest   = dest;
+    shard->first  = 0;
+    shard->last   = ~0ULL;
+
+    return 1;
+}
+
+DynamicMask* dm_init( const char* host, uint16 port )
+{
+    DmShard shard;
+
+    if ( !dm_connect( host, port, &shard ) )
     {
         return NULL;
     }
 
     DynamicMask* dm = calloc( 1, sizeof( DynamicMask ) );
 
-    dm->sockfd    = sockfd;
-    dm->dest      = dest;
+    dm->shards    = malloc( sizeof( DmShard ) );
+    dm->shards[0] = shard;
+    dm->nshards   = 1;
     dm->send_next = 1;
 
     return dm;
 }
 
+static int cmp_shards( const void* a, const void* b )
+{
+    const DmShard* x = (const DmShard*)a;
+    const DmShard* y = (const DmShard*)b;
+
+    return ( x->first > y->first ) - ( x->first < y->first );
+}
+
+// asks the shards for their reads, they have to cover the database without gaps
+
+static int dm_shard_ranges( DynamicMask* dm )
+{
+    uint64 nreads = 0;
+    int i;
+
+    for ( i = 0; i < dm->nshards; i++ )
+    {
+        DmShard* shard = dm->shards + i;
+        DmHeader header;
+
+        bzero( &header, sizeof( header ) );
+
+        header.version = DM_VERSION;
+        header.type    = DM_TYPE_REQUEST_RANGE;
+        header.length  = sizeof( header );
+
+        if ( send( shard->sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) ||
+             !socket_receive( shard->sockfd, sizeof( header ), &header ) || header.type != DM_TYPE_RESPONSE_RANGE )
+        {
+            fprintf( stderr, "failed to receive the reads of shard %d\n", i + 1 );
+            return 0;
+        }
+
+        shard->first = header.reserved1;
+        shard->last  = header.reserved2;
+
+        if ( i > 0 && header.reserved3 != nreads )
+        {
+            fprintf( stderr, "shards serve databases of different size\n" );
+            return 0;
+        }
+
+        nreads = header.reserved3;
+    }
+
+    qsort( dm->shards, dm->nshards, sizeof( DmShard ), cmp_shards );
+
+    for ( i = 0; i < dm->nshards; i++ )
+    {
+        uint64 expected = ( i == 0 ) ? 0 : dm->shards[ i - 1 ].last;
+
+        if ( dm->shards[ i ].first != expected )
+        {
+            fprintf( stderr, "shards don't cover reads %llu..%llu\n", expected, dm->shards[ i ].first - 1 );
+            return 0;
+        }
+    }
+
+    if ( dm->shards[ dm->nshards - 1 ].last != nreads )
+    {
+        fprintf( stderr, "shards don't cover reads %llu..%llu\n", dm->shards[ dm->nshards - 1 ].last, nreads - 1 );
+        return 0;
+    }
+
+    return 1;
+}
+
+DynamicMask* dm_init_shards( const char* servers, uint16 port )
+{
+    DynamicMask* dm = calloc( 1, sizeof( DynamicMask ) );
+    char* list      = strdup( servers );
+    char* save;
+    char* server;
+
+    dm->send_next = 1;
+
+    for ( server = strtok_r( list, ",", &save ); server != NULL; server = strtok_r( NULL, ",", &save ) )
+    {
+        uint16 sport = port;
+        char* colon  = strchr( server, ':' );
+
+        if ( colon != NULL )
+        {
+            *colon = '\0';
+            sport  = atoi( colon + 1 );
+        }
+
+        dm->shards = realloc( dm->shards, sizeof( DmShard ) * ( dm->nshards + 1 ) );
+
+        if ( !dm_connect( server, sport, dm->shards + dm->nshards ) )
+        {
+            break;
+        }
+
+        dm->nshards++;
+    }
+
+    int ok = ( server == NULL && dm->nshards > 0 );
+
+    free( list );
+
+    if ( ok && dm->nshards > 1 )
+    {
+        ok = dm_shard_ranges( dm );
+    }
+
+    if ( !ok )
+    {
+        dm_free( dm );
+        return NULL;
+    }
+
+    return dm;
+}
+
 void dm_send_next( DynamicMask* dm, int run, HITS_DB* blocka, char* namea, HITS_DB* blockb, char* nameb )
 
 {
@@ -111,6 +301,78 @@ void dm_send_next( DynamicMask* dm, int run, HITS_DB* blocka, char* namea, HITS_
     }
 
     dm->send_next = send_next;
+
+    free( dira );
+    free( dirb );
+}
+
+static int dm_send_las_available( DmShard* shard, char* msg, int mcur )
+{
+    DmHeader* header = (DmHeader*)msg;
+    bzero( header, sizeof( DmHeader ) );
+
+    header->version = DM_VERSION;
+    header->type    = DM_TYPE_LAS_AVAILABLE;
+    header->length  = mcur;
+
+    if ( !socket_send( shard->sockfd, msg, mcur ) )
+    {
+        fprintf( stderr, "failed to send BLOCK DONE message\n" );
+        return 0;
+    }
+
+    return 1;
+}
+
+// sends each .las file to the shards owning some of its A reads beg[i]..end[i]-1, to all if beg is NULL.
+// the paths are batched into as few messages as DM_MAX_PATHS allows.
+
+static int dm_send_paths( DynamicMask* dm, int npaths, char** paths, uint64* beg, uint64* end )
+{
+    int mmax  = 1000;
+    char* msg = malloc( mmax );
+    int sent  = 1;
+    int s, i;
+
+    for ( s = 0; s < dm->nshards; s++ )
+    {
+        DmShard* shard = dm->shards + s;
+        int mcur       = sizeof( DmHeader );
+
+        for ( i = 0; i < npaths; i++ )
+        {
+            if ( beg != NULL && ( end[ i ] <= shard->first || beg[ i ] >= shard->last ) )
+            {
+                continue;
+            }
+
+            int len = strlen( paths[ i ] ) + 1;
+
+            if ( mcur > (int)sizeof( DmHeader ) && mcur + len > DM_MAX_PATHS )
+            {
+                sent &= dm_send_las_available( shard, msg, mcur );
+                mcur = sizeof( DmHeader );
+            }
+
+            if ( mcur + len > mmax )
+            {
+                mmax = ( mcur + len ) * 1.2 + 1000;
+                msg  = realloc( msg, mmax );
+            }
+
+            memcpy( msg + mcur, paths[ i ], len );
+            mcur += len;
+        }
+
+        if ( mcur > (int)sizeof( DmHeader ) )
+        {
+            sent &= dm_send_las_available( shard, msg, mcur );
+        }
+    }
+
+    free( msg );
+
+    return sent;
 }
 
 int dm_send_block_done( DynamicMask* dm, int run, HITS_DB* blocka, char* namea, HITS_DB* blockb, char* nameb )
@@ -124,18 +386,16 @@ int dm_send_block_done( DynamicMask* dm, int run, HITS_DB* blocka, char* namea,
     char* dira = strdup( getDir( run, blocka->part ) );
     char* dirb = strdup( getDir( run, blockb->part ) );
 
-    int mmax  = 1000;
-    int mcur  = 0;
-    char* msg = malloc( mmax );
+    char* paths[ 2 ];
+    uint64 beg[ 2 ], end[ 2 ];
+    int npaths = 0;
     char* path;
     char abspath[ PATH_MAX + 1 ];
 
     int self = ( blocka == blockb );
 
-    mcur += sizeof( DmHeader );
-    msg[ mcur ] = '\0';
+    // the A reads of namea.nameb.las are in blocka
 
-    int len;
     path = Catenate( Catenate( dira, "/", namea, "" ), ".", nameb, ".las" );
 
     if ( realpath( path, abspath ) == NULL )
@@ -144,16 +404,11 @@ int dm_send_block_done( DynamicMask* dm, int run, HITS_DB* blocka, char* namea,
         exit( 1 );
     }
 
-    len = strlen( abspath ) + 1;
-
-    if ( mcur + len > mmax )
-    {
-        mmax = ( mcur + len ) * 1.2 + 1000;
-        msg  = realloc( msg, mmax );
-    }
+    paths[ npaths ] = strdup( abspath );
+    beg[ npaths ]   = blocka->ufirst;
+    end[ npaths ]   = blocka->ufirst + blocka->nreads;
+    npaths++;
 
-    memcpy( msg + mcur, abspath, len );
-    mcur += len;
     if ( !self )
     {
         path = Catenate( Catenate( dirb, "/", nameb, "" ), ".", namea, ".las" );
@@ -164,34 +419,23 @@ int dm_send_block_done( DynamicMask* dm, int run, HITS_DB* blocka, char* namea,
             exit( 1 );
         }
 
-        len = strlen( abspath ) + 1;
-
-        if ( mcur + len > mmax )
-        {
-            mmax = ( mcur + len ) * 1.2 + 1000;
-            msg  = realloc( msg, mmax );
-        }
-
-        memcpy( msg + mcur, abspath, len );
-        mcur += len;
+        paths[ npaths ] = strdup( abspath );
+        beg[ npaths ]   = blockb->ufirst;
+        end[ npaths ]   = blockb->ufirst + blockb->nreads;
+        npaths++;
     }
-    DmHeader* header = (DmHeader*)msg;
-    header->version  = DM_VERSION;
-    header->type     = DM_TYPE_LAS_AVAILABLE;
-    header->length   = mcur;
 
-    // TODO ... loop in case send didn't transfer the whole buffer
+    int sent = dm_send_paths( dm, npaths, paths, beg, end );
 
-    if ( send( dm->sockfd, msg, mcur, 0 ) != mcur )
+    while ( npaths > 0 )
     {
-        fprintf( stderr, "failed to send BLOCK DONE message\n" );
-        return 0;
+        free( paths[ --npaths ] );
     }
 
     free( dira );
     free( dirb );
 
-    return 1;
+    return sent;
 }
 
 void dm_free( DynamicMask* dm )
@@ -201,36 +445,14 @@ void dm_free( DynamicMask* dm )
         return;
     }
 
-    close( dm->sockfd );
-
-    free( dm );
-}
-
-static int socket_receive( int sock, uint64 data, void* buffer )
-{
-    uint64 pending = data;
-    uint64 bcur    = 0;
-
-    while ( pending )
-    {
-        int received = recv( sock, buffer + bcur, pending, 0 );
-
-        if ( received < 1 )
-        {
-            fprintf( stderr, "failed to receive\n" );
-            break;
-        }
-
-        bcur += received;
-        pending -= received;
-    }
-
-    if ( pending != 0 )
+    int i;
+    for ( i = 0; i < dm->nshards; i++ )
     {
-        fprintf( stderr, "%lld pending bytes\n", pending );
+        close( dm->shards[ i ].sockfd );
     }
 
-    return ( pending == 0 );
+    free( dm->shards );
+    free( dm );
 }
 
 static void dm_simple_message( DynamicMask* dm, int msg )
@@ -242,9 +464,13 @@ static void dm_simple_message( DynamicMask* dm, int msg )
     header.type    = msg;
     header.length  = sizeof( header );
 
-    if ( send( dm->sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+    int i;
+    for ( i = 0; i < dm->nshards; i++ )
     {
-        fprintf( stderr, "failed to send message\n" );
+        if ( send( dm->shards[ i ].sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+        {
+            fprintf( stderr, "failed to send message\n" );
+        }
     }
 }
 
@@ -281,124 +507,459 @@ int dm_done( DynamicMask* dm, char** files )
         return 0;
     }
 
-    int mmax  = 1000;
-    int mcur  = 0;
-    char* msg = malloc( mmax );
     char abspath[ PATH_MAX + 1 ];
+    char** paths;
+    int i, npaths;
+
+    for ( npaths = 0; files[ npaths ] != NULL; npaths++ )
+    {
+    }
+
+    if ( npaths == 0 )
+    {
+        return 0;
+    }
 
-    mcur += sizeof( DmHeader );
-    msg[ mcur ] = '\0';
+    paths = malloc( sizeof( char* ) * npaths );
 
-    int i, len;
-    i = 0;
-    while ( files[ i ] != NULL )
+    for ( i = 0; i < npaths; i++ )
     {
         if ( realpath( files[ i ], abspath ) == NULL )
         {
             perror( "realpath failed" );
             exit( 1 );
         }
-        len = strlen( abspath ) + 1;
 
-        if ( mcur + len > mmax )
+        paths[ i ] = strdup( abspath );
+    }
+
+    // the A reads of the files are unknown, every shard gets all of them
+
+    int sent = dm_send_paths( dm, npaths, paths, NULL, NULL );
+
+    for ( i = 0; i < npaths; i++ )
+    {
+        free( paths[ i ] );
+    }
+
+    free( paths );
+
+    return sent;
+}
+
+#define DM_PAIR_RETRY 10 // seconds to wait while the remaining pairs are held by other workers
+
+int dm_next_pair( DynamicMask* dm, int preva, int prevb, int* a, int* b )
+{
+    DmHeader header;
+
+    while ( 1 )
+    {
+        bzero( &header, sizeof( header ) );
+
+        header.version   = DM_VERSION;
+        header.type      = DM_TYPE_REQUEST_PAIR;
+        header.length    = sizeof( header );
+        header.reserved1 = preva;
+        header.reserved2 = prevb;
+
+        // pairs are handed out by the first shard
+
+        if ( send( dm->shards[ 0 ].sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+        {
+            fprintf( stderr, "failed to send pair request\n" );
+            return -1;
+        }
+
+        if ( !socket_receive( dm->shards[ 0 ].sockfd, sizeof( header ), &header ) || header.type != DM_TYPE_RESPONSE_PAIR )
+        {
+            fprintf( stderr, "failed to receive pair\n" );
+            return -1;
+        }
+
+        if ( header.reserved1 != 0 )
         {
-            mmax = ( mcur + len ) * 1.2 + 1000;
-            msg  = realloc( msg, mmax );
+            *a = header.reserved1;
+            *b = header.reserved2;
+
+            return 1;
+        }
+
+        if ( header.reserved3 == 0 )
+        {
+            return 0;
         }
 
-        memcpy( msg + mcur, abspath, len );
-        mcur += len;
-        i++;
+        // a worker holding one of the remaining pairs might fail
+
+        preva = prevb = 0;
+        sleep( DM_PAIR_RETRY );
+    }
+}
+
+/*
+    copy of a block's track, kept next to the database as .<db>.<block>.<track>.dmc
+    and brought up to date with the deltas sent by the server. with several shards
+    each keeps a copy .<db>.<block>.<track>.<shard>.dmc of the reads it owns.
+
+    [DmCache] [track_anno * ( nreads + 1 )] [track_data]
+*/
+
+#define DM_CACHE_MAGIC   0x434d4d44
+#define DM_CACHE_VERSION 1
+
+typedef struct
+{
+    uint32 magic;
+    uint32 version;
+
+    uint64 epoch;    // of the server the copy came from
+    uint64 tversion; // track version of the copy
+
+    uint64 ufirst;
+    uint64 nreads;
+
+    uint64 reserved1;
+    uint64 reserved2;
+} DmCache;
+
+static char* dm_cache_path( HITS_DB* db, char* trackName, int shard )
+{
+    char* path;
+    char* suffix = strdup( shard > 0 ? Numbered_Suffix( ".", shard, ".dmc" ) : ".dmc" );
+
+    if ( db->part > 0 )
+    {
+        path = Catenate( db->path, Numbered_Suffix( ".", db->part, "." ), trackName, suffix );
+    }
+    else
+    {
+        path = Catenate( db->path, ".", trackName, suffix );
     }
 
-    if ( mcur == 0 )
+    free( suffix );
+
+    return strdup( path );
+}
+
+static int dm_cache_load( char* path, uint64 first, uint64 nreads, DmCache* cache, track_anno** _anno, track_data** _data )
+{
+    FILE* fileIn = fopen( path, "r" );
+
+    if ( fileIn == NULL )
     {
-        free( msg );
         return 0;
     }
 
-    DmHeader* header = (DmHeader*)msg;
-    header->version  = DM_VERSION;
-    header->type     = DM_TYPE_LAS_AVAILABLE;
-    header->length   = mcur;
+    track_anno* anno = NULL;
+    track_data* data = NULL;
+    int ok           = 0;
+
+    if ( fread( cache, sizeof( DmCache ), 1, fileIn ) == 1 &&
+         cache->magic == DM_CACHE_MAGIC && cache->version == DM_CACHE_VERSION &&
+         cache->ufirst == first && cache->nreads == nreads )
+    {
+        anno = malloc( sizeof( track_anno ) * ( nreads + 1 ) );
 
-    // TODO ... loop in case send didn't transfer the whole buffer
+        if ( fread( anno, sizeof( track_anno ), nreads + 1, fileIn ) == nreads + 1 && anno[ 0 ] == 0 )
+        {
+            data = malloc( anno[ nreads ] + 1 );
+
+            ok = ( fread( data, 1, anno[ nreads ], fileIn ) == (size_t)anno[ nreads ] );
+        }
+    }
+
+    fclose( fileIn );
 
-    if ( send( dm->sockfd, msg, mcur, 0 ) != mcur )
+    if ( !ok )
     {
-        fprintf( stderr, "failed to send BLOCK DONE message\n" );
-        free( msg );
+        fprintf( stderr, "ignoring malformed track copy %s\n", path );
+
+        free( anno );
+        free( data );
+
         return 0;
     }
 
-    free( msg );
+    *_anno = anno;
+    *_data = data;
+
     return 1;
 }
 
-HITS_TRACK* dm_load_track( HITS_DB* db, DynamicMask* dm, char* trackName )
+static void dm_cache_write( char* path, DmCache* cache, track_anno* anno, track_data* data )
 {
+    // concurrent jobs of the same block replace the copy atomically
+
+    char* pathTmp = malloc( strlen( path ) + 32 );
+    sprintf( pathTmp, "%s.%d", path, getpid() );
+
+    FILE* fileOut = fopen( pathTmp, "w" );
+
+    if ( fileOut == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", pathTmp );
+        free( pathTmp );
+
+        return;
+    }
+
+    uint64 nreads = cache->nreads;
+
+    int ok = ( fwrite( cache, sizeof( DmCache ), 1, fileOut ) == 1 &&
+               fwrite( anno, sizeof( track_anno ), nreads + 1, fileOut ) == nreads + 1 &&
+               fwrite( data, 1, anno[ nreads ], fileOut ) == (size_t)anno[ nreads ] );
+
+    if ( fclose( fileOut ) != 0 || !ok || rename( pathTmp, path ) != 0 )
+    {
+        fprintf( stderr, "failed to write %s\n", path );
+        unlink( pathTmp );
+    }
+
+    free( pathTmp );
+}
+
+// brings the copy at path of the track of reads first..first+nreads-1 up to date with the server's
+
+static int dm_load_range( int sockfd, char* path, uint64 first, uint64 nreads, track_anno** _anno, track_data** _data )
+{
+    DmCache cache;
+    track_anno* anno = NULL;
+    track_data* data = NULL;
+
+    if ( !dm_cache_load( path, first, nreads, &cache, &anno, &data ) )
+    {
+        bzero( &cache, sizeof( cache ) );
+
+        cache.magic   = DM_CACHE_MAGIC;
+        cache.version = DM_CACHE_VERSION;
+        cache.ufirst  = first;
+        cache.nreads  = nreads;
+    }
+
     DmHeader header;
     bzero( &header, sizeof( header ) );
 
     header.version = DM_VERSION;
-    header.type    = DM_TYPE_REQUEST_TRACK;
+    header.type    = DM_TYPE_REQUEST_DELTA;
     header.length  = sizeof( header );
 
-    header.reserved1 = db->ufirst;
-    header.reserved2 = db->nreads;
+    header.reserved1 = first;
+    header.reserved2 = nreads;
+    header.reserved3 = cache.epoch;
+    header.reserved4 = cache.tversion;
 
-    // track request
+    // delta request
 
-    if ( send( dm->sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+    if ( send( sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
     {
-        fprintf( stderr, "failed to send BLOCK DONE message\n" );
-        return NULL;
+        fprintf( stderr, "failed to send track request\n" );
+        return 0;
     }
 
-    // response header
+    // response header and compressed delta
 
-    if ( recv( dm->sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) )
+    if ( !socket_receive( sockfd, sizeof( header ), &header ) || header.type != DM_TYPE_RESPONSE_DELTA )
     {
         fprintf( stderr, "failed to receive header\n" );
-        return NULL;
+        return 0;
+    }
+
+    uint64 clen   = header.length - sizeof( DmHeader );
+    uint64 ulen   = header.reserved3;
+    void* cbuf    = malloc( clen );
+    uint64* delta = malloc( ulen );
+
+    if ( !socket_receive( sockfd, clen, cbuf ) )
+    {
+        fprintf( stderr, "failed to receive track delta\n" );
+        return 0;
     }
 
-    // track anno part
+    if ( ulen < 2 * sizeof( uint64 ) || uncompress_chunks( cbuf, clen, delta, ulen ) != ulen )
+    {
+        fprintf( stderr, "failed to uncompress track delta\n" );
+        return 0;
+    }
 
-    uint64 len_anno = sizeof( track_anno ) * ( db->nreads + 1 );
+    free( cbuf );
 
-    track_anno* buf_anno = malloc( len_anno );
+    uint64 full   = delta[ 0 ];
+    uint64 n      = delta[ 1 ];
 
-    if ( !socket_receive( dm->sockfd, len_anno, buf_anno ) )
+    if ( n > nreads || sizeof( uint64 ) * ( 2 + 2 * n ) > ulen )
     {
-        fprintf( stderr, "failed to receive track.anno\n" );
-        return NULL;
+        fprintf( stderr, "malformed track delta\n" );
+        return 0;
     }
 
-    // track data part
+    uint64* reads = delta + 2;
+    uint64* lens  = reads + n;
+    char* ddata   = (char*)( lens + n );
 
-    uint64 len_data      = buf_anno[ db->nreads ];
-    track_data* buf_data = malloc( len_data );
+    if ( full || anno == NULL )
+    {
+        free( anno );
+        free( data );
+
+        anno = NULL;
+        data = NULL;
+    }
 
-    if ( !socket_receive( dm->sockfd, len_data, buf_data ) )
+    // merge the changed reads into the copy
+
+    track_anno* nanno = malloc( sizeof( track_anno ) * ( nreads + 1 ) );
+    track_anno off    = 0;
+    uint64 dlen       = 0;
+    uint64 i, k;
+
+    for ( i = k = 0; i < nreads; i++ )
     {
-        fprintf( stderr, "failed to receive track.data\n" );
-        return NULL;
+        nanno[ i ] = off;
+
+        if ( k < n && reads[ k ] == i )
+        {
+            off += lens[ k ];
+            dlen += lens[ k ];
+            k++;
+        }
+        else if ( anno )
+        {
+            off += anno[ i + 1 ] - anno[ i ];
+        }
+    }
+
+    nanno[ nreads ] = off;
+
+    if ( k != n || sizeof( uint64 ) * ( 2 + 2 * n ) + dlen != ulen )
+    {
+        fprintf( stderr, "malformed track delta\n" );
+        return 0;
     }
 
-    assert( ( len_anno + len_data + sizeof( DmHeader ) ) == header.length );
+    track_data* ndata = malloc( off + 1 );
+
+    for ( i = k = 0; i < nreads; i++ )
+    {
+        track_anno len = nanno[ i + 1 ] - nanno[ i ];
+
+        if ( k < n && reads[ k ] == i )
+        {
+            memcpy( (char*)ndata + nanno[ i ], ddata, len );
+            ddata += len;
+            k++;
+        }
+        else if ( len )
+        {
+            memcpy( (char*)ndata + nanno[ i ], (char*)data + anno[ i ], len );
+        }
+    }
+
+    if ( full || n > 0 || cache.epoch != header.reserved1 || cache.tversion != header.reserved2 )
+    {
+        cache.epoch    = header.reserved1;
+        cache.tversion = header.reserved2;
+
+        dm_cache_write( path, &cache, nanno, ndata );
+    }
+
+    free( anno );
+    free( data );
+    free( delta );
+
+    printf( "received %llu bytes, %s of %llu reads, track version %llu\n",
+            clen, full ? "full track" : "changes", n, cache.tversion );
+
+    *_anno = nanno;
+    *_data = ndata;
+
+    return 1;
+}
+
+HITS_TRACK* dm_load_track( HITS_DB* db, DynamicMask* dm, char* trackName )
+{
+    uint64 bfirst    = db->ufirst;
+    uint64 blast     = db->ufirst + db->nreads;
+    track_anno* anno = NULL;
+    track_data* data = NULL;
+    uint64 dlen      = 0;
+    int s;
+
+    // the parts of the block owned by the shards, in the order of the reads
+
+    for ( s = 0; s < dm->nshards; s++ )
+    {
+        DmShard* shard = dm->shards + s;
+        uint64 first   = ( shard->first > bfirst ) ? shard->first : bfirst;
+        uint64 last    = ( shard->last < blast ) ? shard->last : blast;
+
+        if ( first >= last )
+        {
+            continue;
+        }
+
+        char* path = dm_cache_path( db, trackName, ( dm->nshards > 1 ) ? s + 1 : 0 );
+        track_anno* panno;
+        track_data* pdata;
+
+        int ok = dm_load_range( shard->sockfd, path, first, last - first, &panno, &pdata );
+
+        free( path );
+
+        if ( !ok )
+        {
+            free( anno );
+            free( data );
+
+            return NULL;
+        }
+
+        if ( first == bfirst && last == blast )
+        {
+            anno = panno;
+            data = pdata;
+
+            break;
+        }
+
+        if ( anno == NULL )
+        {
+            anno = malloc( sizeof( track_anno ) * ( db->nreads + 1 ) );
+        }
+
+        uint64 i;
+        uint64 plen = panno[ last - first ];
+
+        data = realloc( data, dlen + plen + 1 );
+        memcpy( (char*)data + dlen, pdata, plen );
+
+        for ( i = first; i < last; i++ )
+        {
+            anno[ i - bfirst ] = dlen + panno[ i - first ];
+        }
+
+        dlen += plen;
+        anno[ db->nreads ] = dlen;
+
+        free( panno );
+        free( pdata );
+    }
+
+    if ( anno == NULL )
+    {
+        fprintf( stderr, "no server owns reads %llu..%llu\n", bfirst, blast - 1 );
+        return NULL;
+    }
 
     HITS_TRACK* track = (HITS_TRACK*)malloc( sizeof( HITS_TRACK ) );
 
     track->name = strdup( trackName );
     track->size = sizeof( track_anno );
-    track->anno = buf_anno;
-    track->data = buf_data;
+    track->anno = anno;
+    track->data = data;
 
     track->next = db->tracks;
     db->tracks  = track;
 
-    printf( "received %llu + %llu bytes\n", len_anno, len_data );
-
     return track;
 }
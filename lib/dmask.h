@@ -17,12 +17,25 @@
 typedef struct
 {
     int sockfd;
-    struct sockaddr_in dest;    
-    
+    struct sockaddr_in dest;
+
+    uint64 first;   // reads first..last-1 are owned by the server
+    uint64 last;
+} DmShard;
+
+typedef struct
+{
+    DmShard* shards; // ordered by their reads, the first hands out the block pairs
+    int nshards;
+
     int send_next;
 } DynamicMask;
 
 DynamicMask* dm_init(const char* host, uint16 port);
+
+// connects to the comma separated host[:port] servers, each one a shard (DMserver -S) of the reads
+
+DynamicMask* dm_init_shards(const char* servers, uint16 port);
 void dm_free(DynamicMask* dm);
 
 void dm_write_track(DynamicMask* dm);
@@ -41,3 +54,8 @@ int dm_send_block_done(DynamicMask* dm, int run,
 void dm_send_next(DynamicMask* dm, int run,
                   HITS_DB* blocka, char* namea, 
                   HITS_DB* blockb, char* nameb);
+
+// reports the pair preva x prevb (0 for none) as finished and asks for the next one.
+// returns 1 with the pair in a and b, 0 once all pairs are finished and -1 on errors.
+
+int dm_next_pair(DynamicMask* dm, int preva, int prevb, int* a, int* b);
@@ -15,9 +15,12 @@ typedef struct
     uint64 reserved4;
 } DmHeader;
 
-#define DM_VERSION               0x1
+#define DM_VERSION               0x2
 
-#define DM_TYPE_LAS_AVAILABLE    (0x1 << 0)     // c -> s ... contains NULL separated paths as data after header
+#define DM_TYPE_LAS_AVAILABLE    (0x1 << 0)     // c -> s ... contains NULL separated paths as data after header.
+                                                //            the server queues each batch ordered by block pair
+
+#define DM_MAX_PATHS             ( 1024 * 1024 ) // bytes per DM_TYPE_LAS_AVAILABLE message, larger batches are split
 #define DM_TYPE_REQUEST_TRACK    (0x1 << 1)     // c -> s ... request track. reserved1 = bfirst, reserved2 = nreads
 #define DM_TYPE_RESPONSE_TRACK   (0x1 << 2)     // c <- s ... dust track for the requested offset/block (bfirst & nreads)
 #define DM_TYPE_SHUTDOWN         (0x1 << 3)     // c -> s ... initiate server shutdown
@@ -27,3 +30,43 @@ typedef struct
 #define DM_TYPE_INTERVALS        (0x1 << 6)     // c -> s ... dump dusted intervals to text file
 
 #define DM_TYPE_WRITE_TRACK      (0x1 << 7)     // c -> s ... write track
+
+#define DM_TYPE_REQUEST_DELTA    0x81           // c -> s ... request changes of the track since the client's copy.
+                                                //            reserved1 = bfirst, reserved2 = nreads,
+                                                //            reserved3 = epoch, reserved4 = version of the copy (0 for none)
+#define DM_TYPE_RESPONSE_DELTA   0x82           // c <- s ... changed reads of bfirst..bfirst+nreads, compressed with compress_chunks.
+                                                //            reserved1 = epoch, reserved2 = version, reserved3 = uncompressed size
+
+#define DM_TYPE_REQUEST_PAIR     0x83           // c -> s ... request the next block pair to compare (server started with -D).
+                                                //            reserved1, reserved2 = A and B block of the pair finished, 0 if none
+#define DM_TYPE_RESPONSE_PAIR    0x84           // c <- s ... reserved1, reserved2 = A and B block (B <= A), 0 if none is left.
+                                                //            reserved3 = pairs handed out to others and not yet finished
+
+#define DM_TYPE_REQUEST_RANGE    0x85           // c -> s ... request the reads owned by the server (started with -S)
+#define DM_TYPE_RESPONSE_RANGE   0x86           // c <- s ... reserved1 = first read, reserved2 = last read + 1,
+                                                //            reserved3 = reads in the database
+
+/*
+    the server's track version is bumped each time a track update changes the
+    intervals of at least one read, the epoch identifies the server instance.
+    if the epoch doesn't match the server's or the client has no copy, the
+    delta holds all reads with intervals and replaces the copy.
+
+    uncompressed delta
+
+        [uint64 full] [uint64 n] [uint64 read offset to bfirst] * n [uint64 bytes of intervals] * n [track_data]
+*/
+
+/*
+    pairs are handed out diagonal first, then by increasing distance of the
+    blocks. a worker keeps its A block as long as one of its pairs is close to
+    the front. pairs of a worker that disconnects are handed out again.
+*/
+
+/*
+    with -S <shard>/<shards> a server only keeps the coverage of the reads of
+    its contiguous range of blocks. clients connected to all shards ask each
+    for the part of a block's track in its range and send a .las file only to
+    the shards owning some of its A reads. track deltas have to be requested
+    for reads within the range of the server.
+*/
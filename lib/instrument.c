@@ -0,0 +1,339 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "instrument.h"
+
+#define INS_ENV_FILE        "MARVEL_STATS"
+#define INS_ENV_FORMAT      "MARVEL_STATS_FORMAT"
+
+int ins_state = -1;
+
+static struct
+{
+    pthread_mutex_t lock;
+
+    ins_metric** metrics;
+    int nmetrics;
+    int maxmetrics;
+
+    char* path;
+    int prometheus;
+} Ins = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL, 0 };
+
+static const char* type_name[] = { "counter", "timer", "histogram" };
+
+static void ins_exit()
+{
+    char* buf = NULL;
+    size_t len = 0;
+
+    FILE* file = open_memstream(&buf, &len);
+
+    if (file == NULL)
+    {
+        return ;
+    }
+
+    ins_report(file, Ins.prometheus);
+    fclose(file);
+
+    // a single append, so that reports of concurrent processes don't interleave
+
+    int fd;
+
+    if (strcmp(Ins.path, "-") == 0)
+    {
+        fd = STDERR_FILENO;
+    }
+    else
+    {
+        fd = open(Ins.path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+
+    if (fd == -1)
+    {
+        fprintf(stderr, "failed to open %s\n", Ins.path);
+    }
+    else
+    {
+        if ( write(fd, buf, len) != (ssize_t)len )
+        {
+            fprintf(stderr, "failed to write the report to %s\n", Ins.path);
+        }
+
+        if (fd != STDERR_FILENO)
+        {
+            close(fd);
+        }
+    }
+
+    free(buf);
+}
+
+int ins_setup()
+{
+    pthread_mutex_lock(&Ins.lock);
+
+    if (ins_state < 0)
+    {
+        char* path = getenv(INS_ENV_FILE);
+        char* format = getenv(INS_ENV_FORMAT);
+
+        if (path != NULL && *path != '\0')
+        {
+            Ins.path = strdup(path);
+            Ins.prometheus = ( format != NULL && strncmp(format, "prom", 4) == 0 );
+
+            atexit(ins_exit);
+
+            __atomic_store_n(&ins_state, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_store_n(&ins_state, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    pthread_mutex_unlock(&Ins.lock);
+
+    return ins_state;
+}
+
+ins_metric* ins_get(const char* name, ins_type type)
+{
+    ins_metric* m = NULL;
+    int i;
+
+    pthread_mutex_lock(&Ins.lock);
+
+    for (i = 0; i < Ins.nmetrics; i++)
+    {
+        if (strcmp(Ins.metrics[i]->name, name) == 0)
+        {
+            m = Ins.metrics[i];
+            break;
+        }
+    }
+
+    if (m == NULL)
+    {
+        if (Ins.nmetrics == Ins.maxmetrics)
+        {
+            Ins.maxmetrics = Ins.maxmetrics * 2 + 16;
+            Ins.metrics = realloc(Ins.metrics, sizeof(ins_metric*) * Ins.maxmetrics);
+        }
+
+        m = calloc(1, sizeof(ins_metric));
+        m->name = strdup(name);
+        m->type = type;
+
+        Ins.metrics[Ins.nmetrics] = m;
+        Ins.nmetrics += 1;
+    }
+
+    pthread_mutex_unlock(&Ins.lock);
+
+    return m;
+}
+
+uint64_t ins_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ins_add(ins_metric* m, uint64_t n)
+{
+    __atomic_fetch_add(&(m->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(m->sum), n, __ATOMIC_RELAXED);
+}
+
+void ins_observe(ins_metric* m, uint64_t value)
+{
+    int bin = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+
+    __atomic_fetch_add(&(m->count), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(m->sum), value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(m->bins + bin, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&(m->max), __ATOMIC_RELAXED);
+
+    while ( value > max &&
+            !__atomic_compare_exchange_n(&(m->max), &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+    {
+    }
+}
+
+static int cmp_metric(const void* a, const void* b)
+{
+    ins_metric* x = *(ins_metric**)a;
+    ins_metric* y = *(ins_metric**)b;
+
+    return strcmp(x->name, y->name);
+}
+
+// largest value of bin b
+
+static uint64_t bin_bound(int b)
+{
+    if (b == 0)
+    {
+        return 0;
+    }
+
+    if (b == 64)
+    {
+        return UINT64_MAX;
+    }
+
+    return (1llu << b) - 1;
+}
+
+static void program_name(char* name, size_t len)
+{
+    FILE* file = fopen("/proc/self/comm", "r");
+
+    strcpy(name, "unknown");
+
+    if (file != NULL)
+    {
+        if ( fgets(name, len, file) != NULL )
+        {
+            name[strcspn(name, "\n")] = '\0';
+        }
+
+        fclose(file);
+    }
+}
+
+static void report_json(FILE* file, ins_metric** metrics, int n, const char* program)
+{
+    int i, b;
+
+    fprintf(file, "{\"program\": \"%s\", \"pid\": %d, \"metrics\": {", program, (int)getpid());
+
+    for (i = 0; i < n; i++)
+    {
+        ins_metric* m = metrics[i];
+        double scale = (m->type == INS_TIMER) ? 1e-9 : 1.0;
+
+        fprintf(file, "%s\"%s\": {\"type\": \"%s\"", i > 0 ? ", " : "", m->name, type_name[m->type]);
+
+        if (m->type == INS_COUNTER)
+        {
+            fprintf(file, ", \"value\": %llu, \"updates\": %llu}",
+                    (unsigned long long)m->sum, (unsigned long long)m->count);
+            continue;
+        }
+
+        fprintf(file, ", \"count\": %llu, \"sum\": %.9g, \"max\": %.9g, \"bins\": [",
+                (unsigned long long)m->count, m->sum * scale, m->max * scale);
+
+        int first = 1;
+
+        for (b = 0; b < INS_BINS; b++)
+        {
+            if (m->bins[b] == 0)
+            {
+                continue;
+            }
+
+            fprintf(file, "%s[%.9g, %llu]", first ? "" : ", ", bin_bound(b) * scale, (unsigned long long)m->bins[b]);
+            first = 0;
+        }
+
+        fprintf(file, "]}");
+    }
+
+    fprintf(file, "}}\n");
+}
+
+static void report_prometheus(FILE* file, ins_metric** metrics, int n, const char* program)
+{
+    int i, b;
+    char name[256];
+
+    for (i = 0; i < n; i++)
+    {
+        ins_metric* m = metrics[i];
+        double scale = (m->type == INS_TIMER) ? 1e-9 : 1.0;
+        size_t j;
+
+        snprintf(name, sizeof(name), "marvel_%s%s", m->name, (m->type == INS_TIMER) ? "_seconds" : "");
+
+        for (j = 0; name[j] != '\0'; j++)
+        {
+            if ( !isalnum((unsigned char)name[j]) )
+            {
+                name[j] = '_';
+            }
+        }
+
+        if (m->type == INS_COUNTER)
+        {
+            fprintf(file, "# TYPE %s counter\n", name);
+            fprintf(file, "%s{program=\"%s\"} %llu\n", name, program, (unsigned long long)m->sum);
+            continue;
+        }
+
+        fprintf(file, "# TYPE %s histogram\n", name);
+
+        uint64_t cum = 0;
+
+        for (b = 0; b < INS_BINS - 1; b++)
+        {
+            cum += m->bins[b];
+
+            if (m->bins[b] != 0)
+            {
+                fprintf(file, "%s_bucket{program=\"%s\",le=\"%.9g\"} %llu\n",
+                        name, program, bin_bound(b) * scale, (unsigned long long)cum);
+            }
+        }
+
+        fprintf(file, "%s_bucket{program=\"%s\",le=\"+Inf\"} %llu\n", name, program, (unsigned long long)m->count);
+        fprintf(file, "%s_sum{program=\"%s\"} %.9g\n", name, program, m->sum * scale);
+        fprintf(file, "%s_count{program=\"%s\"} %llu\n", name, program, (unsigned long long)m->count);
+    }
+}
+
+void ins_report(FILE* file, int prometheus)
+{
+    char program[64];
+
+    program_name(program, sizeof(program));
+
+    pthread_mutex_lock(&Ins.lock);
+
+    int n = Ins.nmetrics;
+    ins_metric** metrics = malloc(sizeof(ins_metric*) * (n + 1));
+
+    if (n > 0)
+    {
+        memcpy(metrics, Ins.metrics, sizeof(ins_metric*) * n);
+    }
+
+    pthread_mutex_unlock(&Ins.lock);
+
+    qsort(metrics, n, sizeof(ins_metric*), cmp_metric);
+
+    if (prometheus)
+    {
+        report_prometheus(file, metrics, n, program);
+    }
+    else
+    {
+        report_json(file, metrics, n, program);
+    }
+
+    free(metrics);
+}
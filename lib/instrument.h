@@ -0,0 +1,111 @@
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+// process wide registry of named counters, timers and histograms.
+//
+// metrics are created on first use and live until the process exits. updates
+// are lock free (relaxed atomics), so they can be made from any thread. timers
+// and histograms keep the number of events, their sum and maximum and a log2
+// histogram of the values (nanoseconds for timers).
+//
+// recording is enabled by setting MARVEL_STATS to a file name (- for stderr).
+// at exit the report is appended to it as a single json line, or in the
+// prometheus text format if MARVEL_STATS_FORMAT is set to prometheus.
+// when disabled the INS_* macros cost a load and a branch.
+
+typedef enum
+{
+    INS_COUNTER,
+    INS_TIMER,
+    INS_HISTOGRAM
+} ins_type;
+
+#define INS_BINS 65             // bins[0] counts zeros, bins[i] values in [2^(i-1), 2^i)
+
+typedef struct
+{
+    char* name;
+    ins_type type;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t bins[INS_BINS];
+} ins_metric;
+
+extern int ins_state;           // -1 not yet set up, 0 disabled, 1 enabled
+
+int ins_setup();
+
+static inline int ins_enabled()
+{
+    int state = __atomic_load_n(&ins_state, __ATOMIC_RELAXED);
+
+    if (state < 0)
+    {
+        state = ins_setup();
+    }
+
+    return state;
+}
+
+// returns the metric of that name, creating it if needed
+
+ins_metric* ins_get(const char* name, ins_type type);
+
+uint64_t ins_now();
+
+void ins_add(ins_metric* m, uint64_t n);
+void ins_observe(ins_metric* m, uint64_t value);
+
+// writes all metrics in json (prometheus = 0) or prometheus text format
+
+void ins_report(FILE* file, int prometheus);
+
+// the macros cache the metric in a static per call site, hence name has to be a constant
+
+#define INS_METRIC(name, type)                                              \
+    ({                                                                      \
+        static ins_metric* _ins_m = NULL;                                   \
+        ins_metric* _ins_p = __atomic_load_n(&_ins_m, __ATOMIC_ACQUIRE);    \
+        if (_ins_p == NULL)                                                 \
+        {                                                                   \
+            _ins_p = ins_get(name, type);                                   \
+            __atomic_store_n(&_ins_m, _ins_p, __ATOMIC_RELEASE);            \
+        }                                                                   \
+        _ins_p;                                                             \
+    })
+
+#define INS_COUNT(name, n)                                                  \
+    do                                                                      \
+    {                                                                       \
+        if (ins_enabled())                                                  \
+        {                                                                   \
+            ins_add(INS_METRIC(name, INS_COUNTER), n);                      \
+        }                                                                   \
+    } while (0)
+
+#define INS_OBSERVE(name, value)                                            \
+    do                                                                      \
+    {                                                                       \
+        if (ins_enabled())                                                  \
+        {                                                                   \
+            ins_observe(INS_METRIC(name, INS_HISTOGRAM), value);            \
+        }                                                                   \
+    } while (0)
+
+// uint64_t t = INS_START(); ... INS_STOP("phase", t);
+
+#define INS_START() ( ins_enabled() ? ins_now() : 0 )
+
+#define INS_STOP(name, start)                                               \
+    do                                                                      \
+    {                                                                       \
+        if (start)                                                          \
+        {                                                                   \
+            ins_observe(INS_METRIC(name, INS_TIMER), ins_now() - (start));  \
+        }                                                                   \
+    } while (0)
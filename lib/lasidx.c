@@ -4,8 +4,10 @@
 #include <strings.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <limits.h>
 #include <sys/param.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 
@@ -30,135 +32,268 @@ static char* lasidx_filename(const char* pathLas)
     return pathIdx;
 }
 
-static time_t file_mtime(const char* path)
+static int file_stat(const char* path, int64_t* mtime, uint64_t* size)
 {
     struct stat attr;
-    stat(path, &attr);
 
-    return attr.st_mtime;
+    if ( stat(path, &attr) != 0 )
+    {
+        return 0;
+    }
+
+    *mtime = attr.st_mtime;
+    *size = attr.st_size;
+
+    return 1;
 }
 
-lasidx* lasidx_create(HITS_DB* db, const char* pathLas)
+static void lasidx_grow(lasidx* idx, uint64_t nreads)
 {
-    FILE* fileLas;
-    FILE* fileIdx;
-
-    if ( (fileLas = fopen(pathLas, "r")) == NULL )
+    if (nreads <= idx->maxreads)
     {
-        fprintf(stderr, "failed to open %s\n", pathLas);
-
-        return NULL;
+        return ;
     }
 
-    char* pathIdx = lasidx_filename(pathLas);
+    uint64_t maxreads = idx->maxreads * 1.2 + 1000;
 
-    if ( (fileIdx = fopen(pathIdx, "w")) == NULL)
+    if (maxreads < nreads)
     {
-        fprintf(stderr, "failed to open %s\n", pathIdx);
-        free(pathIdx);
+        maxreads = nreads;
+    }
 
-        return NULL;
+    idx->entries = realloc(idx->entries, sizeof(lasidx_entry) * maxreads);
+
+    if ( idx->entries == NULL )
+    {
+        fprintf(stderr, "failed to allocate index of %" PRIu64 " reads\n", maxreads);
+        exit(1);
     }
 
-    printf("indexing %s\n", pathLas);
+    bzero(idx->entries + idx->maxreads, sizeof(lasidx_entry) * (maxreads - idx->maxreads));
 
-    PassContext* pctx = pass_init(fileLas, NULL);
+    idx->maxreads = maxreads;
+}
 
-    int tbytes = TBYTES( pctx->twidth );
-    int nreads = DB_NREADS(db);
+lasidx* lasidx_new(int twidth)
+{
+    lasidx* idx = calloc(1, sizeof(lasidx));
+
+    idx->header.magic = LASIDX_MAGIC;
+    idx->header.version = LASIDX_VERSION;
+    idx->header.twidth = twidth;
+
+    return idx;
+}
+
+void lasidx_add(lasidx* idx, int aread, off_t offset, uint64_t tbytes)
+{
+    uint64_t a = aread;
+
+    lasidx_grow(idx, a + 1);
 
-    lasidx* lasIndex = malloc(sizeof(lasidx) * ( nreads + 1) );
+    lasidx_entry* entry = idx->entries + a;
 
-    if ( lasIndex == NULL )
+    if (entry->novl == 0)
     {
-        fprintf(stderr, "Cannot allocate index buffer if size: %d\n!", nreads+1);
-        exit(1);
+        entry->offset = offset;
     }
 
-    bzero(lasIndex, sizeof(lasidx) * ( nreads + 1) );
+    entry->novl += 1;
+    entry->tbytes += tbytes;
 
-    Overlap ovl;
-    int a = -1;
+    if (a >= idx->nreads)
+    {
+        idx->nreads = a + 1;
+    }
 
-    while (!Read_Overlap(fileLas, &ovl))
+    idx->header.novl += 1;
+}
+
+void lasidx_append(lasidx* idx, lasidx* part, off_t base)
+{
+    uint64_t a;
+
+    lasidx_grow(idx, part->nreads);
+
+    for (a = 0; a < part->nreads; a++)
     {
-        if (a != ovl.aread)
+        lasidx_entry* src = part->entries + a;
+        lasidx_entry* entry = idx->entries + a;
+
+        if (src->novl == 0)
         {
-            off_t cur = ftello(fileLas) - ( sizeof(Overlap) - sizeof(void*) );
+            continue;
+        }
 
-            lasIndex[ ovl.aread ] = cur;
-            a = ovl.aread;
+        if (entry->novl == 0)
+        {
+            entry->offset = src->offset + base;
         }
 
-        fseek(fileLas, tbytes * ovl.path.tlen, SEEK_CUR);
+        entry->novl += src->novl;
+        entry->tbytes += src->tbytes;
+    }
+
+    if (part->nreads > idx->nreads)
+    {
+        idx->nreads = part->nreads;
+    }
+
+    idx->header.novl += part->header.novl;
+}
+
+int lasidx_write(lasidx* idx, const char* pathLas)
+{
+    char* pathIdx = lasidx_filename(pathLas);
+
+    if (pathIdx == NULL)
+    {
+        return 0;
     }
 
-    if (a != ovl.aread)
+    FILE* fileIdx;
+
+    if ( (fileIdx = fopen(pathIdx, "w")) == NULL )
     {
-        off_t cur = ftello(fileLas) - ( sizeof(Overlap) - sizeof(void*) );
+        fprintf(stderr, "failed to open %s\n", pathIdx);
+        free(pathIdx);
 
-        lasIndex[ ovl.aread ] = cur;
+        return 0;
     }
 
-    long mtime = file_mtime(pathLas);
+    if ( !file_stat(pathLas, &(idx->header.mtime), &(idx->header.size)) )
+    {
+        fprintf(stderr, "failed to stat %s\n", pathLas);
+        fclose(fileIdx);
+        free(pathIdx);
+
+        return 0;
+    }
 
-    fwrite(&mtime, sizeof(long), 1, fileIdx);
+    idx->header.nreads = idx->nreads;
 
-    uint64 left = 0;
-    uint64 right = nreads;
+    int ok = ( fwrite(&(idx->header), sizeof(LASIDX_HEADER), 1, fileIdx) == 1 );
 
-    while ( lasIndex[left] == 0 )
+    if ( ok && idx->nreads > 0 )
     {
-        left++;
+        ok = ( fwrite(idx->entries, sizeof(lasidx_entry), idx->nreads, fileIdx) == idx->nreads );
     }
 
-    while ( lasIndex[right] == 0 )
+    if ( fclose(fileIdx) != 0 || !ok )
     {
-        right--;
+        fprintf(stderr, "failed to write %s\n", pathIdx);
+        free(pathIdx);
+
+        return 0;
     }
 
-    fwrite(&left, sizeof(uint64), 1, fileIdx);
-    fwrite(&right, sizeof(uint64), 1, fileIdx);
+    free(pathIdx);
 
-    fwrite(lasIndex + left, sizeof(lasidx), right - left + 1, fileIdx);
+    return 1;
+}
 
-    fclose(fileIdx);
-    fclose(fileLas);
+lasidx* lasidx_create(HITS_DB* db, const char* pathLas)
+{
+    FILE* fileLas;
 
+    if ( (fileLas = fopen(pathLas, "r")) == NULL )
+    {
+        fprintf(stderr, "failed to open %s\n", pathLas);
+
+        return NULL;
+    }
+
+    printf("indexing %s\n", pathLas);
+
+    PassContext* pctx = pass_init(fileLas, NULL);
+
+    int tbytes = TBYTES( pctx->twidth );
+
+    lasidx* idx = lasidx_new( pctx->twidth );
+
+    Overlap ovl;
+    off_t cur = sizeof(ovl_header_novl) + sizeof(ovl_header_twidth);
+
+    while (!Read_Overlap(fileLas, &ovl))
+    {
+        uint64_t tlen = tbytes * ovl.path.tlen;
+
+        lasidx_add(idx, ovl.aread, cur, tlen);
+
+        fseeko(fileLas, tlen, SEEK_CUR);
+        cur += OVERLAP_IO_SIZE + tlen;
+    }
+
+    // cover all reads of the database
+
+    if ( db != NULL && (uint64_t)DB_NREADS(db) > idx->nreads )
+    {
+        lasidx_grow(idx, DB_NREADS(db));
+        idx->nreads = DB_NREADS(db);
+    }
+
+    fclose(fileLas);
     pass_free(pctx);
-    free(pathIdx);
 
-    return lasIndex;
+    if ( !lasidx_write(idx, pathLas) )
+    {
+        lasidx_close(idx);
+
+        return NULL;
+    }
+
+    return idx;
 }
 
 lasidx* lasidx_load(HITS_DB* db, const char* pathLas, int create)
 {
-    FILE* fileIdx;
     char* pathIdx = lasidx_filename(pathLas);
 
-    if ( (fileIdx = fopen(pathIdx, "r")) == NULL)
+    if (pathIdx == NULL)
+    {
+        return NULL;
+    }
+
+    int fd = open(pathIdx, O_RDONLY);
+
+    free(pathIdx);
+
+    if (fd == -1)
     {
         if (create)
         {
             return lasidx_create(db, pathLas);
         }
 
-        fprintf(stderr, "failed to open %s\n", pathIdx);
-        free(pathIdx);
-
         return NULL;
     }
 
-    long mtime = 0;
-
-    if ( fread(&mtime, sizeof(long), 1, fileIdx) != 1 )
+    struct stat attr;
+    LASIDX_HEADER header;
+    int64_t mtime;
+    uint64_t size;
+
+    if ( fstat(fd, &attr) != 0 || (size_t)attr.st_size < sizeof(LASIDX_HEADER) ||
+         pread(fd, &header, sizeof(LASIDX_HEADER), 0) != sizeof(LASIDX_HEADER) ||
+         header.magic != LASIDX_MAGIC || header.version != LASIDX_VERSION ||
+         (size_t)attr.st_size != sizeof(LASIDX_HEADER) + sizeof(lasidx_entry) * header.nreads )
     {
-        fprintf(stderr, "failed to read index header\n");
+        close(fd);
+
+        printf("outdated or malformed index for %s\n", pathLas);
+
+        if (create)
+        {
+            return lasidx_create(db, pathLas);
+        }
+
         return NULL;
     }
 
-    if ( mtime != file_mtime(pathLas) )
+    if ( !file_stat(pathLas, &mtime, &size) || mtime != header.mtime || size != header.size )
     {
+        close(fd);
+
         printf("las file has been modified after index creation\n");
 
         if (create)
@@ -169,48 +304,87 @@ lasidx* lasidx_load(HITS_DB* db, const char* pathLas, int create)
         return NULL;
     }
 
-    uint64 left, right;
+    void* map = mmap(NULL, attr.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
 
-    if( fread(&left, sizeof(uint64), 1, fileIdx) != 1 )
+    if (map == MAP_FAILED)
     {
-        fprintf(stderr, "ERROR: failed to read left offset\n");
-        exit(1);
+        fprintf(stderr, "failed to map index of %s\n", pathLas);
+
+        return NULL;
     }
 
-    if ( fread(&right, sizeof(uint64), 1, fileIdx) != 1 )
+    lasidx* idx = calloc(1, sizeof(lasidx));
+
+    idx->header = header;
+    idx->map = map;
+    idx->mapsize = attr.st_size;
+    idx->entries = (lasidx_entry*)( (char*)map + sizeof(LASIDX_HEADER) );
+    idx->nreads = header.nreads;
+
+    return idx;
+}
+
+void lasidx_close(lasidx* idx)
+{
+    if (idx == NULL)
     {
-        fprintf(stderr, "ERROR: failed to read right offset\n");
-        exit(1);
+        return ;
     }
 
-    int nreads = DB_NREADS(db);
-    lasidx* lasIndex = malloc(sizeof(lasidx) * ( nreads + 1) );
-    bzero(lasIndex, sizeof(lasidx) * (nreads + 1));
-
-    if ( fread(lasIndex + left, sizeof(lasidx), right - left + 1, fileIdx) != (size_t)( right - left + 1 ) )
+    if (idx->map)
     {
-        fprintf(stderr, "index file too short\n");
-        return NULL;
+        munmap(idx->map, idx->mapsize);
+    }
+    else
+    {
+        free(idx->entries);
     }
 
-    off_t end = ftello(fileIdx);
-    fseeko(fileIdx, 0, SEEK_END);
+    free(idx);
+}
 
-    if (end != ftello(fileIdx))
+off_t lasidx_offset(lasidx* idx, int aread)
+{
+    if ( aread < 0 || (uint64_t)aread >= idx->nreads )
     {
-        fprintf(stderr, "index file too long\n");
-        return NULL;
+        return 0;
     }
 
-    fclose(fileIdx);
+    return idx->entries[aread].offset;
+}
 
-    free(pathIdx);
+uint64_t lasidx_novl(lasidx* idx, int aread)
+{
+    if ( aread < 0 || (uint64_t)aread >= idx->nreads )
+    {
+        return 0;
+    }
 
-    return lasIndex;
+    return idx->entries[aread].novl;
 }
 
-void lasidx_close(lasidx* idx)
+uint64_t lasidx_bytes(lasidx* idx, int aread)
 {
-    free(idx);
+    if ( aread < 0 || (uint64_t)aread >= idx->nreads )
+    {
+        return 0;
+    }
+
+    lasidx_entry* entry = idx->entries + aread;
+
+    return entry->novl * OVERLAP_IO_SIZE + entry->tbytes;
 }
 
+uint64_t lasidx_cost(lasidx* idx, int aread)
+{
+    if ( aread < 0 || (uint64_t)aread >= idx->nreads )
+    {
+        return 0;
+    }
+
+    lasidx_entry* entry = idx->entries + aread;
+
+    return entry->novl + entry->tbytes / TBYTES( idx->header.twidth );
+}
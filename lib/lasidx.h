@@ -2,11 +2,91 @@
 #pragma once
 
 #include <stdio.h>
+#include <sys/types.h>
+#include <inttypes.h>
+
 #include <db/DB.h>
 
-typedef off_t lasidx;
+/*
+ * index of an overlap file, stored next to it as <name>.idx
+ *
+ * [LASIDX_HEADER] [lasidx_entry read 0] [lasidx_entry read 1] ... [lasidx_entry read nreads - 1]
+ *
+ * one entry per A-read holds the file offset of its first overlap, the number
+ * of overlaps and the number of trace bytes of the pile. the .las file's size
+ * and mtime are recorded in the header, a mismatch invalidates the index.
+ * loaded indices are memory mapped.
+ */
+
+#define LASIDX_MAGIC 0x5844494c
+
+#define LASIDX_VERSION 2
+
+typedef struct
+{
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    twidth;
+
+    int64_t     mtime;          // of the .las file
+    uint64_t    size;           // of the .las file
+
+    uint64_t    nreads;         // number of entries
+    uint64_t    novl;
+
+    uint64_t    reserved1;
+    uint64_t    reserved2;
+} LASIDX_HEADER;
+
+typedef struct
+{
+    uint64_t    offset;         // first overlap of the A-read, 0 if it has none
+    uint64_t    novl;
+    uint64_t    tbytes;         // trace bytes of all its overlaps
+} lasidx_entry;
+
+typedef struct
+{
+    LASIDX_HEADER header;
+
+    lasidx_entry* entries;      // indexed by A-read
+    uint64_t nreads;
+
+    uint64_t maxreads;          // allocated entries, only when built in memory
+
+    void* map;                  // mapped index file
+    size_t mapsize;
+} lasidx;
+
+// scan pathLas and write its index
 
 lasidx* lasidx_create(HITS_DB* db, const char* pathLas);
+
+// map the index of pathLas. if it is missing or stale it is created when create is set,
+// otherwise NULL is returned.
+
 lasidx* lasidx_load(HITS_DB* db, const char* pathLas, int create);
 
 void lasidx_close(lasidx* idx);
+
+// build an index while writing an overlap file. overlaps have to be added in file order,
+// offset being the position of the overlap record in the file.
+
+lasidx* lasidx_new(int twidth);
+void lasidx_add(lasidx* idx, int aread, off_t offset, uint64_t tbytes);
+int lasidx_write(lasidx* idx, const char* pathLas);
+
+// add the entries of part, whose offsets are relative to base
+
+void lasidx_append(lasidx* idx, lasidx* part, off_t base);
+
+// lookups, aread outside of the index behaves like a read without overlaps
+
+off_t lasidx_offset(lasidx* idx, int aread);
+uint64_t lasidx_novl(lasidx* idx, int aread);
+uint64_t lasidx_bytes(lasidx* idx, int aread);        // size of the pile in the file
+
+// estimated work of handling the pile, its overlaps weighted by their trace points
+
+uint64_t lasidx_cost(lasidx* idx, int aread);
+
@@ -0,0 +1,174 @@
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "lastream.h"
+#include "lastream_proto.h"
+
+#define STREAM_BUFFER ( 1024 * 1024 )
+
+static int socket_receive( int sock, uint64 data, void* buffer )
+{
+    uint64 pending = data;
+    uint64 bcur    = 0;
+
+    while ( pending )
+    {
+        int received = recv( sock, buffer + bcur, pending, 0 );
+
+        if ( received < 1 )
+        {
+            break;
+        }
+
+        bcur += received;
+        pending -= received;
+    }
+
+    return ( pending == 0 );
+}
+
+static FILE* ls_open( void* arg, int ablock, int bblock, int tspace, int tbytes )
+{
+    LaStream* ls = (LaStream*)arg;
+    int sockfd;
+
+    if ( ( sockfd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        fprintf( stderr, "error creating socket\n" );
+        return NULL;
+    }
+
+    int retry     = 3;
+    int connected = 0;
+
+    while ( retry > 0 && connected != 1 )
+    {
+        if ( connect( sockfd, (struct sockaddr*)&( ls->dest ), sizeof( ls->dest ) ) != 0 )
+        {
+            fprintf( stderr, "could not connect to %s:%d - %s\n", ls->host, ls->port, strerror( errno ) );
+            retry--;
+            sleep( 2 );
+        }
+        else
+        {
+            connected = 1;
+        }
+    }
+
+    if ( connected == 0 )
+    {
+        close( sockfd );
+        return NULL;
+    }
+
+    LsHeader header;
+    bzero( &header, sizeof( header ) );
+
+    header.version   = LS_VERSION;
+    header.type      = LS_TYPE_RUN;
+    header.reserved1 = ablock;
+    header.reserved2 = bblock;
+    header.reserved3 = tspace;
+    header.reserved4 = tbytes;
+
+    FILE* out;
+
+    if ( send( sockfd, &header, sizeof( header ), 0 ) != sizeof( header ) ||
+         ( out = fdopen( sockfd, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "failed to start the run of blocks %d and %d\n", ablock, bblock );
+        close( sockfd );
+        return NULL;
+    }
+
+    setvbuf( out, NULL, _IOFBF, STREAM_BUFFER );
+
+    return out;
+}
+
+static int ls_close( void* arg, FILE* out, int64 novl )
+{
+    LaStream* ls = (LaStream*)arg;
+    int sockfd   = fileno( out );
+    Overlap end;
+
+    // end marker and the number of overlaps
+
+    bzero( &end, sizeof( end ) );
+    end.path.tlen = -1;
+
+    Write_Overlap( out, &end, 0 );
+    fwrite( &novl, sizeof( int64 ), 1, out );
+
+    LsHeader ack;
+    int ok = ( fflush( out ) == 0 && shutdown( sockfd, SHUT_WR ) == 0 &&
+               socket_receive( sockfd, sizeof( ack ), &ack ) && ack.type == LS_TYPE_ACK );
+
+    fclose( out );
+
+    if ( !ok )
+    {
+        fprintf( stderr, "no acknowledgement from %s:%d\n", ls->host, ls->port );
+        return 1;
+    }
+
+    if ( ack.reserved2 == LS_STATUS_FAILED || (int64)ack.reserved1 != novl )
+    {
+        fprintf( stderr, "%s:%d rejected the run of %lld overlaps\n", ls->host, ls->port, novl );
+        return 1;
+    }
+
+    return 0;
+}
+
+LaStream* ls_init( const char* server, uint16 port )
+{
+    LaStream* ls = calloc( 1, sizeof( LaStream ) );
+    char* colon;
+
+    ls->host = strdup( server );
+    ls->port = port;
+
+    if ( ( colon = strchr( ls->host, ':' ) ) != NULL )
+    {
+        *colon   = '\0';
+        ls->port = atoi( colon + 1 );
+    }
+
+    struct hostent* he;
+
+    if ( ( he = gethostbyname( ls->host ) ) == NULL || he->h_addr_list[ 0 ] == NULL )
+    {
+        herror( "gethostbyname" );
+        ls_free( ls );
+        return NULL;
+    }
+
+    ls->dest.sin_family = AF_INET;
+    ls->dest.sin_port   = htons( ls->port );
+    memcpy( &( ls->dest.sin_addr ), he->h_addr_list[ 0 ], sizeof( struct in_addr ) );
+
+    ls->stream.open  = ls_open;
+    ls->stream.close = ls_close;
+    ls->stream.arg   = ls;
+
+    // a server going away shows up as a failed write, not as a signal
+
+    signal( SIGPIPE, SIG_IGN );
+
+    return ls;
+}
+
+void ls_free( LaStream* ls )
+{
+    free( ls->host );
+    free( ls );
+}
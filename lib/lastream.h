@@ -0,0 +1,25 @@
+
+#pragma once
+
+#include <netinet/in.h>
+
+#include "dalign/align.h"
+#include "db/DB.h"
+
+#define LASTREAM_DEFAULT_PORT 12346
+
+// streams the overlaps written by daligner to LAserver instead of .las files
+
+typedef struct
+{
+    char* host;
+    uint16 port;
+    struct sockaddr_in dest;
+
+    Overlap_Stream stream; // passed to Set_Overlap_Stream
+} LaStream;
+
+// resolves host[:port] of the LAserver, connections are made per block pair
+
+LaStream* ls_init(const char* server, uint16 port);
+void ls_free(LaStream* ls);
@@ -0,0 +1,33 @@
+
+#pragma once
+
+#include "../db/DB.h"
+
+typedef struct
+{
+    unsigned char version;    // protocol version
+    unsigned char type;       // message type LS_TYPE_xxx
+
+    uint64 reserved1;
+    uint64 reserved2;
+    uint64 reserved3;
+    uint64 reserved4;
+} LsHeader;
+
+#define LS_VERSION               0x1
+
+#define LS_TYPE_RUN              0x1    // c -> s ... sorted overlaps of a block pair. reserved1 = A block, reserved2 = B block,
+                                        //            reserved3 = trace spacing, reserved4 = trace bytes
+#define LS_TYPE_ACK              0x2    // c <- s ... reserved1 = overlaps received, reserved2 = LS_STATUS_xxx
+
+#define LS_STATUS_STORED         0x0    // run was added to the A block
+#define LS_STATUS_DUPLICATE      0x1    // the A block already had a run for the B block, it was dropped
+#define LS_STATUS_FAILED         0x2    // run was rejected
+
+/*
+    each block pair (A and B block of the A reads) is sent over its own connection.
+    the LS_TYPE_RUN header is followed by the overlap records as written to a .las
+    file (without the .las header) in sort order, and an end marker, an overlap
+    record with tlen -1, followed by the int64 number of records sent.
+    the server answers with LS_TYPE_ACK once the run is on disk.
+*/
@@ -1,42 +1,455 @@
 
-#include "laz.h"
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <zlib.h>
 
-LAZ* laz_open(char* fpath, int create)
+#include "laz.h"
+#include "compression.h"
+
+#define LAZ_OVL_SIZE (sizeof(Overlap) - sizeof(void*))
+
+// traces with at least that many values have their inner points bit packed
+
+#define LAZ_PACK_MIN_TLEN 6
+
+// blocks in flight per compression thread
+
+#define LAZ_PIPE_DEPTH 2
+
+#define LAZ_BLOCK_FREE      0
+#define LAZ_BLOCK_QUEUED    1
+#define LAZ_BLOCK_DONE      2
+
+// a block cut by laz_write, holding the piles of a_from..a_to
+
+typedef struct
 {
-    FILE* fin = NULL;
-    LAZ* laz = NULL;
+    char* buf;
+    uint64_t bmax;
+    uint64_t blen;
 
-    if (create)
+    uint64_t a_from;
+    uint64_t a_to;
+    uint64_t novl;
+
+    uint8_t* pbuf;              // packed encoding
+    uint64_t pmax;
+    uint64_t plen;
+
+    void* cbuf;                 // compressed data
+    uint64_t clen;
+
+    int state;                  // LAZ_BLOCK_*
+} laz_block;
+
+// ring of blocks, handed to the threads in order of their sequence numbers
+// queued > taken >= written
+
+typedef struct
+{
+    LAZ* laz;
+
+    pthread_t* threads;
+    int nthreads;
+
+    laz_block* blocks;
+    int nblocks;
+
+    uint64_t queued;            // blocks handed to the pipe
+    uint64_t taken;             // blocks picked up by a thread
+    uint64_t written;           // blocks written to the file
+
+    int stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a block was queued
+    pthread_cond_t done;        // a block was compressed
+} laz_pipe;
+
+static inline size_t laz_tbytes(LAZ* laz)
+{
+    return laz->twidth <= TRACE_XOVR ? sizeof(uint8) : sizeof(uint16);
+}
+
+static inline uint8_t* put_varint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80)
     {
-        laz->file = fopen(fpath, "wb");
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+
+    *p++ = v;
+
+    return p;
+}
+
+static inline uint8_t* get_varint(uint8_t* p, uint8_t* end, uint64_t* v)
+{
+    uint64_t x = 0;
+    int shift = 0;
+
+    while (p < end && shift < 64)
+    {
+        uint8_t b = *p++;
+
+        x |= (uint64_t)(b & 0x7f) << shift;
+
+        if ( !(b & 0x80) )
+        {
+            *v = x;
+            return p;
+        }
+
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ( (uint64_t)v << 1 ) ^ (uint64_t)( v >> 63 );
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)( v >> 1 ) ^ -(int64_t)( v & 1 );
+}
+
+static inline int bit_width(uint64_t v)
+{
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+static inline uint64_t trace_value(void* trace, size_t tbytes, int i)
+{
+    return tbytes == sizeof(uint8) ? ((uint8*)trace)[i] : ((uint16*)trace)[i];
+}
+
+// the first and last trace point pairs are varints, since they usually cover
+// partial segments. of the inner ones the diffs and the b lengths relative
+// to twidth are bit packed at the width of their respective maximum.
+
+static uint8_t* pack_trace(uint8_t* p, void* trace, int tlen, size_t tbytes, int twidth)
+{
+    int i;
+
+    if (tlen < LAZ_PACK_MIN_TLEN || (tlen & 1))
+    {
+        for (i = 0; i < tlen; i++)
+        {
+            p = put_varint(p, trace_value(trace, tbytes, i));
+        }
+
+        return p;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        p = put_varint(p, trace_value(trace, tbytes, i));
+        p = put_varint(p, trace_value(trace, tbytes, tlen - 2 + i));
+    }
+
+    uint64_t dmax = 0;
+    uint64_t bmax = 0;
+
+    for (i = 2; i < tlen - 2; i += 2)
+    {
+        dmax |= trace_value(trace, tbytes, i);
+        bmax |= zigzag( (int64_t)trace_value(trace, tbytes, i + 1) - twidth );
+    }
+
+    int wd = bit_width(dmax);
+    int wb = bit_width(bmax);
+
+    *p++ = wd;
+    *p++ = wb;
+
+    uint64_t acc = 0;
+    int nacc = 0;
+
+    for (i = 2; i < tlen - 2; i += 2)
+    {
+        acc |= trace_value(trace, tbytes, i) << nacc;
+        nacc += wd;
+
+        while (nacc >= 8)
+        {
+            *p++ = acc;
+            acc >>= 8;
+            nacc -= 8;
+        }
+
+        acc |= zigzag( (int64_t)trace_value(trace, tbytes, i + 1) - twidth ) << nacc;
+        nacc += wb;
+
+        while (nacc >= 8)
+        {
+            *p++ = acc;
+            acc >>= 8;
+            nacc -= 8;
+        }
+    }
+
+    if (nacc > 0)
+    {
+        *p++ = acc;
+    }
+
+    return p;
+}
+
+static inline void set_trace_value(void* trace, size_t tbytes, int i, uint64_t v)
+{
+    if (tbytes == sizeof(uint8))
+    {
+        ((uint8*)trace)[i] = v;
     }
     else
     {
-        laz->file = fopen(fpath, "rb");
+        ((uint16*)trace)[i] = v;
     }
+}
 
-    if (laz->file == NULL)
+static uint8_t* unpack_trace(uint8_t* p, uint8_t* end, void* trace, int tlen, size_t tbytes, int twidth)
+{
+    uint64_t v = 0;
+    int i;
+
+    if (tlen < LAZ_PACK_MIN_TLEN || (tlen & 1))
+    {
+        for (i = 0; i < tlen && p != NULL; i++)
+        {
+            p = get_varint(p, end, &v);
+            set_trace_value(trace, tbytes, i, v);
+        }
+
+        return p;
+    }
+
+    for (i = 0; i < 2 && p != NULL; i++)
+    {
+        p = get_varint(p, end, &v);
+        set_trace_value(trace, tbytes, i, v);
+
+        if (p != NULL)
+        {
+            p = get_varint(p, end, &v);
+            set_trace_value(trace, tbytes, tlen - 2 + i, v);
+        }
+    }
+
+    if (p == NULL || p + 2 > end)
     {
         return NULL;
     }
 
-    laz = calloc( 1, sizeof(LAZ) );
-    laz->file = fin;
+    int wd = *p++;
+    int wb = *p++;
 
-    return laz;
+    uint64_t nbytes = ( (uint64_t)(wd + wb) * (tlen / 2 - 2) + 7 ) / 8;
+
+    if (wd > 32 || wb > 33 || p + nbytes > end)
+    {
+        return NULL;
+    }
+
+    uint64_t acc = 0;
+    int nacc = 0;
+
+    for (i = 2; i < tlen - 2; i += 2)
+    {
+        while (nacc < wd)
+        {
+            acc |= (uint64_t)(*p++) << nacc;
+            nacc += 8;
+        }
+
+        set_trace_value(trace, tbytes, i, acc & ( (1llu << wd) - 1 ));
+        acc >>= wd;
+        nacc -= wd;
+
+        while (nacc < wb)
+        {
+            acc |= (uint64_t)(*p++) << nacc;
+            nacc += 8;
+        }
+
+        set_trace_value(trace, tbytes, i + 1, twidth + unzigzag( acc & ( (1llu << wb) - 1 ) ));
+        acc >>= wb;
+        nacc -= wb;
+    }
+
+    return p;
 }
 
-int laz_read_header(LAZ* laz)
+// encodes the .las records of the block into its pbuf, returns the packed size
+
+static uint64_t laz_pack(LAZ* laz, laz_block* block)
+{
+    size_t tbytes = laz_tbytes(laz);
+
+    // varints of 32 bit fields take at most 5 bytes, trace values at most 3
+
+    uint64_t bound = 3 * block->blen + 64;
+
+    if (bound > block->pmax)
+    {
+        block->pmax = bound;
+        block->pbuf = realloc(block->pbuf, block->pmax);
+    }
+
+    uint8_t* p = block->pbuf;
+    uint64_t cur = 0;
+    int64_t aprev = block->a_from;
+
+    while (cur < block->blen)
+    {
+        Overlap ovl;
+        memcpy( ((char*)&ovl) + sizeof(void*), block->buf + cur, LAZ_OVL_SIZE );
+
+        // size of the pile
+
+        uint64_t end = cur;
+        uint64_t n = 0;
+
+        while (end < block->blen)
+        {
+            Overlap next;
+            memcpy( ((char*)&next) + sizeof(void*), block->buf + end, LAZ_OVL_SIZE );
+
+            if (next.aread != ovl.aread)
+            {
+                break;
+            }
+
+            end += LAZ_OVL_SIZE + tbytes * next.path.tlen;
+            n += 1;
+        }
+
+        p = put_varint(p, zigzag(ovl.aread - aprev));
+        p = put_varint(p, n);
+
+        aprev = ovl.aread;
+
+        int64_t bprev = 0;
+
+        while (cur < end)
+        {
+            memcpy( ((char*)&ovl) + sizeof(void*), block->buf + cur, LAZ_OVL_SIZE );
+            cur += LAZ_OVL_SIZE;
+
+            Path* path = &(ovl.path);
+
+            p = put_varint(p, zigzag((int64_t)ovl.bread - bprev));
+            p = put_varint(p, ovl.flags);
+            p = put_varint(p, (uint32_t)path->abpos);
+            p = put_varint(p, zigzag((int64_t)path->aepos - path->abpos));
+            p = put_varint(p, (uint32_t)path->bbpos);
+            p = put_varint(p, zigzag((int64_t)path->bepos - path->bbpos));
+            p = put_varint(p, (uint32_t)path->diffs);
+            p = put_varint(p, (uint32_t)path->tlen);
+
+            p = pack_trace(p, block->buf + cur, path->tlen, tbytes, laz->twidth);
+            cur += tbytes * path->tlen;
+
+            bprev = ovl.bread;
+        }
+    }
+
+    return p - block->pbuf;
+}
+
+// decodes plen bytes of packed data from pbuf into the .las records of the block
+
+static int laz_unpack(LAZ* laz, LAZ_INDEX* lidx, uint64_t plen)
+{
+    size_t tbytes = laz_tbytes(laz);
+
+    uint8_t* p = laz->pbuf;
+    uint8_t* pend = p + plen;
+    uint64_t cur = 0;
+    int64_t aprev = lidx->a_from;
+
+    while (p != NULL && p < pend)
+    {
+        uint64_t v, n;
+
+        p = get_varint(p, pend, &v);
+
+        if (p == NULL || (p = get_varint(p, pend, &n)) == NULL)
+        {
+            break;
+        }
+
+        aprev += unzigzag(v);
+
+        int64_t bprev = 0;
+
+        while (n > 0 && p != NULL)
+        {
+            Overlap ovl;
+            Path* path = &(ovl.path);
+            uint64_t f[8];
+            int i;
+
+            bzero(&ovl, sizeof(Overlap));
+
+            for (i = 0; i < 8 && p != NULL; i++)
+            {
+                p = get_varint(p, pend, f + i);
+            }
+
+            if (p == NULL)
+            {
+                break;
+            }
+
+            ovl.aread = aprev;
+            ovl.bread = bprev + unzigzag(f[0]);
+            ovl.flags = f[1];
+            path->abpos = f[2];
+            path->aepos = path->abpos + unzigzag(f[3]);
+            path->bbpos = f[4];
+            path->bepos = path->bbpos + unzigzag(f[5]);
+            path->diffs = f[6];
+            path->tlen = f[7];
+
+            bprev = ovl.bread;
+
+            uint64_t len = LAZ_OVL_SIZE + tbytes * path->tlen;
+
+            if (cur + len > lidx->size)
+            {
+                return 0;
+            }
+
+            memcpy(laz->buf + cur, ((char*)&ovl) + sizeof(void*), LAZ_OVL_SIZE);
+            cur += LAZ_OVL_SIZE;
+
+            p = unpack_trace(p, pend, laz->buf + cur, path->tlen, tbytes, laz->twidth);
+            cur += tbytes * path->tlen;
+
+            n -= 1;
+        }
+    }
+
+    return ( p == pend && cur == lidx->size );
+}
+
+static int laz_read_header(LAZ* laz)
 {
     LAZ_HEADER header;
 
-    if ( fread(&header, sizeof(LAZ_HEADER), 1, laz->file) != 1 )
+    if ( pread(laz->fd, &header, sizeof(LAZ_HEADER), 0) != sizeof(LAZ_HEADER) )
     {
         return 0;
     }
 
-    if (header.magic != LAZ_MAGIC)
+    if (header.magic != LAZ_MAGIC || header.version > LAZ_VERSION || header.index == 0)
     {
         return 0;
     }
@@ -44,83 +457,596 @@ int laz_read_header(LAZ* laz)
     laz->version = header.version;
     laz->novl = header.novl;
     laz->twidth = header.twidth;
+    laz->encoding = (header.version >= 3) ? (int)header.encoding : LAZ_ENCODING_RECORDS;
+
+    if (laz->encoding != LAZ_ENCODING_RECORDS && laz->encoding != LAZ_ENCODING_PACKED)
+    {
+        return 0;
+    }
+
+    laz->dir = header.index;
+    laz->nblocks = laz->maxblocks = header.nblocks;
+    laz->index = malloc( sizeof(LAZ_INDEX) * (laz->nblocks + 1) );
+
+    size_t len = sizeof(LAZ_INDEX) * laz->nblocks;
+
+    if ( pread(laz->fd, laz->index, len, laz->dir) != (ssize_t)len )
+    {
+        return 0;
+    }
+
+    laz->boff = 0;
+    laz->bnext = laz_data_start();
 
     return 1;
 }
 
-int laz_read_index(LAZ* laz, LAZ_INDEX* lidx)
+static void laz_free(LAZ* laz)
+{
+    free(laz->index);
+    free(laz->buf);
+    free(laz->cbuf);
+    free(laz->pbuf);
+    free(laz);
+}
+
+uint64_t laz_data_start()
+{
+    return sizeof(LAZ_HEADER);
+}
+
+int laz_detect(FILE* file)
 {
-    if ( fread(lidx, sizeof(LAZ_INDEX), 1, laz->file) != 1 )
+    uint32_t magic;
+
+    if ( pread(fileno(file), &magic, sizeof(uint32_t), 0) != sizeof(uint32_t) )
     {
         return 0;
     }
 
-    return 1;
+    return (magic == LAZ_MAGIC);
 }
 
-int laz_close(LAZ* laz)
+LAZ* laz_open(char* fpath, int create)
 {
-    if (laz->file)
+    LAZ* laz = calloc( 1, sizeof(LAZ) );
+
+    if (create)
     {
-        fclose(laz->file);
+        laz->file = fopen(fpath, "wb");
+    }
+    else
+    {
+        laz->file = fopen(fpath, "rb");
     }
 
-    if (laz)
+    if (laz->file == NULL)
     {
         free(laz);
+        return NULL;
     }
 
-    return 1;
+    laz->fd = fileno(laz->file);
+    laz->create = create;
+
+    if (create)
+    {
+        LAZ_HEADER header;
+        bzero(&header, sizeof(LAZ_HEADER));
+
+        laz->version = LAZ_VERSION;
+
+        fwrite(&header, sizeof(LAZ_HEADER), 1, laz->file);
+    }
+    else if ( !laz_read_header(laz) )
+    {
+        fclose(laz->file);
+        laz_free(laz);
+
+        return NULL;
+    }
+
+    return laz;
 }
 
-Overlap* laz_read(LAZ* laz)
+LAZ* laz_fdopen(int fd)
 {
-    Overlap* ovl = NULL;
+    LAZ* laz = calloc( 1, sizeof(LAZ) );
 
-    if ( laz->ocur < laz->on )
+    laz->fd = fd;
+
+    if ( !laz_read_header(laz) )
+    {
+        laz_free(laz);
+
+        return NULL;
+    }
+
+    return laz;
+}
+
+// packs and compresses a block into its cbuf
+
+static void laz_compress(LAZ* laz, laz_block* block)
+{
+    block->plen = 0;
+
+    if (laz->encoding == LAZ_ENCODING_PACKED)
     {
-        ovl = laz->ovl + laz->ocur;
-        laz->ocur += 1;
+        block->plen = laz_pack(laz, block);
+
+        compress_chunks(block->pbuf, block->plen, &(block->cbuf), &(block->clen));
     }
     else
     {
-        LAZ_INDEX lidx;
+        compress_chunks(block->buf, block->blen, &(block->cbuf), &(block->clen));
+    }
+}
+
+// appends a compressed block and its index to the file
 
-        if ( laz_read_index(laz, &lidx) )
+static void laz_block_write(LAZ* laz, laz_block* block)
+{
+    if (laz->nblocks == laz->maxblocks)
+    {
+        laz->maxblocks = laz->maxblocks * 1.2 + 100;
+        laz->index = realloc(laz->index, sizeof(LAZ_INDEX) * laz->maxblocks);
+    }
+
+    LAZ_INDEX* lidx = laz->index + laz->nblocks;
+    bzero(lidx, sizeof(LAZ_INDEX));
+
+    lidx->a_from = block->a_from;
+    lidx->a_to = block->a_to;
+    lidx->novl = block->novl;
+    lidx->data = ftello(laz->file) + sizeof(LAZ_INDEX);
+    lidx->next = lidx->data + block->clen;
+    lidx->size = block->blen;
+    lidx->psize = block->plen;
+
+    fwrite(lidx, sizeof(LAZ_INDEX), 1, laz->file);
+    fwrite(block->cbuf, block->clen, 1, laz->file);
+
+    free(block->cbuf);
+    block->cbuf = NULL;
+
+    laz->nblocks += 1;
+}
+
+static void* laz_pipe_thread(void* arg)
+{
+    laz_pipe* pipe = arg;
+
+    pthread_mutex_lock(&pipe->lock);
+
+    while (1)
+    {
+        while (!pipe->stop && pipe->taken == pipe->queued)
         {
-            if ( laz->omax < lidx.novl )
-            {
-                laz->omax = lidx.novl;
-                laz->ovl = realloc( laz->ovl, sizeof(Overlap) * laz->omax );
+            pthread_cond_wait(&pipe->work, &pipe->lock);
+        }
 
-            }
+        if (pipe->taken == pipe->queued)
+        {
+            break;
+        }
 
-            laz->on = lidx.novl;
-            laz->ocur = 0;
+        laz_block* block = pipe->blocks + pipe->taken % pipe->nblocks;
+        pipe->taken += 1;
 
-            off_t cur = ftell(laz->file);
-            uint64_t olen = lidx.data - cur;
-            uint64_t dlen = lidx.next - lidx.data;
+        pthread_mutex_unlock(&pipe->lock);
+
+        laz_compress(pipe->laz, block);
+
+        pthread_mutex_lock(&pipe->lock);
+
+        block->state = LAZ_BLOCK_DONE;
+        pthread_cond_broadcast(&pipe->done);
+    }
+
+    pthread_mutex_unlock(&pipe->lock);
+
+    return NULL;
+}
+
+// writes the compressed blocks at the head of the ring. with wait set it blocks
+// until the oldest one is done. called with the lock held.
+
+static void laz_pipe_write(laz_pipe* pipe, int wait)
+{
+    while (pipe->written < pipe->queued)
+    {
+        laz_block* block = pipe->blocks + pipe->written % pipe->nblocks;
 
-            if ( olen > laz->bmax )
+        if (block->state != LAZ_BLOCK_DONE)
+        {
+            if (!wait)
             {
-                laz->bmax = olen;
-                laz->buf = realloc( laz->buf, laz->bmax );
+                break;
             }
 
-            uLongf destlen;
+            pthread_cond_wait(&pipe->done, &pipe->lock);
+            continue;
+        }
+
+        // only the writing thread touches blocks that are done
+
+        pthread_mutex_unlock(&pipe->lock);
+        laz_block_write(pipe->laz, block);
+        pthread_mutex_lock(&pipe->lock);
+
+        block->state = LAZ_BLOCK_FREE;
+        pipe->written += 1;
+
+        wait = 0;
+    }
+}
 
-            fread( laz->buf, olen, 1, laz->file );
-            uncompress(laz->ovl, &destlen, laz->buf, olen);
-            fseek( laz->file, dlen, SEEK_CUR );
+int laz_set_threads(LAZ* laz, int nthreads)
+{
+    if ( !laz->create || laz->pipe != NULL || laz->novl > 0 )
+    {
+        return 0;
+    }
+
+    if (nthreads < 2)
+    {
+        return 1;
+    }
+
+    laz_pipe* pipe = calloc( 1, sizeof(laz_pipe) );
+
+    pipe->laz = laz;
+    pipe->nblocks = LAZ_PIPE_DEPTH * nthreads;
+    pipe->blocks = calloc( pipe->nblocks, sizeof(laz_block) );
+    pipe->threads = malloc( sizeof(pthread_t) * nthreads );
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->work, NULL);
+    pthread_cond_init(&pipe->done, NULL);
+
+    int i;
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        if ( pthread_create(pipe->threads + pipe->nthreads, NULL, laz_pipe_thread, pipe) == 0 )
+        {
+            pipe->nthreads += 1;
         }
     }
 
+    laz->pipe = pipe;
+
+    if (pipe->nthreads == 0)
+    {
+        fprintf(stderr, "failed to start the LAZ compression threads\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+// finishes all blocks in flight and stops the threads
+
+static void laz_pipe_close(LAZ* laz)
+{
+    laz_pipe* pipe = laz->pipe;
+
+    pthread_mutex_lock(&pipe->lock);
+
+    while (pipe->written < pipe->queued)
+    {
+        laz_pipe_write(pipe, 1);
+    }
+
+    pipe->stop = 1;
+    pthread_cond_broadcast(&pipe->work);
+
+    pthread_mutex_unlock(&pipe->lock);
+
+    int i;
+    for ( i = 0 ; i < pipe->nthreads ; i++ )
+    {
+        pthread_join(pipe->threads[i], NULL);
+    }
+
+    for ( i = 0 ; i < pipe->nblocks ; i++ )
+    {
+        free(pipe->blocks[i].buf);
+        free(pipe->blocks[i].pbuf);
+    }
+
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->work);
+    pthread_cond_destroy(&pipe->done);
+
+    free(pipe->blocks);
+    free(pipe->threads);
+    free(pipe);
+
+    laz->pipe = NULL;
+}
+
+static void laz_flush(LAZ* laz)
+{
+    if (laz->wnovl == 0)
+    {
+        return ;
+    }
+
+    laz_pipe* pipe = laz->pipe;
+
+    if (pipe != NULL && pipe->nthreads > 0)
+    {
+        // the block's buffer is swapped with the one of a free slot in the ring
+
+        pthread_mutex_lock(&pipe->lock);
+
+        laz_pipe_write(pipe, pipe->queued - pipe->written == (uint64_t)pipe->nblocks);
+
+        laz_block* block = pipe->blocks + pipe->queued % pipe->nblocks;
+
+        char* buf = block->buf;
+        uint64_t bmax = block->bmax;
+
+        block->buf = laz->buf;
+        block->bmax = laz->bmax;
+        block->blen = laz->blen;
+        block->a_from = laz->a_from;
+        block->a_to = laz->a_to;
+        block->novl = laz->wnovl;
+        block->state = LAZ_BLOCK_QUEUED;
+
+        laz->buf = buf;
+        laz->bmax = bmax;
+
+        pipe->queued += 1;
+        pthread_cond_signal(&pipe->work);
+
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    else
+    {
+        laz_block block;
+        bzero(&block, sizeof(laz_block));
+
+        block.buf = laz->buf;
+        block.blen = laz->blen;
+        block.a_from = laz->a_from;
+        block.a_to = laz->a_to;
+        block.novl = laz->wnovl;
+        block.pbuf = laz->pbuf;
+        block.pmax = laz->pmax;
+
+        laz_compress(laz, &block);
+
+        laz->pbuf = block.pbuf;
+        laz->pmax = block.pmax;
+
+        laz_block_write(laz, &block);
+    }
+
+    laz->blen = 0;
+    laz->wnovl = 0;
+}
+
+int laz_close(LAZ* laz)
+{
+    if (laz->create)
+    {
+        laz_flush(laz);
+
+        if (laz->pipe)
+        {
+            laz_pipe_close(laz);
+        }
+
+        LAZ_HEADER header;
+        bzero(&header, sizeof(LAZ_HEADER));
+
+        header.magic = LAZ_MAGIC;
+        header.version = (laz->encoding == LAZ_ENCODING_RECORDS) ? LAZ_VERSION_RECORDS : LAZ_VERSION;
+        header.encoding = laz->encoding;
+        header.twidth = laz->twidth;
+        header.novl = laz->novl;
+        header.index = ftello(laz->file);
+        header.nblocks = laz->nblocks;
+
+        fwrite(laz->index, sizeof(LAZ_INDEX), laz->nblocks, laz->file);
+
+        fseeko(laz->file, 0, SEEK_SET);
+        fwrite(&header, sizeof(LAZ_HEADER), 1, laz->file);
+    }
+
+    if (laz->file)
+    {
+        fclose(laz->file);
+    }
+
+    laz_free(laz);
+
+    return 1;
+}
+
+int laz_block_load(LAZ* laz, uint64_t offset)
+{
+    LAZ_INDEX lidx;
+
+    if ( offset >= laz->dir )
+    {
+        return 0;
+    }
+
+    if ( pread(laz->fd, &lidx, sizeof(LAZ_INDEX), offset) != sizeof(LAZ_INDEX) )
+    {
+        return 0;
+    }
+
+    uint64_t clen = lidx.next - lidx.data;
+
+    if (clen > laz->cmax)
+    {
+        laz->cmax = clen;
+        laz->cbuf = realloc(laz->cbuf, laz->cmax);
+    }
+
+    if (lidx.size > laz->bmax)
+    {
+        laz->bmax = lidx.size;
+        laz->buf = realloc(laz->buf, laz->bmax);
+    }
+
+    if ( pread(laz->fd, laz->cbuf, clen, lidx.data) != (ssize_t)clen )
+    {
+        return 0;
+    }
+
+    // version 1 blocks are a single zlib stream, later ones use the chunked codec format
+
+    uint64_t destlen = lidx.size;
+
+    if ( laz->encoding == LAZ_ENCODING_PACKED )
+    {
+        if (lidx.psize > laz->pmax)
+        {
+            laz->pmax = lidx.psize;
+            laz->pbuf = realloc(laz->pbuf, laz->pmax);
+        }
+
+        uint64_t plen = uncompress_chunks(laz->cbuf, clen, laz->pbuf, lidx.psize);
+
+        if ( plen != lidx.psize || !laz_unpack(laz, &lidx, plen) )
+        {
+            destlen = 0;
+        }
+    }
+    else if ( laz->version == 1 )
+    {
+        uLongf zlen = lidx.size;
+
+        if ( uncompress((Bytef*)laz->buf, &zlen, laz->cbuf, clen) != Z_OK )
+        {
+            zlen = 0;
+        }
+
+        destlen = zlen;
+    }
+    else
+    {
+        destlen = uncompress_chunks(laz->cbuf, clen, laz->buf, lidx.size);
+    }
+
+    if ( destlen != lidx.size )
+    {
+        fprintf(stderr, "failed to uncompress block at %" PRIu64 "\n", offset);
+        return 0;
+    }
+
+    laz->blen = lidx.size;
+    laz->bcur = 0;
+    laz->boff = offset;
+    laz->bnext = lidx.next;
+
+    return 1;
+}
+
+int laz_block_next(LAZ* laz)
+{
+    return laz_block_load(laz, laz->bnext);
+}
+
+Overlap* laz_read(LAZ* laz)
+{
+    if ( laz->bcur == laz->blen && !laz_block_next(laz) )
+    {
+        return NULL;
+    }
+
+    Overlap* ovl = &(laz->ovl);
+
+    memcpy( ((char*)ovl) + sizeof(void*), laz->buf + laz->bcur, LAZ_OVL_SIZE );
+    laz->bcur += LAZ_OVL_SIZE;
+
+    ovl->path.trace = laz->buf + laz->bcur;
+    laz->bcur += laz_tbytes(laz) * ovl->path.tlen;
+
     return ovl;
 }
 
-int laz_write(LAZ* laz, Overlap* ovl)
+int laz_seek(LAZ* laz, int aread)
 {
+    uint64_t a = aread;
+    uint64_t left = 0;
+    uint64_t right = laz->nblocks;
+
+    // first block with a_to >= aread
+
+    while (left < right)
+    {
+        uint64_t mid = (left + right) / 2;
+
+        if (laz->index[mid].a_to < a)
+        {
+            left = mid + 1;
+        }
+        else
+        {
+            right = mid;
+        }
+    }
 
+    if ( left == laz->nblocks || !laz_block_load(laz, laz->index[left].data - sizeof(LAZ_INDEX)) )
+    {
+        return 0;
+    }
+
+    size_t tbytes = laz_tbytes(laz);
+
+    Overlap ovl;
+
+    while ( laz->bcur < laz->blen )
+    {
+        memcpy( ((char*)&ovl) + sizeof(void*), laz->buf + laz->bcur, LAZ_OVL_SIZE );
+
+        if ( (uint64_t)ovl.aread >= a )
+        {
+            return 1;
+        }
+
+        laz->bcur += LAZ_OVL_SIZE + tbytes * ovl.path.tlen;
+    }
+
+    return 0;
 }
 
+int laz_write(LAZ* laz, Overlap* ovl)
+{
+    if ( laz->wnovl > 0 && laz->blen >= LAZ_BLOCK_SIZE && (uint64_t)ovl->aread != laz->a_to )
+    {
+        laz_flush(laz);
+    }
+
+    size_t tlen = laz_tbytes(laz) * ovl->path.tlen;
+    uint64_t len = laz->blen + LAZ_OVL_SIZE + tlen;
+
+    if ( len > laz->bmax )
+    {
+        laz->bmax = 1.2 * len + LAZ_BLOCK_SIZE;
+        laz->buf = realloc(laz->buf, laz->bmax);
+    }
+
+    memcpy(laz->buf + laz->blen, ((char*)ovl) + sizeof(void*), LAZ_OVL_SIZE);
+    memcpy(laz->buf + laz->blen + LAZ_OVL_SIZE, ovl->path.trace, tlen);
+
+    laz->blen = len;
+
+    if (laz->wnovl == 0)
+    {
+        laz->a_from = ovl->aread;
+    }
+
+    laz->a_to = ovl->aread;
+    laz->wnovl += 1;
+    laz->novl += 1;
+
+    return 1;
+}
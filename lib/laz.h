@@ -7,8 +7,40 @@
 
 #include "dalign/align.h"
 
+/*
+ * LAZ, compressed overlap files
+ *
+ * [LAZ_HEADER] [LAZ_INDEX block 1] [data 1] [LAZ_INDEX block 2] [data 2] ... [LAZ_INDEX[nblocks]]
+ *
+ * each block holds the complete piles of the A-reads a_from..a_to in .las record
+ * format (overlap followed by its trace), compressed using compress_chunks(). the copies of
+ * all block indices at the end of the file allow seeking to an A-read directly.
+ *
+ * with the packed encoding (version 3) the piles are stored as
+ *
+ *   [aread delta] [novl] [overlap 1] ... [overlap novl]
+ *
+ * where the fields of an overlap are varints, bread delta coded within its pile and the
+ * end points relative to the begin points. the inner trace points are bit packed, with
+ * the b segment lengths relative to twidth. blocks are decoded to .las record format
+ * when loaded, hence readers see the same layout for both encodings.
+ *
+ * with laz_set_threads a writer hands its full blocks to a pool of threads, which
+ * pack and compress them while the following block is filled. the compressed blocks
+ * are written in the order they were cut.
+ */
+
 #define LAZ_MAGIC 0x254c415a
 
+#define LAZ_VERSION 3
+
+#define LAZ_VERSION_RECORDS 2                     // written for the record encoding, readable by older builds
+
+#define LAZ_ENCODING_RECORDS    0
+#define LAZ_ENCODING_PACKED     1
+
+#define LAZ_BLOCK_SIZE ( 4 * 1024 * 1024 )         // target uncompressed size of a block
+
 typedef struct
 {
     uint32_t    magic;
@@ -18,10 +50,11 @@ typedef struct
 
     uint64_t    novl;
 
-    uint64_t    reserved1;
+    uint64_t    index;          // file offset of the block directory
+    uint64_t    nblocks;
+
+    uint64_t    encoding;       // LAZ_ENCODING_*, zero in versions before 3
     uint64_t    reserved2;
-    uint64_t    reserved3;
-    uint64_t    reserved4;
 } LAZ_HEADER;
 
 typedef struct
@@ -31,35 +64,81 @@ typedef struct
 
     uint64_t    novl;
 
-    uint64_t    next;
-    uint64_t    data;
+    uint64_t    next;           // file offset of the next block
+    uint64_t    data;           // file offset of the compressed data
 
-    uint64_t    reserved1;
+    uint64_t    size;           // size of the data in .las record format
+
+    uint64_t    psize;          // size of the packed data
     uint64_t    reserved2;
     uint64_t    reserved3;
-    uint64_t    reserved4;
 } LAZ_INDEX;
 
 typedef struct
 {
     FILE* file;
+    int fd;
+    int create;
+
     uint16_t version;
-    uint16_t twidth;
+    uint16_t twidth;            // needs to be set before the first laz_write
     uint64_t novl;
 
-    Overlap* ovl;
-    uint32_t on;
-    uint32_t omax;
-    uint32_t ocur;
+    int encoding;               // LAZ_ENCODING_*, may be changed before the first laz_write
+
+    LAZ_INDEX* index;           // block directory
+    uint64_t nblocks;
+    uint64_t maxblocks;
+    uint64_t dir;               // file offset of the block directory
+
+    // current block, uncompressed
+
+    char* buf;
+    uint64_t bmax;
+    uint64_t blen;
+    uint64_t bcur;
+
+    uint64_t boff;              // file offset of the current block
+    uint64_t bnext;             // file offset of the following one
 
-    void* buf;
-    uint32_t bmax;
+    Overlap ovl;                // returned by laz_read
+
+    // compressed data
+
+    void* cbuf;
+    uint64_t cmax;
+
+    // packed data
+
+    uint8_t* pbuf;
+    uint64_t pmax;
+
+    // block being written
+
+    uint64_t wnovl;
+    uint64_t a_from;
+    uint64_t a_to;
+
+    void* pipe;                 // blocks being compressed in parallel, see laz_set_threads
 
 } LAZ;
 
 LAZ* laz_open(char* fpath, int create);
+LAZ* laz_fdopen(int fd);
 int  laz_close(LAZ* laz);
 
+int  laz_detect(FILE* file);
+
 Overlap* laz_read(LAZ* laz);
 int laz_write(LAZ* laz, Overlap* ovl);
 
+// compress the blocks of a writer using nthreads threads, before the first laz_write
+
+int laz_set_threads(LAZ* laz, int nthreads);
+
+int laz_seek(LAZ* laz, int aread);
+
+int laz_block_load(LAZ* laz, uint64_t offset);
+int laz_block_next(LAZ* laz);
+uint64_t laz_data_start();
+
@@ -1,24 +1,437 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pass.h"
+#include "laz.h"
 #include "oflags.h"
+#include "instrument.h"
+#include "bulkio.h"
+
+// size of the buffer used to append the parts written by pass_parallel()
+
+#define PASS_READER_BUFFER  ( 4 * 1024 * 1024 )
+
+// ranges per thread of a checkpointed pass_parallel(), handled in rounds of one each
+
+#define PASS_CHECKPOINT_ROUNDS  32
+
+// number of piles decoded ahead of the handler in read-ahead mode
+
+#define PASS_READAHEAD_PILES    4
+
+// overlap source used by the pass loop, either the stdio stream of the
+// context, a private bulk io stream over the same file descriptor
+// or a read-only mapping of the whole file
+
+typedef struct
+{
+    FILE* file;
+
+    int fd;
+    char* buf;
+    size_t bmax;
+    size_t bcur;
+    size_t blen;
+    off_t boff;             // file offset of buf[0]
+
+    int map;                // buf is a mapping of the whole file
+    LAZ* laz;               // buf is the current block of a compressed file
+    bio_stream* stream;     // buf is the current chunk of the stream
+} pass_reader;
+
+// arguments for a pass_parallel() worker
+
+typedef struct
+{
+    PassContext* pctx;      // private copy of the callers context
+    pass_handler handler;
+
+    int thread;
+} pass_worker;
+
+// a pile of overlaps sharing the same A-read (and B-read in split_b mode)
+
+typedef struct
+{
+    Overlap* ovls;
+    int omax;
+    int n;
+
+    ovl_trace* trace;
+    int tmax;
+
+    off_t pos;              // file offset of the overlap following the pile
+    int last;               // no piles left to process after this one
+} pass_pile;
+
+// how the traces are read, fixed for the duration of a pass
+
+typedef enum
+{
+    trace_skip = 0,         // not loaded
+    trace_copy = 1,         // copied into the pile
+    trace_unpack = 2,       // copied and widened to ovl_trace
+    trace_map = 3           // pointed into the mapped input
+} pass_trace_mode;
+
+// how the piles are written, fixed for the duration of a pass
+
+typedef enum
+{
+    write_none = 0,
+    write_trace = 1,        // as handled
+    write_pack = 2,         // narrowed back to uint8 from ovl_trace
+    write_strip = 3         // without trace, it was not loaded
+} pass_write_mode;
+
+typedef struct _pass_source pass_source;
+
+typedef void (*pass_read_fn)(pass_source*, pass_pile*);
+typedef void (*pass_write_fn)(PassContext*, Overlap*, int);
+
+// state for reading consecutive piles
+
+struct _pass_source
+{
+    PassContext* ctx;
+    pass_reader* reader;
+
+    Overlap next;           // first overlap of the next pile, already read
+    ovl_header_novl nread;  // overlaps read so far
+
+    pass_read_fn read_pile;     // variants for the settings of the pass, see pass_source_init()
+    pass_write_fn write_pile;
+};
+
+// ring of piles filled by the background reader in read-ahead mode
+
+typedef struct
+{
+    pass_source* src;
+    pass_pile piles[ PASS_READAHEAD_PILES ];
+
+    uint64 produced;
+    uint64 consumed;
+    int stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} pass_readahead;
 
 static inline size_t ovl_header_length()
 {
     return sizeof(ovl_header_novl) + sizeof(ovl_header_twidth);
 }
 
+static void pile_init(pass_pile* pile)
+{
+    pile->omax = 500;
+    pile->ovls = (Overlap*)malloc(sizeof(Overlap) * pile->omax);
+    pile->n = 0;
+
+    pile->trace = NULL;
+    pile->tmax = 0;
+
+    pile->pos = 0;
+    pile->last = 0;
+}
+
+static void pile_free(pass_pile* pile)
+{
+    free(pile->ovls);
+    free(pile->trace);
+}
+
+static void reader_init_file(pass_reader* r, FILE* file)
+{
+    bzero(r, sizeof(pass_reader));
+
+    r->file = file;
+    r->fd = -1;
+}
+
+static void reader_init_fd(pass_reader* r, int fd, off_t start)
+{
+    bzero(r, sizeof(pass_reader));
+
+    r->fd = fd;
+    r->boff = start;
+
+    if ( (r->stream = bio_stream_open(fd, start)) == NULL )
+    {
+        fprintf(stderr, "failed to open overlap stream\n");
+        exit(1);
+    }
+}
+
+// maps the file and hints the kernel about the range that is going to be read,
+// returns 0 on success
+
+static int reader_init_map(pass_reader* r, int fd, off_t size, off_t start, off_t end)
+{
+    bzero(r, sizeof(pass_reader));
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    r->fd = fd;
+    r->map = 1;
+    r->buf = map;
+    r->bmax = r->blen = size;
+    r->bcur = start;
+
+    long page = sysconf(_SC_PAGESIZE);
+    off_t mstart = start - (start % page);
+
+    madvise(r->buf, size, MADV_SEQUENTIAL);
+    madvise(r->buf + mstart, end - mstart, MADV_WILLNEED);
+
+    return 0;
+}
+
+// reads LAZ compressed input one block at a time
+
+static void reader_init_laz(pass_reader* r, int fd)
+{
+    bzero(r, sizeof(pass_reader));
+
+    r->fd = fd;
+
+    if ( (r->laz = laz_fdopen(fd)) == NULL )
+    {
+        fprintf(stderr, "failed to read LAZ header\n");
+        exit(1);
+    }
+}
+
+static int reader_laz_block(pass_reader* r, off_t off)
+{
+    LAZ* laz = r->laz;
+
+    if ( !laz_block_load(laz, off) )
+    {
+        r->bcur = r->blen = 0;
+        return 1;
+    }
+
+    r->buf = laz->buf;
+    r->bmax = laz->bmax;
+    r->blen = laz->blen;
+    r->bcur = 0;
+    r->boff = laz->boff;
+
+    return 0;
+}
+
+static void reader_free(pass_reader* r)
+{
+    if (r->laz)
+    {
+        laz_close(r->laz);
+    }
+    else if (r->map)
+    {
+        munmap(r->buf, r->bmax);
+    }
+    else if (r->stream)
+    {
+        bio_stream_close(r->stream);
+    }
+}
+
+static off_t reader_tell(pass_reader* r)
+{
+    if (r->file)
+    {
+        return ftello(r->file);
+    }
+
+    return r->boff + r->bcur;
+}
+
+// file offset of the overlap header that was read last
+
+static off_t reader_last_overlap(pass_reader* r)
+{
+    if (r->laz)
+    {
+        // positions inside a compressed block have no file offset. the block's is used
+        // for its first overlap, any offset inside the block serves for the others.
+
+        return r->boff + (r->bcur > OVERLAP_IO_SIZE);
+    }
+
+    return reader_tell(r) - OVERLAP_IO_SIZE;
+}
+
+static void reader_seek(pass_reader* r, off_t off)
+{
+    if (r->file)
+    {
+        fseeko(r->file, off, SEEK_SET);
+        return ;
+    }
+
+    if (r->laz)
+    {
+        reader_laz_block(r, off);
+    }
+    else if (off >= r->boff && off <= r->boff + (off_t)r->blen)
+    {
+        r->bcur = off - r->boff;
+    }
+    else
+    {
+        r->boff = off;
+        r->bcur = r->blen = 0;
+
+        bio_stream_seek(r->stream, off);
+    }
+}
+
+// copy/skip the next n bytes, returns 0 on success like Read_Overlap()
+
+static int reader_read(pass_reader* r, void* dst, size_t n)
+{
+    if (r->file)
+    {
+        if (dst == NULL)
+        {
+            return fseeko(r->file, n, SEEK_CUR) != 0;
+        }
+
+        return n != 0 && fread(dst, n, 1, r->file) != 1;
+    }
+
+    char* out = dst;
+
+    while (n)
+    {
+        if (r->bcur == r->blen)
+        {
+            if (r->map)
+            {
+                return 1;
+            }
+
+            if (r->laz)
+            {
+                if ( reader_laz_block(r, r->laz->bnext) )
+                {
+                    return 1;
+                }
+
+                continue;
+            }
+
+            r->boff += r->blen;
+            r->bcur = r->blen = 0;
+
+            ssize_t len = bio_stream_next(r->stream, &(r->buf));
+
+            if (len <= 0)
+            {
+                return 1;
+            }
+
+            r->blen = len;
+        }
+
+        size_t chunk = r->blen - r->bcur;
+
+        if (chunk > n)
+        {
+            chunk = n;
+        }
+
+        if (out)
+        {
+            memcpy(out, r->buf + r->bcur, chunk);
+            out += chunk;
+        }
+
+        r->bcur += chunk;
+        n -= chunk;
+    }
+
+    return 0;
+}
+
+static inline int reader_overlap(pass_reader* r, Overlap* ovl)
+{
+    return reader_read(r, ((char*)ovl) + sizeof(void*), OVERLAP_IO_SIZE);
+}
+
+static inline int reader_trace(pass_reader* r, Overlap* ovl, size_t tbytes)
+{
+    return reader_read(r, ovl->path.trace, tbytes * ovl->path.tlen);
+}
+
+static inline int reader_skip_trace(pass_reader* r, Overlap* ovl, size_t tbytes)
+{
+    return reader_read(r, NULL, tbytes * ovl->path.tlen);
+}
+
+// points the trace straight into the mapped file instead of copying it.
+// the mapping is private, hence handlers are free to modify the trace.
+
+static inline int reader_map_trace(pass_reader* r, Overlap* ovl, size_t tbytes)
+{
+    size_t n = tbytes * ovl->path.tlen;
+
+    if (r->bcur + n > r->blen)
+    {
+        return 1;
+    }
+
+    ovl->path.trace = r->buf + r->bcur;
+    r->bcur += n;
+
+    return 0;
+}
+
+static void reader_open(PassContext* ctx, pass_reader* r, off_t start, off_t end)
+{
+    if ( ctx->is_laz )
+    {
+        reader_init_laz(r, fileno(ctx->fileOvlIn));
+        return ;
+    }
+
+    if ( ctx->use_mmap && !reader_init_map(r, fileno(ctx->fileOvlIn), ctx->sizeOvlIn, start, end) )
+    {
+        return ;
+    }
+
+    reader_init_fd(r, fileno(ctx->fileOvlIn), start);
+}
 
 PassContext* pass_init(FILE* fileOvlIn, FILE* fileOvlOut)
 {
     PassContext* ctx = malloc(sizeof(PassContext));
 
     ctx->fileOvlIn = fileOvlIn;
-    ctx->trace = NULL;
-    ctx->tmax = 0;
+
+    ctx->thread_init = NULL;
+    ctx->thread_reduce = NULL;
+
+    ctx->use_mmap = 0;
+    ctx->read_ahead = 0;
+    ctx->index = NULL;
+
+    ctx->checkpoint = NULL;
+    ctx->aread = -1;
 
     // get file size
     fseeko(ctx->fileOvlIn, 0L, SEEK_END);
@@ -33,9 +446,27 @@ PassContext* pass_init(FILE* fileOvlIn, FILE* fileOvlOut)
 
     ctx->progress_tick = ctx->sizeOvlIn / 10;
 
-    ovl_header_read(fileOvlIn, &(ctx->novl), &(ctx->twidth));
+    if ( (ctx->is_laz = laz_detect(fileOvlIn)) )
+    {
+        LAZ* laz = laz_fdopen( fileno(fileOvlIn) );
+
+        if (laz == NULL)
+        {
+            free(ctx);
+            return NULL;
+        }
+
+        ctx->novl = laz->novl;
+        ctx->twidth = laz->twidth;
+
+        laz_close(laz);
+    }
+    else
+    {
+        ovl_header_read(fileOvlIn, &(ctx->novl), &(ctx->twidth));
+    }
 
-    if ( ctx->novl == 0 && ctx->sizeOvlIn > (off_t)ovl_header_length() )
+    if ( ctx->novl == 0 && ctx->sizeOvlIn > pass_data_start(ctx) )
     {
         free(ctx);
         return NULL;
@@ -82,7 +513,6 @@ void pass_free(PassContext* ctx)
         ovl_header_write(ctx->fileOvlOut, ctx->novl_out, ctx->twidth);
     }
 
-    free(ctx->trace);
     free(ctx);
 }
 
@@ -96,177 +526,1298 @@ void read_unpacked_trace(FILE* fileOvl, Overlap* ovl, size_t tbytes)
     }
 }
 
-void pass(PassContext* ctx, pass_handler handler)
-{
-    Overlap* pOvls = NULL;
-    int omax = 500;
-    pOvls = (Overlap*)malloc(sizeof(Overlap)*omax);
-
-    int split_b = ctx->split_b;
-    int load_trace = ctx->load_trace;
-    int unpack_trace = ctx->unpack_trace;
-    int write_overlaps = ctx->write_overlaps;
-    int purge_discarded = ctx->purge_discarded;
-
-    if (ctx->off_start)
-    {
-        fseeko(ctx->fileOvlIn, ctx->off_start, SEEK_SET);
-    }
-    else
-    {
-        fseeko(ctx->fileOvlIn, sizeof(ovl_header_novl) + sizeof(ovl_header_twidth), SEEK_SET);
-    }
-
-    if (Read_Overlap(ctx->fileOvlIn, pOvls))
-    {
-        free(pOvls);
+// reads the pile starting with src->next into pile and leaves the first
+// overlap of the following pile in src->next.
+//
+// it is instantiated for every combination of split_b and trace mode by PASS_READ_PILE,
+// the constant arguments take the per overlap tests out of the loop.
 
-        return ;
-    }
+static inline __attribute__((always_inline))
+void pass_read_pile_tmpl(pass_source* src, pass_pile* pile, const int split_b, const pass_trace_mode trace_mode)
+{
+    PassContext* ctx = src->ctx;
+    pass_reader* reader = src->reader;
 
-    int a, b, n, cont;
+    uint64_t start = INS_START();
 
-    ovl_header_novl i;
+    size_t tbytes = ctx->tbytes;
 
-    n = i = 0;
-    cont = 1;
+    Overlap* pOvls = pile->ovls;
+    int a = src->next.aread;
+    int b = src->next.bread;
+    int n = 0;
+    int tcur = 0;
+    int eof = 0;
 
-    ctx->progress_nexttick = ctx->progress_tick;
+    pOvls[0] = src->next;
 
-    while (cont)
+    while (1)
     {
-        if (ctx->progress)
+        if (trace_mode == trace_map)
         {
-            off_t pos = ftello(ctx->fileOvlIn);
-
-            if (pos >= ctx->progress_nexttick)
-            {
-                printf("%3.0f%% done\n", 100.0 * pos / ctx->sizeOvlIn);
-                ctx->progress_nexttick += ctx->progress_tick;
-            }
+            reader_map_trace(reader, pOvls + n, tbytes);
         }
-
-        pOvls[0] = pOvls[n];
-        a = pOvls->aread;
-        b = pOvls->bread;
-
-        if (load_trace)
+        else if (trace_mode == trace_copy || trace_mode == trace_unpack)
         {
-            if (pOvls[0].path.tlen > ctx->tmax)
+            if (pOvls[n].path.tlen + tcur > pile->tmax)
             {
-                ctx->tmax = 1.2 * ctx->tmax + pOvls[0].path.tlen;
-                ctx->trace = realloc(ctx->trace, ctx->tmax * sizeof(ovl_trace));
-            }
+                pile->tmax = 1.2 * pile->tmax + pOvls[n].path.tlen;
+
+                ovl_trace* trace = realloc(pile->trace, pile->tmax * sizeof(ovl_trace));
+
+                int j;
+                for (j = 0; j < n; j++)
+                {
+                    pOvls[j].path.trace = trace + ((ovl_trace*)(pOvls[j].path.trace) - pile->trace);
+                }
 
-            pOvls[0].path.trace = ctx->trace;
+                pile->trace = trace;
+            }
 
-            Read_Trace(ctx->fileOvlIn, pOvls, ctx->tbytes);
+            pOvls[n].path.trace = pile->trace + tcur;
+            reader_trace(reader, pOvls + n, tbytes);
 
-            ctx->tcur = pOvls[0].path.tlen;
+            tcur += pOvls[n].path.tlen;
 
-            if (unpack_trace && ctx->tbytes == sizeof(uint8))
+            if (trace_mode == trace_unpack)
             {
-                Decompress_TraceTo16(pOvls);
+                Decompress_TraceTo16(pOvls + n);
             }
         }
         else
         {
-            fseeko(ctx->fileOvlIn, ctx->tbytes * pOvls[0].path.tlen, SEEK_CUR);
+            reader_skip_trace(reader, pOvls + n, tbytes);
         }
 
-        n = 1;
+        n += 1;
+        if (n >= pile->omax)
+        {
+            pile->omax = 1.2 * n + 10;
+            pile->ovls = pOvls = (Overlap*)realloc(pOvls, sizeof(Overlap) * pile->omax);
+        }
 
-        while (1)
+        if (reader_overlap(reader, &(src->next)))
         {
-            if (Read_Overlap(ctx->fileOvlIn, pOvls+n) ||
-                pOvls[n].aread != a ||
-                (split_b && pOvls[n].bread != b))
-            {
-                break;
-            }
+            eof = 1;
+            break;
+        }
 
-            if (load_trace)
-            {
-                if (pOvls[n].path.tlen + ctx->tcur > ctx->tmax)
-                {
-                    ctx->tmax = 1.2 * ctx->tmax + pOvls[n].path.tlen;
+        if (src->next.aread != a || (split_b && src->next.bread != b))
+        {
+            break;
+        }
 
-                    ovl_trace* trace = realloc(ctx->trace, ctx->tmax * sizeof(ovl_trace));
+        pOvls[n] = src->next;
+    }
 
-                    int j;
-                    for (j = 0; j < n; j++)
-                    {
-                        pOvls[j].path.trace = trace + ((ovl_trace*)(pOvls[j].path.trace) - ctx->trace);
-                    }
+    src->nread += n;
 
-                    ctx->trace = trace;
-                }
+    // the header of the overlap following the pile has already been read
 
-                pOvls[n].path.trace = ctx->trace + ctx->tcur;
-                Read_Trace(ctx->fileOvlIn, pOvls+n, ctx->tbytes);
+    pile->n = n;
+    pile->pos = eof ? reader_tell(reader) : reader_last_overlap(reader);
+    pile->last = eof || (ctx->off_start && pile->pos >= ctx->off_end) || src->nread >= ctx->novl;
 
-                ctx->tcur += pOvls[n].path.tlen;
+    INS_STOP("pass.read", start);
+}
 
-                if (unpack_trace && ctx->tbytes == sizeof(uint8))
-                {
-                    Decompress_TraceTo16(pOvls + n);
-                }
-            }
-            else
-            {
-                fseeko(ctx->fileOvlIn, ctx->tbytes * pOvls[n].path.tlen, SEEK_CUR);
-            }
+#define PASS_READ_PILE(split_b, trace)                                          \
+    static void pass_read_pile_##split_b##_##trace(pass_source* src, pass_pile* pile) \
+    {                                                                           \
+        pass_read_pile_tmpl(src, pile, split_b, trace);                         \
+    }
 
-            n += 1;
-            if (n >= omax)
-            {
-                omax = 1.2 * n + 10;
-                pOvls = (Overlap*)realloc(pOvls, sizeof(Overlap) * omax);
-            }
-        }
+PASS_READ_PILE(0, trace_skip)
+PASS_READ_PILE(0, trace_copy)
+PASS_READ_PILE(0, trace_unpack)
+PASS_READ_PILE(0, trace_map)
+PASS_READ_PILE(1, trace_skip)
+PASS_READ_PILE(1, trace_copy)
+PASS_READ_PILE(1, trace_unpack)
+PASS_READ_PILE(1, trace_map)
 
-        cont = handler(ctx->data, pOvls, n);
+static const pass_read_fn pass_read_piles[2][4] =
+{
+    { pass_read_pile_0_trace_skip, pass_read_pile_0_trace_copy, pass_read_pile_0_trace_unpack, pass_read_pile_0_trace_map },
+    { pass_read_pile_1_trace_skip, pass_read_pile_1_trace_copy, pass_read_pile_1_trace_unpack, pass_read_pile_1_trace_map }
+};
+
+// writes the first n overlaps of a handled pile, instantiated by PASS_WRITE_PILE
 
-        if (write_overlaps)
+static inline __attribute__((always_inline))
+void pass_write_pile_tmpl(PassContext* ctx, Overlap* pOvls, int n, const int purge_discarded, const pass_write_mode mode)
+{
+    int j;
+    for (j = 0; j < n; j++)
+    {
+        int isDiscarded = (pOvls[j].flags & OVL_DISCARD);
+        if (!purge_discarded || !isDiscarded)
         {
-            int j;
-            for (j = 0; j < n; j++)
+            if (mode == write_pack)
             {
-                int isDiscarded = (pOvls[j].flags & OVL_DISCARD);
-                if (!purge_discarded || !isDiscarded)
+                Compress_TraceTo8(pOvls + j);
+            }
+            else if (mode == write_strip)
+            {
+                pOvls[j].path.tlen = 0;
+            }
+
+            pOvls[j].flags &= ~OVL_TEMP;
+
+            Write_Overlap(ctx->fileOvlOut, pOvls + j, ctx->tbytes);
+            ctx->novl_out++;
+
+            if (isDiscarded)
+            {
+                ctx->novl_out_discarded++;
+            }
+        }
+    }
+}
+
+#define PASS_WRITE_PILE(purge, mode)                                            \
+    static void pass_write_pile_##purge##_##mode(PassContext* ctx, Overlap* pOvls, int n) \
+    {                                                                           \
+        pass_write_pile_tmpl(ctx, pOvls, n, purge, mode);                       \
+    }
+
+PASS_WRITE_PILE(0, write_trace)
+PASS_WRITE_PILE(0, write_pack)
+PASS_WRITE_PILE(0, write_strip)
+PASS_WRITE_PILE(1, write_trace)
+PASS_WRITE_PILE(1, write_pack)
+PASS_WRITE_PILE(1, write_strip)
+
+static const pass_write_fn pass_write_piles[2][4] =
+{
+    { NULL, pass_write_pile_0_write_trace, pass_write_pile_0_write_pack, pass_write_pile_0_write_strip },
+    { NULL, pass_write_pile_1_write_trace, pass_write_pile_1_write_pack, pass_write_pile_1_write_strip }
+};
+
+// picks the variants for the settings of the pass, they must not change while it runs
+
+static void pass_source_init(pass_source* src, PassContext* ctx, pass_reader* reader)
+{
+    int unpack = ctx->unpack_trace && ctx->tbytes == sizeof(uint8);
+    pass_trace_mode trace;
+    pass_write_mode mode;
+
+    if (!ctx->load_trace)
+    {
+        trace = trace_skip;
+    }
+    else if (unpack)
+    {
+        trace = trace_unpack;
+    }
+    else if (reader->map)
+    {
+        trace = trace_map;
+    }
+    else
+    {
+        trace = trace_copy;
+    }
+
+    if (!ctx->write_overlaps)
+    {
+        mode = write_none;
+    }
+    else if (!ctx->load_trace)
+    {
+        mode = write_strip;
+    }
+    else if (unpack)
+    {
+        mode = write_pack;
+    }
+    else
+    {
+        mode = write_trace;
+    }
+
+    src->ctx = ctx;
+    src->reader = reader;
+    src->nread = 0;
+
+    src->read_pile = pass_read_piles[ ctx->split_b ? 1 : 0 ][ trace ];
+    src->write_pile = pass_write_piles[ ctx->purge_discarded ? 1 : 0 ][ mode ];
+}
+
+// records the state of the pass, off is the input offset following the last pile handled
+
+void pass_checkpoint_pass(PassContext* ctx, off_t off)
+{
+    PassCheckpoint* ckpt = ctx->checkpoint;
+
+    ckpt->off = off;
+    ckpt->aread = ctx->aread;
+    ckpt->novl_out = ctx->novl_out;
+    ckpt->novl_out_discarded = ctx->novl_out_discarded;
+
+    pass_checkpoint_write(ckpt);
+}
+
+// offset to continue the pass from, 0 if there is no checkpoint to resume
+
+off_t pass_checkpoint_resume(PassContext* ctx)
+{
+    PassCheckpoint* ckpt = ctx->checkpoint;
+
+    if (ckpt == NULL || ctx->off_start)
+    {
+        return 0;
+    }
+
+    // LAZ blocks can't be entered at pile boundaries
+
+    if (ctx->is_laz)
+    {
+        fprintf(stderr, "checkpoints are not supported for LAZ input\n");
+        exit(1);
+    }
+
+    if (!ckpt->resumed)
+    {
+        return 0;
+    }
+
+    if (ckpt->nout != ckpt->maxout)
+    {
+        fprintf(stderr, "checkpoint %s has %d outputs, not %d\n", ckpt->path, ckpt->maxout, ckpt->nout);
+        exit(1);
+    }
+
+    ctx->novl_out = ckpt->novl_out;
+    ctx->novl_out_discarded = ckpt->novl_out_discarded;
+    ctx->aread = ckpt->aread;
+
+    return ckpt->off;
+}
+
+// runs the handler on the pile and writes it. returns the handler's verdict.
+
+static int pass_process_pile(pass_source* src, pass_pile* pile, pass_handler handler)
+{
+    PassContext* ctx = src->ctx;
+    Overlap* pOvls = pile->ovls;
+    int n = pile->n;
+
+    if (ctx->progress && pile->pos >= ctx->progress_nexttick)
+    {
+        printf("%3.0f%% done\n", 100.0 * pile->pos / ctx->sizeOvlIn);
+        ctx->progress_nexttick += ctx->progress_tick;
+    }
+
+    ctx->npile = n;
+    ctx->aread = pOvls->aread;
+
+    INS_COUNT("pass.overlaps", n);
+    INS_OBSERVE("pass.pile_size", n);
+
+    uint64_t start = INS_START();
+
+    int cont = handler(ctx->data, pOvls, n);
+
+    INS_STOP("pass.handler", start);
+
+    if (ctx->npile < n)
+    {
+        n = ctx->npile;
+    }
+
+    if (src->write_pile)
+    {
+        start = INS_START();
+
+        src->write_pile(ctx, pOvls, n);
+
+        INS_STOP("pass.write", start);
+    }
+
+    if (ctx->checkpoint && pass_checkpoint_due(ctx->checkpoint))
+    {
+        pass_checkpoint_pass(ctx, pile->pos);
+    }
+
+    return cont;
+}
+
+// background reader of the read-ahead mode
+
+static void* pass_readahead_thread(void* arg)
+{
+    pass_readahead* ra = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&(ra->lock));
+
+        while (ra->produced - ra->consumed == PASS_READAHEAD_PILES && !ra->stop)
+        {
+            pthread_cond_wait(&(ra->cond), &(ra->lock));
+        }
+
+        int stop = ra->stop;
+
+        pthread_mutex_unlock(&(ra->lock));
+
+        if (stop)
+        {
+            break;
+        }
+
+        pass_pile* pile = ra->piles + (ra->produced % PASS_READAHEAD_PILES);
+
+        ra->src->read_pile(ra->src, pile);
+
+        pthread_mutex_lock(&(ra->lock));
+
+        ra->produced += 1;
+
+        pthread_cond_signal(&(ra->cond));
+        pthread_mutex_unlock(&(ra->lock));
+
+        if (pile->last)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void pass_run_readahead(pass_source* src, pass_handler handler)
+{
+    pass_readahead ra;
+    pthread_t reader;
+
+    int i;
+    for (i = 0; i < PASS_READAHEAD_PILES; i++)
+    {
+        pile_init(ra.piles + i);
+    }
+
+    ra.src = src;
+    ra.produced = ra.consumed = 0;
+    ra.stop = 0;
+
+    pthread_mutex_init(&(ra.lock), NULL);
+    pthread_cond_init(&(ra.cond), NULL);
+
+    pthread_create(&reader, NULL, pass_readahead_thread, &ra);
+
+    int cont = 1;
+
+    while (cont)
+    {
+        pthread_mutex_lock(&(ra.lock));
+
+        while (ra.consumed == ra.produced)
+        {
+            pthread_cond_wait(&(ra.cond), &(ra.lock));
+        }
+
+        pthread_mutex_unlock(&(ra.lock));
+
+        pass_pile* pile = ra.piles + (ra.consumed % PASS_READAHEAD_PILES);
+
+        cont = pass_process_pile(src, pile, handler) && !pile->last;
+
+        pthread_mutex_lock(&(ra.lock));
+
+        ra.consumed += 1;
+
+        if (!cont)
+        {
+            ra.stop = 1;
+        }
+
+        pthread_cond_signal(&(ra.cond));
+        pthread_mutex_unlock(&(ra.lock));
+    }
+
+    pthread_join(reader, NULL);
+
+    pthread_cond_destroy(&(ra.cond));
+    pthread_mutex_destroy(&(ra.lock));
+
+    for (i = 0; i < PASS_READAHEAD_PILES; i++)
+    {
+        pile_free(ra.piles + i);
+    }
+}
+
+static void pass_run(PassContext* ctx, pass_reader* reader, pass_handler handler)
+{
+    pass_source src;
+
+    pass_source_init(&src, ctx, reader);
+
+    if (ctx->off_start)
+    {
+        reader_seek(reader, ctx->off_start);
+    }
+    else
+    {
+        reader_seek(reader, pass_data_start(ctx));
+    }
+
+    if (reader_overlap(reader, &(src.next)))
+    {
+        return ;
+    }
+
+    ctx->progress_nexttick = ctx->progress_tick;
+
+    if (ctx->read_ahead)
+    {
+        pass_run_readahead(&src, handler);
+
+        return ;
+    }
+
+    pass_pile pile;
+    pile_init(&pile);
+
+    int cont = 1;
+
+    while (cont)
+    {
+        src.read_pile(&src, &pile);
+
+        cont = pass_process_pile(&src, &pile, handler) && !pile.last;
+    }
+
+    pile_free(&pile);
+}
+
+void pass(PassContext* ctx, pass_handler handler)
+{
+    pass_reader reader;
+
+    // an empty part of a split
+
+    if (ctx->off_start && ctx->off_start == ctx->off_end)
+    {
+        return ;
+    }
+
+    // parts are read through their own offsets, they can be run concurrently.
+    // with bulk io enabled the whole input is streamed through its queue as well.
+
+    if (ctx->use_mmap || ctx->is_laz || ctx->off_start || bio_enabled())
+    {
+        off_t start = ctx->off_start ? ctx->off_start : pass_data_start(ctx);
+        off_t end = ctx->off_start ? ctx->off_end : ctx->sizeOvlIn;
+
+        reader_open(ctx, &reader, start, end);
+    }
+    else
+    {
+        reader_init_file(&reader, ctx->fileOvlIn);
+    }
+
+    pass_run(ctx, &reader, handler);
+
+    reader_free(&reader);
+}
+
+void pass_ranges(PassContext* ctx, pass_handler handler, int* pts, int npts)
+{
+    lasidx* idx = ctx->index;
+
+    if ( idx == NULL || ctx->is_laz )
+    {
+        pass(ctx, handler);
+
+        return ;
+    }
+
+    int i;
+
+    for ( i = 0; i + 1 < npts; i += 2 )
+    {
+        int first = pts[i];
+        int last = pts[i + 1];
+
+        if ( (uint64)last >= idx->nreads )
+        {
+            last = idx->nreads - 1;
+        }
+
+        while ( first <= last && idx->entries[first].novl == 0 )
+        {
+            first++;
+        }
+
+        while ( last >= first && idx->entries[last].novl == 0 )
+        {
+            last--;
+        }
+
+        if ( first > last )
+        {
+            continue;
+        }
+
+        lasidx_entry* entry = idx->entries + last;
+
+        pass_part(ctx, idx->entries[first].offset, entry->offset + entry->novl * OVERLAP_IO_SIZE + entry->tbytes);
+
+        pass(ctx, handler);
+    }
+
+    ctx->off_start = ctx->off_end = 0;
+}
+
+// LAZ input can only be cut at block boundaries, which the directory provides
+
+static void pass_partition_laz(PassContext* ctx, off_t* offsets, int parts)
+{
+    LAZ* laz = laz_fdopen( fileno(ctx->fileOvlIn) );
+    off_t start = pass_data_start(ctx);
+    off_t span = laz->dir - start;
+
+    uint64 i;
+    int part = 1;
+
+    offsets[0] = start;
+
+    for ( i = 0; i < laz->nblocks && part < parts; i++ )
+    {
+        off_t pos = laz->index[i].data - sizeof(LAZ_INDEX);
+
+        while ( part < parts && pos >= start + span / parts * part )
+        {
+            offsets[ part++ ] = pos;
+        }
+    }
+
+    while ( part <= parts )
+    {
+        offsets[ part++ ] = laz->dir;
+    }
+
+    laz_close(laz);
+}
+
+static void pass_partition_index(PassContext* ctx, off_t* offsets, int parts)
+{
+    lasidx* idx = ctx->index;
+    off_t start = ctx->off_start ? ctx->off_start : (off_t)ovl_header_length();
+    off_t end = ctx->off_start ? ctx->off_end : ctx->sizeOvlIn;
+    off_t span = end - start;
+
+    uint64 i;
+    int part = 1;
+
+    offsets[0] = start;
+
+    for ( i = 0; i < idx->nreads && part < parts; i++ )
+    {
+        if ( idx->entries[i].novl == 0 || (off_t)idx->entries[i].offset < start )
+        {
+            continue;
+        }
+
+        off_t pos = idx->entries[i].offset;
+
+        if ( pos >= end )
+        {
+            break;
+        }
+
+        while ( part < parts && pos >= start + span / parts * part )
+        {
+            offsets[ part++ ] = pos;
+        }
+    }
+
+    while ( part <= parts )
+    {
+        offsets[ part++ ] = end;
+    }
+}
+
+off_t pass_data_start(PassContext* ctx)
+{
+    if (ctx->is_laz)
+    {
+        return laz_data_start();
+    }
+
+    return ovl_header_length();
+}
+
+off_t* pass_partition(PassContext* ctx, int parts)
+{
+    off_t* offsets = malloc( sizeof(off_t) * (parts + 1) );
+
+    if (ctx->is_laz)
+    {
+        pass_partition_laz(ctx, offsets, parts);
+
+        return offsets;
+    }
+
+    if (ctx->index)
+    {
+        pass_partition_index(ctx, offsets, parts);
+
+        return offsets;
+    }
+
+    off_t start = ctx->off_start ? ctx->off_start : (off_t)ovl_header_length();
+    off_t end = ctx->off_start ? ctx->off_end : ctx->sizeOvlIn;
+    off_t span = end - start;
+
+    pass_reader reader;
+    reader_init_fd(&reader, fileno(ctx->fileOvlIn), start);
+
+    Overlap ovl;
+    int a = -1;
+    int part = 1;
+    off_t next = start + span / parts;
+
+    offsets[0] = start;
+
+    while ( part < parts )
+    {
+        off_t pos = reader_tell(&reader);
+
+        if ( pos >= end || reader_overlap(&reader, &ovl) )
+        {
+            break;
+        }
+
+        if ( ovl.aread != a )
+        {
+            // cut in front of the first pile starting past the target offset
+
+            while ( part < parts && pos >= next )
+            {
+                offsets[ part++ ] = pos;
+                next = start + span / parts * part;
+            }
+
+            a = ovl.aread;
+        }
+
+        reader_skip_trace(&reader, &ovl, ctx->tbytes);
+    }
+
+    while ( part <= parts )
+    {
+        offsets[ part++ ] = end;
+    }
+
+    reader_free(&reader);
+
+    return offsets;
+}
+
+off_t* pass_partition_piles(PassContext* ctx, int* areads, int n)
+{
+    off_t* offsets = malloc( sizeof(off_t) * (n + 1) );
+    off_t start = ctx->off_start ? ctx->off_start : pass_data_start(ctx);
+    off_t end = ctx->off_start ? ctx->off_end : ctx->sizeOvlIn;
+    int part = 0;
+
+    assert( !ctx->is_laz );
+
+    if (ctx->index)
+    {
+        lasidx* idx = ctx->index;
+        uint64 i;
+
+        for ( i = 0; i < idx->nreads && part < n; i++ )
+        {
+            off_t pos = idx->entries[i].offset;
+
+            if ( idx->entries[i].novl == 0 || pos < start )
+            {
+                continue;
+            }
+
+            if ( pos >= end )
+            {
+                break;
+            }
+
+            while ( part < n && (int)i >= areads[part] )
+            {
+                offsets[ part++ ] = pos;
+            }
+        }
+    }
+    else
+    {
+        pass_reader reader;
+        reader_init_fd(&reader, fileno(ctx->fileOvlIn), start);
+
+        Overlap ovl;
+        int a = -1;
+
+        while ( part < n )
+        {
+            off_t pos = reader_tell(&reader);
+
+            if ( pos >= end || reader_overlap(&reader, &ovl) )
+            {
+                break;
+            }
+
+            if ( ovl.aread != a )
+            {
+                while ( part < n && ovl.aread >= areads[part] )
                 {
-                    if (unpack_trace && ctx->tbytes == sizeof(uint8) && load_trace)
-                    {
-                        Compress_TraceTo8(pOvls + j);
-                    }
+                    offsets[ part++ ] = pos;
+                }
+
+                a = ovl.aread;
+            }
+
+            reader_skip_trace(&reader, &ovl, ctx->tbytes);
+        }
+
+        reader_free(&reader);
+    }
 
-                    if (!load_trace)
-                    {
-                        pOvls[j].path.tlen = 0;
-                    }
+    while ( part <= n )
+    {
+        offsets[ part++ ] = end;
+    }
 
-                    pOvls[j].flags &= ~OVL_TEMP;
+    return offsets;
+}
 
-                    Write_Overlap(ctx->fileOvlOut, pOvls + j, ctx->tbytes);
-                    ctx->novl_out++;
+static void* pass_worker_thread(void* arg)
+{
+    pass_worker* worker = arg;
+    PassContext* pctx = worker->pctx;
 
-                    if (isDiscarded)
-                    {
-                        ctx->novl_out_discarded++;
-                    }
-                }
+    pass_reader reader;
+    reader_open(pctx, &reader, pctx->off_start, pctx->off_end);
+
+    pass_run(pctx, &reader, worker->handler);
+
+    reader_free(&reader);
+
+    return NULL;
+}
+
+// runs the handler on the ranges offsets[0..nthreads] concurrently and reduces them in file order
+
+static void pass_parallel_run(PassContext* ctx, pass_handler handler, off_t* offsets, int nthreads)
+{
+    pthread_t* threads = malloc( sizeof(pthread_t) * nthreads );
+    pass_worker* workers = malloc( sizeof(pass_worker) * nthreads );
+
+    int i;
+    for ( i = 0; i < nthreads; i++ )
+    {
+        PassContext* pctx = malloc( sizeof(PassContext) );
+        memcpy(pctx, ctx, sizeof(PassContext));
+
+        pctx->progress = (i == 0) ? ctx->progress : 0;
+        pctx->novl_out = pctx->novl_out_discarded = 0;
+        pctx->checkpoint = NULL;
+
+        pctx->off_start = offsets[i];
+        pctx->off_end = offsets[i + 1];
+
+        if (ctx->thread_init)
+        {
+            pctx->data = ctx->thread_init(ctx->data, i);
+        }
+
+        if (ctx->write_overlaps)
+        {
+            if ( (pctx->fileOvlOut = tmpfile()) == NULL )
+            {
+                fprintf(stderr, "failed to create temporary output for thread %d\n", i);
+                exit(1);
+            }
+        }
+
+        workers[i].pctx = pctx;
+        workers[i].handler = handler;
+        workers[i].thread = i;
+    }
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        if ( offsets[i] < offsets[i + 1] )
+        {
+            pthread_create(threads + i, NULL, pass_worker_thread, workers + i);
+        }
+    }
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        if ( offsets[i] < offsets[i + 1] )
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    // reduce in file order, which keeps the output sorted
+
+    char* buf = ctx->write_overlaps ? malloc(PASS_READER_BUFFER) : NULL;
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        PassContext* pctx = workers[i].pctx;
+
+        if (ctx->thread_reduce)
+        {
+            ctx->thread_reduce(ctx->data, pctx->data, i);
+        }
+
+        if (ctx->write_overlaps)
+        {
+            size_t len;
+
+            rewind(pctx->fileOvlOut);
+
+            while ( (len = fread(buf, 1, PASS_READER_BUFFER, pctx->fileOvlOut)) > 0 )
+            {
+                fwrite(buf, 1, len, ctx->fileOvlOut);
+            }
+
+            fclose(pctx->fileOvlOut);
+
+            ctx->novl_out += pctx->novl_out;
+            ctx->novl_out_discarded += pctx->novl_out_discarded;
+        }
+
+        if ( offsets[i] < offsets[i + 1] )
+        {
+            ctx->aread = pctx->aread;
+        }
+
+        free(pctx);
+    }
+
+    free(buf);
+    free(workers);
+    free(threads);
+}
+
+void pass_parallel(PassContext* ctx, pass_handler handler, int nthreads)
+{
+    off_t resume = pass_checkpoint_resume(ctx);
+
+    if (resume >= ctx->sizeOvlIn)
+    {
+        return ;
+    }
+
+    // a restricted pass is split further, unless it is checkpointed or LAZ compressed
+
+    if (nthreads < 2 || (ctx->off_start && (ctx->checkpoint || ctx->is_laz)))
+    {
+        if (resume)
+        {
+            pass_part(ctx, resume, ctx->sizeOvlIn);
+        }
+
+        if (ctx->thread_init)
+        {
+            void* data = ctx->data;
+
+            ctx->data = ctx->thread_init(data, 0);
+            pass(ctx, handler);
+
+            if (ctx->thread_reduce)
+            {
+                ctx->thread_reduce(data, ctx->data, 0);
+            }
+
+            ctx->data = data;
+        }
+        else
+        {
+            pass(ctx, handler);
+        }
+
+        if (resume)
+        {
+            ctx->off_start = ctx->off_end = 0;
+        }
+
+        return ;
+    }
+
+    if (ctx->checkpoint == NULL)
+    {
+        off_t* offsets = pass_partition(ctx, nthreads);
+
+        pass_parallel_run(ctx, handler, offsets, nthreads);
+
+        free(offsets);
+
+        return ;
+    }
+
+    // the outputs are only complete up to a range boundary in between the rounds.
+    // the rounds are cut the same way on resume, ranges are entered at the
+    // checkpoint, which is a pile boundary as well.
+
+    int nparts = nthreads * PASS_CHECKPOINT_ROUNDS;
+    off_t* offsets = pass_partition(ctx, nparts);
+
+    int r;
+    for ( r = 0; r < nparts; r += nthreads )
+    {
+        off_t* round = offsets + r;
+
+        if ( round[nthreads] <= resume )
+        {
+            continue;
+        }
+
+        int i;
+        for ( i = 0; i < nthreads; i++ )
+        {
+            if ( round[i] < resume )
+            {
+                round[i] = resume;
             }
         }
 
-        i += n;
+        pass_parallel_run(ctx, handler, round, nthreads);
+
+        if ( pass_checkpoint_due(ctx->checkpoint) )
+        {
+            pass_checkpoint_pass(ctx, round[nthreads]);
+        }
+    }
+
+    free(offsets);
+}
+
+PassCheckpoint* pass_checkpoint_load(const char* pathOut, FILE* fileOvlIn)
+{
+    PassCheckpoint* ckpt = calloc(1, sizeof(PassCheckpoint));
+    struct stat st;
+
+    if ( fstat(fileno(fileOvlIn), &st) != 0 )
+    {
+        fprintf(stderr, "failed to determine the size of the input\n");
+        exit(1);
+    }
+
+    ckpt->path = malloc( strlen(pathOut) + strlen(PASS_CHECKPOINT_SUFFIX) + 1 );
+    sprintf(ckpt->path, "%s%s", pathOut, PASS_CHECKPOINT_SUFFIX);
+    ckpt->interval = PASS_CHECKPOINT_INTERVAL;
+    ckpt->last = time(NULL);
+    ckpt->size_in = st.st_size;
+    ckpt->aread = -1;
+
+    char* path = ckpt->path;
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        return ckpt;
+    }
+
+    long long size_in, off, novl_out, novl_out_discarded;
+    int nout;
+
+    if ( fscanf(file, "size %lld offset %lld aread %d overlaps %lld %lld outputs %d",
+                &size_in, &off, &(ckpt->aread), &novl_out, &novl_out_discarded, &nout) != 6 || nout < 0 )
+    {
+        fprintf(stderr, "malformed checkpoint %s\n", path);
+        exit(1);
+    }
+
+    if ( size_in != (long long)ckpt->size_in )
+    {
+        fprintf(stderr, "checkpoint %s was taken of a different input\n", path);
+        exit(1);
+    }
+
+    ckpt->off = off;
+    ckpt->novl_out = novl_out;
+    ckpt->novl_out_discarded = novl_out_discarded;
+
+    ckpt->maxout = nout;
+    ckpt->off_out = malloc( sizeof(off_t) * nout );
+    ckpt->out = malloc( sizeof(FILE*) * nout );
+
+    int i;
+    for ( i = 0; i < nout; i++ )
+    {
+        long long size;
+
+        if ( fscanf(file, "%lld", &size) != 1 )
+        {
+            fprintf(stderr, "malformed checkpoint %s\n", path);
+            exit(1);
+        }
+
+        ckpt->off_out[i] = size;
+    }
+
+    fclose(file);
+
+    ckpt->resumed = 1;
+
+    return ckpt;
+}
+
+void pass_checkpoint_output(PassCheckpoint* ckpt, FILE* out)
+{
+    if (ckpt->resumed)
+    {
+        struct stat st;
+
+        if ( ckpt->nout >= ckpt->maxout )
+        {
+            fprintf(stderr, "checkpoint %s has only %d outputs\n", ckpt->path, ckpt->maxout);
+            exit(1);
+        }
+
+        off_t size = ckpt->off_out[ ckpt->nout ];
+
+        // drop whatever was written past the checkpoint
+
+        fflush(out);
+
+        if ( fstat(fileno(out), &st) != 0 || st.st_size < size ||
+             ftruncate(fileno(out), size) != 0 || fseeko(out, size, SEEK_SET) != 0 )
+        {
+            fprintf(stderr, "output %d does not match checkpoint %s\n", ckpt->nout, ckpt->path);
+            exit(1);
+        }
+    }
+    else if ( ckpt->nout >= ckpt->maxout )
+    {
+        ckpt->maxout = ckpt->maxout * 2 + 2;
+        ckpt->out = realloc(ckpt->out, sizeof(FILE*) * ckpt->maxout);
+        ckpt->off_out = realloc(ckpt->off_out, sizeof(off_t) * ckpt->maxout);
+    }
+
+    ckpt->out[ ckpt->nout ] = out;
+    ckpt->nout += 1;
+}
+
+int pass_checkpoint_due(PassCheckpoint* ckpt)
+{
+    return ( time(NULL) - ckpt->last >= ckpt->interval );
+}
+
+void pass_checkpoint_write(PassCheckpoint* ckpt)
+{
+    // the outputs have to be on disk before the checkpoint refers to them
+
+    int i;
+    for ( i = 0; i < ckpt->nout; i++ )
+    {
+        FILE* out = ckpt->out[i];
+
+        fflush(out);
+        fsync(fileno(out));
+
+        ckpt->off_out[i] = ftello(out);
+    }
+
+    char* tmp = malloc( strlen(ckpt->path) + 5 );
+    sprintf(tmp, "%s.tmp", ckpt->path);
+
+    FILE* file = fopen(tmp, "w");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "failed to write checkpoint %s\n", tmp);
+        free(tmp);
+        return ;
+    }
+
+    fprintf(file, "size %lld\noffset %lld\naread %d\noverlaps %lld %lld\noutputs %d\n",
+            (long long)ckpt->size_in, (long long)ckpt->off, ckpt->aread,
+            (long long)ckpt->novl_out, (long long)ckpt->novl_out_discarded, ckpt->nout);
+
+    for ( i = 0; i < ckpt->nout; i++ )
+    {
+        fprintf(file, "%lld\n", (long long)ckpt->off_out[i]);
+    }
+
+    // replace the previous checkpoint only once the new one is complete
+
+    int ok = ( fflush(file) == 0 && fsync(fileno(file)) == 0 );
+
+    if ( fclose(file) != 0 || !ok || rename(tmp, ckpt->path) != 0 )
+    {
+        fprintf(stderr, "failed to write checkpoint %s\n", ckpt->path);
+    }
+
+    free(tmp);
+
+    ckpt->last = time(NULL);
+}
+
+void pass_checkpoint_free(PassCheckpoint* ckpt, int done)
+{
+    if (done)
+    {
+        unlink(ckpt->path);
+    }
+
+    free(ckpt->path);
+    free(ckpt->out);
+    free(ckpt->off_out);
+    free(ckpt);
+}
+
+int pass_split_write(const char* pathSplit, const char* pathLas, PassSplit* parts, int nparts)
+{
+    struct stat st;
+
+    if ( stat(pathLas, &st) != 0 )
+    {
+        fprintf(stderr, "failed to stat %s\n", pathLas);
+        return 1;
+    }
+
+    FILE* file = fopen(pathSplit, "w");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "failed to open %s\n", pathSplit);
+        return 1;
+    }
+
+    fprintf(file, "size %lld mtime %lld parts %d\n", (long long)st.st_size, (long long)st.st_mtime, nparts);
+
+    int i;
+    for ( i = 0; i < nparts; i++ )
+    {
+        PassSplit* part = parts + i;
+
+        fprintf(file, "%lld %lld %llu %llu %d %d\n", (long long)part->beg, (long long)part->end,
+                      (unsigned long long)part->novl, (unsigned long long)part->cost, part->afirst, part->alast);
+    }
+
+    if ( fclose(file) != 0 )
+    {
+        fprintf(stderr, "failed to write %s\n", pathSplit);
+        return 1;
+    }
+
+    return 0;
+}
+
+PassSplit* pass_split_load(const char* pathSplit, FILE* fileOvlIn, int* nparts)
+{
+    struct stat st;
+
+    if ( fstat(fileno(fileOvlIn), &st) != 0 )
+    {
+        fprintf(stderr, "failed to determine the size of the input\n");
+        exit(1);
+    }
+
+    FILE* file = fopen(pathSplit, "r");
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "failed to open %s\n", pathSplit);
+        exit(1);
+    }
+
+    long long size, mtime;
+    int n;
+
+    if ( fscanf(file, "size %lld mtime %lld parts %d", &size, &mtime, &n) != 3 || n < 1 )
+    {
+        fprintf(stderr, "malformed split manifest %s\n", pathSplit);
+        exit(1);
+    }
+
+    if ( size != (long long)st.st_size || mtime != (long long)st.st_mtime )
+    {
+        fprintf(stderr, "split manifest %s was made of a different input\n", pathSplit);
+        exit(1);
+    }
+
+    PassSplit* parts = malloc( sizeof(PassSplit) * n );
+    off_t prev = ovl_header_length();
+
+    int i;
+    for ( i = 0; i < n; i++ )
+    {
+        PassSplit* part = parts + i;
+        long long beg, end;
+        unsigned long long novl, cost;
 
-        if ( !cont || (ctx->off_start && ftello(ctx->fileOvlIn) >= ctx->off_end) || i >= ctx->novl )
+        if ( fscanf(file, "%lld %lld %llu %llu %d %d", &beg, &end, &novl, &cost, &(part->afirst), &(part->alast)) != 6 ||
+             beg != prev || end < beg || end > size )
         {
-            cont = 0;
+            fprintf(stderr, "malformed split manifest %s\n", pathSplit);
+            exit(1);
         }
+
+        part->beg = beg;
+        part->end = prev = end;
+        part->novl = novl;
+        part->cost = cost;
+    }
+
+    fclose(file);
+
+    *nparts = n;
+
+    return parts;
+}
+
+uint64 pass_split_part(PassContext* ctx, const char* spec)
+{
+    char* path = strdup(spec);
+    char* colon = strrchr(path, ':');
+    char* end;
+    int part = 0;
+
+    if (colon != NULL)
+    {
+        *colon = '\0';
+        part = strtol(colon + 1, &end, 10);
+    }
+
+    if (colon == NULL || *end != '\0')
+    {
+        fprintf(stderr, "malformed part %s, expected <manifest>:<part>\n", spec);
+        exit(1);
+    }
+
+    if (ctx->is_laz)
+    {
+        fprintf(stderr, "split manifests cannot be used with LAZ input\n");
+        exit(1);
     }
 
-    free(pOvls);
+    int nparts;
+    PassSplit* parts = pass_split_load(path, ctx->fileOvlIn, &nparts);
+
+    if (part < 1 || part > nparts)
+    {
+        fprintf(stderr, "part %d not in 1..%d of %s\n", part, nparts, path);
+        exit(1);
+    }
+
+    PassSplit* p = parts + (part - 1);
+    uint64 novl = p->novl;
+
+    ctx->off_start = p->beg;
+    ctx->off_end = p->end;
+
+    free(parts);
+    free(path);
+
+    return novl;
 }
 
 int ovl_header_read(FILE* fileOvl, ovl_header_novl* novl, ovl_header_twidth* twidth)
@@ -293,4 +1844,3 @@ void ovl_header_write(FILE* fileOvl, ovl_header_novl novl, ovl_header_twidth twi
     fwrite(&novl, sizeof(ovl_header_novl), 1, fileOvl);
     fwrite(&twidth, sizeof(ovl_header_twidth), 1, fileOvl);
 }
-
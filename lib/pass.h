@@ -2,9 +2,11 @@
 #pragma once
 
 #include <sys/types.h>
+#include <time.h>
 
 #include "db/DB.h"
 #include "dalign/align.h"
+#include "lib/lasidx.h"
 
 #define DB_READ_FLAGS(db, rid) ( (db)->reads[ (rid) ].flags )
 #define DB_READ_LEN(db, rid)   ( (db)->reads[ (rid) ].rlen )
@@ -17,10 +19,70 @@
 
 #define OVERLAP_IO_SIZE     (sizeof(Overlap) - sizeof(void*))
 
+// bytes per trace value of the overlaps passed to the handlers
+
+#define PASS_TRACE_BYTES(ctx)   ( (ctx)->unpack_trace ? sizeof(ovl_trace) : (ctx)->tbytes )
+
 typedef uint64           ovl_header_novl;
 typedef int              ovl_header_twidth;
 typedef uint16           ovl_trace;
 
+typedef int   (*pass_handler)(void*, Overlap*, int);
+
+// pass_parallel() hooks, create the handler data of a worker thread from the
+// user supplied data and merge it back once the thread finished its range
+
+typedef void* (*pass_thread_init)(void*, int);
+typedef void  (*pass_thread_reduce)(void*, void*, int);
+
+// checkpoints of a pass whose results are written to files in input order. the outputs
+// are flushed to disk and their sizes recorded, together with the input offset following
+// the last pile handled, every PASS_CHECKPOINT_INTERVAL seconds. a restarted run
+// truncates the outputs to the recorded sizes and continues from the recorded offset.
+
+#define PASS_CHECKPOINT_INTERVAL   300
+#define PASS_CHECKPOINT_SUFFIX     ".ckpt"
+
+typedef struct
+{
+    char* path;
+    int interval;                       // seconds between checkpoints
+    time_t last;                        // time of the last one
+
+    int resumed;                        // the fields below were loaded from path
+
+    off_t size_in;                      // size of the input
+    off_t off;                          // input offset following the last pile handled
+    int aread;                          // A-read of the last pile handled
+
+    ovl_header_novl novl_out;
+    ovl_header_novl novl_out_discarded;
+
+    FILE** out;                         // outputs, in the order they were registered
+    off_t* off_out;                     // and their sizes
+    int nout;
+    int maxout;
+} PassCheckpoint;
+
+// manifest of an overlap file cut into parts at A-read boundaries, written by LAsplit -m.
+// instead of being copied into a file of its own a part is passed by restricting the pass
+// over the whole file to its range with pass_split_part(). the manifest records the size
+// and mtime of the file it was made of.
+
+#define PASS_SPLIT_SUFFIX   ".split"
+
+typedef struct
+{
+    off_t beg;                          // range of the part in the file
+    off_t end;
+
+    uint64 novl;
+    uint64 cost;                        // see lasidx_cost()
+
+    int afirst;                         // A-reads of its piles, afirst > alast for an empty part
+    int alast;
+} PassSplit;
+
 typedef struct
 {
     // overlaps and trace
@@ -41,16 +103,15 @@ typedef struct
     off_t off_start;
     off_t off_end;
 
-    int tmax;
-    int tcur;
-    ovl_trace* trace;
-
     size_t tbytes;
 
     // user supplied data
 
     void* data;
 
+    pass_thread_init thread_init;
+    pass_thread_reduce thread_reduce;
+
     // pass settings
 
     int split_b;
@@ -60,15 +121,93 @@ typedef struct
     int write_overlaps;
     int purge_discarded;
 
+    int npile;                          // size of the current pile, handlers can lower it to drop the overlaps past it
+
+    int use_mmap;                       // read through a private mapping of the input, traces point into it
+    int read_ahead;                     // decode the following piles in a background thread
+
+    int is_laz;                         // input is LAZ compressed
+
+    lasidx* index;                      // optional, lets pass_partition() split without scanning the input
+
+    PassCheckpoint* checkpoint;         // optional, see pass_checkpoint_load()
+    int aread;                          // A-read of the last pile handled
+
     int progress;
 
 } PassContext;
 
-typedef int (*pass_handler)(void*, Overlap*, int);
-
 PassContext* pass_init(FILE* fileOvlIn, FILE* fileOvlOut);
 
 void pass(PassContext* ctx, pass_handler handler);
+
+// restricts the following pass() to [start, end), which has to be cut at A-read boundaries.
+// the part is read with pread() instead of the stream of fileOvlIn, so passes over different
+// parts can run concurrently.
+
+void pass_part(PassContext* ctx, off_t start, off_t end);
+
+// runs the handler on the piles of the A-reads in the sorted, disjoint and inclusive ranges
+// pts[0]..pts[1], pts[2]..pts[3], ... by seeking to them through the index. without an index
+// (or for LAZ input) the whole input is passed and the handler has to skip the other piles.
+
+void pass_ranges(PassContext* ctx, pass_handler handler, int* pts, int npts);
+
+// splits the input at A-read boundaries into nthreads ranges of similar size and
+// runs the handler on each of them concurrently. thread_reduce is called in file order.
+// with a checkpoint the ranges are handled in rounds, which are checkpointed in between.
+
+void pass_parallel(PassContext* ctx, pass_handler handler, int nthreads);
+off_t* pass_partition(PassContext* ctx, int parts);
+
+// offsets of the first piles of the A-reads >= areads[0] < areads[1] < ... < areads[n-1] and
+// the end of the input in offsets[n], as pass_partition() cuts it. not for LAZ input.
+
+off_t* pass_partition_piles(PassContext* ctx, int* areads, int n);
+
+// loads the checkpoint kept next to the (first) output, if there is one. the outputs have
+// to be opened for writing without truncating them when it is resumed. exits if the
+// checkpoint was not taken of the same input.
+
+PassCheckpoint* pass_checkpoint_load(const char* pathOut, FILE* fileOvlIn);
+
+// adds an output, truncating it to its recorded size when resuming
+
+void pass_checkpoint_output(PassCheckpoint* ckpt, FILE* out);
+
+// pass_parallel() checkpoints by itself. callers writing the output of their own
+// passes in order restore the checkpoint of the context with pass_checkpoint_resume(),
+// which returns the offset to continue from (0 for none), and record the offset following
+// the output completed with pass_checkpoint_pass() once pass_checkpoint_due().
+// without a context off and aread of the checkpoint are set before pass_checkpoint_write().
+
+off_t pass_checkpoint_resume(PassContext* ctx);
+void pass_checkpoint_pass(PassContext* ctx, off_t off);
+
+int pass_checkpoint_due(PassCheckpoint* ckpt);
+void pass_checkpoint_write(PassCheckpoint* ckpt);
+
+// done removes the checkpoint, call it once the outputs are complete
+
+void pass_checkpoint_free(PassCheckpoint* ckpt, int done);
+
+// returns 0 on success
+
+int pass_split_write(const char* pathSplit, const char* pathLas, PassSplit* parts, int nparts);
+
+// loads the manifest, exits if it is malformed or was not made of fileOvlIn
+
+PassSplit* pass_split_load(const char* pathSplit, FILE* fileOvlIn, int* nparts);
+
+// restricts the following passes to the part given as <manifest>:<part>, with parts counted
+// from 1 like the files of LAsplit. returns the number of overlaps of the part, an empty part
+// has a zero length range which is not passed at all.
+
+uint64 pass_split_part(PassContext* ctx, const char* spec);
+
+// file offset of the first overlap
+
+off_t pass_data_start(PassContext* ctx);
 void pass_free(PassContext* ctx);
 
 void read_unpacked_trace(FILE* fileOvl, Overlap* ovl, size_t tbytes);
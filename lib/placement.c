@@ -0,0 +1,212 @@
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "placement.h"
+
+#define PLACEMENT_MAX_NODES 64
+
+static struct
+{
+    pthread_once_t once;
+
+    int nnodes;
+    int id[PLACEMENT_MAX_NODES];        // node ids, they need not be consecutive
+    int* cpus[PLACEMENT_MAX_NODES];
+    int ncpus[PLACEMENT_MAX_NODES];
+} Placement = { PTHREAD_ONCE_INIT, 0, { 0 }, { NULL }, { 0 } };
+
+#if defined(__linux__)
+
+// cpus of the list (e.g. 0-15,32-47) the process is allowed to run on
+
+static int parse_cpulist(FILE* file, cpu_set_t* allowed, int** _cpus)
+{
+    int* cpus = NULL;
+    int ncpus = 0;
+    int maxcpus = 0;
+    int beg, end, c;
+
+    while ( fscanf(file, "%d", &beg) == 1 )
+    {
+        end = beg;
+
+        c = fgetc(file);
+
+        if (c == '-')
+        {
+            if ( fscanf(file, "%d", &end) != 1 )
+            {
+                break;
+            }
+
+            c = fgetc(file);
+        }
+
+        for ( ; beg <= end ; beg++ )
+        {
+            if ( beg >= CPU_SETSIZE || !CPU_ISSET(beg, allowed) )
+            {
+                continue;
+            }
+
+            if (ncpus == maxcpus)
+            {
+                maxcpus = maxcpus * 2 + 16;
+                cpus = realloc(cpus, sizeof(int) * maxcpus);
+            }
+
+            cpus[ncpus++] = beg;
+        }
+
+        if (c != ',')
+        {
+            break;
+        }
+    }
+
+    *_cpus = cpus;
+
+    return ncpus;
+}
+
+#endif
+
+static void placement_init()
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    char path[128];
+    int node;
+
+    if ( sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0 )
+    {
+        return ;
+    }
+
+    for (node = 0; node < PLACEMENT_MAX_NODES; node++)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        FILE* file = fopen(path, "r");
+
+        if (file == NULL)
+        {
+            continue;
+        }
+
+        int* cpus;
+        int ncpus = parse_cpulist(file, &allowed, &cpus);
+
+        fclose(file);
+
+        if (ncpus == 0)
+        {
+            free(cpus);
+            continue;
+        }
+
+        Placement.id[Placement.nnodes] = node;
+        Placement.cpus[Placement.nnodes] = cpus;
+        Placement.ncpus[Placement.nnodes] = ncpus;
+        Placement.nnodes += 1;
+    }
+
+    // without a complete topology treat the allowed cpus as a single node
+
+    int ncpus = 0;
+
+    for (node = 0; node < Placement.nnodes; node++)
+    {
+        ncpus += Placement.ncpus[node];
+    }
+
+    if ( ncpus < CPU_COUNT(&allowed) )
+    {
+        int cpu;
+
+        for (node = 0; node < Placement.nnodes; node++)
+        {
+            free(Placement.cpus[node]);
+        }
+
+        Placement.nnodes = 1;
+        Placement.id[0] = 0;
+        Placement.ncpus[0] = 0;
+        Placement.cpus[0] = malloc( sizeof(int) * CPU_COUNT(&allowed) );
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if ( CPU_ISSET(cpu, &allowed) )
+            {
+                Placement.cpus[0][ Placement.ncpus[0]++ ] = cpu;
+            }
+        }
+    }
+#endif
+}
+
+int placement_nodes()
+{
+    pthread_once(&Placement.once, placement_init);
+
+    return Placement.nnodes;
+}
+
+void placement_pin(int tid)
+{
+    if ( placement_nodes() == 0 || tid < 0 )
+    {
+        return ;
+    }
+
+#if defined(__linux__)
+    int n = tid % Placement.nnodes;
+    int cpu = Placement.cpus[n][ ( tid / Placement.nnodes ) % Placement.ncpus[n] ];
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif
+}
+
+void placement_interleave(void* addr, size_t len)
+{
+    if ( placement_nodes() < 2 || addr == NULL || len == 0 )
+    {
+        return ;
+    }
+
+#if defined(__linux__)
+    unsigned long mask = 0;
+    int i;
+
+    for (i = 0; i < Placement.nnodes; i++)
+    {
+        mask |= 1lu << Placement.id[i];
+    }
+
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t beg = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+
+    // best effort, the policy might not be permitted in containers
+
+    syscall(SYS_mbind, (void*)beg, end - beg, MPOL_INTERLEAVE, &mask, PLACEMENT_MAX_NODES + 1, MPOL_MF_MOVE);
+#endif
+}
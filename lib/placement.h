@@ -0,0 +1,22 @@
+
+#pragma once
+
+#include <stddef.h>
+
+// thread and memory placement on NUMA machines. the nodes and their cpus are
+// taken from /sys, limited to the cpus the process may run on. on machines
+// with a single node, or other systems than linux, the calls do nothing.
+
+// number of nodes with usable cpus
+
+int placement_nodes();
+
+// pins the calling thread to a single cpu. consecutive ids are spread round
+// robin over the nodes, so that n threads use the memory bandwidth of all of them
+
+void placement_pin(int tid);
+
+// spreads the pages of the range over all nodes. pages already in memory are
+// migrated, hence it is cheapest to call before the range is first written
+
+void placement_interleave(void* addr, size_t len);
@@ -0,0 +1,267 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "read_cache.h"
+#include "dalign/align.h"
+
+#define RC_READ_PAD     16          // slack after the terminator for word wise access
+
+static Read_Cache_Shard* rc_shard(Read_Cache* rc, int rid)
+{
+    return rc->shards + (rid % rc->nshards);
+}
+
+static int rc_bucket(Read_Cache* rc, Read_Cache_Shard* shard, int rid, int comp)
+{
+    return ( (rid / rc->nshards) * 2 + comp ) & (shard->nbuckets - 1);
+}
+
+static size_t rc_entry_size(Read_Cache* rc, int rid)
+{
+    return sizeof(Read_Cache_Entry) + rc->db->reads[rid].rlen + RC_READ_PAD;
+}
+
+static void lru_unlink(Read_Cache_Entry* entry)
+{
+    entry->lru_prev->lru_next = entry->lru_next;
+    entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void lru_push(Read_Cache_Shard* shard, Read_Cache_Entry* entry)
+{
+    entry->lru_prev = &(shard->lru);
+    entry->lru_next = shard->lru.lru_next;
+
+    shard->lru.lru_next->lru_prev = entry;
+    shard->lru.lru_next = entry;
+}
+
+static void rc_grow(Read_Cache* rc, Read_Cache_Shard* shard)
+{
+    int nbuckets = shard->nbuckets * 2;
+    Read_Cache_Entry** buckets = calloc(nbuckets, sizeof(Read_Cache_Entry*));
+    int i;
+
+    Read_Cache_Entry** old = shard->buckets;
+    int nold = shard->nbuckets;
+
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+
+    for ( i = 0 ; i < nold ; i++ )
+    {
+        Read_Cache_Entry* entry = old[i];
+
+        while ( entry != NULL )
+        {
+            Read_Cache_Entry* next = entry->next;
+            int b = rc_bucket(rc, shard, entry->rid, entry->comp);
+
+            entry->next = buckets[b];
+            buckets[b] = entry;
+
+            entry = next;
+        }
+    }
+
+    free(old);
+}
+
+// drop least recently used reads that are not pinned until the shard fits
+
+static void rc_evict(Read_Cache* rc, Read_Cache_Shard* shard)
+{
+    while ( shard->mem > shard->max_mem && shard->lru.lru_prev != &(shard->lru) )
+    {
+        Read_Cache_Entry* entry = shard->lru.lru_prev;
+        Read_Cache_Entry** link = shard->buckets + rc_bucket(rc, shard, entry->rid, entry->comp);
+
+        while ( *link != entry )
+        {
+            link = &((*link)->next);
+        }
+
+        *link = entry->next;
+
+        lru_unlink(entry);
+
+        shard->mem -= rc_entry_size(rc, entry->rid);
+        shard->nentries -= 1;
+
+        free(entry);
+    }
+}
+
+Read_Cache* rc_init(HITS_DB* db, size_t max_mem, int nshards)
+{
+    assert( db->loaded == DB_BASES_MAPPED );
+
+    Read_Cache* rc = malloc(sizeof(Read_Cache));
+    int i;
+
+    if ( nshards < 1 )
+    {
+        nshards = 1;
+    }
+
+    rc->db = db;
+    rc->nshards = nshards;
+    rc->shards = malloc(sizeof(Read_Cache_Shard) * nshards);
+
+    for ( i = 0 ; i < nshards ; i++ )
+    {
+        Read_Cache_Shard* shard = rc->shards + i;
+
+        pthread_mutex_init(&(shard->lock), NULL);
+
+        shard->nbuckets = 1024;
+        shard->buckets = calloc(shard->nbuckets, sizeof(Read_Cache_Entry*));
+        shard->nentries = 0;
+
+        shard->lru.lru_prev = shard->lru.lru_next = &(shard->lru);
+
+        shard->mem = 0;
+        shard->max_mem = max_mem / nshards;
+
+        shard->hits = shard->misses = 0;
+    }
+
+    return rc;
+}
+
+void rc_free(Read_Cache* rc)
+{
+    int i, b;
+
+    for ( i = 0 ; i < rc->nshards ; i++ )
+    {
+        Read_Cache_Shard* shard = rc->shards + i;
+
+        for ( b = 0 ; b < shard->nbuckets ; b++ )
+        {
+            Read_Cache_Entry* entry = shard->buckets[b];
+
+            while ( entry != NULL )
+            {
+                Read_Cache_Entry* next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+
+        free(shard->buckets);
+        pthread_mutex_destroy(&(shard->lock));
+    }
+
+    free(rc->shards);
+    free(rc);
+}
+
+Read_Cache_Entry* rc_get(Read_Cache* rc, int rid, int comp)
+{
+    Read_Cache_Shard* shard = rc_shard(rc, rid);
+    Read_Cache_Entry* entry;
+
+    comp = (comp != 0);
+
+    pthread_mutex_lock(&(shard->lock));
+
+    entry = shard->buckets[ rc_bucket(rc, shard, rid, comp) ];
+
+    while ( entry != NULL && ( entry->rid != rid || entry->comp != comp ) )
+    {
+        entry = entry->next;
+    }
+
+    if ( entry != NULL )
+    {
+        if ( entry->nrefs == 0 )
+        {
+            lru_unlink(entry);
+        }
+
+        entry->nrefs += 1;
+        shard->hits += 1;
+
+        pthread_mutex_unlock(&(shard->lock));
+
+        return entry;
+    }
+
+    // unpacking from the mapped bases is cheap enough to do under the lock
+
+    int len = rc->db->reads[rid].rlen;
+
+    entry = malloc( rc_entry_size(rc, rid) );
+    entry->seq = (char*)(entry + 1) + 1;
+    entry->rid = rid;
+    entry->comp = comp;
+    entry->nrefs = 1;
+
+    Load_Read(rc->db, rid, entry->seq, 0);
+
+    if ( comp )
+    {
+        Complement_Seq(entry->seq, len);
+    }
+
+    int b = rc_bucket(rc, shard, rid, comp);
+    entry->next = shard->buckets[b];
+    shard->buckets[b] = entry;
+
+    shard->nentries += 1;
+    shard->mem += rc_entry_size(rc, rid);
+    shard->misses += 1;
+
+    if ( shard->nentries > shard->nbuckets )
+    {
+        rc_grow(rc, shard);
+    }
+
+    rc_evict(rc, shard);
+
+    pthread_mutex_unlock(&(shard->lock));
+
+    return entry;
+}
+
+void rc_release(Read_Cache* rc, Read_Cache_Entry* entry)
+{
+    Read_Cache_Shard* shard = rc_shard(rc, entry->rid);
+
+    pthread_mutex_lock(&(shard->lock));
+
+    assert( entry->nrefs > 0 );
+
+    entry->nrefs -= 1;
+
+    if ( entry->nrefs == 0 )
+    {
+        lru_push(shard, entry);
+        rc_evict(rc, shard);
+    }
+
+    pthread_mutex_unlock(&(shard->lock));
+}
+
+void rc_stats(Read_Cache* rc, uint64* hits, uint64* misses)
+{
+    int i;
+
+    *hits = *misses = 0;
+
+    for ( i = 0 ; i < rc->nshards ; i++ )
+    {
+        Read_Cache_Shard* shard = rc->shards + i;
+
+        pthread_mutex_lock(&(shard->lock));
+
+        *hits += shard->hits;
+        *misses += shard->misses;
+
+        pthread_mutex_unlock(&(shard->lock));
+    }
+}
@@ -0,0 +1,63 @@
+
+#pragma once
+
+#include <pthread.h>
+
+#include "db/DB.h"
+
+// thread safe, size bounded cache of unpacked reads shared by threads working
+// on the same database. reads are kept in forward or complemented orientation
+// and are pinned while in use. the cache is split into shards by read id, each
+// with its own lock and least recently used list of the unpinned reads.
+// the bases of the database must be mapped (Map_Bases)
+
+typedef struct _Read_Cache_Entry Read_Cache_Entry;
+
+struct _Read_Cache_Entry
+{
+    char* seq;              // numeric bases with the terminator 4 at seq[-1] and seq[len]
+    int rid;
+    int comp;
+    int nrefs;
+
+    Read_Cache_Entry* next;         // hash chain
+    Read_Cache_Entry* lru_prev;     // position in the shard's lru list (unpinned only)
+    Read_Cache_Entry* lru_next;
+};
+
+typedef struct
+{
+    pthread_mutex_t lock;
+
+    Read_Cache_Entry** buckets;
+    int nbuckets;
+    int nentries;
+
+    Read_Cache_Entry lru;       // sentinel, lru.lru_next is the most recently released
+
+    size_t mem;
+    size_t max_mem;
+
+    uint64 hits;
+    uint64 misses;
+} Read_Cache_Shard;
+
+typedef struct
+{
+    HITS_DB* db;
+
+    Read_Cache_Shard* shards;
+    int nshards;
+} Read_Cache;
+
+Read_Cache* rc_init(HITS_DB* db, size_t max_mem, int nshards);
+
+void rc_free(Read_Cache* rc);
+
+// returns the pinned read, which stays valid until it is released
+
+Read_Cache_Entry* rc_get(Read_Cache* rc, int rid, int comp);
+
+void rc_release(Read_Cache* rc, Read_Cache_Entry* entry);
+
+void rc_stats(Read_Cache* rc, uint64* hits, uint64* misses);
@@ -1,11 +1,44 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "read_loader.h"
+#include "bulkio.h"
 
-#define BLOCK_BUFFER (10*1024*1024)
+#define BLOCK_BUFFER (10*1024*1024)     // largest range fetched with a single pread
+
+#define RL_MAX_GAP   (64*1024)          // reads closer than this share a range
+
+#define RL_THREADS   4
+
+#define RL_BATCH     64                 // ranges read together by a fetch thread
+
+// consecutive read ids rids[first..last) fetched as the bytes [beg, end) of the .bps
+
+typedef struct
+{
+    off_t beg;
+    off_t end;
+    int first;
+    int last;
+    int gaps;           // bytes of reads that were not requested lie in the range
+} Rl_Range;
+
+typedef struct
+{
+    Read_Loader* rl;
+    int fd;
+    int* rids;
+    Rl_Range* ranges;
+    int nranges;
+    int tid;
+    int nthreads;
+} Rl_Fetch_Arg;
 
 
 Read_Loader* rl_init(HITS_DB* db, size_t max_mem)
@@ -25,6 +58,22 @@ Read_Loader* rl_init(HITS_DB* db, size_t max_mem)
     rl->currid = 0;
     rl->nrid = 0;
 
+    rl->nthreads = RL_THREADS;
+
+    rl->pile_aread = NULL;
+    rl->pile_first = NULL;
+    rl->npile = 0;
+    rl->maxpile = 0;
+
+    rl->win_first = NULL;
+    rl->win_aread = NULL;
+    rl->nwin = 0;
+
+    rl->loaded = NULL;
+    rl->nloaded = 0;
+
+    rl->nbytes = 0;
+
     return rl;
 }
 
@@ -45,6 +94,7 @@ void rl_load_added(Read_Loader* rl)
     rl_load(rl, rl->rid, rl->currid);
 
     free(rl->rid);
+    rl->rid = NULL;
     rl->currid = 0;
     rl->nrid = 0;
 }
@@ -71,100 +121,465 @@ static int unique(int* a, int len)
     return j+1;
 }
 
-void rl_load(Read_Loader* rl, int* rids, int nrids)
+// fetch the ranges tid, tid + nthreads, ... of the sorted read ids. the ranges
+// are read in batches, whose requests are in flight together.
+
+static void* rl_fetch_thread(void* arg)
 {
-    HITS_DB* db = rl->db;
+    Rl_Fetch_Arg* fa = (Rl_Fetch_Arg*)arg;
+    Read_Loader* rl = fa->rl;
+    HITS_READ* reads = rl->db->reads;
+    int* rids = fa->rids;
+
+    char* buffer = NULL;
+    size_t nbuffer = 0;
+    bio_req reqs[ RL_BATCH ];
+    int batch[ RL_BATCH ];
+    int r = fa->tid;
+
+    while (r < fa->nranges)
+    {
+        int n = 0;
+        size_t gaps = 0;
+
+        // ranges with gaps are read into the buffer and copied from there,
+        // the others go straight into the read storage
+
+        for ( ; r < fa->nranges && n < RL_BATCH; r += fa->nthreads)
+        {
+            Rl_Range* range = fa->ranges + r;
+            size_t len = range->end - range->beg;
+
+            if (range->gaps)
+            {
+                if (n > 0 && gaps + len > BLOCK_BUFFER)
+                {
+                    break;
+                }
+
+                gaps += len;
+            }
+
+            batch[n] = r;
+            reqs[n].len = len;
+            reqs[n].off = range->beg;
+            n++;
+        }
+
+        if (gaps > nbuffer)
+        {
+            nbuffer = gaps;
+            buffer = realloc(buffer, nbuffer);
+
+            if (buffer == NULL)
+            {
+                fprintf(stderr, "failed to allocate read buffer\n");
+                exit(1);
+            }
+        }
+
+        int i;
+        size_t boff = 0;
+
+        for (i = 0; i < n; i++)
+        {
+            Rl_Range* range = fa->ranges + batch[i];
+
+            if (range->gaps)
+            {
+                reqs[i].buf = buffer + boff;
+                boff += reqs[i].len;
+            }
+            else
+            {
+                reqs[i].buf = rl->index[ rids[range->first] ];
+            }
+        }
+
+        if ( bio_read(fa->fd, reqs, n) != 0 )
+        {
+            fprintf(stderr, "failed to read bases file\n");
+            exit(1);
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            Rl_Range* range = fa->ranges + batch[i];
+            char* data = reqs[i].buf;
+            int j;
+
+            if (!range->gaps)
+            {
+                continue;
+            }
+
+            for (j = range->first; j < range->last; j++)
+            {
+                int rid = rids[j];
+
+                memcpy(rl->index[rid], data + (reads[rid].boff - range->beg), COMPRESSED_LEN(reads[rid].rlen));
+            }
+        }
+    }
+
+    free(buffer);
+
+    return NULL;
+}
+
+// fetches the sorted, unique reads rids into the storage at base, which has room for them
 
-    FILE* bases = db->bases;
-    uint64 nreads = db->nreads;
+static void rl_fetch(Read_Loader* rl, int* rids, int nrids, char* base)
+{
+    HITS_DB* db = rl->db;
     HITS_READ* reads = db->reads;
+    int i;
+
+    if (nrids == 0)
+    {
+        return ;
+    }
+
+    // storage for the reads in id order, and coalesce them into ranges of the file
+
+    Rl_Range* ranges = malloc(sizeof(Rl_Range) * nrids);
+    int nranges = 0;
+    uint64 curreads = 0;
+
+    for (i = 0; i < nrids; i++)
+    {
+        int rid = rids[i];
+        off_t beg = reads[rid].boff;
+        off_t end = beg + COMPRESSED_LEN(reads[rid].rlen);
+
+        rl->index[rid] = base + curreads;
+        curreads += end - beg;
+
+        if (nranges > 0)
+        {
+            Rl_Range* range = ranges + nranges - 1;
+
+            if ( beg >= range->end && beg - range->end <= RL_MAX_GAP && end - range->beg <= BLOCK_BUFFER )
+            {
+                if (beg > range->end)
+                {
+                    range->gaps = 1;
+                }
+
+                range->end = end;
+                range->last = i + 1;
+
+                continue;
+            }
+        }
+
+        ranges[nranges].beg = beg;
+        ranges[nranges].end = end;
+        ranges[nranges].first = i;
+        ranges[nranges].last = i + 1;
+        ranges[nranges].gaps = 0;
+        nranges++;
+    }
+
+    int fd = open(Catenate(db->path, "", "", ".bps"), O_RDONLY);
+
+    if (fd == -1)
+    {
+        fprintf(stderr, "failed to open bases file\n");
+        exit(1);
+    }
+
+    int nthreads = rl->nthreads;
+
+    if (nthreads > nranges)
+    {
+        nthreads = nranges;
+    }
 
-    if (bases)
+    if (nthreads < 1)
     {
-        rewind(bases);
+        nthreads = 1;
+    }
+
+    Rl_Fetch_Arg* args = malloc(sizeof(Rl_Fetch_Arg) * nthreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        args[i].rl = rl;
+        args[i].fd = fd;
+        args[i].rids = rids;
+        args[i].ranges = ranges;
+        args[i].nranges = nranges;
+        args[i].tid = i;
+        args[i].nthreads = nthreads;
+    }
+
+    if (nthreads == 1)
+    {
+        rl_fetch_thread(args);
     }
     else
     {
-        db->bases = bases = fopen(Catenate(db->path, "", "", ".bps"), "r");
+        for (i = 0; i < nthreads; i++)
+        {
+            pthread_create(threads + i, NULL, rl_fetch_thread, args + i);
+        }
+
+        for (i = 0; i < nthreads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    close(fd);
+
+    free(threads);
+    free(args);
+    free(ranges);
+}
+
+// makes room for len bytes of reads, keeping the contents of the storage
+
+static void rl_reserve(Read_Loader* rl, uint64 len, int nreads)
+{
+    if (len > rl->maxreads)
+    {
+        rl->maxreads = len + 10*1000;
+        rl->reads = (char*)realloc(rl->reads, rl->maxreads);
+
+        if (rl->reads == NULL)
+        {
+            fprintf(stderr, "failed to allocate %llu bytes for %d reads\n", rl->maxreads, nreads);
+            exit(1);
+        }
     }
+}
+
+void rl_load(Read_Loader* rl, int* rids, int nrids)
+{
+    HITS_DB* db = rl->db;
+    HITS_READ* reads = db->reads;
+    int i;
 
-    rewind(bases);
+    bzero(rl->index, sizeof(char*) * db->nreads);
+    rl->nloaded = 0;
+    rl->nbytes = 0;
+
+    if (nrids == 0)
+    {
+        return ;
+    }
 
     qsort(rids, nrids, sizeof(int), cmp_rids);
     nrids = unique(rids, nrids);
 
     uint64 totallen = 0;
-    int i;
+
     for (i = 0; i < nrids; i++)
     {
-        totallen += reads[i].rlen;
+        totallen += COMPRESSED_LEN(reads[ rids[i] ].rlen);
     }
 
-    // printf("%llu bytes needed for %d reads\n", totallen, nrids);
+    rl_reserve(rl, totallen, nrids);
+
+    rl_fetch(rl, rids, nrids, rl->reads);
+
+    rl->nbytes = totallen;
+}
 
-    if (totallen > rl->maxreads)
+void rl_pile(Read_Loader* rl, int aread)
+{
+    if (rl->npile > 0 && rl->pile_aread[ rl->npile - 1 ] == aread)
     {
-        rl->maxreads = totallen + 10*1000;
-        rl->reads = (char*)realloc(rl->reads, rl->maxreads);
+        return ;
     }
 
-    int nbuf = BLOCK_BUFFER;
-    char* buffer = malloc(nbuf);
+    assert(rl->npile == 0 || rl->pile_aread[ rl->npile - 1 ] < aread);
 
-    // uint64 rb = 0;
-    uint64 re = 0;
-    off_t offb = 0;
-    off_t offe = 0;
-    int currid = 0;
-    uint64 curreads = 0;
+    if (rl->npile + 1 >= rl->maxpile)
+    {
+        rl->maxpile = rl->maxpile * 1.2 + 1000;
+        rl->pile_aread = (int*)realloc(rl->pile_aread, sizeof(int) * rl->maxpile);
+        rl->pile_first = (int*)realloc(rl->pile_first, sizeof(int) * (rl->maxpile + 1));
+    }
+
+    rl->pile_aread[ rl->npile ] = aread;
+    rl->pile_first[ rl->npile ] = rl->currid;
+    rl->npile++;
+}
+
+int rl_windows(Read_Loader* rl, int** areads)
+{
+    HITS_READ* reads = rl->db->reads;
+    int* seen = (int*)malloc(sizeof(int) * rl->db->nreads);
+    int p, i, n;
+
+    // the reads added before the first pile are not referenced by any
 
-    while (re < nreads && currid < nrids)
+    if (rl->npile == 0)
     {
-        while (offe - offb < nbuf && re < nreads)
+        rl_pile(rl, 0);
+    }
+
+    rl->pile_first[ rl->npile ] = rl->currid;
+
+    // sort and unique the reads of each pile, compacting the list
+
+    n = 0;
+
+    for (p = 0; p < rl->npile; p++)
+    {
+        int first = rl->pile_first[p];
+        int len = rl->pile_first[p + 1] - first;
+
+        rl->pile_first[p] = n;
+
+        if (len == 0)
         {
-            offe = reads[re].boff;
-            re++;
+            continue;
         }
 
-        while (offe - offb > nbuf)
+        qsort(rl->rid + first, len, sizeof(int), cmp_rids);
+        len = unique(rl->rid + first, len);
+
+        memmove(rl->rid + n, rl->rid + first, sizeof(int) * len);
+        n += len;
+    }
+
+    rl->pile_first[ rl->npile ] = n;
+    rl->currid = n;
+
+    // greedily extend each window by the following piles as long as its reads fit
+
+    rl->win_first = (int*)realloc(rl->win_first, sizeof(int) * (rl->npile + 1));
+    rl->win_aread = (int*)realloc(rl->win_aread, sizeof(int) * (rl->npile + 1));
+    rl->nwin = 0;
+
+    memset(seen, -1, sizeof(int) * rl->db->nreads);
+
+    uint64 size = 0;
+
+    for (p = 0; p < rl->npile; p++)
+    {
+        uint64 psize = 0;
+
+        for (i = rl->pile_first[p]; i < rl->pile_first[p + 1]; i++)
         {
-            re--;
-            offe = reads[re].boff;
+            if (seen[ rl->rid[i] ] != rl->nwin - 1)
+            {
+                psize += COMPRESSED_LEN( reads[ rl->rid[i] ].rlen );
+            }
         }
 
-        //printf("reading from %'llu..%'llu %'llu..%'llu\n", rb, re, offb, offe);
+        if (rl->nwin == 0 || (rl->max_mem > 0 && size + psize > rl->max_mem))
+        {
+            rl->win_first[ rl->nwin ] = p;
+            rl->win_aread[ rl->nwin ] = rl->pile_aread[p];
+            rl->nwin++;
 
-        fseeko(bases, offb, SEEK_SET);
+            size = 0;
+        }
 
-        if (fread(buffer, offe - offb, 1, bases) != 1)
+        for (i = rl->pile_first[p]; i < rl->pile_first[p + 1]; i++)
         {
-            fprintf(stderr, "failed to read bases file\n");
-            exit(1);
+            if (seen[ rl->rid[i] ] != rl->nwin - 1)
+            {
+                seen[ rl->rid[i] ] = rl->nwin - 1;
+                size += COMPRESSED_LEN( reads[ rl->rid[i] ].rlen );
+            }
         }
+    }
+
+    rl->win_first[ rl->nwin ] = rl->npile;
+
+    free(seen);
+
+    *areads = rl->win_aread;
+
+    return rl->nwin;
+}
+
+void rl_window(Read_Loader* rl, int w)
+{
+    HITS_READ* reads = rl->db->reads;
+    int first = rl->pile_first[ rl->win_first[w] ];
+    int last = rl->pile_first[ rl->win_first[w + 1] ];
+    int i, n;
+
+    assert(w >= 0 && w < rl->nwin);
+
+    int* rids = (int*)malloc(sizeof(int) * (last - first + 1));
+
+    memcpy(rids, rl->rid + first, sizeof(int) * (last - first));
+    qsort(rids, last - first, sizeof(int), cmp_rids);
+    n = (last > first) ? unique(rids, last - first) : 0;
+
+    // move the reads still referenced to the front of the storage, in their order there
 
-        while ( currid < nrids && (uint64)rids[currid] < re )
+    uint64 kept = 0;
+    int nkept = 0;
+
+    for (i = 0; i < rl->nloaded; i++)
+    {
+        int rid = rl->loaded[i];
+        int len = COMPRESSED_LEN( reads[rid].rlen );
+
+        if (bsearch(&rid, rids, n, sizeof(int), cmp_rids) == NULL)
         {
-            int rid = rids[currid];
+            rl->index[rid] = NULL;
+            continue;
+        }
+
+        memmove(rl->reads + kept, rl->index[rid], len);
+        rl->loaded[ nkept++ ] = rid;
+        kept += len;
+    }
 
-            int len = reads[rid].rlen;
-            int clen = COMPRESSED_LEN(len);
+    // the reads not held yet are appended
 
-            /*
-            printf("  %'8d @ %'8lld %'8lld %d %d\n",
-                    rid, reads[rid].boff, reads[rid].boff - offb,
-                    curreads, clen);
-            */
+    int nnew = 0;
+    uint64 added = 0;
 
-            memcpy(rl->reads + curreads, buffer + (reads[rid].boff - offb), clen);
-            rl->index[rid] = rl->reads + curreads;
-            curreads += clen;
+    for (i = 0; i < n; i++)
+    {
+        int rid = rids[i];
 
-            currid++;
+        if (rl->index[rid] != NULL)
+        {
+            continue;
         }
 
-        // rb = re;
-        offb = offe;
+        rids[ nnew++ ] = rid;
+        added += COMPRESSED_LEN( reads[rid].rlen );
     }
+
+    rl_reserve(rl, kept + added, nkept + nnew);
+
+    rl->loaded = (int*)realloc(rl->loaded, sizeof(int) * (nkept + nnew + 1));
+
+    uint64 off = 0;
+
+    for (i = 0; i < nkept; i++)
+    {
+        int rid = rl->loaded[i];
+
+        rl->index[rid] = rl->reads + off;
+        off += COMPRESSED_LEN( reads[rid].rlen );
+    }
+
+    rl_fetch(rl, rids, nnew, rl->reads + kept);
+
+    memcpy(rl->loaded + nkept, rids, sizeof(int) * nnew);
+    rl->nloaded = nkept + nnew;
+    rl->nbytes = kept + added;
+
+    free(rids);
+}
+
+uint64 rl_size(Read_Loader* rl)
+{
+    return rl->nbytes;
 }
 
 void rl_load_read(Read_Loader* rl, int rid, char* read, int ascii)
@@ -203,6 +618,13 @@ void rl_free(Read_Loader* rl)
     free(rl->index);
     free(rl->reads);
 
+    free(rl->rid);
+    free(rl->pile_aread);
+    free(rl->pile_first);
+    free(rl->win_first);
+    free(rl->win_aread);
+    free(rl->loaded);
+
     free(rl);
 }
 
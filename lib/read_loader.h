@@ -8,7 +8,7 @@ typedef struct _Read_Loader Read_Loader;
 struct _Read_Loader
 {
     HITS_DB* db;
-    size_t max_mem;
+    size_t max_mem;     // bytes of reads held at once in windowed mode, 0 for no limit
     
     char* reads;        // storage for loaded reads
     uint64 maxreads;      // size of reads
@@ -18,12 +18,34 @@ struct _Read_Loader
     int* rid;
     int currid;
     int nrid;
+
+    int nthreads;       // parallel preads issued by rl_load
+
+    // windowed mode
+
+    int* pile_aread;    // A-read of pile p, its reads are rid[pile_first[p]..pile_first[p+1])
+    int* pile_first;
+    int npile;
+    int maxpile;
+
+    int* win_first;     // window w holds the piles win_first[w]..win_first[w+1]-1
+    int* win_aread;     // A-read of the first pile of window w
+    int nwin;
+
+    int* loaded;        // reads held in reads, in storage order
+    int nloaded;
+
+    uint64 nbytes;      // bytes of reads held
 };
 
 Read_Loader* rl_init(HITS_DB* db, size_t max_mem);
 
 void rl_add(Read_Loader* rl, int rid);
 
+// sorts and uniques the nreads ids in reads. reads stored close together in the .bps
+// file are coalesced into ranges, which are fetched by nthreads parallel preads.
+// only the requested reads are kept in memory, loading replaces the previous set.
+
 void rl_load(Read_Loader* rl, int* reads, int nreads);
 
 
@@ -31,5 +53,22 @@ void rl_load_added(Read_Loader* rl);
 
 void rl_load_read(Read_Loader* rl, int rid, char* read, int ascii);
 
+// windowed mode, for passes whose reads do not fit into memory at once. while collecting
+// the reads with rl_add, rl_pile starts the pile of A-read aread, piles are expected in
+// ascending A-read order. rl_windows cuts the piles into windows whose reads fit into
+// max_mem (a single pile may exceed it) and returns their number and the A-read of the
+// first pile of each window. rl_window loads the reads of window w, the reads of the
+// previous window that are still referenced are kept, all others are dropped.
+
+void rl_pile(Read_Loader* rl, int aread);
+
+int rl_windows(Read_Loader* rl, int** areads);
+
+void rl_window(Read_Loader* rl, int w);
+
+// bytes of sequence currently held
+
+uint64 rl_size(Read_Loader* rl);
+
 void rl_free(Read_Loader* rl);
 
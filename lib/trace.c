@@ -0,0 +1,137 @@
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "trace.h"
+
+void trace_iter_init(trace_iter* it, Overlap* ovl, int twidth, size_t tbytes)
+{
+    it->trace = ovl->path.trace;
+    it->tbytes = tbytes;
+    it->tlen = ovl->path.tlen;
+    it->twidth = twidth;
+    it->aepos = ovl->path.aepos;
+
+    it->i = 0;
+    it->apos = ovl->path.abpos;
+    it->bpos = ovl->path.bbpos;
+}
+
+#if defined(__SSE2__)
+
+// inclusive prefix sum of the four lanes
+
+static inline __m128i prefix_sum4(__m128i x)
+{
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+
+    return x;
+}
+
+#endif
+
+int trace_bpos(Overlap* ovl, size_t tbytes, int k)
+{
+    int n = 2 * k;
+    int sum = ovl->path.bbpos;
+    int i = 0;
+
+#if defined(__SSE2__)
+    if (tbytes == sizeof(uint8_t))
+    {
+        const uint8_t* trace = ovl->path.trace;
+
+        // shifting the pairs drops the differences, sad sums the advances of 4 pairs per half
+
+        __m128i acc = _mm_setzero_si128();
+
+        for ( ; i + 16 <= n; i += 16)
+        {
+            __m128i b = _mm_srli_epi16( _mm_loadu_si128((const __m128i*)(trace + i)), 8 );
+
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(b, _mm_setzero_si128()));
+        }
+
+        sum += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    }
+    else
+    {
+        const uint16_t* trace = ovl->path.trace;
+        __m128i acc = _mm_setzero_si128();
+
+        for ( ; i + 8 <= n; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(trace + i));
+
+            acc = _mm_add_epi32(acc, _mm_srli_epi32(v, 16));
+        }
+
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+        acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+
+        sum += _mm_cvtsi128_si32(acc);
+    }
+#endif
+
+    for ( ; i < n; i += 2)
+    {
+        sum += trace_at(ovl->path.trace, tbytes, i + 1);
+    }
+
+    return sum;
+}
+
+void trace_bpos_all(Overlap* ovl, size_t tbytes, int* bpos)
+{
+    int n = ovl->path.tlen;
+    int i = 0;
+    int k = 1;
+
+    bpos[0] = ovl->path.bbpos;
+
+#if defined(__SSE2__)
+    __m128i carry = _mm_set1_epi32(ovl->path.bbpos);
+
+    if (tbytes == sizeof(uint8_t))
+    {
+        const uint8_t* trace = ovl->path.trace;
+
+        for ( ; i + 16 <= n; i += 16, k += 8)
+        {
+            __m128i b = _mm_srli_epi16( _mm_loadu_si128((const __m128i*)(trace + i)), 8 );
+
+            __m128i lo = _mm_add_epi32( carry, prefix_sum4(_mm_unpacklo_epi16(b, _mm_setzero_si128())) );
+            carry = _mm_shuffle_epi32(lo, 0xff);
+
+            __m128i hi = _mm_add_epi32( carry, prefix_sum4(_mm_unpackhi_epi16(b, _mm_setzero_si128())) );
+            carry = _mm_shuffle_epi32(hi, 0xff);
+
+            _mm_storeu_si128((__m128i*)(bpos + k), lo);
+            _mm_storeu_si128((__m128i*)(bpos + k + 4), hi);
+        }
+    }
+    else
+    {
+        const uint16_t* trace = ovl->path.trace;
+
+        for ( ; i + 8 <= n; i += 8, k += 4)
+        {
+            __m128i b = _mm_srli_epi32( _mm_loadu_si128((const __m128i*)(trace + i)), 16 );
+
+            __m128i x = _mm_add_epi32( carry, prefix_sum4(b) );
+            carry = _mm_shuffle_epi32(x, 0xff);
+
+            _mm_storeu_si128((__m128i*)(bpos + k), x);
+        }
+    }
+#endif
+
+    for ( ; i < n; i += 2, k++)
+    {
+        bpos[k] = bpos[k - 1] + trace_at(ovl->path.trace, tbytes, i + 1);
+    }
+}
@@ -0,0 +1,80 @@
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dalign/align.h"
+
+// access to traces in the form they are stored in the .las file, pairs of
+// (differences, b-read advance) per trace spacing wide segment of the A-read,
+// with tbytes (1 or 2) bytes per value. passes can leave traces packed
+// (unpack_trace = 0) for consumers that only walk the segments.
+
+static inline int trace_at(const void* trace, size_t tbytes, int i)
+{
+    return (tbytes == sizeof(uint8_t)) ? ((const uint8_t*)trace)[i] : ((const uint16_t*)trace)[i];
+}
+
+// a-read position where segment k of the overlap starts
+
+static inline int trace_apos(Overlap* ovl, int twidth, int k)
+{
+    return (k == 0) ? ovl->path.abpos : (ovl->path.abpos / twidth + k) * twidth;
+}
+
+typedef struct
+{
+    int ab, ae;                 // a-read interval of the segment
+    int bb, be;                 // b-read interval
+    int diffs;
+} trace_segment;
+
+typedef struct
+{
+    const void* trace;
+    size_t tbytes;
+    int tlen;
+    int twidth;
+    int aepos;
+
+    int i;                      // index of the next pair
+    int apos;
+    int bpos;
+} trace_iter;
+
+void trace_iter_init(trace_iter* it, Overlap* ovl, int twidth, size_t tbytes);
+
+// fills in the next segment, returns 0 after the last one
+
+static inline int trace_iter_next(trace_iter* it, trace_segment* seg)
+{
+    if (it->i >= it->tlen)
+    {
+        return 0;
+    }
+
+    int ae = (it->apos / it->twidth + 1) * it->twidth;
+
+    seg->ab = it->apos;
+    seg->ae = (ae < it->aepos) ? ae : it->aepos;
+    seg->bb = it->bpos;
+    seg->be = it->bpos + trace_at(it->trace, it->tbytes, it->i + 1);
+    seg->diffs = trace_at(it->trace, it->tbytes, it->i);
+
+    it->i += 2;
+    it->apos = seg->ae;
+    it->bpos = seg->be;
+
+    return 1;
+}
+
+// b-read position where segment k of the overlap starts, ie. bbpos plus the
+// advances of the first k segments
+
+int trace_bpos(Overlap* ovl, size_t tbytes, int k);
+
+// the b-read position at the start of each segment and the end of the overlap,
+// the tlen / 2 + 1 values are stored in bpos
+
+void trace_bpos_all(Overlap* ovl, size_t tbytes, int* bpos);
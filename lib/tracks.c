@@ -3,12 +3,20 @@
 #include "pass.h"
 #include "tracks.h"
 #include "lib/compression.h"
+#include "lib/instrument.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/param.h>
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #if defined(__APPLE__)
 #include <sys/syslimits.h>
@@ -17,7 +25,171 @@
 #endif
 
 
-HITS_TRACK* track_load(HITS_DB *db, char* track)
+static HITS_TRACK* track_record(HITS_DB* db, char* track, int size, void* anno, void* data)
+{
+    HITS_TRACK* record = malloc(sizeof(HITS_TRACK));
+
+    // the QV pseudo track has to stay in front, as Load_Track() does it
+
+    if (db->tracks != NULL && strcmp(db->tracks->name, ".@qvs") == 0)
+    {
+        record->next = db->tracks->next;
+        db->tracks->next = record;
+    }
+    else
+    {
+        record->next = db->tracks;
+        db->tracks = record;
+    }
+
+    record->name = strdup(track);
+    record->data = data;
+    record->anno = anno;
+    record->size = size;
+
+    return record;
+}
+
+// record the loaded track, published for the other processes on the node when key is set
+
+static HITS_TRACK* track_publish(HITS_DB* db, char* track, int size, uint64 key, uint64* anno, void* data)
+{
+    if ( key != 0 )
+    {
+        uint64 alen = size * (db->nreads + 1);
+        uint64 dlen = anno[db->nreads];
+        char* blob = malloc(alen + dlen + sizeof(uint64));
+        char* shared;
+
+        memcpy(blob, anno, alen);
+        memcpy(blob + alen, data, dlen);
+        bzero(blob + alen + dlen, sizeof(uint64));
+
+        shared = Shared_Publish("track", key, blob, alen + dlen + sizeof(uint64), 2);
+        free(blob);
+
+        if (shared != NULL)
+        {
+            free(anno);
+            free(data);
+
+            return track_record(db, track, size, shared, shared + alen);
+        }
+    }
+
+    return track_record(db, track, size, anno, data);
+}
+
+// uncompress the bytes [ubeg, uend) of the chunks starting at base in file
+
+static void* track_range(FILE* file, off_t base, compress_chunk* index, uint64 nchunks, uint64 ubeg, uint64 uend)
+{
+    uint64 first = 0;
+    uint64 last = nchunks;
+
+    while ( first < nchunks && index[first + 1].uoff <= ubeg )
+    {
+        first++;
+    }
+
+    while ( last > first && index[last - 1].uoff >= uend )
+    {
+        last--;
+    }
+
+    uint64 clen = index[last].coff - index[first].coff;
+    uint64 ulen = index[last].uoff - index[first].uoff;
+
+    char* buf = malloc(ulen + 1);
+
+    if ( clen > 0 )
+    {
+        void* cbuf = malloc(clen);
+
+        if ( fseeko(file, base + index[first].coff, SEEK_SET) != 0 || fread(cbuf, clen, 1, file) != 1 )
+        {
+            free(cbuf);
+            free(buf);
+            return NULL;
+        }
+
+        uncompress_chunks(cbuf, clen, buf, ulen);
+        free(cbuf);
+    }
+
+    memmove(buf, buf + (ubeg - index[first].uoff), uend - ubeg);
+
+    return realloc(buf, uend - ubeg + 1);
+}
+
+// load the part of the track covering the reads of the DB block
+
+static int track_load_block(HITS_DB* db, char* track, FILE* afile, track_anno_header* header, uint64** _anno, void** _data)
+{
+    uint64 nreads = db->nreads;
+    uint64 nindex = header->achunks + 1 + ( header->cdlen > 0 ? header->dchunks + 1 : 0 );
+    compress_chunk* aindex = malloc(sizeof(compress_chunk) * nindex);
+    compress_chunk* dindex = aindex + header->achunks + 1;
+
+    if ( fseeko(afile, sizeof(track_anno_header) + header->clen, SEEK_SET) != 0 ||
+         fread(aindex, sizeof(compress_chunk), nindex, afile) != nindex ||
+         aindex[header->achunks].coff != header->clen ||
+         aindex[header->achunks].uoff != header->size * (header->len + 1) ||
+         ( header->cdlen > 0 && dindex[header->dchunks].coff != header->cdlen ) )
+    {
+        free(aindex);
+        return 0;
+    }
+
+    uint64* anno = track_range(afile, sizeof(track_anno_header), aindex, header->achunks,
+                               header->size * db->ufirst, header->size * (db->ufirst + nreads + 1));
+
+    if ( anno == NULL )
+    {
+        free(aindex);
+        return 0;
+    }
+
+    uint64 start = anno[0];
+    uint64 end = anno[nreads];
+    void* data = NULL;
+
+    if ( end > start && header->cdlen > 0 && end <= dindex[header->dchunks].uoff )
+    {
+        FILE* dfile = fopen(Catenate(db->path, ".", track, ".d2"), "r");
+
+        if ( dfile != NULL )
+        {
+            data = track_range(dfile, 0, dindex, header->dchunks, start, end);
+            fclose(dfile);
+        }
+    }
+    else if ( end == start )
+    {
+        data = malloc(1);
+    }
+
+    free(aindex);
+
+    if ( data == NULL )
+    {
+        free(anno);
+        return 0;
+    }
+
+    uint64 i;
+    for ( i = 0 ; i <= nreads ; i++ )
+    {
+        anno[i] -= start;
+    }
+
+    *_anno = anno;
+    *_data = data;
+
+    return 1;
+}
+
+static HITS_TRACK* track_load_files(HITS_DB *db, char* track)
 {
     FILE* afile = fopen(Catenate(db->path, ".", track, ".a2"), "r");
 
@@ -51,6 +223,53 @@ HITS_TRACK* track_load(HITS_DB *db, char* track)
         return NULL;
     }
 
+    // published decompressed copy, [anno 0..nreads] [data] [pad]
+
+    uint64 key = 0;
+
+    if ( getenv(SHARED_DIR_ENV) != NULL )
+    {
+        key = ( (uint64)db->ufirst << 32 ) | (uint32)db->nreads;
+        key = Shared_Key(key, Catenate(db->path, ".", track, ".a2"));
+        key = Shared_Key(key, Catenate(db->path, ".", track, ".d2"));
+
+        size_t size;
+        uint64 alen = header.size * (nreads + 1);
+        char* shared = Shared_Map("track", key, &size, 2);
+
+        if (shared != NULL)
+        {
+            if (size >= alen + sizeof(uint64) && size == alen + ((track_anno*)shared)[nreads] + sizeof(uint64))
+            {
+                fclose(afile);
+
+                return track_record(db, track, header.size, shared, shared + alen);
+            }
+
+            // malformed, release both references
+
+            Shared_Release(shared);
+            Shared_Release(shared);
+        }
+    }
+
+    uint64* anno = NULL;
+    void* data = NULL;
+
+    if ( db->part > 0 && header.achunks > 0 && db->ufirst + nreads <= header.len &&
+         track_load_block(db, track, afile, &header, &anno, &data) )
+    {
+        fclose(afile);
+
+        return track_publish(db, track, header.size, key, anno, data);
+    }
+
+    if ( fseeko(afile, sizeof(track_anno_header), SEEK_SET) != 0 )
+    {
+        fprintf(stderr, "ERROR: failed to read anno track %s\n", track);
+        return NULL;
+    }
+
     void* canno = malloc(header.clen);
     bzero(canno, header.clen);
 
@@ -68,7 +287,7 @@ HITS_TRACK* track_load(HITS_DB *db, char* track)
     // printf("header len %" PRIu64 " clen %" PRIu64 " cdlen %" PRIu64 "\n", header.len, header.clen, header.cdlen);
 
     uint64 alen = header.size * (header.len + 1);
-    uint64* anno = malloc(alen);
+    anno = malloc(alen);
     bzero(anno, alen);
 
     uncompress_chunks(canno, header.clen, anno, alen);
@@ -98,12 +317,12 @@ HITS_TRACK* track_load(HITS_DB *db, char* track)
 
     fclose(dfile);
 
-    void* data = malloc( anno[header.len] );
+    data = malloc( anno[header.len] );
     uncompress_chunks(cdata, header.cdlen, data, anno[header.len]);
 
     free(cdata);
 
-    if ( db->ufirst > 1 )
+    if ( db->ufirst > 0 )
     {
         memmove(anno, anno + db->ufirst, (db->nreads + 1) * sizeof(uint64));
         uint64_t start = anno[0];
@@ -118,24 +337,38 @@ HITS_TRACK* track_load(HITS_DB *db, char* track)
         memmove(data, data + start, end - start);
     }
 
-    HITS_TRACK* record = malloc(sizeof(HITS_TRACK));
+    return track_publish(db, track, header.size, key, anno, data);
+}
 
-    record->next = db->tracks;
-    db->tracks = record;
+HITS_TRACK* track_load(HITS_DB *db, char* track)
+{
+    uint64_t start = INS_START();
 
-    record->name = strdup(track);
-    record->data = data;
-    record->anno = anno;
-    record->size = header.size;
+    HITS_TRACK* t = track_load_files(db, track);
 
-    return record;
+    INS_STOP("tracks.load", start);
+
+    if (t != NULL && t->size == sizeof(track_anno))
+    {
+        INS_COUNT("tracks.load_bytes", sizeof(track_anno) * (db->nreads + 1) + ((track_anno*)t->anno)[db->nreads]);
+    }
+
+    return t;
 }
 
 void track_close(HITS_TRACK* track)
 {
     free(track->name);
-    free(track->anno);
-    free(track->data);
+
+    if ( !Shared_Release(track->anno) )
+    {
+        free(track->anno);
+    }
+
+    if ( !Shared_Release(track->data) )
+    {
+        free(track->data);
+    }
 
     free(track);
 }
@@ -177,36 +410,30 @@ int track_delete(HITS_DB* db, const char* track)
     return suc;
 }
 
-void track_write(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen)
+// write the header placeholder, the compressed offsets and their index to the .a2 file
+
+static FILE* track_write_anno(HITS_DB* db, const char* path_track, track_anno* anno, track_anno_header* ahead)
 {
     uint64_t tlen = DB_NREADS(db);
 
-    char* path_track = track_name(db, track, block);
-    int end = strlen(path_track);
-
-    // offsets
-
-    strcat(path_track, ".a2");
-
     FILE* afile = fopen(path_track, "w");
 
     if (afile == NULL)
     {
         fprintf(stderr, "failed to open %s\n", path_track);
-        return;
+        return NULL;
     }
 
-    track_anno_header ahead;
-    bzero(&ahead, sizeof(track_anno_header));
+    bzero(ahead, sizeof(track_anno_header));
 
-    ahead.version = TRACK_VERSION_2;
-    ahead.len = tlen;
-    ahead.size = sizeof(track_anno);
+    ahead->version = TRACK_VERSION_2;
+    ahead->len = tlen;
+    ahead->size = sizeof(track_anno);
 
-    if (fwrite(&ahead, sizeof(track_anno_header), 1, afile) != 1)
+    if (fwrite(ahead, sizeof(track_anno_header), 1, afile) != 1)
     {
         fprintf(stderr, "failed to write track header\n");
-        return;
+        return NULL;
     }
 
     void* canno;
@@ -217,13 +444,55 @@ void track_write(HITS_DB* db, const char* track, int block, track_anno* anno, tr
     if (fwrite(canno, clen, 1, afile) != 1)
     {
         fprintf(stderr, "failed to write track data offsets\n");
-        return;
+        return NULL;
     }
 
-    ahead.clen = clen;
+    ahead->clen = clen;
+
+    compress_chunk* index = compress_index(canno, clen, &(ahead->achunks));
 
     free(canno);
 
+    if ( index != NULL && fwrite(index, sizeof(compress_chunk), ahead->achunks + 1, afile) != ahead->achunks + 1 )
+    {
+        fprintf(stderr, "failed to write track index\n");
+        return NULL;
+    }
+
+    free(index);
+
+    return afile;
+}
+
+static void track_write_header(FILE* afile, track_anno_header* ahead)
+{
+    rewind(afile);
+    if (fwrite(ahead, sizeof(track_anno_header), 1, afile) != 1)
+    {
+        fprintf(stderr, "failed to write track header\n");
+        return;
+    }
+
+    fclose(afile);
+}
+
+static void track_write_files(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen)
+{
+    char* path_track = track_name(db, track, block);
+    int end = strlen(path_track);
+
+    // offsets
+
+    strcat(path_track, ".a2");
+
+    track_anno_header ahead;
+    FILE* afile = track_write_anno(db, path_track, anno, &ahead);
+
+    if (afile == NULL)
+    {
+        return;
+    }
+
     // data
 
     if (data != NULL)
@@ -238,9 +507,12 @@ void track_write(HITS_DB* db, const char* track, int block, track_anno* anno, tr
             return;
         }
 
+        void* canno;
+        uint64_t clen;
+
         compress_chunks(data, sizeof(track_data) * dlen, &canno, &clen);
 
-        if (fwrite(canno, clen, 1, dfile) != 1)
+        if (clen > 0 && fwrite(canno, clen, 1, dfile) != 1)
         {
             fprintf(stderr, "failed to write track data of %" PRIu64 " (%" PRIu64 ") bytes\n", sizeof(track_data) * dlen, clen);
             return;
@@ -248,26 +520,188 @@ void track_write(HITS_DB* db, const char* track, int block, track_anno* anno, tr
 
         ahead.cdlen = clen;
 
+        fclose(dfile);
+
+        // the data index is only usable along with the one of the offsets
+
+        compress_chunk* index = NULL;
+
+        if ( ahead.achunks > 0 )
+        {
+            index = compress_index(canno, clen, &(ahead.dchunks));
+        }
+
         free(canno);
 
-        fclose(dfile);
+        if ( index == NULL )
+        {
+            ahead.achunks = ahead.dchunks = 0;
+        }
+        else if ( fwrite(index, sizeof(compress_chunk), ahead.dchunks + 1, afile) != ahead.dchunks + 1 )
+        {
+            fprintf(stderr, "failed to write track index\n");
+            return;
+        }
+
+        free(index);
     }
     else if ( dlen != 0 )
     {
         ahead.cdlen = dlen;
+        ahead.achunks = 0;
     }
 
     free(path_track);
 
-    rewind(afile);
-    if (fwrite(&ahead, sizeof(track_anno_header), 1, afile) != 1)
+    track_write_header(afile, &ahead);
+}
+
+void track_write(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen)
+{
+    uint64_t start = INS_START();
+
+    track_write_files(db, track, block, anno, data, dlen);
+
+    INS_STOP("tracks.write", start);
+    INS_COUNT("tracks.write_bytes", sizeof(track_anno) * (DB_NREADS(db) + 1) + sizeof(track_data) * dlen);
+}
+
+void track_write_chunks(HITS_DB* db, const char* track, int block, track_anno* anno,
+                        uint64_t cdlen, compress_chunk* dindex, uint64_t dchunks)
+{
+    char* path_track = track_name(db, track, block);
+
+    strcat(path_track, ".a2");
+
+    track_anno_header ahead;
+    FILE* afile = track_write_anno(db, path_track, anno, &ahead);
+
+    free(path_track);
+
+    if (afile == NULL)
     {
-        fprintf(stderr, "failed to write track header\n");
         return;
     }
 
-    fclose(afile);
+    ahead.cdlen = cdlen;
+    ahead.dchunks = dchunks;
+
+    if ( dindex == NULL || ahead.achunks == 0 )
+    {
+        ahead.achunks = ahead.dchunks = 0;
+    }
+    else if ( fwrite(dindex, sizeof(compress_chunk), dchunks + 1, afile) != dchunks + 1 )
+    {
+        fprintf(stderr, "failed to write track index\n");
+        return;
+    }
+
+    track_write_header(afile, &ahead);
+}
+
+void track_part_compress(track_part* part, void* data, uint64_t len)
+{
+    bzero(part, sizeof(track_part));
+
+    part->ulen = len;
+
+    if (len > 0)
+    {
+        compress_chunks(data, len, &(part->cdata), &(part->clen));
+        part->index = compress_index(part->cdata, part->clen, &(part->nchunks));
+    }
+}
+
+void track_part_free(track_part* part)
+{
+    free(part->cdata);
+    free(part->index);
 
+    bzero(part, sizeof(track_part));
+}
+
+void track_write_parts(HITS_DB* db, const char* track, int block, track_anno* anno,
+                       track_part* parts, int nparts)
+{
+    char* path_track = track_name(db, track, block);
+    strcat(path_track, ".d2");
+
+    FILE* dfile = fopen(path_track, "w");
+
+    if (dfile == NULL)
+    {
+        fprintf(stderr, "failed to open %s\n", path_track);
+        free(path_track);
+        return;
+    }
+
+    compress_chunk* dindex = NULL;
+    uint64_t dchunks = 0;
+    uint64_t maxdchunks = 0;
+    uint64_t cdlen = 0;
+    uint64_t udlen = 0;
+    int indexed = 1;
+    int i;
+
+    for (i = 0; i < nparts; i++)
+    {
+        track_part* part = parts + i;
+
+        if (part->clen == 0)
+        {
+            continue;
+        }
+
+        if (fwrite(part->cdata, part->clen, 1, dfile) != 1)
+        {
+            fprintf(stderr, "failed to write %" PRIu64 " bytes to %s\n", part->clen, path_track);
+            fclose(dfile);
+            free(path_track);
+            free(dindex);
+            return;
+        }
+
+        if (part->index == NULL)
+        {
+            indexed = 0;
+        }
+        else if (indexed)
+        {
+            if (dchunks + part->nchunks + 1 > maxdchunks)
+            {
+                maxdchunks = ( dchunks + part->nchunks + 1 ) * 1.2 + 100;
+                dindex = realloc(dindex, sizeof(compress_chunk) * maxdchunks);
+            }
+
+            uint64_t k;
+            for (k = 0; k <= part->nchunks; k++)
+            {
+                dindex[dchunks + k].coff = cdlen + part->index[k].coff;
+                dindex[dchunks + k].uoff = udlen + part->index[k].uoff;
+            }
+
+            dchunks += part->nchunks;
+        }
+
+        cdlen += part->clen;
+        udlen += part->ulen;
+    }
+
+    fclose(dfile);
+    free(path_track);
+
+    // the index is only valid if it covers all of the data
+
+    if ( dindex == NULL || dindex[dchunks].uoff != anno[DB_NREADS(db)] )
+    {
+        indexed = 0;
+    }
+
+    INS_COUNT("tracks.write_bytes", sizeof(track_anno) * (DB_NREADS(db) + 1) + udlen);
+
+    track_write_chunks(db, track, block, anno, cdlen, indexed ? dindex : NULL, dchunks);
+
+    free(dindex);
 }
 
 static void write_track(HITS_DB* db, const char* track, int block, track_header_len tlen, track_anno* anno, track_data* data, uint64_t dlen)
@@ -339,3 +773,334 @@ void write_track_untrimmed(HITS_DB* db, const char* track, int block, track_anno
 {
     write_track(db, track, block, DB_NREADS(db), anno, data, dlen);
 }
+
+track_cache* track_cache_new(HITS_DB* db, int maxentries)
+{
+    track_cache* cache = malloc(sizeof(track_cache));
+
+    cache->db = db;
+    cache->maxentries = maxentries > 0 ? maxentries : 1;
+    cache->entries = malloc(sizeof(track_cache_entry) * cache->maxentries);
+    cache->nentries = 0;
+    cache->clock = 0;
+
+    return cache;
+}
+
+// remove the track from the DB's list and free it
+
+static void track_cache_evict(track_cache* cache, int e)
+{
+    HITS_TRACK* track = cache->entries[e].track;
+    HITS_TRACK** link = &(cache->db->tracks);
+
+    while ( *link != NULL && *link != track )
+    {
+        link = &((*link)->next);
+    }
+
+    if ( *link != NULL )
+    {
+        *link = track->next;
+    }
+
+    track_close(track);
+
+    cache->nentries -= 1;
+    cache->entries[e] = cache->entries[cache->nentries];
+}
+
+void track_cache_free(track_cache* cache)
+{
+    while ( cache->nentries > 0 )
+    {
+        track_cache_evict(cache, cache->nentries - 1);
+    }
+
+    free(cache->entries);
+    free(cache);
+}
+
+HITS_TRACK* track_cache_get(track_cache* cache, char* track)
+{
+    int e;
+
+    for ( e = 0 ; e < cache->nentries ; e++ )
+    {
+        track_cache_entry* entry = cache->entries + e;
+
+        if ( strcmp(entry->track->name, track) == 0 )
+        {
+            entry->nrefs += 1;
+            entry->used = ++cache->clock;
+
+            return entry->track;
+        }
+    }
+
+    HITS_TRACK* loaded = track_load(cache->db, track);
+
+    if ( loaded == NULL )
+    {
+        return NULL;
+    }
+
+    if ( cache->nentries == cache->maxentries )
+    {
+        int lru = -1;
+
+        for ( e = 0 ; e < cache->nentries ; e++ )
+        {
+            if ( cache->entries[e].nrefs == 0 && ( lru == -1 || cache->entries[e].used < cache->entries[lru].used ) )
+            {
+                lru = e;
+            }
+        }
+
+        if ( lru != -1 )
+        {
+            track_cache_evict(cache, lru);
+        }
+        else
+        {
+            cache->maxentries *= 2;
+            cache->entries = realloc(cache->entries, sizeof(track_cache_entry) * cache->maxentries);
+        }
+    }
+
+    track_cache_entry* entry = cache->entries + cache->nentries;
+
+    entry->track = loaded;
+    entry->nrefs = 1;
+    entry->used = ++cache->clock;
+
+    cache->nentries += 1;
+
+    return loaded;
+}
+
+void track_cache_put(track_cache* cache, HITS_TRACK* track)
+{
+    int e;
+
+    for ( e = 0 ; e < cache->nentries ; e++ )
+    {
+        if ( cache->entries[e].track == track && cache->entries[e].nrefs > 0 )
+        {
+            cache->entries[e].nrefs -= 1;
+            return;
+        }
+    }
+}
+
+static int cmp_interval(const void* a, const void* b)
+{
+    const track_data* x = a;
+    const track_data* y = b;
+
+    if (x[0] != y[0])
+    {
+        return x[0] < y[0] ? -1 : 1;
+    }
+
+    return x[1] < y[1] ? -1 : (x[1] > y[1]);
+}
+
+track_intervals* track_intervals_new(HITS_DB* db, HITS_TRACK* track)
+{
+    track_anno* anno = track->anno;
+    track_data* data = track->data;
+    int nreads = db->nreads;
+    uint64_t n = anno[nreads] / (2 * sizeof(track_data));
+
+    track_intervals* ti = malloc(sizeof(track_intervals));
+
+    ti->nreads = nreads;
+    ti->offset = malloc(sizeof(uint64_t) * (nreads + 1));
+    ti->beg = malloc(sizeof(track_data) * (n + 1));
+    ti->end = malloc(sizeof(track_data) * (n + 1));
+    ti->maxend = malloc(sizeof(track_data) * (n + 1));
+
+    track_data* pairs = malloc(sizeof(track_data) * 2 * (n + 1));
+    int i;
+
+    for ( i = 0 ; i <= nreads ; i++ )
+    {
+        ti->offset[i] = anno[i] / (2 * sizeof(track_data));
+    }
+
+    for ( i = 0 ; i < nreads ; i++ )
+    {
+        uint64_t ib = ti->offset[i];
+        uint64_t ie = ti->offset[i + 1];
+        uint64_t k;
+
+        memcpy(pairs, data + 2 * ib, sizeof(track_data) * 2 * (ie - ib));
+        qsort(pairs, ie - ib, sizeof(track_data) * 2, cmp_interval);
+
+        track_data maxend = 0;
+
+        for ( k = ib ; k < ie ; k++ )
+        {
+            ti->beg[k] = pairs[2 * (k - ib)];
+            ti->end[k] = pairs[2 * (k - ib) + 1];
+
+            maxend = MAX(maxend, ti->end[k]);
+            ti->maxend[k] = maxend;
+        }
+    }
+
+    free(pairs);
+
+    return ti;
+}
+
+void track_intervals_free(track_intervals* ti)
+{
+    free(ti->offset);
+    free(ti->beg);
+    free(ti->end);
+    free(ti->maxend);
+    free(ti);
+}
+
+// the intervals of the read that can intersect [b, e) are [*_ib, *_ie)
+
+static void intervals_range(track_intervals* ti, int read, int b, int e, uint64_t* _ib, uint64_t* _ie)
+{
+    uint64_t ib = ti->offset[read];
+    uint64_t ie = ti->offset[read + 1];
+    uint64_t lo, hi;
+
+    // first interval with maxend > b
+
+    lo = ib;
+    hi = ie;
+
+    while ( lo < hi )
+    {
+        uint64_t mid = (lo + hi) / 2;
+
+        if ( ti->maxend[mid] > b )
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    ib = lo;
+
+    // first interval with beg >= e
+
+    hi = ie;
+
+    while ( lo < hi )
+    {
+        uint64_t mid = (lo + hi) / 2;
+
+        if ( ti->beg[mid] >= e )
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+
+    *_ib = ib;
+    *_ie = lo;
+}
+
+uint64_t track_intervals_overlap(track_intervals* ti, int read, int b, int e)
+{
+    uint64_t i, ie;
+    uint64_t sum = 0;
+
+    intervals_range(ti, read, b, e, &i, &ie);
+
+#if defined(__SSE4_1__)
+    const __m128i vb = _mm_set1_epi32(b);
+    const __m128i ve = _mm_set1_epi32(e);
+    __m128i vsum = _mm_setzero_si128();
+
+    for ( ; i + 4 <= ie ; i += 4 )
+    {
+        __m128i lo = _mm_max_epi32(vb, _mm_loadu_si128((__m128i*)(ti->beg + i)));
+        __m128i hi = _mm_min_epi32(ve, _mm_loadu_si128((__m128i*)(ti->end + i)));
+
+        vsum = _mm_add_epi32(vsum, _mm_max_epi32(_mm_sub_epi32(hi, lo), _mm_setzero_si128()));
+    }
+
+    vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(1, 0, 3, 2)));
+    vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = (uint32_t)_mm_cvtsi128_si32(vsum);
+#elif defined(__ARM_NEON)
+    const int32x4_t vb = vdupq_n_s32(b);
+    const int32x4_t ve = vdupq_n_s32(e);
+    int32x4_t vsum = vdupq_n_s32(0);
+
+    for ( ; i + 4 <= ie ; i += 4 )
+    {
+        int32x4_t lo = vmaxq_s32(vb, vld1q_s32(ti->beg + i));
+        int32x4_t hi = vminq_s32(ve, vld1q_s32(ti->end + i));
+
+        vsum = vaddq_s32(vsum, vmaxq_s32(vsubq_s32(hi, lo), vdupq_n_s32(0)));
+    }
+
+    sum = (uint32_t)vaddvq_s32(vsum);
+#endif
+
+    for ( ; i < ie ; i++ )
+    {
+        int lo = MAX(b, ti->beg[i]);
+        int hi = MIN(e, ti->end[i]);
+
+        sum += MAX(hi - lo, 0);
+    }
+
+    return sum;
+}
+
+uint64_t track_intervals_covered(track_intervals* ti, int read, int b, int e)
+{
+    uint64_t i, ie;
+    uint64_t sum = 0;
+    int cur = b;
+
+    intervals_range(ti, read, b, e, &i, &ie);
+
+    // begins are sorted, everything left of cur has been counted
+
+    for ( ; i < ie ; i++ )
+    {
+        int lo = MAX(cur, ti->beg[i]);
+        int hi = MIN(e, ti->end[i]);
+        int len = MAX(hi - lo, 0);
+
+        sum += len;
+        cur = MAX(cur, hi);
+    }
+
+    return sum;
+}
+
+int track_intervals_contains(track_intervals* ti, int read, int pos)
+{
+    uint64_t i, ie;
+
+    intervals_range(ti, read, pos, pos + 1, &i, &ie);
+
+    for ( ; i < ie ; i++ )
+    {
+        if ( ti->beg[i] <= pos && pos < ti->end[i] )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "db/DB.h"
+#include "lib/compression.h"
 #include <inttypes.h>
 
 #define TRACK_ANNO          "anno"
@@ -48,20 +49,108 @@ typedef struct
   uint64_t clen;
   uint64_t cdlen;
 
-  uint64_t reserved1;
-  uint64_t reserved2;
+  uint64_t achunks;     // chunks in the index of the compressed anno, 0 if there is none
+  uint64_t dchunks;     // chunks in the index of the compressed data
   uint64_t reserved3;
   uint64_t reserved4;
 
 } track_anno_header;
 
+/*
+ * .a2 file layout
+ *
+ *   [track_anno_header] [compressed anno] [anno index] [data index]
+ *
+ * the indices hold achunks + 1 and dchunks + 1 compress_chunk entries, which
+ * allows loading the tracks of a DB block without inflating all of the track.
+ * files written without them are loaded in full.
+ */
+
 HITS_TRACK* track_load(HITS_DB *db, char* track);
 void        track_close(HITS_TRACK* track);
 int         track_delete(HITS_DB* db, const char* track);
 void        track_write(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen);
 
+// write the .a2 of a track whose data has already been written compressed to the .d2,
+// along with the index of its dchunks chunks. dindex may be NULL.
+
+void        track_write_chunks(HITS_DB* db, const char* track, int block, track_anno* anno,
+                               uint64_t cdlen, compress_chunk* dindex, uint64_t dchunks);
+
+// data of a track compressed in consecutive parts, e.g. by several threads
+
+typedef struct
+{
+    void* cdata;
+    uint64_t clen;
+    compress_chunk* index;      // of the chunks in cdata, may be NULL
+    uint64_t nchunks;
+    uint64_t ulen;              // bytes of uncompressed data
+} track_part;
+
+void        track_part_compress(track_part* part, void* data, uint64_t len);
+void        track_part_free(track_part* part);
+
+// write the .d2 as the concatenation of the parts and the .a2 with the joint index
+
+void        track_write_parts(HITS_DB* db, const char* track, int block, track_anno* anno,
+                              track_part* parts, int nparts);
+
 
 char* track_name(HITS_DB* db, const char* track, int block);
 
+// interval tracks held as columns, the intervals of each read sorted by their begin.
+// maxend is the running maximum of the ends of a read's intervals, which allows
+// skipping the intervals ending before a query.
+
+typedef struct
+{
+    int nreads;
+
+    uint64_t* offset;           // intervals of read i are [offset[i], offset[i + 1])
+    track_data* beg;
+    track_data* end;
+    track_data* maxend;
+} track_intervals;
+
+track_intervals* track_intervals_new(HITS_DB* db, HITS_TRACK* track);
+void             track_intervals_free(track_intervals* ti);
+
+// bases of [b, e) inside the intervals of the read, counted once per interval
+
+uint64_t track_intervals_overlap(track_intervals* ti, int read, int b, int e);
+
+// bases of [b, e) inside any of the intervals of the read
+
+uint64_t track_intervals_covered(track_intervals* ti, int read, int b, int e);
+
+int      track_intervals_contains(track_intervals* ti, int read, int pos);
+
+// least recently used cache of loaded tracks. tracks are loaded on first
+// use and stay until the cache is full and they are not referenced anymore.
+
+typedef struct
+{
+    HITS_TRACK* track;
+    int nrefs;
+    uint64_t used;
+} track_cache_entry;
+
+typedef struct
+{
+    HITS_DB* db;
+
+    track_cache_entry* entries;
+    int nentries;
+    int maxentries;
+
+    uint64_t clock;
+} track_cache;
+
+track_cache* track_cache_new(HITS_DB* db, int maxentries);
+void         track_cache_free(track_cache* cache);
+HITS_TRACK*  track_cache_get(track_cache* cache, char* track);
+void         track_cache_put(track_cache* cache, HITS_TRACK* track);
+
 void write_track_trimmed(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen);
 void write_track_untrimmed(HITS_DB* db, const char* track, int block, track_anno* anno, track_data* data, uint64_t dlen);
@@ -20,26 +20,46 @@ static void align(TRIM* trim, Overlap* ovl, int ab, int ae, int bb, int be)
     Alignment* align = &(trim->align);
     Path* path = trim->align.path;
 
-    if(trim->rl)
-    {
-    	Read_Loader* rl = trim->rl;
+    int comp = (ovl->flags & OVL_COMP) ? 1 : 0;
 
-    	rl_load_read(rl, ovl->aread, align->aseq, 0);
-    	rl_load_read(rl, ovl->bread, align->bseq, 0);
-    }
-    else
+    // the sequences are only read by the aligner, keep them for the following overlaps
+
+    if (trim->aread != ovl->aread)
     {
-    	Load_Read(trim->db, ovl->aread, align->aseq, 0);
-    	Load_Read(trim->db, ovl->bread, align->bseq, 0);
-    }
+        if (trim->rl)
+        {
+            rl_load_read(trim->rl, ovl->aread, align->aseq, 0);
+        }
+        else
+        {
+            Load_Read(trim->db, ovl->aread, align->aseq, 0);
+        }
 
+        trim->aread = ovl->aread;
+    }
 
     align->alen = DB_READ_LEN(trim->db, ovl->aread);
     align->blen = DB_READ_LEN(trim->db, ovl->bread);
 
-    if (ovl->flags & OVL_COMP)
+    if (trim->bread != ovl->bread)
     {
-        Complement_Seq(trim->align.bseq,align->blen);
+        if (trim->rl)
+        {
+            rl_load_read(trim->rl, ovl->bread, align->bseq, 0);
+        }
+        else
+        {
+            Load_Read(trim->db, ovl->bread, align->bseq, 0);
+        }
+
+        trim->bread = ovl->bread;
+        trim->bcomp = 0;
+    }
+
+    if (trim->bcomp != comp)
+    {
+        Complement_Seq(trim->align.bseq, align->blen);
+        trim->bcomp = comp;
     }
 
     path->diffs = (ae - ab) + (be - bb);
@@ -459,6 +479,23 @@ void trim_overlap(TRIM* trim, Overlap* ovl)
 #endif
 }
 
+void trim_overlaps(TRIM* trim, Overlap* ovls, int novl)
+{
+    int i;
+    for (i = 0; i < novl; i++)
+    {
+        trim_overlap(trim, ovls + i);
+    }
+}
+
+void trim_reduce(TRIM* dst, TRIM* src)
+{
+    dst->nOvls         += src->nOvls;
+    dst->nOvlBases     += src->nOvlBases;
+    dst->nTrimmedOvls  += src->nTrimmedOvls;
+    dst->nTrimmedBases += src->nTrimmedBases;
+}
+
 TRIM* trim_init(HITS_DB* db, ovl_header_twidth twidth, HITS_TRACK *track, Read_Loader *rl)
 {
     TRIM* trim = malloc( sizeof(TRIM) );
@@ -480,6 +517,10 @@ TRIM* trim_init(HITS_DB* db, ovl_header_twidth twidth, HITS_TRACK *track, Read_L
 
     trim->rl = rl;
 
+    trim->aread = -1;
+    trim->bread = -1;
+    trim->bcomp = 0;
+
     return trim;
 }
 
@@ -20,6 +20,10 @@ typedef struct
     Alignment align;                // alignment and path record for computing the
     Path path;                      // alignment in the gap region
 
+    int aread;                      // reads currently in align.aseq/bseq, -1 if none
+    int bread;
+    int bcomp;                      // bseq holds the complement of bread
+
     uint64 nOvls;
     uint64 nOvlBases;
     uint64 nTrimmedOvls;
@@ -30,3 +34,12 @@ typedef struct
 TRIM* trim_init(HITS_DB* db, ovl_header_twidth twidth, HITS_TRACK *track, Read_Loader *rl);
 void trim_overlap(TRIM* trim, Overlap* ovl);
 void trim_close(TRIM* trim);
+
+// trims a pile. the realignments of overlaps with the same B-read, and
+// orientation, share the loaded (and complemented) B-read.
+
+void trim_overlaps(TRIM* trim, Overlap* ovls, int novl);
+
+// adds the statistics of src, eg. the TRIM of a pass_parallel() thread, to dst
+
+void trim_reduce(TRIM* dst, TRIM* src);
@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <sys/param.h>
 #include <ctype.h>
@@ -257,6 +258,85 @@ int intersect(int ab, int ae, int bb, int be)
     return (b < e ? (e-b) : 0);
 }
 
+// below that many keys per event a counting sort is cheaper than qsort()
+
+#define EVENTS_DENSE_KEYS  32
+
+static int cmp_coverage_events(const void* x, const void* y)
+{
+    int* e1 = (int*)x;
+    int* e2 = (int*)y;
+
+    int cmp = abs(*e1) - abs(*e2);
+
+    if (cmp == 0)
+    {
+        cmp = (*e1) - (*e2);
+    }
+
+    return cmp;
+}
+
+void sort_coverage_events(int* events, int nevents, int* buckets)
+{
+    if (nevents < 2)
+    {
+        return ;
+    }
+
+    // key 2 * pos for ends, 2 * pos + 1 for starts (and the end at 0, as with the comparison)
+
+    int kmin = INT_MAX;
+    int kmax = 0;
+    int i;
+
+    for (i = 0; i < nevents; i++)
+    {
+        int e = events[i];
+        int key = (e < 0) ? -2 * e : 2 * e + 1;
+
+        kmin = MIN(kmin, key);
+        kmax = MAX(kmax, key);
+    }
+
+    if (kmax - kmin >= EVENTS_DENSE_KEYS * nevents)
+    {
+        qsort(events, nevents, sizeof(int), cmp_coverage_events);
+        return ;
+    }
+
+    for (i = 0; i < nevents; i++)
+    {
+        int e = events[i];
+
+        buckets[ (e < 0) ? -2 * e : 2 * e + 1 ] += 1;
+    }
+
+    int key;
+    int j = 0;
+
+    for (key = kmin; key <= kmax; key++)
+    {
+        int n = buckets[key];
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        int e = (key & 1) ? (key >> 1) : -(key >> 1);
+
+        while (n--)
+        {
+            events[j++] = e;
+        }
+
+        buckets[key] = 0;
+    }
+
+    assert(j == nevents);
+}
+
 void get_trim(HITS_DB* db, HITS_TRACK* trimtrack, int rid, int* b, int* e)
 {
     track_anno* anno = (track_anno*)trimtrack->anno;
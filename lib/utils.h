@@ -12,6 +12,13 @@ int fread_integers(FILE* fileIn, int** out_values, int* out_nvalues);
 int intersect(int ab, int ae, int bb, int be);
 void get_trim(HITS_DB* db, HITS_TRACK* trimtrack, int rid, int* b, int* e);
 
+// sorts the coverage events of a pile, the starts of the intervals as pos and
+// the ends as -pos, by position with the ends first. same order as sorting by
+// abs(pos) then value, but a counting sort for deep piles. buckets holds
+// 2 * max pos + 2 zeroed ints and is zeroed again on return.
+
+void sort_coverage_events(int* events, int nevents, int* buckets);
+
 void wrap_write(FILE* fileOut, char* seq, int len, int width);
 void revcomp(char* c, int len);
 void rev(char* c, int len);
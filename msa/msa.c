@@ -5,11 +5,17 @@
 #include <string.h>
 #include <sys/param.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "lib/colors.h"
 #include "msa.h"
 
 #define CONS_MIN_COV_FRACTION 0.5 // base calling threshold
 
+#define NO_BASE 0xff // profile column without a majority base
+
 typedef struct
 {
     char* B;              // sequence that gets aligned to
@@ -31,49 +37,98 @@ typedef struct
     msa_alignment_ctx* pCtx; // points to context, working storage
 } msa_alignment;
 
-static int match( char* a, int ia, msa_profile_entry* p, int ip )
+// majority base of a profile column, or NO_BASE if the dash wins
+
+static unsigned char profile_base( msa_profile_entry* pEntry )
 {
-    msa_profile_entry* pEntry = ( p + ip );
+    msa_count nMax = pEntry->counts[ 0 ];
+    unsigned char cMax = 0;
 
-    char nMax = pEntry->counts[ 0 ];
-    char cMax = 0;
+    // loop unrolled
 
-    char nCount;
+    if ( pEntry->counts[ 1 ] > nMax )
+    {
+        nMax = pEntry->counts[ 1 ];
+        cMax = 1;
+    }
 
-    // loop unrolled
+    if ( pEntry->counts[ 2 ] > nMax )
+    {
+        nMax = pEntry->counts[ 2 ];
+        cMax = 2;
+    }
 
-    nCount = pEntry->counts[ 1 ];
+    if ( pEntry->counts[ 3 ] > nMax )
+    {
+        nMax = pEntry->counts[ 3 ];
+        cMax = 3;
+    }
 
-    if ( nCount > nMax )
+    if ( pEntry->counts[ 4 ] >= nMax )
     {
-        nMax = nCount;
-        cMax = 1;
+        return NO_BASE;
     }
 
-    nCount = pEntry->counts[ 2 ];
+    return cMax;
+}
+
+// majority bases of the profile columns [b, e)
 
-    if ( nCount > nMax )
+static void profile_bases( msa* m, int b, int e )
+{
+    msa_alignment_ctx* pCtx = m->aln_ctx;
+
+    if ( m->curprof > pCtx->maxbase )
     {
-        nMax = nCount;
-        cMax = 2;
+        pCtx->maxbase = 1.2 * m->curprof + 100;
+        pCtx->Abase   = (unsigned char*)realloc( pCtx->Abase, pCtx->maxbase );
     }
 
-    nCount = pEntry->counts[ 3 ];
+    int i;
 
-    if ( nCount > nMax )
+    for ( i = b; i < e; i++ )
     {
-        nMax = nCount;
-        cMax = 3;
+        pCtx->Abase[ i ] = profile_base( m->profile + i );
     }
+}
 
-    nCount = pEntry->counts[ 4 ];
+// extends the match of b against the profile bases a from j up to n
 
-    if ( nCount >= nMax )
+static inline int snake( char* b, unsigned char* a, int j, int n )
+{
+#ifdef __SSE2__
+    if ( j >= 0 )
     {
-        return 0;
+        while ( j + 16 <= n )
+        {
+            __m128i vb = _mm_loadu_si128( (__m128i*)( b + j ) );
+            __m128i va = _mm_loadu_si128( (__m128i*)( a + j ) );
+            int mask   = ~_mm_movemask_epi8( _mm_cmpeq_epi8( va, vb ) ) & 0xffff;
+
+            if ( mask )
+            {
+                return j + __builtin_ctz( mask );
+            }
+
+            j += 16;
+        }
     }
+#endif
 
-    return ( cMax == a[ ia ] );
+    while ( j < n && a[ j ] == (unsigned char)b[ j ] )
+    {
+        j += 1;
+    }
+
+    return j;
+}
+
+static inline void count_inc( msa_count* c )
+{
+    if ( *c < MSA_COUNT_MAX )
+    {
+        *c += 1;
+    }
 }
 
 static int v3_align_onp( msa_alignment* pAlign,
@@ -81,6 +136,7 @@ static int v3_align_onp( msa_alignment* pAlign,
 {
     int** PVF = pAlign->pCtx->PVF; // wave->PVF;
     int** PHF = pAlign->pCtx->PHF; // wave->PHF;
+    unsigned char* Abase = pAlign->pCtx->Abase + ( A - pAlign->pCtx->Aabs );
     int D;
     int del = M - N;
 
@@ -117,7 +173,7 @@ static int v3_align_onp( msa_alignment* pAlign,
         {
             int k, i, j;
             int am, ac, ap;
-            msa_profile_entry* a;
+            unsigned char* a;
 
             F2 = F1;
             F1 = F0;
@@ -157,15 +213,13 @@ static int v3_align_onp( msa_alignment* pAlign,
     }                                          \
                                                \
     if ( N < i )                               \
-        while ( j < N && match( B, j, a, j ) ) \
-            j += 1;                            \
+        j = snake( B, a, j, N );               \
     else                                       \
-        while ( j < i && match( B, j, a, j ) ) \
-            j += 1;                            \
+        j = snake( B, a, j, i );               \
     F0[ k ] = j;
 
             j = -2;
-            a = A + hgh;
+            a = Abase + hgh;
             i = M - hgh;
 
             for ( k = hgh; k > del; k-- )
@@ -178,7 +232,7 @@ static int v3_align_onp( msa_alignment* pAlign,
             }
 
             j = -2;
-            a = A + low;
+            a = Abase + low;
             i = M - low;
 
             for ( k = low; k < del; k++ )
@@ -203,7 +257,7 @@ static int v3_align_onp( msa_alignment* pAlign,
 
     {
         int k, h, m, e, c;
-        msa_profile_entry* a;
+        unsigned char* a;
         int ap = ( pAlign->pCtx->Aabs - A ) - 1; // (wave->Aabs - A) - 1;
         int bp = ( B - pAlign->pCtx->Babs ) + 1; // (B - wave->Babs) + 1;
 
@@ -233,7 +287,7 @@ static int v3_align_onp( msa_alignment* pAlign,
 
             if ( h < k ) // => e = -1 or 2
             {
-                a = A + k;
+                a = Abase + k;
 
                 if ( k < 0 )
                 {
@@ -249,7 +303,7 @@ static int v3_align_onp( msa_alignment* pAlign,
                     c = PVF[ D ][ h ] - 1;
                 }
 
-                while ( c >= m && match( B, c, a, c ) ) // a[c] == B[c])
+                while ( c >= m && a[ c ] == (unsigned char)B[ c ] )
                 {
                     c -= 1;
                 }
@@ -579,10 +633,15 @@ msa* msa_init()
     m->aln_ctx->trace  = NULL;
     m->aln_ctx->vecmax = 0;
     m->aln_ctx->vector = NULL;
+    m->aln_ctx->maxbase = 0;
+    m->aln_ctx->Abase   = NULL;
 
     m->ptp    = NULL;
     m->ptpmax = 0;
 
+    m->wb = 0;
+    m->we = -1;
+
     return m;
 }
 
@@ -603,9 +662,13 @@ void msa_free( msa* m )
     free( m->msa_smax );
     free( m->msa_seq );
     free( m->msa_lgaps );
+    free( m->msa_ids );
+
+    free( m->seq );
 
     free( m->aln_ctx->trace );
     free( m->aln_ctx->vector );
+    free( m->aln_ctx->Abase );
 
     free( m->aln_ctx );
 
@@ -614,12 +677,31 @@ void msa_free( msa* m )
     free( m );
 }
 
+// profile column of the A-read position pos
+
+static int msa_column( msa* m, int pos )
+{
+    pos -= m->wb;
+
+    if ( pos < 0 )
+    {
+        return 0;
+    }
+
+    if ( pos >= m->alen )
+    {
+        return m->curprof;
+    }
+
+    return m->track[ pos ];
+}
+
 void msa_print( msa* m, FILE* fileOut, int b, int e )
 {
     int i;
 
-    b = ( b == -1 ? 0 : m->track[b] );
-    e = ( e == -1 ? m->curprof : m->track[e] );
+    b = ( b == -1 ? 0 : msa_column( m, b ) );
+    e = ( e == -1 ? m->curprof : msa_column( m, e ) );
 
     for ( i = 0; i < m->added; i++ )
     {
@@ -653,8 +735,8 @@ void msa_print_simple( msa* m, FILE* filemsa, FILE* filerids, int b, int e )
 {
     int i;
 
-    b = m->track[ b ];
-    e = m->track[ e ];
+    b = msa_column( m, b );
+    e = msa_column( m, e );
 
     for ( i = 0; i < m->added; i++ )
     {
@@ -706,8 +788,8 @@ void msa_print_profile( msa* m, FILE* fileOut, int b, int e, int colorize )
 {
     msa_profile_entry* pEntry;
 
-    b = ( b == -1 ? 0 : m->track[ b ] );
-    e = ( e == -1 ? m->curprof : m->track[ e ] );
+    b = ( b == -1 ? 0 : msa_column( m, b ) );
+    e = ( e == -1 ? m->curprof : msa_column( m, e ) );
 
     // counts
 
@@ -742,7 +824,7 @@ void msa_print_profile( msa* m, FILE* fileOut, int b, int e, int colorize )
         for ( i = b; i < e; i++ )
         {
             pEntry = m->profile + i;
-            fprintf( fileOut, "%7lu", pEntry->counts[ nBase ] );
+            fprintf( fileOut, "%7d", pEntry->counts[ nBase ] );
         }
 
         fprintf( fileOut, "\n" );
@@ -774,8 +856,80 @@ void msa_print_profile( msa* m, FILE* fileOut, int b, int e, int colorize )
 
 void msa_reset( msa* m )
 {
+    int i;
+
+    for ( i = 0; i < m->added; i++ )
+    {
+        free( m->msa_seq[ i ] );
+    }
+
     m->curprof = 0;
     m->added   = 0;
+
+    m->wb = 0;
+    m->we = -1;
+}
+
+void msa_window( msa* m, int from, int to )
+{
+    assert( m->curprof == 0 && m->twidth > 0 );
+
+    m->wb = ( from / m->twidth ) * m->twidth;
+    m->we = ( ( to + m->twidth - 1 ) / m->twidth ) * m->twidth;
+}
+
+// clip the alignment of [pb, pe] x [sb, se] to the trace points inside the window.
+// returns 0 if no trace interval of it lies in the window.
+
+static int clip_to_window( msa* m, int* pb, int* pe, int* sb, int* se, ovl_trace** trace, int* tlen )
+{
+    int nseg = *tlen / 2;
+    int a    = *pb;
+    int b    = *sb;
+    int kb   = -1;
+    int ke   = -1;
+    int cpb = 0, cpe = 0, csb = 0, cse = 0;
+    int k;
+
+    for ( k = 0; k < nseg; k++ )
+    {
+        int anext = ( k == nseg - 1 ) ? *pe : ( *pb / m->twidth + k + 1 ) * m->twidth;
+
+        if ( kb == -1 && a >= m->wb )
+        {
+            kb  = k;
+            cpb = a;
+            csb = b;
+        }
+
+        b += ( *trace )[ 2 * k + 1 ];
+
+        if ( anext > m->we )
+        {
+            break;
+        }
+
+        ke  = k;
+        cpe = anext;
+        cse = b;
+
+        a = anext;
+    }
+
+    if ( kb == -1 || ke < kb )
+    {
+        return 0;
+    }
+
+    *pb = cpb;
+    *pe = cpe;
+    *sb = csb;
+    *se = cse;
+
+    *trace += 2 * kb;
+    *tlen = 2 * ( ke - kb + 1 );
+
+    return 1;
 }
 
 static void msa_add_first( msa* m, char* seq, int len )
@@ -862,7 +1016,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
         for ( i = 0; i < m->curprof; i++ )
         {
             msa_profile_entry* pe = m->profile + i;
-            unsigned long sum = pe->counts[ 0 ] + pe->counts[ 1 ] + pe->counts[ 2 ] + pe->counts[ 3 ];
+            int sum = pe->counts[ 0 ] + pe->counts[ 1 ] + pe->counts[ 2 ] + pe->counts[ 3 ];
 
             if ( sum < pe->counts[ 4 ] )
             {
@@ -873,6 +1027,31 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
     }
     */
 
+    if ( m->we != -1 )
+    {
+        if ( m->curprof == 0 )
+        {
+            int b = MAX( pb, m->wb );
+            int e = MIN( pe, m->we );
+
+            if ( b >= e ) // window outside of the A-read, use all of it
+            {
+                b = pb;
+                e = pe;
+            }
+
+            sb += b - pb;
+            se -= pe - e;
+
+            m->wb = pb = b;
+            m->we = pe = e;
+        }
+        else if ( tlen > 0 && !clip_to_window( m, &pb, &pe, &sb, &se, &trace, &tlen ) )
+        {
+            return;
+        }
+    }
+
     if ( m->msa_max <= m->added )
     {
         m->msa_max = m->msa_max * 1.2 + 10;
@@ -928,7 +1107,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
 
     if ( pb != -1 )
     {
-        aln.abpos = m->track[ pb ];
+        aln.abpos = m->track[ pb - m->wb ];
     }
     else
     {
@@ -937,7 +1116,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
 
     if ( pe != -1 )
     {
-        aln.aepos = m->track[ pe - 1 ] + 1;
+        aln.aepos = m->track[ pe - 1 - m->wb ] + 1;
     }
     else
     {
@@ -973,7 +1152,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
             ptp_p += m->twidth;
             ptp_s += trace[ i ];
 
-            aln.pPtPoints[ i - 1 ] = m->track[ ptp_p ];
+            aln.pPtPoints[ i - 1 ] = m->track[ ptp_p - m->wb ];
             aln.pPtPoints[ i ]     = ptp_s;
         }
     }
@@ -984,6 +1163,8 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
 
     // align
 
+    profile_bases( m, aln.abpos, aln.aepos );
+
     if ( !v3_align( &aln ) )
     {
         return;
@@ -1027,7 +1208,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
             while ( c <= b )
             {
                 m->profile[ n ] = m->profile[ p ];
-                m->profile[ n ].counts[ (unsigned char)aln.B[ b ] ]++;
+                count_inc( m->profile[ n ].counts + (unsigned char)aln.B[ b ] );
 
                 n--;
 
@@ -1038,7 +1219,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
             apply_gap( m, c + aln.abpos - sb, m->added, m->added + 1 );
 
             m->profile[ n ] = m->profile[ p ];
-            m->profile[ n ].counts[ 4 ]++;
+            count_inc( m->profile[ n ].counts + 4 );
             n--;
 
             p--;
@@ -1051,7 +1232,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
             while ( c <= p )
             {
                 m->profile[ n ] = m->profile[ p ];
-                m->profile[ n ].counts[ (unsigned char)aln.B[ b ] ]++;
+                count_inc( m->profile[ n ].counts + (unsigned char)aln.B[ b ] );
 
                 n--;
 
@@ -1062,12 +1243,13 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
             apply_gap( m, c, 0, m->added );
 
             memset( m->profile + n, 0, sizeof( msa_profile_entry ) );
-            m->profile[ n ].counts[ (unsigned char)aln.B[ b ] ]++;
-            m->profile[ n ].counts[ 4 ] = m->profile[ n + 1 ].counts[ 0 ] +
-                                          m->profile[ n + 1 ].counts[ 1 ] +
-                                          m->profile[ n + 1 ].counts[ 2 ] +
-                                          m->profile[ n + 1 ].counts[ 3 ] +
-                                          m->profile[ n + 1 ].counts[ 4 ];
+            count_inc( m->profile[ n ].counts + (unsigned char)aln.B[ b ] );
+            m->profile[ n ].counts[ 4 ] = MIN( MSA_COUNT_MAX,
+                                               m->profile[ n + 1 ].counts[ 0 ] +
+                                               m->profile[ n + 1 ].counts[ 1 ] +
+                                               m->profile[ n + 1 ].counts[ 2 ] +
+                                               m->profile[ n + 1 ].counts[ 3 ] +
+                                               m->profile[ n + 1 ].counts[ 4 ] );
 
             n--;
 
@@ -1078,7 +1260,7 @@ void msa_add( msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trac
     // aligned leftovers
     while ( b >= aln.bbpos )
     {
-        m->profile[ n ].counts[ (unsigned char)aln.B[ b ] ]++;
+        count_inc( m->profile[ n ].counts + (unsigned char)aln.B[ b ] );
 
         n--;
 
@@ -1141,8 +1323,9 @@ char* msa_consensus( msa* m, int dashes )
     }
 
     int curseq = 0;
-    unsigned char nMax, cMax;
-    unsigned short nCovGaps, nCov;
+    msa_count nMax;
+    unsigned char cMax;
+    int nCovGaps, nCov;
 
     int i, b;
 
@@ -5,9 +5,13 @@
 
 #include "dalign/align.h"
 
+typedef unsigned short msa_count;   // profile counts saturate at MSA_COUNT_MAX
+
+#define MSA_COUNT_MAX 0xffff
+
 typedef struct
 {
-    unsigned long counts[5];     // A C G T -
+    msa_count counts[5];     // A C G T -
 } msa_profile_entry;
 
 typedef struct
@@ -26,6 +30,9 @@ typedef struct
     int** PHF;
 
     msa_profile_entry* Aabs;
+
+    unsigned char* Abase;   // majority base of each profile column
+    int maxbase;
 } msa_alignment_ctx;
 
 typedef struct
@@ -56,6 +63,8 @@ typedef struct
     int* ptp;        // storage for pass through points
     int ptpmax;
 
+    int wb, we;      // A-read interval the msa is restricted to, we == -1 for the whole read
+
     msa_alignment_ctx* aln_ctx;
 } msa;
 
@@ -63,6 +72,10 @@ msa* msa_init();
 void msa_free(msa* m);
 void msa_reset(msa* m);
 
+// restrict the msa to the trace points around [from, to] of the A-read. must be called
+// before the A-read is added, the added sequences are clipped at their trace points.
+void msa_window(msa* m, int from, int to);
+
 void msa_add(msa* m, char* seq, int pb, int pe, int sb, int se, ovl_trace* trace, int tlen, int id);
 
 char* msa_consensus(msa* m, int dashes);
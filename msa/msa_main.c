@@ -7,6 +7,7 @@
 #include <sys/param.h>
 #include <assert.h>
 #include <unistd.h>
+#include <limits.h>
 
 #include "lib/oflags.h"
 #include "lib/tracks.h"
@@ -18,6 +19,12 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+// command line defaults
+
+#define DEF_ARG_J 1
+
+#define APPEND_BUFFER ( 1024 * 1024 )
+
 
 typedef struct
 {
@@ -28,6 +35,13 @@ typedef struct
     int a_to;
 
     int twidth;
+    int window;     // restrict the msa to [a_from, a_to]
+
+    // batch mode
+
+    int batch;
+    int nthreads;
+    char* selected;     // A-reads to build the msa for
 
     int nreads;
     char** reads;
@@ -120,6 +134,7 @@ static void post_msa(MsaContext* mctx)
 {
     fclose(mctx->fileOutConsensus);
     fclose(mctx->fileOutMsa);
+    fclose(mctx->fileOutIds);
 }
 
 static int handler_msa(void* _ctx, Overlap* pOvls, int nOvls)
@@ -139,6 +154,11 @@ static int handler_msa(void* _ctx, Overlap* pOvls, int nOvls)
 
     m->twidth = ctx->twidth;
 
+    if ( ctx->window )
+    {
+        msa_window( m, ctx->a_from, ctx->a_to );
+    }
+
     load_reads(ctx, pOvls, nOvls);
 
     msa_add(m, ctx->reads[0], 0, alen, 0, alen, NULL, 0, a);
@@ -179,9 +199,184 @@ static int handler_msa(void* _ctx, Overlap* pOvls, int nOvls)
     return ( ctx->rid == -1 );
 }
 
+// batch mode, msa of the whole pile of every selected A-read. each thread writes
+// to temporary files, which are appended to the output in file order.
+
+static int handler_batch(void* _ctx, Overlap* pOvls, int nOvls)
+{
+    MsaContext* ctx = _ctx;
+
+    int a = pOvls->aread;
+    int alen = DB_READ_LEN(ctx->db, a);
+
+    if ( !ctx->selected[a] )
+    {
+        return 1;
+    }
+
+    msa* m = ctx->m;
+
+    msa_reset(m);
+
+    load_reads(ctx, pOvls, nOvls);
+
+    msa_add(m, ctx->reads[0], 0, alen, 0, alen, NULL, 0, a);
+
+    int j;
+    for (j = 0; j < nOvls; j++)
+    {
+        Overlap* o = pOvls + j;
+
+        if (o->flags & OVL_DISCARD)
+        {
+            continue;
+        }
+
+        msa_add( m, ctx->reads[ j + 1 ],
+                 o->path.abpos, o->path.aepos,
+                 o->path.bbpos, o->path.bepos,
+                 o->path.trace, o->path.tlen,
+                 o->bread );
+    }
+
+    fprintf(ctx->fileOutMsa, ">%d\n", a);
+    fprintf(ctx->fileOutIds, ">%d\n", a);
+    msa_print_simple(m, ctx->fileOutMsa, ctx->fileOutIds, 0, alen);
+
+    fprintf(ctx->fileOutConsensus, ">%d\n", a);
+    write_seq(ctx->fileOutConsensus, msa_consensus(m, 0));
+
+    return 1;
+}
+
+static FILE* temp_output(int thread)
+{
+    FILE* file = tmpfile();
+
+    if (file == NULL)
+    {
+        fprintf(stderr, "failed to create temporary output for thread %d\n", thread);
+        exit(1);
+    }
+
+    return file;
+}
+
+static void* batch_thread_init(void* _ctx, int thread)
+{
+    MsaContext* ctx = (MsaContext*)_ctx;
+    MsaContext* tctx = malloc( sizeof(MsaContext) );
+
+    memcpy(tctx, ctx, sizeof(MsaContext));
+
+    tctx->m = msa_init();
+    tctx->m->twidth = ctx->twidth;
+
+    tctx->reads = NULL;
+    tctx->nreads = 0;
+
+    tctx->fileOutMsa = temp_output(thread);
+    tctx->fileOutConsensus = temp_output(thread);
+    tctx->fileOutIds = temp_output(thread);
+
+    return tctx;
+}
+
+static void append_output(FILE* fileIn, FILE* fileOut, char* buf)
+{
+    size_t len;
+
+    rewind(fileIn);
+
+    while ( (len = fread(buf, 1, APPEND_BUFFER, fileIn)) > 0 )
+    {
+        fwrite(buf, 1, len, fileOut);
+    }
+
+    fclose(fileIn);
+}
+
+static void batch_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
+
+    MsaContext* ctx = (MsaContext*)_ctx;
+    MsaContext* tctx = (MsaContext*)_tctx;
+
+    char* buf = malloc(APPEND_BUFFER);
+
+    append_output(tctx->fileOutMsa, ctx->fileOutMsa, buf);
+    append_output(tctx->fileOutConsensus, ctx->fileOutConsensus, buf);
+    append_output(tctx->fileOutIds, ctx->fileOutIds, buf);
+
+    free(buf);
+
+    int i;
+    for (i = 0; i < tctx->nreads; i++)
+    {
+        free(tctx->reads[i] - 1);
+    }
+
+    free(tctx->reads);
+
+    msa_free(tctx->m);
+
+    free(tctx);
+}
+
+static void select_reads(MsaContext* mctx, char* pathReadIds, int rb, int re)
+{
+    int nreads = DB_NREADS(mctx->db);
+    int i;
+
+    mctx->selected = calloc(nreads, 1);
+
+    if (pathReadIds)
+    {
+        FILE* fileIn = fopen(pathReadIds, "r");
+
+        if (fileIn == NULL)
+        {
+            fprintf(stderr, "could not open %s\n", pathReadIds);
+            exit(1);
+        }
+
+        int* values;
+        int nvalues;
+
+        fread_integers(fileIn, &values, &nvalues);
+
+        for (i = 0; i < nvalues; i++)
+        {
+            if (values[i] >= 0 && values[i] < nreads)
+            {
+                mctx->selected[ values[i] ] = 1;
+            }
+        }
+
+        free(values);
+        fclose(fileIn);
+    }
+    else
+    {
+        rb = MAX(rb, 0);
+        re = MIN(re, nreads - 1);
+
+        for (i = rb; i <= re; i++)
+        {
+            mctx->selected[i] = 1;
+        }
+    }
+}
+
 static void usage()
 {
-    printf("usage: <db> <overlaps> <base_out> <read.id> <max.ovls> <from> <to>\n");
+    printf("usage: [-w] <db> <overlaps> <base_out> <read.id> <from> <to>\n");
+    printf("       -b [-j n] [-r file] <db> <overlaps> <base_out> [<first.read> <last.read>]\n\n");
+    printf("options: -w  only align the trace point intervals around from..to\n");
+    printf("         -b  batch mode, msa and consensus of the piles of many reads\n");
+    printf("         -j n  number of threads in batch mode (default %d)\n", DEF_ARG_J);
+    printf("         -r file  ids of the reads to process in batch mode (default all or first..last)\n");
 }
 
 int main(int argc, char* argv[])
@@ -195,18 +390,69 @@ int main(int argc, char* argv[])
 
     mctx.db = &db;
 
-    if (argc != 7)
+    char* pathReadIds = NULL;
+    int c;
+
+    mctx.nthreads = DEF_ARG_J;
+
+    opterr = 0;
+
+    while ((c = getopt(argc, argv, "bj:r:w")) != -1)
+    {
+        switch (c)
+        {
+            case 'b':
+                mctx.batch = 1;
+                break;
+
+            case 'j':
+                mctx.nthreads = atoi(optarg);
+                break;
+
+            case 'r':
+                pathReadIds = optarg;
+                break;
+
+            case 'w':
+                mctx.window = 1;
+                break;
+
+            default:
+                usage();
+                exit(1);
+        }
+    }
+
+    if ( mctx.batch ? (argc - optind != 3 && argc - optind != 5) : (argc - optind != 6) )
     {
         usage();
         exit(1);
     }
 
-    char* pcPathReadsIn = argv[1];
-    char* pcPathOverlaps = argv[2];
-    mctx.base_out = argv[3];
-    mctx.rid = atoi(argv[4]);
-    mctx.a_from = atoi(argv[5]);
-    mctx.a_to = atoi(argv[6]);
+    if (mctx.nthreads < 1)
+    {
+        fprintf(stderr, "invalid number of threads %d\n", mctx.nthreads);
+        exit(1);
+    }
+
+    char* pcPathReadsIn = argv[optind++];
+    char* pcPathOverlaps = argv[optind++];
+    mctx.base_out = argv[optind++];
+
+    int rb = 0;
+    int re = INT_MAX;
+
+    if (!mctx.batch)
+    {
+        mctx.rid = atoi(argv[optind++]);
+        mctx.a_from = atoi(argv[optind++]);
+        mctx.a_to = atoi(argv[optind++]);
+    }
+    else if (optind < argc)
+    {
+        rb = atoi(argv[optind++]);
+        re = atoi(argv[optind++]);
+    }
 
     if ( (fileOvls = fopen(pcPathOverlaps, "r")) == NULL )
     {
@@ -229,10 +475,40 @@ int main(int argc, char* argv[])
 
     pre_msa(pctx, &mctx);
 
-    pass(pctx, handler_msa);
+    if (mctx.batch)
+    {
+        // the threads share the mapped bases
+
+        Map_Bases(&db);
+
+        select_reads(&mctx, pathReadIds, rb, re);
+
+        pctx->thread_init = batch_thread_init;
+        pctx->thread_reduce = batch_thread_reduce;
+
+        // balance the threads using the index, if there is an up to date one
+
+        if (mctx.nthreads > 1 && !pctx->is_laz)
+        {
+            pctx->index = lasidx_load(&db, pcPathOverlaps, 0);
+        }
+
+        pass_parallel(pctx, handler_batch, mctx.nthreads);
+
+        lasidx_close(pctx->index);
+
+        free(mctx.selected);
+    }
+    else
+    {
+        pass(pctx, handler_msa);
+    }
 
     post_msa(&mctx);
 
+    pass_free(pctx);
+    fclose(fileOvls);
+
     Close_DB(&db);
 
     return 0;
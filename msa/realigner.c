@@ -24,6 +24,7 @@
 #include <stdlib.h>
 
 #include <unistd.h>
+#include <pthread.h>
 
 #include "realigner.h"
 
@@ -42,7 +43,9 @@
 #define INIT_MAX_CONTIG_DEPTH  128
 #define INIT_MAX_FRAG_LENGTH  1024
 #define SPACE_GROWTH_RATE      1.2
-#define LIST_SPACE_BLOCK_SIZE 8192
+#define ARENA_SLAB_SIZE    1048576
+#define WINDOW_FACTOR            8  /* Windows of parallel passes span at least this many
+                                       average padded fragment lengths                   */
 
 #define MAX_CODE  5
 #define DASH_CODE 4         /* Code for -'s must be second to last code */
@@ -81,6 +84,7 @@ typedef struct re_column
                                     /* Used during realignment: */
     int        bound;               /*    inter-column position to left is a boundary */
     float      score[MAX_CODE+1];   /*    alignment scores for realignment            */
+    int        index;               /*    position in the contig (parallel passes)    */
   } re_column;
 
 typedef struct re_fragment
@@ -90,12 +94,28 @@ typedef struct re_fragment
     struct re_symbol   *next;
     int                 letter; /* '\0' char to identify record as a fragment and not a symbol */
     int                 row;    /* row sequence was on when input */
+    int                 ecol;   /* index of the column after its last symbol (parallel passes) */
   } re_fragment;
 
+typedef struct re_slab
+  { struct re_slab *next;   /* slabs of an arena, followed by ARENA_SLAB_SIZE bytes of records */
+  } re_slab;
+
+typedef struct
+  { re_slab     *slabs;           /* slabs, the first one is being cut */
+    char        *top;             /* next free byte in the first slab and bytes left there */
+    int          avail;
+    re_symbol   *free_symbols;    /* free lists of released records */
+    re_column   *free_columns;
+    long long    cells;           /* records cut from the slabs */
+    pthread_mutex_t lock;
+  } re_arena;
+
 typedef struct
   { re_fragment *frags;     /* anchor of singly-linked fragment list */
     re_column   *first;     /* first and last columns of contig */
     re_column   *last;
+    re_arena    *arena;     /* storage of the contig's records */
   } re_contig;
 
 
@@ -116,62 +136,105 @@ static void setup_encode()
 }
 
 
-/* Uniform list space of symbol, column and fragment records
-     (one macro defines all)                                   */
+/* Uniform list space of symbol, column and fragment records (one macro defines all).
+     Records are cut from the slabs of the contig's arena and recycled through its free
+     lists, so the records of a contig lie close together and freeing the contig frees
+     its slabs.  The arena is shared by the threads of a parallel realignment.          */
 
-static int avail_cells = 0;
+static re_arena *new_arena(void)
+{ re_arena *arena;
+
+  arena = (re_arena *) malloc(sizeof(re_arena));
+  arena->slabs = NULL;
+  arena->avail = 0;
+  arena->free_symbols   = NULL;
+  arena->free_columns   = NULL;
+  arena->cells = 0;
+  pthread_mutex_init(&arena->lock,NULL);
+  return (arena);
+}
+
+static void free_arena(re_arena *arena)
+{ re_slab *s, *t;
+
+  for (s = arena->slabs; s != NULL; s = t)
+    { t = s->next;
+      free(s);
+    }
+  pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
+
+static void *arena_cell(re_arena *arena, int size)
+{ void *ptr;
+
+  if (arena->avail < size)
+    { re_slab *s;
+
+      s = (re_slab *) malloc(sizeof(re_slab) + ARENA_SLAB_SIZE);
+      s->next      = arena->slabs;
+      arena->slabs = s;
+      arena->top   = (char *) (s+1);
+      arena->avail = ARENA_SLAB_SIZE;
+    }
+  ptr = arena->top;
+  arena->top   += size;
+  arena->avail -= size;
+  arena->cells += 1;
+  return (ptr);
+}
 
 #define LIST_SPACE(type,new_routine,free_routine,free_ptr,free_link)			\
 											\
-static type *free_ptr = NULL;								\
-											\
-static type *new_routine(void)								\
+static type *new_routine(re_arena *arena)						\
 { type *ptr;										\
 											\
-  if (free_ptr == NULL)									\
-    { int i;										\
-      free_ptr = ptr = (type *)								\
-          malloc(sizeof(type)*LIST_SPACE_BLOCK_SIZE);		\
-      for (i = 0; i < LIST_SPACE_BLOCK_SIZE; i++)					\
-        { ptr->free_link = ptr+1;							\
-          ptr += 1;									\
-        }										\
-      ptr[-1].free_link = NULL;								\
-      avail_cells += LIST_SPACE_BLOCK_SIZE;						\
+  pthread_mutex_lock(&arena->lock);							\
+  if (arena->free_ptr == NULL)								\
+    ptr = (type *) arena_cell(arena,sizeof(type));					\
+  else											\
+    { ptr = arena->free_ptr;								\
+      arena->free_ptr = ptr->free_link;							\
     }											\
-											\
-  ptr      = free_ptr;									\
-  free_ptr = ptr->free_link;								\
+  pthread_mutex_unlock(&arena->lock);							\
   return (ptr);										\
 }											\
 											\
-static void free_routine(type *ptr)							\
-{ ptr->free_link = free_ptr;								\
-  free_ptr       = ptr;									\
+static void free_routine(re_arena *arena, type *ptr)					\
+{ pthread_mutex_lock(&arena->lock);							\
+  ptr->free_link  = arena->free_ptr;							\
+  arena->free_ptr = ptr;								\
+  pthread_mutex_unlock(&arena->lock);							\
 }
 
-LIST_SPACE(re_symbol,new_symbol,free_symbol,free_symbol_ptr,next)
+LIST_SPACE(re_symbol,new_symbol,free_symbol,free_symbols,next)
+
+LIST_SPACE(re_column,new_column,free_column,free_columns,succ)
 
-LIST_SPACE(re_column,new_column,free_column,free_column_ptr,succ)
+/* Fragments are only released with their contig */
 
-LIST_SPACE(re_fragment,new_fragment,free_fragment,free_fragment_ptr,link)
+static re_fragment *new_fragment(re_arena *arena)
+{ re_fragment *ptr;
+
+  pthread_mutex_lock(&arena->lock);
+  ptr = (re_fragment *) arena_cell(arena,sizeof(re_fragment));
+  pthread_mutex_unlock(&arena->lock);
+  return (ptr);
+}
 
 #ifdef CHECK_MEMORY
 
-static void check_memory()
+static void check_memory(re_arena *arena)
 { re_symbol   *s;
   re_column   *c;
-  re_fragment *f;
   int          free_cells;
 
   free_cells = 0;
-  for (s = free_symbol_ptr; s != NULL; s = s->next)
+  for (s = arena->free_symbols; s != NULL; s = s->next)
     free_cells += 1;
-  for (c = free_column_ptr; c != NULL; c = c->succ)
+  for (c = arena->free_columns; c != NULL; c = c->succ)
     free_cells += 1;
-  for (f = free_fragment_ptr; f != NULL; f = f->link)
-    free_cells += 1;
-  fprintf(stderr,"Avail %d Free %d\n",avail_cells,free_cells);
+  fprintf(stderr,"Avail %lld Free %d\n",arena->cells,free_cells);
 }
 
 #endif
@@ -182,13 +245,16 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
   int          sym;
   re_column   *curcol, *firstcol;
   re_fragment *frags;
+  re_arena    *arena;
 
   if (encode == NULL)
     setup_encode();
 
+  arena = new_arena();
+
   /* Start with empty first column, and empty fragment list */
 
-  firstcol = curcol = new_column();
+  firstcol = curcol = new_column(arena);
   curcol->up = curcol->down = (re_symbol *) curcol;
   curcol->pred = NULL;
 
@@ -201,7 +267,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
 
   do
     { if (firstcol != curcol)        /* Not first time through this loop ==> saw a blank line */
-        { free_column(curcol);       /*   on the last pass, clean up and start over           */
+        { free_column(arena,curcol);       /*   on the last pass, clean up and start over           */
           curcol = firstcol;
         }
 
@@ -226,7 +292,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
           /* Add new, initially empty column */
 
           prevcol = curcol;
-          curcol  = new_column();
+          curcol  = new_column(arena);
           curcol->up = curcol->down = (re_symbol *) curcol;
           prevcol->succ = curcol;
           curcol->pred  = prevcol;
@@ -244,7 +310,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
           row = 0;
           if (sym != EOF)
             while (sym != '\n')
-              { e = new_symbol();
+              { e = new_symbol(arena);
                 e->down = (re_symbol *) curcol;
                 e->up   = curcol->up;
                 e->down->up = e->up->down = e;
@@ -255,7 +321,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
                         sym = ' ';
                       else
                         { re_fragment *f;
-                          f = new_fragment();
+                          f = new_fragment(arena);
                           f->scol   = curcol;
                           f->letter = '\0';
                           f->link   = frags;
@@ -293,7 +359,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
                 if (p->letter == ' ')
                   { q->up = p->up;
                     p->up->down = q;
-                    free_symbol(p);
+                    free_symbol(arena,p);
                   }
                 else if (e == (re_symbol *) curcol || e->letter == ' ')
                   { for (c = prevcol; p->letter == '-'; p = r)
@@ -302,7 +368,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
                         r->next = p->next;
                         p->up->down = p->down;
                         p->down->up = p->up;
-                        free_symbol(p);
+                        free_symbol(arena,p);
                         c->count[DASH_CODE] -= 1;
                         c->depth -= 1;
                         c = c->pred;
@@ -321,7 +387,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
         while ((s = curcol->down) != (re_symbol *) curcol)
           { s->up->down = s->down;
             s->down->up = s->up;
-            free_symbol(s);
+            free_symbol(arena,s);
           }
       }
     }
@@ -330,8 +396,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
   curcol->succ = NULL;
 
   if (firstcol->succ == curcol)   /* Nothing but zero or more blank lines and then EOF */
-    { free_column(curcol);        /*   Free columns and return NULL                    */
-      free_column(firstcol);
+    { free_arena(arena);                /*   Free columns and return NULL                    */
       return (NULL);
     }
 
@@ -340,6 +405,7 @@ Re_Contig *Re_Read_Contig(FILE *input, FILE *comments)
   readctg.frags = frags;
   readctg.first = firstcol;
   readctg.last  = curcol;
+  readctg.arena = arena;
 
   return ((Re_Contig *) (&readctg));
 }
@@ -537,24 +603,12 @@ void Re_Print_Structure(Re_Contig *contig, FILE *output)
 }
 
 void Re_Free_Contig(Re_Contig *contig)
-{ re_contig   *ctg = (re_contig *) contig;
-  re_fragment *f, *g;
-  re_symbol   *s;
+{ re_contig *ctg = (re_contig *) contig;
 
-  /* Each fragment list can be linked onto its free list as a
-     linked block, as can the entire list of column anchors    */
+  /* All records of the contig are in the slabs of its arena */
 
-  for (f = ctg->frags; f != NULL; f = g)
-    { g = f->link;
-      s = (re_symbol *) f;
-      if (s != s->next)
-        { s->prev->next   = free_symbol_ptr;
-          free_symbol_ptr = s->next;
-        }
-      free_fragment(f);
-    }
-  ctg->last->succ   = free_column_ptr;
-  free_column_ptr   = ctg->first;
+  free_arena(ctg->arena);
+  ctg->arena = NULL;
 }
 
 Re_Contig *Re_Start_Contig(int id, char *seq)
@@ -566,18 +620,21 @@ Re_Contig *Re_Start_Contig(int id, char *seq)
 
   re_column   *first, *last;
   re_fragment *frag;
+  re_arena    *arena;
 
   if (encode == NULL)
     setup_encode();
 
-  d = first = new_column();
+  arena = new_arena();
+
+  d = first = new_column(arena);
   d->down = d->up = (re_symbol *) d;
   d->pred = NULL;
-  f = (re_symbol *) (frag = new_fragment());
+  f = (re_symbol *) (frag = new_fragment(arena));
 
   for (s = seq; *s != '\0'; s++)
-    { c = new_column();
-      e = new_symbol();
+    { c = new_column(arena);
+      e = new_symbol(arena);
 
       c->down = c->up = e;
       e->down = e->up = (re_symbol *) c;
@@ -607,7 +664,7 @@ Re_Contig *Re_Start_Contig(int id, char *seq)
   e->prev   = f;
   f->next   = e;;
 
-  c = last = new_column();
+  c = last = new_column(arena);
   c->down = c->up = (re_symbol *) c;
   c->pred = d;
   d->succ = c;
@@ -616,6 +673,7 @@ Re_Contig *Re_Start_Contig(int id, char *seq)
   seedctg.first = first;
   seedctg.last  = last;
   seedctg.frags = frag;
+  seedctg.arena = arena;
 
   return ((Re_Contig *) (&seedctg));
 }
@@ -633,7 +691,8 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
   static int     dpmax  = -1;
   static int     segmax = -1;
 
-  re_contig   *ctg = (re_contig *) contig;
+  re_contig   *ctg   = (re_contig *) contig;
+  re_arena    *arena = ctg->arena;
 
   re_fragment *base;             /* The re_fragment record for the aread                   */
   re_column   *cstart, *cfinis;  /* Column interval to realign against                     */
@@ -899,14 +958,14 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
     re_symbol   *s, *p;
     re_fragment *read;
 
-    s = (re_symbol *) (read = new_fragment());
+    s = (re_symbol *) (read = new_fragment(arena));
     s->letter = '\0';
     for (j = blen-1; j > 0; j--)
       { while (cbck[j] == DEL)
           {
             /* Weave a '-' into the column mincol for the read */
 
-            p = new_symbol();
+            p = new_symbol(arena);
             p->next   = s;
             s->prev   = p;
             p->letter = '-';
@@ -930,7 +989,7 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
                contains the non-dash char of the read and a column of
                '-'s for each read not ending at the boundary          */
 
-            c = new_column();
+            c = new_column(arena);
             c->pred = mincol;
             c->succ = mincol->succ;
             c->pred->succ = c->succ->pred = c;
@@ -946,7 +1005,7 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
 
             for (t = mincol->up; t != (re_symbol *) mincol; t = t->up)
               if (t->next->letter != '\0')
-                { u = new_symbol();
+                { u = new_symbol(arena);
                   u->letter = '-';
                   u->prev   = t;
                   u->next   = t->next;
@@ -959,7 +1018,7 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
                   c->count[DASH_CODE] += 1;
                 }
 
-            p = new_symbol();
+            p = new_symbol(arena);
             p->next   = s;
             s->prev   = p;
             p->letter = seq[j];
@@ -972,7 +1031,7 @@ void Re_Add_Overlap(Re_Contig *contig, Overlap *o, char *seq, int bandsize)
 
           /* Weave the char of the read into column mincol */
 
-          { p = new_symbol();
+          { p = new_symbol(arena);
             p->next   = s;
             s->prev   = p;
             p->letter = seq[j];
@@ -1116,10 +1175,21 @@ char *Re_Next_Column(int **ids)
   return (column);
 }
 
-static void Re_Align_Fragment(re_fragment *read, int bandsize)
-{ static double *matrix = NULL;
-  static char   *trace  = NULL;
-  static int     readmax = -1;
+/* D.p. space of a realignment, one per thread */
+
+typedef struct
+  { double *matrix;
+    char   *trace;
+    int     readmax;
+  } re_workspace;
+
+static re_workspace Seq_Work = { NULL, NULL, -1 };
+
+static void Re_Align_Fragment(re_fragment *read, int bandsize, re_workspace *work,
+                              re_arena *arena)
+{ double    *matrix = work->matrix;
+  char      *trace  = work->trace;
+  int        readmax = work->readmax;
 
   int        bandwidth;        /* Bandwidth for realignment                                */
   re_column *cstart, *cfinis;  /* Column interval to realign against [cstart,cfinis)       */
@@ -1137,8 +1207,6 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
 #define DEL 2
 
   bandwidth = 2*bandsize;
-  if (encode == NULL)
-    setup_encode();
 
   /* Strip fragment from structure, compute its padded length, and
      determine the range of columns against which to realign it. */
@@ -1228,6 +1296,9 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
       newsize = readmax*(bandwidth+1);
       matrix  = (double *) realloc(matrix,sizeof(double)*newsize);
       trace   = (char   *) realloc(trace ,  sizeof(char)*newsize);
+      work->matrix  = matrix;
+      work->trace   = trace;
+      work->readmax = readmax;
     }
 
   /* Do the d.p. in the forward direction computing successive
@@ -1353,7 +1424,7 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
 
             /* Weave a '-' into the column mincol for the read */
 
-            p = new_symbol();
+            p = new_symbol(arena);
             p->prev   = s;
             p->next   = s->next;
             p->letter = '-';
@@ -1380,7 +1451,7 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
                 s = s->next;
                 s->prev = p->prev;
                 p->prev->next = s;
-                free_symbol(p);
+                free_symbol(arena,p);
               }
             else
               { re_column *c;
@@ -1390,7 +1461,7 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
                    contains the non-dash char of the read and a column of
                    '-'s for each read not ending at the boundary          */
 
-                c = new_column();
+                c = new_column(arena);
                 c->pred = mincol;
                 c->succ = mincol->succ;
                 c->pred->succ = c->succ->pred = c;
@@ -1406,7 +1477,7 @@ static void Re_Align_Fragment(re_fragment *read, int bandsize)
 
                 for (t = mincol->up; t != (re_symbol *) mincol; t = t->up)
                   if (t->next->letter != '\0')
-                    { u = new_symbol();
+                    { u = new_symbol(arena);
                       u->letter = '-';
                       u->prev   = t;
                       u->next   = t->next;
@@ -1465,16 +1536,185 @@ static int num_contigs;
 static int total_iterations;
 #endif
 
+/* Windows of a parallel realignment pass, handed out to the threads one at a time */
+
+typedef struct
+  { re_fragment   **frags;      /* fragments inside window w are frags[wfirst[w],wfirst[w+1]) */
+    int            *wfirst;
+    int             nwindows;
+    int             next;       /* next window to realign */
+    int             bandsize;
+    re_arena       *arena;
+    pthread_mutex_t lock;
+  } re_windows;
+
+static void *realign_windows(void *arg)
+{ re_windows  *win = (re_windows *) arg;
+  re_workspace work = { NULL, NULL, -1 };
+
+  while (1)
+    { int w, i;
+
+      pthread_mutex_lock(&win->lock);
+      w = win->next;
+      if (w < win->nwindows)
+        win->next += 1;
+      pthread_mutex_unlock(&win->lock);
+
+      if (w >= win->nwindows)
+        break;
+
+      for (i = win->wfirst[w]; i < win->wfirst[w+1]; i++)
+        Re_Align_Fragment(win->frags[i],win->bandsize,&work,win->arena);
+    }
+
+  free(work.matrix);
+  free(work.trace);
+  return (NULL);
+}
+
+/* Realign every fragment in a pass over windows of the contig's columns.  Realigning a
+   fragment touches only the columns from one before to one after its padded range, so
+   the fragments whose range (plus a margin) lies inside a window are realigned window
+   by window in parallel, and those crossing a window border sequentially afterwards.
+   Within each window and for the border fragments the order of the list is kept.       */
+
+static void Re_Align_Windows(re_contig *ctg, int bandsize, int nthreads)
+{ re_windows   win;
+  re_fragment *f, **border;
+  re_column   *c;
+  int          ncols, nfrags, nborder, width, i, w;
+  int         *fwin;
+  long long    padded;
+
+  ncols = 0;
+  for (c = ctg->first; c != NULL; c = c->succ)
+    { re_symbol *s;
+
+      c->index = ncols++;
+      for (s = c->down; s != (re_symbol *) c; s = s->down)
+        if (s->next->letter == '\0')
+          ((re_fragment *) (s->next))->ecol = ncols;
+    }
+
+  nfrags = 0;
+  for (f = ctg->frags; f != NULL; f = f->link)
+    nfrags += 1;
+
+  win.frags = (re_fragment **) malloc(sizeof(re_fragment *)*nfrags);
+  border    = (re_fragment **) malloc(sizeof(re_fragment *)*nfrags);
+  fwin      = (int *) malloc(sizeof(int)*nfrags*3);
+
+  /* Padded column range [fwin[3i+1],fwin[3i+2]) of each non-empty fragment, fwin[3i]
+     becomes its window or -1 if it crosses a border                                   */
+
+  padded = 0;
+  nfrags = 0;
+  for (f = ctg->frags; f != NULL; f = f->link)
+    if (f->next != (re_symbol *) f)
+      { win.frags[nfrags] = f;
+        fwin[3*nfrags+1]  = f->scol->index - (bandsize+2);
+        fwin[3*nfrags+2]  = f->ecol + (bandsize+2);
+        padded += fwin[3*nfrags+2] - fwin[3*nfrags+1];
+        nfrags += 1;
+      }
+
+  if (nfrags > 0)
+    width = WINDOW_FACTOR * (padded/nfrags);
+  else
+    width = ncols;
+  if (width < 1)
+    width = 1;
+  win.nwindows = ncols/width + 1;
+  win.wfirst   = (int *) calloc(win.nwindows+1,sizeof(int));
+
+  /* Bucket the fragments by window, keeping the list order */
+
+  for (i = 0; i < nfrags; i++)
+    { int b = fwin[3*i+1];
+      int e = fwin[3*i+2];
+
+      if (b >= 0 && b/width == e/width)
+        { fwin[3*i] = b/width;
+          win.wfirst[b/width+1] += 1;
+        }
+      else
+        fwin[3*i] = -1;
+    }
+  for (w = 0; w < win.nwindows; w++)
+    win.wfirst[w+1] += win.wfirst[w];
+
+  { re_fragment **inside;
+    int          *next;
+
+    inside = (re_fragment **) malloc(sizeof(re_fragment *)*(nfrags+1));
+    next   = (int *) malloc(sizeof(int)*(win.nwindows+1));
+    for (w = 0; w <= win.nwindows; w++)
+      next[w] = win.wfirst[w];
+
+    nborder = 0;
+    for (i = 0; i < nfrags; i++)
+      if (fwin[3*i] >= 0)
+        inside[next[fwin[3*i]]++] = win.frags[i];
+      else
+        border[nborder++] = win.frags[i];
+
+    free(next);
+    free(win.frags);
+    win.frags = inside;
+  }
+
+  /* Realign the windows concurrently */
+
+  win.next     = 0;
+  win.bandsize = bandsize;
+  win.arena    = ctg->arena;
+  pthread_mutex_init(&win.lock,NULL);
+
+  { pthread_t *threads;
+    int        nt;
+
+    nt = nthreads;
+    if (nt > win.nwindows)
+      nt = win.nwindows;
+    threads = (pthread_t *) malloc(sizeof(pthread_t)*nt);
+    for (i = 0; i < nt; i++)
+      pthread_create(threads+i,NULL,realign_windows,&win);
+    for (i = 0; i < nt; i++)
+      pthread_join(threads[i],NULL);
+    free(threads);
+  }
+
+  pthread_mutex_destroy(&win.lock);
+
+  /* Then the fragments crossing a border */
+
+  for (i = 0; i < nborder; i++)
+    Re_Align_Fragment(border[i],bandsize,&Seq_Work,ctg->arena);
+
+  free(fwin);
+  free(border);
+  free(win.frags);
+  free(win.wfirst);
+}
+
 /* Return how much the consensus score was improved by */
 
 int Re_Align_Contig(Re_Contig *contig, int bandsize)
+{ return (Re_Align_Contig_Parallel(contig,bandsize,1)); }
+
+int Re_Align_Contig_Parallel(Re_Contig *contig, int bandsize, int nthreads)
 { static re_column* bprelft = NULL;
   static re_column *bprergt, *bsufrgt, *bsuflft;
 
-  re_contig *ctg = (re_contig *) contig;
+  re_contig *ctg   = (re_contig *) contig;
+  re_arena  *arena = ctg->arena;
 
   int score, oldscore, original;
 
+  if (encode == NULL)
+    setup_encode();
+
   /* If first time, create column padding for each end of consensus */
 
   if (bprelft == NULL)
@@ -1518,11 +1758,14 @@ int Re_Align_Contig(Re_Contig *contig, int bandsize)
     {
       /* Realign every fragment (in reverse order of list) */
 
+      if (nthreads > 1)
+        Re_Align_Windows(ctg,bandsize,nthreads);
+      else
       { re_fragment *f;
 
         for (f = ctg->frags; f != NULL; f = f->link)
           if (f->next != (re_symbol *) f)
-            { Re_Align_Fragment(f,bandsize);
+            { Re_Align_Fragment(f,bandsize,&Seq_Work,ctg->arena);
 
 #ifdef DEBUG_REALIGN
               printf("\nFragment = %p\n",f);
@@ -1539,7 +1782,7 @@ int Re_Align_Contig(Re_Contig *contig, int bandsize)
 
         c = bprergt->succ;
         for (b = bprergt; b->depth > 0; b = b->pred)  /* Initial border */
-          { a = new_column();
+          { a = new_column(arena);
             *a = *b;
             a->down->up = a->up->down = (re_symbol *) a;
             a->succ = c;
@@ -1558,7 +1801,7 @@ int Re_Align_Contig(Re_Contig *contig, int bandsize)
 
         c = bsuflft->pred;
         for (b = bsuflft; b->depth > 0; b = b->succ)  /* Tail border */
-          { a = new_column();
+          { a = new_column(arena);
             *a = *b;
             a->down->up = a->up->down = (re_symbol *) a;
             a->pred = c;
@@ -1589,9 +1832,9 @@ int Re_Align_Contig(Re_Contig *contig, int bandsize)
                       ((re_fragment *) (s->prev))->scol = d;
                     s->prev->next = s->next;
                     s->next->prev = s->prev;
-                    free_symbol(s);
+                    free_symbol(arena,s);
                   }
-                free_column(c);
+                free_column(arena,c);
               }
           }
       }
@@ -34,6 +34,12 @@ int Re_Consensus_Score(Re_Contig *contig);
 
 int Re_Align_Contig(Re_Contig *contig, int bandsize);
 
+  // The same with nthreads threads.  Each pass realigns the fragments inside windows of the
+  //   contig's columns concurrently and the fragments crossing a window border after them.
+  //   The result does not depend on nthreads > 1, but differs from the sequential one.
+
+int Re_Align_Contig_Parallel(Re_Contig *contig, int bandsize, int nthreads);
+
   // Free the storage for a contig
 
 void Re_Free_Contig(Re_Contig *contig);
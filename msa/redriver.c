@@ -22,14 +22,16 @@
 #define OPT_B_DEFAULT 8
 #define OPT_R_DEFAULT 0
 #define OPT_C_DEFAULT 0
+#define OPT_J_DEFAULT 1
 
 extern char *optarg;
 extern int optind, opterr, optopt;
 
 static void usage()
 {
-    printf("[-b <int>] [-r] [-c]\n");
+    printf("[-b <int>] [-j <int>] [-r] [-c]\n");
     printf("options: -b ... band width (%d)\n", OPT_B_DEFAULT);
+    printf("         -j ... threads (%d)\n", OPT_J_DEFAULT);
     printf("         -r ... same rows (%d)\n", OPT_R_DEFAULT);
     printf("         -c ... comments (%d)\n", OPT_C_DEFAULT);
 }
@@ -40,12 +42,13 @@ int main(int argc, char *argv[])
 int bandwidth = OPT_B_DEFAULT;
   int samerows = OPT_R_DEFAULT;
   int comments = OPT_C_DEFAULT;
+  int nthreads = OPT_J_DEFAULT;
  
     int c;
     
     opterr = 0;
     
-    while ((c = getopt(argc, argv, "crb:")) != -1)
+    while ((c = getopt(argc, argv, "crb:j:")) != -1)
     {
         switch (c)
         {
@@ -60,6 +63,10 @@ int bandwidth = OPT_B_DEFAULT;
             case 'r':
                       samerows = 1;
                       break;
+
+            case 'j':
+                      nthreads = atoi(optarg);
+                      break;
                       
             default:
                       usage();
@@ -83,7 +90,7 @@ int bandwidth = OPT_B_DEFAULT;
       Re_Print_Structure(ctg,stdout);
 #endif
 
-      Re_Align_Contig(ctg,bandwidth);
+      Re_Align_Contig_Parallel(ctg,bandwidth,nthreads);
 
 #ifdef DEBUG
       Re_Print_Structure(ctg,stdout);
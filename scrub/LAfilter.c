@@ -26,12 +26,15 @@
 #include "dalign/align.h"
 #include "db/DB.h"
 
+#include "scrub/stage.h"
+
 // command line defaults
 
 #define DEF_ARG_S -1
 #define DEF_ARG_T TRACK_TRIM
 #define DEF_ARG_TT 0
 #define DEF_ARG_R TRACK_REPEATS
+#define DEF_ARG_J 1
 
 #define DEF_ARG_NN_LEN 2000
 #define DEF_ARG_NN_RATE 80
@@ -47,6 +50,7 @@
 #define READ_NONE 0x0
 #define READ_DISCARD ( 0x1 << 0 )
 #define READ_STRICT ( 0x1 << 1 )
+#define READ_EDGES ( 0x1 << 2 )     // has excluded edges
 
 // debug toggles
 
@@ -61,6 +65,16 @@
 #endif
 
 
+// edges excluded by the rules, an open addressing hash of their (a, b) keys
+// holding both orientations. key 0 marks a free slot.
+
+typedef struct
+{
+    uint64_t* keys;
+    uint64_t mask;          // slots - 1
+    uint64_t n;
+} EdgeSet;
+
 typedef struct
 {
     // stats counters
@@ -85,6 +99,7 @@ typedef struct
     int rm_aggressive; // -M
     int do_trim;
     int contained;     // -c
+    int nthreads;      // -j
 
     int hrd;      // -N
     int hrd_len;  // -N x,-,-
@@ -125,6 +140,10 @@ typedef struct
     HITS_TRACK* trackRepeat;
     HITS_TRACK* trackTrim;
     HITS_TRACK* trackRepeatStrict;
+    track_cache* tracks;
+
+    track_intervals* repeats;       // repeat tracks as sorted intervals
+    track_intervals* repeatsStrict;
 
     int* r2bin;
     int max_r2bin;
@@ -135,81 +154,136 @@ typedef struct
 
     ovl_header_twidth twidth;
 
+    // command line
+
+    char* pathRules;
+    EdgeSet* exclude_edges;     // pair rules, NULL if there are none
+    char* pcTrackRepeats;
+    char* pcTrackRepeatsStrict;
+    char* pcTrackTrim;
+    int purge;
+
+    int loaded;     // tracks and rules
+
 } FilterContext;
 
 
-typedef struct
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+static int cmp_ovl_q_desc( const void* a, const void* b )
 {
-    int* exclude_reads;
-    int exclude_reads_n;
+    Overlap* o1 = *(Overlap**)a;
+    Overlap* o2 = *(Overlap**)b;
 
-    int* exclude_edges;
-    int exclude_edges_n;
+    float q1 = 1.0 * o1->path.diffs / ( o1->path.aepos - o1->path.abpos );
+    float q2 = 1.0 * o2->path.diffs / ( o2->path.aepos - o2->path.abpos );
 
-    int* include_edges;
-    int include_edges_n;
+    if ( q1 < q2 )
+    {
+        return 1;
+    }
+    else if ( q2 > q1 )
+    {
+        return -1;
+    }
 
-    int* strict_reads;
-    int strict_reads_n;
-} FilterRules;
+    return 0;
+}
 
+static inline uint64_t edge_key( int a, int b )
+{
+    return ( ( (uint64_t)(uint32_t)a << 32 ) | (uint32_t)b ) + 1;
+}
 
-extern char* optarg;
-extern int optind, opterr, optopt;
+static inline uint64_t edge_slot( EdgeSet* edges, uint64_t key )
+{
+    return ( ( key * 0x9e3779b97f4a7c15llu ) >> 32 ) & edges->mask;
+}
 
-static int cmp_int( const void* a, const void* b )
+static void edge_set_add( EdgeSet* edges, int a, int b )
 {
-    return ( *(int*)a ) - ( *(int*)b );
+    uint64_t key  = edge_key( a, b );
+    uint64_t slot = edge_slot( edges, key );
+
+    while ( edges->keys[ slot ] != 0 )
+    {
+        if ( edges->keys[ slot ] == key )
+        {
+            return;
+        }
+
+        slot = ( slot + 1 ) & edges->mask;
+    }
+
+    edges->keys[ slot ] = key;
+    edges->n += 1;
 }
 
-static int cmp_2int( const void* a, const void* b )
+static inline int edge_set_has( EdgeSet* edges, int a, int b )
 {
-    int cmp = cmp_int( a, b );
+    uint64_t key  = edge_key( a, b );
+    uint64_t slot = edge_slot( edges, key );
 
-    if ( cmp )
+    while ( edges->keys[ slot ] != 0 )
     {
-        return cmp;
+        if ( edges->keys[ slot ] == key )
+        {
+            return 1;
+        }
+
+        slot = ( slot + 1 ) & edges->mask;
     }
 
-    return cmp_int( ( (int*)a ) + 1, ( (int*)b ) + 1 );
+    return 0;
 }
 
-static int cmp_ovl_q_desc( const void* a, const void* b )
+static EdgeSet* edge_set_new( int* pairs, int npairs )
 {
-    Overlap* o1 = *(Overlap**)a;
-    Overlap* o2 = *(Overlap**)b;
+    EdgeSet* edges = malloc( sizeof( EdgeSet ) );
+    uint64_t slots = 16;
+    int i;
 
-    float q1 = 1.0 * o1->path.diffs / ( o1->path.aepos - o1->path.abpos );
-    float q2 = 1.0 * o2->path.diffs / ( o2->path.aepos - o2->path.abpos );
+    // both orientations at a load of at most 1/2
 
-    if ( q1 < q2 )
+    while ( slots < 4 * (uint64_t)npairs )
     {
-        return 1;
+        slots *= 2;
     }
-    else if ( q2 > q1 )
+
+    edges->keys = calloc( slots, sizeof( uint64_t ) );
+    edges->mask = slots - 1;
+    edges->n    = 0;
+
+    for ( i = 0; i < npairs; i++ )
     {
-        return -1;
+        edge_set_add( edges, pairs[ 2 * i ], pairs[ 2 * i + 1 ] );
+        edge_set_add( edges, pairs[ 2 * i + 1 ], pairs[ 2 * i ] );
     }
 
-    return 0;
+    return edges;
 }
 
-static void fread_rules( FILE* fin, FilterRules* rules )
+static void edge_set_free( EdgeSet* edges )
 {
+    free( edges->keys );
+    free( edges );
+}
+
+// single read rules become read flags, the excluded edges an EdgeSet
+
+static void fread_rules( FILE* fin, FilterContext* ctx )
+{
+    HITS_READ* reads = ctx->db->reads;
+    int nreads       = DB_NREADS( ctx->db );
     char* line;
     size_t len;
-    int* singles      = NULL;
-    int singles_cur   = 0;
-    int singles_max   = 0;
-    int* multi_inc    = NULL;
-    int multi_inc_cur = 0;
-    int multi_inc_max = 0;
-    int* multi_ex     = NULL;
-    int multi_ex_cur  = 0;
-    int multi_ex_max  = 0;
-    int* strict       = NULL;
-    int strict_cur    = 0;
-    int strict_max    = 0;
+    int* pairs     = NULL;
+    int npairs     = 0;
+    int maxpairs   = 0;
+    int nexclude   = 0;
+    int nstrict    = 0;
+    int ninclude   = 0;
 
     while ( ( line = fgetln( fin, &len ) ) != NULL )
     {
@@ -241,97 +315,74 @@ static void fread_rules( FILE* fin, FilterRules* rules )
 
         if ( single )
         {
-            if ( mode == '-' )
+            int a = strtoimax( line + 1, NULL, 10 );
+
+            if ( a < 0 || a >= nreads )
             {
-                if ( singles_max == singles_cur )
-                {
-                    singles_max = singles_max * 1.2 + 100;
-                    singles     = realloc( singles, sizeof( int ) * singles_max );
-                }
+                printf( "read out of range: %*s\n", (int)( len - 1 ), line );
+                continue;
+            }
 
-                singles[ singles_cur ] = strtoimax( line + 1, NULL, 10 );
-                singles_cur += 1;
+            if ( mode == '-' )
+            {
+                reads[ a ].flags |= READ_DISCARD;
+                nexclude += 1;
             }
             else if ( mode == 's' )
             {
-                if ( strict_max == strict_cur )
-                {
-                    strict_max = strict_max * 1.2 + 100;
-                    strict     = realloc( strict, sizeof( int ) * strict_max );
-                }
-
-                strict[ strict_cur ] = strtoimax( line + 1, NULL, 10 );
-                strict_cur += 1;
+                reads[ a ].flags |= READ_STRICT;
+                nstrict += 1;
             }
         }
-        else
+        else if ( mode == '-' )
         {
             *sep = '\0';
 
-            if ( mode == '-' )
-            {
-                if ( multi_ex_cur + 4 >= multi_ex_max )
-                {
-                    multi_ex_max = multi_ex_max * 1.2 + 100;
-                    multi_ex     = realloc( multi_ex, sizeof( int ) * multi_ex_max );
-                }
-
-                multi_ex[ multi_ex_cur ]     = strtoimax( line + 1, NULL, 10 );
-                multi_ex[ multi_ex_cur + 1 ] = strtoimax( sep + 1, NULL, 10 );
-                multi_ex[ multi_ex_cur + 2 ] = multi_ex[ multi_ex_cur + 1 ];
-                multi_ex[ multi_ex_cur + 3 ] = multi_ex[ multi_ex_cur ];
+            int a = strtoimax( line + 1, NULL, 10 );
+            int b = strtoimax( sep + 1, NULL, 10 );
 
-                multi_ex_cur += 4;
+            if ( a < 0 || a >= nreads || b < 0 || b >= nreads )
+            {
+                *sep = '-';
+                printf( "read out of range: %*s\n", (int)( len - 1 ), line );
+                continue;
             }
-            else
+
+            if ( npairs == maxpairs )
             {
-                if ( multi_inc_cur + 4 >= multi_inc_max )
-                {
-                    multi_inc_max = multi_inc_max * 1.2 + 100;
-                    multi_inc     = realloc( multi_inc, sizeof( int ) * multi_inc_max );
-                }
+                maxpairs = maxpairs * 1.2 + 100;
+                pairs    = realloc( pairs, sizeof( int ) * 2 * maxpairs );
+            }
 
-                multi_inc[ multi_inc_cur ]     = strtoimax( line + 1, NULL, 10 );
-                multi_inc[ multi_inc_cur + 1 ] = strtoimax( sep + 1, NULL, 10 );
-                multi_inc[ multi_inc_cur + 2 ] = multi_inc[ multi_inc_cur + 1 ];
-                multi_inc[ multi_inc_cur + 3 ] = multi_inc[ multi_inc_cur ];
+            pairs[ 2 * npairs ]     = a;
+            pairs[ 2 * npairs + 1 ] = b;
+            npairs += 1;
 
-                multi_inc_cur += 4;
-            }
+            reads[ a ].flags |= READ_EDGES;
+            reads[ b ].flags |= READ_EDGES;
+        }
+        else
+        {
+            ninclude += 1;
         }
     }
 
-    qsort( singles, singles_cur, sizeof( int ), cmp_int );
-    qsort( strict, strict_cur, sizeof( int ), cmp_int );
-    qsort( multi_inc, multi_inc_cur / 2, sizeof( int ) * 2, cmp_2int );
-    qsort( multi_ex, multi_ex_cur / 2, sizeof( int ) * 2, cmp_2int );
-
-    rules->exclude_reads   = singles;
-    rules->exclude_reads_n = singles_cur;
+    printf( "excluding %d reads\n", nexclude );
+    printf( "strict repeats for %d reads\n", nstrict );
 
-    rules->strict_reads   = strict;
-    rules->strict_reads_n = strict_cur;
+    if ( npairs > 0 )
+    {
+        ctx->exclude_edges = edge_set_new( pairs, npairs );
 
-    rules->exclude_edges   = multi_ex;
-    rules->exclude_edges_n = multi_ex_cur;
+        printf( "excluding %d edges\n", npairs );
+    }
 
-    rules->include_edges   = multi_inc;
-    rules->include_edges_n = multi_inc_cur;
+    if ( ninclude > 0 )
+    {
+        printf( "ignoring %d include rules\n", ninclude );
+    }
 
-    int i;
-    printf( "exclude reads: " );
-    for ( i = 0; i < rules->exclude_reads_n; i++ )
-        printf( "%d ", rules->exclude_reads[ i ] );
-    printf( "\nstrict reads: " );
-    for ( i = 0; i < rules->strict_reads_n; i++ )
-        printf( "%d ", rules->strict_reads[ i ] );
-    printf( "\ninclude edges: " );
-    for ( i = 0; i < rules->include_edges_n; i += 2 )
-        printf( "%d-%d ", rules->include_edges[ i ], rules->include_edges[ i + 1 ] );
-    printf( "\nexclude edges: " );
-    for ( i = 0; i < rules->exclude_edges_n; i += 2 )
-        printf( "%d-%d ", rules->exclude_edges[ i ], rules->exclude_edges[ i + 1 ] );
-    printf( "\n" );
+    free( pairs );
 }
 
 static int loader_handler( void* _ctx, Overlap* ovl, int novl )
@@ -628,7 +679,7 @@ static int find_repeat_modules( FilterContext* ctx, Overlap* ovls, int novl )
     if ( oe - ob > ctx->rm_maxrepeat ) // bytes
     {
         ctx->rm_maxrepeat = ( oe - ob ) + 128;
-        ctx->rm_repeat    = malloc( ctx->rm_maxrepeat );
+        ctx->rm_repeat    = realloc( ctx->rm_repeat, ctx->rm_maxrepeat );
     }
 
     // merge repeats close to each other
@@ -1241,37 +1292,21 @@ static int filter( FilterContext* ctx, Overlap* ovl )
 
     if ( ctx->nMinNonRepeatBases != -1 )
     {
-        int b, e, rb, re, ovllen, repeat, repeat_read;
+        int ovllen, repeat;
 
-        track_anno* repeats_anno;
-        track_data* repeats_data;
+        track_intervals* repeats;
 
         if ( ctx->trackRepeatStrict && ( ( reads[ ovl->aread ].flags & READ_STRICT ) || ( reads[ bread ].flags & READ_STRICT ) ) )
         {
-            repeats_anno = ctx->trackRepeatStrict->anno;
-            repeats_data = ctx->trackRepeatStrict->data;
+            repeats = ctx->repeatsStrict;
         }
         else
         {
-            repeats_anno = ctx->trackRepeat->anno;
-            repeats_data = ctx->trackRepeat->data;
+            repeats = ctx->repeats;
         }
 
-        b      = repeats_anno[ ovl->aread ] / sizeof( track_data );
-        e      = repeats_anno[ ovl->aread + 1 ] / sizeof( track_data );
         ovllen = ovl->path.aepos - ovl->path.abpos;
-        repeat = repeat_read = 0;
-
-        while ( b < e )
-        {
-            rb = repeats_data[ b ];
-            re = repeats_data[ b + 1 ];
-
-            repeat_read += ( re - rb );
-            repeat += intersect( ovl->path.abpos, ovl->path.aepos, rb, re );
-
-            b += 2;
-        }
+        repeat = track_intervals_overlap( repeats, ovl->aread, ovl->path.abpos, ovl->path.aepos );
 
         if ( repeat > 0 && ovllen - repeat < ctx->nMinNonRepeatBases )
         {
@@ -1284,8 +1319,6 @@ static int filter( FilterContext* ctx, Overlap* ovl )
             ret |= OVL_DISCARD | OVL_REPEAT;
         }
 
-        b      = repeats_anno[ bread ] / sizeof( track_data );
-        e      = repeats_anno[ bread + 1 ] / sizeof( track_data );
         ovllen = ovl->path.bepos - ovl->path.bbpos;
 
         int bbpos, bepos;
@@ -1301,18 +1334,7 @@ static int filter( FilterContext* ctx, Overlap* ovl )
             bepos = ovl->path.bepos;
         }
 
-        repeat = repeat_read = 0;
-
-        while ( b < e )
-        {
-            rb = repeats_data[ b ];
-            re = repeats_data[ b + 1 ];
-
-            repeat += intersect( bbpos, bepos, rb, re );
-            repeat_read += ( re - rb );
-
-            b += 2;
-        }
+        repeat = track_intervals_overlap( repeats, bread, bbpos, bepos );
 
         if ( repeat > 0 && ovllen - repeat < ctx->nMinNonRepeatBases )
         {
@@ -1446,6 +1468,7 @@ static void filter_post( FilterContext* ctx )
     if ( ctx->trim )
     {
         trim_close( ctx->trim );
+        free( ctx->trim );
     }
 
     free( ctx->le_lbins );
@@ -1474,10 +1497,7 @@ static int filter_handler( void* _ctx, Overlap* ovl, int novl )
 
     if ( ctx->trim )
     {
-        for ( j = 0; j < novl; j++ )
-        {
-            trim_overlap( ctx->trim, ovl + j );
-        }
+        trim_overlaps( ctx->trim, ovl, novl );
     }
 
     if ( ctx->stitch >= 0 )
@@ -1675,20 +1695,127 @@ static int filter_handler( void* _ctx, Overlap* ovl, int novl )
             {
                 ovl[ j ].flags |= OVL_DISCARD;
             }
+            else if ( ( reads[ aread ].flags & READ_EDGES ) && edge_set_has( ctx->exclude_edges, aread, bread ) )
+            {
+                ovl[ j ].flags |= OVL_DISCARD;
+            }
         }
     }
 
     return 1;
 }
 
+// per thread state for pass_parallel(). the tracks, read loader and rm_anno are
+// shared, the latter since the threads work on disjoint A-read ranges.
+
+static void* filter_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    FilterContext* ctx  = (FilterContext*)_ctx;
+    FilterContext* tctx = malloc( sizeof( FilterContext ) );
+
+    memcpy( tctx, ctx, sizeof( FilterContext ) );
+
+    tctx->nFilteredDiffs          = 0;
+    tctx->nFilteredDiffsSegments  = 0;
+    tctx->nFilteredUnalignedBases = 0;
+    tctx->nFilteredLength         = 0;
+    tctx->nFilteredRepeat         = 0;
+    tctx->nFilteredReadLength     = 0;
+    tctx->nRepeatOvlsKept         = 0;
+    tctx->nFilteredLocalEnd       = 0;
+    tctx->nStitched               = 0;
+
+    if ( ctx->trim )
+    {
+        tctx->trim = trim_init( ctx->db, ctx->twidth, ctx->trackTrim, ctx->rl );
+    }
+
+    tctx->rm_ndata   = 0;
+    tctx->rm_maxdata = 100;
+    tctx->rm_data    = (track_data*)malloc( sizeof( track_data ) * tctx->rm_maxdata );
+    tctx->rm_bins    = malloc( sizeof( uint64_t ) * tctx->rm_maxbins );
+
+    tctx->rm_repeat    = NULL;
+    tctx->rm_maxrepeat = 0;
+
+    tctx->r2bin     = NULL;
+    tctx->max_r2bin = 0;
+
+    tctx->le_lbins = malloc( sizeof( int ) * tctx->le_maxbins );
+    tctx->le_rbins = malloc( sizeof( int ) * tctx->le_maxbins );
+
+    if ( ctx->hrd )
+    {
+        tctx->hrd_groups    = NULL;
+        tctx->hrd_ngroups   = NULL;
+        tctx->hrd_maxgroups = NULL;
+        tctx->hrd_allocated = 0;
+        tctx->hrd_mapgroup  = calloc( DB_READ_MAXLEN( ctx->db ), sizeof( uint16_t ) );
+    }
+
+    return tctx;
+}
+
+static void filter_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( thread );
+
+    FilterContext* ctx  = (FilterContext*)_ctx;
+    FilterContext* tctx = (FilterContext*)_tctx;
+
+    ctx->nFilteredDiffs          += tctx->nFilteredDiffs;
+    ctx->nFilteredDiffsSegments  += tctx->nFilteredDiffsSegments;
+    ctx->nFilteredUnalignedBases += tctx->nFilteredUnalignedBases;
+    ctx->nFilteredLength         += tctx->nFilteredLength;
+    ctx->nFilteredRepeat         += tctx->nFilteredRepeat;
+    ctx->nFilteredReadLength     += tctx->nFilteredReadLength;
+    ctx->nRepeatOvlsKept         += tctx->nRepeatOvlsKept;
+    ctx->nFilteredLocalEnd       += tctx->nFilteredLocalEnd;
+    ctx->nStitched               += tctx->nStitched;
+
+    if ( tctx->trim )
+    {
+        trim_reduce( ctx->trim, tctx->trim );
+
+        trim_close( tctx->trim );
+        free( tctx->trim );
+    }
+
+    free( tctx->rm_data );
+    free( tctx->rm_bins );
+    free( tctx->rm_repeat );
+    free( tctx->r2bin );
+    free( tctx->le_lbins );
+    free( tctx->le_rbins );
+
+    if ( tctx->hrd )
+    {
+        int i;
+        for ( i = 1; i < tctx->hrd_allocated; i++ )
+        {
+            free( tctx->hrd_groups[ i ] );
+        }
+
+        free( tctx->hrd_groups );
+        free( tctx->hrd_ngroups );
+        free( tctx->hrd_maxgroups );
+        free( tctx->hrd_mapgroup );
+    }
+
+    free( tctx );
+}
+
 static void usage( FILE* fout, const char* app )
 {
-    fprintf( fout, "usage: %s [-cLpTv] [-dlmMnosSu n] [-rRt track] [-x file] [-N n,n,n] database input.las output.las\n\n", app );
+    fprintf( fout, "usage: %s [-cLpTv] [-djlmMnosSu n] [-rRt track] [-x file] [-N n,n,n] database input.las output.las\n\n", app );
 
     fprintf( fout, "Filters the input las file by various critera\n\n" );
 
     fprintf( fout, "options: -v  verbose output\n" );
     fprintf( fout, "         -c  drop contained reads\n");
+    fprintf( fout, "         -j n  number of threads (default %d)\n", DEF_ARG_J );
     fprintf( fout, "         -d n  max divergence allowed [0,100]\n" );
     fprintf( fout, "         -l n  minimum read length\n" );
     fprintf( fout, "         -L  two-pass processing with read caching\n\n" );
@@ -1743,68 +1870,59 @@ static int opt_repeat_count( int argc, char** argv, char opt )
     return count;
 }
 
-int main( int argc, char* argv[] )
+static void filter_args( FilterContext* fctx, int argc, char* argv[] )
 {
-    HITS_DB db;
-    FilterContext fctx;
-    PassContext* pctx;
-    FILE* fileOvlIn;
-    FILE* fileOvlOut;
     char* app = argv[ 0 ];
 
-    bzero( &fctx, sizeof( FilterContext ) );
-
-    fctx.db = &db;
-
-    // args
-
-    char* pathRules            = NULL;
-    char* pcTrackRepeats       = DEF_ARG_R;
-    char* pcTrackRepeatsStrict = NULL;
-    char* arg_trimTrack        = DEF_ARG_T;
-    int arg_purge              = 0;
-
-    fctx.trackRepeatStrict   = NULL;
-    fctx.fMaxDiffs           = -1;
-    fctx.nMaxUnalignedBases  = -1;
-    fctx.nMinAlnLength       = -1;
-    fctx.nMinNonRepeatBases  = -1;
-    fctx.nMinReadLength      = -1;
-    fctx.nVerbose            = 0;
-    fctx.stitch              = DEF_ARG_S;
-    fctx.rm_cov              = -1;
-    fctx.rm_aggressive       = 0;
-    fctx.useRLoader          = 0;
-    fctx.do_trim             = DEF_ARG_TT;
-    fctx.rm_mode             = 0;
-    fctx.stitch_aggressively = 0;
-    fctx.contained = 0;
-    fctx.hrd                = 0; // heuristic repeat dropping
-    fctx.hrd_len            = DEF_ARG_NN_LEN;
-    fctx.hrd_rate           = DEF_ARG_NN_RATE;
-    fctx.hrd_fuzz           = DEF_ARG_NN_FUZZ;
-
-    fctx.rm_merge = 50;
+    fctx->pathRules            = NULL;
+    fctx->exclude_edges        = NULL;
+    fctx->pcTrackRepeats       = DEF_ARG_R;
+    fctx->pcTrackRepeatsStrict = NULL;
+    fctx->pcTrackTrim          = DEF_ARG_T;
+    fctx->purge                = 0;
+
+    fctx->trackRepeatStrict   = NULL;
+    fctx->fMaxDiffs           = -1;
+    fctx->nMaxUnalignedBases  = -1;
+    fctx->nMinAlnLength       = -1;
+    fctx->nMinNonRepeatBases  = -1;
+    fctx->nMinReadLength      = -1;
+    fctx->nVerbose            = 0;
+    fctx->stitch              = DEF_ARG_S;
+    fctx->rm_cov              = -1;
+    fctx->rm_aggressive       = 0;
+    fctx->useRLoader          = 0;
+    fctx->do_trim             = DEF_ARG_TT;
+    fctx->rm_mode             = 0;
+    fctx->stitch_aggressively = 0;
+    fctx->contained = 0;
+    fctx->nthreads            = DEF_ARG_J;
+    fctx->hrd                = 0; // heuristic repeat dropping
+    fctx->hrd_len            = DEF_ARG_NN_LEN;
+    fctx->hrd_rate           = DEF_ARG_NN_RATE;
+    fctx->hrd_fuzz           = DEF_ARG_NN_FUZZ;
+
+    fctx->rm_merge = 50;
 
     int c;
 
-    fctx.rm_mode = opt_repeat_count( argc, argv, 'm' );
-    if ( fctx.rm_mode == 0 )
+    fctx->rm_mode = opt_repeat_count( argc, argv, 'm' );
+    if ( fctx->rm_mode == 0 )
     {
-        fctx.rm_mode = opt_repeat_count( argc, argv, 'M' );
+        fctx->rm_mode = opt_repeat_count( argc, argv, 'M' );
     }
 
     opterr = 0;
-    while ( ( c = getopt( argc, argv, "cLpTvd:l:m:M:n:N:o:r:R:s:S:t:u:x:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "cLpTvd:j:l:m:M:n:N:o:r:R:s:S:t:u:x:" ) ) != -1 )
     {
         switch ( c )
         {
             case 'c':
-                fctx.contained = 1;
+                fctx->contained = 1;
                 break;
 
             case 'N':
-                fctx.hrd = 1;
+                fctx->hrd = 1;
 
                 char* dup = strdup(optarg);
                 char* token;
@@ -1818,33 +1936,33 @@ int main( int argc, char* argv[] )
                         case 0:
                             if (toklen == 1 && token[0] == '-')
                             {
-                                fctx.hrd_len = DEF_ARG_NN_LEN;
+                                fctx->hrd_len = DEF_ARG_NN_LEN;
                             }
                             else
                             {
-                                fctx.hrd_len = atoi(token);
+                                fctx->hrd_len = atoi(token);
                             }
                             break;
 
                         case 1:
                             if (toklen == 1 && token[0] == '-')
                             {
-                                fctx.hrd_rate = DEF_ARG_NN_RATE;
+                                fctx->hrd_rate = DEF_ARG_NN_RATE;
                             }
                             else
                             {
-                                fctx.hrd_rate = atoi(token);
+                                fctx->hrd_rate = atoi(token);
                             }
                             break;
 
                         case 2:
                             if (toklen == 1 && token[0] == '-')
                             {
-                                fctx.hrd_fuzz = DEF_ARG_NN_FUZZ;
+                                fctx->hrd_fuzz = DEF_ARG_NN_FUZZ;
                             }
                             else
                             {
-                                fctx.hrd_fuzz = atoi(token);
+                                fctx->hrd_fuzz = atoi(token);
                             }
                             break;
                     }
@@ -1863,74 +1981,78 @@ int main( int argc, char* argv[] )
                 break;
 
             case 'T':
-                fctx.do_trim = 1;
+                fctx->do_trim = 1;
                 break;
 
             case 'x':
-                pathRules = optarg;
+                fctx->pathRules = optarg;
                 break;
 
             case 'L':
-                fctx.useRLoader = 1;
+                fctx->useRLoader = 1;
                 break;
 
             case 'M':
-                fctx.rm_aggressive = 1;
+                fctx->rm_aggressive = 1;
 
                 // fall through
 
             case 'm':
-                fctx.rm_cov = atoi( optarg );
+                fctx->rm_cov = atoi( optarg );
                 break;
 
             case 'S':
-                fctx.stitch_aggressively = 1;
+                fctx->stitch_aggressively = 1;
 
                 // fall through
 
             case 's':
-                fctx.stitch = atoi( optarg );
+                fctx->stitch = atoi( optarg );
                 break;
 
             case 'v':
-                fctx.nVerbose = 1;
+                fctx->nVerbose = 1;
                 break;
 
             case 'p':
-                arg_purge = 1;
+                fctx->purge = 1;
                 break;
 
             case 'd':
-                fctx.fMaxDiffs = atof( optarg ) / 100.0;
+                fctx->fMaxDiffs = atof( optarg ) / 100.0;
                 break;
 
             case 'o':
-                fctx.nMinAlnLength = atoi( optarg );
+                fctx->nMinAlnLength = atoi( optarg );
+                break;
+
+            case 'j':
+                fctx->nthreads = atoi( optarg );
                 break;
 
             case 'l':
-                fctx.nMinReadLength = atoi( optarg );
+                fctx->nMinReadLength = atoi( optarg );
                 break;
 
             case 'u':
-                fctx.nMaxUnalignedBases = atoi( optarg );
+                fctx->nMaxUnalignedBases = atoi( optarg );
                 break;
 
             case 'n':
-                fctx.nMinNonRepeatBases = atoi( optarg );
-                fctx.rm_merge           = fctx.nMinNonRepeatBases;
+                fctx->nMinNonRepeatBases = atoi( optarg );
+                fctx->rm_merge           = fctx->nMinNonRepeatBases;
                 break;
 
             case 'r':
-                pcTrackRepeats = optarg;
+                fctx->pcTrackRepeats = optarg;
                 break;
 
             case 'R':
-                pcTrackRepeatsStrict = optarg;
+                fctx->pcTrackRepeatsStrict = optarg;
                 break;
 
             case 't':
-                arg_trimTrack = optarg;
+                fctx->pcTrackTrim = optarg;
                 break;
 
             default:
@@ -1940,109 +2062,301 @@ int main( int argc, char* argv[] )
         }
     }
 
-    if ( argc - optind != 3 )
+    if ( fctx->nthreads < 1 )
     {
-        usage( stdout, app );
+        fprintf( stderr, "invalid number of threads %d\n", fctx->nthreads );
         exit( 1 );
     }
+}
 
-    char* pcPathReadsIn     = argv[ optind++ ];
-    char* pcPathOverlapsIn  = argv[ optind++ ];
-    char* pcPathOverlapsOut = argv[ optind++ ];
-
-    if ( ( fileOvlIn = fopen( pcPathOverlapsIn, "r" ) ) == NULL )
+static void filter_load( FilterContext* fctx )
+{
+    if ( fctx->loaded )
     {
-        fprintf( stderr, "could not open %s\n", pcPathOverlapsIn );
-        exit( 1 );
+        return;
     }
 
-    if ( ( fileOvlOut = fopen( pcPathOverlapsOut, "w" ) ) == NULL )
+    int i;
+    for ( i = 0; i < DB_NREADS( fctx->db ); i++ )
     {
-        fprintf( stderr, "could not open %s\n", pcPathOverlapsOut );
-        exit( 1 );
+        fctx->db->reads[ i ].flags = READ_NONE;
     }
 
-    if ( Open_DB( pcPathReadsIn, &db ) )
-    {
-        fprintf( stderr, "could not open %s\n", pcPathReadsIn );
-        exit( 1 );
-    }
+    fctx->tracks = track_cache_new( fctx->db, 4 );
 
-    int i;
-    for ( i = 0; i < DB_NREADS( &db ); i++ )
+    if ( fctx->pcTrackRepeatsStrict )
     {
-        db.reads[ i ].flags = READ_NONE;
+        fctx->trackRepeatStrict = track_cache_get( fctx->tracks, fctx->pcTrackRepeatsStrict );
+        if ( !fctx->trackRepeatStrict )
+        {
+            fprintf( stderr, "could not load track %s\n", fctx->pcTrackRepeatsStrict );
+            exit( 1 );
+        }
     }
 
-    if ( pcTrackRepeatsStrict )
+    if ( fctx->nMinNonRepeatBases != -1 || fctx->hrd )
     {
-        fctx.trackRepeatStrict = track_load( &db, pcTrackRepeatsStrict );
-        if ( !fctx.trackRepeatStrict )
+        fctx->trackRepeat = track_cache_get( fctx->tracks, fctx->pcTrackRepeats );
+
+        if ( !fctx->trackRepeat )
         {
-            fprintf( stderr, "could not load track %s\n", pcTrackRepeatsStrict );
+            fprintf( stderr, "could not load track %s\n", fctx->pcTrackRepeats );
             exit( 1 );
         }
     }
 
-    if ( fctx.nMinNonRepeatBases != -1 || fctx.hrd )
+    if ( fctx->nMinNonRepeatBases != -1 )
     {
-        fctx.trackRepeat = track_load( &db, pcTrackRepeats );
+        fctx->repeats = track_intervals_new( fctx->db, fctx->trackRepeat );
 
-        if ( !fctx.trackRepeat )
+        if ( fctx->trackRepeatStrict )
         {
-            fprintf( stderr, "could not load track %s\n", pcTrackRepeats );
-            exit( 1 );
+            fctx->repeatsStrict = track_intervals_new( fctx->db, fctx->trackRepeatStrict );
         }
     }
 
-    fctx.trackTrim = track_load( &db, arg_trimTrack );
+    fctx->trackTrim = track_cache_get( fctx->tracks, fctx->pcTrackTrim );
 
-    if ( !fctx.trackTrim )
+    if ( !fctx->trackTrim )
     {
-        fprintf( stderr, "could not load track %s\n", arg_trimTrack );
+        fprintf( stderr, "could not load track %s\n", fctx->pcTrackTrim );
         // exit( 1 );
     }
 
-    if ( pathRules )
+    if ( fctx->pathRules )
     {
-        FILE* fileIn = fopen( pathRules, "r" );
+        FILE* fileIn = fopen( fctx->pathRules, "r" );
 
         if ( fileIn == NULL )
         {
-            fprintf( stderr, "could not open %s\n", pathRules );
+            fprintf( stderr, "could not open %s\n", fctx->pathRules );
             exit( 1 );
         }
 
-        FilterRules rules;
+        fread_rules( fileIn, fctx );
 
-        fread_rules( fileIn, &rules );
+        fclose( fileIn );
+    }
 
-        printf( "excluding %d reads\n", rules.exclude_reads_n );
+    if ( fctx->hrd )
+    {
+#ifdef VERBOSE
+        printf("HRD drop < %dbp - downsample by %d%% - fuzzing %d\n", fctx->hrd_len, fctx->hrd_rate, fctx->hrd_fuzz);
+#endif
 
-        for ( i = 0; i < rules.exclude_reads_n; i++ )
-        {
-            db.reads[ rules.exclude_reads[ i ] ].flags |= READ_DISCARD;
-        }
+        fctx->hrd_mapgroup = calloc( DB_READ_MAXLEN( fctx->db ), sizeof( uint16_t ) );
+    }
 
-        printf( "strict repeats for %d reads\n", rules.strict_reads_n );
+    fctx->loaded = 1;
+}
+
+static void filter_free( FilterContext* fctx )
+{
+    if ( fctx->rl )
+    {
+        rl_free( fctx->rl );
+    }
 
-        for ( i = 0; i < rules.strict_reads_n; i++ )
+    if ( fctx->repeats )
+    {
+        track_intervals_free( fctx->repeats );
+    }
+
+    if ( fctx->repeatsStrict )
+    {
+        track_intervals_free( fctx->repeatsStrict );
+    }
+
+    track_cache_free( fctx->tracks );
+
+    if ( fctx->exclude_edges )
+    {
+        edge_set_free( fctx->exclude_edges );
+    }
+
+    if ( fctx->hrd )
+    {
+        int i;
+        for ( i = 1; i < fctx->hrd_allocated; i++ )
         {
-            db.reads[ rules.strict_reads[ i ] ].flags |= READ_STRICT;
+            free(fctx->hrd_groups[i]);
         }
 
-        fclose( fileIn );
+        free(fctx->hrd_groups);
+        free(fctx->hrd_ngroups);
+        free(fctx->hrd_maxgroups);
+        free(fctx->hrd_mapgroup);
     }
+}
+
+// LAscrub stage
+
+static void stage_prepare_pre( PassContext* pctx, void* data )
+{
+    UNUSED( pctx );
 
-    if ( fctx.hrd )
+    FilterContext* fctx = (FilterContext*)data;
+
+    filter_load( fctx );
+
+    if ( fctx->rl )
     {
-#ifdef VERBOSE
-        printf("HRD drop < %dbp - downsample by %d%% - fuzzing %d\n", fctx.hrd_len, fctx.hrd_rate, fctx.hrd_fuzz);
-#endif
+        rl_free( fctx->rl );
+    }
+
+    fctx->rl = rl_init( fctx->db, 1 );
+}
+
+static void stage_prepare_post( void* data )
+{
+    FilterContext* fctx = (FilterContext*)data;
+
+    rl_load_added( fctx->rl );
+}
+
+static void stage_pre( PassContext* pctx, void* data )
+{
+    FilterContext* fctx = (FilterContext*)data;
 
-        fctx.hrd_mapgroup = calloc( DB_READ_MAXLEN( fctx.db ), sizeof( uint16_t ) );
+    filter_load( fctx );
+
+    if ( !fctx->useRLoader )
+    {
+        Map_Bases( fctx->db );
     }
 
+    // the stage is run again by later phases
+
+    fctx->nFilteredDiffs          = 0;
+    fctx->nFilteredDiffsSegments  = 0;
+    fctx->nFilteredUnalignedBases = 0;
+    fctx->nFilteredLength         = 0;
+    fctx->nFilteredRepeat         = 0;
+    fctx->nFilteredReadLength     = 0;
+    fctx->nRepeatOvlsKept         = 0;
+    fctx->nFilteredLocalEnd       = 0;
+    fctx->nStitched               = 0;
+
+    fctx->trim = NULL;
+
+    filter_pre( pctx, fctx );
+}
+
+static void stage_post( void* data )
+{
+    filter_post( (FilterContext*)data );
+}
+
+static void stage_free( void* data )
+{
+    FilterContext* fctx = (FilterContext*)data;
+
+    filter_free( fctx );
+    free( fctx );
+}
+
+void lafilter_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] )
+{
+    FilterContext* fctx = calloc( 1, sizeof( FilterContext ) );
+
+    fctx->db = db;
+
+    filter_args( fctx, argc, argv );
+
+    if ( argc != optind )
+    {
+        usage( stdout, argv[ 0 ] );
+        exit( 1 );
+    }
+
+    bzero( stage, sizeof( ScrubStage ) );
+
+    stage->name   = "LAfilter";
+    stage->data   = fctx;
+    stage->filter = 1;
+    stage->purge  = fctx->purge;
+
+    stage->load_trace   = 1;
+    stage->unpack_trace = 1;
+
+    stage->tracks_in[ stage->ntracks_in++ ] = fctx->pcTrackTrim;
+
+    if ( fctx->nMinNonRepeatBases != -1 || fctx->hrd )
+    {
+        stage->tracks_in[ stage->ntracks_in++ ] = fctx->pcTrackRepeats;
+    }
+
+    if ( fctx->pcTrackRepeatsStrict )
+    {
+        stage->tracks_in[ stage->ntracks_in++ ] = fctx->pcTrackRepeatsStrict;
+    }
+
+    if ( fctx->useRLoader )
+    {
+        stage->prepare_pre  = stage_prepare_pre;
+        stage->prepare      = loader_handler;
+        stage->prepare_post = stage_prepare_post;
+        stage->prepare_any  = 1;
+    }
+
+    stage->pre     = stage_pre;
+    stage->handler = filter_handler;
+    stage->post    = stage_post;
+    stage->free    = stage_free;
+
+    stage->thread_init   = filter_thread_init;
+    stage->thread_reduce = filter_thread_reduce;
+}
+
+#ifndef LASCRUB
+
+int main( int argc, char* argv[] )
+{
+    HITS_DB db;
+    FilterContext fctx;
+    PassContext* pctx;
+    FILE* fileOvlIn;
+    FILE* fileOvlOut;
+    char* app = argv[ 0 ];
+
+    bzero( &fctx, sizeof( FilterContext ) );
+
+    fctx.db = &db;
+
+    // args
+
+    filter_args( &fctx, argc, argv );
+
+    if ( argc - optind != 3 )
+    {
+        usage( stdout, app );
+        exit( 1 );
+    }
+
+    char* pcPathReadsIn     = argv[ optind++ ];
+    char* pcPathOverlapsIn  = argv[ optind++ ];
+    char* pcPathOverlapsOut = argv[ optind++ ];
+
+    if ( ( fileOvlIn = fopen( pcPathOverlapsIn, "r" ) ) == NULL )
+    {
+        fprintf( stderr, "could not open %s\n", pcPathOverlapsIn );
+        exit( 1 );
+    }
+
+    if ( ( fileOvlOut = fopen( pcPathOverlapsOut, "w" ) ) == NULL )
+    {
+        fprintf( stderr, "could not open %s\n", pcPathOverlapsOut );
+        exit( 1 );
+    }
+
+    if ( Open_DB( pcPathReadsIn, &db ) )
+    {
+        fprintf( stderr, "could not open %s\n", pcPathReadsIn );
+        exit( 1 );
+    }
+
+    filter_load( &fctx );
+
     // passes
 
     if ( fctx.useRLoader )
@@ -2059,6 +2373,10 @@ int main( int argc, char* argv[] )
         rl_load_added( fctx.rl );
         pass_free( pctx );
     }
+    else
+    {
+        Map_Bases( &db );
+    }
 
     pctx = pass_init( fileOvlIn, fileOvlOut );
 
@@ -2067,40 +2385,34 @@ int main( int argc, char* argv[] )
     pctx->unpack_trace    = 1;
     pctx->data            = &fctx;
     pctx->write_overlaps  = 1;
-    pctx->purge_discarded = arg_purge;
+    pctx->purge_discarded = fctx.purge;
+    pctx->thread_init     = filter_thread_init;
+    pctx->thread_reduce   = filter_thread_reduce;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if ( fctx.nthreads > 1 && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load( &db, pcPathOverlapsIn, 0 );
+    }
 
     filter_pre( pctx, &fctx );
-    pass( pctx, filter_handler );
+    pass_parallel( pctx, filter_handler, fctx.nthreads );
     filter_post( &fctx );
 
+    lasidx_close( pctx->index );
     pass_free( pctx );
 
     // cleanup
 
-    if ( fctx.useRLoader )
-    {
-        rl_free( fctx.rl );
-    }
+    filter_free( &fctx );
 
     Close_DB( &db );
 
-    if ( fctx.hrd )
-    {
-        int i = 1;
-        while ( fctx.hrd_groups[i] )
-        {
-            free(fctx.hrd_groups[i]);
-            i += 1;
-        }
-
-        free(fctx.hrd_groups);
-        free(fctx.hrd_ngroups);
-        free(fctx.hrd_maxgroups);
-        free(fctx.hrd_mapgroup);
-    }
-
     fclose( fileOvlOut );
     fclose( fileOvlIn );
 
     return 0;
 }
+
+#endif
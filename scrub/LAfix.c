@@ -16,6 +16,7 @@
 #include "lib/colors.h"
 #include "lib/tracks.h"
 #include "lib/pass.h"
+#include "lib/trace.h"
 #include "lib/oflags.h"
 #include "lib/utils.h"
 
@@ -28,11 +29,14 @@
 #define DEF_ARG_G     500   // don't patch gaps above a certain size
 #define DEF_ARG_QQ     28   // low quality cutoff
 #define DEF_ARG_Q    TRACK_Q
+#define DEF_ARG_J       1
 
 // settings
 
 #define FASTA_WIDTH    60   // wrapping for result fasta files
 
+#define COPY_BUFFER   ( 4 * 1024 * 1024 )   // merging the output of the threads
+
 #define MIN_INT_LEN     5   // min length of an adjusted track interval
 
 #define MIN_SPAN      400   // only alignments with at least MIN_SPAN bases left and right of a segment are considering as support
@@ -56,6 +60,7 @@ typedef struct
 {
     HITS_DB* db;
     int twidth;
+    size_t tbytes;
 
     FILE* fileFastaOut;
     FILE* fileQvOut;
@@ -69,6 +74,7 @@ typedef struct
     int maxspanners;
     int minsupport;
     int a_anno_only;
+    int nthreads;
 
     HITS_TRACK* qtrack;
     char* trimName;
@@ -129,6 +135,7 @@ static void fix_pre(PassContext* pctx, FixContext* fctx)
 #endif
 
     fctx->twidth = pctx->twidth;
+    fctx->tbytes = PASS_TRACE_BYTES(pctx);
 
     if ( !(fctx->qtrack = track_load(fctx->db, fctx->qName)) )
     {
@@ -149,52 +156,129 @@ static void fix_pre(PassContext* pctx, FixContext* fctx)
         fctx->trimtrack = NULL;
     }
 
+}
+
+static void fix_post(PassContext* pctx, FixContext* fctx)
+{
+#ifdef VERBOSE
+    printf("gaps: %d\n", fctx->num_gaps);
+    printf("flips: %d\n", fctx->num_flips);
+    printf("replaced %'" PRIu64 "with %'" PRIu64 " bases\n", fctx->stats_bases_before, fctx->stats_bases_after);
+#else
+    UNUSED(fctx);
+#endif
+
+    UNUSED(pctx);
+}
+
+// per thread state for pass_parallel(). the workers patch into their own
+// buffers and, if there is more than one, write to temporary files that are
+// appended to the output in file order.
+
+static void* fix_thread_init(void* _ctx, int thread)
+{
+    FixContext* fctx = (FixContext*)_ctx;
+    FixContext* tctx = malloc(sizeof(FixContext));
+
+    memcpy(tctx, fctx, sizeof(FixContext));
+
+    tctx->num_flips = tctx->num_gaps = 0;
+    tctx->stats_bases_before = tctx->stats_bases_after = 0;
+
+    if (fctx->nthreads > 1)
+    {
+        tctx->fileFastaOut = tmpfile();
+
+        if (tctx->fileFastaOut == NULL || (fctx->fileQvOut && (tctx->fileQvOut = tmpfile()) == NULL))
+        {
+            fprintf(stderr, "failed to create temporary output for thread %d\n", thread);
+            exit(1);
+        }
+    }
+
     int maxlen = fctx->db->maxlen;
 
-    fctx->reada = New_Read_Buffer(fctx->db);
-    fctx->readb = New_Read_Buffer(fctx->db);
-    fctx->read_patched = malloc(maxlen * 2 + 4);
+    tctx->reada = New_Read_Buffer(fctx->db);
+    tctx->readb = New_Read_Buffer(fctx->db);
+    tctx->read_patched = malloc(maxlen * 2 + 4);
 
     if (fctx->fileQvOut)
     {
-        fctx->qva = New_QV_Buffer(fctx->db);
-        fctx->qvb = New_QV_Buffer(fctx->db);
-        fctx->qv_patched = malloc(sizeof(char*) * NUM_QV_STREAMS);
+        tctx->qva = New_QV_Buffer(fctx->db);
+        tctx->qvb = New_QV_Buffer(fctx->db);
+        tctx->qv_patched = malloc(sizeof(char*) * NUM_QV_STREAMS);
 
         char* qvs = malloc( maxlen * 2 * NUM_QV_STREAMS );
         int i;
         for (i = 0; i < NUM_QV_STREAMS; i++)
         {
-            fctx->qv_patched[i] = qvs + i * maxlen * 2;
+            tctx->qv_patched[i] = qvs + i * maxlen * 2;
         }
     }
 
-    fctx->apatches = malloc( (maxlen / pctx->twidth + 1) * 3 * sizeof(int) );
+    tctx->apatches = malloc( (maxlen / fctx->twidth + 1) * 3 * sizeof(int) );
+
+    tctx->spanners = NULL;
+    tctx->allocspanners = 0;
+
+    return tctx;
 }
 
-static void fix_post(PassContext* pctx, FixContext* fctx)
+static void append_file(FILE* out, FILE* in, char* buf)
 {
-#ifdef VERBOSE
-    printf("gaps: %d\n", fctx->num_gaps);
-    printf("flips: %d\n", fctx->num_flips);
-    printf("replaced %'" PRIu64 "with %'" PRIu64 " bases\n", fctx->stats_bases_before, fctx->stats_bases_after);
-#endif
+    size_t len;
 
-    UNUSED(pctx);
+    rewind(in);
+
+    while ( (len = fread(buf, 1, COPY_BUFFER, in)) > 0 )
+    {
+        fwrite(buf, 1, len, out);
+    }
+
+    fclose(in);
+}
+
+static void fix_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
+
+    FixContext* fctx = (FixContext*)_ctx;
+    FixContext* tctx = (FixContext*)_tctx;
+
+    fctx->num_flips += tctx->num_flips;
+    fctx->num_gaps += tctx->num_gaps;
+    fctx->stats_bases_before += tctx->stats_bases_before;
+    fctx->stats_bases_after += tctx->stats_bases_after;
+
+    if (tctx->fileFastaOut != fctx->fileFastaOut)
+    {
+        char* buf = malloc(COPY_BUFFER);
+
+        append_file(fctx->fileFastaOut, tctx->fileFastaOut, buf);
+
+        if (fctx->fileQvOut)
+        {
+            append_file(fctx->fileQvOut, tctx->fileQvOut, buf);
+        }
 
-    free(fctx->reada - 1);
-    free(fctx->readb - 1);
-    free(fctx->read_patched);
+        free(buf);
+    }
+
+    free(tctx->reada - 1);
+    free(tctx->readb - 1);
+    free(tctx->read_patched);
 
     if (fctx->fileQvOut)
     {
-        Free_QV_Buffer(fctx->qva);
-        Free_QV_Buffer(fctx->qvb);
-        Free_QV_Buffer(fctx->qv_patched);
+        Free_QV_Buffer(tctx->qva);
+        Free_QV_Buffer(tctx->qvb);
+        Free_QV_Buffer(tctx->qv_patched);
     }
 
-    free(fctx->apatches);
-    free(fctx->spanners);
+    free(tctx->apatches);
+    free(tctx->spanners);
+
+    free(tctx);
 }
 
 static int cmp_gaps(const void* x, const void* y)
@@ -342,12 +426,12 @@ static int filter_flips(FixContext* fctx, Overlap* ovls, int novl, int* trim_b,
             {
                 // printf("  -> crosses diagonal %5d..%5d x %5d..%5d\n", ab, ae, ab_c, ae_c);
 
-                ovl_trace* trace = ovl->path.trace;
+                void* trace = ovl->path.trace;
 
                 int sab = ovl->path.abpos;
                 int sae = (sab / fctx->twidth + 1) * fctx->twidth;
                 int sbb = ovl->path.bbpos;
-                int sbe = sbb + trace[1];
+                int sbe = sbb + trace_at(trace, fctx->tbytes, 1);
 
                 int j;
                 for (j = 2; j < ovl->path.tlen - 2; j += 2)
@@ -377,7 +461,7 @@ static int filter_flips(FixContext* fctx, Overlap* ovls, int novl, int* trim_b,
                     sae += fctx->twidth;
 
                     sbb = sbe;
-                    sbe += trace[j + 1];
+                    sbe += trace_at(trace, fctx->tbytes, j + 1);
                 }
 
                 sae = ovl->path.aepos;
@@ -526,16 +610,16 @@ static int fix_handler(void* _ctx, Overlap* ovl, int novl)
                 data = realloc(data, sizeof(Gap) * dmax);
             }
 
-            ovl_trace* trace_left = ovl[i-1].path.trace;
-            ovl_trace* trace_right = ovl[i].path.trace;
+            void* trace_left = ovl[i-1].path.trace;
+            void* trace_right = ovl[i].path.trace;
 
             int ab = (ovl[i-1].path.aepos - 1) / twidth;
             int ae = ovl[i].path.abpos / twidth + 1;
 
             int j = ovl[i-1].path.tlen - 1;
 
-            int bb = ovl[i-1].path.bepos - trace_left[j];
-            int be = ovl[i].path.bbpos + trace_right[1];
+            int bb = ovl[i-1].path.bepos - trace_at(trace_left, fctx->tbytes, j);
+            int be = ovl[i].path.bbpos + trace_at(trace_right, fctx->tbytes, 1);
 
             /*
             while (qa[ab-1] > lowq)
@@ -543,7 +627,7 @@ static int fix_handler(void* _ctx, Overlap* ovl, int novl)
                 j -= 2;
                 ab--;
 
-                bb -= trace_left[j];
+                bb -= trace_at(trace_left, fctx->tbytes, j);
             }
 
             j = 1;
@@ -552,7 +636,7 @@ static int fix_handler(void* _ctx, Overlap* ovl, int novl)
                 j += 2;
                 ae++;
 
-                be += trace_right[j];
+                be += trace_at(trace_right, fctx->tbytes, j);
             }
             */
 
@@ -825,26 +909,12 @@ static int fix_handler(void* _ctx, Overlap* ovl, int novl)
 
             if (ovl[j].path.abpos + 100 <= ab && ovl[j].path.aepos - 100 >= ae)     // TODO --- hardcoded
             {
-                // locate replacement segment(s) in B
-
-                int bb, be;
-
-                bb = -1;
-                be = ovl[j].path.bbpos;
-                ovl_trace* tracerep = ovl[j].path.trace;
-
-                int apos = ovl[j].path.abpos;
-                int k = 0;
-                while (apos <= ab)
-                {
-                    apos = (apos / twidth + 1) * twidth;
+                // locate replacement segment(s) in B, the segment of the overlap containing ab
 
-                    bb = be;
-                    be += tracerep[ k + 1 ];
-                    k += 2;
-                }
+                int k = ab / twidth - ovl[j].path.abpos / twidth;
 
-                assert( bb != -1 );
+                int bb = trace_bpos(ovl + j, fctx->tbytes, k);
+                int be = bb + trace_at(ovl[j].path.trace, fctx->tbytes, 2 * k + 1);
 
                 if (ovl[j].flags & OVL_COMP)
                 {
@@ -1348,7 +1418,7 @@ static int fix_handler(void* _ctx, Overlap* ovl, int novl)
 
 static void usage()
 {
-    printf( "usage: [-al] [-gQx n] [ [-c track] ...] [-qt track] [-f file] database input.las patched.fasta\n\n" );
+    printf( "usage: [-alR] [-gjQx n] [ [-c track] ...] [-qt track] [-f file] [-p split:part] database input.las patched.fasta\n\n" );
 
     printf( "Patches larger sequencing errors in the reads based on the alignments.\n" );
     printf( "Errors include polymerase strand changes, missed adaptors, missing sequence\n" );
@@ -1364,6 +1434,10 @@ static void usage()
     printf( "   -g n      maximum gap in the read that gets patched (default %d, -1 to patch all gaps)\n", DEF_ARG_G );
     printf( "   -t track  trim reads based on a track and the -Q value\n" );
     printf( "   -l        enable the low-coverage mode, recommended for <= 10x\n" );
+    printf( "   -j n      number of threads (default %d)\n", DEF_ARG_J );
+    printf( "   -p split:part  only patch the reads of a part of input.las, as cut by LAsplit -m\n" );
+    printf( "   -R        checkpoint to patched.fasta%s every %ds and resume from it, if present\n",
+                            PASS_CHECKPOINT_SUFFIX, PASS_CHECKPOINT_INTERVAL );
 }
 
 int main(int argc, char* argv[])
@@ -1372,6 +1446,7 @@ int main(int argc, char* argv[])
     PassContext* pctx;
     FixContext fctx;
     FILE* fileOvlIn;
+    PassCheckpoint* ckpt = NULL;
 
     bzero(&fctx, sizeof(FixContext));
     fctx.db = &db;
@@ -1381,18 +1456,25 @@ int main(int argc, char* argv[])
     fctx.trimName = NULL;
     fctx.qName = DEF_ARG_Q;
     fctx.a_anno_only = 0;
+    fctx.nthreads = DEF_ARG_J;
 
     // process arguments
 
     char* pathQvOut = NULL;
+    char* part = NULL;
     int c;
     int lowc = 0;
+    int resume = 0;
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "alf:x:c:q:Q:g:t:")) != -1)
+    while ((c = getopt(argc, argv, "alRf:j:x:c:p:q:Q:g:t:")) != -1)
     {
         switch (c)
         {
+            case 'R':
+                      resume = 1;
+                      break;
+
             case 'a':
                       fctx.a_anno_only = 1;
                       break;
@@ -1417,6 +1499,10 @@ int main(int argc, char* argv[])
                       fctx.minlen = atoi(optarg);
                       break;
 
+            case 'j':
+                      fctx.nthreads = atoi(optarg);
+                      break;
+
             case 'f':
                       pathQvOut = optarg;
                       break;
@@ -1425,6 +1511,10 @@ int main(int argc, char* argv[])
                       fctx.trimName = optarg;
                       break;
 
+            case 'p':
+                      part = optarg;
+                      break;
+
             case 'c':
                       if (fctx.curctracks >= fctx.maxctracks)
                       {
@@ -1451,6 +1541,18 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (fctx.nthreads < 1)
+    {
+        fprintf(stderr, "invalid number of threads %d\n", fctx.nthreads);
+        exit(1);
+    }
+
+    if (part && resume)
+    {
+        fprintf(stderr, "parts of a split cannot be checkpointed\n");
+        exit(1);
+    }
+
     char* pcPathReadsIn = argv[optind++];
     char* pcPathOverlapsIn = argv[optind++];
     char* pcPathFastaOut = argv[optind++];
@@ -1461,7 +1563,21 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    if ( (fctx.fileFastaOut = fopen(pcPathFastaOut, "w")) == NULL )
+    // a resumed run continues the outputs of the previous one
+
+    char* mode = "w";
+
+    if (resume)
+    {
+        ckpt = pass_checkpoint_load(pcPathFastaOut, fileOvlIn);
+
+        if (ckpt->resumed)
+        {
+            mode = "r+";
+        }
+    }
+
+    if ( (fctx.fileFastaOut = fopen(pcPathFastaOut, mode)) == NULL )
     {
         fprintf(stderr, "could not open '%s'\n", pcPathFastaOut);
         exit(1);
@@ -1469,19 +1585,31 @@ int main(int argc, char* argv[])
 
     if (pathQvOut)
     {
-        if ( (fctx.fileQvOut = fopen(pathQvOut, "w")) == NULL )
+        if ( (fctx.fileQvOut = fopen(pathQvOut, mode)) == NULL )
         {
             fprintf(stderr, "error: could not open '%s'\n", pathQvOut);
             exit(1);
         }
     }
 
+    if (ckpt)
+    {
+        pass_checkpoint_output(ckpt, fctx.fileFastaOut);
+
+        if (fctx.fileQvOut)
+        {
+            pass_checkpoint_output(ckpt, fctx.fileQvOut);
+        }
+    }
+
     if ( Open_DB(pcPathReadsIn, &db) )
     {
         fprintf(stderr, "could not open database '%s'\n", pcPathReadsIn);
         exit(1);
     }
 
+    Map_Bases(&db);
+
     int i;
     for (i = 0; i < fctx.curctracks; i++)
     {
@@ -1510,7 +1638,7 @@ int main(int argc, char* argv[])
 
     if (fctx.fileQvOut)
     {
-        if (Load_QVs(&db) != 0)
+        if (Load_QVs(&db) != 0 || Map_QVs(&db) != 0)
         {
             fprintf(stderr, "error: failed to load QVs\n");
             exit(1);
@@ -1521,15 +1649,33 @@ int main(int argc, char* argv[])
 
     pctx->split_b = 0;
     pctx->load_trace = 1;
-    pctx->unpack_trace = 1;
+    pctx->unpack_trace = 0;
+    pctx->read_ahead = 1;
     pctx->data = &fctx;
 
+    pctx->thread_init = fix_thread_init;
+    pctx->thread_reduce = fix_thread_reduce;
+    pctx->checkpoint = ckpt;
+
+    if (part)
+    {
+        pass_split_part(pctx, part);
+    }
+
+    // balance the threads using the index, if there is an up to date one
+
+    if (fctx.nthreads > 1 && !pctx->is_laz)
+    {
+        pctx->index = lasidx_load(&db, pcPathOverlapsIn, 0);
+    }
+
     fix_pre(pctx, &fctx);
 
-    pass(pctx, fix_handler);
+    pass_parallel(pctx, fix_handler, fctx.nthreads);
 
     fix_post(pctx, &fctx);
 
+    lasidx_close(pctx->index);
     pass_free(pctx);
 
     // cleanup
@@ -1544,5 +1690,17 @@ int main(int argc, char* argv[])
     fclose(fileOvlIn);
     fclose(fctx.fileFastaOut);
 
+    if (fctx.fileQvOut)
+    {
+        fclose(fctx.fileQvOut);
+    }
+
+    // the outputs are complete
+
+    if (ckpt)
+    {
+        pass_checkpoint_free(ckpt, 1);
+    }
+
     return 0;
 }
@@ -23,6 +23,8 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+#include "scrub/stage.h"
+
 // argument defaults
 
 #define DEF_ARG_P 0
@@ -33,6 +35,8 @@
 #define BIN_SIZE    100
 #define MIN_LR      450
 
+#define SWEEP_MIN   16      // B-read groups of at least that many overlaps are swept instead of compared pairwise
+
 // switches
 
 #define VERBOSE
@@ -42,6 +46,14 @@
 
 // constants
 
+// A interval of an overlap, ovl is its index in the pile
+
+typedef struct
+{
+    int ab, ae;
+    int ovl;
+} GapIvl;
+
 typedef struct
 {
     HITS_DB* db;
@@ -63,12 +75,32 @@ typedef struct
     int* rc_right;
     int rc_maxleft;
 
+    // per pile, the overlaps of each B read sorted by abpos
+
+    GapIvl* ivl;
+    GapIvl* ivl_len;
+    int* ivl_rank;
+    int* ivl_tree;
+    int* ivl_cand;
+    int ivl_max;
+
+    // stitchable pairs of the pile, as abpos of the first and aepos of the second
+
+    int* spairs;
+    int nspairs;
+    int maxspairs;
+
     // for trimming
     HITS_TRACK* trackTrim;
     int useRLoader;
     TRIM* trim;
     Read_Loader *rl;
 
+    // command line
+    int purge;
+    char* trimTrack;
+    char* excludeTrack;
+
 } GapContext;
 
 // for getopt()
@@ -194,57 +226,174 @@ static int drop_break(Overlap* pOvls, int nOvls, int p1, int p2)
     return dropped;
 }
 
-static int stitchable(Overlap* pOvls, int n, int fuzz, int beg, int end)
+static int group_end(Overlap* ovls, int novl, int gb)
 {
-    if (n < 2)
+    int ge = gb + 1;
+
+    while (ge < novl && ovls[ge].bread == ovls[gb].bread)
     {
-        return 0;
+        ge++;
     }
 
-    int t = 0;
-    int k, b;
-    int ab2, ae1;
-    int bb2, be1;
+    return ge;
+}
 
-    const int ignore_mask = OVL_TEMP | OVL_CONT | OVL_TRIM | OVL_STITCH;
+static int cmp_ivl_ab(const void* x, const void* y)
+{
+    GapIvl* a = (GapIvl*)x;
+    GapIvl* b = (GapIvl*)y;
+
+    if (a->ab != b->ab)
+    {
+        return a->ab - b->ab;
+    }
+
+    return a->ovl - b->ovl;
+}
+
+static int cmp_ivl_len(const void* x, const void* y)
+{
+    GapIvl* a = (GapIvl*)x;
+    GapIvl* b = (GapIvl*)y;
+
+    int la = a->ae - a->ab;
+    int lb = b->ae - b->ab;
+
+    if (la != lb)
+    {
+        return lb - la;
+    }
+
+    return a->ovl - b->ovl;
+}
+
+// number of intervals starting before pos
+
+static int ivl_before(GapIvl* ivl, int n, int pos)
+{
+    int l = 0;
+    int r = n;
+
+    while (l < r)
+    {
+        int m = (l + r) / 2;
+
+        if (ivl[m].ab < pos)
+        {
+            l = m + 1;
+        }
+        else
+        {
+            r = m;
+        }
+    }
+
+    return l;
+}
+
+static void pile_groups(GapContext* ctx, Overlap* ovls, int novl)
+{
+    if (novl > ctx->ivl_max)
+    {
+        ctx->ivl_max = novl * 1.2 + 100;
+
+        ctx->ivl = realloc(ctx->ivl, sizeof(GapIvl) * ctx->ivl_max);
+        ctx->ivl_len = realloc(ctx->ivl_len, sizeof(GapIvl) * ctx->ivl_max);
+        ctx->ivl_rank = realloc(ctx->ivl_rank, sizeof(int) * ctx->ivl_max);
+        ctx->ivl_tree = realloc(ctx->ivl_tree, sizeof(int) * 8 * ctx->ivl_max);
+        ctx->ivl_cand = realloc(ctx->ivl_cand, sizeof(int) * 2 * ctx->ivl_max);
+    }
 
     int i;
-    for (i = 0; i < n; i++)
+    for (i = 0; i < novl; i++)
+    {
+        ctx->ivl[i].ab = ovls[i].path.abpos;
+        ctx->ivl[i].ae = ovls[i].path.aepos;
+        ctx->ivl[i].ovl = i;
+    }
+
+    int gb, ge;
+    for (gb = 0; gb < novl; gb = ge)
     {
-        if (pOvls[i].flags & ignore_mask)
+        ge = group_end(ovls, novl, gb);
+
+        if (ge - gb > 1)
         {
-            continue;
+            qsort(ctx->ivl + gb, ge - gb, sizeof(GapIvl), cmp_ivl_ab);
         }
 
-        b = pOvls[i].bread;
+        for (i = gb; i < ge; i++)
+        {
+            ctx->ivl_rank[ ctx->ivl[i].ovl ] = i - gb;
+        }
+    }
+}
 
-        ae1 = pOvls[i].path.aepos;
-        be1 = pOvls[i].path.bepos;
+static void stitchable_pairs(GapContext* ctx, Overlap* pOvls, int n, int fuzz)
+{
+    const int ignore_mask = OVL_TEMP | OVL_CONT | OVL_TRIM | OVL_STITCH;
+
+    ctx->nspairs = 0;
+
+    int gb, ge;
+    for (gb = 0; gb < n; gb = ge)
+    {
+        ge = group_end(pOvls, n, gb);
 
-        for (k = i+1; k < n && pOvls[k].bread == b; k++)
+        GapIvl* ivl = ctx->ivl + gb;
+        int nivl = ge - gb;
+
+        int i;
+        for (i = gb; i < ge; i++)
         {
-            if (  pOvls[k].flags & ignore_mask ||
-                 (pOvls[i].flags & OVL_COMP) != (pOvls[k].flags & OVL_COMP))
+            if (pOvls[i].flags & ignore_mask)
             {
                 continue;
             }
 
-            ab2 = pOvls[k].path.abpos;
-            bb2 = pOvls[k].path.bbpos;
+            int ae1 = pOvls[i].path.aepos;
+            int be1 = pOvls[i].path.bepos;
 
-            int deltaa = abs(ae1 - ab2);
-            int deltab = abs(be1 - bb2);
+            // abpos of the second overlap within fuzz of ae1
 
-            if ( deltaa < fuzz && deltab < fuzz )
+            int p;
+            for (p = ivl_before(ivl, nivl, ae1 - fuzz + 1); p < nivl && ivl[p].ab < ae1 + fuzz; p++)
             {
-                if (pOvls[i].path.abpos < beg - MIN_LR && pOvls[k].path.aepos > end + MIN_LR)
+                int k = ivl[p].ovl;
+
+                if ( k <= i ||
+                     pOvls[k].flags & ignore_mask ||
+                     (pOvls[i].flags & OVL_COMP) != (pOvls[k].flags & OVL_COMP) )
                 {
-                    t++;
+                    continue;
+                }
 
-                    // printf("stitch using b %d\n", b);
+                if ( abs(be1 - pOvls[k].path.bbpos) < fuzz )
+                {
+                    if (ctx->nspairs + 2 > ctx->maxspairs)
+                    {
+                        ctx->maxspairs = ctx->maxspairs * 1.2 + 100;
+                        ctx->spairs = realloc(ctx->spairs, sizeof(int) * ctx->maxspairs);
+                    }
+
+                    ctx->spairs[ ctx->nspairs++ ] = pOvls[i].path.abpos;
+                    ctx->spairs[ ctx->nspairs++ ] = pOvls[k].path.aepos;
                 }
             }
+        }
+    }
+}
 
+static int stitchable(GapContext* ctx, int beg, int end)
+{
+    int t = 0;
+
+    int i;
+    for (i = 0; i < ctx->nspairs; i += 2)
+    {
+        if (ctx->spairs[i] < beg - MIN_LR && ctx->spairs[i + 1] > end + MIN_LR)
+        {
+            t++;
         }
     }
 
@@ -256,6 +405,186 @@ static int ovl_intersect(Overlap* a, Overlap* b)
     return intersect( a->path.abpos, a->path.aepos, b->path.abpos, b->path.aepos );
 }
 
+static int gap_counted(Overlap* ovl)
+{
+    return !( ovl->flags & OVL_DISCARD ) && ovl->aread != ovl->bread;
+}
+
+/*
+ * overlaps of a B read that intersect a longer one of the same B read are tagged
+ * OVL_TEMP and don't count towards the coverage. pairwise this is done for all
+ * pairs (i, j > i) where i is counted, ties go against j.
+ */
+
+static void mark_shadowed_pairwise(Overlap* ovls, int gb, int ge)
+{
+    int i, j;
+    for (i = gb; i < ge; i++)
+    {
+        Overlap* ovl = ovls + i;
+
+        if ( !gap_counted(ovl) )
+        {
+            continue;
+        }
+
+        for (j = i + 1; j < ge; j++)
+        {
+            if ( ovl_intersect(ovl, ovls + j) )
+            {
+                if ( ovl->path.aepos - ovl->path.abpos < ovls[j].path.aepos - ovls[j].path.abpos )
+                {
+                    ovl->flags |= OVL_TEMP;
+                }
+                else
+                {
+                    ovls[j].flags |= OVL_TEMP;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * B-read groups of many overlaps are split by pile index. the pairs crossing the
+ * split are handled by sweeping both halves in order of decreasing length, with a
+ * prefix maximum of aepos over the abpos sorted intervals of the group telling
+ * whether any of the longer ones seen so far intersects.
+ */
+
+static void shadow_insert(int* fen, int n, int r, int ae)
+{
+    for (r++; r <= n; r += r & -r)
+    {
+        fen[r] = MAX(fen[r], ae);
+    }
+}
+
+static void shadow_clear(int* fen, int n, int r)
+{
+    for (r++; r <= n; r += r & -r)
+    {
+        fen[r] = -1;
+    }
+}
+
+static int shadow_query(int* fen, GapIvl* ivl, int n, Overlap* ovl)
+{
+    int r;
+    for (r = ivl_before(ivl, n, ovl->path.aepos); r > 0; r -= r & -r)
+    {
+        if (fen[r] > ovl->path.abpos)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void mark_shadowed_split(GapContext* ctx, Overlap* ovls, int gb, int ge, int l, int r)
+{
+    if (r - l < SWEEP_MIN)
+    {
+        mark_shadowed_pairwise(ovls, l, r);
+        return;
+    }
+
+    int n = ge - gb;
+    GapIvl* ivl = ctx->ivl + gb;
+    GapIvl* order = ctx->ivl_len;
+    int* fen = ctx->ivl_tree;
+    int m = (l + r) / 2;
+    int nl = 0;
+    int nr = 0;
+    int i, p;
+
+    for (i = l; i < m; i++)
+    {
+        if ( gap_counted(ovls + i) )
+        {
+            order[nl].ab = ovls[i].path.abpos;
+            order[nl].ae = ovls[i].path.aepos;
+            order[nl].ovl = i;
+            nl++;
+        }
+    }
+
+    if (nl > 0)
+    {
+        for (i = m; i < r; i++)
+        {
+            order[nl + nr].ab = ovls[i].path.abpos;
+            order[nl + nr].ae = ovls[i].path.aepos;
+            order[nl + nr].ovl = i;
+            nr++;
+        }
+
+        qsort(order, nl, sizeof(GapIvl), cmp_ivl_len);
+        qsort(order + nl, nr, sizeof(GapIvl), cmp_ivl_len);
+
+        // right half against the counted ones at least as long on the left
+
+        for (i = nl, p = 0; i < nl + nr; i++)
+        {
+            int len = order[i].ae - order[i].ab;
+
+            for ( ; p < nl && order[p].ae - order[p].ab >= len; p++)
+            {
+                shadow_insert(fen, n, ctx->ivl_rank[ order[p].ovl ], order[p].ae);
+            }
+
+            if ( shadow_query(fen, ivl, n, ovls + order[i].ovl) )
+            {
+                ovls[ order[i].ovl ].flags |= OVL_TEMP;
+            }
+        }
+
+        while (p > 0)
+        {
+            p--;
+            shadow_clear(fen, n, ctx->ivl_rank[ order[p].ovl ]);
+        }
+
+        // counted ones on the left against the longer ones on the right
+
+        for (i = 0, p = nl; i < nl; i++)
+        {
+            int len = order[i].ae - order[i].ab;
+
+            for ( ; p < nl + nr && order[p].ae - order[p].ab > len; p++)
+            {
+                shadow_insert(fen, n, ctx->ivl_rank[ order[p].ovl ], order[p].ae);
+            }
+
+            if ( shadow_query(fen, ivl, n, ovls + order[i].ovl) )
+            {
+                ovls[ order[i].ovl ].flags |= OVL_TEMP;
+            }
+        }
+
+        while (p > nl)
+        {
+            p--;
+            shadow_clear(fen, n, ctx->ivl_rank[ order[p].ovl ]);
+        }
+    }
+
+    mark_shadowed_split(ctx, ovls, gb, ge, l, m);
+    mark_shadowed_split(ctx, ovls, gb, ge, m, r);
+}
+
+static void mark_shadowed_sweep(GapContext* ctx, Overlap* ovls, int gb, int ge)
+{
+    int i;
+    for (i = 1; i <= ge - gb; i++)
+    {
+        ctx->ivl_tree[i] = -1;
+    }
+
+    mark_shadowed_split(ctx, ovls, gb, ge, gb, ge);
+}
+
 /*
 static int handle_repeat_chimers(GapContext* ctx, Overlap* ovls, int novl)
 {
@@ -345,6 +674,23 @@ static int handle_gaps_and_breaks(GapContext* ctx, Overlap* ovls, int novl)
 
     bzero(ctx->rm_bins, sizeof(uint64) * ctx->rm_maxbins);
 
+    int gb, ge;
+    for (gb = 0; gb < novl; gb = ge)
+    {
+        ge = group_end(ovls, novl, gb);
+
+        if (ge - gb >= SWEEP_MIN)
+        {
+            mark_shadowed_sweep(ctx, ovls, gb, ge);
+        }
+        else
+        {
+            mark_shadowed_pairwise(ovls, gb, ge);
+        }
+    }
+
+    // coverage of the bins, as differences first
+
     int trim_b = INT_MAX;
     int trim_e = 0;
 
@@ -353,29 +699,7 @@ static int handle_gaps_and_breaks(GapContext* ctx, Overlap* ovls, int novl)
     {
         Overlap* ovl = ovls + i;
 
-        if ( ( ovl->flags & OVL_DISCARD ) ||
-             ( ovl->aread == ovl->bread ) )
-        {
-            continue;
-        }
-
-        int j;
-        for ( j = i + 1; j < novl && ovls[j].bread == ovl->bread; j++)
-        {
-            if ( ovl_intersect(ovl, ovls + j) )
-            {
-                if ( ovl->path.aepos - ovl->path.abpos < ovls[j].path.aepos - ovls[j].path.abpos )
-                {
-                    ovl->flags |= OVL_TEMP;
-                }
-                else
-                {
-                    ovls[j].flags |= OVL_TEMP;
-                }
-            }
-        }
-
-        if (ovl->flags & OVL_TEMP)
+        if ( !gap_counted(ovl) || (ovl->flags & OVL_TEMP) )
         {
             continue;
         }
@@ -386,13 +710,18 @@ static int handle_gaps_and_breaks(GapContext* ctx, Overlap* ovls, int novl)
         trim_b = MIN(ovl->path.abpos, trim_b);
         trim_e = MAX(ovl->path.aepos, trim_e);
 
-        while (b < e)
+        if (b < e)
         {
             ctx->rm_bins[b]++;
-            b++;
+            ctx->rm_bins[e]--;
         }
     }
 
+    for (i = 1; i < ctx->rm_maxbins; i++)
+    {
+        ctx->rm_bins[i] += ctx->rm_bins[i - 1];
+    }
+
     if (trim_b >= trim_e)
     {
         return 1;
@@ -404,6 +733,7 @@ static int handle_gaps_and_breaks(GapContext* ctx, Overlap* ovls, int novl)
     int e = ( trim_e - MIN_LR ) / BIN_SIZE;
 
     int beg = -1;
+    int spairs = 0;
 
     while (b < e)
     {
@@ -459,7 +789,13 @@ static int handle_gaps_and_breaks(GapContext* ctx, Overlap* ovls, int novl)
 
                 if (!skip && stitch > 0)
                 {
-                    int nstitch = stitchable(ovls, novl, stitch, breakb, breake);
+                    if (!spairs)
+                    {
+                        stitchable_pairs(ctx, ovls, novl, stitch);
+                        spairs = 1;
+                    }
+
+                    int nstitch = stitchable(ctx, breakb, breake);
 
                     if (nstitch)
                     {
@@ -520,94 +856,247 @@ static int contained(int ab, int ae, int bb, int be)
     return 0;
 }
 
-static int drop_containments(GapContext* ctx, Overlap* ovl, int novl)
+static void b_interval(Overlap* ovl, int blen, int* bb, int* be)
 {
-    if (novl < 2)
+    if (ovl->flags & OVL_COMP)
     {
-        return 1;
+        *bb = blen - ovl->path.bepos;
+        *be = blen - ovl->path.bbpos;
     }
+    else
+    {
+        *bb = ovl->path.bbpos;
+        *be = ovl->path.bepos;
+    }
+}
 
-    int i;
-    int ab1, ab2, ae1, ae2;
-    int bb1, bb2, be1, be2;
+// discards i or k if one contains the other in A and B, returns 1 if it was i
 
-    for (i = 0; i < novl; i++)
+static int drop_contained_pair(GapContext* ctx, Overlap* ovl, int i, int k, int blen)
+{
+    int ab1 = ovl[i].path.abpos;
+    int ae1 = ovl[i].path.aepos;
+    int ab2 = ovl[k].path.abpos;
+    int ae2 = ovl[k].path.aepos;
+    int bb1, be1, bb2, be2;
+
+    b_interval(ovl + i, blen, &bb1, &be1);
+    b_interval(ovl + k, blen, &bb2, &be2);
+
+    int cont = contained(ab1, ae1, ab2, ae2);
+    if ( cont && contained(bb1, be1, bb2, be2) )
     {
-        int bread = ovl[i].bread;
+#ifdef VERBOSE_CONTAINMENT
+        printf("CONTAINMENT %8d @ %5d..%5d -> %8d @ %5d..%5d\n"
+               "                       %5d..%5d -> %8d @ %5d..%5d\n",
+                ovl[i].aread, ab1, ae1, ovl[i].bread, bb1, be1,
+                              ab2, ae2, ovl[k].bread, bb2, be2);
+#endif
 
-        if ( (ovl[i].flags & OVL_DISCARD) ||
-              ovl[i].aread == bread )
+        if (cont == 1)
         {
-            continue;
+            ovl[i].flags |= OVL_DISCARD | OVL_CONT;
+            ctx->stats_contained++;
+            return 1;
         }
-
-        int blen = DB_READ_LEN(ctx->db, bread);
-
-        ab1 = ovl[i].path.abpos;
-        ae1 = ovl[i].path.aepos;
-
-        if (ovl[i].flags & OVL_COMP)
+        else if (cont == 2)
         {
-            bb1 = blen - ovl[i].path.bepos;
-            be1 = blen - ovl[i].path.bbpos;
+            ovl[k].flags |= OVL_DISCARD | OVL_CONT;
+            ctx->stats_contained++;
         }
-        else
+    }
+
+    return 0;
+}
+
+static void drop_containments_pairwise(GapContext* ctx, Overlap* ovl, int gb, int ge, int blen)
+{
+    int i, k;
+    for (i = gb; i < ge; i++)
+    {
+        if (ovl[i].flags & OVL_DISCARD)
         {
-            bb1 = ovl[i].path.bbpos;
-            be1 = ovl[i].path.bepos;
+            continue;
         }
 
-        int k;
-        for (k = i+1; k < novl; k++)
+        for (k = i + 1; k < ge; k++)
         {
             if (ovl[k].flags & OVL_DISCARD)
             {
                 continue;
             }
 
-            if (ovl[k].bread != bread)
+            if ( drop_contained_pair(ctx, ovl, i, k, blen) )
             {
-                break ;
+                break;
             }
+        }
+    }
+}
+
+/*
+ * segment tree over the abpos sorted intervals of a B-read group holding the min
+ * and max aepos of the overlaps not discarded. reports the intervals in [ql, qr)
+ * with aepos >= x (ge) or <= x.
+ */
+
+static void seg_report(int* t, int node, int l, int r, int ql, int qr, int x, int ge, int* out, int* nout)
+{
+    if (qr <= l || r <= ql || (ge ? t[node] < x : t[node] > x))
+    {
+        return;
+    }
+
+    if (r - l == 1)
+    {
+        out[ (*nout)++ ] = l;
+        return;
+    }
 
-            ab2 = ovl[k].path.abpos;
-            ae2 = ovl[k].path.aepos;
+    int m = (l + r) / 2;
+
+    seg_report(t, 2 * node, l, m, ql, qr, x, ge, out, nout);
+    seg_report(t, 2 * node + 1, m, r, ql, qr, x, ge, out, nout);
+}
+
+static void seg_remove(int* tmin, int* tmax, int size, int p)
+{
+    int node = size + p;
 
-            if (ovl[k].flags & OVL_COMP)
+    tmin[node] = INT_MAX;
+    tmax[node] = INT_MIN;
+
+    for (node /= 2; node >= 1; node /= 2)
+    {
+        tmin[node] = MIN(tmin[2 * node], tmin[2 * node + 1]);
+        tmax[node] = MAX(tmax[2 * node], tmax[2 * node + 1]);
+    }
+}
+
+static int cmp_int(const void* x, const void* y)
+{
+    return *(int*)x - *(int*)y;
+}
+
+/*
+ * same result as pairwise, but for each i only the overlaps nested with it in A
+ * are looked at. those are the ones starting at or before abpos and ending at or
+ * after aepos, plus the ones starting and ending within it. they are visited in
+ * pile order, since discarding is order dependent.
+ */
+
+static void drop_containments_sweep(GapContext* ctx, Overlap* ovl, int gb, int ge, int blen)
+{
+    int n = ge - gb;
+    GapIvl* ivl = ctx->ivl + gb;
+    int* cand = ctx->ivl_cand;
+
+    int size = 1;
+    while (size < n)
+    {
+        size *= 2;
+    }
+
+    int* tmin = ctx->ivl_tree;
+    int* tmax = ctx->ivl_tree + 2 * size;
+
+    int p;
+    for (p = 0; p < size; p++)
+    {
+        if (p < n && !(ovl[ ivl[p].ovl ].flags & OVL_DISCARD))
+        {
+            tmin[size + p] = tmax[size + p] = ivl[p].ae;
+        }
+        else
+        {
+            tmin[size + p] = INT_MAX;
+            tmax[size + p] = INT_MIN;
+        }
+    }
+
+    for (p = size - 1; p >= 1; p--)
+    {
+        tmin[p] = MIN(tmin[2 * p], tmin[2 * p + 1]);
+        tmax[p] = MAX(tmax[2 * p], tmax[2 * p + 1]);
+    }
+
+    int i;
+    for (i = gb; i < ge; i++)
+    {
+        if (ovl[i].flags & OVL_DISCARD)
+        {
+            continue;
+        }
+
+        int ab = ovl[i].path.abpos;
+        int ae = ovl[i].path.aepos;
+        int ncand = 0;
+
+        seg_report(tmax, 1, 0, size, 0, ivl_before(ivl, n, ab + 1), ae, 1, cand, &ncand);
+        seg_report(tmin, 1, 0, size, ivl_before(ivl, n, ab), ivl_before(ivl, n, ae + 1), ae, 0, cand, &ncand);
+
+        int c, nc;
+        for (c = nc = 0; c < ncand; c++)
+        {
+            if (ivl[ cand[c] ].ovl > i)
             {
-                bb2 = blen - ovl[k].path.bepos;
-                be2 = blen - ovl[k].path.bbpos;
+                cand[nc++] = ivl[ cand[c] ].ovl;
             }
-            else
+        }
+
+        qsort(cand, nc, sizeof(int), cmp_int);
+
+        for (c = 0; c < nc; c++)
+        {
+            int k = cand[c];
+
+            if ( (c > 0 && cand[c - 1] == k) || (ovl[k].flags & OVL_DISCARD) )
             {
-                bb2 = ovl[k].path.bbpos;
-                be2 = ovl[k].path.bepos;
+                continue;
             }
 
-            int cont = contained(ab1, ae1, ab2, ae2);
-            if ( cont && contained(bb1, be1, bb2, be2) )
+            if ( drop_contained_pair(ctx, ovl, i, k, blen) )
             {
-#ifdef VERBOSE_CONTAINMENT
-                printf("CONTAINMENT %8d @ %5d..%5d -> %8d @ %5d..%5d\n"
-                       "                       %5d..%5d -> %8d @ %5d..%5d\n",
-                        a, ab1, ae1, ovl[i].bread, bb1, be1,
-                           ab2, ae2, ovl[k].bread, bb2, be2);
-#endif
+                seg_remove(tmin, tmax, size, ctx->ivl_rank[i]);
+                break;
+            }
 
-                if (cont == 1)
-                {
-                    ovl[i].flags |= OVL_DISCARD | OVL_CONT;
-                    ctx->stats_contained++;
-                    break;
-                }
-                else if (cont == 2)
-                {
-                    ovl[k].flags |= OVL_DISCARD | OVL_CONT;
-                    ctx->stats_contained++;
-                }
+            if (ovl[k].flags & OVL_DISCARD)
+            {
+                seg_remove(tmin, tmax, size, ctx->ivl_rank[k]);
             }
         }
     }
+}
+
+static int drop_containments(GapContext* ctx, Overlap* ovl, int novl)
+{
+    if (novl < 2)
+    {
+        return 1;
+    }
+
+    int gb, ge;
+    for (gb = 0; gb < novl; gb = ge)
+    {
+        ge = group_end(ovl, novl, gb);
+
+        if (ge - gb < 2 || ovl[gb].aread == ovl[gb].bread)
+        {
+            continue;
+        }
+
+        int blen = DB_READ_LEN(ctx->db, ovl[gb].bread);
+
+        if (ge - gb >= SWEEP_MIN)
+        {
+            drop_containments_sweep(ctx, ovl, gb, ge, blen);
+        }
+        else
+        {
+            drop_containments_pairwise(ctx, ovl, gb, ge, blen);
+        }
+    }
 
     return 1;
 }
@@ -627,6 +1116,13 @@ static void gaps_pre(PassContext* pctx, GapContext* ctx)
     ctx->rc_right = NULL;
     ctx->rc_maxright = 0;
 
+    ctx->ivl = ctx->ivl_len = NULL;
+    ctx->ivl_rank = ctx->ivl_tree = ctx->ivl_cand = NULL;
+    ctx->ivl_max = 0;
+
+    ctx->spairs = NULL;
+    ctx->maxspairs = 0;
+
     // trim
 
     ctx->trim = trim_init(ctx->db, pctx->twidth, ctx->trackTrim, ctx->rl);
@@ -651,6 +1147,14 @@ static void gaps_post(GapContext* ctx)
     free(ctx->rc_left);
     free(ctx->rc_right);
 
+    free(ctx->ivl);
+    free(ctx->ivl_len);
+    free(ctx->ivl_rank);
+    free(ctx->ivl_tree);
+    free(ctx->ivl_cand);
+
+    free(ctx->spairs);
+
     if(ctx->trackTrim)
     {
     	trim_close(ctx->trim);
@@ -664,13 +1168,11 @@ static int gaps_handler(void* _ctx, Overlap* ovl, int novl)
     // trim
     if (ctx->trackTrim)
     {
-        int i;
-		for (i = 0; i < novl; i++)
-		{
-			trim_overlap(ctx->trim, ovl + i);
-		}
+        trim_overlaps(ctx->trim, ovl, novl);
     }
 
+    pile_groups(ctx, ovl, novl);
+
     drop_containments(ctx, ovl, novl);
 
     handle_gaps_and_breaks(ctx, ovl, novl);
@@ -703,24 +1205,14 @@ static void usage(FILE* fout, const char* app)
     fprintf( fout, "         -L two-pass processing with read caching\n" );
 }
 
-int main(int argc, char* argv[])
+static void gaps_args(GapContext* gctx, int argc, char* argv[])
 {
-    HITS_DB db;
-    PassContext* pctx;
-    FILE* fileOvlIn;
-    FILE* fileOvlOut;
-    GapContext gctx;
     char* app = argv[ 0 ];
 
-    // process arguments
-    int arg_purge = DEF_ARG_P;
-    char* arg_trimTrack = NULL;
-    char* excludeTrack = NULL;
-    // char* repeatTrack = NULL;
-
-    bzero(&gctx, sizeof(GapContext));
-
-    gctx.stitch = DEF_ARG_S;
+    gctx->stitch = DEF_ARG_S;
+    gctx->purge = DEF_ARG_P;
+    gctx->trimTrack = NULL;
+    gctx->excludeTrack = NULL;
 
     opterr = 0;
 
@@ -729,30 +1221,24 @@ int main(int argc, char* argv[])
     {
         switch (c)
         {
-            /*
-            case 'r':
-                      repeatTrack = optarg;
-                      break;
-            */
-
             case 'e':
-                      excludeTrack = optarg;
+                      gctx->excludeTrack = optarg;
                       break;
 
             case 't':
-                      arg_trimTrack = optarg;
+                      gctx->trimTrack = optarg;
                       break;
 
             case 's':
-                      gctx.stitch = atoi(optarg);
+                      gctx->stitch = atoi(optarg);
                       break;
 
             case 'p':
-                      arg_purge = 1;
+                      gctx->purge = 1;
                       break;
 
             case 'L':
-                      gctx.useRLoader = 1;
+                      gctx->useRLoader = 1;
                       break;
 
             default:
@@ -761,6 +1247,165 @@ int main(int argc, char* argv[])
         }
     }
 
+    if ( gctx->useRLoader && gctx->trimTrack == NULL )
+    {
+        fprintf(stderr, "read loader requires a trim track\n");
+        exit(1);
+    }
+}
+
+static void gaps_load_tracks(GapContext* gctx)
+{
+    if (gctx->excludeTrack && !gctx->trackExclude)
+    {
+        gctx->trackExclude = track_load(gctx->db, gctx->excludeTrack);
+
+        if (!gctx->trackExclude)
+        {
+            fprintf(stderr, "could not open track '%s'\n", gctx->excludeTrack);
+            exit(1);
+        }
+    }
+
+    if (gctx->trimTrack && !gctx->trackTrim)
+    {
+        gctx->trackTrim = track_load(gctx->db, gctx->trimTrack);
+
+        if (!gctx->trackTrim)
+        {
+            fprintf(stderr, "could not open track '%s'\n", gctx->trimTrack);
+            exit(1);
+        }
+    }
+}
+
+// LAscrub stage
+
+static void stage_prepare_pre(PassContext* pctx, void* data)
+{
+    UNUSED(pctx);
+
+    GapContext* gctx = (GapContext*)data;
+
+    gaps_load_tracks(gctx);
+
+    if (gctx->rl)
+    {
+        rl_free(gctx->rl);
+    }
+
+    gctx->rl = rl_init(gctx->db, 1);
+}
+
+static void stage_prepare_post(void* data)
+{
+    GapContext* gctx = (GapContext*)data;
+
+    rl_load_added(gctx->rl);
+}
+
+static void stage_pre(PassContext* pctx, void* data)
+{
+    GapContext* gctx = (GapContext*)data;
+
+    gaps_load_tracks(gctx);
+
+    if (gctx->trackTrim && !gctx->useRLoader)
+    {
+        Map_Bases(gctx->db);
+    }
+
+    // the stage is run again by later phases
+
+    gctx->stats_contained = 0;
+    gctx->stats_breaks = 0;
+    gctx->stats_breaks_novl = 0;
+
+    gaps_pre(pctx, gctx);
+}
+
+static void stage_post(void* data)
+{
+    gaps_post((GapContext*)data);
+}
+
+static void stage_free(void* data)
+{
+    GapContext* gctx = (GapContext*)data;
+
+    if (gctx->rl)
+    {
+        rl_free(gctx->rl);
+    }
+
+    free(gctx);
+}
+
+void lagap_stage(ScrubStage* stage, HITS_DB* db, int argc, char* argv[])
+{
+    GapContext* gctx = calloc(1, sizeof(GapContext));
+
+    gctx->db = db;
+
+    gaps_args(gctx, argc, argv);
+
+    if (argc != optind)
+    {
+        usage(stdout, argv[0]);
+        exit(1);
+    }
+
+    bzero(stage, sizeof(ScrubStage));
+
+    stage->name = "LAgap";
+    stage->data = gctx;
+    stage->filter = 1;
+    stage->purge = gctx->purge;
+
+    stage->load_trace = 1;
+    stage->unpack_trace = (gctx->trimTrack == NULL ? 0 : 1);
+
+    if (gctx->trimTrack)
+    {
+        stage->tracks_in[ stage->ntracks_in++ ] = gctx->trimTrack;
+    }
+
+    if (gctx->excludeTrack)
+    {
+        stage->tracks_in[ stage->ntracks_in++ ] = gctx->excludeTrack;
+    }
+
+    if (gctx->useRLoader)
+    {
+        stage->prepare_pre = stage_prepare_pre;
+        stage->prepare = loader_handler;
+        stage->prepare_post = stage_prepare_post;
+        stage->prepare_any = 1;
+    }
+
+    stage->pre = stage_pre;
+    stage->handler = gaps_handler;
+    stage->post = stage_post;
+    stage->free = stage_free;
+}
+
+#ifndef LASCRUB
+
+int main(int argc, char* argv[])
+{
+    HITS_DB db;
+    PassContext* pctx;
+    FILE* fileOvlIn;
+    FILE* fileOvlOut;
+    GapContext gctx;
+    char* app = argv[ 0 ];
+
+    // process arguments
+
+    bzero(&gctx, sizeof(GapContext));
+
+    gaps_args(&gctx, argc, argv);
+
     if (argc - optind < 3)
     {
         usage(stdout, app);
@@ -789,41 +1434,12 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    if (excludeTrack)
-    {
-        gctx.trackExclude = track_load(&db, excludeTrack);
-
-        if (!gctx.trackExclude)
-        {
-            fprintf(stderr, "could not open track '%s'\n", excludeTrack);
-            exit(1);
-        }
-    }
-
-    /*
-    if (repeatTrack)
-    {
-        gctx.trackRepeat = track_load(&db, repeatTrack);
-
-        if (!gctx.trackRepeat)
-        {
-            fprintf(stderr, "could not open track '%s'\n", repeatTrack);
-            exit(1);
-        }
-    }
-    */
-
     gctx.db = &db;
 
-    if ( arg_trimTrack != NULL )
-    {
-    	gctx.trackTrim = track_load(gctx.db, arg_trimTrack);
-        if (!gctx.trackTrim)
-        {
-            fprintf(stderr, "could not open track '%s'\n", arg_trimTrack);
-            exit(1);
-        }
+    gaps_load_tracks(&gctx);
 
+    if ( gctx.trackTrim != NULL )
+    {
     	if ( gctx.useRLoader )
     	{
 			gctx.rl = rl_init(&db, 1);
@@ -838,12 +1454,11 @@ int main(int argc, char* argv[])
 			rl_load_added(gctx.rl);
 			pass_free(pctx);
     	}
+    	else
+    	{
+    		Map_Bases(&db);
+    	}
 	}
-    else if ( gctx.useRLoader )
-    {
-        fprintf(stderr, "read loader requires a trim track\n");
-        exit(1);
-    }
 
     pctx = pass_init(fileOvlIn, fileOvlOut);
 
@@ -852,7 +1467,7 @@ int main(int argc, char* argv[])
     pctx->unpack_trace = (gctx.trackTrim == NULL ? 0 : 1);
     pctx->data = &gctx;
     pctx->write_overlaps = 1;
-    pctx->purge_discarded = arg_purge;
+    pctx->purge_discarded = gctx.purge;
 
     gaps_pre(pctx, &gctx);
 
@@ -877,3 +1492,4 @@ int main(int argc, char* argv[])
     return 0;
 }
 
+#endif
@@ -64,6 +64,7 @@ typedef struct
     track_anno* rp_anno;
 
     int* rp_events;
+    int* rp_buckets;    // sort_coverage_events()
 
     uint64_t stats_bases;
     uint64_t stats_repeat_bases;
@@ -74,21 +75,6 @@ typedef struct
 extern char* optarg;
 extern int optind, opterr, optopt;
 
-static int cmp_repeats_events(const void* x, const void* y)
-{
-    int* e1 = (int*)x;
-    int* e2 = (int*)y;
-
-    int cmp = abs(*e1) - abs(*e2);
-
-    if (cmp == 0)
-    {
-        cmp = (*e1) - (*e2);
-    }
-
-    return cmp;
-}
-
 static void pre_repeats(RepeatContext* ctx)
 {
 #ifdef VERBOSE
@@ -104,6 +90,7 @@ static void pre_repeats(RepeatContext* ctx)
 
     ctx->rp_emax = 100;
     ctx->rp_events = (int*)malloc(sizeof(int) * ctx->rp_emax);
+    ctx->rp_buckets = (int*)calloc(2 * DB_READ_MAXLEN(ctx->db) + 2, sizeof(int));
     ctx->rp_anno = (track_anno*)malloc(sizeof(track_anno) * ( DB_NREADS(ctx->db) + 1));
     bzero(ctx->rp_anno, sizeof(track_anno)*( DB_NREADS(ctx->db) + 1));
 
@@ -131,6 +118,7 @@ static void post_repeats(RepeatContext* ctx)
     free(ctx->rp_anno);
     free(ctx->rp_data);
     free(ctx->rp_events);
+    free(ctx->rp_buckets);
 
 #ifdef VERBOSE
     printf("BASES_TOTAL %" PRIu64 "\n", ctx->stats_bases);
@@ -211,7 +199,7 @@ static int handler_repeats(void* _ctx, Overlap* ovls, int novl)
 
     novl = j/2;
 
-    qsort(ctx->rp_events, 2*novl, sizeof(int), cmp_repeats_events);
+    sort_coverage_events(ctx->rp_events, 2*novl, ctx->rp_buckets);
 
     int span = 0;
     int span_leave = ctx->cnt_leave;
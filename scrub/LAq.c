@@ -28,6 +28,8 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+#include "scrub/stage.h"
+
 // toggles
 
 #define VERBOSE
@@ -35,6 +37,12 @@
 
 #define TRIM_WINDOW        5
 
+// partial q tracks, per read [twidth] [segmax] followed by
+// [n] [q << PART_Q_SHIFT | count] x n for each tile
+
+#define PART_Q_SHIFT      16
+#define PART_COUNT_MASK   0xffff
+
 // command line defaults
 
 #define DEF_ARG_B          0
@@ -44,6 +52,7 @@
 
 #define DEF_ARG_S          1
 #define DEF_ARG_SS        20
+#define DEF_ARG_J          1
 
 #define DEF_ARG_T   	TRACK_TRIM
 #define DEF_ARG_Q   	TRACK_Q
@@ -59,20 +68,28 @@ typedef struct
     int min_trimmed_len;    // min length of read after trimming
 
     int twidth;             // trace point spacing
+    size_t tbytes;          // bytes per value of the traces passed in
 
     unsigned int segmin;    // min number of segments for q estimate
     unsigned int segmax;
 
-    uint32* q_histo;
+    uint32* q_histo;        // per tile the number of segments by diffs, twidth bins each
     size_t q_histo_len;
 
     track_anno* q_anno;
     track_data* q_data;
     int q_dprev, q_dcur, q_dmax;
 
+    // partial q track, the capped segment histograms that can be merged
+    char* track_part_out;
+    track_anno* p_anno;
+    track_data* p_data;
+    uint64 p_dcur, p_dmax;
+
     // re-annotate only
     HITS_TRACK* q_track;        // q track
     HITS_TRACK* trim_track;     // trim track
+    track_cache* tracks;
     int trim_q;                 // trimming quality cutoff
 
     char *track_trim_in;
@@ -84,6 +101,13 @@ typedef struct
     track_anno* trim_anno;
     track_data* trim_data;
     track_anno tcur;
+
+    // command line
+
+    int update;                 // update existing trim track
+    int merge;                  // merge partial q tracks instead of a .las pass
+    int nthreads;
+    char* qlog;
 } AnnotateContext;
 
 // for getopt()
@@ -265,14 +289,8 @@ static void calculate_trim(AnnotateContext* actx)
     free(anno);
 }
 
-static void pre_annotate(PassContext* pctx, AnnotateContext* ctx)
+static void alloc_annotate(AnnotateContext* ctx)
 {
-#ifdef VERBOSE
-    printf(ANSI_COLOR_GREEN "PASS quality estimate and trimming" ANSI_COLOR_RESET "\n");
-#endif
-
-    ctx->twidth = pctx->twidth;
-
     ctx->q_anno = (track_anno*)malloc(sizeof(track_anno)*(DB_NREADS(ctx->db)+1));
     bzero(ctx->q_anno, sizeof(track_anno)*(DB_NREADS(ctx->db)+1));
 
@@ -282,8 +300,30 @@ static void pre_annotate(PassContext* pctx, AnnotateContext* ctx)
 
     int maxtiles = (DB_READ_MAXLEN(ctx->db) + ctx->twidth - 1) / ctx->twidth;
 
-    ctx->q_histo_len = ctx->twidth * 2 * maxtiles;
+    ctx->q_histo_len = ctx->twidth * maxtiles;
     ctx->q_histo = malloc( sizeof(uint32) * ctx->q_histo_len );
+
+    if (ctx->track_part_out)
+    {
+        ctx->p_anno = (track_anno*)malloc(sizeof(track_anno)*(DB_NREADS(ctx->db)+1));
+        bzero(ctx->p_anno, sizeof(track_anno)*(DB_NREADS(ctx->db)+1));
+
+        ctx->p_dmax = DB_NREADS(ctx->db);
+        ctx->p_dcur = 0;
+        ctx->p_data = (track_data*)malloc(sizeof(track_data)*ctx->p_dmax);
+    }
+}
+
+static void pre_annotate(PassContext* pctx, AnnotateContext* ctx)
+{
+#ifdef VERBOSE
+    printf(ANSI_COLOR_GREEN "PASS quality estimate and trimming" ANSI_COLOR_RESET "\n");
+#endif
+
+    ctx->twidth = pctx->twidth;
+    ctx->tbytes = PASS_TRACE_BYTES(pctx);
+
+    alloc_annotate(ctx);
 }
 
 static void post_annotate(AnnotateContext* ctx)
@@ -307,26 +347,171 @@ static void post_annotate(AnnotateContext* ctx)
 
     track_write(ctx->db, ctx->track_q_out, ctx->tblock, ctx->q_anno, ctx->q_data, ctx->q_dcur);
 
+    if (ctx->track_part_out)
+    {
+        qoff = 0;
+
+        for (j = 0; j <= nreads; j++)
+        {
+            coff = ctx->p_anno[j];
+            ctx->p_anno[j] = qoff;
+            qoff += coff;
+        }
+
+        track_write(ctx->db, ctx->track_part_out, ctx->tblock, ctx->p_anno, ctx->p_data, ctx->p_dcur);
+
+        free(ctx->p_anno);
+        free(ctx->p_data);
+    }
+
     free(ctx->q_anno);
     free(ctx->q_data);
 
     free(ctx->q_histo);
 }
 
-static int handler_annotate(void* _ctx, Overlap* ovls, int novl)
-{
-    AnnotateContext* ctx = (AnnotateContext*)_ctx;
+// mean q of the lowest segmax diffs in each tile, from the histograms in q_histo
 
+static void estimate_q(AnnotateContext* ctx, int a, int ntiles)
+{
     unsigned int segmin = ctx->segmin;
     unsigned int segmax = ctx->segmax;
+    uint32* q_histo = ctx->q_histo;
+    int twidth = ctx->twidth;
+
+    if (ctx->q_dcur + ntiles >= ctx->q_dmax)
+    {
+        ctx->q_dmax = ctx->q_dmax * 1.2 + ntiles;
+        ctx->q_data = realloc(ctx->q_data, sizeof(track_data) * ctx->q_dmax);
+    }
+
+    int i;
+    for (i = 0; i < ntiles; i++)
+    {
+        uint32* tile_qhisto = q_histo + twidth * i;
+        uint32 sum = 0;
+        uint32 count = 0;
+
+        int q;
+
+        for ( q = 0 ; q < twidth && count != segmax ; q++ )
+        {
+            uint32 has = MIN(tile_qhisto[q], segmax - count);
+            count += has;
+            sum += has * q;
+        }
+
+        if (count < segmin)
+        {
+            q = 0;
+        }
+        else
+        {
+            if (sum == 0)
+            {
+                sum = count;
+            }
+
+            q = (int)( ((float)sum)/count + 0.5 );
+        }
+
+        ctx->q_data[ ctx->q_dcur++ ] = q;
+        ctx->q_anno[ a ] += 1 * sizeof(track_data);
+    }
+}
+
+// append the histograms in q_histo, cut off after the lowest segmax diffs, to the partial track.
+// that is all estimate_q() looks at, hence merging partials gives the same q as a single pass.
+
+static void emit_partial(AnnotateContext* ctx, int a, int ntiles)
+{
+    uint32 segmax = ctx->segmax;
+    uint32* q_histo = ctx->q_histo;
+    int twidth = ctx->twidth;
+
+    uint64 need = 2 + (uint64)ntiles * (1 + MIN(segmax, (uint32)twidth));
+
+    if (ctx->p_dcur + need >= ctx->p_dmax)
+    {
+        ctx->p_dmax = ctx->p_dmax * 1.2 + need;
+        ctx->p_data = realloc(ctx->p_data, sizeof(track_data) * ctx->p_dmax);
+    }
+
+    track_data* data = ctx->p_data;
+    uint64 dcur = ctx->p_dcur;
+
+    data[ dcur++ ] = twidth;
+    data[ dcur++ ] = segmax;
+
+    int i;
+    for (i = 0; i < ntiles; i++)
+    {
+        uint32* tile_qhisto = q_histo + twidth * i;
+        uint32 count = 0;
+        uint64 dn = dcur++;
+
+        data[ dn ] = 0;
+
+        int q;
+        for ( q = 0 ; q < twidth && count != segmax ; q++ )
+        {
+            uint32 has = MIN(tile_qhisto[q], segmax - count);
+
+            if (has)
+            {
+                data[ dcur++ ] = (q << PART_Q_SHIFT) | has;
+                data[ dn ] += 1;
+                count += has;
+            }
+        }
+    }
+
+    ctx->p_anno[ a ] += (dcur - ctx->p_dcur) * sizeof(track_data);
+    ctx->p_dcur = dcur;
+}
+
+// count the diffs of the segments covering whole tiles into the tiles' histograms.
+// diffs beyond the last bin are counted there.
+
+#define COUNT_SEGMENTS( type )                                              \
+    {                                                                       \
+        type* trace = ovl->path.trace;                                      \
+        int t;                                                              \
+                                                                            \
+        if ( (abpos % twidth) == 0 )                                        \
+        {                                                                   \
+            histo[ MIN( trace[0], qlast ) ] += 1;                           \
+        }                                                                   \
+                                                                            \
+        histo += twidth;                                                    \
+                                                                            \
+        for (t = 2; t < tlen - 2; t += 2)                                   \
+        {                                                                   \
+            histo[ MIN( trace[t], qlast ) ] += 1;                           \
+            histo += twidth;                                                \
+        }                                                                   \
+                                                                            \
+        if ( t < tlen && ( (aepos % twidth) == 0 || aepos == alen ) )       \
+        {                                                                   \
+            histo[ MIN( trace[t], qlast ) ] += 1;                           \
+        }                                                                   \
+    }
+
+static int handler_annotate(void* _ctx, Overlap* ovls, int novl)
+{
+    AnnotateContext* ctx = (AnnotateContext*)_ctx;
 
     int a           = ovls->aread;
     int alen        = DB_READ_LEN( ctx->db, a );
     int ntiles      = ( alen + ctx->twidth - 1 ) / ctx->twidth;
     uint32* q_histo = ctx->q_histo;
     int twidth      = ctx->twidth;
+    int qlast       = twidth - 1;
+    size_t tbytes   = ctx->tbytes;
+
+    // only the tiles of this read are used
 
-    bzero(q_histo, ctx->q_histo_len * sizeof(uint32));
+    bzero(q_histo, sizeof(uint32) * twidth * ntiles);
 
     int i;
     for (i = 0; i < novl; i++)
@@ -341,77 +526,89 @@ static int handler_annotate(void* _ctx, Overlap* ovls, int novl)
         int abpos = ovl->path.abpos;
         int aepos = ovl->path.aepos;
         int tlen  = ovl->path.tlen;
-        int comp  = ( ovl->flags & OVL_COMP ) ? 1 : 0;
 
-        int tile = abpos / twidth;
-        ovl_trace* trace = ovl->path.trace;
+        uint32* histo = q_histo + twidth * (abpos / twidth);
 
-        if ( (abpos % twidth) == 0 )
+        if ( tbytes == sizeof(uint8) )
         {
-            int q = trace[0];
-            q_histo[ twidth * 2 * tile + 2 * q + comp] += 1;
+            COUNT_SEGMENTS( uint8 );
         }
-
-        tile++;
-
-        int t;
-        for (t = 2; t < tlen - 2; t += 2)
-        {
-            int q = trace[t];
-            q_histo[ twidth * 2 * tile + 2 * q + comp] += 1;
-
-            tile += 1;
-        }
-
-        if ( (aepos % twidth) == 0 || aepos == alen )
+        else
         {
-            int q = trace[t];
-            q_histo[ twidth * 2 * tile + 2 * q + comp] += 1;
+            COUNT_SEGMENTS( uint16 );
         }
     }
 
-    // estimate mean q
+    estimate_q(ctx, a, ntiles);
 
-    if (ctx->q_dcur + ntiles >= ctx->q_dmax)
+    if (ctx->track_part_out)
     {
-        ctx->q_dmax = ctx->q_dmax * 1.2 + ntiles;
-        ctx->q_data = realloc(ctx->q_data, sizeof(track_data) * ctx->q_dmax);
+        emit_partial(ctx, a, ntiles);
     }
 
-    for (i = 0; i < ntiles; i++)
+    return 1;
+}
+
+#undef COUNT_SEGMENTS
+
+// per thread state for pass_parallel(), q_anno/trim_anno are shared since
+// the threads work on disjoint A-read ranges
+
+static void* annotate_thread_init(void* _ctx, int thread)
+{
+    UNUSED(thread);
+
+    AnnotateContext* ctx = (AnnotateContext*)_ctx;
+    AnnotateContext* tctx = malloc(sizeof(AnnotateContext));
+
+    memcpy(tctx, ctx, sizeof(AnnotateContext));
+
+    tctx->q_dcur = tctx->q_dprev = 0;
+    tctx->q_data = (track_data*)malloc(sizeof(track_data)*tctx->q_dmax);
+    tctx->q_histo = malloc( sizeof(uint32) * tctx->q_histo_len );
+
+    if (tctx->track_part_out)
     {
-        uint32* tile_qhisto = q_histo + 2 * twidth * i;
-        uint32 sum = 0;
-        uint32 count = 0;
+        tctx->p_dcur = 0;
+        tctx->p_data = (track_data*)malloc(sizeof(track_data)*tctx->p_dmax);
+    }
 
-        int q;
+    return tctx;
+}
 
-        for ( q = 0 ; q < twidth && count != segmax ; q++ )
-        {
-            uint32 has = MIN(tile_qhisto[2 * q] + tile_qhisto[2 * q + 1], segmax - count);
-            count += has;
-            sum += has * q;
-        }
+static void annotate_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
 
-        if (count < segmin)
+    AnnotateContext* ctx = (AnnotateContext*)_ctx;
+    AnnotateContext* tctx = (AnnotateContext*)_tctx;
+
+    if (ctx->q_dcur + tctx->q_dcur >= ctx->q_dmax)
+    {
+        ctx->q_dmax = ctx->q_dcur + tctx->q_dcur + 1;
+        ctx->q_data = realloc(ctx->q_data, sizeof(track_data) * ctx->q_dmax);
+    }
+
+    memcpy(ctx->q_data + ctx->q_dcur, tctx->q_data, sizeof(track_data) * tctx->q_dcur);
+    ctx->q_dcur += tctx->q_dcur;
+
+    if (ctx->track_part_out)
+    {
+        if (ctx->p_dcur + tctx->p_dcur >= ctx->p_dmax)
         {
-            q = 0;
+            ctx->p_dmax = ctx->p_dcur + tctx->p_dcur + 1;
+            ctx->p_data = realloc(ctx->p_data, sizeof(track_data) * ctx->p_dmax);
         }
-        else
-        {
-            if (sum == 0)
-            {
-                sum = count;
-            }
 
-            q = (int)( ((float)sum)/count + 0.5 );
-        }
+        memcpy(ctx->p_data + ctx->p_dcur, tctx->p_data, sizeof(track_data) * tctx->p_dcur);
+        ctx->p_dcur += tctx->p_dcur;
 
-        ctx->q_data[ ctx->q_dcur++ ] = q;
-        ctx->q_anno[ a ] += 1 * sizeof(track_data);
+        free(tctx->p_data);
     }
 
-    return 1;
+    free(tctx->q_data);
+    free(tctx->q_histo);
+    free(tctx);
 }
 
 static void pre_update_anno(PassContext* pctx, AnnotateContext* actx)
@@ -420,7 +617,7 @@ static void pre_update_anno(PassContext* pctx, AnnotateContext* actx)
     printf(ANSI_COLOR_GREEN "PASS update quality estimate and trimming" ANSI_COLOR_RESET "\n");
 #endif
 
-    actx->q_track = track_load(actx->db, actx->track_q_in);
+    actx->q_track = track_cache_get(actx->tracks, actx->track_q_in);
 
     if (!actx->q_track)
     {
@@ -428,7 +625,7 @@ static void pre_update_anno(PassContext* pctx, AnnotateContext* actx)
         exit(1);
     }
 
-    actx->trim_track = track_load(actx->db, actx->track_trim_in);
+    actx->trim_track = track_cache_get(actx->tracks, actx->track_trim_in);
 
     if (!actx->trim_track)
     {
@@ -550,9 +747,39 @@ static int handler_update_anno(void* _ctx, Overlap* ovls, int novl)
     return 1;
 }
 
+static void* update_anno_thread_init(void* _ctx, int thread)
+{
+    UNUSED(thread);
+
+    AnnotateContext* actx = (AnnotateContext*)_ctx;
+    AnnotateContext* tctx = malloc(sizeof(AnnotateContext));
+
+    memcpy(tctx, actx, sizeof(AnnotateContext));
+
+    tctx->trim_data = (track_data*)malloc( ((track_anno*)actx->trim_track->anno)[ DB_NREADS(actx->db) ] );
+    tctx->tcur = 0;
+
+    return tctx;
+}
+
+static void update_anno_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
+
+    AnnotateContext* actx = (AnnotateContext*)_ctx;
+    AnnotateContext* tctx = (AnnotateContext*)_tctx;
+
+    memcpy(actx->trim_data + actx->tcur, tctx->trim_data, sizeof(track_data) * tctx->tcur);
+    actx->tcur += tctx->tcur;
+
+    free(tctx->trim_data);
+    free(tctx);
+}
+
 static void usage()
 {
-    fprintf( stderr, "usage: [-u] [-b n] [-d n] [-s n] [-S n] [-t track] [-T track] [-q track] [-Q track] database input.las\n\n" );
+    fprintf( stderr, "usage: [-u] [-b n] [-d n] [-s n] [-S n] [-t track] [-T track] [-q track] [-Q track] [-P track] database input.las\n" );
+    fprintf( stderr, "       -m [-b n] [-d n] [-s n] [-S n] [-T track] [-Q track] [-P track] database partial.track ...\n\n" );
 
     fprintf( stderr, "Creates an annotation track containing the reads' qualities and computes trim information.\n\n" );
 
@@ -565,88 +792,98 @@ static void usage()
     fprintf( stderr, "         -o n      minimum overlap length after trim (default %d)\n", DEF_ARG_O );
 
     fprintf( stderr, "         -u        update existing trim track\n" );
+    fprintf( stderr, "         -j n      number of threads (default %d)\n", DEF_ARG_J );
 
     fprintf( stderr, "         -t track  input trim track in -u mode (default %s)\n", DEF_ARG_T );
     fprintf( stderr, "         -T track  output trim track (default %s)\n", DEF_ARG_T );
 
     fprintf( stderr, "         -q track  input quality track in -u mode (default %s)\n", DEF_ARG_Q );
     fprintf( stderr, "         -Q track  output quality track (default %s)\n", DEF_ARG_Q );
+
+    fprintf( stderr, "         -P track  also write a partial quality track, that can be merged with -m\n" );
+    fprintf( stderr, "         -m        merge partial quality tracks instead of a pass over a .las file\n" );
+    fprintf( stderr, "                   (eg. the ones of the daligner jobs of a block, only rerun jobs need a new partial)\n" );
 }
 
-int main(int argc, char* argv[])
+static void annotate_args(AnnotateContext* actx, int argc, char* argv[])
 {
-    HITS_DB db;
-    PassContext* pctx;
-    AnnotateContext actx;
-    FILE* fileOvlIn;
-
-    bzero(&actx, sizeof(AnnotateContext));
-    actx.db = &db;
-
-    // process arguments
-
-    int arg_u = DEF_ARG_U;
-    char* qlog = NULL;
+    actx->update = DEF_ARG_U;
+    actx->nthreads = DEF_ARG_J;
+    actx->qlog = NULL;
+
+    actx->tblock = DEF_ARG_B;
+    actx->min_trimmed_len = DEF_ARG_O;
+    actx->trim_q = DEF_ARG_D;
+    actx->segmin = DEF_ARG_S;
+    actx->segmax = DEF_ARG_SS;
+    actx->track_trim_in = NULL;
+    actx->track_trim_out = DEF_ARG_T;
+    actx->track_q_in = DEF_ARG_Q;
+    actx->track_q_out = DEF_ARG_Q;
+    actx->track_part_out = NULL;
+    actx->merge = 0;
 
     opterr = 0;
 
-    actx.tblock = DEF_ARG_B;
-    actx.min_trimmed_len = DEF_ARG_O;
-    actx.trim_q = DEF_ARG_D;
-    actx.segmin = DEF_ARG_S;
-    actx.segmax = DEF_ARG_SS;
-    actx.track_trim_in = NULL;
-    actx.track_trim_out = DEF_ARG_T;
-    actx.track_q_in = DEF_ARG_Q;
-    actx.track_q_out = DEF_ARG_Q;
-
     int c;
-    while ((c = getopt(argc, argv, "s:S:o:ub:d:L:t:T:q:Q:")) != -1)
+    while ((c = getopt(argc, argv, "s:S:o:umb:d:j:L:t:T:q:Q:P:")) != -1)
     {
         switch (c)
         {
             case 's':
-                      actx.segmin = atoi(optarg);
+                      actx->segmin = atoi(optarg);
                       break;
 
             case 'S':
-                      actx.segmax = atoi(optarg);
+                      actx->segmax = atoi(optarg);
                       break;
 
             case 'L':
-                      qlog = optarg;
+                      actx->qlog = optarg;
                       break;
 
             case 'd':
-                      actx.trim_q = atoi(optarg);
+                      actx->trim_q = atoi(optarg);
                       break;
 
             case 'o':
-                      actx.min_trimmed_len = atoi(optarg);
+                      actx->min_trimmed_len = atoi(optarg);
                       break;
 
             case 'u':
-                      arg_u = 1;
+                      actx->update = 1;
+                      break;
+
+            case 'm':
+                      actx->merge = 1;
+                      break;
+
+            case 'P':
+                      actx->track_part_out = optarg;
+                      break;
+
+            case 'j':
+                      actx->nthreads = atoi(optarg);
                       break;
 
             case 'b':
-                      actx.tblock = atoi(optarg);
+                      actx->tblock = atoi(optarg);
                       break;
 
             case 't':
-                      actx.track_trim_in = optarg;
+                      actx->track_trim_in = optarg;
                       break;
 
             case 'T':
-                      actx.track_trim_out = optarg;
+                      actx->track_trim_out = optarg;
                       break;
 
             case 'q':
-                      actx.track_q_in = optarg;
+                      actx->track_q_in = optarg;
                       break;
 
             case 'Q':
-                      actx.track_q_out = optarg;
+                      actx->track_q_out = optarg;
                       break;
 
             default:
@@ -655,41 +892,350 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (argc - optind != 2)
+    if (actx->trim_q == 0)
     {
-        usage();
+        fprintf(stderr, "error: -q not specified\n");
         exit(1);
     }
 
-    if (actx.trim_q == 0)
+    if (actx->nthreads < 1)
     {
-        fprintf(stderr, "error: -q not specified\n");
+        fprintf(stderr, "error: invalid -j\n");
         exit(1);
     }
 
-    if (actx.segmin < 1)
+    if (actx->segmin < 1)
     {
         fprintf(stderr, "error: invalid -s\n");
         exit(1);
     }
 
-    if (actx.segmin > actx.segmax)
+    if (actx->segmin > actx->segmax)
     {
         fprintf(stderr, "error: invalid -s -S combination\n");
         exit(1);
     }
 
-    if (actx.track_q_in == NULL && arg_u == 1)
+    if (actx->track_part_out && actx->segmax > PART_COUNT_MASK)
+    {
+        fprintf(stderr, "error: -S too large for -P\n");
+        exit(1);
+    }
+
+    if (actx->merge && actx->update)
+    {
+        fprintf(stderr, "error: -m and -u are mutually exclusive\n");
+        exit(1);
+    }
+
+    if (actx->track_q_in == NULL && actx->update == 1)
     {
         fprintf( stderr, "error: -u specified without -q\n" );
         exit( 1 );
     }
 
-    if (actx.track_trim_in == NULL && arg_u == 1)
+    if (actx->track_trim_in == NULL && actx->update == 1)
     {
         fprintf( stderr, "error: -u specified without -t\n" );
         exit( 1 );
     }
+}
+
+static void write_qlog(AnnotateContext* actx)
+{
+    if (actx->qlog == NULL)
+    {
+        return ;
+    }
+
+    FILE* fileq = fopen(actx->qlog, "w");
+
+    if (fileq)
+    {
+        fprintf(fileq, "%d\n", actx->trim_q);
+        fclose(fileq);
+    }
+    else
+    {
+        fprintf(stderr, "error: failed to open %s\n", actx->qlog);
+    }
+}
+
+// LAscrub stage
+
+static void stage_pre(PassContext* pctx, void* data)
+{
+    AnnotateContext* actx = (AnnotateContext*)data;
+
+    if (actx->update)
+    {
+        pre_update_anno(pctx, actx);
+    }
+    else
+    {
+        pre_annotate(pctx, actx);
+    }
+}
+
+static int stage_handler(void* data, Overlap* ovls, int novl)
+{
+    AnnotateContext* actx = (AnnotateContext*)data;
+
+    if (actx->update)
+    {
+        return handler_update_anno(actx, ovls, novl);
+    }
+
+    return handler_annotate(actx, ovls, novl);
+}
+
+static void stage_post(void* data)
+{
+    AnnotateContext* actx = (AnnotateContext*)data;
+
+    if (actx->update)
+    {
+        post_update_anno(actx);
+    }
+    else
+    {
+        post_annotate(actx);
+    }
+
+    write_qlog(actx);
+}
+
+static void stage_free(void* data)
+{
+    AnnotateContext* actx = (AnnotateContext*)data;
+
+    track_cache_free(actx->tracks);
+    free(actx);
+}
+
+void laq_stage(ScrubStage* stage, HITS_DB* db, int argc, char* argv[])
+{
+    AnnotateContext* actx = calloc(1, sizeof(AnnotateContext));
+
+    actx->db = db;
+
+    annotate_args(actx, argc, argv);
+
+    if (argc != optind || actx->merge)
+    {
+        usage();
+        exit(1);
+    }
+
+    actx->tracks = track_cache_new(db, 2);
+
+    bzero(stage, sizeof(ScrubStage));
+
+    stage->name = "LAq";
+    stage->data = actx;
+    stage->block = actx->tblock;
+    stage->load_trace = 1;
+    stage->unpack_trace = 0;
+
+    if (actx->update)
+    {
+        stage->tracks_in[ stage->ntracks_in++ ] = actx->track_q_in;
+        stage->tracks_in[ stage->ntracks_in++ ] = actx->track_trim_in;
+
+        stage->thread_init = update_anno_thread_init;
+        stage->thread_reduce = update_anno_thread_reduce;
+    }
+    else
+    {
+        stage->tracks_out[ stage->ntracks_out++ ] = actx->track_q_out;
+
+        if (actx->track_part_out)
+        {
+            stage->tracks_out[ stage->ntracks_out++ ] = actx->track_part_out;
+        }
+
+        stage->thread_init = annotate_thread_init;
+        stage->thread_reduce = annotate_thread_reduce;
+    }
+
+    stage->tracks_out[ stage->ntracks_out++ ] = actx->track_trim_out;
+
+    stage->pre = stage_pre;
+    stage->handler = stage_handler;
+    stage->post = stage_post;
+    stage->free = stage_free;
+}
+
+#ifndef LASCRUB
+
+// sum up the partial q tracks of the reads and estimate q and trim from those.
+// only reads present in at least one of the partials are annotated.
+
+static void merge_partials(AnnotateContext* ctx, HITS_TRACK** parts, int nparts)
+{
+#ifdef VERBOSE
+    printf(ANSI_COLOR_GREEN "MERGE %d partial quality estimates" ANSI_COLOR_RESET "\n", nparts);
+#endif
+
+    int nreads = DB_NREADS(ctx->db);
+    int a, i;
+
+    ctx->twidth = 0;
+
+    for (i = 0; i < nparts && ctx->twidth == 0; i++)
+    {
+        track_anno* anno = parts[i]->anno;
+        track_data* data = parts[i]->data;
+
+        for (a = 0; a < nreads; a++)
+        {
+            if (anno[a] < anno[a + 1])
+            {
+                ctx->twidth = data[ anno[a] / sizeof(track_data) ];
+                break;
+            }
+        }
+    }
+
+    if (ctx->twidth == 0)
+    {
+        fprintf(stderr, "error: partial q tracks are empty\n");
+        exit(1);
+    }
+
+    alloc_annotate(ctx);
+
+    int twidth = ctx->twidth;
+    uint32* q_histo = ctx->q_histo;
+
+    for (a = 0; a < nreads; a++)
+    {
+        int ntiles = ( DB_READ_LEN(ctx->db, a) + twidth - 1 ) / twidth;
+        int found = 0;
+
+        bzero(q_histo, sizeof(uint32) * twidth * ntiles);
+
+        for (i = 0; i < nparts; i++)
+        {
+            track_anno* anno = parts[i]->anno;
+            track_data* data = parts[i]->data;
+
+            track_anno ob = anno[a] / sizeof(track_data);
+            track_anno oe = anno[a + 1] / sizeof(track_data);
+
+            if (ob >= oe)
+            {
+                continue;
+            }
+
+            if (data[ob] != twidth)
+            {
+                fprintf(stderr, "error: partial q track %s has trace spacing %d instead of %d\n",
+                                parts[i]->name, data[ob], twidth);
+                exit(1);
+            }
+
+            if ((unsigned int)data[ob + 1] < ctx->segmax)
+            {
+                fprintf(stderr, "error: partial q track %s was created with -S %d, less than the -S %d requested\n",
+                                parts[i]->name, data[ob + 1], ctx->segmax);
+                exit(1);
+            }
+
+            ob += 2;
+
+            int tile;
+            for (tile = 0; tile < ntiles; tile++)
+            {
+                track_data n = data[ob++];
+
+                while (n--)
+                {
+                    track_data e = data[ob++];
+                    q_histo[ twidth * tile + (e >> PART_Q_SHIFT) ] += e & PART_COUNT_MASK;
+                }
+            }
+
+            assert( ob == oe );
+
+            found = 1;
+        }
+
+        if (!found)
+        {
+            continue;
+        }
+
+        estimate_q(ctx, a, ntiles);
+
+        if (ctx->track_part_out)
+        {
+            emit_partial(ctx, a, ntiles);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    HITS_DB db;
+    PassContext* pctx;
+    AnnotateContext actx;
+    FILE* fileOvlIn;
+
+    bzero(&actx, sizeof(AnnotateContext));
+    actx.db = &db;
+
+    // process arguments
+
+    annotate_args(&actx, argc, argv);
+
+    int nthreads = actx.nthreads;
+
+    if (actx.merge)
+    {
+        if (argc - optind < 2)
+        {
+            usage();
+            exit(1);
+        }
+
+        char* pcPathReadsIn = argv[optind++];
+
+        if (Open_DB(pcPathReadsIn, &db))
+        {
+            fprintf(stderr, "failed to open %s\n", pcPathReadsIn);
+            exit(1);
+        }
+
+        int nparts = argc - optind;
+        HITS_TRACK** parts = malloc(sizeof(HITS_TRACK*) * nparts);
+        int i;
+
+        for (i = 0; i < nparts; i++)
+        {
+            if ( !(parts[i] = track_load(&db, argv[optind + i])) )
+            {
+                fprintf(stderr, "could not load track %s\n", argv[optind + i]);
+                exit(1);
+            }
+        }
+
+        merge_partials(&actx, parts, nparts);
+        post_annotate(&actx);
+
+        write_qlog(&actx);
+
+        free(parts);
+        Close_DB(&db);
+
+        return 0;
+    }
+
+    if (argc - optind != 2)
+    {
+        usage();
+        exit(1);
+    }
 
     char* pcPathReadsIn = argv[optind++];
     char* pcPathOverlaps = argv[optind++];
@@ -708,53 +1254,59 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    actx.tracks = track_cache_new(&db, 2);
+
     pctx = pass_init(fileOvlIn, NULL);
 
     pctx->split_b = 0;
     pctx->data = &actx;
 
     pctx->load_trace = 1;
-    pctx->unpack_trace = 1;
+    pctx->unpack_trace = 0;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if (nthreads > 1 && !pctx->is_laz)
+    {
+        pctx->index = lasidx_load(&db, pcPathOverlaps, 0);
+    }
 
     // passes
 
     // update existing trim track
-    if (arg_u)
+    if (actx.update)
     {
+        pctx->thread_init = update_anno_thread_init;
+        pctx->thread_reduce = update_anno_thread_reduce;
+
         pre_update_anno(pctx, &actx);
-        pass(pctx, handler_update_anno);
+        pass_parallel(pctx, handler_update_anno, nthreads);
         post_update_anno(&actx);
     }
     else
     {
+        pctx->thread_init = annotate_thread_init;
+        pctx->thread_reduce = annotate_thread_reduce;
+
         pre_annotate(pctx, &actx);
-        pass(pctx, handler_annotate);
+        pass_parallel(pctx, handler_annotate, nthreads);
         post_annotate(&actx);
     }
 
-    if (qlog != NULL)
-    {
-        FILE* fileq = fopen(qlog, "w");
-
-        if (fileq)
-        {
-            fprintf(fileq, "%d\n", actx.trim_q);
-            fclose(fileq);
-        }
-        else
-        {
-            fprintf(stderr, "error: failed to open %s\n", qlog);
-        }
-
-    }
+    write_qlog(&actx);
 
     // cleanup
 
+    lasidx_close(pctx->index);
     pass_free(pctx);
 
     fclose(fileOvlIn);
 
+    track_cache_free(actx.tracks);
+
     Close_DB(&db);
 
     return 0;
 }
+
+#endif
@@ -29,6 +29,8 @@
 #include "dalign/align.h"
 #include "db/DB.h"
 
+#include "scrub/stage.h"
+
 // constants
 
 #define BINSIZE_COVERAGE 100
@@ -51,6 +53,7 @@
 
 #define DEF_ARG_R 0
 #define DEF_ARG_RR 0
+#define DEF_ARG_J 1
 
 // toggles
 
@@ -94,6 +97,7 @@ typedef struct
     track_data* rp_data;
     track_anno* rp_anno;
     int* rp_events;
+    int* rp_buckets; // sort_coverage_events()
 
     int rp_merge_dist;
 
@@ -107,26 +111,13 @@ typedef struct
     double rp_xcov_enter;
     double rp_xcov_leave;
 
+    int nthreads;
+
 } RepeatContext;
 
 extern char* optarg;
 extern int optind, opterr, optopt;
 
-static int cmp_repeats_events( const void* x, const void* y )
-{
-    int* e1 = (int*)x;
-    int* e2 = (int*)y;
-
-    int cmp = abs( *e1 ) - abs( *e2 );
-
-    if ( cmp == 0 )
-    {
-        cmp = ( *e1 ) - ( *e2 );
-    }
-
-    return cmp;
-}
-
 static void pre_coverage( RepeatContext* ctx )
 {
 #ifdef VERBOSE
@@ -280,6 +271,7 @@ static void pre_repeats( RepeatContext* ctx )
 
     ctx->rp_emax   = 100;
     ctx->rp_events = (int*)malloc( sizeof( int ) * ctx->rp_emax );
+    ctx->rp_buckets = (int*)calloc( 2 * DB_READ_MAXLEN( ctx->db ) + 2, sizeof( int ) );
     ctx->rp_anno   = (track_anno*)malloc( sizeof( track_anno ) * ( DB_NREADS( ctx->db ) + 1 ) );
     bzero( ctx->rp_anno, sizeof( track_anno ) * ( DB_NREADS( ctx->db ) + 1 ) );
 
@@ -307,6 +299,7 @@ static void post_repeats( RepeatContext* ctx )
     free( ctx->rp_anno );
     free( ctx->rp_data );
     free( ctx->rp_events );
+    free( ctx->rp_buckets );
 
 #ifdef VERBOSE
     printf( "COV_ENTER %.1f\n", ctx->rp_xcov_enter );
@@ -370,7 +363,7 @@ static int handler_repeats( void* _ctx, Overlap* ovl, int novl )
 
     novl = j / 2;
 
-    qsort( rp_events, 2 * novl, sizeof( int ), cmp_repeats_events );
+    sort_coverage_events( rp_events, 2 * novl, ctx->rp_buckets );
 
     int span            = 0;
     int span_leave      = ctx->cov * ctx->rp_xcov_leave;
@@ -563,9 +556,60 @@ static int handler_repeats( void* _ctx, Overlap* ovl, int novl )
     return 1;
 }
 
+// per thread state for pass_parallel(), rp_anno is shared since the threads
+// work on disjoint A-read ranges
+
+static void* repeats_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    RepeatContext* ctx  = (RepeatContext*)_ctx;
+    RepeatContext* tctx = malloc( sizeof( RepeatContext ) );
+
+    memcpy( tctx, ctx, sizeof( RepeatContext ) );
+
+    tctx->rp_events  = (int*)malloc( sizeof( int ) * tctx->rp_emax );
+    tctx->rp_buckets = (int*)calloc( 2 * DB_READ_MAXLEN( ctx->db ) + 2, sizeof( int ) );
+
+    tctx->rp_dcur = 0;
+    tctx->rp_data = (track_data*)malloc( sizeof( track_data ) * tctx->rp_dmax );
+
+    tctx->rp_bases        = 0;
+    tctx->rp_repeat_bases = 0;
+    tctx->rp_merged       = 0;
+
+    return tctx;
+}
+
+static void repeats_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( thread );
+
+    RepeatContext* ctx  = (RepeatContext*)_ctx;
+    RepeatContext* tctx = (RepeatContext*)_tctx;
+
+    if ( ctx->rp_dcur + tctx->rp_dcur >= ctx->rp_dmax )
+    {
+        ctx->rp_dmax = ctx->rp_dcur + tctx->rp_dcur + 1;
+        ctx->rp_data = (track_data*)realloc( ctx->rp_data, sizeof( track_data ) * ctx->rp_dmax );
+    }
+
+    memcpy( ctx->rp_data + ctx->rp_dcur, tctx->rp_data, sizeof( track_data ) * tctx->rp_dcur );
+    ctx->rp_dcur += tctx->rp_dcur;
+
+    ctx->rp_bases += tctx->rp_bases;
+    ctx->rp_repeat_bases += tctx->rp_repeat_bases;
+    ctx->rp_merged += tctx->rp_merged;
+
+    free( tctx->rp_events );
+    free( tctx->rp_buckets );
+    free( tctx->rp_data );
+    free( tctx );
+}
+
 static void usage()
 {
-    printf( "usage: [-hl f] [-t track] [-bcmnorR n] database input.las\n\n" );
+    printf( "usage: [-hl f] [-t track] [-bcjmnorR n] database input.las\n\n" );
 
     printf( "Detects repeat elements based on coverage anomalies in reads and creates an annotation track with them.\n\n" );
 
@@ -585,87 +629,84 @@ static void usage()
 
     printf( "         -r n  minimum repeat length (%d)\n", DEF_ARG_R );
     printf( "         -R n  maximum repeat length (%d)\n", DEF_ARG_RR );
+
+    printf( "         -j n  number of threads, used for the repeat pass (%d)\n", DEF_ARG_J );
 }
 
-int main( int argc, char* argv[] )
+static void repeats_args( RepeatContext* ctx, int argc, char* argv[] )
 {
-    HITS_DB db;
-    PassContext* pctx;
-    RepeatContext rctx;
-    FILE* fileOvlIn;
-
-    bzero( &rctx, sizeof( RepeatContext ) );
-    rctx.db = &db;
-
-    // process arguments
-
-    rctx.rp_xcov_enter  = DEFAULT_RP_XCOV_ENTER;
-    rctx.rp_xcov_leave  = DEFAULT_RP_XCOV_LEAVE;
-    rctx.rp_merge_dist  = DEFAULT_RP_MERGE_DIST;
-    rctx.cov            = DEFAULT_COV;
-    rctx.cov_max_areads = DEFAULT_COV_MAX_READS;
-    rctx.rp_track       = TRACK_REPEATS;
-    rctx.rp_block       = 0;
-    rctx.inccov         = DEF_ARG_IC;
-    rctx.min_aln_len    = DEF_ARG_O;
-    rctx.min_rlen       = DEF_ARG_LL;
-    rctx.min_repeat_len = DEF_ARG_R;
-    rctx.max_repeat_len = DEF_ARG_RR;
+    ctx->rp_xcov_enter  = DEFAULT_RP_XCOV_ENTER;
+    ctx->rp_xcov_leave  = DEFAULT_RP_XCOV_LEAVE;
+    ctx->rp_merge_dist  = DEFAULT_RP_MERGE_DIST;
+    ctx->cov            = DEFAULT_COV;
+    ctx->cov_max_areads = DEFAULT_COV_MAX_READS;
+    ctx->rp_track       = TRACK_REPEATS;
+    ctx->rp_block       = 0;
+    ctx->inccov         = DEF_ARG_IC;
+    ctx->min_aln_len    = DEF_ARG_O;
+    ctx->min_rlen       = DEF_ARG_LL;
+    ctx->min_repeat_len = DEF_ARG_R;
+    ctx->max_repeat_len = DEF_ARG_RR;
+    ctx->nthreads       = DEF_ARG_J;
 
     int c;
 
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "Ch:l:L:m:c:n:t:b:o:r:R:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "Ch:l:L:m:c:n:t:b:o:r:R:j:" ) ) != -1 )
     {
         switch ( c )
         {
             case 'r':
-                rctx.min_repeat_len = atoi( optarg );
+                ctx->min_repeat_len = atoi( optarg );
                 break;
 
             case 'R':
-                rctx.max_repeat_len = atoi( optarg );
+                ctx->max_repeat_len = atoi( optarg );
                 break;
 
             case 'L':
-                rctx.min_rlen = atoi( optarg );
+                ctx->min_rlen = atoi( optarg );
+                break;
+
+            case 'j':
+                ctx->nthreads = atoi( optarg );
                 break;
 
             case 'o':
-                rctx.min_aln_len = atoi( optarg );
+                ctx->min_aln_len = atoi( optarg );
                 break;
 
             case 'C':
-                rctx.inccov = 1;
+                ctx->inccov = 1;
                 break;
 
             case 'b':
-                rctx.rp_block = atoi( optarg );
+                ctx->rp_block = atoi( optarg );
                 break;
 
             case 'h':
-                rctx.rp_xcov_enter = atof( optarg );
+                ctx->rp_xcov_enter = atof( optarg );
                 break;
 
             case 'l':
-                rctx.rp_xcov_leave = atof( optarg );
+                ctx->rp_xcov_leave = atof( optarg );
                 break;
 
             case 'm':
-                rctx.rp_merge_dist = atoi( optarg );
+                ctx->rp_merge_dist = atoi( optarg );
                 break;
 
             case 'c':
-                rctx.cov = atoi( optarg );
+                ctx->cov = atoi( optarg );
                 break;
 
             case 'n':
-                rctx.cov_max_areads = atoi( optarg );
+                ctx->cov_max_areads = atoi( optarg );
                 break;
 
             case 't':
-                rctx.rp_track = optarg;
+                ctx->rp_track = optarg;
                 break;
 
             default:
@@ -674,26 +715,128 @@ int main( int argc, char* argv[] )
         }
     }
 
-    if ( argc - optind != 2 )
+    if ( ctx->rp_xcov_enter < ctx->rp_xcov_leave )
     {
-        usage();
+        fprintf( stderr, "invalid arguments: low %.2f > high %.2f\n", ctx->rp_xcov_leave, ctx->rp_xcov_enter );
         exit( 1 );
     }
 
-    char* pcPathReadsIn  = argv[ optind++ ];
-    char* pcPathOverlaps = argv[ optind++ ];
-
-    if ( rctx.rp_xcov_enter < rctx.rp_xcov_leave )
+    if ( ctx->nthreads < 1 )
     {
-        fprintf( stderr, "invalid arguments: low %.2f > high %.2f\n", rctx.rp_xcov_leave, rctx.rp_xcov_enter );
+        fprintf( stderr, "invalid arguments: number of threads %d\n", ctx->nthreads );
         exit( 1 );
     }
 
-    if ( rctx.cov_max_areads != -1 && rctx.cov_max_areads < MIN_OVERLAP_GROUPS )
+    if ( ctx->cov_max_areads != -1 && ctx->cov_max_areads < MIN_OVERLAP_GROUPS )
     {
         fprintf( stderr, "invalid arguments: number of overlap groups tested should be larger than %d\n", MIN_OVERLAP_GROUPS );
         exit( 1 );
     }
+}
+
+// LAscrub stage
+
+static void stage_prepare_pre( PassContext* pctx, void* data )
+{
+    UNUSED( pctx );
+
+    pre_coverage( (RepeatContext*)data );
+}
+
+static void stage_prepare_post( void* data )
+{
+    RepeatContext* ctx = (RepeatContext*)data;
+
+    post_coverage( ctx );
+
+    if ( ctx->cov <= 0 )
+    {
+        fprintf( stderr, "ERROR: coverage estimation resulted in %d\n", ctx->cov );
+        fprintf( stderr, "       bypass estimation using the -c <coverage> argument\n" );
+
+        exit( 1 );
+    }
+}
+
+static void stage_pre( PassContext* pctx, void* data )
+{
+    UNUSED( pctx );
+
+    pre_repeats( (RepeatContext*)data );
+}
+
+static void stage_post( void* data )
+{
+    post_repeats( (RepeatContext*)data );
+}
+
+void larepeat_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] )
+{
+    RepeatContext* ctx = calloc( 1, sizeof( RepeatContext ) );
+
+    ctx->db = db;
+
+    repeats_args( ctx, argc, argv );
+
+    if ( argc != optind )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    if ( ctx->cov_max_areads == -1 )
+    {
+        ctx->cov_max_areads = db->nreads;
+    }
+
+    bzero( stage, sizeof( ScrubStage ) );
+
+    stage->name  = "LArepeat";
+    stage->data  = ctx;
+    stage->block = ctx->rp_block;
+
+    stage->tracks_out[ stage->ntracks_out++ ] = ctx->rp_track;
+
+    if ( ctx->cov <= 0 )
+    {
+        stage->prepare_pre  = stage_prepare_pre;
+        stage->prepare      = handler_coverage;
+        stage->prepare_post = stage_prepare_post;
+    }
+
+    stage->pre     = stage_pre;
+    stage->handler = handler_repeats;
+    stage->post    = stage_post;
+    stage->free    = free;
+
+    stage->thread_init   = repeats_thread_init;
+    stage->thread_reduce = repeats_thread_reduce;
+}
+
+#ifndef LASCRUB
+
+int main( int argc, char* argv[] )
+{
+    HITS_DB db;
+    PassContext* pctx;
+    RepeatContext rctx;
+    FILE* fileOvlIn;
+
+    bzero( &rctx, sizeof( RepeatContext ) );
+    rctx.db = &db;
+
+    // process arguments
+
+    repeats_args( &rctx, argc, argv );
+
+    if ( argc - optind != 2 )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    char* pcPathReadsIn  = argv[ optind++ ];
+    char* pcPathOverlaps = argv[ optind++ ];
 
     if ( ( fileOvlIn = fopen( pcPathOverlaps, "r" ) ) == NULL )
     {
@@ -734,12 +877,23 @@ int main( int argc, char* argv[] )
         }
     }
 
+    // balance the threads using the index, if there is an up to date one
+
+    if ( rctx.nthreads > 1 && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load( &db, pcPathOverlaps, 0 );
+    }
+
+    pctx->thread_init   = repeats_thread_init;
+    pctx->thread_reduce = repeats_thread_reduce;
+
     pre_repeats( &rctx );
-    pass( pctx, handler_repeats );
+    pass_parallel( pctx, handler_repeats, rctx.nthreads );
     post_repeats( &rctx );
 
     // cleanup
 
+    lasidx_close( pctx->index );
     pass_free( pctx );
 
     fclose( fileOvlIn );
@@ -748,3 +902,5 @@ int main( int argc, char* argv[] )
 
     return 0;
 }
+
+#endif
@@ -0,0 +1,665 @@
+/*******************************************************************************************
+ *
+ *  runs a chain of scrubbing tools over the A-read piles of a single pass
+ *
+ *  each stage is given as a tool with its usual options, eg.
+ *
+ *      LAscrub -s "LAq -s 5 -T trim0" -s "LArepeat -c 25" -s "LAgap -t trim0"
+ *              -s "LAq -s 5 -u -t trim0 -T trim1" -s "LAfilter -n 300 -t trim1 -T -o 2000 -u 0"
+ *              DB DB.las DB.filtered.las
+ *
+ *  a stage that needs a track produced by an earlier stage starts a new phase,
+ *  a new pass over the input. the piles are changed by the filter stages in
+ *  memory only, hence filters of earlier phases are replayed by the following
+ *  ones. only the output of the last phase is written.
+ *
+ *  Author  :  MARVEL Team
+ *
+ *******************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/oflags.h"
+#include "lib/colors.h"
+#include "lib/pass.h"
+#include "lib/tracks.h"
+#include "lib/utils.h"
+
+#include "db/DB.h"
+#include "dalign/align.h"
+
+#include "scrub/stage.h"
+
+// command line defaults
+
+#define DEF_ARG_J       1
+
+// constants
+
+#define MAX_STAGES      16
+#define MAX_STAGE_ARGS  64
+
+// switches
+
+#define VERBOSE
+
+typedef struct
+{
+    char* name;
+    void ( *init )( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] );
+} StageTool;
+
+static StageTool Tools[] =
+{
+    { "LAq", laq_stage },
+    { "LArepeat", larepeat_stage },
+    { "LAgap", lagap_stage },
+    { "LAfilter", lafilter_stage },
+    { NULL, NULL }
+};
+
+typedef struct
+{
+    PassContext* pctx;
+
+    ScrubStage* chain[ MAX_STAGES ];
+    void* data[ MAX_STAGES ];       // of the stages, per thread in pass_parallel()
+    int nchain;
+
+    int prepare[ MAX_STAGES ];      // prepare handler still wants piles
+
+    Overlap* purged;                // set aside while purging a pile
+    int maxpurged;
+} ScrubContext;
+
+// for getopt()
+
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+// move the discarded overlaps behind the others, keeping their order
+
+static int purge_pile( ScrubContext* ctx, Overlap* ovls, int novl )
+{
+    if ( novl > ctx->maxpurged )
+    {
+        ctx->maxpurged = novl * 1.2 + 100;
+        ctx->purged    = realloc( ctx->purged, sizeof( Overlap ) * ctx->maxpurged );
+    }
+
+    int i;
+    int nkeep   = 0;
+    int npurged = 0;
+
+    for ( i = 0; i < novl; i++ )
+    {
+        if ( ovls[ i ].flags & OVL_DISCARD )
+        {
+            ctx->purged[ npurged++ ] = ovls[ i ];
+        }
+        else
+        {
+            ovls[ nkeep++ ] = ovls[ i ];
+        }
+    }
+
+    memcpy( ovls + nkeep, ctx->purged, sizeof( Overlap ) * npurged );
+
+    return nkeep;
+}
+
+static int prepare_handler( void* _ctx, Overlap* ovls, int novl )
+{
+    ScrubContext* ctx = (ScrubContext*)_ctx;
+    int cont          = 0;
+
+    int i;
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ScrubStage* stage = ctx->chain[ i ];
+
+        if ( ctx->prepare[ i ] )
+        {
+            ctx->prepare[ i ] = stage->prepare( ctx->data[ i ], ovls, novl );
+            cont |= ctx->prepare[ i ];
+        }
+    }
+
+    return cont;
+}
+
+static int scrub_handler( void* _ctx, Overlap* ovls, int novl )
+{
+    ScrubContext* ctx = (ScrubContext*)_ctx;
+    int cont          = 1;
+    int n             = novl;
+
+    int i;
+    for ( i = 0; i < ctx->nchain && n > 0; i++ )
+    {
+        ScrubStage* stage = ctx->chain[ i ];
+
+        cont &= stage->handler( ctx->data[ i ], ovls, n );
+
+        if ( stage->purge )
+        {
+            n = purge_pile( ctx, ovls, n );
+        }
+    }
+
+    // stages that purge don't run in parallel, hence there is a pctx
+
+    if ( n < novl )
+    {
+        ctx->pctx->npile = n;
+    }
+
+    return cont;
+}
+
+static void* scrub_thread_init( void* _ctx, int thread )
+{
+    ScrubContext* ctx  = (ScrubContext*)_ctx;
+    ScrubContext* tctx = calloc( 1, sizeof( ScrubContext ) );
+
+    tctx->nchain = ctx->nchain;
+
+    int i;
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        tctx->chain[ i ] = ctx->chain[ i ];
+        tctx->data[ i ]  = ctx->chain[ i ]->thread_init( ctx->data[ i ], thread );
+    }
+
+    return tctx;
+}
+
+static void scrub_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    ScrubContext* ctx  = (ScrubContext*)_ctx;
+    ScrubContext* tctx = (ScrubContext*)_tctx;
+
+    int i;
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ctx->chain[ i ]->thread_reduce( ctx->data[ i ], tctx->data[ i ], thread );
+    }
+
+    free( tctx->purged );
+    free( tctx );
+}
+
+static void run_phase( ScrubContext* ctx, FILE* fileOvlIn, FILE* fileOvlOut, lasidx* index, int nthreads )
+{
+    PassContext* pctx;
+    int i;
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ctx->data[ i ] = ctx->chain[ i ]->data;
+    }
+
+    // extra pass for the stages' prepare handlers
+
+    int nprepare = 0;
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ctx->prepare[ i ] = ( ctx->chain[ i ]->prepare != NULL );
+        nprepare += ctx->prepare[ i ];
+    }
+
+    if ( nprepare )
+    {
+        pctx = pass_init( fileOvlIn, NULL );
+
+        pctx->split_b    = 0;
+        pctx->load_trace = 0;
+        pctx->data       = ctx;
+
+        for ( i = 0; i < ctx->nchain; i++ )
+        {
+            if ( ctx->prepare[ i ] )
+            {
+                ctx->chain[ i ]->prepare_pre( pctx, ctx->chain[ i ]->data );
+            }
+        }
+
+        pass( pctx, prepare_handler );
+
+        for ( i = 0; i < ctx->nchain; i++ )
+        {
+            if ( ctx->chain[ i ]->prepare )
+            {
+                ctx->chain[ i ]->prepare_post( ctx->chain[ i ]->data );
+            }
+        }
+
+        pass_free( pctx );
+    }
+
+    // the pass running the chain
+
+    pctx = pass_init( fileOvlIn, fileOvlOut );
+
+    pctx->split_b         = 0;
+    pctx->load_trace      = 0;
+    pctx->unpack_trace    = 0;
+    pctx->purge_discarded = 0;
+    pctx->data            = ctx;
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        pctx->load_trace |= ctx->chain[ i ]->load_trace;
+        pctx->unpack_trace |= ctx->chain[ i ]->unpack_trace;
+    }
+
+    ctx->pctx = pctx;
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ctx->chain[ i ]->pre( pctx, ctx->chain[ i ]->data );
+    }
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        if ( ctx->chain[ i ]->thread_init == NULL )
+        {
+            nthreads = 1;
+        }
+    }
+
+    if ( nthreads > 1 )
+    {
+        pctx->thread_init   = scrub_thread_init;
+        pctx->thread_reduce = scrub_thread_reduce;
+        pctx->index         = index;
+
+        pass_parallel( pctx, scrub_handler, nthreads );
+    }
+    else
+    {
+        pass( pctx, scrub_handler );
+    }
+
+    for ( i = 0; i < ctx->nchain; i++ )
+    {
+        ctx->chain[ i ]->post( ctx->chain[ i ]->data );
+    }
+
+    pass_free( pctx );
+}
+
+static int has_track( char** tracks, int ntracks, char* track )
+{
+    int i;
+    for ( i = 0; i < ntracks; i++ )
+    {
+        if ( strcmp( tracks[ i ], track ) == 0 )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// assign the stages to phases, returns the number of phases
+
+static int plan_phases( ScrubStage* stages, int nstages, int* phase )
+{
+    char* written[ MAX_STAGES * STAGE_MAX_TRACKS ];
+    int nwritten = 0;
+    int nphases  = 1;
+
+    int i, j;
+    for ( i = 0; i < nstages; i++ )
+    {
+        ScrubStage* stage = stages + i;
+
+        for ( j = 0; j < stage->ntracks_in; j++ )
+        {
+            if ( has_track( written, nwritten, stage->tracks_in[ j ] ) )
+            {
+                nphases += 1;
+                nwritten = 0;
+                break;
+            }
+        }
+
+        phase[ i ] = nphases;
+
+        for ( j = 0; j < stage->ntracks_out; j++ )
+        {
+            written[ nwritten++ ] = stage->tracks_out[ j ];
+        }
+    }
+
+    return nphases;
+}
+
+// the stages run by a phase, its own and the filters of the earlier ones
+
+static int phase_chain( ScrubStage* stages, int nstages, int* phase, int p, ScrubStage** chain )
+{
+    int nchain = 0;
+
+    int i;
+    for ( i = 0; i < nstages; i++ )
+    {
+        if ( phase[ i ] == p || ( phase[ i ] < p && stages[ i ].filter ) )
+        {
+            chain[ nchain++ ] = stages + i;
+        }
+    }
+
+    return nchain;
+}
+
+static int split_args( char* spec, char** argv )
+{
+    int argc = 0;
+    char* token;
+
+    while ( ( token = strsep( &spec, " \t" ) ) != NULL )
+    {
+        if ( *token == '\0' )
+        {
+            continue;
+        }
+
+        if ( argc == MAX_STAGE_ARGS - 1 )
+        {
+            fprintf( stderr, "error: too many arguments for stage %s\n", argv[ 0 ] );
+            exit( 1 );
+        }
+
+        argv[ argc++ ] = token;
+    }
+
+    argv[ argc ] = NULL;
+
+    return argc;
+}
+
+static void usage( FILE* fout, const char* app )
+{
+    fprintf( fout, "usage: %s [-n] [-j n] [-P n] -s stage [-s stage ...] database input.las [output.las]\n\n", app );
+
+    fprintf( fout, "Runs scrubbing tools as stages of a single pass over the overlaps, only the output of the last stage is written.\n\n" );
+
+    fprintf( fout, "options: -s stage  tool and its options, without database and .las arguments (eg. \"LAgap -t trim0\")\n" );
+    fprintf( fout, "                   supported: LAq LArepeat LAgap LAfilter\n" );
+    fprintf( fout, "         -j n      number of threads for phases whose stages all support it (default %d)\n", DEF_ARG_J );
+    fprintf( fout, "         -P n      only run phase n, for block-wise processing with TKmerge in between\n" );
+    fprintf( fout, "         -n        show the phases and exit\n\n" );
+
+    fprintf( fout, "Stages depending on tracks produced by earlier ones start a new phase. Filters of earlier\n" );
+    fprintf( fout, "phases are replayed in memory, only the last phase writes output.las.\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+    HITS_DB db;
+    ScrubContext sctx;
+    ScrubStage stages[ MAX_STAGES ];
+    char* specs[ MAX_STAGES ];
+    int phase[ MAX_STAGES ];
+    int nstages = 0;
+    char* app   = argv[ 0 ];
+
+    bzero( &sctx, sizeof( ScrubContext ) );
+
+    // process arguments
+
+    int arg_phase = 0;
+    int arg_plan  = 0;
+    int nthreads  = DEF_ARG_J;
+
+    opterr = 0;
+
+    int c;
+    while ( ( c = getopt( argc, argv, "j:nP:s:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
+            case 'n':
+                arg_plan = 1;
+                break;
+
+            case 'P':
+                arg_phase = atoi( optarg );
+                break;
+
+            case 's':
+                if ( nstages == MAX_STAGES )
+                {
+                    fprintf( stderr, "error: more than %d stages\n", MAX_STAGES );
+                    exit( 1 );
+                }
+
+                specs[ nstages++ ] = optarg;
+                break;
+
+            default:
+                usage( stdout, app );
+                exit( 1 );
+        }
+    }
+
+    if ( argc - optind < 2 || argc - optind > 3 || nstages == 0 )
+    {
+        usage( stdout, app );
+        exit( 1 );
+    }
+
+    if ( nthreads < 1 )
+    {
+        fprintf( stderr, "error: invalid -j\n" );
+        exit( 1 );
+    }
+
+    char* pcPathReadsIn     = argv[ optind++ ];
+    char* pcPathOverlapsIn  = argv[ optind++ ];
+    char* pcPathOverlapsOut = ( optind < argc ) ? argv[ optind++ ] : NULL;
+
+    if ( Open_DB( pcPathReadsIn, &db ) )
+    {
+        fprintf( stderr, "could not open database '%s'\n", pcPathReadsIn );
+        exit( 1 );
+    }
+
+    // set up the stages
+
+    int i, j;
+    for ( i = 0; i < nstages; i++ )
+    {
+        char* stage_argv[ MAX_STAGE_ARGS ];
+        int stage_argc = split_args( strdup( specs[ i ] ), stage_argv );
+
+        if ( stage_argc == 0 )
+        {
+            fprintf( stderr, "error: empty stage\n" );
+            exit( 1 );
+        }
+
+        StageTool* tool = Tools;
+
+        while ( tool->name && strcmp( tool->name, stage_argv[ 0 ] ) != 0 )
+        {
+            tool++;
+        }
+
+        if ( tool->name == NULL )
+        {
+            fprintf( stderr, "error: unsupported stage %s\n", stage_argv[ 0 ] );
+            exit( 1 );
+        }
+
+        optind = 1;
+        tool->init( stages + i, &db, stage_argc, stage_argv );
+    }
+
+    int nphases = plan_phases( stages, nstages, phase );
+
+    // prepare passes see all overlaps of the input and can't follow a filter
+
+    for ( i = 0; i < nstages; i++ )
+    {
+        if ( !stages[ i ].prepare || stages[ i ].prepare_any )
+        {
+            continue;
+        }
+
+        for ( j = 0; j < i; j++ )
+        {
+            if ( stages[ j ].filter )
+            {
+                fprintf( stderr, "error: stage %d (%s) needs an extra pass, which can't follow filter stage %d (%s)\n",
+                         i + 1, stages[ i ].name, j + 1, stages[ j ].name );
+                exit( 1 );
+            }
+        }
+    }
+
+    if ( arg_phase < 0 || arg_phase > nphases )
+    {
+        fprintf( stderr, "error: invalid phase %d, there are %d\n", arg_phase, nphases );
+        exit( 1 );
+    }
+
+    // block tracks need to be merged before a later phase can use them
+
+    if ( arg_phase == 0 )
+    {
+        for ( i = 0; i < nstages; i++ )
+        {
+            for ( j = 0; j < nstages; j++ )
+            {
+                int k;
+
+                if ( phase[ j ] >= phase[ i ] || stages[ j ].block == 0 )
+                {
+                    continue;
+                }
+
+                for ( k = 0; k < stages[ i ].ntracks_in; k++ )
+                {
+                    if ( has_track( stages[ j ].tracks_out, stages[ j ].ntracks_out, stages[ i ].tracks_in[ k ] ) )
+                    {
+                        fprintf( stderr, "error: track %s is written for block %d and used by phase %d\n",
+                                 stages[ i ].tracks_in[ k ], stages[ j ].block, phase[ i ] );
+                        fprintf( stderr, "       run the phases using -P and merge the tracks with TKmerge\n" );
+                        exit( 1 );
+                    }
+                }
+            }
+        }
+    }
+
+    if ( arg_plan )
+    {
+        for ( i = 1; i <= nphases; i++ )
+        {
+            printf( "phase %d:", i );
+
+            for ( j = 0; j < nstages; j++ )
+            {
+                if ( phase[ j ] == i )
+                {
+                    printf( " %s", stages[ j ].name );
+                }
+                else if ( phase[ j ] < i && stages[ j ].filter )
+                {
+                    printf( " (%s)", stages[ j ].name );
+                }
+            }
+
+            printf( "\n" );
+        }
+
+        exit( 0 );
+    }
+
+    FILE* fileOvlIn;
+    FILE* fileOvlOut = NULL;
+
+    if ( ( fileOvlIn = fopen( pcPathOverlapsIn, "r" ) ) == NULL )
+    {
+        fprintf( stderr, "could not open '%s'\n", pcPathOverlapsIn );
+        exit( 1 );
+    }
+
+    if ( pcPathOverlapsOut && ( arg_phase == 0 || arg_phase == nphases ) )
+    {
+        if ( ( fileOvlOut = fopen( pcPathOverlapsOut, "w" ) ) == NULL )
+        {
+            fprintf( stderr, "could not open '%s'\n", pcPathOverlapsOut );
+            exit( 1 );
+        }
+    }
+
+    // balance the threads using the index, if there is an up to date one
+
+    lasidx* index = NULL;
+
+    if ( nthreads > 1 )
+    {
+        PassContext* pctx = pass_init( fileOvlIn, NULL );
+
+        if ( !pctx->is_laz )
+        {
+            index = lasidx_load( &db, pcPathOverlapsIn, 0 );
+        }
+
+        pass_free( pctx );
+    }
+
+    // passes
+
+    int p;
+    for ( p = 1; p <= nphases; p++ )
+    {
+        if ( arg_phase != 0 && p != arg_phase )
+        {
+            continue;
+        }
+
+#ifdef VERBOSE
+        printf( ANSI_COLOR_GREEN "PHASE %d of %d" ANSI_COLOR_RESET "\n", p, nphases );
+#endif
+
+        sctx.nchain = phase_chain( stages, nstages, phase, p, sctx.chain );
+
+        run_phase( &sctx, fileOvlIn, ( p == nphases ) ? fileOvlOut : NULL, index, nthreads );
+    }
+
+    // cleanup
+
+    for ( i = 0; i < nstages; i++ )
+    {
+        stages[ i ].free( stages[ i ].data );
+    }
+
+    lasidx_close( index );
+
+    free( sctx.purged );
+
+    fclose( fileOvlIn );
+
+    if ( fileOvlOut )
+    {
+        fclose( fileOvlOut );
+    }
+
+    Close_DB( &db );
+
+    return 0;
+}
@@ -18,6 +18,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/param.h>
+#include <pthread.h>
 
 #include "lib/read_loader.h"
 #include "lib/pass.h"
@@ -32,6 +33,12 @@
 
 #define DEF_ARG_F   40
 #define DEF_ARG_P    0
+#define DEF_ARG_J    1
+
+// constants
+
+#define PIPE_CHUNKS  4                      // chunks per thread in the pipelined -L mode
+#define PIPE_BUFFER  ( 4 * 1024 * 1024 )    // copying the stitched chunks to the output
 
 // switches
 
@@ -68,6 +75,44 @@ typedef struct
 
 } StitchContext;
 
+// pipelined -L mode. the input is cut into chunks, a loader thread collects
+// and loads the reads of the upcoming chunks while the workers stitch the
+// chunks whose reads are available.
+
+typedef struct
+{
+    PassContext* pctx;              // template for the passes over the chunks
+    StitchContext* sctx;
+
+    off_t* offsets;                 // chunk c is [offsets[c], offsets[c + 1])
+    int nchunks;
+    int ahead;                      // max. chunks loaded and not yet stitched
+    uint64 max_mem;                 // max. bytes of reads loaded for them (-M), 0 for no limit
+    uint64 held;
+
+    Read_Loader** rl;               // reads of the chunks
+    FILE** out;                     // stitched chunks
+    ovl_header_novl* novl_out;
+    int* aread;                     // last A-read stitched
+    char* done;
+
+    int nloaded;                    // chunks loaded
+    int nstitched;                  // chunks stitched
+    int next;                       // next chunk to be picked by a worker
+    int nwritten;                   // chunks appended to the output
+    int writing;                    // a worker is appending
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+} StitchPipe;
+
+typedef struct
+{
+    StitchPipe* pipe;
+    StitchContext* sctx;            // of the worker
+} StitchWorker;
+
 // externals for getopt()
 
 extern char *optarg;
@@ -242,14 +287,6 @@ static void stitch_pre(PassContext* pctx, StitchContext* sctx)
 
     sctx->tbytes = pctx->tbytes;
     sctx->twidth = pctx->twidth;
-    sctx->align_work = New_Work_Data();
-
-    sctx->tmax = 2 * ( ( DB_READ_MAXLEN( sctx->db ) + pctx->twidth ) / pctx->twidth );
-    sctx->trace = (ovl_trace*)malloc( sizeof(ovl_trace) * sctx->tmax );
-
-    sctx->align.path = &(sctx->path);
-    sctx->align.aseq = New_Read_Buffer(sctx->db);
-    sctx->align.bseq = New_Read_Buffer(sctx->db);
 }
 
 /*
@@ -259,13 +296,54 @@ static void stitch_post(PassContext* pctx, StitchContext* sctx)
 {
 #ifdef VERBOSE
     printf("stitched %lld out of %lld overlaps\n", sctx->stitched, pctx->novl);
+#else
+    UNUSED(pctx);
+    UNUSED(sctx);
 #endif
+}
+
+/*
+    per thread state, each worker realigns with its own Work_Data,
+    alignment and trace buffer.
+*/
+static void* stitch_thread_init(void* _ctx, int thread)
+{
+    UNUSED(thread);
+
+    StitchContext* ctx = (StitchContext*)_ctx;
+    StitchContext* tctx = malloc(sizeof(StitchContext));
+
+    memcpy(tctx, ctx, sizeof(StitchContext));
+
+    tctx->stitched = 0;
+    tctx->align_work = New_Work_Data();
+
+    tctx->tcur = 0;
+    tctx->tmax = 2 * ( ( DB_READ_MAXLEN( ctx->db ) + ctx->twidth ) / ctx->twidth );
+    tctx->trace = (ovl_trace*)malloc( sizeof(ovl_trace) * tctx->tmax );
 
-    Free_Work_Data(sctx->align_work);
-    free(sctx->align.aseq - 1);
-    free(sctx->align.bseq - 1);
+    tctx->align.path = &(tctx->path);
+    tctx->align.aseq = New_Read_Buffer(ctx->db);
+    tctx->align.bseq = New_Read_Buffer(ctx->db);
 
-    free(sctx->trace);
+    return tctx;
+}
+
+static void stitch_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
+
+    StitchContext* ctx = (StitchContext*)_ctx;
+    StitchContext* tctx = (StitchContext*)_tctx;
+
+    ctx->stitched += tctx->stitched;
+
+    Free_Work_Data(tctx->align_work);
+    free(tctx->align.aseq - 1);
+    free(tctx->align.bseq - 1);
+
+    free(tctx->trace);
+    free(tctx);
 }
 
 /*
@@ -602,9 +680,279 @@ static int loader_handler(void* _ctx, Overlap* ovl, int novl)
     return 1;
 }
 
+/*
+    loads the reads needed by the chunks ahead of the workers
+*/
+static void* pipe_loader_thread(void* arg)
+{
+    StitchPipe* pipe = arg;
+    StitchContext lctx = *(pipe->sctx);
+    PassContext* pctx = pass_init(pipe->pctx->fileOvlIn, NULL);
+
+    pctx->data = &lctx;
+    pctx->split_b = 1;
+    pctx->load_trace = 0;
+    pctx->progress = 0;
+
+    int c;
+    for (c = 0; c < pipe->nchunks; c++)
+    {
+        pthread_mutex_lock(&(pipe->lock));
+
+        // beyond the memory limit only the chunk the workers wait for is loaded
+
+        while ( pipe->nloaded - pipe->nstitched >= pipe->ahead ||
+                (pipe->max_mem > 0 && pipe->held >= pipe->max_mem && pipe->nloaded > pipe->nstitched) )
+        {
+            pthread_cond_wait(&(pipe->cond), &(pipe->lock));
+        }
+
+        pthread_mutex_unlock(&(pipe->lock));
+
+        Read_Loader* rl = rl_init(pipe->sctx->db, 1);
+
+        if (pipe->offsets[c] < pipe->offsets[c + 1])
+        {
+            lctx.rl = rl;
+
+            pass_part(pctx, pipe->offsets[c], pipe->offsets[c + 1]);
+            pass(pctx, loader_handler);
+        }
+
+        rl_load_added(rl);
+
+        pthread_mutex_lock(&(pipe->lock));
+
+        pipe->rl[c] = rl;
+        pipe->nloaded += 1;
+        pipe->held += rl_size(rl);
+
+        pthread_cond_broadcast(&(pipe->cond));
+        pthread_mutex_unlock(&(pipe->lock));
+    }
+
+    free(pctx);
+
+    return NULL;
+}
+
+/*
+    appends the stitched chunks to the output in file order, at most one worker at a time
+*/
+static void pipe_write_chunks(StitchPipe* pipe)
+{
+    PassContext* pctx = pipe->pctx;
+    char* buf = NULL;
+
+    pthread_mutex_lock(&(pipe->lock));
+
+    while (!pipe->writing && pipe->nwritten < pipe->nchunks && pipe->done[pipe->nwritten])
+    {
+        int c = pipe->nwritten;
+
+        pipe->writing = 1;
+
+        pthread_mutex_unlock(&(pipe->lock));
+
+        if (pipe->out[c] != NULL)
+        {
+            size_t len;
+
+            if (buf == NULL)
+            {
+                buf = malloc(PIPE_BUFFER);
+            }
+
+            rewind(pipe->out[c]);
+
+            while ( (len = fread(buf, 1, PIPE_BUFFER, pipe->out[c])) > 0 )
+            {
+                fwrite(buf, 1, len, pctx->fileOvlOut);
+            }
+
+            fclose(pipe->out[c]);
+
+            pctx->novl_out += pipe->novl_out[c];
+            pctx->aread = pipe->aread[c];
+        }
+
+        if (pctx->checkpoint && pass_checkpoint_due(pctx->checkpoint))
+        {
+            pass_checkpoint_pass(pctx, pipe->offsets[c + 1]);
+        }
+
+        pthread_mutex_lock(&(pipe->lock));
+
+        pipe->out[c] = NULL;
+        pipe->nwritten += 1;
+        pipe->writing = 0;
+    }
+
+    pthread_mutex_unlock(&(pipe->lock));
+
+    free(buf);
+}
+
+/*
+    stitches the chunks in the order they are loaded into temporary output files
+*/
+static void* pipe_worker_thread(void* arg)
+{
+    StitchWorker* worker = arg;
+    StitchPipe* pipe = worker->pipe;
+
+    while (1)
+    {
+        pthread_mutex_lock(&(pipe->lock));
+
+        int c = pipe->next;
+
+        if (c < pipe->nchunks)
+        {
+            pipe->next += 1;
+
+            while (pipe->nloaded <= c)
+            {
+                pthread_cond_wait(&(pipe->cond), &(pipe->lock));
+            }
+        }
+
+        pthread_mutex_unlock(&(pipe->lock));
+
+        if (c >= pipe->nchunks)
+        {
+            break;
+        }
+
+        Read_Loader* rl = pipe->rl[c];
+
+        if (pipe->offsets[c] < pipe->offsets[c + 1])
+        {
+            PassContext* pctx = malloc(sizeof(PassContext));
+            memcpy(pctx, pipe->pctx, sizeof(PassContext));
+
+            if ( (pctx->fileOvlOut = tmpfile()) == NULL )
+            {
+                fprintf(stderr, "failed to create temporary output for chunk %d\n", c);
+                exit(1);
+            }
+
+            pctx->data = worker->sctx;
+            pctx->novl_out = pctx->novl_out_discarded = 0;
+            pctx->progress = 0;
+            pctx->checkpoint = NULL;
+
+            worker->sctx->rl = rl;
+
+            pass_part(pctx, pipe->offsets[c], pipe->offsets[c + 1]);
+            pass(pctx, stitch_handler);
+
+            pipe->out[c] = pctx->fileOvlOut;
+            pipe->novl_out[c] = pctx->novl_out;
+            pipe->aread[c] = pctx->aread;
+
+            free(pctx);
+        }
+
+        uint64 size = rl_size(rl);
+
+        rl_free(rl);
+
+        pthread_mutex_lock(&(pipe->lock));
+
+        pipe->held -= size;
+        pipe->nstitched += 1;
+        pipe->done[c] = 1;
+
+        pthread_cond_broadcast(&(pipe->cond));
+        pthread_mutex_unlock(&(pipe->lock));
+
+        pipe_write_chunks(pipe);
+    }
+
+    return NULL;
+}
+
+/*
+    pass over the input with the loading of the reads running ahead of the stitching
+*/
+static void pass_pipelined(PassContext* pctx, StitchContext* sctx, int nthreads, uint64 max_mem)
+{
+    StitchPipe pipe;
+
+    pipe.pctx = pctx;
+    pipe.sctx = sctx;
+    pipe.nchunks = nthreads * PIPE_CHUNKS;
+    pipe.ahead = nthreads + 1;
+    pipe.max_mem = max_mem;
+    pipe.held = 0;
+    pipe.offsets = pass_partition(pctx, pipe.nchunks);
+
+    // chunks before the checkpoint are left empty
+
+    off_t resume = pass_checkpoint_resume(pctx);
+
+    int i;
+    for (i = 0; i <= pipe.nchunks; i++)
+    {
+        if (pipe.offsets[i] < resume)
+        {
+            pipe.offsets[i] = resume;
+        }
+    }
+
+    pipe.rl = calloc(pipe.nchunks, sizeof(Read_Loader*));
+    pipe.out = calloc(pipe.nchunks, sizeof(FILE*));
+    pipe.novl_out = calloc(pipe.nchunks, sizeof(ovl_header_novl));
+    pipe.aread = calloc(pipe.nchunks, sizeof(int));
+    pipe.done = calloc(pipe.nchunks, 1);
+
+    pipe.nloaded = pipe.nstitched = pipe.next = 0;
+    pipe.nwritten = pipe.writing = 0;
+
+    pthread_mutex_init(&(pipe.lock), NULL);
+    pthread_cond_init(&(pipe.cond), NULL);
+
+    pthread_t loader;
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+    StitchWorker* workers = malloc(sizeof(StitchWorker) * nthreads);
+
+    pthread_create(&loader, NULL, pipe_loader_thread, &pipe);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        workers[i].pipe = &pipe;
+        workers[i].sctx = stitch_thread_init(sctx, i);
+
+        pthread_create(threads + i, NULL, pipe_worker_thread, workers + i);
+    }
+
+    pthread_join(loader, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+
+        stitch_thread_reduce(sctx, workers[i].sctx, i);
+    }
+
+    pthread_cond_destroy(&(pipe.cond));
+    pthread_mutex_destroy(&(pipe.lock));
+
+    free(threads);
+    free(workers);
+
+    free(pipe.offsets);
+    free(pipe.rl);
+    free(pipe.out);
+    free(pipe.novl_out);
+    free(pipe.aread);
+    free(pipe.done);
+}
+
 static void usage()
 {
-    fprintf( stderr, "usage: [-p] [-v] [-L] [-f n] database input.las output.las\n\n" );
+    fprintf( stderr, "usage: [-p] [-v] [-L] [-R] [-f n] [-j n] [-M n] database input.las output.las\n\n" );
 
     fprintf( stderr, "Stitch alignments that would have been continuous if it wasn't for\n" );
     fprintf( stderr, "noisy regions in one or both of the reads, that caused the alignment\n" );
@@ -614,6 +962,10 @@ static void usage()
     fprintf( stderr, "         -f  maximum stitch distance (default %d)\n", DEF_ARG_F );
     fprintf( stderr, "         -p  do not write discarded overlaps to the output file\n" );
     fprintf( stderr, "         -L  two-pass processing with read caching\n" );
+    fprintf( stderr, "         -M  with -L, load the reads of further chunks only while less than n MB are held (default: no limit)\n" );
+    fprintf( stderr, "         -j  number of threads (default %d)\n", DEF_ARG_J );
+    fprintf( stderr, "         -R  checkpoint to output.las%s every %ds and resume from it, if present\n",
+                     PASS_CHECKPOINT_SUFFIX, PASS_CHECKPOINT_INTERVAL );
 }
 
 int main(int argc, char* argv[])
@@ -623,6 +975,7 @@ int main(int argc, char* argv[])
     PassContext* pctx;
     FILE* fileOvlIn;
     FILE* fileOvlOut;
+    PassCheckpoint* ckpt = NULL;
 
     bzero(&sctx, sizeof(StitchContext));
     sctx.fuzz = DEF_ARG_F;
@@ -633,14 +986,21 @@ int main(int argc, char* argv[])
     // process arguments
 
     int arg_purge = DEF_ARG_P;
+    int nthreads = DEF_ARG_J;
+    int resume = 0;
+    int arg_mem = 0;
 
     opterr = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "Lpvf:")) != -1)
+    while ((c = getopt(argc, argv, "LpvRf:j:M:")) != -1)
     {
         switch (c)
         {
+            case 'R':
+                      resume = 1;
+                      break;
+
             case 'p':
                       arg_purge = 1;
                       break;
@@ -657,6 +1017,14 @@ int main(int argc, char* argv[])
                       sctx.fuzz = atoi(optarg);
                       break;
 
+            case 'j':
+                      nthreads = atoi(optarg);
+                      break;
+
+            case 'M':
+                      arg_mem = atoi(optarg);
+                      break;
+
             default:
                       usage();
                       exit(1);
@@ -679,7 +1047,14 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    if ( (fileOvlOut = fopen(pcPathOverlapsOut, "w")) == NULL )
+    // a resumed run continues the output of the previous one
+
+    if (resume)
+    {
+        ckpt = pass_checkpoint_load(pcPathOverlapsOut, fileOvlIn);
+    }
+
+    if ( (fileOvlOut = fopen(pcPathOverlapsOut, (ckpt && ckpt->resumed) ? "r+" : "w")) == NULL )
     {
         fprintf(stderr, "could not open '%s'\n", pcPathOverlapsOut);
         exit(1);
@@ -691,30 +1066,24 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    Map_Bases(&db);
+
     if ( sctx.fuzz < 0 )
     {
         fprintf(stderr, "invalid fuzzing value of %d\n", sctx.fuzz);
         exit(1);
     }
 
-
-    if(sctx.useRLoader)
+    if ( nthreads < 1 )
     {
-		// collect read ids for loading
-
-    	sctx.rl = rl_init(&db, 1);
-
-		pctx = pass_init(fileOvlIn, NULL);
-
-		pctx->data = &sctx;
-		pctx->split_b = 1;
-		pctx->load_trace = 0;
-
-		pass(pctx, loader_handler);
-
-		rl_load_added(sctx.rl);
+        fprintf(stderr, "invalid number of threads %d\n", nthreads);
+        exit(1);
+    }
 
-		pass_free(pctx);
+    if ( arg_mem < 0 )
+    {
+        fprintf(stderr, "invalid memory limit %d\n", arg_mem);
+        exit(1);
     }
 
     // process overlaps
@@ -723,24 +1092,53 @@ int main(int argc, char* argv[])
 
     pctx->data = &sctx;
 
+    if (ckpt)
+    {
+        pass_checkpoint_output(ckpt, fileOvlOut);
+
+        pctx->checkpoint = ckpt;
+
+        if (ckpt->resumed && sctx.verbose)
+        {
+            printf("resuming after A-read %d\n", ckpt->aread);
+        }
+    }
+
     pctx->split_b = 1;
     pctx->load_trace = 1;
     pctx->unpack_trace = 1;
     pctx->write_overlaps = 1;
     pctx->purge_discarded = arg_purge;
+    pctx->read_ahead = 1;
+
+    pctx->thread_init = stitch_thread_init;
+    pctx->thread_reduce = stitch_thread_reduce;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if ( (nthreads > 1 || sctx.useRLoader) && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load(&db, pcPathOverlapsIn, 0);
+    }
 
     stitch_pre(pctx, &sctx);
 
-    pass(pctx, stitch_handler);
+    if (sctx.useRLoader)
+    {
+        // the reads are loaded chunk by chunk, ahead of the stitching
+
+        pass_pipelined(pctx, &sctx, nthreads, (uint64)arg_mem * 1024 * 1024);
+    }
+    else
+    {
+        pass_parallel(pctx, stitch_handler, nthreads);
+    }
 
     stitch_post(pctx, &sctx);
 
     // cleanup
 
-    if(sctx.useRLoader)
-    {
-    	rl_free(sctx.rl);
-    }
+    lasidx_close(pctx->index);
 
     Close_DB(&db);
 
@@ -749,6 +1147,13 @@ int main(int argc, char* argv[])
     fclose(fileOvlIn);
     fclose(fileOvlOut);
 
+    // the output is complete
+
+    if (ckpt)
+    {
+        pass_checkpoint_free(ckpt, 1);
+    }
+
     return 0;
 }
 
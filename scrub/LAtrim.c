@@ -32,6 +32,7 @@
 
 #define DEF_ARG_P 0
 #define DEF_ARG_T TRACK_TRIM
+#define DEF_ARG_J 1
 
 // switches
 
@@ -73,26 +74,55 @@ static void trim_post( TrimContext* tctx, int verbose )
     }
 
     trim_close( tctx->trim );
+    free( tctx->trim );
 }
 
 static int trim_handler( void* _ctx, Overlap* ovl, int novl )
 {
     TrimContext* ctx = (TrimContext*)_ctx;
 
-    int i;
-    for ( i = 0; i < novl; i++ )
-    {
-        trim_overlap( ctx->trim, ovl + i );
-    }
+    trim_overlaps( ctx->trim, ovl, novl );
 
     return 1;
 }
 
+// per thread alignment state for pass_parallel()
+
+static void* trim_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    TrimContext* ctx  = (TrimContext*)_ctx;
+    TrimContext* tctx = malloc( sizeof( TrimContext ) );
+
+    memcpy( tctx, ctx, sizeof( TrimContext ) );
+
+    tctx->trim = trim_init( ctx->db, ctx->trim->twidth, ctx->trackTrim, ctx->rl );
+
+    return tctx;
+}
+
+static void trim_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( thread );
+
+    TrimContext* ctx  = (TrimContext*)_ctx;
+    TrimContext* tctx = (TrimContext*)_tctx;
+
+    trim_reduce( ctx->trim, tctx->trim );
+
+    trim_close( tctx->trim );
+    free( tctx->trim );
+    free( tctx );
+}
+
 static int loader_handler( void* _ctx, Overlap* ovl, int novl )
 {
     TrimContext* ctx = (TrimContext*)_ctx;
     Read_Loader* rl  = ctx->rl;
 
+    rl_pile( rl, ovl[ 0 ].aread );
+
     int i;
     for ( i = 0; i < novl; i++ )
     {
@@ -152,7 +182,7 @@ static int loader_handler( void* _ctx, Overlap* ovl, int novl )
 
 static void usage(FILE* fout, const char* app)
 {
-    fprintf( fout, "usage: %s [-vpL] [-t track] database input.las output.las\n\n", app );
+    fprintf( fout, "usage: %s [-vpL] [-j n] [-M n] [-t track] database input.las output.las\n\n", app );
 
     fprintf( fout, "Apply the trim track to the input las file and update the alignments accordingly.\n\n" );
 
@@ -160,6 +190,8 @@ static void usage(FILE* fout, const char* app)
     fprintf( fout, "         -p  purge discarded overlaps\n" );
     fprintf( fout, "         -t  trim track name (default: %s)\n", DEF_ARG_T );
     fprintf( fout, "         -L  two-pass processing with read caching\n");
+    fprintf( fout, "         -M  with -L, hold at most n MB of reads and trim the piles in windows that fit (default: all reads)\n");
+    fprintf( fout, "         -j  number of threads (default %d)\n", DEF_ARG_J );
 }
 
 int main( int argc, char* argv[] )
@@ -178,12 +210,14 @@ int main( int argc, char* argv[] )
     int arg_purge   = DEF_ARG_P;
     int arg_verbose = 0;
     int arg_rloader = 0;
+    int nthreads    = DEF_ARG_J;
+    int arg_mem     = 0;
 
     int c;
 
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "vpLt:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "vpLt:j:M:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -199,6 +233,14 @@ int main( int argc, char* argv[] )
                 arg_rloader = 1;
                 break;
 
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
+            case 'M':
+                arg_mem = atoi( optarg );
+                break;
+
             case 't':
                 arg_track = optarg;
                 break;
@@ -215,6 +257,18 @@ int main( int argc, char* argv[] )
         exit( 1 );
     }
 
+    if ( nthreads < 1 )
+    {
+        fprintf( stderr, "invalid number of threads %d\n", nthreads );
+        exit( 1 );
+    }
+
+    if ( arg_mem < 0 )
+    {
+        fprintf( stderr, "invalid memory limit %d\n", arg_mem );
+        exit( 1 );
+    }
+
     char* pcPathReadsIn     = argv[ optind++ ];
     char* pcPathOverlapsIn  = argv[ optind++ ];
     char* pcPathOverlapsOut = argv[ optind++ ];
@@ -245,10 +299,15 @@ int main( int argc, char* argv[] )
     }
 
     tctx.db = &db;
+    tctx.rl = NULL;
+
+    // with -M the reads are loaded window by window in the trim pass, LAZ input can't be cut there
+
+    int windowed = 0;
 
     if ( arg_rloader )
     {
-        tctx.rl = rl_init( &db, 1 );
+        tctx.rl = rl_init( &db, (size_t)arg_mem * 1024 * 1024 );
 
         pctx = pass_init( fileOvlIn, NULL );
 
@@ -257,9 +316,20 @@ int main( int argc, char* argv[] )
         pctx->load_trace = 0;
 
         pass( pctx, loader_handler );
-        rl_load_added( tctx.rl );
+
+        windowed = ( arg_mem > 0 && !pctx->is_laz );
+
+        if ( !windowed )
+        {
+            rl_load_added( tctx.rl );
+        }
+
         pass_free( pctx );
     }
+    else
+    {
+        Map_Bases( &db );
+    }
 
     // trim
 
@@ -272,12 +342,55 @@ int main( int argc, char* argv[] )
     pctx->write_overlaps  = 1;
     pctx->purge_discarded = arg_purge;
 
+    pctx->thread_init   = trim_thread_init;
+    pctx->thread_reduce = trim_thread_reduce;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if ( nthreads > 1 && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load( &db, pcPathOverlapsIn, 0 );
+    }
+
     trim_pre( pctx, &tctx, tctx.rl );
 
-    pass( pctx, trim_handler );
+    if ( windowed )
+    {
+        int* areads;
+        int nwin        = rl_windows( tctx.rl, &areads );
+        off_t* offsets  = pass_partition_piles( pctx, areads, nwin );
+        int w;
+
+        if ( arg_verbose )
+        {
+            printf( "trimming in %d windows of at most %d MB of reads\n", nwin, arg_mem );
+        }
+
+        for ( w = 0; w < nwin; w++ )
+        {
+            if ( offsets[ w ] >= offsets[ w + 1 ] )
+            {
+                continue;
+            }
+
+            rl_window( tctx.rl, w );
+
+            pass_part( pctx, offsets[ w ], offsets[ w + 1 ] );
+            pass_parallel( pctx, trim_handler, nthreads );
+        }
+
+        pctx->off_start = pctx->off_end = 0;
+
+        free( offsets );
+    }
+    else
+    {
+        pass_parallel( pctx, trim_handler, nthreads );
+    }
 
     trim_post( &tctx, arg_verbose );
 
+    lasidx_close( pctx->index );
     pass_free( pctx );
 
     // cleanup
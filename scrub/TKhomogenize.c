@@ -15,6 +15,7 @@
 #include <sys/param.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "lib/tracks.h"
 #include "lib/colors.h"
@@ -38,6 +39,7 @@
 #define DEF_ARG_T   TRACK_TRIM
 #define DEF_ARG_E   -1
 #define DEF_ARG_R   1
+#define DEF_ARG_J   1
 
 
 // constants
@@ -47,11 +49,22 @@
 
 #define MIN_INT_LEN  ( 500 )        // min intervals length
 
+#define BUCKET_FLUSH ( 4 * 1024 * 1024 )    // B-read intervals a thread collects before applying them
+
 // toggles
 
 #define VERBOSE
 #undef DEBUG_HOMOGENIZE
 
+// B-read interval, in -r resolution
+
+typedef struct
+{
+    int b;
+    int beg;
+    int end;
+} BInterval;
+
 typedef struct
 {
     HITS_DB* db;
@@ -59,6 +72,7 @@ typedef struct
 
     HITS_TRACK* track_repeats;
     HITS_TRACK* track_trim;
+    track_cache* tracks;
 
     char* track_in;
     char* track_out;
@@ -74,6 +88,17 @@ typedef struct
     bit** read_masks;   	       // repeat annotation bit masks for each read
     bit** bufs;                    // buffers for repeat annotation
 
+    int nthreads;
+
+    // the threads tag other reads than the ones of their A-read range. they collect
+    // the intervals and apply them to read_masks in bulk, holding masks_lock.
+
+    BInterval* bucket;
+    uint64_t bucket_cur;
+    uint64_t bucket_max;
+
+    pthread_mutex_t* masks_lock;
+
 } HomogenizeContext;
 
 // getopt()
@@ -90,7 +115,7 @@ static void pre_homogenize(PassContext* pctx, HomogenizeContext* ctx)
 #endif
 
     int nreads = DB_NREADS(ctx->db);
-    ctx->track_repeats = track_load(ctx->db, ctx->track_in);
+    ctx->track_repeats = track_cache_get(ctx->tracks, ctx->track_in);
 
     if (!ctx->track_repeats)
     {
@@ -254,19 +279,16 @@ static void post_homogenize(HomogenizeContext* ctx)
             continue;
         }
 
+        // skip from run to run instead of testing every position
+
         int j = 0;
-        int beg = -1;
-        int end = -1;
+        int beg, end;
 
-        for (j = 0; j < alen; j++)
+        while ( (beg = ba_find(bitarr, alen, j, TRUE)) < alen )
         {
-            int val = ba_value(bitarr, j);
+            j = ba_find(bitarr, alen, beg, FALSE);
 
-            if (val && beg == -1)
-            {
-                beg = j;
-            }
-            else if (!val && beg != -1)
+            if (j < alen)
             {
                 end = j - 1;
 
@@ -283,14 +305,16 @@ static void post_homogenize(HomogenizeContext* ctx)
                 data[dcur++] = end;
 
                 anno[i] += sizeof(track_data) * 2;
-
-                beg = -1;
+            }
+            else
+            {
+                break;
             }
         }
 
         // interval extends to the end of the read
 
-        if (beg != -1)
+        if (beg < alen)
         {
             if (dcur + 2 >= dmax)
             {
@@ -342,6 +366,105 @@ static void post_homogenize(HomogenizeContext* ctx)
     free(data);
 }
 
+static int cmp_binterval(const void* x, const void* y)
+{
+    BInterval* i1 = (BInterval*)x;
+    BInterval* i2 = (BInterval*)y;
+
+    if (i1->b != i2->b)
+    {
+        return (i1->b < i2->b) ? -1 : 1;
+    }
+
+    return i1->beg - i2->beg;
+}
+
+// apply a thread's intervals to the read masks. the tags are only ever set, hence
+// the order does not matter. sorting by B-read keeps the writes to the masks local.
+
+static void flush_bucket(HomogenizeContext* ctx)
+{
+    if (ctx->bucket_cur == 0)
+    {
+        return ;
+    }
+
+    qsort(ctx->bucket, ctx->bucket_cur, sizeof(BInterval), cmp_binterval);
+
+    pthread_mutex_lock(ctx->masks_lock);
+
+    uint64_t i;
+    for (i = 0; i < ctx->bucket_cur; i++)
+    {
+        BInterval* bi = ctx->bucket + i;
+
+        ba_assign_range(ctx->read_masks[bi->b], bi->beg, bi->end, 1);
+    }
+
+    pthread_mutex_unlock(ctx->masks_lock);
+
+    ctx->bucket_cur = 0;
+}
+
+static void tag_b(HomogenizeContext* ctx, int b, bit* bmask, int beg, int end)
+{
+    if (ctx->bucket == NULL)
+    {
+        ba_assign_range(bmask, beg, end, 1);
+        return ;
+    }
+
+    if (ctx->bucket_cur == ctx->bucket_max)
+    {
+        flush_bucket(ctx);
+    }
+
+    BInterval* bi = ctx->bucket + ctx->bucket_cur;
+
+    bi->b = b;
+    bi->beg = beg;
+    bi->end = end;
+
+    ctx->bucket_cur += 1;
+}
+
+static void* homogenize_thread_init(void* _ctx, int thread)
+{
+    UNUSED(thread);
+
+    HomogenizeContext* ctx = (HomogenizeContext*)_ctx;
+    HomogenizeContext* tctx = malloc(sizeof(HomogenizeContext));
+
+    memcpy(tctx, ctx, sizeof(HomogenizeContext));
+
+    // single threaded, write the masks directly
+
+    if (ctx->nthreads > 1)
+    {
+        tctx->bucket_max = BUCKET_FLUSH;
+        tctx->bucket_cur = 0;
+        tctx->bucket = malloc(sizeof(BInterval) * tctx->bucket_max);
+    }
+
+    return tctx;
+}
+
+static void homogenize_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(_ctx);
+    UNUSED(thread);
+
+    HomogenizeContext* tctx = (HomogenizeContext*)_tctx;
+
+    if (tctx->bucket)
+    {
+        flush_bucket(tctx);
+        free(tctx->bucket);
+    }
+
+    free(tctx);
+}
+
 static int handler_homogenize(void* _ctx, Overlap* ovl, int novl)
 {
     HomogenizeContext* ctx = (HomogenizeContext*)_ctx;
@@ -503,7 +626,7 @@ static int handler_homogenize(void* _ctx, Overlap* ovl, int novl)
                     int bab = ( ibb + ctx->res - 1) / ctx->res;
                     int bae = MIN( ends + trim_bb, ibe ) / ctx->res;
 
-                    ba_assign_range(bmask, bab, bae, 1);
+                    tag_b(ctx, b, bmask, bab, bae);
                 }
 
                 if (ibe > trim_be - ends)
@@ -512,7 +635,7 @@ static int handler_homogenize(void* _ctx, Overlap* ovl, int novl)
                     int bab = ( MAX( trim_be - ends, ibb ) + ctx->res - 1) / ctx->res;
                     int bae = ibe / ctx->res;
 
-                    ba_assign_range(bmask, bab, bae, 1);
+                    tag_b(ctx, b, bmask, bab, bae);
                 }
 
                 // printf("\n");
@@ -522,7 +645,7 @@ static int handler_homogenize(void* _ctx, Overlap* ovl, int novl)
                 ibb = ( ibb + ctx->res - 1) / ctx->res;
                 ibe = ibe / ctx->res;
 
-                ba_assign_range(bmask, ibb, ibe, 1);
+                tag_b(ctx, b, bmask, ibb, ibe);
             }
         }
     }
@@ -532,7 +655,7 @@ static int handler_homogenize(void* _ctx, Overlap* ovl, int novl)
 
 static void usage( FILE* fout, const char* app )
 {
-    fprintf( fout, "usage: %s [-m] [-ber n] [-iIt track] database input.las\n\n", app );
+    fprintf( fout, "usage: %s [-m] [-bejr n] [-iIt track] database input.las\n\n", app );
 
     fprintf( fout, "Creates a new annotation track by transfering the annotation of the A read to the B read aligning to it.\n\n" );
 
@@ -544,6 +667,7 @@ static void usage( FILE* fout, const char* app )
     fprintf( fout, "         -e n  only annotate n bases at the ends of the reads (%d), requires -t \n", DEF_ARG_E );
     fprintf( fout, "         -r n  base pair resolution (default %d)\n", DEF_ARG_R );
     fprintf( fout, "               scales memory usage by n and improves runtime\n" );
+    fprintf( fout, "         -j n  number of threads (default %d)\n", DEF_ARG_J );
 }
 
 int main(int argc, char* argv[])
@@ -562,6 +686,7 @@ int main(int argc, char* argv[])
     hctx.ends = DEF_ARG_E;
     hctx.track_trim_name  = DEF_ARG_T;
     hctx.res = DEF_ARG_R;
+    hctx.nthreads = DEF_ARG_J;
 
     // process arguments
 
@@ -569,7 +694,7 @@ int main(int argc, char* argv[])
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "mr:e:b:i:I:t:")) != -1)
+    while ((c = getopt(argc, argv, "mr:e:b:i:I:t:j:")) != -1)
     {
         switch (c)
         {
@@ -581,6 +706,10 @@ int main(int argc, char* argv[])
                       hctx.res = atoi(optarg);
                       break;
 
+            case 'j':
+                      hctx.nthreads = atoi(optarg);
+                      break;
+
             case 'b':
                       hctx.block = atoi(optarg);
                       break;
@@ -619,6 +748,12 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (hctx.nthreads < 1)
+    {
+        fprintf(stderr, "invalid -j argument %d\n", hctx.nthreads);
+        exit(1);
+    }
+
     char* pcPathReadsIn = argv[optind++];
     char* pcPathOverlaps = argv[optind++];
 
@@ -640,9 +775,11 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    hctx.tracks = track_cache_new(&db, 2);
+
     if (hctx.ends != -1)
     {
-        hctx.track_trim = track_load(&db, hctx.track_trim_name);
+        hctx.track_trim = track_cache_get(hctx.tracks, hctx.track_trim_name);
         if (hctx.track_trim == NULL)
         {
             fprintf(stderr, "-e requires a trim track\n");
@@ -658,23 +795,44 @@ int main(int argc, char* argv[])
 
     pctx->split_b = 0;
     pctx->load_trace = 1;
+    pctx->use_mmap = 1;
     pctx->unpack_trace = 1;
     pctx->data = &hctx;
 
+    pthread_mutex_t masks_lock;
+    pthread_mutex_init(&masks_lock, NULL);
+
+    hctx.masks_lock = &masks_lock;
+
+    pctx->thread_init = homogenize_thread_init;
+    pctx->thread_reduce = homogenize_thread_reduce;
+
+    // balance the threads using the index, if there is an up to date one
+
+    if (hctx.nthreads > 1 && !pctx->is_laz)
+    {
+        pctx->index = lasidx_load(&db, pcPathOverlaps, 0);
+    }
+
     // passes
 
     pre_homogenize(pctx, &hctx);
 
-    pass(pctx, handler_homogenize);
+    pass_parallel(pctx, handler_homogenize, hctx.nthreads);
 
     post_homogenize(&hctx);
 
     // cleanup
 
+    pthread_mutex_destroy(&masks_lock);
+
+    lasidx_close(pctx->index);
     pass_free(pctx);
 
     fclose(fileOvlIn);
 
+    track_cache_free(hctx.tracks);
+
     Close_DB(&db);
 
     return 0;
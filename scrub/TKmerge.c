@@ -13,6 +13,8 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/param.h>
 
 #if defined(__APPLE__)
     #include <sys/syslimits.h>
@@ -30,16 +32,165 @@
 
 #undef DEBUG
 
+// defaults
+
+#define DEF_ARG_J 1
+
 extern char* optarg;
 extern int optind, opterr, optopt;
 
+// a block track, ready to be appended to the merged one
+
+typedef struct
+{
+    HITS_DB* db;
+    char* track;
+    int block;
+
+    int legacy;                 // no .a2, loaded by track_load() in block order
+    int error;
+
+    track_anno* anno;           // offsets of the block, nreads + 1
+    void* cdata;                // data compressed with the codec of the merged track
+    uint64_t clen;
+
+    compress_chunk* index;      // chunks in cdata, NULL if not indexable
+    uint64_t nchunks;
+} MergeBlock;
+
 static void usage()
 {
-    printf( "usage: [-d] database track\n\n" );
+    printf( "usage: [-d] [-j n] [-z codec] database track\n\n" );
 
     printf( "Merge annotation tracks that have been created for each block into a single track.\n\n" );
 
     printf( "options: -d  remove source tracks after merging\n" );
+    printf( "         -j  number of blocks processed in parallel (default %d)\n", DEF_ARG_J );
+    printf( "         -z  compression codec of the merged track, zlib or zstd (default zlib)\n" );
+}
+
+/*
+ * read the compressed block track directly. the data is only inflated when its
+ * chunks don't use the codec of the merged track, otherwise it is passed through.
+ * doesn't touch db->tracks, hence can run concurrently for several blocks.
+ */
+
+static void* merge_load(void* arg)
+{
+    MergeBlock* mb = arg;
+    uint64_t nreads = DB_NREADS(mb->db);
+    char* path = track_name(mb->db, mb->track, mb->block);
+    int end = strlen(path);
+
+    strcat(path, ".a2");
+
+    FILE* afile = fopen(path, "r");
+
+    if (afile == NULL)
+    {
+        mb->legacy = 1;
+        free(path);
+        return NULL;
+    }
+
+    track_anno_header header;
+
+    if ( fread(&header, sizeof(track_anno_header), 1, afile) != 1 ||
+         header.size != sizeof(track_anno) || header.len != nreads )
+    {
+        fprintf(stderr, "ERROR: invalid header in %s\n", path);
+        mb->error = 1;
+        fclose(afile);
+        free(path);
+        return NULL;
+    }
+
+    void* canno = malloc(header.clen);
+
+    if ( header.clen > 0 && fread(canno, header.clen, 1, afile) != 1 )
+    {
+        fprintf(stderr, "ERROR: failed to read %s\n", path);
+        mb->error = 1;
+    }
+
+    fclose(afile);
+
+    mb->anno = malloc(sizeof(track_anno) * (nreads + 1));
+    bzero(mb->anno, sizeof(track_anno) * (nreads + 1));
+
+    uncompress_chunks(canno, header.clen, mb->anno, sizeof(track_anno) * (nreads + 1));
+
+    free(canno);
+
+    mb->cdata = malloc(header.cdlen);
+    mb->clen = header.cdlen;
+
+    if ( header.cdlen > 0 )
+    {
+        strcpy(path + end, ".d2");
+
+        FILE* dfile = fopen(path, "r");
+
+        if ( dfile == NULL || fread(mb->cdata, header.cdlen, 1, dfile) != 1 )
+        {
+            fprintf(stderr, "ERROR: failed to read %s\n", path);
+            mb->error = 1;
+        }
+
+        if ( dfile != NULL )
+        {
+            fclose(dfile);
+        }
+    }
+
+    free(path);
+
+    if ( mb->error )
+    {
+        return NULL;
+    }
+
+    if ( mb->clen > 0 && compress_chunks_codec(mb->cdata, mb->clen) != compress_get_codec() )
+    {
+        uint64_t dlen = mb->anno[nreads];
+        void* data = malloc(dlen);
+
+        uncompress_chunks(mb->cdata, mb->clen, data, dlen);
+
+        free(mb->cdata);
+        compress_chunks(data, dlen, &(mb->cdata), &(mb->clen));
+
+        free(data);
+    }
+
+    mb->index = compress_index(mb->cdata, mb->clen, &(mb->nchunks));
+
+    return NULL;
+}
+
+static void merge_load_legacy(MergeBlock* mb)
+{
+    char path[PATH_MAX];
+    sprintf(path, "%d.%s", mb->block, mb->track);
+
+    HITS_TRACK* track = track_load(mb->db, path);
+
+    if (!track)
+    {
+        fprintf(stderr, "Unable to merge all tracks, stopped at block %d. Cannot open file %s\n", mb->block, path);
+        exit(1);
+    }
+
+    uint64_t nreads = DB_NREADS(mb->db);
+
+    mb->anno = malloc(sizeof(track_anno) * (nreads + 1));
+    memcpy(mb->anno, track->anno, sizeof(track_anno) * (nreads + 1));
+
+    compress_chunks(track->data, mb->anno[nreads], &(mb->cdata), &(mb->clen));
+
+    mb->index = compress_index(mb->cdata, mb->clen, &(mb->nchunks));
+
+    Close_Track(mb->db, track->name);
 }
 
 int main(int argc, char* argv[])
@@ -47,17 +198,36 @@ int main(int argc, char* argv[])
     // args
 
     int delete = 0;
+    int nthreads = DEF_ARG_J;
     opterr = 0;
 
     int c;
 
-    while ((c = getopt(argc, argv, "d")) != -1)
+    while ((c = getopt(argc, argv, "dj:z:")) != -1)
     {
         switch (c)
         {
             case 'd':
                 delete = 1;
                 break;
+
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+
+            case 'z':
+            {
+                int codec = compress_codec_parse(optarg);
+
+                if ( codec == -1 || !compress_codec_available(codec) )
+                {
+                    fprintf(stderr, "error: unsupported compression codec %s\n", optarg);
+                    exit(1);
+                }
+
+                compress_set_codec(codec);
+            }
+                break;
         }
     }
 
@@ -67,6 +237,19 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (nthreads < 1)
+    {
+        fprintf(stderr, "invalid number of threads %d\n", nthreads);
+        exit(1);
+    }
+
+    // the blocks are the unit of parallelism, don't let each of them start a thread per core
+
+    if (nthreads > 1)
+    {
+        compress_set_threads(1);
+    }
+
     char* pcDb = argv[optind++];
     char* pcTrack = argv[optind++];
 
@@ -100,60 +283,136 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    // index of the merged data, the chunks of the blocks one after the other
+
+    compress_chunk* dindex = malloc(sizeof(compress_chunk));
+    uint64_t dchunks = 0;
+    uint64_t maxdchunks = 0;
+    int indexed = 1;
+
+    dindex[0].coff = dindex[0].uoff = 0;
+
+    MergeBlock* blocks = malloc(sizeof(MergeBlock) * nthreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+
     int i;
     uint64_t cdata_total = 0;
+    uint64_t udata_total = 0;
 
-    for ( i = 1 ; i <= nblocks ; i++)
+    for ( i = 1 ; i <= nblocks ; i += nthreads )
     {
-        sprintf(path, "%d.%s", i, pcTrack);
-        HITS_TRACK* track = track_load(&db, path);
+        int nbatch = MIN(nthreads, nblocks - i + 1);
+        int t;
+
+        for ( t = 0 ; t < nbatch ; t++ )
+        {
+            MergeBlock* mb = blocks + t;
+
+            bzero(mb, sizeof(MergeBlock));
+            mb->db = &db;
+            mb->track = pcTrack;
+            mb->block = i + t;
+        }
 
-        if (!track)
+        if (nbatch == 1)
         {
-            fprintf(stderr, "Unable to merge all tracks, stopped at block %d. Cannot open file %s\n", i, path);
-            exit(1);
+            merge_load(blocks);
         }
+        else
+        {
+            for ( t = 0 ; t < nbatch ; t++ )
+            {
+                pthread_create(threads + t, NULL, merge_load, blocks + t);
+            }
 
-        track_anno* offset_in = track->anno;
+            for ( t = 0 ; t < nbatch ; t++ )
+            {
+                pthread_join(threads[t], NULL);
+            }
+        }
+
+        // append in block order
 
-        uint64_t j;
-        for (j = 0; j < nreads; j++)
+        for ( t = 0 ; t < nbatch ; t++ )
         {
-            track_anno ob = offset_in[j];
-            track_anno oe = offset_in[j + 1];
+            MergeBlock* mb = blocks + t;
 
-            if (ob > oe)
+            if (mb->legacy)
             {
-                fprintf(stderr, "ERROR: ob > oe read %" PRIu64 " ob %lld oe %lld\n", j, ob, oe);
-                exit(1);
+                merge_load_legacy(mb);
             }
 
-            if (ob < oe && offset[j] != 0)
+            if (mb->error)
             {
-                fprintf(stderr, "ERROR: not merging in proper order\n");
+                fprintf(stderr, "Unable to merge all tracks, stopped at block %d\n", mb->block);
                 exit(1);
             }
 
-            offset[j] += (oe - ob);
-        }
+            track_anno* offset_in = mb->anno;
 
-        void* canno = NULL;
-        uint64_t clen = 0;
-
-        compress_chunks(track->data, offset_in[nreads], &canno, &clen);
+            uint64_t j;
+            for (j = 0; j < nreads; j++)
+            {
+                track_anno ob = offset_in[j];
+                track_anno oe = offset_in[j + 1];
+
+                if (ob > oe)
+                {
+                    fprintf(stderr, "ERROR: ob > oe read %" PRIu64 " ob %lld oe %lld\n", j, ob, oe);
+                    exit(1);
+                }
+
+                if (ob < oe && offset[j] != 0)
+                {
+                    fprintf(stderr, "ERROR: not merging in proper order\n");
+                    exit(1);
+                }
+
+                offset[j] += (oe - ob);
+            }
 
-        cdata_total += clen;
+            if (mb->clen > 0 && fwrite(mb->cdata, mb->clen, 1, fileDataOut) != 1)
+            {
+                fprintf(stderr, "ERROR: failed to write %" PRIu64 " bytes of track data\n", mb->clen);
+                exit(1);
+            }
 
-        // fwrite(track->data, offset_in[nreads], 1, fileDataOut);
-        fwrite(canno, clen, 1, fileDataOut);
+            if (mb->index == NULL)
+            {
+                indexed = 0;
+            }
+            else if (indexed)
+            {
+                if (dchunks + mb->nchunks + 1 > maxdchunks)
+                {
+                    maxdchunks = ( dchunks + mb->nchunks + 1 ) * 1.2 + 100;
+                    dindex = realloc(dindex, sizeof(compress_chunk) * maxdchunks);
+                }
+
+                uint64_t k;
+                for (k = 0; k <= mb->nchunks; k++)
+                {
+                    dindex[dchunks + k].coff = cdata_total + mb->index[k].coff;
+                    dindex[dchunks + k].uoff = udata_total + mb->index[k].uoff;
+                }
+
+                dchunks += mb->nchunks;
+            }
 
-        free(canno);
+            cdata_total += mb->clen;
+            udata_total += offset_in[nreads] - offset_in[0];
 
-        Close_Track(&db, track->name);
+            free(mb->anno);
+            free(mb->cdata);
+            free(mb->index);
+        }
     }
 
     fclose(fileDataOut);
 
+    free(blocks);
+    free(threads);
+
     track_anno off = 0;
     track_anno coff;
 
@@ -170,7 +429,16 @@ int main(int argc, char* argv[])
         assert(offset[j] <= offset[j + 1]);
     }
 
-    track_write(&db, pcTrack, 0, offset, NULL, cdata_total);
+    // the index is only valid if the data of the blocks follows in read order
+
+    if ( !indexed || dindex[dchunks].uoff != offset[nreads] )
+    {
+        indexed = 0;
+    }
+
+    track_write_chunks(&db, pcTrack, 0, offset, cdata_total, indexed ? dindex : NULL, dchunks);
+
+    free(dindex);
 
     if (delete)
     {
@@ -0,0 +1,64 @@
+
+#pragma once
+
+#include "lib/pass.h"
+
+#include "db/DB.h"
+#include "dalign/align.h"
+
+/*
+ * a scrubbing tool run as a stage of LAscrub
+ *
+ * the tools export a function that parses their usual command line options,
+ * minus database and .las arguments, and fills in a stage. LAscrub chains the
+ * handlers of the stages over each A-read pile of a single pass. tracks are
+ * loaded in pre(), since they might be the result of an earlier phase.
+ */
+
+#define STAGE_MAX_TRACKS 4
+
+typedef struct
+{
+    char* name;
+    void* data;
+
+    int filter;                 // changes the piles, replayed by later phases
+    int purge;                  // overlaps it discarded are not seen by the following stages
+    int block;                  // of the tracks written
+
+    int load_trace;
+    int unpack_trace;
+
+    char* tracks_in[ STAGE_MAX_TRACKS ];
+    int ntracks_in;
+
+    char* tracks_out[ STAGE_MAX_TRACKS ];
+    int ntracks_out;
+
+    // optional extra pass before pre(), it sees the piles unchanged by preceding filters.
+    // prepare_any is set if that is fine, ie. it only needs a superset of the overlaps.
+
+    void ( *prepare_pre )( PassContext* pctx, void* data );
+    pass_handler prepare;
+    void ( *prepare_post )( void* data );
+    int prepare_any;
+
+    void ( *pre )( PassContext* pctx, void* data );
+    pass_handler handler;
+    void ( *post )( void* data );
+
+    // optional, the handler can run in pass_parallel()
+
+    pass_thread_init thread_init;
+    pass_thread_reduce thread_reduce;
+
+    void ( *free )( void* data );
+} ScrubStage;
+
+// argv[0] is the name of the tool. they exit on an invalid command line.
+
+void laq_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] );
+void larepeat_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] );
+void lagap_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] );
+void lafilter_stage( ScrubStage* stage, HITS_DB* db, int argc, char* argv[] );
+
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+
+/*
+ * binary overlap graph, written by OGbuild -f bin and read by OGtour(.py)
+ * without parsing. all values little endian.
+ *
+ *   [OgBinHeader] [uint64 offset[nreads + 1]] [OgBinEdge edge[nedges]] [uint8 node[nreads]]
+ *
+ * the edges are stored as CSR by source read, the edges leaving read i are
+ * edge[offset[i]] .. edge[offset[i + 1] - 1]. node[i] holds the OG_BIN_NODE_*
+ * flags of read i, reads without OG_BIN_NODE_USED aren't part of the graph.
+ */
+
+#define OG_BIN_MAGIC            0x3142474f      // "OGB1"
+#define OG_BIN_VERSION          1
+
+#define OG_BIN_NODE_USED        ( 1 << 0 )
+#define OG_BIN_NODE_OPTIONAL    ( 1 << 1 )
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+
+    uint64_t nreads;
+    uint64_t nedges;
+} OgBinHeader;
+
+typedef struct
+{
+    int32_t source, target;
+
+    int32_t length;             // overhang
+    int32_t flags;
+    int32_t divergence;
+
+    char end;                   // 'l' or 'r'
+    char pad[3];
+} OgBinEdge;
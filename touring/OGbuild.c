@@ -14,6 +14,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 
 #include "lib/colors.h"
@@ -25,17 +27,18 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+#include "OGbin.h"
+
 // read status
 
 #define STATUS_CONTAINED ( 1 << 0 )
 #define STATUS_WIDOW     ( 1 << 1 )
 #define STATUS_PROPER    ( 1 << 2 )
-#define STATUS_USED      ( 1 << 3 )
 #define STATUS_OPTIONAL  ( 1 << 4 )
 
 // graph format
 
-typedef enum { FORMAT_GML, FORMAT_GRAPHML, FORMAT_TGF } GraphFormat;
+typedef enum { FORMAT_GML, FORMAT_GRAPHML, FORMAT_TGF, FORMAT_BIN } GraphFormat;
 
 // contained edges sorting
 
@@ -47,6 +50,12 @@ typedef enum { EDGE_SORT_OVL, EDGE_SORT_OVH } OgEdgeSort;
 #define DEF_ARG_F        "graphml"
 #define DEF_ARG_P        "ovl"
 #define DEF_ARG_T        TRACK_TRIM
+#define DEF_ARG_J        1
+
+// external memory mode, -e
+
+#define EXT_BUCKETS      256            // read ranges the edges are spilled by
+#define EXT_SPILL_EDGES  ( 1 << 20 )    // edges a thread collects before spilling them
 
 // switches
 
@@ -77,11 +86,11 @@ typedef struct
     uint64 stats_edges;
     uint64 stats_redges;
     uint64 stats_symdiscard;
-    uint64 stats_pedges_dropped;
 
     // command line args
 
     char* path_graph;
+    int nthreads;
     int contained;
     int split;
     GraphFormat gformat;
@@ -93,11 +102,10 @@ typedef struct
     int* comp;
     int ncomp;
 
-    // discard during second pass
+    // per thread results of the pass, in file order
 
-    int* discard;
-    int ndiscard;
-    int maxdiscard;
+    struct OgBuildThread** parts;
+    int nparts;
 
     // read -> status
 
@@ -109,11 +117,109 @@ typedef struct
     OgEdge* left;
     OgEdge* right;
 
-    int* curleft;
-    int* curright;
+    // external memory mode, the edges of the pass are spilled to files in path_ext
+    // by buckets of ext_width reads. the final edge lists are mapped files.
+
+    char* path_ext;
+    int ext_width;
+
+    size_t ext_lsize;           // mapped size of left/right
+    size_t ext_rsize;
 
 } OgBuildContext;
 
+// an edge found during the pass, moved to the left or right edges of edge.a afterwards
+
+typedef struct
+{
+    OgEdge edge;
+
+    char side;                  // 'l' or 'r'
+    char reversed;              // edge.a is the B read of the overlap
+} OgBuildEdge;
+
+// edges of a bucket spilled by a thread
+
+typedef struct
+{
+    int bucket;
+    uint64 offset;
+    uint64 n;
+} OgSpillChunk;
+
+// state of a thread of the pass
+
+typedef struct OgBuildThread
+{
+    OgBuildContext* octx;
+
+    OgBuildEdge* edges;
+    uint64 nedges;
+    uint64 maxedges;
+
+    FILE* spill;                // external memory mode, edges grouped by bucket
+    uint64 spilled;             // bytes written to spill
+    OgSpillChunk* chunks;       // in the order they were written
+    int nchunks;
+    int maxchunks;
+    OgBuildEdge* scatter;       // edges of a spill, ordered by bucket
+
+    int* contained;             // reads contained in another one
+    int ncontained;
+    int maxcontained;
+
+    int* symdiscard;            // b, a of the OVL_SYMDISCARD overlaps
+    int nsymdiscard;
+    int maxsymdiscard;
+
+    int* badovh;                // a, b, ovh of the overlaps with a negative overhang
+    int nbadovh;
+    int maxbadovh;
+} OgBuildThread;
+
+// a range of reads processed by a thread
+
+typedef struct
+{
+    OgBuildContext* octx;
+
+    int rb, re;
+    int64 dropped;
+} OgReadRange;
+
+// components written to separate files
+
+typedef struct
+{
+    const char* path;
+    const char* ext;
+
+    int* off;                   // component -> reads[off[c]] .. reads[off[c + 1] - 1]
+    int* reads;
+    int ncomp;
+
+    int nextcomp;
+    pthread_mutex_t lock;
+} OgComponentOutput;
+
+// scratch of a thread writing graphs
+
+typedef struct
+{
+    OgBuildContext* octx;
+    OgComponentOutput* out;
+
+    unsigned char* used;        // read is a node of the graph being written
+    int* nodes;                 // reads with used set
+    int nnodes;
+
+    int* niedges;               // tgf, in and out degree of the nodes
+    int* noedges;
+
+    uint64* offset;             // bin, edge offsets and node flags of all reads
+    unsigned char* node;
+} OgGraphWriter;
+
 // getopt
 
 extern char* optarg;
@@ -121,6 +227,14 @@ extern int optind, opterr, optopt;
 
 // graph output
 
+static int cmp_int(const void* a, const void* b)
+{
+    int* x = (int*)a;
+    int* y = (int*)b;
+
+    return (*x) - (*y);
+}
+
 static void print_graph_graphml_edge(FILE* f, OgEdge* e, char side)
 {
     int div = 100.0 * 2 * e->diffs / ( (e->ae - e->ab) + (e->be - e->bb) );
@@ -171,28 +285,49 @@ static void print_graph_tgf_edge(FILE* f, OgEdge* e, char side)
     fprintf(f, "%d %d %d %d %d %c\n", e->a, e->b, e->ovh, e->flags, div, side);
 }
 
-static void print_graph_tgf(OgBuildContext* octx, FILE* f, int component)
+// mark rid as a node of the graph being written
+
+static void writer_use(OgGraphWriter* w, int rid)
+{
+    if ( !w->used[rid] )
+    {
+        w->used[rid] = 1;
+        w->nodes[ w->nnodes ] = rid;
+        w->nnodes++;
+    }
+}
+
+// put the nodes in read order and clear the marks for the next graph
+
+static void writer_sort_nodes(OgGraphWriter* w)
+{
+    qsort(w->nodes, w->nnodes, sizeof(int), cmp_int);
+
+    int i;
+    for ( i = 0; i < w->nnodes; i++ )
+    {
+        w->used[ w->nodes[i] ] = 0;
+    }
+}
+
+static void print_graph_tgf(OgGraphWriter* w, FILE* f, int* reads, int nreads)
 {
+    OgBuildContext* octx = w->octx;
     uint64* nleft = octx->nleft;
     uint64* nright = octx->nright;
     OgEdge* left = octx->left;
     OgEdge* right = octx->right;
     unsigned char* status = octx->status;
 
-    int* niedges = malloc(sizeof(int) * octx->db->nreads);
-    int* noedges = malloc(sizeof(int) * octx->db->nreads);
-    bzero(niedges, sizeof(int) * octx->db->nreads);
-    bzero(noedges, sizeof(int) * octx->db->nreads);
+    int* niedges = w->niedges;
+    int* noedges = w->noedges;
 
-    int aread;
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
+    int i;
+    for ( i = 0; i < nreads; i++ )
     {
-        if ( !(status[aread] & STATUS_PROPER) )
-        {
-            continue;
-        }
+        int aread = reads ? reads[i] : i;
 
-        if ( component != -1 && octx->comp[aread] != component )
+        if ( !(status[aread] & STATUS_PROPER) )
         {
             continue;
         }
@@ -208,7 +343,7 @@ static void print_graph_tgf(OgBuildContext* octx, FILE* f, int component)
 
             if ( (status[bread] & STATUS_PROPER) )
             {
-                status[bread] |= STATUS_USED;
+                writer_use(w, bread);
                 used = 1;
 
                 noedges[aread]++;
@@ -228,7 +363,7 @@ static void print_graph_tgf(OgBuildContext* octx, FILE* f, int component)
 
             if ( (status[bread] & STATUS_PROPER) )
             {
-                status[bread] |= STATUS_USED;
+                writer_use(w, bread);
                 used = 1;
 
                 noedges[aread]++;
@@ -240,34 +375,31 @@ static void print_graph_tgf(OgBuildContext* octx, FILE* f, int component)
 
         if (used)
         {
-            status[aread] |= STATUS_USED;
+            writer_use(w, aread);
         }
     }
 
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
-    {
-        if ( !(status[aread] & STATUS_USED) )
-        {
-            continue;
-        }
+    writer_sort_nodes(w);
 
+    for ( i = 0; i < w->nnodes; i++ )
+    {
+        int aread = w->nodes[i];
         int optional = (status[aread] & STATUS_OPTIONAL) ? 1 : 0;
 
         fprintf(f, "%d %d %d %d\n", aread, optional, niedges[aread], noedges[aread]);
 
-        status[aread] ^= STATUS_USED;
+        niedges[aread] = noedges[aread] = 0;
     }
 
+    w->nnodes = 0;
+
     fprintf(f, "#\n");
 
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
+    for ( i = 0; i < nreads; i++ )
     {
-        if ( !(status[aread] & STATUS_PROPER) )
-        {
-            continue;
-        }
+        int aread = reads ? reads[i] : i;
 
-        if ( component != -1 && octx->comp[aread] != component )
+        if ( !(status[aread] & STATUS_PROPER) )
         {
             continue;
         }
@@ -302,13 +434,10 @@ static void print_graph_tgf(OgBuildContext* octx, FILE* f, int component)
             b++;
         }
     }
-
-    free(niedges);
-    free(noedges);
 }
 
 
-static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, char** comments, int ncomments, int component)
+static void print_graph_gml(OgGraphWriter* w, FILE* f, const char* title, char** comments, int ncomments, int* reads, int nreads)
 {
     fprintf(f, "graph [\n");
 
@@ -325,21 +454,18 @@ static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, ch
 
     fprintf(f, "  directed 1\n");
 
+    OgBuildContext* octx = w->octx;
     uint64* nleft = octx->nleft;
     uint64* nright = octx->nright;
     OgEdge* left = octx->left;
     OgEdge* right = octx->right;
 
     unsigned char* status = octx->status;
-    int aread;
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
+    for ( i = 0; i < nreads; i++ )
     {
-        if ( !(status[aread] & STATUS_PROPER) )
-        {
-            continue;
-        }
+        int aread = reads ? reads[i] : i;
 
-        if ( component != -1 && octx->comp[aread] != component )
+        if ( !(status[aread] & STATUS_PROPER) )
         {
             continue;
         }
@@ -354,7 +480,7 @@ static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, ch
 
             if ( (status[e->b] & STATUS_PROPER) )
             {
-                status[ e->b ] |= STATUS_USED;
+                writer_use(w, e->b);
                 print_graph_gml_edge(f, e, 'l');
                 used = 1;
             }
@@ -371,7 +497,7 @@ static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, ch
 
             if ( (status[e->b] & STATUS_PROPER) )
             {
-                status[ e->b ] |= STATUS_USED;
+                writer_use(w, e->b);
                 print_graph_gml_edge(f, e, 'r');
                 used = 1;
             }
@@ -381,17 +507,15 @@ static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, ch
 
         if (used)
         {
-            status[aread] |= STATUS_USED;
+            writer_use(w, aread);
         }
     }
 
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
-    {
-        if ( !(status[aread] & STATUS_USED) )
-        {
-            continue;
-        }
+    writer_sort_nodes(w);
 
+    for ( i = 0; i < w->nnodes; i++ )
+    {
+        int aread = w->nodes[i];
         int optional = (status[aread] & STATUS_OPTIONAL) ? 1 : 0;
 
         fprintf(f, "  node [\n");
@@ -399,23 +523,24 @@ static void print_graph_gml(OgBuildContext* octx, FILE* f, const char* title, ch
         fprintf(f, "    read %d\n", aread);
         fprintf(f, "    optional %d\n", optional);
         fprintf(f, "  ]\n");
-
-        status[aread] ^= STATUS_USED;
     }
 
+    w->nnodes = 0;
+
     fprintf(f, "]\n");
 }
 
 
-static void print_graph_graphml(OgBuildContext* octx, FILE* f, const char* title, char** comments, int ncomments, int component)
+static void print_graph_graphml(OgGraphWriter* w, FILE* f, const char* title, char** comments, int ncomments, int* reads, int nreads)
 {
     fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n");
 
+    int i;
+
     if (ncomments)
     {
         fprintf(f, "<!--\n");
 
-        int i;
         for ( i = 0; i < ncomments; i++ )
         {
             fprintf(f, "  %s\n", comments[i]);
@@ -438,21 +563,18 @@ static void print_graph_graphml(OgBuildContext* octx, FILE* f, const char* title
 
     fprintf(f, "  <graph id=\"%s\" edgedefault=\"directed\">\n", title);
 
+    OgBuildContext* octx = w->octx;
     uint64* nleft = octx->nleft;
     uint64* nright = octx->nright;
     OgEdge* left = octx->left;
     OgEdge* right = octx->right;
 
     unsigned char* status = octx->status;
-    int aread;
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
+    for ( i = 0; i < nreads; i++ )
     {
-        if ( !(status[aread] & STATUS_PROPER) )
-        {
-            continue;
-        }
+        int aread = reads ? reads[i] : i;
 
-        if ( component != -1 && octx->comp[aread] != component )
+        if ( !(status[aread] & STATUS_PROPER) )
         {
             continue;
         }
@@ -467,7 +589,7 @@ static void print_graph_graphml(OgBuildContext* octx, FILE* f, const char* title
 
             if ( (status[e->b] & STATUS_PROPER) )
             {
-                status[ e->b ] |= STATUS_USED;
+                writer_use(w, e->b);
                 print_graph_graphml_edge(f, e, 'l');
                 used = 1;
             }
@@ -484,7 +606,7 @@ static void print_graph_graphml(OgBuildContext* octx, FILE* f, const char* title
 
             if ( (status[e->b] & STATUS_PROPER) )
             {
-                status[ e->b ] |= STATUS_USED;
+                writer_use(w, e->b);
                 print_graph_graphml_edge(f, e, 'r');
                 used = 1;
             }
@@ -494,31 +616,157 @@ static void print_graph_graphml(OgBuildContext* octx, FILE* f, const char* title
 
         if (used)
         {
-            status[aread] |= STATUS_USED;
+            writer_use(w, aread);
         }
     }
 
-    for ( aread = 0; aread < octx->db->nreads; aread++ )
-    {
-        if ( !(status[aread] & STATUS_USED) )
-        {
-            continue;
-        }
+    writer_sort_nodes(w);
 
+    for ( i = 0; i < w->nnodes; i++ )
+    {
+        int aread = w->nodes[i];
         int optional = (status[aread] & STATUS_OPTIONAL) ? 1 : 0;
 
         fprintf(f, "    <node id=\"%d\">\n", aread);
         fprintf(f, "      <data key=\"read\">%d</data>\n", aread);
         fprintf(f, "      <data key=\"optional\">%d</data>\n", optional);
         fprintf(f, "    </node>\n");
-
-        status[aread] ^= STATUS_USED;
     }
 
+    w->nnodes = 0;
+
     fprintf(f, "  </graph>\n");
     fprintf(f, "</graphml>\n");
 }
 
+// binary export, see OGbin.h
+
+static void print_graph_bin_edge(FILE* f, OgEdge* e, char side)
+{
+    OgBinEdge be;
+    bzero(&be, sizeof(OgBinEdge));
+
+    be.source = e->a;
+    be.target = e->b;
+    be.length = e->ovh;
+    be.flags = e->flags;
+    be.divergence = 100.0 * 2 * e->diffs / ( (e->ae - e->ab) + (e->be - e->bb) );
+    be.end = side;
+
+    fwrite(&be, sizeof(OgBinEdge), 1, f);
+}
+
+static void print_graph_bin(OgGraphWriter* w, FILE* f, int* reads, int nsources)
+{
+    OgBuildContext* octx = w->octx;
+    uint64* nleft = octx->nleft;
+    uint64* nright = octx->nright;
+    OgEdge* left = octx->left;
+    OgEdge* right = octx->right;
+    unsigned char* status = octx->status;
+    int nreads = octx->db->nreads;
+
+    // the format has offsets and flags for all reads, even for a single component
+
+    uint64* offset = w->offset;
+    unsigned char* node = w->node;
+
+    bzero(offset, sizeof(uint64) * (nreads + 1));
+    bzero(node, nreads);
+
+    // edges per source read and the reads used
+
+    int i;
+    for ( i = 0; i < nsources; i++ )
+    {
+        int aread = reads ? reads[i] : i;
+
+        if ( !(status[aread] & STATUS_PROPER) )
+        {
+            continue;
+        }
+
+        uint64 b;
+        for ( b = nleft[aread]; b < nleft[aread + 1]; b++ )
+        {
+            if ( (status[ left[b].b ] & STATUS_PROPER) )
+            {
+                node[ left[b].b ] |= OG_BIN_NODE_USED;
+                offset[aread]++;
+            }
+        }
+
+        for ( b = nright[aread]; b < nright[aread + 1]; b++ )
+        {
+            if ( (status[ right[b].b ] & STATUS_PROPER) )
+            {
+                node[ right[b].b ] |= OG_BIN_NODE_USED;
+                offset[aread]++;
+            }
+        }
+
+        if (offset[aread])
+        {
+            node[aread] |= OG_BIN_NODE_USED;
+        }
+    }
+
+    uint64 nedges = 0;
+
+    int aread;
+    for ( aread = 0; aread <= nreads; aread++ )
+    {
+        uint64 n = offset[aread];
+        offset[aread] = nedges;
+        nedges += n;
+
+        if ( aread < nreads && (node[aread] & OG_BIN_NODE_USED) && (status[aread] & STATUS_OPTIONAL) )
+        {
+            node[aread] |= OG_BIN_NODE_OPTIONAL;
+        }
+    }
+
+    OgBinHeader header;
+    bzero(&header, sizeof(OgBinHeader));
+
+    header.magic = OG_BIN_MAGIC;
+    header.version = OG_BIN_VERSION;
+    header.nreads = nreads;
+    header.nedges = nedges;
+
+    fwrite(&header, sizeof(OgBinHeader), 1, f);
+    fwrite(offset, sizeof(uint64), nreads + 1, f);
+
+    for ( i = 0; i < nsources; i++ )
+    {
+        int aread = reads ? reads[i] : i;
+
+        if ( offset[aread] == offset[aread + 1] )
+        {
+            continue;
+        }
+
+        uint64 b;
+        for ( b = nleft[aread]; b < nleft[aread + 1]; b++ )
+        {
+            if ( (status[ left[b].b ] & STATUS_PROPER) )
+            {
+                print_graph_bin_edge(f, left + b, 'l');
+            }
+        }
+
+        for ( b = nright[aread]; b < nright[aread + 1]; b++ )
+        {
+            if ( (status[ right[b].b ] & STATUS_PROPER) )
+            {
+                print_graph_bin_edge(f, right + b, 'r');
+            }
+        }
+    }
+
+    fwrite(node, 1, nreads, f);
+}
+
 // assign reads to components
 
 static void assign_component(OgBuildContext* octx)
@@ -672,6 +920,108 @@ static void assign_component(OgBuildContext* octx)
     free(stack_new);
 }
 
+static int uf_find(int* parent, int x)
+{
+    while (parent[x] != x)
+    {
+        parent[x] = parent[ parent[x] ];
+        x = parent[x];
+    }
+
+    return x;
+}
+
+static void uf_union_edges(int* parent, unsigned char* status, OgEdge* edges, uint64 n)
+{
+    uint64 i;
+    for ( i = 0; i < n; i++ )
+    {
+        OgEdge* edge = edges + i;
+
+        if ( !(status[edge->a] & STATUS_PROPER) || !(status[edge->b] & STATUS_PROPER) )
+        {
+            continue;
+        }
+
+        int x = uf_find(parent, edge->a);
+        int y = uf_find(parent, edge->b);
+
+        if (x < y)
+        {
+            parent[y] = x;
+        }
+        else if (y < x)
+        {
+            parent[x] = y;
+        }
+    }
+}
+
+/*
+ * assign reads to components in external memory mode. the mapped edge lists are
+ * streamed once, instead of following the edges of each read. the components are
+ * numbered by their smallest read, reads without proper neighbours get none.
+ */
+
+static void assign_component_streamed(OgBuildContext* octx)
+{
+    int nreads = octx->db->nreads;
+    int* comp = octx->comp;
+    unsigned char* status = octx->status;
+
+    int* parent = malloc( sizeof(int) * nreads );
+    int* size = calloc( nreads, sizeof(int) );
+
+    int i;
+    for (i = 0; i < nreads; i++)
+    {
+        parent[i] = i;
+    }
+
+    uf_union_edges(parent, status, octx->left, octx->nleft[nreads]);
+    uf_union_edges(parent, status, octx->right, octx->nright[nreads]);
+
+    // roots are their set's smallest read and parents are smaller than their children,
+    // hence a single pass in read order points all reads to their root
+
+    for (i = 0; i < nreads; i++)
+    {
+        parent[i] = parent[ parent[i] ];
+
+        if ( status[i] & STATUS_PROPER )
+        {
+            size[ parent[i] ]++;
+        }
+    }
+
+    int curcomp = 0;
+
+    for (i = 0; i < nreads; i++)
+    {
+        int root = parent[i];
+
+        if ( !(status[i] & STATUS_PROPER) || size[root] < 2 )
+        {
+            comp[i] = -1;
+        }
+        else if (root == i)
+        {
+            comp[i] = curcomp++;
+        }
+        else
+        {
+            comp[i] = comp[root];
+        }
+    }
+
+    free(parent);
+    free(size);
+
+    printf("  %d components\n", curcomp);
+
+    octx->ncomp = curcomp;
+}
+
 // sort OgEdge by .a and .b
 
 static int cmp_ogedge(const void* a, const void* b)
@@ -708,31 +1058,10 @@ static int cmp_ogedge_ovl_rev(const void* a, const void* b)
     return ylen - xlen;
 }
 
-static int cmp_int(const void* a, const void* b)
+static int remove_dupes(OgEdge* e, int n)
 {
-    int* x = (int*)a;
-    int* y = (int*)b;
-
-    return (*x) - (*y);
-}
-
-static int cmp_2int(const void* a, const void* b)
-{
-    int* x = (int*)a;
-    int* y = (int*)b;
-
-    if ( x[0] == y[0] )
-    {
-        return x[1] - y[1];
-    }
-
-    return x[0] - y[0];
-}
-
-static int remove_dupes(OgEdge* e, int n)
-{
-    int dropped = 0;
-    OgEdge* prev = e;
+    int dropped = 0;
+    OgEdge* prev = e;
 
     int i;
     for ( i = 1; i < n; i++ )
@@ -780,38 +1109,119 @@ static int remove_lr_dupes(OgEdge* l, int nl, OgEdge* r, int nr)
     return dropped;
 }
 
-static void remove_parallel_edges(OgBuildContext* octx)
+/*
+ * run func on nthreads ranges of reads with about the same number of edges each.
+ * the reads' edge lists are independent of each other, hence the ranges are too.
+ */
+
+static int64 reads_parallel(OgBuildContext* octx, void* (*func)(void*))
 {
-    int64 dropped = 0;
     int nreads = DB_NREADS(octx->db);
+    int nthreads = octx->nthreads;
+    uint64 nedges = octx->nleft[nreads] + octx->nright[nreads];
 
-    printf("parallel edges\n");
+    OgReadRange* ranges = malloc(sizeof(OgReadRange) * nthreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
 
-    int rid;
-    for ( rid = 0; rid < nreads; rid++)
+    int rid = 0;
+    int i;
+    for ( i = 0 ; i < nthreads ; i++ )
     {
-        uint64 lb = octx->nleft[rid];
-        uint64 le = octx->nleft[rid + 1];
+        OgReadRange* range = ranges + i;
+        uint64 target = nedges * (i + 1) / nthreads;
 
-        if ( lb < le )
+        range->octx = octx;
+        range->rb = rid;
+        range->dropped = 0;
+
+        while ( rid < nreads && ( i == nthreads - 1 || octx->nleft[rid] + octx->nright[rid] < target ) )
         {
-            dropped += remove_dupes(octx->left + lb, le - lb);
+            rid++;
         }
 
-        uint64 rb = octx->nright[rid];
-        uint64 re = octx->nright[rid + 1];
+        range->re = rid;
+    }
 
-        if ( rb < re )
+    if (nthreads == 1)
+    {
+        func(ranges);
+    }
+    else
+    {
+        for ( i = 0 ; i < nthreads ; i++ )
         {
-            dropped += remove_dupes(octx->right + rb, re - rb);
+            pthread_create(threads + i, NULL, func, ranges + i);
         }
 
-        if ( lb < le && rb < re )
+        for ( i = 0 ; i < nthreads ; i++ )
         {
-            dropped += remove_lr_dupes(octx->left + lb, le - lb, octx->right + rb, re - rb);
+            pthread_join(threads[i], NULL);
         }
     }
 
+    int64 dropped = 0;
+
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        dropped += ranges[i].dropped;
+    }
+
+    free(ranges);
+    free(threads);
+
+    return dropped;
+}
+
+// drop the parallel edges of a read, given its sorted left and right edges
+
+static int remove_read_dupes(OgEdge* left, uint64 nleft, OgEdge* right, uint64 nright)
+{
+    int dropped = 0;
+
+    if ( nleft > 0 )
+    {
+        dropped += remove_dupes(left, nleft);
+    }
+
+    if ( nright > 0 )
+    {
+        dropped += remove_dupes(right, nright);
+    }
+
+    if ( nleft > 0 && nright > 0 )
+    {
+        dropped += remove_lr_dupes(left, nleft, right, nright);
+    }
+
+    return dropped;
+}
+
+static void* remove_parallel_edges_range(void* arg)
+{
+    OgReadRange* range = arg;
+    OgBuildContext* octx = range->octx;
+
+    int rid;
+    for ( rid = range->rb; rid < range->re; rid++)
+    {
+        uint64 lb = octx->nleft[rid];
+        uint64 le = octx->nleft[rid + 1];
+
+        uint64 rb = octx->nright[rid];
+        uint64 re = octx->nright[rid + 1];
+
+        range->dropped += remove_read_dupes(octx->left + lb, le - lb, octx->right + rb, re - rb);
+    }
+
+    return NULL;
+}
+
+static void remove_parallel_edges(OgBuildContext* octx)
+{
+    printf("parallel edges\n");
+
+    int64 dropped = reads_parallel(octx, remove_parallel_edges_range);
+
     printf("  %'lld parallel edges\n", dropped);
 }
 
@@ -854,13 +1264,21 @@ static void compress_graph(OgBuildContext* octx)
     int dropped = 0;
     int nreads = octx->db->nreads;
 
+    // mapped edge lists of the external memory mode keep their size
+
     dropped += compress_graph_side(octx, octx->left, octx->nleft);
 
-    octx->left = realloc(octx->left, sizeof(OgEdge) * octx->nleft[nreads]);
+    if ( !octx->path_ext )
+    {
+        octx->left = realloc(octx->left, sizeof(OgEdge) * octx->nleft[nreads]);
+    }
 
     dropped += compress_graph_side(octx, octx->right, octx->nright);
 
-    octx->right = realloc(octx->right, sizeof(OgEdge) * octx->nright[nreads]);
+    if ( !octx->path_ext )
+    {
+        octx->right = realloc(octx->right, sizeof(OgEdge) * octx->nright[nreads]);
+    }
 
     if (dropped > 0)
     {
@@ -868,12 +1286,13 @@ static void compress_graph(OgBuildContext* octx)
     }
 }
 
-static void sort_edges(OgBuildContext* octx)
+static void* sort_edges_range(void* arg)
 {
-    printf("sorting edges\n");
+    OgReadRange* range = arg;
+    OgBuildContext* octx = range->octx;
 
     int rid;
-    for ( rid = 0; rid < octx->db->nreads; rid++)
+    for ( rid = range->rb; rid < range->re; rid++)
     {
         uint64 b = octx->nleft[rid];
         uint64 e = octx->nleft[rid + 1];
@@ -885,6 +1304,15 @@ static void sort_edges(OgBuildContext* octx)
 
         qsort(octx->right + b, e - b, sizeof(OgEdge), cmp_ogedge);
     }
+
+    return NULL;
+}
+
+static void sort_edges(OgBuildContext* octx)
+{
+    printf("sorting edges\n");
+
+    reads_parallel(octx, sort_edges_range);
 }
 
 static int proper_edges(OgBuildContext* octx, OgEdge* edge, int n)
@@ -1138,84 +1566,219 @@ static int reduce_edges(OgBuildContext* octx)
 }
 */
 
-static void write_graph(OgBuildContext* octx, const char* path)
+static void writer_init(OgBuildContext* octx, OgGraphWriter* w)
 {
-    if (octx->split)
+    int nreads = octx->db->nreads;
+
+    bzero(w, sizeof(OgGraphWriter));
+
+    w->octx = octx;
+
+    w->used = calloc( nreads, 1 );
+    w->nodes = malloc( sizeof(int) * nreads );
+
+    if (octx->gformat == FORMAT_TGF)
+    {
+        w->niedges = calloc( nreads, sizeof(int) );
+        w->noedges = calloc( nreads, sizeof(int) );
+    }
+    else if (octx->gformat == FORMAT_BIN)
     {
-        char* pathcomp = malloc( strlen(path) + 30 );
+        w->offset = malloc( sizeof(uint64) * (nreads + 1) );
+        w->node = malloc( nreads );
+    }
+}
 
-        int i;
-        for (i = 0; i < octx->ncomp; i++)
-        {
-            char* ext;
-            if (octx->gformat == FORMAT_GML)
-            {
-                ext = "gml";
-            }
-            else if (octx->gformat == FORMAT_TGF)
-            {
-                ext = "tgf";
-            }
-            else
-            {
-                ext = "graphml";
-            }
+static void writer_free(OgGraphWriter* w)
+{
+    free(w->used);
+    free(w->nodes);
+    free(w->niedges);
+    free(w->noedges);
+    free(w->offset);
+    free(w->node);
+}
 
-            sprintf(pathcomp, "%s_%05d.%s", path, i, ext);
+static int print_graph(OgGraphWriter* w, const char* path, int* reads, int nreads)
+{
+    OgBuildContext* octx = w->octx;
+    FILE* f = fopen(path, "w");
 
-            FILE* f = fopen(pathcomp, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "failed to create %s\n", path);
+        return 0;
+    }
 
-            if (f)
-            {
-                if (octx->gformat == FORMAT_GML)
-                {
-                    print_graph_gml(octx, f, "og", NULL, 0, i);
-                }
-                else if (octx->gformat == FORMAT_TGF)
-                {
-                    print_graph_tgf(octx, f, i);
-                }
-                else
-                {
-                    print_graph_graphml(octx, f, "og", NULL, 0, i);
-                }
+    if (octx->gformat == FORMAT_GML)
+    {
+        print_graph_gml(w, f, "og", NULL, 0, reads, nreads);
+    }
+    else if (octx->gformat == FORMAT_TGF)
+    {
+        print_graph_tgf(w, f, reads, nreads);
+    }
+    else if (octx->gformat == FORMAT_BIN)
+    {
+        print_graph_bin(w, f, reads, nreads);
+    }
+    else
+    {
+        print_graph_graphml(w, f, "og", NULL, 0, reads, nreads);
+    }
 
-                fclose(f);
-            }
-            else
-            {
-                fprintf(stderr, "failed to create %s\n", pathcomp);
-            }
+    fclose(f);
+
+    return 1;
+}
+
+// writes the components handed out by the lock
+
+static void* write_components_thread(void* arg)
+{
+    OgGraphWriter* w = arg;
+    OgComponentOutput* out = w->out;
+
+    char* pathcomp = malloc( strlen(out->path) + 30 );
+
+    while (1)
+    {
+        pthread_mutex_lock(&(out->lock));
+
+        int c = out->nextcomp++;
+
+        pthread_mutex_unlock(&(out->lock));
+
+        if (c >= out->ncomp)
+        {
+            break;
         }
 
-        free(pathcomp);
+        sprintf(pathcomp, "%s_%05d.%s", out->path, c, out->ext);
+
+        print_graph(w, pathcomp, out->reads + out->off[c], out->off[c + 1] - out->off[c]);
+    }
+
+    free(pathcomp);
+
+    return NULL;
+}
+
+static void write_graph(OgBuildContext* octx, const char* path)
+{
+    if (!octx->split)
+    {
+        OgGraphWriter w;
+
+        writer_init(octx, &w);
+
+        print_graph(&w, path, NULL, octx->db->nreads);
+
+        writer_free(&w);
+
+        return ;
+    }
+
+    // bucket the reads by component, keeping them in read order
+
+    int nreads = octx->db->nreads;
+    int ncomp = octx->ncomp;
+    int* comp = octx->comp;
+
+    OgComponentOutput out;
+    bzero(&out, sizeof(OgComponentOutput));
+
+    out.path = path;
+    out.ncomp = ncomp;
+    out.off = calloc( ncomp + 1, sizeof(int) );
+    pthread_mutex_init(&(out.lock), NULL);
+
+    if (octx->gformat == FORMAT_GML)
+    {
+        out.ext = "gml";
+    }
+    else if (octx->gformat == FORMAT_TGF)
+    {
+        out.ext = "tgf";
+    }
+    else if (octx->gformat == FORMAT_BIN)
+    {
+        out.ext = "ogb";
     }
     else
     {
-        FILE* f = fopen(path, "w");
+        out.ext = "graphml";
+    }
 
-        if (f)
+    int i;
+    for ( i = 0; i < nreads; i++ )
+    {
+        if ( comp[i] != -1 )
         {
-            if (octx->gformat == FORMAT_GML)
-            {
-                print_graph_gml(octx, f, "og", NULL, 0, -1);
-            }
-            else if (octx->gformat == FORMAT_TGF)
-            {
-                print_graph_tgf(octx, f, -1);
-            }
-            else
-            {
-                print_graph_graphml(octx, f, "og", NULL, 0, -1);
-            }
+            out.off[ comp[i] + 1 ]++;
+        }
+    }
+
+    for ( i = 0; i < ncomp; i++ )
+    {
+        out.off[i + 1] += out.off[i];
+    }
+
+    out.reads = malloc( sizeof(int) * (out.off[ncomp] + 1) );
+    int* cur = malloc( sizeof(int) * (ncomp + 1) );
+
+    memcpy(cur, out.off, sizeof(int) * (ncomp + 1));
+
+    for ( i = 0; i < nreads; i++ )
+    {
+        if ( comp[i] != -1 )
+        {
+            out.reads[ cur[ comp[i] ]++ ] = i;
+        }
+    }
+
+    free(cur);
+
+    // one file per component, written concurrently
+
+    int nthreads = MIN(octx->nthreads, MAX(ncomp, 1));
+    OgGraphWriter* writers = malloc( sizeof(OgGraphWriter) * nthreads );
+    pthread_t* threads = malloc( sizeof(pthread_t) * nthreads );
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        writer_init(octx, writers + i);
+        writers[i].out = &out;
+    }
 
-            fclose(f);
+    if (nthreads == 1)
+    {
+        write_components_thread(writers);
+    }
+    else
+    {
+        for ( i = 0; i < nthreads; i++ )
+        {
+            pthread_create(threads + i, NULL, write_components_thread, writers + i);
         }
-        else
+
+        for ( i = 0; i < nthreads; i++ )
         {
-            fprintf(stderr, "failed to create %s\n", path);
+            pthread_join(threads[i], NULL);
         }
     }
+
+    for ( i = 0; i < nthreads; i++ )
+    {
+        writer_free(writers + i);
+    }
+
+    free(writers);
+    free(threads);
+
+    pthread_mutex_destroy(&(out.lock));
+    free(out.off);
+    free(out.reads);
 }
 
 static void post_build(OgBuildContext* octx)
@@ -1224,11 +1787,16 @@ static void post_build(OgBuildContext* octx)
     printf("  %'llu redges\n", octx->stats_redges);
     printf("  %'llu symmetric discards\n", octx->stats_symdiscard);
 
-    sort_edges(octx);
+    // the external memory mode sorted and compressed the edges bucket by bucket
+
+    if ( !octx->path_ext )
+    {
+        sort_edges(octx);
 
-    remove_parallel_edges(octx);
+        remove_parallel_edges(octx);
 
-    compress_graph(octx);
+        compress_graph(octx);
+    }
 
     if (octx->contained != 0)
     {
@@ -1240,7 +1808,15 @@ static void post_build(OgBuildContext* octx)
     if (octx->split)
     {
         printf("components\n");
-        assign_component(octx);
+
+        if (octx->path_ext)
+        {
+            assign_component_streamed(octx);
+        }
+        else
+        {
+            assign_component(octx);
+        }
     }
 
     write_graph(octx, octx->path_graph);
@@ -1248,11 +1824,16 @@ static void post_build(OgBuildContext* octx)
     free(octx->nleft);
     free(octx->nright);
 
-    free(octx->left);
-    free(octx->right);
-
-    free(octx->curleft);
-    free(octx->curright);
+    if (octx->path_ext)
+    {
+        munmap(octx->left, octx->ext_lsize);
+        munmap(octx->right, octx->ext_rsize);
+    }
+    else
+    {
+        free(octx->left);
+        free(octx->right);
+    }
 
     free(octx->status);
 
@@ -1342,47 +1923,189 @@ static void assign_edge_reversed(OgEdge* edge, Overlap* ovl, int alen, int blen)
     }
 }
 
-static int handler_build(void* _ctx, Overlap* ovls, int novl)
+static void push_ints(int** values, int* n, int* max, int a, int b, int c, int count)
 {
-    OgBuildContext* octx = (OgBuildContext*)_ctx;
-    unsigned char* status = octx->status;
-
-    uint64 edges = 0;
-    uint64 redges = 0;
-    uint64 symdiscard = 0;
+    if (*n + count > *max)
+    {
+        *max = (*max) * 1.2 + 100;
+        *values = realloc(*values, sizeof(int) * (*max));
+    }
 
-    uint64* nleft = octx->nleft;
-    OgEdge* left = octx->left;
-    int* curleft = octx->curleft;
+    int* v = (*values) + (*n);
 
-    uint64* nright = octx->nright;
-    OgEdge* right = octx->right;
-    int* curright = octx->curright;
+    v[0] = a;
 
-    int aread = ovls->aread;
-    int trim_ab, trim_ae;
-    int alen = DB_READ_LEN(octx->db, aread);
+    if (count > 1)
+    {
+        v[1] = b;
+    }
 
-    drop_parallel_edges(ovls, novl);
+    if (count > 2)
+    {
+        v[2] = c;
+    }
 
-    get_trim(octx->db, octx->trimtrack, aread, &trim_ab, &trim_ae);
+    *n += count;
+}
 
-    int i;
-    for ( i = 0; i < novl; i++ )
+static OgEdge* new_edge(OgBuildThread* tctx, char side, char reversed)
+{
+    if (tctx->nedges + 1 > tctx->maxedges)
     {
-        Overlap* ovl = ovls + i;
+        tctx->maxedges = tctx->maxedges * 1.2 + 1000;
+        tctx->edges = realloc(tctx->edges, sizeof(OgBuildEdge) * tctx->maxedges);
+    }
 
-        if (ovl->aread == ovl->bread)
-        {
+    OgBuildEdge* bedge = tctx->edges + tctx->nedges;
+    tctx->nedges++;
+
+    bedge->side = side;
+    bedge->reversed = reversed;
+
+    return &(bedge->edge);
+}
+
+// an unlinked temporary file in the directory of the external memory mode
+
+static FILE* ext_tmpfile(OgBuildContext* octx)
+{
+    char* path = malloc( strlen(octx->path_ext) + 32 );
+    sprintf(path, "%s/OGbuild.XXXXXX", octx->path_ext);
+
+    int fd = mkstemp(path);
+    FILE* f = NULL;
+
+    if (fd != -1)
+    {
+        unlink(path);
+        f = fdopen(fd, "w+");
+    }
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "failed to create a temporary file in %s\n", octx->path_ext);
+        exit(1);
+    }
+
+    free(path);
+
+    return f;
+}
+
+// write the collected edges to the thread's spill file, one chunk per bucket
+
+static void ext_spill(OgBuildThread* tctx)
+{
+    OgBuildContext* octx = tctx->octx;
+    uint64 count[EXT_BUCKETS + 1];
+
+    if (tctx->nedges == 0)
+    {
+        return ;
+    }
+
+    bzero(count, sizeof(count));
+
+    uint64 i;
+    for ( i = 0; i < tctx->nedges; i++ )
+    {
+        count[ tctx->edges[i].edge.a / octx->ext_width + 1 ]++;
+    }
+
+    int k;
+    for ( k = 0; k < EXT_BUCKETS; k++ )
+    {
+        count[k + 1] += count[k];
+    }
+
+    // stable, the edges of a bucket stay in file order
+
+    tctx->scatter = realloc(tctx->scatter, sizeof(OgBuildEdge) * tctx->maxedges);
+
+    for ( i = 0; i < tctx->nedges; i++ )
+    {
+        OgBuildEdge* bedge = tctx->edges + i;
+
+        tctx->scatter[ count[ bedge->edge.a / octx->ext_width ]++ ] = *bedge;
+    }
+
+    uint64 beg = 0;
+
+    for ( k = 0; k < EXT_BUCKETS; k++ )
+    {
+        uint64 n = count[k] - beg;
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        if (tctx->nchunks == tctx->maxchunks)
+        {
+            tctx->maxchunks = tctx->maxchunks * 1.2 + 100;
+            tctx->chunks = realloc(tctx->chunks, sizeof(OgSpillChunk) * tctx->maxchunks);
+        }
+
+        OgSpillChunk* chunk = tctx->chunks + tctx->nchunks;
+        tctx->nchunks++;
+
+        chunk->bucket = k;
+        chunk->offset = tctx->spilled;
+        chunk->n = n;
+
+        if ( fwrite(tctx->scatter + beg, sizeof(OgBuildEdge), n, tctx->spill) != n )
+        {
+            fprintf(stderr, "failed to write to the spill file in %s\n", octx->path_ext);
+            exit(1);
+        }
+
+        tctx->spilled += sizeof(OgBuildEdge) * n;
+        beg = count[k];
+    }
+
+    tctx->nedges = 0;
+}
+
+/*
+ * collects the edges in a single pass. whether an overlap is dropped due to a symmetric
+ * discard is only known once all piles have been seen, hence the edges are kept with
+ * the overlap they came from and placed in the left/right lists by post_build_pass().
+ */
+
+static int handler_build(void* _ctx, Overlap* ovls, int novl)
+{
+    OgBuildThread* tctx = (OgBuildThread*)_ctx;
+    OgBuildContext* octx = tctx->octx;
+
+    int aread = ovls->aread;
+    int trim_ab, trim_ae;
+    int alen = DB_READ_LEN(octx->db, aread);
+
+    drop_parallel_edges(ovls, novl);
+
+    get_trim(octx->db, octx->trimtrack, aread, &trim_ab, &trim_ae);
+
+    int i;
+    for ( i = 0; i < novl; i++ )
+    {
+        Overlap* ovl = ovls + i;
+
+        if (ovl->aread == ovl->bread)
+        {
             continue;
         }
 
+        if ( ovl->flags & OVL_SYMDISCARD )
+        {
+            push_ints(&(tctx->symdiscard), &(tctx->nsymdiscard), &(tctx->maxsymdiscard), ovl->bread, ovl->aread, 0, 2);
+        }
+
         int ab = ovl->path.abpos;
         int ae = ovl->path.aepos;
 
         if (ab == trim_ab && ae == trim_ae)
         {
-            status[aread] = STATUS_CONTAINED;
+            push_ints(&(tctx->contained), &(tctx->ncontained), &(tctx->maxcontained), aread, 0, 0, 1);
             continue;
         }
 
@@ -1404,7 +2127,7 @@ static int handler_build(void* _ctx, Overlap* ovls, int novl)
 
         if ( bb == trim_bb && be == trim_be )
         {
-            status[bread] = STATUS_CONTAINED;
+            push_ints(&(tctx->contained), &(tctx->ncontained), &(tctx->maxcontained), bread, 0, 0, 1);
             continue;
         }
 
@@ -1413,37 +2136,6 @@ static int handler_build(void* _ctx, Overlap* ovls, int novl)
             continue;
         }
 
-        int j = octx->db->reads[aread].flags;
-
-        if ( j != -1 )
-        {
-            int discard = 0;
-            for ( j = 0; j < octx->ndiscard; j += 2)
-            {
-                int a_disc = octx->discard[j];
-                int b_disc = octx->discard[j + 1];
-
-                if ( a_disc > aread )
-                {
-                    break;
-                }
-
-                if ( bread == b_disc )
-                {
-                    discard = 1;
-                    break;
-                }
-            }
-
-            if (discard)
-            {
-                // printf("sym-discard %d -> %d\n", aread, bread);
-                symdiscard += 1;
-
-                continue;
-            }
-        }
-
         if ( ab == trim_ab )
         {
             int ovh = bb - trim_bb;
@@ -1452,41 +2144,20 @@ static int handler_build(void* _ctx, Overlap* ovls, int novl)
             {
                 if (ovh < 0)
                 {
-                    fprintf(stderr, "error: ovh %5d <= 0 %7d -> %7d. Trim track most likely incompatible with overlaps.\n", ovh, aread, bread);
-                    exit(1);
+                    push_ints(&(tctx->badovh), &(tctx->nbadovh), &(tctx->maxbadovh), aread, bread, ovh, 3);
                 }
             }
             else
             {
-                OgEdge* edge = left + nleft[aread] + curleft[aread];
+                OgEdge* edge = new_edge(tctx, 'l', 0);
                 assign_edge(edge, ovl);
                 edge->ovh = ovh;
-                curleft[aread]++;
-
-                edges++;
 
                 if ( ae < trim_ae )
                 {
-                    if ( ovl->flags & OVL_COMP )
-                    {
-                        edge = left + nleft[bread] + curleft[bread];
-                        curleft[bread]++;
-
-                    }
-                    else
-                    {
-                        edge = right + nright[bread] + curright[bread];
-                        curright[bread]++;
-                    }
-
-                    if (status[bread] == STATUS_WIDOW)
-                    {
-                        status[bread] = STATUS_PROPER;
-                    }
-
+                    edge = new_edge(tctx, (ovl->flags & OVL_COMP) ? 'l' : 'r', 1);
                     assign_edge_reversed(edge, ovl, alen, blen);
                     edge->ovh = trim_ae - ae;
-                    redges++;
                 }
             }
         }
@@ -1499,58 +2170,76 @@ static int handler_build(void* _ctx, Overlap* ovls, int novl)
             {
                 if (ovh < 0)
                 {
-                    fprintf(stderr, "error: ovh %5d <= 0 %7d -> %7d. Trim track most likely incompatible with overlaps.\n", ovh, aread, bread);
-                    exit(1);
+                    push_ints(&(tctx->badovh), &(tctx->nbadovh), &(tctx->maxbadovh), aread, bread, ovh, 3);
                 }
             }
             else
             {
-                OgEdge* edge = right + nright[aread] + curright[aread];
+                OgEdge* edge = new_edge(tctx, 'r', 0);
                 assign_edge(edge, ovl);
                 edge->ovh = ovh;
-                curright[aread]++;
-
-                edges++;
 
                 if ( ab > trim_ab )
                 {
-                    if ( ovl->flags & OVL_COMP )
-                    {
-                        edge = right + nright[bread] + curright[bread];
-                        curright[bread]++;
-                    }
-                    else
-                    {
-                        edge = left + nleft[bread] + curleft[bread];
-                        curleft[bread]++;
-                    }
-
-                    if (status[bread] == STATUS_WIDOW)
-                    {
-                        status[bread] = STATUS_PROPER;
-                    }
-
+                    edge = new_edge(tctx, (ovl->flags & OVL_COMP) ? 'r' : 'l', 1);
                     assign_edge_reversed(edge, ovl, alen, blen);
                     edge->ovh = ab - trim_ab;
-                    redges++;
                 }
             }
         }
     }
 
-    if ( status[aread] == STATUS_WIDOW && edges > 0 )
+    if ( tctx->spill && tctx->nedges >= EXT_SPILL_EDGES )
     {
-        status[aread] = STATUS_PROPER;
+        ext_spill(tctx);
     }
 
-    octx->stats_symdiscard += symdiscard;
-    octx->stats_edges += edges;
-    octx->stats_redges += redges;
-
     return 1;
 }
 
-// initialize data structures for pass(es)
+static void* build_thread_init(void* _ctx, int thread)
+{
+    UNUSED(thread);
+
+    OgBuildThread* tctx = malloc(sizeof(OgBuildThread));
+
+    bzero(tctx, sizeof(OgBuildThread));
+    tctx->octx = (OgBuildContext*)_ctx;
+
+    if (tctx->octx->path_ext)
+    {
+        tctx->spill = ext_tmpfile(tctx->octx);
+    }
+
+    return tctx;
+}
+
+static void build_thread_reduce(void* _ctx, void* _tctx, int thread)
+{
+    UNUSED(thread);
+
+    OgBuildContext* octx = (OgBuildContext*)_ctx;
+    OgBuildThread* tctx = (OgBuildThread*)_tctx;
+
+    if (tctx->spill)
+    {
+        ext_spill(tctx);
+
+        free(tctx->edges);
+        free(tctx->scatter);
+
+        tctx->edges = tctx->scatter = NULL;
+        tctx->maxedges = 0;
+
+        fflush(tctx->spill);
+    }
+
+    octx->parts = realloc(octx->parts, sizeof(OgBuildThread*) * (octx->nparts + 1));
+    octx->parts[ octx->nparts ] = (OgBuildThread*)_tctx;
+    octx->nparts++;
+}
+
+// initialize data structures for the pass
 
 static void pre_build(PassContext* pctx, OgBuildContext* octx)
 {
@@ -1578,200 +2267,497 @@ static void pre_build(PassContext* pctx, OgBuildContext* octx)
     octx->nleft = calloc( nreads + 1, sizeof(uint64) );
     octx->nright = calloc( nreads + 1, sizeof(uint64) );
 
-    octx->curleft = calloc( nreads, sizeof(int) );
-    octx->curright = calloc( nreads, sizeof(int) );
-
     octx->comp = malloc( sizeof(int) * nreads );
 }
 
-static int handler_count(void* _ctx, Overlap* ovls, int novl)
+static uint64 to_offsets(uint64* counts, int n)
 {
-    OgBuildContext* octx = (OgBuildContext*)_ctx;
-    uint64* nleft = octx->nleft;
-    uint64* nright = octx->nright;
+    uint64 off = 0;
 
-    int aread = ovls->aread;
-    int trim_ab, trim_ae;
-    // int alen = DB_READ_LEN(octx->db, aread);
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        uint64 coff = counts[i];
+        counts[i] = off;
 
-    drop_parallel_edges(ovls, novl);
+        off += coff;
+    }
 
-    get_trim(octx->db, octx->trimtrack, aread, &trim_ab, &trim_ae);
+    counts[i] = off;
 
-    int i;
-    for ( i = 0; i < novl; i++ )
+    return counts[i];
+}
+
+/*
+ * an overlap a -> b is dropped when another overlap with a as B read has OVL_SYMDISCARD set
+ * and b is the A read of an OVL_SYMDISCARD overlap whose B read is <= a. this is the same
+ * outcome as the scan of the sorted (b, a) pairs the build used to do for each overlap.
+ */
+
+static int symdiscarded(unsigned char* symb, int* symmin, int a, int b)
+{
+    return symb[a] && symmin[b] <= a;
+}
+
+// edges of a bucket spilled by all threads, in file order
+
+static OgBuildEdge* ext_load_bucket(OgBuildContext* octx, int bucket, uint64* _n)
+{
+    uint64 n = 0;
+    int p, i;
+
+    for ( p = 0 ; p < octx->nparts ; p++ )
     {
-        Overlap* ovl = ovls + i;
+        OgBuildThread* part = octx->parts[p];
 
-        if (ovl->aread == ovl->bread)
+        for ( i = 0 ; i < part->nchunks ; i++ )
         {
-            continue;
+            if ( part->chunks[i].bucket == bucket )
+            {
+                n += part->chunks[i].n;
+            }
         }
+    }
 
-        if ( ovl->flags & OVL_SYMDISCARD )
+    OgBuildEdge* edges = malloc( sizeof(OgBuildEdge) * (n + 1) );
+    uint64 cur = 0;
+
+    for ( p = 0 ; p < octx->nparts ; p++ )
+    {
+        OgBuildThread* part = octx->parts[p];
+
+        for ( i = 0 ; i < part->nchunks ; i++ )
         {
-            if (octx->ndiscard + 2 >= octx->maxdiscard)
+            OgSpillChunk* chunk = part->chunks + i;
+
+            if ( chunk->bucket != bucket )
             {
-                octx->maxdiscard = octx->maxdiscard * 1.2 + 100;
-                octx->discard = realloc(octx->discard, sizeof(int) * octx->maxdiscard);
+                continue;
             }
 
-            octx->discard[ octx->ndiscard ] = ovl->bread;
-            octx->discard[ octx->ndiscard + 1 ] = ovl->aread;
+            size_t len = sizeof(OgBuildEdge) * chunk->n;
 
-            octx->ndiscard += 2;
-        }
+            if ( pread(fileno(part->spill), edges + cur, len, chunk->offset) != (ssize_t)len )
+            {
+                fprintf(stderr, "failed to read the spill file in %s\n", octx->path_ext);
+                exit(1);
+            }
 
-        if ( (ovl->flags & OVL_DISCARD) )
-        {
-            continue;
+            cur += chunk->n;
         }
+    }
 
-        int ab = ovl->path.abpos;
-        int ae = ovl->path.aepos;
+    *_n = n;
 
-        if (ab == trim_ab && ae == trim_ae)
-        {
-            continue;
-        }
+    return edges;
+}
 
-        int bread = ovl->bread;
-        int blen = DB_READ_LEN(octx->db, bread);
-        int trim_bb, trim_be;
+// map the edges written to f
 
-        get_trim(octx->db, octx->trimtrack, bread, &trim_bb, &trim_be);
+static OgEdge* ext_map(OgBuildContext* octx, FILE* f, uint64 n, size_t* size)
+{
+    *size = sizeof(OgEdge) * (n + 1);
 
-        if ( ovl->flags & OVL_COMP )
-        {
-            int t = trim_bb;
-            trim_bb = blen - trim_be;
-            trim_be = blen - t;
-        }
+    if ( fflush(f) != 0 || ftruncate(fileno(f), *size) != 0 )
+    {
+        fprintf(stderr, "failed to write the edges to %s\n", octx->path_ext);
+        exit(1);
+    }
 
-        int bb = ovl->path.bbpos;
-        int be = ovl->path.bepos;
+    void* edges = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), 0);
 
-        if ( bb == trim_bb && be == trim_be )
-        {
-            continue;
-        }
+    if (edges == MAP_FAILED)
+    {
+        fprintf(stderr, "failed to map the edges in %s\n", octx->path_ext);
+        exit(1);
+    }
 
-        if ( ab == trim_ab )
+    fclose(f);
+
+    return edges;
+}
+
+/*
+ * external memory version of the edge placement. the buckets are loaded one at a time,
+ * their edges placed, sorted and freed of parallel edges as for all reads in memory,
+ * and appended to the files holding the final left/right lists.
+ */
+
+static void ext_place_edges(OgBuildContext* octx, unsigned char* symb, int* symmin)
+{
+    int nreads = DB_NREADS(octx->db);
+    int width = octx->ext_width;
+    unsigned char* status = octx->status;
+    uint64* nleft = octx->nleft;
+    uint64* nright = octx->nright;
+
+    FILE* fleft = ext_tmpfile(octx);
+    FILE* fright = ext_tmpfile(octx);
+
+    uint64* lcount = malloc( sizeof(uint64) * (width + 1) );
+    uint64* rcount = malloc( sizeof(uint64) * (width + 1) );
+
+    uint64 nl = 0;
+    uint64 nr = 0;
+    uint64 placed_left = 0;
+    uint64 placed_right = 0;
+    int64 dropped = 0;
+
+    int k;
+    for ( k = 0 ; k < EXT_BUCKETS && k * width < nreads ; k++ )
+    {
+        int rb = k * width;
+        int re = MIN(rb + width, nreads);
+        int nb = re - rb;
+
+        uint64 n, j;
+        OgBuildEdge* bedges = ext_load_bucket(octx, k, &n);
+
+        bzero(lcount, sizeof(uint64) * (nb + 1));
+        bzero(rcount, sizeof(uint64) * (nb + 1));
+
+        // count
+
+        for ( j = 0 ; j < n ; j++ )
         {
-            int ovh = bb - trim_bb;
+            OgBuildEdge* bedge = bedges + j;
+            OgEdge* edge = &(bedge->edge);
 
-            if (ovh <= 0)
+            int a = bedge->reversed ? edge->b : edge->a;
+            int b = bedge->reversed ? edge->a : edge->b;
+
+            if ( symdiscarded(symb, symmin, a, b) )
             {
-                if (ovh < 0)
+                if (!bedge->reversed)
                 {
-                    fprintf(stderr, "error: ovh %5d <= 0 %7d -> %7d. Trim track most likely incompatible with overlaps.\n", ovh, aread, bread);
+                    octx->stats_symdiscard++;
                 }
+
+                bedge->side = 0;
+                continue;
+            }
+
+            if (bedge->reversed)
+            {
+                octx->stats_redges++;
             }
             else
             {
-                nleft[aread]++;
+                octx->stats_edges++;
+            }
 
-                if ( ae < trim_ae )
-                {
-                    if ( ovl->flags & OVL_COMP )
-                    {
-                        nleft[bread]++;
-                    }
-                    else
-                    {
-                        nright[bread]++;
-                    }
-                }
+            if ( status[edge->a] == STATUS_WIDOW )
+            {
+                status[edge->a] = STATUS_PROPER;
+            }
+
+            if (bedge->side == 'l')
+            {
+                lcount[edge->a - rb]++;
+            }
+            else
+            {
+                rcount[edge->a - rb]++;
             }
         }
 
-        if ( ae == trim_ae )
+        uint64 bl = to_offsets(lcount, nb);
+        uint64 br = to_offsets(rcount, nb);
+
+        OgEdge* left = malloc( sizeof(OgEdge) * (bl + 1) );
+        OgEdge* right = malloc( sizeof(OgEdge) * (br + 1) );
+
+        // place
+
+        for ( j = 0 ; j < n ; j++ )
         {
-            int ovh = trim_be - be;
+            OgBuildEdge* bedge = bedges + j;
+            OgEdge* edge = &(bedge->edge);
 
-            if ( ovh <= 0 )
+            if (bedge->side == 'l')
             {
-                if (ovh < 0)
+                left[ lcount[edge->a - rb]++ ] = *edge;
+            }
+            else if (bedge->side == 'r')
+            {
+                right[ rcount[edge->a - rb]++ ] = *edge;
+            }
+        }
+
+        free(bedges);
+
+        placed_left += bl;
+        placed_right += br;
+
+        // lcount[i] and rcount[i] are the ends of the edges of read rb + i now.
+        // sort them, drop the parallel edges and compact the remaining ones.
+
+        uint64 lb = 0, rbe = 0;
+        uint64 lkeep = 0, rkeep = 0;
+
+        int i;
+        for ( i = 0 ; i < nb ; i++ )
+        {
+            uint64 le = lcount[i];
+            uint64 ree = rcount[i];
+
+            qsort(left + lb, le - lb, sizeof(OgEdge), cmp_ogedge);
+            qsort(right + rbe, ree - rbe, sizeof(OgEdge), cmp_ogedge);
+
+            dropped += remove_read_dupes(left + lb, le - lb, right + rbe, ree - rbe);
+
+            nleft[rb + i] = nl + lkeep;
+            nright[rb + i] = nr + rkeep;
+
+            for ( ; lb < le ; lb++ )
+            {
+                if ( left[lb].a != -1 && left[lb].b != -1 )
                 {
-                    fprintf(stderr, "error: ovh %5d <= 0 %7d -> %7d. Trim track most likely incompatible with overlaps.\n", ovh, aread, bread);
+                    left[lkeep++] = left[lb];
                 }
             }
-            else
-            {
-                nright[aread]++;
 
-                if ( ab > trim_ab )
+            for ( ; rbe < ree ; rbe++ )
+            {
+                if ( right[rbe].a != -1 && right[rbe].b != -1 )
                 {
-                    if ( ovl->flags & OVL_COMP )
-                    {
-                        nright[bread]++;
-                    }
-                    else
-                    {
-                        nleft[bread]++;
-                    }
+                    right[rkeep++] = right[rbe];
                 }
             }
         }
+
+        if ( fwrite(left, sizeof(OgEdge), lkeep, fleft) != lkeep ||
+             fwrite(right, sizeof(OgEdge), rkeep, fright) != rkeep )
+        {
+            fprintf(stderr, "failed to write the edges to %s\n", octx->path_ext);
+            exit(1);
+        }
+
+        nl += lkeep;
+        nr += rkeep;
+
+        free(left);
+        free(right);
     }
 
-    return 1;
-}
+    nleft[nreads] = nl;
+    nright[nreads] = nr;
 
-static uint64 to_offsets(uint64* counts, int n)
-{
-    uint64 off = 0;
+    free(lcount);
+    free(rcount);
 
-    int i;
-    for (i = 0; i < n; i++)
-    {
-        uint64 coff = counts[i];
-        counts[i] = off;
+    printf("%llu left edges\n", placed_left);
+    printf("%llu right edges\n", placed_right);
 
-        off += coff;
+    printf("parallel edges\n");
+    printf("  %'lld parallel edges\n", dropped);
+
+    // an edge may be a parallel edge of several others
+
+    uint64 removed = placed_left + placed_right - nl - nr;
+
+    if (removed > 0)
+    {
+        printf("removed %llu edges\n", removed);
     }
 
-    counts[i] = off;
+    octx->left = ext_map(octx, fleft, nl, &(octx->ext_lsize));
+    octx->right = ext_map(octx, fright, nr, &(octx->ext_rsize));
 
-    return counts[i];
+    int p;
+    for ( p = 0 ; p < octx->nparts ; p++ )
+    {
+        OgBuildThread* part = octx->parts[p];
+
+        fclose(part->spill);
+        free(part->chunks);
+        free(part->contained);
+        free(part->symdiscard);
+        free(part->badovh);
+        free(part);
+    }
+
+    free(octx->parts);
+    octx->parts = NULL;
+    octx->nparts = 0;
 }
 
-static void post_count(OgBuildContext* octx)
+// apply the symmetric discards, read status and move the edges into exactly sized left/right lists
+
+static void post_build_pass(OgBuildContext* octx)
 {
-    HITS_DB* db = octx->db;
+    int nreads = DB_NREADS(octx->db);
+    unsigned char* status = octx->status;
+    uint64* nleft = octx->nleft;
+    uint64* nright = octx->nright;
 
-    qsort(octx->discard, octx->ndiscard / 2, 2 * sizeof(int), cmp_2int);
+    unsigned char* symb = malloc(nreads);
+    int* symmin = malloc(sizeof(int) * nreads);
 
-    int i;
+    bzero(symb, nreads);
+
+    int i, p;
+    for ( i = 0 ; i < nreads ; i++ )
+    {
+        symmin[i] = INT_MAX;
+    }
+
+    for ( p = 0 ; p < octx->nparts ; p++ )
+    {
+        OgBuildThread* part = octx->parts[p];
+
+        for ( i = 0 ; i < part->nsymdiscard ; i += 2 )
+        {
+            int b = part->symdiscard[i];
+            int a = part->symdiscard[i + 1];
+
+            symb[b] = 1;
+            symmin[a] = MIN(symmin[a], b);
+        }
 
-    for ( i = 0; i < DB_NREADS(octx->db); i++ )
+        for ( i = 0 ; i < part->ncontained ; i++ )
+        {
+            status[ part->contained[i] ] = STATUS_CONTAINED;
+        }
+    }
+
+    for ( p = 0 ; p < octx->nparts ; p++ )
     {
-        octx->db->reads[i].flags = -1;
+        OgBuildThread* part = octx->parts[p];
+
+        for ( i = 0 ; i < part->nbadovh ; i += 3 )
+        {
+            int a = part->badovh[i];
+            int b = part->badovh[i + 1];
+
+            if ( !symdiscarded(symb, symmin, a, b) )
+            {
+                fprintf(stderr, "error: ovh %5d <= 0 %7d -> %7d. Trim track most likely incompatible with overlaps.\n", part->badovh[i + 2], a, b);
+                exit(1);
+            }
+        }
     }
 
-    for ( i = 0; i < octx->ndiscard; i += 2 )
+    if (octx->path_ext)
     {
-        int rid = octx->discard[i];
+        ext_place_edges(octx, symb, symmin);
+
+        free(symb);
+        free(symmin);
 
-        octx->db->reads[ rid ].flags = i;
+        return ;
     }
 
-    int needed;
+    // count
+
+    uint64 j;
+    for ( p = 0 ; p < octx->nparts ; p++ )
+    {
+        OgBuildThread* part = octx->parts[p];
 
-    needed = to_offsets(octx->nleft, db->nreads);
-    octx->left = calloc( needed, sizeof(OgEdge) );
+        for ( j = 0 ; j < part->nedges ; j++ )
+        {
+            OgBuildEdge* bedge = part->edges + j;
+            OgEdge* edge = &(bedge->edge);
 
-    printf("%d left edges\n", needed);
+            int a = bedge->reversed ? edge->b : edge->a;
+            int b = bedge->reversed ? edge->a : edge->b;
 
-    needed = to_offsets(octx->nright, db->nreads);
-    octx->right = calloc( needed, sizeof(OgEdge) );
+            if ( symdiscarded(symb, symmin, a, b) )
+            {
+                if (!bedge->reversed)
+                {
+                    octx->stats_symdiscard++;
+                }
 
-    printf("%d right edges\n", needed);
+                bedge->side = 0;
+                continue;
+            }
+
+            if (bedge->reversed)
+            {
+                octx->stats_redges++;
+            }
+            else
+            {
+                octx->stats_edges++;
+            }
+
+            if ( status[edge->a] == STATUS_WIDOW )
+            {
+                status[edge->a] = STATUS_PROPER;
+            }
+
+            if (bedge->side == 'l')
+            {
+                nleft[edge->a]++;
+            }
+            else
+            {
+                nright[edge->a]++;
+            }
+        }
+    }
+
+    free(symb);
+    free(symmin);
+
+    uint64 needed = to_offsets(nleft, nreads);
+    octx->left = calloc( needed + 1, sizeof(OgEdge) );
+
+    printf("%llu left edges\n", needed);
+
+    needed = to_offsets(nright, nreads);
+    octx->right = calloc( needed + 1, sizeof(OgEdge) );
+
+    printf("%llu right edges\n", needed);
+
+    // place, in file order like the former second pass did
+
+    for ( p = 0 ; p < octx->nparts ; p++ )
+    {
+        OgBuildThread* part = octx->parts[p];
+
+        for ( j = 0 ; j < part->nedges ; j++ )
+        {
+            OgBuildEdge* bedge = part->edges + j;
+            OgEdge* edge = &(bedge->edge);
+
+            if (bedge->side == 'l')
+            {
+                octx->left[ nleft[edge->a]++ ] = *edge;
+            }
+            else if (bedge->side == 'r')
+            {
+                octx->right[ nright[edge->a]++ ] = *edge;
+            }
+        }
+
+        free(part->edges);
+        free(part->contained);
+        free(part->symdiscard);
+        free(part->badovh);
+        free(part);
+    }
+
+    free(octx->parts);
+    octx->parts = NULL;
+    octx->nparts = 0;
+
+    // back to offsets
+
+    for ( i = nreads ; i > 0 ; i-- )
+    {
+        nleft[i] = nleft[i - 1];
+        nright[i] = nright[i - 1];
+    }
+
+    nleft[0] = nright[0] = 0;
 }
 
 static void usage()
 {
-    printf( "usage: [-s] [-c <int>] [-t <track>] [-f gml|graphml|tgf] [-p ovl|ovh] database input.las output.format\n\n" );
+    printf( "usage: [-s] [-c <int>] [-t <track>] [-j <int>] [-e <dir>] [-f gml|graphml|tgf|bin] [-p ovl|ovh] database input.las output.format\n\n" );
 
     printf( "Builds the overlap graph based on the alignments in the input las file.\n\n" );
 
@@ -1780,10 +2766,14 @@ static void usage()
     printf( "         -p mode   which edges should be added when running in -c mode (default %s)\n" , DEF_ARG_P);
     printf( "                   ovl longest overlap, ovh longer overhang\n" );
 
-    printf( "         -f frmt   output graph format. gml, graphml or tgf (default %s)\n", DEF_ARG_F );
+    printf( "         -f frmt   output graph format. gml, graphml, tgf or bin (default %s)\n", DEF_ARG_F );
+    printf( "                   bin is a compact binary format read by OGtour, the others are text\n" );
     printf( "         -s        write on file for each component of the overlap graph.\n" );
     printf( "                   files are named output.<component.number>.format\n" );
     printf( "         -t track  which trim track to use (%s)\n", DEF_ARG_T );
+    printf( "         -j n      number of threads (default %d)\n", DEF_ARG_J );
+    printf( "         -e dir    external memory mode for graphs larger than the main memory. the edges\n" );
+    printf( "                   are kept in temporary files in dir and processed by ranges of reads\n" );
 }
 
 int main(int argc, char* argv[])
@@ -1802,11 +2792,12 @@ int main(int argc, char* argv[])
     char* gformat = DEF_ARG_F;
     octx.contained = DEF_ARG_C;
     octx.trimName = DEF_ARG_T;
+    octx.nthreads = DEF_ARG_J;
 
     opterr = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "sc:f:p:t:")) != -1)
+    while ((c = getopt(argc, argv, "sc:e:f:p:t:j:")) != -1)
     {
         switch (c)
         {
@@ -1830,6 +2821,14 @@ int main(int argc, char* argv[])
                       octx.contained = atoi(optarg);
                       break;
 
+            case 'j':
+                      octx.nthreads = atoi(optarg);
+                      break;
+
+            case 'e':
+                      octx.path_ext = optarg;
+                      break;
+
             default:
                       usage();
                       exit(1);
@@ -1858,6 +2857,10 @@ int main(int argc, char* argv[])
     {
         octx.gformat = FORMAT_TGF;
     }
+    else if ( strcmp(gformat, "bin") == 0 )
+    {
+        octx.gformat = FORMAT_BIN;
+    }
     else
     {
         fprintf(stderr, "error: unknown graph format %s\n", gformat);
@@ -1899,9 +2902,16 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (octx.nthreads < 1)
+    {
+        fprintf(stderr, "invalid number of threads %d\n", octx.nthreads);
+        exit(1);
+    }
+
     // init
 
     octx.db = &db;
+    octx.ext_width = MAX(1, (DB_NREADS(&db) + EXT_BUCKETS - 1) / EXT_BUCKETS);
 
     pctx = pass_init(fileOvlIn, NULL);
 
@@ -1910,21 +2920,25 @@ int main(int argc, char* argv[])
     pctx->progress = 1;
     pctx->data = &octx;
 
-    // pass
+    pctx->thread_init = build_thread_init;
+    pctx->thread_reduce = build_thread_reduce;
 
-    pre_build(pctx, &octx);
+    // balance the threads using the index, if there is an up to date one
 
-    printf(ANSI_COLOR_GREEN "PASS - calculating memory requirements" ANSI_COLOR_RESET "\n");
+    if ( octx.nthreads > 1 && !pctx->is_laz )
+    {
+        pctx->index = lasidx_load(&db, pcPathOverlaps, 0);
+    }
 
-    pass(pctx, handler_count);
+    // pass
 
-    post_count(&octx);
+    pre_build(pctx, &octx);
 
     printf(ANSI_COLOR_GREEN "PASS - building graph" ANSI_COLOR_RESET "\n");
 
-    octx.stats_pedges_dropped = 0;
+    pass_parallel(pctx, handler_build, octx.nthreads);
 
-    pass(pctx, handler_build);
+    post_build_pass(&octx);
 
     printf(ANSI_COLOR_GREEN "processing graph" ANSI_COLOR_RESET "\n");
 
@@ -1934,6 +2948,7 @@ int main(int argc, char* argv[])
 
     Close_DB(&db);
 
+    lasidx_close(pctx->index);
     pass_free(pctx);
 
     fclose(fileOvlIn);
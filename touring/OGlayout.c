@@ -18,6 +18,7 @@
  *                             The ratio used to update the step size across iterations
  *              -d         ... Optimal distance (default: 100)
  *                             The natural length of the springs (edge length). Bigger values mean nodes will be further apart
+ *              -j         ... number of threads (default: 1)
  *
  *  Date    : August 2016
  *
@@ -35,11 +36,10 @@
 #include <float.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "OGlayout.h"
 
-// todo change recursive function calls of calculateForce to get rid of ForceVector mallocs
-
 // constants
 
 #define DEFAULT_QUADTREE_LEVEL  10
@@ -52,6 +52,7 @@
 #define DEFAULT_CONVERGENCE_THRESHOLD 0.0001
 #define DEFAULT_ADAPTIVE_COOLING 0
 #define DEFAULT_RELATIVE_STRENGTH 0.2
+#define DEFAULT_THREADS 1
 
 // switches
 
@@ -182,7 +183,8 @@ int secondAdd(QuadTree *t, Node* n)
 #endif
     divideTree(t);
     t->add = rootAdd;
-    static Node dummy;
+    Node dummy;     // not static, subtrees are built concurrently
+    bzero(&dummy, sizeof(Node));
     dummy.x = t->centerMassX;
     dummy.y = t->centerMassY;
     dummy.id = -1234;
@@ -228,80 +230,133 @@ void initQuadTree(struct QuadTree *t, float posX, float posY, float size)
 
 void divideTree(struct QuadTree *t)
 {
+    QuadTreeArena* arena = t->arena;
     float childSize = t->size / 2;
 
+    assert(arena->cur + 4 <= arena->max);
+
+    t->children = arena->nodes + arena->cur;
+    arena->cur += 4;
+
     initQuadTree(t->children, t->posX + childSize, t->posY + childSize, childSize);
     initQuadTree(t->children + 1, t->posX, t->posY + childSize, childSize);
     initQuadTree(t->children + 2, t->posX, t->posY, childSize);
     initQuadTree(t->children + 3, t->posX + childSize, t->posY, childSize);
 
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        t->children[i].maxLevel = t->maxLevel - 1;
+        t->children[i].arena = arena;
+    }
+
     t->isLeaf = 0;
 }
 
-void deleteQuadTree(QuadTree* t, int maxLevel)
+// number of tree nodes needed for n graph nodes, each one divides at most maxLevel nodes on its way down
+
+static size_t quadTreeCapacity(int maxLevel, size_t n)
 {
-    int i;
+    if (maxLevel <= 0)
+    {
+        return 1;
+    }
 
-    if (t->children != NULL)
+    size_t full = 1;
+    size_t level = 1;
+
+    int i;
+    for (i = 1; i <= maxLevel && full < 1 + 4 * maxLevel * n; i++)
     {
-        for (i = 0; i < 4; i++)
-            deleteQuadTree(t->children + i, maxLevel);
+        level *= 4;
+        full += level;
     }
 
-    if (t->children != NULL)
-        free(t->children);
+    return min(full, 1 + 4 * maxLevel * n);
+}
+
+void deleteQuadTree(QuadTree* t)
+{
+    QuadTreeArena* arena = t->arena;
 
-    if (t->maxLevel == maxLevel)
-        free(t);
+    free(arena->quadrants);
+    free(arena->nodes);
+    free(arena);
 }
 
-QuadTree* createQuadTree(int maxLevel)
+QuadTree* createQuadTree(int maxLevel, int maxNodes)
 {
-    size_t num = 0;
-    int i;
-    for (i = 1; i <= maxLevel; i++)
-        num += pow(4, i);
+    QuadTreeArena* arena = (QuadTreeArena*) malloc(sizeof(QuadTreeArena));
+    assert(arena != NULL);
+
+    // the root, its quadrants and the nodes below them
 
-    QuadTree* tree = (QuadTree*) malloc(sizeof(QuadTree) * (num + 2));
-    assert(tree != NULL);
-    bzero(tree, sizeof(QuadTree) * (num + 2));
+    arena->max = 5 + 4 * quadTreeCapacity(maxLevel - 1, maxNodes);
+    arena->nodes = (QuadTree*) malloc(sizeof(QuadTree) * arena->max);
+    assert(arena->nodes != NULL);
+    bzero(arena->nodes, sizeof(QuadTree));
+    arena->cur = 1;
 
-    QuadTree** list = (QuadTree**) malloc(sizeof(QuadTree*) * ((maxLevel + 1) * 4));
-    int n = 0;
+    arena->quadrants = (QuadTreeArena*) malloc(sizeof(QuadTreeArena) * 4);
 
+    QuadTree* tree = arena->nodes;
     tree->maxLevel = maxLevel;
-    list[n] = tree;
+    tree->arena = arena;
+
+    return tree;
+}
+
+// a quadrant of the root, filled with the nodes of a graph that fall into it
+
+typedef struct
+{
+    QuadTree* tree;
+    Graph* g;
+    int quadrant;
+} QuadrantBuild;
 
-    QuadTree* pos = tree + 1;
+// index of the child of t that addToChildren() would add n to, or -1
 
-    while (n >= 0)
+static int childOf(QuadTree* t, Node* n)
+{
+    int i;
+    for (i = 0; i < 4; i++)
     {
-        QuadTree* t = list[n];
-        n--;
+        QuadTree* c = t->children + i;
 
-        if (t->maxLevel <= 0)
+        if (c->posX <= n->x && n->x <= c->posX + c->size && c->posY <= n->y && n->y <= c->posY + c->size)
         {
-            t->children = NULL;
-            continue;
+            return i;
         }
+    }
+
+    return -1;
+}
+
+static void* buildQuadrant(void* arg)
+{
+    QuadrantBuild* qb = arg;
+    QuadTree* tree = qb->tree;
+    Graph* g = qb->g;
+
+    int i;
+    for (i = 0; i < g->curNodes; i++)
+    {
+        Node* n = g->nodes + i;
 
-        t->children = pos;
-        pos = pos + 4;
-        for (i = 0; i < 4; i++, n++)
+        if (childOf(tree, n) == qb->quadrant)
         {
-            t->children[i].maxLevel = t->maxLevel - 1;
-            list[n + 1] = t->children + i;
+            addNode(tree->children + qb->quadrant, n);
         }
     }
-    free(list);
 
-    return tree;
+    return NULL;
 }
 
-void buildQuadTree(QuadTree* tree, Graph *g)
+void buildQuadTree(QuadTree* tree, Graph *g, int nthreads)
 {
 #if DEBUG
-    printf("buildQuadTree, glevel: %d, mlevel: %d\n", g->level, maxLevel);
+    printf("buildQuadTree, glevel: %d, mlevel: %d\n", g->level, tree->maxLevel);
 #endif
     float minX = FLT_MAX;
     float maxX = -FLT_MAX;
@@ -320,40 +375,86 @@ void buildQuadTree(QuadTree* tree, Graph *g)
     float size = max(maxY - minY, maxX - minX);
     initQuadTree(tree, minX, minY, size);
 
-    for (i = 0; i < g->curNodes; i++)
+    QuadTreeArena* arena = tree->arena;
+    arena->cur = 1;
+
+    if (nthreads < 2 || tree->maxLevel == 0 || g->curNodes < 2)
     {
+        for (i = 0; i < g->curNodes; i++)
+        {
 #if DEBUG
-        printf("add node: id %d, idx %d pos(%f, %f)\n", g->nodes[i].id, g->nodes[i].idx, g->nodes[i].x, g->nodes[i].y);
+            printf("add node: id %d, idx %d pos(%f, %f)\n", g->nodes[i].id, g->nodes[i].idx, g->nodes[i].x, g->nodes[i].y);
 #endif
-        addNode(tree, (g->nodes + i));
+            addNode(tree, (g->nodes + i));
+        }
+
+        return ;
     }
-}
 
-ForceVector* createForceVectorByVector(ForceVector *f)
-{
-    ForceVector *nf = (ForceVector*) malloc(sizeof(ForceVector));
-    nf->x = f->x;
-    nf->y = f->y;
+    /*
+     * the quadrants of the root are independent of each other. the root is split the way
+     * secondAdd() does it, then each quadrant receives its nodes in the same order as in
+     * a sequential build, so the tree is the same.
+     */
 
-    return nf;
-}
+    Node* first = g->nodes;
+    addNode(tree, first);
 
-ForceVector* createForceVectorByPair(float x, float y)
-{
-    ForceVector *nf = (ForceVector*) malloc(sizeof(ForceVector));
-    nf->x = x;
-    nf->y = y;
+    divideTree(tree);
+    tree->add = rootAdd;
 
-    return nf;
-}
+    for (i = 1; i < g->curNodes; i++)
+    {
+        Node* n = g->nodes + i;
 
-ForceVector* createForceVector()
-{
-    ForceVector *nf = (ForceVector*) malloc(sizeof(ForceVector));
-    nf->x = 0;
-    nf->y = 0;
+        if (tree->posX <= n->x && n->x <= tree->posX + tree->size && tree->posY <= n->y && n->y <= tree->posY + tree->size)
+        {
+            assimilateNode(tree, n);
+        }
+    }
+
+    // each quadrant divides its nodes in a separate part of the arena
+
+    size_t count[4] = { 0, 0, 0, 0 };
+
+    for (i = 0; i < g->curNodes; i++)
+    {
+        int c = childOf(tree, g->nodes + i);
+
+        if (c != -1)
+        {
+            count[c]++;
+        }
+    }
+
+    QuadrantBuild qb[4];
+    pthread_t threads[4];
+
+    for (i = 0; i < 4; i++)
+    {
+        QuadTreeArena* quadrant = arena->quadrants + i;
+
+        quadrant->nodes = arena->nodes + arena->cur;
+        quadrant->cur = 0;
+        quadrant->max = quadTreeCapacity(tree->maxLevel - 1, count[i]) - 1;
+        quadrant->quadrants = NULL;
+
+        arena->cur += quadrant->max;
+        assert(arena->cur <= arena->max);
+
+        tree->children[i].arena = quadrant;
+
+        qb[i].tree = tree;
+        qb[i].g = g;
+        qb[i].quadrant = i;
 
-    return nf;
+        pthread_create(threads + i, NULL, buildQuadrant, qb + i);
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
 }
 
 void addForceVectorToForceVector(ForceVector* f1, ForceVector *f2)
@@ -405,13 +506,11 @@ ForceVector* normalizeForceVector(ForceVector *f)
     return &fv;
 }
 
-ForceVector* calculateElectricalForce(ElectricalForce *f, Node* n, QuadTree* t, float dist)
+void calculateElectricalForce(ElectricalForce *f, Node* n, QuadTree* t, float dist, ForceVector *fv)
 {
 #if DEBUG
     printf(" ELECTRICAL_FORCE ");
 #endif
-    ForceVector *fv = createForceVector();
-
     fv->x = t->centerMassX - n->x;
     fv->y = t->centerMassY - n->y;
 
@@ -426,16 +525,13 @@ ForceVector* calculateElectricalForce(ElectricalForce *f, Node* n, QuadTree* t,
 #if DEBUG
     printf("-> final fv: %.3f, %.3f\n", fv->x, fv->y);
 #endif
-    return fv;
 }
 
-ForceVector* calculateSpringForce(SpringForce* f, Node *n1, Node *n2, float dist)
+void calculateSpringForce(SpringForce* f, Node *n1, Node *n2, float dist, ForceVector *fv)
 {
 #if DEBUG
     printf(" SPRING_FORCE ");
 #endif
-    ForceVector *fv = createForceVector();
-
     fv->x = n2->x - n1->x;
     fv->y = n2->y - n1->y;
 
@@ -451,7 +547,6 @@ ForceVector* calculateSpringForce(SpringForce* f, Node *n1, Node *n2, float dist
     {
         multiplyForceVectorByConst(fv, (dist / f->optimalDistance));
     }
-    return fv;
 }
 
 float getForceVectorDistanceToQuadTree(Node *n, QuadTree *t)
@@ -464,7 +559,11 @@ float getForceVectorDistanceToNode(Node *n1, Node *n2)
     return (float) hypot(n1->x - n2->x, n1->y - n2->y);
 }
 
-ForceVector *calculateForce(ElectricalForce* ef, Node* n, QuadTree *t)
+/*
+ * Barnes-Hut force of the tree t on node n, stored in fv. returns 0 if the tree doesn't
+ * exert a force on n. only reads the tree, so the nodes can be processed concurrently.
+ */
+int calculateForce(ElectricalForce* ef, Node* n, QuadTree *t, ForceVector *fv)
 {
 #if DEBUG
     printf("calculate force node %d %f %f and tree cmass %f, %f, mass %d, coord: %f, %f\n", n->id, n->x, n->y, t->centerMassX, t->centerMassY, t->mass, t->posX, t->posY);
@@ -474,7 +573,7 @@ ForceVector *calculateForce(ElectricalForce* ef, Node* n, QuadTree *t)
 #if DEBUG
         printf(" --> mass is 0\n");
 #endif
-        return NULL;
+        return 0;
     }
 
     float distance = getForceVectorDistanceToQuadTree(n, t);
@@ -489,12 +588,13 @@ ForceVector *calculateForce(ElectricalForce* ef, Node* n, QuadTree *t)
 #if DEBUG
             printf(" --> return NULL\n");
 #endif
-            return NULL;
+            return 0;
         }
 #if DEBUG
         printf(" --> calculateElectricalForce(ef, n, t, distance)\n");
 #endif
-        return calculateElectricalForce(ef, n, t, distance);
+        calculateElectricalForce(ef, n, t, distance, fv);
+        return 1;
     }
 
     if (distance * ef->theta > t->size)
@@ -502,12 +602,13 @@ ForceVector *calculateForce(ElectricalForce* ef, Node* n, QuadTree *t)
 #if DEBUG
         printf("--> distance * theta > tree.size()\n");
 #endif
-        ForceVector *tmp = calculateElectricalForce(ef, n, t, distance);
-        multiplyForceVectorByConst(tmp, t->mass);
-        return tmp;
+        calculateElectricalForce(ef, n, t, distance, fv);
+        multiplyForceVectorByConst(fv, t->mass);
+        return 1;
     }
 
-    ForceVector *fr = createForceVector();
+    fv->x = 0;
+    fv->y = 0;
 
     int i;
     for (i = 0; i < 4; i++)
@@ -515,17 +616,16 @@ ForceVector *calculateForce(ElectricalForce* ef, Node* n, QuadTree *t)
 #if DEBUG
         printf("calculate force of child : %d\n", i);
 #endif
-        ForceVector * tmp = calculateForce(ef, n, (t->children + i));
-        if (tmp)
+        ForceVector tmp;
+        if (calculateForce(ef, n, (t->children + i), &tmp))
         {
-            addForceVectorToForceVector(fr, tmp);
-            free(tmp);
+            addForceVectorToForceVector(fv, &tmp);
         }
     }
 #if DEBUG
-    printf(" final force: %f, %f\n", fr->x, fr->y);
+    printf(" final force: %f, %f\n", fv->x, fv->y);
 #endif
-    return fr;
+    return 1;
 }
 
 char *trimwhitespace(char *str)
@@ -2243,7 +2343,7 @@ void sortGraphEdges(Graph *g)
 
 static void usage(FILE* fout, const char* app)
 {
-    fprintf(fout, "usage: %s [-vRS] [-f [dot|graphml]] [-F [dot|svg]] [-qC n] [-tlcsdg f] input.graph output.graph\n\n", app);
+    fprintf(fout, "usage: %s [-vRS] [-f [dot|graphml]] [-F [dot|svg]] [-qCj n] [-tlcsdg f] input.graph output.graph\n\n", app);
 
     fprintf( fout, "Computes a layout for the (usually toured) input graph.\n\n" );
 
@@ -2256,6 +2356,7 @@ static void usage(FILE* fout, const char* app)
     fprintf(fout, "            1  edges and nodes: black, path edges red, contig start/end: green\n");
     fprintf(fout, "            2  edges and nodes: black\n");
     fprintf(fout, "         -R  remove reverse edges from output, i.e. create a directed graph with arbitrary direction\n");
+    fprintf(fout, "         -j n  number of threads (default: 1)\n");
 
     fprintf(fout, "\nlayout:\n");
     fprintf(fout, "         -q n  QuadTree level (default: 10)\n");
@@ -2287,6 +2388,7 @@ static int parseOptions(OgLayoutContext *octx, int argc, char *argv[])
     octx->stepRatio = DEFAULT_STEP_RATIO;
     octx->barnesHutTheta = DEFAULT_BARNESHUT_THETA;
     octx->convergenceThreshold = DEFAULT_CONVERGENCE_THRESHOLD;
+    octx->nthreads = DEFAULT_THREADS;
 
     octx->giformat = FORMAT_UNKNOWN;
     octx->goformat = FORMAT_UNKNOWN;
@@ -2301,7 +2403,7 @@ static int parseOptions(OgLayoutContext *octx, int argc, char *argv[])
     opterr = 0;
 
     int c;
-    while ((c = getopt(argc, argv, "vSRq:t:l:c:s:d:f:F:C:g:")) != -1)
+    while ((c = getopt(argc, argv, "vSRq:t:l:c:s:d:f:F:C:g:j:")) != -1)
     {
         switch (c)
         {
@@ -2349,6 +2451,10 @@ static int parseOptions(OgLayoutContext *octx, int argc, char *argv[])
                 octx->colorScheme = atoi(optarg);
                 break;
 
+            case 'j':
+                octx->nthreads = atoi(optarg);
+                break;
+
             case 'f':
                 giformat = optarg;
                 break;
@@ -2404,6 +2510,12 @@ static int parseOptions(OgLayoutContext *octx, int argc, char *argv[])
         return 1;
     }
 
+    if (octx->nthreads < 1)
+    {
+        fprintf(stderr, "Unsupported number of threads: %d! Should be at least 1\n", octx->nthreads);
+        return 1;
+    }
+
     if (octx->coarseningRate <= 0 && octx->coarseningRate >= 1.0)
     {
         fprintf(stderr, "Unsupported coarsening rate: %f! Allowed range: ] 0, 1 [\n", octx->coarseningRate);
@@ -2700,14 +2812,67 @@ static void resetYifanHuLayout(OgLayoutContext *octx, YifanHuLayout *yfhLayout)
     yfhLayout->step = yfhLayout->initialStep;
 }
 
+// electrical forces on a range of nodes, the tree is shared read-only
+
+typedef struct
+{
+    Graph* g;
+    QuadTree* tree;
+    ElectricalForce* ef;
+
+    int from;
+    int to;
+
+    double energy;
+} ForceThread;
+
+static void* calculateForces(void* arg)
+{
+    ForceThread* ft = arg;
+
+    ft->energy = 0;
+
+    int i;
+    for (i = ft->from; i < ft->to; i++)
+    {
+        Node *n = ft->g->nodes + i;
+        ForceVector fv;
+
+        if (calculateForce(ft->ef, n, ft->tree, &fv))
+        {
+#if DEBUG
+            printf("node %d forcevector %.3f, %.3f, barnesForce: %.3f, %.3f\n", n->id, n->f.x, n->f.y, fv.x, fv.y);
+#endif
+            addForceVectorToForceVector(&(n->f), &fv);
+#if DEBUG
+            printf("apply nodeforce fv: %.3f, %.3f electEnergy: %.3f\n", n->f.x, n->f.y, getForceVectorEnergy(&fv));
+#endif
+            ft->energy += getForceVectorEnergy(&fv);
+        }
+    }
+
+    return NULL;
+}
+
 static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
 {
     YifanHuLayout yfhLayout;
 
-    QuadTree *tree = createQuadTree(octx->quadTreeLevel);
+
+    int nthreads = octx->nthreads;
+    ForceThread* fthreads = malloc(sizeof(ForceThread) * nthreads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
 
     int i;
 
+    int maxNodes = 0;
+    for (i = 0; i <= mlayout->level; i++)
+    {
+        maxNodes = max(maxNodes, mlayout->graphs[i]->curNodes);
+    }
+
+    QuadTree *tree = createQuadTree(octx->quadTreeLevel, maxNodes);
+
     int curLevel = mlayout->level;
     while (curLevel >= 0)
     {
@@ -2725,7 +2890,7 @@ static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
 #if DEBUG
             printf("goAlgo: %d\n", counter++);
 #endif
-            buildQuadTree(tree, tmpGraph);
+            buildQuadTree(tree, tmpGraph, nthreads);
 #if DEBUG
             printf("QUADDTREE: cMass (%.3f, %.3f) pos: (%.3f, %.3f)"
                     " isLeaf %d, eps: %.3f size: %.3f, maxLevel: %d\n", tree->centerMassX, tree->centerMassY, tree->posX, tree->posY, tree->isLeaf, tree->eps, tree->size, tree->maxLevel);
@@ -2740,24 +2905,40 @@ static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
             ef.relativeStrength = yfhLayout.relativeStrength;
             float distance;
 
-            for (i = 0; i < tmpGraph->curNodes; i++)
+            int t;
+            for (t = 0; t < nthreads; t++)
             {
-                Node *n = tmpGraph->nodes + i;
-                ForceVector *fv = calculateForce(&ef, n, tree);
-                if (fv)
+                ForceThread* ft = fthreads + t;
+
+                ft->g = tmpGraph;
+                ft->tree = tree;
+                ft->ef = &ef;
+                ft->from = (size_t)tmpGraph->curNodes * t / nthreads;
+                ft->to = (size_t)tmpGraph->curNodes * (t + 1) / nthreads;
+            }
+
+            if (nthreads == 1)
+            {
+                calculateForces(fthreads);
+            }
+            else
+            {
+                for (t = 0; t < nthreads; t++)
                 {
-#if DEBUG
-                    printf("node %d forcevector %.3f, %.3f, barnesForce: %.3f, %.3f\n", n->id, n->f.x, n->f.y, fv->x, fv->y);
-#endif
-                    addForceVectorToForceVector(&(n->f), fv);
-#if DEBUG
-                    printf("apply nodeforce fv: %.3f, %.3f electEnergy: %.3f\n", n->f.x, n->f.y, getForceVectorEnergy(fv));
-#endif
-                    electricEnergy += getForceVectorEnergy(fv);
-                    free(fv);
+                    pthread_create(threads + t, NULL, calculateForces, fthreads + t);
+                }
+
+                for (t = 0; t < nthreads; t++)
+                {
+                    pthread_join(threads[t], NULL);
                 }
             }
 
+            for (t = 0; t < nthreads; t++)
+            {
+                electricEnergy += fthreads[t].energy;
+            }
+
             // update edge forces
             SpringForce sf;
             sf.optimalDistance = yfhLayout.optimalDistance;
@@ -2772,16 +2953,16 @@ static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
                 Node * n2 = tmpGraph->nodes + e->target;
 
                 distance = getForceVectorDistanceToNode(n1, n2);
-                ForceVector* f = calculateSpringForce(&sf, n1, n2, distance);
+                ForceVector f;
+                calculateSpringForce(&sf, n1, n2, distance, &f);
 #if DEBUG
-                printf("edge: %d - %d dist: %.3f, fv (%.3f, %.3f)(%.3f, %.3f) force: %.3f, %.3f\n", n1->id, n2->id, distance, n1->f.x, n1->f.y, n2->f.x, n2->f.y, f->x, f->y);
+                printf("edge: %d - %d dist: %.3f, fv (%.3f, %.3f)(%.3f, %.3f) force: %.3f, %.3f\n", n1->id, n2->id, distance, n1->f.x, n1->f.y, n2->f.x, n2->f.y, f.x, f.y);
 #endif
-                addForceVectorToForceVector(&(n1->f), f);
-                subtractForceVectorFromForceVector(&(n2->f), f);
+                addForceVectorToForceVector(&(n1->f), &f);
+                subtractForceVectorFromForceVector(&(n2->f), &f);
 #if DEBUG
                 printf("apply edge force: n%d: (%.3f, %.3f), n%d: (%.3f, %.3f)\n", n1->id, n1->f.x, n1->f.y, n2->id, n2->f.x, n2->f.y);
 #endif
-                free(f);
             }
 
             // calculate energy and max force
@@ -2883,7 +3064,6 @@ static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
                 }
             }
 
-//            deleteQuadTree(tree, yfhLayout.quadTreeMaxLevel);
         }
 
         refineGraph(tmpGraph);
@@ -2894,7 +3074,9 @@ static void doYiFanHuLayout(OgLayoutContext *octx, MultiLevelLayout *mlayout)
 #endif
         curLevel--;
     }
-    free(tree);
+    deleteQuadTree(tree);
+    free(fthreads);
+    free(threads);
 }
 
 int main(int argc, char* argv[])
@@ -87,6 +87,7 @@ typedef struct
         float stepRatio;
         float optimalDistance;
         float convergenceThreshold;
+        int nthreads;
 
         char* path_graph_in;
         char* path_graph_out;
@@ -197,6 +198,8 @@ typedef struct MultiLevelLayout
 
 } MultiLevelLayout;
 
+struct QuadTreeArena;
+
 typedef struct QuadTree
 {
         float posX;
@@ -206,16 +209,29 @@ typedef struct QuadTree
         float centerMassY;
         int mass;  // Mass of this tree (the number of nodes it contains)
         int maxLevel;
-        struct QuadTree* children;
+        struct QuadTree* children;  // 4 consecutive nodes of the arena
+        struct QuadTreeArena* arena;
         int (*add)(struct QuadTree*, Node *);
         char isLeaf;
         float eps;
 
 } QuadTree;
 
+// nodes of a QuadTree, handed out in blocks of 4 siblings and reset on every build
+
+typedef struct QuadTreeArena
+{
+        QuadTree* nodes;
+        size_t cur;
+        size_t max;
+
+        struct QuadTreeArena* quadrants;   // sub-arenas of the root quadrants for parallel builds
+} QuadTreeArena;
+
 void initQuadTree(struct QuadTree *t, float posX, float posY, float size);
-QuadTree* createQuadTree(int maxLevel);
-void buildQuadTree(QuadTree* tree, Graph *g);
+QuadTree* createQuadTree(int maxLevel, int maxNodes);
+void deleteQuadTree(QuadTree* t);
+void buildQuadTree(QuadTree* tree, Graph *g, int nthreads);
 int addNode(QuadTree *t, Node* n);
 
 void assimilateNode(QuadTree *t, Node *n);
@@ -227,9 +243,6 @@ int leafAdd(QuadTree *t, Node *n);
 
 void divideTree(struct QuadTree *t);
 
-ForceVector* createForceVectorByVector(ForceVector *f);
-ForceVector* createForceVectorByPair(float x, float y);
-ForceVector* createForceVector();
 void addForceVectorToForceVector(ForceVector* f1, ForceVector *f2);
 void multiplyForceVectorByConst(ForceVector* f1, float s);
 void subtractForceVectorFromForceVector(ForceVector* f1, ForceVector *f2);
@@ -249,9 +262,9 @@ typedef struct SpringForce
         float optimalDistance;
 } SpringForce;
 
-ForceVector* calculateSpringForce(SpringForce* sf, Node *n1, Node *n2, float distance);
-ForceVector* calculateElectricalForce(ElectricalForce* ef, Node* n, QuadTree *t, float distance);
-ForceVector* calculateForce(ElectricalForce* fe, Node* n, QuadTree *t);
+void calculateSpringForce(SpringForce* sf, Node *n1, Node *n2, float distance, ForceVector *fv);
+void calculateElectricalForce(ElectricalForce* ef, Node* n, QuadTree *t, float distance, ForceVector *fv);
+int calculateForce(ElectricalForce* fe, Node* n, QuadTree *t, ForceVector *fv);
 // ForceVector utils
 float getForceVectorDistanceToQuadTree(Node *n, QuadTree *t);
 float getForceVectorDistanceToNode(Node *n1, Node *n2);
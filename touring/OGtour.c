@@ -2,7 +2,10 @@
 /*******************************************************************************************
  *
  *  Tours the overlap graph
- *  (C implementation of touring_v2.py)
+ *  (C implementation of OGtour.py)
+ *
+ *  The weakly connected components of the graph are independent of each other
+ *  and are toured in parallel.
  *
  *  Date    : February 2016
  *
@@ -15,7 +18,19 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#if defined(__APPLE__)
+    #include <sys/syslimits.h>
+#else
+    #include <linux/limits.h>
+#endif
 
 #include "lib/colors.h"
 #include "lib/oflags.h"
@@ -26,8 +41,50 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+#include "OGbin.h"
+
 // defaults
 
+#define DEF_ARG_L 6
+#define DEF_ARG_J 1
+
+// settings (see constants.py)
+
+#define MAX_BB_DISTANCE                     3
+#define PATH_LOOKAHEAD_INCREASE_INVERSION   3
+#define PATH_LOOKAHEAD_MAXPATHS             1000
+
+#define COLORS_DIV_MIN  5       // <=5% goes to same color
+#define COLORS_DIV_MAX  30      // >=30% goes to same color
+
+#define COLOR_GREY      "#F0F0F0"
+#define COLOR_GREEN     "#5FAA60"
+#define COLOR_WHITE     "#FFFFFF"
+
+// edge flags, following the OVL_* flags
+
+#define E_BACKBONE      ( OVL_OPTIONAL << 1 )
+#define E_INVERSION     ( OVL_OPTIONAL << 2 )
+#define E_REMOVED       ( OVL_OPTIONAL << 3 )       // dropped from the graph
+#define E_DROP          ( OVL_OPTIONAL << 4 )       // about to be dropped
+
+#define E_TOUR_FLAGS    ( E_REMOVED | E_DROP )      // not written
+
+// vertex flags
+
+#define V_BACKBONE      ( 1 << 0 )
+#define V_DISCARD       ( 1 << 1 )
+#define V_DEAD_END      ( 1 << 2 )
+#define V_VISITED       ( 1 << 3 )
+#define V_PATH_END      ( 1 << 4 )
+#define V_RETRY         ( 1 << 5 )
+#define V_MODULE        ( 1 << 6 )
+#define V_OPTIONAL      ( 1 << 7 )
+
+// vertex status
+
+#define VS_USED         ( 1 << 0 )      // part of the graph
+#define VS_OPTIONAL     ( 1 << 1 )
 
 // switches
 
@@ -45,30 +102,175 @@ typedef struct
     unsigned short div;
 } OgEdge;
 
+// a path through the graph
+
+typedef struct
+{
+    uint64* edges;
+    int nedges;
+
+    int pid;
+    int vstart;
+    int ends[2];                // path the ends ran into or -1
+} OgPath;
+
+// a weakly connected component
+
+typedef struct
+{
+    int* verts;                 // in read order
+    int nverts;
+
+    int* start;                 // start vertices, best first
+    int nstart;
+
+    OgPath* paths;
+    int npaths;
+    int maxpaths;
+
+    int* potential;             // pairs of vertices of optional edges connecting path ends
+    int npotential;
+    int maxpotential;
+
+    int pathoff;                // global id of the first path
+} OgComponent;
+
 // maintains the state of the app
 
 typedef struct
 {
     HITS_DB* db;
-    HITS_TRACK* trimtrack;
 
     // command line args
 
     char* path_graph_in;
-    char* path_graph_out;
+
+    int nthreads;
+    int dropinversions;
+    int circular;
+    int lookahead;
+    int ilookahead;
 
     // overlap graph
 
-    uint64* nedges;
-    OgEdge* edges;
+    int nreads;
+    unsigned char* vstatus;
+
+    uint64 nedges;
+    OgEdge* edges;              // by source
+
+    uint64* off_out;            // edges leaving v are edges[off_out[v]] .. edges[off_out[v + 1] - 1]
+    uint64* off_in;             // edges entering v are edges[idx_in[off_in[v]]] ..
+    uint64* idx_in;
+
+    // touring state
+
+    int* vflags;
+    int* bbdist;
+    int* vpath;
+
+    // components
+
+    int* comp_pos;              // position of a vertex in its component
+    int* comp_verts;
+    OgComponent* comps;
+    int ncomps;
+    int maxcomp;
+
+    // work distribution
+
+    pthread_mutex_t lock;
+    int nextcomp;
+    int phase;
 
 } OgTourContext;
 
+// one step of a lookahead path
+
+typedef struct
+{
+    uint64 edge;
+    int v;
+} OgStep;
+
+// per thread scratch space
+
+typedef struct
+{
+    OgTourContext* octx;
+
+    // lookahead
+
+    int lookahead;
+
+    OgStep* step;
+    int nstep;
+
+    OgStep* paths;              // lookahead steps each
+    int npaths;
+    int maxpaths;
+
+    int* count;                 // by position in the component
+    int* counted;
+    int ncounted;
+
+    // cleared after use, by position in the component
+
+    int* mark;
+    int* mark2;
+
+    // backbone
+
+    uint64* oedges;
+    int maxoedges;
+
+    uint64* path;
+    int npath;
+    int maxpath;
+
+    uint64* path_d1;
+    int npath_d1;
+    int maxpath_d1;
+
+    int* stack;
+    int* stack_new;
+
+    // path end analysis
+
+    int* ends;
+    int* tgt_off;
+    int* tgt_n;
+
+    uint64* tgt;
+    int maxtgt;
+} OgTourThread;
+
 // getopt
 
 extern char* optarg;
 extern int optind, opterr, optopt;
 
+static void edge_add(OgTourContext* octx, uint64* maxedges,
+                     int source, int target, int ovh, int flags, int div, char end)
+{
+    if (octx->nedges >= *maxedges)
+    {
+        *maxedges = octx->nedges * 1.2 + 1000;
+        octx->edges = realloc(octx->edges, sizeof(OgEdge) * (*maxedges));
+    }
+
+    OgEdge* e = octx->edges + octx->nedges;
+
+    e->source = source;
+    e->target = target;
+    e->ovh = ovh;
+    e->flags = flags;
+    e->div = div;
+    e->end = end;
+
+    octx->nedges++;
+}
+
 static int read_graph_tgf(OgTourContext* octx)
 {
     FILE* fileIn = fopen(octx->path_graph_in, "r");
@@ -81,16 +283,9 @@ static int read_graph_tgf(OgTourContext* octx)
     char* line = NULL;
     size_t maxline = 0;
 
-    int nedgestot = 0;
-    int nreads = octx->db->nreads;
-
-    OgEdge* edges;
-
-    int* curedges = malloc(sizeof(int) * nreads);
-    bzero(curedges, sizeof(int) * nreads);
-
-    uint64* nedges = octx->nedges = malloc(sizeof(uint64) * (nreads + 1));
-    bzero(nedges, sizeof(uint64) * (nreads + 1));
+    int nreads = octx->nreads;
+    uint64 maxedges = 0;
+    unsigned char* vstatus = octx->vstatus;
 
     int parsing_edges = 0;
     int nline = 0;
@@ -101,21 +296,6 @@ static int read_graph_tgf(OgTourContext* octx)
 
         if (line[0] == '#')
         {
-            printf("%d edges\n", nedgestot);
-
-            edges = octx->edges = malloc(sizeof(OgEdge) * nedgestot);
-            bzero(edges, sizeof(OgEdge) * nedgestot);
-
-            // convert counts to offsets
-            int i;
-            uint64 off = 0;
-            for ( i = 0 ; i <= nreads ; i++ )
-            {
-                uint64 coff = nedges[i];
-                nedges[i] = off;
-                off += coff;
-            }
-
             parsing_edges = 1;
 
             continue;
@@ -132,33 +312,19 @@ static int read_graph_tgf(OgTourContext* octx)
                 exit(1);
             }
 
-            OgEdge* e = edges + nedges[source] + curedges[source];
-
-            e->source = source;
-            e->target = target;
-            e->ovh = ovh;
-            e->flags = flags;
-            e->div = div;
-            e->end = end;
-
-            curedges[source]++;
-
-            e = edges + nedges[target] + curedges[target];
-
-            e->source = source;
-            e->target = target;
-            e->ovh = ovh;
-            e->flags = flags;
-            e->div = div;
-            e->end = end;
+            if ( !(vstatus[source] & VS_USED) || !(vstatus[target] & VS_USED) )
+            {
+                fprintf(stderr, "error: edge %d -> %d between unknown reads\n", source, target);
+                exit(1);
+            }
 
-            curedges[target]++;
+            edge_add(octx, &maxedges, source, target, ovh, flags, div, end);
         }
         else
         {
-            int rid, cont, edges_in, edges_out;
+            int rid, optional, edges_in, edges_out;
 
-            if ( sscanf(line, "%d %d %d %d\n", &rid, &cont, &edges_in, &edges_out) != 4 )
+            if ( sscanf(line, "%d %d %d %d\n", &rid, &optional, &edges_in, &edges_out) != 4 )
             {
                 fprintf(stderr, "error: parsing tgf failed at line %d. '%s'\n", nline, line);
                 exit(1);
@@ -170,78 +336,2168 @@ static int read_graph_tgf(OgTourContext* octx)
                 exit(1);
             }
 
-            nedges[rid] += edges_in + edges_out;
-            nedgestot += edges_in + edges_out;
+            vstatus[rid] = VS_USED | (optional ? VS_OPTIONAL : 0);
         }
     }
 
-    free(curedges);
+    free(line);
 
     fclose(fileIn);
 
     return 1;
 }
 
-static void usage()
+// 1 if the file starts with the magic of the binary format
+
+static int is_graph_bin(const char* path)
 {
-    printf("OGtour <db> <overlap_graph.tgf>\n");
-    printf("options:\n");
-};
+    FILE* fileIn = fopen(path, "r");
+    uint32_t magic = 0;
 
-int main(int argc, char* argv[])
+    if (fileIn == NULL)
+    {
+        return 0;
+    }
+
+    if ( fread(&magic, sizeof(uint32_t), 1, fileIn) != 1 )
+    {
+        magic = 0;
+    }
+
+    fclose(fileIn);
+
+    return magic == OG_BIN_MAGIC;
+}
+
+static int read_graph_bin(OgTourContext* octx)
 {
-    HITS_DB db;
-    OgTourContext octx;
+    int fd = open(octx->path_graph_in, O_RDONLY);
 
-    bzero(&octx, sizeof(OgTourContext));
+    if (fd == -1)
+    {
+        return 0;
+    }
 
-    // process arguments
+    struct stat st;
 
-    opterr = 0;
+    if ( fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(OgBinHeader) )
+    {
+        close(fd);
+        return 0;
+    }
+
+    void* graph = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (graph == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    OgBinHeader* header = graph;
+    int nreads = octx->nreads;
+
+    if ( header->magic != OG_BIN_MAGIC || header->version != OG_BIN_VERSION || header->nreads != (uint64)nreads ||
+         (size_t)st.st_size != sizeof(OgBinHeader) + sizeof(uint64) * (nreads + 1) + sizeof(OgBinEdge) * header->nedges + nreads )
+    {
+        fprintf(stderr, "error: malformed graph or graph of a different database\n");
+        munmap(graph, st.st_size);
+        return 0;
+    }
+
+    uint64* offset = (uint64*)(header + 1);
+    OgBinEdge* bedges = (OgBinEdge*)(offset + nreads + 1);
+    unsigned char* node = (unsigned char*)(bedges + header->nedges);
+
+    int r;
+    for ( r = 0 ; r < nreads ; r++ )
+    {
+        if ( node[r] & OG_BIN_NODE_USED )
+        {
+            octx->vstatus[r] = VS_USED | ( (node[r] & OG_BIN_NODE_OPTIONAL) ? VS_OPTIONAL : 0 );
+        }
+    }
+
+    uint64 maxedges = header->nedges;
+    octx->edges = malloc(sizeof(OgEdge) * (maxedges + 1));
+
+    uint64 i;
+    for ( i = 0 ; i < header->nedges ; i++ )
+    {
+        OgBinEdge* be = bedges + i;
 
+        if ( be->source < 0 || be->source >= nreads ||
+             be->target < 0 || be->target >= nreads ||
+             !(node[be->source] & OG_BIN_NODE_USED) || !(node[be->target] & OG_BIN_NODE_USED) )
+        {
+            fprintf(stderr, "error: invalid read id in edge %llu\n", i);
+            exit(1);
+        }
+
+        edge_add(octx, &maxedges, be->source, be->target, be->length, be->flags, be->divergence, be->end);
+    }
+
+    munmap(graph, st.st_size);
+
+    return 1;
+}
+
+// sort the edges by source and index them by target
+
+static void graph_index(OgTourContext* octx)
+{
+    int nreads = octx->nreads;
+    uint64 nedges = octx->nedges;
+    OgEdge* edges = octx->edges;
+
+    uint64* off_out = octx->off_out = malloc(sizeof(uint64) * (nreads + 1));
+    uint64* off_in = octx->off_in = malloc(sizeof(uint64) * (nreads + 1));
+
+    bzero(off_out, sizeof(uint64) * (nreads + 1));
+    bzero(off_in, sizeof(uint64) * (nreads + 1));
+
+    uint64 i;
+    for ( i = 0 ; i < nedges ; i++ )
+    {
+        off_out[ edges[i].source ]++;
+        off_in[ edges[i].target ]++;
+    }
+
+    uint64 off_o = 0;
+    uint64 off_i = 0;
+    int r;
+    for ( r = 0 ; r <= nreads ; r++ )
+    {
+        uint64 coff = off_out[r];
+        off_out[r] = off_o;
+        off_o += coff;
+
+        coff = off_in[r];
+        off_in[r] = off_i;
+        off_i += coff;
+    }
+
+    // stable, keeps the edges of a read in file order
+
+    OgEdge* sorted = malloc(sizeof(OgEdge) * (nedges + 1));
+    uint64* cur = malloc(sizeof(uint64) * (nreads + 1));
+
+    memcpy(cur, off_out, sizeof(uint64) * (nreads + 1));
+
+    for ( i = 0 ; i < nedges ; i++ )
+    {
+        sorted[ cur[ edges[i].source ]++ ] = edges[i];
+    }
+
+    free(edges);
+    edges = octx->edges = sorted;
+
+    uint64* idx_in = octx->idx_in = malloc(sizeof(uint64) * (nedges + 1));
+
+    memcpy(cur, off_in, sizeof(uint64) * (nreads + 1));
+
+    for ( i = 0 ; i < nedges ; i++ )
+    {
+        idx_in[ cur[ edges[i].target ]++ ] = i;
+    }
+
+    free(cur);
+}
+
+// weakly connected components, the unit of parallelism
+
+static int find_root(int* parent, int v)
+{
+    int root = v;
+
+    while (parent[root] != root)
+    {
+        root = parent[root];
+    }
+
+    while (parent[v] != root)
+    {
+        int next = parent[v];
+        parent[v] = root;
+        v = next;
+    }
+
+    return root;
+}
+
+static void graph_components(OgTourContext* octx)
+{
+    int nreads = octx->nreads;
+    OgEdge* edges = octx->edges;
+    unsigned char* vstatus = octx->vstatus;
+
+    int* parent = malloc(sizeof(int) * nreads);
+
+    int r;
+    for ( r = 0 ; r < nreads ; r++ )
+    {
+        parent[r] = r;
+    }
+
+    uint64 i;
+    for ( i = 0 ; i < octx->nedges ; i++ )
+    {
+        int a = find_root(parent, edges[i].source);
+        int b = find_root(parent, edges[i].target);
+
+        if (a != b)
+        {
+            parent[ MAX(a, b) ] = MIN(a, b);
+        }
+    }
+
+    // number the components in the order of their first read
+
+    int* comp = malloc(sizeof(int) * nreads);
+    int* size = malloc(sizeof(int) * (nreads + 1));
+    int ncomps = 0;
+
+    for ( r = 0 ; r < nreads ; r++ )
+    {
+        comp[r] = -1;
+
+        if ( !(vstatus[r] & VS_USED) )
+        {
+            continue;
+        }
+
+        int root = find_root(parent, r);
+
+        if (root == r)
+        {
+            size[ncomps] = 0;
+            comp[r] = ncomps++;
+        }
+        else
+        {
+            comp[r] = comp[root];
+        }
+
+        size[ comp[r] ]++;
+    }
+
+    OgComponent* comps = octx->comps = malloc(sizeof(OgComponent) * (ncomps + 1));
+    int* comp_verts = octx->comp_verts = malloc(sizeof(int) * (nreads + 1));
+    int* comp_pos = octx->comp_pos = malloc(sizeof(int) * (nreads + 1));
+
+    bzero(comps, sizeof(OgComponent) * (ncomps + 1));
+
+    int off = 0;
     int c;
-    while ((c = getopt(argc, argv, "")) != -1)
+    for ( c = 0 ; c < ncomps ; c++ )
     {
-        switch (c)
+        comps[c].verts = comp_verts + off;
+        off += size[c];
+
+        octx->maxcomp = MAX(octx->maxcomp, size[c]);
+    }
+
+    for ( r = 0 ; r < nreads ; r++ )
+    {
+        if ( comp[r] == -1 )
         {
-            default:
-                      usage();
-                      exit(1);
+            comp_pos[r] = -1;
+            continue;
         }
+
+        OgComponent* cp = comps + comp[r];
+
+        comp_pos[r] = cp->nverts;
+        cp->verts[ cp->nverts++ ] = r;
     }
 
-    if (argc - optind < 2)
+    octx->ncomps = ncomps;
+
+    free(parent);
+    free(comp);
+    free(size);
+}
+
+static char reverse(char dir)
+{
+    if (dir == 'l')
     {
-        usage();
-        exit(1);
+        return 'r';
     }
 
-    char* pcPathReadsIn = argv[optind++];
-    octx.path_graph_in = argv[optind++];
+    return 'l';
+}
 
-    if (Open_DB(pcPathReadsIn, &db))
+// edges a lookahead path may continue with
+
+static int lookahead_edge(OgEdge* e, char next_dir)
+{
+    if ( e->flags & (E_REMOVED | OVL_OPTIONAL | E_INVERSION) )
     {
-        fprintf(stderr, "could not open '%s'\n", pcPathReadsIn);
-        exit(1);
+        return 0;
     }
 
-    // init
+    // stay on the same strand
 
-    octx.db = &db;
+    if ( next_dir && e->end != next_dir )
+    {
+        return 0;
+    }
 
-    // work
+    return 1;
+}
 
-    printf("reading graph\n");
+static int best_next_node_rec(OgTourThread* tctx, int vstart, char next_dir, int maxpaths)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int lookahead = tctx->lookahead;
 
-    if (!read_graph_tgf(&octx))
+    // max lookahead reached
+
+    if (tctx->nstep == lookahead)
     {
-        fprintf(stderr, "error: failed to read %s\n", octx.path_graph_in);
-        exit(1);
+        if (tctx->npaths + 1 > tctx->maxpaths)
+        {
+            tctx->maxpaths = tctx->maxpaths * 1.2 + 100;
+            tctx->paths = realloc(tctx->paths, sizeof(OgStep) * lookahead * tctx->maxpaths);
+        }
+
+        memcpy(tctx->paths + (uint64)tctx->npaths * lookahead, tctx->step, sizeof(OgStep) * lookahead);
+        tctx->npaths++;
+
+        return (tctx->npaths <= maxpaths);
     }
 
-    // cleanup
+    uint64 b = octx->off_out[vstart];
+    uint64 e = octx->off_out[vstart + 1];
+    uint64 k;
+    int maxpaths_inc = 0;
+
+    if (tctx->nstep == 0)
+    {
+        int noedges = 0;
+
+        for ( k = b ; k < e ; k++ )
+        {
+            noedges += lookahead_edge(edges + k, next_dir);
+        }
+
+        maxpaths = MAX(1, maxpaths / (noedges + 1));
+        maxpaths_inc = maxpaths;
+    }
+
+    for ( k = b ; k < e ; k++ )
+    {
+        OgEdge* edge = edges + k;
+
+        if ( !lookahead_edge(edge, next_dir) )
+        {
+            continue;
+        }
+
+        char cur_dir = edge->end;
+
+        if (edge->flags & OVL_COMP)
+        {
+            cur_dir = reverse(cur_dir);
+        }
+
+        OgStep* step = tctx->step + tctx->nstep;
+        step->edge = k;
+        step->v = edge->target;
+
+        tctx->nstep++;
+
+        int status = best_next_node_rec(tctx, edge->target, cur_dir, maxpaths);
+
+        tctx->nstep--;
+
+        maxpaths += maxpaths_inc;
+
+        if (tctx->nstep > 0 && !status)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * most frequent vertex in the lookahead paths starting at vstart and the vertex
+ * following vstart on the shortest path to it. edges leading back to a vertex
+ * already on the path are flagged as inversions.
+ */
+
+static int best_next_node(OgTourThread* tctx, int vstart, char next_dir, int lookahead)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* vflags = octx->vflags;
+    int* comp_pos = octx->comp_pos;
+    int* count = tctx->count;
+    int* counted = tctx->counted;
+
+    tctx->lookahead = lookahead;
+    tctx->nstep = 0;
+    tctx->npaths = 0;
+    tctx->ncounted = 0;
+
+    best_next_node_rec(tctx, vstart, next_dir, PATH_LOOKAHEAD_MAXPATHS);
+
+    int p, i, j;
+    for ( p = 0 ; p < tctx->npaths ; p++ )
+    {
+        OgStep* path = tctx->paths + (uint64)p * lookahead;
+
+        // vstart isn't considered seen, same as in OGtour.py
+
+        for ( i = 0 ; i < lookahead ; i++ )
+        {
+            int vnext = path[i].v;
+
+            for ( j = 0 ; j < i && path[j].v != vnext ; j++ ) ;
+
+            if (j < i)
+            {
+                edges[ path[i].edge ].flags |= E_INVERSION;
+                continue;
+            }
+
+            if ( count[ comp_pos[vnext] ]++ == 0 )
+            {
+                counted[ tctx->ncounted++ ] = vnext;
+            }
+        }
+    }
+
+    // most frequent vertex not in a module, ties go to the one encountered first
+
+    int maxv = -1;
+    int maxn = 0;
+    int maxv_mod = -1;
+    int maxn_mod = 0;
+
+    for ( i = 0 ; i < tctx->ncounted ; i++ )
+    {
+        int v = counted[i];
+        int n = count[ comp_pos[v] ];
+
+        count[ comp_pos[v] ] = 0;
+
+        if (n > maxn_mod)
+        {
+            maxn_mod = n;
+            maxv_mod = v;
+        }
+
+        if ( !(vflags[v] & V_MODULE) && n > maxn )
+        {
+            maxn = n;
+            maxv = v;
+        }
+    }
+
+    if (maxv == -1)
+    {
+        maxv = maxv_mod;
+    }
+
+    if (maxv == -1)
+    {
+        return -1;
+    }
+
+    int fminn = lookahead + 1;
+    int fminv = -1;
+
+    int fminn_mod = lookahead + 1;
+    int fminv_mod = -1;
+
+    for ( p = 0 ; p < tctx->npaths ; p++ )
+    {
+        OgStep* path = tctx->paths + (uint64)p * lookahead;
+        int has_mod = 0;
+
+        for ( i = 0 ; i < lookahead ; i++ )
+        {
+            if ( vflags[ path[i].v ] & V_MODULE )
+            {
+                has_mod = 1;
+            }
+
+            if ( path[i].v == maxv )
+            {
+                break;
+            }
+        }
+
+        if (i == lookahead)
+        {
+            continue;
+        }
+
+        if (has_mod)
+        {
+            if (i < fminn_mod)
+            {
+                fminn_mod = i;
+                fminv_mod = path[0].v;
+            }
+        }
+        else if (i < fminn)
+        {
+            fminn = i;
+            fminv = path[0].v;
+        }
+    }
+
+    if (fminv != -1)
+    {
+        return fminv;
+    }
+
+    return fminv_mod;
+}
+
+// end of v an edge leaves from
+
+static char edge_end_at(OgEdge* e, int v)
+{
+    if ( e->source != v && !(e->flags & OVL_COMP) )
+    {
+        return reverse(e->end);
+    }
+
+    return e->end;
+}
+
+static int is_dead_end(OgTourContext* octx, int v)
+{
+    OgEdge* edges = octx->edges;
+    int l = 0;
+    int r = 0;
+    uint64 k;
+
+    for ( k = octx->off_in[v] ; k < octx->off_in[v + 1] ; k++ )
+    {
+        OgEdge* e = edges + octx->idx_in[k];
+
+        if ( !(e->flags & E_REMOVED) )
+        {
+            if (edge_end_at(e, v) == 'l') l++; else r++;
+        }
+    }
+
+    for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+    {
+        OgEdge* e = edges + k;
+
+        if ( !(e->flags & E_REMOVED) )
+        {
+            if (edge_end_at(e, v) == 'l') l++; else r++;
+        }
+    }
+
+    return (l == 0 || r == 0);
+}
+
+static double vertex_quality(OgTourContext* octx, int v)
+{
+    OgEdge* edges = octx->edges;
+    int n = 0;
+    int endl = 0;
+    int endr = 0;
+    uint64 k;
+
+    for ( k = octx->off_in[v] ; k < octx->off_in[v + 1] ; k++ )
+    {
+        OgEdge* e = edges + octx->idx_in[k];
+
+        if ( e->flags & (E_REMOVED | OVL_OPTIONAL | OVL_MODULE) )
+        {
+            continue;
+        }
+
+        n++;
+
+        if (e->end == 'l') endl++; else endr++;
+    }
+
+    for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+    {
+        OgEdge* e = edges + k;
+
+        if ( e->flags & (E_REMOVED | OVL_OPTIONAL | OVL_MODULE) )
+        {
+            continue;
+        }
+
+        n++;
+
+        if (e->end == 'l') endl++; else endr++;
+    }
+
+    if (n == 0)
+    {
+        return DBL_MAX;
+    }
+
+    return ( 1.0 / MAX(1, MIN(10, endl)) ) + ( 1.0 / MAX(1, MIN(10, endr)) );
+}
+
+typedef struct
+{
+    double quality;
+    int v;
+} OgStart;
+
+static int cmp_start(const void* x, const void* y)
+{
+    const OgStart* a = x;
+    const OgStart* b = y;
+
+    if (a->quality < b->quality)
+    {
+        return -1;
+    }
+    else if (a->quality > b->quality)
+    {
+        return 1;
+    }
+
+    return a->v - b->v;
+}
+
+static void update_bbdist(OgTourThread* tctx, OgComponent* comp)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* vflags = octx->vflags;
+    int* bbdist = octx->bbdist;
+    int* comp_pos = octx->comp_pos;
+    int* mark = tctx->mark;
+
+    int* stack = tctx->stack;
+    int* stack_new = tctx->stack_new;
+    int nstack = 0;
+
+    int i;
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        if ( (octx->vstatus[v] & VS_USED) && (vflags[v] & V_BACKBONE) && bbdist[v] == -1 )
+        {
+            stack[nstack++] = v;
+        }
+    }
+
+    int dist = 0;
+
+    while (nstack > 0 && dist < MAX_BB_DISTANCE)
+    {
+        int nstack_new = 0;
+
+        for ( i = 0 ; i < nstack ; i++ )
+        {
+            bbdist[ stack[i] ] = dist;
+        }
+
+        for ( i = 0 ; i < nstack ; i++ )
+        {
+            int v = stack[i];
+            uint64 k;
+
+            for ( k = octx->off_in[v] ; k < octx->off_in[v + 1] + (octx->off_out[v + 1] - octx->off_out[v]) ; k++ )
+            {
+                // in edges followed by the out edges
+
+                OgEdge* e;
+
+                if (k < octx->off_in[v + 1])
+                {
+                    e = edges + octx->idx_in[k];
+                }
+                else
+                {
+                    e = edges + octx->off_out[v] + (k - octx->off_in[v + 1]);
+                }
+
+                if ( e->flags & (E_REMOVED | OVL_OPTIONAL) )
+                {
+                    continue;
+                }
+
+                int vnext = (e->source == v) ? e->target : e->source;
+                int distnext = bbdist[vnext];
+
+                if ( (distnext == -1 || distnext > dist) && !mark[ comp_pos[vnext] ] )
+                {
+                    mark[ comp_pos[vnext] ] = 1;
+                    stack_new[nstack_new++] = vnext;
+                }
+            }
+        }
+
+        for ( i = 0 ; i < nstack_new ; i++ )
+        {
+            mark[ comp_pos[ stack_new[i] ] ] = 0;
+        }
+
+        int* temp = stack;
+        stack = stack_new;
+        stack_new = temp;
+
+        nstack = nstack_new;
+        dist++;
+    }
+}
+
+static void path_push(uint64** path, int* npath, int* maxpath, uint64 e)
+{
+    if (*npath + 1 > *maxpath)
+    {
+        *maxpath = (*maxpath) * 1.2 + 100;
+        *path = realloc(*path, sizeof(uint64) * (*maxpath));
+    }
+
+    (*path)[ (*npath)++ ] = e;
+}
+
+// out edges of v by decreasing length
+
+static int sorted_out_edges(OgTourThread* tctx, int v)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    uint64 b = octx->off_out[v];
+    uint64 e = octx->off_out[v + 1];
+
+    if ( (int)(e - b) > tctx->maxoedges )
+    {
+        tctx->maxoedges = (e - b) * 1.2 + 100;
+        tctx->oedges = realloc(tctx->oedges, sizeof(uint64) * tctx->maxoedges);
+    }
+
+    uint64* oedges = tctx->oedges;
+    int n = 0;
+
+    for ( ; b < e ; b++ )
+    {
+        if ( edges[b].flags & E_REMOVED )
+        {
+            continue;
+        }
+
+        int i = n;
+
+        while ( i > 0 && edges[ oedges[i - 1] ].ovh < edges[b].ovh )
+        {
+            oedges[i] = oedges[i - 1];
+            i--;
+        }
+
+        oedges[i] = b;
+        n++;
+    }
+
+    return n;
+}
+
+static int64 edge_reverse(OgTourContext* octx, int source, int target)
+{
+    OgEdge* edges = octx->edges;
+    uint64 k;
+
+    for ( k = octx->off_out[source] ; k < octx->off_out[source + 1] ; k++ )
+    {
+        if ( edges[k].target == target && !(edges[k].flags & E_REMOVED) )
+        {
+            return k;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * follow the best edges starting at vstart in one direction until a dead end
+ * or another path is reached, then turn around and go the other way.
+ */
+
+static void backbone(OgTourThread* tctx, int vstart, int bid, OgPath* result)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* vflags = octx->vflags;
+    int* vpath = octx->vpath;
+
+    tctx->npath = 0;
+    tctx->npath_d1 = 0;
+
+    vflags[vstart] |= V_BACKBONE | V_VISITED;
+    int v = vstart;
+
+    char next_dir = 0;
+    char first_dir = 0;
+    int other_dir = 0;
+
+    int ends[2];
+    int nends = 0;
+
+    while (1)
+    {
+        // get the best next node
+
+        uint64 emin = 0;
+        int vmin = -1;
+        char next_dir_min = 0;
+
+        int retry = 0;
+        int terminate = 0;
+
+        int vbestnext = best_next_node(tctx, v, next_dir ? next_dir : 'l', octx->lookahead);
+
+        int noedges = sorted_out_edges(tctx, v);
+        int i;
+
+        for ( i = 0 ; i < noedges ; i++ )
+        {
+            uint64 e = tctx->oedges[i];
+            int eflag = edges[e].flags;
+
+            if ( eflag & (E_INVERSION | OVL_OPTIONAL) )
+            {
+                continue;
+            }
+
+            int vnext = edges[e].target;
+            char cur_dir = edges[e].end;
+
+            // make sure we don't turn around
+
+            if (next_dir && cur_dir != next_dir)
+            {
+                continue;
+            }
+
+            if (eflag & OVL_COMP)
+            {
+                cur_dir = reverse(cur_dir);
+            }
+
+            if (vflags[vnext] & V_VISITED)
+            {
+                if (octx->circular)
+                {
+                    uint64* temp = tctx->path_d1;
+                    tctx->path_d1 = tctx->path;
+                    tctx->path = temp;
+
+                    int tmax = tctx->maxpath_d1;
+                    tctx->maxpath_d1 = tctx->maxpath;
+                    tctx->maxpath = tmax;
+
+                    tctx->npath_d1 = tctx->npath;
+                    tctx->npath = 0;
+
+                    retry = 0;
+                    other_dir = 1;
+                    terminate = 1;
+                }
+                else
+                {
+                    // backtrack to last good and start inversion lookahead ...
+
+                    while ( tctx->npath > 1 && edges[ tctx->path[tctx->npath - 1] ].target != vnext )
+                    {
+                        uint64 eprev = tctx->path[tctx->npath - 1];
+                        int vprev = edges[eprev].target;
+
+                        vflags[vprev] &= ~(V_BACKBONE | V_VISITED);
+                        edges[eprev].flags &= ~E_BACKBONE;
+                        vpath[vprev] = -1;
+
+                        tctx->npath--;
+                    }
+
+                    if (tctx->npath > 0)
+                    {
+                        OgEdge* enext = edges + tctx->path[tctx->npath - 1];
+                        v = enext->target;
+                        next_dir = enext->end;
+
+                        if (enext->flags & OVL_COMP)
+                        {
+                            next_dir = reverse(next_dir);
+                        }
+                    }
+                    else
+                    {
+                        edges[e].flags |= E_INVERSION;
+                    }
+
+                    if (vflags[v] & V_RETRY)
+                    {
+                        vmin = -1;
+                    }
+                    else
+                    {
+                        vflags[v] |= V_RETRY;
+
+                        best_next_node(tctx, v, next_dir, octx->ilookahead);
+                        retry = 1;
+                    }
+                }
+
+                break;
+            }
+
+            if ( vmin == -1 || (vflags[vnext] & V_BACKBONE) ||
+                 (vnext == vbestnext && !(vflags[vmin] & V_BACKBONE)) )
+            {
+                emin = e;
+                vmin = vnext;
+                next_dir_min = cur_dir;
+            }
+        }
+
+        if (retry)
+        {
+            continue;
+        }
+
+        int vflag;
+        int vminpath;
+
+        if (!terminate && vmin != -1)
+        {
+            vflag = vflags[vmin];
+            vminpath = vpath[vmin];
+
+            vflags[vmin] |= V_BACKBONE | V_VISITED;
+            edges[emin].flags |= E_BACKBONE;
+
+            vpath[vmin] = bid;
+
+            path_push(&(tctx->path), &(tctx->npath), &(tctx->maxpath), emin);
+
+            v = vmin;
+            next_dir = next_dir_min;
+
+            // remember the first direction we took
+
+            if (!first_dir)
+            {
+                first_dir = (edges[emin].flags & OVL_COMP) ? reverse(next_dir) : next_dir;
+            }
+        }
+        else
+        {
+            vflag = 0;
+            vminpath = -1;
+        }
+
+        // exhausted the first direction, now turn around and go the other way
+
+        if (vmin == -1 || (vflag & V_BACKBONE) || terminate)
+        {
+            ends[nends++] = vminpath;
+
+            if (!other_dir)
+            {
+                uint64* temp = tctx->path_d1;
+                tctx->path_d1 = tctx->path;
+                tctx->path = temp;
+
+                int tmax = tctx->maxpath_d1;
+                tctx->maxpath_d1 = tctx->maxpath;
+                tctx->maxpath = tmax;
+
+                tctx->npath_d1 = tctx->npath;
+                tctx->npath = 0;
+
+                other_dir = 1;
+                v = vstart;
+                next_dir = reverse(first_dir);
+            }
+            else
+            {
+                if (nends == 1)
+                {
+                    ends[nends++] = ends[0];
+                }
+
+                break;
+            }
+        }
+    }
+
+    assert(nends == 2);
+
+    // the second direction reversed followed by the first
+
+    int nedges = tctx->npath + tctx->npath_d1;
+    uint64* pedges = malloc(sizeof(uint64) * (nedges + 1));
+    int i;
+
+    for ( i = 0 ; i < tctx->npath ; i++ )
+    {
+        OgEdge* e = edges + tctx->path[i];
+        int64 erev = edge_reverse(octx, e->target, e->source);
+
+        if (erev == -1)
+        {
+            fprintf(stderr, "error: could not find reverse edge for %d -> %d\n", e->source, e->target);
+            exit(1);
+        }
+
+        pedges[tctx->npath - 1 - i] = erev;
+    }
+
+    memcpy(pedges + tctx->npath, tctx->path_d1, sizeof(uint64) * tctx->npath_d1);
+
+    if (nedges > 0)
+    {
+        for ( i = 0 ; i < nedges ; i++ )
+        {
+            vflags[ edges[ pedges[i] ].source ] ^= V_VISITED;
+        }
+
+        vflags[ edges[ pedges[nedges - 1] ].target ] ^= V_VISITED;
+    }
+
+    result->edges = pedges;
+    result->nedges = nedges;
+    result->pid = bid;
+    result->vstart = vstart;
+    result->ends[0] = ends[0];
+    result->ends[1] = ends[1];
+}
+
+static void component_paths_free(OgComponent* comp)
+{
+    int i;
+    for ( i = 0 ; i < comp->npaths ; i++ )
+    {
+        free(comp->paths[i].edges);
+    }
+
+    comp->npaths = 0;
+}
+
+static void graph_compute_paths(OgTourThread* tctx, OgComponent* comp, int* start, int nstart)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* vflags = octx->vflags;
+    int* bbdist = octx->bbdist;
+
+    component_paths_free(comp);
+
+    int path_num = 0;
+    int i;
+
+    for ( i = 0 ; i < nstart ; i++ )
+    {
+        // look for a good start vertex
+
+        int v = start[i];
+        int dist = bbdist[v];
+
+        if (dist != -1 && dist < MAX_BB_DISTANCE)
+        {
+            continue;
+        }
+
+        if ( vflags[v] & (V_BACKBONE | V_DISCARD | V_DEAD_END | V_MODULE | V_OPTIONAL) )
+        {
+            continue;
+        }
+
+        octx->vpath[v] = path_num;
+
+        if (comp->npaths + 1 > comp->maxpaths)
+        {
+            comp->maxpaths = comp->maxpaths * 1.2 + 100;
+            comp->paths = realloc(comp->paths, sizeof(OgPath) * comp->maxpaths);
+        }
+
+        OgPath* path = comp->paths + comp->npaths;
+        comp->npaths++;
+
+        backbone(tctx, v, path_num, path);
+
+        if (path->nedges > 0)
+        {
+            // trim module and optional edges from the ends
+
+            int b = 0;
+            int e = path->nedges;
+
+            while ( b < e && (edges[ path->edges[b] ].flags & (OVL_MODULE | OVL_OPTIONAL)) )
+            {
+                b++;
+            }
+
+            while ( b < e && (edges[ path->edges[e - 1] ].flags & (OVL_MODULE | OVL_OPTIONAL)) )
+            {
+                e--;
+            }
+
+            memmove(path->edges, path->edges + b, sizeof(uint64) * (e - b));
+            path->nedges = e - b;
+
+            if (path->nedges > 0)
+            {
+                vflags[ edges[ path->edges[0] ].source ] |= V_PATH_END;
+                vflags[ edges[ path->edges[path->nedges - 1] ].target ] |= V_PATH_END;
+            }
+
+            update_bbdist(tctx, comp);
+        }
+
+        path_num++;
+    }
+}
+
+/*
+ * look for path ends that are connected to exactly one other path end by optional
+ * edges. those edges are the candidates for joining the paths.
+ */
+
+static void analyze_path_ends(OgTourThread* tctx, OgComponent* comp)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* comp_pos = octx->comp_pos;
+    int* endidx = tctx->mark;           // index + 1 in ends
+    int* dropped = tctx->mark2;
+
+    int* ends = tctx->ends;
+    int* tgt_off = tctx->tgt_off;
+    int* tgt_n = tctx->tgt_n;
+    int nends = 0;
+    int ntgt = 0;
+
+    comp->npotential = 0;
+
+    int i, j;
+    for ( i = 0 ; i < comp->npaths ; i++ )
+    {
+        OgPath* path = comp->paths + i;
+
+        if (path->nedges == 0)
+        {
+            continue;
+        }
+
+        int pv[2];
+        pv[0] = edges[ path->edges[0] ].source;
+        pv[1] = edges[ path->edges[path->nedges - 1] ].target;
+
+        for ( j = 0 ; j < 2 ; j++ )
+        {
+            if ( !endidx[ comp_pos[ pv[j] ] ] )
+            {
+                ends[nends++] = pv[j];
+                endidx[ comp_pos[ pv[j] ] ] = nends;
+            }
+        }
+    }
+
+    for ( i = 0 ; i < nends ; i++ )
+    {
+        int v = ends[i];
+        uint64 k;
+
+        tgt_off[i] = ntgt;
+
+        for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+        {
+            OgEdge* e = edges + k;
+
+            if ( (e->flags & E_REMOVED) || !(e->flags & OVL_OPTIONAL) || !endidx[ comp_pos[e->target] ] )
+            {
+                continue;
+            }
+
+            for ( j = tgt_off[i] ; j < ntgt && edges[ tctx->tgt[j] ].target != e->target ; j++ ) ;
+
+            if (j < ntgt)
+            {
+                continue;
+            }
+
+            path_push(&(tctx->tgt), &ntgt, &(tctx->maxtgt), k);
+        }
+
+        tgt_n[i] = ntgt - tgt_off[i];
+    }
+
+    while (1)
+    {
+        int ndrop = 0;
+
+        for ( i = 0 ; i < nends ; i++ )
+        {
+            if (tgt_n[i] != 1)
+            {
+                continue;
+            }
+
+            OgEdge* e = edges + tctx->tgt[ tgt_off[i] ];
+            int vtarget = e->target;
+
+            tgt_n[i] = 0;
+
+            if ( tgt_n[ endidx[ comp_pos[vtarget] ] - 1 ] != 1 )
+            {
+                continue;
+            }
+
+            if (comp->npotential + 4 > comp->maxpotential)
+            {
+                comp->maxpotential = comp->maxpotential * 1.2 + 100;
+                comp->potential = realloc(comp->potential, sizeof(int) * comp->maxpotential);
+            }
+
+            comp->potential[ comp->npotential++ ] = e->source;
+            comp->potential[ comp->npotential++ ] = vtarget;
+            comp->potential[ comp->npotential++ ] = vtarget;
+            comp->potential[ comp->npotential++ ] = e->source;
+
+            if ( !dropped[ comp_pos[vtarget] ] )
+            {
+                dropped[ comp_pos[vtarget] ] = 1;
+                tctx->stack[ndrop++] = vtarget;
+            }
+        }
+
+        if (ndrop == 0)
+        {
+            break;
+        }
+
+        for ( i = 0 ; i < nends ; i++ )
+        {
+            int n = 0;
+
+            for ( j = 0 ; j < tgt_n[i] ; j++ )
+            {
+                uint64 k = tctx->tgt[ tgt_off[i] + j ];
+
+                if ( !dropped[ comp_pos[ edges[k].target ] ] )
+                {
+                    tctx->tgt[ tgt_off[i] + n ] = k;
+                    n++;
+                }
+            }
+
+            tgt_n[i] = n;
+        }
+
+        for ( i = 0 ; i < ndrop ; i++ )
+        {
+            dropped[ comp_pos[ tctx->stack[i] ] ] = 0;
+        }
+    }
+
+    for ( i = 0 ; i < nends ; i++ )
+    {
+        endidx[ comp_pos[ ends[i] ] ] = 0;
+    }
+}
+
+// remove edges suspected to be due to inversions, the ones connecting both ends of a read to another one
+
+static void drop_inversions(OgTourThread* tctx, OgComponent* comp)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* comp_pos = octx->comp_pos;
+    int* l = tctx->mark;
+    int* r = tctx->mark2;
+
+    int i, pass;
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        // count the ends, flag the bad edges and reset the counts
+
+        for ( pass = 0 ; pass < 3 ; pass++ )
+        {
+            uint64 k;
+
+            for ( k = octx->off_in[v] ; k < octx->off_in[v + 1] + (octx->off_out[v + 1] - octx->off_out[v]) ; k++ )
+            {
+                OgEdge* e;
+
+                if (k < octx->off_in[v + 1])
+                {
+                    e = edges + octx->idx_in[k];
+                }
+                else
+                {
+                    e = edges + octx->off_out[v] + (k - octx->off_in[v + 1]);
+                }
+
+                if (e->flags & E_REMOVED)
+                {
+                    continue;
+                }
+
+                int t = comp_pos[ (e->source == v) ? e->target : e->source ];
+
+                if (pass == 0)
+                {
+                    if ( edge_end_at(e, v) == 'l' ) l[t]++; else r[t]++;
+                }
+                else if (pass == 1)
+                {
+                    if (l[t] > 0 && r[t] > 0)
+                    {
+                        e->flags |= E_DROP;
+                    }
+                }
+                else
+                {
+                    l[t] = r[t] = 0;
+                }
+            }
+        }
+    }
+
+    int nedges = 0;
+    int nverts = 0;
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+        uint64 k;
+
+        for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+        {
+            if (edges[k].flags & E_DROP)
+            {
+                edges[k].flags = (edges[k].flags & ~E_DROP) | E_REMOVED;
+                nedges++;
+            }
+        }
+    }
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+        int used = 0;
+        uint64 k;
+
+        for ( k = octx->off_out[v] ; !used && k < octx->off_out[v + 1] ; k++ )
+        {
+            used = !(edges[k].flags & E_REMOVED);
+        }
+
+        for ( k = octx->off_in[v] ; !used && k < octx->off_in[v + 1] ; k++ )
+        {
+            used = !(edges[ octx->idx_in[k] ].flags & E_REMOVED);
+        }
+
+        if (!used)
+        {
+            octx->vstatus[v] &= ~VS_USED;
+            nverts++;
+        }
+    }
+}
+
+// flags, start vertices and the initial paths of a component
+
+static void tour_component(OgTourThread* tctx, OgComponent* comp)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    unsigned char* vstatus = octx->vstatus;
+    int* vflags = octx->vflags;
+
+    int i;
+    uint64 k;
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        vflags[v] = 0;
+        octx->bbdist[v] = -1;
+        octx->vpath[v] = -1;
+    }
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+        {
+            OgEdge* e = edges + k;
+
+            if (vstatus[e->source] & VS_OPTIONAL)
+            {
+                e->flags |= OVL_OPTIONAL;
+                vflags[e->source] |= V_OPTIONAL;
+            }
+
+            if (vstatus[e->target] & VS_OPTIONAL)
+            {
+                e->flags |= OVL_OPTIONAL;
+                vflags[e->target] |= V_OPTIONAL;
+            }
+        }
+    }
+
+    if (octx->dropinversions)
+    {
+        drop_inversions(tctx, comp);
+    }
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+        {
+            OgEdge* e = edges + k;
+
+            if ( !(e->flags & E_REMOVED) && (e->flags & OVL_MODULE) )
+            {
+                vflags[e->source] |= V_MODULE;
+                vflags[e->target] |= V_MODULE;
+            }
+        }
+    }
+
+    // flag dead ends and order the start vertices by quality
+
+    OgStart* start = malloc(sizeof(OgStart) * comp->nverts);
+    int nstart = 0;
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        if ( !(vstatus[v] & VS_USED) )
+        {
+            continue;
+        }
+
+        if ( is_dead_end(octx, v) )
+        {
+            vflags[v] |= V_DEAD_END;
+        }
+
+        start[nstart].v = v;
+        start[nstart].quality = vertex_quality(octx, v);
+        nstart++;
+    }
+
+    qsort(start, nstart, sizeof(OgStart), cmp_start);
+
+    comp->start = malloc(sizeof(int) * (nstart + 1));
+    comp->nstart = nstart;
+
+    for ( i = 0 ; i < nstart ; i++ )
+    {
+        comp->start[i] = start[i].v;
+    }
+
+    free(start);
+
+    graph_compute_paths(tctx, comp, comp->start, comp->nstart);
+
+    analyze_path_ends(tctx, comp);
+}
+
+// try to connect the paths using the optional edges found by analyze_path_ends
+
+static void tour_component_optional(OgTourThread* tctx, OgComponent* comp)
+{
+    OgTourContext* octx = tctx->octx;
+    OgEdge* edges = octx->edges;
+    int* vflags = octx->vflags;
+
+    int i;
+    uint64 k;
+
+    // reset touring data
+
+    for ( i = 0 ; i < comp->nverts ; i++ )
+    {
+        int v = comp->verts[i];
+
+        octx->bbdist[v] = -1;
+        octx->vpath[v] = -1;
+        vflags[v] &= ~(V_PATH_END | V_BACKBONE | V_VISITED | V_RETRY);
+
+        for ( k = octx->off_out[v] ; k < octx->off_out[v + 1] ; k++ )
+        {
+            edges[k].flags &= ~E_BACKBONE;
+        }
+    }
+
+    // better start vertices, the middle of the paths found
+
+    int* start = malloc(sizeof(int) * (comp->npaths + comp->nstart + 1));
+    int nstart = 0;
+
+    for ( i = 0 ; i < comp->npaths ; i++ )
+    {
+        OgPath* path = comp->paths + i;
+
+        if (path->nedges > 0)
+        {
+            start[nstart++] = edges[ path->edges[ (path->nedges - 1) / 2 ] ].source;
+        }
+    }
+
+    memcpy(start + nstart, comp->start, sizeof(int) * comp->nstart);
+    nstart += comp->nstart;
+
+    // enable optional edges
+
+    for ( i = 0 ; i < comp->npotential ; i += 2 )
+    {
+        int64 e = edge_reverse(octx, comp->potential[i], comp->potential[i + 1]);
+
+        if (e != -1)
+        {
+            edges[e].flags &= ~OVL_OPTIONAL;
+        }
+    }
+
+    graph_compute_paths(tctx, comp, start, nstart);
+
+    free(start);
+}
+
+static void* tour_thread(void* arg)
+{
+    OgTourThread* tctx = arg;
+    OgTourContext* octx = tctx->octx;
+
+    while (1)
+    {
+        pthread_mutex_lock(&(octx->lock));
+
+        int c = octx->nextcomp++;
+
+        pthread_mutex_unlock(&(octx->lock));
+
+        if (c >= octx->ncomps)
+        {
+            break;
+        }
+
+        OgComponent* comp = octx->comps + c;
+
+        if (octx->phase == 0)
+        {
+            tour_component(tctx, comp);
+        }
+        else
+        {
+            tour_component_optional(tctx, comp);
+        }
+    }
+
+    return NULL;
+}
+
+static void tour_thread_init(OgTourContext* octx, OgTourThread* tctx)
+{
+    int maxcomp = octx->maxcomp + 1;
+
+    bzero(tctx, sizeof(OgTourThread));
+
+    tctx->octx = octx;
+
+    tctx->step = malloc(sizeof(OgStep) * (MAX(octx->lookahead, octx->ilookahead) + 1));
+
+    tctx->count = malloc(sizeof(int) * maxcomp);
+    tctx->counted = malloc(sizeof(int) * maxcomp);
+    tctx->mark = malloc(sizeof(int) * maxcomp);
+    tctx->mark2 = malloc(sizeof(int) * maxcomp);
+
+    bzero(tctx->count, sizeof(int) * maxcomp);
+    bzero(tctx->mark, sizeof(int) * maxcomp);
+    bzero(tctx->mark2, sizeof(int) * maxcomp);
+
+    tctx->stack = malloc(sizeof(int) * maxcomp);
+    tctx->stack_new = malloc(sizeof(int) * maxcomp);
+
+    tctx->ends = malloc(sizeof(int) * maxcomp);
+    tctx->tgt_off = malloc(sizeof(int) * maxcomp);
+    tctx->tgt_n = malloc(sizeof(int) * maxcomp);
+}
+
+static void tour_thread_free(OgTourThread* tctx)
+{
+    free(tctx->step);
+    free(tctx->paths);
+    free(tctx->count);
+    free(tctx->counted);
+    free(tctx->mark);
+    free(tctx->mark2);
+    free(tctx->oedges);
+    free(tctx->path);
+    free(tctx->path_d1);
+    free(tctx->stack);
+    free(tctx->stack_new);
+    free(tctx->ends);
+    free(tctx->tgt_off);
+    free(tctx->tgt_n);
+    free(tctx->tgt);
+}
+
+static void tour_phase(OgTourContext* octx, OgTourThread* tctx, int phase)
+{
+    int nthreads = octx->nthreads;
+
+    octx->phase = phase;
+    octx->nextcomp = 0;
+
+    if (nthreads == 1)
+    {
+        tour_thread(tctx);
+        return;
+    }
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+    int i;
+
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        pthread_create(threads + i, NULL, tour_thread, tctx + i);
+    }
+
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+}
+
+static void tour(OgTourContext* octx)
+{
+    int nthreads = octx->nthreads;
+    int nreads = octx->nreads;
+
+    octx->vflags = malloc(sizeof(int) * nreads);
+    octx->bbdist = malloc(sizeof(int) * nreads);
+    octx->vpath = malloc(sizeof(int) * nreads);
+
+    OgTourThread* tctx = malloc(sizeof(OgTourThread) * nthreads);
+    int i;
+
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        tour_thread_init(octx, tctx + i);
+    }
+
+    pthread_mutex_init(&(octx->lock), NULL);
+
+    tour_phase(octx, tctx, 0);
+
+    int npaths = 0;
+    int npotential = 0;
+
+    for ( i = 0 ; i < octx->ncomps ; i++ )
+    {
+        npaths += octx->comps[i].npaths;
+        npotential += octx->comps[i].npotential;
+    }
+
+    printf("%d paths, %d potential joins\n", npaths, npotential / 4);
+
+    if (npaths > 0 && npotential > 0)
+    {
+        tour_phase(octx, tctx, 1);
+    }
+
+    pthread_mutex_destroy(&(octx->lock));
+
+    for ( i = 0 ; i < nthreads ; i++ )
+    {
+        tour_thread_free(tctx + i);
+    }
+
+    free(tctx);
+
+    // global path ids
+
+    npaths = 0;
+
+    for ( i = 0 ; i < octx->ncomps ; i++ )
+    {
+        OgComponent* comp = octx->comps + i;
+        int j;
+
+        comp->pathoff = npaths;
+        npaths += comp->npaths;
+
+        for ( j = 0 ; j < comp->nverts ; j++ )
+        {
+            int v = comp->verts[j];
+
+            if (octx->vpath[v] != -1)
+            {
+                octx->vpath[v] += comp->pathoff;
+            }
+        }
+
+        for ( j = 0 ; j < comp->npaths ; j++ )
+        {
+            OgPath* path = comp->paths + j;
+            int k;
+
+            path->pid += comp->pathoff;
+
+            for ( k = 0 ; k < 2 ; k++ )
+            {
+                if (path->ends[k] != -1)
+                {
+                    path->ends[k] += comp->pathoff;
+                }
+            }
+        }
+    }
+
+    printf("%d paths\n", npaths);
+}
+
+static int paths_write(OgTourContext* octx, const char* fpath_paths, const char* fpath_rids)
+{
+    FILE* filePaths = fopen(fpath_paths, "w");
+    FILE* fileRids = fopen(fpath_rids, "w");
+
+    if (filePaths == NULL || fileRids == NULL)
+    {
+        return 0;
+    }
+
+    OgEdge* edges = octx->edges;
+    unsigned char* rids = malloc(octx->nreads);
+    bzero(rids, octx->nreads);
+
+    int i, j, k;
+    for ( i = 0 ; i < octx->ncomps ; i++ )
+    {
+        OgComponent* comp = octx->comps + i;
+
+        for ( j = 0 ; j < comp->npaths ; j++ )
+        {
+            OgPath* path = comp->paths + j;
+
+            fprintf(filePaths, "PATH %d %d %d", path->pid, path->ends[0], path->ends[1]);
+
+            for ( k = 0 ; k < path->nedges ; k++ )
+            {
+                OgEdge* e = edges + path->edges[k];
+
+                fprintf(filePaths, " %d-%d", e->source, e->target);
+
+                rids[e->source] = rids[e->target] = 1;
+            }
+
+            fprintf(filePaths, "\n");
+        }
+    }
+
+    for ( i = 0 ; i < octx->nreads ; i++ )
+    {
+        if (rids[i])
+        {
+            fprintf(fileRids, "%d\n", i);
+        }
+    }
+
+    free(rids);
+
+    fclose(filePaths);
+    fclose(fileRids);
+
+    return 1;
+}
+
+// read id with thousands separators
+
+static void format_read(char* buf, int rid)
+{
+    char digits[32];
+    int n = sprintf(digits, "%d", rid);
+    int i;
+
+    for ( i = 0 ; i < n ; i++ )
+    {
+        if ( i > 0 && (n - i) % 3 == 0 )
+        {
+            *buf++ = ',';
+        }
+
+        *buf++ = digits[i];
+    }
+
+    *buf = '\0';
+}
+
+// jet color ramp, the same as colormap.DEFAULT_RAMP
+
+static void format_divergence_color(char* buf, int div)
+{
+    double x = (double)( MAX(COLORS_DIV_MIN, MIN(COLORS_DIV_MAX, div)) - COLORS_DIV_MIN ) / ( COLORS_DIV_MAX - COLORS_DIV_MIN );
+
+    double red = MAX(0.0, MIN(1.0, 1.5 - fabs(4 * x - 3)));
+    double green = MAX(0.0, MIN(1.0, 1.5 - fabs(4 * x - 2)));
+    double blue = MAX(0.0, MIN(1.0, 1.5 - fabs(4 * x - 1)));
+
+    sprintf(buf, "#%.2x%.2x%.2x", (int)(red * 255.0), (int)(green * 255.0), (int)(blue * 255.0));
+}
+
+static int graph_write(OgTourContext* octx, const char* path)
+{
+    FILE* f = fopen(path, "w");
+
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    OgEdge* edges = octx->edges;
+    unsigned char* vstatus = octx->vstatus;
+    int* vflags = octx->vflags;
+    int* vpath = octx->vpath;
+    int* bbdist = octx->bbdist;
+
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(f, "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\"\n");
+    fprintf(f, "         xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n");
+    fprintf(f, "         xsi:schemaLocation=\"http://graphml.graphdrawing.org/xmlns/1.0/graphml.xsd\">\n");
+
+    fprintf(f, "  <key attr.name=\"length\"     attr.type=\"int\"    for=\"edge\" id=\"length\" />\n");
+    fprintf(f, "  <key attr.name=\"flags\"      attr.type=\"int\"    for=\"edge\" id=\"eflags\" />\n");
+    fprintf(f, "  <key attr.name=\"end\"        attr.type=\"string\" for=\"edge\" id=\"end\" />\n");
+    fprintf(f, "  <key attr.name=\"divergence\" attr.type=\"int\"    for=\"edge\" id=\"divergence\" />\n");
+    fprintf(f, "  <key attr.name=\"path\"       attr.type=\"int\"    for=\"edge\" id=\"epath\" />\n");
+    fprintf(f, "  <key attr.name=\"color\"      attr.type=\"string\" for=\"edge\" id=\"ecolor\" />\n");
+    fprintf(f, "  <key attr.name=\"dir\"        attr.type=\"string\" for=\"edge\" id=\"dir\" />\n");
+    fprintf(f, "  <key attr.name=\"label\"      attr.type=\"string\" for=\"edge\" id=\"elabel\" />\n");
+    fprintf(f, "  <key attr.name=\"style\"      attr.type=\"string\" for=\"edge\" id=\"estyle\" />\n");
+    fprintf(f, "  <key attr.name=\"weight\"     attr.type=\"double\" for=\"edge\" id=\"weight\" />\n");
+
+    fprintf(f, "  <key attr.name=\"read\"       attr.type=\"int\"    for=\"node\" id=\"read\" />\n");
+    fprintf(f, "  <key attr.name=\"optional\"   attr.type=\"int\"    for=\"node\" id=\"optional\" />\n");
+    fprintf(f, "  <key attr.name=\"flags\"      attr.type=\"int\"    for=\"node\" id=\"vflags\" />\n");
+    fprintf(f, "  <key attr.name=\"path\"       attr.type=\"int\"    for=\"node\" id=\"vpath\" />\n");
+    fprintf(f, "  <key attr.name=\"color\"      attr.type=\"string\" for=\"node\" id=\"vcolor\" />\n");
+    fprintf(f, "  <key attr.name=\"label\"      attr.type=\"string\" for=\"node\" id=\"vlabel\" />\n");
+    fprintf(f, "  <key attr.name=\"style\"      attr.type=\"string\" for=\"node\" id=\"vstyle\" />\n");
+    fprintf(f, "  <key attr.name=\"width\"      attr.type=\"double\" for=\"node\" id=\"width\" />\n");
+
+    fprintf(f, "  <graph id=\"tour\" edgedefault=\"directed\">\n");
+
+    char read[32];
+    char color[32];
+    int v;
+
+    for ( v = 0 ; v < octx->nreads ; v++ )
+    {
+        if ( !(vstatus[v] & VS_USED) )
+        {
+            continue;
+        }
+
+        int flags = vflags[v];
+        const char* vcolor = COLOR_WHITE;
+
+        if (flags & V_DISCARD)
+        {
+            vcolor = COLOR_GREY;
+        }
+        else if (flags & V_PATH_END)
+        {
+            vcolor = COLOR_GREEN;
+        }
+
+        format_read(read, v);
+
+        fprintf(f, "    <node id=\"%d\">\n", v);
+        fprintf(f, "      <data key=\"read\">%d</data>\n", v);
+        fprintf(f, "      <data key=\"optional\">%d</data>\n", (vstatus[v] & VS_OPTIONAL) ? 1 : 0);
+        fprintf(f, "      <data key=\"vflags\">%d</data>\n", flags);
+        fprintf(f, "      <data key=\"vpath\">%d</data>\n", vpath[v]);
+        fprintf(f, "      <data key=\"vcolor\">%s</data>\n", vcolor);
+
+        if (flags & V_BACKBONE)
+        {
+            fprintf(f, "      <data key=\"vlabel\">%s P%d</data>\n", read, vpath[v]);
+        }
+        else
+        {
+            fprintf(f, "      <data key=\"vlabel\">%s D%d</data>\n", read, bbdist[v]);
+        }
+
+        fprintf(f, "      <data key=\"vstyle\">filled</data>\n");
+        fprintf(f, "      <data key=\"width\">0.2</data>\n");
+        fprintf(f, "    </node>\n");
+    }
+
+    uint64 k;
+    for ( k = 0 ; k < octx->nedges ; k++ )
+    {
+        OgEdge* e = edges + k;
+        int flags = e->flags;
+
+        if (flags & E_REMOVED)
+        {
+            continue;
+        }
+
+        const char* style = "dotted";
+        double weight = 1.0;
+        int path = -1;
+
+        format_divergence_color(color, e->div);
+
+        if (flags & E_BACKBONE)
+        {
+            int vs = e->source;
+            int vt = e->target;
+
+            style = "solid";
+            weight = 2.0;
+
+            if ( vpath[vs] == vpath[vt] || (vflags[vs] & V_PATH_END) || !(vflags[vt] & V_PATH_END) )
+            {
+                path = vpath[vs];
+            }
+            else
+            {
+                path = vpath[vt];
+            }
+        }
+
+        if (flags & OVL_OPTIONAL)
+        {
+            style = "dashed";
+            strcpy(color, "yellow");
+        }
+
+        if (flags & OVL_MODULE)
+        {
+            style = "dashed";
+            strcpy(color, "purple");
+        }
+
+        if (flags & E_INVERSION)
+        {
+            strcpy(color, "magenta");
+        }
+
+        fprintf(f, "    <edge source=\"%d\" target=\"%d\">\n", e->source, e->target);
+        fprintf(f, "      <data key=\"length\">%d</data>\n", e->ovh);
+        fprintf(f, "      <data key=\"eflags\">%d</data>\n", flags & ~E_TOUR_FLAGS);
+        fprintf(f, "      <data key=\"end\">%c</data>\n", e->end);
+        fprintf(f, "      <data key=\"divergence\">%d</data>\n", e->div);
+        fprintf(f, "      <data key=\"epath\">%d</data>\n", path);
+        fprintf(f, "      <data key=\"ecolor\">%s</data>\n", color);
+        fprintf(f, "      <data key=\"dir\">both</data>\n");
+
+        if (flags & E_BACKBONE)
+        {
+            fprintf(f, "      <data key=\"elabel\">%d</data>\n", e->ovh);
+        }
+
+        fprintf(f, "      <data key=\"estyle\">%s</data>\n", style);
+        fprintf(f, "      <data key=\"weight\">%.1f</data>\n", weight);
+        fprintf(f, "    </edge>\n");
+    }
+
+    fprintf(f, "  </graph>\n");
+    fprintf(f, "</graphml>\n");
+
+    fclose(f);
+
+    return 1;
+}
+
+static void usage()
+{
+    printf("usage: [-d] [-l n] [-j n] database overlap_graph.tgf|ogb\n\n");
+
+    printf("Tours the overlap graph. Writes the paths and the annotated graph to\n");
+    printf("<graph>.tour.paths, <graph>.tour.rids and <graph>.tour.graphml.\n\n");
+
+    printf("options: -d  remove edges suspected to be due to inversions\n");
+    printf("         -l  lookahead during touring (default %d)\n", DEF_ARG_L);
+    printf("         -j  number of threads (default %d)\n", DEF_ARG_J);
+}
+
+int main(int argc, char* argv[])
+{
+    HITS_DB db;
+    OgTourContext octx;
+
+    bzero(&octx, sizeof(OgTourContext));
+
+    octx.circular = 1;
+    octx.lookahead = DEF_ARG_L;
+    octx.nthreads = DEF_ARG_J;
+
+    // process arguments
+
+    opterr = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "cdl:j:")) != -1)
+    {
+        switch (c)
+        {
+            case 'c':
+                      octx.circular = 1;
+                      break;
+
+            case 'd':
+                      octx.dropinversions = 1;
+                      break;
+
+            case 'l':
+                      octx.lookahead = atoi(optarg);
+                      break;
+
+            case 'j':
+                      octx.nthreads = atoi(optarg);
+                      break;
+
+            default:
+                      usage();
+                      exit(1);
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        usage();
+        exit(1);
+    }
+
+    if (octx.lookahead < 1 || octx.nthreads < 1)
+    {
+        fprintf(stderr, "error: invalid lookahead or number of threads\n");
+        exit(1);
+    }
+
+    octx.ilookahead = octx.lookahead + PATH_LOOKAHEAD_INCREASE_INVERSION;
+
+    char* pcPathReadsIn = argv[optind++];
+    octx.path_graph_in = argv[optind++];
+
+    if (Open_DB(pcPathReadsIn, &db))
+    {
+        fprintf(stderr, "could not open '%s'\n", pcPathReadsIn);
+        exit(1);
+    }
+
+    // init
+
+    octx.db = &db;
+    octx.nreads = db.nreads;
+
+    octx.vstatus = malloc(octx.nreads);
+    bzero(octx.vstatus, octx.nreads);
+
+    // work
+
+    printf("reading graph\n");
+
+    int read_ok;
+
+    if ( is_graph_bin(octx.path_graph_in) )
+    {
+        read_ok = read_graph_bin(&octx);
+    }
+    else
+    {
+        read_ok = read_graph_tgf(&octx);
+    }
+
+    if (!read_ok)
+    {
+        fprintf(stderr, "error: failed to read %s\n", octx.path_graph_in);
+        exit(1);
+    }
+
+    printf("%llu edges\n", octx.nedges);
+
+    graph_index(&octx);
+    graph_components(&octx);
+
+    printf("%d components, largest %d reads\n", octx.ncomps, octx.maxcomp);
+
+    octx.nthreads = MAX(1, MIN(octx.nthreads, octx.ncomps));
+
+    tour(&octx);
+
+    // output
+
+    char path[PATH_MAX];
+    char* dot = strrchr(octx.path_graph_in, '.');
+    int baselen = dot ? (int)(dot - octx.path_graph_in) : (int)strlen(octx.path_graph_in);
+    char path_rids[PATH_MAX];
+
+    sprintf(path, "%.*s.tour.paths", baselen, octx.path_graph_in);
+    sprintf(path_rids, "%.*s.tour.rids", baselen, octx.path_graph_in);
+
+    if ( !paths_write(&octx, path, path_rids) )
+    {
+        fprintf(stderr, "error: failed to write %s\n", path);
+        exit(1);
+    }
+
+    sprintf(path, "%.*s.tour.graphml", baselen, octx.path_graph_in);
+
+    if ( !graph_write(&octx, path) )
+    {
+        fprintf(stderr, "error: failed to write %s\n", path);
+        exit(1);
+    }
+
+    // cleanup
+
+    for ( c = 0 ; c < octx.ncomps ; c++ )
+    {
+        OgComponent* comp = octx.comps + c;
+
+        component_paths_free(comp);
+
+        free(comp->paths);
+        free(comp->start);
+        free(comp->potential);
+    }
+
+    free(octx.comps);
+    free(octx.comp_verts);
+    free(octx.comp_pos);
+
+    free(octx.vflags);
+    free(octx.bbdist);
+    free(octx.vpath);
 
-    free(octx.nedges);
+    free(octx.vstatus);
+    free(octx.off_out);
+    free(octx.off_in);
+    free(octx.idx_in);
     free(octx.edges);
 
     Close_DB(&db);
@@ -0,0 +1,1340 @@
+
+/*******************************************************************************************
+ *
+ *  Writes the sequences of the paths of a toured overlap graph
+ *  (C implementation of tour2fasta.py)
+ *
+ *  The bases are mapped and the reads of a batch of paths are prefetched before
+ *  they are spliced. Batches are spliced in parallel and written in the order of
+ *  the paths file.
+ *
+ *  Date    : October 2026
+ *
+ *  Author  : MARVEL Team
+ *
+ *******************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#if defined(__APPLE__)
+    #include <sys/syslimits.h>
+#else
+    #include <linux/limits.h>
+#endif
+
+#include "lib/oflags.h"
+#include "lib/pass.h"
+#include "lib/tracks.h"
+#include "lib/utils.h"
+
+#include "db/DB.h"
+#include "db/fastaOut.h"
+#include "dalign/align.h"
+
+// defaults
+
+#define DEF_ARG_P   "path"
+#define DEF_ARG_T   TRACK_TRIM
+#define DEF_ARG_J   1
+
+// settings
+
+#define TRACK_POSTRACE  "postrace"
+
+#define FASTA_WIDTH     50
+
+#define MAX_XML_KEY     64
+
+// edge of the toured graph
+
+typedef struct
+{
+    int source, target;
+
+    int flags;
+    int length;
+    char end;
+} TourEdge;
+
+// path through the graph, its edges are pedges[beg] .. pedges[end - 1]
+
+typedef struct
+{
+    int pid;
+    int ends[2];
+
+    uint64 beg, end;
+} TourPath;
+
+typedef struct
+{
+    HITS_DB* db;
+    HITS_DB* db_seq;            // db or the corrected db, holds the bases of the paths
+
+    HITS_TRACK* trim;
+    HITS_TRACK* source;         // optional
+
+    HITS_TRACK* postrace;       // of the corrected reads
+    int* crid;                  // corrected read of each read or -1
+
+    int* vread;                 // read of each vertex, -1 if unused
+    int nvertices;
+
+    TourEdge* edges;            // sorted by source and target
+    uint64 nedges;
+
+    TourPath* paths;
+    int npaths;
+
+    uint64* pedges;             // edges of the paths
+    uint64 npedges;
+
+    int64* plen;                // length of the spliced paths
+
+    char* prefix;
+} Tour2FastaContext;
+
+// per batch buffers for the splicing
+
+typedef struct
+{
+    char* read;
+    int* posmap;
+
+    char* seq;
+    int64 nseq;
+    int64 maxseq;
+
+    int* segs;                  // read, begin, end
+    int nsegs;
+    int maxsegs;
+} SpliceBuffers;
+
+// getopt
+
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+static int cmp_edges(const void* x, const void* y)
+{
+    TourEdge* e1 = (TourEdge*)x;
+    TourEdge* e2 = (TourEdge*)y;
+
+    if (e1->source != e2->source)
+    {
+        return e1->source < e2->source ? -1 : 1;
+    }
+
+    if (e1->target != e2->target)
+    {
+        return e1->target < e2->target ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static int64 edge_find(Tour2FastaContext* ctx, int source, int target)
+{
+    TourEdge key;
+    key.source = source;
+    key.target = target;
+
+    TourEdge* e = bsearch(&key, ctx->edges, ctx->nedges, sizeof(TourEdge), cmp_edges);
+
+    return e ? e - ctx->edges : -1;
+}
+
+// value of the attribute name in the tag on line, 0 if it is not there
+
+static int xml_attr(const char* line, const char* name, char* value, int maxvalue)
+{
+    char pattern[MAX_XML_KEY];
+    sprintf(pattern, " %s=\"", name);
+
+    const char* beg = strstr(line, pattern);
+
+    if (beg == NULL)
+    {
+        return 0;
+    }
+
+    beg += strlen(pattern);
+
+    const char* end = strchr(beg, '"');
+
+    if (end == NULL || end - beg >= maxvalue)
+    {
+        return 0;
+    }
+
+    memcpy(value, beg, end - beg);
+    value[end - beg] = '\0';
+
+    return 1;
+}
+
+static int xml_attr_int(const char* line, const char* name, int* value)
+{
+    char buf[MAX_XML_KEY];
+    char* end;
+
+    if ( !xml_attr(line, name, buf, MAX_XML_KEY) )
+    {
+        return 0;
+    }
+
+    *value = strtol(buf, &end, 10);
+
+    return *end == '\0' && end != buf;
+}
+
+static void vertex_add(Tour2FastaContext* ctx, int v)
+{
+    if (v >= ctx->nvertices)
+    {
+        int nvertices = MAX(v + 1, ctx->nvertices * 1.2 + 1000);
+
+        ctx->vread = realloc(ctx->vread, sizeof(int) * nvertices);
+        memset(ctx->vread + ctx->nvertices, -1, sizeof(int) * (nvertices - ctx->nvertices));
+
+        ctx->nvertices = nvertices;
+    }
+
+    ctx->vread[v] = v;
+}
+
+// reads the graphml written by OGtour or networkx, one element per line.
+// only the read of the nodes and the length, flags and end of the edges are kept.
+
+static int read_graph(Tour2FastaContext* ctx, const char* path)
+{
+    FILE* fileIn = fopen(path, "r");
+
+    if (fileIn == NULL)
+    {
+        return 0;
+    }
+
+    char key_read[MAX_XML_KEY] = "";
+    char key_length[MAX_XML_KEY] = "";
+    char key_flags[MAX_XML_KEY] = "";
+    char key_end[MAX_XML_KEY] = "";
+
+    char* line = NULL;
+    size_t maxline = 0;
+    int nline = 0;
+
+    uint64 maxedges = 0;
+    TourEdge* e = NULL;
+    int v = -1;
+
+    ctx->nedges = 0;
+
+    while ( getline(&line, &maxline, fileIn) > 0 )
+    {
+        nline++;
+
+        char* tag = line + strspn(line, " \t");
+        char name[MAX_XML_KEY];
+        char kind[MAX_XML_KEY];
+
+        if ( strncmp(tag, "<key ", 5) == 0 )
+        {
+            if ( !xml_attr(tag, "attr.name", name, MAX_XML_KEY) || !xml_attr(tag, "for", kind, MAX_XML_KEY) )
+            {
+                continue;
+            }
+
+            char* key = NULL;
+
+            if ( strcmp(kind, "node") == 0 )
+            {
+                if ( strcmp(name, "read") == 0 )
+                {
+                    key = key_read;
+                }
+            }
+            else if ( strcmp(kind, "edge") == 0 )
+            {
+                if ( strcmp(name, "length") == 0 )
+                {
+                    key = key_length;
+                }
+                else if ( strcmp(name, "flags") == 0 )
+                {
+                    key = key_flags;
+                }
+                else if ( strcmp(name, "end") == 0 )
+                {
+                    key = key_end;
+                }
+            }
+
+            if ( key && !xml_attr(tag, "id", key, MAX_XML_KEY) )
+            {
+                fprintf(stderr, "error: key without id at line %d\n", nline);
+                exit(1);
+            }
+        }
+        else if ( strncmp(tag, "<node ", 6) == 0 )
+        {
+            if ( !xml_attr_int(tag, "id", &v) || v < 0 )
+            {
+                fprintf(stderr, "error: node without a numeric id at line %d\n", nline);
+                exit(1);
+            }
+
+            vertex_add(ctx, v);
+
+            e = NULL;
+
+            if ( strstr(tag, "/>") )
+            {
+                v = -1;
+            }
+        }
+        else if ( strncmp(tag, "<edge ", 6) == 0 )
+        {
+            if (ctx->nedges >= maxedges)
+            {
+                maxedges = ctx->nedges * 1.2 + 1000;
+                ctx->edges = realloc(ctx->edges, sizeof(TourEdge) * maxedges);
+            }
+
+            e = ctx->edges + ctx->nedges;
+            bzero(e, sizeof(TourEdge));
+
+            if ( !xml_attr_int(tag, "source", &(e->source)) || !xml_attr_int(tag, "target", &(e->target)) )
+            {
+                fprintf(stderr, "error: edge without numeric source and target at line %d\n", nline);
+                exit(1);
+            }
+
+            e->end = 'r';
+            ctx->nedges++;
+
+            v = -1;
+        }
+        else if ( strncmp(tag, "<data ", 6) == 0 )
+        {
+            char* value = strchr(tag, '>');
+
+            if ( !xml_attr(tag, "key", name, MAX_XML_KEY) || value == NULL )
+            {
+                fprintf(stderr, "error: malformed data at line %d\n", nline);
+                exit(1);
+            }
+
+            value++;
+
+            if (v != -1)
+            {
+                if ( strcmp(name, key_read) == 0 )
+                {
+                    ctx->vread[v] = atoi(value);
+                }
+            }
+            else if (e != NULL)
+            {
+                if ( strcmp(name, key_length) == 0 )
+                {
+                    e->length = atoi(value);
+                }
+                else if ( strcmp(name, key_flags) == 0 )
+                {
+                    e->flags = atoi(value);
+                }
+                else if ( strcmp(name, key_end) == 0 )
+                {
+                    e->end = value[0];
+                }
+            }
+        }
+        else if ( strncmp(tag, "</node>", 7) == 0 )
+        {
+            v = -1;
+        }
+        else if ( strncmp(tag, "</edge>", 7) == 0 )
+        {
+            e = NULL;
+        }
+    }
+
+    free(line);
+    fclose(fileIn);
+
+    uint64 i;
+    for ( i = 0 ; i < ctx->nedges ; i++ )
+    {
+        e = ctx->edges + i;
+
+        if ( e->source >= ctx->nvertices || ctx->vread[e->source] == -1 ||
+             e->target >= ctx->nvertices || ctx->vread[e->target] == -1 )
+        {
+            fprintf(stderr, "error: edge %d -> %d between unknown nodes\n", e->source, e->target);
+            exit(1);
+        }
+    }
+
+    for ( v = 0 ; v < ctx->nvertices ; v++ )
+    {
+        if ( ctx->vread[v] >= ctx->db->nreads )
+        {
+            fprintf(stderr, "error: node %d has an invalid read id %d\n", v, ctx->vread[v]);
+            exit(1);
+        }
+    }
+
+    qsort(ctx->edges, ctx->nedges, sizeof(TourEdge), cmp_edges);
+
+    return 1;
+}
+
+// PATH id end1 end2 v1-v2 v2-v3 ... v(n-1)-vn
+
+static int read_paths(Tour2FastaContext* ctx, const char* path)
+{
+    FILE* fileIn = fopen(path, "r");
+
+    if (fileIn == NULL)
+    {
+        return 0;
+    }
+
+    char* line = NULL;
+    size_t maxline = 0;
+    int nline = 0;
+
+    int maxpaths = 0;
+    uint64 maxpedges = 0;
+
+    ctx->npaths = 0;
+    ctx->npedges = 0;
+
+    while ( getline(&line, &maxline, fileIn) > 0 )
+    {
+        nline++;
+
+        char* cur = line + strspn(line, " \t\n");
+
+        if (*cur == '\0')
+        {
+            continue;
+        }
+
+        if (ctx->npaths >= maxpaths)
+        {
+            maxpaths = ctx->npaths * 1.2 + 1000;
+            ctx->paths = realloc(ctx->paths, sizeof(TourPath) * maxpaths);
+        }
+
+        TourPath* p = ctx->paths + ctx->npaths;
+        int n;
+
+        if ( sscanf(cur, "PATH %d %d %d%n", &(p->pid), p->ends, p->ends + 1, &n) != 3 )
+        {
+            fprintf(stderr, "error: parsing paths failed at line %d. '%s'\n", nline, line);
+            exit(1);
+        }
+
+        cur += n;
+        p->beg = p->end = ctx->npedges;
+
+        int source, target;
+
+        while ( sscanf(cur, " %d-%d%n", &source, &target, &n) == 2 )
+        {
+            int64 e = -1;
+
+            if ( source >= 0 && target >= 0 )
+            {
+                e = edge_find(ctx, source, target);
+            }
+
+            if (e == -1)
+            {
+                fprintf(stderr, "error: path %d uses the edge %d-%d that is not in the graph\n", p->pid, source, target);
+                exit(1);
+            }
+
+            if ( ctx->npedges > p->beg && ctx->edges[ ctx->pedges[ctx->npedges - 1] ].target != source )
+            {
+                fprintf(stderr, "error: path %d is not contiguous at %d-%d\n", p->pid, source, target);
+                exit(1);
+            }
+
+            if (ctx->npedges >= maxpedges)
+            {
+                maxpedges = ctx->npedges * 1.2 + 1000;
+                ctx->pedges = realloc(ctx->pedges, sizeof(uint64) * maxpedges);
+            }
+
+            ctx->pedges[ctx->npedges++] = e;
+
+            cur += n;
+        }
+
+        if ( cur[strspn(cur, " \t\n")] != '\0' )
+        {
+            fprintf(stderr, "error: parsing paths failed at line %d. '%s'\n", nline, line);
+            exit(1);
+        }
+
+        p->end = ctx->npedges;
+        ctx->npaths++;
+    }
+
+    free(line);
+    fclose(fileIn);
+
+    return 1;
+}
+
+// split aggressively at junctions, ie. where a path runs through the end of another one.
+// the ends of the pieces are the longest other path sharing their end vertices.
+
+static void split_paths(Tour2FastaContext* ctx)
+{
+    TourEdge* edges = ctx->edges;
+    uint64* pedges = ctx->pedges;
+    int nvertices = ctx->nvertices;
+
+    unsigned char* vend = malloc(nvertices);
+    bzero(vend, nvertices);
+
+    int max_pid = 0;
+    int i;
+
+    for ( i = 0 ; i < ctx->npaths ; i++ )
+    {
+        TourPath* p = ctx->paths + i;
+
+        if ( p->beg == p->end || ( p->ends[0] != -1 && p->ends[0] == p->ends[1] ) )
+        {
+            continue;
+        }
+
+        vend[ edges[ pedges[p->beg] ].source ] = 1;
+        vend[ edges[ pedges[p->end - 1] ].target ] = 1;
+
+        max_pid = MAX(max_pid, p->pid);
+    }
+
+    int next_pid = 1;
+
+    while ( next_pid < max_pid + 1 )
+    {
+        next_pid *= 10;
+    }
+
+    int maxsplit = ctx->npaths + 1000;
+    int nsplit = 0;
+    TourPath* split = malloc(sizeof(TourPath) * maxsplit);
+
+    for ( i = 0 ; i < ctx->npaths ; i++ )
+    {
+        TourPath* p = ctx->paths + i;
+        uint64 beg = p->beg;
+        uint64 j;
+
+        for ( j = p->beg + 1 ; j + 1 < p->end ; j++ )
+        {
+            if ( !vend[ edges[ pedges[j] ].source ] )
+            {
+                continue;
+            }
+
+            if (nsplit + 1 >= maxsplit)
+            {
+                maxsplit = maxsplit * 1.2 + 1000;
+                split = realloc(split, sizeof(TourPath) * maxsplit);
+            }
+
+            split[nsplit] = *p;
+            split[nsplit].pid = next_pid++;
+            split[nsplit].beg = beg;
+            split[nsplit].end = j;
+            nsplit++;
+
+            beg = j;
+        }
+
+        if (nsplit + 1 >= maxsplit)
+        {
+            maxsplit = maxsplit * 1.2 + 1000;
+            split = realloc(split, sizeof(TourPath) * maxsplit);
+        }
+
+        split[nsplit] = *p;
+        split[nsplit].beg = beg;
+
+        if (beg != p->beg)
+        {
+            split[nsplit].pid = next_pid++;
+        }
+
+        nsplit++;
+    }
+
+    free(vend);
+
+    printf("split %d into %d paths\n", ctx->npaths, nsplit);
+
+    // pieces running through each vertex
+
+    uint64* voff = malloc(sizeof(uint64) * (nvertices + 1));
+    bzero(voff, sizeof(uint64) * (nvertices + 1));
+
+    uint64 j;
+
+    for ( i = 0 ; i < nsplit ; i++ )
+    {
+        for ( j = split[i].beg ; j < split[i].end ; j++ )
+        {
+            voff[ edges[ pedges[j] ].source ] += 1;
+            voff[ edges[ pedges[j] ].target ] += 1;
+        }
+    }
+
+    uint64 off = 0;
+    int v;
+
+    for ( v = 0 ; v <= nvertices ; v++ )
+    {
+        uint64 n = voff[v];
+        voff[v] = off;
+        off += n;
+    }
+
+    int* vpaths = malloc(sizeof(int) * (off + 1));
+
+    for ( i = 0 ; i < nsplit ; i++ )
+    {
+        for ( j = split[i].beg ; j < split[i].end ; j++ )
+        {
+            vpaths[ voff[ edges[ pedges[j] ].source ]++ ] = i;
+            vpaths[ voff[ edges[ pedges[j] ].target ]++ ] = i;
+        }
+    }
+
+    for ( v = nvertices ; v > 0 ; v-- )
+    {
+        voff[v] = voff[v - 1];
+    }
+
+    voff[0] = 0;
+
+    for ( i = 0 ; i < nsplit ; i++ )
+    {
+        TourPath* p = split + i;
+        int k;
+
+        p->ends[0] = p->ends[1] = -1;
+
+        if (p->end - p->beg < 2)
+        {
+            continue;
+        }
+
+        for ( k = 0 ; k < 2 ; k++ )
+        {
+            v = ( k == 0 ) ? edges[ pedges[p->beg] ].source : edges[ pedges[p->end - 1] ].target;
+
+            // longest, the earliest of those equally long
+
+            int best = -1;
+
+            for ( j = voff[v] ; j < voff[v + 1] ; j++ )
+            {
+                TourPath* o = split + vpaths[j];
+
+                if ( o->pid != p->pid &&
+                     ( best == -1 || o->end - o->beg > split[best].end - split[best].beg ) )
+                {
+                    best = vpaths[j];
+                }
+            }
+
+            if (best != -1)
+            {
+                p->ends[k] = split[best].pid;
+            }
+        }
+    }
+
+    free(voff);
+    free(vpaths);
+
+    free(ctx->paths);
+
+    ctx->paths = split;
+    ctx->npaths = nsplit;
+}
+
+// whether the track exists, the source track is optional
+
+static int track_exists(HITS_DB* db, char* track)
+{
+    return access(Catenate(db->path, ".", track, ".a2"), R_OK) == 0 ||
+           access(Catenate(db->path, ".", track, ".anno"), R_OK) == 0;
+}
+
+static void trace_to_posmap(int32_t* trace, int tlen, int alen, int* posmap)
+{
+    int t, a, ac, p;
+    a = ac = 0;
+
+    for ( t = 0 ; t < tlen ; t++ )
+    {
+        p = trace[t];
+
+        if (p < 0)
+        {
+            p = -p - 1;
+
+            while (a < p)
+            {
+                posmap[a] = ac;
+
+                a += 1;
+                ac += 1;
+            }
+
+            ac += 1;
+        }
+        else
+        {
+            p--;
+
+            while (ac < p)
+            {
+                posmap[a] = ac;
+
+                a += 1;
+                ac += 1;
+            }
+
+            posmap[a] = -1;
+            a += 1;
+        }
+    }
+
+    while (a < alen)
+    {
+        posmap[a] = ac;
+
+        a += 1;
+        ac += 1;
+    }
+}
+
+// read holding the bases of the interval b..e of read rid and the interval in it
+
+static int seq_interval(Tour2FastaContext* ctx, SpliceBuffers* sb, int rid, int* b, int* e)
+{
+    if (ctx->postrace == NULL)
+    {
+        return rid;
+    }
+
+    int ridc = ctx->crid[rid];
+
+    if (ridc == -1)
+    {
+        fprintf(stderr, "error: read %d has no corrected read\n", rid);
+        exit(1);
+    }
+
+    track_anno* anno = ctx->postrace->anno;
+    track_data* data = ctx->postrace->data;
+
+    track_anno ob = anno[ridc] / sizeof(track_data);
+    track_anno oe = anno[ridc + 1] / sizeof(track_data);
+
+    int alen = DB_READ_LEN(ctx->db, rid);
+    int* posmap = sb->posmap;
+
+    trace_to_posmap((int32_t*)(data + ob), oe - ob, alen, posmap);
+
+    // as tour2fasta.py, including its handling of intervals that were corrected away
+
+    int ib = *b;
+    int ie = *e;
+    int b_c = -1;
+    int e_c = -1;
+
+    while (b_c == -1 && ib < ie)
+    {
+        b_c = posmap[ib];
+        ib++;
+    }
+
+    if (ib == ie)
+    {
+        *b = *e = alen - 1;
+        return ridc;
+    }
+
+    ie--;
+
+    while (e_c == -1 && ie > ib)
+    {
+        e_c = posmap[ie];
+        ie--;
+    }
+
+    *b = b_c;
+    *e = e_c + 1;
+
+    return ridc;
+}
+
+static void splice(Tour2FastaContext* ctx, SpliceBuffers* sb, int rid, int b, int e, int comp)
+{
+    int rlen = DB_READ_LEN(ctx->db_seq, rid);
+
+    if (sb->nsegs + 1 >= sb->maxsegs)
+    {
+        sb->maxsegs = sb->maxsegs * 1.2 + 100;
+        sb->segs = realloc(sb->segs, sizeof(int) * 3 * sb->maxsegs);
+    }
+
+    int* seg = sb->segs + 3 * sb->nsegs;
+
+    seg[0] = rid;
+    seg[1] = comp ? e : b;
+    seg[2] = comp ? b : e;
+
+    sb->nsegs++;
+
+    b = MAX(0, MIN(b, rlen));
+    e = MAX(0, MIN(e, rlen));
+
+    if (b >= e)
+    {
+        return;
+    }
+
+    int len = e - b;
+
+    if (sb->nseq + len >= sb->maxseq)
+    {
+        sb->maxseq = (sb->nseq + len) * 1.2 + 1000;
+        sb->seq = realloc(sb->seq, sb->maxseq);
+    }
+
+    char* read = Load_Subread(ctx->db_seq, rid, b, e, sb->read, 0);
+    char* seq = sb->seq + sb->nseq;
+
+    if (comp)
+    {
+        int i;
+        for ( i = 0 ; i < len ; i++ )
+        {
+            seq[i] = 3 - read[len - 1 - i];
+        }
+    }
+    else
+    {
+        memcpy(seq, read, len);
+    }
+
+    sb->nseq += len;
+}
+
+static void splice_path(Tour2FastaContext* ctx, SpliceBuffers* sb, TourPath* p)
+{
+    TourEdge* edges = ctx->edges;
+    int* vread = ctx->vread;
+
+    sb->nseq = 0;
+    sb->nsegs = 0;
+
+    TourEdge* e = edges + ctx->pedges[p->beg];
+    int comp = ( e->end == 'l' );
+
+    int rid = vread[e->source];
+    int b, e_trim;
+
+    get_trim(ctx->db, ctx->trim, rid, &b, &e_trim);
+
+    int rid_seq = seq_interval(ctx, sb, rid, &b, &e_trim);
+    splice(ctx, sb, rid_seq, b, e_trim, comp);
+
+    uint64 i;
+    for ( i = p->beg ; i < p->end ; i++ )
+    {
+        e = edges + ctx->pedges[i];
+        rid = vread[e->target];
+
+        int trim_b, trim_e;
+        get_trim(ctx->db, ctx->trim, rid, &trim_b, &trim_e);
+
+        if (e->flags & OVL_COMP)
+        {
+            comp = !comp;
+        }
+
+        if (comp)
+        {
+            b = trim_b;
+            e_trim = trim_b + e->length;
+        }
+        else
+        {
+            b = trim_e - e->length;
+            e_trim = trim_e;
+        }
+
+        rid_seq = seq_interval(ctx, sb, rid, &b, &e_trim);
+        splice(ctx, sb, rid_seq, b, e_trim, comp);
+    }
+}
+
+// reads of the paths beg .. end-1 are about to be spliced
+
+static void prefetch_paths(Tour2FastaContext* ctx, int beg, int end)
+{
+    int i;
+    for ( i = beg ; i < end ; i++ )
+    {
+        TourPath* p = ctx->paths + i;
+        uint64 j;
+
+        for ( j = p->beg ; j < p->end ; j++ )
+        {
+            TourEdge* e = ctx->edges + ctx->pedges[j];
+            int rid = ctx->vread[e->target];
+
+            if (j == p->beg)
+            {
+                int src = ctx->vread[e->source];
+                src = ctx->crid ? ctx->crid[src] : src;
+
+                if (src != -1)
+                {
+                    Prefetch_Bases(ctx->db_seq, src, src + 1);
+                }
+            }
+
+            rid = ctx->crid ? ctx->crid[rid] : rid;
+
+            if (rid != -1)
+            {
+                Prefetch_Bases(ctx->db_seq, rid, rid + 1);
+            }
+        }
+    }
+}
+
+static int64 path_weight(void* arg, int i)
+{
+    Tour2FastaContext* ctx = (Tour2FastaContext*)arg;
+    TourPath* p = ctx->paths + i;
+    int64 weight = 0;
+    uint64 j;
+
+    for ( j = p->beg ; j < p->end ; j++ )
+    {
+        TourEdge* e = ctx->edges + ctx->pedges[j];
+
+        if (j == p->beg)
+        {
+            weight += DB_READ_LEN(ctx->db, ctx->vread[e->source]);
+        }
+
+        weight += e->length;
+    }
+
+    return weight;
+}
+
+static void format_paths(void* arg, int beg, int end, fasta_buffer* buf)
+{
+    Tour2FastaContext* ctx = (Tour2FastaContext*)arg;
+    SpliceBuffers sb;
+
+    bzero(&sb, sizeof(SpliceBuffers));
+
+    sb.read = New_Read_Buffer(ctx->db_seq);
+
+    if (ctx->postrace)
+    {
+        sb.posmap = malloc(sizeof(int) * (DB_READ_MAXLEN(ctx->db) + 1));
+    }
+
+    prefetch_paths(ctx, beg, end);
+
+    int i, j;
+    for ( i = beg ; i < end ; i++ )
+    {
+        TourPath* p = ctx->paths + i;
+
+        if (p->beg == p->end)
+        {
+            ctx->plen[i] = 0;
+            continue;
+        }
+
+        splice_path(ctx, &sb, p);
+
+        ctx->plen[i] = sb.nseq;
+
+        fasta_printf(buf, ">%s_%d path=%d ends=%d,%d length=%lld reads=",
+                     ctx->prefix, p->pid, p->pid, p->ends[0], p->ends[1], sb.nseq);
+
+        for ( j = 0 ; j < sb.nsegs ; j++ )
+        {
+            int* seg = sb.segs + 3 * j;
+
+            fasta_printf(buf, "%s%d,%d,%d", j ? "," : "", seg[0], seg[1], seg[2]);
+        }
+
+        fasta_append(buf, " sreads=", 8);
+
+        if (ctx->source)
+        {
+            track_anno* anno = ctx->source->anno;
+            track_data* data = ctx->source->data;
+            uint64 k;
+
+            int rid = ctx->vread[ ctx->edges[ ctx->pedges[p->beg] ].source ];
+
+            fasta_printf(buf, "%d", data[ anno[rid] / sizeof(track_data) ]);
+
+            for ( k = p->beg ; k < p->end ; k++ )
+            {
+                rid = ctx->vread[ ctx->edges[ ctx->pedges[k] ].target ];
+
+                fasta_printf(buf, ",%d", data[ anno[rid] / sizeof(track_data) ]);
+            }
+        }
+
+        fasta_append(buf, "\n", 1);
+
+        for ( j = 0 ; j < sb.nseq ; j++ )
+        {
+            sb.seq[j] = "acgt"[ (int)sb.seq[j] ];
+        }
+
+        if (sb.nseq == 0)
+        {
+            fasta_append(buf, "\n", 1);
+        }
+        else
+        {
+            fasta_wrap(buf, sb.seq, sb.nseq, FASTA_WIDTH);
+        }
+    }
+
+    free(sb.read - 1);
+    free(sb.posmap);
+    free(sb.seq);
+    free(sb.segs);
+}
+
+// the reads of the paths and the blocks they are in, 0 if the database was not split
+
+static int rids_write(Tour2FastaContext* ctx, const char* path, const char* pathDb)
+{
+    FILE* fileOut = fopen(path, "w");
+
+    if (fileOut == NULL)
+    {
+        return 0;
+    }
+
+    int nreads = ctx->db->nreads;
+    unsigned char* used = malloc(nreads);
+    bzero(used, nreads);
+
+    int i;
+    uint64 j;
+
+    for ( i = 0 ; i < ctx->npaths ; i++ )
+    {
+        TourPath* p = ctx->paths + i;
+
+        for ( j = p->beg ; j < p->end ; j++ )
+        {
+            TourEdge* e = ctx->edges + ctx->pedges[j];
+
+            used[ ctx->vread[e->source] ] = used[ ctx->vread[e->target] ] = 1;
+        }
+    }
+
+    int nblocks;
+    int* bounds = DB_Block_Bounds((char*)pathDb, &nblocks);
+    int block = 0;
+
+    for ( i = 0 ; i < nreads ; i++ )
+    {
+        if ( !used[i] )
+        {
+            continue;
+        }
+
+        if (bounds)
+        {
+            while ( block < nblocks && i >= bounds[block] )
+            {
+                block++;
+            }
+        }
+
+        fprintf(fileOut, "%d %d\n", i, block);
+    }
+
+    free(bounds);
+    free(used);
+
+    fclose(fileOut);
+
+    return 1;
+}
+
+static void usage()
+{
+    printf("usage: [-s] [-p prefix] [-t track] [-c corrected.db] [-r rids] [-j n] database graph.graphml paths ...\n\n");
+
+    printf("Writes the sequences of the toured paths of each graph to <graph>.fasta.\n\n");
+
+    printf("options: -s  split paths at junctions with the ends of other paths\n");
+    printf("         -p  fasta sequence name prefix (default %s)\n", DEF_ARG_P);
+    printf("         -t  trim track used to build the overlap graph (default %s)\n", DEF_ARG_T);
+    printf("         -c  database containing the corrected reads\n");
+    printf("         -r  write the reads of the paths and their blocks to this file\n");
+    printf("         -j  number of threads (default %d)\n", DEF_ARG_J);
+}
+
+int main(int argc, char* argv[])
+{
+    HITS_DB db, dbc;
+    Tour2FastaContext ctx;
+
+    bzero(&ctx, sizeof(Tour2FastaContext));
+
+    char* prefix = DEF_ARG_P;
+    char* nameTrim = DEF_ARG_T;
+    char* pathCorrected = NULL;
+    char* pathRids = NULL;
+    int nthreads = DEF_ARG_J;
+    int split = 0;
+
+    // process arguments
+
+    opterr = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "sp:t:c:r:j:")) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                      split = 1;
+                      break;
+
+            case 'p':
+                      prefix = optarg;
+                      break;
+
+            case 't':
+                      nameTrim = optarg;
+                      break;
+
+            case 'c':
+                      pathCorrected = optarg;
+                      break;
+
+            case 'r':
+                      pathRids = optarg;
+                      break;
+
+            case 'j':
+                      nthreads = atoi(optarg);
+                      break;
+
+            default:
+                      usage();
+                      exit(1);
+        }
+    }
+
+    if (argc - optind < 3 || (argc - optind - 1) % 2)
+    {
+        usage();
+        exit(1);
+    }
+
+    if (nthreads < 1)
+    {
+        fprintf(stderr, "error: invalid number of threads\n");
+        exit(1);
+    }
+
+    char* pathDb = argv[optind++];
+
+    if (Open_DB(pathDb, &db))
+    {
+        fprintf(stderr, "could not open '%s'\n", pathDb);
+        exit(1);
+    }
+
+    ctx.db = ctx.db_seq = &db;
+    ctx.prefix = prefix;
+
+    if ( !(ctx.trim = track_load(&db, nameTrim)) )
+    {
+        fprintf(stderr, "error: failed to load track %s\n", nameTrim);
+        exit(1);
+    }
+
+    if ( track_exists(&db, TRACK_SOURCE) )
+    {
+        ctx.source = track_load(&db, TRACK_SOURCE);
+    }
+
+    if (pathCorrected)
+    {
+        if (Open_DB(pathCorrected, &dbc))
+        {
+            fprintf(stderr, "could not open '%s'\n", pathCorrected);
+            exit(1);
+        }
+
+        HITS_TRACK* tsrc = track_load(&dbc, TRACK_SOURCE);
+
+        if ( tsrc == NULL || !(ctx.postrace = track_load(&dbc, TRACK_POSTRACE)) )
+        {
+            fprintf(stderr, "error: failed to load the tracks %s and %s of %s\n", TRACK_SOURCE, TRACK_POSTRACE, pathCorrected);
+            exit(1);
+        }
+
+        track_anno* anno = tsrc->anno;
+        track_data* data = tsrc->data;
+
+        ctx.crid = malloc(sizeof(int) * db.nreads);
+        memset(ctx.crid, -1, sizeof(int) * db.nreads);
+
+        int i;
+        for ( i = 0 ; i < dbc.nreads ; i++ )
+        {
+            int srid = data[ anno[i] / sizeof(track_data) ];
+
+            if (srid < 0 || srid >= db.nreads)
+            {
+                fprintf(stderr, "error: corrected read %d has an invalid source read %d\n", i, srid);
+                exit(1);
+            }
+
+            ctx.crid[srid] = i;
+        }
+
+        ctx.db_seq = &dbc;
+    }
+
+    Map_Bases(ctx.db_seq);
+
+    fasta_out fo;
+
+    bzero(&fo, sizeof(fasta_out));
+    fo.db = ctx.db_seq;
+    fo.format = format_paths;
+    fo.weight = path_weight;
+    fo.arg = &ctx;
+    fo.nthreads = nthreads;
+
+    for ( ; optind < argc ; optind += 2 )
+    {
+        char* pathGraph = argv[optind];
+        char* pathPaths = argv[optind + 1];
+
+        printf("loading graph %s\n", pathGraph);
+
+        if ( !read_graph(&ctx, pathGraph) )
+        {
+            fprintf(stderr, "error: failed to read %s\n", pathGraph);
+            exit(1);
+        }
+
+        if ( !read_paths(&ctx, pathPaths) )
+        {
+            fprintf(stderr, "error: failed to read %s\n", pathPaths);
+            exit(1);
+        }
+
+        if (split)
+        {
+            split_paths(&ctx);
+        }
+
+        char path[PATH_MAX];
+        char* dot = strrchr(pathGraph, '.');
+        int baselen = dot ? (int)(dot - pathGraph) : (int)strlen(pathGraph);
+
+        sprintf(path, "%.*s.fasta", baselen, pathGraph);
+
+        FILE* fileOut = fopen(path, "w");
+
+        if (fileOut == NULL)
+        {
+            fprintf(stderr, "error: failed to open %s\n", path);
+            exit(1);
+        }
+
+        ctx.plen = malloc(sizeof(int64) * (ctx.npaths + 1));
+
+        if ( fasta_out_write(&fo, fileOut, 0, ctx.npaths) != 0 || fclose(fileOut) != 0 )
+        {
+            fprintf(stderr, "error: failed to write %s\n", path);
+            exit(1);
+        }
+
+        int64 total = 0;
+        int i;
+
+        for ( i = 0 ; i < ctx.npaths ; i++ )
+        {
+            total += ctx.plen[i];
+        }
+
+        printf("wrote %d paths of %lld bases to %s\n", ctx.npaths, total, path);
+
+        if (pathRids && !rids_write(&ctx, pathRids, pathDb))
+        {
+            fprintf(stderr, "error: failed to write %s\n", pathRids);
+            exit(1);
+        }
+
+        free(ctx.plen);
+        free(ctx.paths);
+        free(ctx.pedges);
+        free(ctx.edges);
+        free(ctx.vread);
+
+        ctx.plen = NULL;
+        ctx.paths = NULL;
+        ctx.pedges = NULL;
+        ctx.edges = NULL;
+        ctx.vread = NULL;
+        ctx.nvertices = 0;
+    }
+
+    // cleanup, the tracks are closed along with their database
+
+    if (pathCorrected)
+    {
+        free(ctx.crid);
+
+        Close_DB(&dbc);
+    }
+
+    Close_DB(&db);
+
+    return 0;
+}
@@ -12,6 +12,9 @@
  *  Date  	:  Jul 29, 2014 - added average movie time in respect to subread length
  *                        	- fixed bug: percentage of fragments
  *
+ *            	- base call streams are read in chunks of whole ZMWs,
+ *            	  bax files are processed in parallel (-j) and written in input order
+ *
  *
  ********************************************************************************************/
 
@@ -20,6 +23,7 @@
 #include <ctype.h>
 #include <hdf5.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,6 +39,34 @@
 
 #include "H5dextractUtils.h"
 
+// the hdf5 library is usually not built thread safe, all calls into it are serialized
+
+static pthread_mutex_t hdf5Lock = PTHREAD_MUTEX_INITIALIZER;
+
+// per base streams, in the order of BaxData.streamSet
+
+static char* baxStreamPath[ BAX_STREAMS ] = {
+    "/PulseData/BaseCalls/Basecall",
+    "/PulseData/BaseCalls/QualityValue",
+    "/PulseData/BaseCalls/DeletionQV",
+    "/PulseData/BaseCalls/DeletionTag",
+    "/PulseData/BaseCalls/InsertionQV",
+    "/PulseData/BaseCalls/MergeQV",
+    "/PulseData/BaseCalls/SubstitutionQV",
+    "/PulseData/BaseCalls/WidthInFrames",
+    "/PulseData/BaseCalls/PreBaseFrames"};
+
+static int baxStreamError[ BAX_STREAMS ] = {
+    BAX_BASECALL_ERR,
+    BAX_QV_ERR,
+    BAX_DELETIONQV_ERR,
+    BAX_DELETIONTAG_ERR,
+    BAX_INSERTIONQV_ERR,
+    BAX_MERGEQV_ERR,
+    BAX_SUBSTITUTIONQV_ERR,
+    BAX_WIDTHINFRAMES_ERR,
+    BAX_PREBASEFRAMES_ERR};
+
 // Fetch the relevant contents of the current bax.h5 file and return the H5 file id.
 
 static int getAttribute( hid_t file_id, char* groupName, char* attrName, char** buffer )
@@ -80,17 +112,34 @@ static int getAttribute( hid_t file_id, char* groupName, char* attrName, char**
     return 0;
 }
 
-static int getBaxData( BaxData* b, BAX_OPT* bopt )
+static void closeBaxFile( BaxData* b )
+{
+    int i;
+    for ( i = 0; i < BAX_STREAMS; i++ )
+    {
+        if ( b->streamSet[ i ] >= 0 )
+            H5Dclose( b->streamSet[ i ] );
+        b->streamSet[ i ] = -1;
+    }
+
+    if ( b->fileId >= 0 )
+        H5Fclose( b->fileId );
+    b->fileId = -1;
+}
+
+// the per ZMW streams are read completely, the per base streams are only opened
+// and read chunk wise by loadBaxChunk
+
+static int fetchBaxData( BaxData* b, BAX_OPT* bopt )
 {
     hid_t field_space;
     hid_t field_set;
     hsize_t field_len[ 1 ];
     hid_t file_id;
     herr_t stat;
+    int i;
 
-    H5Eset_auto( H5E_DEFAULT, 0, 0 ); // silence hdf5 error stack
-
-    file_id = H5Fopen( b->fullName, H5F_ACC_RDONLY, H5P_DEFAULT );
+    file_id = b->fileId = H5Fopen( b->fullName, H5F_ACC_RDONLY, H5P_DEFAULT );
     if ( file_id < 0 )
         return ( CANNOT_OPEN_BAX_FILE );
 
@@ -100,31 +149,34 @@ static int getBaxData( BaxData* b, BAX_OPT* bopt )
         field_space = H5Dget_space( field_set );
         if ( field_set < 0 || field_space < 0 )
         {
-            H5Fclose( file_id );
             return ( BAX_BASECALL_ERR );
         }
         H5Sget_simple_extent_dims( field_space, field_len, NULL );
         b->numBase = field_len[ 0 ];
+        H5Sclose( field_space );
+        H5Dclose( field_set );
 
         field_set   = H5Dopen2( file_id, "/PulseData/BaseCalls/ZMW/NumEvent", H5P_DEFAULT );
         field_space = H5Dget_space( field_set );
         if ( field_set < 0 || field_space < 0 )
         {
-            H5Fclose( file_id );
             return ( BAX_NR_EVENTS_ERR );
         }
         H5Sget_simple_extent_dims( field_space, field_len, NULL );
         b->numZMW = field_len[ 0 ];
+        H5Sclose( field_space );
+        H5Dclose( field_set );
 
         field_set   = H5Dopen2( file_id, "/PulseData/Regions", H5P_DEFAULT );
         field_space = H5Dget_space( field_set );
         if ( field_set < 0 || field_space < 0 )
         {
-            H5Fclose( file_id );
             return ( BAX_REGION_ERR );
         }
         H5Sget_simple_extent_dims( field_space, field_len, NULL );
         b->numRegion = field_len[ 0 ];
+        H5Sclose( field_space );
+        H5Dclose( field_set );
 
         if ( getAttribute( file_id, "/ScanData/RunInfo", "SequencingKit", &( b->sequencingKit ) ) < 0 )
             fprintf( stderr, "Cannot read attribute \"SequencingKit\" from group \"/ScanData/RunInfo\" from file %s. \n", b->fullName );
@@ -136,7 +188,7 @@ static int getBaxData( BaxData* b, BAX_OPT* bopt )
         getAttribute( file_id, "/ScanData/RunInfo", "SequencingChemistry", &( b->sequencingChemistry ) );
     }
 
-    ensureCapacity( b, b->numBase, b->numZMW, b->numRegion );
+    ensureCapacity( b, b->numBase < BAX_CHUNK_BASES ? b->numBase : BAX_CHUNK_BASES, b->numZMW, b->numRegion );
 
 // type is an "enum" :
 // 0 -- unsigned char
@@ -152,10 +204,7 @@ static int getBaxData( BaxData* b, BAX_OPT* bopt )
         field_set   = H5Dopen2( file_id, path, H5P_DEFAULT );                                            \
         field_space = H5Dget_space( field_set );                                                         \
         if ( field_set < 0 || field_space < 0 )                                                          \
-        {                                                                                                \
-            H5Fclose( file_id );                                                                         \
             return ( error );                                                                            \
-        }                                                                                                \
         switch ( type )                                                                                  \
         {                                                                                                \
             case 0:                                                                                      \
@@ -202,13 +251,11 @@ static int getBaxData( BaxData* b, BAX_OPT* bopt )
         if ( b->region[ 0 ] > bopt->wellNumbers[ bopt->curBaxFile ][ bopt->numWellNumbers[ bopt->curBaxFile ] - 2 ] )
         {
             printf( "first zmw of %d > %d (last zmw in selection range)\n", b->region[ 0 ], bopt->wellNumbers[ bopt->curBaxFile ][ bopt->numWellNumbers[ bopt->curBaxFile ] - 2 ] );
-            H5Fclose( file_id );
             return IGNORE_BAX;
         }
         if ( b->region[ ( b->numRegion - 1 ) * 5 ] < bopt->wellNumbers[ bopt->curBaxFile ][ 0 ] )
         {
             printf( "last zmw of %d < %d (first zmw in selection range)\n", b->region[ ( b->numRegion - 1 ) * 5 ], bopt->wellNumbers[ bopt->curBaxFile ][ 0 ] );
-            H5Fclose( file_id );
             return IGNORE_BAX;
         }
     }
@@ -217,28 +264,126 @@ static int getBaxData( BaxData* b, BAX_OPT* bopt )
     FETCH( hqRegionBegTime, "/PulseData/BaseCalls/ZMWMetrics/HQRegionStartTime", BAX_HQREGIONSTARTTIME_ERR, 6 );
     FETCH( hqRegionEndTime, "/PulseData/BaseCalls/ZMWMetrics/HQRegionEndTime", BAX_HQREGIONENDTIME_ERR, 6 );
 
-    // Get all quality streams
-    FETCH( baseCall, "/PulseData/BaseCalls/Basecall", BAX_BASECALL_ERR, 0 )
-    FETCH( fastQV, "/PulseData/BaseCalls/QualityValue", BAX_QV_ERR, 0 )
-    FETCH( delQV, "/PulseData/BaseCalls/DeletionQV", BAX_DELETIONQV_ERR, 0 )
-    FETCH( delTag, "/PulseData/BaseCalls/DeletionTag", BAX_DELETIONTAG_ERR, 0 )
-    FETCH( insQV, "/PulseData/BaseCalls/InsertionQV", BAX_INSERTIONQV_ERR, 0 )
-    FETCH( mergeQV, "/PulseData/BaseCalls/MergeQV", BAX_MERGEQV_ERR, 0 )
-    FETCH( subQV, "/PulseData/BaseCalls/SubstitutionQV", BAX_SUBSTITUTIONQV_ERR, 0 )
-
-    // Get times for single base calls
-    FETCH( widthInFrames, "/PulseData/BaseCalls/WidthInFrames", BAX_WIDTHINFRAMES_ERR, 2 );
-    FETCH( preBaseFrames, "/PulseData/BaseCalls/PreBaseFrames", BAX_PREBASEFRAMES_ERR, 2 );
-
     // Get additional ZMW statistics
     FETCH( pausiness, "/PulseData/BaseCalls/ZMWMetrics/Pausiness", BAX_PAUSINESS_ERR, 6 );
     FETCH( productivity, "/PulseData/BaseCalls/ZMWMetrics/Productivity", BAX_PRODUCTIVITY_ERR, 0 );
     FETCH( readType, "/PulseData/BaseCalls/ZMWMetrics/ReadType", BAX_READTYPE_ERR, 0 );
 
-    H5Fclose( file_id );
+    // Open all quality streams and the times for single base calls
+    for ( i = 0; i < BAX_STREAMS; i++ )
+    {
+        b->streamSet[ i ] = H5Dopen2( file_id, baxStreamPath[ i ], H5P_DEFAULT );
+        if ( b->streamSet[ i ] < 0 )
+            return ( baxStreamError[ i ] );
+    }
+
+    b->chunkBeg = b->chunkEnd = 0;
+
     return ( 0 );
 }
 
+static int getBaxData( BaxData* b, BAX_OPT* bopt )
+{
+    int ecode;
+
+    pthread_mutex_lock( &hdf5Lock );
+
+    ecode = fetchBaxData( b, bopt );
+    if ( ecode < 0 )
+        closeBaxFile( b );
+
+    pthread_mutex_unlock( &hdf5Lock );
+
+    return ecode;
+}
+
+static void closeBaxData( BaxData* b )
+{
+    pthread_mutex_lock( &hdf5Lock );
+    closeBaxFile( b );
+    pthread_mutex_unlock( &hdf5Lock );
+}
+
+// read the bases [beg, beg + len) of all per base streams into the stream buffers
+
+static int readBaxChunk( BaxData* b, int beg, int len )
+{
+    void* buffer[ BAX_STREAMS ] = {b->baseCall, b->fastQV, b->delQV, b->delTag, b->insQV, b->mergeQV, b->subQV, b->widthInFrames, b->preBaseFrames};
+    hsize_t offset[ 1 ] = {beg};
+    hsize_t count[ 1 ]  = {len};
+    hid_t mem_space, field_space;
+    herr_t stat;
+    int i, ecode;
+
+    b->chunkBeg = beg;
+    b->chunkEnd = beg;
+
+    if ( len == 0 )
+        return 0;
+
+    ecode = 0;
+
+    pthread_mutex_lock( &hdf5Lock );
+
+    mem_space = H5Screate_simple( 1, count, NULL );
+
+    for ( i = 0; i < BAX_STREAMS && ecode == 0; i++ )
+    {
+        field_space = H5Dget_space( b->streamSet[ i ] );
+        if ( field_space < 0 )
+        {
+            ecode = baxStreamError[ i ];
+            break;
+        }
+
+        stat = H5Sselect_hyperslab( field_space, H5S_SELECT_SET, offset, NULL, count, NULL );
+        if ( stat >= 0 )
+            stat = H5Dread( b->streamSet[ i ], ( i < BAX_STREAMS - 2 ) ? H5T_NATIVE_UCHAR : H5T_NATIVE_USHORT, mem_space, field_space, H5P_DEFAULT, buffer[ i ] );
+
+        if ( stat < 0 )
+            ecode = baxStreamError[ i ];
+
+        H5Sclose( field_space );
+    }
+
+    H5Sclose( mem_space );
+
+    pthread_mutex_unlock( &hdf5Lock );
+
+    if ( ecode == 0 )
+        b->chunkEnd = beg + len;
+
+    return ecode;
+}
+
+// make sure the bases of the current ZMW are loaded. the chunk starts with the
+// ZMW and is extended by the following ZMWs as long as it stays below BAX_CHUNK_BASES
+
+static int loadBaxChunk( BaxData* b, ZMW* zmw )
+{
+    int idx = zmw->index - 1;
+    int beg = zmw->roff;
+    int end = beg + b->numEvent[ idx ];
+
+    if ( b->chunkBeg <= beg && end <= b->chunkEnd )
+        return 0;
+
+    for ( idx = idx + 1; idx < b->numZMW; idx++ )
+    {
+        if ( end + b->numEvent[ idx ] - beg > BAX_CHUNK_BASES )
+            break;
+
+        end += b->numEvent[ idx ];
+    }
+
+    if ( end > b->numBase )
+        end = b->numBase;
+
+    ensureCapacity( b, end - beg, 0, 0 );
+
+    return readBaxChunk( b, beg, end - beg );
+}
+
 static void printBaxStatisticHeader( BaxStatistic* s, BAX_OPT* bopt )
 {
     FILE* out = bopt->statFile;
@@ -563,7 +708,7 @@ static void getSlowPolymeraseRegions( ZMW* zmw )
 
     slowPolymeraseRegions* spr;
     double lmu, lsig;
-    static double help[ 100000 ];
+    static __thread double help[ 100000 ];
     int segW                 = zmw->spr->segmentWidth;
     int segS                 = zmw->spr->shift;
     int numSuspBaseThreshold = ( segW * 0.5 ) + 1;
@@ -753,8 +898,8 @@ static int getSubreads( BaxData* b, ZMW* zmw, BAX_OPT* bopt )
             int tmpSubreadFrames = 0;
             int curBase          = 0;
             unsigned short *pPBF, *pWIF;
-            pPBF                 = b->preBaseFrames + zmw->roff;
-            pWIF                 = b->widthInFrames + zmw->roff;
+            pPBF                 = b->preBaseFrames + ( zmw->roff - b->chunkBeg );
+            pWIF                 = b->widthInFrames + ( zmw->roff - b->chunkBeg );
             zmw->insTimeBeg[ i ] = zmw->insTimeEnd[ i ] = -1;
 
             for ( j = 0; j < zmw->insEnd[ i ]; j++ )
@@ -849,7 +994,7 @@ static int getSubreads( BaxData* b, ZMW* zmw, BAX_OPT* bopt )
         if ( zmw->toReport == 0 )
             continue;
 
-        tmpOff = zmw->roff + zmw->insBeg[ i ];
+        tmpOff = zmw->roff - b->chunkBeg + zmw->insBeg[ i ];
 
         // set subread stream pointer
         zmw->fragSequ[ i ]      = b->baseCall + tmpOff;
@@ -943,14 +1088,14 @@ static int isInSelectedWellRange( ZMW* zmw, BAX_OPT* bopt )
     return 0;
 }
 
-static void getBaxStats( BaxData* b, BaxStatistic* s, BAX_OPT* bopt )
+static int getBaxStats( BaxData* b, BaxStatistic* s, BAX_OPT* bopt )
 {
     ZMW zmw;
     initZMW( &zmw );
 
     int i = 0, j = 0;
 
-    int hqLen;
+    int hqLen, ecode;
 #if MEASURE_TIME
     clock_t begin, end;
 #endif
@@ -976,6 +1121,10 @@ static void getBaxStats( BaxData* b, BaxStatistic* s, BAX_OPT* bopt )
         if ( zmw.numFrag < bopt->zmw_minNrOfSubReads )
             continue;
 
+        // fetch the base call streams of the ZMW
+        if ( ( ecode = loadBaxChunk( b, &zmw ) ) < 0 )
+            return ecode;
+
 // determine which subreads should be reported
 
 #if MEASURE_TIME
@@ -1185,6 +1334,201 @@ static void getBaxStats( BaxData* b, BaxStatistic* s, BAX_OPT* bopt )
             printf( "ins %d: %d %d -> report? %d\n ", i, zmw.insBeg[ i ], zmw.insEnd[ i ], zmw.toReport[ i ] );
 #endif
     }
+
+    return 0;
+}
+
+#define BAX_OUT         4          // stat, fasta, fastq, quiva
+#define CHUNK_BUFFER    ( 1 << 20 )
+
+// bax files are handed out to the threads in input order, the output of each file
+// goes to temporary files that are appended to the final output files in input order
+
+typedef struct
+{
+    pthread_mutex_t lock;
+
+    BAX_OPT* bopt;
+    BaxStatistic* stat;         // cumulative statistic
+
+    int next;                   // next bax file to process
+    int nwritten;               // bax files appended to the output
+    int writing;
+
+    FILE** out;                 // BAX_OUT temporary files for each bax file
+    char* done;
+} bax_queue;
+
+static void bax_out_files( BAX_OPT* bopt, FILE** out )
+{
+    out[ 0 ] = bopt->statFile;
+    out[ 1 ] = bopt->fastaFile;
+    out[ 2 ] = bopt->fastqFile;
+    out[ 3 ] = bopt->quivaFile;
+}
+
+static void write_bax_files( bax_queue* queue )
+{
+    char* buf = NULL;
+    FILE* fileOut[ BAX_OUT ];
+
+    bax_out_files( queue->bopt, fileOut );
+
+    pthread_mutex_lock( &( queue->lock ) );
+
+    while ( !queue->writing && queue->nwritten < queue->bopt->nBax && queue->done[ queue->nwritten ] )
+    {
+        int c = queue->nwritten;
+        int o;
+
+        queue->writing = 1;
+
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        if ( buf == NULL )
+            buf = malloc( CHUNK_BUFFER );
+
+        for ( o = 0; o < BAX_OUT; o++ )
+        {
+            FILE* fileChunk = queue->out[ c * BAX_OUT + o ];
+            size_t len;
+
+            if ( fileChunk == NULL )
+                continue;
+
+            rewind( fileChunk );
+
+            while ( ( len = fread( buf, 1, CHUNK_BUFFER, fileChunk ) ) > 0 )
+                fwrite( buf, 1, len, fileOut[ o ] );
+
+            fclose( fileChunk );
+            queue->out[ c * BAX_OUT + o ] = NULL;
+        }
+
+        fflush( fileOut[ 0 ] );
+
+        pthread_mutex_lock( &( queue->lock ) );
+
+        queue->nwritten += 1;
+        queue->writing = 0;
+    }
+
+    pthread_mutex_unlock( &( queue->lock ) );
+
+    free( buf );
+}
+
+static void* bax_thread( void* arg )
+{
+    bax_queue* queue = arg;
+    BAX_OPT bopt     = *( queue->bopt );
+    int parallel     = ( bopt.nThreads > 1 );
+
+    BaxData b;
+    initBaxData( &b );
+
+    BaxStatistic s;
+    initBaxStatistic( &s, &bopt );
+
+    while ( 1 )
+    {
+        int i, o, ecode;
+
+        pthread_mutex_lock( &( queue->lock ) );
+        i = queue->next;
+        queue->next += 1;
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        if ( i >= bopt.nBax )
+            break;
+
+        // the output of a single thread goes straight to the output files
+
+        if ( parallel )
+        {
+            FILE* fileOut[ BAX_OUT ];
+            FILE** out = queue->out + i * BAX_OUT;
+
+            bax_out_files( queue->bopt, fileOut );
+
+            for ( o = 0; o < BAX_OUT; o++ )
+            {
+                if ( fileOut[ o ] != NULL && ( out[ o ] = tmpfile() ) == NULL )
+                {
+                    fprintf( stderr, "failed to create temporary file\n" );
+                    exit( 1 );
+                }
+            }
+
+            bopt.statFile  = out[ 0 ];
+            bopt.fastaFile = out[ 1 ];
+            bopt.fastqFile = out[ 2 ];
+            bopt.quivaFile = out[ 3 ];
+        }
+
+        bopt.curBaxFile = i;
+        if ( !bopt.CUMULATIVE )
+            resetBaxStatistic( &s );
+        initBaxNames( &b, bopt.baxIn[ i ] );
+
+#if MEASURE_TIME
+        clock_t begin, end;
+        begin = clock();
+#endif
+
+        ecode = getBaxData( &b, &bopt ); // parse bax.h5 file
+
+#if MEASURE_TIME
+        end = clock();
+        printf( "FETCH TIME: %f\n", (double)( end - begin ) / CLOCKS_PER_SEC );
+#endif
+
+        if ( ecode >= 0 )
+        {
+            s.nFiles++;
+#if MEASURE_TIME
+            begin = clock();
+#endif
+            ecode = getBaxStats( &b, &s, &bopt );
+
+            closeBaxData( &b );
+#if MEASURE_TIME
+            end = clock();
+            printf( "EXTRACT TIME: %f\n", (double)( end - begin ) / CLOCKS_PER_SEC );
+#endif
+        }
+
+        if ( ecode >= 0 )
+        {
+            if ( !bopt.CUMULATIVE )
+                printBaxStatistic( &s, bopt.statFile );
+
+            fflush( stdout );
+        }
+        else
+        {
+            fprintf( stderr, " Skipping %s due to failure\n", b.fullName );
+            printBaxError( ecode );
+        }
+
+        pthread_mutex_lock( &( queue->lock ) );
+        queue->done[ i ] = 1;
+        pthread_mutex_unlock( &( queue->lock ) );
+
+        write_bax_files( queue );
+    }
+
+    if ( bopt.CUMULATIVE )
+    {
+        pthread_mutex_lock( &( queue->lock ) );
+        mergeBaxStatistic( queue->stat, &s );
+        pthread_mutex_unlock( &( queue->lock ) );
+    }
+
+    freeBaxData( &b );
+    freeBaxStatistic( &s );
+
+    return NULL;
 }
 
 int main( int argc, char* argv[] )
@@ -1205,11 +1549,9 @@ int main( int argc, char* argv[] )
     if ( bopt->VERBOSE > 1 )
         printBaxOptions( bopt );
 
-    /* here, do your time-consuming job */
-
-    BaxData b;
+    H5Eset_auto( H5E_DEFAULT, 0, 0 ); // silence hdf5 error stack
 
-    initBaxData( &b );
+    /* here, do your time-consuming job */
 
     BaxStatistic s;
     initBaxStatistic( &s, bopt );
@@ -1219,52 +1561,47 @@ int main( int argc, char* argv[] )
     end = clock();
     printf( "INIT TIME: %f\n", (double)( end - begin ) / CLOCKS_PER_SEC );
 #endif
+
     {
-        int i, ecode;
-        for ( i = 0; i < bopt->nBax; i++ )
-        {
-            bopt->curBaxFile = i;
-            if ( !bopt->CUMULATIVE )
-                resetBaxStatistic( &s );
+        int nthreads = bopt->nThreads;
+        int i;
 
-            initBaxNames( &b, bopt->baxIn[ i ] );
-#if MEASURE_TIME
-            begin = clock();
-#endif
+        if ( nthreads > bopt->nBax )
+            nthreads = bopt->nBax;
 
-            ecode = getBaxData( &b, bopt ); // parse bax.h5 file
+        if ( nthreads < 1 )
+            nthreads = 1;
 
-#if MEASURE_TIME
-            end = clock();
-            printf( "FETCH TIME: %f\n", (double)( end - begin ) / CLOCKS_PER_SEC );
-#endif
-            if ( ecode >= 0 )
-            {
-                s.nFiles++;
-#if MEASURE_TIME
-                begin = clock();
-#endif
-                getBaxStats( &b, &s, bopt );
-#if MEASURE_TIME
-                end = clock();
-                printf( "EXTRACT TIME: %f\n", (double)( end - begin ) / CLOCKS_PER_SEC );
-#endif
-                if ( !bopt->CUMULATIVE )
-                    printBaxStatistic( &s, bopt->statFile );
-                fflush( stdout );
-            }
-            else
-            {
-                fprintf( stderr, " Skipping %s due to failure\n", b.fullName );
-                printBaxError( ecode );
-            }
-        }
+        bax_queue queue;
+
+        pthread_mutex_init( &( queue.lock ), NULL );
+        queue.bopt     = bopt;
+        queue.stat     = &s;
+        queue.next     = 0;
+        queue.nwritten = 0;
+        queue.writing  = 0;
+        queue.out      = calloc( (size_t)bopt->nBax * BAX_OUT + 1, sizeof( FILE* ) );
+        queue.done     = calloc( bopt->nBax + 1, 1 );
+
+        pthread_t* threads = malloc( sizeof( pthread_t ) * nthreads );
+
+        for ( i = 1; i < nthreads; i++ )
+            pthread_create( threads + i, NULL, bax_thread, &queue );
+
+        bax_thread( &queue );
+
+        for ( i = 1; i < nthreads; i++ )
+            pthread_join( threads[ i ], NULL );
 
         if ( bopt->CUMULATIVE )
             printBaxStatistic( &s, bopt->statFile );
+
+        free( threads );
+        free( queue.out );
+        free( queue.done );
+        pthread_mutex_destroy( &( queue.lock ) );
     }
 
-    freeBaxData( &b );
     freeBaxStatistic( &s );
     freeBaxOptions( bopt );
 
@@ -38,6 +38,7 @@ static void printUsage( char* prog, FILE* out )
     fprintf( out, " -w file                restrict extraction to a specific set of wells. one line per input bax.h5 file. Format: n1 n2 n3 n4-n5.\n\n" );
     fprintf( out, " -F file                file with list of input bax.h5 files (one file per line) \n" );
     fprintf( out, " -z n                   extract subreads only from ZMW's with a specific number of subreads (default: -1)\n" );
+    fprintf( out, " -j n, --threads n      number of bax.h5 files processed in parallel (default 1)\n" );
 }
 
 BAX_OPT* parseBaxOptions( int argc, char** argv )
@@ -67,11 +68,12 @@ BAX_OPT* parseBaxOptions( int argc, char** argv )
                 {"subread", required_argument, 0, 'S'},
                 {"wellNumbers", required_argument, 0, 'w'},
                 {"zmw", required_argument, 0, 'z'},
+                {"threads", required_argument, 0, 'j'},
                 {"file", required_argument, 0, 'F'}};
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long( argc, argv, "vchf:q:i:s:x:X:Q:m:M:t:l:S:w:F:z:", long_options, &option_index );
+        c = getopt_long( argc, argv, "vchf:q:i:s:x:X:Q:m:M:t:l:S:w:F:z:j:", long_options, &option_index );
 
         /* Detect the end of the options. */
         if ( c == -1 )
@@ -160,6 +162,14 @@ BAX_OPT* parseBaxOptions( int argc, char** argv )
                     exit( 1 );
                 }
                 break;
+            case 'j':
+                bopt->nThreads = (int)strtol( optarg, NULL, 10 );
+                if ( errno || bopt->nThreads < 1 )
+                {
+                    fprintf( stderr, "Cannot parse argument for threads (-j ARG)! Must be a positive number\n" );
+                    exit( 1 );
+                }
+                break;
             case 't':
                 bopt->TIME_BIN_SIZE = (int)strtol( optarg, NULL, 10 );
                 if ( errno )
@@ -561,6 +571,7 @@ void initBaxOptions( BAX_OPT* bopt )
     bopt->MAX_MOVIE_TIME      = MAX_TIME_LIMIT;
     bopt->subreadSel          = all;
     bopt->zmw_minNrOfSubReads = -1;
+    bopt->nThreads            = 1;
 }
 
 void printBaxOptions( BAX_OPT* bopt )
@@ -682,6 +693,23 @@ void initBaxData( BaxData* b )
     b->numZMW    = 0;
     b->numRegion = 0;
 
+    b->fileId   = -1;
+    b->chunkBeg = 0;
+    b->chunkEnd = 0;
+
+    int i;
+    for ( i = 0; i < BAX_STREAMS; i++ )
+        b->streamSet[ i ] = -1;
+
+    b->bmax = 0;
+    b->hmax = 0;
+    b->rmax = 0;
+
+    b->sequencingKit       = NULL;
+    b->bindingKit          = NULL;
+    b->softwareVersion     = NULL;
+    b->sequencingChemistry = NULL;
+
     b->widthInFrames   = NULL;
     b->preBaseFrames   = NULL;
     b->hqRegionBegTime = NULL;
@@ -860,13 +888,11 @@ void initBaxNames( BaxData* b, char* fname )
 
 void ensureCapacity( BaxData* b, hsize_t numBaseCalls, hsize_t numHoles, hsize_t numHQReads )
 {
-    static hsize_t bmax = 0; // base call streams + metrics (number of bases)
-    static hsize_t hmax = 0; // streams corresponding to a single ZMW (number of ZMW)
-    static hsize_t rmax = 0; // streams correspiding to singles hq subreads (number of all HQ subreads)
+    hsize_t bmax, hmax, rmax;
 
-    if ( bmax < numBaseCalls )
+    if ( b->bmax < numBaseCalls )
     {
-        bmax = 1.2 * numBaseCalls + 10000;
+        bmax = b->bmax = 1.2 * numBaseCalls + 10000;
 
         if ( ( b->baseCall = (unsigned char*)realloc( b->baseCall, 8ll * bmax ) ) == NULL )
         {
@@ -887,9 +913,9 @@ void ensureCapacity( BaxData* b, hsize_t numBaseCalls, hsize_t numHoles, hsize_t
         }
         b->preBaseFrames = b->widthInFrames + bmax;
     }
-    if ( hmax < numHoles )
+    if ( b->hmax < numHoles )
     {
-        hmax = 1.2 * numHoles + 1000;
+        hmax = b->hmax = 1.2 * numHoles + 1000;
         if ( ( b->numEvent = (int*)realloc( b->numEvent, hmax * sizeof( int ) ) ) == NULL )
         {
             fprintf( stderr, "Cannot allocate event buffer\n" );
@@ -902,7 +928,7 @@ void ensureCapacity( BaxData* b, hsize_t numBaseCalls, hsize_t numHoles, hsize_t
             exit( 1 );
         }
 
-        if ( ( b->hqRegionBegTime = (float*)realloc( b->hqRegionEndTime, 2ll * hmax * sizeof( float ) ) ) == NULL )
+        if ( ( b->hqRegionBegTime = (float*)realloc( b->hqRegionBegTime, 2ll * hmax * sizeof( float ) ) ) == NULL )
         {
             fprintf( stderr, "Cannot allocate HQregion buffer\n" );
             exit( 1 );
@@ -922,9 +948,9 @@ void ensureCapacity( BaxData* b, hsize_t numBaseCalls, hsize_t numHoles, hsize_t
             exit( 1 );
         }
     }
-    if ( rmax < numHQReads )
+    if ( b->rmax < numHQReads )
     {
-        rmax = 1.1 * numHQReads + 1000;
+        rmax = b->rmax = 1.1 * numHQReads + 1000;
         if ( ( b->region = (int*)realloc( b->region, 5ll * rmax * sizeof( int ) ) ) == NULL )
         {
             fprintf( stderr, "Cannot allocate HQregion buffer\n" );
@@ -1041,6 +1067,48 @@ void freeBaxStatistic( BaxStatistic* s )
     free( s->cumSlowPolymeraseRegionTimeHist );
 }
 
+// add the statistic t to s
+
+void mergeBaxStatistic( BaxStatistic* s, BaxStatistic* t )
+{
+    int i, j;
+
+    s->nFiles += t->nFiles;
+    s->nZMWs += t->nZMWs;
+    s->cumPausiness += t->cumPausiness;
+    s->numSubreadBases += t->numSubreadBases;
+    s->numSubreads += t->numSubreads;
+
+    for ( i = 0; i <= type_NotDefined; i++ )
+        s->readTypeHist[ i ] += t->readTypeHist[ i ];
+
+    for ( i = 0; i <= prod_NotDefined; i++ )
+        s->productiveHist[ i ] += t->productiveHist[ i ];
+
+    for ( i = 0; i <= UNKNOWN; i++ )
+        s->stateHist[ i ] += t->stateHist[ i ];
+
+    for ( i = 0; i <= MAX_SUBREADS; i++ )
+        s->subreadHist[ i ] += t->subreadHist[ i ];
+
+    for ( i = 0; i < 3 * s->nLenBins; i++ )
+        s->readLengthHist[ i ] += t->readLengthHist[ i ];
+
+    for ( i = 0; i < 2 * s->nLenBins; i++ )
+        s->cumSlowPolymeraseRegionLenHist[ i ] += t->cumSlowPolymeraseRegionLenHist[ i ];
+
+    for ( j = 0; j < s->nTimBins; j++ )
+    {
+        for ( i = BASE_A; i <= BASE_N; i++ )
+            s->baseDistributionHist[ i ][ j ] += t->baseDistributionHist[ i ][ j ];
+
+        for ( i = NUC_COUNT; i <= SUB_SUM; i++ )
+            s->cumTimeDepQVs[ i ][ j ] += t->cumTimeDepQVs[ i ][ j ];
+
+        s->cumSlowPolymeraseRegionTimeHist[ j ] += t->cumSlowPolymeraseRegionTimeHist[ j ];
+    }
+}
+
 void ln_estimate2( unsigned short* data1, unsigned short* data2, int beg, int end, double* mu, double* sig )
 {
     double _mu  = 0.0;
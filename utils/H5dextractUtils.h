@@ -44,6 +44,9 @@ typedef signed char        int8;
 #define MAX_SUBREADS    1000
 #define PHRED_OFFSET 	33
 
+#define BAX_CHUNK_BASES (16 * 1024 * 1024)  // base call streams are read in chunks of whole ZMWs of about this size
+#define BAX_STREAMS     9                   // per base streams (basecall, qvs, frames)
+
 #define NUC_COUNT   0
 #define QV_SUM      1
 #define DEL_SUM     2
@@ -93,6 +96,7 @@ typedef struct
 	int MIN_MOVIE_TIME;
 	int MAX_MOVIE_TIME;
 	int VERBOSE;
+	int nThreads;           // bax files processed in parallel
 
 	enum subreadSelection subreadSel;
 } BAX_OPT;
@@ -131,6 +135,15 @@ typedef struct
 	int numRegion;      // number of region rows
 	int numBase;        // number of raw bases
 
+	hid_t fileId;                   // bax file, kept open while its ZMWs are processed
+	hid_t streamSet[BAX_STREAMS];   // per base streams, read chunk wise
+	int chunkBeg;                   // bases [chunkBeg, chunkEnd) of the streams are loaded
+	int chunkEnd;
+
+	hsize_t bmax;       // allocated bases of the per base streams
+	hsize_t hmax;       // ZMWs of the per ZMW streams
+	hsize_t rmax;       // region rows
+
 	float *hqRegionBegTime, *hqRegionEndTime;   // Start/End time of the HQ (Sequencing) region, in seconds (per ZMW)
 	float *pausiness;						    // Fraction of pause events over the HQ (sequencing) region
 	unsigned char *productivity;			    // ZMW productivity classification --> UnitsOrEncoding = 0:Empty,1:Productive,2:Other,255:NotDefined
@@ -186,6 +199,7 @@ typedef struct
 void initBaxStatistic(BaxStatistic *s, BAX_OPT *bopt);
 void resetBaxStatistic(BaxStatistic *s);
 void freeBaxStatistic(BaxStatistic* s);
+void mergeBaxStatistic(BaxStatistic* s, BaxStatistic* t);
 
 typedef struct
 {
@@ -0,0 +1,197 @@
+/*******************************************************************************************
+ *
+ *  convert between raw .las and block compressed LAZ overlap files
+ *
+ *  Date   : October 2026
+ *
+ *  Author : MARVEL Team
+ *
+ *******************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lib/laz.h"
+#include "lib/pass.h"
+#include "lib/compression.h"
+
+#include "db/DB.h"
+#include "dalign/align.h"
+
+// getopt()
+
+extern char* optarg;
+extern int optind, opterr, optopt;
+
+static void usage()
+{
+    fprintf( stderr, "usage: [-dp] [-c codec] input.las output.laz\n\n" );
+
+    fprintf( stderr, "Compress an overlap file into the block indexed LAZ format.\n\n" );
+
+    fprintf( stderr, "options: -d  decompress input.laz into output.las\n" );
+    fprintf( stderr, "         -p  pack the piles (delta and varint coded records, bit packed traces)\n" );
+    fprintf( stderr, "         -c  codec of the blocks, zlib (default), zstd or none\n" );
+}
+
+static void compress_las( FILE* fileIn, char* pathOut, int encoding )
+{
+    ovl_header_novl novl;
+    ovl_header_twidth twidth;
+
+    if ( !ovl_header_read( fileIn, &novl, &twidth ) )
+    {
+        fprintf( stderr, "failed to read header\n" );
+        exit( 1 );
+    }
+
+    LAZ* laz = laz_open( pathOut, 1 );
+
+    if ( laz == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", pathOut );
+        exit( 1 );
+    }
+
+    laz->twidth   = twidth;
+    laz->encoding = encoding;
+
+    size_t tbytes = TBYTES( twidth );
+    int tmax      = 1000;
+    void* trace   = malloc( tbytes * tmax );
+    Overlap ovl;
+
+    while ( !Read_Overlap( fileIn, &ovl ) )
+    {
+        if ( ovl.path.tlen > tmax )
+        {
+            tmax  = 1.2 * ovl.path.tlen;
+            trace = realloc( trace, tbytes * tmax );
+        }
+
+        ovl.path.trace = trace;
+        Read_Trace( fileIn, &ovl, tbytes );
+
+        laz_write( laz, &ovl );
+    }
+
+    if ( laz->novl != novl )
+    {
+        fprintf( stderr, "warning: header claims %lld overlaps, found %" PRIu64 "\n", novl, laz->novl );
+    }
+
+    laz_close( laz );
+    free( trace );
+}
+
+static void decompress_laz( char* pathIn, FILE* fileOut )
+{
+    LAZ* laz = laz_open( pathIn, 0 );
+
+    if ( laz == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", pathIn );
+        exit( 1 );
+    }
+
+    size_t tbytes = TBYTES( laz->twidth );
+    Overlap* ovl;
+
+    ovl_header_write( fileOut, laz->novl, laz->twidth );
+
+    while ( ( ovl = laz_read( laz ) ) )
+    {
+        Write_Overlap( fileOut, ovl, tbytes );
+    }
+
+    laz_close( laz );
+}
+
+int main( int argc, char* argv[] )
+{
+    int decompress = 0;
+    int encoding   = LAZ_ENCODING_RECORDS;
+    int codec;
+
+    opterr = 0;
+
+    int c;
+    while ( ( c = getopt( argc, argv, "dpc:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 'd':
+                decompress = 1;
+                break;
+
+            case 'p':
+                encoding = LAZ_ENCODING_PACKED;
+                break;
+
+            case 'c':
+                codec = compress_codec_parse( optarg );
+
+                if ( codec == -1 )
+                {
+                    fprintf( stderr, "unknown codec %s\n", optarg );
+                    usage();
+                    exit( 1 );
+                }
+
+                compress_set_codec( codec );
+                break;
+
+            default:
+                usage();
+                exit( 1 );
+        }
+    }
+
+    if ( argc - optind != 2 )
+    {
+        usage();
+        exit( 1 );
+    }
+
+    char* pathIn  = argv[ optind++ ];
+    char* pathOut = argv[ optind++ ];
+
+    if ( decompress )
+    {
+        FILE* fileOut = fopen( pathOut, "w" );
+
+        if ( fileOut == NULL )
+        {
+            fprintf( stderr, "failed to open %s\n", pathOut );
+            exit( 1 );
+        }
+
+        decompress_laz( pathIn, fileOut );
+
+        fclose( fileOut );
+    }
+    else
+    {
+        FILE* fileIn = fopen( pathIn, "r" );
+
+        if ( fileIn == NULL )
+        {
+            fprintf( stderr, "failed to open %s\n", pathIn );
+            exit( 1 );
+        }
+
+        if ( laz_detect( fileIn ) )
+        {
+            fprintf( stderr, "%s is already LAZ, use -d to decompress it\n", pathIn );
+            exit( 1 );
+        }
+
+        compress_las( fileIn, pathOut, encoding );
+
+        fclose( fileIn );
+    }
+
+    return 0;
+}
@@ -545,16 +545,22 @@ static void draw( CartoonsContext* ctx, Overlap* pOvls, int novls )
     printf( "\n" );
 }
 
-static int parse_ranges( int argc, char* argv[], int* _reps, int** _pts )
+static int parse_ranges( int argc, char* argv[], int* ids, int nids, int* _reps, int** _pts )
 {
-    int* pts = (int*)malloc( sizeof( int ) * 2 * ( 2 + argc ) );
+    int* pts = (int*)malloc( sizeof( int ) * 2 * ( 2 + argc + nids ) );
     int reps = 0;
 
-    if ( argc > 0 )
+    if ( argc > 0 || nids > 0 )
     {
         int c, b, e;
         char *eptr, *fptr;
 
+        for ( c = 0; c < nids; c++ )
+        {
+            pts[ reps++ ] = ids[ c ];
+            pts[ reps++ ] = ids[ c ];
+        }
+
         for ( c = 0; c < argc; c++ )
         {
             if ( argv[ c ][ 0 ] == '#' )
@@ -781,7 +787,7 @@ static int handler_cartoons( void* _ctx, Overlap* ovls, int novl )
 
 static void usage()
 {
-    printf( "[-rtqdF] [-s [li]] [-x n] [-F n] database input.las [ <reads:range> ... ]\n\n" );
+    printf( "[-rtqdF] [-s [li]] [-x n] [-F n] [-R file] database input.las [ <reads:range> ... ]\n\n" );
 
     printf( "Displays the contents of a local alignment file on the console\n\n" );
 
@@ -796,6 +802,9 @@ static void usage()
     printf( "         -s [li]  order by (l)ength or read (i)d\n" );
     printf( "         -x n  set minimum read length to n\n" );
     printf( "         -F f  scale quality scores by f\n" );
+    printf( "         -R file  show the reads whose identifiers are listed in file\n\n" );
+
+    printf( "Reads are looked up directly if the .las file is indexed (LAindex)\n" );
 };
 
 int main( int argc, char* argv[] )
@@ -811,6 +820,7 @@ int main( int argc, char* argv[] )
     // process arguments
 
     int c;
+    char* pathIds = NULL;
 
     opterr = 0;
 
@@ -820,7 +830,7 @@ int main( int argc, char* argv[] )
     cctx.min_identity  = -1;
     cctx.show_overlaps = 1;
 
-    while ( ( c = getopt( argc, argv, "cCdqotrx:i:s:F:f" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "cCdqotrx:i:s:F:fR:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -845,6 +855,10 @@ int main( int argc, char* argv[] )
                 cctx.q_scale = atof( optarg );
                 break;
 
+            case 'R':
+                pathIds = optarg;
+                break;
+
             case 'q':
                 cctx.q = 1;
                 break;
@@ -916,7 +930,30 @@ int main( int argc, char* argv[] )
     int reps;
     int* pts = NULL;
 
-    parse_ranges( argc - optind, argv + optind, &reps, &pts );
+    int* ids  = NULL;
+    int nids  = 0;
+
+    if ( pathIds != NULL )
+    {
+        FILE* fileIds = fopen( pathIds, "r" );
+
+        if ( fileIds == NULL )
+        {
+            fprintf( stderr, "could not open '%s'\n", pathIds );
+            exit( 1 );
+        }
+
+        fread_integers( fileIds, &ids, &nids );
+
+        fclose( fileIds );
+    }
+
+    if ( !parse_ranges( argc - optind, argv + optind, ids, nids, &reps, &pts ) )
+    {
+        exit( 1 );
+    }
+
+    free( ids );
 
     // init
 
@@ -936,7 +973,27 @@ int main( int argc, char* argv[] )
 
     //    Trim_DB(&db);
 
-    pass( pctx, handler_cartoons );
+    // seek to the requested piles when the .las is indexed
+
+    if ( argc - optind > 0 || nids > 0 )
+    {
+        pctx->index = lasidx_load( &db, pcPathOverlaps, 0 );
+    }
+
+    // the ranges are 1-based
+
+    int* apts = malloc( sizeof( int ) * reps );
+
+    for ( c = 0; c < reps; c++ )
+    {
+        apts[ c ] = ( pts[ c ] == INT32_MAX ) ? INT32_MAX : pts[ c ] - 1;
+    }
+
+    pass_ranges( pctx, handler_cartoons, apts, reps );
+
+    free( apts );
+
+    lasidx_close( pctx->index );
 
     post_cartoons( &cctx );
 
@@ -20,6 +20,7 @@
 #include "db/DB.h"
 #include "lib/oflags.h"
 #include "lib/pass.h"
+#include "lib/utils.h"
 
 // switches
 
@@ -30,6 +31,7 @@
 #define DEF_ARG_P 0
 #define DEF_ARG_S 0
 #define DEF_ARG_D 0
+#define DEF_ARG_J 1
 
 // errors
 
@@ -65,6 +67,9 @@ typedef struct
 
     int prev_a;
 
+    int first_a; // first and last A-read of a thread's range
+    int last_a;
+
 } CheckContext;
 
 inline static int compare_sort( Overlap* o1, Overlap* o2 )
@@ -101,6 +106,50 @@ static void check_pre( PassContext* pctx, CheckContext* cctx )
     cctx->prev_a = 0;
 }
 
+static void* check_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    CheckContext* ctx  = (CheckContext*)_ctx;
+    CheckContext* tctx = malloc( sizeof( CheckContext ) );
+
+    memcpy( tctx, ctx, sizeof( CheckContext ) );
+
+    tctx->error   = 0;
+    tctx->novl    = 0;
+    tctx->prev_a  = 0;
+    tctx->first_a = -1;
+    tctx->last_a  = -1;
+
+    return tctx;
+}
+
+// merged in file order, the ranges of the threads have to be sorted as well
+
+static void check_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( thread );
+
+    CheckContext* ctx  = (CheckContext*)_ctx;
+    CheckContext* tctx = (CheckContext*)_tctx;
+
+    if ( tctx->first_a != -1 )
+    {
+        if ( ctx->check_sort && ctx->last_a > tctx->first_a )
+        {
+            fprintf( stderr, "overlap %lld: not sorted\n", ctx->novl + 1 );
+            ctx->error |= ERR_NOT_SORTED;
+        }
+
+        ctx->last_a = tctx->last_a;
+    }
+
+    ctx->novl += tctx->novl;
+    ctx->error |= tctx->error;
+
+    free( tctx );
+}
+
 static void check_post( PassContext* pctx, CheckContext* cctx )
 {
     if ( !cctx->error && pctx->novl != cctx->novl )
@@ -118,7 +167,7 @@ static int check_process( void* _ctx, Overlap* ovl, int novl )
 
     for ( i = 0; i < novl; i++ )
     {
-        Overlap* o = ovl + novl;
+        Overlap* o = ovl + i;
 
         ctx->novl++;
 
@@ -209,18 +258,26 @@ static int check_process( void* _ctx, Overlap* ovl, int novl )
 
     ctx->prev_a = ovl->aread;
 
+    if ( ctx->first_a == -1 )
+    {
+        ctx->first_a = ovl->aread;
+    }
+
+    ctx->last_a = ovl->aread;
+
     return ( ctx->error == 0 );
 }
 
 static void usage()
 {
-    fprintf( stderr, "usage: [-dihps] database input.las\n\n" );
+    fprintf( stderr, "usage: [-dihps] [-j n] database input.las\n\n" );
     fprintf( stderr, "Check the contents of a .las file for consistency.\n\n" );
     fprintf( stderr, "options: -d  report duplicates\n" );
     fprintf( stderr, "         -h  only check headers\n" );
     fprintf( stderr, "         -i  skip overlaps tagged as discarded\n" );
     fprintf( stderr, "         -p  check pass-through points\n" );
     fprintf( stderr, "         -s  check sort order\n" );
+    fprintf( stderr, "         -j n  number of threads (%d)\n", DEF_ARG_J );
 }
 
 int main( int argc, char* argv[] )
@@ -241,11 +298,14 @@ int main( int argc, char* argv[] )
     cctx.ignoreDiscardedOvls = 0;
 
     int header_only = 0;
+    int nthreads    = DEF_ARG_J;
+
+    cctx.last_a = -1;
 
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "hihsp" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "dhispj:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -270,6 +330,10 @@ int main( int argc, char* argv[] )
                 cctx.ignoreDiscardedOvls = 1;
                 break;
 
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
             default:
                 usage();
                 exit( 1 );
@@ -309,14 +373,25 @@ int main( int argc, char* argv[] )
     {
         pctx->split_b      = 0;
         pctx->load_trace   = cctx.check_ptp;
+        pctx->use_mmap     = 1;
         pctx->unpack_trace = cctx.check_ptp;
         pctx->data         = &cctx;
 
+        pctx->thread_init   = check_thread_init;
+        pctx->thread_reduce = check_thread_reduce;
+
+        if ( nthreads > 1 )
+        {
+            pctx->index = lasidx_load( &db, pcPathOverlapsIn, 0 );
+        }
+
         check_pre( pctx, &cctx );
 
-        pass( pctx, check_process );
+        pass_parallel( pctx, check_process, nthreads );
 
         check_post( pctx, &cctx );
+
+        lasidx_close( pctx->index );
     }
 
     pass_free( pctx );
@@ -4,6 +4,7 @@
 #include <strings.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "lib/oflags.h"
 #include "lib/utils.h"
@@ -23,6 +24,16 @@
 // defaults
 
 #define DEF_LINEWIDTH 4
+#define DEF_CACHE_MB 512
+
+// reads on each side of the displayed one prefetched by the loader
+
+#define PREFETCH_NEIGHBOURS 4
+
+// overlap tiles, edge length in pixels and number of tiles cached over all zoom levels
+
+#define TILE_SIZE 256
+#define TILE_CACHE 192
 
 // track type
 
@@ -44,6 +55,8 @@ typedef enum
     sort_abpos = 0, sort_aepos = 1, sort_length = 2, sort_readID = 3, sort_qual = 4
 } sortType;
 
+#define SORT_TYPES 5
+
 typedef enum
 {
     show_q = 0, show_distinct = 1, show_same = 2
@@ -60,6 +73,67 @@ typedef struct
     GdkRGBA color;
 } OverlapDetails;
 
+// overlaps of an A-read, kept in the pile cache
+
+typedef struct _Pile Pile;
+
+struct _Pile
+{
+    int rid;
+    int nrefs;                  // pinned while displayed
+
+    OverlapDetails* ovls;
+    int novl;
+    ovl_trace* trace;
+
+    int* order[SORT_TYPES];     // permutation of ovls for each sortType
+
+    size_t mem;
+
+    Pile* lru_prev;             // position in the lru list (unpinned only)
+    Pile* lru_next;
+};
+
+// snapshot of everything the overlap display depends on, shared by the tiles rendered from it
+
+typedef struct
+{
+    int nrefs;
+
+    Pile* pile;                 // pinned
+    int alen;
+
+    OverlapDetails** ovls;      // displayed overlaps, top to bottom
+    int novl;
+
+    int* highlight;
+    int nhighlight;
+    int rid_prev;               // read of the previous view
+
+    showType show;
+    filterType filter;
+    int filter_mask;
+    int line_width;
+    int pad;
+} TileScene;
+
+typedef enum
+{
+    tile_free = 0, tile_queued = 1, tile_rendering = 2, tile_ready = 3
+} tileState;
+
+typedef struct
+{
+    tileState state;
+    int gen;                    // scene generation
+    int width;                  // of the drawing area, ie. the zoom level
+    int col;
+    int row;
+    uint64 stamp;               // last use
+
+    cairo_surface_t* surface;
+} Tile;
+
 typedef struct
 {
     int rid;
@@ -81,9 +155,12 @@ typedef struct
     HITS_TRACK* qtrack;
     HITS_TRACK* srctrack;
 
-    lasidx* lasIndex;
+    off_t* lasIndex;
     int* lasIndexFile;
+    int* lasNovl;
+    uint64* lasTbytes;
     FILE** lasFiles;
+    int nlasFiles;
 
     char* pathDb;
     char* pathLas;
@@ -100,10 +177,6 @@ typedef struct
     int* ovl_display;
     int novl_display;
 
-    int tmax;
-    int tcur;
-    ovl_trace* trace;
-
     size_t tbytes;
     int twidth;
 
@@ -159,10 +232,43 @@ typedef struct
     int viewstack_fill;
     int viewstack_max;
 
+    // pile cache, filled on demand by the ui and ahead of time by the loader thread
+
+    Pile* pile;                 // displayed
+    Pile** piles;               // indexed by read id
+    Pile lru;                   // sentinel, lru.lru_next is the most recently used
+    size_t pile_mem;
+    size_t pile_maxmem;
+
+    pthread_t loader;
+    pthread_mutex_t pile_lock;
+    pthread_cond_t loader_wake;
+    pthread_cond_t loader_done;
+    FILE** loaderFiles;         // the loader's own handles of the las files
+    int* prefetch;              // queue of read ids for the loader
+    int nprefetch;
+    int cprefetch;
+    int maxprefetch;
+    int loading;                // read id the loader is working on, -1 if idle
+    int loader_quit;
+
+    // tile cache, rendered by the tiler thread and painted by read_draw_callback
+
+    TileScene* scene;
+    Tile* tiles;
+    int tile_gen;               // bumped whenever the scene changes
+    uint64 tile_clock;
+    pthread_t tiler;
+    pthread_mutex_t tile_lock;
+    pthread_cond_t tile_wake;
+    int tile_quit;
+
 } ExplorerContext;
 
 static ExplorerContext g_ectx;
 
+static void tiles_invalidate();
+
 // oflags.c
 
 extern OverlapFlag2Label oflag2label[];
@@ -192,9 +298,12 @@ static CurrentView* view_prev()
 static void view_new(int rid)
 {
     CurrentView* prev = view_current();
+    int hzoom = 1;
 
     if ( prev != NULL )
     {
+        hzoom = prev->hzoom;
+
         prev->scroll_x = gtk_adjustment_get_value( gtk_scrolled_window_get_hadjustment(g_ectx.scrolled_wnd) );
         prev->scroll_y = gtk_adjustment_get_value( gtk_scrolled_window_get_vadjustment(g_ectx.scrolled_wnd) );
     }
@@ -216,14 +325,9 @@ static void view_new(int rid)
     view->filter_ab = 0;
     view->filter_ae = -1;
 
-    if ( prev != NULL )
-    {
-        view->hzoom = prev->hzoom;
-    }
-    else
-    {
-        view->hzoom = 1;
-    }
+    // prev is gone if the stack was reallocated
+
+    view->hzoom = hzoom;
 }
 
 static int view_back()
@@ -328,7 +432,9 @@ static void adjust_drawing_area_size()
                                 (g_ectx.novl_display + 1) * g_ectx.line_width * (g_ectx.pad + 1) + PADDING);
 }
 
-static void redraw()
+// the cached tiles of other zoom levels stay valid
+
+static void redraw_zoom()
 {
     g_ectx.idx_details = -1;
 
@@ -338,6 +444,13 @@ static void redraw()
     gtk_widget_queue_draw(g_ectx.drawing_tracks);
 }
 
+static void redraw()
+{
+    tiles_invalidate();
+
+    redraw_zoom();
+}
+
 // convert HSL to RGB
 //
 
@@ -413,9 +526,12 @@ static void get_unique_color(int color, int ncolors, GdkRGBA* rgb)
 
 // assign unique colors to b's occuring more than once
 
-static void assign_colors()
+static void assign_colors(OverlapDetails* ovls, int novl)
 {
-    OverlapDetails* ovls = g_ectx.ovls;
+    if (novl == 0)
+    {
+        return;
+    }
 
     // how many colors do we need
 
@@ -423,7 +539,7 @@ static void assign_colors()
     int colors = 0;
     int beg = 0;
 
-    for (i = 1; i < g_ectx.ocur; i++)
+    for (i = 1; i < novl; i++)
     {
         if (ovls[beg].ovl.bread != ovls[i].ovl.bread)
         {
@@ -453,7 +569,7 @@ static void assign_colors()
 
     beg = 0;
 
-    for (i = 1; i < g_ectx.ocur; i++)
+    for (i = 1; i < novl; i++)
     {
         if (ovls[beg].ovl.bread != ovls[i].ovl.bread)
         {
@@ -462,7 +578,7 @@ static void assign_colors()
                 get_unique_color(col, colors, &(ovls[beg].color));
                 col++;
 
-                while (beg != i)
+                while (beg + 1 < i)
                 {
                     ovls[beg + 1].color = ovls[beg].color;
                     beg++;
@@ -482,7 +598,7 @@ static void assign_colors()
     {
         get_unique_color(col, colors, &(ovls[beg].color));
 
-        while (beg != i)
+        while (beg + 1 < i)
         {
             ovls[beg + 1].color = ovls[beg].color;
             beg++;
@@ -528,7 +644,7 @@ static int xpos2apos(int x)
 
     x /= g_ectx.hscale;
 
-    int ovlALen = DB_READ_LEN(&g_ectx.db, g_ectx.ovls->ovl.aread);
+    int ovlALen = DB_READ_LEN(&g_ectx.db, view_current()->rid);
 
     if (x > ovlALen)
     {
@@ -538,63 +654,26 @@ static int xpos2apos(int x)
     return x;
 }
 
+// arrange the displayed pile in the precomputed order of the current sort type
+
 static void sort_overlaps()
 {
     int i;
     OverlapDetails** ovls_sorted = g_ectx.ovls_sorted;
     int n = g_ectx.ocur;
+    int* order = g_ectx.pile->order[g_ectx.sort];
 
     for (i = 0; i < n; i++)
     {
-        ovls_sorted[i] = g_ectx.ovls + i;
-    }
-
-    switch (g_ectx.sort)
-    {
-        case sort_abpos:
-            qsort(ovls_sorted, n, sizeof(OverlapDetails*), cmp_ovls_abpos);
-            break;
-
-        case sort_aepos:
-            qsort(ovls_sorted, n, sizeof(OverlapDetails*), cmp_ovls_aepos);
-            break;
-
-        case sort_length:
-            qsort(ovls_sorted, n, sizeof(OverlapDetails*), cmp_ovls_length);
-            break;
-
-        case sort_readID:
-            qsort(ovls_sorted, n, sizeof(OverlapDetails*), cmp_ovls_id);
-            break;
-
-        case sort_qual:
-            qsort(ovls_sorted, n, sizeof(OverlapDetails*), cmp_ovls_qual);
-            break;
-
-        default:
-            break;
-    }
-
-    if (g_ectx.revSort)
-    {
-        int j = n - 1;
-        OverlapDetails* temp;
-
-        for ( i = 0 ; i < n / 2 ; i++, j-- )
+        if (g_ectx.revSort)
         {
-            temp = ovls_sorted[i];
-            ovls_sorted[i] = ovls_sorted[j];
-            ovls_sorted[j] = temp;
+            ovls_sorted[i] = g_ectx.ovls + order[n - 1 - i];
         }
-
-        if ( i != j )
+        else
         {
-            temp = ovls_sorted[i];
-            ovls_sorted[i] = ovls_sorted[j];
-            ovls_sorted[j] = temp;
+            ovls_sorted[i] = g_ectx.ovls + order[i];
         }
     }
-
 }
 
 static void filter_overlaps(void)
@@ -640,304 +719,1140 @@ static void filter_overlaps(void)
 }
 
 
-// load overlaps for read g_ectx.rid from las file
+// add the A-read offsets of pathLas to g_ectx.lasIndex, file being its slot in g_ectx.lasFiles
 
-static void load_overlaps()
+static void las_index_add(const char* pathLas, int file)
 {
-    int rid = view_current()->rid;
-    int fileIdx = g_ectx.lasIndexFile[rid];
+    lasidx* idx = lasidx_load(&(g_ectx.db), pathLas, 1);
+
+    if (idx == NULL)
+    {
+        fprintf(stderr, "failed to load index of %s\n", pathLas);
+        exit(1);
+    }
+
+    int nreads = DB_NREADS(&(g_ectx.db));
+    int j;
+
+    for (j = 0; j < nreads; j++)
+    {
+        off_t offset = lasidx_offset(idx, j);
+
+        if (offset == 0)
+        {
+            continue;
+        }
+
+        if (g_ectx.lasIndex[j] != 0)
+        {
+            fprintf(stderr, "error: read id %d used in two indices\n", j);
+            exit(1);
+        }
+
+        g_ectx.lasIndex[j] = offset;
+        g_ectx.lasIndexFile[j] = file;
+        g_ectx.lasNovl[j] = lasidx_novl(idx, j);
+        g_ectx.lasTbytes[j] = idx->entries[j].tbytes;
+    }
+
+    lasidx_close(idx);
+}
+
+static int (*cmp_ovls[SORT_TYPES])(const void*, const void*) =
+{
+    cmp_ovls_abpos, cmp_ovls_aepos, cmp_ovls_length, cmp_ovls_id, cmp_ovls_qual
+};
+
+static void pile_free(Pile* pile)
+{
+    int s;
+
+    for (s = 0; s < SORT_TYPES; s++)
+    {
+        free(pile->order[s]);
+    }
+
+    free(pile->ovls);
+    free(pile->trace);
+    free(pile);
+}
+
+// read the overlaps of rid from the las files, using the sizes recorded in the index.
+// touches no shared state apart from files, which must not be used by another thread.
+
+static Pile* pile_load(int rid, FILE** files)
+{
+    Pile* pile = malloc(sizeof(Pile));
+    bzero(pile, sizeof(Pile));
+
     off_t lasOffset = g_ectx.lasIndex[rid];
+    int novl = 0;
+    uint64 ntrace = 0;
+
+    if (lasOffset > 0)
+    {
+        novl = g_ectx.lasNovl[rid];
+        ntrace = g_ectx.lasTbytes[rid] / g_ectx.tbytes;
+    }
+
+    pile->rid = rid;
+    pile->ovls = malloc(sizeof(OverlapDetails) * MAX(novl, 1));
+    pile->trace = malloc(sizeof(ovl_trace) * MAX(ntrace, 1));
 
     int n = 0;
-    int a = rid;
 
-    if (lasOffset > 0)
+    if (novl > 0)
     {
-        OverlapDetails* ovls = g_ectx.ovls;
-        int omax = g_ectx.omax;
-        FILE* fileLas = g_ectx.lasFiles[fileIdx];
-        g_ectx.tcur = 0;
+        FILE* fileLas = files[g_ectx.lasIndexFile[rid]];
+        ovl_trace* trace = pile->trace;
 
         fseeko(fileLas, lasOffset, SEEK_SET);
 
-        while (1)
+        for (n = 0; n < novl; n++)
         {
-            if (Read_Overlap(fileLas, &(ovls[n].ovl)) || ovls[n].ovl.aread != a)
+            Overlap* ovl = &(pile->ovls[n].ovl);
+
+            if (Read_Overlap(fileLas, ovl) || ovl->aread != rid ||
+                trace + ovl->path.tlen > pile->trace + ntrace)
             {
+                fprintf(stderr, "warning: index does not match the overlaps of read %d\n", rid);
                 break;
             }
 
-            if (ovls[n].ovl.path.tlen + g_ectx.tcur > g_ectx.tmax)
+            ovl->path.trace = trace;
+            Read_Trace(fileLas, ovl, g_ectx.tbytes);
+
+            if (g_ectx.tbytes == sizeof(uint8))
             {
-                g_ectx.tmax = 1.2 * g_ectx.tmax + ovls[n].ovl.path.tlen;
+                Decompress_TraceTo16(ovl);
+            }
+
+            trace += ovl->path.tlen;
+        }
+    }
 
-                ovl_trace* trace = realloc(g_ectx.trace, g_ectx.tmax * sizeof(ovl_trace));
+    pile->novl = n;
 
-                int j;
+    assign_colors(pile->ovls, n);
 
-                for (j = 0; j < n; j++)
-                {
-                    ovls[j].ovl.path.trace = trace + ((ovl_trace*) (ovls[j].ovl.path.trace) - g_ectx.trace);
-                }
+    // sort once for every sort type, switching the sort order is a copy afterwards
 
-                g_ectx.trace = trace;
-            }
+    OverlapDetails** sorted = malloc(sizeof(OverlapDetails*) * MAX(n, 1));
+    int s, i;
 
-            ovls[n].ovl.path.trace = g_ectx.trace + g_ectx.tcur;
-            Read_Trace(fileLas, &(ovls[n].ovl), g_ectx.tbytes);
+    for (s = 0; s < SORT_TYPES; s++)
+    {
+        for (i = 0; i < n; i++)
+        {
+            sorted[i] = pile->ovls + i;
+        }
 
-            g_ectx.tcur += ovls[n].ovl.path.tlen;
+        qsort(sorted, n, sizeof(OverlapDetails*), cmp_ovls[s]);
 
-            if (g_ectx.tbytes == sizeof(uint8))
-            {
-                Decompress_TraceTo16(&(ovls[n].ovl));
-            }
+        pile->order[s] = malloc(sizeof(int) * MAX(n, 1));
+
+        for (i = 0; i < n; i++)
+        {
+            pile->order[s][i] = sorted[i] - pile->ovls;
+        }
+    }
 
-            n += 1;
+    free(sorted);
 
-            if (n >= omax)
-            {
-                omax = 1.2 * n + 100;
-                ovls = realloc(ovls, sizeof(OverlapDetails) * omax);
-                g_ectx.ovls_sorted = realloc(g_ectx.ovls_sorted, sizeof(OverlapDetails*) * omax);
+    pile->mem = sizeof(Pile) + (sizeof(OverlapDetails) + sizeof(int) * SORT_TYPES) * MAX(n, 1) +
+                sizeof(ovl_trace) * MAX(ntrace, 1);
 
-                g_ectx.ovl_display = realloc(g_ectx.ovl_display, sizeof(int) * omax);
-            }
+    return pile;
+}
+
+// pile cache, all of the following require g_ectx.pile_lock
+
+static void pile_lru_unlink(Pile* pile)
+{
+    pile->lru_prev->lru_next = pile->lru_next;
+    pile->lru_next->lru_prev = pile->lru_prev;
+}
+
+static void pile_lru_push(Pile* pile)
+{
+    pile->lru_prev = &(g_ectx.lru);
+    pile->lru_next = g_ectx.lru.lru_next;
+
+    g_ectx.lru.lru_next->lru_prev = pile;
+    g_ectx.lru.lru_next = pile;
+}
+
+// drop least recently used piles that are not displayed until the cache fits
+
+static void pile_evict()
+{
+    while (g_ectx.pile_mem > g_ectx.pile_maxmem && g_ectx.lru.lru_prev != &(g_ectx.lru))
+    {
+        Pile* pile = g_ectx.lru.lru_prev;
+
+        pile_lru_unlink(pile);
+
+        g_ectx.piles[pile->rid] = NULL;
+        g_ectx.pile_mem -= pile->mem;
+
+        pile_free(pile);
+    }
+}
+
+static Pile* pile_pin(int rid)
+{
+    Pile* pile = g_ectx.piles[rid];
+
+    if (pile != NULL)
+    {
+        if (pile->nrefs == 0)
+        {
+            pile_lru_unlink(pile);
         }
 
-        g_ectx.ovls = ovls;
-        g_ectx.omax = omax;
-        g_ectx.ocur = n;
+        pile->nrefs += 1;
+    }
+
+    return pile;
+}
+
+// add a loaded pile, returns the cached one if another thread was faster
+
+static Pile* pile_insert(Pile* pile, int pin)
+{
+    Pile* cached = g_ectx.piles[pile->rid];
+
+    if (cached != NULL)
+    {
+        pile_free(pile);
+
+        return pin ? pile_pin(cached->rid) : cached;
+    }
+
+    g_ectx.piles[pile->rid] = pile;
+    g_ectx.pile_mem += pile->mem;
+
+    if (pin)
+    {
+        pile->nrefs = 1;
     }
     else
     {
-        g_ectx.ocur = n = 0;
+        pile->nrefs = 0;
+        pile_lru_push(pile);
     }
 
-    assign_colors();
+    pile_evict();
 
-    sort_overlaps();
+    return pile;
+}
 
-    int ovlALen = DB_READ_LEN(&g_ectx.db, a);
+static void pile_release(Pile* pile)
+{
+    pile->nrefs -= 1;
 
-    view_current()->filter_ab = 0;
-    view_current()->filter_ae = ovlALen;
+    if (pile->nrefs == 0)
+    {
+        pile_lru_push(pile);
+        pile_evict();
+    }
+}
 
-    gtk_spin_button_set_range(GTK_SPIN_BUTTON(g_ectx.edit_filter_ab), 0, ovlALen);
-    gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_ectx.edit_filter_ab), 0);
+// pinned pile of rid. taken from the cache if possible, waiting for the loader if it is
+// busy with rid and read on the ui thread otherwise
 
-    gtk_spin_button_set_range(GTK_SPIN_BUTTON(g_ectx.edit_filter_ae), 0, ovlALen);
-    gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_ectx.edit_filter_ae), ovlALen);
+static Pile* pile_get(int rid)
+{
+    Pile* pile;
 
-    filter_overlaps();
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+
+    while ((pile = pile_pin(rid)) == NULL && g_ectx.loading == rid)
+    {
+        pthread_cond_wait(&(g_ectx.loader_done), &(g_ectx.pile_lock));
+    }
+
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
+
+    if (pile == NULL)
+    {
+        pile = pile_load(rid, g_ectx.lasFiles);
+
+        pthread_mutex_lock(&(g_ectx.pile_lock));
+        pile = pile_insert(pile, 1);
+        pthread_mutex_unlock(&(g_ectx.pile_lock));
+    }
+
+    return pile;
+}
+
+static void* loader_thread(void* arg)
+{
+    UNUSED(arg);
+
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+
+    while (!g_ectx.loader_quit)
+    {
+        if (g_ectx.cprefetch >= g_ectx.nprefetch)
+        {
+            pthread_cond_wait(&(g_ectx.loader_wake), &(g_ectx.pile_lock));
+            continue;
+        }
+
+        int rid = g_ectx.prefetch[g_ectx.cprefetch++];
+
+        if (g_ectx.piles[rid] != NULL)
+        {
+            continue;
+        }
+
+        g_ectx.loading = rid;
+
+        pthread_mutex_unlock(&(g_ectx.pile_lock));
+
+        Pile* pile = pile_load(rid, g_ectx.loaderFiles);
+
+        pthread_mutex_lock(&(g_ectx.pile_lock));
+
+        pile_insert(pile, 0);
+
+        g_ectx.loading = -1;
+        pthread_cond_broadcast(&(g_ectx.loader_done));
+    }
+
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
+
+    return NULL;
+}
+
+static void prefetch_add(int rid)
+{
+    if (rid < 0 || rid >= DB_NREADS(&(g_ectx.db)) || g_ectx.piles[rid] != NULL)
+    {
+        return;
+    }
+
+    if (g_ectx.nprefetch >= g_ectx.maxprefetch)
+    {
+        g_ectx.maxprefetch = 1.2 * g_ectx.maxprefetch + 20;
+        g_ectx.prefetch = realloc(g_ectx.prefetch, sizeof(int) * g_ectx.maxprefetch);
+    }
+
+    g_ectx.prefetch[g_ectx.nprefetch++] = rid;
+}
+
+// replace the loader's queue with the neighbours of the displayed read and the highlighted reads
+
+static void prefetch_update()
+{
+    int rid = view_current()->rid;
+    int i;
+
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+
+    g_ectx.nprefetch = g_ectx.cprefetch = 0;
+
+    for (i = 1; i <= PREFETCH_NEIGHBOURS; i++)
+    {
+        prefetch_add(rid + i);
+        prefetch_add(rid - i);
+    }
+
+    for (i = 0; i < g_ectx.hcur; i++)
+    {
+        prefetch_add(g_ectx.highlight[i]);
+    }
+
+    pthread_cond_signal(&(g_ectx.loader_wake));
+
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
+}
+
+static void loader_start(size_t maxmem)
+{
+    int nreads = DB_NREADS(&(g_ectx.db));
+
+    g_ectx.piles = calloc(nreads, sizeof(Pile*));
+    g_ectx.lru.lru_prev = g_ectx.lru.lru_next = &(g_ectx.lru);
+    g_ectx.pile_mem = 0;
+    g_ectx.pile_maxmem = maxmem;
+    g_ectx.loading = -1;
+    g_ectx.loader_quit = 0;
+
+    pthread_mutex_init(&(g_ectx.pile_lock), NULL);
+    pthread_cond_init(&(g_ectx.loader_wake), NULL);
+    pthread_cond_init(&(g_ectx.loader_done), NULL);
+
+    pthread_create(&(g_ectx.loader), NULL, loader_thread, NULL);
+}
+
+static void loader_stop()
+{
+    int i;
+
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+    g_ectx.loader_quit = 1;
+    pthread_cond_signal(&(g_ectx.loader_wake));
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
+
+    pthread_join(g_ectx.loader, NULL);
+
+    for (i = 0; i < g_ectx.nlasFiles; i++)
+    {
+        fclose(g_ectx.loaderFiles[i]);
+    }
+
+    pthread_mutex_destroy(&(g_ectx.pile_lock));
+    pthread_cond_destroy(&(g_ectx.loader_wake));
+    pthread_cond_destroy(&(g_ectx.loader_done));
+}
+
+// display the overlaps of the current view's read
+
+static void load_overlaps()
+{
+    int a = view_current()->rid;
+    Pile* pile = pile_get(a);
+
+    if (g_ectx.pile != NULL)
+    {
+        pthread_mutex_lock(&(g_ectx.pile_lock));
+        pile_release(g_ectx.pile);
+        pthread_mutex_unlock(&(g_ectx.pile_lock));
+    }
+
+    g_ectx.pile = pile;
+    g_ectx.ovls = pile->ovls;
+    g_ectx.ocur = pile->novl;
+
+    if (g_ectx.ocur > g_ectx.omax)
+    {
+        g_ectx.omax = g_ectx.ocur;
+        g_ectx.ovls_sorted = realloc(g_ectx.ovls_sorted, sizeof(OverlapDetails*) * g_ectx.omax);
+        g_ectx.ovl_display = realloc(g_ectx.ovl_display, sizeof(int) * g_ectx.omax);
+    }
+
+    sort_overlaps();
+
+    int ovlALen = DB_READ_LEN(&g_ectx.db, a);
+
+    view_current()->filter_ab = 0;
+    view_current()->filter_ae = ovlALen;
+
+    gtk_spin_button_set_range(GTK_SPIN_BUTTON(g_ectx.edit_filter_ab), 0, ovlALen);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_ectx.edit_filter_ab), 0);
+
+    gtk_spin_button_set_range(GTK_SPIN_BUTTON(g_ectx.edit_filter_ae), 0, ovlALen);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(g_ectx.edit_filter_ae), ovlALen);
+
+    filter_overlaps();
+
+    redraw();
+
+    prefetch_update();
+}
+
+// quality class of a trace segment
+
+static int segment_quality(int diffs, int len)
+{
+    int q = ((double) diffs / len) * g_ectx.twidth;
+
+    q = q / 10;
+
+    if (q > 4)
+    {
+        q = 4;
+    }
+
+    return q;
+}
+
+static void set_segment_color(cairo_t* cr, int q, int bHighlight)
+{
+    const int q_colors[] =
+    { 22, 178, 0, 122, 195, 0, 211, 183, 0, 228, 82, 0, 245, 0, 34 };
+
+    float shift = 1.0;
+
+    if (bHighlight)
+    {
+        shift -= 0.3;
+    }
+
+    cairo_set_source_rgb(cr, (q_colors[q * 3] * shift) / 255.0, (q_colors[q * 3 + 1] * shift) / 255.0, (q_colors[q * 3 + 2] * shift) / 255.0);
+}
+
+static void draw_segment(cairo_t* cr, int x_b, int x_e, int q, int y, float scale, int bHighlight)
+{
+    if (q < 0)
+    {
+        return;
+    }
+
+    set_segment_color(cr, q, bHighlight);
+
+    cairo_move_to(cr, PADDING + x_b * scale, y + 0.5);
+    cairo_line_to(cr, PADDING + x_e * scale, y + 0.5);
+    cairo_stroke(cr);
+}
+
+static int highlight_has(int rid)
+{
+    int i;
+
+    for (i = 0; i < g_ectx.hcur; i++)
+    {
+        int h = g_ectx.highlight[i];
+
+        if (h > rid)
+        {
+            return -1;
+        }
+        else if (g_ectx.highlight[i] == rid)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int cmp_int(const void* x, const void* y)
+{
+    int* a = (int*) x;
+    int* b = (int*) y;
+
+    return (*a) - (*b);
+}
+
+static void highlight_add(int rid)
+{
+    if (g_ectx.hcur + 1 >= g_ectx.hmax)
+    {
+        g_ectx.hmax += 20;
+        g_ectx.highlight = realloc(g_ectx.highlight, sizeof(int) * g_ectx.hmax);
+    }
+
+    g_ectx.highlight[g_ectx.hcur] = rid;
+    g_ectx.hcur++;
+
+    qsort(g_ectx.highlight, g_ectx.hcur, sizeof(int), cmp_int);
+
+    prefetch_update();
+}
+
+static void highlight_remove(int rid)
+{
+    int i;
+
+    for (i = 0; i < g_ectx.hcur; i++)
+    {
+        if (g_ectx.highlight[i] == rid)
+        {
+            g_ectx.highlight[i] = INT_MAX;
+            i = -1;
+
+            break;
+        }
+    }
+
+    if (i == -1)
+    {
+        qsort(g_ectx.highlight, g_ectx.hcur, sizeof(int), cmp_int);
+        g_ectx.hcur--;
+    }
+}
+
+static int scene_highlight(TileScene* scene, int rid)
+{
+    int i;
+
+    for (i = 0; i < scene->nhighlight; i++)
+    {
+        int h = scene->highlight[i];
+
+        if (h > rid)
+        {
+            return -1;
+        }
+        else if (h == rid)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void draw_ovl(cairo_t* cr, TileScene* scene, OverlapDetails* ovld, int y, float scale, int clip_xb, int clip_xe, int bHighlight)
+{
+    Overlap* ovl = &(ovld->ovl);
+
+    if (scene->show == show_q)
+    {
+        int x = ovl->path.abpos;
+
+        if (ovl->path.tlen == 0)
+        {
+            int q = segment_quality(ovl->path.diffs, ovl->path.aepos - ovl->path.abpos);
+
+            draw_segment(cr, ovl->path.abpos, ovl->path.aepos, q, y, scale, bHighlight);
+        }
+        else
+        {
+            // segments narrower than a pixel are merged into runs coloured by their
+            // combined diffs, and neighbouring runs of the same colour into one line
+
+            ovl_trace* trace = ovl->path.trace;
+            int nseg = ovl->path.tlen / 2;
+            int run_b = x;
+            int diffs = 0;
+            int len = 0;
+            int line_b = x;
+            int line_e = x;
+            int line_q = -1;
+            int j;
+
+            for (j = 0; j < nseg; j++)
+            {
+                int x_next;
+
+                if (j + 1 < nseg)
+                {
+                    x_next = (x / g_ectx.twidth + 1) * g_ectx.twidth;
+                }
+                else
+                {
+                    x_next = ovl->path.aepos;
+                }
+
+                if (x_next * scale + PADDING < clip_xb)
+                {
+                    x = run_b = line_b = line_e = x_next;
+                    continue;
+                }
+
+                diffs += trace[2 * j];
+                len += trace[2 * j + 1];
+                x = x_next;
+
+                if ((x - run_b) * scale < 1.0 && j + 1 < nseg && x * scale + PADDING <= clip_xe)
+                {
+                    continue;
+                }
+
+                int q = segment_quality(diffs, len);
+
+                if (q != line_q)
+                {
+                    draw_segment(cr, line_b, line_e, line_q, y, scale, bHighlight);
+
+                    line_b = run_b;
+                    line_q = q;
+                }
+
+                line_e = run_b = x;
+                diffs = len = 0;
+
+                if (x * scale + PADDING > clip_xe)
+                {
+                    break;
+                }
+            }
+
+            draw_segment(cr, line_b, line_e, line_q, y, scale, bHighlight);
+        }
+    }
+    else
+    {
+        if (scene->show == show_same)
+        {
+            int base = 0;
+
+            if (bHighlight)
+            {
+                base = 1;
+            }
+
+            cairo_set_source_rgb(cr, fabs(base - 0.3), fabs(base - 0.3), fabs(base - 0.8));
+        }
+        else
+        {
+            if (bHighlight)
+            {
+                cairo_set_source_rgb(cr, 1.0 - ovld->color.red, 1.0 - ovld->color.green, 1.0 - ovld->color.blue);
+            }
+            else
+            {
+                cairo_set_source_rgb(cr, ovld->color.red, ovld->color.green, ovld->color.blue);
+            }
+        }
+
+        cairo_move_to(cr, PADDING + ovl->path.abpos * scale, y + 0.5);
+        cairo_line_to(cr, PADDING + ovl->path.aepos * scale, y + 0.5);
+        cairo_stroke(cr);
+    }
+
+    int hidx = scene_highlight(scene, ovl->bread);
+
+    if (scene->rid_prev == ovl->bread)
+    {
+        cairo_set_source_rgb(cr, 0, 0, 0);
+
+        cairo_move_to(cr, PADDING + ovl->path.abpos * scale - 10, y + 0.5);
+        cairo_line_to(cr, PADDING + ovl->path.abpos * scale - 5, y + 0.5);
+
+        cairo_move_to(cr, PADDING + ovl->path.aepos * scale + 5, y + 0.5);
+        cairo_line_to(cr, PADDING + ovl->path.aepos * scale + 10, y + 0.5);
+
+        cairo_stroke(cr);
+    }
+    else if (hidx != -1)
+    {
+        hidx = hidx % HIGHLIGHT_COLORS;
+        GdkRGBA* color = g_ectx.highlight_color + hidx;
+
+        cairo_set_source_rgb(cr, color->red, color->green, color->blue);
+
+        cairo_move_to(cr, PADDING + ovl->path.abpos * scale - 10, y + 0.5);
+        cairo_line_to(cr, PADDING + ovl->path.abpos * scale - 5, y + 0.5);
+
+        cairo_move_to(cr, PADDING + ovl->path.aepos * scale + 5, y + 0.5);
+        cairo_line_to(cr, PADDING + ovl->path.aepos * scale + 10, y + 0.5);
+
+        cairo_stroke(cr);
+    }
+}
+
+// draw the overlaps of the scene intersecting the rectangle. if hover is not -1 only
+// the overlaps with b-read hover are drawn, highlighted.
+
+static void scene_draw(cairo_t* cr, TileScene* scene, float scale, int xb, int yb, int xe, int ye, int hover)
+{
+    int step = scene->line_width * (1 + scene->pad);
+    int b = MAX(0, (yb - PADDING) / step - 2);
+    int e = MIN(scene->novl, MAX(0, (ye - PADDING) / step + 1));
+    int i;
+
+    cairo_set_line_width(cr, scene->line_width);
+
+    for (i = b; i < e; i++)
+    {
+        OverlapDetails* ovld = scene->ovls[i];
+        Overlap* ovl = &(ovld->ovl);
+
+        if (hover != -1 && ovl->bread != hover)
+        {
+            continue;
+        }
+
+        // the markers of highlighted reads extend 10 pixels past the overlap
+
+        if (PADDING + ovl->path.aepos * scale + 10 < xb || PADDING + ovl->path.abpos * scale - 10 > xe)
+        {
+            continue;
+        }
+
+        int highlight = 0;
+
+        if (hover != -1 || (scene->filter == filter_highlight && (ovl->flags & scene->filter_mask)))
+        {
+            highlight = 1;
+        }
+
+        draw_ovl(cr, scene, ovld, PADDING + (i + 1) * step, scale, xb, xe, highlight);
+    }
+}
+
+static TileScene* scene_create()
+{
+    Pile* pile = g_ectx.pile;
+
+    if (pile == NULL)
+    {
+        return NULL;
+    }
+
+    TileScene* scene = malloc(sizeof(TileScene));
+    int i;
+
+    scene->nrefs = 1;
+    scene->alen = DB_READ_LEN(&g_ectx.db, pile->rid);
+
+    scene->novl = g_ectx.novl_display;
+    scene->ovls = malloc(sizeof(OverlapDetails*) * MAX(scene->novl, 1));
+
+    for (i = 0; i < scene->novl; i++)
+    {
+        scene->ovls[i] = g_ectx.ovls_sorted[g_ectx.ovl_display[i]];
+    }
+
+    scene->nhighlight = g_ectx.hcur;
+    scene->highlight = malloc(sizeof(int) * MAX(scene->nhighlight, 1));
+    memcpy(scene->highlight, g_ectx.highlight, sizeof(int) * scene->nhighlight);
+
+    CurrentView* prev = view_prev();
+    scene->rid_prev = (prev != NULL) ? prev->rid : -1;
+
+    scene->show = g_ectx.show;
+    scene->filter = g_ectx.filter;
+    scene->filter_mask = g_ectx.filter_mask;
+    scene->line_width = g_ectx.line_width;
+    scene->pad = g_ectx.pad;
+
+    // the tiler may still render from the scene after the ui moved on to another read
+
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+    scene->pile = pile_pin(pile->rid);
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
+
+    return scene;
+}
+
+static void scene_unref(TileScene* scene)
+{
+    if (scene == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(g_ectx.tile_lock));
+    int nrefs = --scene->nrefs;
+    pthread_mutex_unlock(&(g_ectx.tile_lock));
+
+    if (nrefs > 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&(g_ectx.pile_lock));
+    pile_release(scene->pile);
+    pthread_mutex_unlock(&(g_ectx.pile_lock));
 
-    redraw();
+    free(scene->ovls);
+    free(scene->highlight);
+    free(scene);
 }
 
-static void set_segment_color(cairo_t* cr, int diffs, int len, int bHighlight)
+// tile cache, all of the following require g_ectx.tile_lock
+
+static void tile_drop(Tile* tile)
 {
-    const int q_colors[] =
-    { 22, 178, 0, 122, 195, 0, 211, 183, 0, 228, 82, 0, 245, 0, 34 };
+    if (tile->surface != NULL)
+    {
+        cairo_surface_destroy(tile->surface);
+        tile->surface = NULL;
+    }
 
-    int q = ((double) diffs / len) * g_ectx.twidth;
+    tile->state = tile_free;
+}
 
-    q = q / 10;
+// queue a tile of the current scene for the tiler, reusing the least recently used slot
 
-    if (q > 4)
+static Tile* tile_request(int width, int col, int row)
+{
+    Tile* tile = NULL;
+    int i;
+
+    for (i = 0; i < TILE_CACHE; i++)
     {
-        q = 4;
-    }
+        Tile* t = g_ectx.tiles + i;
 
-    float shift = 1.0;
+        if (t->state == tile_rendering)
+        {
+            continue;
+        }
 
-    if (bHighlight)
+        if (t->state == tile_free)
+        {
+            tile = t;
+            break;
+        }
+
+        if (tile == NULL || t->stamp < tile->stamp)
+        {
+            tile = t;
+        }
+    }
+
+    if (tile == NULL)
     {
-        shift -= 0.3;
+        return NULL;
     }
 
-    cairo_set_source_rgb(cr, (q_colors[q * 3] * shift) / 255.0, (q_colors[q * 3 + 1] * shift) / 255.0, (q_colors[q * 3 + 2] * shift) / 255.0);
+    tile_drop(tile);
+
+    tile->state = tile_queued;
+    tile->gen = g_ectx.tile_gen;
+    tile->width = width;
+    tile->col = col;
+    tile->row = row;
+
+    return tile;
 }
 
-static int highlight_has(int rid)
+static Tile* tile_get(int width, int col, int row)
 {
     int i;
 
-    for (i = 0; i < g_ectx.hcur; i++)
+    for (i = 0; i < TILE_CACHE; i++)
     {
-        int h = g_ectx.highlight[i];
+        Tile* t = g_ectx.tiles + i;
 
-        if (h > rid)
-        {
-            return -1;
-        }
-        else if (g_ectx.highlight[i] == rid)
+        if (t->state != tile_free && t->gen == g_ectx.tile_gen &&
+            t->width == width && t->col == col && t->row == row)
         {
-            return i;
+            t->stamp = ++g_ectx.tile_clock;
+
+            return t;
         }
     }
 
-    return -1;
+    Tile* tile = tile_request(width, col, row);
+
+    if (tile != NULL)
+    {
+        tile->stamp = ++g_ectx.tile_clock;
+    }
+
+    return tile;
 }
 
-static int cmp_int(const void* x, const void* y)
+static cairo_surface_t* tile_render(TileScene* scene, int width, int col, int row)
 {
-    int* a = (int*) x;
-    int* b = (int*) y;
+    cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, TILE_SIZE, TILE_SIZE);
+    cairo_t* cr = cairo_create(surface);
 
-    return (*a) - (*b);
+    int xb = col * TILE_SIZE;
+    int yb = row * TILE_SIZE;
+    float scale = (width - 2.0 * PADDING) / scene->alen;
+
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    cairo_paint(cr);
+
+    cairo_translate(cr, -xb, -yb);
+
+    scene_draw(cr, scene, scale, xb, yb, xb + TILE_SIZE, yb + TILE_SIZE, -1);
+
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+
+    return surface;
 }
 
-static void highlight_add(int rid)
+// runs on the main loop once a tile is rendered
+
+static gboolean tile_done(gpointer data)
 {
-    if (g_ectx.hcur + 1 >= g_ectx.hmax)
+    GdkRectangle* rect = (GdkRectangle*) data;
+
+    if (g_ectx.drawing_area != NULL)
     {
-        g_ectx.hmax += 20;
-        g_ectx.highlight = realloc(g_ectx.highlight, sizeof(int) * g_ectx.hmax);
+        gtk_widget_queue_draw_area(g_ectx.drawing_area, rect->x, rect->y, rect->width, rect->height);
     }
 
-    g_ectx.highlight[g_ectx.hcur] = rid;
-    g_ectx.hcur++;
+    free(rect);
 
-    qsort(g_ectx.highlight, g_ectx.hcur, sizeof(int), cmp_int);
+    return G_SOURCE_REMOVE;
 }
 
-static void highlight_remove(int rid)
+static void* tiler_thread(void* arg)
 {
-    int i;
+    UNUSED(arg);
 
-    for (i = 0; i < g_ectx.hcur; i++)
+    pthread_mutex_lock(&(g_ectx.tile_lock));
+
+    while (!g_ectx.tile_quit)
     {
-        if (g_ectx.highlight[i] == rid)
+        // most recently requested first, which are the visible ones
+
+        Tile* tile = NULL;
+        int i;
+
+        for (i = 0; i < TILE_CACHE; i++)
         {
-            g_ectx.highlight[i] = INT_MAX;
-            i = -1;
+            Tile* t = g_ectx.tiles + i;
 
-            break;
+            if (t->state == tile_queued && (tile == NULL || t->stamp > tile->stamp))
+            {
+                tile = t;
+            }
         }
-    }
 
-    if (i == -1)
-    {
-        qsort(g_ectx.highlight, g_ectx.hcur, sizeof(int), cmp_int);
-        g_ectx.hcur--;
-    }
-}
+        if (tile == NULL || g_ectx.scene == NULL)
+        {
+            pthread_cond_wait(&(g_ectx.tile_wake), &(g_ectx.tile_lock));
+            continue;
+        }
 
-static void draw_ovl(cairo_t* cr, OverlapDetails* ovld, int y, float scale, int clip_xb, int clip_xe, int bHighlight)
-{
-    Overlap* ovl = &(ovld->ovl);
+        TileScene* scene = g_ectx.scene;
+        scene->nrefs += 1;
 
-    if (g_ectx.show == show_q)
-    {
-        int x = ovl->path.abpos;
+        tile->state = tile_rendering;
+        int gen = tile->gen;
 
-        if (ovl->path.tlen == 0)
+        pthread_mutex_unlock(&(g_ectx.tile_lock));
+
+        cairo_surface_t* surface = tile_render(scene, tile->width, tile->col, tile->row);
+        GdkRectangle* rect = NULL;
+
+        pthread_mutex_lock(&(g_ectx.tile_lock));
+
+        if (gen == g_ectx.tile_gen)
         {
-            set_segment_color(cr, ovl->path.diffs, ovl->path.aepos - ovl->path.abpos, bHighlight);
+            tile->surface = surface;
+            tile->state = tile_ready;
 
-            cairo_move_to(cr, PADDING + ovl->path.abpos * scale, y + 0.5);
-            cairo_line_to(cr, PADDING + ovl->path.aepos * scale, y + 0.5);
-            cairo_stroke(cr);
+            rect = malloc(sizeof(GdkRectangle));
+            rect->x = tile->col * TILE_SIZE;
+            rect->y = tile->row * TILE_SIZE;
+            rect->width = rect->height = TILE_SIZE;
         }
         else
         {
-            ovl_trace* trace = ovl->path.trace;
-            int j;
+            cairo_surface_destroy(surface);
+            tile->state = tile_free;
+        }
 
-            for (j = 0; j < ovl->path.tlen - 2; j += 2)
-            {
-                int x_next = (x / g_ectx.twidth + 1) * g_ectx.twidth;
+        pthread_mutex_unlock(&(g_ectx.tile_lock));
 
-                if (x_next * scale + PADDING < clip_xb)
-                {
-                    x = x_next;
-                    continue;
-                }
+        scene_unref(scene);
 
-                cairo_move_to(cr, PADDING + x * scale, y + 0.5);
+        if (rect != NULL)
+        {
+            g_idle_add(tile_done, rect);
+        }
 
-                set_segment_color(cr, trace[j], trace[j + 1], bHighlight);
-                cairo_line_to(cr, PADDING + x_next * scale, y + 0.5);
-                cairo_stroke(cr);
+        pthread_mutex_lock(&(g_ectx.tile_lock));
+    }
 
-                x = x_next;
+    pthread_mutex_unlock(&(g_ectx.tile_lock));
 
-                if (x * scale + PADDING > clip_xe)
-                {
-                    break;
-                }
-            }
+    return NULL;
+}
 
-            if (x * scale + PADDING <= clip_xe)
-            {
-                set_segment_color(cr, trace[j], trace[j + 1], bHighlight);
+// paint the cached tiles covering the rectangle and queue the missing ones,
+// together with a row of tiles above and below
 
-                cairo_move_to(cr, PADDING + x * scale, y + 0.5);
-                cairo_line_to(cr, PADDING + ovl->path.aepos * scale, y + 0.5);
-                cairo_stroke(cr);
+static void tiles_draw(cairo_t* cr, int width, int xb, int yb, int xe, int ye)
+{
+    int col_b = xb / TILE_SIZE;
+    int col_e = (xe - 1) / TILE_SIZE;
+    int row_b = yb / TILE_SIZE;
+    int row_e = (ye - 1) / TILE_SIZE;
+    int col, row;
+
+    pthread_mutex_lock(&(g_ectx.tile_lock));
+
+    if (g_ectx.scene != NULL)
+    {
+        for (col = col_b; col <= col_e; col++)
+        {
+            if (row_b > 0)
+            {
+                tile_get(width, col, row_b - 1);
             }
+
+            tile_get(width, col, row_e + 1);
         }
     }
-    else
+
+    for (row = row_b; row <= row_e; row++)
     {
-        if (g_ectx.show == show_same)
+        for (col = col_b; col <= col_e; col++)
         {
-            int base = 0;
+            Tile* tile = NULL;
 
-            if (bHighlight)
+            if (g_ectx.scene != NULL)
             {
-                base = 1;
+                tile = tile_get(width, col, row);
             }
 
-            cairo_set_source_rgb(cr, fabs(base - 0.3), fabs(base - 0.3), fabs(base - 0.8));
-        }
-        else
-        {
-            if (bHighlight)
+            if (tile != NULL && tile->state == tile_ready)
             {
-                cairo_set_source_rgb(cr, 1.0 - ovld->color.red, 1.0 - ovld->color.green, 1.0 - ovld->color.blue);
+                cairo_set_source_surface(cr, tile->surface, col * TILE_SIZE, row * TILE_SIZE);
             }
             else
             {
-                cairo_set_source_rgb(cr, ovld->color.red, ovld->color.green, ovld->color.blue);
+                cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
             }
-        }
 
-        cairo_move_to(cr, PADDING + ovl->path.abpos * scale, y + 0.5);
-        cairo_line_to(cr, PADDING + ovl->path.aepos * scale, y + 0.5);
-        cairo_stroke(cr);
+            cairo_rectangle(cr, col * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+            cairo_fill(cr);
+        }
     }
 
-    int hidx = highlight_has(ovl->bread);
-    CurrentView* prev = view_prev();
+    pthread_cond_signal(&(g_ectx.tile_wake));
 
-    if (prev != NULL && prev->rid == ovl->bread)
-    {
-        cairo_set_source_rgb(cr, 0, 0, 0);
+    pthread_mutex_unlock(&(g_ectx.tile_lock));
+}
 
-        cairo_move_to(cr, PADDING + ovl->path.abpos * scale - 10, y + 0.5);
-        cairo_line_to(cr, PADDING + ovl->path.abpos * scale - 5, y + 0.5);
+// the displayed overlaps or the way they are drawn changed
 
-        cairo_move_to(cr, PADDING + ovl->path.aepos * scale + 5, y + 0.5);
-        cairo_line_to(cr, PADDING + ovl->path.aepos * scale + 10, y + 0.5);
+static void tiles_invalidate()
+{
+    TileScene* scene = scene_create();
+    int i;
 
-        cairo_stroke(cr);
-    }
-    else if (hidx != -1)
+    pthread_mutex_lock(&(g_ectx.tile_lock));
+
+    TileScene* prev = g_ectx.scene;
+
+    g_ectx.scene = scene;
+    g_ectx.tile_gen += 1;
+
+    for (i = 0; i < TILE_CACHE; i++)
     {
-        hidx = hidx % HIGHLIGHT_COLORS;
-        GdkRGBA* color = g_ectx.highlight_color + hidx;
+        if (g_ectx.tiles[i].state != tile_rendering)
+        {
+            tile_drop(g_ectx.tiles + i);
+        }
+    }
 
-        cairo_set_source_rgb(cr, color->red, color->green, color->blue);
+    pthread_mutex_unlock(&(g_ectx.tile_lock));
 
-        cairo_move_to(cr, PADDING + ovl->path.abpos * scale - 10, y + 0.5);
-        cairo_line_to(cr, PADDING + ovl->path.abpos * scale - 5, y + 0.5);
+    scene_unref(prev);
+}
 
-        cairo_move_to(cr, PADDING + ovl->path.aepos * scale + 5, y + 0.5);
-        cairo_line_to(cr, PADDING + ovl->path.aepos * scale + 10, y + 0.5);
+static void tiles_start()
+{
+    g_ectx.tiles = calloc(TILE_CACHE, sizeof(Tile));
+    g_ectx.scene = NULL;
+    g_ectx.tile_gen = 0;
+    g_ectx.tile_clock = 0;
+    g_ectx.tile_quit = 0;
 
-        cairo_stroke(cr);
+    pthread_mutex_init(&(g_ectx.tile_lock), NULL);
+    pthread_cond_init(&(g_ectx.tile_wake), NULL);
+
+    pthread_create(&(g_ectx.tiler), NULL, tiler_thread, NULL);
+}
+
+static void tiles_stop()
+{
+    int i;
+
+    pthread_mutex_lock(&(g_ectx.tile_lock));
+    g_ectx.tile_quit = 1;
+    pthread_cond_signal(&(g_ectx.tile_wake));
+    pthread_mutex_unlock(&(g_ectx.tile_lock));
+
+    pthread_join(g_ectx.tiler, NULL);
+
+    for (i = 0; i < TILE_CACHE; i++)
+    {
+        tile_drop(g_ectx.tiles + i);
     }
+
+    free(g_ectx.tiles);
+
+    scene_unref(g_ectx.scene);
+    g_ectx.scene = NULL;
+
+    pthread_mutex_destroy(&(g_ectx.tile_lock));
+    pthread_cond_destroy(&(g_ectx.tile_wake));
 }
 
 static gboolean track_draw_callback(GtkWidget* widget, cairo_t* cr, gpointer data)
@@ -1090,12 +2005,9 @@ static gboolean read_draw_callback(GtkWidget* widget, cairo_t* cr, gpointer data
 {
     UNUSED(data);
 
-    guint width; // , height;
-    OverlapDetails** ovls_sorted = g_ectx.ovls_sorted;
+    int width = gtk_widget_get_allocated_width(widget);
     int rid = view_current()->rid;
-
-    width = gtk_widget_get_allocated_width(widget);
-    // height = gtk_widget_get_allocated_height(widget);
+    TileScene* scene = g_ectx.scene;
 
 #ifdef EXP_PRINT
     int height = gtk_widget_get_allocated_height( widget );
@@ -1115,66 +2027,31 @@ static gboolean read_draw_callback(GtkWidget* widget, cairo_t* cr, gpointer data
     printf("draw clip rect %4d..%4d -> %4d..%4d\n", clip_xb, clip_yb, clip_xe, clip_ye);
 #endif
 
-    // background
-
-    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
-    cairo_rectangle(cr, clip_xb, clip_xe, clip.width, clip.height);
-    cairo_fill(cr);
-
-    cairo_set_line_width(cr, g_ectx.line_width);
     int alen = DB_READ_LEN(&g_ectx.db, rid);
     float scale = g_ectx.hscale = (width - 2.0 * PADDING) / alen;
 
-    // printf("drawing %d overlaps @ scale %.2f\n", ocur, scale);
+    g_ectx.ovl_y_start = PADDING;
 
     // b reads
 
-    int y = PADDING;
-    int i;
-
-    cairo_set_line_width(cr, g_ectx.line_width);
-    // y += g_ectx.line_width;
-
-    g_ectx.ovl_y_start = y;
-
-    int draw_start = MAX(0, ypos2index( clip_yb ) - 1);
-    int draw_end = ypos2index( clip_ye );
+#ifdef EXP_PRINT
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    cairo_rectangle(cr, clip_xb, clip_yb, clip.width, clip.height);
+    cairo_fill(cr);
 
-    if (draw_end == -1 || draw_end > g_ectx.novl_display)
-    {
-        draw_end = g_ectx.novl_display;
-    }
-    else
+    if (scene != NULL)
     {
-        draw_end = MIN(g_ectx.novl_display, draw_end + 1);
+        scene_draw(cr, scene, scale, clip_xb, clip_yb, clip_xe, clip_ye, -1);
     }
-
-#ifdef DEBUG
-    printf("draw_start %d .. draw_end %d\n", draw_start, draw_end);
+#else
+    tiles_draw(cr, width, clip_xb, clip_yb, clip_xe, clip_ye);
 #endif
 
-    y += draw_start * g_ectx.line_width * (1 + g_ectx.pad);
+    // the hovered b read changes with every mouse move and is drawn over the tiles
 
-    for ( i = draw_start ; i < draw_end ; i++ )
+    if (scene != NULL && g_ectx.rid_hover_highlight != -1)
     {
-        int idx = g_ectx.ovl_display[i];
-        Overlap* ovl = &(ovls_sorted[idx]->ovl);
-
-        y += g_ectx.line_width * (1 + g_ectx.pad);
-
-#ifdef DEBUG
-        printf("drawing %d @ y %4d .. bread %8d .. highlight %8d\n", i, y, ovl->bread, g_ectx.rid_hover_highlight);
-#endif
-
-        int highlight = 0;
-
-        if ( ovl->bread == g_ectx.rid_hover_highlight ||
-             ( g_ectx.filter == filter_highlight && ovl->flags & g_ectx.filter_mask ) )
-        {
-            highlight = 1;
-        }
-
-        draw_ovl(cr, ovls_sorted[idx], y, scale, clip_xb, clip_xe, highlight);
+        scene_draw(cr, scene, scale, clip_xb, clip_yb, clip_xe, clip_ye, g_ectx.rid_hover_highlight);
     }
 
 #ifdef EXP_PRINT
@@ -1328,7 +2205,7 @@ static void edit_hzoom_changed(GtkSpinButton* spin_button, gpointer user_data)
 
     gtk_widget_grab_focus(GTK_WIDGET(g_ectx.scrolled_wnd));
 
-    redraw();
+    redraw_zoom();
 }
 
 static void edit_filter_pos_changed(GtkSpinButton* spin_button, gpointer user_data)
@@ -1342,7 +2219,7 @@ static void edit_filter_pos_changed(GtkSpinButton* spin_button, gpointer user_da
     if (filter_ab >= filter_ae)
     {
         view_current()->filter_ab = 0;
-        view_current()->filter_ae = DB_READ_LEN(&g_ectx.db, g_ectx.ovls->ovl.aread);
+        view_current()->filter_ae = DB_READ_LEN(&g_ectx.db, view_current()->rid);
     }
 
     gtk_widget_grab_focus(GTK_WIDGET(g_ectx.scrolled_wnd));
@@ -1356,7 +2233,7 @@ static void edit_linewidth_value_changed(GtkSpinButton* sbtn, gpointer user_data
     UNUSED(user_data);
 
     g_ectx.line_width = gtk_spin_button_get_value_as_int(sbtn);
-    adjust_drawing_area_size();
+    redraw();
 
     gtk_widget_grab_focus(GTK_WIDGET(g_ectx.scrolled_wnd));
 }
@@ -1377,7 +2254,7 @@ static void check_pad_toggled(GtkToggleButton* togglebutton, gpointer user_data)
     UNUSED(user_data);
 
     g_ectx.pad = gtk_toggle_button_get_active(togglebutton);
-    adjust_drawing_area_size();
+    redraw();
 
     gtk_widget_grab_focus(GTK_WIDGET(g_ectx.scrolled_wnd));
 
@@ -1982,6 +2859,7 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
     gchar* tname = TRACK_TRIM;
     gchar* sname = TRACK_SOURCE;
     gchar** inames = NULL;
+    gint cache_mb = DEF_CACHE_MB;
     gchar** remaining = NULL;
 
     GOptionEntry entries[] = {
@@ -1989,6 +2867,7 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
             {"trim", 't', 0, G_OPTION_ARG_STRING, &tname, "name of the track containing the read trim annotation", NULL},
             {"source", 's', 0, G_OPTION_ARG_STRING, &sname, "track containing a mapping of the read ids back to the pre-patching read ids", NULL},
             {"interval", 'i', 0, G_OPTION_ARG_STRING_ARRAY, &inames, "include the interval annotation track in the display", NULL},
+            {"cache", 'c', 0, G_OPTION_ARG_INT, &cache_mb, "memory in MB used for caching the overlaps of recently shown and prefetched reads", NULL},
             {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &remaining, NULL, NULL},
             {NULL, 0, 0, 0, NULL, NULL, NULL}
     };
@@ -2025,10 +2904,15 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
 
     // open las files and their indices
 
-    g_ectx.lasFiles = malloc(sizeof(FILE*) * blocks);
-    bzero(g_ectx.lasFiles, sizeof(FILE*) * blocks);
+    // the loader thread reads the las files through handles of its own
+
+    g_ectx.lasFiles = calloc(blocks, sizeof(FILE*));
+    g_ectx.loaderFiles = calloc(blocks, sizeof(FILE*));
 
+    g_ectx.lasIndex = calloc(nreads, sizeof(off_t));
     g_ectx.lasIndexFile = malloc(sizeof(int) * nreads);
+    g_ectx.lasNovl = calloc(nreads, sizeof(int));
+    g_ectx.lasTbytes = calloc(nreads, sizeof(uint64));
     g_ectx.pathLas = remaining[1];
 
     int rid;
@@ -2054,78 +2938,32 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
         {
             sprintf(pathLas, "%s%d%s", prefix, b, suffix);
 
-            if ((g_ectx.lasFiles[b - 1] = fopen(pathLas, "r")) == NULL)
+            if ((g_ectx.lasFiles[b - 1] = fopen(pathLas, "r")) == NULL ||
+                (g_ectx.loaderFiles[b - 1] = fopen(pathLas, "r")) == NULL)
             {
                 fprintf(stderr, "could not open '%s'\n", pathLas);
                 exit(1);
             }
 
-            if (b == 1)
-            {
-                g_ectx.lasIndex = lasidx_load(&(g_ectx.db), pathLas, 1);
-
-                int j;
-
-                for (j = 0; j < nreads; j++)
-                {
-                    if (g_ectx.lasIndex[j] != 0)
-                    {
-                        g_ectx.lasIndexFile[j] = 0;
-                    }
-                }
-            }
-            else
-            {
-                lasidx* lasIndex = lasidx_load(&(g_ectx.db), pathLas, 1);
-
-                int j;
-
-                for (j = 0; j < nreads; j++)
-                {
-                    if (lasIndex[j] == 0)
-                    {
-                        continue;
-                    }
-
-                    if (g_ectx.lasIndex[j] != 0)
-                    {
-                        fprintf(stderr, "error: read id %d used in two indices\n", j);
-
-                        // printf("%lld %lld\n", lasIndex[j], g_ectx.lasIndex[j]);
-
-                        exit(1);
-                    }
-
-                    g_ectx.lasIndex[j] = lasIndex[j];
-                    g_ectx.lasIndexFile[j] = b - 1;
-                }
-
-                free(lasIndex);
-            }
-
+            las_index_add(pathLas, b - 1);
         }
 
+        g_ectx.nlasFiles = blocks;
+
         *num = '#';
     }
     else
     {
-        if ((g_ectx.lasFiles[0] = fopen(g_ectx.pathLas, "r")) == NULL)
+        if ((g_ectx.lasFiles[0] = fopen(g_ectx.pathLas, "r")) == NULL ||
+            (g_ectx.loaderFiles[0] = fopen(g_ectx.pathLas, "r")) == NULL)
         {
             fprintf(stderr, "could not open '%s'\n", g_ectx.pathLas);
             exit(1);
         }
 
-        g_ectx.lasIndex = lasidx_load(&(g_ectx.db), g_ectx.pathLas, 1);
-
-        int j;
+        las_index_add(g_ectx.pathLas, 0);
 
-        for (j = 0; j < nreads; j++)
-        {
-            if (g_ectx.lasIndex[j] != 0)
-            {
-                g_ectx.lasIndexFile[j] = 0;
-            }
-        }
+        g_ectx.nlasFiles = 1;
     }
 
     g_ectx.qtrack = track_load(&g_ectx.db, qname);
@@ -2166,7 +3004,6 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
     g_ectx.viewstack_max = 0;
     g_ectx.viewstack = NULL;
     g_ectx.omax = 500;
-    g_ectx.ovls = malloc(sizeof(OverlapDetails) * g_ectx.omax);
     g_ectx.ovls_sorted = malloc(sizeof(OverlapDetails*) * g_ectx.omax);
     g_ectx.ovl_display = malloc(sizeof(int) * g_ectx.omax);
 
@@ -2190,6 +3027,9 @@ static int command_line(GApplication* application, GApplicationCommandLine* cmdl
     ovl_header_read(g_ectx.lasFiles[0], &novl, &(g_ectx.twidth));
     g_ectx.tbytes = TBYTES(g_ectx.twidth);
 
+    loader_start((size_t) cache_mb * 1024 * 1024);
+    tiles_start();
+
     // enter even loop
 
     g_option_context_free(optctx);
@@ -2216,5 +3056,11 @@ int main(int argc, char** argv)
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
 
+    if (g_ectx.piles != NULL)
+    {
+        tiles_stop();
+        loader_stop();
+    }
+
     return status;
 }
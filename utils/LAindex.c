@@ -28,7 +28,7 @@
 static void usage()
 {
     printf( "usage: database input.ovl\n\n" );
-    printf( "Creates an index file for input.las containing the offsets of the A reads.\n" );
+    printf( "Creates an index file for input.las containing offset, overlap count and trace size of the A reads.\n" );
     printf( "Index files are used by some tools to locate the alignments of a read quickly.\n" );
 }
 
@@ -57,7 +57,7 @@ int main( int argc, char* argv[] )
     }
 
     // cleanup
-    free( idx );
+    lasidx_close( idx );
     Close_DB( &db );
 
     return 0;
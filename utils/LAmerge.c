@@ -5,16 +5,66 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "LAmergeUtils.h"
 #include "dalign/align.h"
 #include "dalign/filter.h"
 #include "lib/pass.h"
+#include "lib/lasidx.h"
+#include "lib/laz.h"
 
 #undef DEBUG
 
+//  An output file ending in .laz is written compressed
+
+static int merge_laz( char* fout )
+{
+    size_t len = strlen( fout );
+
+    return ( len > 4 && strcmp( fout + len - 4, ".laz" ) == 0 );
+}
+
+//  Opens a LAZ output, whose blocks are compressed by nthreads threads
+
+static LAZ* merge_laz_open( char* fout, int twidth, int nthreads )
+{
+    LAZ* laz = laz_open( fout, 1 );
+
+    if ( laz == NULL )
+    {
+        fprintf( stderr, "[ERROR] - LAmerge: Cannot open file \"%s\" for writing\n", fout );
+        exit( 1 );
+    }
+
+    laz->twidth = twidth;
+    laz_set_threads( laz, nthreads );
+
+    return laz;
+}
+
+//  The inputs of the first merge round are checked on the fly, as their records are read.
+//  mopt is NULL for intermediate files. On a failed check the output is removed.
+
+static int merge_checks( MERGE_OPT* mopt )
+{
+    return ( mopt != NULL && ( mopt->CHECK_SORT_ORDER || mopt->CHECK_TRACE_POINTS ) );
+}
+
+static void merge_check_failed( char* fout, char* fin, int sorted )
+{
+    unlink( fout );
+
+    fprintf( stderr, "[ERROR] : LAmerge - overlap file %s failed check!%s\n",
+             fin, sorted ? " Use -s option to sort the input files!" : "" );
+    exit( 1 );
+}
+
 // is only called once, and if the sort flag is enabled
-void sortFile( char* fout, char* fin, int verbose )
+void sortFile( char* fout, char* fin, int verbose, MERGE_OPT* mopt )
 {
     Overlap* allOvls;
 
@@ -71,6 +121,12 @@ void sortFile( char* fout, char* fin, int verbose )
     nTraces = novls * 60;
     traces  = (uint16*)malloc( sizeof( uint16 ) * nTraces );
 
+    CheckContext cctx;
+    int check = merge_checks( mopt );
+
+    if ( check )
+        check_init( &cctx, mopt, fin, twidth );
+
     // parse all overlaps
     tcur          = 0;
     size_t tbytes = TBYTES( twidth );
@@ -101,10 +157,19 @@ void sortFile( char* fout, char* fin, int verbose )
 
             if ( tbytes == sizeof( uint8 ) )
                 Decompress_TraceTo16( allOvls + j );
+
+            if ( check )
+                check_overlap( &cctx, allOvls + j, allOvls[ j ].path.trace, sizeof( uint16 ) );
         }
 
         // check if j agrees with novls[i]
         assert( j <= novls );
+
+        if ( check && ( cctx.error || j != novls ) )
+        {
+            fclose( outFile );
+            merge_check_failed( fout, fin, 0 );
+        }
     }
 
     qsort( allOvls, novls, sizeof( Overlap ), SORT_OVL );
@@ -132,7 +197,7 @@ void sortFile( char* fout, char* fin, int verbose )
     free( traces );
 }
 
-void sortAndMerge( char* fout, char** fin, int numF, int verbose )
+void sortAndMerge( char* fout, char** fin, int numF, int verbose, int index, MERGE_OPT* mopt )
 {
     assert( fout != NULL );
 
@@ -217,7 +282,18 @@ void sortAndMerge( char* fout, char** fin, int numF, int verbose )
     traces  = (uint16*)malloc( sizeof( uint16 ) * nTraces );
 
     // try to open output file
-    FILE* out = fopen( fout, "w" );
+    LAZ* laz = NULL;
+    FILE* out;
+
+    if ( merge_laz( fout ) )
+    {
+        laz   = merge_laz_open( fout, twidth, mopt->nthreads );
+        out   = laz->file;
+        index = 0;
+    }
+    else
+        out = fopen( fout, "w" );
+
     if ( !out )
     {
         fprintf( stderr,
@@ -230,9 +306,15 @@ void sortAndMerge( char* fout, char** fin, int numF, int verbose )
     ovlIdx        = 0;
     tcur          = 0;
     size_t tbytes = TBYTES( twidth );
+    int check     = merge_checks( mopt );
     for ( i = 0; i < numF; i++ )
     {
         FILE* f = inFiles[ i ];
+        CheckContext cctx;
+
+        if ( check )
+            check_init( &cctx, mopt, fin[ i ], twidth );
+
         for ( j = 0; j < novls[ i ]; j++ )
         {
             if ( ovlIdx >= nAllOvls ) // should never happen, i.e. a header was broken
@@ -266,11 +348,23 @@ void sortAndMerge( char* fout, char** fin, int numF, int verbose )
             if ( tbytes == sizeof( uint8 ) )
                 Decompress_TraceTo16( allOvls + ovlIdx );
 
+            if ( check )
+                check_overlap( &cctx, allOvls + ovlIdx, allOvls[ ovlIdx ].path.trace, sizeof( uint16 ) );
+
             ovlIdx++;
         }
 
         // check if j agrees with novls[i]
         assert( j <= novls[ i ] );
+
+        if ( check && ( cctx.error || j != novls[ i ] ) )
+        {
+            if ( laz )
+                laz_close( laz );
+            else
+                fclose( out );
+            merge_check_failed( fout, fin[ i ], 0 );
+        }
     }
 
     qsort( allOvls, nAllOvls, sizeof( Overlap ), SORT_OVL );
@@ -279,19 +373,51 @@ void sortAndMerge( char* fout, char** fin, int numF, int verbose )
         fprintf( stdout, "SortAndMerged %llu overlaps\n", ovlIdx );
 
     // write header
-    fwrite( &nAllOvls, sizeof( nAllOvls ), 1, out );
-    fwrite( &twidth, sizeof( twidth ), 1, out );
+    if ( !laz )
+    {
+        fwrite( &nAllOvls, sizeof( nAllOvls ), 1, out );
+        fwrite( &twidth, sizeof( twidth ), 1, out );
+    }
+
+    lasidx* idx = NULL;
+    off_t ooff  = sizeof( nAllOvls ) + sizeof( twidth );
+
+    if ( index )
+        idx = lasidx_new( twidth );
 
     for ( j = 0; j < nAllOvls; j++ )
     {
         if ( tbytes == sizeof( uint8 ) )
             Compress_TraceTo8( allOvls + j );
 
+        if ( laz )
+        {
+            laz_write( laz, allOvls + j );
+            continue;
+        }
+
         Write_Overlap( out, allOvls + j, tbytes );
+
+        if ( idx )
+        {
+            lasidx_add( idx, allOvls[ j ].aread, ooff, allOvls[ j ].path.tlen * tbytes );
+            ooff += OVERLAP_IO_SIZE + allOvls[ j ].path.tlen * tbytes;
+        }
     }
 
     // clean up
-    fclose( out );
+    if ( laz )
+        laz_close( laz );
+    else
+        fclose( out );
+
+    if ( idx )
+    {
+        if ( !lasidx_write( idx, fout ) )
+            exit( 1 );
+
+        lasidx_close( idx );
+    }
 
     for ( i = 0; i < numF; i++ )
         fclose( inFiles[ i ] );
@@ -303,7 +429,297 @@ void sortAndMerge( char* fout, char** fin, int numF, int verbose )
     free( traces );
 }
 
-void merge( char* fout, char** fin, int numInFiles, int verbose )
+//  A merge job merges the byte ranges [start[i], end[i]) of all inputs. The ranges
+//  of the jobs cover consecutive A-read intervals, their outputs are concatenated.
+
+typedef struct
+{
+    int fway;
+    int* fd;
+    off_t* start;
+    off_t* end;
+
+    int64 bsize;
+    int prefetch;
+    int tbytes;
+
+    FILE* output;
+    LAZ* laz;               // LAZ output, takes the records instead of output
+    lasidx* idx;            // offsets relative to the start of the job's output
+    int64 count;
+    int64 size;
+
+    CheckContext* check;    // per input, NULL if the inputs are not checked
+} MergeJob;
+
+static void* merge_job( void* arg )
+{
+    MergeJob* job = (MergeJob*)arg;
+    IO_stream* in;
+    LoserTree lt;
+    char *oblock, *optr, *otop;
+    int64 psize, osize;
+    int i, w;
+
+    psize = sizeof( void* );
+    osize = sizeof( Overlap ) - psize;
+
+    in     = (IO_stream*)Malloc( sizeof( IO_stream ) * job->fway,
+                             "Allocating LAmerge streams" );
+    oblock = (char*)Malloc( job->bsize, "Allocating LAmerge blocks" );
+    if ( in == NULL || oblock == NULL )
+        exit( 1 );
+
+    for ( i = 0; i < job->fway; i++ )
+    {
+        stream_open( in + i, job->fd[ i ], job->start[ i ], job->end[ i ],
+                     job->bsize, job->prefetch );
+        stream_next( in + i );
+    }
+
+    lt_init( &lt, in, job->fway );
+
+    optr = oblock;
+    otop = oblock + job->bsize;
+
+    while ( ( w = lt_winner( &lt ) ) >= 0 )
+    {
+        IO_stream* src = in + w;
+        Overlap* ov    = &( src->ovl );
+        int64 tsize, span;
+        char* trace;
+
+        tsize = ov->path.tlen * job->tbytes;
+        span  = osize + tsize;
+        trace = stream_trace( src, tsize );
+
+        if ( job->check )
+            check_overlap( job->check + w, ov, trace, job->tbytes );
+
+        if ( job->laz )
+        {
+            ov->path.trace = trace;
+            laz_write( job->laz, ov );
+        }
+        else
+        {
+            if ( optr + span > otop )
+            {
+                fwrite( oblock, 1, optr - oblock, job->output );
+                optr = oblock;
+            }
+
+            if ( span > job->bsize )
+            {
+                fwrite( ( (char*)ov ) + psize, 1, osize, job->output );
+                fwrite( trace, 1, tsize, job->output );
+            }
+            else
+            {
+                memcpy( optr, ( (char*)ov ) + psize, osize );
+                optr += osize;
+                memcpy( optr, trace, tsize );
+                optr += tsize;
+            }
+        }
+
+        if ( job->idx )
+            lasidx_add( job->idx, ov->aread, job->size, tsize );
+        job->size += span;
+
+        stream_next( src );
+        lt_replay( &lt );
+    }
+
+    if ( optr > oblock )
+        fwrite( oblock, 1, optr - oblock, job->output );
+
+    job->count = 0;
+    for ( i = 0; i < job->fway; i++ )
+    {
+        job->count += in[ i ].count;
+        stream_close( in + i );
+    }
+
+    lt_free( &lt );
+    free( oblock );
+    free( in );
+
+    return NULL;
+}
+
+//  Partitioning of a merge into jobs covering A-read intervals of about the
+//  same size. The A-reads are grouped into buckets, whose width doubles
+//  whenever the range does not fit MERGE_BUCKETS anymore.
+
+#define MERGE_BUCKETS 4096
+
+typedef struct
+{
+    int fway;
+    int lo;                 // smallest A-read of all inputs
+    int width;              // A-reads per bucket
+    int64* bytes;           // per bucket, over all inputs
+    off_t* first;           // per input and bucket the offset of its first record, -1 if empty
+} MergePartition;
+
+static void partition_compact( MergePartition* mp )
+{
+    int b, i;
+
+    for ( b = 0; b < MERGE_BUCKETS / 2; b++ )
+        mp->bytes[ b ] = mp->bytes[ 2 * b ] + mp->bytes[ 2 * b + 1 ];
+    for ( ; b < MERGE_BUCKETS; b++ )
+        mp->bytes[ b ] = 0;
+
+    for ( i = 0; i < mp->fway; i++ )
+    {
+        off_t* first = mp->first + (int64)i * MERGE_BUCKETS;
+
+        for ( b = 0; b < MERGE_BUCKETS / 2; b++ )
+            first[ b ] = ( first[ 2 * b ] != -1 ) ? first[ 2 * b ] : first[ 2 * b + 1 ];
+        for ( ; b < MERGE_BUCKETS; b++ )
+            first[ b ] = -1;
+    }
+
+    mp->width *= 2;
+}
+
+static void partition_add( MergePartition* mp, int i, int aread, off_t offset, int64 bytes )
+{
+    int64 b;
+    off_t* first;
+
+    b = ( aread > mp->lo ) ? ( aread - mp->lo ) / mp->width : 0;
+    while ( b >= MERGE_BUCKETS )
+    {
+        partition_compact( mp );
+        b = ( aread - mp->lo ) / mp->width;
+    }
+
+    mp->bytes[ b ] += bytes;
+
+    first = mp->first + (int64)i * MERGE_BUCKETS;
+    if ( first[ b ] == -1 )
+        first[ b ] = offset;
+}
+
+//  Computes bound[i * (njobs + 1) + p], the offset in input i at which job p starts.
+//  Inputs with an up-to-date index are partitioned using it, the record
+//  headers of all others are scanned once.
+
+static void merge_partition( char** fin, int* fd, off_t* size, int fway, int lo,
+                             int tbytes, int njobs, off_t* bound )
+{
+    MergePartition mp;
+    int64 psize, osize, total, cum;
+    off_t hsize;
+    int i, b, p;
+    int* cut;
+
+    psize = sizeof( void* );
+    osize = sizeof( Overlap ) - psize;
+    hsize = sizeof( int64 ) + sizeof( int );
+
+    mp.fway  = fway;
+    mp.lo    = lo;
+    mp.width = 1;
+    mp.bytes = (int64*)Malloc( sizeof( int64 ) * MERGE_BUCKETS, "Allocating merge partition" );
+    mp.first = (off_t*)Malloc( sizeof( off_t ) * MERGE_BUCKETS * fway, "Allocating merge partition" );
+    cut      = (int*)Malloc( sizeof( int ) * ( njobs + 1 ), "Allocating merge partition" );
+    if ( mp.bytes == NULL || mp.first == NULL || cut == NULL )
+        exit( 1 );
+
+    bzero( mp.bytes, sizeof( int64 ) * MERGE_BUCKETS );
+    for ( b = 0; b < MERGE_BUCKETS * fway; b++ )
+        mp.first[ b ] = -1;
+
+    for ( i = 0; i < fway; i++ )
+    {
+        lasidx* idx = lasidx_load( NULL, fin[ i ], 0 );
+
+        if ( idx )
+        {
+            uint64 a;
+
+            for ( a = 0; a < idx->nreads; a++ )
+                if ( idx->entries[ a ].novl )
+                    partition_add( &mp, i, a, idx->entries[ a ].offset, lasidx_bytes( idx, a ) );
+
+            lasidx_close( idx );
+        }
+        else
+        {
+            IO_stream in;
+            off_t off = hsize;
+
+            stream_open( &in, fd[ i ], hsize, size[ i ], 1000000ll, 0 );
+
+            while ( stream_next( &in ) )
+            {
+                int64 tsize = in.ovl.path.tlen * tbytes;
+
+                stream_trace( &in, tsize );
+                partition_add( &mp, i, in.ovl.aread, off, osize + tsize );
+                off += osize + tsize;
+            }
+
+            stream_close( &in );
+        }
+    }
+
+    total = 0;
+    for ( b = 0; b < MERGE_BUCKETS; b++ )
+        total += mp.bytes[ b ];
+
+    cum = 0;
+    b   = 0;
+    for ( p = 0; p <= njobs; p++ )
+    {
+        while ( b < MERGE_BUCKETS && cum < ( total / njobs ) * p )
+            cum += mp.bytes[ b++ ];
+        cut[ p ] = ( p == njobs ) ? MERGE_BUCKETS : b;
+    }
+
+    for ( i = 0; i < fway; i++ )
+    {
+        off_t* first = mp.first + (int64)i * MERGE_BUCKETS;
+        off_t next   = size[ i ];
+
+        for ( b = MERGE_BUCKETS - 1; b >= 0; b-- )
+        {
+            if ( first[ b ] != -1 )
+                next = first[ b ];
+            first[ b ] = next;
+        }
+
+        for ( p = 0; p <= njobs; p++ )
+            bound[ i * ( njobs + 1 ) + p ] = ( cut[ p ] < MERGE_BUCKETS ) ? first[ cut[ p ] ] : size[ i ];
+        bound[ i * ( njobs + 1 ) ] = hsize;
+    }
+
+    free( cut );
+    free( mp.first );
+    free( mp.bytes );
+}
+
+static void append_file( FILE* output, FILE* input, char* block, int64 bsize )
+{
+    size_t n;
+
+    rewind( input );
+
+    while ( ( n = fread( block, 1, bsize, input ) ) > 0 )
+    {
+        if ( fwrite( block, 1, n, output ) != n )
+            SYSTEM_ERROR
+    }
+
+    if ( ferror( input ) )
+        SYSTEM_ERROR
+}
+
+void merge( char* fout, char** fin, int numInFiles, int verbose, int index, int nthreads, MERGE_OPT* mopt )
 {
     assert( fout != NULL );
 
@@ -319,43 +735,52 @@ void merge( char* fout, char** fin, int numInFiles, int verbose )
         exit( 1 );
     }
 
-    IO_block* in;
-    int64 bsize, osize, psize;
-    char *block, *oblock;
-    int i, fway;
-    Overlap** heap;
-    int hsize;
-    Overlap* ovls;
-    int64 totl;
+    MergeJob* jobs;
+    pthread_t* threads;
+    CheckContext* check;
+    int* fd;
+    off_t *size, *bound, *range;
+    int64 *novls;
+    int64 bsize, totl, count;
+    int i, p, fway, njobs, lo;
     int tspace, tbytes;
     FILE* output;
-    char *optr, *otop;
+    LAZ* laz;
+    off_t hsize;
+
+    //  Open all the input files and read their headers. A LAZ output is merged
+    //  by a single job, the threads compress its blocks.
 
-    //  Open all the input files and initialize their buffers
     fway  = numInFiles;
-    psize = sizeof( void* );
-    osize = sizeof( Overlap ) - psize;
-    bsize = ( MEMORY * 1000000ll ) / ( fway + 1 );
-    block = (char*)Malloc( bsize * ( fway + 1 ) + psize,
-                           "Allocating LAmerge blocks" );
-    in    = (IO_block*)Malloc( sizeof( IO_block ) * fway,
-                            "Allocating LAmerge IO-reacords" );
-    if ( block == NULL || in == NULL )
+    njobs = MAX( nthreads, 1 );
+    hsize = sizeof( int64 ) + sizeof( int );
+    laz   = NULL;
+
+    if ( merge_laz( fout ) )
+    {
+        njobs = 1;
+        index = 0;
+    }
+
+    fd    = (int*)Malloc( sizeof( int ) * fway, "Allocating LAmerge inputs" );
+    size  = (off_t*)Malloc( sizeof( off_t ) * fway, "Allocating LAmerge inputs" );
+    novls = (int64*)Malloc( sizeof( int64 ) * fway, "Allocating LAmerge inputs" );
+    if ( fd == NULL || size == NULL || novls == NULL )
         exit( 1 );
-    block += psize;
 
     totl   = 0;
     tbytes = 0;
     tspace = 0;
+    lo     = INT32_MAX;
     for ( i = 0; i < fway; i++ )
     {
         int64 novl;
         int mspace;
-        FILE* input;
-        char* iblock;
+        struct stat st;
+        Overlap ovl;
 
-        input = fopen( fin[ i ], "r" );
-        if ( input == NULL )
+        fd[ i ] = open( fin[ i ], O_RDONLY );
+        if ( fd[ i ] == -1 )
         {
             fprintf( stderr,
                      "[ERROR] - LAmerge: Cannot open file \"%s\" for reading\n",
@@ -363,11 +788,16 @@ void merge( char* fout, char** fin, int numInFiles, int verbose )
             exit( 1 );
         }
 
-        if ( fread( &novl, sizeof( int64 ), 1, input ) != 1 )
+        if ( pread( fd[ i ], &novl, sizeof( int64 ), 0 ) != sizeof( int64 ) )
             SYSTEM_ERROR
         totl += novl;
-        if ( fread( &mspace, sizeof( int ), 1, input ) != 1 )
+        novls[ i ] = novl;
+        if ( pread( fd[ i ], &mspace, sizeof( int ), sizeof( int64 ) ) != sizeof( int ) )
+            SYSTEM_ERROR
+        if ( fstat( fd[ i ], &st ) != 0 )
             SYSTEM_ERROR
+        size[ i ] = st.st_size;
+
         if ( i == 0 )
         {
             tspace = mspace;
@@ -383,15 +813,36 @@ void merge( char* fout, char** fin, int numInFiles, int verbose )
             exit( 1 );
         }
 
-        in[ i ].stream = input;
-        in[ i ].block = iblock = block + i * bsize;
-        in[ i ].ptr            = iblock;
-        in[ i ].top            = iblock + fread( in[ i ].block, 1, bsize, input );
-        in[ i ].count          = 0;
+        if ( pread( fd[ i ], ( (char*)&ovl ) + sizeof( void* ), OVERLAP_IO_SIZE, hsize ) == OVERLAP_IO_SIZE )
+            lo = MIN( lo, ovl.aread );
+    }
+
+    //  Split the A-reads into the ranges of the jobs
+
+    bound = (off_t*)Malloc( sizeof( off_t ) * fway * ( njobs + 1 ), "Allocating LAmerge jobs" );
+    if ( bound == NULL )
+        exit( 1 );
+
+    if ( njobs > 1 && lo != INT32_MAX )
+        merge_partition( fin, fd, size, fway, lo, tbytes, njobs, bound );
+    else
+    {
+        njobs = 1;
+        for ( i = 0; i < fway; i++ )
+        {
+            bound[ i * 2 ]     = hsize;
+            bound[ i * 2 + 1 ] = size[ i ];
+        }
     }
 
-    //  Open the output file buffer and write (novl,tspace) header
+    //  Open the output file and write (novl,tspace) header
 
+    if ( merge_laz( fout ) )
+    {
+        laz    = merge_laz_open( fout, tspace, nthreads );
+        output = NULL;
+    }
+    else
     {
         output = fopen( fout, "w" );
         if ( output == NULL )
@@ -402,109 +853,184 @@ void merge( char* fout, char** fin, int numInFiles, int verbose )
 
         fwrite( &totl, sizeof( int64 ), 1, output );
         fwrite( &tspace, sizeof( int ), 1, output );
-
-        oblock = block + fway * bsize;
-        optr   = oblock;
-        otop   = oblock + bsize;
     }
 
     if ( verbose )
     {
         printf( "Merging %d files totalling ", fway );
         Print_Number( totl, 0, stdout );
-        printf( " records\n" );
+        if ( laz && nthreads > 1 )
+            printf( " records compressed by %d threads\n", nthreads );
+        else if ( njobs > 1 )
+            printf( " records using %d threads\n", njobs );
+        else
+            printf( " records\n" );
     }
 
-    //  Initialize the heap
+    //  Set up the jobs, the first one writes to the output file directly
+
+    bsize = ( MEMORY * 1000000ll ) / ( ( 2 * fway + 1 ) * njobs );
+    if ( bsize < MIN_MERGE_BLOCK )
+        bsize = MIN_MERGE_BLOCK;
 
-    heap = (Overlap**)Malloc( sizeof( Overlap* ) * ( fway + 1 ),
-                              "Allocating heap" );
-    ovls = (Overlap*)Malloc( sizeof( Overlap ) * fway, "Allocating heap" );
-    if ( heap == NULL || ovls == NULL )
+    jobs    = (MergeJob*)Malloc( sizeof( MergeJob ) * njobs, "Allocating LAmerge jobs" );
+    threads = (pthread_t*)Malloc( sizeof( pthread_t ) * njobs, "Allocating LAmerge jobs" );
+    range   = (off_t*)Malloc( sizeof( off_t ) * 2 * fway * njobs, "Allocating LAmerge jobs" );
+    if ( jobs == NULL || threads == NULL || range == NULL )
         exit( 1 );
 
-    hsize = 0;
-    for ( i = 0; i < fway; i++ )
+    check = NULL;
+    if ( merge_checks( mopt ) )
+    {
+        check = (CheckContext*)Malloc( sizeof( CheckContext ) * fway * njobs, "Allocating LAmerge checks" );
+        if ( check == NULL )
+            exit( 1 );
+
+        for ( i = 0; i < fway * njobs; i++ )
+            check_init( check + i, mopt, fin[ i % fway ], tspace );
+    }
+
+    for ( p = 0; p < njobs; p++ )
     {
-        if ( in[ i ].ptr < in[ i ].top )
+        MergeJob* job = jobs + p;
+
+        job->fway     = fway;
+        job->fd       = fd;
+        job->start    = range + 2 * fway * p;
+        job->end      = job->start + fway;
+        job->bsize    = bsize;
+        job->prefetch = ( fway * njobs <= MAX_PREFETCH_THREADS );
+        job->tbytes   = tbytes;
+        job->laz      = laz;
+        job->idx      = index ? lasidx_new( tspace ) : NULL;
+        job->count    = 0;
+        job->size     = 0;
+        job->check    = check ? check + fway * p : NULL;
+
+        for ( i = 0; i < fway; i++ )
         {
-            ovls[ i ] = *( (Overlap*)( in[ i ].ptr - psize ) );
-            in[ i ].ptr += osize;
-            hsize += 1;
-            heap[ hsize ] = ovls + i;
+            job->start[ i ] = bound[ i * ( njobs + 1 ) + p ];
+            job->end[ i ]   = bound[ i * ( njobs + 1 ) + p + 1 ];
+        }
+
+        if ( p == 0 )
+            job->output = output;
+        else if ( ( job->output = tmpfile() ) == NULL )
+        {
+            fprintf( stderr, "[ERROR] - LAmerge: Cannot create temporary file\n" );
+            exit( 1 );
         }
     }
 
-    if ( hsize > 3 )
-        for ( i = hsize / 2; i > 1; i-- )
-            reheap( i, heap, hsize );
+    for ( p = 1; p < njobs; p++ )
+        if ( pthread_create( threads + p, NULL, merge_job, jobs + p ) != 0 )
+        {
+            fprintf( stderr, "[ERROR] - LAmerge: Cannot create merge thread\n" );
+            exit( 1 );
+        }
 
-    //  While the heap is not empty do
+    merge_job( jobs );
 
-    while ( hsize > 0 )
-    {
-        Overlap* ov;
-        IO_block* src;
-        int64 tsize, span;
+    for ( p = 1; p < njobs; p++ )
+        pthread_join( threads[ p ], NULL );
 
-        reheap( 1, heap, hsize );
+    //  The checks of an input's ranges are joined, its records have to match its header
 
-        ov  = heap[ 1 ];
-        src = in + ( ov - ovls );
+    if ( check )
+    {
+        for ( i = 0; i < fway; i++ )
+        {
+            for ( p = 1; p < njobs; p++ )
+                check_join( check + i, check + fway * p + i );
 
-        src->count += 1;
+            if ( !check[ i ].error && (int64)check[ i ].novl != novls[ i ] )
+                fprintf( stderr, "[ERROR] - LAmerge: In file: %s -> novl of %lld doesn't match actual overlap count of %lld\n",
+                         fin[ i ], novls[ i ], check[ i ].novl );
 
-        tsize = ov->path.tlen * tbytes;
-        span  = osize + tsize;
-        if ( src->ptr + span > src->top )
-            ovl_reload( src, bsize );
-        if ( optr + span > otop )
-        {
-            fwrite( oblock, 1, optr - oblock, output );
-            optr = oblock;
+            if ( check[ i ].error || (int64)check[ i ].novl != novls[ i ] )
+            {
+                if ( laz )
+                    laz_close( laz );
+                else
+                    fclose( output );
+                merge_check_failed( fout, fin[ i ], check[ i ].unsorted );
+            }
         }
 
-        memcpy( optr, ( (char*)ov ) + psize, osize );
-        optr += osize;
-        memcpy( optr, src->ptr, tsize );
-        optr += tsize;
+        free( check );
+    }
+
+    //  Concatenate the job outputs and their indices
+
+    {
+        char* block = (char*)Malloc( bsize, "Allocating LAmerge blocks" );
+        lasidx* idx = index ? lasidx_new( tspace ) : NULL;
+        off_t base  = hsize;
+
+        if ( block == NULL )
+            exit( 1 );
 
-        src->ptr += tsize;
-        if ( src->ptr < src->top )
+        count = 0;
+        for ( p = 0; p < njobs; p++ )
         {
-            *ov = *( (Overlap*)( src->ptr - psize ) );
-            src->ptr += osize;
+            if ( p > 0 )
+            {
+                append_file( output, jobs[ p ].output, block, bsize );
+                fclose( jobs[ p ].output );
+            }
+
+            if ( idx )
+            {
+                lasidx_append( idx, jobs[ p ].idx, base );
+                lasidx_close( jobs[ p ].idx );
+            }
+
+            base += jobs[ p ].size;
+            count += jobs[ p ].count;
         }
-        else
+
+        if ( laz )
+            laz_close( laz );
+        else if ( fclose( output ) != 0 )
         {
-            heap[ 1 ] = heap[ hsize ];
-            hsize -= 1;
+            fprintf( stderr, "[ERROR] - LAmerge: failed to write %s\n", fout );
+            exit( 1 );
         }
-    }
 
-    //  Flush output buffer and wind up
+        if ( idx )
+        {
+            if ( !lasidx_write( idx, fout ) )
+                exit( 1 );
 
-    if ( optr > oblock )
-        fwrite( oblock, 1, optr - oblock, output );
-    fclose( output );
+            lasidx_close( idx );
+        }
 
-    for ( i = 0; i < fway; i++ )
-        fclose( in[ i ].stream );
+        free( block );
+    }
 
     for ( i = 0; i < fway; i++ )
-        totl -= in[ i ].count;
+        close( fd[ i ] );
+
+    totl -= count;
     if ( totl != 0 )
     {
         fprintf( stderr, "ERROR: Did not write all records (%lld)\n", totl );
         exit( 1 );
     }
 
-    free( ovls );
-    free( heap );
-    free( in );
-    free( block - psize );
+    free( range );
+    free( threads );
+    free( jobs );
+    free( bound );
+    free( novls );
+    free( size );
+    free( fd );
 }
 
+//  Extension of the final output, intermediate merge rounds are written as .las
+
+#define MERGE_EXT( mopt ) ( ( mopt )->LAZ ? "laz" : "las" )
+
 static void doMergeAll( MERGE_OPT* mopt )
 {
     int mergeRounds = 0;
@@ -512,7 +1038,7 @@ static void doMergeAll( MERGE_OPT* mopt )
 
     char* fout;
     fout = (char*)malloc( strlen( mopt->oFile ) + 20 );
-    sprintf( fout, "%s.las", mopt->oFile );
+    sprintf( fout, "%s.%s", mopt->oFile, MERGE_EXT( mopt ) );
 
     while ( tmp > 1 )
     {
@@ -524,10 +1050,10 @@ static void doMergeAll( MERGE_OPT* mopt )
     {
         if ( mopt->SORT )
             sortAndMerge( fout, mopt->iFileNames, mopt->numOfFilesToMerge,
-                          mopt->VERBOSE );
+                          mopt->VERBOSE, mopt->INDEX, mopt );
         else
             merge( fout, mopt->iFileNames, mopt->numOfFilesToMerge,
-                   mopt->VERBOSE );
+                   mopt->VERBOSE, mopt->INDEX, mopt->nthreads, mopt );
     }
     else // merging in multiple rounds
     {
@@ -561,10 +1087,10 @@ static void doMergeAll( MERGE_OPT* mopt )
                              currentMergeRound, numOut );
                     if ( mopt->SORT )
                         sortAndMerge( tmpOUT[ numOut ], ( mopt->iFileNames + i ),
-                                      mopt->fway, mopt->VERBOSE );
+                                      mopt->fway, mopt->VERBOSE, 0, mopt );
                     else
                         merge( tmpOUT[ numOut ], ( mopt->iFileNames + i ),
-                               mopt->fway, mopt->VERBOSE );
+                               mopt->fway, mopt->VERBOSE, 0, mopt->nthreads, mopt );
 
                     numOut++;
                 }
@@ -581,7 +1107,7 @@ static void doMergeAll( MERGE_OPT* mopt )
                     sprintf( tmpOUT[ numOut ], "%s.L%d.%d.las", mopt->oFile,
                              currentMergeRound, numOut );
                     merge( tmpOUT[ numOut ], ( tmpIN + i ), mopt->fway,
-                           mopt->VERBOSE );
+                           mopt->VERBOSE, 0, mopt->nthreads, NULL );
                     numOut++;
                 }
             }
@@ -602,10 +1128,17 @@ static void doMergeAll( MERGE_OPT* mopt )
                             sprintf( tmpOUT[ numOut ], "%s.L%d.%d.las",
                                      mopt->oFile, currentMergeRound, numOut );
                             sortFile( tmpOUT[ numOut ], mopt->iFileNames[ i ],
-                                      mopt->VERBOSE );
+                                      mopt->VERBOSE, mopt );
                         }
                         else
                         {
+                            // passed on unmerged, the only input not checked while merging
+                            if ( checkOverlapRecords( mopt, mopt->iFileNames[ i ] ) )
+                            {
+                                fprintf( stderr, "[ERROR] : LAmerge - overlap file %s failed check!\n", mopt->iFileNames[ i ] );
+                                exit( 1 );
+                            }
+
                             sprintf( tmpOUT[ numOut ], "%s", mopt->iFileNames[ i ] );
 #ifdef DEBUG
                             printf( "Add to mergeOut: %s\n", tmpOUT[ numOut ] );
@@ -640,10 +1173,10 @@ static void doMergeAll( MERGE_OPT* mopt )
                                  currentMergeRound, numOut );
                         if ( mopt->SORT )
                             sortAndMerge( tmpOUT[ numOut ], ( mopt->iFileNames + i ),
-                                          numIn - i, mopt->VERBOSE );
+                                          numIn - i, mopt->VERBOSE, 0, mopt );
                         else
                             merge( tmpOUT[ numOut ], ( mopt->iFileNames + i ),
-                                   numIn - i, mopt->VERBOSE );
+                                   numIn - i, mopt->VERBOSE, 0, mopt->nthreads, mopt );
                         numOut++;
                     }
                     else
@@ -659,7 +1192,7 @@ static void doMergeAll( MERGE_OPT* mopt )
                         sprintf( tmpOUT[ numOut ], "%s.L%d.%d.las", mopt->oFile,
                                  currentMergeRound, numOut );
                         merge( tmpOUT[ numOut ], ( tmpIN + i ), numIn - i,
-                               mopt->VERBOSE );
+                               mopt->VERBOSE, 0, mopt->nthreads, NULL );
                         numOut++;
                     }
                 }
@@ -701,10 +1234,10 @@ static void doMergeAll( MERGE_OPT* mopt )
         {
             printf( " %s", tmpIN[ j ] );
         }
-        printf( "\nLAST mergeOut: %s.las\n", mopt->oFile );
+        printf( "\nLAST mergeOut: %s\n", fout );
 #endif
-        sprintf( tmpOUT[ 0 ], "%s.las", mopt->oFile );
-        merge( tmpOUT[ 0 ], tmpIN, numIn, mopt->VERBOSE );
+        sprintf( tmpOUT[ 0 ], "%s", fout );
+        merge( tmpOUT[ 0 ], tmpIN, numIn, mopt->VERBOSE, mopt->INDEX, mopt->nthreads, NULL );
         // remove intermediate files
         if ( !mopt->KEEP && currentMergeRound > 1 )
         {
@@ -739,13 +1272,6 @@ static void doMergeAll( MERGE_OPT* mopt )
         }
     }
 
-    if ( checkOverlapFile( mopt, fout, 0 ) )
-    {
-        fprintf( stderr,
-                 "[ERROR] : LAmerge - overlap file %s failed check! Use -s option to sort the input files!\n",
-                 fout );
-        exit( 1 );
-    }
     free( fout );
 }
 
@@ -805,6 +1331,67 @@ static void copyFile( char* in, char* out )
     free( fout );
 }
 
+//  A single input and a LAZ output, the input is compressed
+
+static void compressFile( char* in, char* out, int nthreads )
+{
+    ovl_header_novl novl;
+    ovl_header_twidth twidth;
+    Overlap ovl;
+    FILE* from;
+    LAZ* laz;
+    uint16* trace;
+    size_t tbytes;
+    int tmax;
+
+    char* fout;
+    fout = (char*)malloc( strlen( out ) + 20 );
+    sprintf( fout, "%s.laz", out );
+
+    if ( ( from = fopen( in, "rb" ) ) == NULL )
+    {
+        fprintf( stderr, "Cannot open source file: %s.\n", in );
+        exit( 1 );
+    }
+
+    if ( !ovl_header_read( from, &novl, &twidth ) )
+    {
+        fprintf( stderr, "Error reading source file.\n" );
+        exit( 1 );
+    }
+
+    laz    = merge_laz_open( fout, twidth, nthreads );
+    tbytes = TBYTES( twidth );
+    tmax   = 1000;
+    trace  = (uint16*)malloc( sizeof( uint16 ) * tmax );
+
+    while ( novl-- > 0 )
+    {
+        if ( Read_Overlap( from, &ovl ) )
+        {
+            fprintf( stderr, "Error reading source file.\n" );
+            exit( 1 );
+        }
+
+        if ( ovl.path.tlen > tmax )
+        {
+            tmax  = ovl.path.tlen * 1.2 + 1000;
+            trace = (uint16*)realloc( trace, sizeof( uint16 ) * tmax );
+        }
+
+        ovl.path.trace = trace;
+        Read_Trace( from, &ovl, tbytes );
+
+        laz_write( laz, &ovl );
+    }
+
+    fclose( from );
+    laz_close( laz );
+
+    free( trace );
+    free( fout );
+}
+
 int main( int argc, char* argv[] )
 {
     MERGE_OPT* mopt = parseMergeOptions( argc, argv );
@@ -822,14 +1409,107 @@ int main( int argc, char* argv[] )
         return 0;
     }
 
+    // an output that is also an input (e.g. the .las of a block receiving the overlaps
+    // of new blocks) is written under a temporary name and replaced at the end
+
+    char* fold = NULL;
+    {
+        struct stat so, si;
+        int i;
+
+        fold = (char*)malloc( strlen( mopt->oFile ) + 20 );
+        sprintf( fold, "%s.%s", mopt->oFile, MERGE_EXT( mopt ) );
+
+        for ( i = 0; i < mopt->numOfFilesToMerge; i++ )
+            if ( stat( fold, &so ) == 0 && stat( mopt->iFileNames[ i ], &si ) == 0 &&
+                 so.st_dev == si.st_dev && so.st_ino == si.st_ino )
+                break;
+
+        if ( i == mopt->numOfFilesToMerge )
+        {
+            free( fold );
+            fold = NULL;
+        }
+        else if ( mopt->numOfFilesToMerge == 1 )
+        {
+            fprintf( stderr, "[WARNING] - LAmerge: %s is the only input. Nothing to do!\n", fold );
+            return 0;
+        }
+        else
+        {
+            char* ofile = (char*)malloc( strlen( mopt->oFile ) + 20 );
+            sprintf( ofile, "%s.fold", mopt->oFile );
+            free( mopt->oFile );
+            mopt->oFile = ofile;
+        }
+    }
+
     if ( mopt->numOfFilesToMerge == 1 )
     {
-        copyFile( mopt->iFileNames[ 0 ], mopt->oFile );
+        if ( checkOverlapRecords( mopt, mopt->iFileNames[ 0 ] ) )
+        {
+            fprintf( stderr, "[ERROR] : LAmerge - overlap file %s failed check!\n", mopt->iFileNames[ 0 ] );
+            exit( 1 );
+        }
+
+        if ( mopt->LAZ )
+            compressFile( mopt->iFileNames[ 0 ], mopt->oFile, mopt->nthreads );
+        else
+            copyFile( mopt->iFileNames[ 0 ], mopt->oFile );
+
+        if ( mopt->INDEX )
+        {
+            char* fout = (char*)malloc( strlen( mopt->oFile ) + 20 );
+            sprintf( fout, "%s.las", mopt->oFile );
+
+            lasidx* idx = lasidx_create( mopt->db, fout );
+
+            if ( idx == NULL )
+                exit( 1 );
+
+            lasidx_close( idx );
+            free( fout );
+        }
+
         return 0;
     }
 
+    // a single merge keeps up to fway input files open
+    {
+        struct rlimit rl;
+
+        if ( getrlimit( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur < rl.rlim_max &&
+             rl.rlim_cur < (rlim_t)mopt->fway + 64 )
+        {
+            rl.rlim_cur = MIN( rl.rlim_max, (rlim_t)mopt->fway + 64 );
+            setrlimit( RLIMIT_NOFILE, &rl );
+        }
+    }
+
     doMergeAll( mopt );
 
+    if ( fold )
+    {
+        char* tmp = (char*)malloc( strlen( mopt->oFile ) + 20 );
+
+        sprintf( tmp, "%s.%s", mopt->oFile, MERGE_EXT( mopt ) );
+        if ( rename( tmp, fold ) != 0 )
+        {
+            fprintf( stderr, "[ERROR] - LAmerge: failed to replace %s with %s\n", fold, tmp );
+            exit( 1 );
+        }
+
+        if ( mopt->INDEX )
+        {
+            sprintf( tmp, "%s.idx", mopt->oFile );
+            strcpy( fold + strlen( fold ) - 4, ".idx" );
+            rename( tmp, fold );
+        }
+
+        free( tmp );
+        free( fold );
+    }
+
     //cleanup
     clearMergeOptions( mopt );
 
@@ -5,12 +5,14 @@
 
 #include "LAmergeUtils.h"
 #include "lib/oflags.h"
+#include "lib/bulkio.h"
 
 void printUsage( char* prog, FILE* out )
 {
-    fprintf( out, "usage: %s [-hksv] [-C [n|s|S|t|A]] [-n n] [-S string] [-f file] database output.las [input.directory | input.1.las ...]\n\n", prog );
+    fprintf( out, "usage: %s [-hiksv] [-C [n|s|S|t|A]] [-n n] [-j n] [-S string] [-f file] database output.[las|laz] [input.directory | input.1.las ...]\n\n", prog );
 
-    fprintf( out, "Merge (and sorts) multiple input las files into a single output file.\n\n" );
+    fprintf( out, "Merge (and sorts) multiple input las files into a single output file.\n" );
+    fprintf( out, "An output ending in .laz is written compressed, using the -j threads for the compression.\n\n" );
 
     fprintf( out, "options:\n" );
 
@@ -18,13 +20,15 @@ void printUsage( char* prog, FILE* out )
     fprintf( out, "  -v  verbose output\n" );
     fprintf( out, "  -s  sort content of the input las files prior to merging\n" );
     fprintf( out, "  -k  keep intermediate merge results\n" );
+    fprintf( out, "  -i  write the index file output.idx while merging, LAZ output carries its own index\n" );
     fprintf( out, "  -C mode  perform sanity checks. Multiple options are possible.\n" );
     fprintf( out, "     n  file names must be consistent with database.\n" );
     fprintf( out, "     s  ensure ascending read id ordering\n" );
     fprintf( out, "     S  -s + ensure complement and alignment start position ordering\n" );
     fprintf( out, "     t  check alignment trace points\n" );
     fprintf( out, "     A  check all (equals -nSt)\n" );
-    fprintf( out, "  -n n  number of input files that are merged simultaneously [2, 255], (Default: 8).\n" );
+    fprintf( out, "  -n n  number of input files that are merged simultaneously [2, %d], (Default: 8).\n", MAX_FWAY_MERGE );
+    fprintf( out, "  -j n  number of merge threads, each writes the overlaps of a range of A-reads (Default: 1).\n" );
     fprintf( out, "  -S suffix  specify a file suffix, e.g. ovh, or rescued, (default: not set)\n" );
     fprintf( out, "  -f file  file that contains a list of las files to be merged. (One file per line)\n" );
 }
@@ -94,85 +98,305 @@ int SORT_OVL(const void *x, const void *y)
   else                                          \
     bigger = 0;
 
-void reheap(int s, Overlap **heap, int hsize)
+#define STREAM_CARRY (16 * 1024)
+
+//  The buffer is read as a batch of chunks that are in flight together
+
+static int64 stream_read(IO_stream *in, char *dst)
   {
-    int c, l, r;
-    int bigger;
-    Overlap *hs, *hr, *hl;
+    bio_req req;
+    int64 n;
+
+    n = MIN(in->bsize, in->end - in->off);
 
-    c = s;
-    hs = heap[s];
-    while ((l = 2 * c) <= hsize)
+    req.buf = dst;
+    req.len = n;
+    req.off = in->off;
+    if (n > 0 && bio_read(in->fd, &req, 1) != 0)
       {
-        r = l + 1;
-        hl = heap[l];
-        if (r > hsize)
-          bigger = 1;
-        else
+        fprintf(stderr, "[ERROR] - LAmerge: failed to read input at offset %lld\n", (long long) in->off);
+        exit(1);
+      }
+    in->off += n;
+
+    return n;
+  }
+
+static void *stream_thread(void *arg)
+  {
+    IO_stream *in = (IO_stream *) arg;
+    int f = 0;
+
+    while (1)
+      {
+        char *dst;
+        int64 n;
+
+        pthread_mutex_lock(&in->lock);
+        while (!in->stop && in->len[f] != -1)
+          pthread_cond_wait(&in->cond, &in->lock);
+        if (in->stop)
           {
-            hr = heap[r];
-            COMPARE(hr, hl)
+            pthread_mutex_unlock(&in->lock);
+            break;
           }
-        if (bigger)
+        dst = in->buf[f] + in->carry[f];
+        pthread_mutex_unlock(&in->lock);
+
+        n = stream_read(in, dst);
+
+        pthread_mutex_lock(&in->lock);
+        in->len[f] = n;
+        pthread_cond_broadcast(&in->cond);
+        pthread_mutex_unlock(&in->lock);
+
+        if (n == 0)
+          break;
+        f ^= 1;
+      }
+
+    return NULL;
+  }
+
+void stream_open(IO_stream *in, int fd, off_t start, off_t end, int64 bsize, int prefetch)
+  {
+    int i;
+
+    in->fd = fd;
+    in->off = start;
+    in->end = end;
+    in->bsize = bsize;
+    for (i = 0; i < 2; i++)
+      {
+        in->carry[i] = STREAM_CARRY;
+        in->buf[i] = (char *) Malloc(in->carry[i] + bsize, "Allocating LAmerge stream");
+        if (in->buf[i] == NULL)
+          exit(1);
+        in->len[i] = -1;
+      }
+    in->cur = -1;
+    in->ptr = in->top = NULL;
+    in->eof = 0;
+    in->done = 0;
+    in->count = 0;
+    in->stop = 0;
+    in->prefetch = (prefetch && start < end);
+
+    if (in->prefetch)
+      {
+        pthread_mutex_init(&in->lock, NULL);
+        pthread_cond_init(&in->cond, NULL);
+        if (pthread_create(&in->thread, NULL, stream_thread, in) != 0)
           {
-            COMPARE(hs, hl)
-            if (bigger)
-              {
-                heap[c] = hl;
-                c = l;
-              }
-            else
-              break;
+            pthread_mutex_destroy(&in->lock);
+            pthread_cond_destroy(&in->cond);
+            in->prefetch = 0;
           }
-        else
+      }
+  }
+
+void stream_close(IO_stream *in)
+  {
+    if (in->prefetch)
+      {
+        pthread_mutex_lock(&in->lock);
+        in->stop = 1;
+        pthread_cond_broadcast(&in->cond);
+        pthread_mutex_unlock(&in->lock);
+
+        pthread_join(in->thread, NULL);
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->cond);
+      }
+
+    free(in->buf[0]);
+    free(in->buf[1]);
+  }
+
+//  Move to the next buffer, taking the unconsumed bytes of the current one along
+
+static void stream_switch(IO_stream *in)
+  {
+    int next = (in->cur < 0) ? 0 : in->cur ^ 1;
+    int64 remains = in->top - in->ptr;
+
+    if (in->prefetch)
+      {
+        pthread_mutex_lock(&in->lock);
+        while (in->len[next] == -1)
+          pthread_cond_wait(&in->cond, &in->lock);
+        pthread_mutex_unlock(&in->lock);
+      }
+    else
+      in->len[next] = stream_read(in, in->buf[next] + in->carry[next]);
+
+    if (remains > in->carry[next])
+      {
+        char *nbuf = (char *) Malloc(remains + in->bsize, "Allocating LAmerge stream");
+        if (nbuf == NULL)
+          exit(1);
+        memcpy(nbuf + remains, in->buf[next] + in->carry[next], in->len[next]);
+        free(in->buf[next]);
+        in->buf[next] = nbuf;
+        in->carry[next] = remains;
+      }
+
+    if (remains > 0)
+      memcpy(in->buf[next] + in->carry[next] - remains, in->ptr, remains);
+    in->ptr = in->buf[next] + in->carry[next] - remains;
+    in->top = in->buf[next] + in->carry[next] + in->len[next];
+
+    if (in->len[next] == 0)
+      in->eof = 1;
+
+    if (in->cur >= 0)
+      {
+        if (in->prefetch)
           {
-            COMPARE(hs, hr)
-            if (bigger)
-              {
-                heap[c] = hr;
-                c = r;
-              }
-            else
-              break;
+            pthread_mutex_lock(&in->lock);
+            in->len[in->cur] = -1;
+            pthread_cond_broadcast(&in->cond);
+            pthread_mutex_unlock(&in->lock);
           }
+        else
+          in->len[in->cur] = -1;
       }
-    if (c != s)
-      heap[c] = hs;
+    in->cur = next;
   }
 
-void ovl_reload(IO_block *in, int64 bsize)
+static int stream_ensure(IO_stream *in, int64 need)
   {
-    int64 remains;
+    while (in->top - in->ptr < need)
+      {
+        if (in->eof)
+          return 0;
+        stream_switch(in);
+      }
 
-    remains = in->top - in->ptr;
-    if (remains > 0)
-      memcpy(in->block, in->ptr, remains);
-    in->ptr = in->block;
-    in->top = in->block + remains;
-    in->top += fread(in->top, 1, bsize - remains, in->stream);
+    return 1;
   }
 
-void showheap(Overlap **heap, int hsize)
+int stream_next(IO_stream *in)
   {
-    int i;
-    printf("\n");
-    for (i = 1; i <= hsize; i++)
-      printf(" %3d: %5d, %5d\n", i, heap[i]->aread, heap[i]->bread);
+    int64 psize = sizeof(void *);
+    int64 osize = sizeof(Overlap) - psize;
+
+    if (in->done || !stream_ensure(in, osize))
+      {
+        if (!in->done && in->ptr < in->top)
+          {
+            fprintf(stderr, "[ERROR] - LAmerge: truncated overlap record\n");
+            exit(1);
+          }
+        in->done = 1;
+        return 0;
+      }
+
+    memcpy(((char *) &in->ovl) + psize, in->ptr, osize);
+    in->ptr += osize;
+
+    return 1;
+  }
+
+char* stream_trace(IO_stream *in, int64 tsize)
+  {
+    char *trace;
+
+    if (!stream_ensure(in, tsize))
+      {
+        fprintf(stderr, "[ERROR] - LAmerge: truncated overlap record\n");
+        exit(1);
+      }
+
+    trace = in->ptr;
+    in->ptr += tsize;
+    in->count += 1;
+
+    return trace;
   }
 
-static void check_pre(PassContext* pctx, CheckContext* cctx)
+//  Does stream a win against stream b
+
+static inline int lt_less(LoserTree *lt, int a, int b)
   {
-    cctx->twidth = pctx->twidth;
-    cctx->prev_a = 0;
+    IO_stream *sa = lt->in + a;
+    IO_stream *sb = lt->in + b;
+    Overlap *pa, *pb;
+    int bigger;
+
+    if (sa->done || sb->done)
+      {
+        if (sa->done && sb->done)
+          return (a < b);
+        return sb->done;
+      }
+
+    pa = &sa->ovl;
+    pb = &sb->ovl;
+
+    COMPARE(pb, pa)
+    if (bigger)
+      return 1;
+    COMPARE(pa, pb)
+    if (bigger)
+      return 0;
+
+    return (a < b);
   }
 
-static void check_post(PassContext* pctx, CheckContext* cctx, char *filename)
+static int lt_build(LoserTree *lt, int n)
   {
-    if (!cctx->error && pctx->novl != cctx->novl)
+    int l, r;
+
+    if (n >= lt->k)
+      return n - lt->k;
+
+    l = lt_build(lt, 2 * n);
+    r = lt_build(lt, 2 * n + 1);
+    if (lt_less(lt, r, l))
       {
-        fprintf(stderr, "[ERROR] - LAmerge: In file: %s -> novl of %lld doesn't match actual overlap count of %lld\n", filename, pctx->novl, cctx->novl);
-        cctx->error = 1;
+        lt->node[n] = l;
+        return r;
       }
+    lt->node[n] = r;
+    return l;
+  }
+
+void lt_init(LoserTree *lt, IO_stream *in, int k)
+  {
+    lt->k = k;
+    lt->in = in;
+    lt->node = (int *) Malloc(sizeof(int) * k, "Allocating loser tree");
+    if (lt->node == NULL)
+      exit(1);
+    lt->node[0] = lt_build(lt, 1);
+  }
+
+void lt_free(LoserTree *lt)
+  {
+    free(lt->node);
+  }
+
+int lt_winner(LoserTree *lt)
+  {
+    int w = lt->node[0];
+
+    return lt->in[w].done ? -1 : w;
+  }
+
+void lt_replay(LoserTree *lt)
+  {
+    int w = lt->node[0];
+    int n, t;
+
+    for (n = (w + lt->k) / 2; n >= 1; n /= 2)
+      if (lt_less(lt, lt->node[n], w))
+        {
+          t = lt->node[n];
+          lt->node[n] = w;
+          w = t;
+        }
+    lt->node[0] = w;
   }
 
 #define CMP(a, b) cmp = (a) - (b); if (cmp != 0) return cmp;
@@ -200,97 +424,148 @@ inline static int compare_sort(Overlap* o1, Overlap* o2, int sort)
     return cmp;
   }
 
-static int check_process(void* _ctx, Overlap* ovl, int novl)
+void check_init(CheckContext* ctx, MERGE_OPT* mopt, char* name, int twidth)
   {
-    CheckContext* ctx = (CheckContext*) _ctx;
+    bzero(ctx, sizeof(CheckContext));
 
-    int i, lena, lenb;
+    ctx->db = mopt->db;
+    ctx->name = name;
+    ctx->twidth = twidth;
+    ctx->check_ptp = mopt->CHECK_TRACE_POINTS;
+    ctx->check_sort = mopt->CHECK_SORT_ORDER;
+  }
 
-    for (i = 0; i < novl; i++)
+static void check_fail(CheckContext* ctx, Overlap* ovl, char* what)
+  {
+    if (!ctx->error)
+      fprintf(stderr, "[ERROR] - LAmerge: In file: %s -> overlap %d x %d: %s\n", ctx->name, ovl->aread, ovl->bread, what);
+
+    ctx->error = 1;
+  }
+
+int check_overlap(CheckContext* ctx, Overlap* ovl, void* trace, int tbytes)
+  {
+    int nreads = ctx->db->nreads;
+
+    if (ctx->novl == 0)
+      ctx->first = *ovl;
+    else if (compare_sort(&(ctx->last), ovl, ctx->check_sort) > 0)
       {
-        ctx->novl++;
+        check_fail(ctx, ovl, "not sorted");
+        ctx->unsorted = 1;
+      }
 
-        if (i == 0)
-          {
-            if (ctx->check_sort && ctx->prev_a > ovl[i].aread)
-              {
-                fprintf(stderr, "overlap %lld: not sorted\n", ctx->novl);
-                ctx->error = 1;
-              }
-          }
-        else
-          {
-            int cmp = compare_sort(ovl + (i - 1), ovl + i, ctx->check_sort);
+    ctx->last = *ovl;
+    ctx->novl++;
 
-            if (cmp > 0 && ctx->check_sort)
-              {
-                printf("%d %d\n", ovl[i - 1].aread, ovl[i - 1].bread);
+    if (ovl->aread < 0 || ovl->aread >= nreads || ovl->bread < 0 || ovl->bread >= nreads)
+      {
+        check_fail(ctx, ovl, "read not in database");
+        return ctx->error;
+      }
 
-                fprintf(stderr, "overlap %lld: not sorted\n", ctx->novl);
-                ctx->error = 1;
-              }
-          }
+    if (ovl->path.abpos < 0)
+      check_fail(ctx, ovl, "abpos < 0");
 
-        lena = DB_READ_LEN(ctx->db, ovl[i].aread);
-        lenb = DB_READ_LEN(ctx->db, ovl[i].bread);
+    if (ovl->path.bbpos < 0)
+      check_fail(ctx, ovl, "bbpos < 0");
 
-        if (ovl[i].path.abpos < 0)
-          {
-            fprintf(stderr, "overlap %lld: abpos < 0\n", ctx->novl);
-            ctx->error = 1;
-          }
+    if (ovl->path.aepos > DB_READ_LEN(ctx->db, ovl->aread))
+      check_fail(ctx, ovl, "aepos > lena");
 
-        if (ovl[i].path.bbpos < 0)
-          {
-            fprintf(stderr, "overlap %lld: bbpos < 0\n", ctx->novl);
-            ctx->error = 1;
-          }
+    if (ovl->path.bepos > DB_READ_LEN(ctx->db, ovl->bread))
+      check_fail(ctx, ovl, "bepos > lenb");
 
-        if (ovl[i].path.aepos > lena)
-          {
-            fprintf(stderr, "overlap %lld: aepos > lena\n", ctx->novl);
-            ctx->error = 1;
-          }
+    if (ovl->path.tlen < 0)
+      check_fail(ctx, ovl, "invalid tlen");
+    else if (ctx->check_ptp)
+      {
+        int bpos = ovl->path.bbpos;
+        int j;
 
-        if (ovl[i].path.bepos > lenb)
-          {
-            fprintf(stderr, "overlap %lld: bepos > lenb\n", ctx->novl);
-            ctx->error = 1;
-          }
+        // b-distances are the odd trace values
 
-        if (ovl[i].path.tlen < 0)
-          {
-            fprintf(stderr, "overlap %lld: invalid tlen %d\n", ctx->novl, ovl[i].path.tlen);
-            ctx->error = 1;
-          }
+        if (tbytes == sizeof(uint8))
+          for (j = 1; j < ovl->path.tlen; j += 2)
+            bpos += ((uint8*) trace)[j];
+        else
+          for (j = 1; j < ovl->path.tlen; j += 2)
+            bpos += ((uint16*) trace)[j];
 
-        if (ctx->check_ptp)
-          {
-            ovl_trace* trace = ovl[i].path.trace;
+        if (bpos != ovl->path.bepos)
+          check_fail(ctx, ovl, "pass-through points inconsistent");
+      }
 
-            int apos = ovl[i].path.abpos;
-            int bpos = ovl[i].path.bbpos;
+    return ctx->error;
+  }
 
-            int j;
-            for (j = 0; j < ovl[i].path.tlen; j += 2)
-              {
-                apos += (apos / ctx->twidth + 1) * ctx->twidth;
-                bpos += trace[j + 1];
-              }
+void check_join(CheckContext* ctx, CheckContext* next)
+  {
+    if (next->novl == 0)
+      return;
 
-            if (bpos != ovl[i].path.bepos)
-              {
-                fprintf(stderr, "overlap %lld (%d x %d): pass-through points inconsistent be = %d (expected %d)\n", ctx->novl, ovl[i].aread, ovl[i].bread, bpos, ovl[i].path.bepos);
-                ctx->error = 1;
-              }
-          }
+    if (ctx->novl == 0)
+      ctx->first = next->first;
+    else if (compare_sort(&(ctx->last), &(next->first), ctx->check_sort) > 0)
+      {
+        check_fail(ctx, &(next->first), "not sorted");
+        ctx->unsorted = 1;
       }
 
-    ctx->prev_a = ovl->aread;
+    ctx->error |= next->error;
+    ctx->unsorted |= next->unsorted;
+    ctx->novl += next->novl;
+    ctx->last = next->last;
+  }
+
+static int check_process(void* _ctx, Overlap* ovl, int novl)
+  {
+    CheckContext* ctx = (CheckContext*) _ctx;
+    int i;
+
+    for (i = 0; i < novl; i++)
+      check_overlap(ctx, ovl + i, ovl[i].path.trace, sizeof(uint16));
 
     return !ctx->error;
   }
 
+int checkOverlapRecords(MERGE_OPT *mopt, char *filename)
+  {
+    if (!mopt->CHECK_SORT_ORDER && !mopt->CHECK_TRACE_POINTS)
+      return 0;
+
+    FILE* fileOvlIn;
+    if ((fileOvlIn = fopen(filename, "r")) == NULL)
+      {
+        fprintf(stderr, "could not open '%s'\n", filename);
+        return 1;
+      }
+
+    PassContext* pctx;
+    CheckContext cctx;
+
+    pctx = pass_init(fileOvlIn, NULL);
+    pctx->split_b = 0;
+    pctx->load_trace = mopt->CHECK_TRACE_POINTS;
+    pctx->unpack_trace = mopt->CHECK_TRACE_POINTS;
+    pctx->data = &cctx;
+
+    check_init(&cctx, mopt, filename, pctx->twidth);
+
+    pass(pctx, check_process);
+
+    if (!cctx.error && pctx->novl != cctx.novl)
+      {
+        fprintf(stderr, "[ERROR] - LAmerge: In file: %s -> novl of %lld doesn't match actual overlap count of %lld\n", filename, pctx->novl, cctx.novl);
+        cctx.error = 1;
+      }
+
+    pass_free(pctx);
+    fclose(fileOvlIn);
+
+    return cctx.error;
+  }
+
 int checkOverlapFile(MERGE_OPT *mopt, char *filename, int silent)
   {
     if (!silent || mopt->VERBOSE > 2)
@@ -406,45 +681,6 @@ int checkOverlapFile(MERGE_OPT *mopt, char *filename, int silent)
           printf(" --> succeeded\n");
       }
 
-    // check
-    if (mopt->CHECK_SORT_ORDER || mopt->CHECK_TRACE_POINTS)
-      {
-          FILE* fileOvlIn;
-          if ( ( fileOvlIn = fopen( filename, "r" ) ) == NULL )
-          {
-            if (!silent)
-              fprintf(stderr, "could not open '%s'\n", filename);
-
-            return 1;
-          }
-
-        PassContext* pctx;
-        CheckContext cctx;
-
-        bzero(&cctx, sizeof(CheckContext));
-        cctx.db = mopt->db;
-
-        cctx.check_ptp = mopt->CHECK_TRACE_POINTS;
-        cctx.check_sort = mopt->CHECK_SORT_ORDER;
-
-        pctx = pass_init(fileOvlIn, NULL);
-        pctx->split_b = 0;
-        pctx->load_trace = cctx.check_ptp;
-        pctx->unpack_trace = cctx.check_ptp;
-        pctx->data = &cctx;
-
-        check_pre(pctx, &cctx);
-
-        pass(pctx, check_process);
-
-        check_post(pctx, &cctx, filename);
-
-        pass_free(pctx);
-
-        fclose(fileOvlIn);
-        return cctx.error;
-      }
-
     return 0;
   }
 
@@ -633,7 +869,10 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
     mopt->VERBOSE = 0;
     mopt->KEEP = 0;
     mopt->SORT = 0;
+    mopt->INDEX = 0;
+    mopt->LAZ = 0;
     mopt->fway = 8;
+    mopt->nthreads = 1;
     mopt->CHECK_TRACE_POINTS = 0;
     mopt->CHECK_SORT_ORDER = 0;
     mopt->CHECK_NAME = 0;
@@ -654,8 +893,10 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
         { "help", no_argument, 0, 'h' },
         { "keep", no_argument, 0, 'k' },
         { "sort", no_argument, 0, 's' },
+        { "index", no_argument, 0, 'i' },
         { "verbose", no_argument, 0, 'v' },
         { "nFiles", required_argument, 0, 'n' },
+        { "threads", required_argument, 0, 'j' },
         { "in", required_argument, 0, 'f' },
         { "suffix", required_argument, 0, 'S' },
         { "check", required_argument, 0, 'C' } };
@@ -663,7 +904,7 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "hksvn:S:f:C:", long_options, &option_index);
+        c = getopt_long(argc, argv, "hiksvn:j:S:f:C:", long_options, &option_index);
 
         /* Detect the end of the options. */
         if (c == -1)
@@ -689,6 +930,9 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
           case 's':
             mopt->SORT = 1;
             break;
+          case 'i':
+            mopt->INDEX = 1;
+            break;
           case '?':
             printUsage(argv[0], stderr);
             exit(1);
@@ -697,12 +941,22 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
               mopt->fway = (int) strtol(optarg, NULL, 10);
               if (errno)
                 {
-                  fprintf(stderr, "Cannot parse argument of numFiles (-j ARG)! Must be an integer in [2, 255]\n");
+                  fprintf(stderr, "Cannot parse argument of numFiles (-j ARG)! Must be an integer in [2, %d]\n", MAX_FWAY_MERGE);
                   exit(1);
                 }
-              if (mopt->fway < 2 || mopt->fway > 255)
+              if (mopt->fway < 2 || mopt->fway > MAX_FWAY_MERGE)
                 {
-                  fprintf(stderr, "Number of files to merge is not accpeted! Must be an integer in [2, 255]\n");
+                  fprintf(stderr, "Number of files to merge is not accpeted! Must be an integer in [2, %d]\n", MAX_FWAY_MERGE);
+                  exit(1);
+                }
+            }
+            break;
+          case 'j':
+            {
+              mopt->nthreads = (int) strtol(optarg, NULL, 10);
+              if (mopt->nthreads < 1)
+                {
+                  fprintf(stderr, "Number of merge threads is not accepted! Must be a positive integer\n");
                   exit(1);
                 }
             }
@@ -770,7 +1024,7 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
         exit(1);
       }
 
-    // if -s option is used: reset CHECK_SORT to 0, the final overlap file is always checked for CHECK_SORT=1
+    // if -s option is used: reset CHECK_SORT to 0, the inputs are sorted while merging
     if(mopt->SORT)
       mopt->CHECK_SORT_ORDER=0;
 
@@ -820,7 +1074,7 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
         exit(1);
       }
     struct stat sb;
-    // get output file name, and trim .las extension
+    // get output file name, and trim .las or .laz extension
       {
         int len = strlen(argv[optind]);
         mopt->oFile = (char*) malloc(len + 10);
@@ -828,6 +1082,12 @@ MERGE_OPT* parseMergeOptions(int argc, char* argv[])
 
         if ((len > 4) && ((strcmp(argv[optind] + (len - 4), ".las") == 0)))
           mopt->oFile[len - 4] = '\0';
+        else if ((len > 4) && ((strcmp(argv[optind] + (len - 4), ".laz") == 0)))
+          {
+            mopt->oFile[len - 4] = '\0';
+            mopt->LAZ = 1;
+            mopt->INDEX = 0;
+          }
 
         if (stat(argv[optind], &sb) != -1)
           {
@@ -888,7 +1148,8 @@ void printOptions(FILE* out, MERGE_OPT* mopt)
         fprintf(out, "SORT:        %d\n", mopt->SORT);
         fprintf(out, "#DB BLOCKS:  %d\n", mopt->nBlocks);
         fprintf(out, "#FWAY MERGE: %d\n", mopt->fway);
-        fprintf(out, "OUT:         %s.las\n", mopt->oFile);
+        fprintf(out, "THREADS:     %d\n", mopt->nthreads);
+        fprintf(out, "OUT:         %s.%s\n", mopt->oFile, mopt->LAZ ? "laz" : "las");
         fprintf(out, "NUM:         %d\n", mopt->numOfFilesToMerge);
         int i;
         for (i = 0; i < mopt->numOfFilesToMerge; i++)
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <getopt.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "db/DB.h"
 #include "lib/pass.h"
@@ -16,26 +17,75 @@
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
 #define MEMORY 1000   // in Mb
-#define MAX_FWAY_MERGE 255
+#define MAX_FWAY_MERGE 1000
+#define MAX_PREFETCH_THREADS 256   // streams above that are read synchronously
+#define MIN_MERGE_BLOCK (64 * 1024)
 
 // used in sortAndMerge(MERGE_OPT *mopt) to sort ovls
 // according: aread, bread, COMP, abpos
 int SORT_OVL(const void *x, const void *y);
 
-//  Input block data structure and block fetcher
+//  Input stream of a merge, reads the byte range [off, end) of a .las file
+//  into two alternating buffers. With prefetch set, a thread fills one buffer
+//  while records are taken from the other. Each buffer is preceded by a carry
+//  area that receives the head of a record spanning both buffers.
+
 typedef struct {
-	FILE *stream;
-	char *block;
+	int fd;
+	off_t off;              // next file offset to read
+	off_t end;
+
+	int64 bsize;
+	char *buf[2];
+	int64 carry[2];
+	int64 len[2];           // bytes read into buf[i], -1 if it is free
+	int cur;                // buffer records are taken from, -1 before the first one
+
 	char *ptr;
 	char *top;
-	int64 count;
-} IO_block;
+	int eof;
+
+	int prefetch;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	Overlap ovl;            // header of the current record
+	int done;               // no records left
+	int64 count;            // records taken
+} IO_stream;
+
+void stream_open(IO_stream *in, int fd, off_t start, off_t end, int64 bsize, int prefetch);
+void stream_close(IO_stream *in);
+
+// load the header of the next record into in->ovl, returns 0 at the end of the range
+
+int stream_next(IO_stream *in);
+
+// return the trace of the current record, valid until the next call to stream_next
+
+char* stream_trace(IO_stream *in, int64 tsize);
+
+//  Loser tree over k streams, ordered by aread, bread, COMP and abpos.
+//  Ties go to the stream with the lower index, exhausted streams lose.
+
+typedef struct {
+	int k;
+	int *node;              // node[0] is the winner, node[1..k-1] losers
+	IO_stream *in;
+} LoserTree;
+
+void lt_init(LoserTree *lt, IO_stream *in, int k);
+void lt_free(LoserTree *lt);
 
-void reheap(int s, Overlap **heap, int hsize);
+// stream holding the smallest record, -1 if all are exhausted
 
-void ovl_reload(IO_block *in, int64 bsize);
+int  lt_winner(LoserTree *lt);
 
-void showheap(Overlap **heap, int hsize);
+// restore the tree after the winner's stream advanced
+
+void lt_replay(LoserTree *lt);
 
 typedef struct
 {
@@ -43,6 +93,8 @@ typedef struct
 	int VERBOSE;
 	int KEEP;       // keep intermediate merge files (default: 0)
 	int SORT;       // sort initial input files (default: 0)
+	int INDEX;      // write an index for the output file (default: 0)
+	int LAZ;        // write the output as LAZ, selected by an output file ending in .laz
 	int CHECK_TRACE_POINTS;
 	int CHECK_SORT_ORDER;
 	int CHECK_NAME;
@@ -56,6 +108,7 @@ typedef struct
 
 	int nBlocks;    // database blocks
 	int fway;       // parallel merge
+	int nthreads;   // merge jobs, each writes the piles of a range of A-reads
 
 	char *inputFileList; // if -f option is given
 	// merge on files
@@ -66,29 +119,52 @@ typedef struct
 	char *oFile;        // output file name
 } MERGE_OPT;
 
+//  Checks of the records of an input, done while they stream through the merge.
+//  The first and last record are kept to check the order across job boundaries.
+
 typedef struct
 {
     HITS_DB* db;
+    char* name;             // of the input
     ovl_header_twidth twidth;
 
     int error;              // file didn't pass check
+    int unsorted;           // failed the sort order check
 
     int check_ptp;          // pass through points
     int check_sort;         // sort order
 
     ovl_header_novl novl;   // Overlaps counted
 
-    int prev_a;
-
+    Overlap first;
+    Overlap last;
 } CheckContext;
 
+void check_init(CheckContext* ctx, MERGE_OPT* mopt, char* name, int twidth);
+
+// check the next record of the input, trace holds tbytes wide values. returns ctx->error.
+
+int check_overlap(CheckContext* ctx, Overlap* ovl, void* trace, int tbytes);
+
+// continue ctx with the checks of the records following it in the same input
+
+void check_join(CheckContext* ctx, CheckContext* next);
+
 
 void printUsage(char *prog, FILE* out);
 MERGE_OPT* parseMergeOptions(int argc, char* argv[]);
 void printOptions(FILE* out, MERGE_OPT* mopt);
 
 void clearMergeOptions(MERGE_OPT* mopt);
+
+// header and file name checks of an input
+
 int checkOverlapFile(MERGE_OPT *mopt, char *filename, int silent);
+
+// full pass over the records of an input, used where they are not merged
+
+int checkOverlapRecords(MERGE_OPT *mopt, char *filename);
+
 void addInputFile(MERGE_OPT *mopt, char *fileName);
 void getFilesFromDir(MERGE_OPT *mopt, char *dirName);
 void getFilesFromFile(MERGE_OPT *mopt);
@@ -0,0 +1,810 @@
+
+/*
+    merges the overlaps of daligner -L into one .las file per A block, without
+    writing the .las files of the block pairs
+
+    daligner sends the sorted overlaps of each block pair as a run over its own
+    connection (see lib/lastream_proto.h). the runs of an A block are appended to
+    its spool file <spool>/<db>.<a>.spool, once there are more than -r runs they are
+    merged into a single one. as soon as the runs of all B blocks were received
+    the A block is merged into <out>/<db>.<a>.las and its spool file removed.
+
+    the state of the spool files is only kept in memory, a restarted server
+    truncates them. on SIGINT/SIGTERM the runs of incomplete A blocks are merged
+    into <out>/<db>.<a>.partial.las. the server exits once all A blocks are done.
+
+    runs of an A block are received one at a time, a slow daligner delays the
+    other runs of its A block, but not those of other A blocks.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "LAmergeUtils.h"
+#include "dalign/align.h"
+#include "db/DB.h"
+#include "lib/lastream.h"
+#include "lib/lastream_proto.h"
+#include "lib/utils.h"
+
+#define DEF_ARG_P LASTREAM_DEFAULT_PORT
+#define DEF_ARG_T 4  // worker threads
+#define DEF_ARG_R 32 // runs of an A block before they are merged
+
+#define BACKLOG 128                      // Passed to listen()
+#define MERGE_BUFFER ( 1024 * 1024 )     // read buffer of each run while merging
+#define OUTPUT_BUFFER ( 4 * 1024 * 1024 )
+#define MAX_TLEN ( 1 << 24 )             // runs with longer traces are rejected
+
+typedef struct
+{
+    pthread_mutex_t lock;
+
+    int beg, end;       // reads of the block
+
+    char* spool;
+    FILE* fspool;       // runs appended back to back
+    int nruns;
+    int maxruns;
+    off_t* roff;        // run i is roff[i]..roff[i+1]
+    int64 novl;
+
+    char* received;     // B blocks received
+    int nreceived;
+    int done;
+} BlockState;
+
+typedef struct
+{
+    char* root;
+    char* spooldir;
+    char* outdir;
+    int nblocks;
+
+    int port;
+    int worker_threads;
+    int max_runs;
+
+    BlockState* blocks; // 1..nblocks
+
+    pthread_mutex_t lock;
+    int tspace;         // of the first run, all have to match
+    int tbytes;
+    int ndone;
+
+    // accepted connections waiting for a worker
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    int* queue;
+    int qbeg, qend, qmax;
+
+    volatile sig_atomic_t shutdown;
+} ServerContext;
+
+static ServerContext* g_sctx = NULL;
+
+static void queue_add( ServerContext* ctx, int sock )
+{
+    pthread_mutex_lock( &( ctx->queue_lock ) );
+
+    if ( ctx->qend == ctx->qmax )
+    {
+        memmove( ctx->queue, ctx->queue + ctx->qbeg, sizeof( int ) * ( ctx->qend - ctx->qbeg ) );
+        ctx->qend -= ctx->qbeg;
+        ctx->qbeg = 0;
+
+        if ( ctx->qend == ctx->qmax )
+        {
+            ctx->qmax  = ctx->qmax * 1.2 + 64;
+            ctx->queue = realloc( ctx->queue, sizeof( int ) * ctx->qmax );
+        }
+    }
+
+    ctx->queue[ ctx->qend++ ] = sock;
+
+    pthread_cond_signal( &( ctx->queue_cond ) );
+    pthread_mutex_unlock( &( ctx->queue_lock ) );
+}
+
+// next connection, -1 once the server shuts down and the queue is empty
+
+static int queue_remove( ServerContext* ctx )
+{
+    int sock = -1;
+
+    pthread_mutex_lock( &( ctx->queue_lock ) );
+
+    while ( ctx->qbeg == ctx->qend && !ctx->shutdown )
+    {
+        pthread_cond_wait( &( ctx->queue_cond ), &( ctx->queue_lock ) );
+    }
+
+    if ( ctx->qbeg < ctx->qend )
+    {
+        sock = ctx->queue[ ctx->qbeg++ ];
+    }
+
+    pthread_mutex_unlock( &( ctx->queue_lock ) );
+
+    return sock;
+}
+
+// merges the runs of the block into path, with the .las header if header is set
+
+static int merge_runs( ServerContext* ctx, BlockState* block, const char* path, int header )
+{
+    int psize = sizeof( void* );
+    int osize = sizeof( Overlap ) - psize;
+    int tbytes = ctx->tbytes;
+    int fd, i, w;
+
+    FILE* fout = fopen( path, "w" );
+
+    if ( fout == NULL )
+    {
+        fprintf( stderr, "failed to open %s\n", path );
+        return 0;
+    }
+
+    setvbuf( fout, NULL, _IOFBF, OUTPUT_BUFFER );
+
+    if ( fflush( block->fspool ) != 0 || ( fd = open( block->spool, O_RDONLY ) ) == -1 )
+    {
+        fprintf( stderr, "failed to open %s\n", block->spool );
+        fclose( fout );
+        return 0;
+    }
+
+    if ( header )
+    {
+        fwrite( &( block->novl ), sizeof( int64 ), 1, fout );
+        fwrite( &( ctx->tspace ), sizeof( int ), 1, fout );
+    }
+
+    IO_stream* in = malloc( sizeof( IO_stream ) * ( block->nruns > 0 ? block->nruns : 1 ) );
+    LoserTree lt;
+
+    for ( i = 0; i < block->nruns; i++ )
+    {
+        stream_open( in + i, fd, block->roff[ i ], block->roff[ i + 1 ], MERGE_BUFFER, 0 );
+        stream_next( in + i );
+    }
+
+    if ( block->nruns > 0 )
+    {
+        lt_init( &lt, in, block->nruns );
+
+        while ( ( w = lt_winner( &lt ) ) >= 0 )
+        {
+            IO_stream* src = in + w;
+            int64 tsize    = src->ovl.path.tlen * tbytes;
+            char* trace    = stream_trace( src, tsize );
+
+            fwrite( ( (char*)&( src->ovl ) ) + psize, osize, 1, fout );
+            fwrite( trace, tsize, 1, fout );
+
+            stream_next( src );
+            lt_replay( &lt );
+        }
+
+        lt_free( &lt );
+    }
+
+    for ( i = 0; i < block->nruns; i++ )
+    {
+        stream_close( in + i );
+    }
+
+    free( in );
+    close( fd );
+
+    if ( fclose( fout ) != 0 )
+    {
+        fprintf( stderr, "failed to write %s\n", path );
+        return 0;
+    }
+
+    return 1;
+}
+
+// merges the runs of the block into a single one
+
+static int compact_runs( ServerContext* ctx, BlockState* block )
+{
+    char* path = malloc( strlen( block->spool ) + 10 );
+    sprintf( path, "%s.tmp", block->spool );
+
+    int ok = merge_runs( ctx, block, path, 0 );
+
+    if ( ok && rename( path, block->spool ) == 0 )
+    {
+        fclose( block->fspool );
+        block->fspool = fopen( block->spool, "a" );
+
+        if ( block->fspool != NULL && fseeko( block->fspool, 0, SEEK_END ) != 0 )
+        {
+            ok = 0;
+        }
+
+        block->roff[ 1 ] = block->roff[ block->nruns ];
+        block->nruns     = 1;
+    }
+    else
+    {
+        unlink( path );
+        ok = 0;
+    }
+
+    free( path );
+
+    return ( ok && block->fspool != NULL );
+}
+
+static void finish_block( ServerContext* ctx, int a, int partial )
+{
+    BlockState* block = ctx->blocks + a;
+    char* path        = malloc( strlen( ctx->outdir ) + strlen( ctx->root ) + 40 );
+
+    sprintf( path, "%s/%s.%d%s.las", ctx->outdir, ctx->root, a, partial ? ".partial" : "" );
+
+    if ( merge_runs( ctx, block, path, 1 ) )
+    {
+        printf( "block %d: %lld overlaps in %d runs merged into %s\n", a, block->novl, block->nruns, path );
+
+        fclose( block->fspool );
+        block->fspool = NULL;
+        unlink( block->spool );
+    }
+    else
+    {
+        fprintf( stderr, "failed to merge block %d, its runs are kept in %s\n", a, block->spool );
+    }
+
+    block->done = 1;
+
+    free( path );
+}
+
+// appends the run of the B block to the A block's spool, returns the overlaps received or -1
+
+static int64 receive_run( ServerContext* ctx, BlockState* block, FILE* in, int store )
+{
+    Overlap ovl;
+    void* trace  = NULL;
+    int64 tmax   = 0;
+    int64 novl   = 0;
+    int64 sent   = -1;
+    int prev_a   = -1;
+    int prev_b   = -1;
+    int tbytes   = ctx->tbytes;
+
+    while ( 1 )
+    {
+        if ( Read_Overlap( in, &ovl ) )
+        {
+            break;
+        }
+
+        if ( ovl.path.tlen == -1 )
+        {
+            if ( fread( &sent, sizeof( int64 ), 1, in ) != 1 )
+            {
+                sent = -1;
+            }
+
+            break;
+        }
+
+        if ( ovl.path.tlen < 0 || ovl.path.tlen > MAX_TLEN ||
+             ovl.aread < block->beg || ovl.aread >= block->end ||
+             ovl.aread < prev_a || ( ovl.aread == prev_a && ovl.bread < prev_b ) )
+        {
+            fprintf( stderr, "overlap %lld of the run is out of order or not in the block\n", novl );
+            break;
+        }
+
+        prev_a = ovl.aread;
+        prev_b = ovl.bread;
+
+        if ( ovl.path.tlen * tbytes > tmax )
+        {
+            tmax  = ovl.path.tlen * tbytes * 1.2 + 1000;
+            trace = realloc( trace, tmax );
+        }
+
+        ovl.path.trace = trace;
+
+        if ( Read_Trace( in, &ovl, tbytes ) )
+        {
+            break;
+        }
+
+        if ( store )
+        {
+            ovl.path.trace = ( tbytes > 0 ) ? trace : NULL;
+            Write_Overlap( block->fspool, &ovl, tbytes );
+        }
+
+        novl++;
+    }
+
+    free( trace );
+
+    if ( sent != novl )
+    {
+        return -1;
+    }
+
+    return novl;
+}
+
+static void handle_run( ServerContext* ctx, int sock )
+{
+    LsHeader header;
+    LsHeader ack;
+    FILE* in;
+
+    bzero( &ack, sizeof( ack ) );
+    ack.version   = LS_VERSION;
+    ack.type      = LS_TYPE_ACK;
+    ack.reserved2 = LS_STATUS_FAILED;
+
+    if ( ( in = fdopen( sock, "r" ) ) == NULL )
+    {
+        close( sock );
+        return;
+    }
+
+    if ( fread( &header, sizeof( header ), 1, in ) != 1 || header.version != LS_VERSION || header.type != LS_TYPE_RUN )
+    {
+        fprintf( stderr, "malformed run header\n" );
+        fclose( in );
+        return;
+    }
+
+    int a      = header.reserved1;
+    int b      = header.reserved2;
+    int tspace = header.reserved3;
+    int tbytes = header.reserved4;
+
+    if ( a < 1 || a > ctx->nblocks || b < 1 || b > ctx->nblocks )
+    {
+        fprintf( stderr, "run of blocks %d and %d outside of 1..%d\n", a, b, ctx->nblocks );
+        send( sock, &ack, sizeof( ack ), 0 );
+        fclose( in );
+        return;
+    }
+
+    pthread_mutex_lock( &( ctx->lock ) );
+
+    if ( ctx->tspace == 0 )
+    {
+        ctx->tspace = tspace;
+        ctx->tbytes = tbytes;
+    }
+
+    int compatible = ( ctx->tspace == tspace && ctx->tbytes == tbytes );
+
+    pthread_mutex_unlock( &( ctx->lock ) );
+
+    if ( !compatible )
+    {
+        fprintf( stderr, "run of blocks %d and %d has trace spacing %d, expected %d\n", a, b, tspace, ctx->tspace );
+        send( sock, &ack, sizeof( ack ), 0 );
+        fclose( in );
+        return;
+    }
+
+    BlockState* block = ctx->blocks + a;
+
+    pthread_mutex_lock( &( block->lock ) );
+
+    int store = ( !block->received[ b ] && !block->done );
+    off_t off = block->roff[ block->nruns ];
+
+    int64 novl = receive_run( ctx, block, in, store );
+
+    if ( novl == -1 )
+    {
+        fprintf( stderr, "run of blocks %d and %d broke off\n", a, b );
+    }
+    else if ( !store )
+    {
+        printf( "block %d: dropped duplicate run of block %d\n", a, b );
+
+        ack.reserved1 = novl;
+        ack.reserved2 = LS_STATUS_DUPLICATE;
+    }
+    else if ( fflush( block->fspool ) != 0 )
+    {
+        fprintf( stderr, "failed to write %s: %s\n", block->spool, strerror( errno ) );
+        novl = -1;
+    }
+    else
+    {
+        if ( block->nruns + 1 >= block->maxruns )
+        {
+            block->maxruns = block->maxruns * 1.2 + 16;
+            block->roff    = realloc( block->roff, sizeof( off_t ) * ( block->maxruns + 1 ) );
+        }
+
+        block->nruns += 1;
+        block->roff[ block->nruns ] = ftello( block->fspool );
+        block->novl += novl;
+
+        block->received[ b ] = 1;
+        block->nreceived += 1;
+
+        ack.reserved1 = novl;
+        ack.reserved2 = LS_STATUS_STORED;
+    }
+
+    if ( novl == -1 && store )
+    {
+        // drop what made it into the spool
+
+        if ( fflush( block->fspool ) != 0 || ftruncate( fileno( block->fspool ), off ) != 0 ||
+             fseeko( block->fspool, off, SEEK_SET ) != 0 )
+        {
+            fprintf( stderr, "failed to truncate %s\n", block->spool );
+            exit( 1 );
+        }
+    }
+
+    if ( ack.reserved2 == LS_STATUS_STORED )
+    {
+        if ( block->nreceived == ctx->nblocks )
+        {
+            finish_block( ctx, a, 0 );
+
+            pthread_mutex_lock( &( ctx->lock ) );
+            ctx->ndone += 1;
+            pthread_mutex_unlock( &( ctx->lock ) );
+        }
+        else if ( block->nruns > ctx->max_runs && !compact_runs( ctx, block ) )
+        {
+            fprintf( stderr, "failed to merge the runs of block %d\n", a );
+            exit( 1 );
+        }
+    }
+
+    pthread_mutex_unlock( &( block->lock ) );
+
+    send( sock, &ack, sizeof( ack ), MSG_NOSIGNAL );
+    fclose( in );
+}
+
+static void* worker_thread( void* arg )
+{
+    ServerContext* ctx = (ServerContext*)arg;
+    int sock;
+
+    while ( ( sock = queue_remove( ctx ) ) != -1 )
+    {
+        handle_run( ctx, sock );
+    }
+
+    return NULL;
+}
+
+static int listen_socket( int port )
+{
+    int sock;
+    int reuseaddr = 1;
+    struct sockaddr_in serv_addr;
+
+    if ( ( sock = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        perror( "socket" );
+        return -1;
+    }
+
+    if ( setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof( int ) ) < 0 )
+    {
+        perror( "setsockopt" );
+        close( sock );
+        return -1;
+    }
+
+    bzero( &serv_addr, sizeof( serv_addr ) );
+
+    serv_addr.sin_family      = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port        = htons( port );
+
+    if ( bind( sock, (struct sockaddr*)&serv_addr, sizeof( serv_addr ) ) < 0 ||
+         listen( sock, BACKLOG ) < 0 )
+    {
+        perror( "bind" );
+        close( sock );
+        return -1;
+    }
+
+    return sock;
+}
+
+static int init_blocks( ServerContext* ctx, char* pathDb )
+{
+    int a;
+
+    ctx->blocks = calloc( ctx->nblocks + 1, sizeof( BlockState ) );
+
+    for ( a = 1; a <= ctx->nblocks; a++ )
+    {
+        BlockState* block = ctx->blocks + a;
+
+        if ( DB_block_range( pathDb, a, &( block->beg ), &( block->end ) ) != 1 )
+        {
+            fprintf( stderr, "failed to get the reads of block %d of %s\n", a, pathDb );
+            return 0;
+        }
+
+        block->spool = malloc( strlen( ctx->spooldir ) + strlen( ctx->root ) + 40 );
+        sprintf( block->spool, "%s/%s.%d.spool", ctx->spooldir, ctx->root, a );
+
+        if ( ( block->fspool = fopen( block->spool, "w" ) ) == NULL )
+        {
+            fprintf( stderr, "failed to open %s\n", block->spool );
+            return 0;
+        }
+
+        block->maxruns = ctx->max_runs + 2;
+        block->roff    = calloc( block->maxruns + 1, sizeof( off_t ) );
+
+        block->received = calloc( ctx->nblocks + 1, 1 );
+
+        pthread_mutex_init( &( block->lock ), NULL );
+    }
+
+    return 1;
+}
+
+static void free_blocks( ServerContext* ctx )
+{
+    int a;
+
+    for ( a = 1; a <= ctx->nblocks; a++ )
+    {
+        BlockState* block = ctx->blocks + a;
+
+        if ( block->fspool )
+        {
+            fclose( block->fspool );
+        }
+
+        pthread_mutex_destroy( &( block->lock ) );
+
+        free( block->spool );
+        free( block->roff );
+        free( block->received );
+    }
+
+    free( ctx->blocks );
+}
+
+static void signal_handler( int sig )
+{
+    UNUSED( sig );
+
+    g_sctx->shutdown = 1;
+}
+
+static void usage( FILE* fout, const char* app )
+{
+    fprintf( fout, "usage:  %s [-t n] [-p n] [-r n] [-s dir] [-o dir] database\n\n", app );
+
+    fprintf( fout, "Merges the overlaps streamed by daligner -L into one .las file per A block.\n\n" );
+
+    fprintf( fout, "options:\n" );
+    fprintf( fout, "  -t n  worker threads (%d)\n", DEF_ARG_T );
+    fprintf( fout, "  -p n  listen port (%d)\n", DEF_ARG_P );
+    fprintf( fout, "  -r n  runs of an A block kept before they are merged (%d)\n", DEF_ARG_R );
+    fprintf( fout, "  -s dir  directory of the spool files (.)\n" );
+    fprintf( fout, "  -o dir  directory of the merged .las files (.)\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+    char* app = argv[ 0 ];
+    ServerContext ctx;
+    pthread_t* worker;
+    int i, c;
+
+    bzero( &ctx, sizeof( ctx ) );
+
+    g_sctx = &ctx;
+
+    ctx.port           = DEF_ARG_P;
+    ctx.worker_threads = DEF_ARG_T;
+    ctx.max_runs       = DEF_ARG_R;
+    ctx.spooldir       = ".";
+    ctx.outdir         = ".";
+
+    opterr = 0;
+
+    while ( ( c = getopt( argc, argv, "t:p:r:s:o:" ) ) != -1 )
+    {
+        switch ( c )
+        {
+            case 't':
+                ctx.worker_threads = atoi( optarg );
+                break;
+
+            case 'p':
+                ctx.port = atoi( optarg );
+                break;
+
+            case 'r':
+                ctx.max_runs = atoi( optarg );
+                break;
+
+            case 's':
+                ctx.spooldir = optarg;
+                break;
+
+            case 'o':
+                ctx.outdir = optarg;
+                break;
+
+            default:
+                usage( stdout, app );
+                exit( 1 );
+        }
+    }
+
+    if ( argc - optind != 1 )
+    {
+        usage( stdout, app );
+        exit( 1 );
+    }
+
+    char* pathDb = argv[ optind ];
+
+    if ( ctx.worker_threads < 1 )
+    {
+        fprintf( stderr, "number of workers threads must be greater than zero\n" );
+        exit( 1 );
+    }
+
+    if ( ctx.max_runs < 2 )
+    {
+        fprintf( stderr, "at least 2 runs have to be kept\n" );
+        exit( 1 );
+    }
+
+    if ( ctx.port == 0 )
+    {
+        fprintf( stderr, "invalid listen port %d\n", ctx.port );
+        exit( 1 );
+    }
+
+    ctx.root    = Root( pathDb, ".db" );
+    ctx.nblocks = DB_Blocks( pathDb );
+
+    if ( ctx.nblocks < 1 )
+    {
+        fprintf( stderr, "failed to get the blocks of %s\n", pathDb );
+        exit( 1 );
+    }
+
+    if ( !init_blocks( &ctx, pathDb ) )
+    {
+        exit( 1 );
+    }
+
+    pthread_mutex_init( &( ctx.lock ), NULL );
+    pthread_mutex_init( &( ctx.queue_lock ), NULL );
+    pthread_cond_init( &( ctx.queue_cond ), NULL );
+
+    // no SA_RESTART, poll returns on the signal
+
+    struct sigaction sa;
+
+    bzero( &sa, sizeof( sa ) );
+    sigemptyset( &sa.sa_mask );
+    sa.sa_handler = signal_handler;
+
+    if ( sigaction( SIGINT, &sa, NULL ) == -1 || sigaction( SIGTERM, &sa, NULL ) == -1 )
+    {
+        fprintf( stderr, "failed to register signal handlers\n" );
+    }
+
+    signal( SIGPIPE, SIG_IGN );
+
+    int sock = listen_socket( ctx.port );
+
+    if ( sock == -1 )
+    {
+        exit( 1 );
+    }
+
+    worker = malloc( sizeof( pthread_t ) * ctx.worker_threads );
+
+    for ( i = 0; i < ctx.worker_threads; i++ )
+    {
+        pthread_create( worker + i, NULL, worker_thread, &ctx );
+    }
+
+    printf( "merging %d blocks of %s (port %d)\n", ctx.nblocks, pathDb, ctx.port );
+
+    while ( !ctx.shutdown )
+    {
+        struct pollfd pfd;
+
+        pfd.fd     = sock;
+        pfd.events = POLLIN;
+
+        pthread_mutex_lock( &( ctx.lock ) );
+        int ndone = ctx.ndone;
+        pthread_mutex_unlock( &( ctx.lock ) );
+
+        if ( ndone == ctx.nblocks )
+        {
+            printf( "all blocks merged\n" );
+            break;
+        }
+
+        if ( poll( &pfd, 1, 1000 ) > 0 )
+        {
+            int newsock = accept( sock, NULL, NULL );
+
+            if ( newsock != -1 )
+            {
+                queue_add( &ctx, newsock );
+            }
+        }
+    }
+
+    close( sock );
+
+    // let the workers drain the queue
+
+    pthread_mutex_lock( &( ctx.queue_lock ) );
+    ctx.shutdown = 1;
+    pthread_cond_broadcast( &( ctx.queue_cond ) );
+    pthread_mutex_unlock( &( ctx.queue_lock ) );
+
+    for ( i = 0; i < ctx.worker_threads; i++ )
+    {
+        pthread_join( worker[ i ], NULL );
+    }
+
+    for ( i = 1; i <= ctx.nblocks; i++ )
+    {
+        BlockState* block = ctx.blocks + i;
+
+        if ( !block->done && block->nreceived == 0 )
+        {
+            unlink( block->spool );
+        }
+        else if ( !block->done )
+        {
+            fprintf( stderr, "block %d incomplete, received %d of %d runs\n", i, block->nreceived, ctx.nblocks );
+
+            finish_block( &ctx, i, 1 );
+        }
+    }
+
+    free_blocks( &ctx );
+
+    pthread_mutex_destroy( &( ctx.lock ) );
+    pthread_mutex_destroy( &( ctx.queue_lock ) );
+    pthread_cond_destroy( &( ctx.queue_cond ) );
+
+    free( ctx.queue );
+    free( ctx.root );
+    free( worker );
+
+    return 0;
+}
@@ -401,16 +401,22 @@ static void show( ShowContext* ctx, Overlap* ovls, int novl )
     }
 }
 
-static int parse_ranges( int argc, char* argv[], int* _reps, int** _pts )
+static int parse_ranges( int argc, char* argv[], int* ids, int nids, int* _reps, int** _pts )
 {
-    int* pts = (int*)malloc( sizeof( int ) * 2 * ( 2 + argc ) );
+    int* pts = (int*)malloc( sizeof( int ) * 2 * ( 2 + argc + nids ) );
     int reps = 0;
 
-    if ( argc > 0 )
+    if ( argc > 0 || nids > 0 )
     {
         int c, b, e;
         char *eptr, *fptr;
 
+        for ( c = 0; c < nids; c++ )
+        {
+            pts[ reps++ ] = ids[ c ];
+            pts[ reps++ ] = ids[ c ];
+        }
+
         for ( c = 0; c < argc; c++ )
         {
             if ( argv[ c ][ 0 ] == '#' )
@@ -574,7 +580,7 @@ static int handler_show( void* _ctx, Overlap* ovls, int novl )
 
 static void usage()
 {
-    fprintf( stderr, "usage: [-tfrc] [-s [l|i|L|I]] [-x n] [-o n] [-T track] [-i f] database input.las [ [n | n-m] ... ] ]\n\n" );
+    fprintf( stderr, "usage: [-tfrc] [-s [l|i|L|I]] [-x n] [-o n] [-T track] [-i f] [-R file] database input.las [ [n | n-m] ... ] ]\n\n" );
 
     fprintf( stderr, "Show the contents of a .las file\n\n" );
 
@@ -587,8 +593,10 @@ static void usage()
     fprintf( stderr, "         -o n  minimum overlap length\n" );
     fprintf( stderr, "         -i f  minimum identity\n" );
     fprintf( stderr, "         -T track  include trim information in the reads\n" );
-    fprintf( stderr, "         -r  parsing friendly raw output\n\n" );
+    fprintf( stderr, "         -r  parsing friendly raw output\n" );
+    fprintf( stderr, "         -R file  show the A reads whose identifiers are listed in file\n\n" );
     fprintf( stderr, "Single A read identifiers or A read identifier ranges can optionally be specified.\n");
+    fprintf( stderr, "If the .las file is indexed (LAindex) the requested reads are looked up directly.\n");
 }
 
 int main( int argc, char* argv[] )
@@ -610,6 +618,7 @@ int main( int argc, char* argv[] )
     int mixed    = 0;
     char* trim_a = NULL;
     char* trim_b = NULL;
+    char* pathIds = NULL;
 
     opterr = 0;
 
@@ -620,7 +629,7 @@ int main( int argc, char* argv[] )
     sctx.sort         = SORT_NATIVE;
     sctx.flags        = DEF_ARG_F;
 
-    while ( ( c = getopt( argc, argv, "mrIfactx:i:o:s:T:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "mrIfactx:i:o:s:T:R:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -653,6 +662,10 @@ int main( int argc, char* argv[] )
                 sctx.show_aln = 1;
                 break;
 
+            case 'R':
+                pathIds = optarg;
+                break;
+
             case 'c':
                 sctx.color = 1;
                 break;
@@ -752,7 +765,30 @@ int main( int argc, char* argv[] )
     int reps;
     int* pts = NULL;
 
-    parse_ranges( argc - optind, argv + optind, &reps, &pts );
+    int* ids  = NULL;
+    int nids  = 0;
+
+    if ( pathIds != NULL )
+    {
+        FILE* fileIds = fopen( pathIds, "r" );
+
+        if ( fileIds == NULL )
+        {
+            fprintf( stderr, "could not open '%s'\n", pathIds );
+            exit( 1 );
+        }
+
+        fread_integers( fileIds, &ids, &nids );
+
+        fclose( fileIds );
+    }
+
+    if ( !parse_ranges( argc - optind, argv + optind, ids, nids, &reps, &pts ) )
+    {
+        exit( 1 );
+    }
+
+    free( ids );
 
     // init
 
@@ -803,7 +839,16 @@ int main( int argc, char* argv[] )
 
     pre_show( pctx, &sctx );
 
-    pass( pctx, handler_show );
+    // seek to the requested piles when the .las is indexed
+
+    if ( argc - optind > 0 || nids > 0 )
+    {
+        pctx->index = lasidx_load( db_a, pcPathOverlaps, 0 );
+    }
+
+    pass_ranges( pctx, handler_show, pts, reps );
+
+    lasidx_close( pctx->index );
 
     post_show();
 
@@ -30,6 +30,7 @@
 #define DEF_ARG_F 0
 #define DEF_ARG_B 1000
 #define DEF_ARG_T NULL
+#define DEF_ARG_J 1
 
 // read flags
 
@@ -37,12 +38,6 @@
 #define R_USED_A ( 1 << 1 )
 #define R_USED_B ( 1 << 2 )
 
-#define R_CONTAINED_G ( 1 << 3 )
-#define R_USED_A_G ( 1 << 4 )
-#define R_USED_B_G ( 1 << 5 )
-
-#define R_MASK_G ( R_CONTAINED_G | R_USED_A_G | R_USED_B_G )
-
 typedef struct
 {
     // stat counters for a single overlap file
@@ -72,6 +67,9 @@ typedef struct
     uint64_t* bsum;
     uint64_t* hist_local;
 
+    // R_xxx flags of the reads
+    unsigned char* rflags;
+
     // db
     HITS_DB* db;
     HITS_TRACK* tracktrim;
@@ -143,12 +141,12 @@ static int contained_stats( StatsContext* ctx, Overlap* pOvls, int n )
         // check for contained reads
         if ( bb <= tbb + ctx->fuzzing && be >= tbe - ctx->fuzzing )
         {
-            ctx->db->reads[ b ].flags |= R_CONTAINED | R_CONTAINED_G;
+            ctx->rflags[ b ] |= R_CONTAINED;
         }
 
         if ( ab <= tab + ctx->fuzzing && ae >= tae - ctx->fuzzing )
         {
-            ctx->db->reads[ a ].flags |= R_CONTAINED | R_CONTAINED_G;
+            ctx->rflags[ a ] |= R_CONTAINED;
         }
     }
 
@@ -172,18 +170,68 @@ static void stats_pre( StatsContext* fctx )
         fctx->hist       = malloc( sizeof( uint64_t ) * fctx->nbin );
         fctx->hist_local = malloc( sizeof( uint64_t ) * fctx->nbin );
         fctx->bsum       = malloc( sizeof( uint64_t ) * fctx->nbin );
+        fctx->rflags     = malloc( nreads );
     }
 
+    bzero( fctx->rflags, nreads );
+    bzero( fctx->hist, sizeof( uint64_t ) * fctx->nbin );
+    bzero( fctx->hist_local, sizeof( uint64_t ) * fctx->nbin );
+    bzero( fctx->bsum, sizeof( uint64_t ) * fctx->nbin );
+}
+
+static void stats_free( StatsContext* ctx )
+{
+    free( ctx->hist );
+    free( ctx->hist_local );
+    free( ctx->bsum );
+    free( ctx->rflags );
+}
+
+// each thread counts into its own histograms and read flags
+
+static void* stats_thread_init( void* _ctx, int thread )
+{
+    UNUSED( thread );
+
+    StatsContext* ctx  = (StatsContext*)_ctx;
+    StatsContext* tctx = malloc( sizeof( StatsContext ) );
+
+    memcpy( tctx, ctx, sizeof( StatsContext ) );
+
+    tctx->hist = NULL;
+    stats_pre( tctx );
+
+    return tctx;
+}
+
+static void stats_thread_reduce( void* _ctx, void* _tctx, int thread )
+{
+    UNUSED( thread );
+
+    StatsContext* ctx  = (StatsContext*)_ctx;
+    StatsContext* tctx = (StatsContext*)_tctx;
     int i;
-    HITS_READ* reads = fctx->db->reads;
+
+    ctx->nOverlaps += tctx->nOverlaps;
+    ctx->nComplementOverlaps += tctx->nComplementOverlaps;
+    ctx->nIdentityOverlaps += tctx->nIdentityOverlaps;
+
+    for ( i = 0; i < ctx->nbin; i++ )
+    {
+        ctx->hist[ i ] += tctx->hist[ i ];
+        ctx->hist_local[ i ] += tctx->hist_local[ i ];
+        ctx->bsum[ i ] += tctx->bsum[ i ];
+    }
+
+    int nreads = DB_NREADS( ctx->db );
+
     for ( i = 0; i < nreads; i++ )
     {
-        reads[ i ].flags &= R_MASK_G;
+        ctx->rflags[ i ] |= tctx->rflags[ i ];
     }
 
-    bzero( fctx->hist, sizeof( uint64_t ) * fctx->nbin );
-    bzero( fctx->hist_local, sizeof( uint64_t ) * fctx->nbin );
-    bzero( fctx->bsum, sizeof( uint64_t ) * fctx->nbin );
+    stats_free( tctx );
+    free( tctx );
 }
 
 static void stats_post( StatsContext* ctx )
@@ -200,8 +248,7 @@ static void stats_post( StatsContext* ctx )
 
     for ( i = 0; i < dbReads; i++ )
     {
-        HITS_READ* read = ctx->db->reads + i;
-        int flags       = read->flags;
+        int flags = ctx->rflags[ i ];
 
         if ( flags & R_CONTAINED )
         {
@@ -316,7 +363,7 @@ static int stats_handler( void* _ctx, Overlap* ovls, int novl )
     StatsContext* ctx = (StatsContext*)_ctx;
     int j;
 
-    ctx->db->reads[ ovls->aread ].flags |= R_USED_A | R_USED_A_G;
+    ctx->rflags[ ovls->aread ] |= R_USED_A;
 
     // contained stats
     {
@@ -329,7 +376,7 @@ static int stats_handler( void* _ctx, Overlap* ovls, int novl )
 
             contained_stats( ctx, ovls + j, k - j + 1 );
 
-            ctx->db->reads[ ovls[ j ].bread ].flags |= R_USED_B | R_USED_B_G;
+            ctx->rflags[ ovls[ j ].bread ] |= R_USED_B;
 
             j = k + 1;
         }
@@ -394,11 +441,12 @@ static int stats_handler( void* _ctx, Overlap* ovls, int novl )
 
 static void usage( FILE* fout, const char* app )
 {
-    fprintf( fout, "usage: %s [-r] [-t track] [-b n] database input.las [input2.las ...]\n\n", app );
+    fprintf( fout, "usage: %s [-r] [-t track] [-b n] [-j n] database input.las [input2.las ...]\n\n", app );
     fprintf( fout, "Output basic statistics on the alignments found in the las file(s).\n\n" );
     fprintf( fout, "options: -b  bin size for the alignment lengths' histogram (%d)\n", DEF_ARG_B );
     fprintf( fout, "         -t  trim track for local alignment classification\n" );
     fprintf( fout, "         -r  raw (parsing friendly) output\n" );
+    fprintf( fout, "         -j  number of threads (%d)\n", DEF_ARG_J );
 }
 
 int main( int argc, char* argv[] )
@@ -420,9 +468,10 @@ int main( int argc, char* argv[] )
 
     int c;
     char* trimname = DEF_ARG_T;
+    int nthreads   = DEF_ARG_J;
     opterr         = 0;
 
-    while ( ( c = getopt( argc, argv, "rt:b:" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "rt:b:j:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -434,6 +483,10 @@ int main( int argc, char* argv[] )
                 trimname = optarg;
                 break;
 
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
             case 'b':
                 sctx.ovlBinSize = atoi( optarg );
                 if ( sctx.ovlBinSize <= 0 )
@@ -497,11 +550,22 @@ int main( int argc, char* argv[] )
 
         pctx->split_b         = 0;
         pctx->load_trace      = 0;
+        pctx->use_mmap        = 1;
         pctx->data            = &sctx;
         pctx->write_overlaps  = 0;
         pctx->purge_discarded = 0;
 
-        pass( pctx, stats_handler );
+        pctx->thread_init   = stats_thread_init;
+        pctx->thread_reduce = stats_thread_reduce;
+
+        if ( nthreads > 1 )
+        {
+            pctx->index = lasidx_load( &db, argv[ optind - 1 ], 0 );
+        }
+
+        pass_parallel( pctx, stats_handler, nthreads );
+
+        lasidx_close( pctx->index );
 
         int last = 0;
         if ( b == blocks )
@@ -516,6 +580,7 @@ int main( int argc, char* argv[] )
     }
 
     stats_post( &sctx );
+    stats_free( &sctx );
 
     Close_DB( &db );
     free( pathLas );
@@ -9,20 +9,56 @@
  */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <unistd.h>
 
 #include "lib/colors.h"
+#include "lib/compression.h"
 #include "lib/tracks.h"
 
 #include "db/DB.h"
 
+// defaults
+
+#define DEF_ARG_J 4
+
+// input tracks merged in one pass, bounds the tracks held in memory when
+// combining the block tracks of a #.track
+
+#define COMBINE_GROUP 16
+
 // toggles
 
 #undef DEBUG
 
+typedef struct
+{
+    track_anno* anno;           // byte offsets of the reads' intervals in data
+    track_data* data;
+} CombineSource;
+
+typedef struct
+{
+    CombineSource* sources;
+    int nsources;
+
+    int beg, end;               // reads of the range
+
+    track_anno* bytes;          // of the merged intervals of read j at bytes[ j ]
+
+    track_data* data;           // merged intervals of the range
+    uint64 dlen, dmax;
+
+    track_part* part;           // data compressed into it, if not NULL
+
+    int64 ncontain;
+    int64 noverlap;
+} CombineRange;
+
 static int cmp_intervals( const void* a, const void* b )
 {
     track_data* x = (track_data*)a;
@@ -33,28 +69,297 @@ static int cmp_intervals( const void* a, const void* b )
 
 static void usage()
 {
-    printf( "usage: [-vd] database track.out [ <track.in1> ... | #.track ]\n\n" );
+    printf( "usage: [-vd] [-j n] [-z codec] database track.out [ <track.in1> ... | #.track ]\n\n" );
 
     printf( "Combines annotation tracks with overlapping intervals into a single track.\n\n" );
 
     printf( "options: -v  verbose\n" );
     printf( "         -d  remove input tracks after combining\n" );
+    printf( "         -j  number of threads (default %d)\n", DEF_ARG_J );
+    printf( "         -z  compression codec of the combined track, zlib or zstd (default zlib)\n" );
     printf( "    #.track  prefixing the track name with #. selects all tracks 1.track ... database_block.tracks\n" );
 }
 
+// cursor of a source in the heap of the k-way merge
+
+typedef struct
+{
+    track_data* cur;
+    track_data* end;
+} CombineCursor;
+
+static void heap_down( CombineCursor* heap, int n, int i )
+{
+    while ( 1 )
+    {
+        int l = 2 * i + 1;
+        int m = i;
+
+        if ( l < n && heap[ l ].cur[ 0 ] < heap[ m ].cur[ 0 ] )
+        {
+            m = l;
+        }
+
+        if ( l + 1 < n && heap[ l + 1 ].cur[ 0 ] < heap[ m ].cur[ 0 ] )
+        {
+            m = l + 1;
+        }
+
+        if ( m == i )
+        {
+            break;
+        }
+
+        CombineCursor t = heap[ i ];
+        heap[ i ]       = heap[ m ];
+        heap[ m ]       = t;
+
+        i = m;
+    }
+}
+
+static void range_append( CombineRange* cr, track_data b, track_data e )
+{
+    if ( cr->dlen + 2 > cr->dmax )
+    {
+        cr->dmax = cr->dmax * 1.2 + 1000;
+        cr->data = (track_data*)realloc( cr->data, sizeof( track_data ) * cr->dmax );
+    }
+
+    cr->data[ cr->dlen++ ] = b;
+    cr->data[ cr->dlen++ ] = e;
+}
+
+/*
+ * merges the intervals of the reads in the range. the intervals of each source are
+ * sorted by their begin, which is checked, so that a k-way merge of the sources yields
+ * them in order. contained intervals are dropped and overlapping ones joined.
+ */
+
+static void* combine_range( void* arg )
+{
+    CombineRange* cr       = arg;
+    CombineCursor* heap    = malloc( sizeof( CombineCursor ) * cr->nsources );
+    track_data* scratch    = NULL;
+    uint64 smax            = 0;
+    int j, s;
+
+    cr->data     = NULL;
+    cr->dlen     = cr->dmax = 0;
+    cr->ncontain = cr->noverlap = 0;
+
+    for ( j = cr->beg; j < cr->end; j++ )
+    {
+        uint64 dstart  = cr->dlen;
+        uint64 nsorted = 0;
+        int n          = 0;
+
+        // intervals of sources that are not sorted are sorted in the scratch buffer
+
+        for ( s = 0; s < cr->nsources; s++ )
+        {
+            CombineSource* src = cr->sources + s;
+            track_anno ob      = src->anno[ j ] / sizeof( track_data );
+            track_anno oe      = src->anno[ j + 1 ] / sizeof( track_data );
+            track_anno k;
+
+            assert( ob <= oe );
+
+            for ( k = ob + 2; k < oe && src->data[ k - 2 ] <= src->data[ k ]; k += 2 )
+                ;
+
+            if ( k < oe )
+            {
+                nsorted += oe - ob;
+            }
+        }
+
+        if ( nsorted > smax )
+        {
+            smax    = nsorted * 1.2 + 100;
+            scratch = (track_data*)realloc( scratch, sizeof( track_data ) * smax );
+        }
+
+        nsorted = 0;
+
+        for ( s = 0; s < cr->nsources; s++ )
+        {
+            CombineSource* src = cr->sources + s;
+            track_anno ob      = src->anno[ j ] / sizeof( track_data );
+            track_anno oe      = src->anno[ j + 1 ] / sizeof( track_data );
+            track_anno k;
+
+            if ( ob == oe )
+            {
+                continue;
+            }
+
+            for ( k = ob + 2; k < oe && src->data[ k - 2 ] <= src->data[ k ]; k += 2 )
+                ;
+
+            if ( k < oe )
+            {
+                track_data* sorted = scratch + nsorted;
+
+                memcpy( sorted, src->data + ob, sizeof( track_data ) * ( oe - ob ) );
+                qsort( sorted, ( oe - ob ) / 2, sizeof( track_data ) * 2, cmp_intervals );
+
+                heap[ n ].cur = sorted;
+                heap[ n ].end = sorted + ( oe - ob );
+
+                nsorted += oe - ob;
+            }
+            else
+            {
+                heap[ n ].cur = src->data + ob;
+                heap[ n ].end = src->data + oe;
+            }
+
+            n++;
+        }
+
+        for ( s = n / 2 - 1; s >= 0; s-- )
+        {
+            heap_down( heap, n, s );
+        }
+
+        track_data cb = 0, ce = 0;
+        int open      = 0;
+
+        while ( n > 0 )
+        {
+            track_data b = heap[ 0 ].cur[ 0 ];
+            track_data e = heap[ 0 ].cur[ 1 ];
+
+            heap[ 0 ].cur += 2;
+
+            if ( heap[ 0 ].cur == heap[ 0 ].end )
+            {
+                heap[ 0 ] = heap[ --n ];
+            }
+
+            heap_down( heap, n, 0 );
+
+            if ( !open )
+            {
+                cb   = b;
+                ce   = e;
+                open = 1;
+            }
+            // contained
+            else if ( e <= ce )
+            {
+                cr->ncontain++;
+            }
+            // overlapping
+            else if ( b <= ce )
+            {
+                ce = e;
+                cr->noverlap++;
+            }
+            else
+            {
+                range_append( cr, cb, ce );
+
+                cb = b;
+                ce = e;
+            }
+        }
+
+        if ( open )
+        {
+            range_append( cr, cb, ce );
+        }
+
+        cr->bytes[ j ] = sizeof( track_data ) * ( cr->dlen - dstart );
+    }
+
+    if ( cr->part )
+    {
+        track_part_compress( cr->part, cr->data, sizeof( track_data ) * cr->dlen );
+
+        free( cr->data );
+        cr->data = NULL;
+    }
+
+    free( heap );
+    free( scratch );
+
+    return NULL;
+}
+
+// merges the sources over nranges ranges of reads, one thread each. the ranges are
+// compressed into parts if given.
+
+static void combine( CombineSource* sources, int nsources, int nreads, track_anno* bytes,
+                     CombineRange* ranges, int nranges, track_part* parts )
+{
+    pthread_t* threads = malloc( sizeof( pthread_t ) * nranges );
+    int i;
+
+    for ( i = 0; i < nranges; i++ )
+    {
+        CombineRange* cr = ranges + i;
+
+        cr->sources  = sources;
+        cr->nsources = nsources;
+        cr->beg      = (int64)nreads * i / nranges;
+        cr->end      = (int64)nreads * ( i + 1 ) / nranges;
+        cr->bytes    = bytes;
+        cr->part     = parts ? parts + i : NULL;
+
+        if ( nranges == 1 )
+        {
+            combine_range( cr );
+        }
+        else
+        {
+            pthread_create( threads + i, NULL, combine_range, cr );
+        }
+    }
+
+    if ( nranges > 1 )
+    {
+        for ( i = 0; i < nranges; i++ )
+        {
+            pthread_join( threads[ i ], NULL );
+        }
+    }
+
+    free( threads );
+}
+
+// turns the bytes per read into offsets
+
+static void bytes_to_offsets( track_anno* anno, int nreads )
+{
+    track_anno coff, off;
+    int j;
+
+    off = 0;
+
+    for ( j = 0; j <= nreads; j++ )
+    {
+        coff      = anno[ j ];
+        anno[ j ] = off;
+        off += coff;
+    }
+}
+
 int main( int argc, char* argv[] )
 {
     HITS_DB db;
 
-    int verbose = 0;
-    int delete  = 0;
+    int verbose  = 0;
+    int delete   = 0;
+    int nthreads = DEF_ARG_J;
     int ntracks;
     char** track_name;
 
     int c;
     opterr = 0;
 
-    while ( ( c = getopt( argc, argv, "hvd" ) ) != -1 )
+    while ( ( c = getopt( argc, argv, "hvdj:z:" ) ) != -1 )
     {
         switch ( c )
         {
@@ -70,27 +375,49 @@ int main( int argc, char* argv[] )
                 delete = 1;
                 break;
 
+            case 'j':
+                nthreads = atoi( optarg );
+                break;
+
+            case 'z':
+            {
+                int codec = compress_codec_parse( optarg );
+
+                if ( codec == -1 || !compress_codec_available( codec ) )
+                {
+                    fprintf( stderr, "error: unsupported compression codec %s\n", optarg );
+                    exit( 1 );
+                }
+
+                compress_set_codec( codec );
+            }
+            break;
+
             default:
                 usage();
                 exit( 1 );
         }
     }
 
-	/*
-    if ( argc - optind == 3 )
+    if ( argc - optind < 3 )
     {
-        if ( argv[ optind + 2 ][ 0 ] != '#' )
-        {
-            usage();
-            exit( 1 );
-        }
+        usage();
+        exit( 1 );
     }
-    else */ if ( argc - optind < 3 )
+
+    if ( nthreads < 1 )
     {
-        usage();
+        fprintf( stderr, "invalid number of threads %d\n", nthreads );
         exit( 1 );
     }
 
+    // the read ranges are the unit of parallelism, don't let each of them start a thread per core
+
+    if ( nthreads > 1 )
+    {
+        compress_set_threads( 1 );
+    }
+
     char* pathReadsIn     = argv[ optind++ ];
     char* nameTrackResult = argv[ optind++ ];
 
@@ -121,185 +448,132 @@ int main( int argc, char* argv[] )
 
     int nreads = db.ureads;
 
-    track_anno* offset_out = (track_anno*)malloc( sizeof( track_anno ) * ( nreads + 1 ) );
-    bzero( offset_out, sizeof( track_anno ) * ( nreads + 1 ) );
-
-    int dcur             = 0;
-    int dmax             = 100;
-    track_data* data_out = (track_data*)malloc( sizeof( track_data ) * dmax );
+    // expand #.track into the block tracks
 
-    int tcur               = 0;
-    int tmax               = 100;
-    track_data* temp       = (track_data*)malloc( sizeof( track_data ) * tmax );
-    track_anno* offset_tmp = (track_anno*)malloc( sizeof( track_anno ) * ( nreads + 1 ) );
-    bzero( offset_tmp, sizeof( track_anno ) * ( nreads + 1 ) );
-
-    int64 noverlap = 0;
-    int64 ncontain = 0;
-
-    HITS_TRACK* inTrack;
+    int ninputs    = 0;
+    char** inputs  = malloc( sizeof( char* ) * ntracks * ( nblocks + 1 ) );
     char* tmpTrackName = malloc( 1000 );
+
     for ( i = 0; i < ntracks; i++ )
     {
-        int cBlock = 1;
-        int cont   = 1;
-
-        while ( cont && cBlock <= nblocks )
+        if ( track_name[ i ][ 0 ] == '#' )
         {
-            if ( track_name[ i ][ 0 ] == '#' )
+            for ( j = 1; j <= nblocks; j++ )
             {
-                sprintf( tmpTrackName, "%d.%s", cBlock++, track_name[ i ] + 2 );
-
-                if ( ( inTrack = track_load( &db, tmpTrackName ) ) == NULL )
-                {
-                    fprintf( stderr, "could not open track %s\n", tmpTrackName );
-                    exit( 1 );
-                }
+                sprintf( tmpTrackName, "%d.%s", j, track_name[ i ] + 2 );
+                inputs[ ninputs++ ] = strdup( tmpTrackName );
             }
-            else
-            {
-                if ( ( inTrack = track_load( &db, track_name[ i ] ) ) == NULL )
-                {
-                    fprintf( stderr, "could not open track %s\n", track_name[ i ] );
-                    exit( 1 );
-                }
+        }
+        else
+        {
+            inputs[ ninputs++ ] = strdup( track_name[ i ] );
+        }
+    }
 
-                cont = 0;
-            }
+    int nranges = MAX( 1, MIN( nthreads, db.nreads ) );
 
-            track_anno* anno_in = inTrack->anno;
-            track_data* data_in = inTrack->data;
+    CombineRange* ranges   = malloc( sizeof( CombineRange ) * nranges );
+    track_part* parts      = malloc( sizeof( track_part ) * nranges );
+    CombineSource* sources = malloc( sizeof( CombineSource ) * ( COMBINE_GROUP + 1 ) );
+    HITS_TRACK** loaded    = malloc( sizeof( HITS_TRACK* ) * COMBINE_GROUP );
 
-            if ( verbose )
-            {
-                printf( "%lld in %s", anno_in[ db.nreads ] / sizeof( track_data ), inTrack->name );
-            }
+    // intervals combined so far
 
-            bzero( offset_tmp, sizeof( track_anno ) * ( nreads + 1 ) );
-            tcur = 0;
-            dcur = 0;
-            for ( j = 0; j < db.nreads; j++ )
-            {
-                // check input track
-                int ispace, ospace;
+    CombineSource acc;
+    acc.anno = NULL;
+    acc.data = NULL;
 
-                offset_tmp[ j ] = tcur;
+    int64 noverlap = 0;
+    int64 ncontain = 0;
 
-                track_anno i_ob = anno_in[ j ] / sizeof( track_data );
-                track_anno i_oe = anno_in[ j + 1 ] / sizeof( track_data );
+    track_anno* offset_out = NULL;
 
-                assert( i_ob <= i_oe );
+    int g;
+    for ( g = 0; g < ninputs; g += COMBINE_GROUP )
+    {
+        int ngroup   = MIN( COMBINE_GROUP, ninputs - g );
+        int last     = ( g + ngroup == ninputs );
+        int nsources = 0;
 
-                ispace = i_oe - i_ob;
+        if ( acc.anno != NULL )
+        {
+            sources[ nsources++ ] = acc;
+        }
 
-                // check current out track
-                track_anno o_ob = offset_out[ j ] / sizeof( track_data );
-                track_anno o_oe = offset_out[ j + 1 ] / sizeof( track_data );
+        for ( i = 0; i < ngroup; i++ )
+        {
+            HITS_TRACK* inTrack = track_load( &db, inputs[ g + i ] );
 
-                assert( o_ob <= o_oe );
+            if ( inTrack == NULL )
+            {
+                fprintf( stderr, "could not open track %s\n", inputs[ g + i ] );
+                exit( 1 );
+            }
 
-                ospace = o_oe - o_ob;
+            loaded[ i ] = inTrack;
 
-                if ( ispace == 0 && ospace == 0 )
-                    continue;
+            sources[ nsources ].anno = inTrack->anno;
+            sources[ nsources ].data = inTrack->data;
+            nsources++;
 
-                if ( tcur + ospace + ispace >= tmax )
-                {
-                    tmax = tmax * 1.2 + ospace + ispace;
-                    temp = (track_data*)realloc( temp, sizeof( track_data ) * tmax );
-                }
+            if ( verbose )
+            {
+                printf( "%lld in %s\n", ( (track_anno*)inTrack->anno )[ db.nreads ] / sizeof( track_data ), inTrack->name );
+            }
+        }
 
-                // merge inTrack and current out-track into temp
-                if ( ispace > 0 )
-                {
-                    memcpy( temp + tcur, data_in + i_ob, sizeof( track_data ) * ( i_oe - i_ob ) );
-                    tcur += ispace;
-                }
-                if ( ospace > 0 )
-                {
-                    memcpy( temp + tcur, data_out + o_ob, sizeof( track_data ) * ( o_oe - o_ob ) );
-                    tcur += ospace;
-                }
+        offset_out = (track_anno*)malloc( sizeof( track_anno ) * ( nreads + 1 ) );
+        bzero( offset_out, sizeof( track_anno ) * ( nreads + 1 ) );
 
-                if ( ispace != 0 && ospace != 0 )
-                {
-                    qsort( temp + ( tcur - ispace - ospace ), ( ispace + ospace ) / 2, sizeof( track_data ) * 2, cmp_intervals );
-
-                    int k;
-                    for ( k = tcur - ispace - ospace + 2; k < tcur; k += 2 )
-                    {
-                        // contained -> replace with previous
-                        if ( temp[ k + 1 ] <= temp[ k - 1 ] )
-                        {
-                            temp[ k ]     = temp[ k - 2 ];
-                            temp[ k + 1 ] = temp[ k - 1 ];
-
-                            temp[ k - 2 ] = temp[ k - 1 ] = -1;
-
-                            ncontain++;
-                        }
-                        // overlapping
-                        else if ( temp[ k ] <= temp[ k - 1 ] )
-                        {
-                            temp[ k ] = temp[ k - 2 ];
-
-                            temp[ k - 2 ] = temp[ k - 1 ] = -1;
-
-                            noverlap++;
-                        }
-                    }
-                }
-            }
+        combine( sources, nsources, db.nreads, offset_out, ranges, nranges, last ? parts : NULL );
 
-            // copy tmp into data_out
-            if ( dcur + tcur >= dmax )
-            {
-                dmax     = dmax * 1.2 + tcur;
-                data_out = (track_data*)realloc( data_out, sizeof( track_data ) * dmax );
-            }
-            bzero( offset_out, sizeof( track_anno ) * ( nreads + 1 ) );
+        bytes_to_offsets( offset_out, nreads );
 
-            offset_tmp[ nreads ] = tcur;
+        for ( i = 0; i < nranges; i++ )
+        {
+            ncontain += ranges[ i ].ncontain;
+            noverlap += ranges[ i ].noverlap;
+        }
 
-            for ( j = 0; j < nreads; j++ )
-            {
-                track_anno k;
-                for ( k = offset_tmp[ j ]; k < offset_tmp[ j + 1 ]; k += 2 )
-                {
-                    if ( temp[ k ] == -1 )
-                    {
-                        continue;
-                    }
+        for ( i = 0; i < ngroup; i++ )
+        {
+            // TODO use track_close, but it has to be adapted to update the linked list of DB tracks
+            Close_Track( &db, loaded[ i ]->name );
+        }
 
-                    data_out[ dcur++ ] = temp[ k ];
-                    data_out[ dcur++ ] = temp[ k + 1 ];
+        free( acc.anno );
+        free( acc.data );
 
-                    offset_out[ j ] += sizeof( track_data ) * 2;
-                }
-            }
+        if ( last )
+        {
+            acc.anno = NULL;
+            acc.data = NULL;
+        }
+        else
+        {
+            // concatenate the ranges into the intervals combined so far
 
-            track_anno coff, off;
-            off = 0;
+            uint64 dlen = offset_out[ nreads ] / sizeof( track_data );
+            uint64 dcur = 0;
 
-            for ( j = 0; j <= nreads; j++ )
-            {
-                coff = offset_out[ j ];
-                offset_out[ j ] = off;
-                off += coff;
-            }
+            acc.anno = offset_out;
+            acc.data = (track_data*)malloc( sizeof( track_data ) * ( dlen + 1 ) );
 
-            for ( j = 0; j < nreads; j++ )
+            for ( i = 0; i < nranges; i++ )
             {
-                assert( offset_out[ j ] <= offset_out[ j + 1 ] );
+                memcpy( acc.data + dcur, ranges[ i ].data, sizeof( track_data ) * ranges[ i ].dlen );
+                dcur += ranges[ i ].dlen;
+
+                free( ranges[ i ].data );
             }
 
-            // TODO use track_close, but it has to be adapted to update the linked list of DB tracks
-            Close_Track( &db, inTrack->name );
+            offset_out = NULL;
+        }
 
-            if ( verbose )
-            {
-                printf( " %lld contained, %lld overlapped, %lld cum\n", ncontain, noverlap, offset_out[ nreads ] / sizeof( track_data ) );
-            }
+        if ( verbose )
+        {
+            printf( "%lld contained, %lld overlapped, %lld cum\n", ncontain, noverlap,
+                    ( last ? offset_out[ nreads ] : acc.anno[ nreads ] ) / sizeof( track_data ) );
         }
     }
 
@@ -310,33 +584,33 @@ int main( int argc, char* argv[] )
                 nameTrackResult );
     }
 
-    track_write( &db, nameTrackResult, 0, offset_out, data_out,
-                 offset_out[ nreads ] / sizeof( track_data ) );
+    track_write_parts( &db, nameTrackResult, 0, offset_out, parts, nranges );
+
+    for ( i = 0; i < nranges; i++ )
+    {
+        track_part_free( parts + i );
+    }
 
-    free( temp );
-    free( data_out );
+    free( parts );
+    free( ranges );
+    free( sources );
+    free( loaded );
     free( offset_out );
-    free( offset_tmp );
 
     if ( delete )
     {
-        for ( i = 0; i < ntracks; i++ )
+        for ( i = 0; i < ninputs; i++ )
         {
-            if ( track_name[ i ][ 0 ] == '#' )
-            {
-                for ( j = 1; j <= nblocks; j++ )
-                {
-                    sprintf( tmpTrackName, "%d.%s", j, track_name[ i ] + 2 );
-                    track_delete( &db, tmpTrackName );
-                }
-            }
-            else
-            {
-                track_delete( &db, track_name[ i ] );
-            }
+            track_delete( &db, inputs[ i ] );
         }
     }
 
+    for ( i = 0; i < ninputs; i++ )
+    {
+        free( inputs[ i ] );
+    }
+
+    free( inputs );
     free( track_name );
     free( tmpTrackName );
 
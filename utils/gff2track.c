@@ -1,4 +1,5 @@
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -19,14 +20,46 @@
 #include "db/DB.h"
 #include "dalign/align.h"
 
+// defaults
+
+#define DEF_ARG_J 4
+
+// parsing
+
+#define GFF_BUFFER      ( 16 * 1024 * 1024 )    // bytes read from the GFF at once
+#define GFF_BUCKETS     4096                    // intervals are bucketed by ranges of reads
+
 // getopt
 
 extern char* optarg;
 extern int optind, opterr, optopt;
 
+// intervals of a range of reads, as (read, begin, end)
+
+typedef struct
+{
+    int* ints;
+    uint64_t nints;
+    uint64_t maxints;
+} GffBucket;
+
+typedef struct
+{
+    HITS_DB* db;
+    track_anno* anno;
+
+    GffBucket* buckets;
+    track_part* parts;
+    int nbuckets;
+
+    int next;                   // next bucket to be sorted
+    pthread_mutex_t lock;
+} GffSort;
+
 static void usage()
 {
-    printf("<db> <gff> <track>\n");
+    printf("[-j <threads>] <db> <gff> <track>\n");
+    printf("options: -j ... number of threads sorting the intervals (default %d)\n", DEF_ARG_J);
 }
 
 static int cmp_ints(const void* x, const void* y)
@@ -34,21 +67,271 @@ static int cmp_ints(const void* x, const void* y)
     int* a = (int*)x;
     int* b = (int*)y;
 
-    int l = a[0];
-    int r = b[0];
+    if (a[0] != b[0])
+    {
+        return a[0] - b[0];
+    }
+
+    if (a[1] != b[1])
+    {
+        return a[1] - b[1];
+    }
+
+    return a[2] - b[2];
+}
+
+static inline int bucket_of(int seqid, int nreads, int nbuckets)
+{
+    return (int64)seqid * nbuckets / nreads;
+}
+
+static void bucket_add(GffBucket* bucket, int seqid, int b, int e)
+{
+    if (bucket->nints + 3 > bucket->maxints)
+    {
+        bucket->maxints = 1.2 * bucket->maxints + 300;
+        bucket->ints = realloc(bucket->ints, bucket->maxints * sizeof(int));
+    }
+
+    bucket->ints[bucket->nints + 0] = seqid;
+    bucket->ints[bucket->nints + 1] = b;
+    bucket->ints[bucket->nints + 2] = e;
+
+    bucket->nints += 3;
+}
+
+// the next whitespace delimited field of the line, terminated in place
+
+static char* next_field(char** line)
+{
+    char* cur = *line;
+
+    while (*cur == ' ' || *cur == '\t')
+    {
+        cur++;
+    }
+
+    if (*cur == '\0')
+    {
+        return NULL;
+    }
+
+    char* field = cur;
+
+    while (*cur != '\0' && *cur != ' ' && *cur != '\t')
+    {
+        cur++;
+    }
+
+    if (*cur != '\0')
+    {
+        *cur++ = '\0';
+    }
+
+    *line = cur;
+
+    return field;
+}
+
+// seqid, source, feature, begin and end of a line, 0 if it isn't an annotation
+
+static int parse_line(char* line, int* seqid, int* b, int* e)
+{
+    char* fields[5];
+    int i;
+
+    for (i = 0; i < 5; i++)
+    {
+        if ((fields[i] = next_field(&line)) == NULL)
+        {
+            return 0;
+        }
+    }
+
+    char* read = strstr(fields[0], "read_");
+    char* end;
+
+    *seqid = strtol(read ? read + 5 : fields[0], NULL, 10);
+    *b = strtol(fields[3], &end, 10);
+
+    if (end == fields[3] || *end != '\0')
+    {
+        return 0;
+    }
+
+    *e = strtol(fields[4], &end, 10);
+
+    if (end == fields[4] || *end != '\0')
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * reads the GFF in large blocks and parses the lines where they are. the intervals go into
+ * the bucket of their read, which keeps them apart from the start for sorting in parallel.
+ */
+
+static uint64_t parse_gff(HITS_DB* db, FILE* fileIn, GffBucket* buckets, int nbuckets)
+{
+    int nreads = DB_NREADS(db);
+    char* buffer = malloc(GFF_BUFFER + 1);
+    size_t nbuf = 0;
+    uint64_t lineno = 0;
+    uint64_t nparsed = 0;
+    uint64_t nmalformed = 0;
+    uint64_t nunknown = 0;
+    int eof = 0;
+
+    while (!eof)
+    {
+        size_t n = fread(buffer + nbuf, 1, GFF_BUFFER - nbuf, fileIn);
+
+        if (n == 0)
+        {
+            if (ferror(fileIn))
+            {
+                fprintf(stderr, "failed to read the gff\n");
+                exit(1);
+            }
+
+            eof = 1;
+        }
+
+        nbuf += n;
 
-    if (l == r)
+        char* line = buffer;
+        char* lend = buffer + nbuf;
+
+        while (line < lend)
+        {
+            char* nl = memchr(line, '\n', lend - line);
+
+            if (nl == NULL)
+            {
+                if (!eof)
+                {
+                    break;
+                }
+
+                nl = lend;
+            }
+
+            *nl = '\0';
+            lineno++;
+
+            int seqid, b, e;
+
+            if (*line == '#' || *line == '\0' || *line == '\r')
+            {
+                // comment or empty
+            }
+            else if (!parse_line(line, &seqid, &b, &e))
+            {
+                nmalformed++;
+            }
+            else if (seqid < 0 || seqid >= nreads)
+            {
+                printf("line %" PRIu64 ": sequence %d not in the database\n", lineno, seqid);
+                nunknown++;
+            }
+            else
+            {
+                int rlen = DB_READ_LEN(db, seqid);
+
+                if ( b < 0 || b > rlen || e < b || e > rlen )
+                {
+                    printf("interval out of bounds %d..%d (%d)\n", b, e, rlen);
+                }
+
+                bucket_add(buckets + bucket_of(seqid, nreads, nbuckets), seqid, b, e);
+                nparsed++;
+            }
+
+            line = nl + 1;
+        }
+
+        // move the incomplete last line to the front
+
+        if (line < lend)
+        {
+            nbuf = lend - line;
+
+            if (nbuf == GFF_BUFFER)
+            {
+                fprintf(stderr, "line %" PRIu64 " of the gff is longer than %d bytes\n", lineno + 1, GFF_BUFFER);
+                exit(1);
+            }
+
+            memmove(buffer, line, nbuf);
+        }
+        else
+        {
+            nbuf = 0;
+        }
+    }
+
+    free(buffer);
+
+    if (nmalformed > 0 || nunknown > 0)
     {
-        l = a[1];
-        r = b[1];
+        fprintf(stderr, "skipped %" PRIu64 " malformed lines and %" PRIu64 " of unknown sequences\n", nmalformed, nunknown);
     }
 
-    return l - r;
+    return nparsed;
+}
+
+// sorts the buckets, counts the intervals of their reads and compresses their data
+
+static void* sort_buckets(void* arg)
+{
+    GffSort* gs = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&(gs->lock));
+        int i = gs->next++;
+        pthread_mutex_unlock(&(gs->lock));
+
+        if (i >= gs->nbuckets)
+        {
+            break;
+        }
+
+        GffBucket* bucket = gs->buckets + i;
+        int* ints = bucket->ints;
+        uint64_t nints = bucket->nints;
+
+        qsort(ints, nints / 3, sizeof(int) * 3, cmp_ints);
+
+        // the intervals are packed in place as (begin, end)
+
+        track_data* data = (track_data*)ints;
+        uint64_t k;
+
+        for (k = 0; k < nints; k += 3)
+        {
+            gs->anno[ints[k]] += 2 * sizeof(track_data);
+
+            data[2 * (k / 3) + 0] = ints[k + 1];
+            data[2 * (k / 3) + 1] = ints[k + 2];
+        }
+
+        track_part_compress(gs->parts + i, data, sizeof(track_data) * 2 * (nints / 3));
+
+        free(bucket->ints);
+        bzero(bucket, sizeof(GffBucket));
+    }
+
+    return NULL;
 }
 
 int main(int argc, char* argv[])
 {
     HITS_DB db;
+    int nthreads = DEF_ARG_J;
 
     // process arguments
 
@@ -56,10 +339,14 @@ int main(int argc, char* argv[])
 
     opterr = 0;
 
-    while ((c = getopt(argc, argv, "")) != -1)
+    while ((c = getopt(argc, argv, "j:")) != -1)
     {
         switch (c)
         {
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+
             default:
                 printf("Unknow option: %s\n", argv[optind - 1]);
                 usage();
@@ -73,6 +360,19 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
+    if (nthreads < 1)
+    {
+        fprintf(stderr, "invalid number of threads %d\n", nthreads);
+        exit(1);
+    }
+
+    // the buckets are the unit of parallelism, don't let each of them start a thread per core
+
+    if (nthreads > 1)
+    {
+        compress_set_threads(1);
+    }
+
     char* pathDb = argv[optind++];
     char* pathGff = argv[optind++];
     char* nameTrack = argv[optind++];
@@ -100,96 +400,68 @@ int main(int argc, char* argv[])
         }
     }
 
-    char seq[128];
-    char source[128];
-    char feature[128];
-    int b, e, len;
-    char strand;
-    char dummy[128];
+    int nreads = DB_NREADS(&db);
+    int nbuckets = MAX(1, MIN(GFF_BUCKETS, nreads));
 
-    int* ints = NULL;
-    int nints = 0;
-    int maxints = 0;
+    GffBucket* buckets = calloc(nbuckets, sizeof(GffBucket));
 
-    while ( 1 )
-    {
-        int count = fscanf(fileIn, "%s\t%s\t%s\t%d\t%d\t%d\t%c\t%s\n", seq, source, feature, &b, &e, &len, &strand, dummy);
+    parse_gff(&db, fileIn, buckets, nbuckets);
 
-        if (count != 8)
-        {
-            break;
-        }
-
-        if (nints + 3 >= maxints)
-        {
-            maxints = 1.2 * maxints + 1000;
-            ints = realloc(ints, maxints * sizeof(int));
-        }
+    if (fileIn != stdin)
+    {
+        fclose(fileIn);
+    }
 
-        int seqid = -1;
-        if (strstr(seq, "read_") != NULL)
-        {
-            sscanf(seq, "read_%d", &seqid);
-        }
-        else
-        {
-            seqid = atoi(seq);
-        }
+    // sort the buckets in parallel, each covers its own reads of anno
 
-        ints[nints + 0] = seqid;
-        ints[nints + 1] = b;
-        ints[nints + 2] = e;
+    GffSort gs;
 
-        int rlen = DB_READ_LEN(&db, seqid);
+    gs.db = &db;
+    gs.anno = calloc(nreads + 1, sizeof(track_anno));
+    gs.buckets = buckets;
+    gs.parts = calloc(nbuckets, sizeof(track_part));
+    gs.nbuckets = nbuckets;
+    gs.next = 0;
 
-        if ( b < 0 || b > rlen || e < b || e > rlen )
-        {
-            printf("interval out of bounds %d..%d (%d)\n", b, e, rlen);
-        }
+    pthread_mutex_init(&(gs.lock), NULL);
 
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+    int i;
 
-        nints += 3;
+    for (i = 0; i < nthreads; i++)
+    {
+        pthread_create(threads + i, NULL, sort_buckets, &gs);
     }
 
-    qsort(ints, nints/3, sizeof(int) * 3, cmp_ints);
-
-    track_anno* anno = malloc( sizeof(track_anno) * (DB_NREADS(&db) + 1) );
-    track_data* data = NULL;
-    int ndata = 0;
-    int maxdata = 0;
-
-    bzero(anno, sizeof(track_anno) * (DB_NREADS(&db) + 1));
-
-    int i;
-    for (i = 0; i < nints; i += 3)
+    for (i = 0; i < nthreads; i++)
     {
-        if (ndata + 2 >= maxdata)
-        {
-            maxdata = maxdata * 1.2 + 1000;
-            data = realloc( data, sizeof(track_data) * maxdata );
-        }
-
-        anno[ ints[i + 0] ] += 2 * sizeof(track_data);
-        data[ ndata + 0 ] = ints[ i + 1 ];
-        data[ ndata + 1 ] = ints[ i + 2 ];
-
-        ndata += 2;
+        pthread_join(threads[i], NULL);
     }
 
+    pthread_mutex_destroy(&(gs.lock));
+
+    track_anno* anno = gs.anno;
     track_anno coff, off;
     off = 0;
 
-    for (i = 0; i <= DB_NREADS(&db); i++)
+    for (i = 0; i <= nreads; i++)
     {
         coff = anno[i];
         anno[i] = off;
         off += coff;
     }
 
-    track_write(&db, nameTrack, 0, anno, data, ndata);
+    track_write_parts(&db, nameTrack, 0, anno, gs.parts, nbuckets);
+
+    for (i = 0; i < nbuckets; i++)
+    {
+        track_part_free(gs.parts + i);
+    }
 
+    free(gs.parts);
+    free(buckets);
+    free(threads);
     free(anno);
-    free(data);
 
     Close_DB(&db);
 